@@ -380,6 +380,28 @@ macro(GENERATE_UTILITIES TABLES_PATH)
   set_property(GLOBAL APPEND PROPERTY AMALGAMATE_TARGETS "${TABLE_FILES_UTILITY}")
 endmacro(GENERATE_UTILITIES)
 
+# Generate the compile-time column headers of every table spec. These are
+# written while configuring, so table implementations may include them.
+macro(GENERATE_TABLE_COLUMNS BASE_PATH)
+  GET_GENERATION_DEPS(${BASE_PATH})
+  file(GLOB_RECURSE TABLE_FILES_ALL "${BASE_PATH}/specs/*.table")
+  execute_process(
+    COMMAND "${PYTHON_EXECUTABLE}"
+      "${BASE_PATH}/tools/codegen/gentable.py"
+      "--columns" "${CMAKE_BINARY_DIR}/generated/columns"
+      ${TABLE_FILES_ALL}
+    WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+    RESULT_VARIABLE TABLE_COLUMNS_RESULT
+  )
+  if(NOT TABLE_COLUMNS_RESULT EQUAL 0)
+    message(FATAL_ERROR "Cannot generate table column headers")
+  endif()
+
+  # Configure again when a spec or the generation code changes.
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS
+    ${TABLE_FILES_ALL} ${GENERATION_DEPENDENCIES})
+endmacro(GENERATE_TABLE_COLUMNS)
+
 macro(GENERATE_TABLE TABLE_FILE FOREIGN NAME BASE_PATH OUTPUT)
   GET_GENERATION_DEPS(${BASE_PATH})
   set(TABLE_FILE_GEN "${TABLE_FILE}")
@@ -10,9 +10,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 #include <boost/iterator/filter_iterator.hpp>
@@ -26,6 +29,8 @@
 
 namespace osquery {
 
+struct ResourceUsage;
+
 class Pack;
 class Schedule;
 class ConfigParserPlugin;
@@ -74,16 +79,46 @@ class Config : private boost::noncopyable {
    * to the updates/changes reflected in the schedule, from the config.
    *
    * @param name The unique name of the scheduled item
-   * @param delay Number of seconds (wall time) taken by the query
    * @param size Number of characters generated by query
-   * @param r0 the process row before the query
-   * @param r1 the process row after the query
+   * @param r0 the resource usage before the query
+   * @param r1 the resource usage after the query
    */
   void recordQueryPerformance(const std::string& name,
-                              size_t delay,
                               size_t size,
-                              const Row& r0,
-                              const Row& r1);
+                              const ResourceUsage& r0,
+                              const ResourceUsage& r1);
+
+  /**
+   * @brief Record the table scans a scheduled query shared with others.
+   *
+   * @param name the unique name of the scheduled item
+   * @param hits scans served from another query's results
+   * @param misses scans generated by this query
+   */
+  void recordQuerySharedScans(const std::string& name,
+                              size_t hits,
+                              size_t misses);
+
+  /**
+   * @brief Record an execution served by an identical scheduled query.
+   *
+   * The query was not executed, its results were reused from a query with
+   * the same SQL due in the same step. The execution time is still recorded
+   * so the query's stored results are not purged as stale.
+   *
+   * @param name the unique name of the scheduled item
+   */
+  void recordQueryDeduplicated(const std::string& name);
+
+  /**
+   * @brief Record an execution aborted by the query's time limits.
+   *
+   * The query's results were not logged, and its previous results remain
+   * stored for the next differential.
+   *
+   * @param name the unique name of the scheduled item
+   */
+  void recordQueryAborted(const std::string& name);
 
   /**
    * @brief Record a query 'initialization', meaning the query will run.
@@ -98,6 +133,36 @@ class Config : private boost::noncopyable {
    */
   void recordQueryStart(const std::string& name);
 
+  /**
+   * @brief Stop scheduling a query for a duration.
+   *
+   * The query is added to the schedule's blacklist, which is also used for
+   * queries that caused a worker to fail, and saved in the backing store.
+   *
+   * @param name the unique name of the scheduled item
+   * @param duration number of seconds the query is not scheduled
+   */
+  void blacklistQuery(const std::string& name, size_t duration);
+
+  /**
+   * @brief A counter incremented whenever the schedule may have changed.
+   *
+   * Packs added or removed by an update, purge, or reset, and blacklisted
+   * queries, change the generation. A scheduler may cache a timeline of the
+   * schedule until the generation changes.
+   */
+  size_t getScheduleGeneration() const {
+    return schedule_generation_;
+  }
+
+  /**
+   * @brief Set a function called after the schedule generation changes.
+   *
+   * The observer is called while the schedule is locked, it must not call
+   * back into the config. Pass an empty function to remove the observer.
+   */
+  void setScheduleObserver(std::function<void()> observer);
+
   /**
    * @brief Calculate the hash of the osquery config
    *
@@ -243,7 +308,13 @@ class Config : private boost::noncopyable {
    */
   Status load();
 
-  /// A step method for Config::update.
+  /**
+   * @brief A step method for Config::update.
+   *
+   * Content equal to the last content applied for the source is not parsed
+   * again. Otherwise only packs and top-level parser keys with changed
+   * content are rebuilt and reapplied, unchanged packs keep their state.
+   */
   Status updateSource(const std::string& source, const std::string& json);
 
   /**
@@ -314,6 +385,21 @@ class Config : private boost::noncopyable {
   /// A set of hashes for each source of the config.
   std::map<std::string, std::string> hash_;
 
+  /// The hash of the content last applied without an error, by source.
+  std::map<std::string, std::string> applied_hash_;
+
+  /// The content hash of each pack added by an update, by source and name.
+  std::map<std::string, std::map<std::string, std::string>> pack_hashes_;
+
+  /// Packs added or kept by the source updates in progress.
+  std::map<std::string, std::set<std::string>> updated_packs_;
+
+  /// The hash of the keys applied to each parser, by source and parser.
+  std::map<std::string, std::map<std::string, std::string>> parser_hashes_;
+
+  /// The config hash of the saved snapshot.
+  std::string snapshot_hash_;
+
   /// Check if the config received valid/parsable content from a config plugin.
   bool valid_{false};
 
@@ -326,12 +412,49 @@ class Config : private boost::noncopyable {
   /// A UNIX timestamp recorded when the config started.
   size_t start_time_{0};
 
+  /// Incremented by scheduleChanged, see getScheduleGeneration.
+  std::atomic<size_t> schedule_generation_{0};
+
+  /// Called by scheduleChanged, see setScheduleObserver.
+  std::function<void()> schedule_observer_;
+
+ private:
+  /// Increment the schedule generation and notify the observer.
+  void scheduleChanged();
+
+  /// Save the config plugin's content as the last good config.
+  void saveSnapshot(const std::map<std::string, std::string>& config);
+
+  /// Update from the last good config, see --config_fast_start.
+  Status loadSnapshot();
+
+  /**
+   * @brief Check, during a source update, if a pack's content changed.
+   *
+   * The pack is recorded as part of the update either way. A pack missing
+   * from the schedule is considered changed.
+   *
+   * @param name the pack name
+   * @param source the config source updating the pack
+   * @param hash the hash of the pack content
+   * @return true if the pack must be added again
+   */
+  bool packChanged(const std::string& name,
+                   const std::string& source,
+                   const std::string& hash);
+
+  /// Add a pack for a source update, unless its content is unchanged.
+  void updatePack(const std::string& name,
+                  const std::string& source,
+                  const boost::property_tree::ptree& tree);
+
  private:
   friend class Initializer;
 
  private:
   friend class ConfigTests;
   friend class ConfigRefreshRunner;
+  friend class ConfigLoadRunner;
   friend class FilePathsConfigParserPluginTests;
   friend class FileEventsTableTests;
   friend class DecoratorsConfigParserPluginTests;
@@ -340,6 +463,8 @@ class Config : private boost::noncopyable {
   FRIEND_TEST(EventsConfigParserPluginTests, test_get_event);
   FRIEND_TEST(PacksTests, test_discovery_cache);
   FRIEND_TEST(PacksTests, test_multi_pack);
+  FRIEND_TEST(ConfigTests, test_incremental_update);
+  FRIEND_TEST(ConfigTests, test_config_snapshot);
   FRIEND_TEST(SchedulerTests, test_monitor);
   FRIEND_TEST(SchedulerTests, test_config_results_purge);
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
@@ -527,10 +652,24 @@ class ConfigParserPlugin : public Plugin {
   friend class Config;
 };
 
-// A thread that periodically reloads configuration state
-class ConfigRefreshRunner : public InternalRunnable {
+/// A periodic service that reloads configuration state.
+class ConfigRefreshRunner : public PeriodicRunnable {
+ public:
+  bool run() override;
+
+  /// The config was read at t=0, the first refresh is after an interval.
+  std::chrono::milliseconds interval() override;
+
+  /// Config plugins may read from the network.
+  bool blocking() override {
+    return true;
+  }
+};
+
+/// A service reading the config plugin after starting from a snapshot.
+class ConfigLoadRunner : public InternalRunnable {
  public:
-  /// A simple wait/interruptible lock.
+  /// Refresh the config once, the snapshot is kept if the refresh fails.
   void start();
 };
 
@@ -50,6 +50,14 @@ extern const std::string kQueries;
 /// The "domain" where event results are stored, queued for querytime retrieval.
 extern const std::string kEvents;
 
+/**
+ * @brief Check if a domain holds event results.
+ *
+ * This is kEvents, or a domain created for a single event subscriber, which
+ * is named kEvents followed by a '.' and the subscriber's namespace.
+ */
+bool isEventsDomain(const std::string& domain);
+
 /**
  * @brief The "domain" where buffered log results are stored.
  *
@@ -59,6 +67,32 @@ extern const std::string kEvents;
  */
 extern const std::string kLogs;
 
+/**
+ * @brief The "domain" where file content hashes are cached.
+ *
+ * Hashes are keyed by the file device and inode and are valid while the
+ * file size, modification, and change times are unchanged.
+ */
+extern const std::string kHashes;
+
+/**
+ * @brief The "domain" where scheduled query rows are stored by fingerprint.
+ *
+ * A query's rows are keyed by its name and the fingerprint, the results in
+ * the queries domain list the fingerprints. The rows are kept apart so their
+ * keys never collide with query names.
+ */
+extern const std::string kQueryRows;
+
+/**
+ * @brief The "domain" where YARA scan results are cached.
+ *
+ * Results are keyed by the file device and inode and the signature group.
+ * They are valid while the file is unchanged and the group's rules are the
+ * rules the file was scanned with.
+ */
+extern const std::string kYARAScans;
+
 /**
  * @brief A variant type for the SQLite type affinities.
  */
@@ -119,6 +153,31 @@ Status deserializeRow(const boost::property_tree::ptree& tree, Row& r);
  */
 Status deserializeRowJSON(const std::string& json, Row& r);
 
+/**
+ * @brief Serialize a Row object into a compact binary string
+ *
+ * The binary encoding is used for internal storage, such as event data. Each
+ * column name and value is length-prefixed. Use JSON for logger output.
+ *
+ * @param r the Row to serialize
+ * @param data the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeRowBinary(const Row& r, std::string& data);
+
+/**
+ * @brief Deserialize a Row object from a binary string
+ *
+ * Content stored as JSON by previous versions is also accepted.
+ *
+ * @param data the input binary or JSON string
+ * @param r the output Row structure
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status deserializeRowBinary(const std::string& data, Row& r);
+
 /**
  * @brief The result set returned from a osquery SQL query
  *
@@ -168,6 +227,23 @@ Status deserializeQueryData(const boost::property_tree::ptree& tree,
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/**
+ * @brief Serialize a QueryData object into a compact binary string
+ *
+ * Column names are written once, as a dictionary, and each row refers to
+ * columns by their dictionary index. This is used for internal storage of
+ * query results.
+ *
+ * @param q the QueryData to serialize
+ * @param data the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataBinary(const QueryData& q, std::string& data);
+
+/// Inverse of serializeQueryDataBinary, also accepts JSON content.
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd);
+
 /**
  * @brief Data structure representing the difference between the results of
  * two queries
@@ -228,6 +304,28 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
  */
 DiffResults diff(const QueryData& old_, const QueryData& new_);
 
+/**
+ * @brief Compute a stable fingerprint of a row's columns and values.
+ *
+ * The fingerprint does not depend on the process, rows with equal columns and
+ * values always have equal fingerprints.
+ *
+ * @param r the row to fingerprint.
+ * @return a 64-bit FNV-1a hash over the ordered column and value pairs.
+ */
+uint64_t rowFingerprint(const Row& r);
+
+/**
+ * @brief Compute a stable fingerprint of a set of rows.
+ *
+ * The fingerprint does not depend on the order of rows, so the same results
+ * returned in a different order have equal fingerprints.
+ *
+ * @param qd the rows to fingerprint.
+ * @return a 64-bit FNV-1a hash over the sorted row fingerprints.
+ */
+uint64_t resultsFingerprint(const QueryData& qd);
+
 /**
  * @brief Add a Row to a QueryData if the Row hasn't appeared in the QueryData
  * already
@@ -268,21 +366,45 @@ struct QueryPerformance {
   /// Last UNIX time in seconds the query was executed successfully.
   size_t last_executed;
 
-  /// Total wall time taken
+  /// Total wall time taken in milliseconds.
   unsigned long long int wall_time;
 
-  /// Total user time (cycles)
+  /// Total user time in milliseconds.
   unsigned long long int user_time;
 
-  /// Total system time (cycles)
+  /// Total system time in milliseconds.
   unsigned long long int system_time;
 
-  /// Average memory differentials. This should be near 0.
+  /// Average heap allocation differentials. This should be near 0.
   unsigned long long int average_memory;
 
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size;
 
+  /// Table scans served by another query within the same schedule tick.
+  unsigned long long int shared_hits;
+
+  /// Table scans generated and made available to other queries.
+  unsigned long long int shared_misses;
+
+  /// Executions served by an identical query due in the same schedule step.
+  size_t deduplicated;
+
+  /// Consecutive executions that exceeded the schedule's time budgets.
+  size_t overruns;
+
+  /// Executions aborted by the query's wall or CPU time limit.
+  size_t aborted;
+
+  /// Total context switches and major page faults while executing.
+  unsigned long long int context_switches;
+  unsigned long long int major_faults;
+
+  /// Total hardware counters, see --schedule_perf_counters.
+  unsigned long long int cycles;
+  unsigned long long int instructions;
+  unsigned long long int cache_misses;
+
   QueryPerformance()
       : executions(0),
         last_executed(0),
@@ -290,7 +412,17 @@ struct QueryPerformance {
         user_time(0),
         system_time(0),
         average_memory(0),
-        output_size(0) {}
+        output_size(0),
+        shared_hits(0),
+        shared_misses(0),
+        deduplicated(0),
+        overruns(0),
+        aborted(0),
+        context_switches(0),
+        major_faults(0),
+        cycles(0),
+        instructions(0),
+        cache_misses(0) {}
 };
 
 /**
@@ -312,7 +444,14 @@ struct ScheduledQuery {
   /// Set of query options.
   std::map<std::string, bool> options;
 
-  ScheduledQuery() : interval(0), splayed_interval(0) {}
+  /// Milliseconds of wall time before an execution is aborted, 0 for default.
+  size_t wall_limit;
+
+  /// Milliseconds of CPU time before an execution is aborted, 0 for default.
+  size_t cpu_limit;
+
+  ScheduledQuery()
+      : interval(0), splayed_interval(0), wall_limit(0), cpu_limit(0) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
@@ -339,6 +478,12 @@ struct QueryLogItem {
   /// Optional snapshot results, no differential applied.
   QueryData snapshot_results;
 
+  /// The fingerprint of an incremental snapshot's results.
+  std::string snapshot_fingerprint;
+
+  /// An incremental snapshot matched the last snapshot logged in full.
+  bool snapshot_unchanged{false};
+
   /// The name of the scheduled query.
   std::string name;
 
@@ -386,6 +531,38 @@ Status serializeQueryLogItem(const QueryLogItem& item,
  */
 Status serializeQueryLogItemJSON(const QueryLogItem& item, std::string& json);
 
+/**
+ * @brief Check if results are serialized with the columnar encoding.
+ *
+ * With --result_encoding=columnar, or with --result_encoding=enroll if the
+ * enroll endpoint chose it, serializeQueryLogItemJSON and distributed
+ * results write each result's column names once, in a "columns" list, and
+ * each row as a list of values in the order of the columns. A missing value
+ * is written as an empty string.
+ */
+bool useColumnarResults();
+
+/**
+ * @brief Keep the result encoding chosen by an enroll endpoint.
+ *
+ * The choice is kept in the persistent settings, with the node key.
+ *
+ * @param encoding "columnar" or "rows", any other value is "rows"
+ */
+Status setEnrolledResultEncoding(const std::string& encoding);
+
+/**
+ * @brief Append the columns of rows not already in a list of columns.
+ *
+ * Columns are added in the order they are first seen.
+ */
+void getQueryDataColumns(const QueryData& q, ColumnNames& columns);
+
+/// Append the values of a row as a JSON list, in the order of the columns.
+void writeColumnarRowJSON(const Row& r,
+                          const ColumnNames& columns,
+                          std::string& json);
+
 /// Inverse of serializeQueryLogItem, convert property tree to QueryLogItem.
 Status deserializeQueryLogItem(const boost::property_tree::ptree& tree,
                                QueryLogItem& item);
@@ -417,6 +594,10 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items);
 
+/// A list of key and value pairs written to a single domain.
+using DatabaseStringValueList =
+    std::vector<std::pair<std::string, std::string>>;
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -449,6 +630,23 @@ class DatabasePlugin : public Plugin {
                      const std::string& key,
                      std::string& value) const = 0;
 
+  /**
+   * @brief Perform a lookup of several keys within a single domain.
+   *
+   * The default implementation calls get for each key. Plugins should
+   * override this method to read every key with a single call.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The list of lookup/retrieval keys.
+   * @param values The output list, with a value for each key. The value is
+   * left empty if the key does not exist.
+   * @return Failure if the data could not be accessed. Missing keys are not
+   * considered a failure.
+   */
+  virtual Status getBatch(const std::string& domain,
+                          const std::vector<std::string>& keys,
+                          std::vector<std::string>& values) const;
+
   /**
    * @brief Store a string-represented value using a domain and key index.
    *
@@ -464,6 +662,19 @@ class DatabasePlugin : public Plugin {
                      const std::string& key,
                      const std::string& value) = 0;
 
+  /**
+   * @brief Store a list of key and value pairs using a single domain.
+   *
+   * The default implementation calls put for each pair. Plugins should
+   * override this method to commit the list as a single, atomic, write.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param data The list of key and value pairs.
+   * @return Failure if any of the data could not be stored.
+   */
+  virtual Status putBatch(const std::string& domain,
+                          const DatabaseStringValueList& data);
+
   /// Data removal method.
   virtual Status remove(const std::string& domain, const std::string& k) = 0;
 
@@ -479,6 +690,51 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /**
+   * @brief Report backing-store specific properties and statistics.
+   *
+   * A domain's properties describe its storage, such as estimated key counts
+   * and sizes. An empty domain requests statistics for the entire store.
+   *
+   * @param domain A database domain, or empty for store-wide statistics.
+   * @param props The output map of property names to values.
+   * @return Failure if the domain is unknown or the store is not open.
+   */
+  virtual Status properties(const std::string& domain,
+                            std::map<std::string, std::string>& props) const {
+    return Status(0, "Not used");
+  }
+
+  /**
+   * @brief Release memory held by the backing store without closing it.
+   *
+   * Unlike #reset, a trim must not block concurrent reads and writes. Plugins
+   * without support return a failure and callers may fall back to #reset.
+   */
+  virtual Status trim() {
+    return Status(1, "Not supported");
+  }
+
+  /// Bytes held in memory by write buffers and caches, 0 if unknown.
+  virtual size_t getMemoryUsage() const {
+    return 0;
+  }
+
+  /**
+   * @brief Create a domain that is not one of kDomains, if it does not exist.
+   *
+   * A created domain persists until it is dropped. Plugins without support
+   * return a failure and callers should keep their keys in one of kDomains.
+   */
+  virtual Status createDomain(const std::string& domain) {
+    return Status(1, "Not supported");
+  }
+
+  /// Remove a created domain and every key within it.
+  virtual Status dropDomain(const std::string& domain) {
+    return Status(1, "Not supported");
+  }
+
   /**
    * @brief Shutdown the database and release initialization resources.
    *
@@ -564,6 +820,21 @@ Status getDatabaseValue(const std::string& domain,
                         const std::string& key,
                         std::string& value);
 
+/**
+ * @brief Lookup several values within a domain of the active DatabasePlugin.
+ *
+ * See DatabasePlugin::getBatch for discussion around missing keys. This
+ * should be used when several keys are read at once, such as event rows.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param keys The list of lookup/retrieval keys.
+ * @param values The output list, with a (possibly empty) value for each key.
+ * @return Storage operation status.
+ */
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values);
+
 /**
  * @brief Set or put a value into the active osquery DatabasePlugin storage.
  *
@@ -580,6 +851,19 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value);
 
+/**
+ * @brief Set or put a list of values into the active DatabasePlugin storage.
+ *
+ * See DatabasePlugin::putBatch for discussion around atomicity. This should
+ * be used when several keys are written at once, such as buffered events.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param data The list of key and value pairs.
+ * @return Storage operation status.
+ */
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseStringValueList& data);
+
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
@@ -599,9 +883,100 @@ Status scanDatabaseKeys(const std::string& domain,
                         const std::string& prefix,
                         size_t max = 0);
 
+/// Create a domain in the active DatabasePlugin, see
+/// DatabasePlugin::createDomain.
+Status createDatabaseDomain(const std::string& domain);
+
+/// Remove a created domain and its keys from the active DatabasePlugin.
+Status dropDatabaseDomain(const std::string& domain);
+
+/// Get the active DatabasePlugin's properties for a domain, see
+/// DatabasePlugin::properties.
+Status getDatabaseProperties(const std::string& domain,
+                             std::map<std::string, std::string>& props);
+
+/**
+ * @brief A domain-bound accessor for the active DatabasePlugin storage.
+ *
+ * Subsystems that access a single domain repeatedly, such as event
+ * subscribers or buffered loggers, may keep a handle instead of passing the
+ * domain to each of the free database functions. The active plugin is
+ * resolved once for each change of the database registry's active plugin.
+ */
+class DatabaseHandle {
+ public:
+  explicit DatabaseHandle(std::string domain) : domain_(std::move(domain)) {}
+
+  /// See getDatabaseValue.
+  Status get(const std::string& key, std::string& value) const {
+    return getDatabaseValue(domain_, key, value);
+  }
+
+  /// See getDatabaseValues.
+  Status get(const std::vector<std::string>& keys,
+             std::vector<std::string>& values) const {
+    return getDatabaseValues(domain_, keys, values);
+  }
+
+  /// See setDatabaseValue.
+  Status put(const std::string& key, const std::string& value) const {
+    return setDatabaseValue(domain_, key, value);
+  }
+
+  /// See setDatabaseBatch.
+  Status put(const DatabaseStringValueList& data) const {
+    return setDatabaseBatch(domain_, data);
+  }
+
+  /// See deleteDatabaseValue.
+  Status remove(const std::string& key) const {
+    return deleteDatabaseValue(domain_, key);
+  }
+
+  /// See deleteDatabaseRange.
+  Status remove(const std::string& low, const std::string& high) const {
+    return deleteDatabaseRange(domain_, low, high);
+  }
+
+  /// See scanDatabaseKeys.
+  Status scan(std::vector<std::string>& keys,
+              const std::string& prefix = "",
+              size_t max = 0) const {
+    return scanDatabaseKeys(domain_, keys, prefix, max);
+  }
+
+  /// The domain this handle accesses.
+  const std::string& domain() const {
+    return domain_;
+  }
+
+ private:
+  std::string domain_;
+};
+
+/**
+ * @brief Compute the exclusive upper bound of keys starting with a prefix.
+ *
+ * Database plugins use this to bound a prefix scan to a key range.
+ *
+ * @return false if there is no bound, such as for an empty prefix.
+ */
+bool getPrefixUpperBound(const std::string& prefix, std::string& upper);
+
 /// Allow callers to reload or reset the database plugin.
 void resetDatabase();
 
+/**
+ * @brief Release database plugin memory while it remains usable.
+ *
+ * This uses DatabasePlugin::trim and falls back to resetDatabase if the
+ * active plugin cannot trim.
+ */
+void trimDatabase();
+
+/// Bytes held in memory by the active database plugin, see #trimDatabase.
+size_t getDatabaseMemoryUsage();
+
 /// Allow callers to scan each column family and print each value.
 void dumpDatabase();
 }
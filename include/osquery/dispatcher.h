@@ -13,7 +13,10 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -159,6 +162,38 @@ class InternalRunnable : private boost::noncopyable,
 using InternalRunnableRef = std::shared_ptr<InternalRunnable>;
 using InternalThreadRef = std::shared_ptr<std::thread>;
 
+/**
+ * @brief A service that runs on an interval without a thread of its own.
+ *
+ * The Dispatcher keeps periodic services in a timer wheel and runs each one
+ * on the timer's thread when it is due, not on the TaskExecutor workers used
+ * by queries. A service is never run again before its previous run returns.
+ * Services that block waiting for events, such as publisher loops, remain
+ * InternalRunnable services.
+ */
+class PeriodicRunnable : private boost::noncopyable {
+ public:
+  virtual ~PeriodicRunnable() {}
+
+  /// Run the service once, return false to stop running it.
+  virtual bool run() = 0;
+
+  /// The delay until the next run, read before the first and after each run.
+  virtual std::chrono::milliseconds interval() = 0;
+
+  /**
+   * @brief A run may block, such as waiting for a network request.
+   *
+   * Blocking services are run in turn on a second timer thread such that
+   * they do not delay the other services.
+   */
+  virtual bool blocking() {
+    return false;
+  }
+};
+
+using PeriodicRunnableRef = std::shared_ptr<PeriodicRunnable>;
+
 /**
  * @brief Singleton for queuing asynchronous tasks to be executed in parallel
  *
@@ -183,6 +218,18 @@ class Dispatcher : private boost::noncopyable {
   /// See `add`, but services are not limited to a thread poll size.
   static Status addService(InternalRunnableRef service);
 
+  /**
+   * @brief Run a service periodically on the timer's thread.
+   *
+   * The first run is after the service's interval. The services are stopped
+   * with stopServices, and joinServices waits for them like other services.
+   */
+  static Status addPeriodicService(PeriodicRunnableRef service);
+
+  /// See addPeriodicService, with the delay of the first run.
+  static Status addPeriodicService(PeriodicRunnableRef service,
+                                   std::chrono::milliseconds delay);
+
   /// See `join`, but applied to osquery services.
   static void joinServices();
 
@@ -245,4 +292,150 @@ class Dispatcher : private boost::noncopyable {
   friend class ExtensionsTests;
   friend class DispatcherTests;
 };
+
+/// The order in which queued tasks are run by the shared executor.
+enum class TaskPriority {
+  /// Background work, run when no other task is queued.
+  LOW = 0,
+
+  /// Queries, such as scheduled and distributed queries.
+  NORMAL = 1,
+
+  /// Parts of a query or table scan that a thread is waiting for.
+  HIGH = 2,
+
+  /// Queries a user is waiting for, such as distributed queries.
+  INTERACTIVE = 3,
+};
+
+/**
+ * @brief A set of tasks run by the shared executor.
+ *
+ * Tasks are added with run and the group is waited for before it is
+ * destroyed. A thread waiting for a group runs the group's queued tasks, so
+ * parallel work done within a task never waits for a worker to become
+ * available. Tasks of other groups are never run by a waiting thread.
+ *
+ * @code{.cpp}
+ *   TaskGroup group(TaskPriority::HIGH);
+ *   for (size_t i = 1; i < threads; i++) {
+ *     group.run(worker);
+ *   }
+ *   worker();
+ *   group.wait();
+ * @endcode
+ */
+class TaskGroup : private boost::noncopyable {
+ public:
+  explicit TaskGroup(TaskPriority priority = TaskPriority::NORMAL);
+
+  /// Wait for every task of the group.
+  ~TaskGroup();
+
+  /// Queue a task for the shared executor.
+  void run(std::function<void()> task);
+
+  /// Wait until every task of the group ran or was cancelled.
+  void wait();
+
+  /// Skip the group's queued tasks and end the pauses of running tasks.
+  void cancel();
+
+  /// Check if the group was cancelled, long running tasks should return.
+  bool cancelled() const;
+
+  /// Put a task into a sleep that ends early if the group is cancelled.
+  void pause(std::chrono::milliseconds milli);
+
+  /// The state shared by the group and its queued tasks.
+  struct State;
+
+ private:
+  std::shared_ptr<State> state_;
+
+  TaskPriority priority_;
+};
+
+/**
+ * @brief A process-wide pool of work-stealing worker threads.
+ *
+ * Features that run work in parallel queue tasks with a TaskGroup instead of
+ * starting threads, such that the number of busy threads is bounded by
+ * --worker_threads. Each worker has a queue of the HIGH priority tasks it
+ * queued, which it runs newest first and other workers steal oldest first.
+ * Tasks queued by other threads are run by priority, then oldest first.
+ *
+ * One more worker is reserved for INTERACTIVE tasks, and the HIGH priority
+ * tasks they queue, so they start while every other worker is busy.
+ */
+class TaskExecutor : private boost::noncopyable {
+ public:
+  /// The executor, its workers are started when the first task is queued.
+  static TaskExecutor& instance() {
+    static TaskExecutor instance;
+    return instance;
+  }
+
+  /// The number of worker threads, not including the reserved worker.
+  size_t workerCount();
+
+ private:
+  TaskExecutor() {}
+  ~TaskExecutor();
+
+  struct Task {
+    std::shared_ptr<TaskGroup::State> group{nullptr};
+    std::function<void()> function;
+    TaskPriority priority{TaskPriority::NORMAL};
+  };
+
+  struct TaskQueue {
+    std::deque<Task> tasks;
+    std::mutex mutex;
+  };
+
+  /// Start the workers once.
+  void start();
+
+  /// Queue a task of a group.
+  void submit(Task task);
+
+  /// Take the next task of at least a priority, false if none are queued.
+  bool take(Task& task, TaskPriority priority);
+
+  /// Take the next queued task of a group, false if none are queued.
+  bool take(Task& task, const std::shared_ptr<TaskGroup::State>& group);
+
+  /// Run a task unless its group was cancelled, then complete it.
+  void execute(Task& task);
+
+  /// A worker's entrypoint.
+  void work(size_t index);
+
+ private:
+  std::vector<std::thread> threads_;
+
+  /// Tasks queued by each worker.
+  std::vector<std::unique_ptr<TaskQueue>> local_;
+
+  /// Tasks queued by other threads, for each priority.
+  TaskQueue global_[4];
+
+  /// The number of queued tasks.
+  std::atomic<size_t> queued_{0};
+
+  /// The number of queued INTERACTIVE tasks.
+  std::atomic<size_t> interactive_{0};
+
+  std::once_flag started_;
+  bool stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable ready_;
+
+  /// Wakes the reserved worker, notified for INTERACTIVE tasks.
+  std::condition_variable reserved_ready_;
+
+ private:
+  friend class TaskGroup;
+};
 }
@@ -10,9 +10,19 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+
 #include <osquery/database.h>
 #include <osquery/registry.h>
 #include <osquery/status.h>
@@ -82,15 +92,24 @@ struct DistributedQueryResult {
  public:
   DistributedQueryResult() {}
   DistributedQueryResult(const DistributedQueryRequest& req,
-                         const QueryData& res,
-                         const ColumnNames& cols,
+                         QueryData res,
+                         ColumnNames cols,
                          const Status& s)
-      : request(req), results(res), columns(cols), status(s) {}
+      : request(req),
+        results(std::move(res)),
+        columns(std::move(cols)),
+        status(s) {}
 
   DistributedQueryRequest request;
   QueryData results;
   ColumnNames columns;
   Status status;
+
+  /// Set if the results were served from the distributed result cache.
+  bool cached{false};
+
+  /// The seconds since a cached result was executed.
+  size_t cache_age{0};
 };
 
 /**
@@ -158,6 +177,21 @@ class DistributedPlugin : public Plugin {
    */
   virtual Status getQueries(std::string& json) = 0;
 
+  /**
+   * @brief Get the queries to be executed, waiting for the server to have work
+   *
+   * A plugin supporting long-polling asks the server to hold the request
+   * until there are queries, or the wait expires. By default this is
+   * getQueries and returns immediately.
+   *
+   * @param json is the string to populate the queries data structure with
+   * @param wait is the most seconds the server may hold the request
+   * @return a Status indicating the success or failure of the operation
+   */
+  virtual Status waitForQueries(std::string& json, size_t wait) {
+    return getQueries(json);
+  }
+
   /**
    * @brief Write the results that were executed
    *
@@ -201,7 +235,7 @@ class DistributedPlugin : public Plugin {
  * Consider the following workflow example, without any error handling
  *
  * @code{.cpp}
- *   auto dist = Distributed();
+ *   Distributed dist;
  *   while (true) {
  *     dist.pullUpdates();
  *     if (dist.getPendingQueryCount() > 0) {
@@ -209,14 +243,22 @@ class DistributedPlugin : public Plugin {
  *     }
  *   }
  * @endcode
+ *
+ * Up to distributed_workers queries run on the shared TaskExecutor and each
+ * result is flushed to the server as soon as it completes.
  */
-class Distributed {
+class Distributed : private boost::noncopyable {
  public:
   /// Default constructor
   Distributed() {}
 
-  /// Retrieve queued queries from a remote server
-  Status pullUpdates();
+  /**
+   * @brief Retrieve queued queries from a remote server
+   *
+   * @param wait if set, the seconds the server may hold the request open
+   * until it has queries, see DistributedPlugin::waitForQueries
+   */
+  Status pullUpdates(size_t wait = 0);
 
   /// Get the number of queries which are waiting to be executed
   size_t getPendingQueryCount();
@@ -227,9 +269,24 @@ class Distributed {
   /// Serialize result data into a JSON string and clear the results
   Status serializeResults(std::string& json);
 
-  /// Process and execute queued queries
+  /**
+   * @brief Process and execute queued queries
+   *
+   * Returns once every query, including queries accepted from check-ins
+   * while others were running, has completed.
+   */
   Status runQueries();
 
+  /**
+   * @brief Cancel a pending or running query.
+   *
+   * A pending query is not run, a running query is interrupted. Either way
+   * the query's result reports a failed status.
+   *
+   * @param id the distributed query ID
+   */
+  Status cancelQuery(const std::string& id);
+
  protected:
   /**
    * @brief Process several queries from a distributed plugin
@@ -254,18 +311,90 @@ class Distributed {
    *
    * @param result is a DistributedQueryResult object to be sent to the server
    */
-  void addResult(const DistributedQueryResult& result);
+  void addResult(DistributedQueryResult result);
 
   /**
    * @brief Flush all of the collected results to the server
    */
   Status flushCompleted();
 
+  /// Execute a request on a worker thread and queue its result.
+  void runQuery(DistributedQueryRequest request,
+                std::shared_ptr<std::atomic<bool>> cancel);
+
+  /**
+   * @brief Find an unexpired cached result for a normalized query.
+   *
+   * The caller must hold results_mutex_.
+   *
+   * @param key the normalized query text
+   * @param result populated with the cached rows, columns, and age
+   * @return true if the cache had a result
+   */
+  bool getCachedResult(const std::string& key, DistributedQueryResult& result);
+
+  /// Cache a successful result, the caller must hold results_mutex_.
+  void setCachedResult(const std::string& key,
+                       const DistributedQueryResult& result);
+
+  /**
+   * @brief Serialize a set of results into distributed write JSON chunks.
+   *
+   * Rows are written directly as JSON. If max_bytes is set, a body is
+   * emitted whenever it reaches max_bytes, and the rows of a large result
+   * continue in the next body. Every body includes a "continuation" token,
+   * its "chunk" index, and whether it is "final". A result's status is
+   * written in the body holding its last rows.
+   *
+   * With the columnar encoding, see useColumnarResults, each result is an
+   * object of its "columns" and "rows", and every body includes its
+   * "encoding". The columns are repeated in each body holding its rows.
+   *
+   * @param results the results to serialize
+   * @param max_bytes the size of each body, 0 writes a single body
+   * @param write called with each body, a failure stops serialization
+   */
+  static Status serializeResults(
+      const std::vector<DistributedQueryResult>& results,
+      size_t max_bytes,
+      const std::function<Status(const std::string& json)>& write);
+
  protected:
   std::vector<DistributedQueryResult> results_;
 
+  /// Queries running on worker threads and their cancel flags.
+  std::map<std::string, std::shared_ptr<std::atomic<bool>>> running_;
+
+  /// The number of queries completed by workers.
+  size_t completions_{0};
+
+  /// Protect the results and running queries, and signal completions.
+  std::mutex results_mutex_;
+  std::condition_variable completed_;
+
+  /// A result cached for identical queries, see --distributed_cache_ttl.
+  struct CachedResult {
+    std::chrono::steady_clock::time_point executed;
+    QueryData results;
+    ColumnNames columns;
+  };
+
+  /// Cached results keyed by normalized query text.
+  std::map<std::string, CachedResult> cache_;
+
+  /// Normalized queries being executed, identical queries wait for them.
+  std::set<std::string> executing_;
+
+  /// IDs of pending queries the server asked to run without the cache.
+  std::set<std::string> no_cache_;
+
  private:
   friend class DistributedTests;
   FRIEND_TEST(DistributedTests, test_workflow);
+  FRIEND_TEST(DistributedTests, test_cancel_pending);
+  FRIEND_TEST(DistributedTests, test_accept_work_errors);
+  FRIEND_TEST(DistributedTests, test_serialize_results_chunks);
+  FRIEND_TEST(DistributedTests, test_serialize_results_columnar);
+  FRIEND_TEST(DistributedTests, test_result_cache);
 };
 }
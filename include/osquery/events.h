@@ -11,11 +11,13 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <osquery/core.h>
@@ -32,6 +34,11 @@ class EventPublisher;
 template <class PUB>
 class EventSubscriber;
 class EventFactory;
+class EventQueueRunner;
+class EventForwardRunner;
+class LoggerPlugin;
+template <typename T>
+class BoundedQueue;
 
 using EventPublisherID = const std::string;
 using EventSubscriberID = const std::string;
@@ -126,6 +133,29 @@ struct SubscriberExpirationDetails {
 
   /// The number of queries that should run between intervals.
   size_t query_count{0};
+
+  /// The names of the scheduled queries selecting from the subscriber.
+  std::set<std::string> queries;
+};
+
+/**
+ * @brief A subscriber's aggregation, from the "events" config "aggregate" key.
+ *
+ * An aggregating subscriber stores one row per key and time bucket instead of
+ * a row per event. The row has the key columns, the minimum or maximum value
+ * of each min and max column, the bucket start time, and the event count in
+ * its "sampling" column.
+ */
+struct EventAggregation {
+  /// Columns whose values form the aggregation key.
+  std::vector<std::string> columns;
+
+  /// Numeric columns keeping the minimum and maximum value in each bucket.
+  std::vector<std::string> min;
+  std::vector<std::string> max;
+
+  /// The bucket size in seconds.
+  size_t interval{60};
 };
 
 /**
@@ -291,6 +321,13 @@ class EventPublisherPlugin : public Plugin,
   /// Remove all subscriptions from a named subscriber.
   virtual void removeSubscriptions(const std::string& subscriber);
 
+ private:
+  /// Resolve each subscription's EventSubscriber into a new snapshot.
+  void updateTargets();
+
+  /// Rebuild the snapshot after EventSubscriber%s are added or removed.
+  void refreshTargets();
+
  public:
   /// Overriding the EventPublisher constructor is not recommended.
   EventPublisherPlugin() {}
@@ -316,6 +353,11 @@ class EventPublisherPlugin : public Plugin,
     return next_ec_id_;
   }
 
+  /// The number of events dropped because the event queue was full.
+  size_t numDropped() const {
+    return dropped_events_;
+  }
+
   /// Check if the EventFactory is ending all publisher threads.
   bool isEnding() const {
     return ending_;
@@ -341,6 +383,18 @@ class EventPublisherPlugin : public Plugin,
     return restart_count_;
   }
 
+  /// Get the CPU placement and scheduling applied to the publisher thread.
+  std::string placement() const {
+    ReadLock lock(placement_lock_);
+    return placement_;
+  }
+
+  /// Set the description of the publisher thread placement.
+  void placement(const std::string& placement) {
+    WriteLock lock(placement_lock_);
+    placement_ = placement;
+  }
+
  public:
   explicit EventPublisherPlugin(EventPublisherPlugin const&) = delete;
   EventPublisherPlugin& operator=(EventPublisherPlugin const&) = delete;
@@ -361,9 +415,25 @@ class EventPublisherPlugin : public Plugin,
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /// Count events the publisher's own event source dropped.
+  void addDropped(size_t count) {
+    dropped_events_ += count;
+  }
+
+ private:
+  /// Call each running subscriber's callback for a fired event.
+  void dispatch(const EventContextRef& ec);
+
+ protected:
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
+  /// A Subscription and its resolved EventSubscriber, used by `fire`.
+  using SubscriptionTarget = std::pair<SubscriptionRef, EventSubscriberRef>;
+
+  /// An immutable set of subscription targets, replaced when changed.
+  using SubscriptionTargets = std::vector<SubscriptionTarget>;
+
   /// An Event ID is assigned by the EventPublisher within the EventContext.
   /// This is not used to store event date in the backing store.
   std::atomic<EventContextID> next_ec_id_{0};
@@ -375,22 +445,55 @@ class EventPublisherPlugin : public Plugin,
   /// Set to indicate whether the event run loop ever started.
   std::atomic<bool> started_{false};
 
-  /// A lock for incrementing the next EventContextID.
-  Mutex ec_id_lock_;
-
   /// A lock for subscription manipulation.
   Mutex subscription_lock_;
 
+  /// The publisher thread placement, see --events_thread_affinity.
+  std::string placement_;
+
+  /// Protect the placement description read by the osquery_events table.
+  mutable Mutex placement_lock_;
+
+  /**
+   * @brief The snapshot of subscription targets read by `fire`.
+   *
+   * This is swapped atomically when subscriptions change, while holding the
+   * subscription_lock_, so firing events never takes a lock or performs an
+   * EventSubscriber lookup.
+   */
+  std::shared_ptr<const SubscriptionTargets> targets_;
+
+  /**
+   * @brief Optional queue of fired events, see events_queue_max.
+   *
+   * When set, `fire` only enqueues and an EventQueueRunner calls subscriber
+   * callbacks, so the publisher run loop is never blocked on storage.
+   */
+  std::shared_ptr<BoundedQueue<EventContextRef>> queue_;
+
+  /// The number of events dropped because the event queue was full.
+  std::atomic<size_t> dropped_events_{0};
+
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
 
+  /// Set by the queue runner while the queue depth is over the overload limit.
+  std::atomic<bool> overloaded_{false};
+
  private:
   /// Enable event factory "callins" through static publisher callbacks.
   friend class EventFactory;
 
+  /// The queue runner dispatches queued events.
+  friend class EventQueueRunner;
+class EventQueueRunner;
+template <typename T>
+class BoundedQueue;
+
  private:
   FRIEND_TEST(EventsTests, test_event_publisher);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_event_queue);
 };
 
 class EventSubscriberPlugin : public Plugin, public Eventer {
@@ -429,6 +532,21 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     return add(r, 0);
   }
 
+  /**
+   * @brief Store a set of parsed event rows using a single backing store write.
+   *
+   * This is equivalent to calling `add` for each row, but the data and
+   * records for every row are committed together. Subscribers that receive
+   * bursts of events may buffer rows and add them as a batch.
+   *
+   * If a row includes a 'time' column it is used as the event time.
+   *
+   * @param row_list A set of osquery Row elements.
+   *
+   * @return Were the elements added to the backing store.
+   */
+  Status addBatch(std::vector<Row>& row_list);
+
   /**
    * @brief Return all events added by this EventSubscriber within start, stop.
    *
@@ -436,23 +554,148 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    *
    * @param start Inclusive lower bound time limit.
    * @param stop Inclusive upper bound time limit.
+   * @param limit If non-zero, only the earliest limit events are returned.
    * @return Set of event rows matching time limits.
    */
-  virtual QueryData get(EventTime start, EventTime stop) final;
+  virtual QueryData get(EventTime start,
+                        EventTime stop,
+                        size_t limit = 0) final;
 
  private:
   /// Overload add for tests and allow them to override the event time.
   virtual Status add(Row& r, EventTime event_time) final;
 
+  /// Serialize an event row and append its data and record to a write batch.
+  Status prepareEvent(size_t eid,
+                      Row& r,
+                      EventTime event_time,
+                      DatabaseStringValueList& batch);
+
+  /// Keep a recent event in memory, it is persisted by flushEvents.
+  void bufferEvent(size_t eid, EventTime time, const Row& r);
+
+  /**
+   * @brief Apply overload sampling to an event row.
+   *
+   * While the publisher queue or the add latency is over its overload limit,
+   * only 1 in events_sampling rows with the same sampling key are stored.
+   * Each stored row's "sampling" column is the number of events it
+   * represents: itself and the rows with its key skipped before it.
+   *
+   * @return false if the row should not be stored.
+   */
+  bool sampleEvent(Row& r);
+
+  /// Check if the publisher queue or the add latency is over its limit.
+  bool isOverloaded() const;
+
+  /**
+   * @brief Store the events skipped for sampling keys not seen again.
+   *
+   * @param all if true also store them while overloaded
+   */
+  void flushSampling(bool all);
+
+  /**
+   * @brief Count an event row in its aggregate, see EventAggregation.
+   *
+   * Once EVENTS_AGGREGATE_KEYS aggregates are kept, rows with a new key are
+   * stored instead.
+   *
+   * @return false if the row is not aggregated and should be stored.
+   */
+  bool aggregateEvent(Row& r, EventTime event_time);
+
+  /// Persist the aggregates of buckets starting before a time.
+  void flushAggregates(EventTime before);
+
+  /// Update the average add latency with the time taken to store rows.
+  void recordLatency(std::chrono::steady_clock::time_point start,
+                     size_t rows);
+
+  /**
+   * @brief Return in-memory events if they cover the requested time range.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param results Output set of event rows matching time limits.
+   * @return true if the in-memory events were sufficient.
+   */
+  bool getBuffered(EventTime start, EventTime stop, QueryData& results);
+
+  /// Apply and save the optimization and expiration state after a get.
+  void applyExpiration();
+
+  /**
+   * @brief Expire the events every scheduled query has read.
+   *
+   * With --events_expire_consumed the events before the earliest optimize
+   * time of the scheduled queries selecting from this subscriber, less the
+   * --events_expire_grace window, are range-deleted after each selection.
+   */
+  void expireConsumed();
+
+  /**
+   * @brief Return the events matching constraints on indexed columns.
+   *
+   * Each event is also stored as a lookup key for each indexed column, by
+   * the column's value and the event time. The events with an EQUALS value
+   * or a LIKE prefix are found by scanning these keys, rather than reading
+   * every event in the time range. The rows read are matched against the
+   * EQUALS and LIKE constraints of every indexed column.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param limit If non-zero, only the earliest limit events are returned.
+   * @param context The query's constraints.
+   * @param results Output set of matching event rows.
+   * @return false if no indexed column is constrained.
+   */
+  bool getIndexed(EventTime start,
+                  EventTime stop,
+                  size_t limit,
+                  QueryContext& context,
+                  QueryData& results);
+
+ public:
+  /**
+   * @brief Persist all in-memory events not yet written to the backing store.
+   *
+   * @param all if true also persist the aggregates of the current bucket
+   */
+  void flushEvents(bool all = false);
+
+  /**
+   * @brief Add the rows a subscriber buffers itself before adding them.
+   *
+   * Called by EventFactory::flushEvents, including when events end, such
+   * that rows buffered by a callback are not lost.
+   */
+  virtual void flushBuffered() {}
+
+  /// Estimate the bytes of the in-memory events.
+  size_t getBufferedBytes();
+
+  /**
+   * @brief Persist and then drop the in-memory events.
+   *
+   * Selects read the dropped events from the backing store.
+   */
+  void releaseBuffered();
+
+  /// Set or clear (nullptr) the subscriber's aggregation.
+  void setAggregation(const std::shared_ptr<const EventAggregation>& agg) {
+    std::atomic_store(&aggregation_, agg);
+  }
+
  private:
   /*
    * @brief When `get`ing event results, return EventID%s from time indexes.
    *
    * Used by EventSubscriber::get to retrieve EventID, EventTime indexes. This
    * applies the lookup-efficiency checks for time list appropriate bins.
-   * If the time range in 24 hours and there is a 24-hour list bin it will
-   * be queried using a single backing store `Get` followed by two `Get`s of
-   * the most-specific boundary lists.
+   * Each record is stored as an individual key within the bin, so each bin is
+   * retrieved using a single prefix scan of the backing store keys.
    *
    * @param index the set of index to scan.
    * @param optimize if true apply optimization checks.
@@ -473,9 +716,12 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    * indexing is required within-EventCallback consider an
    * EventSubscriber%-unique indexing, counting mechanic.
    *
-   * @return A unique ID for backing storage.
+   * IDs are allocated from an atomic counter. A checkpoint is persisted each
+   * time the counter crosses the reserved stride, see events_eid_checkpoint.
+   *
+   * @return A unique ID for backing storage, zero-padded only within keys.
    */
-  EventID getEventID();
+  size_t getEventID();
 
   /**
    * @brief Plan the best set of indexes for event record access.
@@ -493,6 +739,9 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /**
    * @brief Expire indexes and eventually records.
    *
+   * Records and data are keyed in time order, so all expired bins and data
+   * are removed using range deletes rather than per-event deletes.
+   *
    * @param list_type the string representation of list binning type.
    * @param indexes complete set of 'index.step' indexes for the list_type.
    * @param expirations of the indexes, the set to expire.
@@ -501,10 +750,8 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
                      const std::vector<std::string>& indexes,
                      const std::vector<std::string>& expirations);
 
-  /// Expire all datums within a bin.
-  void expireRecords(const std::string& list_type,
-                     const std::string& index,
-                     bool all);
+  /// Expire the datums within a partially-expired bin.
+  void expireRecords(const std::string& list_type, const std::string& index);
 
   /**
    * @brief Inspect the number of events, expire those overflowing events_max.
@@ -526,12 +773,18 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
    * list type 1 bin 4 and list type 2 bin 1.
    *
+   * Records are written as a single key per event, and the bin index is only
+   * rewritten when a new bin is created.
+   *
    * @param eid A unique EventID.
    * @param time The time when this EventID%'s event occurred.
+   * @param batch The write batch the record is appended to.
    *
    * @return Were the indexes recorded.
    */
-  Status recordEvent(EventID& eid, EventTime time);
+  Status recordEvent(EventID& eid,
+                     EventTime time,
+                     DatabaseStringValueList& batch);
 
   /**
    * @brief Get the expiration timeout for this event type
@@ -610,6 +863,14 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     return getType() + '.' + getName();
   }
 
+  /**
+   * @brief The database domain of this subscriber's events.
+   *
+   * This is the shared kEvents domain, unless --events_subscriber_domains
+   * created a domain for the subscriber when it was registered.
+   */
+  const std::string& dbDomain() const;
+
   /// Disable event expiration for this subscriber.
   void doNotExpire() {
     expire_events_ = false;
@@ -644,7 +905,32 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   EventTime expire_time_{0};
 
   /// Cached value of last generated EventID.
-  size_t last_eid_{0};
+  std::atomic<size_t> last_eid_{0};
+
+  /// The last EventID reserved by a persisted checkpoint.
+  std::atomic<size_t> eid_checkpoint_{0};
+
+  /// Set when the last EventID checkpoint has been read.
+  std::atomic<bool> eid_loaded_{false};
+
+  /// The last bin a record was written into, known to exist in the index.
+  std::string last_record_bin_;
+
+  /// An event held in memory, the row includes the event time.
+  struct BufferedEvent {
+    size_t eid;
+    EventTime time;
+    Row row;
+  };
+
+  /// Recent events, in EventID order, when events_memory_max is set.
+  std::deque<BufferedEvent> buffered_events_;
+
+  /// The number of newest in-memory events not yet persisted.
+  size_t buffered_pending_{0};
+
+  /// The in-memory events include every event at or after this time.
+  EventTime buffered_since_{0};
 
   /**
    * @brief Optimize subscriber selects by tracking the last select time.
@@ -673,7 +959,19 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Set of queries that have used this subscriber table.
   std::set<std::string> queries_;
 
-  /// Lock used when incrementing the EventID database index.
+  /// The scheduled queries selecting from this subscriber table.
+  std::set<std::string> consumers_;
+
+  /// The time events were last expired to after every query read them.
+  EventTime consumed_time_{0};
+
+  /// The subscriber table's INDEX columns, events are looked up by value.
+  std::vector<std::string> indexed_columns_;
+
+  /// The domain created for this subscriber, empty if it uses kEvents.
+  std::string db_domain_;
+
+  /// Lock used when reading or persisting the EventID checkpoint.
   Mutex event_id_lock_;
 
   /// Lock used when recording an EventID and time into search bins.
@@ -682,6 +980,52 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Lock used when recording queries executing against this subscriber.
   mutable Mutex event_query_record_;
 
+  /// Lock used when accessing the in-memory events.
+  Mutex buffered_lock_;
+
+  /// Lock used to serialize persisting in-memory events.
+  Mutex flush_lock_;
+
+  /// The events seen and skipped for a sampling key.
+  struct SamplingState {
+    size_t seen{0};
+    size_t skipped{0};
+
+    /// The first skipped row, stored by flushSampling if no row follows.
+    Row row;
+  };
+
+  /// Sampling keys with events seen while overloaded.
+  std::unordered_map<std::string, SamplingState> sampling_;
+
+  /// The events_sampling_columns value, and its split columns.
+  std::string sampling_flag_;
+  std::vector<std::string> sampling_columns_;
+
+  /// Lock used when accessing the sampling state.
+  Mutex sampling_lock_;
+
+  /// Set when dispatched by an overloaded publisher, see events_overload_queue.
+  std::atomic<bool> publisher_overloaded_{false};
+
+  /// Moving average of the microseconds spent storing each row.
+  std::atomic<size_t> add_latency_{0};
+
+  /// The aggregation applied to added rows, if any.
+  std::shared_ptr<const EventAggregation> aggregation_{nullptr};
+
+  /// An aggregated row and the number of events it counts.
+  struct EventAggregate {
+    Row row;
+    size_t count{0};
+  };
+
+  /// Aggregates by bucket start time and key, ordered oldest first.
+  std::map<std::pair<EventTime, std::string>, EventAggregate> aggregates_;
+
+  /// Lock used when accessing the aggregates.
+  Mutex aggregate_lock_;
+
  private:
   friend class EventFactory;
   friend class EventPublisherPlugin;
@@ -689,14 +1033,24 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
   FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
+  FRIEND_TEST(EventsDatabaseTests, test_record_keys);
+  FRIEND_TEST(EventsDatabaseTests, test_event_add_batch);
+  FRIEND_TEST(EventsDatabaseTests, test_memory_events);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
+  FRIEND_TEST(EventsDatabaseTests, test_record_range_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
   FRIEND_TEST(EventsDatabaseTests, test_optimize);
+  FRIEND_TEST(EventsDatabaseTests, test_event_sampling);
+  FRIEND_TEST(EventsDatabaseTests, test_event_aggregation);
+  FRIEND_TEST(EventsDatabaseTests, test_indexed_columns);
+  FRIEND_TEST(EventsDatabaseTests, test_expire_consumed);
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
   friend class DBFakeEventSubscriber;
   friend class BenchmarkEventSubscriber;
+  friend class BenchmarkPipelineSubscriber;
+  friend class SoakEventSubscriber;
 };
 
 /**
@@ -826,8 +1180,18 @@ class EventFactory : private boost::noncopyable {
   /// Set log forwarding by adding a logger receiver.
   static void addForwarder(const std::string& logger);
 
-  /// Optionally forward events to loggers.
-  static void forwardEvent(const std::string& event);
+  /**
+   * @brief Optionally forward events to loggers.
+   *
+   * Internal logger plugins receive one shared copy of the event through
+   * LoggerPlugin::logEvents, and from an EventForwardRunner if
+   * events_forward_queue_max is set. Extension loggers are sent the event
+   * through a registry call.
+   */
+  static void forwardEvent(std::string event);
+
+  /// Check if any logger receives forwarded events.
+  static bool isForwarding();
 
   /**
    * @brief The event factory, subscribers, and publishers respond to updates.
@@ -878,6 +1242,15 @@ class EventFactory : private boost::noncopyable {
    */
   static void end(bool join = false);
 
+  /**
+   * @brief Persist in-memory events and aggregates for every subscriber.
+   *
+   * Rows buffered by the subscribers themselves are added first.
+   *
+   * @param all if true also persist aggregates of buckets still in progress
+   */
+  static void flushEvents(bool all = false);
+
  public:
   EventFactory(EventFactory const&) = delete;
   EventFactory& operator=(EventFactory const&) = delete;
@@ -887,6 +1260,19 @@ class EventFactory : private boost::noncopyable {
   EventFactory() {}
   ~EventFactory() {}
 
+  /**
+   * @brief Create or drop the database domain of a subscriber's events.
+   *
+   * Used with --events_subscriber_domains, a running subscriber's events are
+   * written to a domain of its own and a disabled subscriber's are dropped.
+   * A subscriber whose setUp failed keeps its stored events, it may run again
+   * on the next boot.
+   *
+   * @param sub the subscriber
+   * @param setup_failed the subscriber is disabled because its setUp failed
+   */
+  static void setSubscriberDomain(BaseEventSubscriber& sub, bool setup_failed);
+
  private:
   /// Set of registered EventPublisher instances.
   std::map<EventPublisherID, EventPublisherRef> event_pubs_;
@@ -897,11 +1283,25 @@ class EventFactory : private boost::noncopyable {
   /// Set of running EventPublisher run loop threads.
   std::vector<std::shared_ptr<std::thread>> threads_;
 
-  /// Set of logger plugins to forward events.
+  /// Set of extension logger plugins to forward events through the registry.
   std::vector<std::string> loggers_;
 
+  /// Set of internal logger plugins to forward events directly.
+  std::vector<std::shared_ptr<LoggerPlugin>> forwarders_;
+
+  /// Optional queue of forwarded events, see events_forward_queue_max.
+  std::shared_ptr<BoundedQueue<std::shared_ptr<const std::string>>>
+      forward_queue_;
+
   /// Factory publisher state manipulation.
   Mutex factory_lock_;
+
+ private:
+  /// The forward runner drains the forwarded event queue.
+  friend class EventForwardRunner;
+
+  FRIEND_TEST(EventsTests, test_forward_event);
+  FRIEND_TEST(EventsTests, test_forward_event_queue);
 };
 
 /**
@@ -46,9 +46,19 @@ inline std::string getExtensionSocket(
 /// External (extensions) SQL implementation of the osquery query API.
 Status queryExternal(const std::string& query, QueryData& results);
 
+/// See queryExternal, run in the osquery process serving a manager socket.
+Status queryExternal(const std::string& manager_path,
+                     const std::string& query,
+                     QueryData& results);
+
 /// External (extensions) SQL implementation of the osquery getQueryColumns API.
 Status getQueryColumnsExternal(const std::string& q, TableColumns& columns);
 
+/// See getQueryColumnsExternal, for the process serving a manager socket.
+Status getQueryColumnsExternal(const std::string& manager_path,
+                               const std::string& q,
+                               TableColumns& columns);
+
 /// External (extensions) SQL implementation plugin provider for "sql" registry.
 class ExternalSQLPlugin : public SQLPlugin {
  public:
@@ -89,6 +99,25 @@ Status pingExtension(const std::string& path);
  */
 Status applyExtensionDelay(std::function<Status(bool& stop)> predicate);
 
+/// Check if autoloaded extensions may still register within the timeout.
+bool extensionsPending();
+
+/// Count a registered extension, waking queries waiting for its tables.
+void notifyExtensionRegistered();
+
+/**
+ * @brief Wait for autoloaded extensions to register a table.
+ *
+ * The scheduler and queries do not wait for autoloaded extensions to start.
+ * A query referencing a table that is not registered waits until the table
+ * is registered, every expected extension has registered, or the extensions
+ * timeout since the manager started passed.
+ *
+ * @param name the table name SQLite reports as missing.
+ * @return true if the table is registered.
+ */
+bool waitForExtensionTable(const std::string& name);
+
 /**
  * @brief Request the extensions API to autoload any appropriate extensions.
  *
@@ -165,6 +194,33 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/**
+ * @brief Generate the rows of a table provided by an extension.
+ *
+ * The query context is sent as a Thrift structure. Extensions without the
+ * structured generate API, and calls that are not routed to an extension,
+ * receive the context serialized as a JSON request instead.
+ *
+ * @param table The table plugin name.
+ * @param context The query context given to the table.
+ * @param response The generated rows.
+ * @return Success indicates the extension generated the rows.
+ */
+Status callExtensionTable(const std::string& table,
+                          const QueryContext& context,
+                          QueryData& response);
+
+/**
+ * @brief Close the idle clients kept for an extension socket path.
+ *
+ * Calls to an extension reuse open clients, see --extensions_client_reuse.
+ * The clients are dropped when the extension goes away.
+ */
+void resetExtensionClients(const std::string& path);
+
+/// The number of idle clients kept for an extension socket path.
+size_t getIdleExtensionClients(const std::string& path);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
@@ -10,13 +10,16 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -65,6 +68,55 @@ Status forensicReadFile(const boost::filesystem::path& path,
                         std::string& content,
                         bool blocking = false);
 
+/**
+ * @brief Read a complete file without copying it into a string.
+ *
+ * With --read_mapped the file is mapped read-only and the predicate is given
+ * a reference to the mapping. Files that cannot be mapped, such as special and
+ * /proc files, and all files without --read_mapped, are read into a buffer
+ * with readFile. The same read limits apply.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param predicate called with the content, which is only valid during the
+ * call.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readFileMapped(const boost::filesystem::path& path,
+                      std::function<void(boost::string_ref content)> predicate);
+
+/// The outcome of reading one of the files requested from readFiles.
+struct FileReadResult {
+  Status status;
+  std::string content;
+};
+
+/**
+ * @brief Read many files concurrently.
+ *
+ * Tables reading a few small files from each home directory spend most of
+ * their time waiting on opens and reads. The files are read by up to
+ * --read_threads threads, each file as readFile would.
+ *
+ * @param paths the files to read.
+ * @param results the status and content of each path, in the same order.
+ * @param preserve_time Attempt to preserve file mtime and atime.
+ *
+ * @return success if every file was read.
+ */
+Status readFiles(const std::vector<boost::filesystem::path>& paths,
+                 std::vector<FileReadResult>& results,
+                 bool preserve_time = false);
+
+/**
+ * @brief Return a system path below the --host_root prefix.
+ *
+ * Tables reading /proc, /sys, /etc, and package databases resolve their
+ * paths with this, so they may read a recorded or synthetic host. Without
+ * --host_root the path is returned unchanged.
+ */
+std::string getHostPath(const std::string& path);
+
 /**
  * @brief Return the status of an attempted file read.
  *
@@ -274,6 +326,9 @@ Status parseJSONContent(const std::string& content,
 /**
  * @brief Parse a property list on disk into a property tree.
  *
+ * Parsed files are cached while their inode, modification time, and size are
+ * unchanged, see --plist_cache_max_bytes.
+ *
  * @param path the input path to a property list.
  * @param tree the output property tree.
  *
@@ -295,6 +350,52 @@ Status parsePlistContent(const std::string& content,
 #endif
 
 #ifdef __linux__
+/// Process details parsed from `/proc/<pid>/stat` and `/proc/<pid>/status`.
+struct ProcStat {
+  std::string pid;
+  std::string name;
+  std::string real_uid;
+  std::string real_gid;
+  std::string effective_uid;
+  std::string effective_gid;
+  std::string saved_uid;
+  std::string saved_gid;
+  std::string resident_size;
+  std::string total_size;
+  std::string state;
+  std::string parent;
+  std::string group;
+  std::string nice;
+  std::string threads;
+  std::string user_time;
+  std::string system_time;
+  std::string start_time;
+};
+
+/// A set of process details ordered by pid string.
+using ProcSnapshot = std::vector<ProcStat>;
+
+/**
+ * @brief Read and parse a process's stat and status.
+ *
+ * @param pid a string pid from proc.
+ * @param stat output process details.
+ *
+ * @return failure if the process status could not be read.
+ */
+Status procReadStat(const std::string& pid, ProcStat& stat);
+
+/**
+ * @brief Read the details of every process in `/proc`.
+ *
+ * Processes are read in parallel, see --proc_snapshot_threads. A snapshot is
+ * shared by callers for --proc_snapshot_ttl milliseconds, so the tables of a
+ * query or scheduled tick can read `/proc` once.
+ *
+ * @return the snapshot, never nullptr.
+ */
+std::shared_ptr<const ProcSnapshot> procSnapshot();
+
 /**
  * @brief Iterate over `/proc` process, returns a list of pids.
  *
@@ -315,6 +416,32 @@ Status procProcesses(std::set<std::string>& processes);
 Status procDescriptors(const std::string& process,
                        std::map<std::string, std::string>& descriptors);
 
+/**
+ * @brief Called for each descriptor of a process, see procWalkDescriptors.
+ *
+ * @param index the index of the process in the walked processes.
+ * @param descriptor the descriptor number.
+ * @param link the descriptor's NULL-terminated virtual path.
+ * @param size the length of the virtual path.
+ */
+using ProcDescriptorPredicate = std::function<void(
+    size_t index, const char* descriptor, const char* link, size_t size)>;
+
+/**
+ * @brief Read the descriptors of many `/proc` processes in parallel.
+ *
+ * Each descriptor link is read into a buffer passed to the predicate, which
+ * is only valid during the call, so descriptors a table does not use cost no
+ * allocations. The processes are divided between threads, see
+ * --proc_snapshot_threads. The predicate is called concurrently for different
+ * processes, and in order for the descriptors of one process.
+ *
+ * @param processes string pids from proc.
+ * @param predicate called for each readable descriptor.
+ */
+void procWalkDescriptors(const std::vector<std::string>& processes,
+                         const ProcDescriptorPredicate& predicate);
+
 /**
  * @brief Read a descriptor's virtual path.
  *
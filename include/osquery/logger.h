@@ -54,6 +54,9 @@ struct StatusLogLine {
   std::string message;
 };
 
+/// A serialized event shared, without copies, by every forwarding logger.
+using LogEventRef = std::shared_ptr<const std::string>;
+
 /**
  * @brief Logger plugin feature bits for complicated loggers.
  *
@@ -129,6 +132,27 @@ class LoggerPlugin : public Plugin {
   /// The LoggerPlugin PluginRequest action router.
   Status call(const PluginRequest& request, PluginResponse& response) override;
 
+  /**
+   * @brief Log a results string from within the process.
+   *
+   * This and the following methods are the typed equivalents of each `call`
+   * action. Callers in the same process use them to skip serializing a
+   * PluginRequest, which is only needed to reach an extension's logger.
+   */
+  Status sendString(const std::string& s);
+
+  /// Log a snapshot query's results from within the process.
+  Status sendSnapshot(const std::string& s);
+
+  /// Log status lines from within the process.
+  Status sendStatus(const std::vector<StatusLogLine>& log);
+
+  /// Initialize the logger from within the process.
+  void sendInit(const std::string& name, const std::vector<StatusLogLine>& log);
+
+  /// The LOGGER_FEATURE bits of the logger.
+  size_t getFeatures();
+
   /**
    * @brief A feature method to decide if Glog should stop handling statuses.
    *
@@ -233,8 +257,34 @@ class LoggerPlugin : public Plugin {
     return Status(1, "Not enabled");
   }
 
+  /**
+   * @brief Optionally handle a batch of forwarded events.
+   *
+   * Events from subscribers are handed to internal logger plugins directly,
+   * as shared buffers, instead of through a PluginRequest. A plugin may
+   * override this to write each batch at once. By default each event is sent
+   * to logEvent.
+   *
+   * @param events One or more serialized events.
+   */
+  virtual Status logEvents(const std::vector<LogEventRef>& events) {
+    Status status;
+    for (const auto& event : events) {
+      auto s = logEvent(*event);
+      if (!s.ok()) {
+        status = s;
+      }
+    }
+    return status;
+  }
+
  private:
   std::string process_name_;
+
+ private:
+  /// Events are forwarded without a PluginRequest.
+  friend class EventFactory;
+  friend class EventForwardRunner;
 };
 
 /// Set the verbose mode, changes Glog's sinking logic and will affect plugins.
@@ -367,4 +417,16 @@ void relayStatusLogs();
  * Linux/Darwin: this uses syslog's LOG_NOTICE.
  */
 void systemLog(const std::string& line);
+
+/**
+ * @brief Request that loggers writing to files reopen them.
+ *
+ * This is async-signal-safe, the SIGHUP handler calls it after an external
+ * log rotation. Loggers holding open files compare getLogReopenRequests
+ * before each write.
+ */
+void requestLogReopen();
+
+/// The number of reopen requests, see requestLogReopen.
+size_t getLogReopenRequests();
 }
@@ -22,6 +22,9 @@
 
 namespace osquery {
 
+/// Changes to file paths in this category re-evaluate discovery queries.
+const std::string kDiscoveryFileCategory{"discovery"};
+
 /// Statistics about Pack discovery query actions.
 struct PackStats {
   size_t total{0};
@@ -97,9 +100,25 @@ class Pack : private boost::noncopyable {
   /// Verify that a given version string is compatible
   bool checkVersion(const std::string& version) const;
 
-  /// Verify that a given discovery query returns the appropriate results
+  /**
+   * @brief Verify that the discovery queries return results
+   *
+   * The result is cached by the pack for --pack_refresh_interval seconds.
+   * Each discovery query's result is also cached for that interval and shared
+   * by every pack using the same query, so identical discovery queries run
+   * once for all packs.
+   */
   bool checkDiscovery();
 
+  /**
+   * @brief Drop every cached discovery result
+   *
+   * Each pack evaluates its discovery queries again when next checked. This
+   * is called when the config changes, or a path in the "discovery" file
+   * category changes, such as a package install.
+   */
+  static void invalidateDiscovery();
+
   /**
    * @brief Returns whether this pack is executing
    *
@@ -135,6 +154,9 @@ class Pack : private boost::noncopyable {
   /// Cached time and result from previous discovery step.
   std::pair<size_t, bool> discovery_cache_;
 
+  /// The discovery generation the cached result was evaluated in.
+  size_t discovery_generation_{0};
+
   /// Aggregate appropriateness of pack for this host.
   std::atomic<bool> valid_{false};
 
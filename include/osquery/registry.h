@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <set>
@@ -515,6 +517,22 @@ class RegistryFactory : private boost::noncopyable {
   static Status call(const std::string& registry_name,
                      const PluginRequest& request);
 
+  /**
+   * @brief Run a typed call to a plugin within this process.
+   *
+   * Plugins reached with localPlugin are called directly. Their exceptions
+   * are handled as those of a plugin reached with call, see
+   * --registry_exceptions.
+   *
+   * @param registry_name The unique registry name containing item_name.
+   * @param item_name The name of the plugin, used in the error message.
+   * @param typed_call Calls the plugin's typed methods.
+   * @return the status of typed_call, or a failure if it threw.
+   */
+  static Status callLocal(const std::string& registry_name,
+                          const std::string& item_name,
+                          const std::function<Status()>& typed_call);
+
   /// Run `setUp` on every registry that is not marked 'lazy'.
   static void setUp();
 
@@ -535,6 +553,23 @@ class RegistryFactory : private boost::noncopyable {
   PluginRef plugin(const std::string& registry_name,
                    const std::string& item_name) const;
 
+  /**
+   * @brief Get a plugin of this process as its plugin type.
+   *
+   * Callers use the plugin's typed methods, a PluginRequest is only needed to
+   * reach an extension's plugin through call.
+   *
+   * @return nullptr if the item is missing, an extension's, or another type.
+   */
+  template <class T>
+  std::shared_ptr<T> localPlugin(const std::string& registry_name,
+                                 const std::string& item_name) const {
+    if (!exists(registry_name)) {
+      return nullptr;
+    }
+    return std::dynamic_pointer_cast<T>(plugin(registry_name, item_name));
+  }
+
   /// Serialize this core or extension's registry.
   RegistryBroadcast getBroadcast();
 
@@ -562,6 +597,16 @@ class RegistryFactory : private boost::noncopyable {
   /// Get a registry's active plugin.
   std::string getActive(const std::string& registry_nane) const;
 
+  /**
+   * @brief A counter that changes each time an active plugin is set.
+   *
+   * Callers that cache a resolved active plugin compare this value to detect
+   * a change without a string-keyed registry lookup.
+   */
+  size_t activeGeneration() const {
+    return active_generation_;
+  }
+
   bool exists(const std::string& registry_name) const {
     return (registries_.count(registry_name) > 0);
   }
@@ -688,6 +733,9 @@ class RegistryFactory : private boost::noncopyable {
   /// Protector for broadcast lookups and external registry mutations.
   mutable Mutex mutex_;
 
+  /// Incremented by every setActive, see activeGeneration.
+  std::atomic<size_t> active_generation_{0};
+
  private:
   friend class RegistryInterface;
   friend class RegistryModuleLoader;
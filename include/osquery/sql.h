@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -64,6 +65,13 @@ class SQL : private only_movable {
    */
   const QueryData& rows() const;
 
+  /**
+   * @brief Move the rows returned by the query out of the SQL instance.
+   *
+   * @return A QueryData object of the query results, rows() is then empty.
+   */
+  QueryData takeRows();
+
   /**
    * @brief Column information for the query
    *
@@ -242,4 +250,40 @@ Status getQueryColumns(const std::string& q, TableColumns& columns);
  * @return status indicating success or failure of the operation.
  */
 Status getQueryTables(const std::string& q, std::vector<std::string>& tables);
+
+/**
+ * @brief Check if the calling thread's query should stop generating rows.
+ *
+ * A query run with a wall time, CPU time, or cancel limit, such as a
+ * scheduled query with a budget or a distributed query, is interrupted once
+ * the limit is reached. Tables that walk many files or directories check
+ * between items and return early, the query then fails rather than logging
+ * partial results.
+ *
+ * @return true if the query was interrupted, false if it has no limit.
+ */
+bool isQueryInterrupted();
+
+/**
+ * @brief Get a check of the calling thread's query, for the tasks it queues.
+ *
+ * The check may be called by any thread, such as the TaskGroup tasks of a
+ * filesystem walker. Tasks bound with bindQueryLimit count their CPU time
+ * against the query.
+ */
+std::function<bool()> getQueryInterrupt();
+
+/**
+ * @brief Bind a task queued by a query to the query's limit.
+ *
+ * The task may be run by any thread. While it runs isQueryInterrupted checks
+ * the query's limit, and not a limit of the thread running it. The task's CPU
+ * time is counted against the query's CPU time limit.
+ *
+ * @code{.cpp}
+ *   TaskGroup group(TaskPriority::HIGH);
+ *   group.run(bindQueryLimit(worker));
+ * @endcode
+ */
+std::function<void()> bindQueryLimit(std::function<void()> task);
 }
@@ -157,6 +157,16 @@ class Initializer : private boost::noncopyable {
    */
   static bool isWorker();
 
+  /**
+   * @brief The milliseconds the process took to start.
+   *
+   * This is the time from loading the process until #start completed, which
+   * includes opening the database, loading the config, and attaching events.
+   *
+   * @return the duration, or 0 if the process has not started.
+   */
+  static size_t getStartupDuration();
+
   /// Initialize this process as an osquery daemon worker.
   void initWorker(const std::string& name) const;
 
@@ -310,6 +320,89 @@ std::string getHostIdentifier();
  */
 size_t getUnixTime();
 
+/**
+ * @brief Get an identifier of the current system boot.
+ *
+ * The identifier changes each time the system boots. On Linux it is the
+ * kernel's random boot_id, and on macOS the boot time.
+ *
+ * @return the boot identifier, or an empty string if it is not available.
+ */
+std::string getBootIdentifier();
+
+/**
+ * @brief A sample of the resources used by the calling thread.
+ *
+ * CPU times are for the calling thread where the platform supports it, and
+ * for the process otherwise. Differences between two samples on the same
+ * thread measure the work done between them.
+ */
+struct ResourceUsage {
+  /// Milliseconds of a monotonic clock.
+  unsigned long long int wall_time{0};
+
+  /// Milliseconds of user CPU time.
+  unsigned long long int user_time{0};
+
+  /// Milliseconds of system CPU time.
+  unsigned long long int system_time{0};
+
+  /// Bytes of heap allocated by the process, 0 if unavailable.
+  unsigned long long int memory{0};
+
+  /// The process's largest resident set in bytes, 0 if unavailable.
+  unsigned long long int peak_resident{0};
+
+  /// Voluntary and involuntary context switches.
+  unsigned long long int context_switches{0};
+
+  /// Page faults that required I/O.
+  unsigned long long int major_faults{0};
+
+  /// CPU cycles in user mode, see getPerfCounters.
+  unsigned long long int cycles{0};
+
+  /// Instructions retired in user mode, see getPerfCounters.
+  unsigned long long int instructions{0};
+
+  /// Last level cache misses, see getPerfCounters.
+  unsigned long long int cache_misses{0};
+};
+
+/// Sample the resources used by the calling thread.
+ResourceUsage getResourceUsage();
+
+/**
+ * @brief Microseconds of user and system CPU time used by the calling thread.
+ *
+ * This is cheaper than getResourceUsage and may be sampled often, such as by
+ * the checks of a query's CPU limit. It is 0 if the platform cannot measure
+ * a thread's time.
+ */
+unsigned long long int getThreadCPUTime();
+
+/**
+ * @brief Return free heap memory to the system.
+ *
+ * Freeing many small allocations, such as the rows of large query results,
+ * leaves the allocator's free pages resident. This asks the allocator to
+ * release them, where the platform supports it, and may take milliseconds
+ * for a large heap.
+ */
+void releaseHeapMemory();
+
+/**
+ * @brief Add the calling thread's hardware performance counters to a sample.
+ *
+ * On Linux the counters are opened with perf_event_open the first time a
+ * thread samples them, and kept open for the thread's lifetime. Counters the
+ * kernel or hardware does not provide, such as within many virtual machines
+ * or with a restrictive perf_event_paranoid, remain 0.
+ *
+ * @param usage a sample from getResourceUsage on the same thread
+ */
+void getPerfCounters(ResourceUsage& usage);
+
 /**
  * @brief Getter for the current time, in a human-readable format.
  *
@@ -10,11 +10,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
 #include <set>
+#include <type_traits>
+#include <typeindex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #ifdef WIN32
@@ -24,7 +28,10 @@
 
 #include <boost/coroutine2/all.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/variant.hpp>
 
 #include <osquery/core.h>
 #include <osquery/database.h>
@@ -247,6 +254,24 @@ enum class ColumnOptions {
 
   /// This column should be hidden from '*'' selects.
   HIDDEN = 16,
+
+  /*
+   * @brief Rows may be ordered by this column without a SQLite sort.
+   *
+   * If a query orders by this column the QueryContext includes the order and
+   * the scan's rows are ordered before they are returned to SQLite, a table
+   * that generates rows in this order makes the ordering free.
+   */
+  SORTED = 32,
+
+  /*
+   * @brief An INDEX column whose value identifies at most one row.
+   *
+   * Tables look up each value of an equality constraint on this column, such
+   * as a uid with getpwuid. SQLite plans the constraint as a unique lookup and
+   * may place the table inside a join, reading one row per outer row.
+   */
+  UNIQUE = 64,
 };
 
 /// Treat column options as a set of flags.
@@ -280,6 +305,15 @@ enum class TableAttributes {
 
   /// This table's data requires an osquery kernel extension/module.
   KERNEL_REQUIRED = 16,
+
+  /// The results from this table do not change while the process runs.
+  CACHEABLE_PROCESS = 32,
+
+  /// The results from this table do not change until the system reboots.
+  CACHEABLE_BOOT = 64,
+
+  /// The table may generate on a worker while other tables are generated.
+  CONCURRENT = 128,
 };
 
 /// Treat table attributes as a set of flags.
@@ -306,6 +340,101 @@ using ColumnAliasSet = std::map<std::string, std::set<std::string>>;
 /// Forward declaration of QueryContext for ConstraintList relationships.
 struct QueryContext;
 
+/**
+ * @brief The constraints of a column, compiled for matching many values.
+ *
+ * Comparisons are parsed once into bounds of the column's affinity, EQUALS
+ * expressions into a set, and LIKE and GLOB patterns keep their literal
+ * prefixes to reject most values before matching the pattern.
+ *
+ * EQUALS expressions match any of their values, as the values of an IN list
+ * do. Operators that cannot be evaluated, such as REGEXP, and comparisons on
+ * DOUBLE columns do not limit the values. SQLite filters the generated rows
+ * again, so a matcher only needs to keep every row the query may select.
+ */
+class ConstraintMatcher : private boost::noncopyable {
+ public:
+  ConstraintMatcher(ColumnType affinity,
+                    const std::vector<struct Constraint>& constraints);
+
+  /// Check a value as the column's affinity.
+  bool matches(boost::string_ref expr) const;
+
+  /// Check an integer value without its text representation.
+  bool matches(long long expr) const;
+
+  /// The distinct expressions of an operator.
+  const std::set<std::string>& getAll(ConstraintOperator op) const;
+
+  /// The affinity the constraints were compiled for.
+  ColumnType affinity() const {
+    return affinity_;
+  }
+
+  /// The distinct expressions of an operator, cast to a literal type once.
+  template <typename T>
+  const std::set<T>& getAll(ConstraintOperator op) const {
+    WriteLock lock(views_mutex_);
+    auto& view = views_[std::make_pair(std::type_index(typeid(T)), op)];
+    if (view == nullptr) {
+      auto literals = std::make_shared<std::set<T>>();
+      for (const auto& expr : getAll(op)) {
+        T literal;
+        if (boost::conversion::try_lexical_convert(expr, literal)) {
+          literals->insert(std::move(literal));
+        }
+      }
+      view = literals;
+    }
+    return *std::static_pointer_cast<std::set<T>>(view);
+  }
+
+ private:
+  /// A LIKE or GLOB pattern.
+  struct Pattern {
+    bool like{true};
+    std::string pattern;
+
+    /// The characters before the first wildcard, folded for LIKE.
+    std::string prefix;
+  };
+
+  /// Check the patterns and text comparisons.
+  bool matchesText(boost::string_ref expr) const;
+
+  /// Check an order preserving integer key against the bounds.
+  bool matchesKey(long long key) const;
+
+ private:
+  ColumnType affinity_;
+
+  /// The expressions of each operator.
+  std::map<unsigned char, std::set<std::string>> expressions_;
+
+  /// Sorted EQUALS expressions of TEXT columns.
+  std::vector<std::string> text_equals_;
+
+  /// Comparisons of TEXT columns, by operator.
+  std::vector<std::pair<unsigned char, std::string>> text_ranges_;
+
+  /// EQUALS and inclusive bounds of integer columns.
+  std::unordered_set<long long> integer_equals_;
+  long long min_{0};
+  long long max_{0};
+
+  /// An integer comparison or EQUALS is set, or no integer can match.
+  bool integer_limited_{false};
+  bool integer_empty_{false};
+
+  std::vector<Pattern> patterns_;
+
+  /// Typed copies of expressions, by type and operator.
+  mutable Mutex views_mutex_;
+  mutable std::map<std::pair<std::type_index, unsigned char>,
+                   std::shared_ptr<void>>
+      views_;
+};
+
 /**
  * @brief A ConstraintList is a set of constraints for a column. This list
  * should be mapped to a left-hand-side column name.
@@ -332,24 +461,44 @@ struct ConstraintList : private boost::noncopyable {
    * If there are no predicate constraints in this list, all expression will
    * match. Constraints are limitations.
    *
+   * The constraints are compiled into a ConstraintMatcher when first used,
+   * tables may check each value they generate cheaply.
+   *
    * @param expr a SQL type expression of the column literal type to check.
    * @return If the expression matched all constraints.
    */
-  bool matches(const std::string& expr) const;
+  bool matches(const std::string& expr) const {
+    return getMatcher().matches(boost::string_ref(expr));
+  }
+
+  /// See ConstraintList::matches, without copying the expression.
+  bool matches(boost::string_ref expr) const {
+    return getMatcher().matches(expr);
+  }
+
+  /// See ConstraintList::matches.
+  bool matches(const char* expr) const {
+    return getMatcher().matches(boost::string_ref(expr));
+  }
 
   /**
    * @brief Check if an expression matches the query constraints.
    *
    * `matches` also supports the set of SQL affinite types.
-   * The expression expr will be evaluated as a string and compared using
-   * the affinity of the constraint.
+   * Integers are compared as integers, other expressions are evaluated as a
+   * string and compared using the affinity of the constraint.
    *
    * @param expr a SQL type expression of the column literal type to check.
    * @return If the expression matched all constraints.
    */
   template <typename T>
   bool matches(const T& expr) const {
-    return matches(SQL_TEXT(expr));
+    return matchesLiteral(
+        expr,
+        std::integral_constant<bool,
+                               std::is_integral<T>::value &&
+                                   (std::is_signed<T>::value ||
+                                    sizeof(T) < sizeof(long long))>());
   }
 
   /**
@@ -393,32 +542,30 @@ struct ConstraintList : private boost::noncopyable {
     return (!exists() || matches(expr));
   }
 
-  /**
-   * @brief Helper templated function for ConstraintList::matches.
-   */
-  template <typename T>
-  bool literal_matches(const T& base_expr) const;
-
   /**
    * @brief Get all expressions for a given ConstraintOperator.
    *
    * This is most useful if the table generation requires as column.
    * The generator may `getAll(EQUALS)` then iterate.
    *
+   * The set is kept until a constraint is added to the list.
+   *
    * @param op the ConstraintOperator.
    * @return A list of TEXT%-represented types matching the operator.
    */
-  std::set<std::string> getAll(ConstraintOperator op) const;
+  const std::set<std::string>& getAll(ConstraintOperator op) const {
+    return getMatcher().getAll(op);
+  }
 
-  /// See ConstraintList::getAll, but as a selected literal type.
+  /**
+   * @brief See ConstraintList::getAll, but as a selected literal type.
+   *
+   * Expressions are cast once per type, those that are not literals of the
+   * type are skipped.
+   */
   template <typename T>
-  std::set<T> getAll(ConstraintOperator op) const {
-    std::set<T> literal_matches;
-    auto matches = getAll(op);
-    for (const auto& match : matches) {
-      literal_matches.insert(AS_LITERAL(T, match));
-    }
-    return literal_matches;
+  const std::set<T>& getAll(ConstraintOperator op) const {
+    return getMatcher().getAll<T>(op);
   }
 
   /// Constraint list accessor, types and operator.
@@ -433,8 +580,18 @@ struct ConstraintList : private boost::noncopyable {
    */
   void add(const struct Constraint& constraint) {
     constraints_.push_back(constraint);
+    std::atomic_store(&matcher_, std::shared_ptr<const ConstraintMatcher>());
   }
 
+  /**
+   * @brief Get the compiled constraints.
+   *
+   * The constraints are compiled once the constraints of a scan are set, and
+   * again only if a constraint is added or the affinity changes. Threads
+   * matching values of a scan share the matcher.
+   */
+  const ConstraintMatcher& getMatcher() const;
+
   /**
    * @brief Serialize a ConstraintList into a property tree.
    *
@@ -451,10 +608,24 @@ struct ConstraintList : private boost::noncopyable {
   /// See ConstraintList::unserialize.
   void unserialize(const boost::property_tree::ptree& tree);
 
+ private:
+  template <typename T>
+  bool matchesLiteral(const T& expr, std::true_type) const {
+    return getMatcher().matches(static_cast<long long>(expr));
+  }
+
+  template <typename T>
+  bool matchesLiteral(const T& expr, std::false_type) const {
+    return getMatcher().matches(boost::string_ref(SQL_TEXT(expr)));
+  }
+
  private:
   /// List of constraint operator/expressions.
   std::vector<struct Constraint> constraints_;
 
+  /// The compiled constraints, replaced when a constraint is added.
+  mutable std::shared_ptr<const ConstraintMatcher> matcher_;
+
  private:
   friend struct QueryContext;
 
@@ -468,6 +639,29 @@ using ConstraintMap = std::map<std::string, struct ConstraintList>;
 /// Populate a constraint list from a query's parsed predicate.
 using ConstraintSet = std::vector<std::pair<std::string, struct Constraint>>;
 
+/// The set of column names a query selects or compares.
+using UsedColumns = std::unordered_set<std::string>;
+
+/// Row limit and ordering planned for a scan within xBestIndex.
+struct ScanHints {
+  /// The xFilter argument holding the LIMIT value, 0 if not planned.
+  size_t limit_index{0};
+
+  /// The xFilter argument holding the OFFSET value, 0 if not planned.
+  size_t offset_index{0};
+
+  /// The SORTED column the query orders the scan by, if any.
+  std::string order_by;
+
+  /// If the order is descending.
+  bool descending{false};
+
+  /// The xFilter arguments holding every value of an IN list.
+  std::set<size_t> in_lists;
+};
+
+class TablePlugin;
+
 /**
  * @brief osquery table content descriptor.
  *
@@ -486,6 +680,10 @@ struct VirtualTableContent {
   /// Friendly name for the table.
   TableName name;
 
+  /// The local table plugin, resolved once when the table is created.
+  /// Tables provided by extensions do not have a local plugin.
+  std::shared_ptr<TablePlugin> table{nullptr};
+
   /// Table column structure, retrieved once via the TablePlugin call API.
   TableColumns columns;
 
@@ -505,6 +703,24 @@ struct VirtualTableContent {
   /// Transient set of virtual table access constraints.
   std::unordered_map<size_t, ConstraintSet> constraints;
 
+  /// Transient set of virtual table used columns, indexed like constraints.
+  std::unordered_map<size_t, UsedColumns> colsUsed;
+
+  /// Transient set of scan limits and orders, indexed like constraints.
+  std::unordered_map<size_t, ScanHints> hints;
+
+  /// Constraint indexes planned for cached statements, kept between queries.
+  std::unordered_set<size_t> pinned;
+
+  /**
+   * @brief Transient generated rows, keyed by their constraints and columns.
+   *
+   * When SQLite scans the table again with identical constraint values and
+   * used columns within the same query, such as within correlated subqueries
+   * or self-joins, the rows are reused instead of generated again.
+   */
+  std::unordered_map<std::string, QueryData> results;
+
   /*
    * @brief A table implementation specific query result cache.
    *
@@ -526,6 +742,95 @@ struct VirtualTableContent {
 using RowGenerator = boost::coroutines2::coroutine<Row&>;
 using RowYield = RowGenerator::push_type;
 
+/**
+ * @brief A native column value.
+ *
+ * A blank value is a NULL, integers are used for INTEGER, BIGINT, and
+ * UNSIGNED_BIGINT columns. A string value is cast to the column's type as if
+ * it were emitted in a Row.
+ */
+using TypedValue = boost::variant<boost::blank, long long, double, std::string>;
+
+/// A row of native values, indexed by the column's position in columns().
+using TypedRow = std::vector<TypedValue>;
+
+/// The typed equivalent of QueryData.
+using TypedQueryData = std::vector<TypedRow>;
+
+/// Convert a typed row to a Row using the table's column definition.
+Row typedRowToRow(const TypedRow& row, const TableColumns& columns);
+
+/// Check if a column type is stored as a long long TypedValue.
+constexpr bool isIntegerColumnType(ColumnType type) {
+  return type == INTEGER_TYPE || type == BIGINT_TYPE ||
+         type == UNSIGNED_BIGINT_TYPE;
+}
+
+/**
+ * @brief A TypedRow whose values are set by compile-time checked columns.
+ *
+ * The Columns are generated from each table spec into "columns/<table>.h",
+ * with a Col enumerator, kCount, and kTypes. Integers may only be set for
+ * integer columns and floating point values for DOUBLE columns. Strings may
+ * be set for any column and are cast like Row values.
+ *
+ * @code{.cpp}
+ *   processesRow r;
+ *   r.set<processesColumns::Col::pid>(pid);
+ *   r.set<processesColumns::Col::name>(name);
+ *   results.push_back(r.take());
+ * @endcode
+ */
+template <typename Columns>
+class TypedColumnRow {
+ public:
+  using Col = typename Columns::Col;
+
+  TypedColumnRow() : row_(Columns::kCount) {}
+
+  /// Set the value of a column.
+  template <Col C, typename T>
+  void set(T&& value) {
+    using V = typename std::decay<T>::type;
+    constexpr auto type = Columns::kTypes[static_cast<size_t>(C)];
+    static_assert(!std::is_integral<V>::value || isIntegerColumnType(type),
+                  "Integer values require an integer column");
+    static_assert(!std::is_floating_point<V>::value || type == DOUBLE_TYPE,
+                  "Floating point values require a DOUBLE column");
+    row_[static_cast<size_t>(C)] = toValue(
+        std::forward<T>(value),
+        std::integral_constant<bool, std::is_arithmetic<V>::value>());
+  }
+
+  /// The value of a column, blank if it was not set.
+  template <Col C>
+  const TypedValue& get() const {
+    return row_[static_cast<size_t>(C)];
+  }
+
+  /// Move the row out, such as into a TypedQueryData.
+  TypedRow take() {
+    return std::move(row_);
+  }
+
+ private:
+  template <typename T>
+  static TypedValue toValue(T value, std::true_type) {
+    if (std::is_floating_point<T>::value) {
+      return static_cast<double>(value);
+    }
+    return static_cast<long long>(value);
+  }
+
+  template <typename T>
+  static TypedValue toValue(T&& value, std::false_type) {
+    return std::string(std::forward<T>(value));
+  }
+
+ private:
+  TypedRow row_;
+};
+
 /**
  * @brief A QueryContext is provided to every table generator for optimization
  * on query components like predicate constraints and limits.
@@ -566,6 +871,77 @@ struct QueryContext : private only_movable {
   bool hasConstraint(const std::string& column,
                      ConstraintOperator op = EQUALS) const;
 
+  /**
+   * @brief Check if a column is used by the query.
+   *
+   * Table implementations may skip generating expensive columns that are not
+   * selected or compared. If SQLite did not provide the set of used columns
+   * every column is considered used.
+   *
+   * @param colName The name of a column within this table.
+   * @return true if the column content should be generated.
+   */
+  bool isColumnUsed(const std::string& colName) const;
+
+  /// Check if any of the columns are used by the query.
+  bool isAnyColumnUsed(std::initializer_list<std::string> colNames) const;
+
+  /**
+   * @brief Check a value against the constraints on a column.
+   *
+   * Tables that filter values in an inner loop, such as walked paths or pids,
+   * may skip rows the query cannot select. The constraints are compiled once
+   * per scan, see ConstraintMatcher.
+   *
+   * @param column The name of a column within this table.
+   * @param value The value the row would have.
+   * @return false if the query cannot select a row with the value.
+   */
+  template <typename T>
+  bool matches(const std::string& column, const T& value) const {
+    auto list = constraints.find(column);
+    return list == constraints.end() || list->second.matches(value);
+  }
+
+  /**
+   * @brief Get the values of point lookups on an INDEX column.
+   *
+   * When a query compares an INDEX column by equality, including IN lists and
+   * the columns of an outer table in a join, SQLite only reads rows with one
+   * of these values. Tables should look up each value instead of generating
+   * every row, such that a join does work for its matches only.
+   *
+   * @param column The name of an INDEX column within this table.
+   * @param values The output parameter, the looked up values.
+   * @return true if the rows may be limited to the values.
+   */
+  bool getLookupValues(const std::string& column,
+                       std::set<std::string>& values) const;
+
+  /**
+   * @brief Check if enough rows were generated for the query.
+   *
+   * Tables that walk directories or files may stop once the query's LIMIT
+   * is satisfied. When an order is requested, rows must be generated in that
+   * order for the limit to be used.
+   *
+   * @param rows The number of rows generated so far.
+   * @return true if the table may stop generating rows.
+   */
+  bool isLimitReached(size_t rows) const {
+    return (limit && rows >= *limit);
+  }
+
+  /**
+   * @brief Check if the query was interrupted by its wall or CPU time limit.
+   *
+   * Tables that walk directories or files check between items, and return
+   * the rows found so far. The query fails, partial rows are not logged.
+   *
+   * @return true if the table should stop generating rows.
+   */
+  bool isInterrupted() const;
+
   /**
    * @brief Apply a predicate function to each expression in a constraint list.
    *
@@ -594,7 +970,7 @@ struct QueryContext : private only_movable {
           }
         }
       } else {
-        auto constraint_set = list.getAll<T>(op);
+        const auto& constraint_set = list.getAll<T>(op);
         for (const auto& constraint : constraint_set) {
           predicate(constraint);
         }
@@ -664,6 +1040,24 @@ struct QueryContext : private only_movable {
   /// The map of column name to constraint list.
   ConstraintMap constraints;
 
+  /// The set of used columns, if unset all columns are used.
+  boost::optional<UsedColumns> colsUsed;
+
+  /**
+   * @brief The number of rows the query reads from this scan, if known.
+   *
+   * This is only set when SQLite exposes the LIMIT (and OFFSET) and every
+   * predicate term is an equality or LIKE on a single index, required, or
+   * additional column, such that the generated rows are not filtered again.
+   */
+  boost::optional<size_t> limit;
+
+  /// The SORTED column rows are ordered by, if the query requested an order.
+  boost::optional<std::string> orderBy;
+
+  /// If orderBy is set, the rows are ordered descending.
+  bool orderDescending{false};
+
  private:
   /// If false then the context is maintaining a ephemeral cache.
   bool enable_cache_{false};
@@ -734,9 +1128,7 @@ class TablePlugin : public Plugin {
    * @param request A query context filled in by SQLite's virtual table API.
    * @return The result rows for this table, given the query context.
    */
-  virtual QueryData generate(QueryContext& context) {
-    return QueryData();
-  }
+  virtual QueryData generate(QueryContext& context);
 
   /**
    * @brief Generate a table representation by yielding each row.
@@ -765,6 +1157,67 @@ class TablePlugin : public Plugin {
     return false;
   }
 
+  /**
+   * @brief Generate a table representation using native column values.
+   *
+   * For tables that override usesTypedRows, each row is a vector of values
+   * ordered like columns(). The virtual table API reads each cell by position
+   * and does not parse strings for numeric columns.
+   *
+   * The default generate method converts these rows to QueryData, so callers
+   * such as extensions and the registry continue to work.
+   *
+   * @param context a query context filled in by SQLite's virtual table API.
+   * @return The result rows for this table, given the query context.
+   */
+  virtual TypedQueryData generateTyped(QueryContext& context) {
+    return TypedQueryData();
+  }
+
+  /// Override and return true to use the typed generate method.
+  virtual bool usesTypedRows() const {
+    return false;
+  }
+
+  /**
+   * @brief Files that invalidate lifetime cached results when modified.
+   *
+   * Tables with the CACHEABLE_PROCESS or CACHEABLE_BOOT attribute generate
+   * their results again when the modification time of any of these files
+   * changes, such as a distribution's release file after an upgrade.
+   */
+  virtual std::vector<std::string> lifetimeCachePaths() const {
+    return {};
+  }
+
+  /**
+   * @brief Retrieve results cached for the lifetime of the process or boot.
+   *
+   * The virtual table API checks this cache before calling generate for
+   * tables with the CACHEABLE_PROCESS or CACHEABLE_BOOT attribute. Results
+   * of CACHEABLE_BOOT tables are also persisted in the database and are used
+   * by later processes until the system reboots.
+   *
+   * @param results filled with the cached results.
+   * @param key set to the cache key of the current process, boot, and files.
+   * @return True if results were cached with the current key.
+   */
+  bool getLifetimeCache(QueryData& results, std::string& key);
+
+  /**
+   * @brief Cache results for the lifetime of the process or boot.
+   *
+   * Only complete scans are cached, with no constraints, no row limit, and
+   * all columns used, such that any later scan may be served from them.
+   *
+   * @param context the query context used to generate the results.
+   * @param key the cache key from TablePlugin::getLifetimeCache.
+   * @param results the generated results.
+   */
+  void setLifetimeCache(const QueryContext& context,
+                        const std::string& key,
+                        const QueryData& results);
+
  protected:
   /// An SQL table containing the table definition/syntax.
   std::string columnDefinition() const;
@@ -797,19 +1250,24 @@ class TablePlugin : public Plugin {
   bool isCached(size_t interval);
 
   /**
-   * @brief Perform a database lookup of cached results and deserialize.
+   * @brief Retrieve cached results.
    *
    * If a query determined the table's cached results are fresh, it may ask the
-   * table to retrieve results from the database and deserialized them into
-   * table row data.
+   * table for them. Results are kept in a process-local cache with a memory
+   * budget. If results are persisted, and were evicted or cached by a previous
+   * worker, they are read from the database and deserialized.
    *
-   * @return The deserialized row data of cached results.
+   * @return The row data of cached results.
    */
   QueryData getCache() const;
 
   /// Similar to TablePlugin::getCache, if TablePlugin::generate is called.
   void setCache(size_t step, size_t interval, const QueryData& results);
 
+ private:
+  /// Restore the freshness of results persisted by a previous worker.
+  void restoreCache();
+
  private:
   /// The last time in seconds the table data results were saved to cache.
   size_t last_cached_{0};
@@ -817,18 +1275,23 @@ class TablePlugin : public Plugin {
   /// The last interval in seconds when the table data was cached.
   size_t last_interval_{0};
 
+  /// True once persisted cache freshness was checked.
+  bool cache_restored_{false};
+
  public:
   /**
    * @brief The scheduled interval for the executing query.
    *
-   * Scheduled queries execute within a pseudo-mutex, and each may communicate
-   * their scheduled interval to internal TablePlugin implementations. If the
-   * table is cachable then the interval can be used to calculate freshness.
+   * Scheduled queries communicate their scheduled interval to internal
+   * TablePlugin implementations. If the table is cachable then the interval
+   * can be used to calculate freshness. Each thread running scheduled queries
+   * has its own interval.
    */
-  static size_t kCacheInterval;
+  static thread_local size_t kCacheInterval;
 
   /// The schedule step, this is the current position of the schedule.
-  static size_t kCacheStep;
+  /// It is set by the scheduler and read by queries on worker threads.
+  static std::atomic<size_t> kCacheStep;
 
  public:
   /**
@@ -877,6 +1340,7 @@ class TablePlugin : public Plugin {
   FRIEND_TEST(VirtualTableTests, test_tableplugin_statement);
   FRIEND_TEST(VirtualTableTests, test_indexing_costs);
   FRIEND_TEST(VirtualTableTests, test_yield_generator);
+  FRIEND_TEST(VirtualTableTests, test_unique_lookups);
 };
 
 /// Helper method to generate the virtual table CREATE statement.
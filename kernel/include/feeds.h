@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 5
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -127,6 +127,19 @@ typedef struct {
   char path[MAXPATHLEN];
 } osquery_file_event_subscription_t;
 
+//
+// Event filters
+//
+
+/// The maximum number of processes a filter excludes.
+#define OSQUERY_FILTER_MAX_PIDS 16
+
+/// The maximum size of a filter's packed path prefixes.
+#define OSQUERY_FILTER_MAX_PREFIXES_SIZE (64 * 1024)
+
+/// Actions of events without actions, such as process events.
+#define OSQUERY_FILTER_ALL_ACTIONS 0xFFFFFFFF
+
 #ifdef KERNEL_TEST
 typedef struct {
   uint32_t my_num;
@@ -170,6 +183,44 @@ typedef struct {
   int subscribe;
 } osquery_subscription_args_t;
 
+/** @brief A filter a kernel publisher applies before queueing an event.
+ *
+ *  The daemon compiles a filter from the subscriptions of an event type.
+ *  Events that do not match are counted and discarded before any queue space
+ *  is reserved for them.
+ */
+typedef struct {
+  osquery_event_t event;
+
+  /// Bitmask of the delivered actions, such as the osquery_file_action_t.
+  uint32_t actions;
+
+  /// Number of NUL-terminated path prefixes, 0 matches every path.
+  uint32_t prefix_count;
+
+  /// Size of the packed prefixes.
+  size_t prefixes_size;
+
+  /// User space address of the packed prefixes.
+  uint64_t prefixes;
+
+  /// Number of excluded processes.
+  uint32_t excluded_pid_count;
+
+  /// Processes whose events are discarded, such as the daemon itself.
+  uint64_t excluded_pids[OSQUERY_FILTER_MAX_PIDS];
+} osquery_filter_args_t;
+
+typedef struct {
+  osquery_event_t event;
+
+  /// (Output) Events that matched the filter since the queue was allocated.
+  uint64_t delivered;
+
+  /// (Output) Events discarded by the filter since the queue was allocated.
+  uint64_t filtered;
+} osquery_filter_stats_args_t;
+
 // Flags for buffer sync options.
 enum osquery_options {
   OSQUERY_OPTIONS_DEFAULT = 0,
@@ -207,6 +258,10 @@ typedef struct {
   _IOWR(OSQUERY_IOCTL_NUM, 0x2, osquery_buf_sync_args_t)
 #define OSQUERY_IOCTL_BUF_ALLOCATE \
   _IOWR(OSQUERY_IOCTL_NUM, 0x3, osquery_buf_allocate_args_t)
+#define OSQUERY_IOCTL_FILTER \
+  _IOW(OSQUERY_IOCTL_NUM, 0x5, osquery_filter_args_t)
+#define OSQUERY_IOCTL_FILTER_STATS \
+  _IOWR(OSQUERY_IOCTL_NUM, 0x6, osquery_filter_stats_args_t)
 
 #ifdef KERNEL_TEST
 #define OSQUERY_IOCTL_TEST _IOW(OSQUERY_IOCTL_NUM, 0x4, int)
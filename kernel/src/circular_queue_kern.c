@@ -38,50 +38,41 @@ static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
   lck_grp_attr_free(queue->lck_grp_attr);
 }
 
-static inline void *advance_pointer(osquery_cqueue_t *queue, void *ptr,
-                                    size_t bytes) {
-  return ((uint8_t *)ptr + bytes - queue->buffer) % queue->size + queue->buffer;
-}
-
-static inline size_t get_distance(osquery_cqueue_t *queue, void *lower,
-                                  void *upper, int cannot_be_empty) {
-  ssize_t size = (uint8_t *)upper - (uint8_t *)lower;
-  if (size == 0) {
-    return cannot_be_empty ? queue->size : 0;
-  } else if (size < 0) {
-    return queue->size + size;
-  } else {
-    return size;
-  }
+/** @brief Return a reservation counted by osquery_cqueue_reserve().
+ *
+ *  @param queue The queue the reservation was made in.
+ *  @return Void.
+ */
+static inline void release_reservation(osquery_cqueue_t *queue) {
+  __atomic_fetch_sub(&queue->reservations, 1, __ATOMIC_SEQ_CST);
 }
 
-typedef enum {
-  OSQUERY_BETWEEN_INIT = 0,
-  OSQUERY_BETWEEN = 1,
-  OSQUERY_NOT_BETWEEN = 1 << 1,
-  OSQUERY_NOT_IN_BUFFER = 1 << 2
-} osquery_between_t;
-
-static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
-                                           void *lower, void *upper,
-                                           size_t size) {
-  osquery_between_t b = OSQUERY_BETWEEN_INIT;
-  if (ptr < (void *)queue->buffer
-      || ((uint8_t *)ptr) + size > (queue->buffer + queue->size)) {
-    b |= OSQUERY_NOT_IN_BUFFER;
-  }
-
-  if (lower <= upper && lower <= ptr
-      && ((void *)(((uint8_t *)ptr) + size)) <= upper) {
-    b |= OSQUERY_BETWEEN;
-  } else if (upper < lower
-             && (((void *)(((uint8_t *)ptr) + size)) <= upper || lower <= ptr)) {
-    b |= OSQUERY_BETWEEN;
-  } else {
-    b |= OSQUERY_NOT_BETWEEN;
+/** @brief Move the read position, zeroing the consumed space.
+ *
+ *  Headers are written after their space is reserved, zeroed space makes sure
+ *  a header that is not written yet is never seen as finished.
+ *
+ *  Only called by the single reader.
+ *
+ *  @param queue The queue to move the read position in.
+ *  @param new_read The new read position.
+ *  @return Void.
+ */
+static inline void release_readable(osquery_cqueue_t *queue,
+                                    uint64_t new_read) {
+  uint64_t read = queue->read;
+  while (read < new_read) {
+    size_t offset = read % queue->size;
+    size_t length = queue->size - offset;
+    if (length > new_read - read) {
+      length = new_read - read;
+    }
+    bzero(queue->buffer + offset, length);
+    read += length;
   }
 
-  return b;
+  // Producers may only reuse the space after it is zeroed.
+  __atomic_store_n(&queue->read, new_read, __ATOMIC_RELEASE);
 }
 
 void osquery_cqueue_setup(osquery_cqueue_t *queue) {
@@ -119,24 +110,28 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
   queue->buffer = (uint8_t *)buffer;
   queue->size = size;
 
-  queue->write = queue->buffer;
-  queue->max_read = queue->buffer;
-  queue->read = queue->buffer;
+  queue->write = 0;
+  queue->max_read = 0;
+  queue->read = 0;
 
   queue->drops = 0;
-  queue->initialized = 1;
   queue->reservations = 0;
+  queue->waiting = 0;
+  __atomic_store_n(&queue->initialized, 1, __ATOMIC_SEQ_CST);
   lck_spin_unlock(queue->lck);
 }
 
 void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
   lck_spin_lock(queue->lck);
   if (queue->initialized) {
-    queue->initialized = 0;
-
-    while (queue->reservations > 0) {
-      lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT, &queue->reservations,
-                     THREAD_UNINT);
+    __atomic_store_n(&queue->initialized, 0, __ATOMIC_SEQ_CST);
+
+    // Producers do not take the lock, poll until their reservations finish.
+    while (__atomic_load_n(&queue->reservations, __ATOMIC_SEQ_CST) > 0) {
+      uint64_t deadline;
+      clock_interval_to_deadline(1, kMillisecondScale, &deadline);
+      lck_spin_sleep_deadline(queue->lck, LCK_SLEEP_DEFAULT,
+                              &queue->reservations, THREAD_UNINT, deadline);
     }
 
     // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
@@ -152,26 +147,24 @@ void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
 
 int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
                                 size_t *max_read_offset) {
-  int err = 0;
-  lck_spin_lock(queue->lck);
-
-  if (!queue->initialized) {
-    err = -1;
-    goto error_exit;
+  // The single reader does not need the lock to move the read position.
+  if (!__atomic_load_n(&queue->initialized, __ATOMIC_SEQ_CST)) {
+    return -1;
   }
 
-  uint8_t *new_read = queue->buffer + read_offset;
-  if (OSQUERY_BETWEEN == is_between(queue, new_read, queue->read,
-                                    queue->max_read, 0)) {
-    queue->read = new_read;
-  } else {
-    queue->read = queue->max_read;
+  int err = 0;
+  uint64_t max_read = __atomic_load_n(&queue->max_read, __ATOMIC_ACQUIRE);
+
+  // Find the position of the offset between the read and max_read positions.
+  uint64_t new_read = queue->read +
+                      (read_offset + queue->size - queue->read % queue->size) %
+                          queue->size;
+  if (read_offset >= queue->size || new_read > max_read) {
+    new_read = max_read;
     err = -1;
   }
-  *max_read_offset = queue->max_read - queue->buffer;
-
-error_exit:
-  lck_spin_unlock(queue->lck);
+  release_readable(queue, new_read);
+  *max_read_offset = max_read % queue->size;
 
   return err;
 }
@@ -185,12 +178,16 @@ ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
     goto error_exit;
   }
 
+  // Producers that see the reader waiting take the lock to wake it.
+  __atomic_store_n(&queue->waiting, 1, __ATOMIC_SEQ_CST);
   wait_result_t wait_result = THREAD_AWAKENED;
-  while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
+  while (wait_result == THREAD_AWAKENED &&
+         __atomic_load_n(&queue->max_read, __ATOMIC_SEQ_CST) == queue->read) {
     wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
                                  &queue->max_read, THREAD_ABORTSAFE);
   }
-  offset = queue->max_read - queue->buffer;
+  __atomic_store_n(&queue->waiting, 0, __ATOMIC_SEQ_CST);
+  offset = __atomic_load_n(&queue->max_read, __ATOMIC_ACQUIRE) % queue->size;
 
 error_exit:
   lck_spin_unlock(queue->lck);
@@ -198,145 +195,137 @@ error_exit:
 }
 
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue) {
-  int drops;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
-    drops = -1;
-    goto error_exit;
+  if (!__atomic_load_n(&queue->initialized, __ATOMIC_SEQ_CST)) {
+    return -1;
   }
 
-  drops = queue->drops;
-  queue->drops = 0;
-
-error_exit:
-  lck_spin_unlock(queue->lck);
-
-  return drops;
+  return __atomic_exchange_n(&queue->drops, 0, __ATOMIC_SEQ_CST);
 }
 
 void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
                              osquery_event_t event,
                              size_t size) {
-  void *ret = NULL;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
-    ret = NULL;
-    goto error_exit;
+  // The reservation is counted before checking the queue, so a destroy
+  // waits for it.
+  __atomic_fetch_add(&queue->reservations, 1, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&queue->initialized, __ATOMIC_SEQ_CST)) {
+    release_reservation(queue);
+    return NULL;
   }
 
-  osquery_data_header_t *header = NULL;
-
   size_t contents_size = size;
   size += sizeof(osquery_data_header_t);
 
-  // We do not want the write pointer to ever equal the read pointer unless
-  // everything is empty.  Otherwise we need to track the empty states for the
-  // buffer.
-  if (get_distance(queue, queue->write, queue->read, 1) > size) {
-    if (get_distance(queue, queue->write,
-                     queue->buffer + queue->size, 0) >= size) {
-      // We can fit the allocation by advancing the write pointer.
-      header = (osquery_data_header_t *)queue->write;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->write, size);
-    } else if (get_distance(queue, queue->buffer, queue->read, 0) > size) {
-      // We can fit the allocation by wrapping the write pointer.
-      if (get_distance(queue, queue->write, queue->buffer + queue->size, 0)
-          >= sizeof(osquery_data_header_t)) {
-        // Signal a Null event ie. jump to beginning of buf.  If there
-        // is not enough room to do so, this is ok because it will know to
-        // skip to the beginning of the buffer based on the amount of space
-        // left.
-        header = (osquery_data_header_t *)queue->write;
-        header->event = END_OF_BUFFER_EVENT;
+  uint64_t write = __atomic_load_n(&queue->write, __ATOMIC_RELAXED);
+  uint64_t start = 0;
+  uint64_t end = 0;
+  do {
+    // The allocation is wrapped to the beginning of the buffer if it does not
+    // fit before the end, skipping the remaining space.
+    start = write;
+    size_t space = queue->size - write % queue->size;
+    if (space < size) {
+      start += space;
+    }
+    end = start + size;
+
+    // We do not want the write position to ever reach the read position of
+    // the next pass over the buffer.  Otherwise the user's buffer offsets
+    // cannot tell a full buffer from an empty one.
+    if (end - __atomic_load_n(&queue->read, __ATOMIC_ACQUIRE) >= queue->size) {
+      if (__atomic_load_n(&queue->drops, __ATOMIC_RELAXED) >= 0) {
+        __atomic_fetch_add(&queue->drops, 1, __ATOMIC_RELAXED);
       }
-      header = (osquery_data_header_t *)queue->buffer;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->buffer, size);
+      release_reservation(queue);
+      return NULL;
     }
-  }
+  } while (!__atomic_compare_exchange_n(&queue->write, &write, end, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
 
-  if (header) {
-    header->event = event;
-    header->size = contents_size;
-    header->finished = 0;
-
-    // Give them the pointer to the space not the header.
-    ret = (void *)(header + 1);
-    queue->reservations++;
-  } else {
-    if (queue->drops >= 0) {
-      queue->drops += 1;
-    }
-    ret = NULL;
+  osquery_data_header_t *header = NULL;
+  if (start - write >= sizeof(osquery_data_header_t)) {
+    // Signal a Null event ie. jump to beginning of buf.  If there is not
+    // enough room to do so, this is ok because it will know to skip to the
+    // beginning of the buffer based on the amount of space left.
+    header = (osquery_data_header_t *)(queue->buffer + write % queue->size);
+    header->event = END_OF_BUFFER_EVENT;
+    header->size = 0;
+    __atomic_store_n(&header->finished, 1, __ATOMIC_RELEASE);
   }
-error_exit:
-  lck_spin_unlock(queue->lck);
 
-  return ret;
+  header = (osquery_data_header_t *)(queue->buffer + start % queue->size);
+  header->event = event;
+  header->size = contents_size;
+  __atomic_store_n(&header->finished, 0, __ATOMIC_RELAXED);
+
+  // Give them the pointer to the space not the header.
+  return (void *)(header + 1);
 }
 
 /** @brief Turn blocks that have been commited into readable space for user
  *  level process.
  *
- *  REQUIRES the lock.
+ *  Every producer coalesces after committing.  Producers race to advance the
+ *  max_read position over finished headers, stopping at the first header that
+ *  is not committed.  The producer committing that header continues.
  *
  *  @param queue The queue to create readable space in.
  *  @return Void.
  */
 static inline void coalesce_readable(osquery_cqueue_t *queue) {
-  osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
-  osquery_between_t b;
-
-  while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
-                                       queue->write, sizeof(osquery_data_header_t)))) {
-    if (b & OSQUERY_NOT_IN_BUFFER || header->event == END_OF_BUFFER_EVENT) {
-      queue->max_read = queue->buffer;
-      header = (osquery_data_header_t *)queue->max_read;
-      continue;
-    } else if (!header->finished) {
-      break;
+  int advanced = 0;
+  uint64_t max_read = __atomic_load_n(&queue->max_read, __ATOMIC_SEQ_CST);
+  while (max_read != __atomic_load_n(&queue->write, __ATOMIC_ACQUIRE)) {
+    size_t offset = max_read % queue->size;
+    size_t space = queue->size - offset;
+
+    // Space too small for a header, or an end of buffer event, is skipped.
+    uint64_t next = max_read + space;
+    if (space >= sizeof(osquery_data_header_t)) {
+      osquery_data_header_t *header =
+          (osquery_data_header_t *)(queue->buffer + offset);
+      if (!__atomic_load_n(&header->finished, __ATOMIC_ACQUIRE)) {
+        break;
+      } else if (header->event != END_OF_BUFFER_EVENT) {
+        next = max_read + header->size + sizeof(osquery_data_header_t);
+      }
     }
 
-    queue->max_read = (uint8_t *)advance_pointer(
-        queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
+    // On failure max_read is set to the position another producer advanced.
+    if (__atomic_compare_exchange_n(&queue->max_read, &max_read, next, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      max_read = next;
+      advanced = 1;
+    }
+  }
 
-    header = (osquery_data_header_t *)queue->max_read;
+  if (advanced && __atomic_load_n(&queue->waiting, __ATOMIC_SEQ_CST)) {
+    lck_spin_lock(queue->lck);
     wakeup(&queue->max_read);
-
     lck_spin_unlock(queue->lck);
-    lck_spin_lock(queue->lck);
   }
 }
 
 int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
-  int err = 0;
-
-  lck_spin_lock(queue->lck);
-
   // Retrieve the header for the initialized space.
   osquery_data_header_t *header = ((osquery_data_header_t *)space) - 1;
-  if (OSQUERY_BETWEEN != is_between(queue, header, queue->max_read,
-                                    queue->write,
-                                    sizeof(osquery_data_header_t)) ||
-      queue->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
-      header->finished) {
-    err = -1;  // Invalid space.
-    goto error_exit;
+  if ((uint8_t *)header < queue->buffer ||
+      (uint8_t *)space > queue->buffer + queue->size ||
+      __atomic_load_n(&queue->reservations, __ATOMIC_SEQ_CST) == 0 ||
+      header->event == END_OF_BUFFER_EVENT || header->finished) {
+    return -1;  // Invalid space.
   }
 
-  header->finished = 1;
   clock_sec_t seconds;
   clock_usec_t microsecs;
   clock_get_calendar_microtime(&seconds, &microsecs);
   header->time.time = (uint64_t)seconds;
   clock_get_system_microtime(&seconds, &microsecs);
   header->time.uptime = (uint64_t)seconds;
+  __atomic_store_n(&header->finished, 1, __ATOMIC_SEQ_CST);
 
   coalesce_readable(queue);
 
-  queue->reservations--;
-  wakeup(&queue->reservations);
-error_exit:
-  lck_spin_unlock(queue->lck);
-  return err;
+  release_reservation(queue);
+  return 0;
 }
-
@@ -16,6 +16,11 @@
  *  For safety this queue on an error should log the error and reset to a known
  *  safe state possibly dropping all data in held within it.
  *
+ *  Many event callbacks may produce into the queue concurrently while a single
+ *  daemon consumes it.  Producers reserve and commit space with atomic
+ *  operations on the queue positions, the lock is only used to wake a blocked
+ *  reader and to setup and destroy the queue.
+ *
  */
 
 #pragma once
@@ -35,12 +40,19 @@ extern "C" {
 typedef struct {
   uint8_t *buffer;
   size_t size;
-  uint8_t *write;
-  uint8_t *max_read;
-  uint8_t *read;
+
+  // Positions are byte counts since the queue was initialized, the offset of
+  // a position within the buffer is the position modulo the buffer size.
+  // Space between read and write is reserved, and the committed space between
+  // read and max_read is readable by the user.
+  uint64_t write;
+  uint64_t max_read;
+  uint64_t read;
   int drops;
   int initialized;
   uint32_t reservations;
+  // Set while the reader is blocked waiting for data.
+  int waiting;
   clock_sec_t last_destruction_time;
 
   lck_grp_attr_t *lck_grp_attr;
@@ -73,6 +85,8 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue);
 /** @brief Initialize a circular queue.
  *
  *  Initializes a circular queue given a preallocated buffer of a given size.
+ *  The buffer must be zeroed, readable space is found by the finished flag of
+ *  each header and consumed space is zeroed again before it is reused.
  *
  *  @param queue The circular queue structure to initialize.
  *  @param buffer The buffer to use in the queue.
@@ -117,12 +131,12 @@ int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
  */
 ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
 
-/** @brief Returns if the cqueue has dropped data.
+/** @brief Returns the amount of data the cqueue has dropped.
  *
- *  Returns whether data has been dropped since the last call of this function.
+ *  Returns the number of events dropped since the last call of this function.
  *
  *  @param queue The cqueue to look for dropped data in.
- *  @return 0 for no data dropped 1 for dropped data.
+ *  @return The number of dropped events.  Negative due to an error.
  */
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
 
@@ -130,7 +144,8 @@ int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
  *
  *  This gives you a brief moment to write data to the returned space.
  *  NOTE: You must call the commit function on your pointer shortly after
- *  reserving it.  Otherwise the buffer will become deadlocked.
+ *  reserving it.  Otherwise the buffer will become deadlocked.  The queue must
+ *  be initialized with a zeroed buffer, see osquery_cqueue_init().
  *
  *  @param queue The queue to reserve space in.
  *  @param event The event type to reserve space for.
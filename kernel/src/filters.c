@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <libkern/libkern.h>
+#include <libkern/OSMalloc.h>
+
+#include <sys/errno.h>
+#include <sys/lock.h>
+#include <sys/systm.h>
+
+#include "filters.h"
+
+#define TAGNAME "com.facebook.security.osquery.filters"
+
+typedef struct {
+  uint32_t actions;
+
+  uint32_t prefix_count;
+
+  /// The length of each prefix, the packed prefixes follow in the allocation.
+  size_t *prefix_lengths;
+  char *prefixes;
+  size_t allocation_size;
+
+  uint32_t excluded_pid_count;
+  uint64_t excluded_pids[OSQUERY_FILTER_MAX_PIDS];
+
+  uint64_t delivered;
+  uint64_t filtered;
+} osquery_filter_t;
+
+static osquery_filter_t filters[OSQUERY_NUM_EVENTS];
+
+static OSMallocTag malloc_tag = NULL;
+
+static lck_grp_attr_t *lck_grp_attr = NULL;
+static lck_grp_t *lck_grp = NULL;
+static lck_attr_t *lck_attr = NULL;
+
+/// Publisher callbacks share the lock, setting a filter takes it exclusively.
+static lck_rw_t *lck = NULL;
+
+/** @brief Free a filter's prefixes and restore its defaults.
+ *
+ *  @param filter The filter, its lock must be held exclusively.
+ *  @param event The filter's event type.
+ *  @return Void.
+ */
+static void reset_filter(osquery_filter_t *filter, osquery_event_t event) {
+  if (filter->prefix_lengths != NULL) {
+    OSFree(filter->prefix_lengths, filter->allocation_size, malloc_tag);
+  }
+
+  bzero(filter, sizeof(osquery_filter_t));
+  filter->actions =
+      (event == OSQUERY_FILE_EVENT) ? 0 : OSQUERY_FILTER_ALL_ACTIONS;
+}
+
+void osquery_filters_setup() {
+  // Create locks. Cannot be done on the stack.
+  lck_grp_attr = lck_grp_attr_alloc_init();
+  lck_grp_attr_setstat(lck_grp_attr);
+  lck_grp = lck_grp_alloc_init("osquery filters", lck_grp_attr);
+  lck_attr = lck_attr_alloc_init();
+  lck = lck_rw_alloc_init(lck_grp, lck_attr);
+
+  malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
+
+  bzero(filters, sizeof(filters));
+  for (int i = 0; i < OSQUERY_NUM_EVENTS; i++) {
+    reset_filter(&filters[i], (osquery_event_t)i);
+  }
+}
+
+void osquery_filters_teardown() {
+  osquery_filters_reset();
+
+  lck_rw_free(lck, lck_grp);
+  lck_attr_free(lck_attr);
+  lck_grp_free(lck_grp);
+  lck_grp_attr_free(lck_grp_attr);
+  lck = NULL;
+
+  if (malloc_tag != NULL) {
+    OSMalloc_Tagfree(malloc_tag);
+    malloc_tag = NULL;
+  }
+}
+
+void osquery_filters_reset() {
+  lck_rw_lock_exclusive(lck);
+  for (int i = 0; i < OSQUERY_NUM_EVENTS; i++) {
+    reset_filter(&filters[i], (osquery_event_t)i);
+  }
+  lck_rw_unlock_exclusive(lck);
+}
+
+int osquery_filter_set(const osquery_filter_args_t *args) {
+  if (!(OSQUERY_NULL_EVENT < args->event && args->event < OSQUERY_NUM_EVENTS)) {
+    return -EINVAL;
+  }
+  if (args->excluded_pid_count > OSQUERY_FILTER_MAX_PIDS ||
+      args->prefixes_size > OSQUERY_FILTER_MAX_PREFIXES_SIZE ||
+      args->prefix_count > args->prefixes_size) {
+    return -EINVAL;
+  }
+
+  osquery_filter_t filter;
+  bzero(&filter, sizeof(filter));
+  filter.actions = args->actions;
+  filter.excluded_pid_count = args->excluded_pid_count;
+  memcpy(filter.excluded_pids,
+         args->excluded_pids,
+         sizeof(uint64_t) * args->excluded_pid_count);
+
+  if (args->prefix_count > 0) {
+    // Copy the prefixes and find their lengths while no lock is held.
+    filter.allocation_size =
+        sizeof(size_t) * args->prefix_count + args->prefixes_size;
+    filter.prefix_lengths = OSMalloc(filter.allocation_size, malloc_tag);
+    if (filter.prefix_lengths == NULL) {
+      return -ENOMEM;
+    }
+
+    filter.prefix_count = args->prefix_count;
+    filter.prefixes = (char *)(filter.prefix_lengths + args->prefix_count);
+    if (copyin((user_addr_t)args->prefixes,
+               filter.prefixes,
+               args->prefixes_size) != 0) {
+      OSFree(filter.prefix_lengths, filter.allocation_size, malloc_tag);
+      return -EFAULT;
+    }
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < args->prefix_count; i++) {
+      if (offset >= args->prefixes_size) {
+        OSFree(filter.prefix_lengths, filter.allocation_size, malloc_tag);
+        return -EINVAL;
+      }
+      size_t length =
+          strnlen(filter.prefixes + offset, args->prefixes_size - offset);
+      if (offset + length == args->prefixes_size) {
+        // Each prefix must be NUL-terminated.
+        OSFree(filter.prefix_lengths, filter.allocation_size, malloc_tag);
+        return -EINVAL;
+      }
+      filter.prefix_lengths[i] = length;
+      offset += length + 1;
+    }
+  }
+
+  lck_rw_lock_exclusive(lck);
+  osquery_filter_t *current = &filters[args->event];
+  // The counters continue across filter updates.
+  filter.delivered = current->delivered;
+  filter.filtered = current->filtered;
+  osquery_filter_t previous = *current;
+  *current = filter;
+  lck_rw_unlock_exclusive(lck);
+
+  if (previous.prefix_lengths != NULL) {
+    OSFree(previous.prefix_lengths, previous.allocation_size, malloc_tag);
+  }
+  return 0;
+}
+
+/** @brief Check an event against a filter.
+ *
+ *  @param filter The filter, its lock must be held.
+ *  @return Non-zero if the event matches.
+ */
+static int filter_matches(const osquery_filter_t *filter,
+                          uint32_t action,
+                          const char *path,
+                          pid_t pid) {
+  if ((filter->actions & action) == 0) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < filter->excluded_pid_count; i++) {
+    if (filter->excluded_pids[i] == (uint64_t)pid) {
+      return 0;
+    }
+  }
+
+  if (filter->prefix_count == 0) {
+    return 1;
+  }
+  if (path == NULL) {
+    return 0;
+  }
+
+  const char *prefix = filter->prefixes;
+  for (uint32_t i = 0; i < filter->prefix_count; i++) {
+    size_t length = filter->prefix_lengths[i];
+    if (strncmp(path, prefix, length) == 0) {
+      return 1;
+    }
+    prefix += length + 1;
+  }
+  return 0;
+}
+
+int osquery_filter_match(osquery_event_t event,
+                         uint32_t action,
+                         const char *path,
+                         pid_t pid) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return 0;
+  }
+
+  lck_rw_lock_shared(lck);
+  osquery_filter_t *filter = &filters[event];
+  int matches = filter_matches(filter, action, path, pid);
+  if (matches) {
+    __atomic_fetch_add(&filter->delivered, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_add(&filter->filtered, 1, __ATOMIC_RELAXED);
+  }
+  lck_rw_unlock_shared(lck);
+  return matches;
+}
+
+int osquery_filter_stats(osquery_filter_stats_args_t *stats) {
+  if (!(OSQUERY_NULL_EVENT < stats->event &&
+        stats->event < OSQUERY_NUM_EVENTS)) {
+    return -EINVAL;
+  }
+
+  lck_rw_lock_shared(lck);
+  stats->delivered =
+      __atomic_load_n(&filters[stats->event].delivered, __ATOMIC_RELAXED);
+  stats->filtered =
+      __atomic_load_n(&filters[stats->event].filtered, __ATOMIC_RELAXED);
+  lck_rw_unlock_shared(lck);
+  return 0;
+}
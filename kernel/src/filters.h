@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/** @brief Event filters evaluated by the kernel publishers.
+ *
+ *  Each event type has a filter set by the daemon from its subscriptions:
+ *  the delivered actions, path prefixes, and excluded processes. Publishers
+ *  ask the filter before reserving queue space, so discarded events cost
+ *  neither queue bandwidth nor drops.
+ *
+ *  Until the daemon sets a filter process events are all delivered and file
+ *  events are all discarded.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <feeds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Setup the filter locks and defaults.
+ *  @return Void.
+ */
+void osquery_filters_setup();
+
+/** @brief Free the filters and their locks.
+ *  Only called when no publisher callbacks may run.
+ *  @return Void.
+ */
+void osquery_filters_teardown();
+
+/** @brief Restore the default filters and reset their counters.
+ *  @return Void.
+ */
+void osquery_filters_reset();
+
+/** @brief Replace the filter of an event type.
+ *  The packed prefixes are copied in from the daemon's address space.
+ *  @param args The filter, see osquery_filter_args_t.
+ *  @return 0 on success, negative on failure.
+ */
+int osquery_filter_set(const osquery_filter_args_t *args);
+
+/** @brief Check if a publisher may queue an event, and count it.
+ *  @param event The event type.
+ *  @param action The event's action, or OSQUERY_FILTER_ALL_ACTIONS.
+ *  @param path The event's path, or NULL if it has none.
+ *  @param pid The process causing the event.
+ *  @return Non-zero if the event should be queued.
+ */
+int osquery_filter_match(osquery_event_t event,
+                         uint32_t action,
+                         const char *path,
+                         pid_t pid);
+
+/** @brief Read the delivered and filtered counts of an event type.
+ *  @param stats (Input and output) The event type and its counts.
+ *  @return 0 on success, negative on failure.
+ */
+int osquery_filter_stats(osquery_filter_stats_args_t *stats);
+
+#ifdef __cplusplus
+} // end extern "c"
+#endif
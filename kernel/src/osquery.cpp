@@ -24,6 +24,7 @@
 #include "publishers.h"
 
 #include "circular_queue_kern.h"
+#include "filters.h"
 
 #ifdef DEBUG
 #define dbg_printf(...) printf("osquery kext: " __VA_ARGS__)
@@ -250,6 +251,8 @@ static int osquery_close(dev_t dev, int flag, int fmt, struct proc *p) {
   if (osquery.open_count == 1) {
     unsubscribe_all_events();
     cleanup_user_kernel_buffer();
+    // The next daemon sets its own filters.
+    osquery_filters_reset();
     osquery.open_count--;
   }
   lck_mtx_unlock(osquery.mtx);
@@ -303,6 +306,7 @@ static int osquery_ioctl(
   osquery_subscription_args_t *sub = NULL;
   osquery_buf_sync_args_t *sync = NULL;
   osquery_buf_allocate_args_t *alloc = NULL;
+  osquery_filter_args_t *filter = NULL;
 
   // All control should be from a single daemon.
   // Wrap all IOCTL API handling in locks to guarantee proper use.
@@ -316,6 +320,21 @@ static int osquery_ioctl(
     }
     break;
 
+  // Daemon is setting the events an event type delivers.
+  case OSQUERY_IOCTL_FILTER:
+    filter = (osquery_filter_args_t *)data;
+    if ((err = osquery_filter_set(filter))) {
+      goto error_exit;
+    }
+    break;
+
+  // Daemon is requesting the delivered and filtered counts of an event type.
+  case OSQUERY_IOCTL_FILTER_STATS:
+    if ((err = osquery_filter_stats((osquery_filter_stats_args_t *)data))) {
+      goto error_exit;
+    }
+    break;
+
   // Daemon is requesting a synchronization of readable queue space.
   case OSQUERY_IOCTL_BUF_SYNC:
     // The queue buffer cannot be synchronized if it has not been allocated.
@@ -399,6 +418,9 @@ kern_return_t OsqueryStart(kmod_info_t *ki, void *d) {
   // This does not allocate, share, or set the queue buffer or buffer values.
   osquery_cqueue_setup(&osquery.cqueue);
 
+  // Setup the event filters, used by publishers before reserving queue space.
+  osquery_filters_setup();
+
   // Initialize the IOCTL (and more) device node.
   osquery.major_number = cdevsw_add(osquery.major_number, &osquery_cdevsw);
   if (osquery.major_number < 0) {
@@ -439,6 +461,7 @@ error_exit:
 
   // Reset the queue and remove the queue locks.
   osquery_cqueue_teardown(&osquery.cqueue);
+  osquery_filters_teardown();
   return KERN_FAILURE;
 }
 
@@ -473,6 +496,9 @@ kern_return_t OsqueryStop(kmod_info_t *ki, void *d) {
   lck_mtx_unlock(osquery.mtx);
   teardown_locks();
 
+  // Publishers were unsubscribed when the last daemon closed.
+  osquery_filters_teardown();
+
   return KERN_SUCCESS;
 }
 
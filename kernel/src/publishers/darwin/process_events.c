@@ -18,6 +18,7 @@
 #include <security/mac_policy.h>
 
 #include "publishers.h"
+#include "filters.h"
 
 static osquery_cqueue_t *cqueue = NULL;
 
@@ -54,6 +55,14 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
     goto error_exit;
   }
 
+  // Process filters exclude processes, the executed paths are not matched.
+  if (!osquery_filter_match(OSQUERY_PROCESS_EVENT,
+                            OSQUERY_FILTER_ALL_ACTIONS,
+                            NULL,
+                            proc_pid(p))) {
+    goto error_exit;
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -155,7 +164,8 @@ static struct mac_policy_conf policy_conf = {
 static int subscribe(osquery_cqueue_t *queue) {
   cqueue = queue;
   if (handle != 0) {
-    return -1;
+    // Already subscribed, the daemon may reconfigure its filter.
+    return 0;
   }
 
   mac_policy_register(&policy_conf, &handle, NULL);
@@ -51,6 +51,28 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// A column constraint operator and its expression.
+struct InternalConstraint {
+  1:i32 op,
+  2:string expr,
+}
+
+/// The constraints applied to a column, and the column type affinity.
+struct InternalConstraintList {
+  1:string name,
+  2:string affinity,
+  3:list<InternalConstraint> constraints,
+}
+
+/// The thrift-equivilent of the osquery::QueryContext given to a table.
+struct InternalQueryContext {
+  1:list<InternalConstraintList> constraints,
+  2:optional list<string> colsUsed,
+  3:optional i64 limit,
+  4:optional string orderBy,
+  5:bool orderDescending,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -68,6 +90,11 @@ service Extension {
     2:string item,
     /// The thrift-equivilent of an osquery::PluginRequest.
     3:ExtensionPluginRequest request),
+  /// Generate the rows of a table plugin for a query context.
+  ExtensionResponse generate(
+    /// The table plugin name.
+    1:string table,
+    2:InternalQueryContext context),
   /// Request that an extension shutdown (does not apply to managers).
   void shutdown(),
 }
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/config.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/**
+ * @brief Generate config content with a schedule and a pack of queries.
+ *
+ * The content has the comments of a hand-written config. Content of
+ * different generations differs by its query intervals.
+ */
+static std::string genConfig(size_t count, size_t generation) {
+  std::string content =
+      "# A synthetic config\n"
+      "{\n"
+      "  \"options\": {\"host_identifier\": \"hostname\"},\n"
+      "  // Queries of the main pack\n"
+      "  \"schedule\": {\n";
+
+  auto interval = std::to_string(3600 + generation);
+  auto genQuery = [&interval](const std::string& name, size_t i) {
+    auto id = std::to_string(i);
+    return "    \"" + name + "_" + id + "\": {\"query\": \"select * from " +
+           "processes where name = 'synthetic_" + id + "'\", \"interval\": " +
+           interval + ", \"description\": \"A synthetic query\\u002e\"}";
+  };
+
+  for (size_t i = 0; i < count; i++) {
+    content += genQuery("schedule", i) + ((i + 1 < count) ? ",\n" : "\n");
+  }
+  content += "  },\n  \"packs\": {\n    \"synthetic\": {\"queries\": {\n";
+  for (size_t i = 0; i < count; i++) {
+    content += genQuery("pack", i) + ((i + 1 < count) ? ",\n" : "\n");
+  }
+  content +=
+      "    }}\n  },\n"
+      "  \"file_paths\": {\"homes\": [\"/home/%/.ssh/%%\"]}\n"
+      "}\n";
+  return content;
+}
+
+/// Parse content as the config did: strip comments, copy, and read_json.
+static void CONFIG_parse_read_json(benchmark::State& state) {
+  auto content = genConfig(state.range_x(), 0);
+  while (state.KeepRunning()) {
+    auto clone = content;
+    stripConfigComments(clone);
+    std::stringstream json_stream;
+    json_stream << clone;
+    pt::ptree tree;
+    pt::read_json(json_stream, tree);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+  state.SetLabel("bytes=" + std::to_string(content.size()));
+}
+
+BENCHMARK(CONFIG_parse_read_json)->Arg(100)->Arg(10000);
+
+/// Parse content in place into a property tree, skipping comments.
+static void CONFIG_parse_tree(benchmark::State& state) {
+  auto content = genConfig(state.range_x(), 0);
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    parseJSONTree(content, tree, true);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+  state.SetLabel("bytes=" + std::to_string(content.size()));
+}
+
+BENCHMARK(CONFIG_parse_tree)->Arg(100)->Arg(10000);
+
+/// Parse content with a handler that keeps nothing.
+static void CONFIG_parse_events(benchmark::State& state) {
+  auto content = genConfig(state.range_x(), 0);
+  while (state.KeepRunning()) {
+    JSONHandler handler;
+    parseJSONEvents(content, handler, true);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+  state.SetLabel("bytes=" + std::to_string(content.size()));
+}
+
+BENCHMARK(CONFIG_parse_events)->Arg(100)->Arg(10000);
+
+/// Update the config with alternating content, from parsing to the schedule.
+static void CONFIG_update(benchmark::State& state) {
+  std::vector<std::string> generations = {
+      genConfig(state.range_x(), 0), genConfig(state.range_x(), 1),
+  };
+
+  size_t generation = 0;
+  while (state.KeepRunning()) {
+    Config::getInstance().update(
+        {{"config_benchmark", generations[generation++ % 2]}});
+  }
+  Config::getInstance().update({{"config_benchmark", "{}"}});
+  state.SetBytesProcessed(state.iterations() * generations[0].size());
+}
+
+BENCHMARK(CONFIG_update)->Arg(100)->Arg(10000);
+}
@@ -28,6 +28,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/database/query.h"
 
 namespace pt = boost::property_tree;
 
@@ -66,6 +67,26 @@ CLI_FLAG(uint64,
          0,
          "Optional interval in seconds to re-read configuration");
 
+CLI_FLAG(bool,
+         config_fast_start,
+         false,
+         "Start from the last good config while the config plugin loads");
+
+FLAG(uint64,
+     schedule_wall_budget,
+     0,
+     "Milliseconds of wall time a scheduled query may take (0 = unlimited)");
+
+FLAG(uint64,
+     schedule_cpu_budget,
+     0,
+     "Milliseconds of CPU time a scheduled query may use (0 = unlimited)");
+
+FLAG(uint64,
+     schedule_budget_overruns,
+     3,
+     "Consecutive over-budget executions before a query is blacklisted");
+
 DECLARE_string(config_plugin);
 DECLARE_string(pack_delimiter);
 
@@ -79,6 +100,12 @@ DECLARE_string(pack_delimiter);
 const std::string kExecutingQuery{"executing_query"};
 const std::string kFailedQueries{"failed_queries"};
 
+/// The backing store key of the last good config, see --config_fast_start.
+const std::string kConfigSnapshot{"config_snapshot"};
+
+/// Seconds a failed or over-budget query is removed from the schedule.
+const size_t kBlacklistDuration{86400};
+
 // The config may be accessed and updated asynchronously; use mutexes.
 Mutex config_hash_mutex_;
 Mutex config_valid_mutex_;
@@ -145,10 +172,11 @@ class Schedule : private boost::noncopyable {
     });
   }
 
-  /// Remove all packs by source.
-  void removeAll(const std::string& source) {
-    packs_.remove_if(([source](PackRef& p) {
-      if (p->getSource() == source) {
+  /// Remove all packs by source, except the named packs to keep.
+  void removeAll(const std::string& source,
+                 const std::set<std::string>& keep = {}) {
+    packs_.remove_if(([&source, &keep](PackRef& p) {
+      if (p->getSource() == source && keep.count(p->getName()) == 0) {
         Config::getInstance().removeFiles(source + FLAGS_pack_delimiter +
                                           p->getName());
         return true;
@@ -172,6 +200,16 @@ class Schedule : private boost::noncopyable {
     return packs_.back();
   }
 
+  /// Check if a pack from a source is in the schedule.
+  bool exists(const std::string& pack, const std::string& source) const {
+    for (const auto& p : packs_) {
+      if (p->getName() == pack && p->getSource() == source) {
+        return true;
+      }
+    }
+    return false;
+  }
+
  private:
   /// Underlying storage for the packs
   container packs_;
@@ -242,7 +280,7 @@ Schedule::Schedule() {
     LOG(WARNING) << "Scheduled query may have failed: " << failed_query_;
     setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
     // Add this query name to the blacklist and save the blacklist.
-    blacklist_[failed_query_] = getUnixTime() + 86400;
+    blacklist_[failed_query_] = getUnixTime() + kBlacklistDuration;
     saveScheduleBlacklist(blacklist_);
   }
 }
@@ -260,6 +298,7 @@ void Config::addPack(const std::string& name,
     RecursiveLock wlock(config_schedule_mutex_);
     try {
       schedule_->add(std::make_shared<Pack>(pack_name, source, pack_tree));
+      scheduleChanged();
       if (schedule_->last()->shouldPackExecute()) {
         applyParsers(
             source + FLAGS_pack_delimiter + pack_name, pack_tree, true);
@@ -281,9 +320,56 @@ void Config::addPack(const std::string& name,
   }
 }
 
+/// Hash a property tree by its serialized content.
+static std::string hashTree(const pt::ptree& tree) {
+  std::stringstream ss;
+  try {
+    pt::write_json(ss, tree, false);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return "";
+  }
+  auto content = ss.str();
+  return getBufferSHA1(content.c_str(), content.size());
+}
+
+bool Config::packChanged(const std::string& name,
+                         const std::string& source,
+                         const std::string& hash) {
+  RecursiveLock lock(config_schedule_mutex_);
+  updated_packs_[source].insert(name);
+  auto& previous = pack_hashes_[source][name];
+  if (!hash.empty() && previous == hash && schedule_->exists(name, source)) {
+    return false;
+  }
+  previous = hash;
+  return true;
+}
+
+void Config::updatePack(const std::string& name,
+                        const std::string& source,
+                        const pt::ptree& tree) {
+  if (packChanged(name, source, hashTree(tree))) {
+    addPack(name, source, tree);
+  }
+}
+
 void Config::removePack(const std::string& pack) {
   RecursiveLock wlock(config_schedule_mutex_);
-  return schedule_->remove(pack);
+  schedule_->remove(pack);
+  scheduleChanged();
+}
+
+void Config::setScheduleObserver(std::function<void()> observer) {
+  RecursiveLock lock(config_schedule_mutex_);
+  schedule_observer_ = std::move(observer);
+}
+
+void Config::scheduleChanged() {
+  RecursiveLock lock(config_schedule_mutex_);
+  schedule_generation_++;
+  if (schedule_observer_ != nullptr) {
+    schedule_observer_();
+  }
 }
 
 void Config::addFile(const std::string& source,
@@ -337,9 +423,30 @@ void Config::packs(std::function<void(PackRef& pack)> predicate) {
   }
 }
 
+/// The active config plugin, nullptr if it is an extension's.
+static std::shared_ptr<ConfigPlugin> getLocalConfigPlugin() {
+  auto& rf = RegistryFactory::get();
+  return rf.localPlugin<ConfigPlugin>("config", rf.getActive("config"));
+}
+
+/// Call the active config plugin within this process.
+static Status callLocalConfigPlugin(const std::function<Status()>& call) {
+  return RegistryFactory::callLocal(
+      "config", RegistryFactory::get().getActive("config"), call);
+}
+
 Status Config::refresh() {
+  // Plugins within the process are called without a PluginRequest.
   PluginResponse response;
-  auto status = Registry::call("config", {{"action", "genConfig"}}, response);
+  Status status;
+  auto plugin = getLocalConfigPlugin();
+  if (plugin != nullptr) {
+    response.resize(1);
+    status = callLocalConfigPlugin(
+        [&plugin, &response]() { return plugin->genConfig(response[0]); });
+  } else {
+    status = Registry::call("config", {{"action", "genConfig"}}, response);
+  }
   if (!status.ok()) {
     loaded_ = true;
     return status;
@@ -360,6 +467,9 @@ Status Config::refresh() {
       Initializer::requestShutdown();
     }
     status = update(response[0]);
+    if (status.ok() && FLAGS_config_fast_start) {
+      saveSnapshot(response[0]);
+    }
 
     /*
      * If the initial configuration includes a non-0 refresh, start an
@@ -367,7 +477,7 @@ Status Config::refresh() {
      * configuration.
      */
     if (!started_thread_ && FLAGS_config_refresh >= 1) {
-      Dispatcher::addService(std::make_shared<ConfigRefreshRunner>());
+      Dispatcher::addPeriodicService(std::make_shared<ConfigRefreshRunner>());
       started_thread_ = true;
     }
   }
@@ -383,9 +493,69 @@ Status Config::load() {
     return Status(1, "Missing config plugin " + config_plugin);
   }
 
+  // Schedule from the last good config, the config plugin is read later.
+  if (FLAGS_config_fast_start && !FLAGS_config_check && !FLAGS_config_dump &&
+      loadSnapshot().ok()) {
+    Dispatcher::addService(std::make_shared<ConfigLoadRunner>());
+    return Status(0, "OK");
+  }
+
   return refresh();
 }
 
+void Config::saveSnapshot(const std::map<std::string, std::string>& config) {
+  // Only a changed config is written.
+  std::string hash;
+  if (!genHash(hash).ok() || hash == snapshot_hash_) {
+    return;
+  }
+
+  std::string json = "{";
+  for (const auto& source : config) {
+    if (json.size() > 1) {
+      json += ',';
+    }
+    writeJSONString(source.first, json);
+    json += ':';
+    writeJSONString(source.second, json);
+  }
+  json += '}';
+  if (setDatabaseValue(kPersistentSettings, kConfigSnapshot, json).ok()) {
+    snapshot_hash_ = hash;
+  }
+}
+
+Status Config::loadSnapshot() {
+  std::string json;
+  if (!getDatabaseValue(kPersistentSettings, kConfigSnapshot, json).ok() ||
+      json.empty()) {
+    return Status(1, "No config snapshot");
+  }
+
+  std::map<std::string, std::string> config;
+  {
+    pt::ptree tree;
+    if (!parseJSONTree(json, tree).ok()) {
+      return Status(1, "Cannot parse the config snapshot");
+    }
+    for (auto& source : tree) {
+      config[source.first] = std::move(source.second.data());
+    }
+  }
+
+  auto status = update(config);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The config plugin update that follows reconfigures every plugin.
+  VLOG(1) << "Started from the config snapshot";
+  valid_ = true;
+  loaded_ = true;
+  genHash(snapshot_hash_);
+  return Status(0, "OK");
+}
+
 void stripConfigComments(std::string& json) {
   std::string sink;
 
@@ -406,25 +576,40 @@ void stripConfigComments(std::string& json) {
 Status Config::updateSource(const std::string& source,
                             const std::string& json) {
   // Compute a 'synthesized' hash using the content before it is parsed.
-  hashSource(source, json);
+  auto hash = getBufferSHA1(json.c_str(), json.size());
+  {
+    WriteLock wlock(config_hash_mutex_);
+    hash_[source] = hash;
+  }
 
   {
     RecursiveLock lock(config_schedule_mutex_);
-    // Remove all packs from this source.
-    schedule_->removeAll(source);
-    // Remove all files from this source.
-    removeFiles(source);
+    // Unchanged content is not parsed again if its packs are still scheduled.
+    auto applied = applied_hash_.find(source);
+    if (applied != applied_hash_.end() && applied->second == hash) {
+      bool scheduled = true;
+      for (const auto& pack : pack_hashes_[source]) {
+        scheduled = scheduled && schedule_->exists(pack.first, source);
+      }
+      if (scheduled) {
+        return Status(0, "OK");
+      }
+    }
+    applied_hash_.erase(source);
+    updated_packs_[source].clear();
   }
 
-  // load the config (source.second) into a pt::ptree
+  // Parse the content in place, skipping its comments.
   pt::ptree tree;
-  try {
-    auto clone = json;
-    stripConfigComments(clone);
-    std::stringstream json_stream;
-    json_stream << clone;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!parseJSONTree(json, tree, true).ok()) {
+    RecursiveLock lock(config_schedule_mutex_);
+    // Remove all packs and files from this source.
+    schedule_->removeAll(source);
+    scheduleChanged();
+    removeFiles(source);
+    pack_hashes_.erase(source);
+    parser_hashes_.erase(source);
+    updated_packs_.erase(source);
     return Status(1, "Error parsing the config JSON");
   }
 
@@ -434,7 +619,7 @@ Status Config::updateSource(const std::string& source,
     auto& schedule = tree.get_child("schedule");
     pt::ptree main_pack;
     main_pack.add_child("queries", schedule);
-    addPack("main", source, main_pack);
+    updatePack("main", source, main_pack);
   }
 
   if (tree.count("scheduledQueries") > 0 && !rf.external()) {
@@ -449,7 +634,7 @@ Status Config::updateSource(const std::string& source,
     }
     pt::ptree legacy_pack;
     legacy_pack.add_child("queries", queries);
-    addPack("legacy_main", source, legacy_pack);
+    updatePack("legacy_main", source, legacy_pack);
   }
 
   // extract the "packs" key into additional pack objects
@@ -459,14 +644,30 @@ Status Config::updateSource(const std::string& source,
       auto value = packs.get<std::string>(pack.first, "");
       if (value.empty()) {
         // The pack is a JSON object, treat the content as pack data.
-        addPack(pack.first, source, pack.second);
+        updatePack(pack.first, source, pack.second);
       } else {
         genPack(pack.first, source, value);
       }
     }
   }
 
+  {
+    // Remove packs no longer in this source, unchanged packs are kept.
+    RecursiveLock lock(config_schedule_mutex_);
+    auto& updated = updated_packs_[source];
+    schedule_->removeAll(source, updated);
+    scheduleChanged();
+    auto& hashes = pack_hashes_[source];
+    for (auto it = hashes.begin(); it != hashes.end();) {
+      it = (updated.count(it->first) == 0) ? hashes.erase(it) : ++it;
+    }
+    updated_packs_.erase(source);
+  }
+
   applyParsers(source, tree, false);
+
+  RecursiveLock lock(config_schedule_mutex_);
+  applied_hash_[source] = hash;
   return Status(0, "OK");
 }
 
@@ -476,24 +677,40 @@ Status Config::genPack(const std::string& name,
   // If the pack value is a string (and not a JSON object) then it is a
   // resource to be handled by the config plugin.
   PluginResponse response;
-  PluginRequest request = {
-      {"action", "genPack"}, {"name", name}, {"value", target}};
-  Registry::call("config", request, response);
+  auto plugin = getLocalConfigPlugin();
+  if (plugin != nullptr) {
+    response.push_back({{name, ""}});
+    callLocalConfigPlugin([&]() {
+      return plugin->genPack(name, target, response[0][name]);
+    });
+  } else {
+    PluginRequest request = {
+        {"action", "genPack"}, {"name", name}, {"value", target}};
+    Registry::call("config", request, response);
+  }
 
   if (response.size() == 0 || response[0].count(name) == 0) {
     return Status(1, "Invalid plugin response");
   }
 
-  try {
-    auto clone = response[0][name];
-    stripConfigComments(clone);
-    pt::ptree pack_tree;
-    std::stringstream pack_stream;
-    pack_stream << clone;
-    pt::read_json(pack_stream, pack_tree);
-    addPack(name, source, pack_tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  // A single pack with unchanged content is not parsed again.
+  auto& content = response[0][name];
+  if (name != "*" &&
+      !packChanged(
+          name, source, getBufferSHA1(content.c_str(), content.size()))) {
+    return Status(0);
+  }
+
+  pt::ptree pack_tree;
+  if (!parseJSONTree(content, pack_tree, true).ok()) {
     LOG(WARNING) << "Error parsing the pack JSON: " << name;
+  } else if (name != "*") {
+    addPack(name, source, pack_tree);
+  } else {
+    // Each pack of a multi-pack is compared to its previous content.
+    for (const auto& pack : pack_tree) {
+      updatePack(pack.first, source, pack.second);
+    }
   }
   return Status(0);
 }
@@ -516,12 +733,24 @@ void Config::applyParsers(const std::string& source,
 
     // For each key requested by the parser, add a property tree reference.
     std::map<std::string, pt::ptree> parser_config;
+    std::string content;
     for (const auto& key : parser->keys()) {
       if (tree.count(key) > 0) {
         parser_config[key] = tree.get_child(key);
       } else {
         parser_config[key] = pt::ptree();
       }
+      content += key + ":" + hashTree(parser_config[key]);
+    }
+
+    if (!pack) {
+      // A source's parser is not updated again with unchanged keys.
+      auto hash = getBufferSHA1(content.c_str(), content.size());
+      auto& applied = parser_hashes_[source][plugin.first];
+      if (applied == hash) {
+        continue;
+      }
+      applied = hash;
     }
     // The config parser plugin will receive a copy of each property tree for
     // each top-level-config key. The parser may choose to update the config's
@@ -554,12 +783,18 @@ Status Config::update(const std::map<std::string, std::string>& config) {
   // Before this occurs, take an opportunity to purge stale state.
   purge();
 
+  // A changed schedule evaluates pack discovery queries again.
+  size_t generation = schedule_generation_;
   for (const auto& source : config) {
     auto status = updateSource(source.first, source.second);
     if (!status.ok()) {
+      Pack::invalidateDiscovery();
       return status;
     }
   }
+  if (generation != schedule_generation_) {
+    Pack::invalidateDiscovery();
+  }
 
   if (loaded_) {
     // The config has since been loaded.
@@ -625,7 +860,7 @@ void Config::purge() {
 
     if (last_executed < getUnixTime() - 592200) {
       // Query has not run in the last week, expire results and interval.
-      deleteDatabaseValue(kQueries, saved_query);
+      Query::deleteStoredResults(saved_query);
       deleteDatabaseValue(kPersistentSettings, "interval." + saved_query);
       deleteDatabaseValue(kPersistentSettings, "timestamp." + saved_query);
       VLOG(1) << "Expiring results for scheduled query: " << saved_query;
@@ -635,9 +870,15 @@ void Config::purge() {
 
 void Config::reset() {
   schedule_ = std::make_shared<Schedule>();
+  scheduleChanged();
   std::map<std::string, QueryPerformance>().swap(performance_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
+  applied_hash_.clear();
+  pack_hashes_.clear();
+  updated_packs_.clear();
+  parser_hashes_.clear();
+  snapshot_hash_.clear();
   valid_ = false;
   loaded_ = false;
   start_time_ = 0;
@@ -664,52 +905,122 @@ void ConfigParserPlugin::reset() {
   }
 }
 
-void Config::recordQueryPerformance(const std::string& name,
-                                    size_t delay,
-                                    size_t size,
-                                    const Row& r0,
-                                    const Row& r1) {
-  RecursiveLock lock(config_performance_mutex_);
-  if (performance_.count(name) == 0) {
-    performance_[name] = QueryPerformance();
+/**
+ * @brief Add one execution's resource usage to a query's performance.
+ *
+ * @return true if the query should be blacklisted for exceeding its budget.
+ */
+static bool recordPerformance(QueryPerformance& query,
+                              size_t size,
+                              const ResourceUsage& r0,
+                              const ResourceUsage& r1) {
+  unsigned long long int cpu = 0;
+  if (r1.user_time > r0.user_time) {
+    query.user_time += r1.user_time - r0.user_time;
+    cpu += r1.user_time - r0.user_time;
   }
 
-  // Grab access to the non-const schedule item.
-  auto& query = performance_.at(name);
-  BIGINT_LITERAL diff = 0;
-  if (!r1.at("user_time").empty() && !r0.at("user_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-    if (diff > 0) {
-      query.user_time += diff;
-    }
+  if (r1.system_time > r0.system_time) {
+    query.system_time += r1.system_time - r0.system_time;
+    cpu += r1.system_time - r0.system_time;
   }
 
-  if (!r1.at("system_time").empty() && !r0.at("system_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-    if (diff > 0) {
-      query.system_time += diff;
-    }
+  if (r1.memory > r0.memory) {
+    // Memory is stored as an average of heap changes between query executions.
+    auto diff = r1.memory - r0.memory;
+    query.average_memory = (query.average_memory * query.executions) + diff;
+    query.average_memory = (query.average_memory / (query.executions + 1));
   }
 
-  if (!r1.at("resident_size").empty() && !r0.at("resident_size").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-    if (diff > 0) {
-      // Memory is stored as an average of RSS changes between query executions.
-      query.average_memory = (query.average_memory * query.executions) + diff;
-      query.average_memory = (query.average_memory / (query.executions + 1));
+  // Counters are 0 in both samples when they are unavailable.
+  auto counter = ([](unsigned long long int& total,
+                     unsigned long long int c0,
+                     unsigned long long int c1) {
+    if (c1 > c0) {
+      total += c1 - c0;
     }
+  });
+  counter(query.context_switches, r0.context_switches, r1.context_switches);
+  counter(query.major_faults, r0.major_faults, r1.major_faults);
+  counter(query.cycles, r0.cycles, r1.cycles);
+  counter(query.instructions, r0.instructions, r1.instructions);
+  counter(query.cache_misses, r0.cache_misses, r1.cache_misses);
+
+  unsigned long long int wall = 0;
+  if (r1.wall_time > r0.wall_time) {
+    wall = r1.wall_time - r0.wall_time;
+    query.wall_time += wall;
   }
-
-  query.wall_time += delay;
   query.output_size += size;
   query.executions += 1;
   query.last_executed = getUnixTime();
 
+  if ((FLAGS_schedule_wall_budget > 0 && wall > FLAGS_schedule_wall_budget) ||
+      (FLAGS_schedule_cpu_budget > 0 && cpu > FLAGS_schedule_cpu_budget)) {
+    query.overruns += 1;
+  } else {
+    query.overruns = 0;
+  }
+
+  if (FLAGS_schedule_budget_overruns > 0 &&
+      query.overruns >= FLAGS_schedule_budget_overruns) {
+    query.overruns = 0;
+    return true;
+  }
+  return false;
+}
+
+void Config::recordQueryPerformance(const std::string& name,
+                                    size_t size,
+                                    const ResourceUsage& r0,
+                                    const ResourceUsage& r1) {
+  bool blacklist = false;
+  {
+    RecursiveLock lock(config_performance_mutex_);
+    blacklist = recordPerformance(performance_[name], size, r0, r1);
+  }
+
   // Clear the executing query (remove the dirty bit).
   setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
+
+  // The schedule lock is taken without holding the performance lock, as the
+  // scheduler holds the schedule lock while executing queries.
+  if (blacklist) {
+    LOG(WARNING) << "Scheduled query exceeded its budget "
+                 << FLAGS_schedule_budget_overruns
+                 << " consecutive times and is blacklisted: " << name;
+    blacklistQuery(name, kBlacklistDuration);
+  }
+}
+
+void Config::blacklistQuery(const std::string& name, size_t duration) {
+  RecursiveLock lock(config_schedule_mutex_);
+  schedule_->blacklist_[name] = getUnixTime() + duration;
+  saveScheduleBlacklist(schedule_->blacklist_);
+  scheduleChanged();
+}
+
+void Config::recordQuerySharedScans(const std::string& name,
+                                    size_t hits,
+                                    size_t misses) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  query.shared_hits += hits;
+  query.shared_misses += misses;
+}
+
+void Config::recordQueryDeduplicated(const std::string& name) {
+  {
+    RecursiveLock lock(config_performance_mutex_);
+    performance_[name].deduplicated++;
+  }
+  setDatabaseValue(
+      kPersistentSettings, "timestamp." + name, std::to_string(getUnixTime()));
+}
+
+void Config::recordQueryAborted(const std::string& name) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].aborted++;
 }
 
 void Config::recordQueryStart(const std::string& name) {
@@ -822,19 +1133,21 @@ Status ConfigParserPlugin::setUp() {
   return Status(0, "OK");
 }
 
-void ConfigRefreshRunner::start() {
-  while (!interrupted()) {
-    // Cool off and time wait the configured period.
-    // Apply this interruption initially as at t=0 the config was read.
-    pauseMilli(FLAGS_config_refresh * 1000);
-    // Since the pause occurs before the logic, we need to check for an
-    // interruption request.
-    if (interrupted()) {
-      return;
-    }
-
-    VLOG(1) << "Refreshing configuration state";
-    Config::getInstance().refresh();
+void ConfigLoadRunner::start() {
+  auto status = Config::getInstance().refresh();
+  if (!status.ok()) {
+    LOG(WARNING) << "Error reading config, using the config snapshot: "
+                 << status.toString();
   }
 }
+
+bool ConfigRefreshRunner::run() {
+  VLOG(1) << "Refreshing configuration state";
+  Config::getInstance().refresh();
+  return true;
+}
+
+std::chrono::milliseconds ConfigRefreshRunner::interval() {
+  return std::chrono::seconds(FLAGS_config_refresh);
+}
 }
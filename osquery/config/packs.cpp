@@ -9,6 +9,8 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <map>
 #include <random>
 
 #include <osquery/core.h>
@@ -33,6 +35,11 @@ FLAG(string, pack_delimiter, "_", "Delimiter for pack and query names");
 
 FLAG(uint64, schedule_splay_percent, 10, "Percent to splay config times");
 
+FLAG(bool,
+     schedule_packing,
+     false,
+     "Offset scheduled queries by their cost instead of splaying intervals");
+
 FLAG(uint64,
      schedule_default_interval,
      3600,
@@ -40,6 +47,21 @@ FLAG(uint64,
 
 size_t kMaxQueryInterval = 604800;
 
+/// A discovery query result shared by every pack using the query.
+struct DiscoveryResult {
+  size_t time{0};
+  bool result{false};
+};
+
+/// Discovery results by query, see Pack::checkDiscovery.
+static std::map<std::string, DiscoveryResult> kDiscoveryResults;
+
+/// Protect access to the shared discovery results.
+static Mutex kDiscoveryResultsMutex;
+
+/// Incremented to invalidate the discovery results cached by each pack.
+static std::atomic<size_t> kDiscoveryGeneration{1};
+
 size_t splayValue(size_t original, size_t splayPercent) {
   if (splayPercent == 0 || splayPercent > 100) {
     return original;
@@ -191,9 +213,17 @@ void Pack::initialize(const std::string& name,
       continue;
     }
 
-    query.splayed_interval = restoreSplayedValue(q.first, query.interval);
+    // Packing offsets queries at their exact interval, see the scheduler.
+    query.splayed_interval = (FLAGS_schedule_packing)
+                                 ? query.interval
+                                 : restoreSplayedValue(q.first, query.interval);
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
+    query.options["exclusive"] = q.second.get<bool>("exclusive", false);
+    query.options["incremental"] = q.second.get<bool>("incremental", false);
+    query.options["continuous"] = q.second.get<bool>("continuous", false);
+    query.wall_limit = q.second.get<size_t>("wall_limit", 0);
+    query.cpu_limit = q.second.get<size_t>("cpu_limit", 0);
     schedule_[q.first] = query;
   }
 }
@@ -271,10 +301,42 @@ bool Pack::checkVersion(const std::string& version) const {
   return versionAtLeast(version, kSDKVersion);
 }
 
+/// Run a discovery query, or use the result of a recent identical query.
+static bool runDiscoveryQuery(const std::string& query, size_t current) {
+  {
+    ReadLock lock(kDiscoveryResultsMutex);
+    auto cached = kDiscoveryResults.find(query);
+    if (cached != kDiscoveryResults.end() &&
+        (current - cached->second.time) < FLAGS_pack_refresh_interval) {
+      return cached->second.result;
+    }
+  }
+
+  SQL results(query);
+  if (!results.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << results.getMessageString();
+  }
+
+  WriteLock lock(kDiscoveryResultsMutex);
+  auto& cached = kDiscoveryResults[query];
+  cached.time = current;
+  cached.result = (results.ok() && results.rows().size() > 0);
+  return cached.result;
+}
+
+void Pack::invalidateDiscovery() {
+  WriteLock lock(kDiscoveryResultsMutex);
+  kDiscoveryResults.clear();
+  kDiscoveryGeneration++;
+}
+
 bool Pack::checkDiscovery() {
   stats_.total++;
   size_t current = osquery::getUnixTime();
-  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
+  size_t generation = kDiscoveryGeneration;
+  if (discovery_generation_ == generation &&
+      (current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
     stats_.hits++;
     return discovery_cache_.second;
   }
@@ -282,15 +344,9 @@ bool Pack::checkDiscovery() {
   stats_.misses++;
   discovery_cache_.first = current;
   discovery_cache_.second = true;
+  discovery_generation_ = generation;
   for (const auto& q : discovery_queries_) {
-    SQL results(q);
-    if (!results.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << results.getMessageString();
-      discovery_cache_.second = false;
-      break;
-    }
-    if (results.rows().size() == 0) {
+    if (!runDiscoveryQuery(q, current)) {
       discovery_cache_.second = false;
       break;
     }
@@ -8,12 +8,18 @@
  *
  */
 
+#include <sstream>
+
 #include <osquery/config.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/core/process.h"
 
 namespace pt = boost::property_tree;
 
@@ -26,6 +32,21 @@ FLAG(bool,
      false,
      "Add decorators as top level JSON objects");
 
+FLAG(uint64,
+     decorations_always_ttl,
+     0,
+     "Seconds to reuse 'always' decorations between queries (0 = rerun)");
+
+FLAG(bool,
+     decorations_per_step,
+     false,
+     "Run 'always' decorators once per schedule step for all due queries");
+
+FLAG(bool,
+     decorations_warm_restart,
+     true,
+     "Reuse decorations saved by the previous worker of the same watcher");
+
 /// Statically define the parser name to avoid mistakes.
 #define PARSER_NAME "decorators"
 
@@ -35,11 +56,28 @@ const std::map<DecorationPoint, std::string> kDecorationPointKeys = {
     {DECORATE_INTERVAL, "interval"},
 };
 
+/// The database key of the decorations saved for the next worker.
+const std::string kDecorationsWarmKey = "decorations.warm";
+
 using KeyValueMap = std::map<std::string, std::string>;
 using DecorationStore = std::map<std::string, KeyValueMap>;
 
 namespace {
 
+/// An 'always' decorator query and the time its decorations were added.
+struct AlwaysDecorator {
+  std::string query;
+
+  /// Seconds the decorations are reused, 0 runs before every query.
+  size_t ttl{0};
+
+  /// The time the query last ran, 0 if it has not run.
+  size_t time{0};
+
+  /// The schedule step the query last ran in.
+  size_t step{0};
+};
+
 /**
  * @brief A simple ConfigParserPlugin for a "decorators" dictionary key.
  *
@@ -52,6 +90,9 @@ namespace {
  * always: run these decorators for every query immediate before
  * interval: run these decorators on an interval.
  *
+ * An 'always' decorator may be an object with a "query" and a "ttl" in
+ * seconds its decorations are reused for, see --decorations_always_ttl.
+ *
  * When 'interval' is used, the value is a dictionary of intervals, each of the
  * subkeys are treated as the requested interval in sections. The internals
  * are emulated by the query schedule.
@@ -80,12 +121,24 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
   /// Clear the decorations created from decorators for the given source.
   void clearSources(const std::string& source);
 
+  /**
+   * @brief Restore the decorations a previous worker saved for a source.
+   *
+   * A worker saves its decorations when it stops gracefully. The next worker
+   * of the same watcher reuses them for its first config load, instead of
+   * running the 'load' decorators again, if the source's decorators did not
+   * change. The 'always' decorators keep their last run times.
+   *
+   * @return true if the source's decorations were restored.
+   */
+  bool restoreDecorations(const std::string& source);
+
   /// Clear all decorations.
   virtual void reset() override;
 
  public:
   /// Set of configuration sources to the set of decorator queries.
-  std::map<std::string, std::vector<std::string>> always_;
+  std::map<std::string, std::vector<AlwaysDecorator>> always_;
 
   /// Set of configuration sources to the set of on-load decorator queries.
   std::map<std::string, std::vector<std::string>> load_;
@@ -93,6 +146,15 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
   /// Set of configuration sources to valid intervals.
   std::map<std::string, std::map<size_t, std::vector<std::string>>> intervals_;
 
+  /// Set of configuration sources to a digest of their decorators.
+  std::map<std::string, std::string> digests_;
+
+  /// Decorations saved by the previous worker, read at the first update.
+  pt::ptree warm_;
+
+  /// The saved decorations were read, later updates run their decorators.
+  bool warm_read_{false};
+
  public:
   /// The result set of decorations, column names and their values.
   static DecorationStore kDecorations;
@@ -102,12 +164,16 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
 
   /// Protect the configuration controlled content.
   static Mutex kDecorationsConfigMutex;
+
+  /// Protect the last run times of 'always' decorators.
+  static Mutex kDecorationsCacheMutex;
 };
 }
 
 DecorationStore DecoratorsConfigParserPlugin::kDecorations;
 Mutex DecoratorsConfigParserPlugin::kDecorationsMutex;
 Mutex DecoratorsConfigParserPlugin::kDecorationsConfigMutex;
+Mutex DecoratorsConfigParserPlugin::kDecorationsCacheMutex;
 
 Status DecoratorsConfigParserPlugin::setUp() {
   // Decorators are kept within customized data structures.
@@ -124,7 +190,9 @@ Status DecoratorsConfigParserPlugin::update(const std::string& source,
     // The run decorators method is designed to have call sites throughout
     // the code base.
     updateDecorations(source, config.at(PARSER_NAME));
-    runDecorators(DECORATE_LOAD, 0, source);
+    if (!restoreDecorations(source)) {
+      runDecorators(DECORATE_LOAD, 0, source);
+    }
   }
 
   return Status(0, "OK");
@@ -144,6 +212,7 @@ void DecoratorsConfigParserPlugin::clearSources(const std::string& source) {
   if (load_.count(source) > 0) {
     load_[source].clear();
   }
+  digests_.erase(source);
 }
 
 void DecoratorsConfigParserPlugin::reset() {
@@ -152,11 +221,18 @@ void DecoratorsConfigParserPlugin::reset() {
     clearSources(source.first);
     clearDecorations(source.first);
   }
+  warm_.clear();
+  warm_read_ = false;
 }
 
 void DecoratorsConfigParserPlugin::updateDecorations(
     const std::string& source, const pt::ptree& decorators) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsConfigMutex);
+  std::stringstream json;
+  pt::write_json(json, decorators, false);
+  auto content = json.str();
+  digests_[source] = getBufferSHA1(content.data(), content.size());
+
   // Assign load decorators.
   auto& load_key = kDecorationPointKeys.at(DECORATE_LOAD);
   if (decorators.count(load_key) > 0) {
@@ -169,7 +245,16 @@ void DecoratorsConfigParserPlugin::updateDecorations(
   auto& always_key = kDecorationPointKeys.at(DECORATE_ALWAYS);
   if (decorators.count(always_key) > 0) {
     for (const auto& item : decorators.get_child(always_key)) {
-      always_[source].push_back(item.second.data());
+      // Each decorator starts without cached decorations.
+      AlwaysDecorator decorator;
+      decorator.ttl = FLAGS_decorations_always_ttl;
+      if (item.second.count("query") > 0) {
+        decorator.query = item.second.get<std::string>("query", "");
+        decorator.ttl = item.second.get<size_t>("ttl", decorator.ttl);
+      } else {
+        decorator.query = item.second.data();
+      }
+      always_[source].push_back(std::move(decorator));
     }
   }
 
@@ -195,6 +280,83 @@ void DecoratorsConfigParserPlugin::updateDecorations(
   }
 }
 
+bool DecoratorsConfigParserPlugin::restoreDecorations(
+    const std::string& source) {
+  if (!warm_read_) {
+    warm_read_ = true;
+    std::string content;
+    if (!FLAGS_decorations_warm_restart || !Initializer::isWorker() ||
+        !getDatabaseValue(kPersistentSettings, kDecorationsWarmKey, content)
+             .ok()) {
+      return false;
+    }
+
+    // The decorations are handed off once, a crashed worker saves none.
+    deleteDatabaseValue(kPersistentSettings, kDecorationsWarmKey);
+    try {
+      std::stringstream json(content);
+      pt::read_json(json, warm_);
+    } catch (const pt::json_parser::json_parser_error& /* e */) {
+      warm_.clear();
+    }
+
+    auto watcher = PlatformProcess::getLauncherProcess();
+    if (watcher == nullptr ||
+        warm_.get("watcher", "") != std::to_string(watcher->pid())) {
+      warm_.clear();
+    }
+  }
+
+  ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsConfigMutex);
+  auto digest = digests_.find(source);
+  if (digest == digests_.end()) {
+    return false;
+  }
+
+  auto sources = warm_.get_child_optional("sources");
+  if (!sources) {
+    return false;
+  }
+
+  // Each source is restored at most once, later updates run its decorators.
+  for (auto it = sources->begin(); it != sources->end(); ++it) {
+    if (it->second.get("source", "") != source) {
+      continue;
+    }
+    auto saved = std::move(*it);
+    sources->erase(it);
+    if (saved.second.get("digest", "") != digest->second) {
+      return false;
+    }
+
+    {
+      WriteLock decorations_lock(
+          DecoratorsConfigParserPlugin::kDecorationsMutex);
+      for (const auto& decoration :
+           saved.second.get_child("decorations", pt::ptree())) {
+        kDecorations[source][decoration.first] = decoration.second.data();
+      }
+    }
+
+    // The schedule steps of the new worker start over.
+    auto& always = always_[source];
+    const auto& times = saved.second.get_child("always", pt::ptree());
+    if (times.size() == always.size()) {
+      WriteLock cache_lock(
+          DecoratorsConfigParserPlugin::kDecorationsCacheMutex);
+      auto decorator = always.begin();
+      for (const auto& time : times) {
+        decorator->time = time.second.get_value<size_t>(0);
+        decorator->step = 0;
+        ++decorator;
+      }
+    }
+    VLOG(1) << "Restored decorations of config source: " << source;
+    return true;
+  }
+  return false;
+}
+
 inline void addDecoration(const std::string& source,
                           const std::string& name,
                           const std::string& value) {
@@ -222,6 +384,35 @@ inline void runDecorators(const std::string& source,
   }
 }
 
+/**
+ * @brief Select the 'always' decorators whose decorations are not reusable.
+ *
+ * Decorations are reused within the same schedule step, when
+ * --decorations_per_step is set, or within the decorator's TTL. The selected
+ * decorators are marked as run.
+ */
+static std::vector<std::string> getDueDecorators(
+    std::vector<AlwaysDecorator>& decorators, size_t step) {
+  auto now = getUnixTime();
+  std::vector<std::string> queries;
+
+  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsCacheMutex);
+  for (auto& decorator : decorators) {
+    if (decorator.time > 0) {
+      if (FLAGS_decorations_per_step && step > 0 && decorator.step == step) {
+        continue;
+      }
+      if (decorator.ttl > 0 && now < decorator.time + decorator.ttl) {
+        continue;
+      }
+    }
+    decorator.time = now;
+    decorator.step = step;
+    queries.push_back(decorator.query);
+  }
+  return queries;
+}
+
 void clearDecorations(const std::string& source) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
   DecoratorsConfigParserPlugin::kDecorations[source].clear();
@@ -250,9 +441,10 @@ void runDecorators(DecorationPoint point,
       }
     }
   } else if (point == DECORATE_ALWAYS) {
-    for (const auto& target_source : dp->always_) {
+    for (auto& target_source : dp->always_) {
       if (source.empty() || target_source.first == source) {
-        runDecorators(target_source.first, target_source.second);
+        runDecorators(target_source.first,
+                      getDueDecorators(target_source.second, time));
       }
     }
   } else if (point == DECORATE_INTERVAL) {
@@ -268,6 +460,62 @@ void runDecorators(DecorationPoint point,
   }
 }
 
+void saveDecorations() {
+  if (!FLAGS_decorations_warm_restart || FLAGS_disable_decorators ||
+      !Initializer::isWorker()) {
+    return;
+  }
+
+  auto parser = Config::getParser(PARSER_NAME);
+  auto watcher = PlatformProcess::getLauncherProcess();
+  if (parser == nullptr || watcher == nullptr) {
+    return;
+  }
+
+  auto dp = std::dynamic_pointer_cast<DecoratorsConfigParserPlugin>(parser);
+  pt::ptree sources;
+  {
+    ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsConfigMutex);
+    ReadLock decorations_lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+    ReadLock cache_lock(DecoratorsConfigParserPlugin::kDecorationsCacheMutex);
+    for (const auto& digest : dp->digests_) {
+      pt::ptree saved;
+      saved.put("source", digest.first);
+      saved.put("digest", digest.second);
+
+      // Decoration names may contain the ptree path separator.
+      pt::ptree decorations;
+      const auto& store = DecoratorsConfigParserPlugin::kDecorations;
+      auto source = store.find(digest.first);
+      if (source != store.end()) {
+        for (const auto& decoration : source->second) {
+          decorations.push_back(
+              std::make_pair(decoration.first, pt::ptree(decoration.second)));
+        }
+      }
+      saved.add_child("decorations", decorations);
+
+      pt::ptree times;
+      auto always = dp->always_.find(digest.first);
+      if (always != dp->always_.end()) {
+        for (const auto& decorator : always->second) {
+          times.push_back(
+              std::make_pair("", pt::ptree(std::to_string(decorator.time))));
+        }
+      }
+      saved.add_child("always", times);
+      sources.push_back(std::make_pair("", saved));
+    }
+  }
+
+  pt::ptree warm;
+  warm.put("watcher", std::to_string(watcher->pid()));
+  warm.add_child("sources", sources);
+  std::stringstream json;
+  pt::write_json(json, warm, false);
+  setDatabaseValue(kPersistentSettings, kDecorationsWarmKey, json.str());
+}
+
 void getDecorations(std::map<std::string, std::string>& results) {
   if (FLAGS_disable_decorators) {
     return;
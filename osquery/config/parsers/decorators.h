@@ -35,7 +35,8 @@ extern const std::map<DecorationPoint, std::string> kDecorationPointKeys;
  * decorators. The source tracking is abstracted for the decorator iterator.
  *
  * @param point request execution of decorators for this given point.
- * @param time an optional time for points using intervals.
+ * @param time an optional time for points using intervals, or the schedule
+ * step for 'always' decorators shared by the step's queries.
  * @param source restrict run to a specific config source.
  */
 void runDecorators(DecorationPoint point,
@@ -57,4 +58,13 @@ void getDecorations(std::map<std::string, std::string>& results);
 
 /// Clear decorations for a source when it updates.
 void clearDecorations(const std::string& source);
+
+/**
+ * @brief Save the decorations for the next worker of the same watcher.
+ *
+ * A worker calls this when it stops gracefully, see
+ * --decorations_warm_restart. The next worker's first config load restores
+ * the decorations of sources whose decorators did not change.
+ */
+void saveDecorations();
 }
@@ -8,19 +8,25 @@
  *
  */
 
+#include <boost/algorithm/string/replace.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/config.h>
 #include <osquery/flags.h>
 #include <osquery/registry.h>
+#include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/process.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
 DECLARE_bool(disable_decorators);
 DECLARE_bool(decorations_top_level);
+DECLARE_uint64(decorations_always_ttl);
+DECLARE_bool(decorations_per_step);
 
 class DecoratorsConfigParserPluginTests : public testing::Test {
  public:
@@ -43,6 +49,12 @@ class DecoratorsConfigParserPluginTests : public testing::Test {
     FLAGS_disable_decorators = decorator_status_;
   }
 
+  /// Mimic a new worker's config, before its first load.
+  void resetConfig() {
+    Config::getInstance().reset();
+    clearDecorations("awesome");
+  }
+
  protected:
   std::string content_;
   std::map<std::string, std::string> config_data_;
@@ -104,6 +116,99 @@ TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_interval) {
   ASSERT_EQ(second_item.decorations.size(), 2U);
 }
 
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_always_cache) {
+  FLAGS_disable_decorators = true;
+  auto ttl = FLAGS_decorations_always_ttl;
+  FLAGS_decorations_always_ttl = 3600;
+  Config::getInstance().update(config_data_);
+  FLAGS_disable_decorators = false;
+
+  runDecorators(DECORATE_ALWAYS);
+  QueryLogItem item;
+  getDecorations(item.decorations);
+  EXPECT_EQ(item.decorations["always_test"], "test");
+
+  // The decorations are reused within the TTL, the queries do not run again.
+  clearDecorations("awesome");
+  runDecorators(DECORATE_ALWAYS);
+  QueryLogItem cached_item;
+  getDecorations(cached_item.decorations);
+  EXPECT_EQ(cached_item.decorations.count("always_test"), 0U);
+
+  // A configuration update invalidates the cache.
+  FLAGS_decorations_always_ttl = 0;
+  FLAGS_disable_decorators = true;
+  Config::getInstance().update(config_data_);
+  FLAGS_disable_decorators = false;
+
+  // Without a TTL decorations may be shared by the queries of a step.
+  FLAGS_decorations_per_step = true;
+  runDecorators(DECORATE_ALWAYS, 100);
+  clearDecorations("awesome");
+  runDecorators(DECORATE_ALWAYS, 100);
+  QueryLogItem step_item;
+  getDecorations(step_item.decorations);
+  EXPECT_EQ(step_item.decorations.count("always_test"), 0U);
+
+  runDecorators(DECORATE_ALWAYS, 101);
+  QueryLogItem next_item;
+  getDecorations(next_item.decorations);
+  EXPECT_EQ(next_item.decorations["always_test"], "test");
+
+  FLAGS_decorations_per_step = false;
+  FLAGS_decorations_always_ttl = ttl;
+}
+
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_warm_restart) {
+  // Only workers hand off decorations.
+  auto worker = getEnvVar("OSQUERY_WORKER");
+  setEnvVar("OSQUERY_WORKER", "1");
+  FLAGS_disable_decorators = false;
+  Config::getInstance().update(config_data_);
+  saveDecorations();
+
+  // Mark the saved decorations to tell them apart from the queries' results.
+  std::string content;
+  ASSERT_TRUE(
+      getDatabaseValue(kPersistentSettings, "decorations.warm", content).ok());
+  boost::replace_all(
+      content, "\"load_test\":\"test\"", "\"load_test\":\"warm\"");
+  setDatabaseValue(kPersistentSettings, "decorations.warm", content);
+
+  // The next worker's first config load restores the saved decorations.
+  resetConfig();
+  Config::getInstance().update(config_data_);
+  QueryLogItem item;
+  getDecorations(item.decorations);
+  EXPECT_EQ(item.decorations["load_test"], "warm");
+  EXPECT_FALSE(
+      getDatabaseValue(kPersistentSettings, "decorations.warm", content).ok());
+
+  // Later updates run the 'load' decorators.
+  Config::getInstance().update(config_data_);
+  QueryLogItem updated_item;
+  getDecorations(updated_item.decorations);
+  EXPECT_EQ(updated_item.decorations["load_test"], "test");
+
+  // Changed decorators are not restored.
+  saveDecorations();
+  resetConfig();
+  FLAGS_disable_decorators = true;
+  config_data_["awesome"] =
+      "{\"decorators\": {\"load\": [\"SELECT 1 AS one\"]}}";
+  Config::getInstance().update(config_data_);
+  FLAGS_disable_decorators = false;
+  QueryLogItem changed_item;
+  getDecorations(changed_item.decorations);
+  EXPECT_EQ(changed_item.decorations.count("load_test"), 0U);
+
+  if (worker) {
+    setEnvVar("OSQUERY_WORKER", *worker);
+  } else {
+    unsetEnvVar("OSQUERY_WORKER");
+  }
+}
+
 TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_load_top_level) {
   // Re-enable the decorators, then update the config.
   // The 'load' decorator set should run every time the config is updated.
@@ -82,12 +82,7 @@ Status FilesystemConfigPlugin::genPack(const std::string& name,
 
       // Assemble an intermediate property tree for simplified parsing.
       pt::ptree single_pack;
-      stripConfigComments(content);
-      try {
-        std::stringstream json_stream;
-        json_stream << content;
-        pt::read_json(json_stream, single_pack);
-      } catch (const pt::json_parser::json_parser_error& /* e */) {
+      if (!parseJSONTree(content, single_pack, true).ok()) {
         LOG(WARNING) << "Cannot read multi-pack JSON: " << path;
         continue;
       }
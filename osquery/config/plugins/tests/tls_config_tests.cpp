@@ -97,6 +97,31 @@ TEST_F(TLSConfigTests, test_retrieve_config) {
   EXPECT_EQ("baz", response[0]["tls_plugin"]);
 }
 
+TEST_F(TLSConfigTests, test_conditional_config) {
+  Flag::updateValue("config_tls_endpoint", "/config_etag");
+  Registry::get().setActive("config", "tls");
+
+  auto plugin = std::dynamic_pointer_cast<TLSConfigPlugin>(
+      Registry::get().plugin("config", "tls"));
+  ASSERT_NE(nullptr, plugin);
+  ASSERT_TRUE(plugin->setUp().ok());
+
+  std::map<std::string, std::string> config;
+  auto status = plugin->genConfig(config);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ("OK", status.getMessage());
+  EXPECT_FALSE(plugin->etag_.empty());
+  auto content = config["tls_plugin"];
+  EXPECT_FALSE(content.empty());
+
+  // The server responds without content and the last config is reused.
+  config.clear();
+  status = plugin->genConfig(config);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ("Not modified", status.getMessage());
+  EXPECT_EQ(content, config["tls_plugin"]);
+}
+
 TEST_F(TLSConfigTests, test_runner_and_scheduler) {
   Flag::updateValue("config_tls_endpoint", "/config");
   // Will cause another enroll.
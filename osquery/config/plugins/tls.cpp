@@ -61,8 +61,55 @@ DECLARE_bool(enroll_always);
 
 REGISTER(TLSConfigPlugin, "config", "tls");
 
+/// The genConfig status message when the server's config did not change.
+const std::string kConfigNotModified = "Not modified";
+
 std::atomic<size_t> TLSConfigPlugin::kCurrentDelay{0};
 
+/// Keep only the top-level "config" string of a node API response.
+class NodeConfigHandler : public JSONHandler {
+ public:
+  bool startObject() override {
+    depth_++;
+    return true;
+  }
+
+  bool endObject() override {
+    depth_--;
+    return true;
+  }
+
+  bool startArray() override {
+    depth_++;
+    return true;
+  }
+
+  bool endArray() override {
+    depth_--;
+    return true;
+  }
+
+  bool key(std::string& name) override {
+    selected_ = (depth_ == 1 && name == "config");
+    return true;
+  }
+
+  bool value(std::string& value, bool string) override {
+    if (selected_ && depth_ == 1) {
+      config = std::move(value);
+    }
+    selected_ = false;
+    return true;
+  }
+
+ public:
+  std::string config;
+
+ private:
+  size_t depth_{0};
+  bool selected_{false};
+};
+
 Status TLSConfigPlugin::setUp() {
   if (FLAGS_enroll_always && !FLAGS_disable_enrollment) {
     // clear any cached node key
@@ -104,60 +151,66 @@ Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
     params.put("_get", true);
   }
 
+  {
+    // The server may skip sending a config that did not change.
+    ReadLock lock(content_mutex_);
+    params.put("_etag", etag_);
+  }
+
   auto s = TLSRequestHelper::go<JSONSerializer>(
       uri_, params, json, FLAGS_config_tls_max_attempts);
 
-  if (s.ok()) {
+  if (s.ok() && params.get("_not_modified", false)) {
+    ReadLock lock(content_mutex_);
+    config["tls_plugin"] = content_;
+    s = Status(0, kConfigNotModified);
+  } else if (s.ok()) {
     if (FLAGS_tls_node_api) {
       // The node API embeds configuration data (JSON escaped).
-      pt::ptree tree;
-      try {
-        std::stringstream input;
-        input << json;
-        pt::read_json(input, tree);
-      } catch (const pt::json_parser::json_parser_error& /* e */) {
+      NodeConfigHandler handler;
+      if (!parseJSONEvents(json, handler).ok()) {
         VLOG(1) << "Could not parse JSON from TLS node API";
       }
 
       // Re-encode the config key into JSON.
-      config["tls_plugin"] = unescapeUnicode(tree.get("config", ""));
+      config["tls_plugin"] = unescapeUnicode(handler.config);
     } else {
       config["tls_plugin"] = json;
     }
+
+    // Only content the server can report as unchanged is kept.
+    WriteLock lock(content_mutex_);
+    etag_ = params.get<std::string>("_etag", "");
+    content_ = (etag_.empty()) ? "" : config["tls_plugin"];
   }
   updateDelayPeriod(s.ok());
 
   // If the initial configuration includes a non-0 refresh, start an additional
   // service that sleeps and periodically regenerates the configuration.
   if (!started_thread_ && FLAGS_config_tls_refresh >= 1) {
-    Dispatcher::addService(std::make_shared<TLSConfigRefreshRunner>());
+    Dispatcher::addPeriodicService(std::make_shared<TLSConfigRefreshRunner>());
     started_thread_ = true;
   }
   return s;
 }
 
-void TLSConfigRefreshRunner::start() {
-  while (!interrupted()) {
-    // Cool off and time wait the configured period.
-    // Apply this interruption initially as at t=0 the config was read.
-    pauseMilli(TLSConfigPlugin::kCurrentDelay * 1000);
-    // Since the pause occurs before the logic, we need to check for an
-    // interruption request.
-    if (interrupted()) {
-      return;
-    }
-
-    // Access the configuration.
-    auto plugin = RegistryFactory::get().plugin("config", "tls");
-    if (plugin != nullptr) {
-      auto config_plugin = std::dynamic_pointer_cast<ConfigPlugin>(plugin);
-
-      // The config instance knows the TLS plugin is selected.
-      std::map<std::string, std::string> config;
-      if (config_plugin->genConfig(config)) {
-        Config::getInstance().update(config);
-      }
+bool TLSConfigRefreshRunner::run() {
+  // Access the configuration.
+  auto plugin = RegistryFactory::get().plugin("config", "tls");
+  if (plugin != nullptr) {
+    auto config_plugin = std::dynamic_pointer_cast<ConfigPlugin>(plugin);
+
+    // The config instance knows the TLS plugin is selected.
+    std::map<std::string, std::string> config;
+    auto status = config_plugin->genConfig(config);
+    if (status.ok() && status.getMessage() != kConfigNotModified) {
+      Config::getInstance().update(config);
     }
   }
+  return true;
+}
+
+std::chrono::milliseconds TLSConfigRefreshRunner::interval() {
+  return std::chrono::seconds(TLSConfigPlugin::kCurrentDelay);
 }
 }
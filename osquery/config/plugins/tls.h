@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <osquery/config.h>
+#include <osquery/core.h>
 #include <osquery/dispatcher.h>
 
 namespace osquery {
@@ -32,14 +33,31 @@ class TLSConfigPlugin : public ConfigPlugin,
 
  private:
   friend class TLSConfigTests;
+  FRIEND_TEST(TLSConfigTests, test_conditional_config);
 
   void updateDelayPeriod(bool success);
   bool started_thread_{false};
+
+  /// The ETag of the last config response, if the server sent one.
+  std::string etag_;
+
+  /// The last config content, reused when the server reports no change.
+  std::string content_;
+
+  /// Protects the ETag and content between refreshes.
+  Mutex content_mutex_;
 };
 
-class TLSConfigRefreshRunner : public InternalRunnable {
+class TLSConfigRefreshRunner : public PeriodicRunnable {
  public:
-  /// A simple wait/interruptible lock.
-  void start();
+  bool run() override;
+
+  /// The current delay, which backs off while the server is unreachable.
+  std::chrono::milliseconds interval() override;
+
+  /// Each refresh is a TLS request.
+  bool blocking() override {
+    return true;
+  }
 };
 }
@@ -34,6 +34,10 @@ extern void saveScheduleBlacklist(
     const std::map<std::string, size_t>& blacklist);
 extern void stripConfigComments(std::string& json);
 
+DECLARE_bool(config_fast_start);
+DECLARE_uint64(schedule_wall_budget);
+DECLARE_uint64(schedule_budget_overruns);
+
 class ConfigTests : public testing::Test {
  public:
   ConfigTests() {
@@ -105,6 +109,38 @@ TEST_F(ConfigTests, test_plugin) {
   EXPECT_EQ(status.toString(), "OK");
 }
 
+TEST_F(ConfigTests, test_config_snapshot) {
+  auto& rf = RegistryFactory::get();
+  auto plugin = std::make_shared<TestConfigPlugin>();
+  rf.registry("config")->add("test_snapshot", plugin);
+  ASSERT_TRUE(rf.setActive("config", "test_snapshot").ok());
+
+  // A good config from the plugin is saved as the snapshot.
+  deleteDatabaseValue(kPersistentSettings, "config_snapshot");
+  FLAGS_config_fast_start = true;
+  ASSERT_TRUE(get().refresh().ok());
+  EXPECT_EQ(1, plugin->genConfigCount);
+  std::string hash;
+  ASSERT_TRUE(get().genHash(hash).ok());
+
+  // The snapshot restores the config without calling the plugin.
+  get().reset();
+  ASSERT_TRUE(get().loadSnapshot().ok());
+  EXPECT_EQ(1, plugin->genConfigCount);
+  EXPECT_TRUE(get().isValid());
+  std::string restored;
+  ASSERT_TRUE(get().genHash(restored).ok());
+  EXPECT_EQ(hash, restored);
+
+  size_t count = 0;
+  get().packs(([&count](std::shared_ptr<Pack>& pack) { count++; }));
+  EXPECT_GT(count, 0U);
+
+  FLAGS_config_fast_start = false;
+  deleteDatabaseValue(kPersistentSettings, "config_snapshot");
+  get().reset();
+}
+
 TEST_F(ConfigTests, test_invalid_content) {
   std::string bad_json = "{\"options\": {},}";
   ASSERT_NO_THROW(get().update({{"bad_source", bad_json}}));
@@ -240,6 +276,51 @@ TEST_F(ConfigTests, test_content_update) {
   EXPECT_EQ(count, 0U);
 }
 
+TEST_F(ConfigTests, test_incremental_update) {
+  auto config = [](const std::string& interval) {
+    return "{\"packs\": {"
+           "\"a\": {\"queries\": {\"q\": {\"query\": \"select 1\", "
+           "\"interval\": " +
+           interval + "}}}, "
+           "\"b\": {\"queries\": {\"q\": {\"query\": \"select 2\", "
+           "\"interval\": 10}}}}}";
+  };
+  auto getPacks = [this]() {
+    std::map<std::string, std::shared_ptr<Pack>> packs;
+    get().packs(([&packs](std::shared_ptr<Pack>& pack) {
+      packs[pack->getName()] = pack;
+    }));
+    return packs;
+  };
+
+  ASSERT_TRUE(get().update({{"data", config("10")}}).ok());
+  auto packs = getPacks();
+  ASSERT_EQ(2U, packs.size());
+
+  // Unchanged content does not change the schedule.
+  auto generation = get().getScheduleGeneration();
+  ASSERT_TRUE(get().update({{"data", config("10")}}).ok());
+  EXPECT_EQ(generation, get().getScheduleGeneration());
+  EXPECT_EQ(packs, getPacks());
+
+  // Only the changed pack is rebuilt.
+  ASSERT_TRUE(get().update({{"data", config("20")}}).ok());
+  auto updated = getPacks();
+  ASSERT_EQ(2U, updated.size());
+  EXPECT_NE(packs["a"], updated["a"]);
+  EXPECT_EQ(packs["b"], updated["b"]);
+
+  // A pack removed from the source is removed from the schedule.
+  ASSERT_TRUE(get()
+                  .update({{"data",
+                            "{\"packs\": {\"b\": {\"queries\": {\"q\": "
+                            "{\"query\": \"select 2\", \"interval\": 10}}}}}"}})
+                  .ok());
+  updated = getPacks();
+  ASSERT_EQ(1U, updated.size());
+  EXPECT_EQ(packs["b"], updated["b"]);
+}
+
 TEST_F(ConfigTests, test_get_scheduled_queries) {
   std::vector<ScheduledQuery> queries;
   get().addPack("unrestricted_pack", "", getUnrestrictedPack());
@@ -367,4 +448,92 @@ TEST_F(ConfigTests, test_pack_file_paths) {
   get().files(fileCounter);
   EXPECT_EQ(count, 0U);
 }
+
+TEST_F(ConfigTests, test_query_performance) {
+  ResourceUsage r0;
+  r0.wall_time = 1000;
+  r0.user_time = 10;
+  r0.system_time = 20;
+  r0.memory = 4096;
+  r0.context_switches = 3;
+  r0.cycles = 1000000;
+
+  auto r1 = r0;
+  r1.wall_time += 50;
+  r1.user_time += 5;
+  r1.system_time += 2;
+  r1.memory += 1024;
+  r1.context_switches += 4;
+  r1.cycles += 2000;
+  r1.instructions += 3000;
+
+  get().recordQueryPerformance("performance_test", 100, r0, r1);
+  // A sample that went backward is not recorded.
+  get().recordQueryPerformance("performance_test", 100, r1, r0);
+
+  get().getPerformanceStats(
+      "performance_test", ([](const QueryPerformance& query) {
+        EXPECT_EQ(query.executions, 2U);
+        EXPECT_EQ(query.wall_time, 50U);
+        EXPECT_EQ(query.user_time, 5U);
+        EXPECT_EQ(query.system_time, 2U);
+        EXPECT_EQ(query.average_memory, 1024U);
+        EXPECT_EQ(query.output_size, 200U);
+        EXPECT_EQ(query.context_switches, 4U);
+        EXPECT_EQ(query.cycles, 2000U);
+        EXPECT_EQ(query.instructions, 3000U);
+        EXPECT_EQ(query.cache_misses, 0U);
+      }));
+}
+
+TEST_F(ConfigTests, test_query_budget_blacklist) {
+  auto backup_budget = FLAGS_schedule_wall_budget;
+  auto backup_overruns = FLAGS_schedule_budget_overruns;
+  FLAGS_schedule_wall_budget = 100;
+  FLAGS_schedule_budget_overruns = 2;
+
+  get().update({{"data",
+                 "{\"schedule\": {\"budget_test\": {"
+                 "\"query\": \"select * from time\", \"interval\": 1}}}"}});
+  auto scheduled = [this]() {
+    bool found = false;
+    get().scheduledQueries(
+        ([&found](const std::string& name, const ScheduledQuery& query) {
+          found = found || (name == "budget_test");
+        }));
+    return found;
+  };
+  EXPECT_TRUE(scheduled());
+
+  ResourceUsage r0;
+  auto slow = r0;
+  slow.wall_time = 200;
+  auto fast = r0;
+  fast.wall_time = 10;
+
+  // An execution within the budget resets the overruns.
+  get().recordQueryPerformance("budget_test", 0, r0, slow);
+  get().recordQueryPerformance("budget_test", 0, r0, fast);
+  get().recordQueryPerformance("budget_test", 0, r0, slow);
+  EXPECT_TRUE(scheduled());
+
+  get().recordQueryPerformance("budget_test", 0, r0, slow);
+  EXPECT_FALSE(scheduled());
+
+  // Clear the saved blacklist.
+  saveScheduleBlacklist({});
+  FLAGS_schedule_wall_budget = backup_budget;
+  FLAGS_schedule_budget_overruns = backup_overruns;
+}
+
+TEST_F(ConfigTests, test_resource_usage) {
+  auto r0 = getResourceUsage();
+  volatile size_t spin = 0;
+  for (size_t i = 0; i < 10000000; i++) {
+    spin += i;
+  }
+  auto r1 = getResourceUsage();
+  EXPECT_GE(r1.wall_time, r0.wall_time);
+  EXPECT_GE(r1.user_time + r1.system_time, r0.user_time + r0.system_time);
+}
 }
@@ -14,6 +14,8 @@
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/json.h"
 #include "osquery/tests/test_util.h"
@@ -150,6 +152,54 @@ TEST_F(PacksTests, test_discovery_cache) {
   c.reset();
 }
 
+/// A table counting how many times a discovery query generated it.
+class DiscoveryCounterPlugin : public TablePlugin {
+ public:
+  static size_t generated;
+
+ protected:
+  TableColumns columns() const override {
+    return {std::make_tuple("value", INTEGER_TYPE, ColumnOptions::DEFAULT)};
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    generated++;
+    return {{{"value", "1"}}};
+  }
+};
+
+size_t DiscoveryCounterPlugin::generated = 0;
+
+TEST_F(PacksTests, test_shared_discovery) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("discovery_counter", std::make_shared<DiscoveryCounterPlugin>());
+  PluginResponse response;
+  Registry::call(
+      "sql", {{"action", "attach"}, {"table", "discovery_counter"}}, response);
+
+  pt::ptree tree;
+  pt::ptree discovery;
+  discovery.push_back(
+      std::make_pair("", pt::ptree("select * from discovery_counter")));
+  tree.put_child("discovery", discovery);
+
+  // Packs with the same discovery query share its result.
+  Pack::invalidateDiscovery();
+  Pack first("first", tree);
+  Pack second("second", tree);
+  EXPECT_TRUE(first.checkDiscovery());
+  EXPECT_TRUE(second.checkDiscovery());
+  EXPECT_EQ(1U, DiscoveryCounterPlugin::generated);
+  EXPECT_EQ(1U, second.getStats().misses);
+
+  // An invalidation, such as a config change, runs the query again.
+  Pack::invalidateDiscovery();
+  EXPECT_TRUE(first.checkDiscovery());
+  EXPECT_TRUE(second.checkDiscovery());
+  EXPECT_EQ(2U, DiscoveryCounterPlugin::generated);
+  EXPECT_EQ(2U, first.getStats().misses);
+}
+
 TEST_F(PacksTests, test_multi_pack) {
   std::string multi_pack_content = "{\"first\": {}, \"second\": {}}";
   pt::ptree multi_pack;
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <osquery/status.h>
+
+#include "osquery/core/process.h"
+
+namespace osquery {
+
+/**
+ * @brief Create a kernel-enforced container for watched processes.
+ *
+ * On Linux this is a cgroup v2 group using the cpu.max and memory.high
+ * controls. On Windows this is a Job Object with a hard CPU rate cap. The
+ * kernel throttles contained processes, so the watchdog does not need to
+ * restart them when they briefly exceed the limits.
+ *
+ * @param cpu_percent the percent of one CPU the processes may use together.
+ * @param memory_bytes the memory used before the kernel applies reclaim
+ * pressure, this is not enforced on Windows.
+ * @return success if the container was created.
+ */
+Status initContainment(size_t cpu_percent, size_t memory_bytes);
+
+/// Move a watched process into the container.
+Status containProcess(const PlatformProcess& process);
+
+/**
+ * @brief Read the container's throttling counters.
+ *
+ * Linux reports "nr_throttled", "throttled_usec" and "memory_high" events.
+ */
+Status getContainmentStats(std::map<std::string, size_t>& stats);
+}
@@ -79,6 +79,153 @@ bool isPrintable(const std::string& check) {
   return true;
 }
 
+bool likeMatches(const std::string& pattern, boost::string_ref value) {
+  auto fold = [](char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+  };
+  auto next = [&value](size_t i) {
+    // Skip a lead byte and its continuation bytes.
+    i++;
+    while (i < value.size() && (value[i] & 0xC0) == 0x80) {
+      i++;
+    }
+    return i;
+  };
+
+  size_t p = 0;
+  size_t v = 0;
+  size_t star = std::string::npos;
+  size_t resume = 0;
+  while (v < value.size()) {
+    if (p < pattern.size() && pattern[p] == '%') {
+      star = p++;
+      resume = v;
+    } else if (p < pattern.size() && pattern[p] == '_') {
+      p++;
+      v = next(v);
+    } else if (p < pattern.size() && fold(pattern[p]) == fold(value[v])) {
+      p++;
+      v++;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      v = ++resume;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '%') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+/// Decode the UTF-8 character at an offset, and move the offset past it.
+static uint32_t nextCodePoint(boost::string_ref value, size_t& i) {
+  auto lead = static_cast<unsigned char>(value[i++]);
+  if (lead < 0xC0) {
+    return lead;
+  }
+  size_t length = (lead >= 0xF0) ? 3 : (lead >= 0xE0) ? 2 : 1;
+  uint32_t code = lead & (0x3F >> length);
+  while (length-- > 0 && i < value.size() &&
+         (static_cast<unsigned char>(value[i]) & 0xC0) == 0x80) {
+    code = (code << 6) | (static_cast<unsigned char>(value[i++]) & 0x3F);
+  }
+  return code;
+}
+
+/**
+ * @brief Match a character against the set of a GLOB pattern at an offset.
+ *
+ * @return The offset following the set, or npos if the set is not closed.
+ */
+static size_t globSetMatches(const std::string& pattern,
+                             size_t p,
+                             uint32_t code,
+                             bool& matched) {
+  p++;
+  bool invert = (p < pattern.size() && pattern[p] == '^');
+  if (invert) {
+    p++;
+  }
+
+  matched = false;
+  bool first = true;
+  uint32_t previous = 0;
+  while (p < pattern.size() && (first || pattern[p] != ']')) {
+    first = false;
+    if (pattern[p] == '-' && previous != 0 && p + 1 < pattern.size() &&
+        pattern[p + 1] != ']') {
+      p++;
+      auto upper = nextCodePoint(pattern, p);
+      matched = matched || (code >= previous && code <= upper);
+      previous = 0;
+      continue;
+    }
+    previous = nextCodePoint(pattern, p);
+    matched = matched || (code == previous);
+  }
+
+  if (p >= pattern.size()) {
+    return std::string::npos;
+  }
+  matched = (matched != invert);
+  return p + 1;
+}
+
+bool globMatches(const std::string& pattern, boost::string_ref value) {
+  size_t p = 0;
+  size_t v = 0;
+  size_t star = std::string::npos;
+  size_t resume = 0;
+  while (v < value.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = v;
+      continue;
+    }
+
+    auto next = v;
+    if (p < pattern.size() && pattern[p] == '?') {
+      nextCodePoint(value, next);
+      p++;
+      v = next;
+      continue;
+    }
+    if (p < pattern.size() && pattern[p] == '[') {
+      bool matched = false;
+      auto code = nextCodePoint(value, next);
+      auto end = globSetMatches(pattern, p, code, matched);
+      if (end == std::string::npos) {
+        // A set that is not closed matches nothing.
+        return false;
+      }
+      if (matched) {
+        p = end;
+        v = next;
+        continue;
+      }
+    } else if (p < pattern.size() && pattern[p] == value[v]) {
+      p++;
+      v++;
+      continue;
+    }
+
+    if (star == std::string::npos) {
+      return false;
+    }
+    p = star + 1;
+    nextCodePoint(value, resume);
+    v = resume;
+  }
+
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
 std::vector<std::string> split(const std::string& s, const std::string& delim) {
   std::vector<std::string> elems;
   boost::split(elems, s, boost::is_any_of(delim));
@@ -115,10 +262,65 @@ std::vector<std::string> split(const std::string& s,
   return elems;
 }
 
+/// Remove leading and trailing whitespace, as boost::algorithm::trim.
+static inline boost::string_ref trimRef(boost::string_ref s) {
+  while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+std::vector<boost::string_ref> splitRef(boost::string_ref s,
+                                        boost::string_ref delim) {
+  std::vector<boost::string_ref> elems;
+  size_t start = 0;
+  for (size_t i = 0; i <= s.size(); i++) {
+    if (i < s.size() && delim.find(s[i]) == boost::string_ref::npos) {
+      continue;
+    }
+    // Empty elements are removed before the remaining elements are trimmed.
+    if (i > start) {
+      elems.push_back(trimRef(s.substr(start, i - start)));
+    }
+    start = i + 1;
+  }
+  return elems;
+}
+
+void iterateLines(boost::string_ref content,
+                  std::function<void(boost::string_ref line)> predicate) {
+  while (!content.empty()) {
+    auto end = content.find('\n');
+    auto line = content.substr(0, end);
+    if (!line.empty()) {
+      predicate(trimRef(line));
+    }
+    if (end == boost::string_ref::npos) {
+      break;
+    }
+    content.remove_prefix(end + 1);
+  }
+}
+
 std::string join(const std::vector<std::string>& s, const std::string& tok) {
   return boost::algorithm::join(s, tok);
 }
 
+std::string join(const std::vector<boost::string_ref>& s,
+                 const std::string& tok) {
+  std::string joined;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (i > 0) {
+      joined += tok;
+    }
+    joined.append(s[i].data(), s[i].size());
+  }
+  return joined;
+}
+
 std::string getBufferSHA1(const char* buffer, size_t size) {
   // SHA1 produces 160-bit digests, so allocate (5 * 32) bits.
   uint32_t digest[5] = {0};
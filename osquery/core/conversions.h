@@ -12,12 +12,14 @@
 
 #include <limits.h>
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -77,6 +79,33 @@ std::vector<std::string> split(const std::string& s,
                                const std::string& delim,
                                size_t occurences);
 
+/**
+ * @brief Split a string in place, without copying the elements.
+ *
+ * The elements are those of osquery::split: empty elements are removed and
+ * the remaining elements are trimmed of whitespace. Each element refers to
+ * the input, which must outlive the result.
+ *
+ * @param s the string that you'd like to split
+ * @param delim the delimiters which you'd like to split the string by
+ *
+ * @return a vector of references to the elements of s.
+ */
+std::vector<boost::string_ref> splitRef(boost::string_ref s,
+                                        boost::string_ref delim = "\t ");
+
+/**
+ * @brief Call a predicate with each line of content, without copying.
+ *
+ * The lines are those of osquery::split(content, "\n"): empty lines are
+ * skipped and the remaining lines are trimmed of whitespace.
+ *
+ * @param content the content to iterate
+ * @param predicate called with a reference to each line
+ */
+void iterateLines(boost::string_ref content,
+                  std::function<void(boost::string_ref line)> predicate);
+
 /**
  * @brief In-line replace all instances of from with to.
  *
@@ -108,6 +137,10 @@ inline void replaceAll(std::string& str,
  */
 std::string join(const std::vector<std::string>& s, const std::string& tok);
 
+/// Join string references, see osquery::join.
+std::string join(const std::vector<boost::string_ref>& s,
+                 const std::string& tok);
+
 /**
  * @brief Decode a base64 encoded string.
  *
@@ -132,6 +165,24 @@ std::string base64Encode(const std::string& unencoded);
  */
 bool isPrintable(const std::string& check);
 
+/**
+ * @brief Match a value against a SQL LIKE pattern.
+ *
+ * This follows SQLite's default LIKE: ASCII letters match case-insensitively,
+ * '%' matches any sequence and '_' matches a single UTF-8 character. There is
+ * no escape character without an ESCAPE clause.
+ */
+bool likeMatches(const std::string& pattern, boost::string_ref value);
+
+/**
+ * @brief Match a value against a SQL GLOB pattern.
+ *
+ * This follows SQLite's GLOB: matching is case-sensitive, '*' matches any
+ * sequence, '?' matches a single UTF-8 character, and '[...]' matches a
+ * character within the set or ranges, or not within them with '[^...]'.
+ */
+bool globMatches(const std::string& pattern, boost::string_ref value);
+
 /// Safely convert a string representation of an integer base.
 inline Status safeStrtol(const std::string& rep, size_t base, long int& out) {
   char* end{nullptr};
@@ -8,6 +8,7 @@
  *
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <random>
@@ -39,7 +40,11 @@
 #include <osquery/registry.h>
 #include <osquery/system.h>
 
+#include "osquery/config/parsers/decorators.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/profiler.h"
 #include "osquery/core/watcher.h"
 
 #if defined(__linux__) || defined(__FreeBSD__)
@@ -120,11 +125,26 @@ static inline bool hasWorkerVariable() {
 
 volatile std::sig_atomic_t kHandledSignal{0};
 
+/// The time the process loaded, the start of its initialization.
+static const auto kProcessLoadTime = std::chrono::steady_clock::now();
+
+/// Milliseconds the process took to start, 0 until it started.
+static std::atomic<size_t> kStartupDuration{0};
+
 static inline bool isWatcher() {
   return (osquery::Watcher::getWorker().isValid());
 }
 
 void signalHandler(int num) {
+  // A hangup is not an exit request, it may be received many times.
+  if (num == SIGHUP) {
+    if (!isWatcher() || hasWorkerVariable()) {
+      // Reopen log files after an external rotation.
+      osquery::requestLogReopen();
+    }
+    return;
+  }
+
   // Inform exit status of main threads blocked by service joins.
   if (kHandledSignal == 0) {
     kHandledSignal = num;
@@ -137,11 +157,7 @@ void signalHandler(int num) {
     }
 
     // Handle signals based on a tri-state (worker, watcher, neither).
-    if (num == SIGHUP) {
-      if (!isWatcher() || hasWorkerVariable()) {
-        // Reload configuration.
-      }
-    } else if (num == SIGTERM || num == SIGINT || num == SIGABRT ||
+    if (num == SIGTERM || num == SIGINT || num == SIGABRT ||
                num == SIGUSR1) {
 #ifndef WIN32
       // Time to stop, set an upper bound time constraint on how long threads
@@ -630,6 +646,29 @@ void Initializer::start() const {
   // Start event threads.
   osquery::attachEvents();
   EventFactory::delay();
+
+  // Optionally export internal metrics for a local collector.
+  if (!isWatcher()) {
+    startMetricsExport();
+  }
+
+  // Keep caches and buffers within a share of the watchdog memory limit.
+  startMemoryBudget();
+
+  // Sample CPU stacks while --cpu_profile is set, it may be set at runtime.
+  if (!isWatcher()) {
+    startCPUProfiler();
+  }
+
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - kProcessLoadTime)
+                      .count();
+  kStartupDuration = static_cast<size_t>(duration);
+  getMetricGauge("startup_milliseconds").set(duration);
+}
+
+size_t Initializer::getStartupDuration() {
+  return kStartupDuration;
 }
 
 void Initializer::waitForShutdown() {
@@ -638,6 +677,9 @@ void Initializer::waitForShutdown() {
   // End any event type run loops.
   EventFactory::end(true);
 
+  // Hand off state to the next worker while the database is open.
+  saveDecorations();
+
   // Hopefully release memory used by global string constructors in gflags.
   GFLAGS_NAMESPACE::ShutDownCommandLineFlags();
   DatabasePlugin::shutdown();
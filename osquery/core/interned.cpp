@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <unordered_map>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "osquery/core/interned.h"
+
+namespace osquery {
+
+/// Strings up to this size are usually stored within the string object.
+const size_t kShortStringSize = 15;
+
+/// FNV-1a of the strings being interned.
+struct StringRefHash {
+  size_t operator()(const boost::string_ref& s) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const auto& c : s) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+  }
+};
+
+/// The interned index of each distinct string, referencing the input rows.
+using StringIndex =
+    std::unordered_map<boost::string_ref, uint32_t, StringRefHash>;
+
+static uint32_t intern(const std::string& s,
+                       StringIndex& index,
+                       std::vector<std::string>& strings) {
+  auto it = index.find(s);
+  if (it != index.end()) {
+    return it->second;
+  }
+
+  auto id = static_cast<uint32_t>(strings.size());
+  strings.push_back(s);
+  index.emplace(boost::string_ref(s), id);
+  return id;
+}
+
+static size_t stringBytes(const std::string& s) {
+  return sizeof(std::string) +
+         ((s.size() > kShortStringSize) ? s.capacity() + 1 : 0);
+}
+
+InternedQueryData::InternedQueryData(const QueryData& results) {
+  StringIndex columns;
+  StringIndex values;
+  std::map<std::vector<uint32_t>, uint32_t> shapes;
+
+  rows_.reserve(results.size());
+  std::vector<uint32_t> shape;
+  for (const auto& r : results) {
+    InternedRow row;
+    row.values.reserve(r.size());
+    shape.clear();
+    for (const auto& column : r) {
+      shape.push_back(intern(column.first, columns, columns_));
+      row.values.push_back(intern(column.second, values, values_));
+    }
+
+    auto it = shapes.find(shape);
+    if (it == shapes.end()) {
+      it = shapes.emplace(shape, static_cast<uint32_t>(shapes_.size())).first;
+      shapes_.push_back(shape);
+    }
+    row.shape = it->second;
+    rows_.push_back(std::move(row));
+  }
+
+  columns_.shrink_to_fit();
+  values_.shrink_to_fit();
+  shapes_.shrink_to_fit();
+
+  bytes_ = sizeof(InternedQueryData);
+  for (const auto& column : columns_) {
+    bytes_ += stringBytes(column);
+  }
+  for (const auto& value : values_) {
+    bytes_ += stringBytes(value);
+  }
+  for (const auto& columns : shapes_) {
+    bytes_ += sizeof(columns) + columns.capacity() * sizeof(uint32_t);
+  }
+  for (const auto& row : rows_) {
+    bytes_ += sizeof(row) + row.values.capacity() * sizeof(uint32_t);
+  }
+}
+
+QueryData InternedQueryData::rows() const {
+  QueryData results;
+  results.reserve(rows_.size());
+  for (size_t i = 0; i < rows_.size(); i++) {
+    results.push_back(row(i));
+  }
+  return results;
+}
+
+Row InternedQueryData::row(size_t index) const {
+  Row r;
+  const auto& row = rows_[index];
+  const auto& shape = shapes_[row.shape];
+  for (size_t i = 0; i < shape.size(); i++) {
+    // The shape's columns are in Row order, each is inserted at the end.
+    r.emplace_hint(r.end(), columns_[shape[i]], values_[row.values[i]]);
+  }
+  return r;
+}
+
+bool InternedQueryData::equalRows(size_t left, size_t right) const {
+  const auto& l = rows_[left];
+  const auto& r = rows_[right];
+  return l.shape == r.shape && l.values == r.values;
+}
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osquery/database.h>
+
+namespace osquery {
+
+/**
+ * @brief Query results stored with their column names and values interned.
+ *
+ * Large results repeat the same column names in every row, and the same
+ * values across many rows: usernames, package architectures, socket states,
+ * or the paths of mapped libraries. Each distinct name and value is stored
+ * once and a row keeps the indexes of its values. Rows with the same columns
+ * share one list of column indexes.
+ *
+ * Results kept in memory between queries, such as table caches, are stored
+ * interned and expanded into Row maps when they are read, so tables and
+ * queries keep using the Row API.
+ */
+class InternedQueryData {
+ public:
+  InternedQueryData() = default;
+
+  /// Intern the rows of a result.
+  explicit InternedQueryData(const QueryData& results);
+
+  /// Expand the rows.
+  QueryData rows() const;
+
+  /// Expand a single row.
+  Row row(size_t index) const;
+
+  /**
+   * @brief Check if two rows have the same columns and values.
+   *
+   * Equal names and values have equal indexes, the strings are not compared.
+   */
+  bool equalRows(size_t left, size_t right) const;
+
+  /// The number of rows.
+  size_t size() const {
+    return rows_.size();
+  }
+
+  bool empty() const {
+    return rows_.empty();
+  }
+
+  /// The approximate heap bytes held, including the interned strings.
+  size_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  struct InternedRow {
+    /// The row's list of column indexes, in shapes_.
+    uint32_t shape{0};
+
+    /// The index of each column's value, in the order of the shape.
+    std::vector<uint32_t> values;
+  };
+
+  /// Distinct column names.
+  std::vector<std::string> columns_;
+
+  /// Distinct lists of column indexes, in Row order.
+  std::vector<std::vector<uint32_t>> shapes_;
+
+  /// Distinct values.
+  std::vector<std::string> values_;
+
+  std::vector<InternedRow> rows_;
+
+  size_t bytes_{0};
+};
+}
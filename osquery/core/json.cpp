@@ -0,0 +1,477 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Append a code point as UTF-8.
+static void appendUTF8(uint32_t code, std::string& output) {
+  if (code < 0x80) {
+    output += static_cast<char>(code);
+  } else if (code < 0x800) {
+    output += static_cast<char>(0xC0 | (code >> 6));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    output += static_cast<char>(0xE0 | (code >> 12));
+    output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    output += static_cast<char>(0xF0 | (code >> 18));
+    output += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+/**
+ * @brief A JSON parser reading content in place.
+ *
+ * Containers are tracked with an explicit stack, so deeply nested content
+ * does not grow the thread's stack.
+ */
+class JSONParser {
+ public:
+  JSONParser(boost::string_ref content, JSONHandler& handler, bool comments)
+      : start_(content.data()),
+        pos_(content.data()),
+        end_(content.data() + content.size()),
+        handler_(handler),
+        comments_(comments) {}
+
+  Status parse() {
+    skipSpace();
+    if (pos_ == end_) {
+      return error("No JSON content");
+    }
+
+    std::vector<char> containers;
+    bool value = true;
+    while (true) {
+      if (value) {
+        if (pos_ == end_) {
+          return error("Expected a value");
+        }
+
+        value = false;
+        if (*pos_ == '{') {
+          pos_++;
+          if (!handler_.startObject()) {
+            return error("Stopped");
+          }
+          skipSpace();
+          if (pos_ != end_ && *pos_ == '}') {
+            pos_++;
+            if (!handler_.endObject()) {
+              return error("Stopped");
+            }
+          } else {
+            containers.push_back('{');
+            if (!parseKey()) {
+              return status_;
+            }
+            value = true;
+            continue;
+          }
+        } else if (*pos_ == '[') {
+          pos_++;
+          if (!handler_.startArray()) {
+            return error("Stopped");
+          }
+          skipSpace();
+          if (pos_ != end_ && *pos_ == ']') {
+            pos_++;
+            if (!handler_.endArray()) {
+              return error("Stopped");
+            }
+          } else {
+            containers.push_back('[');
+            value = true;
+            continue;
+          }
+        } else if (*pos_ == '"') {
+          if (!parseString()) {
+            return status_;
+          }
+          if (!handler_.value(buffer_, true)) {
+            return error("Stopped");
+          }
+        } else {
+          if (!parseLiteral()) {
+            return status_;
+          }
+          if (!handler_.value(buffer_, false)) {
+            return error("Stopped");
+          }
+        }
+      }
+
+      // A value ended, continue or close its container.
+      skipSpace();
+      if (containers.empty()) {
+        break;
+      }
+      if (pos_ == end_) {
+        return error("Unterminated container");
+      }
+
+      auto container = containers.back();
+      if (*pos_ == ',') {
+        pos_++;
+        skipSpace();
+        if (container == '{' && !parseKey()) {
+          return status_;
+        }
+        value = true;
+      } else if (container == '{' && *pos_ == '}') {
+        pos_++;
+        containers.pop_back();
+        if (!handler_.endObject()) {
+          return error("Stopped");
+        }
+      } else if (container == '[' && *pos_ == ']') {
+        pos_++;
+        containers.pop_back();
+        if (!handler_.endArray()) {
+          return error("Stopped");
+        }
+      } else {
+        return error("Expected ',' or the end of a container");
+      }
+    }
+
+    if (pos_ != end_) {
+      return error("Unexpected content after the JSON value");
+    }
+    return Status(0, "OK");
+  }
+
+ private:
+  Status error(const std::string& message) {
+    status_ = Status(1,
+                     "JSON parse error at offset " +
+                         std::to_string(pos_ - start_) + ": " + message);
+    return status_;
+  }
+
+  /// Skip whitespace, and comments if they are allowed.
+  void skipSpace() {
+    while (pos_ != end_) {
+      auto c = *pos_;
+      if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        pos_++;
+      } else if (comments_ && (c == '#' || (c == '/' && pos_ + 1 != end_ &&
+                                            pos_[1] == '/'))) {
+        auto newline =
+            static_cast<const char*>(memchr(pos_, '\n', end_ - pos_));
+        pos_ = (newline == nullptr) ? end_ : newline;
+      } else if (comments_ && c == '\\' && pos_ + 1 != end_ &&
+                 pos_[1] == '\n') {
+        pos_ += 2;
+      } else {
+        break;
+      }
+    }
+  }
+
+  /// Parse an object member's name and the ':' following it.
+  bool parseKey() {
+    if (pos_ == end_ || *pos_ != '"') {
+      error("Expected a member name");
+      return false;
+    }
+    if (!parseString()) {
+      return false;
+    }
+    if (!handler_.key(buffer_)) {
+      error("Stopped");
+      return false;
+    }
+    skipSpace();
+    if (pos_ == end_ || *pos_ != ':') {
+      error("Expected ':'");
+      return false;
+    }
+    pos_++;
+    skipSpace();
+    return true;
+  }
+
+  /// Read 4 hex digits of a \u escape.
+  bool parseHex(uint32_t& code) {
+    if (end_ - pos_ < 4) {
+      return false;
+    }
+    code = 0;
+    for (size_t i = 0; i < 4; i++) {
+      auto c = *pos_++;
+      code <<= 4;
+      if (c >= '0' && c <= '9') {
+        code |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        code |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        code |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Parse and unescape a string into the buffer.
+  bool parseString() {
+    buffer_.clear();
+    pos_++;
+    while (true) {
+      // Runs of plain characters are appended at once.
+      auto run = pos_;
+      while (pos_ != end_ && *pos_ != '"' && *pos_ != '\\' &&
+             static_cast<unsigned char>(*pos_) >= 0x20) {
+        pos_++;
+      }
+      buffer_.append(run, pos_ - run);
+
+      if (pos_ == end_) {
+        error("Unterminated string");
+        return false;
+      }
+      if (*pos_ == '"') {
+        pos_++;
+        return true;
+      }
+      if (*pos_ != '\\') {
+        error("Control character in a string");
+        return false;
+      }
+
+      pos_++;
+      if (pos_ == end_) {
+        error("Unterminated string");
+        return false;
+      }
+      auto c = *pos_++;
+      switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        buffer_ += c;
+        break;
+      case 'b':
+        buffer_ += '\b';
+        break;
+      case 'f':
+        buffer_ += '\f';
+        break;
+      case 'n':
+        buffer_ += '\n';
+        break;
+      case 'r':
+        buffer_ += '\r';
+        break;
+      case 't':
+        buffer_ += '\t';
+        break;
+      case '\n':
+        // A line continuation, only allowed with comments.
+        if (!comments_) {
+          error("Invalid escape");
+          return false;
+        }
+        break;
+      case 'u': {
+        uint32_t code = 0;
+        if (!parseHex(code)) {
+          error("Invalid unicode escape");
+          return false;
+        }
+        // A high surrogate must be followed by a low surrogate, they are
+        // combined. Unpaired surrogates are not valid UTF-8.
+        if (code >= 0xDC00 && code <= 0xDFFF) {
+          error("Invalid unicode surrogate");
+          return false;
+        }
+        if (code >= 0xD800 && code <= 0xDBFF) {
+          uint32_t low = 0;
+          if (end_ - pos_ < 6 || pos_[0] != '\\' || pos_[1] != 'u') {
+            error("Invalid unicode surrogate");
+            return false;
+          }
+          pos_ += 2;
+          if (!parseHex(low) || low < 0xDC00 || low > 0xDFFF) {
+            error("Invalid unicode surrogate");
+            return false;
+          }
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        appendUTF8(code, buffer_);
+        break;
+      }
+      default:
+        error("Invalid escape");
+        return false;
+      }
+    }
+  }
+
+  /// Parse a number, true, false, or null into the buffer.
+  bool parseLiteral() {
+    auto start = pos_;
+    for (const auto& word : {"true", "false", "null"}) {
+      auto size = strlen(word);
+      if (static_cast<size_t>(end_ - pos_) >= size &&
+          memcmp(pos_, word, size) == 0) {
+        pos_ += size;
+        buffer_.assign(start, size);
+        return true;
+      }
+    }
+
+    auto digits = [this]() {
+      auto first = pos_;
+      while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9') {
+        pos_++;
+      }
+      return pos_ - first;
+    };
+
+    if (pos_ != end_ && *pos_ == '-') {
+      pos_++;
+    }
+    auto integer = pos_;
+    if (digits() == 0 || (*integer == '0' && pos_ - integer > 1)) {
+      pos_ = start;
+      error("Expected a value");
+      return false;
+    }
+    if (pos_ != end_ && *pos_ == '.') {
+      pos_++;
+      if (digits() == 0) {
+        error("Invalid number");
+        return false;
+      }
+    }
+    if (pos_ != end_ && (*pos_ == 'e' || *pos_ == 'E')) {
+      pos_++;
+      if (pos_ != end_ && (*pos_ == '+' || *pos_ == '-')) {
+        pos_++;
+      }
+      if (digits() == 0) {
+        error("Invalid number");
+        return false;
+      }
+    }
+    buffer_.assign(start, pos_ - start);
+    return true;
+  }
+
+ private:
+  const char* start_{nullptr};
+  const char* pos_{nullptr};
+  const char* end_{nullptr};
+
+  JSONHandler& handler_;
+  bool comments_{false};
+
+  /// The last string or literal, reused between values.
+  std::string buffer_;
+
+  Status status_;
+};
+
+Status parseJSONEvents(boost::string_ref content,
+                       JSONHandler& handler,
+                       bool comments) {
+  return JSONParser(content, handler, comments).parse();
+}
+
+/// Build a property tree as read_json does.
+class JSONTreeHandler : public JSONHandler {
+ public:
+  explicit JSONTreeHandler(pt::ptree& root) : root_(root) {}
+
+  bool startObject() override {
+    push();
+    return true;
+  }
+
+  bool endObject() override {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool startArray() override {
+    push();
+    return true;
+  }
+
+  bool endArray() override {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool key(std::string& name) override {
+    key_ = std::move(name);
+    return true;
+  }
+
+  bool value(std::string& value, bool string) override {
+    if (stack_.empty()) {
+      root_.data() = std::move(value);
+      return true;
+    }
+
+    auto child =
+        stack_.back()->push_back(std::make_pair(std::move(key_), pt::ptree()));
+    child->second.data() = std::move(value);
+    key_.clear();
+    return true;
+  }
+
+ private:
+  /// Add a container, array elements have empty names.
+  void push() {
+    if (stack_.empty()) {
+      stack_.push_back(&root_);
+      return;
+    }
+
+    auto child =
+        stack_.back()->push_back(std::make_pair(std::move(key_), pt::ptree()));
+    key_.clear();
+    stack_.push_back(&child->second);
+  }
+
+ private:
+  pt::ptree& root_;
+
+  /// The open containers, children are not moved by later insertions.
+  std::vector<pt::ptree*> stack_;
+
+  std::string key_;
+};
+
+Status parseJSONTree(boost::string_ref content,
+                     pt::ptree& tree,
+                     bool comments) {
+  tree.clear();
+  JSONTreeHandler handler(tree);
+  auto status = parseJSONEvents(content, handler, comments);
+  if (!status.ok()) {
+    tree.clear();
+  }
+  return status;
+}
+}
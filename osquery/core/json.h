@@ -23,3 +23,104 @@
 // We need to reinclude this to re-enable boost's warning suppression
 #include <boost/config/compiler/visualc.hpp>
 #endif
+
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Append a quoted and escaped JSON string.
+ *
+ * The escaping matches the property tree JSON writer, so values written
+ * directly and values written from a tree are identical.
+ */
+inline void writeJSONString(const std::string& value, std::string& json) {
+  json += '"';
+  // Printable ASCII is written as-is, except for quotes and (back)slashes.
+  bool plain = true;
+  for (const auto& c : value) {
+    auto u = static_cast<unsigned char>(c);
+    if (u < 0x20 || u > 0x7F || c == '"' || c == '/' || c == '\\') {
+      plain = false;
+      break;
+    }
+  }
+
+  if (plain) {
+    json += value;
+  } else {
+    json += boost::property_tree::json_parser::create_escapes(value);
+  }
+  json += '"';
+}
+
+/**
+ * @brief Receives the events of a streaming JSON parse.
+ *
+ * Each method returns false to stop the parse. Scalars are given as text:
+ * strings unescaped, and numbers, true, false, and null as written. The
+ * handler may move the given strings.
+ */
+class JSONHandler {
+ public:
+  virtual ~JSONHandler() {}
+
+  virtual bool startObject() {
+    return true;
+  }
+
+  virtual bool endObject() {
+    return true;
+  }
+
+  virtual bool startArray() {
+    return true;
+  }
+
+  virtual bool endArray() {
+    return true;
+  }
+
+  /// The name of an object member, its value's events follow.
+  virtual bool key(std::string& name) {
+    return true;
+  }
+
+  /// A scalar value, string is false for numbers, true, false, and null.
+  virtual bool value(std::string& value, bool string) {
+    return true;
+  }
+};
+
+/**
+ * @brief Parse JSON content in place, calling a handler for each event.
+ *
+ * The content is neither copied into a stream nor into a tree. Callers that
+ * only need some members, or build their own objects, avoid the transient
+ * memory of a property tree.
+ *
+ * @param content the JSON text.
+ * @param handler receives the events.
+ * @param comments allow the comments of config content: from '#' or '//' to
+ * the end of a line outside of strings, and backslash-newline sequences.
+ *
+ * @return failure if the content is not JSON or the handler stopped.
+ */
+Status parseJSONEvents(boost::string_ref content,
+                       JSONHandler& handler,
+                       bool comments = false);
+
+/**
+ * @brief Parse JSON content into a property tree, see parseJSONEvents.
+ *
+ * The tree is the same as boost::property_tree::read_json's, without the
+ * copies of reading the content from a stream.
+ */
+Status parseJSONTree(boost::string_ref content,
+                     boost::property_tree::ptree& tree,
+                     bool comments = false);
+}
@@ -0,0 +1,219 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/core/watcher.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     memory_budget,
+     80,
+     "Percent of the watchdog memory limit shared by caches (0 disables)");
+
+namespace {
+
+/// While the footprint stays over the budget, everything is released this often.
+const std::chrono::minutes kMemoryReleaseCooldown(5);
+
+/// Pressure ends once the footprint is below this percent of the budget.
+const size_t kMemoryPressureExitPercent = 90;
+
+struct MemoryConsumer {
+  size_t weight{1};
+  MemoryUsageFunction usage;
+  MemoryShrinkFunction shrink;
+  size_t shrinks{0};
+};
+
+struct MemoryConsumers {
+  std::map<std::string, MemoryConsumer> consumers;
+  std::mutex mutex;
+
+  /// The footprint exceeded the budget and has not dropped below the exit.
+  bool pressure{false};
+
+  /// When consumers were last asked to release everything.
+  std::chrono::steady_clock::time_point released;
+};
+
+MemoryConsumers& getConsumers() {
+  static MemoryConsumers consumers;
+  return consumers;
+}
+
+/// Copy the consumers, their functions are called without the lock.
+std::map<std::string, MemoryConsumer> copyConsumers(size_t& total_weight) {
+  auto& consumers = getConsumers();
+  std::lock_guard<std::mutex> lock(consumers.mutex);
+  total_weight = 0;
+  for (const auto& consumer : consumers.consumers) {
+    total_weight += consumer.second.weight;
+  }
+  return consumers.consumers;
+}
+
+void collectMemoryMetrics(std::vector<MetricValue>& values) {
+  for (const auto& consumer : getMemoryConsumers()) {
+    MetricValue bytes;
+    bytes.name = "memory_consumer_bytes";
+    bytes.labels = {{"consumer", consumer.name}};
+    bytes.type = MetricType::GAUGE;
+    bytes.value = static_cast<int64_t>(consumer.bytes);
+    values.push_back(bytes);
+
+    MetricValue budget = bytes;
+    budget.name = "memory_consumer_budget_bytes";
+    budget.value = static_cast<int64_t>(consumer.budget);
+    values.push_back(budget);
+
+    MetricValue shrinks = bytes;
+    shrinks.name = "memory_consumer_shrinks";
+    shrinks.type = MetricType::COUNTER;
+    shrinks.value = static_cast<int64_t>(consumer.shrinks);
+    values.push_back(shrinks);
+  }
+}
+
+/// Check memory consumers against the budget on the watchdog's interval.
+class MemoryBudgetRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    ProcessStats stats;
+    if (getProcessStats(platformGetPid(), stats).ok()) {
+      auto resident = static_cast<size_t>(stats.resident_size);
+      if (initial_ == 0) {
+        initial_ = resident;
+      }
+      auto footprint = (resident > initial_) ? resident - initial_ : 0;
+      checkMemoryBudget(getMemoryBudget(), footprint);
+    }
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::seconds(getWorkerLimit(WatchdogLimitType::INTERVAL));
+  }
+
+ private:
+  /// Like the watchdog, only allocations after the first sample count.
+  size_t initial_{0};
+};
+}
+
+void registerMemoryConsumer(const std::string& name,
+                            size_t weight,
+                            MemoryUsageFunction usage,
+                            MemoryShrinkFunction shrink) {
+  {
+    auto& consumers = getConsumers();
+    std::lock_guard<std::mutex> lock(consumers.mutex);
+    auto& consumer = consumers.consumers[name];
+    consumer.weight = weight;
+    consumer.usage = std::move(usage);
+    consumer.shrink = std::move(shrink);
+  }
+  registerMetricCollector("memory", collectMemoryMetrics);
+}
+
+void deregisterMemoryConsumer(const std::string& name) {
+  auto& consumers = getConsumers();
+  std::lock_guard<std::mutex> lock(consumers.mutex);
+  consumers.consumers.erase(name);
+}
+
+size_t getMemoryBudget() {
+  auto limit = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  return static_cast<size_t>(limit / 100 * FLAGS_memory_budget);
+}
+
+void checkMemoryBudget(size_t budget, size_t footprint) {
+  size_t total_weight = 0;
+  auto consumers = copyConsumers(total_weight);
+  if (total_weight == 0) {
+    return;
+  }
+
+  // Freed memory is not always returned to the system, the footprint may stay
+  // over the budget after a release. It is not repeated every check.
+  bool pressure = false;
+  {
+    auto& registered = getConsumers();
+    std::lock_guard<std::mutex> lock(registered.mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (footprint > budget) {
+      if (!registered.pressure ||
+          now - registered.released >= kMemoryReleaseCooldown) {
+        pressure = true;
+        registered.released = now;
+      }
+      registered.pressure = true;
+    } else if (footprint < budget / 100 * kMemoryPressureExitPercent) {
+      registered.pressure = false;
+    }
+  }
+
+  for (const auto& consumer : consumers) {
+    auto bytes = consumer.second.usage();
+    auto share = budget / total_weight * consumer.second.weight;
+    if (bytes == 0 || (!pressure && bytes <= share)) {
+      continue;
+    }
+
+    auto target = (pressure) ? 0 : share;
+    VLOG(1) << "Memory consumer " << consumer.first << " holds " << bytes
+            << " bytes, shrinking to " << target;
+    consumer.second.shrink(target);
+
+    auto& registered = getConsumers();
+    std::lock_guard<std::mutex> lock(registered.mutex);
+    auto it = registered.consumers.find(consumer.first);
+    if (it != registered.consumers.end()) {
+      it->second.shrinks++;
+    }
+  }
+}
+
+std::vector<MemoryConsumerUsage> getMemoryConsumers() {
+  size_t total_weight = 0;
+  auto consumers = copyConsumers(total_weight);
+  auto budget = getMemoryBudget();
+
+  std::vector<MemoryConsumerUsage> usages;
+  for (const auto& consumer : consumers) {
+    MemoryConsumerUsage usage;
+    usage.name = consumer.first;
+    usage.weight = consumer.second.weight;
+    usage.bytes = consumer.second.usage();
+    usage.budget = budget / total_weight * consumer.second.weight;
+    usage.shrinks = consumer.second.shrinks;
+    usages.push_back(std::move(usage));
+  }
+  return usages;
+}
+
+void startMemoryBudget() {
+  if (FLAGS_memory_budget > 0 && Initializer::isWorker()) {
+    Dispatcher::addPeriodicService(std::make_shared<MemoryBudgetRunner>(),
+                                   std::chrono::milliseconds(0));
+  }
+}
+}
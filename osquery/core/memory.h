@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace osquery {
+
+/// Report the bytes a consumer holds in memory.
+using MemoryUsageFunction = std::function<size_t()>;
+
+/**
+ * @brief Ask a consumer to release memory.
+ *
+ * The consumer should release reclaimable memory until it holds at most the
+ * target bytes, a target of 0 asks it to release everything it can. Memory
+ * that cannot be reclaimed, such as events that have not been persisted,
+ * must be written out or kept rather than dropped.
+ */
+using MemoryShrinkFunction = std::function<void(size_t target)>;
+
+/// A consumer's usage and its share of the memory budget.
+struct MemoryConsumerUsage {
+  std::string name;
+
+  /// The consumer's relative share of the budget.
+  size_t weight{0};
+
+  /// Bytes held by the consumer.
+  size_t bytes{0};
+
+  /// The consumer's share of the budget in bytes.
+  size_t budget{0};
+
+  /// The number of times the consumer was asked to shrink.
+  size_t shrinks{0};
+};
+
+/**
+ * @brief Add or replace a consumer of the memory budget.
+ *
+ * Caches and buffers that grow with the workload register as consumers. Each
+ * is given a part of the budget proportional to its weight.
+ *
+ * @param name a consumer name, such as "table_cache"
+ * @param weight the consumer's relative share of the budget
+ * @param usage reports the bytes the consumer holds
+ * @param shrink releases memory when the consumer exceeds its share
+ */
+void registerMemoryConsumer(const std::string& name,
+                            size_t weight,
+                            MemoryUsageFunction usage,
+                            MemoryShrinkFunction shrink);
+
+/// Remove a consumer, such as a plugin that is tearing down.
+void deregisterMemoryConsumer(const std::string& name);
+
+/**
+ * @brief The bytes shared by memory consumers.
+ *
+ * This is --memory_budget percent of the watchdog's memory limit. The memory
+ * the process used when it started does not count against the watchdog limit
+ * nor the budget.
+ */
+size_t getMemoryBudget();
+
+/**
+ * @brief Check every consumer against its share of a budget.
+ *
+ * A consumer holding more than its share is asked to shrink to its share.
+ * When the process footprint exceeds the budget every consumer is asked to
+ * release what it can, before the watchdog would restart the worker. While
+ * the footprint stays over 90% of the budget this is repeated at most every
+ * 5 minutes.
+ *
+ * @param budget the bytes shared by consumers
+ * @param footprint the bytes the process allocated since it started
+ */
+void checkMemoryBudget(size_t budget, size_t footprint);
+
+/// The current usage of each consumer and its share of the budget.
+std::vector<MemoryConsumerUsage> getMemoryConsumers();
+
+/**
+ * @brief Start checking memory consumers on the watchdog's interval.
+ *
+ * This only applies to a worker process, which has a watchdog memory limit.
+ */
+void startMemoryBudget();
+}
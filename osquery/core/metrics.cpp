@@ -0,0 +1,305 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/metrics.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(string,
+     metrics_export_path,
+     "",
+     "Write internal metrics in the OpenMetrics text format to a file");
+
+FLAG(uint64,
+     metrics_export_interval,
+     60,
+     "Seconds between writes of --metrics_export_path");
+
+namespace {
+
+using MetricKey = std::pair<std::string, MetricLabels>;
+
+/// Every metric by type, metrics are never removed.
+struct MetricRegistry {
+  std::map<MetricKey, std::unique_ptr<MetricCounter>> counters;
+  std::map<MetricKey, std::unique_ptr<MetricGauge>> gauges;
+  std::map<MetricKey, std::unique_ptr<MetricHistogram>> histograms;
+  std::map<std::string, MetricCollector> collectors;
+  std::mutex mutex;
+};
+
+MetricRegistry& getRegistry() {
+  static MetricRegistry registry;
+  return registry;
+}
+
+template <typename T>
+T& getMetric(std::map<MetricKey, std::unique_ptr<T>>& metrics,
+             const std::string& name,
+             const MetricLabels& labels) {
+  std::lock_guard<std::mutex> lock(getRegistry().mutex);
+  auto& metric = metrics[std::make_pair(name, labels)];
+  if (metric == nullptr) {
+    metric = std::unique_ptr<T>(new T());
+  }
+  return *metric;
+}
+
+/// Write metrics to --metrics_export_path on an interval.
+class MetricsExportRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    auto temp = FLAGS_metrics_export_path + ".tmp";
+    auto status = writeTextFile(temp, formatOpenMetrics(getMetrics()), 0644);
+    if (status.ok()) {
+      // Readers never see a partially written file.
+      boost::system::error_code ec;
+      fs::rename(temp, FLAGS_metrics_export_path, ec);
+      if (ec) {
+        status = Status(1, ec.message());
+      }
+    }
+    if (!status.ok()) {
+      VLOG(1) << "Cannot write metrics: " << status.getMessage();
+    }
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::seconds(FLAGS_metrics_export_interval);
+  }
+};
+}
+
+size_t MetricHistogram::bucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<size_t>(value);
+  }
+
+  // The magnitude, the log2 of the value, is at least 3.
+  size_t magnitude = 3;
+  while (magnitude < 63 && (value >> (magnitude + 1)) != 0) {
+    magnitude++;
+  }
+  auto sub = static_cast<size_t>(value >> (magnitude - 3)) & (kSubBuckets - 1);
+  return (magnitude - 2) * kSubBuckets + sub;
+}
+
+uint64_t MetricHistogram::bucketUpperBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+
+  size_t magnitude = index / kSubBuckets + 2;
+  uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets)
+                   << (magnitude - 3);
+  return lower + ((1ULL << (magnitude - 3)) - 1);
+}
+
+void MetricHistogram::record(uint64_t value) {
+  buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  auto max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t MetricHistogram::percentile(double quantile) const {
+  // Buckets are read without a snapshot, the total is counted from them.
+  std::array<uint64_t, kBuckets> counts;
+  uint64_t total = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  auto rank = static_cast<uint64_t>(std::ceil(quantile * total));
+  rank = std::max<uint64_t>(std::min(rank, total), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return std::min(bucketUpperBound(i), max());
+    }
+  }
+  return max();
+}
+
+MetricCounter& getMetricCounter(const std::string& name,
+                                const MetricLabels& labels) {
+  return getMetric(getRegistry().counters, name, labels);
+}
+
+MetricGauge& getMetricGauge(const std::string& name,
+                            const MetricLabels& labels) {
+  return getMetric(getRegistry().gauges, name, labels);
+}
+
+MetricHistogram& getMetricHistogram(const std::string& name,
+                                    const MetricLabels& labels) {
+  return getMetric(getRegistry().histograms, name, labels);
+}
+
+void registerMetricCollector(const std::string& name,
+                             MetricCollector collector) {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.collectors[name] = std::move(collector);
+}
+
+std::vector<MetricValue> getMetrics() {
+  std::vector<MetricValue> values;
+  std::map<std::string, MetricCollector> collectors;
+  {
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& counter : registry.counters) {
+      MetricValue value;
+      value.name = counter.first.first;
+      value.labels = counter.first.second;
+      value.type = MetricType::COUNTER;
+      value.value = static_cast<int64_t>(counter.second->value());
+      values.push_back(std::move(value));
+    }
+
+    for (const auto& gauge : registry.gauges) {
+      MetricValue value;
+      value.name = gauge.first.first;
+      value.labels = gauge.first.second;
+      value.type = MetricType::GAUGE;
+      value.value = gauge.second->value();
+      values.push_back(std::move(value));
+    }
+
+    for (const auto& histogram : registry.histograms) {
+      const auto& metric = *histogram.second;
+      MetricValue value;
+      value.name = histogram.first.first;
+      value.labels = histogram.first.second;
+      value.type = MetricType::HISTOGRAM;
+      value.value = static_cast<int64_t>(metric.sum());
+      value.count = metric.count();
+      value.max = metric.max();
+      value.p50 = metric.percentile(0.5);
+      value.p90 = metric.percentile(0.9);
+      value.p99 = metric.percentile(0.99);
+      values.push_back(std::move(value));
+    }
+    collectors = registry.collectors;
+  }
+
+  // Collectors may look up metrics, they are called without the lock.
+  for (const auto& collector : collectors) {
+    collector.second(values);
+  }
+  return values;
+}
+
+/// Format labels as {name="value",...}, with extra labels appended.
+static std::string formatLabels(const MetricLabels& labels,
+                                const std::string& extra = "") {
+  std::string formatted;
+  for (const auto& label : labels) {
+    formatted += (formatted.empty()) ? "" : ",";
+    formatted += label.first + "=\"";
+    for (const auto& c : label.second) {
+      if (c == '"' || c == '\\') {
+        formatted += '\\';
+        formatted += c;
+      } else if (c == '\n') {
+        formatted += "\\n";
+      } else {
+        formatted += c;
+      }
+    }
+    formatted += "\"";
+  }
+  if (!extra.empty()) {
+    formatted += (formatted.empty()) ? extra : "," + extra;
+  }
+  return (formatted.empty()) ? "" : "{" + formatted + "}";
+}
+
+std::string formatOpenMetrics(const std::vector<MetricValue>& values) {
+  // Samples of a metric family must be consecutive.
+  std::map<std::string, std::vector<const MetricValue*>> families;
+  for (const auto& value : values) {
+    families["osquery_" + value.name].push_back(&value);
+  }
+
+  std::stringstream out;
+  for (const auto& family : families) {
+    const auto& name = family.first;
+    auto type = family.second.front()->type;
+    if (type == MetricType::COUNTER) {
+      out << "# TYPE " << name << " counter\n";
+    } else if (type == MetricType::GAUGE) {
+      out << "# TYPE " << name << " gauge\n";
+    } else {
+      out << "# TYPE " << name << " summary\n";
+    }
+
+    for (const auto* value : family.second) {
+      if (value->type != type) {
+        continue;
+      }
+
+      if (type == MetricType::COUNTER) {
+        out << name << "_total" << formatLabels(value->labels) << " "
+            << value->value << "\n";
+      } else if (type == MetricType::GAUGE) {
+        out << name << formatLabels(value->labels) << " " << value->value
+            << "\n";
+      } else {
+        out << name << formatLabels(value->labels, "quantile=\"0.5\"") << " "
+            << value->p50 << "\n";
+        out << name << formatLabels(value->labels, "quantile=\"0.9\"") << " "
+            << value->p90 << "\n";
+        out << name << formatLabels(value->labels, "quantile=\"0.99\"") << " "
+            << value->p99 << "\n";
+        out << name << "_sum" << formatLabels(value->labels) << " "
+            << value->value << "\n";
+        out << name << "_count" << formatLabels(value->labels) << " "
+            << value->count << "\n";
+      }
+    }
+  }
+  out << "# EOF\n";
+  return out.str();
+}
+
+void startMetricsExport() {
+  if (!FLAGS_metrics_export_path.empty()) {
+    Dispatcher::addPeriodicService(std::make_shared<MetricsExportRunner>(),
+                                   std::chrono::milliseconds(0));
+  }
+}
+}
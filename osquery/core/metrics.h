@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// Labels distinguishing metrics of the same name, such as a publisher type.
+using MetricLabels = std::map<std::string, std::string>;
+
+enum class MetricType {
+  COUNTER = 0,
+  GAUGE,
+  HISTOGRAM,
+};
+
+/// A monotonically increasing count.
+class MetricCounter : private boost::noncopyable {
+ public:
+  void add(uint64_t count = 1) {
+    value_.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+/// A value that may go up and down, such as a queue depth.
+class MetricGauge : private boost::noncopyable {
+ public:
+  void set(int64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  void add(int64_t value) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  int64_t value() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * @brief A distribution of values, such as latencies in microseconds.
+ *
+ * Values are counted in log-linear buckets like an HDR histogram: each power
+ * of two is split into 8 linear sub-buckets, so a percentile is reported
+ * within 12.5% of the recorded value. Recording is a few relaxed atomic
+ * increments and never allocates or locks.
+ */
+class MetricHistogram : private boost::noncopyable {
+ public:
+  /// Record a single value.
+  void record(uint64_t value);
+
+  /// The number of recorded values.
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  /// The sum of recorded values.
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+
+  /// The largest recorded value.
+  uint64_t max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Estimate a percentile of the recorded values.
+   *
+   * @param quantile the percentile as a fraction, such as 0.99
+   * @return the upper bound of the bucket holding the percentile, or 0
+   */
+  uint64_t percentile(double quantile) const;
+
+ private:
+  /// The sub-buckets within each power of two.
+  static const size_t kSubBuckets = 8;
+
+  /// Buckets for every uint64_t value.
+  static const size_t kBuckets = (64 - 2) * kSubBuckets;
+
+  static size_t bucketIndex(uint64_t value);
+
+  static uint64_t bucketUpperBound(size_t index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+/// Record the microseconds a scope takes into a histogram.
+class MetricTimer : private boost::noncopyable {
+ public:
+  explicit MetricTimer(MetricHistogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ~MetricTimer() {
+    histogram_.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start_)
+                          .count());
+  }
+
+ private:
+  MetricHistogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// A snapshot of one metric, as reported by the osquery_metrics table.
+struct MetricValue {
+  std::string name;
+  MetricLabels labels;
+  MetricType type{MetricType::COUNTER};
+
+  /// The counter or gauge value, or the histogram's sum.
+  int64_t value{0};
+
+  /// Histogram values.
+  uint64_t count{0};
+  uint64_t max{0};
+  uint64_t p50{0};
+  uint64_t p90{0};
+  uint64_t p99{0};
+};
+
+/**
+ * @brief Report metrics that are kept elsewhere when metrics are read.
+ *
+ * Components that already count their work, such as event publishers, add
+ * their values from a collector instead of updating a second counter.
+ */
+using MetricCollector = std::function<void(std::vector<MetricValue>& values)>;
+
+/**
+ * @brief Find or create a metric.
+ *
+ * Metrics live until the process exits, callers on hot paths should look up
+ * a metric once and keep the reference. A name is only used for one type.
+ *
+ * @param name a metric name, such as "database_get_microseconds"
+ * @param labels optional labels distinguishing metrics of the same name
+ */
+MetricCounter& getMetricCounter(const std::string& name,
+                                const MetricLabels& labels = {});
+
+/// See getMetricCounter.
+MetricGauge& getMetricGauge(const std::string& name,
+                            const MetricLabels& labels = {});
+
+/// See getMetricCounter.
+MetricHistogram& getMetricHistogram(const std::string& name,
+                                    const MetricLabels& labels = {});
+
+/// Add or replace a named collector.
+void registerMetricCollector(const std::string& name,
+                             MetricCollector collector);
+
+/// Read every metric and the values of every collector.
+std::vector<MetricValue> getMetrics();
+
+/**
+ * @brief Format metrics in the OpenMetrics text format.
+ *
+ * Names are prefixed with "osquery_". Counters are reported with a "_total"
+ * suffix and histograms as summaries with 0.5, 0.9 and 0.99 quantiles.
+ */
+std::string formatOpenMetrics(const std::vector<MetricValue>& values);
+
+/**
+ * @brief Start writing metrics to --metrics_export_path.
+ *
+ * The file is replaced every --metrics_export_interval seconds and may be read
+ * by a textfile collector, such as the Prometheus node_exporter's.
+ */
+void startMetricsExport();
+}
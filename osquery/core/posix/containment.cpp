@@ -0,0 +1,121 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/containment.h"
+#include "osquery/core/conversions.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_string(watchdog_cgroup);
+
+#ifdef __linux__
+/// The cgroup v2 CPU quota period in microseconds.
+const size_t kCgroupPeriod = 100000;
+
+/// Path to the created cgroup, empty if containment is not active.
+static fs::path kCgroupPath;
+
+/// Read whitespace-separated "key value" lines from a cgroup file.
+static void readCgroupCounters(const fs::path& path,
+                               const std::string& prefix,
+                               std::map<std::string, size_t>& stats) {
+  std::string content;
+  if (!readFile(path, content).ok()) {
+    return;
+  }
+
+  for (const auto& line : osquery::split(content, "\n")) {
+    auto fields = osquery::split(line, " ");
+    long long value = 0;
+    if (fields.size() == 2 && safeStrtoll(fields[1], 10, value).ok()) {
+      stats[prefix + fields[0]] = static_cast<size_t>(value);
+    }
+  }
+}
+
+Status initContainment(size_t cpu_percent, size_t memory_bytes) {
+  fs::path cgroup(FLAGS_watchdog_cgroup);
+  auto parent = cgroup.parent_path();
+  if (!pathExists(parent / "cgroup.controllers").ok()) {
+    return Status(1, "No cgroup v2 hierarchy at " + parent.string());
+  }
+
+  boost::system::error_code ec;
+  fs::create_directory(cgroup, ec);
+  if (ec.value() != 0 || !pathExists(cgroup / "cgroup.procs").ok()) {
+    return Status(1, "Cannot create cgroup " + cgroup.string());
+  }
+
+  // The controllers may already be enabled for the parent's children.
+  writeTextFile(parent / "cgroup.subtree_control", "+cpu +memory");
+
+  auto quota = std::max(cpu_percent * kCgroupPeriod / 100, (size_t)1000);
+  auto status = writeTextFile(
+      cgroup / "cpu.max",
+      std::to_string(quota) + " " + std::to_string(kCgroupPeriod));
+  if (!status.ok()) {
+    return Status(1, "Cannot set cpu.max: " + status.getMessage());
+  }
+
+  status = writeTextFile(cgroup / "memory.high", std::to_string(memory_bytes));
+  if (!status.ok()) {
+    return Status(1, "Cannot set memory.high: " + status.getMessage());
+  }
+
+  kCgroupPath = cgroup;
+  return Status(0, "OK");
+}
+
+Status containProcess(const PlatformProcess& process) {
+  if (kCgroupPath.empty()) {
+    return Status(1, "Containment is not active");
+  }
+
+  return writeTextFile(kCgroupPath / "cgroup.procs",
+                       std::to_string(process.pid()));
+}
+
+Status getContainmentStats(std::map<std::string, size_t>& stats) {
+  if (kCgroupPath.empty()) {
+    return Status(1, "Containment is not active");
+  }
+
+  std::map<std::string, size_t> cpu, memory;
+  readCgroupCounters(kCgroupPath / "cpu.stat", "", cpu);
+  readCgroupCounters(kCgroupPath / "memory.events", "memory_", memory);
+  for (const auto& key : {"nr_throttled", "throttled_usec"}) {
+    stats[key] = cpu[key];
+  }
+  stats["memory_high"] = memory["memory_high"];
+  return Status(0, "OK");
+}
+#else
+Status initContainment(size_t cpu_percent, size_t memory_bytes) {
+  return Status(1, "Containment is not supported on this platform");
+}
+
+Status containProcess(const PlatformProcess& process) {
+  return Status(1, "Containment is not supported on this platform");
+}
+
+Status getContainmentStats(std::map<std::string, size_t>& stats) {
+  return Status(1, "Containment is not supported on this platform");
+}
+#endif
+}
@@ -11,7 +11,16 @@
 #include <string>
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <libproc.h>
+#elif defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#endif
 
 #include <sys/resource.h>
 #include <sys/syscall.h>
@@ -23,6 +32,8 @@
 
 #include <osquery/flags.h>
 
+#include "osquery/core/conversions.h"
+
 #include "osquery/core/process.h"
 
 namespace osquery {
@@ -94,4 +105,93 @@ int platformGetTid() {
 #endif
   return 0;
 }
+
+#if defined(__linux__)
+Status getProcessStats(int pid, ProcessStats& stats) {
+  auto path = "/proc/" + std::to_string(pid) + "/stat";
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + path);
+  }
+
+  // The stat line is short, a single read avoids the filesystem helpers.
+  char buffer[1024];
+  auto size = ::read(fd, buffer, sizeof(buffer) - 1);
+  ::close(fd);
+  if (size <= 0) {
+    return Status(1, "Cannot read " + path);
+  }
+  buffer[size] = 0;
+
+  // The process name may contain spaces, fields begin after ") ".
+  std::string content(buffer, static_cast<size_t>(size));
+  auto start = content.find_last_of(')');
+  if (start == std::string::npos || content.size() <= start + 2) {
+    return Status(1, "Invalid /proc/stat header");
+  }
+
+  auto details = osquery::split(content.substr(start + 2), " ");
+  if (details.size() <= 21) {
+    return Status(1, "Invalid /proc/stat content");
+  }
+
+  long long parent = 0, user = 0, system = 0, resident = 0;
+  if (!safeStrtoll(details[1], 10, parent) ||
+      !safeStrtoll(details[11], 10, user) ||
+      !safeStrtoll(details[12], 10, system) ||
+      !safeStrtoll(details[21], 10, resident)) {
+    return Status(1, "Invalid /proc/stat content");
+  }
+
+  static const auto kTicks = static_cast<long long>(::sysconf(_SC_CLK_TCK));
+  static const auto kPageSize = static_cast<long long>(::sysconf(_SC_PAGESIZE));
+  stats.parent = static_cast<int>(parent);
+  stats.user_time = static_cast<unsigned long long int>(user * 1000 / kTicks);
+  stats.system_time =
+      static_cast<unsigned long long int>(system * 1000 / kTicks);
+  stats.resident_size =
+      static_cast<unsigned long long int>(resident * kPageSize);
+  return Status(0, "OK");
+}
+#elif defined(__APPLE__)
+Status getProcessStats(int pid, ProcessStats& stats) {
+  struct proc_bsdshortinfo bsd;
+  if (::proc_pidinfo(pid, PROC_PIDT_SHORTBSDINFO, 0, &bsd, sizeof(bsd)) !=
+      sizeof(bsd)) {
+    return Status(1, "Cannot read process info");
+  }
+
+  struct proc_taskinfo task;
+  if (::proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task, sizeof(task)) !=
+      sizeof(task)) {
+    return Status(1, "Cannot read process task info");
+  }
+
+  // Task times are in nanoseconds.
+  stats.parent = static_cast<int>(bsd.pbsi_ppid);
+  stats.user_time = task.pti_total_user / 1000000;
+  stats.system_time = task.pti_total_system / 1000000;
+  stats.resident_size = task.pti_resident_size;
+  return Status(0, "OK");
+}
+#elif defined(__FreeBSD__)
+Status getProcessStats(int pid, ProcessStats& stats) {
+  int request[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
+  struct kinfo_proc proc;
+  size_t size = sizeof(proc);
+  if (::sysctl(request, 4, &proc, &size, nullptr, 0) != 0 || size == 0) {
+    return Status(1, "Cannot read process info");
+  }
+
+  const auto& usage = proc.ki_rusage;
+  stats.parent = static_cast<int>(proc.ki_ppid);
+  stats.user_time =
+      usage.ru_utime.tv_sec * 1000ULL + usage.ru_utime.tv_usec / 1000;
+  stats.system_time =
+      usage.ru_stime.tv_sec * 1000ULL + usage.ru_stime.tv_usec / 1000;
+  stats.resident_size =
+      static_cast<unsigned long long int>(proc.ki_rssize) * ::getpagesize();
+  return Status(0, "OK");
+}
+#endif
 }
@@ -41,6 +41,21 @@ namespace osquery {
 /// Constant for an invalid process
 const PlatformPidType kInvalidPid = (PlatformPidType)-1;
 
+/// CPU and memory use of a process, sampled without the processes table.
+struct ProcessStats {
+  /// The parent process ID.
+  int parent{-1};
+
+  /// Milliseconds of user CPU time.
+  unsigned long long int user_time{0};
+
+  /// Milliseconds of system CPU time.
+  unsigned long long int system_time{0};
+
+  /// Bytes of resident memory.
+  unsigned long long int resident_size{0};
+};
+
 /**
  * @brief Categories of process states adapted to be platform agnostic
  *
@@ -286,4 +301,13 @@ int platformGetPid();
 * and on posix platforms returns gettid()
 */
 int platformGetTid();
+
+/**
+ * @brief Sample the CPU and memory use of a process.
+ *
+ * This reads only the counters the watchdog needs: /proc/<pid>/stat on Linux,
+ * proc_pidinfo on OS X, the kinfo_proc sysctl on FreeBSD, and the process
+ * times and memory counters on Windows.
+ */
+Status getProcessStats(int pid, ProcessStats& stats);
 }
@@ -0,0 +1,567 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/process.h"
+#include "osquery/core/profiler.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(bool,
+     cpu_profile,
+     false,
+     "Sample CPU stacks and write profiles to the --logger_path directory");
+
+FLAG(uint64,
+     cpu_profile_frequency,
+     99,
+     "Samples per second of CPU time while --cpu_profile is set");
+
+FLAG(uint64,
+     cpu_profile_interval,
+     60,
+     "Seconds between writing CPU profiles while --cpu_profile is set");
+
+FLAG(string,
+     cpu_profile_format,
+     "collapsed",
+     "Format of CPU profiles: collapsed (flame graph stacks) or pprof");
+
+/// The deepest stack recorded for a sample.
+const size_t kProfileMaxFrames = 64;
+
+/// Samples recorded before a drain, later samples are dropped.
+const size_t kProfileSlots = 4096;
+
+/// The most bytes between two frames of a walked stack.
+const uintptr_t kProfileMaxFrameSize = 1024 * 1024;
+
+/// The name of samples without a query or table label.
+const std::string kProfileUnlabeled = "(none)";
+
+/// The sample states of a ring slot.
+enum ProfileSlotState {
+  SLOT_EMPTY = 0,
+  SLOT_WRITING = 1,
+  SLOT_FULL = 2,
+};
+
+namespace {
+
+/// A stack recorded by the signal handler.
+struct ProfileSample {
+  std::atomic<int> state{SLOT_EMPTY};
+  const char* labels[2];
+  int depth{0};
+  void* frames[kProfileMaxFrames];
+};
+
+/// Names of labels, their storage is never freed.
+struct ProfileLabels {
+  std::set<std::string> names;
+  std::mutex mutex;
+};
+}
+
+static ProfileSample kProfileSamples[kProfileSlots];
+
+/// The index of the next slot written by the signal handler.
+static std::atomic<size_t> kProfileNext{0};
+
+/// Samples lost since the last drain.
+static std::atomic<size_t> kProfileDropped{0};
+
+static std::atomic<bool> kProfileSampling{false};
+
+/// Serialize starting and stopping the sampling timer.
+static std::mutex kProfileTimerMutex;
+
+/// The query and table labels of this thread, read by the signal handler.
+static thread_local std::atomic<const char*> kThreadLabels[2];
+
+/// The highest address of this thread's stack, 0 if it was not read yet.
+static thread_local std::atomic<uintptr_t> kThreadStackTop{0};
+
+/// The sampling period in microseconds, written to pprof profiles.
+static std::atomic<size_t> kProfilePeriod{0};
+
+static ProfileLabels& getProfileLabels() {
+  static ProfileLabels labels;
+  return labels;
+}
+
+/// Samples read the label names after the label has ended.
+static const char* internProfileLabel(const std::string& name) {
+  auto& labels = getProfileLabels();
+  std::lock_guard<std::mutex> lock(labels.mutex);
+  return labels.names.insert(name).first->c_str();
+}
+
+/**
+ * @brief Read the bounds of this thread's stack for the signal handler.
+ *
+ * Reading them may allocate and lock, so it happens outside the handler, the
+ * first time the thread is labeled while sampling.
+ */
+static void setThreadStackTop() {
+#ifndef WIN32
+  if (kThreadStackTop.load() != 0) {
+    return;
+  }
+
+  uintptr_t top = 0;
+#ifdef __APPLE__
+  top = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(pthread_self()));
+#else
+  pthread_attr_t attr;
+#ifdef __FreeBSD__
+  pthread_attr_init(&attr);
+  auto result = pthread_attr_get_np(pthread_self(), &attr);
+#else
+  auto result = pthread_getattr_np(pthread_self(), &attr);
+#endif
+  if (result == 0) {
+    void* address = nullptr;
+    size_t size = 0;
+    if (pthread_attr_getstack(&attr, &address, &size) == 0) {
+      top = reinterpret_cast<uintptr_t>(address) + size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  kThreadStackTop.store(top);
+#endif
+}
+
+ProfileLabel::ProfileLabel(Kind kind, const std::string& name) : kind_(kind) {
+  if (!kProfileSampling) {
+    return;
+  }
+
+  setThreadStackTop();
+  previous_ = kThreadLabels[kind_].load();
+  kThreadLabels[kind_].store(internProfileLabel(name));
+  set_ = true;
+}
+
+ProfileLabel::~ProfileLabel() {
+  if (set_) {
+    kThreadLabels[kind_].store(previous_);
+  }
+}
+
+#ifndef WIN32
+/// Read the program counter, frame pointer and stack pointer of a context.
+static bool getContextRegisters(void* context,
+                                uintptr_t& pc,
+                                uintptr_t& fp,
+                                uintptr_t& sp) {
+  auto uc = static_cast<ucontext_t*>(context);
+#if defined(__APPLE__) && defined(__x86_64__)
+  pc = static_cast<uintptr_t>(uc->uc_mcontext->__ss.__rip);
+  fp = static_cast<uintptr_t>(uc->uc_mcontext->__ss.__rbp);
+  sp = static_cast<uintptr_t>(uc->uc_mcontext->__ss.__rsp);
+#elif defined(__FreeBSD__) && defined(__x86_64__)
+  pc = static_cast<uintptr_t>(uc->uc_mcontext.mc_rip);
+  fp = static_cast<uintptr_t>(uc->uc_mcontext.mc_rbp);
+  sp = static_cast<uintptr_t>(uc->uc_mcontext.mc_rsp);
+#elif defined(__linux__) && defined(__x86_64__)
+  pc = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+  fp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+  sp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__linux__) && defined(__aarch64__)
+  pc = static_cast<uintptr_t>(uc->uc_mcontext.pc);
+  fp = static_cast<uintptr_t>(uc->uc_mcontext.regs[29]);
+  sp = static_cast<uintptr_t>(uc->uc_mcontext.sp);
+#else
+  (void)uc;
+  return false;
+#endif
+  return true;
+}
+
+/**
+ * @brief Walk the saved frame pointers of the interrupted stack.
+ *
+ * Each frame starts with the caller's frame pointer followed by the return
+ * address, which needs code built with -fno-omit-frame-pointer. Code without
+ * frame pointers, such as some system libraries, cuts the stack short or
+ * skips its callers. A frame is only read if it is aligned, above the last
+ * frame and below the top of the thread's stack, so a bad frame pointer ends
+ * the walk instead of faulting.
+ */
+static int walkFrames(void* context, void** frames) {
+  uintptr_t pc = 0;
+  uintptr_t fp = 0;
+  uintptr_t sp = 0;
+  if (!getContextRegisters(context, pc, fp, sp)) {
+    return 0;
+  }
+
+  int depth = 0;
+  frames[depth++] = reinterpret_cast<void*>(pc);
+
+  // The stack of a thread that was never labeled is unknown.
+  auto top = kThreadStackTop.load();
+  auto low = sp;
+  while (depth < static_cast<int>(kProfileMaxFrames)) {
+    if (fp < low || fp % sizeof(uintptr_t) != 0 ||
+        fp - low > kProfileMaxFrameSize || top < 2 * sizeof(uintptr_t) ||
+        fp > top - 2 * sizeof(uintptr_t)) {
+      break;
+    }
+
+    auto frame = reinterpret_cast<const uintptr_t*>(fp);
+    auto next = frame[0];
+    auto address = frame[1];
+    if (address == 0) {
+      break;
+    }
+    frames[depth++] = reinterpret_cast<void*>(address);
+    if (next <= fp) {
+      break;
+    }
+    low = fp + 2 * sizeof(uintptr_t);
+    fp = next;
+  }
+  return depth;
+}
+
+/**
+ * @brief Record the interrupted thread's stack and labels.
+ *
+ * The handler never allocates or locks: it uses atomics, a ring slot it owns
+ * and reads of the interrupted stack bounded by walkFrames. The slot is
+ * skipped if the drain has not emptied it yet.
+ */
+static void profileSignalHandler(int /* num */,
+                                 siginfo_t* /* info */,
+                                 void* context) {
+  auto saved_errno = errno;
+  auto& sample = kProfileSamples[kProfileNext++ % kProfileSlots];
+  int expected = SLOT_EMPTY;
+  if (!sample.state.compare_exchange_strong(expected, SLOT_WRITING)) {
+    kProfileDropped++;
+    errno = saved_errno;
+    return;
+  }
+
+  sample.labels[ProfileLabel::QUERY] =
+      kThreadLabels[ProfileLabel::QUERY].load();
+  sample.labels[ProfileLabel::TABLE] =
+      kThreadLabels[ProfileLabel::TABLE].load();
+  sample.depth = walkFrames(context, sample.frames);
+  sample.state.store(SLOT_FULL);
+  errno = saved_errno;
+}
+#endif
+
+Status startCPUSampling(size_t frequency) {
+#ifdef WIN32
+  return Status(1, "CPU profiling is not supported");
+#else
+  std::lock_guard<std::mutex> lock(kProfileTimerMutex);
+  if (kProfileSampling) {
+    return Status(1, "CPU profiling is already running");
+  }
+
+  setThreadStackTop();
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = profileSignalHandler;
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    return Status(1, "Cannot handle SIGPROF");
+  }
+
+  frequency = std::max(std::min(frequency, (size_t)1000), (size_t)1);
+  auto period = 1000000 / frequency;
+  struct itimerval timer;
+  timer.it_interval.tv_sec = static_cast<time_t>(period / 1000000);
+  timer.it_interval.tv_usec = static_cast<suseconds_t>(period % 1000000);
+  timer.it_value = timer.it_interval;
+  kProfilePeriod = period;
+  kProfileSampling = true;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    kProfileSampling = false;
+    return Status(1, "Cannot start the profiling timer");
+  }
+  return Status(0, "OK");
+#endif
+}
+
+void stopCPUSampling() {
+#ifndef WIN32
+  std::lock_guard<std::mutex> lock(kProfileTimerMutex);
+  if (!kProfileSampling) {
+    return;
+  }
+
+  // The handler stays installed, a signal may still be pending.
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  kProfileSampling = false;
+#endif
+}
+
+bool isCPUSampling() {
+  return kProfileSampling;
+}
+
+void CPUProfile::drain() {
+  for (auto& sample : kProfileSamples) {
+    if (sample.state.load() != SLOT_FULL) {
+      continue;
+    }
+
+    auto depth = static_cast<size_t>(std::max(sample.depth, 0));
+    std::vector<void*> frames(sample.frames, sample.frames + depth);
+    stacks_[std::make_tuple(sample.labels[ProfileLabel::QUERY],
+                            sample.labels[ProfileLabel::TABLE],
+                            std::move(frames))]++;
+    samples_++;
+    sample.state.store(SLOT_EMPTY);
+  }
+  dropped_ += kProfileDropped.exchange(0);
+}
+
+void CPUProfile::clear() {
+  stacks_.clear();
+  samples_ = 0;
+  dropped_ = 0;
+}
+
+#ifndef WIN32
+/// The demangled function of an address, or its module and offset.
+static std::string getFrameName(void* address) {
+  Dl_info info;
+  if (dladdr(address, &info) == 0) {
+    std::stringstream unknown;
+    unknown << address;
+    return unknown.str();
+  }
+
+  if (info.dli_sname != nullptr) {
+    int status = 0;
+    auto demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = (status == 0 && demangled != nullptr)
+                           ? demangled
+                           : info.dli_sname;
+    free(demangled);
+    return name;
+  }
+
+  std::stringstream offset;
+  auto module = (info.dli_fname != nullptr)
+                    ? fs::path(info.dli_fname).filename().string()
+                    : std::string("?");
+  offset << module << "+0x" << std::hex
+         << (static_cast<char*>(address) - static_cast<char*>(info.dli_fbase));
+  return offset.str();
+}
+#endif
+
+Status CPUProfile::writeCollapsed(const std::string& path) const {
+#ifdef WIN32
+  return Status(1, "CPU profiling is not supported");
+#else
+  std::ofstream output(path, std::ios::out | std::ios::trunc);
+  if (!output.is_open()) {
+    return Status(1, "Cannot open profile: " + path);
+  }
+
+  // Stack frames are separated by ';' and cannot contain them.
+  std::map<void*, std::string> names;
+  auto frameName = [&names](void* address) -> const std::string& {
+    auto name = names.find(address);
+    if (name == names.end()) {
+      auto frame = getFrameName(address);
+      std::replace(frame.begin(), frame.end(), ';', ':');
+      name = names.emplace(address, std::move(frame)).first;
+    }
+    return name->second;
+  };
+
+  for (const auto& stack : stacks_) {
+    const auto* query = std::get<0>(stack.first);
+    const auto* table = std::get<1>(stack.first);
+    output << ((query != nullptr) ? query : kProfileUnlabeled);
+    if (table != nullptr) {
+      output << ";table:" << table;
+    }
+    const auto& frames = std::get<2>(stack.first);
+    for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame) {
+      output << ";" << frameName(*frame);
+    }
+    output << " " << stack.second << "\n";
+  }
+  return Status(0, "OK");
+#endif
+}
+
+Status CPUProfile::writePprof(const std::string& path) const {
+#ifndef __linux__
+  return Status(1, "The pprof format needs the process's memory map");
+#else
+  std::ofstream output(path,
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!output.is_open()) {
+    return Status(1, "Cannot open profile: " + path);
+  }
+
+  auto write = [&output](uintptr_t word) {
+    output.write(reinterpret_cast<const char*>(&word), sizeof(word));
+  };
+
+  // The header: count, header words, version, period, padding.
+  for (const auto& word :
+       {uintptr_t(0), uintptr_t(3), uintptr_t(0), uintptr_t(kProfilePeriod),
+        uintptr_t(0)}) {
+    write(word);
+  }
+
+  // Stacks of different labels are merged by pprof.
+  for (const auto& stack : stacks_) {
+    const auto& frames = std::get<2>(stack.first);
+    write(stack.second);
+    write(frames.size());
+    for (const auto& frame : frames) {
+      write(reinterpret_cast<uintptr_t>(frame));
+    }
+  }
+
+  // The trailer, followed by the memory map.
+  for (const auto& word : {uintptr_t(0), uintptr_t(1), uintptr_t(0)}) {
+    write(word);
+  }
+  std::string maps;
+  readFile("/proc/self/maps", maps);
+  output << maps;
+  return Status(0, "OK");
+#endif
+}
+
+namespace {
+
+/// Follow --cpu_profile, draining samples and writing profiles.
+class CPUProfileRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    if (FLAGS_cpu_profile && !sampling_) {
+      auto status = startCPUSampling(FLAGS_cpu_profile_frequency);
+      if (!status.ok()) {
+        LOG(WARNING) << "Cannot start CPU profiling: " << status.getMessage();
+        return true;
+      }
+      sampling_ = true;
+      written_ = std::chrono::steady_clock::now();
+      VLOG(1) << "Started CPU profiling";
+    }
+
+    if (!sampling_) {
+      return true;
+    }
+
+    profile_.drain();
+    auto now = std::chrono::steady_clock::now();
+    if (!FLAGS_cpu_profile) {
+      stopCPUSampling();
+      profile_.drain();
+      sampling_ = false;
+      write();
+      VLOG(1) << "Stopped CPU profiling";
+    } else if (now >= written_ + std::chrono::seconds(
+                                     std::max(FLAGS_cpu_profile_interval,
+                                              static_cast<uint64_t>(1)))) {
+      write();
+      written_ = now;
+    }
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    // Samples are drained often enough to keep the ring from filling.
+    return (sampling_) ? std::chrono::seconds(1) : std::chrono::seconds(10);
+  }
+
+ private:
+  void write() {
+    if (profile_.size() == 0) {
+      return;
+    }
+
+    bool pprof = (FLAGS_cpu_profile_format == "pprof");
+    auto directory = Flag::getValue("logger_path");
+    auto name = "osquery." + std::to_string(platformGetPid()) + "." +
+                std::to_string(getUnixTime()) +
+                ((pprof) ? ".cpu.pprof" : ".cpu.collapsed");
+    auto path = (fs::path(directory) / name).string();
+    auto status =
+        (pprof) ? profile_.writePprof(path) : profile_.writeCollapsed(path);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot write CPU profile: " << status.getMessage();
+    } else {
+      VLOG(1) << "Wrote " << profile_.size() << " CPU samples ("
+              << profile_.dropped() << " dropped) to " << path;
+    }
+    profile_.clear();
+  }
+
+ private:
+  CPUProfile profile_;
+
+  bool sampling_{false};
+
+  /// The time the last profile was written.
+  std::chrono::steady_clock::time_point written_;
+};
+}
+
+void startCPUProfiler() {
+  Dispatcher::addPeriodicService(std::make_shared<CPUProfileRunner>(),
+                                 std::chrono::milliseconds(0));
+}
+}
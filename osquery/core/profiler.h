@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Attribute CPU profile samples taken on this thread.
+ *
+ * A label names the scheduled query or the table whose work the thread is
+ * doing while the label exists. Labels of the same kind nest, the innermost
+ * is used. Labels do nothing while the CPU profiler is not sampling.
+ */
+class ProfileLabel : private boost::noncopyable {
+ public:
+  enum Kind {
+    QUERY = 0,
+    TABLE = 1,
+  };
+
+  ProfileLabel(Kind kind, const std::string& name);
+  ~ProfileLabel();
+
+ private:
+  Kind kind_;
+
+  /// The label this one hides.
+  const char* previous_{nullptr};
+
+  /// The label was set, the profiler was sampling when it was created.
+  bool set_{false};
+};
+
+/**
+ * @brief Start sampling the process's CPU time.
+ *
+ * Each thread using CPU time is interrupted with SIGPROF at the frequency,
+ * and its stack and labels are recorded into a fixed ring of samples. See
+ * CPUProfile for reading them.
+ *
+ * @param frequency samples per second of CPU time.
+ * @return Failure if sampling is not supported or is already running.
+ */
+Status startCPUSampling(size_t frequency);
+
+/// Stop sampling, samples not drained by a CPUProfile are kept.
+void stopCPUSampling();
+
+/// Check if the process's CPU time is sampled.
+bool isCPUSampling();
+
+/// Samples aggregated by their labels and stack.
+class CPUProfile : private boost::noncopyable {
+ public:
+  /// Move the recorded samples into the profile.
+  void drain();
+
+  /**
+   * @brief Write the samples as collapsed stacks.
+   *
+   * Each line is the query label, the table label, and the stack from the
+   * outermost frame separated by ';', followed by the sample count. Flame
+   * graph tools read this format.
+   */
+  Status writeCollapsed(const std::string& path) const;
+
+  /**
+   * @brief Write the samples in the legacy pprof CPU profile format.
+   *
+   * The format has no labels, and is followed by the process's memory map so
+   * pprof can symbolize the stacks offline.
+   */
+  Status writePprof(const std::string& path) const;
+
+  /// Remove the aggregated samples.
+  void clear();
+
+  /// The number of aggregated samples.
+  size_t size() const {
+    return samples_;
+  }
+
+  /// The number of samples lost because the ring was full.
+  size_t dropped() const {
+    return dropped_;
+  }
+
+ private:
+  /// Query label, table label, and stack from the innermost frame.
+  using SampleKey = std::tuple<const char*, const char*, std::vector<void*>>;
+
+  std::map<SampleKey, size_t> stacks_;
+
+  size_t samples_{0};
+
+  size_t dropped_{0};
+};
+
+/**
+ * @brief Start the service writing CPU profiles while --cpu_profile is set.
+ *
+ * The flag may be changed at runtime, such as by a config's options. A
+ * profile is written to the --logger_path directory every
+ * --cpu_profile_interval seconds and when the flag is unset.
+ */
+void startCPUProfiler();
+}
@@ -14,6 +14,13 @@
 
 #ifndef WIN32
 #include <grp.h>
+#include <sys/resource.h>
+#endif
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__linux__) || defined(WIN32)
+#include <malloc.h>
 #endif
 
 #include <signal.h>
@@ -23,10 +30,23 @@
 #include <uuid/uuid.h>
 #endif
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <unistd.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+
 #ifdef WIN32
 #include <WinSock2.h>
+#include <psapi.h>
 #endif
 
+#include <chrono>
+#include <cstring>
 #include <ctime>
 #include <sstream>
 
@@ -224,6 +244,205 @@ size_t getUnixTime() {
   return std::time(nullptr);
 }
 
+std::string getBootIdentifier() {
+#if defined(__linux__)
+  std::string content;
+  if (readFile("/proc/sys/kernel/random/boot_id", content).ok()) {
+    boost::algorithm::trim(content);
+    return content;
+  }
+#elif defined(__APPLE__)
+  struct timeval boot_time;
+  size_t size = sizeof(boot_time);
+  int request[] = {CTL_KERN, KERN_BOOTTIME};
+  if (sysctl(request, 2, &boot_time, &size, nullptr, 0) == 0) {
+    return std::to_string(boot_time.tv_sec) + "." +
+           std::to_string(boot_time.tv_usec);
+  }
+#endif
+  return "";
+}
+
+ResourceUsage getResourceUsage() {
+  ResourceUsage usage;
+  usage.wall_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+
+#ifdef WIN32
+  FILETIME creation, exit, kernel, user;
+  if (::GetThreadTimes(
+          ::GetCurrentThread(), &creation, &exit, &kernel, &user) != 0) {
+    // Thread times are in 100 nanosecond units.
+    ULARGE_INTEGER time;
+    time.LowPart = user.dwLowDateTime;
+    time.HighPart = user.dwHighDateTime;
+    usage.user_time = time.QuadPart / 10000;
+    time.LowPart = kernel.dwLowDateTime;
+    time.HighPart = kernel.dwHighDateTime;
+    usage.system_time = time.QuadPart / 10000;
+  }
+
+  PROCESS_MEMORY_COUNTERS_EX counters;
+  if (::GetProcessMemoryInfo(
+          ::GetCurrentProcess(),
+          reinterpret_cast<PPROCESS_MEMORY_COUNTERS>(&counters),
+          sizeof(counters)) != 0) {
+    usage.memory = counters.PrivateUsage;
+    usage.peak_resident = counters.PeakWorkingSetSize;
+  }
+#else
+#if defined(RUSAGE_THREAD)
+  int who = RUSAGE_THREAD;
+#else
+  int who = RUSAGE_SELF;
+#endif
+  struct rusage ru;
+  if (::getrusage(who, &ru) == 0) {
+    usage.user_time = ru.ru_utime.tv_sec * 1000ULL + ru.ru_utime.tv_usec / 1000;
+    usage.system_time =
+        ru.ru_stime.tv_sec * 1000ULL + ru.ru_stime.tv_usec / 1000;
+    usage.context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+    usage.major_faults = ru.ru_majflt;
+#if defined(__APPLE__)
+    usage.peak_resident = ru.ru_maxrss;
+#else
+    // The largest resident set is in KB, and is the process's for a thread.
+    usage.peak_resident = ru.ru_maxrss * 1024ULL;
+#endif
+  }
+
+#if defined(__APPLE__)
+  malloc_statistics_t stats;
+  ::malloc_zone_statistics(nullptr, &stats);
+  usage.memory = stats.size_in_use;
+#elif defined(__linux__)
+  // The counters are ints and wrap above 2GB of heap.
+  auto info = ::mallinfo();
+  usage.memory = static_cast<unsigned int>(info.uordblks) +
+                 static_cast<unsigned int>(info.hblkhd);
+#endif
+#endif
+  return usage;
+}
+
+unsigned long long int getThreadCPUTime() {
+#if defined(WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (::GetThreadTimes(
+          ::GetCurrentThread(), &creation, &exit, &kernel, &user) == 0) {
+    return 0;
+  }
+  ULARGE_INTEGER user_time, kernel_time;
+  user_time.LowPart = user.dwLowDateTime;
+  user_time.HighPart = user.dwHighDateTime;
+  kernel_time.LowPart = kernel.dwLowDateTime;
+  kernel_time.HighPart = kernel.dwHighDateTime;
+  return (user_time.QuadPart + kernel_time.QuadPart) / 10;
+#elif defined(__APPLE__)
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  auto thread = ::mach_thread_self();
+  auto result = ::thread_info(thread,
+                              THREAD_BASIC_INFO,
+                              reinterpret_cast<thread_info_t>(&info),
+                              &count);
+  ::mach_port_deallocate(::mach_task_self(), thread);
+  if (result != KERN_SUCCESS) {
+    return 0;
+  }
+  return (info.user_time.seconds + info.system_time.seconds) * 1000000ULL +
+         info.user_time.microseconds + info.system_time.microseconds;
+#else
+  struct timespec ts;
+  if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+void releaseHeapMemory() {
+#if defined(__APPLE__)
+  ::malloc_zone_pressure_relief(nullptr, 0);
+#elif defined(__linux__)
+  ::malloc_trim(0);
+#elif defined(WIN32)
+  ::_heapmin();
+#endif
+}
+
+#if defined(__linux__)
+namespace {
+
+/// Hardware counters opened for a single thread.
+class ThreadPerfCounters : private boost::noncopyable {
+ public:
+  ThreadPerfCounters() {
+    fds_[0] = open(PERF_COUNT_HW_CPU_CYCLES);
+    fds_[1] = open(PERF_COUNT_HW_INSTRUCTIONS);
+    fds_[2] = open(PERF_COUNT_HW_CACHE_MISSES);
+  }
+
+  ~ThreadPerfCounters() {
+    for (const auto& fd : fds_) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  void read(ResourceUsage& usage) const {
+    usage.cycles = read(fds_[0]);
+    usage.instructions = read(fds_[1]);
+    usage.cache_misses = read(fds_[2]);
+  }
+
+ private:
+  static int open(unsigned long long int config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    // User mode counting is allowed with perf_event_paranoid up to 2.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(::syscall(
+        __NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+  }
+
+  static unsigned long long int read(int fd) {
+    // The value, then the time the counter was enabled and running.
+    uint64_t values[3] = {0, 0, 0};
+    if (fd < 0 || ::read(fd, values, sizeof(values)) != sizeof(values) ||
+        values[2] == 0) {
+      return 0;
+    }
+
+    // A counter multiplexed with others is scaled to the time enabled.
+    if (values[2] < values[1]) {
+      return static_cast<unsigned long long int>(
+          static_cast<double>(values[0]) * values[1] / values[2]);
+    }
+    return values[0];
+  }
+
+ private:
+  int fds_[3];
+};
+}
+#endif
+
+void getPerfCounters(ResourceUsage& usage) {
+#if defined(__linux__)
+  static thread_local ThreadPerfCounters counters;
+  counters.read(usage);
+#endif
+}
+
 Status checkStalePid(const std::string& content) {
   int pid;
   try {
@@ -8,23 +8,46 @@
  *
  */
 
+#include <algorithm>
+#include <climits>
+#include <list>
+
+#include <boost/filesystem.hpp>
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/interned.h"
 #include "osquery/core/json.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
 
+namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
+FLAG(uint64,
+     table_cache_max_bytes,
+     16 * 1024 * 1024,
+     "Memory budget for cached table results (0 for unlimited)");
+
+FLAG(bool,
+     table_cache_persist,
+     false,
+     "Persist cached table results in the database across restarts");
+
 CREATE_LAZY_REGISTRY(TablePlugin, "table");
 
-size_t TablePlugin::kCacheInterval = 0;
-size_t TablePlugin::kCacheStep = 0;
+thread_local size_t TablePlugin::kCacheInterval = 0;
+std::atomic<size_t> TablePlugin::kCacheStep{0};
 
 const std::map<ColumnType, std::string> kColumnTypeNames = {
     {UNKNOWN_TYPE, "UNKNOWN"},
@@ -71,6 +94,24 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  if (context.colsUsed) {
+    // Extensions may also skip generating unused columns.
+    pt::ptree colsUsed;
+    for (const auto& colName : *context.colsUsed) {
+      colsUsed.push_back(std::make_pair("", pt::ptree(colName)));
+    }
+    tree.add_child("colsUsed", colsUsed);
+  }
+
+  if (context.limit) {
+    tree.put("limit", *context.limit);
+  }
+
+  if (context.orderBy) {
+    tree.put("orderBy", *context.orderBy);
+    tree.put("orderDescending", context.orderDescending);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -102,6 +143,37 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  if (tree.count("colsUsed") > 0) {
+    UsedColumns colsUsed;
+    for (const auto& colName : tree.get_child("colsUsed")) {
+      colsUsed.insert(colName.second.data());
+    }
+    context.colsUsed = std::move(colsUsed);
+  }
+
+  auto limit = tree.get_optional<size_t>("limit");
+  if (limit) {
+    context.limit = *limit;
+  }
+
+  auto order = tree.get_optional<std::string>("orderBy");
+  if (order) {
+    context.orderBy = *order;
+    context.orderDescending = tree.get<bool>("orderDescending", false);
+  }
+}
+
+QueryData TablePlugin::generate(QueryContext& context) {
+  QueryData results;
+  if (usesTypedRows()) {
+    // Adapt native rows for callers that expect string-valued rows.
+    auto table_columns = columns();
+    for (const auto& row : generateTyped(context)) {
+      results.push_back(typedRowToRow(row, table_columns));
+    }
+  }
+  return results;
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -169,29 +241,303 @@ PluginResponse TablePlugin::routeInfo() const {
   return response;
 }
 
+/**
+ * @brief A process-local cache of table results.
+ *
+ * Each table's results are an immutable snapshot that expires with its
+ * scheduled interval. The least recently used snapshots are evicted when the
+ * cache grows beyond --table_cache_max_bytes or its share of the memory
+ * budget. Snapshots are stored interned, see InternedQueryData.
+ */
+class TableCache : private boost::noncopyable {
+ public:
+  TableCache() {
+    registerMemoryConsumer("table_cache",
+                           1,
+                           ([this]() { return bytes(); }),
+                           ([this](size_t target) { shrink(target); }));
+  }
+
+  /// Return fresh results for a table, or nullptr.
+  std::shared_ptr<const InternedQueryData> get(const std::string& name,
+                                               size_t step) {
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(name);
+    if (entry == entries_.end()) {
+      return nullptr;
+    }
+
+    if (step >= entry->second.expires) {
+      erase(entry);
+      return nullptr;
+    }
+
+    // Move the table to the most recently used position.
+    lru_.splice(lru_.end(), lru_, entry->second.position);
+    return entry->second.rows;
+  }
+
+  /// Add or replace a table's results, they expire at a step.
+  void set(const std::string& name, const QueryData& results, size_t expires) {
+    auto rows = std::make_shared<const InternedQueryData>(results);
+    auto bytes = rows->bytes();
+
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(name);
+    if (entry != entries_.end()) {
+      erase(entry);
+    }
+
+    if (FLAGS_table_cache_max_bytes > 0 &&
+        bytes > FLAGS_table_cache_max_bytes) {
+      // These results would evict every other table and still not fit.
+      return;
+    }
+
+    auto& added = entries_[name];
+    added.rows = std::move(rows);
+    added.bytes = bytes;
+    added.expires = expires;
+    added.position = lru_.insert(lru_.end(), name);
+    bytes_ += bytes;
+
+    if (FLAGS_table_cache_max_bytes > 0) {
+      evict(FLAGS_table_cache_max_bytes);
+    }
+  }
+
+  /// The total size of the cached results.
+  size_t bytes() {
+    WriteLock lock(mutex_);
+    return bytes_;
+  }
+
+  /// Evict the least recently used tables until the cache fits a size.
+  void shrink(size_t target) {
+    WriteLock lock(mutex_);
+    evict(target);
+  }
+
+ private:
+  struct Entry {
+    std::shared_ptr<const InternedQueryData> rows{nullptr};
+    size_t bytes{0};
+    size_t expires{0};
+    std::list<std::string>::iterator position;
+  };
+
+  void evict(size_t target) {
+    while (bytes_ > target && !lru_.empty()) {
+      erase(entries_.find(lru_.front()));
+    }
+  }
+
+  void erase(std::map<std::string, Entry>::iterator entry) {
+    bytes_ -= entry->second.bytes;
+    lru_.erase(entry->second.position);
+    entries_.erase(entry);
+  }
+
+ private:
+  /// Cached results for each table.
+  std::map<std::string, Entry> entries_;
+
+  /// Table names ordered from least to most recently used.
+  std::list<std::string> lru_;
+
+  /// Total size of the cached results.
+  size_t bytes_{0};
+
+  Mutex mutex_;
+};
+
+static TableCache kTableCache;
+
 bool TablePlugin::isCached(size_t step) {
-  return (!FLAGS_disable_caching && step < last_cached_ + last_interval_);
+  if (FLAGS_disable_caching) {
+    return false;
+  }
+
+  if (!cache_restored_) {
+    restoreCache();
+  }
+
+  static auto& hits = getMetricCounter("table_cache_hits");
+  static auto& misses = getMetricCounter("table_cache_misses");
+  // Evicted results are only available if they were persisted.
+  bool cached = step < last_cached_ + last_interval_ &&
+                (FLAGS_table_cache_persist ||
+                 kTableCache.get(getName(), step) != nullptr);
+  if (cached) {
+    hits.add();
+  } else {
+    misses.add();
+  }
+  return cached;
 }
 
 QueryData TablePlugin::getCache() const {
   VLOG(1) << "Retrieving results from cache for table: " << getName();
+  auto rows = kTableCache.get(getName(), last_cached_);
+  if (rows != nullptr) {
+    return rows->rows();
+  }
+
   // Lookup results from database and deserialize.
-  std::string content;
-  getDatabaseValue(kQueries, "cache." + getName(), content);
   QueryData results;
-  deserializeQueryDataJSON(content, results);
+  if (FLAGS_table_cache_persist) {
+    std::string content;
+    getDatabaseValue(kQueries, "cache." + getName(), content);
+    deserializeQueryDataBinary(content, results);
+  }
   return results;
 }
 
 void TablePlugin::setCache(size_t step,
                            size_t interval,
                            const QueryData& results) {
+  // The rows of an interrupted query may be partial.
+  if (FLAGS_disable_caching || isQueryInterrupted()) {
+    return;
+  }
+
+  last_cached_ = step;
+  last_interval_ = interval;
+  kTableCache.set(getName(), results, step + interval);
+
   // Serialize QueryData and save to database.
   std::string content;
-  if (!FLAGS_disable_caching && serializeQueryDataJSON(results, content)) {
-    last_cached_ = step;
-    last_interval_ = interval;
+  if (FLAGS_table_cache_persist && serializeQueryDataBinary(results, content)) {
     setDatabaseValue(kQueries, "cache." + getName(), content);
+    setDatabaseValue(kQueries,
+                     "cache_step." + getName(),
+                     std::to_string(step) + ":" + std::to_string(interval));
+  }
+}
+
+void TablePlugin::restoreCache() {
+  cache_restored_ = true;
+  if (!FLAGS_table_cache_persist) {
+    return;
+  }
+
+  std::string content;
+  getDatabaseValue(kQueries, "cache_step." + getName(), content);
+  auto freshness = osquery::split(content, ":");
+  if (freshness.size() == 2) {
+    unsigned long int step = 0;
+    unsigned long int interval = 0;
+    if (safeStrtoul(freshness[0], 10, step) &&
+        safeStrtoul(freshness[1], 10, interval)) {
+      last_cached_ = static_cast<size_t>(step);
+      last_interval_ = static_cast<size_t>(interval);
+    }
+  }
+}
+
+/// Results of CACHEABLE_PROCESS and CACHEABLE_BOOT tables, with their keys.
+struct LifetimeCache {
+  std::map<std::string, std::pair<std::string, InternedQueryData>> entries;
+  Mutex mutex;
+};
+
+static LifetimeCache& getLifetimeCache() {
+  static LifetimeCache cache;
+  return cache;
+}
+
+bool TablePlugin::getLifetimeCache(QueryData& results, std::string& key) {
+  auto attrs = attributes();
+  bool boot = (attrs & TableAttributes::CACHEABLE_BOOT) != 0;
+  if (FLAGS_disable_caching ||
+      !(boot || attrs & TableAttributes::CACHEABLE_PROCESS)) {
+    return false;
+  }
+
+  // Results are invalid after a reboot, or once the table's files change.
+  static const auto boot_id = getBootIdentifier();
+  key = (boot) ? boot_id + "|" : "";
+  for (const auto& path : lifetimeCachePaths()) {
+    boost::system::error_code ec;
+    auto mtime = fs::last_write_time(path, ec);
+    key += path + ":" + ((ec) ? "" : std::to_string(mtime)) + ";";
+  }
+
+  static auto& hits = getMetricCounter("table_lifetime_cache_hits");
+  auto& cache = osquery::getLifetimeCache();
+  {
+    ReadLock lock(cache.mutex);
+    auto entry = cache.entries.find(getName());
+    if (entry != cache.entries.end() && entry->second.first == key) {
+      results = entry->second.second.rows();
+      hits.add();
+      return true;
+    }
+  }
+
+  // Results persisted by an earlier process during this boot are reused.
+  if (!boot || boot_id.empty()) {
+    return false;
+  }
+
+  std::string persisted_key;
+  getDatabaseValue(kQueries, "lifetime_cache_key." + getName(), persisted_key);
+  if (persisted_key != key) {
+    return false;
+  }
+
+  std::string content;
+  getDatabaseValue(kQueries, "lifetime_cache." + getName(), content);
+  results.clear();
+  if (!deserializeQueryDataBinary(content, results).ok()) {
+    return false;
+  }
+
+  InternedQueryData interned(results);
+  WriteLock lock(cache.mutex);
+  cache.entries[getName()] = std::make_pair(key, std::move(interned));
+  hits.add();
+  return true;
+}
+
+void TablePlugin::setLifetimeCache(const QueryContext& context,
+                                   const std::string& key,
+                                   const QueryData& results) {
+  auto attrs = attributes();
+  bool boot = (attrs & TableAttributes::CACHEABLE_BOOT) != 0;
+  if (FLAGS_disable_caching ||
+      !(boot || attrs & TableAttributes::CACHEABLE_PROCESS)) {
+    return;
+  }
+
+  // Only complete scans may serve later scans.
+  if (context.limit) {
+    return;
+  }
+  for (const auto& constraint : context.constraints) {
+    if (constraint.second.exists()) {
+      return;
+    }
+  }
+  for (const auto& column : columns()) {
+    if (!context.isColumnUsed(std::get<0>(column))) {
+      return;
+    }
+  }
+
+  auto& cache = osquery::getLifetimeCache();
+  {
+    InternedQueryData interned(results);
+    WriteLock lock(cache.mutex);
+    cache.entries[getName()] = std::make_pair(key, std::move(interned));
+  }
+
+  // Without a boot identifier the results are only valid for this process.
+  std::string content;
+  if (boot && key.front() != '|' &&
+      serializeQueryDataBinary(results, content)) {
+    setDatabaseValue(kQueries, "lifetime_cache." + getName(), content);
+    setDatabaseValue(kQueries, "lifetime_cache_key." + getName(), key);
   }
 }
 
@@ -256,6 +602,27 @@ std::string columnDefinition(const PluginResponse& response, bool aliases) {
   return columnDefinition(columns);
 }
 
+Row typedRowToRow(const TypedRow& row, const TableColumns& columns) {
+  Row r;
+  for (size_t i = 0; i < row.size() && i < columns.size(); ++i) {
+    const auto& name = std::get<0>(columns[i]);
+    const auto& value = row[i];
+    if (const auto* integer = boost::get<long long>(&value)) {
+      if (std::get<1>(columns[i]) == UNSIGNED_BIGINT_TYPE) {
+        r[name] = UNSIGNED_BIGINT(static_cast<unsigned long long>(*integer));
+      } else {
+        r[name] = BIGINT(*integer);
+      }
+    } else if (const auto* real = boost::get<double>(&value)) {
+      r[name] = DOUBLE(*real);
+    } else if (const auto* text = boost::get<std::string>(&value)) {
+      r[name] = *text;
+    }
+    // A blank value is a NULL and is left out of the row.
+  }
+  return r;
+}
+
 ColumnType columnTypeName(const std::string& type) {
   for (const auto& col : kColumnTypeNames) {
     if (col.second == type) {
@@ -278,61 +645,244 @@ bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
   }
 }
 
-bool ConstraintList::matches(const std::string& expr) const {
-  // Support each SQL affinity type casting.
-  if (affinity == TEXT_TYPE) {
-    return literal_matches<TEXT_LITERAL>(expr);
-  } else if (affinity == INTEGER_TYPE) {
-    INTEGER_LITERAL lexpr = AS_LITERAL(INTEGER_LITERAL, expr);
-    return literal_matches<INTEGER_LITERAL>(lexpr);
-  } else if (affinity == BIGINT_TYPE) {
-    BIGINT_LITERAL lexpr = AS_LITERAL(BIGINT_LITERAL, expr);
-    return literal_matches<BIGINT_LITERAL>(lexpr);
-  } else if (affinity == UNSIGNED_BIGINT_TYPE) {
-    UNSIGNED_BIGINT_LITERAL lexpr = AS_LITERAL(UNSIGNED_BIGINT_LITERAL, expr);
-    return literal_matches<UNSIGNED_BIGINT_LITERAL>(lexpr);
-  } else {
-    // Unsupported affinity type.
+/// Compare TEXT values and expressions without copying the values.
+struct TextLess {
+  bool operator()(const std::string& a, boost::string_ref b) const {
+    return boost::string_ref(a) < b;
+  }
+
+  bool operator()(boost::string_ref a, const std::string& b) const {
+    return a < boost::string_ref(b);
+  }
+};
+
+static char foldASCII(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/**
+ * @brief Parse an integer of a column's affinity into an ordered key.
+ *
+ * UNSIGNED_BIGINT values are offset such that their keys order as the
+ * unsigned values do.
+ */
+static bool integerKey(ColumnType affinity,
+                       boost::string_ref expr,
+                       long long& key) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < expr.size() && (expr[i] == '-' || expr[i] == '+')) {
+    negative = (expr[i++] == '-');
+  }
+  if (i == expr.size()) {
     return false;
   }
+
+  unsigned long long value = 0;
+  for (; i < expr.size(); i++) {
+    if (expr[i] < '0' || expr[i] > '9') {
+      return false;
+    }
+    auto digit = static_cast<unsigned long long>(expr[i] - '0');
+    if (value > (ULLONG_MAX - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+
+  if (affinity == UNSIGNED_BIGINT_TYPE) {
+    if (negative) {
+      value = 0 - value;
+    }
+    key = static_cast<long long>(value ^ (1ULL << 63));
+    return true;
+  }
+
+  if (negative) {
+    if (value > static_cast<unsigned long long>(LLONG_MAX) + 1) {
+      return false;
+    }
+    key = static_cast<long long>(0 - value);
+  } else {
+    if (value > static_cast<unsigned long long>(LLONG_MAX)) {
+      return false;
+    }
+    key = static_cast<long long>(value);
+  }
+  return true;
 }
 
-template <typename T>
-bool ConstraintList::literal_matches(const T& base_expr) const {
-  bool aggregate = true;
-  for (size_t i = 0; i < constraints_.size(); ++i) {
-    T constraint_expr = AS_LITERAL(T, constraints_[i].expr);
-    if (constraints_[i].op == EQUALS) {
-      aggregate = aggregate && (base_expr == constraint_expr);
-    } else if (constraints_[i].op == GREATER_THAN) {
-      aggregate = aggregate && (base_expr > constraint_expr);
-    } else if (constraints_[i].op == LESS_THAN) {
-      aggregate = aggregate && (base_expr < constraint_expr);
-    } else if (constraints_[i].op == GREATER_THAN_OR_EQUALS) {
-      aggregate = aggregate && (base_expr >= constraint_expr);
-    } else if (constraints_[i].op == LESS_THAN_OR_EQUALS) {
-      aggregate = aggregate && (base_expr <= constraint_expr);
+ConstraintMatcher::ConstraintMatcher(
+    ColumnType affinity, const std::vector<struct Constraint>& constraints)
+    : affinity_(affinity), min_(LLONG_MIN), max_(LLONG_MAX) {
+  bool integer = isIntegerColumnType(affinity);
+  for (const auto& constraint : constraints) {
+    const auto& expr = constraint.expr;
+    auto op = constraint.op;
+    expressions_[op].insert(expr);
+
+    if (op == LIKE || op == GLOB) {
+      Pattern pattern;
+      pattern.like = (op == LIKE);
+      pattern.pattern = expr;
+      pattern.prefix =
+          expr.substr(0, expr.find_first_of((op == LIKE) ? "%_" : "*?["));
+      if (pattern.like) {
+        std::transform(pattern.prefix.begin(),
+                       pattern.prefix.end(),
+                       pattern.prefix.begin(),
+                       foldASCII);
+      }
+      patterns_.push_back(std::move(pattern));
+      continue;
+    }
+
+    if (op != EQUALS && op != GREATER_THAN && op != GREATER_THAN_OR_EQUALS &&
+        op != LESS_THAN && op != LESS_THAN_OR_EQUALS) {
+      // Other operators are left to SQLite.
+      continue;
+    }
+
+    if (affinity == TEXT_TYPE) {
+      if (op == EQUALS) {
+        text_equals_.push_back(expr);
+      } else {
+        text_ranges_.push_back(std::make_pair(op, expr));
+      }
+      continue;
+    }
+
+    long long key = 0;
+    if (!integer || !integerKey(affinity, expr, key)) {
+      continue;
+    }
+    integer_limited_ = true;
+    if (op == EQUALS) {
+      integer_equals_.insert(key);
+    } else if (op == GREATER_THAN) {
+      integer_empty_ = integer_empty_ || key == LLONG_MAX;
+      min_ = std::max(min_, (key == LLONG_MAX) ? key : key + 1);
+    } else if (op == GREATER_THAN_OR_EQUALS) {
+      min_ = std::max(min_, key);
+    } else if (op == LESS_THAN) {
+      integer_empty_ = integer_empty_ || key == LLONG_MIN;
+      max_ = std::min(max_, (key == LLONG_MIN) ? key : key - 1);
     } else {
-      // Unsupported constraint.
+      max_ = std::min(max_, key);
+    }
+  }
+
+  integer_empty_ = integer_empty_ || min_ > max_;
+  std::sort(text_equals_.begin(), text_equals_.end());
+  text_equals_.erase(std::unique(text_equals_.begin(), text_equals_.end()),
+                     text_equals_.end());
+}
+
+bool ConstraintMatcher::matchesKey(long long key) const {
+  if (integer_empty_ || key < min_ || key > max_) {
+    return false;
+  }
+  return integer_equals_.empty() || integer_equals_.count(key) > 0;
+}
+
+bool ConstraintMatcher::matchesText(boost::string_ref expr) const {
+  if (!text_equals_.empty() &&
+      !std::binary_search(
+          text_equals_.begin(), text_equals_.end(), expr, TextLess())) {
+    return false;
+  }
+
+  for (const auto& range : text_ranges_) {
+    auto compared = expr.compare(boost::string_ref(range.second));
+    if ((range.first == GREATER_THAN && compared <= 0) ||
+        (range.first == GREATER_THAN_OR_EQUALS && compared < 0) ||
+        (range.first == LESS_THAN && compared >= 0) ||
+        (range.first == LESS_THAN_OR_EQUALS && compared > 0)) {
       return false;
     }
-    if (!aggregate) {
-      // Speed up comparison.
+  }
+
+  for (const auto& pattern : patterns_) {
+    // Most values are rejected by the literal prefix.
+    const auto& prefix = pattern.prefix;
+    if (expr.size() < prefix.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < prefix.size(); i++) {
+      auto c = (pattern.like) ? foldASCII(expr[i]) : expr[i];
+      if (c != prefix[i]) {
+        return false;
+      }
+    }
+    if (prefix.size() == pattern.pattern.size()) {
+      if (expr.size() != prefix.size()) {
+        return false;
+      }
+      continue;
+    }
+    if (pattern.like ? !likeMatches(pattern.pattern, expr)
+                     : !globMatches(pattern.pattern, expr)) {
       return false;
     }
   }
   return true;
 }
 
-std::set<std::string> ConstraintList::getAll(ConstraintOperator op) const {
-  std::set<std::string> set;
-  for (size_t i = 0; i < constraints_.size(); ++i) {
-    if (constraints_[i].op == op) {
-      // TODO: this does not apply a distinct.
-      set.insert(constraints_[i].expr);
+bool ConstraintMatcher::matches(boost::string_ref expr) const {
+  if (integer_limited_) {
+    long long key = 0;
+    if (!integerKey(affinity_, expr, key) || !matchesKey(key)) {
+      return false;
     }
   }
-  return set;
+  return matchesText(expr);
+}
+
+bool ConstraintMatcher::matches(long long expr) const {
+  if (integer_limited_) {
+    auto key = expr;
+    if (affinity_ == UNSIGNED_BIGINT_TYPE) {
+      key = static_cast<long long>(static_cast<unsigned long long>(expr) ^
+                                   (1ULL << 63));
+    }
+    if (!matchesKey(key)) {
+      return false;
+    }
+  }
+
+  if (text_equals_.empty() && text_ranges_.empty() && patterns_.empty()) {
+    return true;
+  }
+  return matchesText(std::to_string(expr));
+}
+
+const std::set<std::string>& ConstraintMatcher::getAll(
+    ConstraintOperator op) const {
+  static const std::set<std::string> kNoExpressions;
+  auto expressions = expressions_.find(op);
+  if (expressions == expressions_.end()) {
+    return kNoExpressions;
+  }
+  return expressions->second;
+}
+
+const ConstraintMatcher& ConstraintList::getMatcher() const {
+  auto matcher = std::atomic_load(&matcher_);
+  if (matcher != nullptr && matcher->affinity() == affinity) {
+    return *matcher;
+  }
+
+  std::shared_ptr<const ConstraintMatcher> compiled =
+      std::make_shared<ConstraintMatcher>(affinity, constraints_);
+  if (matcher == nullptr) {
+    // Keep a matcher another thread compiled, its expressions may be in use.
+    if (!std::atomic_compare_exchange_strong(&matcher_, &matcher, compiled)) {
+      return *matcher;
+    }
+  } else {
+    std::atomic_store(&matcher_, compiled);
+  }
+  return *compiled;
 }
 
 void ConstraintList::serialize(boost::property_tree::ptree& tree) const {
@@ -356,6 +906,7 @@ void ConstraintList::unserialize(const boost::property_tree::ptree& tree) {
     constraints_.push_back(constraint);
   }
   affinity = columnTypeName(tree.get<std::string>("affinity", "UNKNOWN"));
+  std::atomic_store(&matcher_, std::shared_ptr<const ConstraintMatcher>());
 }
 
 bool QueryContext::hasConstraint(const std::string& column,
@@ -366,6 +917,34 @@ bool QueryContext::hasConstraint(const std::string& column,
   return constraints.at(column).exists(op);
 }
 
+bool QueryContext::isColumnUsed(const std::string& colName) const {
+  return !colsUsed || colsUsed->count(colName) > 0;
+}
+
+bool QueryContext::isAnyColumnUsed(
+    std::initializer_list<std::string> colNames) const {
+  for (const auto& colName : colNames) {
+    if (isColumnUsed(colName)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool QueryContext::isInterrupted() const {
+  return isQueryInterrupted();
+}
+
+bool QueryContext::getLookupValues(const std::string& column,
+                                   std::set<std::string>& values) const {
+  if (!hasConstraint(column, EQUALS)) {
+    return false;
+  }
+  // SQLite compares the rows again, each value is only a candidate.
+  values = constraints.at(column).getAll(EQUALS);
+  return true;
+}
+
 Status QueryContext::expandConstraints(
     const std::string& column,
     ConstraintOperator op,
@@ -87,6 +87,25 @@ TEST_F(ConversionsTests, test_join) {
   EXPECT_EQ(join(content, ", "), "one, two, three");
 }
 
+TEST_F(ConversionsTests, test_split_ref) {
+  for (const auto& i : generateSplitStringTestData()) {
+    std::vector<std::string> copies;
+    for (const auto& element : splitRef(i.test_string)) {
+      copies.push_back(element.to_string());
+    }
+    EXPECT_EQ(i.test_vector, copies);
+  }
+
+  std::string content = " a b # c\r\n\n##d/e \n";
+  std::vector<std::string> lines;
+  iterateLines(content, ([&lines](boost::string_ref line) {
+                 lines.push_back(line.to_string());
+               }));
+  std::vector<std::string> expected = {"a b # c", "##d/e"};
+  EXPECT_EQ(expected, lines);
+  EXPECT_EQ(join(splitRef(lines[0], "#"), " # "), "a b # c");
+}
+
 TEST_F(ConversionsTests, test_split_occurences) {
   std::string content = "T: 'S:S'";
   std::vector<std::string> expected = {
@@ -95,6 +114,19 @@ TEST_F(ConversionsTests, test_split_occurences) {
   EXPECT_EQ(split(content, ":", 1), expected);
 }
 
+TEST_F(ConversionsTests, test_glob_matches) {
+  EXPECT_TRUE(globMatches("*.txt", "notes.txt"));
+  EXPECT_FALSE(globMatches("*.txt", "notes.TXT"));
+  EXPECT_TRUE(globMatches("a?c", "a\xc3\xa9"
+                                 "c"));
+  EXPECT_TRUE(globMatches("[a-c]x", "bx"));
+  EXPECT_FALSE(globMatches("[^a-c]x", "bx"));
+  EXPECT_TRUE(globMatches("[]]", "]"));
+  EXPECT_FALSE(globMatches("[abc", "a"));
+  EXPECT_FALSE(globMatches("a*b", "acbd"));
+  EXPECT_TRUE(globMatches("a*b*", "acbd"));
+}
+
 TEST_F(ConversionsTests, test_buffer_sha1) {
   std::string test = "test\n";
   EXPECT_EQ("4e1243bd22c66e76c2ba9eddc1f91394e57f9f83",
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/interned.h"
+
+namespace osquery {
+
+class InternedQueryDataTests : public testing::Test {};
+
+TEST_F(InternedQueryDataTests, test_round_trip) {
+  QueryData results = {
+      {{"path", "/usr/lib/libc.so.6"}, {"pid", "1"}, {"user", "root"}},
+      {{"path", "/usr/lib/libc.so.6"}, {"pid", "2"}, {"user", "root"}},
+      {{"name", "different columns"}, {"empty", ""}},
+      {},
+  };
+
+  InternedQueryData interned(results);
+  EXPECT_EQ(interned.size(), 4U);
+  EXPECT_FALSE(interned.empty());
+  EXPECT_EQ(interned.rows(), results);
+  EXPECT_EQ(interned.row(2), results[2]);
+  EXPECT_TRUE(interned.row(3).empty());
+
+  EXPECT_TRUE(InternedQueryData().empty());
+  EXPECT_TRUE(InternedQueryData(QueryData()).rows().empty());
+}
+
+TEST_F(InternedQueryDataTests, test_equal_rows) {
+  QueryData results = {
+      {{"arch", "amd64"}, {"name", "bash"}},
+      {{"arch", "amd64"}, {"name", "zsh"}},
+      {{"arch", "amd64"}, {"name", "bash"}},
+      {{"arch", "amd64"}, {"other", "bash"}},
+  };
+
+  InternedQueryData interned(results);
+  EXPECT_TRUE(interned.equalRows(0, 2));
+  EXPECT_FALSE(interned.equalRows(0, 1));
+  // The same values under another column name are not equal.
+  EXPECT_FALSE(interned.equalRows(0, 3));
+}
+
+TEST_F(InternedQueryDataTests, test_repeated_values_bytes) {
+  // Long values repeated across rows are stored once.
+  QueryData results;
+  size_t expanded = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    Row r;
+    r["path"] =
+        "/System/Library/Frameworks/CoreFoundation.framework/CoreFoundation";
+    r["permissions"] = (i % 2 == 0) ? "r-xp" : "r--p";
+    r["user"] = "administrator";
+    for (const auto& column : r) {
+      expanded += column.first.size() + column.second.size();
+    }
+    results.push_back(std::move(r));
+  }
+
+  InternedQueryData interned(results);
+  EXPECT_EQ(interned.rows(), results);
+  EXPECT_GT(interned.bytes(), 0U);
+  EXPECT_LT(interned.bytes(), expanded / 2);
+}
+}
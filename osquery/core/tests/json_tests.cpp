@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class JSONTests : public testing::Test {};
+
+/// Parse content with read_json, for comparison.
+static pt::ptree readJSON(const std::string& content) {
+  pt::ptree tree;
+  std::stringstream input(content);
+  pt::read_json(input, tree);
+  return tree;
+}
+
+TEST_F(JSONTests, test_parse_tree) {
+  std::vector<std::string> documents = {
+      "{}",
+      "[]",
+      "{\"a\": 1, \"b\": [1, -2.5e+3, {\"c\": \"d\"}], \"e\": {\"f\": null}}",
+      "{\"queries\": {\"q1\": {\"query\": \"select 1\", \"interval\": 10}}}",
+      "[[], {}, [true, false]]",
+      "{\"dup\": 1, \"dup\": 2}",
+  };
+
+  for (const auto& document : documents) {
+    pt::ptree tree;
+    ASSERT_TRUE(parseJSONTree(document, tree).ok()) << document;
+    EXPECT_EQ(tree, readJSON(document)) << document;
+  }
+
+  // The tree is replaced.
+  pt::ptree tree;
+  tree.put("previous", "value");
+  ASSERT_TRUE(parseJSONTree("{\"a\": \"b\"}", tree).ok());
+  EXPECT_EQ(tree.count("previous"), 0U);
+  EXPECT_EQ(tree.get("a", ""), "b");
+}
+
+TEST_F(JSONTests, test_parse_escapes) {
+  pt::ptree tree;
+  auto content =
+      "{\"a\": \"\\\"\\\\\\/\\b\\f\\n\\r\\t\", "
+      "\"b\": \"\\u00e9\\ud83d\\ude00\"}";
+  ASSERT_TRUE(parseJSONTree(content, tree).ok());
+  EXPECT_EQ(tree.get("a", ""), "\"\\/\b\f\n\r\t");
+  EXPECT_EQ(tree.get("b", ""), "\xc3\xa9\xf0\x9f\x98\x80");
+  EXPECT_EQ(tree, readJSON(content));
+}
+
+TEST_F(JSONTests, test_parse_comments) {
+  std::string content =
+      "# A config comment\n"
+      "{\n"
+      "  // Another comment\n"
+      "  \"a\": \"con\\\n"
+      "tinued\", # trailing\n"
+      "  \"b\": \"# not a comment\"\n"
+      "}\n";
+
+  pt::ptree tree;
+  EXPECT_FALSE(parseJSONTree(content, tree).ok());
+  ASSERT_TRUE(parseJSONTree(content, tree, true).ok());
+  EXPECT_EQ(tree.get("a", ""), "continued");
+  EXPECT_EQ(tree.get("b", ""), "# not a comment");
+}
+
+TEST_F(JSONTests, test_parse_errors) {
+  std::vector<std::string> documents = {
+      "",
+      "{",
+      "{\"a\": 1,}",
+      "{\"a\" 1}",
+      "[1 2]",
+      "{\"a\": 01}",
+      "{\"a\": tru}",
+      "{\"a\": \"\\x\"}",
+      "{\"a\": \"line\nbreak\"}",
+      "{\"a\": \"\\ud83d\"}",
+      "{\"a\": \"\\ud83dx\"}",
+      "{\"a\": \"\\ud83d\\u0041\"}",
+      "{\"a\": \"\\ude00\"}",
+      "{} trailing",
+  };
+
+  for (const auto& document : documents) {
+    pt::ptree tree;
+    auto status = parseJSONTree(document, tree);
+    EXPECT_FALSE(status.ok()) << document;
+    EXPECT_EQ(status.getMessage().find("JSON parse error at offset"), 0U);
+    EXPECT_TRUE(tree.empty());
+  }
+}
+
+/// Count containers, and stop at a key.
+class CountingHandler : public JSONHandler {
+ public:
+  bool startObject() override {
+    objects++;
+    return true;
+  }
+
+  bool startArray() override {
+    arrays++;
+    return true;
+  }
+
+  bool key(std::string& name) override {
+    return name != "stop";
+  }
+
+  bool value(std::string& value, bool string) override {
+    (string ? strings : literals)++;
+    return true;
+  }
+
+ public:
+  size_t objects{0};
+  size_t arrays{0};
+  size_t strings{0};
+  size_t literals{0};
+};
+
+TEST_F(JSONTests, test_parse_events) {
+  CountingHandler handler;
+  auto content = "{\"a\": [\"1\", 1, null, {}], \"b\": {\"c\": \"d\"}}";
+  ASSERT_TRUE(parseJSONEvents(content, handler).ok());
+  EXPECT_EQ(handler.objects, 3U);
+  EXPECT_EQ(handler.arrays, 1U);
+  EXPECT_EQ(handler.strings, 2U);
+  EXPECT_EQ(handler.literals, 2U);
+
+  // A handler stops the parse.
+  CountingHandler stopping;
+  EXPECT_FALSE(parseJSONEvents("{\"a\": 1, \"stop\": 2}", stopping).ok());
+  EXPECT_EQ(stopping.literals, 1U);
+}
+}
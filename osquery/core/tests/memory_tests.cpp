@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/memory.h"
+
+namespace osquery {
+
+class MemoryTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    deregisterMemoryConsumer("test_small");
+    deregisterMemoryConsumer("test_large");
+  }
+};
+
+TEST_F(MemoryTests, test_shrink_to_share) {
+  size_t small = 100;
+  size_t large = 1000;
+  registerMemoryConsumer("test_small",
+                         1,
+                         ([&small]() { return small; }),
+                         ([&small](size_t target) { small = target; }));
+  registerMemoryConsumer("test_large",
+                         3,
+                         ([&large]() { return large; }),
+                         ([&large](size_t target) { large = target; }));
+
+  // Only the consumer over its share of the budget is asked to shrink.
+  checkMemoryBudget(10000, 0);
+  EXPECT_EQ(100U, small);
+  EXPECT_EQ(1000U, large);
+
+  // Process-wide consumers, such as the table cache, also have weights.
+  size_t weights = 0;
+  for (const auto& consumer : getMemoryConsumers()) {
+    weights += consumer.weight;
+  }
+
+  checkMemoryBudget(1000, 0);
+  EXPECT_EQ(100U, small);
+  EXPECT_EQ(1000 / weights * 3, large);
+
+  // Under pressure every consumer releases what it can.
+  checkMemoryBudget(1000, 1001);
+  EXPECT_EQ(0U, small);
+  EXPECT_EQ(0U, large);
+
+  std::map<std::string, size_t> shrinks;
+  for (const auto& consumer : getMemoryConsumers()) {
+    shrinks[consumer.name] = consumer.shrinks;
+  }
+  EXPECT_EQ(1U, shrinks["test_small"]);
+  EXPECT_EQ(2U, shrinks["test_large"]);
+
+  // Continued pressure only shrinks consumers to their share.
+  small = 100;
+  large = 1000;
+  checkMemoryBudget(100000, 100001);
+  EXPECT_EQ(100U, small);
+  EXPECT_EQ(1000U, large);
+
+  // Pressure after the footprint dropped releases everything again.
+  checkMemoryBudget(100000, 0);
+  checkMemoryBudget(100000, 100001);
+  EXPECT_EQ(0U, small);
+  EXPECT_EQ(0U, large);
+}
+}
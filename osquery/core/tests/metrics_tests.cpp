@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <limits>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+class MetricsTests : public testing::Test {};
+
+static const MetricValue* findMetric(const std::vector<MetricValue>& values,
+                                     const std::string& name) {
+  for (const auto& value : values) {
+    if (value.name == name) {
+      return &value;
+    }
+  }
+  return nullptr;
+}
+
+TEST_F(MetricsTests, test_counters_and_gauges) {
+  auto& counter = getMetricCounter("test_counter", {{"kind", "a"}});
+  counter.add();
+  counter.add(2);
+  EXPECT_EQ(&counter, &getMetricCounter("test_counter", {{"kind", "a"}}));
+  EXPECT_NE(&counter, &getMetricCounter("test_counter", {{"kind", "b"}}));
+  EXPECT_EQ(3U, counter.value());
+
+  auto& gauge = getMetricGauge("test_gauge");
+  gauge.set(10);
+  gauge.add(-4);
+  EXPECT_EQ(6, gauge.value());
+
+  auto values = getMetrics();
+  auto* gauge_value = findMetric(values, "test_gauge");
+  ASSERT_NE(nullptr, gauge_value);
+  EXPECT_EQ(MetricType::GAUGE, gauge_value->type);
+  EXPECT_EQ(6, gauge_value->value);
+}
+
+TEST_F(MetricsTests, test_histogram) {
+  auto& histogram = getMetricHistogram("test_histogram");
+  EXPECT_EQ(0U, histogram.percentile(0.5));
+
+  for (uint64_t i = 1; i <= 1000; i++) {
+    histogram.record(i);
+  }
+  EXPECT_EQ(1000U, histogram.count());
+  EXPECT_EQ(500500U, histogram.sum());
+  EXPECT_EQ(1000U, histogram.max());
+
+  // Percentiles are bucket bounds within 12.5% of the value.
+  auto p50 = histogram.percentile(0.5);
+  EXPECT_GE(p50, 500U);
+  EXPECT_LE(p50, 563U);
+  auto p99 = histogram.percentile(0.99);
+  EXPECT_GE(p99, 990U);
+  EXPECT_LE(p99, 1000U);
+
+  // Small values are counted exactly.
+  auto& small = getMetricHistogram("test_histogram_small");
+  small.record(0);
+  small.record(3);
+  small.record(3);
+  EXPECT_EQ(3U, small.percentile(0.5));
+  EXPECT_EQ(0U, small.percentile(0.1));
+
+  // Every value has a bucket.
+  auto& large = getMetricHistogram("test_histogram_large");
+  large.record(std::numeric_limits<uint64_t>::max());
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), large.percentile(1));
+}
+
+TEST_F(MetricsTests, test_collectors) {
+  registerMetricCollector("test", ([](std::vector<MetricValue>& values) {
+                            MetricValue value;
+                            value.name = "test_collected";
+                            value.value = 42;
+                            values.push_back(value);
+                          }));
+
+  auto* value = findMetric(getMetrics(), "test_collected");
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ(42, value->value);
+}
+
+TEST_F(MetricsTests, test_open_metrics) {
+  MetricValue counter;
+  counter.name = "requests";
+  counter.labels = {{"path", "a\"b"}};
+  counter.value = 7;
+
+  MetricValue histogram;
+  histogram.name = "latency";
+  histogram.type = MetricType::HISTOGRAM;
+  histogram.value = 100;
+  histogram.count = 4;
+  histogram.p50 = 20;
+  histogram.p90 = 30;
+  histogram.p99 = 40;
+
+  auto expected =
+      "# TYPE osquery_latency summary\n"
+      "osquery_latency{quantile=\"0.5\"} 20\n"
+      "osquery_latency{quantile=\"0.9\"} 30\n"
+      "osquery_latency{quantile=\"0.99\"} 40\n"
+      "osquery_latency_sum 100\n"
+      "osquery_latency_count 4\n"
+      "# TYPE osquery_requests counter\n"
+      "osquery_requests_total{path=\"a\\\"b\"} 7\n"
+      "# EOF\n";
+  EXPECT_EQ(expected, formatOpenMetrics({counter, histogram}));
+}
+}
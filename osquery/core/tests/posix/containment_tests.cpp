@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/containment.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_string(watchdog_cgroup);
+
+class ContainmentTests : public testing::Test {};
+
+TEST_F(ContainmentTests, test_containment_unavailable) {
+  auto backup_cgroup = FLAGS_watchdog_cgroup;
+
+  // The working directory is not a cgroup v2 hierarchy.
+  FLAGS_watchdog_cgroup = kTestWorkingDirectory + "osquery";
+  EXPECT_FALSE(initContainment(90, 200 * 1024 * 1024).ok());
+
+  // Without a container processes are not moved or throttled.
+  auto self = PlatformProcess::getCurrentProcess();
+  EXPECT_FALSE(containProcess(*self).ok());
+  std::map<std::string, size_t> stats;
+  EXPECT_FALSE(getContainmentStats(stats).ok());
+
+  FLAGS_watchdog_cgroup = backup_cgroup;
+}
+}
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/core/profiler.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+class ProfilerTests : public testing::Test {
+ public:
+  void TearDown() override {
+    stopCPUSampling();
+  }
+};
+
+/// Use CPU time until the profile has samples.
+static void spinUntilSampled(CPUProfile& profile) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  volatile size_t counter = 0;
+  while (profile.size() == 0 && std::chrono::steady_clock::now() < deadline) {
+    for (size_t i = 0; i < 1000000; i++) {
+      counter = counter + i;
+    }
+    profile.drain();
+  }
+}
+
+TEST_F(ProfilerTests, test_sampling) {
+#ifdef WIN32
+  EXPECT_FALSE(startCPUSampling(99).ok());
+#else
+  ASSERT_TRUE(startCPUSampling(1000).ok());
+  EXPECT_TRUE(isCPUSampling());
+  EXPECT_FALSE(startCPUSampling(1000).ok());
+
+  CPUProfile profile;
+  {
+    ProfileLabel query(ProfileLabel::QUERY, "profiler_query");
+    ProfileLabel table(ProfileLabel::TABLE, "profiler_table");
+    spinUntilSampled(profile);
+  }
+  stopCPUSampling();
+  EXPECT_FALSE(isCPUSampling());
+  ASSERT_GT(profile.size(), 0U);
+
+  auto path = kTestWorkingDirectory + "profiler_test.collapsed";
+  ASSERT_TRUE(profile.writeCollapsed(path).ok());
+  std::string content;
+  ASSERT_TRUE(readFile(path, content).ok());
+  EXPECT_NE(content.find("profiler_query;table:profiler_table;"),
+            std::string::npos);
+
+  profile.clear();
+  EXPECT_EQ(profile.size(), 0U);
+#endif
+}
+
+TEST_F(ProfilerTests, test_labels_without_sampling) {
+  // Labels created while not sampling are not applied.
+  CPUProfile profile;
+  {
+    ProfileLabel query(ProfileLabel::QUERY, "unsampled_query");
+    profile.drain();
+  }
+  EXPECT_EQ(profile.size(), 0U);
+
+#ifdef __linux__
+  ASSERT_TRUE(startCPUSampling(1000).ok());
+  spinUntilSampled(profile);
+  stopCPUSampling();
+  ASSERT_GT(profile.size(), 0U);
+
+  // Unlabeled samples are written, and pprof profiles end with the map.
+  auto path = kTestWorkingDirectory + "profiler_test.pprof";
+  ASSERT_TRUE(profile.writePprof(path).ok());
+  std::string content;
+  ASSERT_TRUE(readFile(path, content).ok());
+  EXPECT_NE(content.find("[stack]"), std::string::npos);
+
+  path = kTestWorkingDirectory + "profiler_test.collapsed";
+  ASSERT_TRUE(profile.writeCollapsed(path).ok());
+  ASSERT_TRUE(readFile(path, content).ok());
+  EXPECT_EQ(content.find("unsampled_query"), std::string::npos);
+  EXPECT_NE(content.find("(none);"), std::string::npos);
+#endif
+}
+}
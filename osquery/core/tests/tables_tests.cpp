@@ -8,12 +8,20 @@
  *
  */
 
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
+#include "osquery/tests/test_util.h"
+
 namespace osquery {
 
+DECLARE_uint64(table_cache_max_bytes);
+
 class TablesTests : public testing::Test {};
 
 TEST_F(TablesTests, test_constraint) {
@@ -106,6 +114,50 @@ TEST_F(TablesTests, test_constraint_matching) {
   EXPECT_TRUE(cl3.matches(1));
 }
 
+TEST_F(TablesTests, test_constraint_matcher) {
+  struct ConstraintList cl;
+  cl.affinity = BIGINT_TYPE;
+  cl.add(Constraint(EQUALS, "1"));
+  cl.add(Constraint(EQUALS, "20"));
+  cl.add(Constraint(LESS_THAN, "10"));
+
+  // Equalities match any value, as the values of an IN list.
+  EXPECT_TRUE(cl.matches(1));
+  EXPECT_TRUE(cl.matches("1"));
+  EXPECT_FALSE(cl.matches(20));
+  EXPECT_FALSE(cl.matches(2));
+  EXPECT_FALSE(cl.matches("not_integer"));
+
+  // Typed views are cast once and kept until a constraint is added.
+  const auto& equals = cl.getAll<long long>(EQUALS);
+  EXPECT_EQ(std::set<long long>({1, 20}), equals);
+  EXPECT_EQ(&equals, &cl.getAll<long long>(EQUALS));
+  cl.add(Constraint(EQUALS, "3"));
+  EXPECT_EQ(3U, cl.getAll<long long>(EQUALS).size());
+  EXPECT_TRUE(cl.matches(3));
+
+  // Unsigned values order as unsigned.
+  struct ConstraintList unsigned_cl;
+  unsigned_cl.affinity = UNSIGNED_BIGINT_TYPE;
+  unsigned_cl.add(Constraint(GREATER_THAN, "9223372036854775807"));
+  EXPECT_TRUE(unsigned_cl.matches("18446744073709551615"));
+  EXPECT_FALSE(unsigned_cl.matches("1"));
+
+  // Patterns are checked with their prefixes, LIKE ignores ASCII case.
+  struct ConstraintList text;
+  text.add(Constraint(LIKE, "/USR/%.so"));
+  text.add(Constraint(GLOB, "/usr/lib*"));
+  EXPECT_TRUE(text.matches("/usr/lib/libc.so"));
+  EXPECT_FALSE(text.matches("/usr/lib/libc.SO.6"));
+  EXPECT_FALSE(text.matches("/usr/local/lib/libc.so"));
+  EXPECT_TRUE(text.matches(boost::string_ref("/usr/lib64/libm.so")));
+
+  // Operators that are not evaluated do not limit the values.
+  struct ConstraintList regexp;
+  regexp.add(Constraint(REGEXP, "^a"));
+  EXPECT_TRUE(regexp.matches("b"));
+}
+
 TEST_F(TablesTests, test_constraint_map) {
   ConstraintMap cm;
 
@@ -136,7 +188,13 @@ class TestTablePlugin : public TablePlugin {
     setCache(step, interval, r);
   }
 
+  void testSetCache(size_t step, size_t interval, const QueryData& r) {
+    setCache(step, interval, r);
+  }
+
   bool testIsCached(size_t interval) { return isCached(interval); }
+
+  QueryData testGetCache() const { return getCache(); }
 };
 
 TEST_F(TablesTests, test_caching) {
@@ -164,4 +222,80 @@ TEST_F(TablesTests, test_caching) {
   EXPECT_TRUE(test.testIsCached(6));
   EXPECT_FALSE(test.testIsCached(7));
 }
+
+TEST_F(TablesTests, test_caching_memory_budget) {
+  auto max_bytes = FLAGS_table_cache_max_bytes;
+  FLAGS_table_cache_max_bytes = 20;
+
+  TestTablePlugin first;
+  first.setName("cache_first");
+  TestTablePlugin second;
+  second.setName("cache_second");
+
+  // Each set of results is 12 bytes, both cannot fit within the budget.
+  first.testSetCache(1, 5, {{{"data", "12345678"}}});
+  EXPECT_TRUE(first.testIsCached(2));
+  ASSERT_EQ(first.testGetCache().size(), 1U);
+  EXPECT_EQ(first.testGetCache()[0]["data"], "12345678");
+
+  second.testSetCache(1, 5, {{{"data", "87654321"}}});
+  EXPECT_TRUE(second.testIsCached(2));
+
+  // The least recently used results were evicted.
+  EXPECT_FALSE(first.testIsCached(2));
+
+  // Results larger than the budget are not cached.
+  second.testSetCache(2, 5, {{{"data", "1234567890123456789"}}});
+  EXPECT_FALSE(second.testIsCached(3));
+
+  FLAGS_table_cache_max_bytes = max_bytes;
+}
+
+class ProcessTablePlugin : public TablePlugin {
+ public:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("data", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  TableAttributes attributes() const override {
+    return TableAttributes::CACHEABLE_PROCESS;
+  }
+
+  std::vector<std::string> lifetimeCachePaths() const override {
+    return {path};
+  }
+
+  std::string path;
+};
+
+TEST_F(TablesTests, test_lifetime_caching) {
+  ProcessTablePlugin test;
+  test.setName("cache_process");
+  test.path = kTestWorkingDirectory + "lifetime-cache";
+  ASSERT_TRUE(writeTextFile(test.path, "1").ok());
+
+  QueryData results;
+  std::string key;
+  EXPECT_FALSE(test.getLifetimeCache(results, key));
+
+  // Results of constrained scans are not complete.
+  QueryContext constrained;
+  constrained.constraints["data"].add(Constraint(EQUALS, "1"));
+  test.setLifetimeCache(constrained, key, {{{"data", "1"}}});
+  EXPECT_FALSE(test.getLifetimeCache(results, key));
+
+  QueryContext context;
+  test.setLifetimeCache(context, key, {{{"data", "1"}}});
+  ASSERT_TRUE(test.getLifetimeCache(results, key));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["data"]);
+
+  // Modifying the table's files invalidates the results.
+  auto mtime = boost::filesystem::last_write_time(test.path);
+  boost::filesystem::last_write_time(test.path, mtime - 60);
+  EXPECT_FALSE(test.getLifetimeCache(results, key));
+  boost::filesystem::remove(test.path);
+}
 }
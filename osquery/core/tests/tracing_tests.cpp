@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/tracing.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_string(schedule_trace_path);
+
+class TracingTests : public testing::Test {};
+
+static std::map<std::string, SpanStats> getProfile(const std::string& name) {
+  std::map<std::string, SpanStats> spans;
+  getScheduleProfile(([&name, &spans](const std::string& query,
+                                      const std::string& span,
+                                      const SpanStats& stats) {
+    if (query == name) {
+      spans[span] = stats;
+    }
+  }));
+  return spans;
+}
+
+TEST_F(TracingTests, test_trace_spans) {
+  {
+    // Spans outside of a scope are not recorded.
+    TraceSpan span("diff");
+  }
+
+  {
+    QueryTraceScope scope("tracing_test");
+    TraceSpan query("query");
+    for (size_t i = 0; i < 3; i++) {
+      TraceSpan generate("generate", "processes");
+    }
+  }
+
+  auto spans = getProfile("tracing_test");
+  ASSERT_EQ(spans.size(), 2U);
+  EXPECT_EQ(spans["query"].calls, 1U);
+  EXPECT_EQ(spans["generate:processes"].calls, 3U);
+  EXPECT_GE(spans["query"].total_time, spans["generate:processes"].total_time);
+  EXPECT_GE(spans["generate:processes"].total_time,
+            spans["generate:processes"].max_time);
+}
+
+TEST_F(TracingTests, test_trace_unrecorded) {
+  std::map<std::string, SpanStats> spans;
+  {
+    QueryTraceScope scope("tracing_unrecorded_test", false);
+    for (size_t i = 0; i < 2; i++) {
+      TraceSpan generate("generate", "processes");
+      generate.setRows(5);
+    }
+    spans = scope.spans();
+  }
+
+  // The caller reads the spans, they are not in the schedule profile.
+  ASSERT_EQ(spans.size(), 1U);
+  EXPECT_EQ(spans["generate:processes"].calls, 2U);
+  EXPECT_EQ(spans["generate:processes"].rows, 10U);
+  EXPECT_TRUE(getProfile("tracing_unrecorded_test").empty());
+}
+
+TEST_F(TracingTests, test_trace_file) {
+  auto path = kTestWorkingDirectory + "osquery.trace";
+  remove(path);
+  auto backup_path = FLAGS_schedule_trace_path;
+  FLAGS_schedule_trace_path = path;
+  {
+    QueryTraceScope scope("tracing_file_test");
+    TraceSpan span("log");
+  }
+  FLAGS_schedule_trace_path = backup_path;
+
+  std::string content;
+  ASSERT_TRUE(readFile(path, content).ok());
+  EXPECT_EQ(content.find("[\n{\"name\":\"log\""), 0U);
+  EXPECT_NE(content.find("\"query\":\"tracing_file_test\""), std::string::npos);
+}
+}
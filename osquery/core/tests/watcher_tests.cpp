@@ -194,32 +194,33 @@ class FakeWatcherRunner : public WatcherRunner {
   /**
   * @brief What the runner's internals will use as process state.
   *
-  * Internal calls to getProcessRow will return this structure.
+  * Internal calls to getProcessStats will return this structure.
   */
-  void setProcessRow(QueryData qd) {
-    qd_ = std::move(qd);
+  void setProcessStats(const ProcessStats& stats) {
+    stats_ = stats;
   }
 
-  /// The tests do not have access to the processes table.
-  QueryData getProcessRow(pid_t pid) const override {
-    return qd_;
+  /// The tests control the sampled process state.
+  Status getProcessStats(pid_t pid, ProcessStats& stats) const override {
+    stats = stats_;
+    return Status(0, "OK");
   }
 
  private:
-  QueryData qd_;
+  ProcessStats stats_;
 };
 
 TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
   FakeWatcherRunner runner(0, nullptr, true);
 
-  // Construct a process state, assume this would have been returned from the
-  // processes table, which the WorkerRunner normally uses internally.
-  Row r;
-  r["parent"] = INTEGER(1);
-  r["user_time"] = INTEGER(100);
-  r["system_time"] = INTEGER(100);
-  r["resident_size"] = INTEGER(100);
-  runner.setProcessRow({r});
+  // Construct a process state, assume this would have been sampled from the
+  // process, which the WorkerRunner normally does internally.
+  ProcessStats stats;
+  stats.parent = 1;
+  stats.user_time = 1000;
+  stats.system_time = 1000;
+  stats.resident_size = 100;
+  runner.setProcessStats(stats);
 
   // Hold the process and process state externally.
   // Normally the WatcherRunner's entry point will persist these and use them
@@ -236,29 +237,41 @@ TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
   EXPECT_EQ(100U, state.initial_footprint);
 
   // The measurement of latency applies an interval value normalization.
+  // CPU time is measured in hundredths of a second.
   auto iv = std::max(getWorkerLimit(WatchdogLimitType::INTERVAL), (size_t)1);
   EXPECT_EQ(100U / iv, state.user_time);
   EXPECT_EQ(0U, state.sustained_latency);
 
   // Now we can alter the performance.
   // Let us emulate the watcher having just allocated 1G of memory.
-  r["resident_size"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  stats.resident_size = 1024 * 1024 * 1024;
+  runner.setProcessStats(stats);
 
   auto status = runner.isWatcherHealthy(*test_process, state);
   EXPECT_FALSE(status.ok());
   EXPECT_EQ(status.getMessage(), "Memory limits exceeded");
 
   // Now emulate a rapid increase in CPU requirements.
-  r["user_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  stats.user_time = 1024 * 1024 * 1024;
+  runner.setProcessStats(stats);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(1U, state.sustained_latency);
 
   // And again, the CPU continues to increase from the system perspective.
-  r["system_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  stats.system_time = 1024 * 1024 * 1024;
+  runner.setProcessStats(stats);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(2U, state.sustained_latency);
 }
+
+TEST_F(WatcherTests, test_process_stats) {
+  auto self = PlatformProcess::getCurrentProcess();
+  ProcessStats stats;
+  ASSERT_TRUE(getProcessStats(self->pid(), stats).ok());
+  EXPECT_GT(stats.resident_size, 0U);
+  EXPECT_GT(stats.parent, 0);
+
+  // An invalid process cannot be sampled.
+  EXPECT_FALSE(getProcessStats(-1, stats).ok());
+}
 }
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
+
+namespace osquery {
+
+FLAG(bool,
+     schedule_profile,
+     true,
+     "Record per-table and per-stage timing of scheduled queries");
+
+FLAG(string,
+     schedule_trace_path,
+     "",
+     "Append scheduled query spans to a Chrome trace format file");
+
+/// The scope of the query running on this thread.
+static thread_local QueryTraceScope* kTraceScope{nullptr};
+
+/// Spans of every scheduled query, by query name then span name.
+static std::map<std::string, std::map<std::string, SpanStats>> kProfile;
+static std::mutex kProfileMutex;
+
+/// Writes to the trace file are serialized across query threads.
+static std::mutex kTraceMutex;
+
+static unsigned long long int getMicros(
+    std::chrono::steady_clock::time_point point) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             point.time_since_epoch())
+      .count();
+}
+
+/// Quote a string for a JSON trace event.
+static std::string quoteTraceString(const std::string& value) {
+  std::string quoted = "\"";
+  for (const auto& c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+QueryTraceScope::QueryTraceScope(const std::string& name, bool record)
+    : name_(name), previous_(kTraceScope), record_(record) {
+  kTraceScope = this;
+}
+
+QueryTraceScope::~QueryTraceScope() {
+  kTraceScope = previous_;
+  if (!record_) {
+    return;
+  }
+
+  if (!spans_.empty()) {
+    std::lock_guard<std::mutex> lock(kProfileMutex);
+    auto& profile = kProfile[name_];
+    for (const auto& span : spans_) {
+      auto& stats = profile[span.first];
+      stats.calls += span.second.calls;
+      stats.total_time += span.second.total_time;
+      stats.max_time = std::max(stats.max_time, span.second.max_time);
+      stats.rows += span.second.rows;
+    }
+  }
+
+  if (events_.empty() || FLAGS_schedule_trace_path.empty()) {
+    return;
+  }
+
+  // The trace format allows an unterminated array of complete events.
+  std::lock_guard<std::mutex> lock(kTraceMutex);
+  std::ofstream trace(FLAGS_schedule_trace_path,
+                      std::ios::out | std::ios::app);
+  if (!trace.is_open()) {
+    return;
+  }
+  if (trace.tellp() == 0) {
+    trace << "[\n";
+  }
+
+  auto pid = std::to_string(platformGetPid());
+  auto tid = std::to_string(platformGetTid());
+  auto query = quoteTraceString(name_);
+  for (const auto& event : events_) {
+    trace << "{\"name\":" << quoteTraceString(event.span)
+          << ",\"cat\":\"osquery\",\"ph\":\"X\",\"ts\":" << event.start
+          << ",\"dur\":" << event.duration << ",\"pid\":" << pid
+          << ",\"tid\":" << tid << ",\"args\":{\"query\":" << query
+          << "}},\n";
+  }
+}
+
+void QueryTraceScope::add(const std::string& span,
+                          unsigned long long int start,
+                          unsigned long long int duration,
+                          size_t rows) {
+  auto& stats = spans_[span];
+  stats.calls++;
+  stats.total_time += duration;
+  stats.max_time = std::max(stats.max_time, duration);
+  stats.rows += rows;
+  if (record_ && !FLAGS_schedule_trace_path.empty()) {
+    events_.push_back({span, start, duration});
+  }
+}
+
+TraceSpan::TraceSpan(const char* category, const std::string& name) {
+  if (kTraceScope == nullptr ||
+      (!FLAGS_schedule_profile && kTraceScope->record_)) {
+    return;
+  }
+
+  scope_ = kTraceScope;
+  span_ = (name.empty()) ? category : std::string(category) + ":" + name;
+  start_ = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan() {
+  // The scope may have ended on this thread before the span.
+  if (scope_ == nullptr || scope_ != kTraceScope) {
+    return;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  scope_->add(
+      span_, getMicros(start_), getMicros(end) - getMicros(start_), rows_);
+}
+
+void getScheduleProfile(
+    std::function<void(const std::string& query,
+                       const std::string& span,
+                       const SpanStats& stats)> predicate) {
+  std::lock_guard<std::mutex> lock(kProfileMutex);
+  for (const auto& query : kProfile) {
+    for (const auto& span : query.second) {
+      predicate(query.first, span.first, span.second);
+    }
+  }
+}
+}
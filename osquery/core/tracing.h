@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// Aggregate timing of one kind of span within a scheduled query.
+struct SpanStats {
+  /// Number of times the span was entered.
+  size_t calls{0};
+
+  /// Total microseconds spent within the span.
+  unsigned long long int total_time{0};
+
+  /// The longest single span in microseconds.
+  unsigned long long int max_time{0};
+
+  /// Rows produced within the span, such as by a table's generate.
+  size_t rows{0};
+};
+
+/**
+ * @brief Collect the spans of one scheduled query execution.
+ *
+ * A scope is bound to the calling thread while it exists. Spans entered on
+ * this thread within the scope are aggregated into the query's profile when
+ * the scope ends, see getScheduleProfile.
+ */
+class QueryTraceScope : private boost::noncopyable {
+ public:
+  /**
+   * @brief Begin collecting the spans of a query on this thread.
+   *
+   * @param name the scheduled query name.
+   * @param record add the spans to the schedule profile and trace file. A
+   * scope that is not recorded collects spans even if --schedule_profile is
+   * unset, and the caller reads them with #spans.
+   */
+  explicit QueryTraceScope(const std::string& name, bool record = true);
+  ~QueryTraceScope();
+
+  /// The spans collected so far, aggregated by name.
+  const std::map<std::string, SpanStats>& spans() const {
+    return spans_;
+  }
+
+ private:
+  struct Event {
+    std::string span;
+    unsigned long long int start;
+    unsigned long long int duration;
+  };
+
+  /// Add a finished span.
+  void add(const std::string& span,
+           unsigned long long int start,
+           unsigned long long int duration,
+           size_t rows);
+
+ private:
+  /// The scheduled query name.
+  std::string name_;
+
+  /// Spans aggregated by name.
+  std::map<std::string, SpanStats> spans_;
+
+  /// Individual spans, only kept when writing a trace file.
+  std::vector<Event> events_;
+
+  /// A scope within the lifetime of another on the same thread.
+  QueryTraceScope* previous_{nullptr};
+
+  /// The spans are added to the schedule profile.
+  bool record_{true};
+
+ private:
+  friend class TraceSpan;
+};
+
+/**
+ * @brief Time a region of a scheduled query.
+ *
+ * Spans outside of a QueryTraceScope, or when profiling is disabled, do not
+ * read the clock.
+ */
+class TraceSpan : private boost::noncopyable {
+ public:
+  /**
+   * @brief Begin a span.
+   *
+   * @param category the kind of work, such as "generate" or "diff".
+   * @param name an optional subject, such as a table name.
+   */
+  explicit TraceSpan(const char* category, const std::string& name = "");
+  ~TraceSpan();
+
+  /// Set the rows produced within the span.
+  void setRows(size_t rows) {
+    rows_ = rows;
+  }
+
+ private:
+  QueryTraceScope* scope_{nullptr};
+  std::string span_;
+  std::chrono::steady_clock::time_point start_;
+  size_t rows_{0};
+};
+
+/// Iterate the recorded spans of every scheduled query.
+void getScheduleProfile(
+    std::function<void(const std::string& query,
+                       const std::string& span,
+                       const SpanStats& stats)> predicate);
+}
@@ -24,6 +24,7 @@
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
+#include "osquery/core/containment.h"
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
 
@@ -80,6 +81,22 @@ CLI_FLAG(uint64,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(bool,
+         watchdog_containment,
+         false,
+         "Throttle the worker and extensions in a cgroup or Job Object");
+
+CLI_FLAG(string,
+         watchdog_cgroup,
+         "/sys/fs/cgroup/osquery",
+         "The cgroup v2 group created for watchdog containment");
+
+/// Contained processes are only stopped beyond this multiple of the limits.
+const size_t kContainedLimitFactor = 2;
+
+/// Seconds between reports of containment throttling.
+const size_t kContainmentReportInterval = 60;
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   auto& state = instance().state_;
@@ -177,9 +194,64 @@ bool WatcherRunner::ok() {
   return (Watcher::getWorker().isValid() || Watcher::hasManagedExtensions());
 }
 
+void WatcherRunner::initContainment() {
+  if (!FLAGS_watchdog_containment || FLAGS_disable_watchdog ||
+      FLAGS_watchdog_level < 0) {
+    return;
+  }
+
+  auto status = osquery::initContainment(
+      getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT),
+      getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024);
+  if (!status.ok()) {
+    LOG(WARNING) << "Watchdog containment unavailable: " << status.getMessage();
+    return;
+  }
+  contained_ = true;
+}
+
+void WatcherRunner::contain(const PlatformProcess& child) const {
+  if (!contained_) {
+    return;
+  }
+
+  auto status = containProcess(child);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot contain child process (" << child.pid()
+                 << "): " << status.getMessage();
+  }
+}
+
+void WatcherRunner::reportContainment() {
+  auto now = getUnixTime();
+  if (!contained_ || now < last_report_ + kContainmentReportInterval) {
+    return;
+  }
+  last_report_ = now;
+
+  std::map<std::string, size_t> stats;
+  if (!getContainmentStats(stats).ok()) {
+    return;
+  }
+
+  // Report the throttling since the last report.
+  std::string changes;
+  for (const auto& stat : stats) {
+    auto& last = throttle_stats_[stat.first];
+    if (stat.second > last) {
+      changes += " " + stat.first + "=" + std::to_string(stat.second - last);
+    }
+    last = stat.second;
+  }
+  if (!changes.empty()) {
+    LOG(INFO) << "osqueryd children were throttled:" << changes;
+  }
+}
+
 void WatcherRunner::start() {
   // Set worker performance counters to an initial state.
   Watcher::resetWorkerCounters(0);
+  initContainment();
   // Hold the current process (watcher) for inspection too.
   auto watcher = PlatformProcess::getCurrentProcess();
   PerformanceState watcher_state;
@@ -224,6 +296,7 @@ void WatcherRunner::start() {
       }
     }
 
+    reportContainment();
     if (run_once_) {
       // A test harness can end the thread immediately.
       break;
@@ -277,21 +350,18 @@ void WatcherRunner::stopChild(const PlatformProcess& child) const {
   }
 }
 
-PerformanceChange getChange(const Row& r, PerformanceState& state) {
+PerformanceChange getChange(const ProcessStats& stats,
+                            PerformanceState& state) {
   PerformanceChange change;
 
   // IV is the check interval in seconds, and utilization is set per-second.
   change.iv = std::max(getWorkerLimit(WatchdogLimitType::INTERVAL), (size_t)1);
-  UNSIGNED_BIGINT_LITERAL user_time = 0, system_time = 0;
-  try {
-    change.parent =
-        static_cast<pid_t>(AS_LITERAL(BIGINT_LITERAL, r.at("parent")));
-    user_time = AS_LITERAL(BIGINT_LITERAL, r.at("user_time")) / change.iv;
-    system_time = AS_LITERAL(BIGINT_LITERAL, r.at("system_time")) / change.iv;
-    change.footprint = AS_LITERAL(BIGINT_LITERAL, r.at("resident_size"));
-  } catch (const std::exception& /* e */) {
-    state.sustained_latency = 0;
-  }
+  change.parent = static_cast<pid_t>(stats.parent);
+  change.footprint = static_cast<size_t>(stats.resident_size);
+
+  // Utilization limits are a percent of a CPU, use hundredths of a second.
+  size_t user_time = static_cast<size_t>(stats.user_time / 10) / change.iv;
+  size_t system_time = static_cast<size_t>(stats.system_time / 10) / change.iv;
 
   // Check the difference of CPU time used since last check.
   if (user_time - state.user_time >
@@ -326,13 +396,14 @@ PerformanceChange getChange(const Row& r, PerformanceState& state) {
   return change;
 }
 
-static bool exceededMemoryLimit(const PerformanceChange& change) {
+static bool exceededMemoryLimit(const PerformanceChange& change,
+                                size_t factor = 1) {
   if (change.footprint == 0) {
     return false;
   }
 
-  return (change.footprint >
-          getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024);
+  return (change.footprint > getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) *
+                                 1024 * 1024 * factor);
 }
 
 static bool exceededCyclesLimit(const PerformanceChange& change) {
@@ -346,13 +417,13 @@ static bool exceededCyclesLimit(const PerformanceChange& change) {
 
 Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
                                        PerformanceState& watcher_state) const {
-  auto rows = getProcessRow(watcher.pid());
-  if (rows.size() == 0) {
+  ProcessStats stats;
+  if (!getProcessStats(watcher.pid(), stats).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find watcher process");
   }
 
-  auto change = getChange(rows[0], watcher_state);
+  auto change = getChange(stats, watcher_state);
   if (exceededMemoryLimit(change)) {
     return Status(1, "Memory limits exceeded");
   }
@@ -360,13 +431,13 @@ Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
   return Status(0);
 }
 
-QueryData WatcherRunner::getProcessRow(pid_t pid) const {
-  return SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(pid));
+Status WatcherRunner::getProcessStats(pid_t pid, ProcessStats& stats) const {
+  return osquery::getProcessStats(static_cast<int>(pid), stats);
 }
 
 Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
-  auto rows = getProcessRow(child.pid());
-  if (rows.size() == 0) {
+  ProcessStats stats;
+  if (!getProcessStats(child.pid(), stats).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find worker process");
   }
@@ -375,7 +446,7 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
   {
     WatcherLocker locker;
     auto& state = Watcher::getState(child);
-    change = getChange(rows[0], state);
+    change = getChange(stats, state);
   }
 
   // Only make a decision about the child sanity if it is still the watcher's
@@ -387,11 +458,14 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
     return Status(0);
   }
 
-  if (exceededCyclesLimit(change)) {
+  // The kernel caps the CPU use of contained processes.
+  if (!contained_ && exceededCyclesLimit(change)) {
     return Status(1, "System performance limits exceeded");
   }
   // Check if the private memory exceeds a memory limit.
-  if (exceededMemoryLimit(change)) {
+  // Contained processes are under reclaim pressure above the limit, stopping
+  // them is a last resort.
+  if (exceededMemoryLimit(change, contained_ ? kContainedLimitFactor : 1)) {
     return Status(
         1, "Memory limits exceeded: " + std::to_string(change.footprint));
   }
@@ -435,9 +509,10 @@ void WatcherRunner::createWorker() {
   }
 
   // Set an environment signaling to potential plugin-dependent workers to wait
-  // for extensions to broadcast.
+  // for extensions to broadcast, with the number of extensions launched.
   if (Watcher::hasManagedExtensions()) {
-    setEnvVar("OSQUERY_EXTENSIONS", "true");
+    setEnvVar("OSQUERY_EXTENSIONS",
+              std::to_string(Watcher::extensions().size()));
   }
 
   // Get the complete path of the osquery process binary.
@@ -461,6 +536,7 @@ void WatcherRunner::createWorker() {
   }
 
   Watcher::setWorker(worker);
+  contain(*worker);
   Watcher::resetWorkerCounters(getUnixTime());
   VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
           << ") executing worker (" << worker->pid() << ")";
@@ -501,6 +577,7 @@ void WatcherRunner::createExtension(const std::string& extension) {
   }
 
   Watcher::setExtension(extension, ext_process);
+  contain(*ext_process);
   Watcher::resetExtensionCounters(extension, getUnixTime());
   VLOG(1) << "Created and monitoring extension child (" << ext_process->pid()
           << "): " << extension;
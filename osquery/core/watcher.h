@@ -294,8 +294,17 @@ class WatcherRunner : public InternalRunnable {
   virtual Status isWatcherHealthy(const PlatformProcess& watcher,
                                   PerformanceState& watcher_state) const;
 
-  /// Get row data from the processes table for a given pid.
-  virtual QueryData getProcessRow(pid_t pid) const;
+  /// Sample the CPU and memory use of a given pid.
+  virtual Status getProcessStats(pid_t pid, ProcessStats& stats) const;
+
+  /// Create the kernel container for children, if requested.
+  void initContainment();
+
+  /// Move a child into the kernel container.
+  void contain(const PlatformProcess& child) const;
+
+  /// Log the kernel container's throttling counters.
+  void reportContainment();
 
  private:
   /// Fork and execute a worker process.
@@ -329,6 +338,15 @@ class WatcherRunner : public InternalRunnable {
   /// Similarly to the uncontrolled worker restarted, count each extension.
   std::map<std::string, size_t> extension_restarts_;
 
+  /// Children are throttled by the kernel, stopping them is a last resort.
+  bool contained_{false};
+
+  /// The throttling counters at the last report.
+  std::map<std::string, size_t> throttle_stats_;
+
+  /// Time of the last throttling report.
+  size_t last_report_{0};
+
  private:
   FRIEND_TEST(WatcherTests, test_watcherrunner_watch);
   FRIEND_TEST(WatcherTests, test_watcherrunner_stop);
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <algorithm>
+
+#include "osquery/core/containment.h"
+
+namespace osquery {
+
+/// The Job Object holding watched processes, null if not active.
+static HANDLE kJobObject{nullptr};
+
+Status initContainment(size_t cpu_percent, size_t memory_bytes) {
+  auto job = ::CreateJobObject(nullptr, nullptr);
+  if (job == nullptr) {
+    return Status(1, "Cannot create Job Object");
+  }
+
+  // Job CPU rates are in hundredths of a percent of the whole machine.
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  auto cpus = std::max(info.dwNumberOfProcessors, (DWORD)1);
+  JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate = {0};
+  rate.ControlFlags =
+      JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+  rate.CpuRate = static_cast<DWORD>(
+      std::min(std::max(cpu_percent * 100 / cpus, (size_t)1), (size_t)10000));
+  if (!::SetInformationJobObject(
+          job, JobObjectCpuRateControlInformation, &rate, sizeof(rate))) {
+    ::CloseHandle(job);
+    return Status(1, "Cannot set Job Object CPU rate");
+  }
+
+  kJobObject = job;
+  return Status(0, "OK");
+}
+
+Status containProcess(const PlatformProcess& process) {
+  if (kJobObject == nullptr) {
+    return Status(1, "Containment is not active");
+  }
+
+  if (!::AssignProcessToJobObject(kJobObject, process.nativeHandle())) {
+    return Status(1, "Cannot assign process to Job Object");
+  }
+  return Status(0, "OK");
+}
+
+Status getContainmentStats(std::map<std::string, size_t>& stats) {
+  // Job Objects do not count throttled intervals.
+  return Status(1, "Throttle counters are not available");
+}
+}
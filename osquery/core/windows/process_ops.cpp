@@ -13,6 +13,8 @@
 #include <Windows.h>
 // clang-format off
 #include <LM.h>
+#include <psapi.h>
+#include <tlhelp32.h>
 // clang-format on
 
 #include <vector>
@@ -229,4 +231,56 @@ int platformGetPid() {
 int platformGetTid() {
   return static_cast<int>(GetCurrentThreadId());
 }
+
+/// Find the parent of a process from a snapshot of the process list.
+static int getParentPid(DWORD pid) {
+  auto snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return -1;
+  }
+
+  int parent = -1;
+  PROCESSENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  if (::Process32First(snapshot, &entry)) {
+    do {
+      if (entry.th32ProcessID == pid) {
+        parent = static_cast<int>(entry.th32ParentProcessID);
+        break;
+      }
+    } while (::Process32Next(snapshot, &entry));
+  }
+  ::CloseHandle(snapshot);
+  return parent;
+}
+
+Status getProcessStats(int pid, ProcessStats& stats) {
+  auto process = ::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION,
+                               FALSE,
+                               static_cast<DWORD>(pid));
+  if (process == nullptr) {
+    return Status(1, "Cannot open process");
+  }
+
+  FILETIME creation, exit, kernel, user;
+  PROCESS_MEMORY_COUNTERS counters;
+  auto times = ::GetProcessTimes(process, &creation, &exit, &kernel, &user);
+  auto memory = ::GetProcessMemoryInfo(process, &counters, sizeof(counters));
+  ::CloseHandle(process);
+  if (times == 0 || memory == 0) {
+    return Status(1, "Cannot read process times");
+  }
+
+  // Process times are in 100 nanosecond units.
+  ULARGE_INTEGER time;
+  time.LowPart = user.dwLowDateTime;
+  time.HighPart = user.dwHighDateTime;
+  stats.user_time = time.QuadPart / 10000;
+  time.LowPart = kernel.dwLowDateTime;
+  time.HighPart = kernel.dwHighDateTime;
+  stats.system_time = time.QuadPart / 10000;
+  stats.resident_size = counters.WorkingSetSize;
+  stats.parent = getParentPid(static_cast<DWORD>(pid));
+  return Status(0, "OK");
+}
 }
\ No newline at end of file
@@ -9,12 +9,126 @@
  */
 
 #include <locale>
+#include <mutex>
 #include <string>
 
+#include <boost/algorithm/string/join.hpp>
+
+#include <osquery/core.h>
+
 #include "osquery/core/windows/wmi.h"
 
 namespace osquery {
 
+/// The number of result objects requested from an enumerator at once.
+const ULONG kWmiBatchSize = 64;
+
+/// The locator used to connect to WMI namespaces, created on first use.
+static IWbemLocator* kWmiLocator{nullptr};
+
+/// Connections to WMI namespaces, shared between requests.
+static std::map<std::wstring, IWbemServices*> kWmiServices;
+
+/// Protect the WMI locator and connections.
+static Mutex kWmiServicesMutex;
+
+/**
+ * @brief Get the shared connection to a WMI namespace, connecting if needed
+ *
+ * @param nspace the WMI namespace
+ * @param reconnect release the shared connection and connect again
+ * @param services on success, a referenced connection the caller releases
+ * @returns S_OK if a connection is available.
+ */
+static HRESULT getWmiServices(BSTR nspace,
+                              bool reconnect,
+                              IWbemServices** services) {
+  static std::once_flag security;
+  std::call_once(security, []() {
+    ::CoInitializeSecurity(nullptr,
+                           -1,
+                           nullptr,
+                           nullptr,
+                           RPC_C_AUTHN_LEVEL_DEFAULT,
+                           RPC_C_IMP_LEVEL_IMPERSONATE,
+                           nullptr,
+                           EOAC_NONE,
+                           nullptr);
+  });
+
+  WriteLock lock(kWmiServicesMutex);
+  std::wstring name(static_cast<const wchar_t*>(nspace));
+  auto cached = kWmiServices.find(name);
+  if (cached != kWmiServices.end()) {
+    if (!reconnect) {
+      cached->second->AddRef();
+      *services = cached->second;
+      return S_OK;
+    }
+    cached->second->Release();
+    kWmiServices.erase(cached);
+  }
+
+  HRESULT hr = S_OK;
+  if (kWmiLocator == nullptr) {
+    hr = ::CoCreateInstance(CLSID_WbemLocator,
+                            0,
+                            CLSCTX_INPROC_SERVER,
+                            IID_IWbemLocator,
+                            (LPVOID*)&kWmiLocator);
+    if (hr != S_OK) {
+      kWmiLocator = nullptr;
+      return hr;
+    }
+  }
+
+  IWbemServices* connection = nullptr;
+  hr = kWmiLocator->ConnectServer(
+      nspace, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &connection);
+  if (hr != S_OK) {
+    return hr;
+  }
+
+  // The shared entry holds one reference and the caller holds another.
+  connection->AddRef();
+  kWmiServices[name] = connection;
+  *services = connection;
+  return S_OK;
+}
+
+/// Check if a request failed because its shared connection is broken.
+static inline bool isWmiDisconnected(HRESULT hr) {
+  return hr == RPC_E_DISCONNECTED || hr == WBEM_E_TRANSPORT_FAILURE ||
+         hr == HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE) ||
+         hr == HRESULT_FROM_WIN32(RPC_S_CALL_FAILED);
+}
+
+std::string getWmiSelect(const QueryContext& context,
+                         const std::string& wmi_class,
+                         const std::map<std::string, std::string>& properties,
+                         const std::set<std::string>& required) {
+  if (!context.colsUsed) {
+    return "SELECT * FROM " + wmi_class;
+  }
+
+  auto selected = required;
+  for (const auto& property : properties) {
+    if (context.isColumnUsed(property.first)) {
+      selected.insert(property.second);
+    }
+  }
+
+  if (selected.empty()) {
+    // No property is used, such as for count(*), but each object is needed.
+    if (properties.empty()) {
+      return "SELECT * FROM " + wmi_class;
+    }
+    selected.insert(properties.begin()->second);
+  }
+  return "SELECT " + boost::algorithm::join(selected, ",") + " FROM " +
+         wmi_class;
+}
+
 std::wstring stringToWstring(const std::string& src) {
   std::wstring utf16le_str = converter.from_bytes(src);
   return utf16le_str;
@@ -251,47 +365,50 @@ WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
 
   HRESULT hr = E_FAIL;
 
-  hr = ::CoInitializeSecurity(nullptr,
-                              -1,
-                              nullptr,
-                              nullptr,
-                              RPC_C_AUTHN_LEVEL_DEFAULT,
-                              RPC_C_IMP_LEVEL_IMPERSONATE,
-                              nullptr,
-                              EOAC_NONE,
-                              nullptr);
-  hr = ::CoCreateInstance(CLSID_WbemLocator,
-                          0,
-                          CLSCTX_INPROC_SERVER,
-                          IID_IWbemLocator,
-                          (LPVOID*)&locator_);
-  if (hr != S_OK) {
-    locator_ = nullptr;
-    return;
-  }
+  // A shared connection may be broken, such as when the WMI service restarts,
+  // so a failed query is retried once with a new connection.
+  for (size_t attempt = 0; attempt < 2; attempt++) {
+    if (services_ != nullptr) {
+      services_->Release();
+      services_ = nullptr;
+    }
 
-  hr = locator_->ConnectServer(
-      nspace, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &services_);
-  if (hr != S_OK) {
-    services_ = nullptr;
-    return;
-  }
+    hr = getWmiServices(nspace, attempt > 0, &services_);
+    if (hr != S_OK) {
+      services_ = nullptr;
+      return;
+    }
 
-  hr = services_->ExecQuery(
-      (BSTR)L"WQL", (BSTR)wql.c_str(), WBEM_FLAG_FORWARD_ONLY, nullptr, &enum_);
-  if (hr != S_OK) {
+    hr = services_->ExecQuery((BSTR)L"WQL",
+                              (BSTR)wql.c_str(),
+                              WBEM_FLAG_FORWARD_ONLY |
+                                  WBEM_FLAG_RETURN_IMMEDIATELY,
+                              nullptr,
+                              &enum_);
+    if (hr == S_OK) {
+      break;
+    }
     enum_ = nullptr;
+    if (!isWmiDisconnected(hr)) {
+      break;
+    }
+  }
+
+  if (enum_ == nullptr) {
     return;
   }
 
   hr = WBEM_S_NO_ERROR;
   while (hr == WBEM_S_NO_ERROR) {
-    IWbemClassObject* result = nullptr;
+    IWbemClassObject* result[kWmiBatchSize] = {nullptr};
     ULONG result_count = 0;
 
-    hr = enum_->Next(WBEM_INFINITE, 1, &result, &result_count);
-    if (SUCCEEDED(hr) && result_count > 0) {
-      results_.push_back(WmiResultItem(result));
+    // The last batch returns WBEM_S_FALSE along with the remaining objects.
+    hr = enum_->Next(WBEM_INFINITE, kWmiBatchSize, result, &result_count);
+    if (SUCCEEDED(hr)) {
+      for (ULONG i = 0; i < result_count; i++) {
+        results_.push_back(WmiResultItem(result[i]));
+      }
     }
   }
 
@@ -299,8 +416,8 @@ WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
 }
 
 WmiRequest::WmiRequest(WmiRequest&& src) {
-  locator_ = nullptr;
-  std::swap(locator_, src.locator_);
+  status_ = src.status_;
+  results_ = std::move(src.results_);
 
   services_ = nullptr;
   std::swap(services_, src.services_);
@@ -321,10 +438,5 @@ WmiRequest::~WmiRequest() {
     services_->Release();
     services_ = nullptr;
   }
-
-  if (locator_ != nullptr) {
-    locator_->Release();
-    locator_ = nullptr;
-  }
 }
 }
@@ -12,6 +12,8 @@
 
 #include <codecvt>
 #include <iostream>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -58,6 +60,25 @@ std::string wstringToString(const wchar_t* src);
 */
 std::string bstrToString(const BSTR src);
 
+/**
+* @brief Build a WQL SELECT for the WMI properties a query uses
+*
+* WMI providers skip computing properties that are not selected. Each table
+* column is mapped to the property it is generated from, and only properties
+* of used columns are selected. When the used columns are unknown, every
+* property is selected.
+*
+* @param context the table's query context
+* @param wmi_class the class, and optional WHERE clause, to select from
+* @param properties a map of table column names to WMI property names
+* @param required properties the table reads regardless of the used columns
+* @returns the WQL query string
+*/
+std::string getWmiSelect(const QueryContext& context,
+                         const std::string& wmi_class,
+                         const std::map<std::string, std::string>& properties,
+                         const std::set<std::string>& required = {});
+
 /**
 * @brief Helper class to hold 1 result object from a WMI request
 *
@@ -177,6 +198,9 @@ class WmiResultItem {
 *
 * This class abstracts away the WMI querying logic and
 * will return WMI results given a query string.
+*
+* Connections to each WMI namespace are created once and shared between
+* requests, and results are enumerated in batches.
 */
 class WmiRequest {
  public:
@@ -201,7 +225,6 @@ class WmiRequest {
  private:
   Status status_;
   std::vector<WmiResultItem> results_;
-  IWbemLocator* locator_{nullptr};
   IWbemServices* services_{nullptr};
   IEnumWbemClassObject* enum_{nullptr};
 };
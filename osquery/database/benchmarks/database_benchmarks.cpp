@@ -8,16 +8,27 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+
 #include <benchmark/benchmark.h>
 
+#include <boost/filesystem/operations.hpp>
+
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
 
+#include "osquery/core/interned.h"
+#include "osquery/core/json.h"
 #include "osquery/tests/test_util.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+DECLARE_string(database_path);
+
 QueryData getExampleQueryData(size_t x, size_t y) {
   QueryData qd;
   Row r;
@@ -78,6 +89,145 @@ BENCHMARK(DATABASE_serialize_json)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+static void DATABASE_serialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryDataBinary(qd, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_deserialize_json(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataJSON(qd, content);
+  while (state.KeepRunning()) {
+    QueryData output;
+    deserializeQueryDataJSON(content, output);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_json)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_deserialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataBinary(qd, content);
+  while (state.KeepRunning()) {
+    QueryData output;
+    deserializeQueryDataBinary(content, output);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_row_json(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), 1);
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeRowJSON(qd[0], content);
+    Row r;
+    deserializeRowJSON(content, r);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_row_json)->Arg(1)->Arg(10)->Arg(20);
+
+static void DATABASE_serialize_row_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), 1);
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeRowBinary(qd[0], content);
+    Row r;
+    deserializeRowBinary(content, r);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_row_binary)->Arg(1)->Arg(10)->Arg(20);
+
+static QueryLogItem getExampleLogItem(size_t x, size_t y) {
+  QueryLogItem item;
+  item.name = "pack_example_processes";
+  item.identifier = "example.host";
+  item.calendar_time = "Mon Jan  1 00:00:00 2016 UTC";
+  item.time = 1451606400;
+  item.decorations["username"] = "root";
+  item.results.added = getExampleQueryData(x, y);
+  return item;
+}
+
+static void DATABASE_serialize_log_item_ptree(benchmark::State& state) {
+  auto item = getExampleLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    serializeQueryLogItem(item, tree);
+    std::ostringstream output;
+    boost::property_tree::write_json(output, tree, false);
+    auto content = output.str();
+  }
+}
+
+BENCHMARK(DATABASE_serialize_log_item_ptree)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_log_item_json(benchmark::State& state) {
+  auto item = getExampleLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryLogItemJSON(item, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_log_item_json)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_events_ptree(benchmark::State& state) {
+  auto item = getExampleLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    serializeQueryLogItemAsEvents(item, tree);
+    std::vector<std::string> items;
+    for (const auto& event : tree) {
+      std::ostringstream output;
+      boost::property_tree::write_json(output, event.second, false);
+      items.push_back(output.str());
+    }
+  }
+}
+
+BENCHMARK(DATABASE_serialize_events_ptree)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_events_json(benchmark::State& state) {
+  auto item = getExampleLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::vector<std::string> items;
+    serializeQueryLogItemAsEventsJSON(item, items);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_events_json)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
 static void DATABASE_diff(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -87,6 +237,30 @@ static void DATABASE_diff(benchmark::State& state) {
 
 BENCHMARK(DATABASE_diff)->ArgPair(1, 1)->ArgPair(10, 10)->ArgPair(10, 100);
 
+static void DATABASE_diff_changed(benchmark::State& state) {
+  // Rows are distinct, and a tenth of them change between results.
+  QueryData old_qd;
+  QueryData current_qd;
+  for (const auto& r : getExampleQueryData(state.range_x(), state.range_y())) {
+    auto id = std::to_string(old_qd.size());
+    old_qd.push_back(r);
+    old_qd.back()["id"] = id;
+    current_qd.push_back(old_qd.back());
+    if (old_qd.size() % 10 == 0) {
+      current_qd.back()["id"] = id + "changed";
+    }
+  }
+
+  while (state.KeepRunning()) {
+    auto d = diff(old_qd, current_qd);
+  }
+}
+
+BENCHMARK(DATABASE_diff_changed)
+    ->ArgPair(10, 100)
+    ->ArgPair(30, 1000)
+    ->ArgPair(30, 10000);
+
 static void DATABASE_query_results(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   auto query = getOsqueryScheduledQuery();
@@ -102,6 +276,28 @@ BENCHMARK(DATABASE_query_results)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+static void DATABASE_intern(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  size_t bytes = 0;
+  while (state.KeepRunning()) {
+    InternedQueryData interned(qd);
+    bytes = interned.bytes();
+  }
+  state.SetLabel("interned_bytes=" + std::to_string(bytes));
+}
+
+BENCHMARK(DATABASE_intern)->ArgPair(10, 100)->ArgPair(30, 10000);
+
+static void DATABASE_intern_expand(benchmark::State& state) {
+  InternedQueryData interned(
+      getExampleQueryData(state.range_x(), state.range_y()));
+  while (state.KeepRunning()) {
+    auto qd = interned.rows();
+  }
+}
+
+BENCHMARK(DATABASE_intern_expand)->ArgPair(10, 100)->ArgPair(30, 10000);
+
 static void DATABASE_get(benchmark::State& state) {
   setDatabaseValue(kPersistentSettings, "benchmark", "1");
   while (state.KeepRunning()) {
@@ -159,4 +355,255 @@ static void DATABASE_store_append(benchmark::State& state) {
 }
 
 BENCHMARK(DATABASE_store_append);
+
+/// Database plugins compared by the workload benchmarks, by argument index.
+static const std::vector<std::string> kWorkloadDatabases = {
+    "rocksdb", "sqlite", "ephemeral"};
+
+/// Workload threads wait for the first thread to set up the database.
+static std::atomic<bool> kWorkloadReady{false};
+static std::atomic<int> kWorkloadFinished{0};
+
+/// Unique event IDs and log indexes across workload threads.
+static std::atomic<size_t> kWorkloadSequence{0};
+
+/// Bytes of keys and values written by the workload threads.
+static std::atomic<size_t> kWorkloadBytes{0};
+
+static std::string kWorkloadPreviousPath;
+
+static inline std::string toWorkloadIndex(size_t i) {
+  auto index = std::to_string(i);
+  return std::string((index.size() < 10) ? 10 - index.size() : 0, '0') +
+         index;
+}
+
+static void startWorkload(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    // Each plugin uses its own path, the SQLite database is a single file.
+    auto name = kWorkloadDatabases[state.range_x()];
+    kWorkloadPreviousPath = FLAGS_database_path;
+    FLAGS_database_path = kTestWorkingDirectory + "benchmark-workload-" + name;
+    boost::filesystem::remove_all(FLAGS_database_path);
+    RegistryFactory::get().setActive("database", name);
+
+    kWorkloadSequence = 0;
+    kWorkloadBytes = 0;
+    kWorkloadFinished = 0;
+    kWorkloadReady = true;
+  }
+
+  while (!kWorkloadReady) {
+    std::this_thread::yield();
+  }
+}
+
+static size_t getWorkloadDiskSize(const std::string& path) {
+  boost::system::error_code ec;
+  if (boost::filesystem::is_regular_file(path, ec)) {
+    return static_cast<size_t>(boost::filesystem::file_size(path, ec));
+  }
+
+  size_t size = 0;
+  boost::filesystem::recursive_directory_iterator it(path, ec), end;
+  for (; !ec && it != end; it.increment(ec)) {
+    if (boost::filesystem::is_regular_file(it->path(), ec)) {
+      size += static_cast<size_t>(boost::filesystem::file_size(it->path(), ec));
+    }
+  }
+  return size;
+}
+
+static void finishWorkload(benchmark::State& state) {
+  kWorkloadFinished++;
+  if (state.thread_index != 0) {
+    return;
+  }
+
+  while (kWorkloadFinished < state.threads) {
+    std::this_thread::yield();
+  }
+  kWorkloadReady = false;
+
+  // Report the RocksDB write amplification if statistics are collected.
+  std::string label;
+  std::map<std::string, std::string> stats;
+  getDatabaseProperties("", stats);
+  if (stats.count("rocksdb.bytes.written") > 0) {
+    auto written = std::stod(stats["rocksdb.bytes.written"]);
+    auto flushed = std::stod(stats["rocksdb.flush.write.bytes"]);
+    auto compacted = std::stod(stats["rocksdb.compact.write.bytes"]);
+    if (written > 0) {
+      label += "write_amp=" + std::to_string((flushed + compacted) / written) +
+               " ";
+    }
+  }
+
+  // Closing the database flushes pending writes to disk before measuring.
+  resetDatabase();
+  auto logical = kWorkloadBytes.load();
+  auto disk = getWorkloadDiskSize(FLAGS_database_path);
+  label += "logical_bytes=" + std::to_string(logical) + " disk_bytes=" +
+           std::to_string(disk);
+  state.SetLabel(label);
+  state.SetBytesProcessed(static_cast<int64_t>(logical));
+
+  boost::filesystem::remove_all(FLAGS_database_path);
+  FLAGS_database_path = kWorkloadPreviousPath;
+  RegistryFactory::get().setActive("database", "rocksdb");
+}
+
+/**
+ * @brief Store events using the subscriber key layout.
+ *
+ * Each event writes its row data and a time-bin record in a batch, and each
+ * new bin updates the subscriber's bin index.
+ * Arguments are the database plugin index and the row data size.
+ */
+static void DATABASE_workload_events(benchmark::State& state) {
+  startWorkload(state);
+
+  const std::string ns = "benchmark.workload";
+  std::string data(state.range_y(), 'e');
+  size_t bytes = 0;
+  while (state.KeepRunning()) {
+    auto eid = ++kWorkloadSequence;
+    // Model 100 events per second.
+    auto time = 1400000000 + eid / 100;
+    auto time_value = std::to_string(time);
+    auto eid_index = toWorkloadIndex(eid);
+
+    DatabaseStringValueList batch = {
+        {"data." + ns + "." + toWorkloadIndex(time) + "." + eid_index, data},
+        {"records." + ns + ".60." + toWorkloadIndex(time / 60) + "." +
+             eid_index + ":" + time_value,
+         time_value},
+    };
+    setDatabaseBatch(kEvents, batch);
+    for (const auto& kv : batch) {
+      bytes += kv.first.size() + kv.second.size();
+    }
+
+    if (eid % 6000 == 0) {
+      std::string index;
+      getDatabaseValue(kEvents, "indexes." + ns + ".60", index);
+      index += "," + std::to_string(time / 60);
+      setDatabaseValue(kEvents, "indexes." + ns + ".60", index);
+      bytes += index.size();
+    }
+  }
+
+  kWorkloadBytes += bytes;
+  state.SetItemsProcessed(state.iterations());
+  finishWorkload(state);
+}
+
+BENCHMARK(DATABASE_workload_events)
+    ->ArgPair(0, 128)
+    ->ArgPair(0, 4096)
+    ->ArgPair(1, 128)
+    ->ArgPair(1, 4096)
+    ->ArgPair(2, 128)
+    ->ArgPair(2, 4096)
+    ->Threads(1)
+    ->Threads(4)
+    ->UseRealTime();
+
+/**
+ * @brief Buffer log lines and periodically forward them.
+ *
+ * Each iteration buffers a result line, every 256 lines are read and removed
+ * using the BufferedLogForwarder check pattern.
+ * Arguments are the database plugin index and the log line size.
+ */
+static void DATABASE_workload_logs(benchmark::State& state) {
+  startWorkload(state);
+
+  const std::string prefix = "buffered_log_" +
+                             std::to_string(state.thread_index) + "_r_";
+  std::string line(state.range_y(), 'l');
+  size_t bytes = 0;
+  size_t count = 0;
+  while (state.KeepRunning()) {
+    auto index = prefix + std::to_string(1400000000 + count / 100) + "_" +
+                 std::to_string(++kWorkloadSequence);
+    setDatabaseValue(kLogs, index, line);
+    bytes += index.size() + line.size();
+
+    if (++count % 256 == 0) {
+      std::vector<std::string> indexes;
+      scanDatabaseKeys(kLogs, indexes, prefix, 1024);
+      std::vector<std::string> lines;
+      getDatabaseValues(kLogs, indexes, lines);
+      for (const auto& key : indexes) {
+        deleteDatabaseValue(kLogs, key);
+      }
+    }
+  }
+
+  kWorkloadBytes += bytes;
+  state.SetItemsProcessed(state.iterations());
+  finishWorkload(state);
+}
+
+BENCHMARK(DATABASE_workload_logs)
+    ->ArgPair(0, 256)
+    ->ArgPair(0, 2048)
+    ->ArgPair(1, 256)
+    ->ArgPair(1, 2048)
+    ->ArgPair(2, 256)
+    ->ArgPair(2, 2048)
+    ->Threads(1)
+    ->Threads(4)
+    ->UseRealTime();
+
+/**
+ * @brief Store the previous results of a scheduled query.
+ *
+ * Each iteration adds a result set where a tenth of the rows change, and
+ * diffs it against the stored previous results.
+ * Arguments are the database plugin index and the number of result rows.
+ */
+static void DATABASE_workload_queries(benchmark::State& state) {
+  startWorkload(state);
+
+  auto query = getOsqueryScheduledQuery();
+  auto name = "workload_" + std::to_string(state.thread_index);
+  auto results = getExampleQueryData(10, state.range_y());
+  for (size_t i = 0; i < results.size(); i++) {
+    results[i]["id"] = std::to_string(i);
+  }
+
+  std::string content;
+  serializeQueryDataJSON(results, content);
+  size_t bytes = 0;
+  size_t step = 0;
+  while (state.KeepRunning()) {
+    // Change a different tenth of the rows each execution.
+    for (size_t i = step % 10; i < results.size(); i += 10) {
+      results[i]["id"] = std::to_string(i) + "." + std::to_string(step);
+    }
+    step++;
+
+    DiffResults diff_results;
+    auto dbq = Query(name, query);
+    dbq.addNewResults(results, diff_results);
+    bytes += content.size();
+  }
+
+  kWorkloadBytes += bytes;
+  state.SetItemsProcessed(state.iterations());
+  finishWorkload(state);
+}
+
+BENCHMARK(DATABASE_workload_queries)
+    ->ArgPair(0, 100)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 100)
+    ->ArgPair(1, 1000)
+    ->ArgPair(2, 100)
+    ->ArgPair(2, 1000)
+    ->Threads(1)
+    ->Threads(4)
+    ->UseRealTime();
 }
@@ -8,7 +8,9 @@
  *
  */
 
+#include <algorithm>
 #include <set>
+#include <unordered_map>
 
 #include <boost/lexical_cast.hpp>
 
@@ -16,6 +18,8 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/json.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
 
 namespace pt = boost::property_tree;
 
@@ -34,6 +38,12 @@ FLAG_ALIAS(std::string, db_path, database_path);
 
 FLAG(bool, disable_database, false, "Disable the persistent RocksDB storage");
 
+FLAG(string,
+     result_encoding,
+     "rows",
+     "Encoding of result logs and distributed results: rows, columnar, or "
+     "enroll to use the encoding chosen by the enroll endpoint");
+
 DECLARE_bool(decorations_top_level);
 
 #if defined(SKIP_ROCKSDB)
@@ -47,9 +57,28 @@ const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kLogs = "logs";
+const std::string kHashes = "hashes";
+const std::string kYARAScans = "yara";
+const std::string kQueryRows = "query_rows";
+
+const std::vector<std::string> kDomains = {kPersistentSettings,
+                                           kQueries,
+                                           kEvents,
+                                           kLogs,
+                                           kHashes,
+                                           kYARAScans,
+                                           kQueryRows};
+
+bool isEventsDomain(const std::string& domain) {
+  return domain.compare(0, kEvents.size(), kEvents) == 0 &&
+         (domain.size() == kEvents.size() || domain[kEvents.size()] == '.');
+}
+
+/// The persistent settings key of the result encoding chosen at enrollment.
+const std::string kEnrolledResultEncoding = "resultEncoding";
 
-const std::vector<std::string> kDomains = {
-    kPersistentSettings, kQueries, kEvents, kLogs};
+/// The encoding chosen at enrollment, 1 if columnar, or -1 if not yet read.
+static std::atomic<int> kEnrolledColumnar{-1};
 
 bool DatabasePlugin::kDBHandleOptionAllowOpen(false);
 bool DatabasePlugin::kDBHandleOptionRequireWrite(false);
@@ -63,6 +92,21 @@ std::atomic<bool> DatabasePlugin::kCheckingDB(false);
  */
 Mutex kDatabaseReset;
 
+/// A resolved active database plugin, see getDatabasePlugin.
+struct ActiveDatabasePlugin {
+  /// The registry's active generation when the plugin was resolved.
+  size_t generation{0};
+
+  std::shared_ptr<DatabasePlugin> plugin{nullptr};
+};
+
+static std::shared_ptr<const ActiveDatabasePlugin> kActiveDatabase{nullptr};
+
+static inline void clearDatabasePlugin() {
+  std::atomic_store(&kActiveDatabase,
+                    std::shared_ptr<const ActiveDatabasePlugin>(nullptr));
+}
+
 Status serializeRow(const Row& r, pt::ptree& tree) {
   try {
     for (auto& i : r) {
@@ -124,6 +168,156 @@ Status deserializeRowJSON(const std::string& json, Row& r) {
   return deserializeRow(tree, r);
 }
 
+/// The first byte of binary Row content, JSON content begins with '{'.
+const char kBinaryRowVersion = '\x01';
+
+/// The first byte of binary QueryData content, JSON content begins with '['.
+const char kBinaryQueryDataVersion = '\x02';
+
+static inline void putVarint(size_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static inline bool getVarint(const std::string& data,
+                             size_t& offset,
+                             size_t& value) {
+  value = 0;
+  for (size_t shift = 0; offset < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[offset++]);
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void putString(const std::string& value, std::string& data) {
+  putVarint(value.size(), data);
+  data.append(value);
+}
+
+static inline bool getString(const std::string& data,
+                             size_t& offset,
+                             std::string& value) {
+  size_t size = 0;
+  if (!getVarint(data, offset, size) || size > data.size() - offset) {
+    return false;
+  }
+  value.assign(data, offset, size);
+  offset += size;
+  return true;
+}
+
+Status serializeRowBinary(const Row& r, std::string& data) {
+  data.clear();
+  data.push_back(kBinaryRowVersion);
+  putVarint(r.size(), data);
+  for (const auto& column : r) {
+    putString(column.first, data);
+    putString(column.second, data);
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeRowBinary(const std::string& data, Row& r) {
+  if (data.empty() || data[0] != kBinaryRowVersion) {
+    // Content was stored before the binary encoding was used.
+    return deserializeRowJSON(data, r);
+  }
+
+  size_t offset = 1;
+  size_t columns = 0;
+  if (!getVarint(data, offset, columns)) {
+    return Status(1, "Invalid binary row");
+  }
+
+  std::string name;
+  for (size_t i = 0; i < columns; ++i) {
+    if (!getString(data, offset, name) || !getString(data, offset, r[name])) {
+      return Status(1, "Invalid binary row");
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status serializeQueryDataBinary(const QueryData& q, std::string& data) {
+  // Build a dictionary of column names, most result sets share columns.
+  std::vector<const std::string*> names;
+  std::map<std::string, size_t> dictionary;
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      if (dictionary.count(column.first) == 0) {
+        dictionary[column.first] = names.size();
+        names.push_back(&column.first);
+      }
+    }
+  }
+
+  data.clear();
+  data.push_back(kBinaryQueryDataVersion);
+  putVarint(names.size(), data);
+  for (const auto& name : names) {
+    putString(*name, data);
+  }
+
+  putVarint(q.size(), data);
+  for (const auto& r : q) {
+    putVarint(r.size(), data);
+    for (const auto& column : r) {
+      putVarint(dictionary.at(column.first), data);
+      putString(column.second, data);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd) {
+  if (data.empty() || data[0] != kBinaryQueryDataVersion) {
+    // Content was stored before the binary encoding was used.
+    return deserializeQueryDataJSON(data, qd);
+  }
+
+  size_t offset = 1;
+  size_t count = 0;
+  if (!getVarint(data, offset, count)) {
+    return Status(1, "Invalid binary query data");
+  }
+
+  std::vector<std::string> names(count);
+  for (auto& name : names) {
+    if (!getString(data, offset, name)) {
+      return Status(1, "Invalid binary query data");
+    }
+  }
+
+  if (!getVarint(data, offset, count)) {
+    return Status(1, "Invalid binary query data");
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    Row r;
+    size_t columns = 0;
+    if (!getVarint(data, offset, columns)) {
+      return Status(1, "Invalid binary query data");
+    }
+
+    for (size_t j = 0; j < columns; ++j) {
+      size_t index = 0;
+      if (!getVarint(data, offset, index) || index >= names.size() ||
+          !getString(data, offset, r[names[index]])) {
+        return Status(1, "Invalid binary query data");
+      }
+    }
+    qd.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
 Status serializeQueryData(const QueryData& q, pt::ptree& tree) {
   for (const auto& r : q) {
     pt::ptree serialized;
@@ -230,7 +424,285 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
   return Status(0, "OK");
 }
 
+/**
+ * @brief Check that a key is written as-is by the property tree.
+ *
+ * The tree treats a '.' as a path separator and an empty key as the node's
+ * own value. Results using these keys are serialized through a tree.
+ */
+static inline bool isPlainKey(const std::string& key) {
+  return !key.empty() && key.find('.') == std::string::npos;
+}
+
+static inline bool isPlainQueryData(const QueryData& q) {
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      if (!isPlainKey(column.first)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// Keys of a log item, a top-level decoration must not replace them.
+const std::set<std::string> kLogItemKeys = {
+    "action",
+    "calendarTime",
+    "columns",
+    "decorations",
+    "diffResults",
+    "encoding",
+    "fingerprint",
+    "hostIdentifier",
+    "name",
+    "snapshot",
+    "unixTime",
+};
+
+static inline bool isPlainDecorations(const QueryLogItem& item) {
+  for (const auto& name : item.decorations) {
+    if (!isPlainKey(name.first) ||
+        (FLAGS_decorations_top_level && kLogItemKeys.count(name.first) > 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline bool isPlainQueryLogItem(const QueryLogItem& item) {
+  return isPlainDecorations(item) && isPlainQueryData(item.results.added) &&
+         isPlainQueryData(item.results.removed) &&
+         isPlainQueryData(item.snapshot_results);
+}
+
+/*
+ * The JSON writers below produce the same output as writing the equivalent
+ * property tree, without building the tree. Like the tree, an empty row or
+ * list of rows is written as an empty string.
+ */
+
+static void writeRowJSON(const Row& r, std::string& json) {
+  if (r.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '{';
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    if (it != r.begin()) {
+      json += ',';
+    }
+    writeJSONString(it->first, json);
+    json += ':';
+    writeJSONString(it->second, json);
+  }
+  json += '}';
+}
+
+static void writeQueryDataJSON(const QueryData& q, std::string& json) {
+  if (q.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '[';
+  for (size_t i = 0; i < q.size(); i++) {
+    if (i > 0) {
+      json += ',';
+    }
+    writeRowJSON(q[i], json);
+  }
+  json += ']';
+}
+
+static void writeDiffResultsJSON(const DiffResults& d, std::string& json) {
+  // Like serializeDiffResults, "removed" is written first.
+  json += "{\"removed\":";
+  writeQueryDataJSON(d.removed, json);
+  json += ",\"added\":";
+  writeQueryDataJSON(d.added, json);
+  json += '}';
+}
+
+/// Write the members added by addLegacyFieldsAndDecorations.
+static void writeLegacyFieldsAndDecorations(const QueryLogItem& item,
+                                            std::string& json) {
+  json += "\"name\":";
+  writeJSONString(item.name, json);
+  json += ",\"hostIdentifier\":";
+  writeJSONString(item.identifier, json);
+  json += ",\"calendarTime\":";
+  writeJSONString(item.calendar_time, json);
+  json += ",\"unixTime\":\"" + std::to_string(item.time) + "\"";
+
+  if (item.decorations.size() > 0) {
+    if (!FLAGS_decorations_top_level) {
+      json += ",\"decorations\":{";
+    }
+    for (auto it = item.decorations.begin(); it != item.decorations.end();
+         ++it) {
+      if (FLAGS_decorations_top_level || it != item.decorations.begin()) {
+        json += ',';
+      }
+      writeJSONString(it->first, json);
+      json += ':';
+      writeJSONString(it->second, json);
+    }
+    if (!FLAGS_decorations_top_level) {
+      json += '}';
+    }
+  }
+}
+
+bool useColumnarResults() {
+  if (FLAGS_result_encoding == "columnar") {
+    return true;
+  } else if (FLAGS_result_encoding != "enroll") {
+    return false;
+  }
+
+  auto columnar = kEnrolledColumnar.load();
+  if (columnar < 0) {
+    // The choice is kept with the node key, read it once. Without a choice
+    // rows are used until an enrollment sets one.
+    std::string encoding;
+    getDatabaseValue(kPersistentSettings, kEnrolledResultEncoding, encoding);
+    columnar = (encoding == "columnar") ? 1 : 0;
+    kEnrolledColumnar = columnar;
+  }
+  return columnar == 1;
+}
+
+Status setEnrolledResultEncoding(const std::string& encoding) {
+  bool columnar = (encoding == "columnar");
+  kEnrolledColumnar = (columnar) ? 1 : 0;
+  return setDatabaseValue(kPersistentSettings,
+                          kEnrolledResultEncoding,
+                          (columnar) ? "columnar" : "rows");
+}
+
+void getQueryDataColumns(const QueryData& q, ColumnNames& columns) {
+  std::set<std::string> seen(columns.begin(), columns.end());
+  const Row* last = nullptr;
+  for (const auto& r : q) {
+    // Rows of a query usually have the columns of the row before them.
+    if (last != nullptr && r.size() == last->size() &&
+        std::equal(r.begin(),
+                   r.end(),
+                   last->begin(),
+                   [](const Row::value_type& a, const Row::value_type& b) {
+                     return a.first == b.first;
+                   })) {
+      continue;
+    }
+
+    for (const auto& column : r) {
+      if (seen.insert(column.first).second) {
+        columns.push_back(column.first);
+      }
+    }
+    last = &r;
+  }
+}
+
+void writeColumnarRowJSON(const Row& r,
+                          const ColumnNames& columns,
+                          std::string& json) {
+  if (columns.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '[';
+  auto value = r.begin();
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (i > 0) {
+      json += ',';
+    }
+    // The columns are usually in the row's order, the next value is checked
+    // before the row is searched.
+    if (value == r.end() || value->first != columns[i]) {
+      value = r.find(columns[i]);
+    }
+    if (value != r.end()) {
+      writeJSONString(value->second, json);
+      ++value;
+    } else {
+      json += "\"\"";
+    }
+  }
+  json += ']';
+}
+
+static void writeColumnsJSON(const ColumnNames& columns, std::string& json) {
+  if (columns.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '[';
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (i > 0) {
+      json += ',';
+    }
+    writeJSONString(columns[i], json);
+  }
+  json += ']';
+}
+
+static void writeColumnarQueryDataJSON(const QueryData& q,
+                                       const ColumnNames& columns,
+                                       std::string& json) {
+  if (q.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '[';
+  for (size_t i = 0; i < q.size(); i++) {
+    if (i > 0) {
+      json += ',';
+    }
+    writeColumnarRowJSON(q[i], columns, json);
+  }
+  json += ']';
+}
+
+/// Write a log item's results once with their column names, then as values.
+static void writeColumnarQueryLogItemJSON(const QueryLogItem& i,
+                                          std::string& json) {
+  ColumnNames columns;
+  if (i.results.added.size() > 0 || i.results.removed.size() > 0) {
+    getQueryDataColumns(i.results.removed, columns);
+    getQueryDataColumns(i.results.added, columns);
+    json += "\"diffResults\":{\"columns\":";
+    writeColumnsJSON(columns, json);
+    json += ",\"removed\":";
+    writeColumnarQueryDataJSON(i.results.removed, columns, json);
+    json += ",\"added\":";
+    writeColumnarQueryDataJSON(i.results.added, columns, json);
+    json += "},";
+  } else {
+    getQueryDataColumns(i.snapshot_results, columns);
+    json += "\"snapshot\":{\"columns\":";
+    writeColumnsJSON(columns, json);
+    json += ",\"rows\":";
+    writeColumnarQueryDataJSON(i.snapshot_results, columns, json);
+    json += "},\"action\":\"snapshot\",";
+  }
+  json += "\"encoding\":\"columnar\",";
+}
+
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
+  if (isPlainQueryData(d.added) && isPlainQueryData(d.removed)) {
+    std::string output;
+    writeDiffResultsJSON(d, output);
+    output += '\n';
+    json.swap(output);
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeDiffResults(d, tree);
   if (!status.ok()) {
@@ -248,26 +720,83 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
   return Status(0, "OK");
 }
 
+uint64_t rowFingerprint(const Row& r) {
+  // FNV-1a over each length-prefixed column name and value, in column order.
+  uint64_t hash = 14695981039346656037ULL;
+  auto update = [&hash](const std::string& data) {
+    auto size = data.size();
+    for (size_t i = 0; i < sizeof(size); i++) {
+      hash = (hash ^ ((size >> (i * 8)) & 0xff)) * 1099511628211ULL;
+    }
+    for (const auto& c : data) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+  };
+
+  for (const auto& column : r) {
+    update(column.first);
+    update(column.second);
+  }
+  return hash;
+}
+
+uint64_t resultsFingerprint(const QueryData& qd) {
+  std::vector<uint64_t> fingerprints;
+  fingerprints.reserve(qd.size());
+  for (const auto& r : qd) {
+    fingerprints.push_back(rowFingerprint(r));
+  }
+  std::sort(fingerprints.begin(), fingerprints.end());
+
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& fingerprint : fingerprints) {
+    for (size_t i = 0; i < sizeof(fingerprint); i++) {
+      hash = (hash ^ ((fingerprint >> (i * 8)) & 0xff)) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
 DiffResults diff(const QueryData& old, const QueryData& current) {
   DiffResults r;
-  QueryData overlap;
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
-    } else {
-      r.added.push_back(i);
+  // Index the old rows by fingerprint, rows are only compared on a match.
+  std::unordered_map<uint64_t, std::vector<size_t>> fingerprints;
+  fingerprints.reserve(old.size());
+  for (size_t i = 0; i < old.size(); i++) {
+    fingerprints[rowFingerprint(old[i])].push_back(i);
+  }
+
+  // A current row matching any old row is not added. Each old row is matched
+  // at most once, the unmatched old rows are removed.
+  std::vector<bool> matched(old.size(), false);
+  for (const auto& row : current) {
+    auto candidates = fingerprints.find(rowFingerprint(row));
+    bool exists = false;
+    if (candidates != fingerprints.end()) {
+      for (const auto& index : candidates->second) {
+        if (old[index] != row) {
+          // A fingerprint collision.
+          continue;
+        }
+        exists = true;
+        if (!matched[index]) {
+          matched[index] = true;
+          break;
+        }
+      }
+    }
+
+    if (!exists) {
+      r.added.push_back(row);
     }
   }
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
+  for (size_t i = 0; i < old.size(); i++) {
+    if (!matched[i]) {
+      r.removed.push_back(old[i]);
+    }
+  }
   return r;
 }
 
@@ -315,6 +844,9 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
       return status;
     }
     tree.add_child("diffResults", results_tree);
+  } else if (item.snapshot_unchanged) {
+    // The receiver already has these results from an earlier snapshot.
+    tree.put<std::string>("action", "snapshot_unchanged");
   } else {
     auto status = serializeQueryData(item.snapshot_results, results_tree);
     if (!status.ok()) {
@@ -324,11 +856,60 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
     tree.put<std::string>("action", "snapshot");
   }
 
+  if (!item.snapshot_fingerprint.empty()) {
+    tree.put<std::string>("fingerprint", item.snapshot_fingerprint);
+  }
+
   addLegacyFieldsAndDecorations(item, tree);
   return Status(0, "OK");
 }
 
 Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
+  bool unchanged = i.results.added.empty() && i.results.removed.empty() &&
+                   i.snapshot_unchanged;
+  if (!unchanged && isPlainDecorations(i) && useColumnarResults()) {
+    // Column names are written as values, any name may be used.
+    std::string output = "{";
+    writeColumnarQueryLogItemJSON(i, output);
+    if (!i.snapshot_fingerprint.empty()) {
+      output += "\"fingerprint\":";
+      writeJSONString(i.snapshot_fingerprint, output);
+      output += ',';
+    }
+
+    writeLegacyFieldsAndDecorations(i, output);
+    output += "}\n";
+    json.swap(output);
+    return Status(0, "OK");
+  }
+
+  if (isPlainQueryLogItem(i)) {
+    // Members are written in the order serializeQueryLogItem adds them.
+    std::string output = "{";
+    if (i.results.added.size() > 0 || i.results.removed.size() > 0) {
+      output += "\"diffResults\":";
+      writeDiffResultsJSON(i.results, output);
+      output += ',';
+    } else if (i.snapshot_unchanged) {
+      output += "\"action\":\"snapshot_unchanged\",";
+    } else {
+      output += "\"snapshot\":";
+      writeQueryDataJSON(i.snapshot_results, output);
+      output += ",\"action\":\"snapshot\",";
+    }
+
+    if (!i.snapshot_fingerprint.empty()) {
+      output += "\"fingerprint\":";
+      writeJSONString(i.snapshot_fingerprint, output);
+      output += ',';
+    }
+
+    writeLegacyFieldsAndDecorations(i, output);
+    output += "}\n";
+    json.swap(output);
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeQueryLogItem(i, tree);
   if (!status.ok()) {
@@ -346,8 +927,49 @@ Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
   return Status(0, "OK");
 }
 
+/// Read columnar rows, each row is a list of values in the order of columns.
+static Status deserializeColumnarQueryData(const pt::ptree& tree,
+                                           const std::string& name,
+                                           QueryData& qd) {
+  ColumnNames columns;
+  for (const auto& column : tree.get_child("columns", pt::ptree())) {
+    columns.push_back(column.second.data());
+  }
+
+  for (const auto& row : tree.get_child(name, pt::ptree())) {
+    if (row.second.size() != columns.size()) {
+      return Status(1, "Columnar row does not match the columns");
+    }
+
+    Row r;
+    auto column = columns.begin();
+    for (const auto& value : row.second) {
+      r[*column++] = value.second.data();
+    }
+    qd.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
 Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
-  if (tree.count("diffResults") > 0) {
+  if (tree.get<std::string>("encoding", "") == "columnar") {
+    Status status;
+    if (tree.count("diffResults") > 0) {
+      const auto& results = tree.get_child("diffResults");
+      auto& removed = item.results.removed;
+      status = deserializeColumnarQueryData(results, "removed", removed);
+      if (status.ok()) {
+        auto& added = item.results.added;
+        status = deserializeColumnarQueryData(results, "added", added);
+      }
+    } else if (tree.count("snapshot") > 0) {
+      status = deserializeColumnarQueryData(
+          tree.get_child("snapshot"), "rows", item.snapshot_results);
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  } else if (tree.count("diffResults") > 0) {
     auto status =
         deserializeDiffResults(tree.get_child("diffResults"), item.results);
     if (!status.ok()) {
@@ -361,6 +983,9 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
     }
   }
 
+  item.snapshot_fingerprint = tree.get<std::string>("fingerprint", "");
+  item.snapshot_unchanged =
+      (tree.get<std::string>("action", "") == "snapshot_unchanged");
   getLegacyFieldsAndDecorations(tree, item);
   return Status(0, "OK");
 }
@@ -416,6 +1041,26 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& i, pt::ptree& tree) {
 
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items) {
+  if (isPlainQueryLogItem(i)) {
+    // Each event shares the legacy fields and decorations.
+    std::string header = "{";
+    writeLegacyFieldsAndDecorations(i, header);
+    header += ",\"columns\":";
+
+    for (const auto& action : {std::make_pair("removed", &i.results.removed),
+                               std::make_pair("added", &i.results.added)}) {
+      for (const auto& row : *action.second) {
+        std::string event = header;
+        writeRowJSON(row, event);
+        event += ",\"action\":\"";
+        event += action.first;
+        event += "\"}\n";
+        items.push_back(std::move(event));
+      }
+    }
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeQueryLogItemAsEvents(i, tree);
   if (!status.ok()) {
@@ -443,6 +1088,12 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
 }
 
 bool DatabasePlugin::initPlugin() {
+  // Memtables and the block cache are released by a trim.
+  registerMemoryConsumer("database",
+                         2,
+                         getDatabaseMemoryUsage,
+                         ([](size_t) { trimDatabase(); }));
+
   // Initialize the database plugin using the flag.
   auto plugin = (FLAGS_disable_database) ? "ephemeral" : kInternalDatabase;
   return RegistryFactory::get().setActive("database", plugin).ok();
@@ -453,6 +1104,7 @@ void DatabasePlugin::shutdown() {
   for (auto& plugin : RegistryFactory::get().names("database")) {
     datbase_registry->remove(plugin);
   }
+  clearDatabasePlugin();
 }
 
 Status DatabasePlugin::reset() {
@@ -479,6 +1131,28 @@ bool DatabasePlugin::checkDB() {
   return result;
 }
 
+Status DatabasePlugin::getBatch(const std::string& domain,
+                                const std::vector<std::string>& keys,
+                                std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+  for (size_t i = 0; i < keys.size(); i++) {
+    // A missing key leaves its value empty.
+    this->get(domain, keys[i], values[i]);
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::putBatch(const std::string& domain,
+                                const DatabaseStringValueList& data) {
+  for (const auto& kv : data) {
+    auto status = this->put(domain, kv.first, kv.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status DatabasePlugin::call(const PluginRequest& request,
                             PluginResponse& response) {
   if (request.count("action") == 0) {
@@ -521,8 +1195,21 @@ Status DatabasePlugin::call(const PluginRequest& request,
       response.push_back({{"k", k}});
     }
     return status;
+  } else if (request.at("action") == "properties") {
+    std::map<std::string, std::string> props;
+    auto status = this->properties(domain, props);
+    for (const auto& prop : props) {
+      response.push_back({{"k", prop.first}, {"v", prop.second}});
+    }
+    return status;
+  } else if (request.at("action") == "create_domain") {
+    return this->createDomain(domain);
+  } else if (request.at("action") == "drop_domain") {
+    return this->dropDomain(domain);
   } else if (request.at("action") == "reset") {
     return this->reset();
+  } else if (request.at("action") == "trim") {
+    return this->trim();
   }
 
   return Status(1, "Unknown database plugin action");
@@ -530,12 +1217,25 @@ Status DatabasePlugin::call(const PluginRequest& request,
 
 static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
   auto& rf = RegistryFactory::get();
+  // Resolve the active plugin once for each change of active plugins.
+  auto generation = rf.activeGeneration();
+  auto active = std::atomic_load(&kActiveDatabase);
+  if (active != nullptr && active->generation == generation) {
+    return active->plugin;
+  }
+
   if (!rf.exists("database", rf.getActive("database"), true)) {
     return nullptr;
   }
 
-  auto plugin = rf.plugin("database", rf.getActive("database"));
-  return std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  auto resolved = std::make_shared<ActiveDatabasePlugin>();
+  resolved->generation = generation;
+  resolved->plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      rf.plugin("database", rf.getActive("database")));
+  // The generation is read before resolving, a racing change is seen later.
+  std::atomic_store(&kActiveDatabase,
+                    std::shared_ptr<const ActiveDatabasePlugin>(resolved));
+  return resolved->plugin;
 }
 
 Status getDatabaseValue(const std::string& domain,
@@ -561,11 +1261,44 @@ Status getDatabaseValue(const std::string& domain,
     }
     return status;
   } else {
+    static auto& latency = getMetricHistogram("database_get_microseconds");
+    MetricTimer timer(latency);
     auto plugin = getDatabasePlugin();
     return plugin->get(domain, key, value);
   }
 }
 
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values) {
+  if (domain.empty()) {
+    return Status(1, "Missing domain");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    values.assign(keys.size(), "");
+    for (size_t i = 0; i < keys.size(); i++) {
+      PluginRequest request = {
+          {"action", "get"}, {"domain", domain}, {"key", keys[i]}};
+      PluginResponse response;
+      Registry::call("database", request, response);
+      if (response.size() > 0 && response[0].count("v") > 0) {
+        values[i] = std::move(response[0]["v"]);
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    static auto& latency =
+        getMetricHistogram("database_get_batch_microseconds");
+    MetricTimer timer(latency);
+    auto plugin = getDatabasePlugin();
+    return plugin->getBatch(domain, keys, values);
+  }
+}
+
 Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value) {
@@ -581,11 +1314,43 @@ Status setDatabaseValue(const std::string& domain,
         {"action", "put"}, {"domain", domain}, {"key", key}, {"value", value}};
     return Registry::call("database", request);
   } else {
+    static auto& latency = getMetricHistogram("database_put_microseconds");
+    MetricTimer timer(latency);
     auto plugin = getDatabasePlugin();
     return plugin->put(domain, key, value);
   }
 }
 
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseStringValueList& data) {
+  if (domain.empty()) {
+    return Status(1, "Missing domain");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    for (const auto& kv : data) {
+      PluginRequest request = {{"action", "put"},
+                               {"domain", domain},
+                               {"key", kv.first},
+                               {"value", kv.second}};
+      auto status = Registry::call("database", request);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    static auto& latency =
+        getMetricHistogram("database_put_batch_microseconds");
+    MetricTimer timer(latency);
+    auto plugin = getDatabasePlugin();
+    return plugin->putBatch(domain, data);
+  }
+}
+
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   if (domain.empty()) {
     return Status(1, "Missing domain");
@@ -664,8 +1429,78 @@ Status scanDatabaseKeys(const std::string& domain,
   }
 }
 
+Status createDatabaseDomain(const std::string& domain) {
+  if (domain.empty()) {
+    return Status(1, "Missing domain");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "create_domain"}, {"domain", domain}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->createDomain(domain);
+  }
+}
+
+Status dropDatabaseDomain(const std::string& domain) {
+  if (domain.empty()) {
+    return Status(1, "Missing domain");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    PluginRequest request = {{"action", "drop_domain"}, {"domain", domain}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->dropDomain(domain);
+  }
+}
+
+Status getDatabaseProperties(const std::string& domain,
+                             std::map<std::string, std::string>& props) {
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "properties"}, {"domain", domain}};
+    PluginResponse response;
+    auto status = Registry::call("database", request, response);
+
+    for (const auto& item : response) {
+      if (item.count("k") > 0 && item.count("v") > 0) {
+        props[item.at("k")] = item.at("v");
+      }
+    }
+    return status;
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->properties(domain, props);
+  }
+}
+
+bool getPrefixUpperBound(const std::string& prefix, std::string& upper) {
+  // The smallest key greater than every key with the prefix: increment the
+  // last byte that is not 0xff and drop the bytes after it.
+  upper = prefix;
+  while (!upper.empty()) {
+    auto& last = reinterpret_cast<unsigned char&>(upper.back());
+    if (last != 0xff) {
+      last++;
+      return true;
+    }
+    upper.pop_back();
+  }
+  return false;
+}
+
 void resetDatabase() {
   WriteLock lock(kDatabaseReset);
+  clearDatabasePlugin();
 
   // Prevent RocksDB reentrancy by logger plugins during plugin setup.
   VLOG(1) << "Resetting the database plugin: "
@@ -678,6 +1513,31 @@ void resetDatabase() {
   }
 }
 
+void trimDatabase() {
+  Status status;
+  {
+    // A trim shares access with readers and writers.
+    ReadLock lock(kDatabaseReset);
+    LoggerForwardingDisabler disable_logging;
+    PluginRequest request = {{"action", "trim"}};
+    status = Registry::call("database", request);
+  }
+
+  if (!status.ok()) {
+    resetDatabase();
+  }
+}
+
+size_t getDatabaseMemoryUsage() {
+  ReadLock lock(kDatabaseReset);
+  if (RegistryFactory::get().external()) {
+    return 0;
+  }
+
+  auto plugin = getDatabasePlugin();
+  return (plugin == nullptr) ? 0 : plugin->getMemoryUsage();
+}
+
 void dumpDatabase() {
   for (const auto& domain : kDomains) {
     std::vector<std::string> keys;
@@ -8,15 +8,70 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+
 #include <osquery/database.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(uint64,
+     ephemeral_events_max_bytes,
+     0,
+     "Max bytes of events kept by the ephemeral database (0 = unlimited)");
+
+/// Number of independently-locked shards within each domain.
+const size_t kEphemeralShards = 16;
+
 class EphemeralDatabasePlugin : public DatabasePlugin {
-  using DBType = std::map<std::string, std::map<std::string, std::string>>;
+  struct Value {
+    std::string data;
+
+    /// Insertion sequence, used to match eviction entries to values.
+    size_t sequence{0};
+  };
+
+  /**
+   * @brief A lock-striped partition of a domain's keys.
+   *
+   * Keys are assigned to a shard by hash. Each shard keeps its keys ordered
+   * so prefix scans and range removes can merge the shards.
+   */
+  struct Shard {
+    mutable Mutex mutex;
+    std::map<std::string, Value> keys;
+  };
+
+  struct Domain {
+    std::array<Shard, kEphemeralShards> shards;
+
+    /// Size of every key and value in the domain.
+    std::atomic<size_t> bytes{0};
+
+    /// Number of keys in the domain.
+    std::atomic<size_t> count{0};
+
+    /// The last insertion sequence.
+    std::atomic<size_t> sequence{0};
+
+    /// Insertion order of keys, only tracked for a domain with a memory cap.
+    std::deque<std::pair<std::string, size_t>> order;
+    Mutex order_mutex;
+
+    Shard& getShard(const std::string& key) {
+      return shards[std::hash<std::string>()(key) % kEphemeralShards];
+    }
+  };
+
+  using DBType = std::map<std::string, std::unique_ptr<Domain>>;
 
  public:
   /// Data retrieval method.
@@ -42,56 +97,193 @@ class EphemeralDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// There is nothing to release, a reset would drop every key.
+  Status trim() override {
+    return Status(0, "OK");
+  }
+
+  /// Report the key count and size of a domain.
+  Status properties(const std::string& domain,
+                    std::map<std::string, std::string>& props) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override {
+    WriteLock lock(domains_mutex_);
     DBType().swap(db_);
+    for (const auto& domain : kDomains) {
+      db_[domain] = std::unique_ptr<Domain>(new Domain());
+    }
     return Status(0);
   }
 
+ private:
+  /// Lookup a domain, the caller must hold domains_mutex_.
+  Domain* getDomain(const std::string& domain) const;
+
+  /// Remove a shard's key, the caller must hold the shard's lock.
+  static void erase(Domain& domain,
+                    Shard& shard,
+                    std::map<std::string, Value>::iterator it);
+
+  /// Remove the oldest keys until the domain is within its memory cap.
+  static void evict(Domain& domain, size_t max_bytes);
+
  private:
   DBType db_;
+
+  /// Domains are added on first use and dropped by setUp.
+  mutable Mutex domains_mutex_;
 };
 
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(EphemeralDatabasePlugin, "database", "ephemeral");
 
+EphemeralDatabasePlugin::Domain* EphemeralDatabasePlugin::getDomain(
+    const std::string& domain) const {
+  auto it = db_.find(domain);
+  return (it == db_.end()) ? nullptr : it->second.get();
+}
+
+void EphemeralDatabasePlugin::erase(Domain& domain,
+                                    Shard& shard,
+                                    std::map<std::string, Value>::iterator it) {
+  domain.bytes -= it->first.size() + it->second.data.size();
+  domain.count--;
+  shard.keys.erase(it);
+}
+
+void EphemeralDatabasePlugin::evict(Domain& domain, size_t max_bytes) {
+  WriteLock lock(domain.order_mutex);
+  while (domain.bytes > max_bytes && !domain.order.empty()) {
+    auto oldest = std::move(domain.order.front());
+    domain.order.pop_front();
+
+    auto& shard = domain.getShard(oldest.first);
+    WriteLock shard_lock(shard.mutex);
+    auto it = shard.keys.find(oldest.first);
+    // Skip keys that were removed or written again since.
+    if (it != shard.keys.end() && it->second.sequence == oldest.second) {
+      erase(domain, shard, it);
+    }
+  }
+
+  // Removed keys leave entries behind, drop them if they accumulate.
+  if (domain.order.size() > 2 * domain.count + 1024) {
+    std::deque<std::pair<std::string, size_t>> order;
+    for (auto& entry : domain.order) {
+      auto& shard = domain.getShard(entry.first);
+      ReadLock shard_lock(shard.mutex);
+      auto it = shard.keys.find(entry.first);
+      if (it != shard.keys.end() && it->second.sequence == entry.second) {
+        order.push_back(std::move(entry));
+      }
+    }
+    domain.order.swap(order);
+  }
+}
+
 Status EphemeralDatabasePlugin::get(const std::string& domain,
                                     const std::string& key,
                                     std::string& value) const {
-  if (db_.count(domain) > 0 && db_.at(domain).count(key) > 0) {
-    value = db_.at(domain).at(key);
-    return Status(0);
-  } else {
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
     return Status(1);
   }
+
+  auto& shard = d->getShard(key);
+  ReadLock shard_lock(shard.mutex);
+  auto it = shard.keys.find(key);
+  if (it == shard.keys.end()) {
+    return Status(1);
+  }
+  value = it->second.data;
+  return Status(0);
 }
 
 Status EphemeralDatabasePlugin::put(const std::string& domain,
                                     const std::string& key,
                                     const std::string& value) {
-  db_[domain][key] = value;
+  {
+    ReadLock lock(domains_mutex_);
+    if (getDomain(domain) == nullptr) {
+      lock.unlock();
+      WriteLock create_lock(domains_mutex_);
+      if (getDomain(domain) == nullptr) {
+        db_[domain] = std::unique_ptr<Domain>(new Domain());
+      }
+    }
+  }
+
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(1, "Database was reset");
+  }
+
+  auto max_bytes = (domain == kEvents) ? FLAGS_ephemeral_events_max_bytes : 0;
+  auto sequence = ++d->sequence;
+  {
+    auto& shard = d->getShard(key);
+    WriteLock shard_lock(shard.mutex);
+    auto it = shard.keys.find(key);
+    if (it == shard.keys.end()) {
+      shard.keys.emplace(key, Value{value, sequence});
+      d->bytes += key.size() + value.size();
+      d->count++;
+    } else {
+      d->bytes += value.size();
+      d->bytes -= it->second.data.size();
+      it->second.data = value;
+      it->second.sequence = sequence;
+    }
+  }
+
+  if (max_bytes > 0) {
+    {
+      WriteLock order_lock(d->order_mutex);
+      d->order.emplace_back(key, sequence);
+    }
+    if (d->bytes > max_bytes) {
+      evict(*d, max_bytes);
+    }
+  }
   return Status(0);
 }
 
 Status EphemeralDatabasePlugin::remove(const std::string& domain,
                                        const std::string& k) {
-  db_[domain].erase(k);
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(0);
+  }
+
+  auto& shard = d->getShard(k);
+  WriteLock shard_lock(shard.mutex);
+  auto it = shard.keys.find(k);
+  if (it != shard.keys.end()) {
+    erase(*d, shard, it);
+  }
   return Status(0);
 }
 
 Status EphemeralDatabasePlugin::removeRange(const std::string& domain,
                                             const std::string& low,
                                             const std::string& high) {
-  std::vector<std::string> keys;
-  for (const auto& it : db_[domain]) {
-    if (it.first >= low && it.first <= high) {
-      keys.push_back(it.first);
-    }
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(0);
   }
 
-  for (const auto& key : keys) {
-    db_[domain].erase(key);
+  for (auto& shard : d->shards) {
+    WriteLock shard_lock(shard.mutex);
+    auto it = shard.keys.lower_bound(low);
+    while (it != shard.keys.end() && it->first <= high) {
+      erase(*d, shard, it++);
+    }
   }
   return Status(0);
 }
@@ -100,21 +292,55 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
                                      std::vector<std::string>& results,
                                      const std::string& prefix,
                                      size_t max) const {
-  if (db_.count(domain) == 0) {
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
     return Status(0);
   }
 
-  for (const auto& key : db_.at(domain)) {
-    if (!prefix.empty() &&
-        !(std::mismatch(prefix.begin(), prefix.end(), key.first.begin())
-              .first == prefix.end())) {
-      continue;
-    }
-    results.push_back(key.first);
-    if (max > 0 && results.size() >= max) {
-      break;
+  // Each shard contributes at most max of its ordered matches, the smallest
+  // max of the merged matches are returned.
+  std::vector<std::string> keys;
+  for (const auto& shard : d->shards) {
+    ReadLock shard_lock(shard.mutex);
+    size_t count = 0;
+    for (auto it = shard.keys.lower_bound(prefix); it != shard.keys.end();
+         ++it) {
+      if (it->first.compare(0, prefix.size(), prefix) != 0) {
+        break;
+      }
+      keys.push_back(it->first);
+      if (max > 0 && ++count >= max) {
+        break;
+      }
     }
   }
+
+  std::sort(keys.begin(), keys.end());
+  if (max > 0 && keys.size() > max) {
+    keys.resize(max);
+  }
+  results.insert(results.end(),
+                 std::make_move_iterator(keys.begin()),
+                 std::make_move_iterator(keys.end()));
   return Status(0);
 }
+
+Status EphemeralDatabasePlugin::properties(
+    const std::string& domain,
+    std::map<std::string, std::string>& props) const {
+  if (domain.empty()) {
+    return Status(0, "OK");
+  }
+
+  ReadLock lock(domains_mutex_);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(1, "Unknown domain: " + domain);
+  }
+
+  props["ephemeral.keys"] = std::to_string(d->count.load());
+  props["ephemeral.bytes"] = std::to_string(d->bytes.load());
+  return Status(0, "OK");
+}
 }
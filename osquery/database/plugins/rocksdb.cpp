@@ -8,26 +8,79 @@
  *
  */
 
+#include <algorithm>
+#include <map>
 #include <mutex>
 
 #include <sys/stat.h>
 
+#include <boost/algorithm/string/trim.hpp>
+
 #include <snappy.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/options.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(string,
+     rocksdb_profiles,
+     "",
+     "Comma-separated domain:profile list (small, write_heavy, read_mostly)");
+
+FLAG(uint64,
+     rocksdb_block_cache_size,
+     8 * 1024 * 1024,
+     "Bytes of the block cache shared by the non-small RocksDB profiles");
+
+FLAG(bool,
+     rocksdb_statistics,
+     false,
+     "Collect RocksDB statistics for the osquery_database table");
+
+/// The set of tuned column family options a database domain may use.
+enum class RocksDBProfile {
+  /// The original, memory-conscious, options used for every domain.
+  SMALL,
+
+  /// Larger write buffers and fewer compactions for buffered events.
+  WRITE_HEAVY,
+
+  /// Compressed blocks and bloom filters for stored query results.
+  READ_MOSTLY,
+};
+
+/**
+ * @brief Length of the key prefix used for prefix blooms.
+ *
+ * Most scans use a prefix such as "records." or "distributed.", scans with a
+ * shorter prefix fall back to a total-order seek.
+ */
+const size_t kRocksDBPrefixLength = 8;
+
+const std::map<std::string, RocksDBProfile> kRocksDBProfiles = {
+    {"small", RocksDBProfile::SMALL},
+    {"write_heavy", RocksDBProfile::WRITE_HEAVY},
+    {"read_mostly", RocksDBProfile::READ_MOSTLY},
+};
+
 class GlogRocksDBLogger : public rocksdb::Logger {
  public:
   // We intend to override a virtual method that is overloaded.
@@ -42,11 +95,20 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// Data retrieval method for a list of keys, using MultiGet.
+  Status getBatch(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Data storage method for a list of values, using a WriteBatch.
+  Status putBatch(const std::string& domain,
+                  const DatabaseStringValueList& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
@@ -61,6 +123,22 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Flush memtables and drop unused cached blocks.
+  Status trim() override;
+
+  /// Bytes of every memtable and the shared block cache.
+  size_t getMemoryUsage() const override;
+
+  /// Column family properties, or database statistics for an empty domain.
+  Status properties(const std::string& domain,
+                    std::map<std::string, std::string>& props) const override;
+
+  /// Create a column family for a domain.
+  Status createDomain(const std::string& domain) override;
+
+  /// Drop a created domain's column family.
+  Status dropDomain(const std::string& domain) override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -101,6 +179,16 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
    */
   void repairDB();
 
+  /// Lookup the profile requested for a domain by --rocksdb_profiles.
+  static RocksDBProfile getProfile(const std::string& domain);
+
+  /// Apply a profile to a copy of the shared connection options.
+  rocksdb::ColumnFamilyOptions getColumnFamilyOptions(
+      RocksDBProfile profile);
+
+  /// The options of a created domain, event domains use the events profile.
+  rocksdb::ColumnFamilyOptions getCreatedOptions(const std::string& domain);
+
  private:
   bool initialized_{false};
 
@@ -116,11 +204,31 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// A vector of pointers to column family handles
   std::vector<rocksdb::ColumnFamilyHandle*> handles_;
 
+  /// Handles of the column families of created domains.
+  std::map<std::string, rocksdb::ColumnFamilyHandle*> created_handles_;
+
+  /**
+   * @brief Handles of dropped domains, deleted on close.
+   *
+   * A concurrent caller may still hold a dropped domain's handle, RocksDB
+   * allows using a dropped column family until its handle is deleted.
+   */
+  std::vector<rocksdb::ColumnFamilyHandle*> dropped_handles_;
+
+  /// Mutex protecting the created and dropped handles.
+  mutable Mutex created_mutex_;
+
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The profile applied to each of the kDomains column families.
+  std::vector<RocksDBProfile> profiles_;
+
+  /// Block cache shared by every non-small profile.
+  std::shared_ptr<rocksdb::Cache> block_cache_{nullptr};
+
   /// Deconstruction mutex.
-  Mutex close_mutex_;
+  mutable Mutex close_mutex_;
 };
 
 /// Backing-storage provider for osquery internal/core.
@@ -185,12 +293,25 @@ Status RocksDBDatabasePlugin::setUp() {
     }
     options_.info_log = logger_;
 
+    if (FLAGS_rocksdb_statistics) {
+      options_.statistics = rocksdb::CreateDBStatistics();
+    }
+
+    // The handle for kDomains[i] is handles_[i], which the descriptor at the
+    // same index opens. The last descriptor is only used as the default.
+    for (size_t i = 0; i < kDomains.size(); i++) {
+      profiles_.push_back(getProfile(kDomains[i]));
+    }
+
     column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
-        rocksdb::kDefaultColumnFamilyName, options_));
+        rocksdb::kDefaultColumnFamilyName,
+        getColumnFamilyOptions(profiles_[0])));
 
-    for (const auto& cf_name : kDomains) {
-      column_families_.push_back(
-          rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+    for (size_t i = 0; i < kDomains.size(); i++) {
+      auto profile = (i + 1 < profiles_.size()) ? profiles_[i + 1]
+                                                : RocksDBProfile::SMALL;
+      column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
+          kDomains[i], getColumnFamilyOptions(profile)));
     }
   }
 
@@ -209,14 +330,26 @@ Status RocksDBDatabasePlugin::setUp() {
   // Tests may trash calls to setUp, make sure subsequent calls do not leak.
   close();
 
+  // Every column family must be opened, including those of created domains.
+  auto descriptors = column_families_;
+  std::vector<std::string> names;
+  rocksdb::DB::ListColumnFamilies(options_, path_, &names);
+  for (const auto& name : names) {
+    if (name != rocksdb::kDefaultColumnFamilyName &&
+        std::find(kDomains.begin(), kDomains.end(), name) == kDomains.end()) {
+      descriptors.push_back(
+          rocksdb::ColumnFamilyDescriptor(name, getCreatedOptions(name)));
+    }
+  }
+
   // Attempt to create a RocksDB instance and handles.
-  auto s =
-      rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
+  auto s = rocksdb::DB::Open(options_, path_, descriptors, &handles_, &db_);
 
   if (s.IsCorruption()) {
-    // The database is corrupt - try to repair it
+    // The database is corrupt - try to repair it. Every listed column family
+    // is opened again, the created domains are recreated empty.
     repairDB();
-    s = rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
+    s = rocksdb::DB::Open(options_, path_, descriptors, &handles_, &db_);
   }
 
   if (!s.ok() || db_ == nullptr) {
@@ -236,13 +369,23 @@ Status RocksDBDatabasePlugin::setUp() {
     // writable or (2) it is already opened by another process.
     // Try to open the database in a ReadOnly mode.
     rocksdb::DB::OpenForReadOnly(
-        options_, path_, column_families_, &handles_, &db_);
+        options_, path_, descriptors, &handles_, &db_);
 #endif
     // Also disable event publishers.
     Flag::updateValue("disable_events", "true");
     read_only_ = true;
   }
 
+  {
+    WriteLock lock(created_mutex_);
+    for (size_t i = column_families_.size(); i < handles_.size(); i++) {
+      created_handles_[descriptors[i].name] = handles_[i];
+    }
+    if (handles_.size() > column_families_.size()) {
+      handles_.resize(column_families_.size());
+    }
+  }
+
   // RocksDB may not create/append a directory with acceptable permissions.
   if (!read_only_ && platformChmod(path_, S_IRWXU) == false) {
     return Status(1, "Cannot set permissions on RocksDB path: " + path_);
@@ -250,6 +393,82 @@ Status RocksDBDatabasePlugin::setUp() {
   return Status(0);
 }
 
+RocksDBProfile RocksDBDatabasePlugin::getProfile(const std::string& domain) {
+  for (auto& item : osquery::split(FLAGS_rocksdb_profiles, ",")) {
+    auto delim = item.find(':');
+    if (delim == std::string::npos) {
+      continue;
+    }
+
+    auto name = boost::algorithm::trim_copy(item.substr(0, delim));
+    if (name != domain) {
+      continue;
+    }
+
+    auto profile = boost::algorithm::trim_copy(item.substr(delim + 1));
+    if (kRocksDBProfiles.count(profile) > 0) {
+      return kRocksDBProfiles.at(profile);
+    }
+    LOG(WARNING) << "Unknown RocksDB profile " << profile << " for " << domain;
+  }
+  return RocksDBProfile::SMALL;
+}
+
+rocksdb::ColumnFamilyOptions RocksDBDatabasePlugin::getColumnFamilyOptions(
+    RocksDBProfile profile) {
+  rocksdb::ColumnFamilyOptions options(options_);
+  // Keep a prefix bloom for each memtable, scans use it to skip memtables.
+  options.prefix_extractor.reset(
+      rocksdb::NewCappedPrefixTransform(kRocksDBPrefixLength));
+  options.memtable_prefix_bloom_size_ratio = 0.1;
+  if (profile == RocksDBProfile::SMALL) {
+    return options;
+  }
+
+  if (block_cache_ == nullptr) {
+    block_cache_ = rocksdb::NewLRUCache(FLAGS_rocksdb_block_cache_size);
+  }
+
+  rocksdb::BlockBasedTableOptions table_options;
+  table_options.block_cache = block_cache_;
+  // Filters include key prefixes as well as whole keys.
+  table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+
+  if (profile == RocksDBProfile::WRITE_HEAVY) {
+    // Events are written in bursts and expired in bulk, trade memory for
+    // fewer flushes and compactions.
+    options.write_buffer_size = 4 * 1024 * 1024;
+    options.min_write_buffer_number_to_merge = 2;
+    options.level0_file_num_compaction_trigger = 8;
+#if !defined(ROCKSDB_LITE)
+    // RocksDB LITE only implements level-style compaction.
+    options.compaction_style = rocksdb::kCompactionStyleUniversal;
+#endif
+  } else if (profile == RocksDBProfile::READ_MOSTLY) {
+    // Query results are read and rewritten once per interval.
+#ifdef WIN32
+    options.compression = rocksdb::kSnappyCompression;
+#else
+    options.compression = rocksdb::kLZ4Compression;
+#endif
+    table_options.block_size = 16 * 1024;
+    table_options.cache_index_and_filter_blocks = true;
+  }
+
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+
+rocksdb::ColumnFamilyOptions RocksDBDatabasePlugin::getCreatedOptions(
+    const std::string& domain) {
+  auto options = getColumnFamilyOptions(
+      getProfile(isEventsDomain(domain) ? kEvents : domain));
+  // Each created domain has its own, smaller, set of write buffers.
+  options.max_write_buffer_number = 2;
+  return options;
+}
+
 void RocksDBDatabasePlugin::close() {
   WriteLock lock(close_mutex_);
   if (db_ != nullptr) {
@@ -260,6 +479,18 @@ void RocksDBDatabasePlugin::close() {
   }
   handles_.clear();
 
+  {
+    WriteLock created_lock(created_mutex_);
+    for (auto& created : created_handles_) {
+      delete created.second;
+    }
+    created_handles_.clear();
+    for (auto handle : dropped_handles_) {
+      delete handle;
+    }
+    dropped_handles_.clear();
+  }
+
   if (db_ != nullptr) {
     delete db_;
     db_ = nullptr;
@@ -296,6 +527,12 @@ rocksdb::ColumnFamilyHandle* RocksDBDatabasePlugin::getHandleForColumnFamily(
   } catch (const std::exception& /* e */) {
     // pass through and return nullptr
   }
+
+  ReadLock lock(created_mutex_);
+  auto created = created_handles_.find(cf);
+  if (created != created_handles_.end()) {
+    return created->second;
+  }
   return nullptr;
 }
 
@@ -313,6 +550,31 @@ Status RocksDBDatabasePlugin::get(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::getBatch(const std::string& domain,
+                                       const std::vector<std::string>& keys,
+                                       std::vector<std::string>& values) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  std::vector<rocksdb::ColumnFamilyHandle*> handles(keys.size(), cfh);
+  auto statuses =
+      getDB()->MultiGet(rocksdb::ReadOptions(), handles, slices, &values);
+  for (size_t i = 0; i < statuses.size(); i++) {
+    if (statuses[i].IsNotFound()) {
+      values[i].clear();
+    } else if (!statuses[i].ok()) {
+      return Status(statuses[i].code(), statuses[i].ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status RocksDBDatabasePlugin::put(const std::string& domain,
                                   const std::string& key,
                                   const std::string& value) {
@@ -327,7 +589,7 @@ Status RocksDBDatabasePlugin::put(const std::string& domain,
 
   auto options = rocksdb::WriteOptions();
   // Events should be fast, and do not need to force syncs.
-  if (kEvents != domain) {
+  if (!isEventsDomain(domain)) {
     options.sync = true;
   } else {
     options.disableWAL = true;
@@ -345,6 +607,40 @@ Status RocksDBDatabasePlugin::put(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::putBatch(const std::string& domain,
+                                       const DatabaseStringValueList& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& kv : data) {
+    batch.Put(cfh, kv.first, kv.second);
+  }
+
+  auto options = rocksdb::WriteOptions();
+  // See RocksDBDatabasePlugin::put for the event-specific write options.
+  if (!isEventsDomain(domain)) {
+    options.sync = true;
+  } else {
+    options.disableWAL = true;
+  }
+  auto s = getDB()->Write(options, &batch);
+  if (s.code() != 0 && s.IsIOError()) {
+    std::string error_string = s.ToString();
+    size_t error_pos = error_string.find_last_of(":");
+    if (error_pos != std::string::npos) {
+      return Status(s.code(), "IOError: " + error_string.substr(error_pos + 2));
+    }
+  }
+  return Status(s.code(), s.ToString());
+}
+
 Status RocksDBDatabasePlugin::remove(const std::string& domain,
                                      const std::string& key) {
   if (read_only_) {
@@ -359,7 +655,7 @@ Status RocksDBDatabasePlugin::remove(const std::string& domain,
 
   // We could sync here, but large deletes will cause multi-syncs.
   // For example: event record expirations found in an expired index.
-  if (kEvents != domain) {
+  if (!isEventsDomain(domain)) {
     options.sync = true;
   }
   auto s = getDB()->Delete(options, cfh, key);
@@ -381,7 +677,7 @@ Status RocksDBDatabasePlugin::removeRange(const std::string& domain,
 
   // We could sync here, but large deletes will cause multi-syncs.
   // For example: event record expirations found in an expired index.
-  if (kEvents != domain) {
+  if (!isEventsDomain(domain)) {
     options.sync = true;
   }
   auto s = getDB()->DeleteRange(options, cfh, low, high);
@@ -406,22 +702,206 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
-  auto it = getDB()->NewIterator(options, cfh);
+
+  // Short (or empty) prefixes may span several extracted prefixes.
+  if (prefix.size() >= kRocksDBPrefixLength) {
+    options.prefix_same_as_start = true;
+  } else {
+    options.total_order_seek = true;
+  }
+
+  // Bound the iterator to the prefix so it does not read the block after it.
+  std::string upper;
+  rocksdb::Slice upper_slice;
+  if (getPrefixUpperBound(prefix, upper)) {
+    upper_slice = upper;
+    options.iterate_upper_bound = &upper_slice;
+  }
+
+  std::unique_ptr<rocksdb::Iterator> it(getDB()->NewIterator(options, cfh));
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
 
+  if (max > 0) {
+    results.reserve(results.size() + max);
+  }
+
+  // Keys are ordered, seek to the first key matching the prefix and stop at
+  // the first key that does not match.
   size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
-    auto key = it->key().ToString();
-    if (key.find(prefix) == 0) {
-      results.push_back(std::move(key));
-      if (max > 0 && ++count >= max) {
-        break;
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    auto key = it->key();
+    if (!key.starts_with(prefix)) {
+      break;
+    }
+    results.emplace_back(key.data(), key.size());
+    if (max > 0 && ++count >= max) {
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::trim() {
+  ReadLock lock(close_mutex_);
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (!read_only_) {
+    // Writers switch to a new memtable, the flush does not block them.
+    rocksdb::FlushOptions options;
+    options.wait = false;
+    for (auto handle : handles_) {
+      getDB()->Flush(options, handle);
+    }
+
+    ReadLock created_lock(created_mutex_);
+    for (const auto& created : created_handles_) {
+      getDB()->Flush(options, created.second);
+    }
+  }
+
+  if (block_cache_ != nullptr) {
+    block_cache_->EraseUnRefEntries();
+  }
+  return Status(0, "OK");
+}
+
+size_t RocksDBDatabasePlugin::getMemoryUsage() const {
+  ReadLock lock(close_mutex_);
+  if (getDB() == nullptr) {
+    return 0;
+  }
+
+  std::vector<rocksdb::ColumnFamilyHandle*> handles = handles_;
+  {
+    ReadLock created_lock(created_mutex_);
+    for (const auto& created : created_handles_) {
+      handles.push_back(created.second);
+    }
+  }
+
+  size_t bytes = 0;
+  for (auto handle : handles) {
+    uint64_t size = 0;
+    if (getDB()->GetIntProperty(
+            handle, "rocksdb.cur-size-all-mem-tables", &size)) {
+      bytes += static_cast<size_t>(size);
+    }
+  }
+
+  if (block_cache_ != nullptr) {
+    bytes += block_cache_->GetUsage();
+  }
+  return bytes;
+}
+
+Status RocksDBDatabasePlugin::properties(
+    const std::string& domain,
+    std::map<std::string, std::string>& props) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (domain.empty()) {
+    // Statistics are collected for the entire database.
+    if (options_.statistics == nullptr) {
+      return Status(0, "Statistics disabled");
+    }
+
+    for (const auto& ticker : rocksdb::TickersNameMap) {
+      props[ticker.second] =
+          std::to_string(options_.statistics->getTickerCount(ticker.first));
+    }
+    return Status(0, "OK");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  for (size_t i = 0; i < kDomains.size(); i++) {
+    if (kDomains[i] == domain && i < profiles_.size()) {
+      for (const auto& profile : kRocksDBProfiles) {
+        if (profile.second == profiles_[i]) {
+          props["osquery.profile"] = profile.first;
+        }
       }
     }
   }
-  delete it;
+
+  static const std::vector<std::string> kProperties = {
+      "rocksdb.estimate-num-keys",
+      "rocksdb.estimate-live-data-size",
+      "rocksdb.total-sst-files-size",
+      "rocksdb.cur-size-all-mem-tables",
+      "rocksdb.num-entries-active-mem-table",
+      "rocksdb.num-running-compactions",
+      "rocksdb.num-running-flushes",
+      "rocksdb.block-cache-usage",
+  };
+
+  for (const auto& property : kProperties) {
+    std::string value;
+    // Properties unknown to this RocksDB version are not reported.
+    if (getDB()->GetProperty(cfh, property, &value)) {
+      props[property] = value;
+    }
+  }
   return Status(0, "OK");
 }
+
+Status RocksDBDatabasePlugin::createDomain(const std::string& domain) {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (getHandleForColumnFamily(domain) != nullptr) {
+    return Status(0, "OK");
+  } else if (read_only_) {
+    return Status(1, "Database in readonly mode");
+  }
+
+  rocksdb::ColumnFamilyHandle* handle = nullptr;
+  auto s =
+      getDB()->CreateColumnFamily(getCreatedOptions(domain), domain, &handle);
+  if (!s.ok() || handle == nullptr) {
+    return Status(1, "Cannot create column family: " + s.ToString());
+  }
+
+  WriteLock lock(created_mutex_);
+  created_handles_[domain] = handle;
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::dropDomain(const std::string& domain) {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (std::find(kDomains.begin(), kDomains.end(), domain) != kDomains.end()) {
+    return Status(1, "Cannot drop domain: " + domain);
+  } else if (read_only_) {
+    return Status(1, "Database in readonly mode");
+  }
+
+  rocksdb::ColumnFamilyHandle* handle = nullptr;
+  {
+    WriteLock lock(created_mutex_);
+    auto created = created_handles_.find(domain);
+    if (created == created_handles_.end()) {
+      return Status(0, "OK");
+    }
+    handle = created->second;
+    created_handles_.erase(created);
+    dropped_handles_.push_back(handle);
+  }
+
+  // Every key in the column family is dropped at once.
+  auto s = getDB()->DropColumnFamily(handle);
+  return Status(s.code(), s.ToString());
+}
 }
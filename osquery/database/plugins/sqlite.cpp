@@ -9,13 +9,16 @@
  */
 
 #include <mutex>
+#include <unordered_map>
 
 #include <sqlite3.h>
 
 #include <sys/stat.h>
 
 #include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/filesystem/fileops.h"
@@ -24,12 +27,17 @@ namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(uint64,
+     database_vacuum_interval,
+     3600,
+     "Seconds between SQLite database fragmentation checks (0 = never)");
+
 const std::map<std::string, std::string> kDBSettings = {
-    {"synchronous", "OFF"},
+    {"synchronous", "NORMAL"},
     {"count_changes", "OFF"},
     {"default_temp_store", "2"},
     {"auto_vacuum", "FULL"},
-    {"journal_mode", "OFF"},
+    {"journal_mode", "WAL"},
     {"cache_size", "1000"},
     {"page_count", "1000"},
 };
@@ -41,11 +49,20 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// Data retrieval method for a list of keys, using a single statement.
+  Status getBatch(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Data storage method for a list of values, using a transaction.
+  Status putBatch(const std::string& domain,
+                  const DatabaseStringValueList& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
@@ -74,13 +91,33 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
     close();
   }
 
+  /// Check the database fragmentation and vacuum if needed.
+  void vacuum();
+
+  /// Release the connection's page cache and unused memory.
+  Status trim() override;
+
  private:
   void close();
 
+  /**
+   * @brief Get a cached prepared statement for a query.
+   *
+   * The caller must hold statement_mutex_ and reset the statement once
+   * finished, see resetStatement.
+   */
+  sqlite3_stmt* getStatement(const std::string& q) const;
+
  private:
   /// The long-lived sqlite3 database.
   sqlite3* db_{nullptr};
 
+  /// Prepared statements, keyed by their query.
+  mutable std::map<std::string, sqlite3_stmt*> statements_;
+
+  /// A cached statement may only be stepped by one caller at a time.
+  mutable Mutex statement_mutex_;
+
   /// Deconstruction mutex.
   Mutex close_mutex_;
 };
@@ -88,6 +125,37 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(SQLiteDatabasePlugin, "database", "sqlite");
 
+/// Periodically checks the active SQLite database plugin for fragmentation.
+class SQLiteVacuumRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    auto& rf = RegistryFactory::get();
+    if (rf.getActive("database") != "sqlite") {
+      return true;
+    }
+    auto plugin = std::dynamic_pointer_cast<SQLiteDatabasePlugin>(
+        rf.plugin("database", "sqlite"));
+    if (plugin != nullptr) {
+      plugin->vacuum();
+    }
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::seconds(FLAGS_database_vacuum_interval);
+  }
+
+  /// A vacuum rewrites the database file.
+  bool blocking() override {
+    return true;
+  }
+};
+
+static inline void resetStatement(sqlite3_stmt* stmt) {
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
 Status SQLiteDatabasePlugin::setUp() {
   if (!DatabasePlugin::kDBHandleOptionAllowOpen) {
     LOG(WARNING) << RLOG(1629) << "Not allowed to create DBHandle instance";
@@ -145,6 +213,12 @@ Status SQLiteDatabasePlugin::setUp() {
       settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
     }
     sqlite3_exec(db_, settings.c_str(), nullptr, nullptr, nullptr);
+
+    // Fragmentation checks are expensive, run them outside of writes.
+    static std::atomic<bool> vacuum_started{false};
+    if (FLAGS_database_vacuum_interval > 0 && !vacuum_started.exchange(true)) {
+      Dispatcher::addPeriodicService(std::make_shared<SQLiteVacuumRunner>());
+    }
   }
 
   // RocksDB may not create/append a directory with acceptable permissions.
@@ -157,12 +231,36 @@ Status SQLiteDatabasePlugin::setUp() {
 
 void SQLiteDatabasePlugin::close() {
   WriteLock lock(close_mutex_);
+  {
+    WriteLock statement_lock(statement_mutex_);
+    for (auto& statement : statements_) {
+      sqlite3_finalize(statement.second);
+    }
+    statements_.clear();
+  }
+
   if (db_ != nullptr) {
     sqlite3_close(db_);
     db_ = nullptr;
   }
 }
 
+sqlite3_stmt* SQLiteDatabasePlugin::getStatement(const std::string& q) const {
+  auto it = statements_.find(q);
+  if (it != statements_.end()) {
+    return it->second;
+  }
+
+  sqlite3_stmt* stmt = nullptr;
+  if (db_ == nullptr ||
+      sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return nullptr;
+  }
+  statements_[q] = stmt;
+  return stmt;
+}
+
 static int getData(void* argument, int argc, char* argv[], char* column[]) {
   if (argument == nullptr) {
     return SQLITE_MISUSE;
@@ -182,23 +280,98 @@ static int getData(void* argument, int argc, char* argv[], char* column[]) {
 Status SQLiteDatabasePlugin::get(const std::string& domain,
                                  const std::string& key,
                                  std::string& value) const {
-  QueryData results;
-  char* err = nullptr;
-  std::string q = "select value from " + domain + " where key = '" + key + "';";
-  sqlite3_exec(db_, q.c_str(), getData, &results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement("select value from " + domain + " where key = ?1;");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare select for: " + domain);
   }
 
+  sqlite3_bind_text(
+      stmt, 1, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+
   // Only assign value if the query found a result.
-  if (results.size() > 0) {
-    value = std::move(results[0]["value"]);
-    return Status(0);
+  bool found = false;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    value = (data != nullptr) ? data : "";
+    found = true;
+  }
+  resetStatement(stmt);
+  return Status((found) ? 0 : 1);
+}
+
+Status SQLiteDatabasePlugin::getBatch(const std::string& domain,
+                                      const std::vector<std::string>& keys,
+                                      std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+
+  // Keys may repeat, map each to every position it is requested within.
+  std::unordered_map<std::string, std::vector<size_t>> positions;
+  for (size_t i = 0; i < keys.size(); i++) {
+    positions[keys[i]].push_back(i);
+  }
+
+  // Stay well below the default SQLITE_MAX_VARIABLE_NUMBER (999).
+  const size_t kMaxBatchKeys = 500;
+  auto it = positions.begin();
+  while (it != positions.end()) {
+    auto remaining = static_cast<size_t>(std::distance(it, positions.end()));
+    auto count = std::min(kMaxBatchKeys, remaining);
+    std::string q = "select key, value from " + domain + " where key in (?";
+    for (size_t i = 1; i < count; i++) {
+      q += ", ?";
+    }
+    q += ");";
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+      return Status(1, "Cannot prepare batch select for: " + domain);
+    }
+
+    for (size_t i = 0; i < count; i++, it++) {
+      sqlite3_bind_text(stmt,
+                        static_cast<int>(i + 1),
+                        it->first.c_str(),
+                        static_cast<int>(it->first.size()),
+                        SQLITE_STATIC);
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      auto key = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+      auto value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      if (key == nullptr) {
+        continue;
+      }
+
+      auto found = positions.find(key);
+      if (found != positions.end()) {
+        for (auto position : found->second) {
+          values[position] = (value != nullptr) ? value : "";
+        }
+      }
+    }
+    sqlite3_finalize(stmt);
   }
-  return Status(1);
+  return Status(0);
+}
+
+Status SQLiteDatabasePlugin::trim() {
+  ReadLock lock(close_mutex_);
+  if (db_ == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  sqlite3_db_release_memory(db_);
+  return Status(0, "OK");
 }
 
-static void tryVacuum(sqlite3* db) {
+void SQLiteDatabasePlugin::vacuum() {
+  ReadLock lock(close_mutex_);
+  if (db_ == nullptr || read_only_) {
+    return;
+  }
+
+  WriteLock statement_lock(statement_mutex_);
   std::string q =
       "SELECT (sum(s1.pageno + 1 == s2.pageno) * 1.0 / count(*)) < 0.01 as v "
       " FROM "
@@ -207,9 +380,10 @@ static void tryVacuum(sqlite3* db) {
       "s1.rowid + 1 = s2.rowid; ";
 
   QueryData results;
-  sqlite3_exec(db, q.c_str(), getData, &results, nullptr);
-  if (results.size() > 0 && results[0]["v"].back() == '1') {
-    sqlite3_exec(db, "vacuum;", nullptr, nullptr, nullptr);
+  sqlite3_exec(db_, q.c_str(), getData, &results, nullptr);
+  if (results.size() > 0 && !results[0]["v"].empty() &&
+      results[0]["v"].back() == '1') {
+    sqlite3_exec(db_, "vacuum;", nullptr, nullptr, nullptr);
   }
 }
 
@@ -220,21 +394,56 @@ Status SQLiteDatabasePlugin::put(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "insert or replace into " + domain + " values (?1, ?2);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  WriteLock lock(statement_mutex_);
+  auto stmt =
+      getStatement("insert or replace into " + domain + " values (?1, ?2);");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare insert for: " + domain);
+  }
 
   sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
   sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_STATIC);
   auto rc = sqlite3_step(stmt);
+  resetStatement(stmt);
   if (rc != SQLITE_DONE) {
     return Status(1);
   }
+  return Status(0);
+}
+
+Status SQLiteDatabasePlugin::putBatch(const std::string& domain,
+                                      const DatabaseStringValueList& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
 
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
-    tryVacuum(db_);
+  WriteLock lock(statement_mutex_);
+  auto stmt =
+      getStatement("insert or replace into " + domain + " values (?1, ?2);");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare batch insert for: " + domain);
   }
+
+  // Apply every insert within a single transaction.
+  sqlite3_exec(db_, "begin transaction;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto& kv : data) {
+    sqlite3_bind_text(stmt, 1, kv.first.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, kv.second.c_str(), -1, SQLITE_STATIC);
+    auto rc = sqlite3_step(stmt);
+    resetStatement(stmt);
+    if (rc != SQLITE_DONE) {
+      success = false;
+      break;
+    }
+  }
+
+  if (!success) {
+    sqlite3_exec(db_, "rollback;", nullptr, nullptr, nullptr);
+    return Status(1);
+  }
+
+  sqlite3_exec(db_, "commit;", nullptr, nullptr, nullptr);
   return Status(0);
 }
 
@@ -244,20 +453,18 @@ Status SQLiteDatabasePlugin::remove(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "delete from " + domain + " where key IN (?1);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement("delete from " + domain + " where key IN (?1);");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare delete for: " + domain);
+  }
 
   sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
   auto rc = sqlite3_step(stmt);
+  resetStatement(stmt);
   if (rc != SQLITE_DONE) {
     return Status(1);
   }
-
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
-    tryVacuum(db_);
-  }
   return Status(0);
 }
 
@@ -268,21 +475,20 @@ Status SQLiteDatabasePlugin::removeRange(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "delete from " + domain + " where key >= ?1 and key <= ?2;";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement("delete from " + domain +
+                           " where key >= ?1 and key <= ?2;");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare range delete for: " + domain);
+  }
 
   sqlite3_bind_text(stmt, 1, low.c_str(), -1, SQLITE_STATIC);
   sqlite3_bind_text(stmt, 2, high.c_str(), -1, SQLITE_STATIC);
   auto rc = sqlite3_step(stmt);
+  resetStatement(stmt);
   if (rc != SQLITE_DONE) {
     return Status(1);
   }
-
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
-    tryVacuum(db_);
-  }
   return Status(0);
 }
 
@@ -290,24 +496,34 @@ Status SQLiteDatabasePlugin::scan(const std::string& domain,
                                   std::vector<std::string>& results,
                                   const std::string& prefix,
                                   size_t max) const {
-  QueryData _results;
-  char* err = nullptr;
-
-  std::string q =
-      "select key from " + domain + " where key LIKE '" + prefix + "%'";
-  if (max > 0) {
-    q += " limit " + std::to_string(max);
-  }
-  sqlite3_exec(db_, q.c_str(), getData, &_results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  // Use a key range instead of LIKE, prefixes may contain '_' or '%'.
+  std::string upper;
+  bool bounded = getPrefixUpperBound(prefix, upper);
+
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement("select key from " + domain + " where key >= ?1" +
+                           ((bounded) ? " and key < ?2" : "") +
+                           " order by key limit ?3;");
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare scan for: " + domain);
   }
 
-  // Only assign value if the query found a result.
-  for (auto& r : _results) {
-    results.push_back(std::move(r["key"]));
+  sqlite3_bind_text(
+      stmt, 1, prefix.c_str(), static_cast<int>(prefix.size()), SQLITE_STATIC);
+  if (bounded) {
+    sqlite3_bind_text(
+        stmt, 2, upper.c_str(), static_cast<int>(upper.size()), SQLITE_STATIC);
   }
+  // A negative limit is unlimited.
+  sqlite3_bind_int64(stmt, 3, (max > 0) ? static_cast<sqlite3_int64>(max) : -1);
 
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto key = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    if (key != nullptr) {
+      results.push_back(key);
+    }
+  }
+  resetStatement(stmt);
   return Status(0, "OK");
 }
 }
@@ -33,4 +33,81 @@ TEST_F(RocksDBDatabasePluginTests, test_rocksdb_loglevel) {
   auto details = SQL::selectAllFrom("file", "path", EQUALS, path_ + "/LOG");
   ASSERT_EQ(details.size(), 0U);
 }
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_properties) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  ASSERT_NE(plugin, nullptr);
+
+  std::map<std::string, std::string> props;
+  EXPECT_TRUE(plugin->properties(kQueries, props).ok());
+  EXPECT_EQ(props["osquery.profile"], "small");
+  EXPECT_EQ(props.count("rocksdb.estimate-num-keys"), 1U);
+
+  // Unknown domains do not map to a column family.
+  props.clear();
+  EXPECT_FALSE(plugin->properties("not_a_domain", props).ok());
+  EXPECT_TRUE(props.empty());
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_prefix_scan) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  ASSERT_NE(plugin, nullptr);
+
+  // Use prefixes both shorter and longer than the extracted prefix.
+  for (const auto& key : {"a1", "a2", "b1", "records.a.1", "records.a.2",
+                          "records.b.1", "recordsz"}) {
+    plugin->put(kEvents, key, "value");
+  }
+
+  std::vector<std::string> keys;
+  EXPECT_TRUE(plugin->scan(kEvents, keys, "a").ok());
+  EXPECT_EQ(keys, std::vector<std::string>({"a1", "a2"}));
+
+  keys.clear();
+  plugin->scan(kEvents, keys, "records.a.");
+  EXPECT_EQ(keys, std::vector<std::string>({"records.a.1", "records.a.2"}));
+
+  keys.clear();
+  plugin->scan(kEvents, keys, "records.", 2);
+  EXPECT_EQ(keys.size(), 2U);
+
+  keys.clear();
+  plugin->scan(kEvents, keys, "");
+  EXPECT_EQ(keys.size(), 7U);
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_created_domains) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  ASSERT_NE(plugin, nullptr);
+
+  // Nothing can be stored in a domain that was not created.
+  auto domain = kEvents + ".test.subscriber";
+  EXPECT_FALSE(plugin->put(domain, "key", "value").ok());
+  EXPECT_TRUE(plugin->createDomain(domain).ok());
+  EXPECT_TRUE(plugin->createDomain(domain).ok());
+  EXPECT_TRUE(plugin->put(domain, "key", "value").ok());
+  EXPECT_TRUE(isEventsDomain(domain));
+
+  // Created domains are opened again with the database.
+  EXPECT_TRUE(plugin->setUp().ok());
+  std::string value;
+  EXPECT_TRUE(plugin->get(domain, "key", value).ok());
+  EXPECT_EQ(value, "value");
+
+  // A dropped domain's keys are removed.
+  EXPECT_TRUE(plugin->dropDomain(domain).ok());
+  EXPECT_FALSE(plugin->get(domain, "key", value).ok());
+  EXPECT_TRUE(plugin->createDomain(domain).ok());
+  std::vector<std::string> keys;
+  plugin->scan(domain, keys, "");
+  EXPECT_TRUE(keys.empty());
+  EXPECT_TRUE(plugin->dropDomain(domain).ok());
+
+  // The kDomains domains cannot be dropped.
+  EXPECT_FALSE(plugin->dropDomain(kEvents).ok());
+  EXPECT_FALSE(isEventsDomain(kEvents + "_other"));
+}
 }
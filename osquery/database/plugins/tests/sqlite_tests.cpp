@@ -21,4 +21,29 @@ class SQLiteDatabasePluginTests : public DatabasePluginTests {
 
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(SQLiteDatabasePluginTests);
+
+TEST_F(SQLiteDatabasePluginTests, test_sqlite_scan_wildcards) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  ASSERT_NE(plugin, nullptr);
+
+  // Scan prefixes are literal, '_' and '%' are not LIKE wildcards.
+  plugin->put(kLogs, "log_a", "1");
+  plugin->put(kLogs, "logxb", "2");
+  plugin->put(kLogs, "log%c", "3");
+
+  std::vector<std::string> keys;
+  EXPECT_TRUE(plugin->scan(kLogs, keys, "log_").ok());
+  EXPECT_EQ(keys, std::vector<std::string>({"log_a"}));
+
+  keys.clear();
+  plugin->scan(kLogs, keys, "log%");
+  EXPECT_EQ(keys, std::vector<std::string>({"log%c"}));
+
+  // Repeated use of the cached statements sees new values.
+  std::string value;
+  plugin->put(kLogs, "log_a", "4");
+  EXPECT_TRUE(plugin->get(kLogs, "log_a", value).ok());
+  EXPECT_EQ(value, "4");
+}
 }
@@ -9,13 +9,136 @@
  */
 
 #include <algorithm>
+#include <map>
 
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+FLAG(bool,
+     query_fingerprint_results,
+     false,
+     "Store scheduled query results as row fingerprints");
+
+/// Stored results beginning with this marker are a list of fingerprints.
+const std::string kFingerprintsMarker = "fingerprints:";
+
+/// Rows grouped by fingerprint, a group has more than one row if repeated.
+using FingerprintGroups = std::map<uint64_t, std::vector<const Row*>>;
+
+static std::string fingerprintHex(uint64_t fingerprint) {
+  static const char* kHex = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (size_t i = 0; i < 16; i++) {
+    hex[15 - i] = kHex[(fingerprint >> (i * 4)) & 0xf];
+  }
+  return hex;
+}
+
+static inline std::string fingerprintKey(const std::string& name,
+                                         uint64_t fingerprint) {
+  return name + "." + fingerprintHex(fingerprint);
+}
+
+/// Parse the count of rows for each fingerprint from stored results.
+static bool getFingerprints(const std::string& raw,
+                            std::map<uint64_t, size_t>& fingerprints) {
+  if (!boost::starts_with(raw, kFingerprintsMarker)) {
+    return false;
+  }
+
+  for (size_t i = kFingerprintsMarker.size(); i + 16 <= raw.size(); i += 16) {
+    uint64_t fingerprint = 0;
+    for (size_t j = i; j < i + 16; j++) {
+      auto c = raw[j];
+      auto digit = (c >= 'a') ? c - 'a' + 10 : c - '0';
+      fingerprint = (fingerprint << 4) | static_cast<uint64_t>(digit & 0xf);
+    }
+    fingerprints[fingerprint]++;
+  }
+  return true;
+}
+
+/// Read the rows stored for a fingerprint.
+static QueryData getFingerprintRows(const std::string& name,
+                                    uint64_t fingerprint) {
+  QueryData rows;
+  std::string raw;
+  auto key = fingerprintKey(name, fingerprint);
+  if (getDatabaseValue(kQueryRows, key, raw).ok()) {
+    deserializeQueryDataBinary(raw, rows);
+  }
+  return rows;
+}
+
+/// Read every stored row for a query stored as fingerprints.
+static Status getFingerprintResults(
+    const std::string& name,
+    const std::map<uint64_t, size_t>& fingerprints,
+    QueryData& results) {
+  for (const auto& fingerprint : fingerprints) {
+    auto rows = getFingerprintRows(name, fingerprint.first);
+    if (rows.size() != fingerprint.second) {
+      return Status(1, "Missing stored rows for query: " + name);
+    }
+    results.insert(results.end(), rows.begin(), rows.end());
+  }
+  return Status(0, "OK");
+}
+
+/// Delete the rows of the fingerprints listed in stored results.
+static void deleteFingerprintRows(const std::string& name,
+                                  const std::string& raw) {
+  std::map<uint64_t, size_t> fingerprints;
+  getFingerprints(raw, fingerprints);
+  for (const auto& fingerprint : fingerprints) {
+    deleteDatabaseValue(kQueryRows, fingerprintKey(name, fingerprint.first));
+  }
+}
+
+void Query::deleteStoredResults(const std::string& name) {
+  std::string raw;
+  getDatabaseValue(kQueries, name, raw);
+  deleteDatabaseValue(kQueries, name);
+
+  // Only the listed rows are deleted, keys of other queries may share a prefix.
+  deleteFingerprintRows(name, raw);
+}
+
+bool Query::checkSnapshotResults(const QueryData& qd,
+                                 size_t max_age,
+                                 std::string& fingerprint) {
+  fingerprint = fingerprintHex(resultsFingerprint(qd));
+
+  // The last snapshot logged in full is stored as "fingerprint:time".
+  std::string content;
+  getDatabaseValue(kPersistentSettings, "snapshot." + name_, content);
+  auto now = static_cast<long long>(getUnixTime());
+  auto details = osquery::split(content, ":");
+  if (details.size() == 2 && details[0] == fingerprint) {
+    long long logged = 0;
+    if (safeStrtoll(details[1], 10, logged).ok() &&
+        now < logged + static_cast<long long>(max_age)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Status Query::setSnapshotLogged(const std::string& fingerprint) {
+  auto now = static_cast<long long>(getUnixTime());
+  return setDatabaseValue(kPersistentSettings,
+                          "snapshot." + name_,
+                          fingerprint + ":" + std::to_string(now));
+}
+
 Status Query::getPreviousQueryResults(QueryData& results) {
   std::string raw;
   auto status = getDatabaseValue(kQueries, name_, raw);
@@ -23,7 +146,12 @@ Status Query::getPreviousQueryResults(QueryData& results) {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
+  std::map<uint64_t, size_t> fingerprints;
+  if (getFingerprints(raw, fingerprints)) {
+    return getFingerprintResults(name_, fingerprints, results);
+  }
+
+  status = deserializeQueryDataBinary(raw, results);
   if (!status.ok()) {
     return status;
   }
@@ -37,7 +165,9 @@ std::vector<std::string> Query::getStoredQueryNames() {
 }
 
 bool Query::isQueryNameInDatabase() {
-  auto names = Query::getStoredQueryNames();
+  // Only scan keys sharing the name.
+  std::vector<std::string> names;
+  scanDatabaseKeys(kQueries, names, name_);
   return std::find(names.begin(), names.end(), name_) != names.end();
 }
 
@@ -73,6 +203,10 @@ Status Query::addNewResults(const QueryData& current_qd,
     saveQuery(name_, query_.query);
   }
 
+  if (FLAGS_query_fingerprint_results) {
+    return addFingerprintResults(current_qd, dr, fresh_results);
+  }
+
   // Use a 'target' avoid copying the query data when serializing and saving.
   // If a differential is requested and needed the target remains the original
   // query data, otherwise the content is moved to the differential's added set.
@@ -95,16 +229,129 @@ Status Query::addNewResults(const QueryData& current_qd,
 
   if (fresh_results) {
     // Replace the "previous" query data with the current.
-    std::string json;
-    auto status = serializeQueryDataJSON(*target_gd, json);
+    std::string content;
+    auto status = serializeQueryDataBinary(*target_gd, content);
     if (!status.ok()) {
       return status;
     }
 
-    status = setDatabaseValue(kQueries, name_, json);
+    // Results stored as fingerprints by an earlier run are converted. Their
+    // rows are deleted once the results replaced the list of fingerprints.
+    std::string previous;
+    getDatabaseValue(kQueries, name_, previous);
+    status = setDatabaseValue(kQueries, name_, content);
     if (!status.ok()) {
       return status;
     }
+    if (boost::starts_with(previous, kFingerprintsMarker)) {
+      deleteFingerprintRows(name_, previous);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::addFingerprintResults(const QueryData& current_qd,
+                                    DiffResults& dr,
+                                    bool fresh_results) {
+  FingerprintGroups current;
+  for (const auto& row : current_qd) {
+    current[rowFingerprint(row)].push_back(&row);
+  }
+
+  std::string raw;
+  std::map<uint64_t, size_t> previous;
+  bool fingerprinted = false;
+  if (getDatabaseValue(kQueries, name_, raw).ok()) {
+    fingerprinted = getFingerprints(raw, previous);
+  }
+
+  if (fresh_results) {
+    dr.added = current_qd;
+  } else if (!fingerprinted) {
+    // Convert results stored by an earlier run without fingerprints.
+    QueryData previous_qd;
+    auto status = deserializeQueryDataBinary(raw, previous_qd);
+    if (!status.ok()) {
+      return status;
+    }
+    dr = diff(previous_qd, current_qd);
+  }
+
+  // Rows are only written, or read and removed, for changed fingerprints.
+  // A current row is not added if an equal previous row exists, see diff.
+  DatabaseStringValueList writes;
+  std::string fingerprints = kFingerprintsMarker;
+  for (const auto& group : current) {
+    for (size_t i = 0; i < group.second.size(); i++) {
+      fingerprints += fingerprintHex(group.first);
+    }
+
+    auto stored = previous.find(group.first);
+    if (stored != previous.end() && stored->second == group.second.size()) {
+      continue;
+    }
+
+    if (!fresh_results && fingerprinted) {
+      if (stored == previous.end()) {
+        for (const auto* row : group.second) {
+          dr.added.push_back(*row);
+        }
+      } else if (stored->second > group.second.size()) {
+        auto rows = getFingerprintRows(name_, group.first);
+        for (size_t i = group.second.size(); i < rows.size(); i++) {
+          dr.removed.push_back(std::move(rows[i]));
+        }
+      }
+    }
+
+    QueryData rows;
+    for (const auto* row : group.second) {
+      rows.push_back(*row);
+    }
+    std::string content;
+    auto status = serializeQueryDataBinary(rows, content);
+    if (!status.ok()) {
+      return status;
+    }
+    writes.push_back(
+        std::make_pair(fingerprintKey(name_, group.first), std::move(content)));
+  }
+
+  std::vector<uint64_t> removed;
+  for (const auto& fingerprint : previous) {
+    if (current.count(fingerprint.first) == 0) {
+      removed.push_back(fingerprint.first);
+    }
+  }
+
+  if (fingerprinted && writes.empty() && removed.empty()) {
+    // The results did not change.
+    return Status(0, "OK");
+  }
+
+  if (!fresh_results && fingerprinted) {
+    for (const auto& fingerprint : removed) {
+      auto rows = getFingerprintRows(name_, fingerprint);
+      for (auto& row : rows) {
+        dr.removed.push_back(std::move(row));
+      }
+    }
+  }
+
+  // Rows are written before the list referencing them, and removed rows are
+  // deleted after the list no longer references them.
+  if (!writes.empty()) {
+    auto status = setDatabaseBatch(kQueryRows, writes);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  auto status = setDatabaseValue(kQueries, name_, fingerprints);
+  if (!status.ok()) {
+    return status;
+  }
+  for (const auto& fingerprint : removed) {
+    deleteDatabaseValue(kQueryRows, fingerprintKey(name_, fingerprint));
   }
   return Status(0, "OK");
 }
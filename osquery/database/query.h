@@ -114,6 +114,41 @@ class Query {
    */
   Status getCurrentResults(QueryData& qd);
 
+  /// Delete the stored results of a query, including fingerprinted rows.
+  static void deleteStoredResults(const std::string& name);
+
+  /**
+   * @brief Check if an incremental snapshot should be logged in full.
+   *
+   * The snapshot's fingerprint is compared with the last snapshot logged in
+   * full. That snapshot is replaced when the results changed, or when it was
+   * logged more than max_age seconds ago. Nothing is stored, a snapshot
+   * logged in full is recorded with setSnapshotLogged.
+   *
+   * @param qd the snapshot results.
+   * @param max_age seconds an unchanged snapshot may go without a full log.
+   * @param fingerprint output hex fingerprint of the results.
+   * @return true if the snapshot should be logged in full.
+   */
+  bool checkSnapshotResults(const QueryData& qd,
+                            size_t max_age,
+                            std::string& fingerprint);
+
+  /// Record the fingerprint of a snapshot once it was logged in full.
+  Status setSnapshotLogged(const std::string& fingerprint);
+
+ private:
+  /**
+   * @brief Store results as a list of row fingerprints.
+   *
+   * The rows for each fingerprint are stored separately, a run that does not
+   * change the results reads the fingerprint list and writes nothing. A run
+   * that changes rows writes the added rows and reads the removed rows.
+   */
+  Status addFingerprintResults(const QueryData& current_qd,
+                               DiffResults& dr,
+                               bool fresh_results);
+
  private:
   /// The scheduled query and internal
   ScheduledQuery query_;
@@ -129,5 +164,7 @@ class Query {
   FRIEND_TEST(QueryTests, test_get_executions);
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
+  FRIEND_TEST(QueryTests, test_fingerprint_results);
+  FRIEND_TEST(QueryTests, test_snapshot_results);
 };
 }
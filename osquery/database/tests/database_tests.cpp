@@ -72,4 +72,39 @@ TEST_F(DatabaseTests, test_delete_values) {
   EXPECT_FALSE(s.ok());
   EXPECT_TRUE(value.empty());
 }
+
+TEST_F(DatabaseTests, test_prefix_upper_bound) {
+  std::string upper;
+  EXPECT_FALSE(getPrefixUpperBound("", upper));
+  EXPECT_TRUE(getPrefixUpperBound("records.", upper));
+  EXPECT_EQ(upper, "records/");
+  EXPECT_TRUE(getPrefixUpperBound(std::string("a\xff\xff", 3), upper));
+  EXPECT_EQ(upper, "b");
+  EXPECT_FALSE(getPrefixUpperBound(std::string("\xff", 1), upper));
+}
+
+TEST_F(DatabaseTests, test_database_handle) {
+  DatabaseHandle logs(kLogs);
+  EXPECT_EQ(logs.domain(), kLogs);
+  EXPECT_TRUE(logs.put("handle_1", "1"));
+  EXPECT_TRUE(logs.put({{"handle_2", "2"}, {"handle_3", "3"}}));
+
+  std::string value;
+  EXPECT_TRUE(logs.get("handle_2", value));
+  EXPECT_EQ(value, "2");
+
+  std::vector<std::string> values;
+  EXPECT_TRUE(logs.get({"handle_1", "handle_3"}, values));
+  EXPECT_EQ(values, std::vector<std::string>({"1", "3"}));
+
+  std::vector<std::string> keys;
+  EXPECT_TRUE(logs.scan(keys, "handle_"));
+  EXPECT_EQ(keys.size(), 3U);
+
+  EXPECT_TRUE(logs.remove("handle_1"));
+  EXPECT_TRUE(logs.remove("handle_2", "handle_3"));
+  keys.clear();
+  logs.scan(keys, "handle_");
+  EXPECT_TRUE(keys.empty());
+}
 }
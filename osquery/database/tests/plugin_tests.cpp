@@ -12,6 +12,8 @@
 
 namespace osquery {
 
+DECLARE_uint64(ephemeral_events_max_bytes);
+
 class EphemeralDatabasePluginTests : public DatabasePluginTests {
  protected:
   std::string name() override {
@@ -22,6 +24,35 @@ class EphemeralDatabasePluginTests : public DatabasePluginTests {
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(EphemeralDatabasePluginTests);
 
+TEST_F(EphemeralDatabasePluginTests, test_ephemeral_events_eviction) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  ASSERT_NE(plugin, nullptr);
+
+  // Each key and value pair is 4 bytes, allow three pairs.
+  auto max_bytes = FLAGS_ephemeral_events_max_bytes;
+  FLAGS_ephemeral_events_max_bytes = 12;
+  plugin->put(kEvents, "e1", "aa");
+  plugin->put(kEvents, "e2", "bb");
+  plugin->put(kEvents, "e3", "cc");
+  // Rewriting a key does not make it the oldest.
+  plugin->put(kEvents, "e1", "dd");
+  plugin->put(kEvents, "e4", "ee");
+
+  std::vector<std::string> keys;
+  plugin->scan(kEvents, keys, "e");
+  EXPECT_EQ(keys, std::vector<std::string>({"e1", "e3", "e4"}));
+
+  // Other domains are not capped.
+  for (size_t i = 0; i < 10; i++) {
+    plugin->put(kQueries, "q" + std::to_string(i), "value");
+  }
+  keys.clear();
+  plugin->scan(kQueries, keys, "q");
+  EXPECT_EQ(keys.size(), 10U);
+  FLAGS_ephemeral_events_max_bytes = max_bytes;
+}
+
 void DatabasePluginTests::testPluginCheck() {
   auto& rf = RegistryFactory::get();
 
@@ -51,6 +82,17 @@ void DatabasePluginTests::testReset() {
   }
 }
 
+void DatabasePluginTests::testTrim() {
+  getPlugin()->put(kEvents, "test_trim", "1");
+  EXPECT_TRUE(getPlugin()->trim().ok());
+
+  // Trimming must keep the database open and its contents intact.
+  std::string value;
+  EXPECT_TRUE(getPlugin()->get(kEvents, "test_trim", value).ok());
+  EXPECT_EQ(value, "1");
+  EXPECT_TRUE(getPlugin()->put(kEvents, "test_trim", "2").ok());
+}
+
 void DatabasePluginTests::testPut() {
   auto s = getPlugin()->put(kQueries, "test_put", "bar");
   EXPECT_TRUE(s.ok());
@@ -67,6 +109,35 @@ void DatabasePluginTests::testGet() {
   EXPECT_EQ(r, "bar");
 }
 
+void DatabasePluginTests::testGetBatch() {
+  getPlugin()->put(kQueries, "test_get_batch_1", "1");
+  getPlugin()->put(kQueries, "test_get_batch_2", "2");
+
+  // Missing and repeated keys keep their positions.
+  std::vector<std::string> keys = {"test_get_batch_2",
+                                   "test_get_batch_missing",
+                                   "test_get_batch_1",
+                                   "test_get_batch_2"};
+  std::vector<std::string> values;
+  auto s = getPlugin()->getBatch(kQueries, keys, values);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"2", "", "1", "2"}));
+}
+
+void DatabasePluginTests::testPutBatch() {
+  DatabaseStringValueList data = {
+      {"test_batch_1", "1"}, {"test_batch_2", "2"}, {"test_batch_3", "3"}};
+  auto s = getPlugin()->putBatch(kQueries, data);
+  EXPECT_TRUE(s.ok());
+
+  for (const auto& kv : data) {
+    std::string r;
+    s = getPlugin()->get(kQueries, kv.first, r);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(r, kv.second);
+  }
+}
+
 void DatabasePluginTests::testDelete() {
   getPlugin()->put(kQueries, "test_delete", "baz");
   auto s = getPlugin()->remove(kQueries, "test_delete");
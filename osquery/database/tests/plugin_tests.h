@@ -27,12 +27,21 @@
   TEST_F(n, test_reset) {                                                      \
     testReset();                                                               \
   }                                                                            \
+  TEST_F(n, test_trim) {                                                       \
+    testTrim();                                                                \
+  }                                                                            \
   TEST_F(n, test_put) {                                                        \
     testPut();                                                                 \
   }                                                                            \
   TEST_F(n, test_get) {                                                        \
     testGet();                                                                 \
   }                                                                            \
+  TEST_F(n, test_get_batch) {                                                  \
+    testGetBatch();                                                            \
+  }                                                                            \
+  TEST_F(n, test_put_batch) {                                                  \
+    testPutBatch();                                                            \
+  }                                                                            \
   TEST_F(n, test_delete) {                                                     \
     testDelete();                                                              \
   }                                                                            \
@@ -104,8 +113,11 @@ class DatabasePluginTests : public testing::Test {
  protected:
   void testPluginCheck();
   void testReset();
+  void testTrim();
   void testPut();
   void testGet();
+  void testGetBatch();
+  void testPutBatch();
   void testDelete();
   void testDeleteRange();
   void testScan();
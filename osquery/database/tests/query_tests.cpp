@@ -16,11 +16,15 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
+
 #include "osquery/database/query.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_bool(query_fingerprint_results);
+
 class QueryTests : public testing::Test {};
 
 TEST_F(QueryTests, test_private_members) {
@@ -61,6 +65,94 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   }
 }
 
+TEST_F(QueryTests, test_fingerprint_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("fingerprinted", query);
+  QueryData first = {{{"k", "1"}}, {{"k", "2"}}, {{"k", "2"}}};
+  ASSERT_TRUE(cf.addNewResults(first).ok());
+
+  // Results stored without fingerprints are converted.
+  FLAGS_query_fingerprint_results = true;
+  QueryData second = {{{"k", "2"}}, {{"k", "3"}}};
+  DiffResults dr;
+  ASSERT_TRUE(cf.addNewResults(second, dr, true).ok());
+  EXPECT_EQ(dr, diff(first, second));
+
+  std::string raw;
+  getDatabaseValue(kQueries, "fingerprinted", raw);
+  EXPECT_EQ(raw.find("fingerprints:"), 0U);
+  QueryData previous;
+  ASSERT_TRUE(cf.getPreviousQueryResults(previous).ok());
+  EXPECT_EQ(diff(previous, second), DiffResults());
+
+  // An unchanged run has no differential.
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(second, dr, true).ok());
+  EXPECT_EQ(dr, DiffResults());
+
+  // Changed fingerprints have the same differential as diff.
+  QueryData third = {{{"k", "3"}}, {{"k", "3"}}, {{"k", "4"}}};
+  ASSERT_TRUE(cf.addNewResults(third, dr, true).ok());
+  EXPECT_EQ(dr, diff(second, third));
+
+  // Fingerprinted rows are internal and removed with their results.
+  auto names = cf.getStoredQueryNames();
+  EXPECT_EQ(std::count(names.begin(), names.end(), "fingerprinted"), 1);
+
+  // The rows of a query whose name extends another's are kept.
+  auto other = Query("fingerprinted.other", query);
+  ASSERT_TRUE(other.addNewResults(third, dr, true).ok());
+  Query::deleteStoredResults("fingerprinted");
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueryRows, keys, "fingerprinted.");
+  EXPECT_EQ(keys.size(), 2U);
+  for (const auto& key : keys) {
+    EXPECT_EQ(key.find("fingerprinted.other."), 0U);
+  }
+
+  // Disabling fingerprints stores the results whole and deletes the rows.
+  FLAGS_query_fingerprint_results = false;
+  ASSERT_TRUE(other.addNewResults(third, dr, true).ok());
+  keys.clear();
+  scanDatabaseKeys(kQueryRows, keys, "fingerprinted.");
+  EXPECT_TRUE(keys.empty());
+  QueryData previous_other;
+  ASSERT_TRUE(other.getPreviousQueryResults(previous_other).ok());
+  EXPECT_EQ(diff(previous_other, third), DiffResults());
+  Query::deleteStoredResults("fingerprinted.other");
+}
+
+TEST_F(QueryTests, test_snapshot_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("incremental_snapshot", query);
+  QueryData results = {{{"k", "1"}}, {{"k", "2"}}};
+
+  // The first snapshot is always logged in full.
+  std::string fingerprint;
+  EXPECT_TRUE(cf.checkSnapshotResults(results, 3600, fingerprint));
+  EXPECT_EQ(fingerprint.size(), 16U);
+
+  // A snapshot that was not logged is never referenced.
+  std::string unchanged;
+  EXPECT_TRUE(cf.checkSnapshotResults(results, 3600, unchanged));
+  ASSERT_TRUE(cf.setSnapshotLogged(fingerprint).ok());
+
+  // The same rows in any order are unchanged.
+  QueryData reordered = {{{"k", "2"}}, {{"k", "1"}}};
+  EXPECT_FALSE(cf.checkSnapshotResults(reordered, 3600, unchanged));
+  EXPECT_EQ(fingerprint, unchanged);
+
+  // Changed rows are logged in full.
+  QueryData changed = {{{"k", "1"}}, {{"k", "3"}}};
+  EXPECT_TRUE(cf.checkSnapshotResults(changed, 3600, fingerprint));
+  EXPECT_NE(fingerprint, unchanged);
+  ASSERT_TRUE(cf.setSnapshotLogged(fingerprint).ok());
+
+  // Unchanged rows are logged in full again after the maximum age.
+  EXPECT_TRUE(cf.checkSnapshotResults(changed, 0, fingerprint));
+  deleteDatabaseValue(kPersistentSettings, "snapshot.incremental_snapshot");
+}
+
 TEST_F(QueryTests, test_get_query_results) {
   // Grab an expected set of query data and add it as the previous result.
   auto encoded_qd = getSerializedQueryDataJSON();
@@ -15,14 +15,18 @@
 #include <gtest/gtest.h>
 
 #include <osquery/database.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
 #include "osquery/tests/test_util.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(decorations_top_level);
+
 class ResultsTests : public testing::Test {};
 
 TEST_F(ResultsTests, test_simple_diff) {
@@ -38,6 +42,21 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_diff_rows) {
+  QueryData o = {{{"k", "1"}}, {{"k", "2"}}, {{"k", "2"}}, {{"k", "3"}}};
+  QueryData n = {{{"k", "2"}}, {{"k", "4"}}, {{"k", "1"}}, {{"k", "1"}}};
+
+  // Repeated rows are not added if any equal row existed, and the unmatched
+  // old rows are removed.
+  auto results = diff(o, n);
+  EXPECT_EQ(results.added, QueryData({{{"k", "4"}}}));
+  EXPECT_EQ(results.removed, QueryData({{{"k", "2"}}, {{"k", "3"}}}));
+
+  // Column names and values are fingerprinted separately.
+  EXPECT_EQ(rowFingerprint({{"k", "1"}}), rowFingerprint({{"k", "1"}}));
+  EXPECT_NE(rowFingerprint({{"ab", "c"}}), rowFingerprint({{"a", "bc"}}));
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -99,6 +118,49 @@ TEST_F(ResultsTests, test_deserialize_query_data_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_deserialize_row_binary) {
+  auto results = getSerializedRow();
+  std::string input;
+  auto s = serializeRowBinary(results.second, input);
+  EXPECT_TRUE(s.ok());
+
+  Row output;
+  s = deserializeRowBinary(input, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+
+  // Content stored using JSON is still accepted.
+  serializeRowJSON(results.second, input);
+  output.clear();
+  s = deserializeRowBinary(input, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+
+  // Truncated content is an error.
+  serializeRowBinary(results.second, input);
+  input.resize(input.size() - 1);
+  s = deserializeRowBinary(input, output);
+  EXPECT_FALSE(s.ok());
+}
+
+TEST_F(ResultsTests, test_deserialize_query_data_binary) {
+  auto results = getSerializedQueryDataJSON();
+  std::string input;
+  auto s = serializeQueryDataBinary(results.second, input);
+  EXPECT_TRUE(s.ok());
+
+  QueryData output;
+  s = deserializeQueryDataBinary(input, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+
+  // Content stored using JSON is still accepted.
+  output.clear();
+  s = deserializeQueryDataBinary(results.first, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+}
+
 TEST_F(ResultsTests, test_serialize_diff_results) {
   auto results = getSerializedDiffResults();
   pt::ptree tree;
@@ -135,6 +197,63 @@ TEST_F(ResultsTests, test_serialize_query_log_item_json) {
   EXPECT_EQ(results.first, json);
 }
 
+static std::string writeTree(const pt::ptree& tree) {
+  std::ostringstream output;
+  pt::write_json(output, tree, false);
+  return output.str();
+}
+
+TEST_F(ResultsTests, test_serialize_query_log_item_json_tree) {
+  QueryLogItem item;
+  item.name = "pack/escapes";
+  item.identifier = "host\t\"name\"";
+  item.calendar_time = "Mon Jan  1 00:00:00 2016 UTC";
+  item.time = 1451606400;
+  item.decorations["user"] = "\\root\x01";
+  item.results.added.push_back({{"path", "/tmp/\xe9"}, {"mode", "0644"}});
+  item.results.added.push_back({});
+  item.results.removed.push_back({{"a.b", "dotted"}});
+
+  // The JSON written directly matches the JSON of the tree, including keys
+  // the tree treats as paths.
+  for (const auto& top_level : {false, true}) {
+    FLAGS_decorations_top_level = top_level;
+    pt::ptree tree;
+    EXPECT_TRUE(serializeQueryLogItem(item, tree));
+    std::string json;
+    EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+    EXPECT_EQ(writeTree(tree), json);
+
+    item.results.removed.clear();
+    tree.clear();
+    EXPECT_TRUE(serializeQueryLogItem(item, tree));
+    EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+    EXPECT_EQ(writeTree(tree), json);
+
+    tree.clear();
+    EXPECT_TRUE(serializeQueryLogItemAsEvents(item, tree));
+    std::vector<std::string> events;
+    EXPECT_TRUE(serializeQueryLogItemAsEventsJSON(item, events));
+    ASSERT_EQ(tree.size(), events.size());
+    size_t i = 0;
+    for (const auto& event : tree) {
+      EXPECT_EQ(writeTree(event.second), events[i++]);
+    }
+    item.results.removed.push_back({{"a.b", "dotted"}});
+  }
+  FLAGS_decorations_top_level = false;
+
+  // Snapshots are written the same way.
+  item.results = DiffResults();
+  item.snapshot_results.push_back({{"path", "/"}});
+  item.snapshot_fingerprint = "1234";
+  pt::ptree tree;
+  EXPECT_TRUE(serializeQueryLogItem(item, tree));
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+  EXPECT_EQ(writeTree(tree), json);
+}
+
 TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   auto results = getSerializedQueryLogItemJSON();
 
@@ -146,6 +265,63 @@ TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_query_log_item_columnar) {
+  QueryLogItem item;
+  item.name = "pack/columnar";
+  item.identifier = "host";
+  item.calendar_time = "Mon Jan  1 00:00:00 2016 UTC";
+  item.time = 1451606400;
+  item.results.added.push_back({{"path", "/tmp"}, {"mode", "0644"}});
+  item.results.added.push_back({{"path", "/var"}, {"mode", "0755"}});
+  item.results.removed.push_back({{"a.b", "dotted"}, {"path", "/"}});
+
+  Flag::updateValue("result_encoding", "columnar");
+  EXPECT_TRUE(useColumnarResults());
+  std::string json;
+  auto status = serializeQueryLogItemJSON(item, json);
+  Flag::updateValue("result_encoding", "rows");
+  ASSERT_TRUE(status.ok());
+  EXPECT_FALSE(useColumnarResults());
+
+  // The columns of both lists are written once, before the values.
+  EXPECT_EQ(
+      "{\"diffResults\":{\"columns\":[\"a.b\",\"path\",\"mode\"],"
+      "\"removed\":[[\"dotted\",\"\\/\",\"\"]],"
+      "\"added\":[[\"\",\"\\/tmp\",\"0644\"],"
+      "[\"\",\"\\/var\",\"0755\"]]},"
+      "\"encoding\":\"columnar\",\"name\":\"pack\\/columnar\","
+      "\"hostIdentifier\":\"host\","
+      "\"calendarTime\":\"Mon Jan  1 00:00:00 2016 UTC\","
+      "\"unixTime\":\"1451606400\"}\n",
+      json);
+
+  // Columnar lines are read back with every column of the line.
+  QueryLogItem output;
+  ASSERT_TRUE(deserializeQueryLogItemJSON(json, output).ok());
+  ASSERT_EQ(1U, output.results.removed.size());
+  EXPECT_EQ("", output.results.removed[0]["mode"]);
+  EXPECT_EQ(3U, output.results.removed[0].size());
+  ASSERT_EQ(2U, output.results.added.size());
+  EXPECT_EQ("/var", output.results.added[1]["path"]);
+  EXPECT_EQ(item.name, output.name);
+
+  // Snapshots list their rows.
+  item.results = DiffResults();
+  item.snapshot_results.push_back({{"path", "/"}});
+  Flag::updateValue("result_encoding", "columnar");
+  status = serializeQueryLogItemJSON(item, json);
+  Flag::updateValue("result_encoding", "rows");
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(0U,
+            json.find("{\"snapshot\":{\"columns\":[\"path\"],"
+                      "\"rows\":[[\"\\/\"]]},\"action\":\"snapshot\","
+                      "\"encoding\":\"columnar\","));
+
+  output = QueryLogItem();
+  ASSERT_TRUE(deserializeQueryLogItemJSON(json, output).ok());
+  EXPECT_EQ(item.snapshot_results, output.snapshot_results);
+}
+
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   Row r1, r2, r3;
   r1["foo"] = "bar";
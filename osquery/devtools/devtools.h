@@ -26,6 +26,9 @@ DECLARE_string(A);
 /// The shell may request execution of all queries in a pack immediately.
 DECLARE_string(pack);
 
+/// The shell may run its queries in a running osqueryd.
+DECLARE_string(connect);
+
 /// The shell may need to disable events for fast operations.
 DECLARE_bool(disable_events);
 
@@ -64,6 +67,22 @@ void prettyPrint(const QueryData& results,
                  const std::vector<std::string>& columns,
                  std::map<std::string, size_t>& lengths);
 
+/**
+ * @brief Pretty print the header for a non-empty set of rows
+ *
+ * A shell streaming results prints the header using the lengths of the rows
+ * seen so far, then prints each following row with generateRow.
+ *
+ * @param results The rows used to compute column lengths
+ * @param columns The order of the keys (since maps are unordered)
+ * @param lengths A mutable set of column lengths
+ *
+ * @return The separator string, printed again after the last row
+ */
+std::string prettyPrintHeader(const QueryData& results,
+                              const std::vector<std::string>& columns,
+                              std::map<std::string, size_t>& lengths);
+
 /**
  * @brief JSON print a QueryData object
  *
@@ -74,6 +93,23 @@ void prettyPrint(const QueryData& results,
  */
 void jsonPrint(const QueryData& q);
 
+/**
+ * @brief JSON print a row as an element of a results array
+ *
+ * @param r The row to print
+ * @param first True if this is the first row, which opens the array
+ *
+ * @return true if the row was printed
+ */
+bool jsonPrintRow(const Row& r, bool first);
+
+/**
+ * @brief Close a JSON array of rows printed with jsonPrintRow
+ *
+ * @param empty True if no row was printed, the array is opened first
+ */
+void jsonPrintEnd(bool empty);
+
 /**
  * @brief Compute a map of metadata about the supplied QueryData object
  *
@@ -93,10 +93,9 @@ std::string generateRow(const Row& r,
     } else {
       int buffer_size =
           static_cast<int>(lengths.at(column) - utf8StringSize(r.at(column)));
-      if (buffer_size >= 0) {
-        size = static_cast<size_t>(buffer_size);
-        out += r.at(column);
-      }
+      // A streamed value may be wider than the column, it is not padded.
+      size = (buffer_size > 0) ? static_cast<size_t>(buffer_size) : 0;
+      out += r.at(column);
     }
     out += std::string(size + 1, ' ');
   }
@@ -109,13 +108,9 @@ std::string generateRow(const Row& r,
   return out;
 }
 
-void prettyPrint(const QueryData& results,
-                 const std::vector<std::string>& columns,
-                 std::map<std::string, size_t>& lengths) {
-  if (results.size() == 0) {
-    return;
-  }
-
+std::string prettyPrintHeader(const QueryData& results,
+                              const std::vector<std::string>& columns,
+                              std::map<std::string, size_t>& lengths) {
   // Call a final compute using the column names as minimum lengths.
   computeRowLengths(results.front(), lengths, true);
 
@@ -123,6 +118,17 @@ void prettyPrint(const QueryData& results,
   auto separator = generateToken(lengths, columns);
   auto header = separator + generateHeader(lengths, columns) + separator;
   printf("%s", header.c_str());
+  return separator;
+}
+
+void prettyPrint(const QueryData& results,
+                 const std::vector<std::string>& columns,
+                 std::map<std::string, size_t>& lengths) {
+  if (results.size() == 0) {
+    return;
+  }
+
+  auto separator = prettyPrintHeader(results, columns, lengths);
 
   // Iterate each row and pretty print.
   for (const auto& row : results) {
@@ -131,20 +137,29 @@ void prettyPrint(const QueryData& results,
   printf("%s", separator.c_str());
 }
 
+bool jsonPrintRow(const Row& r, bool first) {
+  std::string row_string;
+  if (!serializeRowJSON(r, row_string).ok()) {
+    return false;
+  }
+
+  row_string.pop_back();
+  printf("%s  %s", (first) ? "[\n" : ",\n", row_string.c_str());
+  return true;
+}
+
+void jsonPrintEnd(bool empty) {
+  printf("%s\n]\n", (empty) ? "[\n" : "");
+}
+
 void jsonPrint(const QueryData& q) {
-  printf("[\n");
-  for (size_t i = 0; i < q.size(); ++i) {
-    std::string row_string;
-
-    if (serializeRowJSON(q[i], row_string).ok()) {
-      row_string.pop_back();
-      printf("  %s", row_string.c_str());
-      if (i < q.size() - 1) {
-        printf(",\n");
-      }
+  bool empty = true;
+  for (const auto& row : q) {
+    if (jsonPrintRow(row, empty)) {
+      empty = false;
     }
   }
-  printf("\n]\n");
+  jsonPrintEnd(empty);
 }
 
 void computeRowLengths(const Row& r,
@@ -16,6 +16,8 @@
 #include <signal.h>
 #include <stdio.h>
 
+#include <chrono>
+
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -33,11 +35,14 @@
 
 #include <osquery/config.h>
 #include <osquery/database.h>
+#include <osquery/extensions.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
+#include <osquery/system.h>
 
 #include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
 #include "osquery/devtools/devtools.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/sql/virtual_table.h"
@@ -55,11 +60,21 @@ namespace osquery {
 /// Define flags used by the shell. They are parsed by the drop-in shell.
 SHELL_FLAG(bool, csv, false, "Set output mode to 'csv'");
 SHELL_FLAG(bool, json, false, "Set output mode to 'json'");
+SHELL_FLAG(bool, jsonl, false, "Set output mode to 'jsonl'");
 SHELL_FLAG(bool, line, false, "Set output mode to 'line'");
 SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, separator, "|", "Set output field separator, default '|'");
 SHELL_FLAG(bool, header, true, "Toggle column headers true/false");
 SHELL_FLAG(string, pack, "", "Run all queries in a pack");
+SHELL_FLAG(uint64,
+           pretty_stream_rows,
+           0,
+           "Stream pretty results using the widths of N rows (0 = buffer all)");
+
+SHELL_FLAG(string,
+           connect,
+           "",
+           "Run queries in the osqueryd serving this extensions socket");
 
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
@@ -92,11 +107,13 @@ static char zHelp[] =
     ".mode MODE       Set output mode where MODE is one of:\n"
     "                   csv      Comma-separated values\n"
     "                   column   Left-aligned columns see .width\n"
+    "                   jsonl    One JSON object per line\n"
     "                   line     One value per line\n"
     "                   list     Values delimited by .separator string\n"
     "                   pretty   Pretty printed SQL results (default)\n"
     ".nullvalue STR   Use STRING in place of NULL values\n"
     ".print STR...    Print literal STRING\n"
+    ".profile ON|OFF  Report each statement's table, SQLite, memory costs\n"
     ".quit            Exit this program\n"
     ".schema [TABLE]  Show the CREATE statements\n"
     ".separator STR   Change separator used by output mode\n"
@@ -116,9 +133,10 @@ static char zTimerHelp[] =
 #define MODE_Semi 3 // Same as MODE_List but append ";" to each line
 #define MODE_Csv 4 // Quote strings, numbers are plain
 #define MODE_Pretty 5 // Pretty print the SQL results
+#define MODE_Jsonl 6 // One JSON object per line
 
 static const char* modeDescr[] = {
-    "line", "column", "list", "semi", "csv", "pretty",
+    "line", "column", "list", "semi", "csv", "pretty", "jsonl",
 };
 
 // ctype macros that work with signed characters
@@ -222,6 +240,103 @@ static void endTimer(void) {
 #define END_TIMER endTimer()
 #define HAS_TIMER 1
 
+// True if each statement's costs are reported after its results
+static int enableProfile = 0;
+
+/*
+** The resources used by a statement, see .profile.
+*/
+struct StatementProfile {
+  osquery::ResourceUsage begin;
+  std::chrono::steady_clock::time_point start;
+
+  // Rows returned by the statement
+  size_t rows{0};
+};
+
+static void beginStatementProfile(StatementProfile& profile) {
+  // Reset SQLite's allocation high-water mark for the statement.
+  int current = 0;
+  int highwater = 0;
+  sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 1);
+  profile.begin = osquery::getResourceUsage();
+  profile.start = std::chrono::steady_clock::now();
+}
+
+/*
+** Format the costs of a statement: the time and rows of each table's
+** generate, the remaining time spent in SQLite with its sorts and scans,
+** and the growth of the process's memory.
+*/
+static std::string endStatementProfile(
+    const StatementProfile& profile,
+    sqlite3_stmt* pStmt,
+    const std::map<std::string, osquery::SpanStats>& spans) {
+  auto end = osquery::getResourceUsage();
+  auto total = std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - profile.start)
+                   .count();
+
+  char line[256];
+  std::string report;
+  snprintf(line,
+           sizeof(line),
+           "Profile: %.3f ms, %zu rows returned\n",
+           total / 1000.0,
+           profile.rows);
+  report += line;
+
+  unsigned long long int generate = 0;
+  for (const auto& span : spans) {
+    if (!boost::starts_with(span.first, "generate:")) {
+      continue;
+    }
+    generate += span.second.total_time;
+    snprintf(line,
+             sizeof(line),
+             "  %-24s %10.3f ms %6zu scans %10zu rows\n",
+             span.first.substr(9).c_str(),
+             span.second.total_time / 1000.0,
+             span.second.calls,
+             span.second.rows);
+    report += line;
+  }
+
+  // SQLite's time is all but the time spent generating rows.
+  auto sqlite = (static_cast<unsigned long long int>(total) > generate)
+                    ? total - generate
+                    : 0;
+  snprintf(line,
+           sizeof(line),
+           "  %-24s %10.3f ms %6d sorts %4d autoindexes %10d scan steps "
+           "%10d VM steps\n",
+           "(sqlite)",
+           sqlite / 1000.0,
+           sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_SORT, 0),
+           sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_AUTOINDEX, 0),
+           sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0),
+           sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_VM_STEP, 0));
+  report += line;
+
+  int current = 0;
+  int highwater = 0;
+  sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+  auto delta = [](unsigned long long int before,
+                  unsigned long long int after) -> long long int {
+    auto kb = static_cast<long long int>(
+        ((after > before) ? after - before : before - after) / 1024);
+    return (after > before) ? kb : -kb;
+  };
+  snprintf(line,
+           sizeof(line),
+           "  Memory: peak RSS %+lld KB, heap %+lld KB, SQLite peak %d KB\n",
+           delta(profile.begin.peak_resident, end.peak_resident),
+           delta(profile.begin.memory, end.memory),
+           highwater / 1024);
+  report += line;
+  return report;
+}
+
 // If the following flag is set, then command execution stops
 // at an error if we are not interactive.
 static int bail_on_error = 0;
@@ -346,6 +461,12 @@ struct prettyprint_data {
   osquery::QueryData results;
   std::vector<std::string> columns;
   std::map<std::string, size_t> lengths;
+
+  /* The separator, once the header of streamed results is printed */
+  std::string separator;
+
+  /* The number of rows printed as JSON so far */
+  size_t printed{0};
 };
 
 /*
@@ -507,6 +628,18 @@ static void interrupt_handler(int signal) {
 ** This is the callback routine that the shell
 ** invokes for each row of a query result.
 */
+static osquery::Row shell_row(int nArg, char** azArg, char** azCol) {
+  osquery::Row r;
+  for (int i = 0; i < nArg; ++i) {
+    if (azCol[i] != nullptr) {
+      r[std::string(azCol[i])] = (azArg[i] == nullptr)
+                                     ? osquery::FLAGS_nullvalue
+                                     : std::string(azArg[i]);
+    }
+  }
+  return r;
+}
+
 static int shell_callback(
     void* pArg, int nArg, char** azArg, char** azCol, int* aiType) {
   int i;
@@ -514,22 +647,51 @@ static int shell_callback(
 
   switch (p->mode) {
   case MODE_Pretty: {
-    if (p->prettyPrint->columns.size() == 0) {
+    auto& pretty = *p->prettyPrint;
+    if (pretty.columns.size() == 0) {
       for (i = 0; i < nArg; i++) {
-        p->prettyPrint->columns.push_back(std::string(azCol[i]));
+        pretty.columns.push_back(std::string(azCol[i]));
       }
     }
 
-    osquery::Row r;
-    for (i = 0; i < nArg; ++i) {
-      if (azCol[i] != nullptr) {
-        r[std::string(azCol[i])] = (azArg[i] == nullptr)
-                                       ? osquery::FLAGS_nullvalue
-                                       : std::string(azArg[i]);
+    auto r = shell_row(nArg, azArg, azCol);
+    if (osquery::FLAGS_json) {
+      // JSON results are printed as they are stepped.
+      if (osquery::jsonPrintRow(r, pretty.printed == 0)) {
+        pretty.printed++;
       }
+      break;
+    }
+
+    if (!pretty.separator.empty()) {
+      // The header is printed, following rows are printed as they are stepped.
+      printf("%s",
+             osquery::generateRow(r, pretty.lengths, pretty.columns).c_str());
+      break;
+    }
+
+    osquery::computeRowLengths(r, pretty.lengths);
+    pretty.results.push_back(std::move(r));
+    if (osquery::FLAGS_pretty_stream_rows > 0 &&
+        pretty.results.size() >= osquery::FLAGS_pretty_stream_rows) {
+      // The buffered rows decide the column widths of the streamed results.
+      pretty.separator = osquery::prettyPrintHeader(
+          pretty.results, pretty.columns, pretty.lengths);
+      for (const auto& row : pretty.results) {
+        printf("%s",
+               osquery::generateRow(row, pretty.lengths, pretty.columns)
+                   .c_str());
+      }
+      osquery::QueryData().swap(pretty.results);
+    }
+    break;
+  }
+  case MODE_Jsonl: {
+    std::string row_string;
+    if (osquery::serializeRowJSON(shell_row(nArg, azArg, azCol), row_string)
+            .ok()) {
+      fprintf(p->out, "%s", row_string.c_str());
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
     break;
   }
   case MODE_Line: {
@@ -760,6 +922,91 @@ static char* save_err_msg(sqlite3* db) {
   return zErrMsg;
 }
 
+/*
+** Print the rows buffered by the pretty output mode.
+*/
+static void shell_print_pretty(struct callback_data* pArg) {
+  auto& pretty = *pArg->prettyPrint;
+  if (osquery::FLAGS_json) {
+    osquery::jsonPrintEnd(pretty.printed == 0);
+  } else if (!pretty.separator.empty()) {
+    printf("%s", pretty.separator.c_str());
+  } else {
+    osquery::prettyPrint(pretty.results, pretty.columns, pretty.lengths);
+  }
+  pretty.results.clear();
+  pretty.columns.clear();
+  pretty.lengths.clear();
+  pretty.separator.clear();
+  pretty.printed = 0;
+}
+
+/*
+** Execute statements in the osqueryd serving the --connect socket.
+**
+** The daemon runs the SQL with its own tables, caches, and events. The
+** statement's columns are read first so rows are printed in column order.
+*/
+static int shell_exec_connected(
+    const char* zSql,
+    int (*xCallback)(void*, int, char**, char**, int*),
+    struct callback_data* pArg,
+    char** pzErrMsg) {
+  if (pzErrMsg) {
+    *pzErrMsg = nullptr;
+  }
+  if (pArg && pArg->echoOn) {
+    fprintf(pArg->out, "%s\n", zSql);
+  }
+
+  osquery::TableColumns columns;
+  osquery::QueryData results;
+  auto status =
+      osquery::getQueryColumnsExternal(osquery::FLAGS_connect, zSql, columns);
+  if (status.ok()) {
+    status = osquery::queryExternal(osquery::FLAGS_connect, zSql, results);
+  }
+  if (!status.ok()) {
+    if (pzErrMsg) {
+      *pzErrMsg = sqlite3_mprintf("%s", status.getMessage().c_str());
+    }
+    return SQLITE_ERROR;
+  }
+
+  int rc = SQLITE_OK;
+  if (xCallback && !results.empty()) {
+    auto nCol = static_cast<int>(columns.size());
+    std::vector<char*> azCols(nCol);
+    std::vector<char*> azVals(nCol);
+    std::vector<int> aiTypes(nCol);
+    for (int i = 0; i < nCol; i++) {
+      azCols[i] = const_cast<char*>(std::get<0>(columns[i]).c_str());
+    }
+
+    for (const auto& row : results) {
+      for (int i = 0; i < nCol; i++) {
+        auto value = row.find(std::get<0>(columns[i]));
+        if (value == row.end()) {
+          azVals[i] = nullptr;
+          aiTypes[i] = SQLITE_NULL;
+        } else {
+          azVals[i] = const_cast<char*>(value->second.c_str());
+          aiTypes[i] = SQLITE_TEXT;
+        }
+      }
+      if (xCallback(pArg, nCol, azVals.data(), azCols.data(), aiTypes.data())) {
+        rc = SQLITE_ABORT;
+        break;
+      }
+    }
+  }
+
+  if (pArg && pArg->mode == MODE_Pretty) {
+    shell_print_pretty(pArg);
+  }
+  return rc;
+}
+
 /*
 ** Execute a statement or set of statements.  Print
 ** any result rows/columns depending on the current mode
@@ -776,6 +1023,10 @@ static int shell_exec(
     struct callback_data* pArg, /* Pointer to struct callback_data */
     char** pzErrMsg /* Error msg written here */
     ) {
+  if (!osquery::FLAGS_connect.empty()) {
+    return shell_exec_connected(zSql, xCallback, pArg, pzErrMsg);
+  }
+
   // Grab a lock on the managed DB instance.
   auto dbc = osquery::SQLiteDBManager::get();
   auto db = dbc->db();
@@ -784,6 +1035,7 @@ static int shell_exec(
   int rc = SQLITE_OK; /* Return Code */
   int rc2;
   const char* zLeftover; /* Tail of unprocessed SQL */
+  std::string profiles; /* Statement costs printed after the results */
 
   if (pzErrMsg) {
     *pzErrMsg = nullptr;
@@ -820,10 +1072,25 @@ static int shell_exec(
         fprintf(pArg->out, "%s\n", zStmtSql ? zStmtSql : zSql);
       }
 
+      /* collect the spans of the statement's table scans if profiling */
+      StatementProfile profile;
+      std::unique_ptr<osquery::QueryTraceScope> trace;
+      if (enableProfile) {
+        trace.reset(new osquery::QueryTraceScope("shell", false));
+        beginStatementProfile(profile);
+      }
+      auto step = [pStmt, &profile]() {
+        int result = sqlite3_step(pStmt);
+        if (result == SQLITE_ROW) {
+          profile.rows++;
+        }
+        return result;
+      };
+
       /* perform the first step.  this will tell us if we
       ** have a result set or not and how wide it is.
       */
-      rc = sqlite3_step(pStmt);
+      rc = step();
       /* if we have a result set... */
       if (SQLITE_ROW == rc) {
         /* if we have a callback... */
@@ -860,7 +1127,7 @@ static int shell_exec(
                 if (xCallback(pArg, nCol, azVals, azCols, aiTypes)) {
                   rc = SQLITE_ABORT;
                 } else {
-                  rc = sqlite3_step(pStmt);
+                  rc = step();
                 }
               }
             } while (SQLITE_ROW == rc);
@@ -868,11 +1135,16 @@ static int shell_exec(
           }
         } else {
           do {
-            rc = sqlite3_step(pStmt);
+            rc = step();
           } while (rc == SQLITE_ROW);
         }
       }
 
+      if (trace != nullptr) {
+        profiles += endStatementProfile(profile, pStmt, trace->spans());
+        trace.reset();
+      }
+
       /* Finalize the statement just executed. If this fails, save a
       ** copy of the error message. Otherwise, set zSql to point to the
       ** next statement to execute. */
@@ -898,16 +1170,11 @@ static int shell_exec(
   dbc->clearAffectedTables();
 
   if (pArg && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
-    } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
-    }
-    pArg->prettyPrint->results.clear();
-    pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
+    shell_print_pretty(pArg);
+  }
+
+  if (!profiles.empty()) {
+    fprintf((pArg) ? pArg->out : stdout, "%s", profiles.c_str());
   }
 
   return rc;
@@ -1309,10 +1576,12 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
     } else if (n2 == 3 && strncmp(azArg[1], "csv", n2) == 0) {
       p->mode = MODE_Csv;
       sqlite3_snprintf(sizeof(p->separator), p->separator, ",");
+    } else if (n2 == 5 && strncmp(azArg[1], "jsonl", n2) == 0) {
+      p->mode = MODE_Jsonl;
     } else {
       fprintf(stderr,
               "Error: mode should be one of: "
-              "column csv line list pretty\n");
+              "column csv jsonl line list pretty\n");
       rc = 1;
     }
   } else if (c == 'n' && strncmp(azArg[0], "nullvalue", n) == 0 && nArg == 2) {
@@ -1330,6 +1599,12 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
       fprintf(p->out, "%s", azArg[j]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    enableProfile = booleanValue(azArg[1]);
+    if (enableProfile && !osquery::FLAGS_connect.empty()) {
+      fprintf(stderr, "Statements run by --connect are not profiled\n");
+    }
   } else if (c == 'q' && strncmp(azArg[0], "quit", n) == 0 && nArg == 1) {
     rc = 2;
   } else if (c == 's' && strncmp(azArg[0], "schema", n) == 0 && nArg < 3) {
@@ -1673,6 +1948,8 @@ int launchIntoShell(int argc, char** argv) {
   } else if (FLAGS_csv) {
     data.mode = MODE_Csv;
     data.separator[0] = ',';
+  } else if (FLAGS_jsonl) {
+    data.mode = MODE_Jsonl;
   } else {
     data.mode = MODE_Pretty;
   }
@@ -1708,8 +1985,14 @@ int launchIntoShell(int argc, char** argv) {
   } else {
     // Run commands received from standard input
     if (stdin_is_interactive) {
-      printf("Using a ");
-      print_bold("virtual database");
+      if (FLAGS_connect.empty()) {
+        printf("Using a ");
+        print_bold("virtual database");
+      } else {
+        printf("Connected to ");
+        print_bold("osqueryd");
+        printf(" at %s", FLAGS_connect.c_str());
+      }
       printf(". Need help, type '.help'\n");
 
       auto history_file =
@@ -95,6 +95,34 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+TEST_F(PrinterTests, test_generate_row_streamed) {
+  // Streamed rows are printed using the lengths of earlier rows.
+  std::map<std::string, size_t> lengths;
+  computeRowLengths(q.front(), lengths);
+
+  auto results = generateRow(q.back(), lengths, order);
+  auto expected = "| Doctor Who | 2000 | fish sticks and custard | 11 |\n";
+  EXPECT_EQ(results, expected);
+}
+
+TEST_F(PrinterTests, test_json_print_rows) {
+  testing::internal::CaptureStdout();
+  jsonPrint(q);
+  auto expected = testing::internal::GetCapturedStdout();
+
+  // Rows printed as they are stepped form the same array.
+  testing::internal::CaptureStdout();
+  for (size_t i = 0; i < q.size(); i++) {
+    EXPECT_TRUE(jsonPrintRow(q[i], i == 0));
+  }
+  jsonPrintEnd(false);
+  EXPECT_EQ(expected, testing::internal::GetCapturedStdout());
+
+  testing::internal::CaptureStdout();
+  jsonPrintEnd(true);
+  EXPECT_EQ("[\n\n]\n", testing::internal::GetCapturedStdout());
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
@@ -0,0 +1,520 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <set>
+#include <sstream>
+
+#ifdef __linux__
+#include <malloc.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/packs.h>
+#include <osquery/registry.h>
+#include <osquery/sql.h>
+#include <osquery/system.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/dispatcher/scheduler.h"
+#include "osquery/logger/plugins/buffered.h"
+#include "osquery/logger/queue.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_bool(disable_logging);
+
+/// Pack replayed by the scheduler benchmarks, relative to the source root.
+const std::string kBenchmarkPack = "packs/osquery-monitoring.conf";
+
+/// Environment variable naming a different pack to replay.
+const std::string kBenchmarkPackEnv = "OSQUERY_BENCHMARK_PACK";
+
+static std::string getBenchmarkPack() {
+  auto pack = getEnvVar(kBenchmarkPackEnv);
+  return (pack.is_initialized()) ? *pack : kBenchmarkPack;
+}
+
+/**
+ * @brief A table returning the recorded results of a pack query.
+ *
+ * Each pack query is executed once against the real tables and its results
+ * are replayed from then on, so measurements do not depend on the host.
+ */
+class ReplayTablePlugin : public TablePlugin {
+ public:
+  ReplayTablePlugin(const ColumnNames& columns, const QueryData& rows)
+      : columns_(columns), rows_(rows) {}
+
+ protected:
+  TableColumns columns() const override {
+    TableColumns columns;
+    for (const auto& column : columns_) {
+      columns.push_back(
+          std::make_tuple(column, TEXT_TYPE, ColumnOptions::DEFAULT));
+    }
+    return columns;
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    return rows_;
+  }
+
+ private:
+  ColumnNames columns_;
+  QueryData rows_;
+};
+
+/// A pack query rewritten to select from its replay table.
+struct ReplayQuery {
+  std::string name;
+  ScheduledQuery query;
+};
+
+/// Record every query in the benchmark pack, once.
+static const std::vector<ReplayQuery>& getReplaySchedule() {
+  static std::vector<ReplayQuery> schedule;
+  static bool recorded = false;
+  if (recorded) {
+    return schedule;
+  }
+  recorded = true;
+
+  pt::ptree tree;
+  try {
+    pt::read_json(getBenchmarkPack(), tree);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return schedule;
+  }
+
+  Pack pack("benchmark", tree);
+  auto tables = RegistryFactory::get().registry("table");
+  for (const auto& scheduled : pack.getSchedule()) {
+    SQL sql(scheduled.second.query);
+
+    // Duplicate result column names collapse into one replay column.
+    ColumnNames columns;
+    std::set<std::string> seen;
+    for (const auto& column : sql.columns()) {
+      if (seen.insert(column).second) {
+        columns.push_back(column);
+      }
+    }
+    if (columns.empty()) {
+      columns.push_back("value");
+    }
+
+    auto table = "replay_" + std::to_string(schedule.size());
+    auto plugin = std::make_shared<ReplayTablePlugin>(columns, sql.rows());
+    tables->add(table, plugin);
+    PluginResponse response;
+    Registry::call("sql", {{"action", "attach"}, {"table", table}}, response);
+
+    ReplayQuery replay;
+    replay.name = "pack_benchmark_" + scheduled.first;
+    replay.query = scheduled.second;
+    replay.query.query = "select * from " + table;
+    schedule.push_back(std::move(replay));
+  }
+  return schedule;
+}
+
+/// Register a benchmark argument for every query in the pack.
+static void genReplayArgs(benchmark::internal::Benchmark* b) {
+  pt::ptree tree;
+  try {
+    pt::read_json(getBenchmarkPack(), tree);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return;
+  }
+
+  auto queries = tree.get_child_optional("queries");
+  for (size_t i = 0; queries.is_initialized() && i < queries->size(); i++) {
+    b->Arg(static_cast<int>(i));
+  }
+}
+
+/// Label a benchmark with the time and heap used by each iteration.
+static void setUsageLabel(benchmark::State& state,
+                          const std::string& name,
+                          const ResourceUsage& r0,
+                          const ResourceUsage& r1) {
+  double iterations = (state.iterations() > 0) ? state.iterations() : 1;
+  auto cpu = (r1.user_time + r1.system_time) - (r0.user_time + r0.system_time);
+  auto wall = r1.wall_time - r0.wall_time;
+  auto memory = (r1.memory > r0.memory) ? r1.memory - r0.memory : 0;
+  state.SetLabel(name + " wall_ms=" + std::to_string(wall / iterations) +
+                 " cpu_ms=" + std::to_string(cpu / iterations) + " heap=" +
+                 std::to_string(memory / iterations));
+}
+
+/// Run one pack query per iteration: SQL, diff, serialize, and log.
+static void SCHEDULER_launch_query(benchmark::State& state) {
+  const auto& schedule = getReplaySchedule();
+  if (static_cast<size_t>(state.range_x()) >= schedule.size()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  const auto& replay = schedule.at(state.range_x());
+  auto logging = FLAGS_disable_logging;
+  FLAGS_disable_logging = false;
+  RegistryFactory::get().setActive("logger", "none");
+
+  auto r0 = getResourceUsage();
+  while (state.KeepRunning()) {
+    launchQuery(replay.name, replay.query);
+  }
+  setUsageLabel(state, replay.name, r0, getResourceUsage());
+  FLAGS_disable_logging = logging;
+}
+
+BENCHMARK(SCHEDULER_launch_query)->Apply(genReplayArgs);
+
+/// Run every pack query per iteration, a tick where the whole pack is due.
+static void SCHEDULER_pack_tick(benchmark::State& state) {
+  const auto& schedule = getReplaySchedule();
+  auto logging = FLAGS_disable_logging;
+  FLAGS_disable_logging = false;
+  RegistryFactory::get().setActive("logger", "none");
+
+  auto r0 = getResourceUsage();
+  while (state.KeepRunning()) {
+    for (const auto& replay : schedule) {
+      launchQuery(replay.name, replay.query);
+    }
+  }
+  setUsageLabel(state, getBenchmarkPack(), r0, getResourceUsage());
+  state.SetItemsProcessed(state.iterations() * schedule.size());
+  FLAGS_disable_logging = logging;
+}
+
+BENCHMARK(SCHEDULER_pack_tick);
+
+/// Environment variable with the seconds a soak runs, the soak is skipped
+/// unless it is set.
+const std::string kSoakSecondsEnv = "OSQUERY_SOAK_SECONDS";
+
+/// Environment variable naming the soak's timeline CSV.
+const std::string kSoakTimelineEnv = "OSQUERY_SOAK_TIMELINE";
+
+/// Events fired into each soak subscriber per simulated second.
+const size_t kSoakEventsPerTick = 50;
+
+/// The soak subscribers buffer this many events, so expiration runs.
+const size_t kSoakEventsMax = 20000;
+
+/// Seconds between samples, shortened for short soaks.
+const size_t kSoakSampleSeconds = 60;
+
+class SoakEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("soak");
+
+ public:
+  void soakFire() {
+    auto ec = createEventContext();
+    fire(ec, 0);
+  }
+};
+
+/// A subscriber adding a process-like row per event.
+class SoakEventSubscriber : public EventSubscriber<SoakEventPublisher> {
+ public:
+  explicit SoakEventSubscriber(const std::string& name) {
+    setName(name);
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    Row r;
+    r["path"] = "/usr/bin/soak";
+    r["cmdline"] = "soak --events --subscriber " + getName();
+    r["pid"] = std::to_string(ec->id);
+    add(r, ec->time);
+    return Status(0, "OK");
+  }
+
+  void soakInit() {
+    subscribe(&SoakEventSubscriber::Callback, createSubscriptionContext());
+  }
+
+  size_t getEventsMax() override {
+    return kSoakEventsMax;
+  }
+
+  /// Select the buffered events, as a scheduled query of the table would.
+  size_t soakSelect() {
+    QueryContext ctx;
+    return genTable(ctx).size();
+  }
+};
+
+/// A buffered forwarder discarding the logs it sends.
+class SoakLogForwarder : public BufferedLogForwarder {
+ public:
+  SoakLogForwarder() : BufferedLogForwarder("soak") {}
+
+  /// Send the buffered logs, until none remain.
+  void flush() {
+    while (check()) {
+    }
+  }
+
+ protected:
+  Status send(std::vector<std::string>& log_data,
+              const std::string& log_type) override {
+    return Status(0, "OK");
+  }
+};
+
+static std::shared_ptr<SoakLogForwarder> getSoakForwarder() {
+  static std::shared_ptr<SoakLogForwarder> forwarder;
+  if (forwarder == nullptr) {
+    forwarder = std::make_shared<SoakLogForwarder>();
+    forwarder->setUp();
+  }
+  return forwarder;
+}
+
+/// A logger buffering results and statuses in the soak forwarder.
+class SoakLoggerPlugin : public LoggerPlugin {
+ public:
+  Status setUp() override {
+    return Status(0);
+  }
+
+  Status logString(const std::string& s) override {
+    return getSoakForwarder()->logString(s);
+  }
+
+  Status logStatus(const std::vector<StatusLogLine>& log) override {
+    return getSoakForwarder()->logStatus(log);
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+};
+
+REGISTER(SoakLoggerPlugin, "logger", "soak");
+
+/// Process memory and resources sampled during a soak.
+struct SoakSample {
+  size_t seconds{0};
+  size_t ticks{0};
+  size_t resident{0};
+
+  /// Heap bytes in use, and free heap bytes the allocator keeps.
+  size_t heap{0};
+  size_t heap_free{0};
+
+  size_t database{0};
+  size_t fds{0};
+};
+
+static SoakSample getSoakSample() {
+  SoakSample sample;
+  sample.heap = getResourceUsage().memory;
+  sample.database = getDatabaseMemoryUsage();
+
+#ifdef __linux__
+  ProcStat stat;
+  if (procReadStat(std::to_string(::getpid()), stat).ok()) {
+    unsigned long int resident = 0;
+    if (safeStrtoul(stat.resident_size, 10, resident).ok()) {
+      sample.resident = static_cast<size_t>(resident);
+    }
+  }
+
+  // Free chunks within the heap measure its fragmentation.
+  auto info = ::mallinfo();
+  sample.heap_free = static_cast<unsigned int>(info.fordblks);
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (::task_info(::mach_task_self(),
+                  MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info),
+                  &count) == KERN_SUCCESS) {
+    sample.resident = info.resident_size;
+  }
+
+  malloc_statistics_t stats;
+  ::malloc_zone_statistics(nullptr, &stats);
+  sample.heap_free = stats.size_allocated - stats.size_in_use;
+#endif
+
+#ifndef WIN32
+#ifdef __linux__
+  const std::string fds = "/proc/self/fd";
+#else
+  const std::string fds = "/dev/fd";
+#endif
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(fds, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    sample.fds++;
+  }
+#endif
+  return sample;
+}
+
+/**
+ * @brief Soak the scheduler, events, and logger, recording a timeline.
+ *
+ * Each tick is a simulated second of osqueryd: the replayed pack queries due
+ * that second are launched and logged through a buffered forwarder, events
+ * are fired into subscribers and selected, and the logs are sent. Ticks run
+ * without sleeping until the seconds of wall time passed.
+ *
+ * Resident, heap, database memory, and open descriptors are sampled and
+ * written as a CSV to the timeline, rewritten with each sample so an
+ * interrupted soak keeps its timeline. Memory that grows across the timeline,
+ * rather than settling, is a leak or fragmentation regression.
+ *
+ * @return a summary of the growth between the first and last samples.
+ */
+static std::string runSoak(size_t seconds, const std::string& timeline) {
+  auto interval = std::max(std::min(kSoakSampleSeconds, seconds / 10),
+                           static_cast<size_t>(1));
+
+  const auto& schedule = getReplaySchedule();
+  RegistryFactory::get().setActive("logger", "soak");
+  auto forwarder = getSoakForwarder();
+
+  auto publisher = std::make_shared<SoakEventPublisher>();
+  EventFactory::registerEventPublisher(publisher);
+  std::vector<std::shared_ptr<SoakEventSubscriber>> subscribers;
+  for (const auto& name : {"soak_processes", "soak_sockets"}) {
+    auto sub = std::make_shared<SoakEventSubscriber>(name);
+    EventFactory::registerEventSubscriber(sub);
+    sub->soakInit();
+    subscribers.push_back(sub);
+  }
+
+  std::stringstream csv;
+  csv << "seconds,ticks,resident_bytes,heap_bytes,heap_free_bytes,"
+         "database_bytes,fds\n";
+  auto record = [&csv, &timeline](const SoakSample& sample) {
+    csv << sample.seconds << "," << sample.ticks << "," << sample.resident
+        << "," << sample.heap << "," << sample.heap_free << ","
+        << sample.database << "," << sample.fds << "\n";
+    writeTextFile(timeline, csv.str(), 0644);
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  auto first = getSoakSample();
+  record(first);
+  auto last = first;
+
+  size_t tick = 0;
+  while (true) {
+    auto elapsed = static_cast<size_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    if (elapsed >= last.seconds + interval || elapsed >= seconds) {
+      last = getSoakSample();
+      last.seconds = elapsed;
+      last.ticks = tick;
+      record(last);
+    }
+    if (elapsed >= seconds) {
+      break;
+    }
+
+    tick++;
+    for (const auto& replay : schedule) {
+      if (replay.query.interval > 0 && tick % replay.query.interval == 0) {
+        launchQuery(replay.name, replay.query);
+      }
+    }
+
+    for (size_t i = 0; i < kSoakEventsPerTick; i++) {
+      publisher->soakFire();
+    }
+    if (tick % 60 == 0) {
+      for (const auto& sub : subscribers) {
+        sub->soakSelect();
+      }
+    }
+
+    flushLoggerQueues();
+    forwarder->flush();
+  }
+
+  for (const auto& sub : subscribers) {
+    EventFactory::deregisterEventSubscriber(sub->getName());
+  }
+  EventFactory::deregisterEventPublisher(publisher->type());
+
+  auto growth = [](size_t from, size_t to) {
+    return std::to_string(static_cast<long long>(to) -
+                          static_cast<long long>(from));
+  };
+  return "ticks=" + std::to_string(tick) + " resident_growth=" +
+         growth(first.resident, last.resident) + " heap_growth=" +
+         growth(first.heap, last.heap) + " fd_growth=" +
+         growth(first.fds, last.fds) + " timeline=" + timeline;
+}
+
+/// Run a soak of OSQUERY_SOAK_SECONDS, writing OSQUERY_SOAK_TIMELINE.
+static void SCHEDULER_soak(benchmark::State& state) {
+  auto seconds_env = getEnvVar(kSoakSecondsEnv);
+  unsigned long int seconds = 0;
+  if (!seconds_env.is_initialized() ||
+      !safeStrtoul(*seconds_env, 10, seconds).ok() || seconds == 0) {
+    while (state.KeepRunning()) {
+    }
+    state.SetLabel("set " + kSoakSecondsEnv + " to soak");
+    return;
+  }
+
+  auto timeline_env = getEnvVar(kSoakTimelineEnv);
+  auto timeline = (timeline_env.is_initialized())
+                      ? *timeline_env
+                      : kTestWorkingDirectory + "soak_timeline.csv";
+
+  auto logging = FLAGS_disable_logging;
+  FLAGS_disable_logging = false;
+  // The first iteration takes the soak's duration, so it is the only one.
+  std::string label;
+  while (state.KeepRunning()) {
+    if (label.empty()) {
+      label = runSoak(seconds, timeline);
+    }
+  }
+  state.SetLabel(label);
+  FLAGS_disable_logging = logging;
+}
+
+BENCHMARK(SCHEDULER_soak);
+}
@@ -8,7 +8,9 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
 
 #include <osquery/dispatcher.h>
 #include <osquery/flags.h>
@@ -22,6 +24,25 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+/// The index of the executor worker running on this thread.
+static thread_local size_t kTaskWorker = std::numeric_limits<size_t>::max();
+
+/// How long a waiting thread sleeps before looking for queued tasks again.
+const std::chrono::milliseconds kTaskWaitInterval(10);
+
+struct TaskGroup::State {
+  /// Tasks queued or running.
+  size_t pending{0};
+
+  std::atomic<bool> cancelled{false};
+
+  /// Ends the pauses of the group's tasks when it is cancelled.
+  RunnerInterruptPoint point;
+
+  std::mutex mutex;
+  std::condition_variable done;
+};
+
 /// Cancel the pause request.
 void RunnerInterruptPoint::cancel() {
   std::unique_lock<std::mutex> lock(mutex_);
@@ -155,4 +176,281 @@ void Dispatcher::stopServices() {
     DLOG(INFO) << "Service: " << service.get() << " has been interrupted";
   }
 }
+
+TaskGroup::TaskGroup(TaskPriority priority)
+    : state_(std::make_shared<State>()), priority_(priority) {}
+
+TaskGroup::~TaskGroup() {
+  wait();
+}
+
+void TaskGroup::run(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->pending++;
+  }
+
+  TaskExecutor::Task queued;
+  queued.group = state_;
+  queued.function = std::move(task);
+  queued.priority = priority_;
+  TaskExecutor::instance().submit(std::move(queued));
+}
+
+void TaskGroup::wait() {
+  auto& executor = TaskExecutor::instance();
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->pending == 0) {
+        return;
+      }
+    }
+
+    // Run the group's queued tasks instead of idling. Tasks of other groups
+    // are not run, the caller may hold locks those tasks need, and they would
+    // be accounted to the caller's query.
+    TaskExecutor::Task task;
+    if (executor.take(task, state_)) {
+      executor.execute(task);
+      continue;
+    }
+
+    // The remaining tasks are running, or were queued after the last look.
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->done.wait_for(
+        lock, kTaskWaitInterval, [this]() { return state_->pending == 0; });
+  }
+}
+
+void TaskGroup::cancel() {
+  state_->cancelled = true;
+  state_->point.cancel();
+}
+
+bool TaskGroup::cancelled() const {
+  return state_->cancelled;
+}
+
+void TaskGroup::pause(std::chrono::milliseconds milli) {
+  if (cancelled()) {
+    return;
+  }
+
+  try {
+    state_->point.pause(milli);
+  } catch (const RunnerInterruptError&) {
+    // The group was cancelled.
+  }
+}
+
+TaskExecutor::~TaskExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  reserved_ready_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+size_t TaskExecutor::workerCount() {
+  start();
+  return threads_.size() - 1;
+}
+
+void TaskExecutor::start() {
+  std::call_once(started_, [this]() {
+    // The last worker is reserved for INTERACTIVE tasks.
+    auto workers = static_cast<size_t>(std::max(FLAGS_worker_threads, 1)) + 1;
+    for (size_t i = 0; i < workers; i++) {
+      local_.push_back(std::make_unique<TaskQueue>());
+    }
+    for (size_t i = 0; i < workers; i++) {
+      threads_.emplace_back(&TaskExecutor::work, this, i);
+    }
+  });
+}
+
+void TaskExecutor::submit(Task task) {
+  start();
+
+  // A worker's HIGH priority tasks are parts of the task it is running.
+  bool local = (task.priority == TaskPriority::HIGH &&
+                kTaskWorker < local_.size());
+  auto& queue = (local) ? *local_[kTaskWorker]
+                        : global_[static_cast<size_t>(task.priority)];
+  // Count the task first, workers look for it until it is queued.
+  auto interactive = (task.priority == TaskPriority::INTERACTIVE);
+  queued_++;
+  if (interactive) {
+    interactive_++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  {
+    // Do not notify between a worker's check for tasks and its wait.
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  ready_.notify_one();
+  if (interactive) {
+    reserved_ready_.notify_one();
+  }
+}
+
+bool TaskExecutor::take(Task& task, TaskPriority priority) {
+  auto pop = [this, &task](TaskQueue& queue, bool newest) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+
+    if (newest) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued_--;
+    if (task.priority == TaskPriority::INTERACTIVE) {
+      interactive_--;
+    }
+    return true;
+  };
+
+  if (queued_ == 0) {
+    return false;
+  }
+
+  // A worker runs its own tasks first, then steals from other workers.
+  auto workers = local_.size();
+  auto self = (kTaskWorker < workers) ? kTaskWorker : 0;
+  if (kTaskWorker < workers && pop(*local_[self], true)) {
+    return true;
+  }
+  // Callers of INTERACTIVE tasks only, such as the reserved worker, do not
+  // steal the HIGH priority parts of other tasks.
+  for (size_t i = 1; priority <= TaskPriority::HIGH && i <= workers; i++) {
+    auto victim = (self + i) % workers;
+    if (victim != kTaskWorker && pop(*local_[victim], false)) {
+      return true;
+    }
+  }
+
+  for (auto level = static_cast<int>(TaskPriority::INTERACTIVE);
+       level >= static_cast<int>(priority);
+       level--) {
+    if (pop(global_[level], false)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TaskExecutor::take(Task& task,
+                        const std::shared_ptr<TaskGroup::State>& group) {
+  auto pop = [this, &task, &group](TaskQueue& queue, bool newest) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    auto matches = [&group](const Task& queued) {
+      return queued.group == group;
+    };
+    std::deque<Task>::iterator it;
+    if (newest) {
+      auto last =
+          std::find_if(queue.tasks.rbegin(), queue.tasks.rend(), matches);
+      if (last == queue.tasks.rend()) {
+        return false;
+      }
+      it = std::next(last).base();
+    } else {
+      it = std::find_if(queue.tasks.begin(), queue.tasks.end(), matches);
+      if (it == queue.tasks.end()) {
+        return false;
+      }
+    }
+
+    task = std::move(*it);
+    queue.tasks.erase(it);
+    queued_--;
+    if (task.priority == TaskPriority::INTERACTIVE) {
+      interactive_--;
+    }
+    return true;
+  };
+
+  if (queued_ == 0) {
+    return false;
+  }
+
+  // The group's tasks are in the queue of the worker that queued them, or
+  // in the global queue of the group's priority.
+  auto workers = local_.size();
+  auto self = (kTaskWorker < workers) ? kTaskWorker : 0;
+  if (kTaskWorker < workers && pop(*local_[self], true)) {
+    return true;
+  }
+  for (size_t i = 1; i <= workers; i++) {
+    auto victim = (self + i) % workers;
+    if (victim != kTaskWorker && pop(*local_[victim], false)) {
+      return true;
+    }
+  }
+  for (auto& queue : global_) {
+    if (pop(queue, false)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskExecutor::execute(Task& task) {
+  if (!task.group->cancelled) {
+    try {
+      task.function();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Task failed: " << e.what();
+    } catch (...) {
+      LOG(ERROR) << "Task failed with an unknown exception";
+    }
+  }
+
+  // The group may be destroyed once the task is complete.
+  auto group = std::move(task.group);
+  task.function = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->pending--;
+  }
+  group->done.notify_all();
+}
+
+void TaskExecutor::work(size_t index) {
+  kTaskWorker = index;
+  auto reserved = (index + 1 == local_.size());
+  auto priority = (reserved) ? TaskPriority::INTERACTIVE : TaskPriority::LOW;
+  while (true) {
+    Task task;
+    if (take(task, priority)) {
+      execute(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (reserved) {
+      reserved_ready_.wait(
+          lock, [this]() { return stopping_ || interactive_ > 0; });
+    } else {
+      ready_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+    }
+    if (stopping_) {
+      return;
+    }
+  }
+}
 }
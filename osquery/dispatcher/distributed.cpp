@@ -8,6 +8,8 @@
  *
  */
 
+#include <chrono>
+
 #include <osquery/database.h>
 #include <osquery/distributed.h>
 #include <osquery/flags.h>
@@ -23,19 +25,40 @@ FLAG(uint64,
      60,
      "Seconds between polling for new queries (default 60)")
 
+FLAG(uint64,
+     distributed_long_poll,
+     0,
+     "Seconds the server may hold a distributed read open until it has "
+     "queries, reads are sent continuously (0 = disabled)");
+
 DECLARE_bool(disable_distributed);
 DECLARE_string(distributed_plugin);
 
 const size_t kDistributedAccelerationInterval = 5;
 
+/// The shortest long-poll read, a server answering sooner does not hold reads.
+const std::chrono::seconds kDistributedLongPollMin(1);
+
 void DistributedRunner::start() {
-  auto dist = Distributed();
+  Distributed dist;
   while (!interrupted()) {
-    dist.pullUpdates();
-    if (dist.getPendingQueryCount() > 0) {
+    auto wait = static_cast<size_t>(FLAGS_distributed_long_poll);
+    auto started = std::chrono::steady_clock::now();
+    dist.pullUpdates(wait);
+    bool work =
+        dist.getPendingQueryCount() > 0 || dist.getCompletedCount() > 0;
+    if (work) {
       dist.runQueries();
     }
 
+    // The next long-poll read is sent as soon as the last returns. If the
+    // server answered without work and without holding the read, it may not
+    // support long-polling, so wait for the interval instead.
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    if (wait > 0 && (work || elapsed >= kDistributedLongPollMin)) {
+      continue;
+    }
+
     std::string str_acu = "0";
     Status database = getDatabaseValue(
         kPersistentSettings, "distributed_accelerate_checkins_expire", str_acu);
@@ -8,7 +8,17 @@
  *
  */
 
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <deque>
+#include <limits>
+#include <set>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
@@ -18,10 +28,16 @@
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
-#include "osquery/core/process.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
+#include "osquery/core/watcher.h"
 #include "osquery/database/query.h"
 #include "osquery/dispatcher/scheduler.h"
+#include "osquery/sql/materialized_view.h"
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
@@ -39,50 +55,221 @@ HIDDEN_FLAG(bool,
             false,
             "Reload the SQL implementation during schedule reload");
 
+FLAG(bool,
+     schedule_share_scans,
+     true,
+     "Share table scans between queries scheduled in the same second");
+
+FLAG(bool,
+     schedule_dedup_queries,
+     true,
+     "Execute identical scheduled queries due in the same step once");
+
+FLAG(uint64,
+     schedule_workers,
+     0,
+     "Threads used to run due scheduled queries concurrently (0 = serial)");
+
+FLAG(uint64,
+     snapshot_max_age,
+     86400,
+     "Seconds an unchanged incremental snapshot may go without a full log");
+
+FLAG(uint64,
+     schedule_trim_memory,
+     1024 * 1024,
+     "Release free heap after a query with more result bytes (0 = never)");
+
+FLAG(bool,
+     schedule_perf_counters,
+     false,
+     "Count cycles, instructions and cache misses of scheduled queries");
+
+FLAG(bool,
+     schedule_catch_up,
+     false,
+     "Run each step missed while queries overran, instead of skipping them");
+
+FLAG(uint64,
+     schedule_wall_limit,
+     0,
+     "Milliseconds of wall time before a scheduled query is aborted "
+     "(0 = none)");
+
+FLAG(uint64,
+     schedule_cpu_limit,
+     0,
+     "Milliseconds of CPU time before a scheduled query is aborted "
+     "(0 = none)");
+
 /// Used to bypass (optimize-out) the set-differential of query results.
 DECLARE_bool(events_optimize);
 
+DECLARE_bool(schedule_packing);
+DECLARE_uint64(pack_refresh_interval);
+
+/// Number of steps over which schedule packing spreads query costs.
+const size_t kSchedulePackingSteps = 3600;
+
+/// The most missed steps a schedule may run to catch up.
+const size_t kScheduleMaxCatchUp = 60;
+
+/// The most worker threads a schedule may use.
+const size_t kMaxScheduleWorkers = 16;
+
+/// The schedule's worker thread count, 1 or fewer runs queries serially.
+static size_t getScheduleWorkers() {
+  auto workers = std::min(static_cast<size_t>(FLAGS_schedule_workers),
+                          kMaxScheduleWorkers);
+  if (workers > 1 && !FLAGS_disable_watchdog && FLAGS_watchdog_level >= 0) {
+    // The watchdog's utilization limit is a percentage of a single CPU.
+    // Do not run more concurrent queries than the CPUs it allows.
+    auto cpus = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT) / 100;
+    workers = std::min(workers, std::max(cpus, static_cast<size_t>(1)));
+  }
+  return workers;
+}
+
+/// The expected byte output of results, the size of every name and value.
+static size_t getResultsSize(const QueryData& rows) {
+  size_t size = 0;
+  for (const auto& row : rows) {
+    for (const auto& column : row) {
+      size += column.first.size();
+      size += column.second.size();
+    }
+  }
+  return size;
+}
+
+/**
+ * @brief Release the heap used by a scheduled query's results once it ends.
+ *
+ * Results are copied, escaped, diffed and serialized as many small strings.
+ * After a large result the allocator is asked to return the freed pages, so
+ * a long-running worker's memory does not creep toward the watchdog limit.
+ */
+class QueryMemoryScope : private boost::noncopyable {
+ public:
+  ~QueryMemoryScope() {
+    if (FLAGS_schedule_trim_memory > 0 &&
+        size_ >= FLAGS_schedule_trim_memory) {
+      releaseHeapMemory();
+    }
+  }
+
+  /// Record the size of the query's results.
+  void setResults(const QueryData& rows) {
+    if (FLAGS_schedule_trim_memory > 0) {
+      size_ = getResultsSize(rows);
+    }
+  }
+
+ private:
+  size_t size_{0};
+};
+
+/// Run a scheduled query, optionally sharing scans with the current tick.
+SQLInternal runScheduledQuery(const std::string& name,
+                              const ScheduledQuery& query) {
+  // Scheduled queries yield to distributed queries between tables.
+  SQLQueryPriority priority(SQLQueryPriority::LOW);
+
+  // A query over its time limits is interrupted, the worker keeps running.
+  auto wall = (query.wall_limit > 0) ? query.wall_limit
+                                     : FLAGS_schedule_wall_limit;
+  auto cpu =
+      (query.cpu_limit > 0) ? query.cpu_limit : FLAGS_schedule_cpu_limit;
+  SQLQueryLimit limit(std::chrono::milliseconds(wall),
+                      nullptr,
+                      std::chrono::milliseconds(cpu));
+
+  auto sql = [&name, &query]() {
+    // Shared scans are scoped to a single thread, see SharedScanScope.
+    if (!FLAGS_schedule_share_scans || getScheduleWorkers() > 1) {
+      return SQLInternal(query.query);
+    }
+
+    SharedScanScope scope;
+    SQLInternal shared(query.query);
+    Config::getInstance().recordQuerySharedScans(
+        name, scope.hits(), scope.misses());
+    return shared;
+  }();
+
+  // A query that completed returned every row, even if its limit expired.
+  if (!sql.ok() && limit.interrupted()) {
+    LOG(WARNING) << "Scheduled query " << name
+                 << " exceeded its time limit and was aborted";
+    Config::getInstance().recordQueryAborted(name);
+  }
+  return sql;
+}
+
 SQLInternal monitor(const std::string& name, const ScheduledQuery& query) {
-  // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  auto t0 = getUnixTime();
+  // Sample the thread's resource usage before running.
   Config::getInstance().recordQueryStart(name);
-  SQLInternal sql(query.query);
-  // Snapshot the performance after, and compare.
-  auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    // Calculate a size as the expected byte output of results.
-    // This does not dedup result differentials and is not aware of snapshots.
-    size_t size = 0;
-    for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
-    }
-    // Always called while processes table is working.
-    Config::getInstance().recordQueryPerformance(
-        name, t1 - t0, size, r0[0], r1[0]);
+  auto r0 = getResourceUsage();
+  if (FLAGS_schedule_perf_counters) {
+    getPerfCounters(r0);
+  }
+  auto sql = runScheduledQuery(name, query);
+  // Sample again after, and compare.
+  auto r1 = getResourceUsage();
+  if (FLAGS_schedule_perf_counters) {
+    getPerfCounters(r1);
   }
+
+  // Calculate a size as the expected byte output of results.
+  // This does not dedup result differentials and is not aware of snapshots.
+  auto size = getResultsSize(sql.rows());
+  Config::getInstance().recordQueryPerformance(name, size, r0, r1);
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
-  // Execute the scheduled query and create a named query object.
-  LOG(INFO) << "Executing scheduled query " << name << ": " << query.query;
-  runDecorators(DECORATE_ALWAYS);
+std::string normalizeScheduledQuery(const std::string& query) {
+  std::string normalized;
+  normalized.reserve(query.size());
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote == 0 && std::isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      continue;
+    }
+    if (space && !normalized.empty()) {
+      normalized += ' ';
+    }
+    space = false;
+
+    if (quote != 0) {
+      // A doubled quote escapes itself, and is seen as leaving and entering.
+      quote = (c == quote) ? 0 : quote;
+    } else if (c == '\'' || c == '"' || c == '`') {
+      quote = c;
+    } else if (c == '[') {
+      quote = ']';
+    }
+    normalized += c;
+  }
 
-  auto sql =
-      (FLAGS_enable_monitor) ? monitor(name, query) : SQLInternal(query.query);
+  while (!normalized.empty() &&
+         (normalized.back() == ';' || normalized.back() == ' ')) {
+    normalized.pop_back();
+  }
+  return normalized;
+}
 
-  if (!sql.ok()) {
-    LOG(ERROR) << "Error executing scheduled query " << name << ": "
-               << sql.getMessageString();
-    return;
+/// The results of an execution, given to an identical query in the step.
+class ReusedResults : public SQL {
+ public:
+  explicit ReusedResults(const QueryData& rows) {
+    results_ = rows;
   }
+};
 
+/// Create the log item of a scheduled query's execution.
+static QueryLogItem getQueryLogItem(const std::string& name) {
   // Fill in a host identifier fields based on configuration or availability.
   std::string ident = getHostIdentifier();
 
@@ -94,11 +281,69 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   item.time = osquery::getUnixTime();
   item.calendar_time = osquery::getAsciiTime();
   getDecorations(item.decorations);
+  return item;
+}
+
+/// Log the differential results of a scheduled query, if there are any.
+static void logDifferential(const std::string& name,
+                            const ScheduledQuery& query,
+                            QueryLogItem& item,
+                            DiffResults& diff_results) {
+  if (diff_results.added.empty() && diff_results.removed.empty()) {
+    // No diff results or events to emit.
+    return;
+  }
+
+  VLOG(1) << "Found results for query: " << name;
+  item.results = std::move(diff_results);
+  if (query.options.count("removed") && !query.options.at("removed")) {
+    item.results.removed.clear();
+  }
+
+  Status status;
+  {
+    TraceSpan log("log");
+    status = logQueryLogItem(item);
+  }
+  if (!status.ok()) {
+    // If log directory is not available, then the daemon shouldn't continue.
+    std::string error = "Error logging the results of query: " + name + ": " +
+                        status.toString();
+    LOG(ERROR) << error;
+    Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
+  }
+}
+
+/// Diff and log the results of a scheduled query's execution.
+static void logScheduledResults(const std::string& name,
+                                const ScheduledQuery& query,
+                                SQL& sql,
+                                bool event_based) {
+  auto item = getQueryLogItem(name);
 
   if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
-    item.snapshot_results = std::move(sql.rows());
-    logSnapshotQuery(item);
+    auto dbQuery = Query(name, query);
+    bool incremental =
+        query.options.count("incremental") && query.options.at("incremental");
+    if (incremental) {
+      // Unchanged results are logged as a reference to the last full snapshot.
+      item.snapshot_unchanged = !dbQuery.checkSnapshotResults(
+          sql.rows(), FLAGS_snapshot_max_age, item.snapshot_fingerprint);
+    }
+    if (!item.snapshot_unchanged) {
+      item.snapshot_results = std::move(sql.rows());
+    }
+
+    Status status;
+    {
+      TraceSpan log("log");
+      status = logSnapshotQuery(item);
+    }
+    // A reference is only valid to a snapshot that was logged.
+    if (status.ok() && incremental && !item.snapshot_unchanged) {
+      dbQuery.setSnapshotLogged(item.snapshot_fingerprint);
+    }
     return;
   }
 
@@ -112,7 +357,8 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   // Add this execution's set of results to the database-tracked named query.
   // We can then ask for a differential from the last time this named query
   // was executed by exact matching each row.
-  if (!FLAGS_events_optimize || !sql.eventBased()) {
+  if (!FLAGS_events_optimize || !event_based) {
+    TraceSpan diff("diff");
     status = dbQuery.addNewResults(sql.rows(), diff_results);
     if (!status.ok()) {
       std::string line =
@@ -125,56 +371,608 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   } else {
     diff_results.added = std::move(sql.rows());
   }
+  logDifferential(name, query, item, diff_results);
+}
 
-  if (diff_results.added.empty() && diff_results.removed.empty()) {
-    // No diff results or events to emit.
-    return;
+bool parseContinuousQuery(const std::string& query,
+                          std::string& table,
+                          std::vector<std::string>& columns) {
+  auto normalized = boost::to_lower_copy(normalizeScheduledQuery(query));
+  auto isIdentifier = [](const std::string& name) {
+    return !name.empty() &&
+           std::all_of(name.begin(), name.end(), [](const char c) {
+             return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+           });
+  };
+
+  const std::string kSelect = "select ";
+  const std::string kFrom = " from ";
+  auto from = normalized.find(kFrom);
+  if (normalized.compare(0, kSelect.size(), kSelect) != 0 ||
+      from == std::string::npos) {
+    return false;
   }
 
-  VLOG(1) << "Found results for query: " << name;
-  item.results = diff_results;
-  if (query.options.count("removed") && !query.options.at("removed")) {
-    item.results.removed.clear();
+  table = normalized.substr(from + kFrom.size());
+  columns.clear();
+  for (const auto& column : split(
+           normalized.substr(kSelect.size(), from - kSelect.size()), ",")) {
+    if (!isIdentifier(column)) {
+      return false;
+    }
+    columns.push_back(column);
+  }
+  return isIdentifier(table) && !columns.empty();
+}
+
+/**
+ * @brief Log the changes of a continuous query's materialized view.
+ *
+ * @return false if the query cannot be read from a view, and must execute.
+ */
+static bool launchContinuousQuery(const std::string& name,
+                                  const ScheduledQuery& query) {
+  std::string table;
+  std::vector<std::string> columns;
+  if (!parseContinuousQuery(query.query, table, columns)) {
+    VLOG(1) << "Continuous query " << name
+            << " must select columns from a single table";
+    return false;
+  }
+
+  LOG(INFO) << "Reading continuous scheduled query " << name << ": "
+            << query.query;
+  runDecorators(DECORATE_ALWAYS, TablePlugin::kCacheStep);
+  QueryTraceScope trace(name);
+  ProfileLabel label(ProfileLabel::QUERY, name);
+  TraceSpan span("query");
+
+  DiffResults diff_results;
+  Status status;
+  {
+    TraceSpan execute("execute");
+    if (FLAGS_enable_monitor) {
+      Config::getInstance().recordQueryStart(name);
+    }
+    auto r0 = getResourceUsage();
+    status = getMaterializedDelta(name, table, columns, diff_results);
+    auto r1 = getResourceUsage();
+    if (FLAGS_enable_monitor) {
+      auto size = getResultsSize(diff_results.added) +
+                  getResultsSize(diff_results.removed);
+      Config::getInstance().recordQueryPerformance(name, size, r0, r1);
+    }
   }
 
-  status = logQueryLogItem(item);
   if (!status.ok()) {
-    // If log directory is not available, then the daemon shouldn't continue.
-    std::string error = "Error logging the results of query: " + name + ": " +
-                        status.toString();
-    LOG(ERROR) << error;
-    Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
+    VLOG(1) << "Cannot read continuous query " << name << ": "
+            << status.getMessage();
+    return false;
   }
+
+  auto item = getQueryLogItem(name);
+  logDifferential(name, query, item, diff_results);
+  return true;
+}
+
+void launchQueries(const ScheduledGroup& queries) {
+  if (queries.empty()) {
+    return;
+  }
+
+  // Continuous differentials are read from their table's view.
+  const auto& options = queries.front().second.options;
+  if (queries.size() == 1 && options.count("continuous") > 0 &&
+      options.at("continuous") &&
+      !(options.count("snapshot") > 0 && options.at("snapshot")) &&
+      launchContinuousQuery(queries.front().first, queries.front().second)) {
+    return;
+  }
+
+  // Declared first, the results are freed before the heap is released.
+  QueryMemoryScope memory;
+  const auto& first = queries.front().first;
+  QueryData shared;
+  bool reuse = false;
+  {
+    const auto& name = first;
+    const auto& query = queries.front().second;
+    // Execute the scheduled query and create a named query object.
+    LOG(INFO) << "Executing scheduled query " << name << ": " << query.query;
+    // Decorations may be reused within the step, see --decorations_per_step.
+    runDecorators(DECORATE_ALWAYS, TablePlugin::kCacheStep);
+
+    // Spans within this execution are added to the query's profile.
+    QueryTraceScope trace(name);
+    ProfileLabel label(ProfileLabel::QUERY, name);
+    TraceSpan span("query");
+    auto sql = [&name, &query]() {
+      TraceSpan execute("execute");
+      return (FLAGS_enable_monitor) ? monitor(name, query)
+                                    : runScheduledQuery(name, query);
+    }();
+
+    if (!sql.ok()) {
+      for (const auto& item : queries) {
+        LOG(ERROR) << "Error executing scheduled query " << item.first << ": "
+                   << sql.getMessageString();
+      }
+      return;
+    }
+    memory.setResults(sql.rows());
+
+    // Event-based tables return the events since the executing query's last
+    // execution, so their results belong to that query alone.
+    reuse = (queries.size() > 1 && !sql.eventBased());
+    if (reuse) {
+      shared = sql.rows();
+    }
+    logScheduledResults(name, query, sql, sql.eventBased());
+  }
+
+  for (size_t i = 1; i < queries.size(); i++) {
+    const auto& name = queries[i].first;
+    if (!reuse) {
+      launchQuery(name, queries[i].second);
+      continue;
+    }
+
+    VLOG(1) << "Reusing the results of scheduled query " << first
+            << " for identical query " << name;
+    Config::getInstance().recordQueryDeduplicated(name);
+    QueryTraceScope trace(name);
+    ProfileLabel label(ProfileLabel::QUERY, name);
+    TraceSpan span("query");
+    ReusedResults sql(shared);
+    logScheduledResults(name, queries[i].second, sql, false);
+  }
+}
+
+void launchQuery(const std::string& name, const ScheduledQuery& query) {
+  launchQueries({std::make_pair(name, query)});
+}
+
+/**
+ * @brief Run due scheduled queries on a bounded number of executor workers.
+ *
+ * An execution of a query is not started while an earlier execution of the
+ * same query is queued or running.
+ */
+class ScheduleWorkers : private boost::noncopyable {
+ public:
+  explicit ScheduleWorkers(size_t threads) : threads_(threads) {}
+
+  ~ScheduleWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.clear();
+    }
+    group_.cancel();
+    group_.wait();
+  }
+
+  /// Queue queries sharing an execution, skipping those already pending.
+  void launch(ScheduledGroup queries) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = queries.begin();
+      while (it != queries.end()) {
+        if (pending_.insert(it->first).second) {
+          ++it;
+          continue;
+        }
+        VLOG(1) << "Skipping scheduled query " << it->first
+                << ": the previous execution has not finished";
+        it = queries.erase(it);
+      }
+      if (queries.empty()) {
+        return;
+      }
+      queue_.push_back(std::move(queries));
+      if (running_ >= threads_) {
+        return;
+      }
+      running_++;
+    }
+    group_.run([this]() { work(); });
+  }
+
+  /// Wait until every queued and running query finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return pending_.empty(); });
+  }
+
+ private:
+  /// Run queued queries until the queue is empty.
+  void work() {
+    while (true) {
+      ScheduledGroup item;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty() || group_.cancelled()) {
+          running_--;
+          return;
+        }
+        item = std::move(queue_.front());
+        queue_.pop_front();
+      }
+
+      // The worker is shared, other tasks do not use the query's interval.
+      TablePlugin::kCacheInterval = item.front().second.splayed_interval;
+      launchQueries(item);
+      TablePlugin::kCacheInterval = 0;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& query : item) {
+          pending_.erase(query.first);
+        }
+      }
+      idle_.notify_all();
+    }
+  }
+
+ private:
+  /// The most queries running at once.
+  size_t threads_{0};
+
+  /// The number of executor tasks running queued queries.
+  size_t running_{0};
+
+  /// Queries waiting for a worker.
+  std::deque<ScheduledGroup> queue_;
+
+  /// Names of queued or running queries.
+  std::set<std::string> pending_;
+
+  std::mutex mutex_;
+  std::condition_variable idle_;
+
+  /// Declared last, its tasks complete before the state they use is gone.
+  TaskGroup group_;
+};
+
+/// Check if a step interval elapsed in the steps after last, up to i.
+inline bool isStepDue(size_t interval,
+                      size_t last,
+                      size_t i,
+                      size_t offset = 0) {
+  return interval > 0 &&
+         ((i - offset) / interval) > ((last - offset) / interval);
+}
+
+void packScheduleOffsets(
+    const std::map<std::string, std::pair<size_t, size_t>>& queries,
+    std::map<std::string, size_t>& offsets) {
+  using PackedQuery = std::pair<std::string, std::pair<size_t, size_t>>;
+
+  // Place the most expensive queries first.
+  std::vector<PackedQuery> order(queries.begin(), queries.end());
+  std::stable_sort(order.begin(),
+                   order.end(),
+                   [](const PackedQuery& a, const PackedQuery& b) {
+                     return a.second.second > b.second.second;
+                   });
+
+  std::vector<size_t> load(kSchedulePackingSteps, 0);
+  for (const auto& query : order) {
+    auto interval = query.second.first;
+    if (interval == 0) {
+      continue;
+    }
+
+    size_t best = 0;
+    size_t best_load = std::numeric_limits<size_t>::max();
+    auto candidates = std::min(interval, kSchedulePackingSteps);
+    for (size_t offset = 0; offset < candidates; offset++) {
+      size_t overlap = 0;
+      for (size_t step = offset; step < kSchedulePackingSteps;
+           step += interval) {
+        overlap += load[step];
+      }
+      if (overlap < best_load) {
+        best = offset;
+        best_load = overlap;
+      }
+    }
+
+    for (size_t step = best; step < kSchedulePackingSteps; step += interval) {
+      load[step] += query.second.second;
+    }
+    offsets[query.first] = best;
+  }
+}
+
+void SchedulerRunner::packSchedule() {
+  std::map<std::string, std::pair<size_t, size_t>> queries;
+  Config::getInstance().scheduledQueries(
+      ([&queries](const std::string& name, const ScheduledQuery& query) {
+        // Queries without history are given the smallest cost.
+        size_t cost = 1;
+        Config::getInstance().getPerformanceStats(
+            name, ([&cost](const QueryPerformance& perf) {
+              if (perf.executions > 0) {
+                auto cpu = perf.user_time + perf.system_time;
+                cost = std::max(cost,
+                                static_cast<size_t>(cpu / perf.executions));
+              }
+            }));
+        queries[name] = std::make_pair(query.splayed_interval, cost);
+      }));
+
+  offsets_.clear();
+  packScheduleOffsets(queries, offsets_);
+}
+
+/// Run the queries due in the steps after last, up to i.
+static void runScheduleStep(size_t last,
+                            size_t i,
+                            ScheduleWorkers* workers,
+                            const std::map<std::string, size_t>& offsets,
+                            bool& repack) {
+  // Due queries with identical SQL share an execution, in schedule order.
+  std::vector<ScheduledGroup> due;
+  std::map<std::string, size_t> groups;
+  Config::getInstance().scheduledQueries(
+      ([last, i, &offsets, &repack, &due, &groups](
+          const std::string& name, const ScheduledQuery& query) {
+        size_t offset = 0;
+        if (FLAGS_schedule_packing) {
+          auto it = offsets.find(name);
+          if (it != offsets.end()) {
+            offset = it->second;
+          } else {
+            // The schedule changed since the offsets were assigned.
+            repack = true;
+          }
+        }
+
+        if (!isStepDue(query.splayed_interval, last, i, offset)) {
+          return;
+        }
+
+        auto continuous = query.options.count("continuous") > 0 &&
+                          query.options.at("continuous");
+        if (FLAGS_schedule_dedup_queries && !continuous) {
+          // Exclusive queries only share with other exclusive queries.
+          auto exclusive = query.options.count("exclusive") > 0 &&
+                           query.options.at("exclusive");
+          auto key = normalizeScheduledQuery(query.query);
+          key += (exclusive) ? "\n1" : "\n0";
+          auto group = groups.find(key);
+          if (group != groups.end()) {
+            due[group->second].emplace_back(name, query);
+            return;
+          }
+          groups[key] = due.size();
+        }
+        due.push_back({std::make_pair(name, query)});
+      }));
+
+  if (due.empty()) {
+    return;
+  }
+
+  TablePlugin::kCacheStep = i;
+  // Exclusive queries run alone, once the workers are idle.
+  std::vector<ScheduledGroup*> exclusive;
+  for (auto& queries : due) {
+    const auto& query = queries.front().second;
+    if (workers == nullptr) {
+      TablePlugin::kCacheInterval = query.splayed_interval;
+      launchQueries(queries);
+    } else if (query.options.count("exclusive") > 0 &&
+               query.options.at("exclusive")) {
+      exclusive.push_back(&queries);
+    } else {
+      workers->launch(queries);
+    }
+  }
+
+  if (!exclusive.empty()) {
+    workers->wait();
+    for (const auto& queries : exclusive) {
+      TablePlugin::kCacheInterval = queries->front().second.splayed_interval;
+      launchQueries(*queries);
+    }
+  }
+}
+
+/// The running scheduler, woken by wakeScheduler.
+static SchedulerRunner* kScheduler{nullptr};
+static Mutex kSchedulerMutex;
+
+void wakeScheduler() {
+  WriteLock lock(kSchedulerMutex);
+  if (kScheduler != nullptr) {
+    kScheduler->wake();
+  }
+}
+
+void SchedulerRunner::wake() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    woken_ = true;
+  }
+  wake_cv_.notify_all();
+}
+
+bool SchedulerRunner::sleepUntil(
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(wake_mutex_);
+  wake_cv_.wait_until(lock, deadline, [this]() { return woken_; });
+  auto woken = woken_;
+  woken_ = false;
+  return woken;
+}
+
+void SchedulerRunner::buildTimeline() {
+  timeline_generation_ = Config::getInstance().getScheduleGeneration();
+  timeline_.clear();
+  std::set<std::string> continuous;
+  Config::getInstance().scheduledQueries(
+      ([this, &continuous](const std::string& name,
+                           const ScheduledQuery& query) {
+        size_t offset = 0;
+        if (FLAGS_schedule_packing && offsets_.count(name) > 0) {
+          offset = offsets_.at(name);
+        }
+        timeline_.insert(std::make_pair(query.splayed_interval, offset));
+
+        const auto& options = query.options;
+        if (options.count("continuous") > 0 && options.at("continuous")) {
+          continuous.insert(name);
+        }
+      }));
+
+  // The rows kept for removed continuous queries are released.
+  pruneMaterializedDeltas(continuous);
+}
+
+/// The first step after i that is due for an interval and offset.
+inline size_t getNextDueStep(size_t interval, size_t i, size_t offset = 0) {
+  return ((i - offset) / interval + 1) * interval + offset;
+}
+
+size_t SchedulerRunner::getNextStep(size_t i) const {
+  // Decorators, reloads, and pack discovery are also due at intervals.
+  auto next = getNextDueStep(60, i);
+  for (const auto& interval :
+       {FLAGS_schedule_reload, FLAGS_pack_refresh_interval}) {
+    if (interval > 0) {
+      next = std::min(next, getNextDueStep(interval, i));
+    }
+  }
+
+  for (const auto& item : timeline_) {
+    if (item.first > 0) {
+      next = std::min(next, getNextDueStep(item.first, i, item.second));
+    }
+  }
+
+  if (timeout_ > 0) {
+    next = std::min(next, static_cast<size_t>(timeout_) + 1);
+  }
+  return next;
 }
 
 void SchedulerRunner::start() {
+  std::unique_ptr<ScheduleWorkers> workers;
+  auto threads = getScheduleWorkers();
+  if (threads > 1) {
+    workers.reset(new ScheduleWorkers(threads));
+  }
+
+  // Schedule changes and manual triggers wake the scheduler from its sleep.
+  {
+    WriteLock lock(kSchedulerMutex);
+    kScheduler = this;
+  }
+  Config::getInstance().setScheduleObserver(wakeScheduler);
+
+  // Steps are scheduled against a monotonic deadline, the time spent running
+  // queries does not delay the following steps.
+  auto step = std::chrono::seconds(interval_);
+  auto base = std::chrono::steady_clock::now();
+
   // Start the counter at the second.
-  auto i = osquery::getUnixTime();
-  for (; (timeout_ == 0) || (i <= timeout_); ++i) {
-    Config::getInstance().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
-          if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
-          }
-        }));
+  auto first = osquery::getUnixTime();
+  auto i = first;
+  auto last = i - 1;
+  auto& lag = getMetricHistogram("schedule_lag_microseconds");
+  auto& missed_steps = getMetricCounter("schedule_missed_steps");
+  bool repack = FLAGS_schedule_packing;
+  bool rebuild = true;
+  while ((timeout_ == 0) || (i <= timeout_)) {
+    if (repack) {
+      packSchedule();
+      repack = false;
+      rebuild = true;
+    }
+    runScheduleStep(last, i, workers.get(), offsets_, repack);
+
+    // Queries within a tick may share table scans, but never across ticks.
+    resetSharedScans();
     // Configuration decorators run on 60 second intervals only.
-    if ((i % 60) == 0) {
+    if (isStepDue(60, last, i)) {
       runDecorators(DECORATE_INTERVAL, i);
     }
-    if (FLAGS_schedule_reload > 0 && (i % FLAGS_schedule_reload) == 0) {
+    if (isStepDue(FLAGS_schedule_reload, last, i)) {
       if (FLAGS_schedule_reload_sql) {
         SQLiteDBManager::resetPrimary();
       }
-      resetDatabase();
+      // Release database memory without blocking event writers.
+      trimDatabase();
+      // Offsets are reassigned with the performance recorded since.
+      repack = FLAGS_schedule_packing;
+      // Expired blacklist entries return to the schedule.
+      rebuild = true;
+    }
+    if (isStepDue(FLAGS_pack_refresh_interval, last, i)) {
+      // Pack discovery queries may have changed the active packs.
+      rebuild = true;
     }
 
-    // Put the thread into an interruptible sleep without a config instance.
-    pauseMilli(interval_ * 1000);
+    // Sleep until the next step with a due query, or a wake.
+    last = i;
+    size_t next = 0;
+    size_t current = 0;
+    do {
+      if (repack) {
+        packSchedule();
+        repack = false;
+        rebuild = true;
+      }
+      if (rebuild || timeline_generation_ !=
+                         Config::getInstance().getScheduleGeneration()) {
+        buildTimeline();
+        rebuild = false;
+      }
+
+      next = getNextStep(last);
+      sleepUntil(base + step * (next - first));
+      if (interrupted()) {
+        break;
+      }
+      current = first + static_cast<size_t>(
+                            (std::chrono::steady_clock::now() - base) / step);
+      // A wake within the last step only refreshes the timeline.
+    } while (current <= last);
     if (interrupted()) {
       break;
     }
+
+    // The lag is the time between a due step's deadline and its start.
+    std::chrono::steady_clock::duration late =
+        std::chrono::steady_clock::now() - (base + step * (next - first));
+    if (late.count() > 0) {
+      lag.record(
+          std::chrono::duration_cast<std::chrono::microseconds>(late).count());
+    } else {
+      lag.record(0);
+    }
+
+    // Steps between the next due step and now were missed while queries
+    // overran.
+    i = current;
+    if (current > next) {
+      auto missed = current - next;
+      missed_steps.add(missed);
+      if (FLAGS_schedule_catch_up && missed <= kScheduleMaxCatchUp) {
+        // The missed steps run without pausing until on time.
+        i = next;
+      } else {
+        // Skip the missed steps, queries due within them run once now.
+        VLOG(1) << "Scheduler skipping " << missed << " missed steps";
+      }
+    }
+  }
+
+  Config::getInstance().setScheduleObserver(nullptr);
+  WriteLock lock(kSchedulerMutex);
+  if (kScheduler == this) {
+    kScheduler = nullptr;
   }
 }
 
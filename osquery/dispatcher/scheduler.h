@@ -10,7 +10,13 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <osquery/dispatcher.h>
 
@@ -29,11 +35,40 @@ class SchedulerRunner : public InternalRunnable {
   void start() override;
 
   /// The Dispatcher interrupt point.
-  void stop() override {}
+  void stop() override {
+    wake();
+  }
+
+  /// Interrupt the sleep until the next due step, see wakeScheduler.
+  void wake();
 
  protected:
-  /// The UNIX domain socket path for the ExtensionManager.
-  std::map<std::string, size_t> splay_;
+  /// Assign step offsets to the scheduled queries when packing.
+  void packSchedule();
+
+  /// Collect the interval and offset of every scheduled query.
+  void buildTimeline();
+
+  /// The first step after i where a query, or schedule maintenance, is due.
+  size_t getNextStep(size_t i) const;
+
+  /// Sleep until a deadline or a wake, return true if woken.
+  bool sleepUntil(std::chrono::steady_clock::time_point deadline);
+
+ protected:
+  /// Step offsets of scheduled queries, used with schedule packing.
+  std::map<std::string, size_t> offsets_;
+
+  /// Distinct (interval, offset) pairs of the scheduled queries.
+  std::set<std::pair<size_t, size_t>> timeline_;
+
+  /// The config schedule generation the timeline was built from.
+  size_t timeline_generation_{0};
+
+  /// Set by wake and cleared by sleepUntil.
+  bool woken_{false};
+  std::mutex wake_mutex_;
+  std::condition_variable wake_cv_;
 
   /// Interval in seconds between schedule steps.
   size_t interval_;
@@ -44,6 +79,63 @@ class SchedulerRunner : public InternalRunnable {
 
 SQLInternal monitor(const std::string& name, const ScheduledQuery& query);
 
+/// Scheduled queries, by name, that share a single execution.
+using ScheduledGroup = std::vector<std::pair<std::string, ScheduledQuery>>;
+
+/// Execute a scheduled query, then diff and log its results.
+void launchQuery(const std::string& name, const ScheduledQuery& query);
+
+/**
+ * @brief Execute the first of a group of identical queries once.
+ *
+ * The results are diffed and logged for every query of the group, using each
+ * query's own options. If the results are event-based the remaining queries
+ * are executed on their own.
+ */
+void launchQueries(const ScheduledGroup& queries);
+
+/**
+ * @brief Normalize a query's SQL to find identical scheduled queries.
+ *
+ * Whitespace outside of quoted strings and identifiers is collapsed, and
+ * trailing semicolons are removed.
+ */
+std::string normalizeScheduledQuery(const std::string& query);
+
+/**
+ * @brief Parse a continuous query, which selects columns from one table.
+ *
+ * Continuous queries are read from their table's MaterializedView, they may
+ * not use expressions, constraints, or joins.
+ *
+ * @return false if the query is not a selection of columns from a table.
+ */
+bool parseContinuousQuery(const std::string& query,
+                          std::string& table,
+                          std::vector<std::string>& columns);
+
+/**
+ * @brief Spread the cost of scheduled queries across steps.
+ *
+ * Each query runs at steps where (step - offset) is a multiple of its interval.
+ * Queries are placed most expensive first, each at the offset whose steps
+ * have the least cost already placed within an hour of steps.
+ *
+ * @param queries a map of query name to its interval and cost.
+ * @param offsets output map of query name to its offset.
+ */
+void packScheduleOffsets(
+    const std::map<std::string, std::pair<size_t, size_t>>& queries,
+    std::map<std::string, size_t>& offsets);
+
+/**
+ * @brief Wake the running scheduler to check for due queries.
+ *
+ * The scheduler sleeps until the next step with a due query. Config updates
+ * wake it automatically, manual and distributed triggers may call this.
+ */
+void wakeScheduler();
+
 /// Start querying according to the config's schedule
 void startScheduler();
 
@@ -8,6 +8,10 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/dispatcher.h>
@@ -124,4 +128,120 @@ TEST_F(DispatcherTests, test_stop_dispatcher) {
   auto s = Dispatcher::addService(r1);
   EXPECT_FALSE(s);
 }
+
+TEST_F(DispatcherTests, test_task_group) {
+  EXPECT_GT(TaskExecutor::instance().workerCount(), 0U);
+
+  std::atomic<size_t> count{0};
+  {
+    TaskGroup group;
+    for (size_t i = 0; i < 16; i++) {
+      group.run([&count]() {
+        // Each task waits for parts of its work, as a table scan would.
+        TaskGroup parts(TaskPriority::HIGH);
+        for (size_t j = 0; j < 4; j++) {
+          parts.run([&count]() { count++; });
+        }
+        parts.wait();
+      });
+    }
+    group.wait();
+    EXPECT_EQ(64U, count);
+  }
+
+  // Tasks of a cancelled group are skipped.
+  TaskGroup cancelled;
+  cancelled.cancel();
+  cancelled.run([&count]() { count++; });
+  cancelled.wait();
+  EXPECT_EQ(64U, count);
+}
+
+TEST_F(DispatcherTests, test_task_group_cancel) {
+  TaskGroup group;
+  auto start = std::chrono::steady_clock::now();
+  group.run([&group]() {
+    // This task would normally wait for 100 seconds.
+    group.pause(std::chrono::seconds(100));
+  });
+
+  group.cancel();
+  group.wait();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST_F(DispatcherTests, test_task_group_interactive) {
+  auto workers = TaskExecutor::instance().workerCount();
+  std::atomic<size_t> busy{0};
+  std::atomic<bool> release{false};
+
+  // Occupy every worker that is not reserved.
+  TaskGroup low(TaskPriority::LOW);
+  for (size_t i = 0; i < workers; i++) {
+    low.run([&busy, &release]() {
+      busy++;
+      while (!release) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (busy < workers && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(workers, busy);
+
+  // The reserved worker runs an interactive task, while this thread waits.
+  std::atomic<bool> ran{false};
+  TaskGroup interactive(TaskPriority::INTERACTIVE);
+  interactive.run([&ran]() { ran = true; });
+  while (!ran && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(ran);
+
+  release = true;
+  interactive.wait();
+  low.wait();
+}
+
+TEST_F(DispatcherTests, test_task_group_wait_own_tasks) {
+  auto workers = TaskExecutor::instance().workerCount();
+  std::atomic<size_t> busy{0};
+  std::atomic<bool> release{false};
+
+  // Occupy every worker that is not reserved.
+  TaskGroup low(TaskPriority::LOW);
+  for (size_t i = 0; i < workers; i++) {
+    low.run([&busy, &release]() {
+      busy++;
+      while (!release) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (busy < workers && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(workers, busy);
+
+  // A thread waiting for its group runs the group's tasks, but not the
+  // queued tasks of another group, even of a higher priority.
+  std::atomic<bool> other_ran{false};
+  TaskGroup other(TaskPriority::HIGH);
+  other.run([&other_ran]() { other_ran = true; });
+
+  std::atomic<bool> own_ran{false};
+  TaskGroup own(TaskPriority::LOW);
+  own.run([&own_ran]() { own_ran = true; });
+  own.wait();
+  EXPECT_TRUE(own_ran);
+  EXPECT_FALSE(other_ran);
+
+  release = true;
+  other.wait();
+  EXPECT_TRUE(other_ran);
+  low.wait();
+}
 }
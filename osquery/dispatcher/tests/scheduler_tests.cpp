@@ -8,6 +8,9 @@
  *
  */
 
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -21,6 +24,8 @@ namespace osquery {
 
 DECLARE_bool(disable_logging);
 DECLARE_uint64(schedule_reload);
+DECLARE_uint64(schedule_workers);
+DECLARE_bool(disable_watchdog);
 
 class SchedulerTests : public testing::Test {
   void SetUp() override {
@@ -138,7 +143,7 @@ TEST_F(SchedulerTests, test_config_results_purge) {
 }
 
 TEST_F(SchedulerTests, test_scheduler) {
-  auto backup_step = TablePlugin::kCacheStep;
+  size_t backup_step = TablePlugin::kCacheStep;
   auto backup_interval = TablePlugin::kCacheInterval;
 
   // Start the scheduler now.
@@ -166,13 +171,157 @@ TEST_F(SchedulerTests, test_scheduler) {
   runner.start();
 
   // If a query was executed the cache step will have been advanced.
-  EXPECT_GT(TablePlugin::kCacheStep, now);
+  EXPECT_GT(TablePlugin::kCacheStep.load(), now);
 
   // Restore plugin settings.
   TablePlugin::kCacheStep = backup_step;
   TablePlugin::kCacheInterval = backup_interval;
 }
 
+TEST_F(SchedulerTests, test_scheduler_workers) {
+  size_t backup_step = TablePlugin::kCacheStep;
+  auto backup_workers = FLAGS_schedule_workers;
+  auto backup_watchdog = FLAGS_disable_watchdog;
+
+  // The watchdog limits workers to its CPU utilization allowance.
+  FLAGS_schedule_workers = 2;
+  FLAGS_disable_watchdog = true;
+
+  auto now = osquery::getUnixTime();
+  TablePlugin::kCacheStep = now;
+
+  // Mix queries run by the workers with a query run alone.
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"scheduler\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from osquery_info\", \"interval\": 1},"
+      "\"2\": {\"query\": \"select * from time\", \"interval\": 1},"
+      "\"3\": {\"query\": \"select * from processes\", \"interval\": 1, "
+      "\"exclusive\": true}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  SchedulerRunner runner(static_cast<unsigned long int>(now + 1), 1);
+  runner.start();
+  EXPECT_GT(TablePlugin::kCacheStep.load(), now);
+
+  TablePlugin::kCacheStep = backup_step;
+  FLAGS_schedule_workers = backup_workers;
+  FLAGS_disable_watchdog = backup_watchdog;
+}
+
+TEST_F(SchedulerTests, test_normalize_scheduled_query) {
+  EXPECT_EQ("select * from time",
+            normalizeScheduledQuery("  select *\n\tfrom   time ; "));
+  EXPECT_EQ(normalizeScheduledQuery("select 1;"),
+            normalizeScheduledQuery("select  1"));
+
+  // Whitespace within quotes is part of the query.
+  EXPECT_EQ("select 'a  b', \"c  d\" from [e  f]",
+            normalizeScheduledQuery("select 'a  b',  \"c  d\" from [e  f]"));
+  EXPECT_EQ("select 'it''s  here'",
+            normalizeScheduledQuery("select   'it''s  here'"));
+}
+
+TEST_F(SchedulerTests, test_parse_continuous_query) {
+  std::string table;
+  std::vector<std::string> columns;
+  EXPECT_TRUE(parseContinuousQuery(
+      "SELECT pid, Path\nFROM processes;", table, columns));
+  EXPECT_EQ("processes", table);
+  EXPECT_EQ(std::vector<std::string>({"pid", "path"}), columns);
+
+  // Only a selection of columns from a single table can be read from a view.
+  EXPECT_FALSE(parseContinuousQuery("select * from processes", table, columns));
+  EXPECT_FALSE(parseContinuousQuery(
+      "select pid from processes where pid = 1", table, columns));
+  EXPECT_FALSE(parseContinuousQuery(
+      "select count(pid) from processes", table, columns));
+  EXPECT_FALSE(parseContinuousQuery(
+      "select pid from processes join users using (uid)", table, columns));
+}
+
+TEST_F(SchedulerTests, test_monitor_aborted) {
+  std::string name = "pack_test_aborted_query";
+
+  // The query never completes on its own, its wall time limit aborts it.
+  ScheduledQuery query;
+  query.interval = 10;
+  query.splayed_interval = 10;
+  query.wall_limit = 20;
+  query.query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+  auto results = monitor(name, query);
+  EXPECT_FALSE(results.ok());
+
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      name, ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.executions, 1U);
+  EXPECT_EQ(perf.aborted, 1U);
+
+  // The worker continues, and queries within their limits complete.
+  query.query = "select * from time";
+  EXPECT_TRUE(monitor(name, query).ok());
+  Config::getInstance().getPerformanceStats(
+      name, ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.executions, 2U);
+  EXPECT_EQ(perf.aborted, 1U);
+}
+
+TEST_F(SchedulerTests, test_scheduler_dedup) {
+  size_t backup_step = TablePlugin::kCacheStep;
+  auto now = osquery::getUnixTime();
+  TablePlugin::kCacheStep = now;
+
+  // Three names for the same SQL, and one different query.
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"scheduler\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from time\", \"interval\": 1},"
+      "\"2\": {\"query\": \"select *  from time;\", \"interval\": 1},"
+      "\"3\": {\"query\": \"select * from time\", \"interval\": 1, "
+      "\"snapshot\": true},"
+      "\"4\": {\"query\": \"select * from osquery_info\", \"interval\": 1}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  SchedulerRunner runner(static_cast<unsigned long int>(now + 1), 1);
+  runner.start();
+
+  size_t executions = 0;
+  size_t deduplicated = 0;
+  Config::getInstance().scheduledQueries(
+      ([&executions, &deduplicated](const std::string& name,
+                                    const ScheduledQuery& query) {
+        if (query.query.find("time") == std::string::npos) {
+          return;
+        }
+        Config::getInstance().getPerformanceStats(
+            name, ([&executions, &deduplicated](const QueryPerformance& r) {
+              executions += r.executions;
+              deduplicated += r.deduplicated;
+            }));
+      }));
+
+  // Each step executed the query once, for the first of the three names.
+  EXPECT_GT(executions, 0U);
+  EXPECT_EQ(executions * 2, deduplicated);
+
+  TablePlugin::kCacheStep = backup_step;
+}
+
 TEST_F(SchedulerTests, test_scheduler_reload) {
   std::string config =
       "{\"schedule\":{\"1\":{"
@@ -185,4 +334,72 @@ TEST_F(SchedulerTests, test_scheduler_reload) {
   SchedulerRunner runner(expire, 1);
   FLAGS_schedule_reload = backup_reload;
 }
+
+class TestSchedulerRunner : public SchedulerRunner {
+ public:
+  explicit TestSchedulerRunner(unsigned long int timeout)
+      : SchedulerRunner(timeout, 1) {}
+
+  using SchedulerRunner::getNextStep;
+  using SchedulerRunner::sleepUntil;
+  using SchedulerRunner::timeline_;
+};
+
+TEST_F(SchedulerTests, test_scheduler_next_step) {
+  auto backup_reload = FLAGS_schedule_reload;
+  FLAGS_schedule_reload = 300;
+
+  // Without queries the scheduler wakes for decorators, every 60 steps.
+  TestSchedulerRunner runner(0);
+  EXPECT_EQ(runner.getNextStep(1000), 1020U);
+
+  // Otherwise it wakes for the first due query, including its offset.
+  runner.timeline_.insert(std::make_pair(10U, 3U));
+  runner.timeline_.insert(std::make_pair(600U, 0U));
+  EXPECT_EQ(runner.getNextStep(1000), 1003U);
+  EXPECT_EQ(runner.getNextStep(1003), 1013U);
+
+  // The last step is limited by the timeout.
+  TestSchedulerRunner limited(1001);
+  EXPECT_EQ(limited.getNextStep(1000), 1002U);
+  FLAGS_schedule_reload = backup_reload;
+}
+
+TEST_F(SchedulerTests, test_scheduler_wake) {
+  TestSchedulerRunner runner(0);
+
+  // A sleep ends at the deadline without a wake.
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(runner.sleepUntil(start + std::chrono::milliseconds(10)));
+
+  // A wake ends the sleep before the deadline.
+  std::thread waker([&runner]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    runner.wake();
+  });
+  EXPECT_TRUE(runner.sleepUntil(start + std::chrono::seconds(60)));
+  waker.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(30));
+}
+
+TEST_F(SchedulerTests, test_scheduler_packing) {
+  std::map<std::string, std::pair<size_t, size_t>> queries = {
+      {"heavy_1", {60, 1000}},
+      {"heavy_2", {60, 1000}},
+      {"heavy_3", {120, 500}},
+      {"light", {10, 1}},
+  };
+
+  std::map<std::string, size_t> offsets;
+  packScheduleOffsets(queries, offsets);
+  ASSERT_EQ(offsets.size(), queries.size());
+
+  // The most expensive queries do not share steps.
+  EXPECT_EQ(offsets["heavy_1"], 0U);
+  EXPECT_EQ(offsets["heavy_2"], 1U);
+  EXPECT_EQ(offsets["heavy_3"], 2U);
+
+  // The cheap query avoids the steps used by the expensive queries.
+  EXPECT_EQ(offsets["light"], 3U);
+}
 }
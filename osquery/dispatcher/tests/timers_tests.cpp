@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <limits>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <osquery/dispatcher.h>
+
+#include "osquery/dispatcher/timers.h"
+
+namespace osquery {
+
+class TimersTests : public testing::Test {};
+
+TEST_F(TimersTests, test_wheel_expiry) {
+  TimerWheel<size_t> wheel;
+  wheel.add(3, 3);
+  wheel.add(1, 1);
+  wheel.add(2, 2);
+  EXPECT_EQ(3U, wheel.size());
+  EXPECT_EQ(1U, wheel.next());
+
+  std::vector<size_t> expired;
+  wheel.advance(2, expired);
+  ASSERT_EQ(2U, expired.size());
+  EXPECT_EQ(1U, expired[0]);
+  EXPECT_EQ(2U, expired[1]);
+  EXPECT_EQ(3U, wheel.next());
+
+  // A timer that already expired is due at the next tick.
+  wheel.add(0, 0);
+  EXPECT_EQ(3U, wheel.next());
+  wheel.advance(3, expired);
+  EXPECT_EQ(4U, expired.size());
+  EXPECT_EQ(0U, wheel.size());
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), wheel.next());
+}
+
+TEST_F(TimersTests, test_wheel_cascade) {
+  // Timers in higher levels move down and expire at their own tick.
+  TimerWheel<uint64_t> wheel(10);
+  std::vector<uint64_t> ticks = {75, 64 * 64 + 5, 64 * 64 * 64 + 100, 130};
+  for (const auto& tick : ticks) {
+    wheel.add(tick, tick);
+  }
+
+  std::vector<uint64_t> expired;
+  while (wheel.size() > 0) {
+    auto next = wheel.next();
+    ASSERT_GT(next, wheel.now());
+    wheel.advance(next, expired);
+    for (const auto& tick : expired) {
+      EXPECT_EQ(next, tick);
+    }
+    expired.clear();
+  }
+  EXPECT_EQ(64U * 64 * 64 + 100, wheel.now());
+}
+
+class CountingService : public PeriodicRunnable {
+ public:
+  explicit CountingService(size_t runs) : runs_(runs) {}
+
+  bool run() override {
+    return ++count < runs_;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::milliseconds(10);
+  }
+
+  std::atomic<size_t> count{0};
+
+ private:
+  size_t runs_{0};
+};
+
+TEST_F(TimersTests, test_periodic_service) {
+  auto first = std::make_shared<CountingService>(3);
+  auto second = std::make_shared<CountingService>(1);
+  EXPECT_TRUE(Dispatcher::addPeriodicService(first));
+  EXPECT_TRUE(
+      Dispatcher::addPeriodicService(second, std::chrono::milliseconds(0)));
+
+  // The runner ends once no service asks to run again.
+  Dispatcher::joinServices();
+  EXPECT_EQ(3U, first->count);
+  EXPECT_EQ(1U, second->count);
+
+  // A later service starts a new runner.
+  auto third = std::make_shared<CountingService>(2);
+  EXPECT_TRUE(Dispatcher::addPeriodicService(third));
+  Dispatcher::joinServices();
+  EXPECT_EQ(2U, third->count);
+}
+
+class BlockingService : public PeriodicRunnable {
+ public:
+  explicit BlockingService(std::shared_ptr<CountingService> other)
+      : other_(std::move(other)) {}
+
+  bool run() override {
+    // Wait, as a network request would, for the other service's runs.
+    for (size_t i = 0; i < 200 && other_->count < 3; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    unblocked = (other_->count >= 3);
+    return false;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::milliseconds(0);
+  }
+
+  bool blocking() override {
+    return true;
+  }
+
+  std::atomic<bool> unblocked{false};
+
+ private:
+  std::shared_ptr<CountingService> other_;
+};
+
+TEST_F(TimersTests, test_blocking_service) {
+  // A blocking run does not delay the other services.
+  auto counting = std::make_shared<CountingService>(3);
+  auto blocking = std::make_shared<BlockingService>(counting);
+  EXPECT_TRUE(Dispatcher::addPeriodicService(blocking));
+  EXPECT_TRUE(Dispatcher::addPeriodicService(counting));
+
+  Dispatcher::joinServices();
+  EXPECT_TRUE(blocking->unblocked);
+  EXPECT_EQ(3U, counting->count);
+}
+}
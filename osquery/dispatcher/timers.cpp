@@ -0,0 +1,308 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/timers.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     timer_slack,
+     0,
+     "Milliseconds periodic services may be delayed to share wakeups");
+
+FLAG(uint64,
+     timer_battery_slack,
+     5000,
+     "Milliseconds periodic services may be delayed while on battery power");
+
+/// The duration of a timer wheel tick.
+const std::chrono::milliseconds kTimerResolution(100);
+
+/// How long the power source is assumed unchanged.
+const std::chrono::seconds kPowerSourceCheckInterval(60);
+
+/// Check if the host is running on battery power.
+static bool isOnBatteryPower() {
+  bool discharging = false;
+#ifdef __linux__
+  std::vector<std::string> supplies;
+  listDirectoriesInDirectory("/sys/class/power_supply", supplies);
+  for (const auto& supply : supplies) {
+    std::string type;
+    std::string value;
+    if (!readFile(supply + "/type", type).ok()) {
+      continue;
+    }
+    boost::algorithm::trim(type);
+    if (type == "Mains" && readFile(supply + "/online", value).ok()) {
+      boost::algorithm::trim(value);
+      if (value == "1") {
+        return false;
+      }
+    } else if (type == "Battery" && readFile(supply + "/status", value).ok()) {
+      boost::algorithm::trim(value);
+      discharging = discharging || (value == "Discharging");
+    }
+  }
+#endif
+  return discharging;
+}
+
+/**
+ * @brief Runs the periodic services of a timer wheel.
+ *
+ * The runner's thread sleeps until the wheel's next tick, rounded up to
+ * a multiple of the timer slack such that services due close together are
+ * run after a single wakeup. It exits once no services remain.
+ *
+ * Due services are run by the runner's thread, they never wait for a worker
+ * busy with queries. Services that may block, such as a network request, are
+ * run in turn by a second thread of the runner.
+ */
+class TimerRunner : public InternalRunnable {
+ public:
+  TimerRunner() : epoch_(std::chrono::steady_clock::now()) {}
+
+  /// Add a service, false if the runner is exiting.
+  bool add(PeriodicRunnableRef service, std::chrono::milliseconds delay) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || exited_) {
+      return false;
+    }
+
+    auto when = std::chrono::steady_clock::now() + delay - epoch_;
+    auto expires = static_cast<uint64_t>(
+        (when + kTimerResolution - std::chrono::milliseconds(1)) /
+        kTimerResolution);
+    intervals_[service.get()] = service->interval();
+    wheel_.add(expires, std::move(service));
+    if (expires < planned_) {
+      changed_.notify_one();
+    }
+    return true;
+  }
+
+  void start() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+      if (wheel_.size() == 0 && running_ == 0) {
+        break;
+      }
+
+      // Wake at the next tick, or later to share the wakeup.
+      auto slack = static_cast<uint64_t>(
+          std::chrono::milliseconds(getSlack()) / kTimerResolution);
+      planned_ = wheel_.next();
+      if (slack > 1 && planned_ != std::numeric_limits<uint64_t>::max()) {
+        planned_ = (planned_ + slack - 1) / slack * slack;
+      }
+
+      if (planned_ == std::numeric_limits<uint64_t>::max()) {
+        changed_.wait(lock);
+      } else {
+        changed_.wait_until(lock, epoch_ + planned_ * kTimerResolution);
+      }
+      planned_ = std::numeric_limits<uint64_t>::max();
+      if (stopping_) {
+        break;
+      }
+
+      std::vector<PeriodicRunnableRef> due;
+      wheel_.advance(static_cast<uint64_t>(
+                         (std::chrono::steady_clock::now() - epoch_) /
+                         kTimerResolution),
+                     due);
+      running_ += due.size();
+
+      std::vector<PeriodicRunnableRef> ready;
+      for (auto& service : due) {
+        if (!service->blocking()) {
+          ready.push_back(std::move(service));
+          continue;
+        }
+
+        blocking_.push_back(std::move(service));
+        if (!blocking_thread_.joinable()) {
+          blocking_thread_ = std::thread(&TimerRunner::runBlocking, this);
+        }
+        blocking_ready_.notify_one();
+      }
+
+      lock.unlock();
+      for (const auto& service : ready) {
+        runService(service);
+      }
+      lock.lock();
+    }
+    exited_ = true;
+    blocking_ready_.notify_one();
+    lock.unlock();
+
+    // A blocking run in progress completes before the runner is joined.
+    if (blocking_thread_.joinable()) {
+      blocking_thread_.join();
+    }
+  }
+
+  void stop() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    changed_.notify_one();
+    blocking_ready_.notify_one();
+  }
+
+ private:
+  /// The entrypoint of the thread running blocking services.
+  void runBlocking() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      blocking_ready_.wait(lock, [this]() {
+        return stopping_ || exited_ || !blocking_.empty();
+      });
+      if (stopping_ || exited_) {
+        return;
+      }
+
+      auto service = std::move(blocking_.front());
+      blocking_.pop_front();
+      lock.unlock();
+      runService(service);
+      lock.lock();
+    }
+  }
+
+  void runService(const PeriodicRunnableRef& service) {
+    bool again = false;
+    try {
+      again = service->run();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Periodic service failed: " << e.what();
+    }
+    auto delay = (again) ? service->interval() : std::chrono::milliseconds(0);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_--;
+    if (!again || stopping_) {
+      intervals_.erase(service.get());
+    } else {
+      intervals_[service.get()] = delay;
+      auto when = std::chrono::steady_clock::now() + delay - epoch_;
+      auto expires = static_cast<uint64_t>(
+          (when + kTimerResolution - std::chrono::milliseconds(1)) /
+          kTimerResolution);
+      wheel_.add(expires, service);
+      if (expires >= planned_) {
+        return;
+      }
+    }
+    // Wake the runner for an earlier run, or to exit once no runs remain.
+    changed_.notify_one();
+  }
+
+  /**
+   * @brief The timer slack, larger on battery power.
+   *
+   * The slack is at most half the shortest interval of the services, such
+   * that frequent services, like the 1 second flushes, keep their rate.
+   */
+  uint64_t getSlack() {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= power_checked_ + kPowerSourceCheckInterval) {
+      power_checked_ = now;
+      on_battery_ = isOnBatteryPower();
+    }
+    auto slack = FLAGS_timer_slack;
+    if (on_battery_) {
+      slack = std::max(slack, FLAGS_timer_battery_slack);
+    }
+    for (const auto& interval : intervals_) {
+      auto limit = std::max(interval.second.count(),
+                            static_cast<std::chrono::milliseconds::rep>(0));
+      slack = std::min(slack, static_cast<uint64_t>(limit) / 2);
+    }
+    return slack;
+  }
+
+ private:
+  /// The time of tick 0.
+  std::chrono::steady_clock::time_point epoch_;
+
+  TimerWheel<PeriodicRunnableRef> wheel_;
+
+  /// The tick the runner is sleeping until.
+  uint64_t planned_{std::numeric_limits<uint64_t>::max()};
+
+  /// The number of services due or running.
+  size_t running_{0};
+
+  /// The current interval of each service, used to limit the slack.
+  std::map<const PeriodicRunnable*, std::chrono::milliseconds> intervals_;
+
+  /// Blocking services due, run in turn by the blocking thread.
+  std::deque<PeriodicRunnableRef> blocking_;
+
+  /// Started once a blocking service is due.
+  std::thread blocking_thread_;
+
+  bool stopping_{false};
+  bool exited_{false};
+
+  std::chrono::steady_clock::time_point power_checked_;
+  bool on_battery_{false};
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+
+  /// Wakes the blocking thread.
+  std::condition_variable blocking_ready_;
+};
+
+/// The runner of the periodic services, replaced once it exits.
+static std::shared_ptr<TimerRunner> kTimerRunner;
+
+static std::mutex kTimerRunnerMutex;
+
+Status Dispatcher::addPeriodicService(PeriodicRunnableRef service) {
+  auto delay = service->interval();
+  return addPeriodicService(std::move(service), delay);
+}
+
+Status Dispatcher::addPeriodicService(PeriodicRunnableRef service,
+                                      std::chrono::milliseconds delay) {
+  std::lock_guard<std::mutex> lock(kTimerRunnerMutex);
+  if (kTimerRunner != nullptr && kTimerRunner->add(service, delay)) {
+    return Status(0, "OK");
+  }
+
+  auto runner = std::make_shared<TimerRunner>();
+  runner->add(std::move(service), delay);
+  auto status = addService(runner);
+  if (status.ok()) {
+    kTimerRunner = std::move(runner);
+  }
+  return status;
+}
+}
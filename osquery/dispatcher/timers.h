@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace osquery {
+
+/**
+ * @brief A hierarchical timer wheel.
+ *
+ * Timers expire at a tick. Each level has 64 slots, a slot of level L covers
+ * 64^L ticks. A timer is added to the lowest level whose span includes its
+ * expiration, and moves down a level each time the wheel reaches its slot.
+ * Adding a timer and expiring it are constant time, which keeps the cost of
+ * many idle services independent of their intervals.
+ *
+ * Timers further than 64^4 ticks away expire at the end of the last level.
+ */
+template <typename T>
+class TimerWheel {
+ public:
+  /// Bits of a tick used to index the slots of each level.
+  static const size_t kSlotBits = 6;
+
+  /// Slots of each level.
+  static const size_t kSlots = 1 << kSlotBits;
+
+  static const size_t kLevels = 4;
+
+  explicit TimerWheel(uint64_t now = 0) : now_(now) {}
+
+  /// Add a timer, a timer that already expired expires at the next tick.
+  void add(uint64_t expires, T value) {
+    expires = std::max(expires, now_ + 1);
+    auto last = now_ + (static_cast<uint64_t>(1) << (kSlotBits * kLevels)) - 1;
+    insert(std::min(expires, last), std::move(value));
+  }
+
+  /**
+   * @brief Advance the wheel to a tick.
+   *
+   * @param to the current tick, earlier ticks are ignored.
+   * @param expired receives the timers expiring up to the tick, in order.
+   */
+  void advance(uint64_t to, std::vector<T>& expired) {
+    while (now_ < to) {
+      now_++;
+      // Higher levels move their timers down first, they may expire now.
+      for (auto level = kLevels - 1; level > 0; level--) {
+        auto span = static_cast<uint64_t>(1) << (kSlotBits * level);
+        if (now_ % span == 0) {
+          auto timers = std::move(slots_[level][slot(now_, level)]);
+          slots_[level][slot(now_, level)].clear();
+          size_ -= timers.size();
+          for (auto& timer : timers) {
+            insert(timer.first, std::move(timer.second));
+          }
+        }
+      }
+
+      auto& due = slots_[0][slot(now_, 0)];
+      for (auto& timer : due) {
+        expired.push_back(std::move(timer.second));
+      }
+      size_ -= due.size();
+      due.clear();
+    }
+  }
+
+  /**
+   * @brief The next tick the wheel should be advanced to.
+   *
+   * This is the earliest expiration of the lowest level, or an earlier tick
+   * when a higher level moves timers down.
+   *
+   * @return the tick, or the largest tick if the wheel is empty.
+   */
+  uint64_t next() const {
+    auto next = std::numeric_limits<uint64_t>::max();
+    if (size_ == 0) {
+      return next;
+    }
+
+    for (uint64_t tick = now_ + 1; tick < now_ + kSlots; tick++) {
+      if (!slots_[0][slot(tick, 0)].empty()) {
+        next = tick;
+        break;
+      }
+    }
+
+    for (size_t level = 1; level < kLevels; level++) {
+      auto shift = kSlotBits * level;
+      for (uint64_t i = 1; i <= kSlots; i++) {
+        auto tick = ((now_ >> shift) + i) << shift;
+        if (tick >= next) {
+          break;
+        }
+        if (!slots_[level][slot(tick, level)].empty()) {
+          next = tick;
+          break;
+        }
+      }
+    }
+    return next;
+  }
+
+  /// The last tick the wheel was advanced to.
+  uint64_t now() const {
+    return now_;
+  }
+
+  /// The number of timers.
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  /// Add a timer expiring now or later to the lowest level spanning it.
+  void insert(uint64_t expires, T value) {
+    size_t level = 0;
+    auto delta = expires - now_;
+    while (level + 1 < kLevels &&
+           delta >= (static_cast<uint64_t>(1) << (kSlotBits * (level + 1)))) {
+      level++;
+    }
+    slots_[level][slot(expires, level)].emplace_back(expires, std::move(value));
+    size_++;
+  }
+
+  static size_t slot(uint64_t tick, size_t level) {
+    return static_cast<size_t>(tick >> (kSlotBits * level)) & (kSlots - 1);
+  }
+
+ private:
+  /// Timers and their expiration of each slot, of each level.
+  std::vector<std::pair<uint64_t, T>> slots_[kLevels][kSlots];
+
+  uint64_t now_{0};
+
+  size_t size_{0};
+};
+}
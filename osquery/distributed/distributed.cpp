@@ -8,10 +8,17 @@
  *
  */
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <sstream>
 #include <utility>
 
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
 #include <osquery/core.h>
+#include <osquery/dispatcher.h>
 #include <osquery/distributed.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
@@ -19,6 +26,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/sql/sqlite_util.h"
 
 namespace pt = boost::property_tree;
 
@@ -33,6 +41,37 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
+FLAG(uint64,
+     distributed_workers,
+     1,
+     "Number of distributed queries run concurrently (default 1)");
+
+FLAG(uint64,
+     distributed_timeout,
+     0,
+     "Seconds a distributed query may run before it is interrupted "
+     "(0 = unlimited)");
+
+FLAG(uint64,
+     distributed_write_max_bytes,
+     0,
+     "Max bytes of each distributed results write, larger results continue "
+     "in more writes (0 = unlimited)");
+
+FLAG(uint64,
+     distributed_cache_ttl,
+     0,
+     "Seconds identical distributed queries are answered from a cached "
+     "result (0 = disabled)");
+
+DECLARE_uint64(distributed_interval);
+
+/// The most distributed queries run concurrently.
+const size_t kMaxDistributedWorkers = 16;
+
+/// The most distinct queries with a cached result.
+const size_t kMaxDistributedCacheEntries = 64;
+
 const std::string kDistributedQueryPrefix{"distributed."};
 
 Status DistributedPlugin::call(const PluginRequest& request,
@@ -43,7 +82,13 @@ Status DistributedPlugin::call(const PluginRequest& request,
 
   if (request.at("action") == "getQueries") {
     std::string queries;
-    getQueries(queries);
+    unsigned long wait = 0;
+    if (request.count("wait") > 0 &&
+        safeStrtoul(request.at("wait"), 10, wait).ok() && wait > 0) {
+      waitForQueries(queries, wait);
+    } else {
+      getQueries(queries);
+    }
     response.push_back({{"results", queries}});
     return Status(0, "OK");
   } else if (request.at("action") == "writeResults") {
@@ -57,15 +102,35 @@ Status DistributedPlugin::call(const PluginRequest& request,
                 "Distributed plugin action unknown: " + request.at("action"));
 }
 
-Status Distributed::pullUpdates() {
+Status Distributed::pullUpdates(size_t wait) {
   auto distributed_plugin = RegistryFactory::get().getActive("distributed");
   if (!RegistryFactory::get().exists("distributed", distributed_plugin)) {
     return Status(1, "Missing distributed plugin: " + distributed_plugin);
   }
 
+  // Plugins within the process are called without a PluginRequest.
+  auto plugin = RegistryFactory::get().localPlugin<DistributedPlugin>(
+      "distributed", distributed_plugin);
+  if (plugin != nullptr) {
+    std::string queries;
+    auto status = RegistryFactory::callLocal(
+        "distributed", distributed_plugin, [&plugin, &queries, wait]() {
+          return (wait > 0) ? plugin->waitForQueries(queries, wait)
+                            : plugin->getQueries(queries);
+        });
+    if (!status.ok()) {
+      return status;
+    }
+    return acceptWork(queries);
+  }
+
+  PluginRequest request = {{"action", "getQueries"}};
+  if (wait > 0) {
+    request["wait"] = std::to_string(wait);
+  }
+
   PluginResponse response;
-  auto status =
-      Registry::call("distributed", {{"action", "getQueries"}}, response);
+  auto status = Registry::call("distributed", request, response);
   if (!status.ok()) {
     return status;
   }
@@ -84,47 +149,290 @@ size_t Distributed::getPendingQueryCount() {
 }
 
 size_t Distributed::getCompletedCount() {
+  std::lock_guard<std::mutex> lock(results_mutex_);
   return results_.size();
 }
 
 Status Distributed::serializeResults(std::string& json) {
-  pt::ptree queries;
-  pt::ptree statuses;
-  for (const auto& result : results_) {
-    pt::ptree qd;
-    auto s = serializeQueryData(result.results, result.columns, qd);
-    if (!s.ok()) {
-      return s;
+  std::lock_guard<std::mutex> lock(results_mutex_);
+  return serializeResults(results_, 0, [&json](const std::string& body) {
+    json = body;
+    return Status(0, "OK");
+  });
+}
+
+/// Write a result row as a JSON object, in the order of the result columns.
+static void writeResultRowJSON(const Row& r,
+                               const ColumnNames& columns,
+                               std::string& json) {
+  if (columns.empty() && r.empty()) {
+    json += "\"\"";
+    return;
+  }
+
+  json += '{';
+  bool first = true;
+  auto write = [&json, &first](const std::string& name,
+                               const std::string& value) {
+    if (!first) {
+      json += ',';
+    }
+    first = false;
+    writeJSONString(name, json);
+    json += ':';
+    writeJSONString(value, json);
+  };
+
+  if (columns.empty()) {
+    for (const auto& column : r) {
+      write(column.first, column.second);
+    }
+  } else {
+    for (const auto& column : columns) {
+      auto value = r.find(column);
+      write(column, (value != r.end()) ? value->second : "");
     }
-    queries.add_child(result.request.id, qd);
-    statuses.put(result.request.id, result.status.getCode());
   }
+  json += '}';
+}
 
-  pt::ptree results;
-  results.add_child("queries", queries);
-  results.add_child("statuses", statuses);
+Status Distributed::serializeResults(
+    const std::vector<DistributedQueryResult>& results,
+    size_t max_bytes,
+    const std::function<Status(const std::string& json)>& write) {
+  std::string token;
+  if (max_bytes > 0) {
+    token = boost::uuids::to_string(boost::uuids::random_generator()());
+  }
+  bool columnar = useColumnarResults();
+
+  // The members of the "queries" and "statuses" objects of the next body.
+  std::string queries;
+  std::string statuses;
+  size_t chunk = 0;
+  auto send = [&](bool final) {
+    std::string json;
+    json.reserve(queries.size() + statuses.size() + 128);
+    json += "{\"queries\":{";
+    json += queries;
+    json += "},\"statuses\":{";
+    json += statuses;
+    json += '}';
+    if (columnar) {
+      json += ",\"encoding\":\"columnar\"";
+    }
+    if (!token.empty()) {
+      json += ",\"continuation\":\"" + token + "\",\"chunk\":" +
+              std::to_string(chunk++) + ",\"final\":";
+      json += (final) ? "true" : "false";
+    }
+    json += "}\n";
+    queries.clear();
+    statuses.clear();
+    return write(json);
+  };
+
+  auto full = [&]() {
+    return max_bytes > 0 && queries.size() + statuses.size() >= max_bytes;
+  };
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    if (!queries.empty()) {
+      queries += ',';
+    }
+    // A columnar result lists its column names once, before its rows.
+    std::string head;
+    auto columns = result.columns;
+    writeJSONString(result.request.id, head);
+    if (columnar && !result.results.empty()) {
+      if (columns.empty()) {
+        getQueryDataColumns(result.results, columns);
+      }
+      head += ":{\"columns\":[";
+      for (size_t j = 0; j < columns.size(); j++) {
+        if (j > 0) {
+          head += ',';
+        }
+        writeJSONString(columns[j], head);
+      }
+      head += "],\"rows\":[";
+    } else {
+      head += ':';
+    }
+    std::string tail = (columnar) ? "]}" : "]";
+
+    queries += head;
+    if (result.results.empty()) {
+      queries += "\"\"";
+    } else {
+      if (!columnar) {
+        queries += '[';
+      }
+      const auto& rows = result.results;
+      for (size_t j = 0; j < rows.size(); j++) {
+        if (queries.back() != '[') {
+          queries += ',';
+        }
+        if (columnar) {
+          writeColumnarRowJSON(rows[j], columns, queries);
+        } else {
+          writeResultRowJSON(rows[j], result.columns, queries);
+        }
+        if (j + 1 < rows.size() && full()) {
+          // The result's rows continue in the next body.
+          queries += tail;
+          auto s = send(false);
+          if (!s.ok()) {
+            return s;
+          }
+          queries += head;
+          if (!columnar) {
+            queries += '[';
+          }
+        }
+      }
+      queries += tail;
+    }
 
-  std::stringstream ss;
-  try {
-    pt::write_json(ss, results, false);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error writing JSON: " + std::string(e.what()));
+    if (!statuses.empty()) {
+      statuses += ',';
+    }
+    writeJSONString(result.request.id, statuses);
+    auto code = "\"" + std::to_string(result.status.getCode()) + "\"";
+    if (result.cached) {
+      statuses += ":{\"code\":" + code + ",\"cached\":true,\"cache_age\":" +
+                  std::to_string(result.cache_age) + "}";
+    } else {
+      statuses += ":" + code;
+    }
+
+    if (i + 1 < results.size() && full()) {
+      auto s = send(false);
+      if (!s.ok()) {
+        return s;
+      }
+    }
   }
-  json = ss.str();
+  return send(true);
+}
 
-  return Status(0, "OK");
+void Distributed::addResult(DistributedQueryResult result) {
+  std::lock_guard<std::mutex> lock(results_mutex_);
+  results_.push_back(std::move(result));
 }
 
-void Distributed::addResult(const DistributedQueryResult& result) {
-  results_.push_back(result);
+/// Collapse whitespace and case outside of quoted text, and trailing ';'.
+static std::string normalizeDistributedQuery(const std::string& query) {
+  std::string key;
+  key.reserve(query.size());
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote != 0) {
+      // An escaped quote closes and reopens the quoted text.
+      key += c;
+      quote = (c == quote) ? 0 : quote;
+      continue;
+    }
+
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      continue;
+    }
+    if (space && !key.empty()) {
+      key += ' ';
+    }
+    space = false;
+    if (c == '\'' || c == '"' || c == '`') {
+      quote = c;
+    }
+    key += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+
+  while (!key.empty() && (key.back() == ';' || key.back() == ' ')) {
+    key.pop_back();
+  }
+  return key;
 }
 
-Status Distributed::runQueries() {
-  while (getPendingQueryCount() > 0) {
-    auto request = popRequest();
-    LOG(INFO) << "Executing distributed query: " << request.id << ": "
-              << request.query;
+bool Distributed::getCachedResult(const std::string& key,
+                                  DistributedQueryResult& result) {
+  auto entry = cache_.find(key);
+  if (entry == cache_.end()) {
+    return false;
+  }
 
+  auto age = std::chrono::steady_clock::now() - entry->second.executed;
+  if (age >= std::chrono::seconds(FLAGS_distributed_cache_ttl)) {
+    cache_.erase(entry);
+    return false;
+  }
+
+  result.results = entry->second.results;
+  result.columns = entry->second.columns;
+  result.cached = true;
+  result.cache_age =
+      std::chrono::duration_cast<std::chrono::seconds>(age).count();
+  return true;
+}
+
+void Distributed::setCachedResult(const std::string& key,
+                                  const DistributedQueryResult& result) {
+  auto now = std::chrono::steady_clock::now();
+  auto ttl = std::chrono::seconds(FLAGS_distributed_cache_ttl);
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    it = (now - it->second.executed >= ttl) ? cache_.erase(it) : ++it;
+  }
+
+  // Replace the oldest result when the cache is full.
+  if (cache_.size() >= kMaxDistributedCacheEntries && cache_.count(key) == 0) {
+    cache_.erase(std::min_element(
+        cache_.begin(), cache_.end(), [](const auto& l, const auto& r) {
+          return l.second.executed < r.second.executed;
+        }));
+  }
+
+  auto& entry = cache_[key];
+  entry.executed = now;
+  entry.results = result.results;
+  entry.columns = result.columns;
+}
+
+void Distributed::runQuery(DistributedQueryRequest request,
+                           std::shared_ptr<std::atomic<bool>> cancel) {
+  // Identical queries share a cached result, unless the server opted out.
+  std::string key;
+  bool executing = false;
+  if (FLAGS_distributed_cache_ttl > 0) {
+    key = normalizeDistributedQuery(request.query);
+    std::unique_lock<std::mutex> lock(results_mutex_);
+    if (no_cache_.erase(request.id) == 0) {
+      // Wait for an identical query that is executing, then use its result.
+      completed_.wait(
+          lock, [&]() { return executing_.count(key) == 0 || *cancel; });
+      DistributedQueryResult result(request, {}, {}, Status(0, "OK"));
+      if (!*cancel && getCachedResult(key, result)) {
+        LOG(INFO) << "Using cached distributed query result: " << request.id;
+        results_.push_back(std::move(result));
+        running_.erase(request.id);
+        completions_++;
+        lock.unlock();
+        completed_.notify_all();
+        return;
+      }
+    }
+    executing = executing_.insert(key).second;
+  }
+
+  LOG(INFO) << "Executing distributed query: " << request.id << ": "
+            << request.query;
+
+  {
+    // Queries exceeding the time limit, or cancelled, are interrupted.
+    SQLQueryLimit limit(std::chrono::seconds(FLAGS_distributed_timeout),
+                        cancel);
+    SQLQueryPriority priority(SQLQueryPriority::INTERACTIVE);
     SQL sql(request.query);
     if (!sql.getStatus().ok()) {
       LOG(ERROR) << "Error executing distributed query: " << request.id << ": "
@@ -132,95 +440,342 @@ Status Distributed::runQueries() {
     }
 
     DistributedQueryResult result(
-        request, sql.rows(), sql.columns(), sql.getStatus());
-    addResult(result);
+        request, sql.takeRows(), sql.columns(), sql.getStatus());
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    if (executing) {
+      // Only successful results are cached, a failure is retried.
+      if (result.status.ok()) {
+        setCachedResult(key, result);
+      }
+      executing_.erase(key);
+    }
+    results_.push_back(std::move(result));
+    running_.erase(request.id);
+    completions_++;
   }
+  completed_.notify_all();
+}
+
+Status Distributed::runQueries() {
+  auto workers = std::min(static_cast<size_t>(FLAGS_distributed_workers),
+                          kMaxDistributedWorkers);
+  workers = std::max(workers, static_cast<size_t>(1));
+  auto interval = std::chrono::seconds(
+      std::max<uint64_t>(FLAGS_distributed_interval, 1));
+  auto checkin = std::chrono::steady_clock::now() + interval;
+
+  // Queries run on the executor's reserved worker when others are busy.
+  TaskGroup group(TaskPriority::INTERACTIVE);
+  size_t flushed = 0;
+  while (true) {
+    // Start pending queries while there are idle workers.
+    while (getPendingQueryCount() > 0) {
+      std::unique_lock<std::mutex> lock(results_mutex_);
+      if (running_.size() >= workers) {
+        break;
+      }
+      lock.unlock();
+
+      auto request = popRequest();
+      auto cancel = std::make_shared<std::atomic<bool>>(false);
+      lock.lock();
+      running_[request.id] = cancel;
+      lock.unlock();
+      group.run(std::bind(
+          &Distributed::runQuery, this, std::move(request), cancel));
+    }
+
+    bool completed = false;
+    {
+      std::unique_lock<std::mutex> lock(results_mutex_);
+      if (running_.empty()) {
+        break;
+      }
+      completed_.wait_until(
+          lock, checkin, [this, flushed]() { return completions_ != flushed; });
+      completed = (completions_ != flushed);
+      flushed = completions_;
+    }
+
+    // Send each result as soon as it completes, failures are sent again with
+    // the next result.
+    if (completed) {
+      flushCompleted();
+    }
+
+    // Keep checking in while queries run, for new and cancelled queries.
+    if (std::chrono::steady_clock::now() >= checkin) {
+      pullUpdates();
+      checkin = std::chrono::steady_clock::now() + interval;
+    }
+  }
+
+  group.wait();
   return flushCompleted();
 }
 
+Status Distributed::cancelQuery(const std::string& id) {
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    auto running = running_.find(id);
+    if (running != running_.end()) {
+      // Wake the query if it is waiting for an identical query.
+      *running->second = true;
+      completed_.notify_all();
+      return Status(0, "OK");
+    }
+    no_cache_.erase(id);
+  }
+
+  DistributedQueryRequest request;
+  auto key = kDistributedQueryPrefix + id;
+  if (!getDatabaseValue(kQueries, key, request.query).ok()) {
+    return Status(1, "Unknown distributed query: " + id);
+  }
+
+  deleteDatabaseValue(kQueries, key);
+  request.id = id;
+  LOG(INFO) << "Cancelled distributed query: " << id;
+  addResult(DistributedQueryResult(
+      request, {}, {}, Status(1, "Distributed query cancelled")));
+  return Status(0, "OK");
+}
+
 Status Distributed::flushCompleted() {
-  if (getCompletedCount() == 0) {
+  std::vector<DistributedQueryResult> completed;
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    completed.swap(results_);
+  }
+
+  if (completed.empty()) {
     return Status(0, "OK");
   }
 
+  // Results that are not written are kept for the next flush.
+  auto restore = [this, &completed]() {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    results_.insert(results_.begin(),
+                    std::make_move_iterator(completed.begin()),
+                    std::make_move_iterator(completed.end()));
+  };
+
   auto distributed_plugin = RegistryFactory::get().getActive("distributed");
   if (!RegistryFactory::get().exists("distributed", distributed_plugin)) {
+    restore();
     return Status(1, "Missing distributed plugin " + distributed_plugin);
   }
 
-  std::string results;
-  auto s = serializeResults(results);
+  // Each body is written as it is serialized, only one is held at a time.
+  auto plugin = RegistryFactory::get().localPlugin<DistributedPlugin>(
+      "distributed", distributed_plugin);
+  auto write = [&plugin, &distributed_plugin](const std::string& json) {
+    if (plugin != nullptr) {
+      return RegistryFactory::callLocal(
+          "distributed", distributed_plugin, [&plugin, &json]() {
+            return plugin->writeResults(json);
+          });
+    }
+    PluginResponse response;
+    return Registry::call("distributed",
+                          {{"action", "writeResults"}, {"results", json}},
+                          response);
+  };
+  auto max_bytes = static_cast<size_t>(FLAGS_distributed_write_max_bytes);
+  auto s = serializeResults(completed, max_bytes, write);
   if (!s.ok()) {
-    return s;
-  }
-
-  PluginResponse response;
-  s = Registry::call("distributed",
-                     {{"action", "writeResults"}, {"results", results}},
-                     response);
-  if (s.ok()) {
-    results_.clear();
+    // A later flush writes every result again, with a new continuation.
+    restore();
   }
   return s;
 }
 
-Status Distributed::acceptWork(const std::string& work) {
-  try {
-    pt::ptree tree;
-    {
-      std::stringstream ss(work);
-      pt::read_json(ss, tree);
-    }
-    std::set<std::string> queries_to_run;
-    // Check for and run discovery queries first
-    if (tree.count("discovery") > 0) {
-      auto& queries = tree.get_child("discovery");
-
-      for (const auto& node : queries) {
-        auto query = queries.get<std::string>(node.first, "");
-        if (query.empty() || node.first.empty()) {
-          return Status(
-              1,
-              "Distributed discovery query does not have complete attributes");
-        }
-        SQL sql(query);
-        if (!sql.getStatus().ok()) {
-          return Status(1, "Distributed discovery query has an SQL error");
-        }
-        if (sql.rows().size() > 0) {
-          queries_to_run.insert(node.first);
-        }
+/**
+ * @brief Collect the distributed work from JSON parse events.
+ *
+ * The members of the top-level "discovery", "queries", "cancel", and
+ * "no_cache" keys are kept as they are parsed, without a property tree.
+ */
+class DistributedWorkHandler : public JSONHandler {
+ public:
+  bool startObject() override {
+    return start();
+  }
+
+  bool endObject() override {
+    depth_--;
+    return true;
+  }
+
+  bool startArray() override {
+    return start();
+  }
+
+  bool endArray() override {
+    depth_--;
+    return true;
+  }
+
+  bool key(std::string& name) override {
+    if (depth_ == 1) {
+      section_ = NONE;
+      if (name == "discovery") {
+        section_ = DISCOVERY;
+      } else if (name == "queries") {
+        section_ = QUERIES;
+        has_queries = true;
+      } else if (name == "cancel") {
+        section_ = CANCEL;
+      } else if (name == "no_cache") {
+        section_ = NO_CACHE;
+      } else if (name == "accelerate") {
+        section_ = ACCELERATE;
+        has_accelerate = true;
       }
+    } else if (depth_ == 2) {
+      member_ = std::move(name);
     }
+    return true;
+  }
 
-    auto& queries = tree.get_child("queries");
-    for (const auto& node : queries) {
-      auto query = queries.get<std::string>(node.first, "");
-      if (query.empty() || node.first.empty()) {
-        return Status(1, "Distributed query does not have complete attributes");
-      }
-      if (queries_to_run.empty() || queries_to_run.count(node.first)) {
-        setDatabaseValue(kQueries, kDistributedQueryPrefix + node.first, query);
+  bool value(std::string& value, bool string) override {
+    if (depth_ == 1) {
+      if (section_ == ACCELERATE) {
+        accelerate = std::move(value);
+      } else if (section_ == NO_CACHE) {
+        no_cache_all = (value == "true");
       }
+    } else if (depth_ == 2) {
+      addMember(value);
     }
+    return true;
+  }
+
+ public:
+  /// Discovery query names and queries.
+  std::vector<std::pair<std::string, std::string>> discovery;
+
+  /// Distributed query names and queries.
+  std::vector<std::pair<std::string, std::string>> queries;
+
+  /// IDs of queries to cancel.
+  std::vector<std::string> cancel;
+
+  /// IDs of queries to execute even if a cached result exists.
+  std::set<std::string> no_cache;
+
+  bool no_cache_all{false};
+
+  bool has_queries{false};
+
+  std::string accelerate;
+
+  bool has_accelerate{false};
+
+ private:
+  bool start() {
+    depth_++;
+    if (depth_ == 3) {
+      // A member with a container value has no query.
+      std::string empty;
+      addMember(empty);
+    }
+    return true;
+  }
+
+  /// An ID is a member's value, or its name if the value is empty.
+  void addMember(std::string& value) {
+    if (section_ == DISCOVERY) {
+      discovery.push_back(std::make_pair(std::move(member_), std::move(value)));
+    } else if (section_ == QUERIES) {
+      queries.push_back(std::make_pair(std::move(member_), std::move(value)));
+    } else if (section_ == CANCEL) {
+      cancel.push_back(value.empty() ? member_ : value);
+    } else if (section_ == NO_CACHE) {
+      no_cache.insert(value.empty() ? member_ : value);
+    }
+    member_.clear();
+  }
+
+ private:
+  enum Section {
+    NONE = 0,
+    DISCOVERY,
+    QUERIES,
+    CANCEL,
+    NO_CACHE,
+    ACCELERATE,
+  };
+
+  Section section_{NONE};
+
+  size_t depth_{0};
 
-    if (tree.count("accelerate") > 0) {
-      auto new_time = tree.get<std::string>("accelerate", "");
-      unsigned long duration;
-      Status conversion = safeStrtoul(new_time, 10, duration);
-      if (conversion.ok()) {
-        LOG(INFO) << "Accelerating distributed query checkins for " << duration
-                  << " seconds";
-        setDatabaseValue(kPersistentSettings,
-                         "distributed_accelerate_checkins_expire",
-                         std::to_string(getUnixTime() + duration));
-      } else {
-        LOG(WARNING) << "Failed to Accelerate: Timeframe is not an integer";
+  std::string member_;
+};
+
+Status Distributed::acceptWork(const std::string& work) {
+  DistributedWorkHandler work_handler;
+  auto status = parseJSONEvents(work, work_handler);
+  if (!status.ok()) {
+    return Status(1, "Error parsing JSON: " + status.getMessage());
+  }
+  if (!work_handler.has_queries) {
+    return Status(1, "Error parsing JSON: No such node (queries)");
+  }
+
+  std::set<std::string> queries_to_run;
+  // Check for and run discovery queries first
+  for (const auto& node : work_handler.discovery) {
+    if (node.second.empty() || node.first.empty()) {
+      return Status(
+          1, "Distributed discovery query does not have complete attributes");
+    }
+    SQL sql(node.second);
+    if (!sql.getStatus().ok()) {
+      return Status(1, "Distributed discovery query has an SQL error");
+    }
+    if (sql.rows().size() > 0) {
+      queries_to_run.insert(node.first);
+    }
+  }
+
+  // IDs of pending or running queries, as a list or keys of an object.
+  for (const auto& id : work_handler.cancel) {
+    auto s = cancelQuery(id);
+    if (!s.ok()) {
+      VLOG(1) << s.getMessage();
+    }
+  }
+
+  // Queries to execute even if a cached result exists, true for all.
+  const auto& no_cache = work_handler.no_cache;
+  for (const auto& node : work_handler.queries) {
+    if (node.second.empty() || node.first.empty()) {
+      return Status(1, "Distributed query does not have complete attributes");
+    }
+    if (queries_to_run.empty() || queries_to_run.count(node.first)) {
+      if (work_handler.no_cache_all || no_cache.count(node.first) > 0) {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        no_cache_.insert(node.first);
       }
+      setDatabaseValue(
+          kQueries, kDistributedQueryPrefix + node.first, node.second);
     }
+  }
 
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error parsing JSON: " + std::string(e.what()));
+  if (work_handler.has_accelerate) {
+    unsigned long duration;
+    Status conversion = safeStrtoul(work_handler.accelerate, 10, duration);
+    if (conversion.ok()) {
+      LOG(INFO) << "Accelerating distributed query checkins for " << duration
+                << " seconds";
+      setDatabaseValue(kPersistentSettings,
+                       "distributed_accelerate_checkins_expire",
+                       std::to_string(getUnixTime() + duration));
+    } else {
+      LOG(WARNING) << "Failed to Accelerate: Timeframe is not an integer";
+    }
   }
 
   return Status(0, "OK");
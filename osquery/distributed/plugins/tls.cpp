@@ -16,6 +16,7 @@
 #include <vector>
 #include <sstream>
 
+#include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/distributed.h>
@@ -48,12 +49,20 @@ FLAG(uint64,
      3,
      "Number of times to attempt a request")
 
+FLAG(bool,
+     distributed_tls_compress,
+     false,
+     "GZip compress distributed query results sent to TLS/HTTPS");
+
 class TLSDistributedPlugin : public DistributedPlugin {
  public:
   Status setUp() override;
 
   Status getQueries(std::string& json) override;
 
+  /// Send "long_poll" with the read request, the server may hold it open.
+  Status waitForQueries(std::string& json, size_t wait) override;
+
   Status writeResults(const std::string& json) override;
 
  protected:
@@ -76,18 +85,62 @@ Status TLSDistributedPlugin::getQueries(std::string& json) {
       read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
 }
 
-Status TLSDistributedPlugin::writeResults(const std::string& json) {
+Status TLSDistributedPlugin::waitForQueries(std::string& json, size_t wait) {
   pt::ptree params;
-  try {
-    std::stringstream ss(json);
-    pt::read_json(ss, params);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error parsing JSON: " + std::string(e.what()));
+  params.put("_verb", "POST");
+  params.put("long_poll", wait);
+
+  // The response may take up to the wait, plus the usual request timeout.
+  params.put("_timeout", wait + kTLSRequestTimeout);
+  return TLSRequestHelper::go<JSONSerializer>(
+      read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
+}
+
+Status TLSDistributedPlugin::writeResults(const std::string& json) {
+  // Results may be large, rather than parsing the JSON into a tree to add the
+  // node key, the key is written into the serialized object.
+  auto start = json.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos || json[start] != '{') {
+    return Status(1, "Error parsing JSON: Results must be an object");
+  }
+
+  // With --tls_node_api the node key is part of the URI instead.
+  std::string head = "{";
+  if (!FLAGS_tls_node_api) {
+    auto rest = json.find_first_not_of(" \t\r\n", start + 1);
+    auto node_key = pt::json_parser::create_escapes(getNodeKey("tls"));
+    head += "\"node_key\":\"" + node_key + "\"";
+    if (rest != std::string::npos && json[rest] != '}') {
+      head += ",";
+    }
+  }
+
+  std::string body;
+  bool compress = FLAGS_distributed_tls_compress;
+  if (compress) {
+    StreamCompressor compressor;
+    compressor.append(head);
+    compressor.append(json.data() + start + 1, json.size() - start - 1);
+    body = compressor.finish();
+    if (body.empty()) {
+      return Status(1, "Could not compress TLS/HTTPS request body");
+    }
+  } else {
+    body.reserve(head.size() + json.size() - start - 1);
+    body.append(head).append(json, start + 1, std::string::npos);
   }
 
   // The response is ignored.
-  std::string response;
-  return TLSRequestHelper::go<JSONSerializer>(
-      write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
+  Status status;
+  for (size_t i = 1; i <= FLAGS_distributed_tls_max_attempts; i++) {
+    pt::ptree response;
+    status = TLSRequestHelper::goSerialized<JSONSerializer>(
+        write_uri_, body, compress, response);
+    if (status.ok() || i == FLAGS_distributed_tls_max_attempts) {
+      break;
+    }
+    sleepFor(i * i * 1000);
+  }
+  return status;
 }
 }
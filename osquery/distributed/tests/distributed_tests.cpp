@@ -9,6 +9,7 @@
  */
 
 #include <iostream>
+#include <sstream>
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -171,7 +172,7 @@ TEST_F(DistributedTests, test_deserialize_distributed_query_result_json) {
 }
 
 TEST_F(DistributedTests, test_workflow) {
-  auto dist = Distributed();
+  Distributed dist;
   auto s = dist.pullUpdates();
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(s.toString(), "OK");
@@ -185,4 +186,170 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
   EXPECT_EQ(dist.results_.size(), 0U);
 }
+
+TEST_F(DistributedTests, test_accept_work_errors) {
+  Distributed dist;
+  EXPECT_FALSE(dist.acceptWork("{\"queries\": ").ok());
+  EXPECT_FALSE(dist.acceptWork("{\"discovery\": {}}").ok());
+  EXPECT_FALSE(dist.acceptWork("{\"queries\": {\"a\": {}}}").ok());
+  EXPECT_FALSE(dist.acceptWork("{\"queries\": [\"select 1\"]}").ok());
+  EXPECT_EQ(0U, dist.getPendingQueryCount());
+
+  // Only top-level keys are work, nested members are not queries.
+  auto s = dist.acceptWork(
+      "{\"other\": {\"queries\": {\"b\": \"select 2\"}}, "
+      "\"queries\": {\"a\": \"select 1\"}}");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(1U, dist.getPendingQueryCount());
+  dist.popRequest();
+}
+
+TEST_F(DistributedTests, test_cancel_pending) {
+  Distributed dist;
+  auto s = dist.acceptWork(
+      "{\"queries\": {\"a\": \"select 1\", \"b\": \"select 2\"}}");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(2U, dist.getPendingQueryCount());
+
+  // A cancelled pending query is not run, a failed status is reported.
+  s = dist.acceptWork("{\"queries\": {}, \"cancel\": [\"a\"]}");
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(1U, dist.getPendingQueryCount());
+  ASSERT_EQ(1U, dist.getCompletedCount());
+  EXPECT_EQ("a", dist.results_[0].request.id);
+  EXPECT_FALSE(dist.results_[0].status.ok());
+
+  EXPECT_FALSE(dist.cancelQuery("does_not_exist").ok());
+
+  // The remaining query runs and both results are written.
+  s = dist.runQueries();
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0U, dist.getPendingQueryCount());
+  EXPECT_EQ(0U, dist.getCompletedCount());
+}
+
+TEST_F(DistributedTests, test_serialize_results_chunks) {
+  std::vector<DistributedQueryResult> results(2);
+  results[0].request.id = "a";
+  results[0].columns = {"x"};
+  for (size_t i = 0; i < 10; i++) {
+    results[0].results.push_back({{"x", std::to_string(i)}});
+  }
+  results[1].request.id = "b";
+  results[1].status = Status(1, "Failed");
+
+  // Without a maximum the results are written as one body.
+  std::vector<std::string> bodies;
+  auto write = [&bodies](const std::string& json) {
+    bodies.push_back(json);
+    return Status(0, "OK");
+  };
+  ASSERT_TRUE(Distributed::serializeResults(results, 0, write).ok());
+  ASSERT_EQ(1U, bodies.size());
+  EXPECT_EQ(
+      "{\"queries\":{\"a\":[{\"x\":\"0\"},{\"x\":\"1\"},{\"x\":\"2\"},"
+      "{\"x\":\"3\"},{\"x\":\"4\"},{\"x\":\"5\"},{\"x\":\"6\"},"
+      "{\"x\":\"7\"},{\"x\":\"8\"},{\"x\":\"9\"}],\"b\":\"\"},"
+      "\"statuses\":{\"a\":\"0\",\"b\":\"1\"}}\n",
+      bodies[0]);
+
+  // Large results continue across bodies of the same continuation.
+  bodies.clear();
+  ASSERT_TRUE(Distributed::serializeResults(results, 32, write).ok());
+  ASSERT_GT(bodies.size(), 2U);
+
+  std::string token;
+  size_t rows = 0;
+  for (size_t i = 0; i < bodies.size(); i++) {
+    pt::ptree tree;
+    std::stringstream input(bodies[i]);
+    ASSERT_NO_THROW(pt::read_json(input, tree));
+    if (i == 0) {
+      token = tree.get<std::string>("continuation");
+    }
+    EXPECT_EQ(token, tree.get<std::string>("continuation"));
+    EXPECT_EQ(i, tree.get<size_t>("chunk"));
+    EXPECT_EQ(i + 1 == bodies.size(), tree.get<bool>("final"));
+
+    // The status is written with the last rows of a result.
+    auto a = tree.get_child_optional("queries.a");
+    if (a.is_initialized()) {
+      rows += a->size();
+    }
+    EXPECT_EQ(a.is_initialized() && rows == 10,
+              tree.get_child("statuses").count("a") > 0);
+  }
+  EXPECT_EQ(10U, rows);
+  EXPECT_FALSE(token.empty());
+}
+
+TEST_F(DistributedTests, test_serialize_results_columnar) {
+  std::vector<DistributedQueryResult> results(2);
+  results[0].request.id = "a";
+  results[0].results.push_back({{"x", "0"}, {"y", "1"}});
+  results[0].results.push_back({{"x", "2"}, {"z", "3"}});
+  results[1].request.id = "b";
+
+  std::vector<std::string> bodies;
+  auto write = [&bodies](const std::string& json) {
+    bodies.push_back(json);
+    return Status(0, "OK");
+  };
+  Flag::updateValue("result_encoding", "columnar");
+  auto status = Distributed::serializeResults(results, 0, write);
+  Flag::updateValue("result_encoding", "rows");
+  ASSERT_TRUE(status.ok());
+
+  // Columns are written once, a value missing from a row is empty.
+  ASSERT_EQ(1U, bodies.size());
+  EXPECT_EQ(
+      "{\"queries\":{\"a\":{\"columns\":[\"x\",\"y\",\"z\"],"
+      "\"rows\":[[\"0\",\"1\",\"\"],[\"2\",\"\",\"3\"]]},\"b\":\"\"},"
+      "\"statuses\":{\"a\":\"0\",\"b\":\"0\"},\"encoding\":\"columnar\"}\n",
+      bodies[0]);
+}
+
+TEST_F(DistributedTests, test_result_cache) {
+  auto ttl = Flag::getValue("distributed_cache_ttl");
+  Flag::updateValue("distributed_cache_ttl", "60");
+
+  Distributed dist;
+  auto s = dist.acceptWork(
+      "{\"queries\": {\"c\": \"select 1 as x\"}, \"no_cache\": [\"c\"]}");
+  ASSERT_TRUE(s.ok());
+  dist.popRequest();
+
+  // Identical queries, after normalization, use the first result.
+  DistributedQueryRequest request;
+  request.id = "a";
+  request.query = "select 1 as x";
+  dist.runQuery(request, std::make_shared<std::atomic<bool>>(false));
+  request.id = "b";
+  request.query = "  SELECT 1\n  AS x; ";
+  dist.runQuery(request, std::make_shared<std::atomic<bool>>(false));
+
+  // The server opted out of the cache for this query.
+  request.id = "c";
+  dist.runQuery(request, std::make_shared<std::atomic<bool>>(false));
+
+  ASSERT_EQ(3U, dist.results_.size());
+  EXPECT_FALSE(dist.results_[0].cached);
+  EXPECT_TRUE(dist.results_[1].cached);
+  EXPECT_FALSE(dist.results_[2].cached);
+  ASSERT_EQ(1U, dist.results_[1].results.size());
+  EXPECT_EQ("1", dist.results_[1].results[0]["x"]);
+  EXPECT_EQ(1U, dist.cache_.size());
+
+  // The cache hit is reported in the statuses.
+  std::string json;
+  ASSERT_TRUE(dist.serializeResults(json).ok());
+  pt::ptree tree;
+  std::stringstream input(json);
+  ASSERT_NO_THROW(pt::read_json(input, tree));
+  EXPECT_EQ("0", tree.get<std::string>("statuses.a"));
+  EXPECT_TRUE(tree.get<bool>("statuses.b.cached"));
+  EXPECT_EQ("0", tree.get<std::string>("statuses.c"));
+
+  Flag::updateValue("distributed_cache_ttl", ttl);
+}
 }
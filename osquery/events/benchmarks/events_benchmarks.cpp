@@ -8,9 +8,15 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
 #include <benchmark/benchmark.h>
 
 #include <osquery/config.h>
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/tables.h>
 
@@ -180,4 +186,299 @@ BENCHMARK(EVENTS_add_and_gentable)
     ->ArgPair(0, 100)
     ->ArgPair(0, 1000)
     ->ArgPair(0, 10000);
+
+/// Database plugins compared by the pipeline benchmarks, selected by Arg.
+static const std::vector<std::string> kBenchmarkDatabases = {
+    "rocksdb", "sqlite", "ephemeral"};
+
+/**
+ * @brief A subscriber modeling production, each event callback adds a row.
+ *
+ * The latency of each add is recorded to report a p99.
+ */
+class BenchmarkPipelineSubscriber
+    : public EventSubscriber<BenchmarkEventPublisher> {
+ public:
+  explicit BenchmarkPipelineSubscriber(const std::string& name) {
+    setName(name);
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    Row r;
+    r["path"] = "/usr/bin/benchmark";
+    r["cmdline"] = "benchmark --events --pipeline";
+    r["pid"] = std::to_string(ec->id);
+
+    auto start = std::chrono::steady_clock::now();
+    add(r, ec->time);
+    auto stop = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(latency_lock_);
+    latencies_.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+            .count());
+    return Status(0, "OK");
+  }
+
+  void benchmarkInit() {
+    auto sub_ctx = createSubscriptionContext();
+    subscribe(&BenchmarkPipelineSubscriber::Callback, sub_ctx);
+  }
+
+  size_t getEventsMax() override {
+    return events_max_;
+  }
+
+  void setEventsMax(size_t max) {
+    events_max_ = max;
+  }
+
+  /// Run the expiration checks normally triggered by adds.
+  void benchmarkExpire() {
+    expireCheck();
+  }
+
+  void benchmarkGenTable() {
+    QueryContext ctx;
+    genTable(ctx);
+  }
+
+  /// The p99 add latency in nanoseconds, resets the recorded latencies.
+  size_t p99() {
+    std::lock_guard<std::mutex> lock(latency_lock_);
+    if (latencies_.empty()) {
+      return 0;
+    }
+
+    auto pos = latencies_.size() * 99 / 100;
+    std::nth_element(latencies_.begin(),
+                     latencies_.begin() + pos,
+                     latencies_.end());
+    auto value = latencies_[pos];
+    latencies_.clear();
+    return static_cast<size_t>(value);
+  }
+
+  /// The number of bytes stored for this subscriber's data and records.
+  size_t storedBytes() {
+    size_t bytes = 0;
+    for (const auto& prefix : {"data.", "records."}) {
+      std::vector<std::string> keys;
+      scanDatabaseKeys(kEvents, keys, prefix + dbNamespace());
+      for (const auto& key : keys) {
+        std::string value;
+        getDatabaseValue(kEvents, key, value);
+        bytes += key.size() + value.size();
+      }
+    }
+    return bytes;
+  }
+
+  void clearRows() {
+    auto ee = expire_events_;
+    auto et = expire_time_;
+    expire_events_ = true;
+    expire_time_ = -1;
+    getIndexes(0, 0);
+    expire_events_ = ee;
+    expire_time_ = et;
+  }
+
+ private:
+  /// Add latencies in nanoseconds.
+  std::vector<long long> latencies_;
+
+  /// Protect the recorded latencies, callbacks run in producer threads.
+  std::mutex latency_lock_;
+
+  /// Maximum number of events to buffer.
+  size_t events_max_{100000};
+};
+
+/// Shared state for the multi-threaded pipeline benchmarks.
+static std::shared_ptr<BenchmarkEventPublisher> kPipelinePublisher;
+static std::vector<std::shared_ptr<BenchmarkPipelineSubscriber>>
+    kPipelineSubscribers;
+
+/// Set by the first thread when the publisher and subscribers exist.
+static std::atomic<bool> kPipelineRunning{false};
+
+/// The number of threads that have finished producing.
+static std::atomic<int> kPipelineFinished{0};
+
+/// Benchmark threads wait for the first thread to set up the pipeline.
+static void waitForPipeline() {
+  while (!kPipelineRunning) {
+    std::this_thread::yield();
+  }
+}
+
+/// The first thread waits for every thread to finish before tearing down.
+static bool finishPipeline(benchmark::State& state) {
+  kPipelineFinished++;
+  if (state.thread_index != 0) {
+    return false;
+  }
+
+  while (kPipelineFinished < state.threads) {
+    std::this_thread::yield();
+  }
+  kPipelineRunning = false;
+  return true;
+}
+
+static void setUpPipeline(size_t database, size_t subscribers) {
+  RegistryFactory::get().setActive("database", kBenchmarkDatabases[database]);
+
+  kPipelinePublisher = std::make_shared<BenchmarkEventPublisher>();
+  EventFactory::registerEventPublisher(kPipelinePublisher);
+  for (size_t i = 0; i < subscribers; ++i) {
+    auto sub = std::make_shared<BenchmarkPipelineSubscriber>(
+        "benchmark_pipeline_" + std::to_string(i));
+    EventFactory::registerEventSubscriber(sub);
+    sub->benchmarkInit();
+    kPipelineSubscribers.push_back(sub);
+  }
+  kPipelineFinished = 0;
+}
+
+static void tearDownPipeline(benchmark::State& state) {
+  // Report the worst p99 add latency and bytes stored per event.
+  size_t p99 = 0;
+  size_t bytes = 0;
+  size_t events = 0;
+  for (const auto& sub : kPipelineSubscribers) {
+    p99 = std::max(p99, sub->p99());
+    bytes += sub->storedBytes();
+    events += sub->numEvents();
+  }
+
+  state.SetLabel("p99_add_ns=" + std::to_string(p99) + " bytes_per_event=" +
+                 std::to_string((events > 0) ? bytes / events : 0));
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+
+  for (const auto& sub : kPipelineSubscribers) {
+    sub->clearRows();
+    EventFactory::deregisterEventSubscriber(sub->getName());
+  }
+  kPipelineSubscribers.clear();
+  EventFactory::deregisterEventPublisher(kPipelinePublisher->type());
+  kPipelinePublisher = nullptr;
+
+  RegistryFactory::get().setActive("database", "rocksdb");
+}
+
+/**
+ * @brief N producer threads fire into M subscribers.
+ *
+ * Arguments are the database plugin index and the number of subscribers.
+ */
+static void EVENTS_pipeline_fire(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    setUpPipeline(state.range_x(), state.range_y());
+    kPipelineRunning = true;
+  }
+  waitForPipeline();
+
+  while (state.KeepRunning()) {
+    kPipelinePublisher->benchmarkFire();
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (finishPipeline(state)) {
+    tearDownPipeline(state);
+  }
+}
+
+BENCHMARK(EVENTS_pipeline_fire)
+    ->ArgPair(0, 1)
+    ->ArgPair(0, 4)
+    ->ArgPair(1, 1)
+    ->ArgPair(1, 4)
+    ->ArgPair(2, 1)
+    ->ArgPair(2, 4)
+    ->Threads(1)
+    ->Threads(4)
+    ->Threads(8);
+
+/**
+ * @brief Producer threads fire while the first thread selects from the table.
+ *
+ * Arguments are the database plugin index and the number of subscribers.
+ */
+static void EVENTS_pipeline_gentable(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    setUpPipeline(state.range_x(), state.range_y());
+    kPipelineRunning = true;
+  }
+  waitForPipeline();
+
+  while (state.KeepRunning()) {
+    if (state.thread_index == 0) {
+      kPipelineSubscribers[0]->benchmarkGenTable();
+    } else {
+      kPipelinePublisher->benchmarkFire();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (finishPipeline(state)) {
+    tearDownPipeline(state);
+  }
+}
+
+BENCHMARK(EVENTS_pipeline_gentable)
+    ->ArgPair(0, 1)
+    ->ArgPair(1, 1)
+    ->ArgPair(2, 1)
+    ->Threads(2)
+    ->Threads(4);
+
+/**
+ * @brief Producer threads fire while expiration runs in the background.
+ *
+ * Each subscriber buffers a small number of events so expiration removes
+ * events throughout the benchmark.
+ */
+static void EVENTS_pipeline_expire(benchmark::State& state) {
+  static std::atomic<bool> expiring{false};
+  static std::thread expire_thread;
+
+  if (state.thread_index == 0) {
+    setUpPipeline(state.range_x(), state.range_y());
+    for (const auto& sub : kPipelineSubscribers) {
+      sub->setEventsMax(1000);
+    }
+
+    expiring = true;
+    expire_thread = std::thread([]() {
+      while (expiring) {
+        for (const auto& sub : kPipelineSubscribers) {
+          sub->benchmarkExpire();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    });
+    kPipelineRunning = true;
+  }
+  waitForPipeline();
+
+  while (state.KeepRunning()) {
+    kPipelinePublisher->benchmarkFire();
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (finishPipeline(state)) {
+    expiring = false;
+    expire_thread.join();
+    tearDownPipeline(state);
+  }
+}
+
+BENCHMARK(EVENTS_pipeline_expire)
+    ->ArgPair(0, 1)
+    ->ArgPair(1, 1)
+    ->ArgPair(2, 1)
+    ->Threads(1)
+    ->Threads(4);
 }
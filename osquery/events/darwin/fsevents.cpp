@@ -8,11 +8,13 @@
  *
  */
 
-#include <fnmatch.h>
+#include <algorithm>
+#include <unordered_map>
 
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -46,6 +48,22 @@ std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
 
 REGISTER(FSEventsEventPublisher, "event_publisher", "fsevents");
 
+FLAG(uint64,
+     fsevents_latency,
+     1000,
+     "Milliseconds FSEvents waits to coalesce events before delivery");
+
+FLAG(uint64,
+     fsevents_latency_max,
+     8000,
+     "Max milliseconds the FSEvents latency is raised to while busy");
+
+/// A batch with at least this many events raises the latency.
+const size_t kFSEventsBusyBatch = 1024;
+
+/// A batch with at most this many events lowers the latency.
+const size_t kFSEventsIdleBatch = 64;
+
 void FSEventsSubscriptionContext::requireAction(const std::string& action) {
   for (const auto& bit : kMaskActions) {
     if (action == bit.second) {
@@ -92,13 +110,22 @@ void FSEventsEventPublisher::restart() {
     flags |= kFSEventStreamCreateFlagIgnoreSelf;
   }
 
+  // A stream restarted to change its latency resumes after the last event.
+  FSEventStreamEventId since = kFSEventStreamEventIdSinceNow;
+  if (relatency_.exchange(false) && last_id_ > 0) {
+    since = last_id_;
+  } else {
+    latency_ = FLAGS_fsevents_latency;
+  }
+
   // Create the FSEvent stream.
+  FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
   stream_ = FSEventStreamCreate(nullptr,
                                 &FSEventsEventPublisher::Callback,
-                                nullptr,
+                                &context,
                                 watch_list,
-                                kFSEventStreamEventIdSinceNow,
-                                1,
+                                since,
+                                latency_ / 1000.0,
                                 flags);
   if (stream_ != nullptr) {
     // Schedule the stream on the run loop.
@@ -192,14 +219,17 @@ void FSEventsEventPublisher::configure() {
   {
     WriteLock lock(mutex_);
     paths_.clear();
+    auto index = std::make_shared<PathPatternIndex>();
     for (auto& sub : subscriptions_) {
       auto sc = getSubscriptionContext(sub->context);
-      if (sc->discovered_.size() > 0) {
-        continue;
+      if (sc->discovered_.empty()) {
+        auto paths = transformSubscription(sc);
+        paths_.insert(paths.begin(), paths.end());
       }
-      auto paths = transformSubscription(sc);
-      paths_.insert(paths.begin(), paths.end());
+      index->add(sc, sc->path, sc->matchType());
     }
+    std::atomic_store(&index_,
+                      std::shared_ptr<const PathPatternIndex>(index));
   }
 
   restart();
@@ -223,6 +253,11 @@ Status FSEventsEventPublisher::run() {
 
   // Start the run loop, it may be removed with a tearDown.
   CFRunLoopRun();
+
+  // The callback stops the run loop when the stream latency was tuned.
+  if (relatency_) {
+    restart();
+  }
   return Status(0, "OK");
 }
 
@@ -233,41 +268,117 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  auto publisher = reinterpret_cast<FSEventsEventPublisher*>(callback_info);
+  if (publisher == nullptr) {
+    return;
+  }
+
+  publisher->process(stream,
+                     num_events,
+                     reinterpret_cast<char**>(event_paths),
+                     fsevent_flags,
+                     fsevent_ids);
+
+  auto latency = tuneLatency(publisher->latency_, num_events);
+  if (latency != publisher->latency_ && !publisher->no_defer_) {
+    // The stream is recreated with the new latency by the run loop's thread.
+    publisher->latency_ = latency;
+    publisher->relatency_ = true;
+    CFRunLoopStop(CFRunLoopGetCurrent());
+  }
+}
+
+size_t FSEventsEventPublisher::tuneLatency(size_t latency, size_t num_events) {
+  auto minimum = static_cast<size_t>(FLAGS_fsevents_latency);
+  auto maximum =
+      std::max(minimum, static_cast<size_t>(FLAGS_fsevents_latency_max));
+  if (num_events >= kFSEventsBusyBatch) {
+    return std::min(std::max(latency, static_cast<size_t>(1)) * 2, maximum);
+  } else if (num_events <= kFSEventsIdleBatch) {
+    return std::max(latency / 2, minimum);
+  }
+  return std::min(std::max(latency, minimum), maximum);
+}
+
+void FSEventsEventPublisher::process(
+    ConstFSEventStreamRef stream,
+    size_t num_events,
+    char** event_paths,
+    const FSEventStreamEventFlags fsevent_flags[],
+    const FSEventStreamEventId fsevent_ids[]) {
+  // Coalesce events for the same path, keeping the order of first appearance.
+  struct CoalescedEvent {
+    std::string path;
+    FSEventStreamEventFlags flags{0};
+    FSEventStreamEventId id{0};
+  };
+  std::vector<CoalescedEvent> events;
+  std::unordered_map<std::string, size_t> positions;
   for (size_t i = 0; i < num_events; ++i) {
-    auto ec = createEventContext();
-    ec->fsevent_stream = stream;
-    ec->fsevent_flags = fsevent_flags[i];
-    ec->transaction_id = fsevent_ids[i];
-    ec->path = std::string(((char**)event_paths)[i]);
+    if (fsevent_ids[i] > last_id_) {
+      last_id_ = fsevent_ids[i];
+    }
+    if (fsevent_flags[i] & kFSEventStreamEventFlagHistoryDone) {
+      // A resumed stream delivered the events it missed.
+      continue;
+    }
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
+    std::string path(event_paths[i]);
+    auto position = positions.find(path);
+    if (position == positions.end()) {
+      positions[path] = events.size();
+      events.push_back({std::move(path), fsevent_flags[i], fsevent_ids[i]});
+    } else {
+      events[position->second].flags |= fsevent_flags[i];
+      events[position->second].id = fsevent_ids[i];
+    }
+  }
+
+  auto index = std::atomic_load(&index_);
+  for (auto& event : events) {
+    if (event.flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
-      TLOG << "FSEvents collision, root: " << ec->path;
+      TLOG << "FSEvents collision, root: " << event.path;
     }
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagRootChanged) {
+    if (event.flags & kFSEventStreamEventFlagRootChanged) {
       // Must rescan for the changed root.
     }
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagUnmount) {
+    if (event.flags & kFSEventStreamEventFlagUnmount) {
       // Should remove the watch on this path.
     }
 
+    // Match the path once, the event contexts for each action share it.
+    PathPatternIndex::MatchesRef matches;
+    if (index != nullptr) {
+      matches = index->match(event.path);
+    }
+
+    auto fire = [&](const std::string& action) {
+      auto ec = createEventContext();
+      ec->fsevent_stream = stream;
+      ec->fsevent_flags = event.flags;
+      ec->transaction_id = event.id;
+      ec->path = event.path;
+      ec->action = action;
+      ec->matches = matches;
+      EventFactory::fire<FSEventsEventPublisher>(ec);
+    };
+
     // Record the string-version of the first matched mask bit.
     bool has_action = false;
     for (const auto& action : kMaskActions) {
-      if (ec->fsevent_flags & action.first) {
+      if (event.flags & action.first) {
         // Actions may be multiplexed. Fire and event for each.
-        ec->action = action.second;
-        EventFactory::fire<FSEventsEventPublisher>(ec);
+        fire(action.second);
         has_action = true;
       }
     }
 
     if (!has_action) {
       // If no action was matched for this path event, fire and unknown.
-      ec->action = "UNKNOWN";
-      EventFactory::fire<FSEventsEventPublisher>(ec);
+      fire("UNKNOWN");
     }
   }
 }
@@ -275,17 +386,12 @@ void FSEventsEventPublisher::Callback(
 bool FSEventsEventPublisher::shouldFire(
     const FSEventsSubscriptionContextRef& sc,
     const FSEventsEventContextRef& ec) const {
-  if (sc->recursive && !sc->recursive_match) {
-    ssize_t found = ec->path.find(sc->path);
-    if (found != 0) {
+  if (ec->matches != nullptr && ec->matches->indexed(sc.get())) {
+    // The path was matched against the configured subscriptions once.
+    if (!ec->matches->matched(sc.get())) {
       return false;
     }
-  } else if (fnmatch((sc->path + "*").c_str(),
-                     ec->path.c_str(),
-                     FNM_PATHNAME | FNM_CASEFOLD |
-                         ((sc->recursive_match) ? FNM_LEADING_DIR : 0)) != 0) {
-    // Only apply a leading-dir match if this is a recursive watch with a
-    // match requirement (an inline wildcard with ending recursive wildcard).
+  } else if (!PathPattern(sc->path, sc->matchType()).matches(ec->path)) {
     return false;
   }
 
@@ -21,6 +21,8 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/path_index.h"
+
 namespace osquery {
 
 struct FSEventsSubscriptionContext : public SubscriptionContext {
@@ -40,6 +42,15 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
   /// Append an action.
   void requireAction(const std::string& action);
 
+  /// How event paths are matched with the configured path.
+  PathMatchType matchType() const {
+    if (recursive && !recursive_match) {
+      return PathMatchType::PREFIX;
+    }
+    return (recursive_match) ? PathMatchType::GLOB_LEADING_DIR
+                             : PathMatchType::GLOB;
+  }
+
  private:
   /**
    * @brief The existing configure-time discovered path.
@@ -63,6 +74,9 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
   friend class FSEventsEventPublisher;
 };
 
+using FSEventsSubscriptionContextRef =
+    std::shared_ptr<FSEventsSubscriptionContext>;
+
 struct FSEventsEventContext : public EventContext {
  public:
   ConstFSEventStreamRef fsevent_stream{nullptr};
@@ -71,11 +85,12 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// The configured subscriptions matching the path, if known.
+  PathPatternIndex::MatchesRef matches;
 };
 
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
-using FSEventsSubscriptionContextRef =
-    std::shared_ptr<FSEventsSubscriptionContext>;
 
 /**
  * @brief An osquery EventPublisher for the Apple FSEvents notification API.
@@ -111,6 +126,18 @@ class FSEventsEventPublisher
   bool shouldFire(const FSEventsSubscriptionContextRef& sc,
                   const FSEventsEventContextRef& ec) const override;
 
+  /**
+   * @brief Tune the stream latency to the number of events in a batch.
+   *
+   * Latency doubles, up to --fsevents_latency_max, while batches are busy and
+   * halves back to --fsevents_latency once they are small.
+   *
+   * @param latency the current latency in milliseconds
+   * @param num_events the size of the last batch
+   * @return the latency for the next batches
+   */
+  static size_t tuneLatency(size_t latency, size_t num_events);
+
  private:
   /// Restart the run loop.
   void restart();
@@ -121,6 +148,13 @@ class FSEventsEventPublisher
   /// Cause the FSEvents to flush kernel-buffered events.
   void flush(bool async = false);
 
+  /// Coalesce a callback batch by path and fire an event per path and action.
+  void process(ConstFSEventStreamRef stream,
+               size_t num_events,
+               char** event_paths,
+               const FSEventStreamEventFlags fsevent_flags[],
+               const FSEventStreamEventId fsevent_ids[]);
+
   /**
    * @brief Each subscription is 'parsed' during configuration.
    *
@@ -155,6 +189,18 @@ class FSEventsEventPublisher
   /// Reference to the run loop for this thread.
   CFRunLoopRef run_loop_{nullptr};
 
+  /// The subscription index, replaced when configured.
+  std::shared_ptr<const PathPatternIndex> index_;
+
+  /// The stream latency in milliseconds, tuned by the callback.
+  std::atomic<size_t> latency_{0};
+
+  /// The stream must be restarted to apply a tuned latency.
+  std::atomic<bool> relatency_{false};
+
+  /// The last event ID delivered, a restarted stream resumes after it.
+  std::atomic<FSEventStreamEventId> last_id_{0};
+
  private:
   /// For testing only, ask the event stream to publish events immediately.
   bool no_defer_{false};
@@ -174,5 +220,6 @@ class FSEventsEventPublisher
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
   FRIEND_TEST(FSEventsTests, test_fsevents_embedded_wildcards);
+  FRIEND_TEST(FSEventsTests, test_fsevents_match_subscription);
 };
 }
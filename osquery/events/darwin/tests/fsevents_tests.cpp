@@ -376,4 +376,59 @@ TEST_F(FSEventsTests, test_fsevents_embedded_wildcards) {
   std::set<std::string> expected = {real_test_dir + "/2/1/"};
   EXPECT_EQ(event_pub_->paths_, expected);
 }
+
+TEST_F(FSEventsTests, test_fsevents_match_subscription) {
+  auto pub = std::make_shared<FSEventsEventPublisher>();
+
+  auto recursive = std::make_shared<FSEventsSubscriptionContext>();
+  recursive->path = "/tmp/osquery-a/**";
+  auto glob = std::make_shared<FSEventsSubscriptionContext>();
+  glob->path = "/tmp/osquery-B/*.txt";
+  auto plain = std::make_shared<FSEventsSubscriptionContext>();
+  plain->path = "/tmp/osquery-c";
+
+  auto index = std::make_shared<PathPatternIndex>();
+  for (const auto& sc : {recursive, glob, plain}) {
+    auto mutable_sc = sc;
+    pub->transformSubscription(mutable_sc);
+    index->add(sc, sc->path, sc->matchType());
+  }
+
+  std::vector<std::string> paths = {"/tmp/osquery-a/1/2",
+                                    "/tmp/osquery-b/file.TXT",
+                                    "/tmp/osquery-b/file.log",
+                                    "/tmp/osquery-c",
+                                    "/tmp/osquery-d",
+                                    "/"};
+  for (const auto& path : paths) {
+    // Indexed matches are the same as comparing each subscription.
+    auto ec = std::make_shared<FSEventsEventContext>();
+    ec->path = path;
+    auto indexed = std::make_shared<FSEventsEventContext>();
+    indexed->path = path;
+    indexed->matches = index->match(path);
+    for (const auto& sc : {recursive, glob, plain}) {
+      EXPECT_EQ(pub->shouldFire(sc, ec), pub->shouldFire(sc, indexed))
+          << path;
+    }
+  }
+
+  auto matches = index->match("/tmp/osquery-B/file.txt");
+  EXPECT_TRUE(matches->matched(glob.get()));
+  EXPECT_EQ(1U, matches->size());
+  EXPECT_TRUE(index->match("/tmp/osquery-a/1")->matched(recursive.get()));
+}
+
+TEST_F(FSEventsTests, test_fsevents_latency) {
+  // Busy batches double the latency, up to the max.
+  EXPECT_EQ(2000U, FSEventsEventPublisher::tuneLatency(1000, 5000));
+  EXPECT_EQ(8000U, FSEventsEventPublisher::tuneLatency(8000, 5000));
+
+  // Small batches halve the latency back to the configured value.
+  EXPECT_EQ(4000U, FSEventsEventPublisher::tuneLatency(8000, 1));
+  EXPECT_EQ(1000U, FSEventsEventPublisher::tuneLatency(1000, 1));
+
+  // Other batches keep the latency.
+  EXPECT_EQ(2000U, FSEventsEventPublisher::tuneLatency(2000, 100));
+}
 }
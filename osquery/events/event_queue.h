@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief A bounded, lock-free, multi-producer queue.
+ *
+ * Each cell holds a sequence number that producers and consumers use to claim
+ * it, so neither side takes a lock. A push to a full queue fails immediately
+ * instead of waiting for a consumer.
+ *
+ * The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class BoundedQueue : private boost::noncopyable {
+ public:
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    mask_ = size - 1;
+    cells_ = std::unique_ptr<Cell[]>(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Add an item, returns false if the queue is full.
+  bool push(const T& item) {
+    Cell* cell = nullptr;
+    auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & mask_];
+      auto seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest item, returns false if the queue is empty.
+  bool pop(T& item) {
+    Cell* cell = nullptr;
+    auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & mask_];
+      auto seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    item = std::move(cell->data);
+    cell->data = T();
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// The approximate number of queued items.
+  size_t size() const {
+    auto dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+    auto enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+    return (enqueued > dequeued) ? enqueued - dequeued : 0;
+  }
+
+  /// The number of items the queue holds before a push fails.
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    T data;
+  };
+
+  /// Ring of cells, the size is a power of two.
+  std::unique_ptr<Cell[]> cells_{nullptr};
+
+  /// Mask used to map a position to a cell.
+  size_t mask_{0};
+
+  /// Next position to claim for a push.
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+
+  /// Next position to claim for a pop.
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+};
+}
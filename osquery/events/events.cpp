@@ -8,8 +8,18 @@
  *
  */
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <chrono>
 #include <exception>
+#include <limits>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
@@ -25,6 +35,12 @@
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
+#include "osquery/events/event_queue.h"
+#include "osquery/events/placement.h"
+
+namespace pt = boost::property_tree;
 
 namespace osquery {
 
@@ -48,10 +64,209 @@ FLAG(uint64,
      86000,
      "Timeout to expire event subscriber results");
 
+FLAG(bool,
+     events_subscriber_domains,
+     false,
+     "Store each subscriber's events in its own database domain, a RocksDB "
+     "column family");
+
+FLAG(bool,
+     events_expire_consumed,
+     false,
+     "Expire events once every scheduled query selecting them has read them "
+     "(requires events_optimize)");
+
+FLAG(uint64,
+     events_expire_grace,
+     0,
+     "Seconds consumed events are kept for ad-hoc and distributed queries");
+
 // Access this flag through EventSubscriberPlugin::getEventsMax to allow for
 // overriding in subclasses
 FLAG(uint64, events_max, 1000, "Maximum number of events per type to buffer");
 
+FLAG(uint64,
+     events_memory_max,
+     0,
+     "Maximum number of recent events per type to keep in memory (0 disables)");
+
+FLAG(uint64,
+     events_eid_checkpoint,
+     10,
+     "Number of event IDs reserved by each persisted checkpoint");
+
+FLAG(uint64,
+     events_queue_max,
+     0,
+     "Maximum number of events queued per publisher for subscribers "
+     "(0 calls subscribers within the publisher)");
+
+FLAG(uint64,
+     events_forward_queue_max,
+     0,
+     "Maximum number of events queued for forwarding loggers "
+     "(0 forwards within the subscriber)");
+
+FLAG(string,
+     events_thread_affinity,
+     "",
+     "Comma-separated publisher:cpus pinning publisher threads to CPUs "
+     "(Linux only)");
+
+FLAG(string,
+     events_thread_policy,
+     "",
+     "Comma-separated publisher:policy where policy is batch, idle, or a "
+     "nice level (Linux only)");
+
+FLAG(uint64,
+     events_overload_queue,
+     0,
+     "Queued events per publisher at which subscribers sample events "
+     "(0 disables)");
+
+FLAG(uint64,
+     events_overload_latency,
+     0,
+     "Average microseconds to store an event at which a subscriber samples "
+     "events (0 disables)");
+
+FLAG(uint64,
+     events_sampling,
+     10,
+     "Keep 1 in N events with the same sampling key while overloaded");
+
+FLAG(string,
+     events_sampling_columns,
+     "path,target_path",
+     "Comma-separated event columns, the first present is the sampling key");
+
+/// Maximum number of sampling keys tracked by each subscriber.
+#define EVENTS_SAMPLING_KEYS 4096
+
+/// Maximum number of aggregates kept in memory by each subscriber.
+#define EVENTS_AGGREGATE_KEYS 4096
+
+/// Interval in milliseconds between persisting in-memory events.
+#define EVENTS_FLUSH_INTERVAL 1000
+
+/// Interval in milliseconds between checks of an empty event queue.
+#define EVENTS_QUEUE_INTERVAL 10
+
+/// Maximum number of queued events sent to a logger plugin as one batch.
+#define EVENTS_FORWARD_BATCH 1024
+
+/// Seconds of events in each bin of an indexed column's lookups.
+#define EVENTS_LOOKUP_BIN 3600
+
+/// Maximum number of bytes of an indexed column value kept in a lookup.
+#define EVENTS_LOOKUP_MAX 256
+
+/**
+ * @brief A service that calls subscriber callbacks for queued events.
+ *
+ * This is only started if `events_queue_max` is set. There is one runner per
+ * publisher so each subscriber continues to receive its events in order and
+ * from a single thread.
+ */
+class EventQueueRunner : public InternalRunnable {
+ public:
+  explicit EventQueueRunner(const EventPublisherRef& publisher)
+      : publisher_(publisher) {}
+
+  void start() override {
+    auto queue = std::atomic_load(&publisher_->queue_);
+    if (queue == nullptr) {
+      return;
+    }
+
+    EventContextRef ec;
+    while (!interrupted()) {
+      if (queue->pop(ec)) {
+        publisher_->overloaded_ = FLAGS_events_overload_queue > 0 &&
+                                  queue->size() >= FLAGS_events_overload_queue;
+        publisher_->dispatch(ec);
+        ec = nullptr;
+      } else {
+        pauseMilli(EVENTS_QUEUE_INTERVAL);
+      }
+    }
+  }
+
+ private:
+  /// The publisher whose events are dispatched.
+  EventPublisherRef publisher_;
+};
+
+/**
+ * @brief A service that forwards queued events to logger plugins in batches.
+ *
+ * This is only started if `events_forward_queue_max` is set and an internal
+ * logger plugin uses logEvent. Subscribers only enqueue a shared buffer.
+ */
+class EventForwardRunner : public InternalRunnable {
+ public:
+  void start() override {
+    auto& ef = EventFactory::getInstance();
+    auto queue = std::atomic_load(&ef.forward_queue_);
+    if (queue == nullptr) {
+      return;
+    }
+
+    while (!interrupted()) {
+      if (!drain(*queue)) {
+        pauseMilli(EVENTS_QUEUE_INTERVAL);
+      }
+    }
+
+    // Forward the events that remain.
+    while (drain(*queue)) {
+    }
+  }
+
+ private:
+  /// Send up to a batch of events to each logger, false if none were queued.
+  bool drain(BoundedQueue<LogEventRef>& queue) {
+    LogEventRef event;
+    while (batch_.size() < EVENTS_FORWARD_BATCH && queue.pop(event)) {
+      batch_.push_back(std::move(event));
+    }
+
+    if (batch_.empty()) {
+      return false;
+    }
+
+    for (const auto& logger : EventFactory::getInstance().forwarders_) {
+      logger->logEvents(batch_);
+    }
+    batch_.clear();
+    return true;
+  }
+
+ private:
+  /// Reused between batches to avoid reallocation.
+  std::vector<LogEventRef> batch_;
+};
+
+/**
+ * @brief A service that periodically persists in-memory subscriber events.
+ *
+ * This is only started if `events_memory_max` is set. Subscribers will keep
+ * recent events in memory and this writes them to the backing store in
+ * batches, outside of the publisher threads.
+ */
+class EventsFlushRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    EventFactory::flushEvents();
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::milliseconds(EVENTS_FLUSH_INTERVAL);
+  }
+};
+
 static inline EventTime timeFromRecord(const std::string& record) {
   // Convert a stored index "as string bytes" to a time value.
   long long afinite;
@@ -70,6 +285,127 @@ static inline std::string toIndex(size_t i) {
   return (n >= 10) ? j : std::string(10 - n, '0').append(std::move(j));
 }
 
+/**
+ * @brief Convert an 'index.step' index string into its record key suffix.
+ *
+ * Bins are zero-padded within record keys so the records are stored in time
+ * order, this allows every expired bin to be removed with a single range.
+ */
+static inline std::string toBinKey(const std::string& index) {
+  auto delim = index.find('.');
+  if (delim == std::string::npos) {
+    return toIndex(timeFromRecord(index));
+  }
+  return index.substr(0, delim + 1) +
+         toIndex(timeFromRecord(index.substr(delim + 1)));
+}
+
+/// Order events by time, keeping the insertion order of simultaneous events.
+static bool eventTimeLess(const Row& left, const Row& right) {
+  auto left_time = left.find("time");
+  auto right_time = right.find("time");
+  if (left_time == left.end() || right_time == right.end()) {
+    return false;
+  }
+  return (timeFromRecord(left_time->second) <
+          timeFromRecord(right_time->second));
+}
+
+/**
+ * @brief The value of an indexed column within its lookup keys.
+ *
+ * ASCII letters are folded, as a LIKE prefix matches either case, and long
+ * values are truncated. A lookup may include events that do not match, the
+ * rows are matched again when read.
+ */
+static inline std::string toLookupValue(const std::string& value) {
+  auto lookup = value.substr(0, EVENTS_LOOKUP_MAX);
+  for (auto& c : lookup) {
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c - 'A' + 'a');
+    }
+  }
+  return lookup;
+}
+
+/// The EQUALS and LIKE expressions constraining an indexed column.
+struct EventLookup {
+  std::string column;
+  std::set<std::string> equals;
+  std::set<std::string> likes;
+};
+
+/// A row matches if it matches any expression of every constrained column.
+static bool lookupsMatch(const std::vector<EventLookup>& lookups,
+                         const Row& r) {
+  for (const auto& lookup : lookups) {
+    auto value = r.find(lookup.column);
+    if (value == r.end()) {
+      return false;
+    }
+
+    bool matched = (lookup.equals.count(value->second) > 0);
+    for (const auto& like : lookup.likes) {
+      if (matched) {
+        break;
+      }
+      matched = likeMatches(like, value->second);
+    }
+    if (!matched) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Read event data keys, in order, until the limit of rows is read.
+ *
+ * A limited read continues if some data was missing or did not match.
+ */
+static void getEventData(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         size_t limit,
+                         const std::vector<EventLookup>& lookups,
+                         QueryData& results) {
+  // Select the keys in as few reads as the limit allows.
+  size_t offset = 0;
+  while (offset < keys.size() && (limit == 0 || results.size() < limit)) {
+    auto count = keys.size() - offset;
+    if (limit > 0) {
+      count = std::min(count, limit - results.size());
+    }
+
+    std::vector<std::string> read(keys.begin() + offset,
+                                  keys.begin() + offset + count);
+    offset += count;
+
+    std::vector<std::string> data_values;
+    getDatabaseValues(domain, read, data_values);
+    for (const auto& data_value : data_values) {
+      if (data_value.length() == 0) {
+        // There is no record here, interesting error case.
+        continue;
+      }
+
+      Row r;
+      if (deserializeRowBinary(data_value, r).ok() &&
+          lookupsMatch(lookups, r)) {
+        results.push_back(std::move(r));
+      }
+    }
+  }
+}
+
+/// Read the time a scheduled query last selected events until.
+static inline EventTime getOptimizeTime(const std::string& query_name) {
+  std::string content;
+  getDatabaseValue(kEvents, "optimize." + query_name, content);
+  long long optimize_time = 0;
+  safeStrtoll(content, 10, optimize_time);
+  return static_cast<EventTime>(optimize_time);
+}
+
 static inline void getOptimizeData(EventTime& o_time,
                                    size_t& o_eid,
                                    std::string& query_name,
@@ -82,14 +418,7 @@ static inline void getOptimizeData(EventTime& o_time,
     return;
   }
 
-  {
-    std::string content;
-    getDatabaseValue(kEvents, "optimize." + query_name, content);
-    long long optimize_time = 0;
-    safeStrtoll(content, 10, optimize_time);
-    o_time = static_cast<EventTime>(optimize_time);
-  }
-
+  o_time = getOptimizeTime(query_name);
   {
     std::string content;
     getDatabaseValue(kEvents, "optimize_eid." + query_name, content);
@@ -116,6 +445,10 @@ static inline void setOptimizeData(EventTime time,
 QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
   // Stop is an unsigned (-1), our end of time equivalent.
   EventTime start = 0, stop = 0;
+  // Optimized queries must read every new event.
+  bool optimized = false;
+  // Scheduled queries read the events since their last run.
+  bool scheduled = false;
   if (context.constraints["time"].getAll().size() > 0) {
     // Use the 'time' constraint to optimize backing-store lookups.
     for (const auto& constraint : context.constraints["time"].getAll()) {
@@ -140,6 +473,8 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
     getOptimizeData(optimize_time_, optimize_eid_, query_name, dbNamespace());
     start = optimize_time_;
     optimize_time_ = getUnixTime() - 1;
+    optimized = true;
+    scheduled = !query_name.empty();
 
     // Track the queries that have selected data.
     WriteLock lock(event_query_record_);
@@ -147,7 +482,140 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
       queries_.insert(query_name);
     }
   }
-  return get(start, stop);
+
+  // The earliest events satisfy a LIMIT unless they are read descending.
+  size_t limit = 0;
+  if (context.limit && !optimized && !context.orderDescending) {
+    limit = std::max(*context.limit, static_cast<size_t>(1));
+  }
+
+  // The events since a scheduled query's last run are read by time.
+  QueryData results;
+  if (!scheduled && getIndexed(start, stop, limit, context, results)) {
+    return results;
+  }
+  return get(start, stop, limit);
+}
+
+bool EventSubscriberPlugin::getIndexed(EventTime start,
+                                       EventTime stop,
+                                       size_t limit,
+                                       QueryContext& context,
+                                       QueryData& results) {
+  std::vector<EventLookup> lookups;
+  for (const auto& column : indexed_columns_) {
+    auto list = context.constraints.find(column);
+    if (list == context.constraints.end()) {
+      continue;
+    }
+
+    EventLookup lookup;
+    lookup.column = column;
+    lookup.equals = list->second.getAll(EQUALS);
+    lookup.likes = list->second.getAll(LIKE);
+    if (!lookup.equals.empty() || !lookup.likes.empty()) {
+      lookups.push_back(std::move(lookup));
+    }
+  }
+
+  if (lookups.empty()) {
+    return false;
+  }
+
+  // Use the first column whose expressions each have a lookup prefix, and
+  // if the prefix is an entire value.
+  std::string column;
+  std::vector<std::pair<std::string, bool>> prefixes;
+  for (const auto& lookup : lookups) {
+    prefixes.clear();
+    for (const auto& expr : lookup.equals) {
+      prefixes.push_back(std::make_pair(toLookupValue(expr), true));
+    }
+    for (const auto& expr : lookup.likes) {
+      auto prefix = expr.substr(0, expr.find_first_of("%_"));
+      if (prefix.empty()) {
+        break;
+      }
+      prefixes.push_back(std::make_pair(toLookupValue(prefix), false));
+    }
+
+    if (prefixes.size() == lookup.equals.size() + lookup.likes.size()) {
+      column = lookup.column;
+      break;
+    }
+  }
+
+  if (column.empty()) {
+    // Every event is read, the earliest matching events satisfy a LIMIT.
+    results = get(start, stop);
+    results.erase(std::remove_if(results.begin(),
+                                 results.end(),
+                                 [&lookups](const Row& r) {
+                                   return !lookupsMatch(lookups, r);
+                                 }),
+                  results.end());
+    if (limit > 0 && results.size() > limit) {
+      std::stable_sort(results.begin(), results.end(), eventTimeLess);
+      results.resize(limit);
+    }
+    return true;
+  }
+
+  // Only persisted events are indexed.
+  flushEvents();
+
+  // Each lookup bin overlapping the requested time range is scanned.
+  std::set<EventTime> bins;
+  for (const auto& index : getIndexes(start, stop)) {
+    auto step = timeFromRecord(index.substr(index.find('.') + 1));
+    bins.insert(step * 60 / EVENTS_LOOKUP_BIN);
+  }
+
+  // Lookups are keyed: 'lookup.NS.COLUMN.BIN.VALUE.TIME.EID'.
+  auto lookup_key = "lookup." + dbNamespace() + "." + column + ".";
+  std::set<std::pair<EventTime, std::string>> records;
+  for (const auto& bin : bins) {
+    auto bin_key = lookup_key + toIndex(bin) + ".";
+    for (const auto& prefix : prefixes) {
+      std::vector<std::string> keys;
+      auto value_key = bin_key + prefix.first;
+      if (prefix.second) {
+        value_key += '.';
+      }
+      scanDatabaseKeys(dbDomain(), keys, value_key);
+
+      for (const auto& key : keys) {
+        // Values may include '.', the time and EID are the last fields.
+        auto eid_delim = key.rfind('.');
+        if (eid_delim == std::string::npos || eid_delim <= bin_key.size()) {
+          continue;
+        }
+        auto time_delim = key.rfind('.', eid_delim - 1);
+        if (time_delim == std::string::npos || time_delim < bin_key.size() ||
+            (prefix.second &&
+             time_delim - bin_key.size() != prefix.first.size())) {
+          continue;
+        }
+
+        auto time = timeFromRecord(
+            key.substr(time_delim + 1, eid_delim - time_delim - 1));
+        if (time >= start && (time <= stop || stop == 0)) {
+          records.insert(std::make_pair(time, key.substr(eid_delim + 1)));
+        }
+      }
+    }
+  }
+
+  std::string events_key = "data." + dbNamespace();
+  std::vector<std::string> mapped_records;
+  for (const auto& record : records) {
+    mapped_records.push_back(events_key + "." + toIndex(record.first) + "." +
+                             record.second);
+  }
+
+  getEventData(dbDomain(), mapped_records, limit, lookups, results);
+  applyExpiration();
+  return true;
 }
 
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
@@ -156,11 +624,7 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     return;
   }
 
-  EventContextID ec_id = 0;
-  {
-    WriteLock lock(ec_id_lock_);
-    ec_id = next_ec_id_++;
-  }
+  EventContextID ec_id = next_ec_id_++;
 
   // Fill in EventContext ID and time if needed.
   if (ec != nullptr) {
@@ -173,11 +637,30 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     }
   }
 
-  WriteLock lock(subscription_lock_);
-  for (const auto& subscription : subscriptions_) {
-    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
+  auto queue = std::atomic_load(&queue_);
+  if (queue != nullptr) {
+    // Subscribers are called by the queue's runner.
+    if (!queue->push(ec)) {
+      dropped_events_++;
+    }
+    return;
+  }
+
+  dispatch(ec);
+}
+
+void EventPublisherPlugin::dispatch(const EventContextRef& ec) {
+  auto targets = std::atomic_load(&targets_);
+  if (targets == nullptr) {
+    return;
+  }
+
+  bool overloaded = overloaded_;
+  for (const auto& target : *targets) {
+    const auto& es = target.second;
     if (es != nullptr && es->state() == EventState::EVENT_RUNNING) {
-      fireCallback(subscription, ec);
+      es->publisher_overloaded_ = overloaded;
+      fireCallback(target.first, ec);
     }
   }
 }
@@ -192,7 +675,7 @@ std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
   EventTime r_stop = (stop > 0) ? stop / 60 + 1 : 0;
 
   std::string content;
-  getDatabaseValue(kEvents, index_key + ".60", content);
+  getDatabaseValue(dbDomain(), index_key + ".60", content);
   if (content.empty()) {
     return indexes;
   }
@@ -206,7 +689,7 @@ std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
     if (step_stop <= expire_time_) {
       expirations.push_back(bin);
     } else if (step_start < expire_time_ && sort) {
-      expireRecords("60", bin, false);
+      expireRecords("60", bin);
     }
 
     if (step >= l_start && (r_stop == 0 || step < r_stop) && sort) {
@@ -235,42 +718,27 @@ std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
 }
 
 void EventSubscriberPlugin::expireRecords(const std::string& list_type,
-                                          const std::string& index,
-                                          bool all) {
+                                          const std::string& index) {
   if (!executedAllQueries()) {
     return;
   }
 
   auto record_key = "records." + dbNamespace();
   auto data_key = "data." + dbNamespace();
+  auto bin_key = record_key + "." + toBinKey(list_type + "." + index);
 
-  // If the expirations is not removing all records, rewrite the persisting.
-  std::vector<std::string> persisting_records;
   // Request all records within this list-size + bin offset.
   auto expired_records = getRecords({list_type + '.' + index}, false);
-  if (all && expired_records.size() > 1) {
-    deleteDatabaseRange(kEvents,
-                        data_key + '.' + expired_records.begin()->first,
-                        data_key + '.' + expired_records.rbegin()->first);
-  } else {
-    for (const auto& record : expired_records) {
-      if (record.second <= expire_time_) {
-        deleteDatabaseValue(kEvents, data_key + '.' + record.first);
-      } else {
-        persisting_records.push_back(record.first + ':' +
-                                     std::to_string(record.second));
-      }
+  for (const auto& record : expired_records) {
+    if (record.second <= expire_time_) {
+      auto time_value = std::to_string(record.second);
+      deleteDatabaseValue(
+          dbDomain(),
+          data_key + '.' + toIndex(record.second) + '.' + record.first);
+      deleteDatabaseValue(dbDomain(),
+                          bin_key + '.' + record.first + ':' + time_value);
     }
   }
-
-  // Either drop or overwrite the record list.
-  if (all) {
-    deleteDatabaseValue(kEvents, record_key + "." + list_type + "." + index);
-  } else if (persisting_records.size() < expired_records.size()) {
-    auto new_records = boost::algorithm::join(persisting_records, ",");
-    setDatabaseValue(
-        kEvents, record_key + "." + list_type + "." + index, new_records);
-  }
 }
 
 void EventSubscriberPlugin::expireIndexes(
@@ -282,12 +750,39 @@ void EventSubscriberPlugin::expireIndexes(
   }
 
   auto index_key = "indexes." + dbNamespace();
+  auto record_key = "records." + dbNamespace();
+  auto data_key = "data." + dbNamespace();
+
+  // Data keys are ordered by event time, and record keys by bin. Expired bins
+  // end before the expire time so every record and datum within them, and any
+  // other datum before the expire time, is removed using a range.
+  auto list_size = timeFromRecord(list_type);
+  auto expire_bin = (list_size > 0) ? expire_time_ / list_size : 0;
+  deleteDatabaseRange(dbDomain(),
+                      record_key + "." + list_type + ".",
+                      record_key + "." + list_type + "." + toIndex(expire_bin));
+  deleteDatabaseRange(
+      dbDomain(), data_key + ".", data_key + "." + toIndex(expire_time_ + 1));
+
+  // Lookups are binned by time in the same way.
+  auto lookup_bin = expire_time_ / EVENTS_LOOKUP_BIN;
+  for (const auto& column : indexed_columns_) {
+    auto lookup_key = "lookup." + dbNamespace() + "." + column + ".";
+    deleteDatabaseRange(
+        dbDomain(), lookup_key, lookup_key + toIndex(lookup_bin));
+  }
 
   // Construct a mutable list of persisting indexes to rewrite as records.
   std::vector<std::string> persisting_indexes = indexes;
-  // Remove the records using the list of expired indexes.
   for (const auto& bin : expirations) {
-    expireRecords(list_type, bin, true);
+    // Remove a legacy comma-joined record list, if one exists.
+    deleteDatabaseValue(dbDomain(), record_key + "." + list_type + "." + bin);
+    {
+      WriteLock lock(event_record_lock_);
+      if (last_record_bin_ == bin) {
+        last_record_bin_.clear();
+      }
+    }
     persisting_indexes.erase(
         std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
         persisting_indexes.end());
@@ -295,86 +790,51 @@ void EventSubscriberPlugin::expireIndexes(
 
   // Update the list of indexes with the non-expired indexes.
   auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
-  setDatabaseValue(kEvents, index_key + "." + list_type, new_indexes);
+  setDatabaseValue(dbDomain(), index_key + "." + list_type, new_indexes);
 }
 
 void EventSubscriberPlugin::expireCheck() {
   auto data_key = "data." + dbNamespace();
-  auto eid_key = "eid." + dbNamespace();
-  // Min key will be the last surviving key.
-  size_t threshold_key = 0;
-
-  {
-    auto limit = getEventsMax();
-    std::vector<std::string> keys;
-    scanDatabaseKeys(kEvents, keys, data_key);
-    if (keys.size() <= limit) {
-      return;
-    }
-
-    // There is an overflow of events buffered for this subscriber.
-    LOG(WARNING) << "Expiring events for subscriber: " << getName()
-                 << " (overflowed limit " << limit << ")";
-    VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
-            << " by: " << keys.size() - limit;
-    // Inspect the N-FLAGS_events_max -th event's value and expire before the
-    // time within the content.
-    std::string last_key;
-    getDatabaseValue(kEvents, eid_key, last_key);
-    // The EID is the next-index.
-    // EID - events_max is the most last-recent event to keep.
-    threshold_key = boost::lexical_cast<size_t>(last_key) - getEventsMax();
-
-    // Scan each of the keys in keys, if their ID portion is < threshold.
-    // Nix them, this requires lots of conversions, use with care.
-    std::string max_key;
-    std::string min_key;
-    unsigned long min_key_value = 0;
-    unsigned long max_key_value = 0;
-    for (const auto& key : keys) {
-      unsigned long key_value = 0;
-      safeStrtoul(key.substr(key.rfind('.') + 1), 10, key_value);
-
-      if (key_value < static_cast<unsigned long>(threshold_key)) {
-        min_key_value = (min_key_value == 0 || key_value < min_key_value)
-                            ? key_value
-                            : min_key_value;
-        if (min_key_value == key_value) {
-          min_key = key;
-        }
-
-        max_key_value = (key_value > max_key_value) ? key_value : max_key_value;
-        if (max_key_value == key_value) {
-          max_key = key;
-        }
-      }
-    }
+  auto limit = getEventsMax();
 
-    if (!min_key.empty()) {
-      if (max_key_value == min_key_value) {
-        deleteDatabaseValue(kEvents, min_key);
-      } else {
-        deleteDatabaseRange(kEvents, min_key, max_key);
-      }
-    }
+  std::vector<std::string> keys;
+  scanDatabaseKeys(dbDomain(), keys, data_key + ".");
+  if (keys.size() <= limit) {
+    return;
   }
 
-  // Convert the key index into a time using the content.
-  // The last-recent event is fetched and the corresponding time is used as
-  // the expiration time for the subscriber.
-  std::string content;
-  getDatabaseValue(kEvents, data_key + "." + toIndex(threshold_key), content);
+  // There is an overflow of events buffered for this subscriber.
+  LOG(WARNING) << "Expiring events for subscriber: " << getName()
+               << " (overflowed limit " << limit << ")";
+  VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
+          << " by: " << keys.size() - limit;
+
+  // Data keys are ordered by event time: 'data.NS.TIME.EID'. The events
+  // before the N-events_max -th key are removed with a single range.
+  const auto& threshold_key = keys[keys.size() - limit];
+  deleteDatabaseRange(dbDomain(), keys.front(), keys[keys.size() - limit - 1]);
 
-  // Decode the value into a row structure to extract the time.
-  Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
+  // The time of the last-recent event to keep is the implicit expiration
+  // time for the subscriber.
+  auto time_start = data_key.size() + 1;
+  auto time_stop = threshold_key.find('.', time_start);
+  if (time_stop == std::string::npos) {
+    // A legacy datum without an event time.
     return;
   }
 
-  // The last time will become the implicit expiration time.
-  size_t last_time = boost::lexical_cast<size_t>(r.at("time"));
+  auto last_time =
+      timeFromRecord(threshold_key.substr(time_start, time_stop - time_start));
   if (last_time > 0) {
     expire_time_ = last_time - (last_time % 60);
+
+    // Lookup bins before the oldest event kept only reference removed data.
+    auto lookup_bin = last_time / EVENTS_LOOKUP_BIN;
+    for (const auto& column : indexed_columns_) {
+      auto lookup_key = "lookup." + dbNamespace() + "." + column + ".";
+      deleteDatabaseRange(
+          dbDomain(), lookup_key, lookup_key + toIndex(lookup_bin));
+    }
   }
 
   // Finally, attempt an index query to trigger expirations.
@@ -382,6 +842,10 @@ void EventSubscriberPlugin::expireCheck() {
   getIndexes(expire_time_, 0, false);
 }
 
+const std::string& EventSubscriberPlugin::dbDomain() const {
+  return (db_domain_.empty()) ? kEvents : db_domain_;
+}
+
 bool EventSubscriberPlugin::executedAllQueries() const {
   ReadLock lock(event_query_record_);
   return queries_.size() >= query_count_;
@@ -393,24 +857,20 @@ std::vector<EventRecord> EventSubscriberPlugin::getRecords(
 
   std::vector<EventRecord> records;
   for (const auto& index : indexes) {
+    // Each record is a key within the bin: 'records.NS.60.BIN.EID:TIME'.
+    auto bin_prefix = record_key + "." + toBinKey(index) + ".";
     std::vector<std::string> bin_records;
-    {
-      std::string record_value;
-      getDatabaseValue(kEvents, record_key + "." + index, record_value);
-      if (record_value.empty()) {
-        // There are actually no events in this bin, interesting error case.
+    scanDatabaseKeys(dbDomain(), bin_records, bin_prefix);
+
+    for (const auto& bin_record : bin_records) {
+      auto delim = bin_record.find(':', bin_prefix.size());
+      if (delim == std::string::npos) {
+        // An unexpected record format, likely a legacy list.
         continue;
       }
 
-      // Each list is tokenized into a record=event_id:time.
-      boost::split(bin_records, record_value, boost::is_any_of(",:"));
-    }
-
-    auto bin_it = bin_records.begin();
-    // Iterate over every 2 items: EID:TIME.
-    for (; bin_it != bin_records.end(); bin_it++) {
-      const auto& eid = *bin_it;
-      EventTime et = timeFromRecord(*(++bin_it));
+      auto eid = bin_record.substr(bin_prefix.size(), delim - bin_prefix.size());
+      EventTime et = timeFromRecord(bin_record.substr(delim + 1));
       if (FLAGS_events_optimize && optimize && et <= optimize_time_ + 1) {
         // There is an optimization collision, check for colliding IDs.
         auto eidr = timeFromRecord(eid);
@@ -418,14 +878,16 @@ std::vector<EventRecord> EventSubscriberPlugin::getRecords(
           continue;
         }
       }
-      records.push_back(std::make_pair(eid, et));
+      records.push_back(std::make_pair(std::move(eid), et));
     }
   }
 
   return records;
 }
 
-Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime et) {
+Status EventSubscriberPlugin::recordEvent(EventID& eid,
+                                          EventTime et,
+                                          DatabaseStringValueList& batch) {
   std::string time_value = boost::lexical_cast<std::string>(et);
 
   // The record is identified by the event type then module name.
@@ -434,169 +896,696 @@ Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime et) {
   // The list key includes the list type (bin size) and the list ID (bin).
   std::string list_id;
 
-  // The list_id is the MOST-Specific key ID, the bin for this list.
-  // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-  list_id = boost::lexical_cast<std::string>(et / 60);
+  // The list_id is the MOST-Specific key ID, the bin for this list.
+  // If the event time was 13 and the time_list is 5 seconds, lid = 2.
+  list_id = boost::lexical_cast<std::string>(et / 60);
+  auto bin_key = record_key + ".60." + toIndex(et / 60);
+
+  WriteLock lock(event_record_lock_);
+  if (list_id != last_record_bin_) {
+    // Most events arrive in time order, only inspect the backing store when
+    // the bin changes. A bin without records is new for this list_key.
+    std::vector<std::string> bin_records;
+    scanDatabaseKeys(dbDomain(), bin_records, bin_key + ".", 1);
+    if (bin_records.empty()) {
+      // This is a new list_id for list_key, append the ID to the indirect
+      // lookup for this list_key.
+      std::string index_value;
+      getDatabaseValue(dbDomain(), index_key + ".60", index_value);
+      if (index_value.length() == 0) {
+        // A new index.
+        index_value = list_id;
+      } else {
+        index_value += "," + list_id;
+      }
+      setDatabaseValue(dbDomain(), index_key + ".60", index_value);
+    }
+    last_record_bin_ = list_id;
+  }
+
+  // Each record is written once as its own key, the EID/time is tokenized
+  // using ':'. The time is duplicated as the value for debugging.
+  batch.push_back(
+      std::make_pair(bin_key + "." + eid + ":" + time_value, time_value));
+  return Status(0, "OK");
+}
+
+size_t EventSubscriberPlugin::getEventsExpiry() {
+  return FLAGS_events_expiry;
+}
+
+size_t EventSubscriberPlugin::getEventsMax() {
+  return FLAGS_events_max;
+}
+
+size_t EventSubscriberPlugin::getEventID() {
+  std::string eid_key = "eid." + dbNamespace();
+  if (!eid_loaded_) {
+    // First get the last checkpoint from the meta key.
+    WriteLock lock(event_id_lock_);
+    if (!eid_loaded_) {
+      std::string last_eid_value;
+      unsigned long int last_eid = 0;
+      auto status = getDatabaseValue(kEvents, eid_key, last_eid_value);
+      if (status.ok() && !last_eid_value.empty()) {
+        safeStrtoul(last_eid_value, 10, last_eid);
+      }
+      last_eid_ = static_cast<size_t>(last_eid);
+      eid_checkpoint_ = last_eid_.load();
+      eid_loaded_ = true;
+    }
+  }
+
+  auto eid = ++last_eid_;
+  if (eid > eid_checkpoint_) {
+    // Reserve the next stride of EventIDs before using any of them. Only the
+    // producer that crosses a checkpoint persists the next.
+    WriteLock lock(event_id_lock_);
+    if (eid > eid_checkpoint_) {
+      auto stride = std::max(static_cast<size_t>(FLAGS_events_eid_checkpoint),
+                             static_cast<size_t>(1));
+      auto checkpoint = eid + stride - 1;
+      setDatabaseValue(kEvents, eid_key, toIndex(checkpoint));
+      eid_checkpoint_ = checkpoint;
+    }
+  }
+  return eid;
+}
+
+bool EventSubscriberPlugin::getBuffered(EventTime start,
+                                        EventTime stop,
+                                        QueryData& results) {
+  ReadLock lock(buffered_lock_);
+  if (buffered_since_ == 0 || start < buffered_since_) {
+    // The in-memory events do not include every event in this range.
+    return false;
+  }
+
+  bool expire = (expire_time_ > 0 && executedAllQueries());
+  for (const auto& event : buffered_events_) {
+    if (FLAGS_events_optimize && event.time <= optimize_time_ + 1 &&
+        event.eid <= optimize_eid_) {
+      // See getRecords, apply the same optimization collision checks.
+      continue;
+    }
+
+    if (expire && event.time <= expire_time_) {
+      continue;
+    }
+
+    if (event.time >= start && (event.time <= stop || stop == 0)) {
+      results.push_back(event.row);
+    }
+  }
+
+  if (FLAGS_events_optimize && !buffered_events_.empty()) {
+    // Mirror the backing store behavior of saving the last EID.
+    optimize_eid_ = buffered_events_.back().eid;
+  }
+  return true;
+}
+
+void EventSubscriberPlugin::bufferEvent(size_t eid,
+                                        EventTime time,
+                                        const Row& r) {
+  auto max = std::min(static_cast<size_t>(FLAGS_events_memory_max),
+                      getEventsMax());
+
+  bool flush = false;
+  {
+    WriteLock lock(buffered_lock_);
+    if (buffered_since_ == 0) {
+      // Events persisted before now may not be in memory.
+      buffered_since_ = getUnixTime() + 1;
+    }
+
+    buffered_events_.push_back({eid, time, r});
+    buffered_pending_++;
+    while (buffered_events_.size() > max &&
+           buffered_pending_ < buffered_events_.size()) {
+      // The oldest event has been persisted and can be dropped.
+      auto& front = buffered_events_.front();
+      buffered_since_ = std::max(buffered_since_, front.time + 1);
+      buffered_events_.pop_front();
+    }
+    flush = (buffered_events_.size() > max);
+  }
+
+  if (flush) {
+    // The flush service has fallen behind, persist within this thread.
+    flushEvents();
+  }
+}
+
+void EventSubscriberPlugin::flushEvents(bool all) {
+  // Skipped events are counted once the overload ends.
+  flushSampling(all);
+
+  // Completed buckets are persisted, and every bucket when ending or when
+  // the aggregation was removed.
+  auto aggregation = std::atomic_load(&aggregation_);
+  if (all || aggregation == nullptr) {
+    flushAggregates(std::numeric_limits<EventTime>::max());
+  } else {
+    auto now = getUnixTime();
+    flushAggregates(now - now % aggregation->interval);
+  }
+
+  WriteLock flush_lock(flush_lock_);
+
+  std::vector<std::pair<size_t, Row>> pending;
+  {
+    WriteLock lock(buffered_lock_);
+    if (buffered_pending_ == 0) {
+      return;
+    }
+
+    auto it = buffered_events_.end() - buffered_pending_;
+    for (; it != buffered_events_.end(); ++it) {
+      pending.push_back(std::make_pair(it->eid, it->row));
+    }
+    buffered_pending_ = 0;
+  }
+
+  DatabaseStringValueList batch;
+  for (auto& event : pending) {
+    auto event_time = timeFromRecord(event.second["time"]);
+    prepareEvent(event.first, event.second, event_time, batch);
+  }
+  setDatabaseBatch(dbDomain(), batch);
+}
+
+size_t EventSubscriberPlugin::getBufferedBytes() {
+  ReadLock lock(buffered_lock_);
+  size_t bytes = 0;
+  for (const auto& event : buffered_events_) {
+    bytes += sizeof(BufferedEvent);
+    for (const auto& column : event.row) {
+      bytes += column.first.size() + column.second.size();
+    }
+  }
+  return bytes;
+}
+
+void EventSubscriberPlugin::releaseBuffered() {
+  flushEvents();
+
+  WriteLock lock(buffered_lock_);
+  // Events buffered since the flush are kept until the next flush.
+  while (buffered_pending_ < buffered_events_.size()) {
+    auto& front = buffered_events_.front();
+    buffered_since_ = std::max(buffered_since_, front.time + 1);
+    buffered_events_.pop_front();
+  }
+  buffered_events_.shrink_to_fit();
+}
+
+QueryData EventSubscriberPlugin::get(EventTime start,
+                                     EventTime stop,
+                                     size_t limit) {
+  QueryData results;
+  if (getBuffered(start, stop, results)) {
+    // All of the events in this range were in memory.
+    if (limit > 0 && results.size() > limit) {
+      std::stable_sort(results.begin(), results.end(), eventTimeLess);
+      results.resize(limit);
+    }
+    applyExpiration();
+    return results;
+  }
+
+  // Persist in-memory events before using the backing store.
+  flushEvents();
+
+  // Get the records for this time range.
+  auto indexes = getIndexes(start, stop);
+  auto records = getRecords(indexes);
+
+  if (FLAGS_events_optimize && !records.empty()) {
+    // If records were returned save the ordered-last as the optimization EID.
+    unsigned long int eidr = 0;
+    if (safeStrtoul(records.back().first, 10, eidr)) {
+      optimize_eid_ = static_cast<size_t>(eidr);
+    }
+  }
+
+  std::vector<const EventRecord*> ordered;
+  ordered.reserve(records.size());
+  for (const auto& record : records) {
+    ordered.push_back(&record);
+  }
+
+  if (limit > 0) {
+    // Only the earliest records are read from the backing store.
+    std::stable_sort(ordered.begin(),
+                     ordered.end(),
+                     [](const EventRecord* left, const EventRecord* right) {
+                       return left->second < right->second;
+                     });
+  }
+
+  std::string events_key = "data." + dbNamespace();
+  std::vector<std::string> mapped_records;
+  for (const auto* record : ordered) {
+    if (record->second >= start && (record->second <= stop || stop == 0)) {
+      mapped_records.push_back(events_key + "." + toIndex(record->second) +
+                               "." + record->first);
+    }
+  }
+
+  // Select mapped_records using event_ids as keys.
+  getEventData(dbDomain(), mapped_records, limit, {}, results);
+  applyExpiration();
+  return results;
+}
+
+void EventSubscriberPlugin::applyExpiration() {
+  auto expiry = getEventsExpiry();
+  if (expiry > 0) {
+    // Make sure the configured expiration is at least the minimum needed to
+    // execute all related queries in the schedule.
+    if (expiry < min_expiration_) {
+      expiry = min_expiration_;
+    }
+
+    // Set the expire time to NOW - "configured lifetime".
+    // Index retrieval will apply the constraints checking and auto-expire.
+    expire_time_ = getUnixTime() - expiry;
+    expire_time_ = expire_time_ - (expire_time_ % 60);
+  }
+
+  if (FLAGS_events_optimize) {
+    setOptimizeData(optimize_time_, optimize_eid_, dbNamespace());
+    expireConsumed();
+  }
+}
+
+void EventSubscriberPlugin::expireConsumed() {
+  if (!FLAGS_events_expire_consumed || kToolType != ToolType::DAEMON ||
+      !executedAllQueries()) {
+    return;
+  }
+
+  std::set<std::string> consumers;
+  {
+    ReadLock lock(event_query_record_);
+    consumers = consumers_;
+  }
+  if (consumers.empty()) {
+    return;
+  }
+
+  // Each scheduled query has read every event before its optimize time, the
+  // earliest of these is the watermark every consumer has passed.
+  EventTime watermark = 0;
+  for (const auto& query_name : consumers) {
+    auto optimize_time = getOptimizeTime(query_name);
+    if (optimize_time == 0) {
+      // A query that has not selected events yet holds every event.
+      return;
+    }
+    if (watermark == 0 || optimize_time < watermark) {
+      watermark = optimize_time;
+    }
+  }
+
+  if (watermark <= FLAGS_events_expire_grace + 60) {
+    return;
+  }
+  EventTime consumed = watermark - 1 - FLAGS_events_expire_grace;
+  consumed -= consumed % 60;
+  if (consumed > expire_time_) {
+    expire_time_ = consumed;
+  }
+
+  // Range-delete the consumed events now, rather than at the next selection.
+  if (consumed > consumed_time_) {
+    consumed_time_ = consumed;
+    getIndexes(expire_time_, 0, false);
+  }
+}
+
+Status EventSubscriberPlugin::prepareEvent(size_t eid,
+                                           Row& r,
+                                           EventTime event_time,
+                                           DatabaseStringValueList& batch) {
+  // Serialize and store the row data, for query-time retrieval.
+  std::string data;
+  auto status = serializeRowBinary(r, data);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Use the EventID and a checkpoint bucket size to periodically apply
+  // buffer eviction. Eviction occurs if the total count exceeds events_max.
+  if (eid % EVENTS_CHECKPOINT == 0) {
+    expireCheck();
+  }
+
+  // Logger plugins may request events to be forwarded directly.
+  // If no active logger is marked 'usesLogEvent' then this is a no-op.
+  if (EventFactory::isForwarding()) {
+    std::string json;
+    if (serializeRowJSON(r, json).ok()) {
+      // Then remove the newline.
+      if (json.size() > 0 && json.back() == '\n') {
+        json.pop_back();
+      }
+      EventFactory::forwardEvent(std::move(json));
+    }
+  }
+
+  // The zero-padded EventID is only used within backing store keys.
+  EventID eid_index = toIndex(eid);
+
+  // Store the event data, ordered by event time for range expiration.
+  auto time_index = toIndex(event_time);
+  batch.push_back(std::make_pair(
+      "data." + dbNamespace() + "." + time_index + "." + eid_index,
+      std::move(data)));
+
+  // Add a lookup for each indexed column, see getIndexed.
+  for (const auto& column : indexed_columns_) {
+    auto value = r.find(column);
+    if (value != r.end()) {
+      batch.push_back(std::make_pair(
+          "lookup." + dbNamespace() + "." + column + "." +
+              toIndex(event_time / EVENTS_LOOKUP_BIN) + "." +
+              toLookupValue(value->second) + "." + time_index + "." +
+              eid_index,
+          time_index));
+    }
+  }
+  // Record the event in the indexing bins, using the index time.
+  recordEvent(eid_index, event_time, batch);
+  return Status(0, "OK");
+}
+
+bool EventSubscriberPlugin::isOverloaded() const {
+  return publisher_overloaded_ ||
+         (FLAGS_events_overload_latency > 0 &&
+          add_latency_ >= FLAGS_events_overload_latency);
+}
+
+bool EventSubscriberPlugin::sampleEvent(Row& r) {
+  if (FLAGS_events_overload_queue == 0 && FLAGS_events_overload_latency == 0) {
+    return true;
+  }
+
+  bool overloaded = isOverloaded();
+  WriteLock lock(sampling_lock_);
+  if (!overloaded && sampling_.empty()) {
+    r["sampling"] = "1";
+    return true;
+  }
+
+  // The sampling columns are split again only when the flag changes.
+  if (sampling_flag_ != FLAGS_events_sampling_columns) {
+    sampling_flag_ = FLAGS_events_sampling_columns;
+    sampling_columns_ = osquery::split(sampling_flag_, ",");
+  }
+
+  std::string key;
+  for (const auto& column : sampling_columns_) {
+    auto value = r.find(column);
+    if (value != r.end()) {
+      key = value->second;
+      break;
+    }
+  }
+
+  // Keys over the limit share a single sampling state.
+  if (sampling_.count(key) == 0 && sampling_.size() >= EVENTS_SAMPLING_KEYS) {
+    key.clear();
+  }
+
+  auto& state = sampling_[key];
+  if (overloaded && FLAGS_events_sampling > 1 &&
+      state.seen++ % FLAGS_events_sampling != 0) {
+    if (state.skipped++ == 0) {
+      state.row = r;
+    }
+    return false;
+  }
+
+  r["sampling"] = std::to_string(state.skipped + 1);
+  if (overloaded) {
+    state.skipped = 0;
+    state.row.clear();
+  } else {
+    // The skipped events are now represented, stop tracking the key.
+    sampling_.erase(key);
+  }
+  return true;
+}
+
+void EventSubscriberPlugin::flushSampling(bool all) {
+  std::vector<Row> pending;
+  {
+    WriteLock lock(sampling_lock_);
+    if (sampling_.empty() || (!all && isOverloaded())) {
+      return;
+    }
+
+    // Keys not seen again since the overload are stored with their first
+    // skipped row, representing each skipped event.
+    for (auto& key : sampling_) {
+      auto& state = key.second;
+      if (state.skipped > 0 && !state.row.empty()) {
+        state.row["sampling"] = std::to_string(state.skipped);
+        pending.push_back(std::move(state.row));
+      }
+    }
+    sampling_.clear();
+  }
+
+  DatabaseStringValueList batch;
+  for (auto& r : pending) {
+    auto event_time = timeFromRecord(r["time"]);
+    if (aggregateEvent(r, event_time)) {
+      continue;
+    }
 
-  WriteLock lock(event_record_lock_);
-  // Append the record (eid, unix_time) to the list bin.
-  std::string record_value;
-  getDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
-
-  if (record_value.length() == 0) {
-    // This is a new list_id for list_key, append the ID to the indirect
-    // lookup for this list_key.
-    std::string index_value;
-    getDatabaseValue(kEvents, index_key + ".60", index_value);
-    if (index_value.length() == 0) {
-      // A new index.
-      index_value = list_id;
-    } else {
-      index_value += "," + list_id;
+    auto status = prepareEvent(getEventID(), r, event_time, batch);
+    if (!status.ok()) {
+      VLOG(1) << "Could not add sampled event to " << getName() << ": "
+              << status.getMessage();
     }
-    setDatabaseValue(kEvents, index_key + ".60", index_value);
-    record_value = eid + ":" + time_value;
-  } else {
-    // Tokenize a record using ',' and the EID/time using ':'.
-    record_value += "," + eid + ":" + time_value;
   }
-  auto status =
-      setDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
-  if (!status.ok()) {
-    LOG(ERROR) << "Could not put Event Record key: " << record_key;
+
+  if (!batch.empty()) {
+    setDatabaseBatch(dbDomain(), batch);
   }
-  return Status(0, "OK");
 }
 
-size_t EventSubscriberPlugin::getEventsExpiry() {
-  return FLAGS_events_expiry;
-}
+/// Replace a numeric aggregate value if the predicate prefers the new value.
+template <typename Predicate>
+static void updateAggregateValue(Row& aggregate,
+                                 const Row& r,
+                                 const std::string& column,
+                                 Predicate prefer) {
+  auto value = r.find(column);
+  if (value == r.end()) {
+    return;
+  }
 
-size_t EventSubscriberPlugin::getEventsMax() {
-  return FLAGS_events_max;
+  long long next = 0;
+  long long current = 0;
+  auto& stored = aggregate[column];
+  if (!safeStrtoll(value->second, 10, next).ok()) {
+    return;
+  }
+  if (stored.empty() || !safeStrtoll(stored, 10, current).ok() ||
+      prefer(next, current)) {
+    stored = value->second;
+  }
 }
 
-EventID EventSubscriberPlugin::getEventID() {
-  Status status;
-  // First get an event ID from the meta key.
-  std::string eid_key = "eid." + dbNamespace();
+bool EventSubscriberPlugin::aggregateEvent(Row& r, EventTime event_time) {
+  auto aggregation = std::atomic_load(&aggregation_);
+  if (aggregation == nullptr) {
+    return false;
+  }
 
-  {
-    WriteLock lock(event_id_lock_);
-    if (last_eid_ == 0) {
-      std::string last_eid_value;
-      status = getDatabaseValue(kEvents, eid_key, last_eid_value);
-      if (!status.ok() || last_eid_value.empty()) {
-        last_eid_value = "0";
-      }
-      last_eid_ = boost::lexical_cast<size_t>(last_eid_value);
+  auto bucket = event_time - event_time % aggregation->interval;
+  std::string key;
+  for (const auto& column : aggregation->columns) {
+    auto value = r.find(column);
+    if (value != r.end()) {
+      key += value->second;
     }
+    key.push_back('\0');
+  }
 
-    if (last_eid_ % 10 == 0) {
-      status = setDatabaseValue(kEvents, eid_key, toIndex(last_eid_ + 10));
-    }
-    last_eid_++;
+  // A row stored while sampling represents several events.
+  long long count = 1;
+  auto sampling = r.find("sampling");
+  if (sampling != r.end() &&
+      (!safeStrtoll(sampling->second, 10, count).ok() || count < 1)) {
+    count = 1;
   }
 
-  return toIndex(last_eid_);
-}
+  bool flush = false;
+  bool aggregated = false;
+  {
+    WriteLock lock(aggregate_lock_);
+    auto aggregate_key = std::make_pair(bucket, std::move(key));
+    if (aggregates_.size() < EVENTS_AGGREGATE_KEYS ||
+        aggregates_.count(aggregate_key) > 0) {
+      auto& aggregate = aggregates_[std::move(aggregate_key)];
+      if (aggregate.count == 0) {
+        for (const auto& column : aggregation->columns) {
+          auto value = r.find(column);
+          aggregate.row[column] = (value != r.end()) ? value->second : "";
+        }
+        aggregate.row["time"] = std::to_string(bucket);
+      }
+      aggregate.count += static_cast<size_t>(count);
 
-QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
-  QueryData results;
+      for (const auto& column : aggregation->min) {
+        updateAggregateValue(aggregate.row, r, column, std::less<long long>());
+      }
+      for (const auto& column : aggregation->max) {
+        updateAggregateValue(
+            aggregate.row, r, column, std::greater<long long>());
+      }
+      aggregated = true;
+    }
 
-  // Get the records for this time range.
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
+    // An event in a newer bucket completes the older buckets.
+    flush = (!aggregates_.empty() && aggregates_.begin()->first.first < bucket);
+  }
 
-  std::string events_key = "data." + dbNamespace();
-  std::vector<std::string> mapped_records;
-  for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
-    }
+  if (flush) {
+    flushAggregates(bucket);
   }
 
-  if (FLAGS_events_optimize && !records.empty()) {
-    // If records were returned save the ordered-last as the optimization EID.
-    unsigned long int eidr = 0;
-    if (safeStrtoul(records.back().first, 10, eidr)) {
-      optimize_eid_ = static_cast<size_t>(eidr);
-    }
+  if (!aggregated) {
+    // Keys over the limit are stored as events, counting themselves.
+    r.emplace("sampling", std::to_string(count));
   }
+  return aggregated;
+}
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    auto status = getDatabaseValue(kEvents, record, data_value);
-    if (data_value.length() == 0) {
-      // There is no record here, interesting error case.
-      continue;
-    }
-    status = deserializeRowJSON(data_value, r);
-    data_value.clear();
-    if (status.ok()) {
-      results.push_back(std::move(r));
+void EventSubscriberPlugin::flushAggregates(EventTime before) {
+  std::vector<EventAggregate> completed;
+  {
+    WriteLock lock(aggregate_lock_);
+    auto it = aggregates_.begin();
+    while (it != aggregates_.end() && it->first.first < before) {
+      completed.push_back(std::move(it->second));
+      it = aggregates_.erase(it);
     }
   }
 
-  auto expiry = getEventsExpiry();
-  if (expiry > 0) {
-    // Make sure the configured expiration is at least the minimum needed to
-    // execute all related queries in the schedule.
-    if (expiry < min_expiration_) {
-      expiry = min_expiration_;
+  if (completed.empty()) {
+    return;
+  }
+
+  DatabaseStringValueList batch;
+  for (auto& aggregate : completed) {
+    aggregate.row["sampling"] = std::to_string(aggregate.count);
+    auto event_time = timeFromRecord(aggregate.row["time"]);
+    auto status = prepareEvent(getEventID(), aggregate.row, event_time, batch);
+    if (!status.ok()) {
+      VLOG(1) << "Could not add aggregate to " << getName() << ": "
+              << status.getMessage();
     }
+  }
+  setDatabaseBatch(dbDomain(), batch);
+}
 
-    // Set the expire time to NOW - "configured lifetime".
-    // Index retrieval will apply the constraints checking and auto-expire.
-    expire_time_ = getUnixTime() - expiry;
-    expire_time_ = expire_time_ - (expire_time_ % 60);
+void EventSubscriberPlugin::recordLatency(
+    std::chrono::steady_clock::time_point start, size_t rows) {
+  if (rows == 0) {
+    return;
   }
 
-  if (FLAGS_events_optimize) {
-    setOptimizeData(optimize_time_, optimize_eid_, dbNamespace());
+  static auto& store = getMetricHistogram("events_store_microseconds");
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  store.record(elapsed.count());
+  if (FLAGS_events_overload_latency == 0) {
+    return;
   }
 
-  return results;
+  size_t latency = elapsed.count() / rows;
+  // An exponential moving average over roughly the last 8 adds.
+  add_latency_ = (add_latency_ * 7 + latency) / 8;
 }
 
 Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
   // Get and increment the EID for this module.
-  EventID eid = getEventID();
+  auto eid = getEventID();
   // Without encouraging a missing event time, do not support a 0-time.
   if (event_time == 0) {
     event_time = getUnixTime();
   }
 
   r["time"] = std::to_string(event_time);
-  // Serialize and store the row data, for query-time retrieval.
-  std::string data;
-  auto status = serializeRowJSON(r, data);
-  if (!status.ok()) {
-    return status;
+  event_count_++;
+  if (!sampleEvent(r) || aggregateEvent(r, event_time)) {
+    return Status(0, "OK");
   }
-  // Then remove the newline.
-  if (data.size() > 0 && data.back() == '\n') {
-    data.pop_back();
+
+  if (FLAGS_events_memory_max > 0) {
+    // Recent events are kept in memory and persisted by a flush.
+    bufferEvent(eid, event_time, r);
+    return Status(0, "OK");
   }
 
-  // Use the last EventID and a checkpoint bucket size to periodically apply
-  // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
-    expireCheck();
+  auto start = std::chrono::steady_clock::now();
+  DatabaseStringValueList batch;
+  auto status = prepareEvent(eid, r, event_time, batch);
+  if (!status.ok()) {
+    return status;
   }
 
-  // Logger plugins may request events to be forwarded directly.
-  // If no active logger is marked 'usesLogEvent' then this is a no-op.
-  EventFactory::forwardEvent(data);
+  // The data and record keys are committed together.
+  status = setDatabaseBatch(dbDomain(), batch);
+  recordLatency(start, 1);
+  return status;
+}
 
-  // Store the event data.
-  std::string event_key = "data." + dbNamespace() + "." + eid;
-  status = setDatabaseValue(kEvents, event_key, data);
-  // Record the event in the indexing bins, using the index time.
-  recordEvent(eid, event_time);
-  event_count_++;
+Status EventSubscriberPlugin::addBatch(std::vector<Row>& row_list) {
+  auto start = std::chrono::steady_clock::now();
+  DatabaseStringValueList batch;
+  size_t rows = 0;
+  for (auto& r : row_list) {
+    // Rows may have been buffered, respect an existing event time.
+    EventTime event_time = 0;
+    if (r.count("time") > 0) {
+      event_time = timeFromRecord(r.at("time"));
+    }
+    if (event_time == 0) {
+      event_time = getUnixTime();
+    }
+
+    auto eid = getEventID();
+    r["time"] = std::to_string(event_time);
+    event_count_++;
+    if (!sampleEvent(r) || aggregateEvent(r, event_time)) {
+      continue;
+    }
+
+    if (FLAGS_events_memory_max > 0) {
+      bufferEvent(eid, event_time, r);
+      continue;
+    }
+
+    rows++;
+    auto status = prepareEvent(eid, r, event_time, batch);
+    if (!status.ok()) {
+      VLOG(1) << "Could not add event to " << getName() << " batch: "
+              << status.getMessage();
+    }
+  }
+
+  if (batch.empty()) {
+    return Status(0, "OK");
+  }
+  auto status = setDatabaseBatch(dbDomain(), batch);
+  recordLatency(start, rows);
   return status;
 }
 
@@ -615,12 +1604,33 @@ void EventSubscriberPlugin::removeSubscriptions() {
   getPublisher()->removeSubscriptions(getName());
 }
 
+void EventFactory::flushEvents(bool all) {
+  std::vector<EventSubscriberRef> subscribers;
+  {
+    auto& ef = EventFactory::getInstance();
+    WriteLock lock(ef.factory_lock_);
+    for (const auto& subscriber : ef.event_subs_) {
+      subscribers.push_back(subscriber.second);
+    }
+  }
+
+  for (const auto& subscriber : subscribers) {
+    subscriber->flushBuffered();
+    subscriber->flushEvents(all);
+  }
+}
+
 void EventFactory::delay() {
   // Caller may disable event publisher threads.
   if (FLAGS_disable_events) {
     return;
   }
 
+  if (FLAGS_events_memory_max > 0) {
+    // Subscribers keep recent events in memory, persist them periodically.
+    Dispatcher::addPeriodicService(std::make_shared<EventsFlushRunner>());
+  }
+
   // Create a thread for each event publisher.
   auto& ef = EventFactory::getInstance();
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
@@ -639,6 +1649,7 @@ Status EventPublisherPlugin::addSubscription(
   // subscriptions will be walked.
   WriteLock lock(subscription_lock_);
   subscriptions_.push_back(subscription);
+  updateTargets();
   return Status(0);
 }
 
@@ -652,16 +1663,105 @@ void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
                        return (subscription->subscriber_name == subscriber);
                      });
   subscriptions_.erase(end, subscriptions_.end());
+  updateTargets();
+}
+
+void EventPublisherPlugin::updateTargets() {
+  // The caller holds the subscription_lock_. Subscribers add subscriptions
+  // before they are registered, those are resolved by refreshTargets.
+  auto targets = std::make_shared<SubscriptionTargets>();
+  for (const auto& subscription : subscriptions_) {
+    EventSubscriberRef subscriber = nullptr;
+    if (EventFactory::exists(subscription->subscriber_name)) {
+      subscriber = EventFactory::getEventSubscriber(
+          subscription->subscriber_name);
+    }
+    targets->push_back(std::make_pair(subscription, subscriber));
+  }
+  std::atomic_store(&targets_,
+                    std::shared_ptr<const SubscriptionTargets>(targets));
+}
+
+void EventPublisherPlugin::refreshTargets() {
+  WriteLock lock(subscription_lock_);
+  updateTargets();
 }
 
 void EventFactory::addForwarder(const std::string& logger) {
-  getInstance().loggers_.push_back(logger);
+  auto& ef = getInstance();
+  auto registry = RegistryFactory::get().registry("logger");
+  std::shared_ptr<LoggerPlugin> plugin = nullptr;
+  if (registry != nullptr && registry->isInternal(logger)) {
+    plugin = std::dynamic_pointer_cast<LoggerPlugin>(registry->plugin(logger));
+  }
+
+  if (plugin == nullptr) {
+    // Extension loggers can only be reached through the registry.
+    ef.loggers_.push_back(logger);
+    return;
+  }
+
+  ef.forwarders_.push_back(plugin);
+  if (FLAGS_events_forward_queue_max > 0 &&
+      std::atomic_load(&ef.forward_queue_) == nullptr) {
+    std::atomic_store(&ef.forward_queue_,
+                      std::make_shared<BoundedQueue<LogEventRef>>(
+                          FLAGS_events_forward_queue_max));
+    Dispatcher::addService(std::make_shared<EventForwardRunner>());
+  }
+}
+
+bool EventFactory::isForwarding() {
+  auto& ef = getInstance();
+  return !ef.loggers_.empty() || !ef.forwarders_.empty();
+}
+
+void EventFactory::forwardEvent(std::string event) {
+  auto& ef = getInstance();
+  auto shared = std::make_shared<const std::string>(std::move(event));
+  if (!ef.forwarders_.empty()) {
+    auto queue = std::atomic_load(&ef.forward_queue_);
+    // A full queue applies back pressure, the event is forwarded in place.
+    if (queue == nullptr || !queue->push(shared)) {
+      for (const auto& logger : ef.forwarders_) {
+        logger->logEvent(*shared);
+      }
+    }
+  }
+
+  for (const auto& logger : ef.loggers_) {
+    Registry::call("logger", logger, {{"event", *shared}});
+  }
 }
 
-void EventFactory::forwardEvent(const std::string& event) {
-  for (const auto& logger : getInstance().loggers_) {
-    Registry::call("logger", logger, {{"event", event}});
+/// Read the aggregation configured for a subscriber, nullptr if there is none.
+static std::shared_ptr<const EventAggregation> getEventAggregation(
+    const pt::ptree& data, const std::string& name) {
+  auto config = data.get_child_optional("events.aggregate." + name);
+  if (!config.is_initialized()) {
+    return nullptr;
+  }
+
+  auto aggregation = std::make_shared<EventAggregation>();
+  auto readColumns = [&config](const std::string& key,
+                               std::vector<std::string>& columns) {
+    auto list = config->get_child_optional(key);
+    if (list.is_initialized()) {
+      for (const auto& column : *list) {
+        columns.push_back(column.second.data());
+      }
+    }
+  };
+  readColumns("columns", aggregation->columns);
+  readColumns("min", aggregation->min);
+  readColumns("max", aggregation->max);
+
+  aggregation->interval = config->get<size_t>("interval", 60);
+  if (aggregation->interval == 0) {
+    LOG(WARNING) << "Invalid aggregation interval for " << name;
+    return nullptr;
   }
+  return aggregation;
 }
 
 void EventFactory::configUpdate() {
@@ -691,6 +1791,7 @@ void EventFactory::configUpdate() {
                                  ? query.interval
                                  : details.max_interval;
       details.query_count++;
+      details.queries.insert(name);
     }
   });
 
@@ -715,6 +1816,25 @@ void EventFactory::configUpdate() {
 
     WriteLock subscriber_lock(subscriber->event_query_record_);
     subscriber->queries_.clear();
+    subscriber->consumers_ = details.second.queries;
+  }
+
+  {
+    // Resolve subscription targets for every publisher.
+    WriteLock lock(ef.factory_lock_);
+    for (const auto& publisher : ef.event_pubs_) {
+      publisher.second->refreshTargets();
+    }
+  }
+
+  auto plugin = Config::getInstance().getParser("events");
+  if (plugin != nullptr) {
+    // Apply the aggregation configured for each subscriber.
+    WriteLock lock(ef.factory_lock_);
+    for (const auto& subscriber : ef.event_subs_) {
+      subscriber.second->setAggregation(
+          getEventAggregation(plugin->getData(), subscriber.first));
+    }
   }
 
   // If events are enabled configure the subscribers before publishers.
@@ -724,6 +1844,122 @@ void EventFactory::configUpdate() {
   }
 }
 
+std::string EventThreadPlacement::toString() const {
+  std::string description;
+  for (const auto& cpu : cpus) {
+    description += (description.empty()) ? "cpus=" : "+";
+    description += std::to_string(cpu);
+  }
+
+  if (policy != EventThreadPolicy::DEFAULT) {
+    description += (description.empty()) ? "" : " ";
+    description += (policy == EventThreadPolicy::BATCH) ? "policy=batch"
+                                                        : "policy=idle";
+  }
+
+  if (nice != 0) {
+    description += (description.empty()) ? "" : " ";
+    description += "nice=" + std::to_string(nice);
+  }
+  return description;
+}
+
+/// The number of CPUs a publisher thread may be pinned to, as in a cpu_set_t.
+const long int kMaxEventThreadCPUs = 1024;
+
+/// Find the value of a type's entry in a comma-separated type:value list.
+static bool getPlacementEntry(const std::string& type,
+                              const std::string& list,
+                              std::string& value) {
+  for (const auto& entry : osquery::split(list, ",")) {
+    auto separator = entry.find(':');
+    if (separator != std::string::npos && entry.substr(0, separator) == type) {
+      value = entry.substr(separator + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+Status getEventThreadPlacement(const std::string& type,
+                               const std::string& affinity,
+                               const std::string& policy,
+                               EventThreadPlacement& placement) {
+  placement = EventThreadPlacement();
+
+  std::string value;
+  if (getPlacementEntry(type, affinity, value)) {
+    for (const auto& range : osquery::split(value, "+")) {
+      auto bounds = osquery::split(range, "-");
+      long int first = 0;
+      long int last = 0;
+      if (bounds.empty() || bounds.size() > 2 ||
+          !safeStrtol(bounds.front(), 10, first).ok() ||
+          !safeStrtol(bounds.back(), 10, last).ok() || first < 0 ||
+          last < first || last >= kMaxEventThreadCPUs) {
+        return Status(1, "Invalid CPU list for " + type + ": " + value);
+      }
+      for (auto cpu = first; cpu <= last; ++cpu) {
+        placement.cpus.insert(static_cast<int>(cpu));
+      }
+    }
+  }
+
+  if (getPlacementEntry(type, policy, value)) {
+    long int nice = 0;
+    if (value == "batch") {
+      placement.policy = EventThreadPolicy::BATCH;
+    } else if (value == "idle") {
+      placement.policy = EventThreadPolicy::IDLE;
+    } else if (safeStrtol(value, 10, nice).ok() && nice >= -20 && nice <= 19) {
+      placement.nice = static_cast<int>(nice);
+    } else {
+      return Status(1, "Invalid thread policy for " + type + ": " + value);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status applyEventThreadPlacement(const EventThreadPlacement& placement) {
+#ifdef __linux__
+  if (!placement.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto& cpu : placement.cpus) {
+      CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      return Status(1, "Cannot set the thread CPU affinity");
+    }
+  }
+
+  // The Linux scheduler applies these to the calling thread only.
+  if (placement.policy != EventThreadPolicy::DEFAULT) {
+    struct sched_param param;
+    param.sched_priority = 0;
+    auto policy = (placement.policy == EventThreadPolicy::BATCH) ? SCHED_BATCH
+                                                                 : SCHED_IDLE;
+    if (sched_setscheduler(0, policy, &param) != 0) {
+      return Status(1, "Cannot set the thread scheduling policy");
+    }
+  }
+
+  if (placement.nice != 0) {
+    auto tid = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, placement.nice) != 0) {
+      return Status(1, "Cannot set the thread nice level");
+    }
+  }
+  return Status(0, "OK");
+#else
+  if (!placement.cpus.empty() ||
+      placement.policy != EventThreadPolicy::DEFAULT || placement.nice != 0) {
+    return Status(1, "Thread placement is not supported on this platform");
+  }
+  return Status(0, "OK");
+#endif
+}
+
 Status EventFactory::run(EventPublisherID& type_id) {
   if (FLAGS_disable_events) {
     return Status(0, "Events disabled");
@@ -749,6 +1985,30 @@ Status EventFactory::run(EventPublisherID& type_id) {
   VLOG(1) << "Starting event publisher run loop: " + type_id;
   publisher->hasStarted(true);
 
+  // Place the publisher thread before its run loop starts.
+  EventThreadPlacement placement;
+  auto placed = getEventThreadPlacement(type_id,
+                                        FLAGS_events_thread_affinity,
+                                        FLAGS_events_thread_policy,
+                                        placement);
+  if (placed.ok()) {
+    placed = applyEventThreadPlacement(placement);
+  }
+  if (!placed.ok()) {
+    LOG(WARNING) << "Event publisher " << type_id
+                 << " placement failed: " << placed.getMessage();
+  } else {
+    publisher->placement(placement.toString());
+  }
+
+  if (FLAGS_events_queue_max > 0) {
+    // Decouple the run loop from subscriber callbacks.
+    std::atomic_store(&publisher->queue_,
+                      std::make_shared<BoundedQueue<EventContextRef>>(
+                          FLAGS_events_queue_max));
+    Dispatcher::addService(std::make_shared<EventQueueRunner>(publisher));
+  }
+
   auto status = Status(0, "OK");
   while (!publisher->isEnding()) {
     // Can optionally implement a global cooloff latency here.
@@ -835,6 +2095,62 @@ Status EventFactory::registerEventPublisher(const PluginRef& pub) {
   return Status(0, "OK");
 }
 
+/// The INDEX columns of a table, see EventSubscriberPlugin::getIndexed.
+static std::vector<std::string> getIndexedColumns(const std::string& table) {
+  std::vector<std::string> columns;
+  if (!Registry::get().exists("table", table, true)) {
+    return columns;
+  }
+
+  auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+      Registry::get().plugin("table", table));
+  if (plugin == nullptr) {
+    return columns;
+  }
+
+  for (const auto& column : plugin->columns()) {
+    if (std::get<2>(column) & ColumnOptions::INDEX) {
+      columns.push_back(std::get<0>(column));
+    }
+  }
+  return columns;
+}
+
+void EventFactory::setSubscriberDomain(BaseEventSubscriber& sub,
+                                       bool setup_failed) {
+  auto ns = sub.dbNamespace();
+  auto domain = kEvents + "." + ns;
+  if (sub.disabled) {
+    // The events of a disabled subscriber are dropped at once, unless it was
+    // only disabled because its setUp failed during this boot.
+    if (!setup_failed) {
+      dropDatabaseDomain(domain);
+    }
+    sub.db_domain_.clear();
+    return;
+  }
+
+  auto status = createDatabaseDomain(domain);
+  if (!status.ok()) {
+    VLOG(1) << "Storing events of " << sub.getName()
+            << " in the shared domain: " << status.getMessage();
+    return;
+  }
+
+  if (sub.db_domain_.empty()) {
+    // Remove the subscriber's events stored before it had a domain, only the
+    // event ID checkpoint and query optimization state stay shared.
+    for (const auto& type : {"data.", "records.", "indexes.", "lookup."}) {
+      std::string prefix = type + ns + ".";
+      std::string high;
+      if (getPrefixUpperBound(prefix, high)) {
+        deleteDatabaseRange(kEvents, prefix, high);
+      }
+    }
+  }
+  sub.db_domain_ = domain;
+}
+
 Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   // Try to downcast the plugin to an event subscriber.
   EventSubscriberRef specialized_sub;
@@ -878,17 +2194,27 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
         }
       }
     }
+    specialized_sub->setAggregation(getEventAggregation(data, name));
   }
 
   if (specialized_sub->state() != EventState::EVENT_NONE) {
     specialized_sub->tearDown();
   }
+  if (specialized_sub->indexed_columns_.empty()) {
+    // Set once, before the subscriber receives events.
+    specialized_sub->indexed_columns_ = getIndexedColumns(name);
+  }
 
   // Allow subscribers a configure-time setup to determine if they should run.
   auto status = specialized_sub->setUp();
+  auto setup_failed = (!status && !specialized_sub->disabled);
   if (!status) {
     specialized_sub->disabled = true;
   }
+
+  if (FLAGS_events_subscriber_domains) {
+    setSubscriberDomain(*specialized_sub, setup_failed);
+  }
   specialized_sub->state(EventState::EVENT_SETUP);
 
   // Let the subscriber initialize any Subscriptions.
@@ -904,6 +2230,11 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   {
     WriteLock lock(getInstance().factory_lock_);
     ef.event_subs_[name] = specialized_sub;
+    // Subscriptions added during init may now be resolved.
+    auto type = specialized_sub->getType();
+    if (ef.event_pubs_.count(type) > 0) {
+      ef.event_pubs_.at(type)->refreshTargets();
+    }
   }
 
   // Set state of subscriber.
@@ -1009,7 +2340,12 @@ Status EventFactory::deregisterEventSubscriber(EventSubscriberID& sub) {
   auto& subscriber = ef.event_subs_.at(sub);
   subscriber->state(EventState::EVENT_NONE);
   subscriber->tearDown();
+  auto type = subscriber->getType();
   ef.event_subs_.erase(sub);
+  if (ef.event_pubs_.count(type) > 0) {
+    // Release the publisher's reference to the subscriber.
+    ef.event_pubs_.at(type)->refreshTargets();
+  }
   return Status(0);
 }
 
@@ -1034,6 +2370,9 @@ std::vector<std::string> EventFactory::subscriberNames() {
 void EventFactory::end(bool join) {
   auto& ef = EventFactory::getInstance();
 
+  // Persist any in-memory events before the subscribers are removed.
+  flushEvents(true);
+
   // Call deregister on each publisher.
   for (const auto& publisher : ef.publisherTypes()) {
     deregisterEventPublisher(publisher);
@@ -1061,7 +2400,69 @@ void EventFactory::end(bool join) {
   }
 }
 
+/// Report the counts kept by each publisher and subscriber as metrics.
+static void collectEventMetrics(std::vector<MetricValue>& values) {
+  auto counter = ([&values](const std::string& name,
+                            const MetricLabels& labels,
+                            size_t count) {
+    MetricValue value;
+    value.name = name;
+    value.labels = labels;
+    value.type = MetricType::COUNTER;
+    value.value = static_cast<int64_t>(count);
+    values.push_back(std::move(value));
+  });
+
+  for (const auto& type : EventFactory::publisherTypes()) {
+    auto publisher = EventFactory::getEventPublisher(type);
+    if (publisher != nullptr) {
+      counter("events_fired", {{"publisher", type}}, publisher->numEvents());
+      counter("events_dropped", {{"publisher", type}}, publisher->numDropped());
+    }
+  }
+
+  for (const auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      counter("events_added",
+              {{"publisher", subscriber->getType()}, {"subscriber", name}},
+              subscriber->numEvents());
+    }
+  }
+}
+
+static size_t getEventsMemoryUsage() {
+  size_t bytes = 0;
+  for (const auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      bytes += subscriber->getBufferedBytes();
+    }
+  }
+  return bytes;
+}
+
+static void shrinkEventsMemory(size_t target) {
+  // In-memory events are persisted before they are dropped.
+  for (const auto& name : EventFactory::subscriberNames()) {
+    if (getEventsMemoryUsage() <= target) {
+      break;
+    }
+
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      subscriber->releaseBuffered();
+    }
+  }
+}
+
 void attachEvents() {
+  registerMetricCollector("events", collectEventMetrics);
+  if (FLAGS_events_memory_max > 0) {
+    registerMemoryConsumer(
+        "events", 1, getEventsMemoryUsage, shrinkEventsMemory);
+  }
+
   const auto& publishers = RegistryFactory::get().plugins("event_publisher");
   for (const auto& publisher : publishers) {
     EventFactory::registerEventPublisher(publisher.second);
@@ -8,15 +8,25 @@
  *
  */
 
+#include <unistd.h>
+
+#include <set>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/metrics.h"
 #include "osquery/events/kernel.h"
 
 namespace osquery {
 
 FLAG(bool, disable_kernel, false, "Disable osquery kernel extension");
 
+FLAG(bool,
+     kernel_exclude_self,
+     true,
+     "Discard kernel events caused by the osquery process");
+
 const std::string kKernelDevice = "/dev/osquery";
 
 /// Kernel shared buffer size in bytes.
@@ -25,7 +35,7 @@ static const size_t kKernelQueueSize = (20 * (1 << 20));
 /// Handle a maximum of 1000 events before requesting a resync.
 static const int kKernelEventsSyncMax = 1000;
 
-/// Handle a maximum of 10 events before request another lock.
+/// Dequeue a maximum of 10 events before request another lock.
 static const int kKernelEventsIterate = 10;
 
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
@@ -49,6 +59,8 @@ Status KernelEventPublisher::setUp() {
   try {
     WriteLock lock(mutex_);
     queue_ = new CQueue(kKernelDevice, kKernelQueueSize);
+    // The kernel resets its filters and counts for each daemon.
+    filter_counts_.clear();
   } catch (const CQueueException &e) {
     queue_ = nullptr;
     return Status(1, e.what());
@@ -61,12 +73,52 @@ Status KernelEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
+std::map<osquery_event_t, KernelFilter> KernelEventPublisher::getFilters()
+    const {
+  std::map<osquery_event_t, KernelFilter> filters;
+  std::map<osquery_event_t, std::set<std::string>> prefixes;
+  std::set<osquery_event_t> all_paths;
+  for (const auto &sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    filters[sc->event_type].actions |= sc->actions;
+    if (sc->path_prefix.empty()) {
+      // A subscription matches every path, the prefixes are not used.
+      all_paths.insert(sc->event_type);
+    } else {
+      prefixes[sc->event_type].insert(sc->path_prefix);
+    }
+  }
+
+  for (auto &filter : filters) {
+    if (all_paths.count(filter.first) == 0) {
+      const auto &event_prefixes = prefixes[filter.first];
+      filter.second.prefixes.assign(event_prefixes.begin(),
+                                    event_prefixes.end());
+    }
+    if (FLAGS_kernel_exclude_self) {
+      filter.second.excluded_pids.push_back(getpid());
+    }
+  }
+  return filters;
+}
+
 void KernelEventPublisher::configure() {
   WriteLock lock(mutex_);
-  for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
-      auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  for (const auto &filter : getFilters()) {
+    try {
+      // Set the filter first, the publisher may already be subscribed.
+      queue_->setFilter(filter.first,
+                        filter.second.actions,
+                        filter.second.prefixes,
+                        filter.second.excluded_pids);
+      queue_->subscribe(filter.first);
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Cannot configure kernel event type " << filter.first
+                   << ": " << e.what();
     }
   }
 }
@@ -91,43 +143,44 @@ Status KernelEventPublisher::run() {
   try {
     int drops = 0;
     WriteLock lock(mutex_);
-    if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0 &&
-        kToolType == ToolType::DAEMON) {
-      LOG(WARNING) << "Dropping " << drops << " kernel events";
+    if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0) {
+      // Events the kernel could not queue are reported by osquery_events.
+      addDropped(drops);
+      if (kToolType == ToolType::DAEMON) {
+        LOG(WARNING) << "Dropping " << drops << " kernel events";
+      }
     }
   } catch (const CQueueException &e) {
     LOG(WARNING) << "Queue synchronization error: " << e.what();
   }
 
-  auto dequeueEvents = [this]() {
-    // Dequeue several events while holding the lock.
-    int max_before_lock = kKernelEventsIterate;
-    while (max_before_lock > 0) {
-      // Request an event from the synchronized, safe, portion of the queue.
-      CQueue::event *event = nullptr;
-      auto event_type = queue_->dequeue(&event);
-      if (event_type == OSQUERY_NULL_EVENT) {
-        return false;
-      }
+  updateFilterMetrics();
 
+  std::vector<CQueue::EventRef> events;
+  auto dequeueEvents = [this, &events]() {
+    // Request a batch of events from the synchronized, safe, portion of the
+    // queue, and fire them while holding the lock.
+    queue_->dequeue(events, kKernelEventsIterate);
+    for (const auto &event : events) {
       // Each event type may use a specific event type structure.
       KernelEventContextRef ec = nullptr;
-      switch (event_type) {
+      switch (event.first) {
       case OSQUERY_PROCESS_EVENT:
-        ec = createEventContextFrom<osquery_process_event_t>(event_type, event);
+        ec = createEventContextFrom<osquery_process_event_t>(event.first,
+                                                             event.second);
         fire(ec);
         break;
       case OSQUERY_FILE_EVENT:
-        ec = createEventContextFrom<osquery_file_event_t>(event_type, event);
+        ec = createEventContextFrom<osquery_file_event_t>(event.first,
+                                                          event.second);
         fire(ec);
         break;
       default:
-        LOG(WARNING) << "Unknown kernel event received: " << event_type;
+        LOG(WARNING) << "Unknown kernel event received: " << event.first;
         break;
       }
-      max_before_lock--;
     }
-    return true;
+    return events.size() == static_cast<size_t>(kKernelEventsIterate);
   };
 
   // Iterate over each event type in the queue and appropriately fire each.
@@ -138,7 +191,7 @@ Status KernelEventPublisher::run() {
     if (queue_ == nullptr) {
       break;
     }
-    // A NULL event occurred, stop dequeuing.
+    // The queue was drained, stop dequeuing.
     if (!dequeueEvents()) {
       break;
     }
@@ -151,6 +204,39 @@ Status KernelEventPublisher::run() {
   return Status(0, "Continue");
 }
 
+void KernelEventPublisher::updateFilterMetrics() {
+  WriteLock lock(mutex_);
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  static const std::map<osquery_event_t, std::string> kEventNames = {
+      {OSQUERY_PROCESS_EVENT, "process"}, {OSQUERY_FILE_EVENT, "file"},
+  };
+
+  for (const auto &event : kEventNames) {
+    uint64_t delivered = 0;
+    uint64_t filtered = 0;
+    try {
+      queue_->filterStats(event.first, delivered, filtered);
+    } catch (const CQueueException &e) {
+      continue;
+    }
+
+    auto &counts = filter_counts_[event.first];
+    MetricLabels labels = {{"event", event.second}};
+    if (delivered > counts.first) {
+      getMetricCounter("kernel_events_delivered", labels)
+          .add(delivered - counts.first);
+    }
+    if (filtered > counts.second) {
+      getMetricCounter("kernel_events_filtered", labels)
+          .add(filtered - counts.second);
+    }
+    counts = std::make_pair(delivered, filtered);
+  }
+}
+
 template <typename EventType>
 KernelEventContextRef KernelEventPublisher::createEventContextFrom(
     osquery_event_t event_type, CQueue::event *event) const {
@@ -170,6 +256,26 @@ KernelEventContextRef KernelEventPublisher::createEventContextFrom(
 
 bool KernelEventPublisher::shouldFire(const KernelSubscriptionContextRef &sc,
                                       const KernelEventContextRef &ec) const {
-  return ec->event_type == sc->event_type;
+  if (ec->event_type != sc->event_type) {
+    return false;
+  }
+
+  // The kernel filter is the union of the subscriptions, so file events are
+  // matched to each subscription's actions and path.
+  if (ec->event_type == OSQUERY_FILE_EVENT) {
+    auto fc =
+        std::static_pointer_cast<TypedKernelEventContext<osquery_file_event_t>>(
+            ec);
+    if ((sc->actions & fc->event.action) == 0) {
+      return false;
+    }
+    if (!sc->path_prefix.empty() &&
+        strncmp(fc->event.path,
+                sc->path_prefix.c_str(),
+                sc->path_prefix.size()) != 0) {
+      return false;
+    }
+  }
+  return true;
 }
 } // namespace osquery
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <map>
+#include <utility>
 #include <vector>
 
 #include <osquery/events.h>
@@ -41,6 +43,12 @@ struct KernelSubscriptionContext : public SubscriptionContext {
 
   /// Optional category passed to the callback.
   std::string category;
+
+  /// The event actions delivered to the subscription, such as file actions.
+  uint32_t actions{OSQUERY_FILTER_ALL_ACTIONS};
+
+  /// Optional path prefix of delivered events, empty matches every path.
+  std::string path_prefix;
 };
 
 /**
@@ -69,6 +77,23 @@ template <typename EventType>
 using TypedKernelEventContextRef =
     std::shared_ptr<TypedKernelEventContext<EventType>>;
 
+/**
+ * @brief The kernel filter of an event type.
+ *
+ * The union of the event type's subscriptions, events no subscription would
+ * fire are discarded by the kernel before they use queue space.
+ */
+struct KernelFilter {
+  /// The subscribed actions, or OSQUERY_FILTER_ALL_ACTIONS.
+  uint32_t actions{0};
+
+  /// Path prefixes of the subscriptions, empty matches every path.
+  std::vector<std::string> prefixes;
+
+  /// Processes whose events are discarded, see --kernel_exclude_self.
+  std::vector<pid_t> excluded_pids;
+};
+
 class KernelEventPublisher
     : public EventPublisher<KernelSubscriptionContext, KernelEventContext> {
   DECLARE_PUBLISHER("kernel");
@@ -99,6 +124,10 @@ class KernelEventPublisher
    * register kernel-based callbacks or start kernel threads that publish into
    * a circular queue. When the queue is initialized it may communicate to each
    * of these kernel publishers.
+   *
+   * The subscriptions of each event type are also compiled into a kernel
+   * filter: the union of their actions and path prefixes. Events no
+   * subscription would fire are discarded before they use queue space.
    */
   void configure() override;
 
@@ -120,6 +149,15 @@ class KernelEventPublisher
 
   CQueue *queue_{nullptr};
 
+  /// The kernel's delivered and filtered counts, already added to metrics.
+  std::map<osquery_event_t, std::pair<uint64_t, uint64_t>> filter_counts_;
+
+  /// Add the kernel filter counts to the kernel_events_* metrics.
+  void updateFilterMetrics();
+
+  /// Compile the subscriptions of each event type into a kernel filter.
+  std::map<osquery_event_t, KernelFilter> getFilters() const;
+
   /// Check whether the subscription matches the event.
   bool shouldFire(const KernelSubscriptionContextRef &sc,
                   const KernelEventContextRef &ec) const override;
@@ -127,6 +165,10 @@ class KernelEventPublisher
   template <typename EventType>
   KernelEventContextRef createEventContextFrom(osquery_event_t event_type,
                                                CQueue::event *event) const;
+
+ private:
+  FRIEND_TEST(KernelFilterTests, test_configure_filters);
+  FRIEND_TEST(KernelFilterTests, test_should_fire);
 };
 
 } // namespace osquery
@@ -30,8 +30,7 @@ static inline void producerThread(benchmark::State &state) {
     // The device interface cannot be found or cannot be opened.
   }
 
-  osquery_event_t event;
-  osquery::CQueue::event *event_buf = nullptr;
+  std::vector<CQueue::EventRef> events;
   int drops = 0;
   size_t reads0 = 0;
   size_t reads1 = 0;
@@ -44,19 +43,20 @@ static inline void producerThread(benchmark::State &state) {
     drops += queue->kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
     syncs++;
     max_before_sync = 2000;
-    while (max_before_sync > 0 && (event = queue->dequeue(&event_buf))) {
-      switch (event) {
-      case OSQUERY_TEST_EVENT_0:
-        reads0++;
-        max_before_sync--;
-        break;
-      case OSQUERY_TEST_EVENT_1:
-        reads1++;
-        max_before_sync--;
-        break;
-      default:
-        break;
+    while (max_before_sync > 0 && queue->dequeue(events, 100) > 0) {
+      for (const auto &event : events) {
+        switch (event.first) {
+        case OSQUERY_TEST_EVENT_0:
+          reads0++;
+          break;
+        case OSQUERY_TEST_EVENT_1:
+          reads1++;
+          break;
+        default:
+          break;
+        }
       }
+      max_before_sync -= events.size();
     }
   }
 
@@ -12,6 +12,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <cstring>
+
 #include "osquery/events/kernel/circular_queue_user.h"
 
 namespace osquery {
@@ -54,6 +56,54 @@ void CQueue::subscribe(osquery_event_t event) {
   }
 }
 
+void CQueue::setFilter(osquery_event_t event,
+                       uint32_t actions,
+                       const std::vector<std::string> &prefixes,
+                       const std::vector<pid_t> &excluded_pids) {
+  if (excluded_pids.size() > OSQUERY_FILTER_MAX_PIDS) {
+    throw CQueueException("Too many excluded processes");
+  }
+
+  // The prefixes are packed and NUL-terminated, the kernel copies them in.
+  std::string packed;
+  for (const auto &prefix : prefixes) {
+    packed.append(prefix.c_str(), prefix.size() + 1);
+  }
+  if (packed.size() > OSQUERY_FILTER_MAX_PREFIXES_SIZE) {
+    throw CQueueException("Filter path prefixes are too large");
+  }
+
+  osquery_filter_args_t filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.event = event;
+  filter.actions = actions;
+  filter.prefix_count = static_cast<uint32_t>(prefixes.size());
+  filter.prefixes_size = packed.size();
+  filter.prefixes = reinterpret_cast<uint64_t>(packed.data());
+  filter.excluded_pid_count = static_cast<uint32_t>(excluded_pids.size());
+  for (size_t i = 0; i < excluded_pids.size(); i++) {
+    filter.excluded_pids[i] = static_cast<uint64_t>(excluded_pids[i]);
+  }
+
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER, &filter)) {
+    throw CQueueException("Could not set event filter");
+  }
+}
+
+void CQueue::filterStats(osquery_event_t event,
+                         uint64_t &delivered,
+                         uint64_t &filtered) {
+  osquery_filter_stats_args_t stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.event = event;
+
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER_STATS, &stats)) {
+    throw CQueueException("Could not read event filter counts");
+  }
+  delivered = stats.delivered;
+  filtered = stats.filtered;
+}
+
 osquery_event_t CQueue::dequeue(CQueue::event **event) {
   if (read_ == max_read_ || event == nullptr) {
     return (osquery_event_t)0;
@@ -76,6 +126,19 @@ osquery_event_t CQueue::dequeue(CQueue::event **event) {
   return header->event;
 }
 
+size_t CQueue::dequeue(std::vector<CQueue::EventRef> &events, size_t max) {
+  events.clear();
+  CQueue::event *event = nullptr;
+  while (events.size() < max) {
+    auto event_type = dequeue(&event);
+    if (event_type == OSQUERY_NULL_EVENT) {
+      break;
+    }
+    events.push_back(std::make_pair(event_type, event));
+  }
+  return events.size();
+}
+
 int CQueue::kernelSync(int options) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_OPTIONS_NO_BLOCK.
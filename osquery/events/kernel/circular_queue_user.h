@@ -12,6 +12,10 @@
 
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
 
 #include <boost/noncopyable.hpp>
 
@@ -37,6 +41,9 @@ class CQueue : private boost::noncopyable {
     char buf[];
   };
 
+  /// A dequeued event type and its event within the shared buffer.
+  using EventRef = std::pair<osquery_event_t, event *>;
+
   /**
    * @brief Creates cqueue.
    *
@@ -66,6 +73,33 @@ class CQueue : private boost::noncopyable {
    */
   void subscribe(osquery_event_t event);
 
+  /**
+   * @brief Set the events the kernel extension queues for an event type.
+   *
+   * Events are checked by the kernel before reserving queue space, events not
+   * matching the filter are discarded and counted, see filterStats.
+   *
+   * @param event The event type.
+   * @param actions The delivered actions, or OSQUERY_FILTER_ALL_ACTIONS.
+   * @param prefixes Delivered path prefixes, empty to deliver all paths.
+   * @param excluded_pids Processes whose events are discarded.
+   */
+  void setFilter(osquery_event_t event,
+                 uint32_t actions,
+                 const std::vector<std::string> &prefixes,
+                 const std::vector<pid_t> &excluded_pids);
+
+  /**
+   * @brief Read the kernel's counts of delivered and filtered events.
+   *
+   * @param event The event type.
+   * @param delivered (output) Events passing the filter since it was reset.
+   * @param filtered (output) Events discarded by the filter.
+   */
+  void filterStats(osquery_event_t event,
+                   uint64_t &delivered,
+                   uint64_t &filtered);
+
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
@@ -75,6 +109,18 @@ class CQueue : private boost::noncopyable {
    */
   osquery_event_t dequeue(event **event);
 
+  /**
+   * @brief Dequeue a batch of events from the shared buffer.
+   *
+   * The events point into the shared buffer and may only be used until the
+   * next call to kernelSync, which releases their space to the kernel.
+   *
+   * @param events (output) The dequeued events, replacing the contents.
+   * @param max The maximum number of events to dequeue.
+   * @return The number of events dequeued, 0 if the queue is empty.
+   */
+  size_t dequeue(std::vector<EventRef> &events, size_t max);
+
   /**
    * @brief Sync the cqueue structure with the cqueue structure in the kernel.
    *
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/events/kernel.h"
+
+namespace osquery {
+
+DECLARE_bool(kernel_exclude_self);
+
+class KernelFilterTests : public testing::Test {
+  void TearDown() override {
+    FLAGS_kernel_exclude_self = true;
+  }
+
+ protected:
+  void subscribe(KernelEventPublisher& pub,
+                 osquery_event_t event_type,
+                 uint32_t actions,
+                 const std::string& prefix) {
+    auto sc = std::make_shared<KernelSubscriptionContext>();
+    sc->event_type = event_type;
+    sc->actions = actions;
+    sc->path_prefix = prefix;
+    pub.addSubscription(Subscription::create("kernel_filter_tests", sc));
+  }
+};
+
+TEST_F(KernelFilterTests, test_configure_filters) {
+  KernelEventPublisher pub;
+  subscribe(pub, OSQUERY_FILE_EVENT, OSQUERY_FILE_ACTION_OPEN, "/etc/");
+  subscribe(pub, OSQUERY_FILE_EVENT, OSQUERY_FILE_ACTION_CLOSE, "/tmp/");
+  subscribe(pub, OSQUERY_FILE_EVENT, OSQUERY_FILE_ACTION_OPEN, "/etc/");
+  subscribe(pub, OSQUERY_PROCESS_EVENT, OSQUERY_FILTER_ALL_ACTIONS, "");
+
+  // Each event type's filter is the union of its subscriptions.
+  auto filters = pub.getFilters();
+  ASSERT_EQ(filters.size(), 2U);
+  const auto& file = filters[OSQUERY_FILE_EVENT];
+  EXPECT_EQ(file.actions,
+            static_cast<uint32_t>(OSQUERY_FILE_ACTION_OPEN |
+                                  OSQUERY_FILE_ACTION_CLOSE));
+  std::vector<std::string> expected = {"/etc/", "/tmp/"};
+  EXPECT_EQ(file.prefixes, expected);
+  std::vector<pid_t> self = {getpid()};
+  EXPECT_EQ(file.excluded_pids, self);
+
+  const auto& process = filters[OSQUERY_PROCESS_EVENT];
+  EXPECT_EQ(process.actions, OSQUERY_FILTER_ALL_ACTIONS);
+  EXPECT_TRUE(process.prefixes.empty());
+
+  // A subscription without a prefix matches every path.
+  subscribe(pub,
+            OSQUERY_FILE_EVENT,
+            OSQUERY_FILE_ACTION_CLOSE_MODIFIED,
+            "");
+  FLAGS_kernel_exclude_self = false;
+  filters = pub.getFilters();
+  EXPECT_TRUE(filters[OSQUERY_FILE_EVENT].prefixes.empty());
+  EXPECT_TRUE(filters[OSQUERY_FILE_EVENT].excluded_pids.empty());
+  EXPECT_NE(filters[OSQUERY_FILE_EVENT].actions &
+                OSQUERY_FILE_ACTION_CLOSE_MODIFIED,
+            0U);
+}
+
+TEST_F(KernelFilterTests, test_should_fire) {
+  KernelEventPublisher pub;
+  auto sc = std::make_shared<KernelSubscriptionContext>();
+  sc->event_type = OSQUERY_FILE_EVENT;
+  sc->actions = OSQUERY_FILE_ACTION_OPEN;
+  sc->path_prefix = "/etc/";
+
+  auto ec = std::make_shared<TypedKernelEventContext<osquery_file_event_t>>();
+  memset(&ec->event, 0, sizeof(ec->event));
+  ec->event_type = OSQUERY_FILE_EVENT;
+  ec->event.action = OSQUERY_FILE_ACTION_OPEN;
+  strncpy(ec->event.path, "/etc/hosts", sizeof(ec->event.path) - 1);
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+
+  // Another subscription's action or path is not fired.
+  ec->event.action = OSQUERY_FILE_ACTION_CLOSE;
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+  ec->event.action = OSQUERY_FILE_ACTION_OPEN;
+  strncpy(ec->event.path, "/tmp/hosts", sizeof(ec->event.path) - 1);
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+
+  // Without a prefix every path matches.
+  sc->path_prefix.clear();
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+
+  // Process events are matched by their type.
+  auto process_ec = std::make_shared<KernelEventContext>();
+  process_ec->event_type = OSQUERY_PROCESS_EVENT;
+  EXPECT_FALSE(pub.shouldFire(sc, process_ec));
+  sc->event_type = OSQUERY_PROCESS_EVENT;
+  EXPECT_TRUE(pub.shouldFire(sc, process_ec));
+}
+}
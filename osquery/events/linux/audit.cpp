@@ -8,11 +8,18 @@
  *
  */
 
+#include <sys/socket.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/utility/string_ref.hpp>
 
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -37,8 +44,132 @@ FLAG(bool,
      false,
      "Allow the audit publisher to change auditing configuration");
 
+/// Allow the kernel to queue more replies while the publisher is parsing.
+FLAG(uint64,
+     audit_socket_buffer,
+     0,
+     "Audit netlink receive buffer size in bytes (0 = system default)");
+
+/// Assemble and fire audit messages from several threads.
+FLAG(uint64,
+     audit_assembly_threads,
+     1,
+     "Threads firing audit messages, sharded by audit ID (1 = publisher)");
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
+/// The maximum number of assembly shards.
+static const size_t kAuditShardsMax = 64;
+
+/// Messages queued for each shard before the netlink reader waits.
+static const size_t kAuditShardQueueSize = 4096;
+
+/// A queue of messages fired by one assembly shard's thread.
+struct AuditShard {
+  explicit AuditShard(AuditFire f) : fire(std::move(f)) {}
+
+  /// Queue a message, waiting while the queue is full. False if stopped.
+  bool push(const AuditEventContextRef& ec) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this]() {
+      return stopped || queue.size() < kAuditShardQueueSize;
+    });
+    if (stopped) {
+      return false;
+    }
+
+    queue.push_back(ec);
+    not_empty.notify_one();
+    return true;
+  }
+
+  /// Wait for the oldest message, false if the shard was stopped.
+  bool pop(AuditEventContextRef& ec) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return stopped || !queue.empty(); });
+    if (stopped) {
+      return false;
+    }
+
+    ec = std::move(queue.front());
+    queue.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  /// Wake the shard's thread and the reader, messages are no longer queued.
+  void stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    queue.clear();
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+  bool isStopped() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopped;
+  }
+
+  /// Fire a message from the publisher.
+  AuditFire fire;
+
+  /// Held while firing, the publisher waits for it when torn down.
+  Mutex fire_mutex;
+
+ private:
+  std::deque<AuditEventContextRef> queue;
+
+  /// Set when the publisher is stopped or the thread is interrupted.
+  bool stopped{false};
+
+  /// Protects the queue and stopped, both conditions wait on it.
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+};
+
+/// The thread of an assembly shard, firing the messages of its queue.
+class AuditShardRunner : public InternalRunnable {
+ public:
+  explicit AuditShardRunner(std::shared_ptr<AuditShard> shard)
+      : shard_(std::move(shard)) {}
+
+  void start() override {
+    AuditEventContextRef ec;
+    while (!interrupted() && shard_->pop(ec)) {
+      WriteLock lock(shard_->fire_mutex);
+      if (!shard_->isStopped()) {
+        shard_->fire(ec);
+      }
+      ec = nullptr;
+    }
+  }
+
+  void stop() override {
+    shard_->stop();
+  }
+
+ private:
+  std::shared_ptr<AuditShard> shard_;
+};
+
+size_t getAuditShards() {
+  static const size_t shards = std::max<size_t>(
+      1, std::min<size_t>(FLAGS_audit_assembly_threads, kAuditShardsMax));
+  return shards;
+}
+
+void ShardedAuditAssembler::start(size_t capacity,
+                                  std::vector<size_t> types,
+                                  AuditUpdate update) {
+  shards_.clear();
+  for (size_t i = 0; i < getAuditShards(); i++) {
+    shards_.push_back(std::make_unique<AuditAssembler>());
+    shards_.back()->start(capacity, types, update);
+  }
+}
+
 enum AuditStatus {
   AUDIT_DISABLED = 0,
   AUDIT_ENABLED = 1,
@@ -54,11 +185,46 @@ void AuditAssembler::start(size_t capacity,
   update_ = update;
 
   queue_.clear();
-  queue_.reserve(capacity_);
   mt_.clear();
   m_.clear();
 
   types_ = std::move(types);
+  if (types_.size() > 64) {
+    types_.resize(64);
+  }
+  complete_types_ =
+      (types_.size() == 64) ? ~0ULL : (1ULL << types_.size()) - 1;
+}
+
+Status addAuditRuleFilter(struct audit_rule_data* rule,
+                          const std::string& filter,
+                          int flags) {
+  for (const auto& pair : osquery::split(filter, " ")) {
+    // The rule data has no buffer for string fields such as paths or keys.
+    auto op = pair.find_first_of("=!<>&");
+    auto value = pair.find_first_not_of("=!<>&", op);
+    long long number = 0;
+    if (op == 0 || value == std::string::npos ||
+        !safeStrtoll(pair.substr(value), 0, number).ok()) {
+      return Status(1, "Not an integer field comparison: " + pair);
+    }
+
+    auto* rrule = rule;
+    int rc = audit_rule_fieldpair_data(&rrule, pair.c_str(), flags);
+    if (rc < 0) {
+      return Status(1, "Invalid field comparison: " + pair);
+    }
+  }
+  return Status(0, "OK");
+}
+
+uint64_t AuditAssembler::typeBit(size_t type) const {
+  for (size_t i = 0; i < types_.size(); i++) {
+    if (types_[i] == type) {
+      return 1ULL << i;
+    }
+  }
+  return 0;
 }
 
 boost::optional<AuditFields> AuditAssembler::add(Auid id,
@@ -84,8 +250,9 @@ boost::optional<AuditFields> AuditAssembler::add(Auid id,
     }
 
     // Add the type, push the ID onto the queue, and update.
-    mt_[id] = {type};
-    queue_.push_back(id);
+    auto& state = mt_[id];
+    state.types = typeBit(type);
+    state.position = queue_.insert(queue_.end(), id);
     if (update_ == nullptr) {
       m_[id] = {};
     } else {
@@ -95,10 +262,13 @@ boost::optional<AuditFields> AuditAssembler::add(Auid id,
   }
 
   // Add the type and update.
-  auto& mt = mt_[id];
-  if (std::find(mt.begin(), mt.end(), type) == mt.end()) {
-    mt.push_back(type);
+  auto state = mt_.find(id);
+  if (state == mt_.end()) {
+    // The fields were explicitly set before a message was added.
+    state = mt_.emplace(id, AuditAssemblerState()).first;
+    state->second.position = queue_.insert(queue_.end(), id);
   }
+  state->second.types |= typeBit(type);
 
   if (update_ != nullptr && !update_(type, fields, m_[id])) {
     evict(id);
@@ -118,25 +288,25 @@ boost::optional<AuditFields> AuditAssembler::add(Auid id,
 }
 
 void AuditAssembler::evict(Auid id) {
-  queue_.erase(std::remove(queue_.begin(), queue_.end(), id), queue_.end());
-  mt_.erase(id);
+  auto state = mt_.find(id);
+  if (state != mt_.end()) {
+    queue_.erase(state->second.position);
+    mt_.erase(state);
+  }
   m_.erase(id);
 }
 
 void AuditAssembler::shuffle(Auid id) {
-  queue_.erase(std::remove(queue_.begin(), queue_.end(), id), queue_.end());
-  queue_.push_back(id);
+  auto state = mt_.find(id);
+  if (state != mt_.end()) {
+    queue_.splice(queue_.end(), queue_, state->second.position);
+  }
 }
 
 bool AuditAssembler::complete(Auid id) {
   // Is this type enough.
-  const auto& types = mt_.at(id);
-  for (const auto& t : types_) {
-    if (std::find(types.begin(), types.end(), t) == types.end()) {
-      return false;
-    }
-  }
-  return true;
+  auto state = mt_.find(id);
+  return state != mt_.end() && state->second.types == complete_types_;
 }
 
 Status AuditEventPublisher::setUp() {
@@ -150,6 +320,17 @@ Status AuditEventPublisher::setUp() {
     return Status(1, "Could not open audit subsystem");
   }
 
+  if (FLAGS_audit_socket_buffer > 0) {
+    // A root process may exceed the system's maximum receive buffer size.
+    int size = static_cast<int>(FLAGS_audit_socket_buffer);
+    auto forced =
+        setsockopt(handle_, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+    if (forced < 0 &&
+        setsockopt(handle_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+      VLOG(1) << "Could not set the audit socket buffer size";
+    }
+  }
+
   // The setup can try to enable auditing.
   if (FLAGS_audit_allow_config) {
     audit_set_enabled(handle_, AUDIT_ENABLED);
@@ -185,9 +366,38 @@ Status AuditEventPublisher::setUp() {
     // Request only the highest priority of audit status messages.
     set_aumessage_mode(MSG_QUIET, DBG_NO);
   }
+
+  // Each shard assembles and fires the messages of its audit IDs.
+  startShards(getAuditShards(),
+              [this](const AuditEventContextRef& ec) { fire(ec); });
   return Status(0, "OK");
 }
 
+void AuditEventPublisher::startShards(size_t shards, AuditFire fire) {
+  WriteLock lock(shards_mutex_);
+  if (shards <= 1 || !shards_.empty()) {
+    return;
+  }
+
+  for (size_t i = 0; i < shards; i++) {
+    auto shard = std::make_shared<AuditShard>(fire);
+    shards_.push_back(shard);
+    Dispatcher::addService(std::make_shared<AuditShardRunner>(shard));
+  }
+}
+
+void AuditEventPublisher::fireShard(const AuditEventContextRef& ec) {
+  if (shards_.empty()) {
+    fire(ec);
+    return;
+  }
+
+  // The records of an audit ID are queued in order to the same shard.
+  // The reader waits while the queue is full, until the publisher stops.
+  ec->shard = ec->auid % shards_.size();
+  shards_[ec->shard]->push(ec);
+}
+
 void AuditEventPublisher::configure() {
   // Able to issue libaudit API calls.
   struct AuditRuleInternal rule;
@@ -218,8 +428,18 @@ void AuditEventPublisher::configure() {
 
       if (scr.filter.size() > 0) {
         // Fill in rule's filter data.
-        auto* rrule = &rule.rule;
-        audit_rule_fieldpair_data(&rrule, scr.filter.c_str(), scr.flags);
+        auto status = addAuditRuleFilter(&rule.rule, scr.filter, scr.flags);
+        if (!status.ok()) {
+          // The rule is still needed by the subscriber, it is installed
+          // without the filter rather than losing its events.
+          LOG(ERROR) << "Cannot add audit rule filter '" << scr.filter
+                     << "', adding the rule unfiltered: "
+                     << status.getMessage();
+          memset(&rule.rule, 0, sizeof(struct audit_rule_data));
+          if (scr.syscall != 0) {
+            audit_rule_syscall_data(&rule.rule, scr.syscall);
+          }
+        }
       }
 
       // Apply this rule to the EXIT filter, ALWAYS.
@@ -250,7 +470,24 @@ void AuditEventPublisher::configure() {
   }
 }
 
+void AuditEventPublisher::stop() {
+  WriteLock lock(shards_mutex_);
+  for (auto& shard : shards_) {
+    shard->stop();
+  }
+}
+
 void AuditEventPublisher::tearDown() {
+  // Wait for messages being fired, the shards do not fire afterward.
+  {
+    WriteLock lock(shards_mutex_);
+    for (auto& shard : shards_) {
+      shard->stop();
+      WriteLock fire_lock(shard->fire_mutex);
+    }
+    shards_.clear();
+  }
+
   if (handle_ <= 0) {
     return;
   }
@@ -294,46 +531,47 @@ bool handleAuditReply(const struct audit_reply& reply,
       std::string(message_view.substr(21, preamble_end - 21)), 10, ec->auid);
   boost::string_ref field_view(message_view.substr(preamble_end + 3));
 
-  // The linear search will construct series of key value pairs.
-  std::string key, value;
-  key.reserve(20);
-  value.reserve(256);
+  // The linear search finds the bounds of each key and value pair, the field
+  // strings are constructed once from the message.
+  const char* data = field_view.data();
+  auto addField = [&ec, data](size_t start, size_t assign, size_t end) {
+    auto key_end = (assign == std::string::npos) ? end : assign;
+    if (key_end == start) {
+      // Multiple space tokens are supported.
+      return;
+    }
+    auto value_start = (assign == std::string::npos) ? end : assign + 1;
+    ec->fields.emplace(std::string(data + start, key_end - start),
+                       std::string(data + value_start, end - value_start));
+  };
 
   // There are several ways of representing value data (enclosed strings, etc).
-  bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : field_view) {
+  size_t start = 0;
+  size_t assign = std::string::npos;
+  bool found_enclose{false};
+  for (size_t i = 0; i < field_view.size(); i++) {
     // Iterate over each character in the audit message.
+    auto c = data[i];
     if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
-      if (c == '"') {
-        value += c;
-      }
       // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
-        // Multiple space tokens are supported.
-        ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
-      }
+      // An enclosed value keeps its closing quote.
+      addField(start, assign, (c == '"') ? i + 1 : i);
       found_enclose = false;
-      found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
-    } else if (found_assignment) {
+      assign = std::string::npos;
+      start = i + 1;
+    } else if (assign != std::string::npos) {
       // Enclosure sequences appear immediately following assignment.
       if (c == '"') {
         found_enclose = true;
       }
-      value += c;
     } else if (c == '=') {
-      found_assignment = true;
-    } else {
-      key += c;
+      assign = i;
     }
   }
 
   // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
+  if (start < field_view.size()) {
+    addField(start, assign, field_view.size());
   }
 
   // There is a special field for syscalls.
@@ -394,23 +632,35 @@ static inline bool adjust_reply(struct audit_reply* rep, int len) {
   return true;
 }
 
-static inline bool safe_audit_get_reply(int fd, struct audit_reply* rep) {
+/**
+ * @brief Receive the next audit reply without blocking.
+ *
+ * @param fd the audit netlink handle
+ * @param rep the reply to fill in
+ * @param wait wait up to kAuditMTimeout for the handle to become readable
+ * @return the reply length, a negative errno if there was no reply
+ */
+static inline int safe_audit_get_reply(int fd,
+                                       struct audit_reply* rep,
+                                       bool wait) {
   if (fd < 0) {
     return -EBADF;
   }
 
-  struct timeval timeout = {0, kAuditMTimeout};
+  if (wait) {
+    struct timeval timeout = {0, kAuditMTimeout};
 
-  fd_set readSet;
-  FD_ZERO(&readSet);
-  FD_SET(fd, &readSet);
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(fd, &readSet);
 
-  if (select(fd + 1, &readSet, nullptr, nullptr, &timeout) < 0) {
-    return -1;
-  }
+    if (select(fd + 1, &readSet, nullptr, nullptr, &timeout) < 0) {
+      return -errno;
+    }
 
-  if (!FD_ISSET(fd, &readSet)) {
-    return -1;
+    if (!FD_ISSET(fd, &readSet)) {
+      return -EAGAIN;
+    }
   }
 
   struct sockaddr_nl nladdr;
@@ -419,7 +669,7 @@ static inline bool safe_audit_get_reply(int fd, struct audit_reply* rep) {
   int len = recvfrom(fd,
                      &rep->msg,
                      sizeof(rep->msg),
-                     0,
+                     MSG_DONTWAIT,
                      (struct sockaddr*)&nladdr,
                      &nladdrlen);
   if (len < 0) {
@@ -499,25 +749,28 @@ Status AuditEventPublisher::run() {
       auto ec = createEventContext();
       // Build the event context from the reply type and parse the message.
       if (handleAuditReply(reply_, ec)) {
-        fire(ec);
+        fireShard(ec);
       }
     }
   });
 
   // Reset the reply data.
-  bool result = false;
+  int result = 0;
+  bool wait = true;
   do {
     // Request a reply in a non-blocking mode.
     // This allows the publisher's run loop to periodically request an audit
     // status update. These updates can check for other processes attempting to
     // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = safe_audit_get_reply(handle_, &reply_);
+    // Only the first read waits for the handle, queued replies are then
+    // drained without a select for each one.
+    result = safe_audit_get_reply(handle_, &reply_, wait);
+    wait = false;
 
-    if (result) {
+    if (result > 0) {
       inspectReply();
     }
-  } while (result && !isEnding());
+  } while (result > 0 && !isEnding());
 
   if (static_cast<pid_t>(status_.pid) != getpid()) {
     if (control_ && status_.pid != 0) {
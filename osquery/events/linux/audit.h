@@ -12,7 +12,9 @@
 
 #include <libaudit.h>
 
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -37,7 +39,14 @@ struct AuditRule {
   /// The rule may either contain a filter or syscall number.
   int syscall{0};
 
-  /// The rule may either contain a filter or a syscall number.
+  /**
+   * @brief The rule may either contain a filter or a syscall number.
+   *
+   * A filter is a space-separated list of audit rule field comparisons, like
+   * the `-F` arguments to auditctl: "success=1 auid>=1000". Each comparison
+   * is compiled into the rule, so the kernel does not emit records the
+   * subscriber would discard. Only integer fields may be compared.
+   */
   std::string filter;
 
   /// All rules must include an action and set of flags.
@@ -98,6 +107,10 @@ using AuditUpdate =
  *
  * The publisher also sets an update callable to transfer needed fields from
  * the audit message into a persisent Row.
+ *
+ * Adding a message is constant time with respect to the capacity: each audit
+ * ID keeps its position in the time-ordered queue and a bitmask of the
+ * expected types seen. At most 64 expected types are supported.
  */
 class AuditAssembler : private boost::noncopyable {
  public:
@@ -127,8 +140,17 @@ class AuditAssembler : private boost::noncopyable {
   /// A map of audit ID to aggregate message fields.
   std::unordered_map<Auid, AuditFields> m_;
 
+  /// The queue position and the expected types seen for an audit ID.
+  struct AuditAssemblerState {
+    /// Bit N is set when the Nth expected type was seen.
+    uint64_t types{0};
+
+    /// The audit ID's position in the queue.
+    std::list<Auid>::iterator position;
+  };
+
   /// A map of audit ID to current set of types seen.
-  std::unordered_map<Auid, std::vector<size_t>> mt_;
+  std::unordered_map<Auid, AuditAssemblerState> mt_;
 
   /// A functional callable to sanitize individual messages.
   AuditUpdate update_{nullptr};
@@ -137,15 +159,50 @@ class AuditAssembler : private boost::noncopyable {
   size_t capacity_{0};
 
   /// The in-order (by time) queue of audit IDs.
-  std::vector<Auid> queue_;
+  std::list<Auid> queue_;
 
   /// The set of required types.
   std::vector<size_t> types_;
 
+  /// The bitmask of types seen by a complete audit ID.
+  uint64_t complete_types_{0};
+
+ private:
+  /// The bit for a message type, 0 if the type is not expected.
+  uint64_t typeBit(size_t type) const;
+
  private:
   FRIEND_TEST(AuditTests, test_audit_assembler);
 };
 
+/**
+ * @brief The number of audit assembly shards, see --audit_assembly_threads.
+ *
+ * Records are fired from the shard of their audit ID. The value is read once,
+ * such that publishers and subscribers agree on it.
+ */
+size_t getAuditShards();
+
+/**
+ * @brief An AuditAssembler for each audit assembly shard.
+ *
+ * The records of an audit ID are fired in order from a single shard, so each
+ * shard's assembler is used by one thread and needs no lock.
+ */
+class ShardedAuditAssembler : private boost::noncopyable {
+ public:
+  /// Start or restart an assembler for each shard.
+  void start(size_t capacity, std::vector<size_t> types, AuditUpdate update);
+
+  /// The assembler of a shard, see AuditEventContext::shard.
+  AuditAssembler& shard(size_t shard) {
+    return *shards_[shard % shards_.size()];
+  }
+
+ private:
+  std::vector<std::unique_ptr<AuditAssembler>> shards_;
+};
+
 /// Handle quote and hex-encoded audit field content.
 inline std::string decodeAuditValue(const std::string& s) {
   if (s.size() > 1 && s[0] == '"') {
@@ -206,11 +263,17 @@ struct AuditEventContext : public EventContext {
 
   /// Each message will contain the event time.
   size_t time{0};
+
+  /// The assembly shard firing the message, the same for each audit ID.
+  size_t shard{0};
 };
 
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
 using AuditSubscriptionContextRef = std::shared_ptr<AuditSubscriptionContext>;
 
+/// Fire an audit message from an assembly shard.
+using AuditFire = std::function<void(const AuditEventContextRef&)>;
+
 class AuditEventPublisher
     : public EventPublisher<AuditSubscriptionContext, AuditEventContext> {
   DECLARE_PUBLISHER("audit");
@@ -245,6 +308,9 @@ class AuditEventPublisher
   /// Poll for replies to the netlink handle in a non-blocking mode.
   Status run() override;
 
+  /// Stop the assembly shards, a reader waiting for a full queue returns.
+  void stop() override;
+
  public:
   AuditEventPublisher() : EventPublisher() {}
 
@@ -260,6 +326,12 @@ class AuditEventPublisher
   bool shouldFire(const AuditSubscriptionContextRef& mc,
                   const AuditEventContextRef& ec) const override;
 
+  /// Start the threads of more than one assembly shard.
+  void startShards(size_t shards, AuditFire fire);
+
+  /// Fire a message, or queue it to the shard of its audit ID.
+  void fireShard(const AuditEventContextRef& ec);
+
  private:
   /// Audit subsystem (netlink) socket descriptor.
   int handle_{0};
@@ -292,8 +364,31 @@ class AuditEventPublisher
 
   /// Track all rule data added by the publisher.
   std::vector<struct AuditRuleInternal> transient_rules_;
+
+  /// Queues of messages fired by assembly shards, empty if not sharded.
+  std::vector<std::shared_ptr<struct AuditShard>> shards_;
+
+  /// Protects the shards from being stopped while they are torn down.
+  Mutex shards_mutex_;
+
+ private:
+  FRIEND_TEST(AuditTests, test_shard_routing);
+  FRIEND_TEST(AuditTests, test_shard_teardown);
 };
 
+/**
+ * @brief Compile a rule filter's field comparisons into audit rule data.
+ *
+ * @param rule the rule data, which has no string buffer space
+ * @param filter the space-separated field comparisons
+ * @param flags the audit filter list the rule is added to
+ * @return Failure if a comparison is invalid or not an integer comparison,
+ * the comparisons before it remain in the rule.
+ */
+Status addAuditRuleFilter(struct audit_rule_data* rule,
+                          const std::string& filter,
+                          int flags);
+
 /**
  * @brief Populate an event context from a single audit reply.
  */
@@ -62,12 +62,35 @@ static void AUDIT_handleReply(benchmark::State& state) {
     // Perform the parsing.
     handleAuditReply(reply, ec);
   }
+  state.SetItemsProcessed(state.iterations());
 
   free((void*)reply.message);
 }
 
 BENCHMARK(AUDIT_handleReply);
 
+/// Parse each record of an execve event, reporting records per second.
+static void AUDIT_handleReply_event(benchmark::State& state) {
+  std::vector<struct audit_reply> replies;
+  for (const auto& message : kBenchmarkMessages) {
+    replies.push_back(getMockReply(message));
+  }
+
+  while (state.KeepRunning()) {
+    for (const auto& reply : replies) {
+      auto ec = std::make_shared<AuditEventContext>();
+      handleAuditReply(reply, ec);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * replies.size());
+
+  for (auto& r : replies) {
+    free((void*)r.message);
+  }
+}
+
+BENCHMARK(AUDIT_handleReply_event);
+
 static void AUDIT_assembler(benchmark::State& state) {
   AuditAssembler asmb;
   asmb.start(
@@ -101,4 +124,38 @@ static void AUDIT_assembler(benchmark::State& state) {
 }
 
 BENCHMARK(AUDIT_assembler);
+
+/// Assemble interleaved events while the assembler holds capacity IDs.
+static void AUDIT_assembler_capacity(benchmark::State& state) {
+  size_t capacity = state.range_x();
+  AuditAssembler asmb;
+  asmb.start(capacity,
+             {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD},
+             &ProcessUpdate);
+
+  std::vector<AuditEventContextRef> contexts;
+  for (const auto& message : kBenchmarkMessages) {
+    auto reply = getMockReply(message);
+    auto ec = std::make_shared<AuditEventContext>();
+    handleAuditReply(reply, ec);
+    contexts.push_back(ec);
+    free((void*)reply.message);
+  }
+
+  // Fill the assembler with incomplete events.
+  for (size_t id = 0; id < capacity; id++) {
+    asmb.add(id, contexts[0]->type, contexts[0]->fields);
+  }
+
+  // Each audit ID receives one record of its event per pass.
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    const auto& ec = contexts[(i / capacity) % contexts.size()];
+    asmb.add(i % capacity, ec->type, ec->fields);
+    i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(AUDIT_assembler_capacity)->Range(16, 16384);
 }
@@ -0,0 +1,235 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(bool,
+     file_events_fanotify,
+     false,
+     "Use fanotify mount marks instead of inotify watches for file_events");
+
+static_assert(FAN_ACCESS == IN_ACCESS && FAN_MODIFY == IN_MODIFY &&
+                  FAN_CLOSE_WRITE == IN_CLOSE_WRITE && FAN_OPEN == IN_OPEN,
+              "fanotify and inotify event bits differ");
+
+const uint32_t kFAnotifyMasks =
+    IN_ACCESS | IN_MODIFY | IN_CLOSE_WRITE | IN_OPEN;
+
+/// The number of event records read from the handle at once.
+static const size_t kFAnotifyBufferEvents = 256;
+
+REGISTER(FAnotifyEventPublisher, "event_publisher", "fanotify");
+
+Status FAnotifyEventPublisher::setUp() {
+  if (!FLAGS_file_events_fanotify) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  fanotify_handle_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC,
+                                     O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fanotify_handle_ == -1) {
+    return Status(1, "Could not start fanotify: fanotify_init failed");
+  }
+  return Status(0, "OK");
+}
+
+bool FAnotifyEventPublisher::addMount(const std::string& path, uint32_t mask) {
+  // A mark is placed on the mount of the nearest existing directory.
+  auto existing = fs::path(path);
+  while (!existing.empty() && !pathExists(existing).ok()) {
+    existing = existing.parent_path();
+  }
+  if (existing.empty()) {
+    existing = "/";
+  }
+
+  struct stat info;
+  if (::stat(existing.string().c_str(), &info) != 0) {
+    return false;
+  }
+
+  // Each mount is marked once for the union of the subscribed actions.
+  auto& marked = mounts_[info.st_dev];
+  if ((marked & mask) == mask) {
+    return true;
+  }
+
+  if (::fanotify_mark(fanotify_handle_,
+                      FAN_MARK_ADD | FAN_MARK_MOUNT,
+                      mask,
+                      AT_FDCWD,
+                      existing.string().c_str()) == -1) {
+    LOG(WARNING) << "Could not add fanotify mount mark on: " << existing;
+    return false;
+  }
+  marked |= mask;
+  return true;
+}
+
+void FAnotifyEventPublisher::configure() {
+  if (fanotify_handle_ == -1) {
+    // This publisher has not been setup correctly.
+    return;
+  }
+
+  // Subscriptions may have been removed, mark the needed mounts again.
+  ::fanotify_mark(
+      fanotify_handle_, FAN_MARK_FLUSH | FAN_MARK_MOUNT, 0, AT_FDCWD, "/");
+  mounts_.clear();
+
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->discovered_.empty()) {
+      // Apply the same path rules as the inotify publisher.
+      sc->discovered_ = sc->path;
+      if (sc->path.find("**") != std::string::npos) {
+        sc->recursive = true;
+        sc->path = sc->path.substr(0, sc->path.find("**"));
+      }
+      sc->recursive_match =
+          sc->recursive && sc->path.find('*') != std::string::npos;
+      if (sc->path.find('*') == std::string::npos &&
+          isDirectory(sc->path).ok() && sc->path.back() != '/') {
+        sc->path += '/';
+      }
+    }
+
+    // Mark the mount of the path's leading directories without wildcards.
+    auto root = sc->path.substr(0, sc->path.find('*'));
+    auto mask = (sc->mask == 0) ? kFileDefaultMasks : sc->mask;
+    addMount(root, mask & kFAnotifyMasks);
+  }
+
+  auto index = std::make_shared<PathPatternIndex>();
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    index->add(sc, sc->path, sc->matchType());
+  }
+  std::atomic_store(&index_, std::shared_ptr<const PathPatternIndex>(index));
+}
+
+void FAnotifyEventPublisher::tearDown() {
+  if (fanotify_handle_ > -1) {
+    ::close(fanotify_handle_);
+  }
+  fanotify_handle_ = -1;
+  mounts_.clear();
+}
+
+Status FAnotifyEventPublisher::run() {
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(fanotify_handle_, &set);
+
+  struct timeval timeout = {1, 0};
+  int selector =
+      ::select(fanotify_handle_ + 1, &set, nullptr, nullptr, &timeout);
+  if (selector == -1) {
+    LOG(WARNING) << "Could not read fanotify handle";
+    return Status(1, "fanotify handle failed");
+  }
+
+  if (selector == 0) {
+    // Read timeout.
+    return Status(0, "Continue");
+  }
+
+  struct fanotify_event_metadata buffer[kFAnotifyBufferEvents];
+  auto length = ::read(fanotify_handle_, buffer, sizeof(buffer));
+  if (length == 0 || length == -1) {
+    return Status(1, "fanotify read failed");
+  }
+
+  auto pid = getpid();
+  auto index = std::atomic_load(&index_);
+  auto metadata = buffer;
+  while (FAN_EVENT_OK(metadata, length)) {
+    if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+      return Status(1, "fanotify metadata version mismatch");
+    }
+
+    if (metadata->mask & FAN_Q_OVERFLOW) {
+      // Events were dropped, the mount marks remain in place.
+      VLOG(1) << "fanotify queue overflowed";
+    } else if (metadata->fd >= 0 && metadata->pid != pid) {
+      // Changes made by this process, such as hashing, are not reported.
+      auto ec = createEventContextFrom(*metadata);
+      if (!ec->action.empty() && !ec->path.empty()) {
+        if (index != nullptr) {
+          ec->matches = index->match(ec->path);
+        }
+        fire(ec);
+      }
+    }
+
+    if (metadata->fd >= 0) {
+      ::close(metadata->fd);
+    }
+    metadata = FAN_EVENT_NEXT(metadata, length);
+  }
+  return Status(0, "OK");
+}
+
+INotifyEventContextRef FAnotifyEventPublisher::createEventContextFrom(
+    const struct fanotify_event_metadata& metadata) const {
+  auto ec = createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  memset(ec->event.get(), 0, sizeof(struct inotify_event));
+  ec->event->mask = static_cast<uint32_t>(metadata.mask) & kFAnotifyMasks;
+
+  // The event's descriptor is the opened file, resolve its path.
+  char path[PATH_MAX] = {0};
+  auto link = "/proc/self/fd/" + std::to_string(metadata.fd);
+  auto size = ::readlink(link.c_str(), path, sizeof(path) - 1);
+  if (size <= 0) {
+    return ec;
+  }
+  ec->path = std::string(path, size);
+
+  // Several actions may be merged into one event, a write is most relevant.
+  if (metadata.mask & (FAN_MODIFY | FAN_CLOSE_WRITE)) {
+    ec->action = "UPDATED";
+  } else if (metadata.mask & FAN_OPEN) {
+    ec->action = "OPENED";
+  } else if (metadata.mask & FAN_ACCESS) {
+    ec->action = "ACCESSED";
+  }
+  return ec;
+}
+
+bool FAnotifyEventPublisher::shouldFire(
+    const INotifySubscriptionContextRef& sc,
+    const INotifyEventContextRef& ec) const {
+  // The subscription may supply a required event mask.
+  if (sc->mask != 0 && !(ec->event->mask & sc->mask)) {
+    return false;
+  }
+
+  if (ec->matches != nullptr && ec->matches->indexed(sc.get())) {
+    return ec->matches->matched(sc.get());
+  }
+  return PathPattern(sc->path, sc->matchType()).matches(ec->path);
+}
+}
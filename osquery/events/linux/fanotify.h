@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+
+#include <sys/fanotify.h>
+#include <sys/types.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/inotify.h"
+
+namespace osquery {
+
+/// The inotify actions that fanotify reports, the bits are the same.
+extern const uint32_t kFAnotifyMasks;
+
+/**
+ * @brief A Linux `fanotify` EventPublisher.
+ *
+ * This is an alternative to the INotifyEventPublisher for file_events, see
+ * --file_events_fanotify. Instead of a watch for every monitored directory,
+ * the publisher marks each mount containing a subscribed path. Kernel memory
+ * does not grow with the number of directories and a queue overflow drops
+ * events without requiring a re-walk of the monitored paths.
+ *
+ * Events report the path of the opened file, subscriptions are matched in
+ * user space with the same path and glob rules as INotifyEventPublisher.
+ * Mount marks only report opens, accesses, modifications, and closes after a
+ * write. Creations, deletions, moves, and attribute changes are not reported.
+ *
+ * The publisher uses the INotify subscription and event contexts, so a
+ * subscriber may select a publisher at runtime. The event's inotify_event
+ * carries the equivalent inotify mask bits.
+ */
+class FAnotifyEventPublisher
+    : public EventPublisher<INotifySubscriptionContext, INotifyEventContext> {
+  DECLARE_PUBLISHER("fanotify");
+
+ public:
+  virtual ~FAnotifyEventPublisher() {
+    tearDown();
+  }
+
+  /// Create a `fanotify` handle descriptor, this requires CAP_SYS_ADMIN.
+  Status setUp() override;
+
+  /// Mark the mounts containing every subscribed path.
+  void configure() override;
+
+  /// Release the `fanotify` handle descriptor.
+  void tearDown() override;
+
+  /// Read and fire events from the handle.
+  Status run() override;
+
+ private:
+  /// Helper/specialized event context creation.
+  INotifyEventContextRef createEventContextFrom(
+      const struct fanotify_event_metadata& metadata) const;
+
+  /// Given a SubscriptionContext and INotifyEventContext match path and action.
+  bool shouldFire(const INotifySubscriptionContextRef& sc,
+                  const INotifyEventContextRef& ec) const override;
+
+  /// Mark the mount containing a path, or its nearest existing parent.
+  bool addMount(const std::string& path, uint32_t mask);
+
+ private:
+  /// The fanotify file descriptor handle.
+  int fanotify_handle_{-1};
+
+  /// The event mask marked on each mount, by device.
+  std::map<dev_t, uint32_t> mounts_;
+
+  /// The subscription path index, replaced when configured.
+  std::shared_ptr<const PathPatternIndex> index_;
+
+ private:
+  FRIEND_TEST(FAnotifyTests, test_fanotify_match_subscription);
+};
+}
@@ -8,14 +8,24 @@
  *
  */
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <tuple>
 
-#include <fnmatch.h>
+#include <dirent.h>
 #include <linux/limits.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 
 #include <boost/filesystem.hpp>
 
+#include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
@@ -25,9 +35,30 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
-static const int kINotifyMLatency = 200;
+FLAG(uint64,
+     inotify_watch_threads,
+     4,
+     "Maximum number of threads walking directories of recursive file paths");
+
+FLAG(bool,
+     inotify_watch_cache,
+     true,
+     "Re-arm the inotify watches of the last run, then verify them");
+
+/// Time to wait for the inotify handle before checking for interrupts.
+static const int kINotifyMWait = 1000;
+
+/// The deepest directory watched below a recursive path.
+static const size_t kINotifyMaxDepth = 64;
+
+/// The persistent settings key of the watches stored by the last run.
+const std::string kINotifyWatchesKey = "inotify_watches";
+
 static const uint32_t kINotifyBufferSize =
-    (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+    (256 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+
+/// Buffers read as one batch, events read later are fired again.
+static const size_t kINotifyBatchReads = 4;
 
 std::map<int, std::string> kMaskActions = {
     {IN_ACCESS, "ACCESSED"},
@@ -48,17 +79,138 @@ const uint32_t kFileAccessMasks = IN_OPEN | IN_ACCESS;
 
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
+/// Append the canonical paths of a canonical directory's child directories.
+static void listChildDirectories(const std::string& directory,
+                                 std::vector<std::string>& children) {
+  auto dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    auto child = directory + entry->d_name;
+    if (entry->d_type == DT_DIR) {
+      // The child of a canonical directory is canonical.
+      children.push_back(child + '/');
+    } else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      struct stat info;
+      char resolved[PATH_MAX];
+      if (stat(child.c_str(), &info) == 0 && S_ISDIR(info.st_mode) &&
+          realpath(child.c_str(), resolved) != nullptr) {
+        children.push_back(std::string(resolved) + '/');
+      }
+    }
+  }
+  closedir(dir);
+}
+
+/**
+ * @brief Append the canonical paths of the directories below a directory.
+ *
+ * Directories are walked by up to threads at once. Each directory is listed
+ * once, links to directories that were walked, such as loops, are skipped.
+ */
+static void walkDirectories(const std::string& root,
+                            std::vector<std::string>& directories,
+                            size_t threads) {
+  char resolved[PATH_MAX];
+  if (realpath(root.c_str(), resolved) == nullptr) {
+    return;
+  }
+
+  struct WalkState {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::pair<std::string, size_t>> pending;
+    std::set<std::string> visited;
+    size_t walking{0};
+  } state;
+
+  auto canonical = std::string(resolved) + '/';
+  state.visited.insert(canonical);
+  state.pending.emplace_back(std::move(canonical), 0);
+
+  auto worker = [&state, &directories]() {
+    std::vector<std::string> children;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (true) {
+      state.changed.wait(lock, [&state]() {
+        return !state.pending.empty() || state.walking == 0;
+      });
+      if (state.pending.empty()) {
+        break;
+      }
+
+      auto next = std::move(state.pending.front());
+      state.pending.pop_front();
+      state.walking++;
+      lock.unlock();
+
+      children.clear();
+      listChildDirectories(next.first, children);
+
+      lock.lock();
+      state.walking--;
+      for (auto& child : children) {
+        if (state.visited.insert(child).second) {
+          directories.push_back(child);
+          if (next.second + 1 < kINotifyMaxDepth) {
+            state.pending.emplace_back(std::move(child), next.second + 1);
+          }
+        }
+      }
+      state.changed.notify_all();
+    }
+  };
+
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; ++i) {
+    group.run(worker);
+  }
+  worker();
+  group.wait();
+}
+
 Status INotifyEventPublisher::setUp() {
-  inotify_handle_ = ::inotify_init();
+  inotify_handle_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
     return Status(1, "Could not start inotify: inotify_init failed");
   }
+
+  epoll_handle_ = ::epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = inotify_handle_;
+  if (epoll_handle_ == -1 ||
+      ::epoll_ctl(epoll_handle_, EPOLL_CTL_ADD, inotify_handle_, &event) ==
+          -1) {
+    tearDown();
+    return Status(1, "Could not start inotify: epoll failed");
+  }
   return Status(0, "OK");
 }
 
 bool INotifyEventPublisher::monitorSubscription(
     INotifySubscriptionContextRef& sc, bool add_watch) {
+  parseSubscription(sc);
+  resolveWatches(sc, sc->watches_);
+
+  bool added = true;
+  for (const auto& watch : sc->watches_) {
+    added = addMonitor(watch, sc->mask, false, add_watch) && added;
+  }
+  return added;
+}
+
+void INotifyEventPublisher::parseSubscription(
+    INotifySubscriptionContextRef& sc) {
   sc->discovered_ = sc->path;
   if (sc->path.find("**") != std::string::npos) {
     sc->recursive = true;
@@ -68,7 +220,7 @@ bool INotifyEventPublisher::monitorSubscription(
 
   if (sc->path.find('*') != std::string::npos) {
     // If the wildcard exists within the file (leaf), remove and monitor the
-    // directory instead. Apply a fnmatch on fired events to filter leafs.
+    // directory instead. Match fired events with the pattern to filter leafs.
     auto fullpath = fs::path(sc->path);
     if (fullpath.filename().string().find('*') != std::string::npos) {
       sc->discovered_ = fullpath.parent_path().string() + '/';
@@ -77,13 +229,8 @@ bool INotifyEventPublisher::monitorSubscription(
     if (sc->discovered_.find('*') != std::string::npos) {
       // If a wildcard exists within the tree (stem), resolve at configure
       // time and monitor each path.
-      std::vector<std::string> paths;
-      resolveFilePattern(sc->discovered_, paths);
-      for (const auto& _path : paths) {
-        addMonitor(_path, sc->mask, sc->recursive, add_watch);
-      }
       sc->recursive_match = sc->recursive;
-      return true;
+      return;
     }
   }
 
@@ -91,7 +238,24 @@ bool INotifyEventPublisher::monitorSubscription(
     sc->path += '/';
     sc->discovered_ += '/';
   }
-  return addMonitor(sc->discovered_, sc->mask, sc->recursive, add_watch);
+}
+
+void INotifyEventPublisher::resolveWatches(
+    const INotifySubscriptionContextRef& sc,
+    std::vector<std::string>& watches) const {
+  std::vector<std::string> paths;
+  if (sc->discovered_.find('*') != std::string::npos) {
+    resolveFilePattern(sc->discovered_, paths);
+  } else {
+    paths.push_back(sc->discovered_);
+  }
+
+  for (const auto& path : paths) {
+    watches.push_back(path);
+    if (sc->recursive && isDirectory(path).ok()) {
+      walkDirectories(path, watches, FLAGS_inotify_watch_threads);
+    }
+  }
 }
 
 void INotifyEventPublisher::configure() {
@@ -100,19 +264,196 @@ void INotifyEventPublisher::configure() {
     return;
   }
 
+  WriteLock lock(configure_mutex_);
+  if (!restored_loaded_) {
+    restored_loaded_ = true;
+    restoreWatches();
+  }
+
+  // Subscriptions replaced by a config refresh reuse the resolved watches of
+  // the subscriptions they replace. These were kept current as directories
+  // were created, and are not resolved again.
+  std::map<std::string, INotifySubscriptionContextRef> resolved;
+  for (const auto& sc : contexts_) {
+    resolved[sc->key_] = sc;
+  }
+
+  contexts_.clear();
   for (auto& sub : subscriptions_) {
-    // Anytime a configure is called, try to monitor all subscriptions.
-    // Configure is called as a response to removing/adding subscriptions.
-    // This means recalculating all monitored paths.
     auto sc = getSubscriptionContext(sub->context);
+    contexts_.push_back(sc);
     if (sc->discovered_.size() > 0) {
       continue;
     }
-    monitorSubscription(sc);
+
+    sc->key_ = std::to_string(sc->mask) + ':' +
+               ((sc->recursive) ? '1' : '0') + ':' + sc->path;
+    parseSubscription(sc);
+
+    // Watches restored from the last run are verified by the run loop.
+    std::vector<std::string> watches;
+    bool restored = false;
+    auto reused = resolved.find(sc->key_);
+    auto stored = restored_.find(sc->key_);
+    if (reused != resolved.end()) {
+      WriteLock path_lock(path_mutex_);
+      watches = reused->second->watches_;
+      restored = reused->second->restored_;
+    } else if (stored != restored_.end()) {
+      watches = std::move(stored->second);
+      restored = true;
+    } else {
+      resolveWatches(sc, watches);
+    }
+
+    // Events for new directories may append watches concurrently.
+    WriteLock path_lock(path_mutex_);
+    sc->watches_ = std::move(watches);
+    sc->restored_ = restored;
+    if (restored) {
+      verify_ = true;
+    }
+  }
+  restored_.clear();
+
+  applyWatches();
+  persistWatches();
+
+  auto index = std::make_shared<PathPatternIndex>();
+  for (const auto& sc : contexts_) {
+    index->add(sc, sc->path, sc->matchType());
+  }
+  std::atomic_store(&index_, std::shared_ptr<const PathPatternIndex>(index));
+}
+
+void INotifyEventPublisher::applyWatches() {
+  PathMaskMap desired;
+  std::vector<std::string> removed;
+  {
+    WriteLock lock(path_mutex_);
+    for (const auto& sc : contexts_) {
+      auto mask = (sc->mask == 0) ? kFileDefaultMasks : sc->mask;
+      for (const auto& watch : sc->watches_) {
+        desired[watch] |= mask;
+      }
+    }
+
+    for (const auto& path : path_descriptors_) {
+      if (desired.count(path.first) == 0) {
+        removed.push_back(path.first);
+      }
+    }
+  }
+
+  // Remove the watches no subscription uses.
+  for (const auto& path : removed) {
+    removeMonitor(path, true);
+  }
+
+  for (const auto& watch : desired) {
+    {
+      WriteLock lock(path_mutex_);
+      auto current = path_masks_.find(watch.first);
+      if (current != path_masks_.end() && current->second == watch.second &&
+          path_descriptors_.count(watch.first) > 0) {
+        // The path is watched with the same events.
+        continue;
+      }
+    }
+    addMonitor(watch.first, watch.second, false);
+  }
+}
+
+void INotifyEventPublisher::verifyWatches() {
+  WriteLock lock(configure_mutex_);
+  for (const auto& sc : contexts_) {
+    if (!sc->restored_) {
+      continue;
+    }
+
+    std::vector<std::string> watches;
+    resolveWatches(sc, watches);
+
+    // Keep directories watched since the walk, such as newly created ones.
+    WriteLock path_lock(path_mutex_);
+    std::set<std::string> resolved(watches.begin(), watches.end());
+    for (const auto& watch : sc->watches_) {
+      if (resolved.count(watch) == 0 && path_descriptors_.count(watch) > 0) {
+        watches.push_back(watch);
+      }
+    }
+    sc->watches_ = std::move(watches);
+    sc->restored_ = false;
+  }
+
+  applyWatches();
+  persistWatches();
+}
+
+void INotifyEventPublisher::persistWatches() {
+  if (!FLAGS_inotify_watch_cache) {
+    return;
+  }
+
+  // Each subscription's key line is followed by its watched paths.
+  std::string content;
+  {
+    WriteLock lock(path_mutex_);
+    for (const auto& sc : contexts_) {
+      if (sc->key_.empty() || sc->key_.find('\n') != std::string::npos) {
+        continue;
+      }
+      content += '@' + sc->key_ + '\n';
+      for (const auto& watch : sc->watches_) {
+        if (!watch.empty() && watch[0] == '/' &&
+            watch.find('\n') == std::string::npos) {
+          content += watch + '\n';
+        }
+      }
+    }
+  }
+
+  auto hash = std::hash<std::string>()(content);
+  if (hash != persisted_hash_) {
+    persisted_hash_ = hash;
+    setDatabaseValue(kPersistentSettings, kINotifyWatchesKey, content);
+  }
+}
+
+void INotifyEventPublisher::restoreWatches() {
+  if (!FLAGS_inotify_watch_cache) {
+    return;
+  }
+
+  std::string content;
+  if (!getDatabaseValue(kPersistentSettings, kINotifyWatchesKey, content)
+           .ok()) {
+    return;
+  }
+  persisted_hash_ = std::hash<std::string>()(content);
+
+  std::vector<std::string>* watches = nullptr;
+  size_t start = 0;
+  while (start < content.size()) {
+    auto end = content.find('\n', start);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+    if (content[start] == '@') {
+      watches = &restored_[content.substr(start + 1, end - start - 1)];
+    } else if (watches != nullptr && end > start) {
+      watches->push_back(content.substr(start, end - start));
+    }
+    start = end + 1;
   }
 }
 
 void INotifyEventPublisher::tearDown() {
+  if (epoll_handle_ > -1) {
+    ::close(epoll_handle_);
+  }
+  epoll_handle_ = -1;
+
   if (inotify_handle_ > -1) {
     ::close(inotify_handle_);
   }
@@ -138,6 +479,7 @@ Status INotifyEventPublisher::restartMonitoring() {
     WriteLock lock(path_mutex_);
     path_descriptors_.clear();
     descriptor_paths_.clear();
+    path_masks_.clear();
   }
 
   // Reconfigure ourself, the subscribers will not reconfigure.
@@ -146,26 +488,45 @@ Status INotifyEventPublisher::restartMonitoring() {
 }
 
 Status INotifyEventPublisher::run() {
-  // Get a while wrapper for free.
-  char buffer[kINotifyBufferSize];
-  fd_set set;
-
-  FD_ZERO(&set);
-  FD_SET(getHandle(), &set);
+  if (verify_.exchange(false)) {
+    // Restored watches are armed, events are queued while paths are resolved.
+    verifyWatches();
+  }
 
-  struct timeval timeout = {1, 0};
-  int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
+  struct epoll_event ready;
+  int selector = ::epoll_wait(epoll_handle_, &ready, 1, kINotifyMWait);
+  if (selector == -1 && errno != EINTR) {
     LOG(WARNING) << "Could not read inotify handle";
     return Status(1, "INotify handle failed");
   }
 
-  if (selector == 0) {
+  if (selector <= 0) {
     // Read timeout.
     return Status(0, "Continue");
   }
+
+  // Read a batch, until the queue is empty or for a few buffers. A batch fires
+  // each distinct watch, mask, and name once, an editor's save often repeats
+  // the same modifications. A file written continuously fires once a batch.
+  std::set<std::tuple<int, uint32_t, std::string>> fired;
+  for (size_t i = 0; i < kINotifyBatchReads && !isEnding(); i++) {
+    auto status = readEvents(fired);
+    if (status.getCode() == 2) {
+      break;
+    } else if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status INotifyEventPublisher::readEvents(
+    std::set<std::tuple<int, uint32_t, std::string>>& fired) {
+  alignas(struct inotify_event) char buffer[kINotifyBufferSize];
   ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
-  if (record_num == 0 || record_num == -1) {
+  if (record_num == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return Status(2, "Empty");
+  } else if (record_num == 0 || record_num == -1) {
     return Status(1, "INotify read failed");
   }
 
@@ -180,6 +541,12 @@ Status INotifyEventPublisher::run() {
       }
     }
 
+    if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_MOVE_SELF |
+                       IN_DELETE_SELF)) {
+      // A removed watch descriptor may be reused for another path.
+      fired.clear();
+    }
+
     if (event->mask & IN_IGNORED) {
       // This inotify watch was removed.
       removeMonitor(event->wd, false);
@@ -190,16 +557,21 @@ Status INotifyEventPublisher::run() {
       // A file was moved to replace the watched path.
       removeMonitor(event->wd, false);
     } else {
-      auto ec = createEventContextFrom(event);
-      if (!ec->action.empty()) {
-        fire(ec);
+      std::string name((event->len > 0) ? event->name : "");
+      if (fired.emplace(event->wd, event->mask, std::move(name)).second) {
+        auto ec = createEventContextFrom(event);
+        if (!ec->action.empty()) {
+          auto index = std::atomic_load(&index_);
+          if (index != nullptr) {
+            ec->matches = index->match(ec->path);
+          }
+          fire(ec);
+        }
       }
     }
     // Continue to iterate
     p += (sizeof(struct inotify_event)) + event->len;
   }
-
-  pauseMilli(kINotifyMLatency);
   return Status(0, "OK");
 }
 
@@ -240,26 +612,28 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
     return false;
   }
 
-  if (sc->recursive && !sc->recursive_match) {
-    ssize_t found = ec->path.find(sc->path);
-    if (found != 0) {
+  if (ec->matches != nullptr && ec->matches->indexed(sc.get())) {
+    // The path was matched against the configured subscriptions once.
+    if (!ec->matches->matched(sc.get())) {
       return false;
     }
-  } else if (ec->path == sc->path) {
-    return true;
-  } else if (fnmatch((sc->path + "*").c_str(),
-                     ec->path.c_str(),
-                     FNM_PATHNAME | FNM_CASEFOLD |
-                         ((sc->recursive_match) ? FNM_LEADING_DIR : 0)) != 0) {
-    // Only apply a leading-dir match if this is a recursive watch with a
-    // match requirement (an inline wildcard with ending recursive wildcard).
+  } else if (!PathPattern(sc->path, sc->matchType()).matches(ec->path)) {
     return false;
   }
 
   // inotify will not monitor recursively, new directories need watches.
   if (sc->recursive && ec->action == "CREATED" && isDirectory(ec->path)) {
-    const_cast<INotifyEventPublisher*>(this)
-        ->addMonitor(ec->path + '/', sc->mask, true);
+    std::vector<std::string> watches = {ec->path + '/'};
+    walkDirectories(watches[0], watches, 1);
+
+    auto self = const_cast<INotifyEventPublisher*>(this);
+    for (const auto& watch : watches) {
+      self->addMonitor(watch, sc->mask, false);
+    }
+
+    // The watches are kept when the publisher is configured again.
+    WriteLock lock(path_mutex_);
+    sc->watches_.insert(sc->watches_.end(), watches.begin(), watches.end());
   }
 
   return true;
@@ -269,9 +643,18 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
                                        uint32_t mask,
                                        bool recursive,
                                        bool add_watch) {
-  if (!isPathMonitored(path)) {
-    int watch = ::inotify_add_watch(
-        getHandle(), path.c_str(), ((mask == 0) ? kFileDefaultMasks : mask));
+  auto watch_mask = (mask == 0) ? kFileDefaultMasks : mask;
+  bool update = false;
+  {
+    // A watched path with different events has its watch replaced.
+    WriteLock lock(path_mutex_);
+    auto current = path_masks_.find(path);
+    update = (current != path_masks_.end() && current->second != watch_mask &&
+              path_descriptors_.count(path) > 0);
+  }
+
+  if (update || !isPathMonitored(path)) {
+    int watch = ::inotify_add_watch(getHandle(), path.c_str(), watch_mask);
     if (add_watch && watch == -1) {
       LOG(WARNING) << "Could not add inotify watch on: " << path;
       return false;
@@ -280,23 +663,23 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
     {
       WriteLock lock(path_mutex_);
       // Keep a list of the watch descriptors
-      descriptors_.push_back(watch);
+      if (!update) {
+        descriptors_.push_back(watch);
+      }
       // Keep a map of the path -> watch descriptor
       path_descriptors_[path] = watch;
       // Keep a map of the opposite (descriptor -> path)
       descriptor_paths_[watch] = path;
+      path_masks_[path] = watch_mask;
     }
   }
 
   if (recursive && isDirectory(path).ok()) {
-    std::vector<std::string> children;
     // Get a list of children of this directory (requested recursive watches).
-    listDirectoriesInDirectory(path, children, true);
-
-    boost::system::error_code ec;
+    std::vector<std::string> children;
+    walkDirectories(path, children, FLAGS_inotify_watch_threads);
     for (const auto& child : children) {
-      auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, mask, false);
+      addMonitor(child, mask, false);
     }
   }
 
@@ -318,6 +701,7 @@ bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
     watch = path_descriptors_[path];
     path_descriptors_.erase(path);
     descriptor_paths_.erase(watch);
+    path_masks_.erase(path);
 
     auto position = std::find(descriptors_.begin(), descriptors_.end(), watch);
     descriptors_.erase(position);
@@ -342,10 +726,8 @@ bool INotifyEventPublisher::removeMonitor(int watch, bool force) {
 }
 
 void INotifyEventPublisher::removeSubscriptions(const std::string& subscriber) {
-  auto paths = descriptor_paths_;
-  for (const auto& path : paths) {
-    removeMonitor(path.first, true);
-  }
+  // Watches are removed when the publisher is configured, if no subscription
+  // added by then uses them.
   EventPublisherPlugin::removeSubscriptions(subscriber);
 }
 
@@ -11,6 +11,8 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <tuple>
 #include <vector>
 
 #include <sys/inotify.h>
@@ -18,6 +20,8 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/path_index.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -64,6 +68,17 @@ struct INotifySubscriptionContext : public SubscriptionContext {
     }
   }
 
+  /// How event paths are matched with the configured path.
+  PathMatchType matchType() const {
+    if (recursive && !recursive_match) {
+      return PathMatchType::PREFIX;
+    }
+    // Only apply a leading-dir match if this is a recursive watch with a
+    // match requirement (an inline wildcard with ending recursive wildcard).
+    return (recursive_match) ? PathMatchType::GLOB_LEADING_DIR
+                             : PathMatchType::GLOB;
+  }
+
  private:
   /// During configure the INotify publisher may modify/optimize the paths.
   std::string discovered_;
@@ -71,8 +86,19 @@ struct INotifySubscriptionContext : public SubscriptionContext {
   /// A configure-time pattern was expanded to match absolute paths.
   bool recursive_match{false};
 
+  /// The configured path, mask, and recursion, identifying resolved watches.
+  std::string key_;
+
+  /// The paths watched for this subscription, including recursed directories.
+  std::vector<std::string> watches_;
+
+  /// The watches were restored from the last run and are not yet verified.
+  bool restored_{false};
+
  private:
   friend class INotifyEventPublisher;
+  friend class FAnotifyEventPublisher;
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
 };
 
 /**
@@ -90,6 +116,9 @@ struct INotifyEventContext : public EventContext {
 
   /// A no-op event transaction id.
   uint32_t transaction_id{0};
+
+  /// The configured subscriptions matching the path, if known.
+  PathPatternIndex::MatchesRef matches;
 };
 
 using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
@@ -100,6 +129,7 @@ using INotifySubscriptionContextRef =
 using DescriptorVector = std::vector<int>;
 using PathDescriptorMap = std::map<std::string, int>;
 using DescriptorPathMap = std::map<int, std::string>;
+using PathMaskMap = std::map<std::string, uint32_t>;
 
 /**
  * @brief A Linux `inotify` EventPublisher.
@@ -131,7 +161,7 @@ class INotifyEventPublisher
   /// Release the `inotify` handle descriptor.
   void tearDown() override;
 
-  /// The calling for beginning the thread's run loop.
+  /// Wait for events, then read and fire events until the queue is empty.
   Status run() override;
 
   /// Remove all monitors and subscriptions.
@@ -142,6 +172,15 @@ class INotifyEventPublisher
   INotifyEventContextRef createEventContextFrom(
       struct inotify_event* event) const;
 
+  /**
+   * @brief Read and fire one buffer of events from the handle.
+   *
+   * @param fired the watch, mask, and name of events fired in this batch, an
+   * event already fired is skipped, cleared when a watch is removed
+   * @return Return code (2) if the handle had no events
+   */
+  Status readEvents(std::set<std::tuple<int, uint32_t, std::string>>& fired);
+
   /// Check if the application-global `inotify` handle is alive.
   bool isHandleOpen() const {
     return inotify_handle_ > 0;
@@ -174,6 +213,31 @@ class INotifyEventPublisher
   bool monitorSubscription(INotifySubscriptionContextRef& sc,
                            bool add_watch = true);
 
+  /// Optimize a subscription's path into the path that is watched, once.
+  void parseSubscription(INotifySubscriptionContextRef& sc);
+
+  /// Expand a parsed subscription's globs and recursion into watched paths.
+  void resolveWatches(const INotifySubscriptionContextRef& sc,
+                      std::vector<std::string>& watches) const;
+
+  /**
+   * @brief Watch the paths of the configured subscriptions.
+   *
+   * The paths are diffed against the existing watches. Watches no
+   * subscription uses are removed and only new or changed watches are added,
+   * events on unchanged paths are never missed while reconfiguring.
+   */
+  void applyWatches();
+
+  /// Resolve the subscriptions whose watches were restored from the last run.
+  void verifyWatches();
+
+  /// Store the resolved watches, see --inotify_watch_cache.
+  void persistWatches();
+
+  /// Read the watches stored by the last run.
+  void restoreWatches();
+
   /// Remove an INotify watch (monitor) from our tracking.
   bool removeMonitor(const std::string& path, bool force = false);
   bool removeMonitor(int watch, bool force = false);
@@ -207,12 +271,39 @@ class INotifyEventPublisher
   /// The inotify file descriptor handle.
   std::atomic<int> inotify_handle_{-1};
 
+  /// The epoll descriptor waiting on the inotify handle.
+  int epoll_handle_{-1};
+
   /// Time in seconds of the last inotify restart.
   std::atomic<int> last_restart_{-1};
 
   /// Access to path and descriptor mappings.
   mutable Mutex path_mutex_;
 
+  /// The subscription path index, replaced when configured.
+  std::shared_ptr<const PathPatternIndex> index_;
+
+  /// Map of watched path string to the inotify mask of its watch.
+  PathMaskMap path_masks_;
+
+  /// The configured subscriptions, whose watches are applied.
+  std::vector<INotifySubscriptionContextRef> contexts_;
+
+  /// Watches of the last run by subscription key, used by the first configure.
+  std::map<std::string, std::vector<std::string>> restored_;
+
+  /// The stored watches were read.
+  bool restored_loaded_{false};
+
+  /// A hash of the stored watches, unchanged watches are not stored again.
+  size_t persisted_hash_{0};
+
+  /// The run loop should resolve the subscriptions with restored watches.
+  std::atomic<bool> verify_{false};
+
+  /// Serialize configuring and verifying watches.
+  Mutex configure_mutex_;
+
  public:
   friend class INotifyTests;
   FRIEND_TEST(INotifyTests, test_inotify_init);
@@ -220,5 +311,6 @@ class INotifyEventPublisher
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_match_subscription);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
 };
 }
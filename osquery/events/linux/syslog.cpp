@@ -16,7 +16,7 @@
 #include <time.h>
 #include <unistd.h>
 
-#include <istream>
+#include <cstring>
 #include <string>
 
 #include <boost/algorithm/string/trim.hpp>
@@ -57,6 +57,12 @@ const std::vector<std::string> kCsvFields = {
     "time", "host", "severity", "facility", "tag", "message"};
 const size_t kErrorThreshold = 10;
 
+/// Bytes requested from the pipe by each read.
+const size_t kSyslogReadSize = 64 * 1024;
+
+/// Longest line buffered while waiting for its newline.
+const size_t kSyslogMaxLine = 1024 * 1024;
+
 Status SyslogEventPublisher::setUp() {
   if (!FLAGS_enable_syslog) {
     return Status(1, "Publisher disabled via configuration");
@@ -85,12 +91,10 @@ Status SyslogEventPublisher::setUp() {
   }
 
   // Opening with both flags appears to be the only way to open the pipe
-  // without blocking for a writer. We won't ever write to the pipe, but we
-  // don't want to block here and will instead block waiting for a read in the
-  // run() method
-  readStream_.open(FLAGS_syslog_pipe_path,
-                   std::ifstream::in | std::ifstream::out);
-  if (!readStream_.good()) {
+  // without blocking for a writer. We won't ever write to the pipe. Reads are
+  // non-blocking, the run() method returns when the pipe is empty.
+  readFd_ = open(FLAGS_syslog_pipe_path.c_str(), O_RDWR | O_NONBLOCK);
+  if (readFd_ == -1) {
     return Status(1,
                   "Error opening pipe for reading: " + FLAGS_syslog_pipe_path);
   }
@@ -148,20 +152,47 @@ void SyslogEventPublisher::unlockPipe() {
   }
 }
 
+bool SyslogEventPublisher::readPipe() {
+  // Drop the parsed lines before appending.
+  readBuffer_.erase(0, readOffset_);
+  readOffset_ = 0;
+  if (readBuffer_.size() >= kSyslogMaxLine) {
+    LOG(WARNING) << "Dropping syslog line longer than " << kSyslogMaxLine
+                 << " bytes";
+    readBuffer_.clear();
+  }
+
+  auto size = readBuffer_.size();
+  readBuffer_.resize(size + kSyslogReadSize);
+  auto bytes = read(readFd_, &readBuffer_[size], kSyslogReadSize);
+  readBuffer_.resize(size + ((bytes > 0) ? bytes : 0));
+  return bytes > 0;
+}
+
 Status SyslogEventPublisher::run() {
   // This run function will be called by the event factory with ~100ms pause
   // (see InterruptableRunnable::pause()) between runs. In case something goes
   // weird and there is a huge amount of input, we limit how many logs we
   // take in per run to avoid pegging the CPU.
-  for (size_t i = 0; i < FLAGS_syslog_rate_limit; ++i) {
-    if (readStream_.rdbuf()->in_avail() == 0) {
-      // If there is no pending data, we have flushed everything and can wait
-      // until the next time EventFactory calls run(). This also allows the
-      // thread to join when it is stopped by EventFactory.
-      return Status(0, "OK");
+  for (size_t i = 0; i < FLAGS_syslog_rate_limit;) {
+    auto start = readBuffer_.data() + readOffset_;
+    auto end = static_cast<const char*>(
+        memchr(start, '\n', readBuffer_.size() - readOffset_));
+    if (end == nullptr) {
+      if (!readPipe()) {
+        // If there is no pending data, we have flushed everything and can
+        // wait until the next time EventFactory calls run(). This also allows
+        // the thread to join when it is stopped by EventFactory.
+        return Status(0, "OK");
+      }
+      continue;
     }
-    std::string line;
-    std::getline(readStream_, line);
+
+    // Parse the line in place, then move past it and its newline.
+    boost::string_ref line(start, end - start);
+    readOffset_ += line.size() + 1;
+    ++i;
+
     auto ec = createEventContext();
     Status status = populateEventContext(line, ec);
     if (status.ok()) {
@@ -182,11 +213,16 @@ Status SyslogEventPublisher::run() {
 
 void SyslogEventPublisher::tearDown() {
   unlockPipe();
+  if (readFd_ != -1) {
+    close(readFd_);
+    readFd_ = -1;
+  }
 }
 
-Status SyslogEventPublisher::populateEventContext(const std::string& line,
+Status SyslogEventPublisher::populateEventContext(boost::string_ref line,
                                                   SyslogEventContextRef& ec) {
-  boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
+  boost::tokenizer<RsyslogCsvSeparator, boost::string_ref::const_iterator>
+      tokenizer(line.begin(), line.end());
   auto key = kCsvFields.begin();
   for (std::string value : tokenizer) {
     if (key == kCsvFields.end()) {
@@ -195,12 +231,13 @@ Status SyslogEventPublisher::populateEventContext(const std::string& line,
 
     boost::trim(value);
     if (*key == "time") {
-      ec->fields["datetime"] = value;
+      ec->fields["datetime"] = std::move(value);
     } else if (*key == "tag" && !value.empty() && value.back() == ':') {
       // rsyslog sends "tag" with a trailing colon that we don't need
-      ec->fields.emplace(*key, value.substr(0, value.size() - 1));
+      value.pop_back();
+      ec->fields.emplace(*key, std::move(value));
     } else {
-      ec->fields.emplace(*key, value);
+      ec->fields.emplace(*key, std::move(value));
     }
     ++key;
   }
@@ -12,10 +12,10 @@
 
 #include <stdio.h>
 
-#include <fstream>
 #include <map>
 
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/events.h>
 
@@ -72,6 +72,10 @@ class SyslogEventPublisher
  public:
   SyslogEventPublisher() : EventPublisher(), errorCount_(0), lockFd_(-1) {}
 
+  virtual ~SyslogEventPublisher() {
+    tearDown();
+  }
+
  private:
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const SyslogSubscriptionContextRef& mc,
@@ -111,13 +115,28 @@ class SyslogEventPublisher
    * Performs basic cleanup on the JSON data as it is populated into the
    * context.
    */
-  static Status populateEventContext(const std::string& line,
+  static Status populateEventContext(boost::string_ref line,
                                      SyslogEventContextRef& ec);
 
   /**
-   * @brief Input stream for reading from the pipe.
+   * @brief Append the data available in the pipe to the read buffer.
+   *
+   * @return false if there was no data to read.
+   */
+  bool readPipe();
+
+  /// Descriptor for reading from the pipe, in non-blocking mode.
+  int readFd_{-1};
+
+  /**
+   * @brief Data read from the pipe and not yet parsed.
+   *
+   * The pipe is read in large chunks, lines are parsed in place starting at
+   * readOffset_. A line that has not been completely written stays in the
+   * buffer until the rest of it is read.
    */
-  std::fstream readStream_;
+  std::string readBuffer_;
+  size_t readOffset_{0};
 
   /**
    * @brief Counter used to shut down thread when too many errors occur.
@@ -133,7 +152,7 @@ class SyslogEventPublisher
    * @brief File descriptor used to lock the pipe for reading.
    *
    * This fd should not be used for reading from the pipe, instead use
-   * readStream_.
+   * readFd_.
    */
   int lockFd_;
 
@@ -10,6 +10,10 @@
 
 #include <stdio.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/events.h>
@@ -113,7 +117,7 @@ TEST_F(AuditTests, test_audit_assembler) {
 
   // Again empty.
   EXPECT_TRUE(asmb.m_[100].empty());
-  EXPECT_EQ(1U, asmb.mt_[100].size());
+  EXPECT_EQ(1U, asmb.mt_[100].types);
 
   asmb.add(100U, 2, expected_fields);
   asmb.add(100U, 3, expected_fields);
@@ -140,6 +144,15 @@ TEST_F(AuditTests, test_audit_assembler) {
   EXPECT_EQ(0U, asmb.mt_.size());
   EXPECT_EQ(0U, asmb.m_.size());
 
+  // The oldest audit ID is evicted, a new message moves an ID to the back.
+  asmb.add(1, 1, {});
+  asmb.add(2, 1, {});
+  asmb.add(3, 1, {});
+  asmb.add(1, 2, {});
+  asmb.add(4, 1, {});
+  EXPECT_EQ(0U, asmb.mt_.count(2));
+  EXPECT_EQ(std::list<Auid>({3, 1, 4}), asmb.queue_);
+
   asmb.start(3U, {1, 2, 3}, &SimpleUpdate);
   EXPECT_FALSE(asmb.add(1, 1, expected_fields).is_initialized());
   EXPECT_EQ(1U, kAuditCounter);
@@ -154,6 +167,133 @@ TEST_F(AuditTests, test_audit_assembler) {
   EXPECT_EQ(*fields, expected_fields);
 }
 
+TEST_F(AuditTests, test_sharded_audit_assembler) {
+  ShardedAuditAssembler asmb;
+  asmb.start(3, {1, 2}, nullptr);
+
+  // Each shard assembles its audit IDs independently.
+  auto shards = getAuditShards();
+  ASSERT_GE(shards, 1U);
+  EXPECT_EQ(&asmb.shard(0), &asmb.shard(shards));
+  EXPECT_FALSE(asmb.shard(0).add(100, 1, {}).is_initialized());
+  if (shards > 1) {
+    EXPECT_FALSE(asmb.shard(1).add(100, 2, {}).is_initialized());
+  }
+  EXPECT_TRUE(asmb.shard(0).add(100, 2, {}).is_initialized());
+}
+
+TEST_F(AuditTests, test_shard_routing) {
+  struct Fired {
+    size_t auid;
+    size_t shard;
+    size_t time;
+    std::thread::id thread;
+  };
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<Fired> fired;
+  AuditEventPublisher pub;
+  pub.startShards(4, [&](const AuditEventContextRef& ec) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fired.push_back({ec->auid, ec->shard, ec->time, std::this_thread::get_id()});
+    condition.notify_all();
+  });
+  ASSERT_EQ(pub.shards_.size(), 4U);
+
+  // Each audit ID has several records, fired in order.
+  for (size_t time = 1; time <= 3; time++) {
+    for (size_t auid = 100; auid < 108; auid++) {
+      auto ec = std::make_shared<AuditEventContext>();
+      ec->auid = auid;
+      ec->time = time;
+      pub.fireShard(ec);
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait_for(
+        lock, std::chrono::seconds(5), [&]() { return fired.size() == 24; });
+  }
+  pub.tearDown();
+  ASSERT_EQ(fired.size(), 24U);
+
+  std::map<size_t, std::pair<size_t, std::thread::id>> last;
+  for (const auto& f : fired) {
+    EXPECT_EQ(f.shard, f.auid % 4);
+    auto it = last.find(f.auid);
+    if (it != last.end()) {
+      EXPECT_EQ(it->second.first + 1, f.time);
+      EXPECT_EQ(it->second.second, f.thread);
+    }
+    last[f.auid] = std::make_pair(f.time, f.thread);
+  }
+  EXPECT_EQ(last.size(), 8U);
+}
+
+TEST_F(AuditTests, test_shard_teardown) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t fired = 0;
+  bool release = false;
+  AuditEventPublisher pub;
+  pub.startShards(2, [&](const AuditEventContextRef& /* ec */) {
+    std::unique_lock<std::mutex> lock(mutex);
+    fired++;
+    condition.notify_all();
+    condition.wait(lock, [&]() { return release; });
+  });
+
+  // The audit IDs are fired by the first shard, which waits in the first.
+  for (size_t auid = 0; auid < 6; auid += 2) {
+    auto ec = std::make_shared<AuditEventContext>();
+    ec->auid = auid;
+    pub.fireShard(ec);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(condition.wait_for(
+        lock, std::chrono::seconds(5), [&]() { return fired == 1; }));
+  }
+
+  // A stopped shard does not queue messages, the reader does not wait.
+  pub.stop();
+  auto ec = std::make_shared<AuditEventContext>();
+  pub.fireShard(ec);
+
+  // Tearing down waits for the message being fired, the rest are dropped.
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+    condition.notify_all();
+  }
+  pub.tearDown();
+  EXPECT_TRUE(pub.shards_.empty());
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(fired, 1U);
+}
+
+TEST_F(AuditTests, test_audit_rule_filter) {
+  struct AuditRuleInternal rule;
+  memset(&rule.rule, 0, sizeof(struct audit_rule_data));
+
+  auto status =
+      addAuditRuleFilter(&rule.rule, "auid>=1000 success=1", AUDIT_FILTER_EXIT);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(2U, rule.rule.field_count);
+
+  // String fields need rule buffer space and are not supported.
+  memset(&rule.rule, 0, sizeof(struct audit_rule_data));
+  status = addAuditRuleFilter(&rule.rule, "exe=/bin/sh", AUDIT_FILTER_EXIT);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(0U, rule.rule.field_count);
+
+  status = addAuditRuleFilter(&rule.rule, "=1", AUDIT_FILTER_EXIT);
+  EXPECT_FALSE(status.ok());
+}
+
 TEST_F(AuditTests, test_parse_sock_addr) {
   Row r;
   std::string msg = "02001F907F0000010000000000000000";
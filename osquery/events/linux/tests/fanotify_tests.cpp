@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+class FAnotifyTests : public testing::Test {};
+
+TEST_F(FAnotifyTests, test_fanotify_match_subscription) {
+  FAnotifyEventPublisher pub;
+
+  auto ec = FAnotifyEventPublisher::createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->event->mask = IN_MODIFY;
+  ec->action = "UPDATED";
+
+  // A directory subscription matches the files within the directory.
+  auto sc = FAnotifyEventPublisher::createSubscriptionContext();
+  sc->path = "/etc/";
+  ec->path = "/etc/passwd";
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+  ec->path = "/etc/ssh/sshd_config";
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+
+  // A recursive subscription matches the whole tree below the path.
+  sc->recursive = true;
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+  ec->path = "/var/log/messages";
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+
+  // Leaf globs are matched in user space.
+  sc = FAnotifyEventPublisher::createSubscriptionContext();
+  sc->path = "/var/log/*.log";
+  ec->path = "/var/log/auth.log";
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+  ec->path = "/var/log/messages";
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+
+  // The subscription's inotify action mask applies to fanotify events.
+  ec->path = "/var/log/auth.log";
+  sc->mask = IN_OPEN;
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+}
+}
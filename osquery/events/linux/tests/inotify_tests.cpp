@@ -102,7 +102,13 @@ class INotifyTests : public testing::Test {
   }
 
   void RemoveAll(std::shared_ptr<INotifyEventPublisher>& pub) {
-    pub->subscriptions_.clear();
+    std::set<std::string> subscribers;
+    for (const auto& sub : pub->subscriptions_) {
+      subscribers.insert(sub->subscriber_name);
+    }
+    for (const auto& subscriber : subscribers) {
+      pub->removeSubscriptions(subscriber);
+    }
     // Reset monitors.
     std::vector<std::string> monitors;
     for (const auto& path : pub->path_descriptors_) {
@@ -303,6 +309,7 @@ class TestINotifyEventSubscriber
   FRIEND_TEST(INotifyTests, test_inotify_directory_watch);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
 };
 
 TEST_F(INotifyTests, test_inotify_run) {
@@ -501,4 +508,59 @@ TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   ASSERT_EQ(event_pub_->numDescriptors(), 1U);
   EXPECT_EQ(event_pub_->path_descriptors_.count(real_test_dir + "/2/1/"), 1U);
 }
+
+TEST_F(INotifyTests, test_inotify_incremental_configure) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+
+  // Create ./inotify-triggers/2/1/ and watch it recursively.
+  fs::create_directories(real_test_sub_dir_path);
+  auto sc = sub->createSubscriptionContext();
+  sc->path = real_test_dir + "/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc);
+  pub->configure();
+  ASSERT_EQ(pub->numDescriptors(), 3U);
+  auto descriptors = pub->path_descriptors_;
+
+  // A refreshed config with the same paths keeps every watch, without
+  // walking the directories again.
+  pub->removeSubscriptions(sub->getName());
+  auto sc2 = sub->createSubscriptionContext();
+  sc2->path = real_test_dir + "/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc2);
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_, descriptors);
+  EXPECT_FALSE(pub->verify_);
+  auto key = sc2->key_;
+  EventFactory::deregisterEventPublisher("inotify");
+
+  // Watches restored from the last run are verified, a new directory is
+  // found.
+  pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  pub->restored_loaded_ = true;
+  pub->restored_[key] = {real_test_dir + "/"};
+  auto restored = sub->createSubscriptionContext();
+  restored->path = real_test_dir + "/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, restored);
+  pub->configure();
+  EXPECT_EQ(pub->numDescriptors(), 1U);
+  EXPECT_TRUE(pub->verify_);
+
+  fs::create_directories(real_test_dir_path);
+  pub->verifyWatches();
+  EXPECT_EQ(pub->numDescriptors(), 4U);
+  EXPECT_FALSE(restored->restored_);
+
+  // Watches no subscription uses are removed.
+  pub->removeSubscriptions(sub->getName());
+  auto sc3 = sub->createSubscriptionContext();
+  sc3->path = real_test_sub_dir;
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc3);
+  pub->configure();
+  EXPECT_EQ(pub->numDescriptors(), 1U);
+  EXPECT_EQ(pub->path_descriptors_.count(real_test_sub_dir + "/"), 1U);
+  EventFactory::deregisterEventPublisher("inotify");
+}
 }
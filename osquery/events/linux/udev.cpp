@@ -152,6 +152,11 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     ec->driver = std::string(value);
   }
 
+  value = udev_device_get_syspath(device);
+  if (value != nullptr) {
+    ec->syspath = std::string(value);
+  }
+
   return ec;
 }
 
@@ -65,6 +65,9 @@ struct UdevEventContext : public EventContext {
   std::string devnode;
   std::string devtype;
   std::string driver;
+
+  /// The device's sysfs path, which outlives the device pointer.
+  std::string syspath;
 };
 
 using UdevEventContextRef = std::shared_ptr<UdevEventContext>;
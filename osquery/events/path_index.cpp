@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cctype>
+
+#include "osquery/events/path_index.h"
+
+namespace osquery {
+
+static inline char foldCase(char c) {
+  return static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+}
+
+PathPattern::PathPattern(const std::string& pattern, PathMatchType type)
+    : pattern_(pattern), type_(type) {
+  if (type_ == PathMatchType::PREFIX) {
+    prefix_ = pattern_;
+    return;
+  }
+
+  bool literal_prefix = true;
+  for (size_t i = 0; i < pattern_.size(); i++) {
+    Token token;
+    auto c = pattern_[i];
+    if (c == '\\' && i + 1 < pattern_.size()) {
+      token.type = TokenType::LITERAL;
+      token.literal = foldCase(pattern_[++i]);
+    } else if (c == '*') {
+      if (!tokens_.empty() && tokens_.back().type == TokenType::ANY) {
+        continue;
+      }
+      token.type = TokenType::ANY;
+    } else if (c == '?') {
+      token.type = TokenType::ANY_ONE;
+    } else if (c == '[' && parseSet(i, token)) {
+      token.type = TokenType::SET;
+    } else {
+      token.type = TokenType::LITERAL;
+      token.literal = foldCase(c);
+    }
+
+    if (token.type != TokenType::LITERAL) {
+      literal_prefix = false;
+    } else if (literal_prefix) {
+      prefix_ += token.literal;
+    }
+    tokens_.push_back(std::move(token));
+  }
+
+  // Globs match any ending of their last path component.
+  if (tokens_.empty() || tokens_.back().type != TokenType::ANY) {
+    Token token;
+    token.type = TokenType::ANY;
+    tokens_.push_back(std::move(token));
+  }
+}
+
+bool PathPattern::parseSet(size_t& i, Token& token) const {
+  // A ']' directly after the '[' or '!' is literal, a '\\' escapes.
+  size_t j = i + 1;
+  bool negate =
+      (j < pattern_.size() && (pattern_[j] == '!' || pattern_[j] == '^'));
+  if (negate) {
+    j++;
+  }
+
+  std::vector<unsigned char> chars;
+  std::vector<bool> escaped;
+  for (size_t k = j; k < pattern_.size(); k++) {
+    if (pattern_[k] == ']' && k > j) {
+      // The set holds case-folded characters, ranges use folded bounds.
+      for (size_t n = 0; n < chars.size(); n++) {
+        auto first = static_cast<unsigned char>(foldCase(chars[n]));
+        auto last = first;
+        if (n + 2 < chars.size() && chars[n + 1] == '-' && !escaped[n + 1]) {
+          last = static_cast<unsigned char>(foldCase(chars[n + 2]));
+          n += 2;
+        }
+        for (size_t ch = first; ch <= last; ch++) {
+          token.set.set(ch);
+        }
+      }
+      if (negate) {
+        token.set.flip();
+      }
+      // Bracket expressions never match a path separator.
+      token.set.reset('/');
+      i = k;
+      return true;
+    }
+
+    bool escape = (pattern_[k] == '\\' && k + 1 < pattern_.size());
+    if (escape) {
+      k++;
+    }
+    chars.push_back(static_cast<unsigned char>(pattern_[k]));
+    escaped.push_back(escape);
+  }
+
+  // Without a closing ']' the '[' is literal.
+  return false;
+}
+
+bool PathPattern::matchToken(const Token& token, char c) {
+  switch (token.type) {
+  case TokenType::LITERAL:
+    return foldCase(c) == token.literal;
+  case TokenType::ANY_ONE:
+    return c != '/';
+  case TokenType::SET:
+    return token.set.test(static_cast<unsigned char>(foldCase(c)));
+  default:
+    return false;
+  }
+}
+
+bool PathPattern::matches(const std::string& path) const {
+  if (type_ == PathMatchType::PREFIX) {
+    return path.compare(0, pattern_.size(), pattern_) == 0;
+  }
+
+  if (path == pattern_) {
+    return true;
+  }
+
+  bool leading_dir = (type_ == PathMatchType::GLOB_LEADING_DIR);
+  size_t p = 0;
+  size_t s = 0;
+  size_t star = std::string::npos;
+  size_t star_s = 0;
+  while (true) {
+    if (p < tokens_.size() && tokens_[p].type == TokenType::ANY) {
+      star = p++;
+      star_s = s;
+      continue;
+    }
+
+    if (s == path.size()) {
+      // Extending a wildcard cannot match the remaining tokens.
+      return p == tokens_.size();
+    }
+
+    if (p == tokens_.size()) {
+      if (leading_dir && path[s] == '/') {
+        return true;
+      }
+    } else if (matchToken(tokens_[p], path[s])) {
+      p++;
+      s++;
+      continue;
+    }
+
+    // A wildcard cannot extend over a path separator. The separators before
+    // it were matched literally, so earlier wildcards cannot help either.
+    if (star == std::string::npos || path[star_s] == '/') {
+      return false;
+    }
+    s = ++star_s;
+    p = star + 1;
+  }
+}
+
+void PathPatternIndex::add(const SubscriptionContextRef& sc,
+                           const std::string& path,
+                           PathMatchType type) {
+  Entry entry{sc, PathPattern(path, type)};
+  auto& trie = (type == PathMatchType::PREFIX) ? exact_ : folded_;
+
+  size_t node = 0;
+  for (const auto& c : entry.pattern.prefix()) {
+    auto child = trie[node].children.find(c);
+    if (child != trie[node].children.end()) {
+      node = child->second;
+      continue;
+    }
+    trie.emplace_back();
+    trie[node].children[c] = trie.size() - 1;
+    node = trie.size() - 1;
+  }
+  trie[node].entries.push_back(std::move(entry));
+  indexed_.insert(sc.get());
+}
+
+template <typename Predicate>
+void PathPatternIndex::walk(const std::vector<Node>& trie,
+                            const std::string& path,
+                            bool fold,
+                            Predicate predicate) {
+  size_t node = 0;
+  for (size_t i = 0;; i++) {
+    for (const auto& entry : trie[node].entries) {
+      predicate(entry);
+    }
+    if (i == path.size()) {
+      return;
+    }
+
+    auto c = (fold) ? foldCase(path[i]) : path[i];
+    auto child = trie[node].children.find(c);
+    if (child == trie[node].children.end()) {
+      return;
+    }
+    node = child->second;
+  }
+}
+
+PathPatternIndex::MatchesRef PathPatternIndex::match(
+    const std::string& path) const {
+  auto matches = std::make_shared<Matches>();
+  matches->index_ = shared_from_this();
+
+  walk(exact_, path, false, [&matches](const Entry& entry) {
+    matches->subscriptions_.insert(entry.sc.get());
+  });
+
+  walk(folded_, path, true, [&matches, &path](const Entry& entry) {
+    if (entry.pattern.matches(path)) {
+      matches->subscriptions_.insert(entry.sc.get());
+    }
+  });
+  return matches;
+}
+}
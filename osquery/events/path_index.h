@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <bitset>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// How a filesystem subscription's path is matched against event paths.
+enum class PathMatchType {
+  /// The event path starts with the subscription path, case-sensitive.
+  PREFIX = 0,
+
+  /// The subscription path is a glob followed by an implicit '*'.
+  GLOB,
+
+  /// A glob that also matches any path within a matched directory.
+  GLOB_LEADING_DIR,
+};
+
+/**
+ * @brief A compiled filesystem glob pattern.
+ *
+ * Patterns are the configuration's file paths after their '%' wildcards are
+ * replaced with '*'. A glob is matched like fnmatch with FNM_PATHNAME and
+ * FNM_CASEFOLD (and FNM_LEADING_DIR) after an implicit trailing '*' is
+ * appended: '*' and '?' do not match '/', and bracket expressions and
+ * backslash escapes are supported. A path equal to the pattern matches.
+ */
+class PathPattern {
+ public:
+  PathPattern(const std::string& pattern, PathMatchType type);
+
+  /// Check if a path matches the pattern.
+  bool matches(const std::string& path) const;
+
+  /// The characters before the first wildcard, case-folded for globs.
+  const std::string& prefix() const {
+    return prefix_;
+  }
+
+  PathMatchType type() const {
+    return type_;
+  }
+
+ private:
+  enum class TokenType {
+    LITERAL = 0,
+    ANY_ONE,
+    ANY,
+    SET,
+  };
+
+  struct Token {
+    TokenType type;
+    char literal{0};
+    std::bitset<256> set;
+  };
+
+  /// Parse a bracket expression starting at i, moving i to its closing ']'.
+  bool parseSet(size_t& i, Token& token) const;
+
+  /// Match a single non-star token against a character.
+  static bool matchToken(const Token& token, char c);
+
+ private:
+  std::string pattern_;
+  std::string prefix_;
+  PathMatchType type_;
+  std::vector<Token> tokens_;
+};
+
+/**
+ * @brief An index of filesystem event subscriptions by path pattern.
+ *
+ * Filesystem event publishers build an index of their subscriptions when they
+ * are configured, then match each event path once, instead of comparing the
+ * path with every subscription's pattern. Subscriptions are stored in prefix
+ * tries by the pattern's characters before its first wildcard. Walking an
+ * event path through the tries finds the candidate subscriptions in O(path
+ * length). Prefix subscriptions match outright, and glob candidates are then
+ * checked with their compiled pattern.
+ */
+class PathPatternIndex
+    : public std::enable_shared_from_this<PathPatternIndex> {
+ public:
+  /**
+   * @brief The subscriptions an event path matched.
+   *
+   * A publisher attaches the result to its event context and its shouldFire
+   * checks the result for indexed subscriptions.
+   */
+  class Matches {
+   public:
+    /// Check if the subscription was indexed when the path was matched.
+    bool indexed(const SubscriptionContext* sc) const {
+      return index_->contains(sc);
+    }
+
+    /// Check if the indexed subscription matched the path.
+    bool matched(const SubscriptionContext* sc) const {
+      return subscriptions_.count(sc) > 0;
+    }
+
+    size_t size() const {
+      return subscriptions_.size();
+    }
+
+   private:
+    std::shared_ptr<const PathPatternIndex> index_;
+    std::set<const SubscriptionContext*> subscriptions_;
+
+   private:
+    friend class PathPatternIndex;
+  };
+
+  using MatchesRef = std::shared_ptr<const Matches>;
+
+  /// Index a subscription by its path.
+  void add(const SubscriptionContextRef& sc,
+           const std::string& path,
+           PathMatchType type);
+
+  /// Match a path against the indexed subscriptions.
+  MatchesRef match(const std::string& path) const;
+
+  /// Check if a subscription was indexed.
+  bool contains(const SubscriptionContext* sc) const {
+    return indexed_.count(sc) > 0;
+  }
+
+  size_t size() const {
+    return indexed_.size();
+  }
+
+ private:
+  struct Entry {
+    SubscriptionContextRef sc;
+    PathPattern pattern;
+  };
+
+  struct Node {
+    std::map<char, size_t> children;
+    std::vector<Entry> entries;
+  };
+
+  /// Walk a path through a trie, calling the predicate for each entry passed.
+  template <typename Predicate>
+  static void walk(const std::vector<Node>& trie,
+                   const std::string& path,
+                   bool fold,
+                   Predicate predicate);
+
+ private:
+  /// Prefix subscriptions, matched exactly.
+  std::vector<Node> exact_{1};
+
+  /// Glob subscriptions, indexed by a case-folded literal prefix.
+  std::vector<Node> folded_{1};
+
+  /// The indexed subscriptions, the trie entries hold their references.
+  std::set<const SubscriptionContext*> indexed_;
+};
+
+using PathPatternIndexRef = std::shared_ptr<PathPatternIndex>;
+}
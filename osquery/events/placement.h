@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <set>
+#include <string>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The scheduling policy applied to an event publisher thread.
+enum class EventThreadPolicy {
+  DEFAULT = 0,
+  BATCH,
+  IDLE,
+};
+
+/**
+ * @brief The CPU placement and scheduling of an event publisher thread.
+ *
+ * Placement is configured per publisher type with --events_thread_affinity
+ * and --events_thread_policy and is applied by the publisher's thread before
+ * its run loop starts.
+ */
+struct EventThreadPlacement {
+  /// The CPUs the thread may run on, empty leaves the affinity unchanged.
+  std::set<int> cpus;
+
+  /// The scheduling policy.
+  EventThreadPolicy policy{EventThreadPolicy::DEFAULT};
+
+  /// The nice level of the thread, 0 leaves the priority unchanged.
+  int nice{0};
+
+  /// Describe the placement, as reported by the osquery_events table.
+  std::string toString() const;
+};
+
+/**
+ * @brief Find the placement configured for a publisher type.
+ *
+ * @param type the event publisher type
+ * @param affinity a comma-separated list of type:cpus, where cpus is a
+ * list of CPUs or ranges separated by '+', for example "audit:2,inotify:0-1+4"
+ * @param policy a comma-separated list of type:policy, where policy is
+ * "batch", "idle", or a nice level, for example "syslog:batch,inotify:10"
+ * @param placement the output placement for the type
+ * @return Failure if either list has an invalid entry for the type.
+ */
+Status getEventThreadPlacement(const std::string& type,
+                               const std::string& affinity,
+                               const std::string& policy,
+                               EventThreadPlacement& placement);
+
+/// Apply a placement to the calling thread.
+Status applyEventThreadPlacement(const EventThreadPlacement& placement);
+}
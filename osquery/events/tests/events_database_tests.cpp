@@ -27,7 +27,12 @@ namespace osquery {
 
 DECLARE_uint64(events_expiry);
 DECLARE_uint64(events_max);
+DECLARE_uint64(events_memory_max);
 DECLARE_bool(events_optimize);
+DECLARE_bool(events_expire_consumed);
+DECLARE_uint64(events_expire_grace);
+DECLARE_uint64(events_overload_queue);
+DECLARE_uint64(events_sampling);
 
 class EventsDatabaseTests : public ::testing::Test {
   void SetUp() override {
@@ -72,6 +77,18 @@ class DBFakeEventSubscriber : public EventSubscriber<DBFakeEventPublisher> {
     return add(r, t);
   }
 
+  /// Add a batch of fake events at times t
+  Status testAddBatch(const std::vector<size_t>& times) {
+    std::vector<Row> rows;
+    for (const auto& t : times) {
+      Row r;
+      r["testing"] = "hello from space";
+      r["time"] = INTEGER(t);
+      rows.push_back(std::move(r));
+    }
+    return addBatch(rows);
+  }
+
   size_t getEventsMax() override {
     return max_;
   }
@@ -100,9 +117,14 @@ TEST_F(EventsDatabaseTests, test_event_module_id) {
 
   // Not normally available outside of EventSubscriber->Add().
   auto event_id1 = sub->getEventID();
-  EXPECT_EQ(event_id1, "0000000001");
+  EXPECT_EQ(1U, event_id1);
   auto event_id2 = sub->getEventID();
-  EXPECT_EQ(event_id2, "0000000002");
+  EXPECT_EQ(2U, event_id2);
+
+  // The checkpoint reserves a stride of IDs.
+  std::string content;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), content);
+  EXPECT_EQ("0000000010", content);
 }
 
 TEST_F(EventsDatabaseTests, test_event_add) {
@@ -111,6 +133,166 @@ TEST_F(EventsDatabaseTests, test_event_add) {
   EXPECT_TRUE(status.ok());
 }
 
+TEST_F(EventsDatabaseTests, test_event_add_batch) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto status = sub->testAddBatch({1, 2, 61});
+  EXPECT_TRUE(status.ok());
+
+  // Each row in the batch receives an EventID and a record.
+  auto indexes = sub->getIndexes(0, 0);
+  auto output = boost::algorithm::join(indexes, ", ");
+  EXPECT_EQ("60.0, 60.1", output);
+  auto records = sub->getRecords(indexes);
+  EXPECT_EQ(3U, records.size());
+
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("61", results[2]["time"]);
+}
+
+TEST_F(EventsDatabaseTests, test_event_sampling) {
+  auto overload_queue = FLAGS_events_overload_queue;
+  auto sampling = FLAGS_events_sampling;
+  FLAGS_events_overload_queue = 1;
+  FLAGS_events_sampling = 4;
+
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto addPath = [&sub](const std::string& path) {
+    std::vector<Row> rows = {{{"path", path}, {"time", "10"}}};
+    return sub->addBatch(rows);
+  };
+
+  // Without overload every row is stored and represents itself.
+  addPath("/bin/noisy");
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["sampling"]);
+
+  // While overloaded 1 in 4 rows for each path is stored.
+  sub->publisher_overloaded_ = true;
+  for (size_t i = 0; i < 10; i++) {
+    addPath("/bin/noisy");
+  }
+  addPath("/bin/rare");
+  results = sub->get(0, 0);
+  ASSERT_EQ(5U, results.size());
+  EXPECT_EQ("1", results[1]["sampling"]);
+  EXPECT_EQ("4", results[2]["sampling"]);
+  EXPECT_EQ("4", results[3]["sampling"]);
+  EXPECT_EQ("/bin/rare", results[4]["path"]);
+  EXPECT_EQ("1", results[4]["sampling"]);
+
+  // The next stored row represents the events skipped while overloaded.
+  sub->publisher_overloaded_ = false;
+  addPath("/bin/noisy");
+  results = sub->get(0, 0);
+  ASSERT_EQ(6U, results.size());
+  EXPECT_EQ("2", results[5]["sampling"]);
+  EXPECT_EQ(13U, sub->numEvents());
+
+  // Skipped events of a key not seen again are stored after the overload.
+  sub->publisher_overloaded_ = true;
+  addPath("/bin/once");
+  addPath("/bin/once");
+  addPath("/bin/once");
+  sub->flushEvents();
+  EXPECT_EQ(7U, sub->get(0, 0).size());
+  sub->publisher_overloaded_ = false;
+  results = sub->get(0, 0);
+  ASSERT_EQ(8U, results.size());
+  EXPECT_EQ("/bin/once", results[7]["path"]);
+  EXPECT_EQ("2", results[7]["sampling"]);
+  EXPECT_TRUE(sub->sampling_.empty());
+
+  FLAGS_events_overload_queue = overload_queue;
+  FLAGS_events_sampling = sampling;
+}
+
+TEST_F(EventsDatabaseTests, test_event_aggregation) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto aggregation = std::make_shared<EventAggregation>();
+  aggregation->columns = {"path"};
+  aggregation->max = {"uptime"};
+  aggregation->interval = 60;
+  sub->setAggregation(aggregation);
+
+  auto addPath = [&sub](const std::string& path, size_t t, size_t uptime) {
+    std::vector<Row> rows = {
+        {{"path", path}, {"time", INTEGER(t)}, {"uptime", INTEGER(uptime)}}};
+    return sub->addBatch(rows);
+  };
+
+  addPath("/bin/ls", 61, 5);
+  addPath("/bin/ls", 62, 7);
+  addPath("/bin/sh", 70, 1);
+  addPath("/bin/ls", 119, 6);
+
+  // Nothing is stored until the bucket completes.
+  EXPECT_EQ(2U, sub->aggregates_.size());
+  addPath("/bin/ls", 120, 1);
+  EXPECT_EQ(1U, sub->aggregates_.size());
+
+  // The remaining bucket is stored when the subscriber flushes everything.
+  sub->flushEvents(true);
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("/bin/ls", results[0]["path"]);
+  EXPECT_EQ("60", results[0]["time"]);
+  EXPECT_EQ("3", results[0]["sampling"]);
+  EXPECT_EQ("7", results[0]["uptime"]);
+  EXPECT_EQ("/bin/sh", results[1]["path"]);
+  EXPECT_EQ("1", results[1]["sampling"]);
+  EXPECT_EQ("120", results[2]["time"]);
+  EXPECT_EQ("1", results[2]["sampling"]);
+  EXPECT_EQ(5U, sub->numEvents());
+
+  // Keys over the limit are not aggregated.
+  for (size_t i = 0; i < 4096; i++) {
+    addPath("/bin/" + std::to_string(i), 180, 1);
+  }
+  EXPECT_EQ(4096U, sub->aggregates_.size());
+  addPath("/bin/other", 181, 1);
+  addPath("/bin/0", 182, 1);
+  EXPECT_EQ(4096U, sub->aggregates_.size());
+  sub->flushEvents(true);
+  results = sub->get(0, 0);
+  ASSERT_EQ(4100U, results.size());
+  for (auto& r : results) {
+    if (r["path"] == "/bin/other") {
+      EXPECT_EQ("181", r["time"]);
+      EXPECT_EQ("1", r["sampling"]);
+    } else if (r["path"] == "/bin/0") {
+      EXPECT_EQ("180", r["time"]);
+      EXPECT_EQ("2", r["sampling"]);
+    }
+  }
+}
+
+TEST_F(EventsDatabaseTests, test_memory_events) {
+  auto memory_max = FLAGS_events_memory_max;
+  FLAGS_events_memory_max = 10;
+
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto t = getUnixTime() + 100;
+  sub->testAdd(t);
+  sub->testAdd(t + 1);
+
+  // Recent events are kept in memory and not yet persisted.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(0U, keys.size());
+  auto results = sub->get(t, 0);
+  EXPECT_EQ(2U, results.size());
+
+  // A range before the in-memory events requires a flush.
+  results = sub->get(0, 0);
+  EXPECT_EQ(2U, results.size());
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(2U, keys.size());
+
+  FLAGS_events_memory_max = memory_max;
+}
+
 TEST_F(EventsDatabaseTests, test_record_indexing) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(2);
@@ -143,6 +325,40 @@ TEST_F(EventsDatabaseTests, test_record_indexing) {
   EXPECT_EQ("60.0, 60.1, 60.60, 60.120, 60.121", output);
 }
 
+TEST_F(EventsDatabaseTests, test_record_keys) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd(61);
+  sub->testAdd(62);
+  sub->testAdd(121);
+
+  // Each record is an individual key within its bin.
+  std::vector<std::string> keys;
+  auto record_key = "records." + sub->dbNamespace();
+  scanDatabaseKeys(kEvents, keys, record_key);
+  ASSERT_EQ(3U, keys.size());
+  EXPECT_EQ(record_key + ".60.0000000001.0000000001:61", keys[0]);
+  EXPECT_EQ(record_key + ".60.0000000001.0000000002:62", keys[1]);
+  EXPECT_EQ(record_key + ".60.0000000002.0000000003:121", keys[2]);
+
+  // Event data is ordered by the event time.
+  keys.clear();
+  auto data_key = "data." + sub->dbNamespace();
+  scanDatabaseKeys(kEvents, keys, data_key);
+  ASSERT_EQ(3U, keys.size());
+  EXPECT_EQ(data_key + ".0000000061.0000000001", keys[0]);
+  EXPECT_EQ(data_key + ".0000000121.0000000003", keys[2]);
+
+  // The bin index is only appended when a bin is created.
+  std::string content;
+  getDatabaseValue(kEvents, "indexes." + sub->dbNamespace() + ".60", content);
+  EXPECT_EQ("1,2", content);
+
+  auto records = sub->getRecords({"60.1"});
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("0000000002", records[1].first);
+  EXPECT_EQ(62U, records[1].second);
+}
+
 TEST_F(EventsDatabaseTests, test_record_range) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
@@ -227,6 +443,27 @@ TEST_F(EventsDatabaseTests, test_record_expiration) {
   EXPECT_EQ(3U, records.size()); // 11, 61, 3601
 }
 
+TEST_F(EventsDatabaseTests, test_record_range_expiration) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd(1);
+  sub->testAdd(61);
+  sub->testAdd(121);
+  sub->testAdd(181);
+
+  // Both expired bins and their data are removed.
+  sub->expire_events_ = true;
+  sub->expire_time_ = 120;
+  auto indexes = sub->getIndexes(0, 0);
+  EXPECT_EQ("60.2, 60.3", boost::algorithm::join(indexes, ", "));
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "records." + sub->dbNamespace());
+  EXPECT_EQ(2U, keys.size());
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(2U, keys.size());
+}
+
 TEST_F(EventsDatabaseTests, test_gentable) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
@@ -250,7 +487,7 @@ TEST_F(EventsDatabaseTests, test_gentable) {
 
   std::vector<std::string> keys;
   scanDatabaseKeys("events", keys);
-  // 9 data records, 1 eid counter, 3 indexes, 15 index records.
+  // 9 data records, 1 eid counter, 1 index, 9 records.
   // Depending on the moment, an additional 3 indexes may be introduced.
   EXPECT_LE(16U, keys.size());
 
@@ -277,6 +514,75 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   EXPECT_LE(6U, keys.size());
 }
 
+TEST_F(EventsDatabaseTests, test_indexed_columns) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->indexed_columns_ = {"path"};
+
+  auto t = getUnixTime() - 7200;
+  std::vector<std::string> paths = {"/usr/bin/curl",
+                                    "/usr/bin/Curl",
+                                    "/etc/passwd",
+                                    "/usr/bin/curl.d",
+                                    "/etc/hosts"};
+  for (size_t i = 0; i < paths.size(); i++) {
+    Row r;
+    r["path"] = paths[i];
+    r["time"] = INTEGER(t + i * 1800);
+    ASSERT_TRUE(sub->add(r, t + i * 1800).ok());
+  }
+
+  // Each event has a lookup of its path.
+  auto lookup_key = "lookup." + sub->dbNamespace() + ".path.";
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, lookup_key);
+  EXPECT_EQ(paths.size(), keys.size());
+
+  // Equality is case-sensitive and does not match longer values.
+  QueryContext context;
+  context.constraints["path"].add(Constraint(EQUALS, "/usr/bin/curl"));
+  auto results = sub->genTable(context);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("/usr/bin/curl", results[0]["path"]);
+
+  context.constraints["time"].add(
+      Constraint(GREATER_THAN, BIGINT(static_cast<size_t>(t))));
+  EXPECT_TRUE(sub->genTable(context).empty());
+
+  // A LIKE prefix matches either case, the earliest events satisfy a limit.
+  QueryContext like;
+  like.constraints["path"].add(Constraint(LIKE, "/USR/bin/%"));
+  EXPECT_EQ(3U, sub->genTable(like).size());
+  like.limit = 2;
+  results = sub->genTable(like);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("/usr/bin/Curl", results[1]["path"]);
+
+  // Without a prefix every event is read and matched.
+  QueryContext suffix;
+  suffix.constraints["path"].add(Constraint(LIKE, "%hosts"));
+  results = sub->genTable(suffix);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("/etc/hosts", results[0]["path"]);
+
+  // Lookups are expired with their events.
+  sub->expire_time_ = t + 3600;
+  sub->getIndexes(0, 0);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, lookup_key);
+  EXPECT_LT(keys.size(), paths.size());
+  EXPECT_LE(3U, keys.size());
+
+  // Lookups are also removed with the events over the events_max limit.
+  sub->setEventsMax(1);
+  sub->expireCheck();
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, lookup_key);
+  EXPECT_LE(keys.size(), 2U);
+  QueryContext newest;
+  newest.constraints["path"].add(Constraint(EQUALS, "/etc/hosts"));
+  EXPECT_EQ(1U, sub->genTable(newest).size());
+}
+
 TEST_F(EventsDatabaseTests, test_optimize) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   for (size_t i = 800; i < 800 + 10; ++i) {
@@ -318,6 +624,53 @@ TEST_F(EventsDatabaseTests, test_optimize) {
   kToolType = default_type;
 }
 
+TEST_F(EventsDatabaseTests, test_expire_consumed) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setEventsExpiry(0);
+  auto t = getUnixTime() - 600;
+  for (size_t i = t; i < t + 10; ++i) {
+    sub->testAdd(i);
+  }
+
+  auto default_type = kToolType;
+  kToolType = ToolType::DAEMON;
+  FLAGS_events_optimize = true;
+  FLAGS_events_expire_consumed = true;
+  FLAGS_events_expire_grace = 3600;
+
+  // Two scheduled queries select from the subscriber.
+  sub->consumers_ = {"consumed_a", "consumed_b"};
+  sub->query_count_ = 2;
+
+  QueryContext context;
+  auto data_key = "data." + sub->dbNamespace();
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumed_a");
+  EXPECT_EQ(10U, sub->genTable(context).size());
+
+  // The second query has not read the events.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(10U, keys.size());
+
+  // Both have read them, but the grace window keeps them.
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumed_b");
+  EXPECT_EQ(10U, sub->genTable(context).size());
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(10U, keys.size());
+
+  // Without a grace window the events are removed after the next query.
+  FLAGS_events_expire_grace = 0;
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumed_a");
+  EXPECT_EQ(0U, sub->genTable(context).size());
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(0U, keys.size());
+
+  FLAGS_events_expire_consumed = false;
+  kToolType = default_type;
+}
+
 TEST_F(EventsDatabaseTests, test_expire_check) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   // Set the max number of buffered events to something reasonably small.
@@ -352,7 +705,7 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
         sub->testAdd(t++);
       }
 
-      // Records hold the event_id + time indexes.
+      // Records hold the event_id + time indexes, one key per event.
       // Data hosts the event_id + JSON content.
       auto record_key = "records." + sub->dbNamespace();
       auto data_key = "data." + sub->dbNamespace();
@@ -361,7 +714,8 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
       scanDatabaseKeys(kEvents, records, record_key);
       scanDatabaseKeys(kEvents, datas, data_key);
 
-      EXPECT_LT(records.size(), 20U);
+      // Records are expired using time bins, expect at most two bins.
+      EXPECT_LT(records.size(), 130U);
       EXPECT_LT(datas.size(), 60U);
     }
   }
@@ -14,8 +14,12 @@
 
 #include <osquery/config.h>
 #include <osquery/events.h>
+#include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/event_queue.h"
+#include "osquery/events/placement.h"
+
 namespace osquery {
 
 class EventsTests : public ::testing::Test {
@@ -519,6 +523,126 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_TRUE(status.ok());
 }
 
+TEST_F(EventsTests, test_fire_event_queue) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  pub->setName("BasicPublisher");
+  auto status = EventFactory::registerEventPublisher(pub);
+  ASSERT_TRUE(status.ok());
+
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  status = EventFactory::registerEventSubscriber(sub);
+  ASSERT_TRUE(status.ok());
+
+  auto subscription = Subscription::create("fake_events");
+  subscription->callback = TestTheeCallback;
+  status = EventFactory::addSubscription("BasicPublisher", subscription);
+  ASSERT_TRUE(status.ok());
+
+  // A queued publisher does not call subscribers within fire.
+  pub->queue_ = std::make_shared<BoundedQueue<EventContextRef>>(2);
+  auto tolled = kBellHathTolled;
+  for (size_t i = 0; i < 3; i++) {
+    pub->fire(pub->createEventContext(), 0);
+  }
+  EXPECT_EQ(tolled, kBellHathTolled);
+  EXPECT_EQ(1U, pub->numDropped());
+
+  // The queued events are dispatched in order.
+  EventContextRef ec;
+  while (pub->queue_->pop(ec)) {
+    pub->dispatch(ec);
+  }
+  EXPECT_EQ(tolled + 2, kBellHathTolled);
+
+  EventFactory::deregisterEventSubscriber(sub->getName());
+  EventFactory::deregisterEventPublisher(pub->type());
+}
+
+class ForwardLoggerPlugin : public LoggerPlugin {
+ public:
+  bool usesLogEvent() override {
+    return true;
+  }
+
+  Status logEvent(const std::string& e) override {
+    events.push_back(e);
+    return Status(0, "OK");
+  }
+
+  Status logString(const std::string& s) override {
+    return Status(0, "OK");
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+
+  Status logEvents(const std::vector<LogEventRef>& events) override {
+    batches++;
+    return LoggerPlugin::logEvents(events);
+  }
+
+ public:
+  std::vector<std::string> events;
+  size_t batches{0};
+};
+
+TEST_F(EventsTests, test_forward_event) {
+  auto logger = std::make_shared<ForwardLoggerPlugin>();
+  RegistryFactory::get().registry("logger")->add("forward_test", logger);
+
+  // Internal loggers receive events directly, not through the registry.
+  auto& ef = EventFactory::getInstance();
+  EventFactory::addForwarder("forward_test");
+  EXPECT_TRUE(EventFactory::isForwarding());
+  ASSERT_EQ(1U, ef.forwarders_.size());
+  EXPECT_TRUE(ef.loggers_.empty());
+
+  EventFactory::forwardEvent("{\"a\":\"1\"}");
+  EventFactory::forwardEvent("{\"a\":\"2\"}");
+  ASSERT_EQ(2U, logger->events.size());
+  EXPECT_EQ("{\"a\":\"1\"}", logger->events.front());
+  EXPECT_EQ("{\"a\":\"2\"}", logger->events.back());
+
+  ef.forwarders_.clear();
+  RegistryFactory::get().registry("logger")->remove("forward_test");
+}
+
+TEST_F(EventsTests, test_forward_event_queue) {
+  auto logger = std::make_shared<ForwardLoggerPlugin>();
+  RegistryFactory::get().registry("logger")->add("forward_test", logger);
+
+  auto& ef = EventFactory::getInstance();
+  EventFactory::addForwarder("forward_test");
+  ASSERT_EQ(1U, ef.forwarders_.size());
+
+  // Queued events are not forwarded within the subscriber, unless the queue
+  // is full.
+  ef.forward_queue_ = std::make_shared<BoundedQueue<LogEventRef>>(2);
+  for (size_t i = 0; i < 3; i++) {
+    EventFactory::forwardEvent(std::to_string(i));
+  }
+  ASSERT_EQ(1U, logger->events.size());
+  EXPECT_EQ("2", logger->events.back());
+  EXPECT_EQ(0U, logger->batches);
+
+  // The queued events share their buffers and are logged as a batch.
+  std::vector<LogEventRef> batch;
+  LogEventRef event;
+  while (ef.forward_queue_->pop(event)) {
+    EXPECT_EQ(1, event.use_count());
+    batch.push_back(std::move(event));
+  }
+  EXPECT_TRUE(logger->logEvents(batch).ok());
+  EXPECT_EQ(1U, logger->batches);
+  ASSERT_EQ(3U, logger->events.size());
+  EXPECT_EQ("0", logger->events[1]);
+  EXPECT_EQ("1", logger->events[2]);
+
+  ef.forward_queue_ = nullptr;
+  ef.forwarders_.clear();
+  RegistryFactory::get().registry("logger")->remove("forward_test");
+}
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() : FakeEventSubscriber(true) {
@@ -563,4 +687,35 @@ TEST_F(EventsTests, test_event_toggle_subscribers) {
   auto status = EventFactory::deregisterEventSubscriber(sub->getName());
   EXPECT_TRUE(status.ok());
 }
+
+TEST_F(EventsTests, test_event_thread_placement) {
+  EventThreadPlacement placement;
+  auto status = getEventThreadPlacement(
+      "audit", "inotify:0,audit:1-3+6", "audit:batch", placement);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(placement.cpus, std::set<int>({1, 2, 3, 6}));
+  EXPECT_EQ(placement.policy, EventThreadPolicy::BATCH);
+  EXPECT_EQ(placement.toString(), "cpus=1+2+3+6 policy=batch");
+
+  // Types without an entry keep the default placement.
+  status = getEventThreadPlacement("syslog", "audit:1", "inotify:5", placement);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(placement.cpus.empty());
+  EXPECT_EQ(placement.nice, 0);
+  EXPECT_TRUE(placement.toString().empty());
+
+  status = getEventThreadPlacement("inotify", "", "inotify:5", placement);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(placement.nice, 5);
+
+  // Applying a default placement has no effect.
+  EXPECT_TRUE(applyEventThreadPlacement(EventThreadPlacement()).ok());
+
+  status = getEventThreadPlacement("audit", "audit:3-1", "", placement);
+  EXPECT_FALSE(status.ok());
+  status = getEventThreadPlacement("audit", "audit:x", "", placement);
+  EXPECT_FALSE(status.ok());
+  status = getEventThreadPlacement("audit", "", "audit:fast", placement);
+  EXPECT_FALSE(status.ok());
+}
 }
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/path_index.h"
+
+namespace osquery {
+
+class PathIndexTests : public testing::Test {};
+
+TEST_F(PathIndexTests, test_path_pattern) {
+  PathPattern prefix("/etc/", PathMatchType::PREFIX);
+  EXPECT_TRUE(prefix.matches("/etc/passwd"));
+  EXPECT_TRUE(prefix.matches("/etc/ssh/sshd_config"));
+  EXPECT_FALSE(prefix.matches("/ETC/passwd"));
+  EXPECT_FALSE(prefix.matches("/etc"));
+
+  // Globs match case-insensitively within the last path component.
+  PathPattern glob("/Users/*/Downloads/", PathMatchType::GLOB);
+  EXPECT_EQ("/users/", glob.prefix());
+  EXPECT_TRUE(glob.matches("/users/alice/downloads/file.dmg"));
+  EXPECT_FALSE(glob.matches("/Users/alice/Downloads/new/file.dmg"));
+  EXPECT_FALSE(glob.matches("/Users/alice/bob/Downloads/file.dmg"));
+
+  // A leading-dir glob also matches within matched directories.
+  PathPattern leading("/Users/*/Downloads/", PathMatchType::GLOB_LEADING_DIR);
+  EXPECT_TRUE(leading.matches("/Users/alice/Downloads/new/file.dmg"));
+
+  PathPattern set("/tmp/[a-c]?.log", PathMatchType::GLOB);
+  EXPECT_TRUE(set.matches("/tmp/B1.log"));
+  EXPECT_FALSE(set.matches("/tmp/d1.log"));
+  EXPECT_FALSE(set.matches("/tmp/a/.log"));
+
+  PathPattern negated("/tmp/[!a]", PathMatchType::GLOB);
+  EXPECT_TRUE(negated.matches("/tmp/b"));
+  EXPECT_FALSE(negated.matches("/tmp/A"));
+
+  PathPattern escaped("/tmp/\\*", PathMatchType::GLOB);
+  EXPECT_TRUE(escaped.matches("/tmp/*file"));
+  EXPECT_FALSE(escaped.matches("/tmp/file"));
+}
+
+TEST_F(PathIndexTests, test_path_index) {
+  auto index = std::make_shared<PathPatternIndex>();
+  auto etc = std::make_shared<SubscriptionContext>();
+  auto users = std::make_shared<SubscriptionContext>();
+  auto shadow = std::make_shared<SubscriptionContext>();
+  auto any = std::make_shared<SubscriptionContext>();
+  index->add(etc, "/etc/", PathMatchType::PREFIX);
+  index->add(users, "/Users/*/Downloads/", PathMatchType::GLOB);
+  index->add(shadow, "/etc/shadow", PathMatchType::GLOB);
+  index->add(any, "*", PathMatchType::GLOB_LEADING_DIR);
+  EXPECT_EQ(4U, index->size());
+
+  auto matches = index->match("/etc/shadow");
+  EXPECT_TRUE(matches->matched(etc.get()));
+  EXPECT_TRUE(matches->matched(shadow.get()));
+  EXPECT_FALSE(matches->matched(users.get()));
+  EXPECT_TRUE(matches->matched(any.get()));
+
+  matches = index->match("/users/alice/Downloads/a.dmg");
+  EXPECT_TRUE(matches->matched(users.get()));
+  EXPECT_FALSE(matches->matched(etc.get()));
+  EXPECT_EQ(2U, matches->size());
+
+  // Subscriptions added after the index was built are not known to it.
+  auto other = std::make_shared<SubscriptionContext>();
+  EXPECT_TRUE(matches->indexed(users.get()));
+  EXPECT_FALSE(matches->indexed(other.get()));
+}
+}
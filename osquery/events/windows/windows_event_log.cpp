@@ -28,10 +28,33 @@ namespace osquery {
 
 REGISTER(WindowsEventLogEventPublisher, "event_publisher", "windows_event_log");
 
+FLAG(bool,
+     windows_event_data,
+     true,
+     "Render the event data of Windows event log records");
+
 const std::chrono::milliseconds kWinEventLogPause(200);
 
+/// The number of events pulled from a subscription at once.
+const unsigned long kWinEventLogBatch = 64;
+
+Status WindowsEventLogEventPublisher::setUp() {
+  signal_ = CreateEvent(nullptr, false, false, nullptr);
+  if (signal_ == nullptr) {
+    return Status(GetLastError(), "Cannot create event log signal");
+  }
+
+  render_context_ = EvtCreateRenderContext(0, nullptr, EvtRenderContextSystem);
+  if (render_context_ == nullptr) {
+    return Status(GetLastError(), "Cannot create event log render context");
+  }
+  return Status(0, "OK");
+}
+
 void WindowsEventLogEventPublisher::configure() {
   stop();
+
+  WriteLock lock(handles_mutex_);
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
     for (const auto& chan : sc->sources) {
@@ -39,16 +62,18 @@ void WindowsEventLogEventPublisher::configure() {
        * We don't apply any filtering to the Windows event logs. It's assumed
        * that if filtering is required, this will be handled via SQL queries
        * or in the subscriber logic.
+       *
+       * Pull subscriptions signal when events are available, then events are
+       * read in batches from the publisher's run loop.
        */
-      auto hSubscription =
-          EvtSubscribe(nullptr,
-                       nullptr,
-                       chan.c_str(),
-                       L"*",
-                       nullptr,
-                       nullptr,
-                       EVT_SUBSCRIBE_CALLBACK(winEventCallback),
-                       EvtSubscribeToFutureEvents);
+      auto hSubscription = EvtSubscribe(nullptr,
+                                        signal_,
+                                        chan.c_str(),
+                                        L"*",
+                                        nullptr,
+                                        nullptr,
+                                        nullptr,
+                                        EvtSubscribeToFutureEvents);
       if (hSubscription == nullptr) {
         LOG(WARNING) << "Failed to subscribe to "
                      << wstringToString(chan.c_str()) << ": " << GetLastError();
@@ -57,14 +82,78 @@ void WindowsEventLogEventPublisher::configure() {
       }
     }
   }
+
+  // Events that arrived before the subscriptions were created are not read.
+  if (signal_ != nullptr) {
+    SetEvent(signal_);
+  }
 }
 
 Status WindowsEventLogEventPublisher::run() {
-  pause();
+  if (signal_ == nullptr) {
+    return Status(1, "No event log signal");
+  }
+
+  auto ret = WaitForSingleObject(
+      signal_, static_cast<unsigned long>(kWinEventLogPause.count()));
+  if (ret == WAIT_FAILED) {
+    return Status(GetLastError(), "Cannot wait for event log signal");
+  }
+
+  /*
+   * A single signal is shared by the subscriptions, an auto-reset signal may
+   * combine several notifications so each subscription is drained. Waiting
+   * on a timeout also reads events whose notifications were combined while
+   * a batch was being fired.
+   */
+  WriteLock lock(handles_mutex_);
+  for (const auto& subscription : win_event_handles_) {
+    pull(subscription);
+  }
   return Status(0, "OK");
 }
 
+void WindowsEventLogEventPublisher::pull(EVT_HANDLE subscription) {
+  EVT_HANDLE events[kWinEventLogBatch];
+  while (!interrupted()) {
+    unsigned long count = 0;
+    if (!EvtNext(subscription, kWinEventLogBatch, events, 0, 0, &count)) {
+      auto err = GetLastError();
+      if (err != ERROR_NO_MORE_ITEMS && err != ERROR_TIMEOUT) {
+        VLOG(1) << "Windows event pull failed: " << err;
+      }
+      return;
+    }
+
+    for (unsigned long i = 0; i < count; i++) {
+      auto ec = createEventContext();
+      auto s =
+          renderSystem(render_context_, events[i], ec->channel, ec->record);
+      if (s.ok() && FLAGS_windows_event_data) {
+        pt::ptree propTree;
+        s = parseEvent(events[i], propTree);
+        auto event = propTree.get_child_optional("Event");
+        if (s.ok() && event) {
+          for (auto& node : *event) {
+            if (node.first != "System" && node.first != "<xmlattr>") {
+              ec->eventData.push_back(std::move(node));
+            }
+          }
+        }
+      }
+      EvtClose(events[i]);
+
+      if (s.ok()) {
+        EventFactory::fire<WindowsEventLogEventPublisher>(ec);
+      } else {
+        VLOG(1) << "Error rendering Windows event log: " << s.getCode();
+      }
+    }
+  }
+}
+
 void WindowsEventLogEventPublisher::stop() {
+  WriteLock lock(handles_mutex_);
   for (auto& e : win_event_handles_) {
     if (e != nullptr) {
       EvtClose(e);
@@ -75,35 +164,115 @@ void WindowsEventLogEventPublisher::stop() {
 
 void WindowsEventLogEventPublisher::tearDown() {
   stop();
+
+  if (render_context_ != nullptr) {
+    EvtClose(render_context_);
+    render_context_ = nullptr;
+  }
+
+  if (signal_ != nullptr) {
+    CloseHandle(signal_);
+    signal_ = nullptr;
+  }
 }
 
-unsigned long __stdcall WindowsEventLogEventPublisher::winEventCallback(
-    EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent) {
-  UNREFERENCED_PARAMETER(pContext);
-
-  switch (action) {
-  case EvtSubscribeActionError:
-    VLOG(1) << "Windows event callback failed: " << hEvent;
-    break;
-  case EvtSubscribeActionDeliver: {
-    pt::ptree propTree;
-    auto s = parseEvent(hEvent, propTree);
-    if (s.ok()) {
-      auto ec = createEventContext();
-      /// We leave the parsing of the properties up to the subscriber
-      ec->eventRecord = propTree;
-      ec->channel = stringToWstring(propTree.get("Event.System.Channel", ""));
-      EventFactory::fire<WindowsEventLogEventPublisher>(ec);
-    } else {
-      VLOG(1) << "Error rendering Windows event log: " << s.getCode();
+/// Format a FILETIME like the SystemTime attribute of an event's XML.
+static std::string formatEventTime(unsigned long long filetime) {
+  FILETIME ft;
+  ft.dwLowDateTime = static_cast<unsigned long>(filetime & 0xFFFFFFFF);
+  ft.dwHighDateTime = static_cast<unsigned long>(filetime >> 32);
+
+  SYSTEMTIME st;
+  if (!FileTimeToSystemTime(&ft, &st)) {
+    return "";
+  }
+
+  char buffer[32] = {0};
+  _snprintf_s(buffer,
+              sizeof(buffer),
+              _TRUNCATE,
+              "%04u-%02u-%02uT%02u:%02u:%02u.%09lluZ",
+              st.wYear,
+              st.wMonth,
+              st.wDay,
+              st.wHour,
+              st.wMinute,
+              st.wSecond,
+              (filetime % 10000000ULL) * 100);
+  return buffer;
+}
+
+Status WindowsEventLogEventPublisher::renderSystem(
+    EVT_HANDLE context,
+    EVT_HANDLE evt,
+    std::wstring& channel,
+    WindowsEventLogRecord& record) {
+  unsigned long buffUsed = 0;
+  unsigned long propCount = 0;
+  std::vector<unsigned char> buffer(1024);
+  auto ret = EvtRender(context,
+                       evt,
+                       EvtRenderEventValues,
+                       static_cast<unsigned long>(buffer.size()),
+                       buffer.data(),
+                       &buffUsed,
+                       &propCount);
+  if (ret == 0 && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+    buffer.resize(buffUsed);
+    ret = EvtRender(context,
+                    evt,
+                    EvtRenderEventValues,
+                    static_cast<unsigned long>(buffer.size()),
+                    buffer.data(),
+                    &buffUsed,
+                    &propCount);
+  }
+  if (ret == 0) {
+    return Status(GetLastError(), "Event rendering failed");
+  }
+  if (propCount < EvtSystemPropertyIdEND) {
+    return Status(1, "Event rendering is missing System properties");
+  }
+
+  auto values = reinterpret_cast<PEVT_VARIANT>(buffer.data());
+  const auto& name = values[EvtSystemProviderName];
+  if (name.Type == EvtVarTypeString && name.StringVal != nullptr) {
+    record.provider_name = wstringToString(name.StringVal);
+  }
+
+  const auto& guid = values[EvtSystemProviderGuid];
+  if (guid.Type == EvtVarTypeGuid && guid.GuidVal != nullptr) {
+    wchar_t guid_string[40] = {0};
+    if (StringFromGUID2(*guid.GuidVal, guid_string, 40) > 0) {
+      record.provider_guid = wstringToString(guid_string);
     }
-  } break;
+  }
+
+  const auto& chan = values[EvtSystemChannel];
+  if (chan.Type == EvtVarTypeString && chan.StringVal != nullptr) {
+    channel = chan.StringVal;
+    record.channel = wstringToString(chan.StringVal);
+  }
+
+  const auto& created = values[EvtSystemTimeCreated];
+  if (created.Type == EvtVarTypeFileTime) {
+    record.datetime = formatEventTime(created.FileTimeVal);
+  }
 
-  default:
-    VLOG(1) << "Received unknown action from Windows event log: "
-            << GetLastError();
+  if (values[EvtSystemEventID].Type == EvtVarTypeUInt16) {
+    record.eventid = values[EvtSystemEventID].UInt16Val;
+  }
+  if (values[EvtSystemTask].Type == EvtVarTypeUInt16) {
+    record.task = values[EvtSystemTask].UInt16Val;
   }
-  return ERROR_SUCCESS;
+  if (values[EvtSystemLevel].Type == EvtVarTypeByte) {
+    record.level = values[EvtSystemLevel].ByteVal;
+  }
+  if (values[EvtSystemKeywords].Type == EvtVarTypeHexInt64) {
+    record.keywords =
+        static_cast<long long>(values[EvtSystemKeywords].UInt64Val);
+  }
+  return Status(0, "OK");
 }
 
 Status WindowsEventLogEventPublisher::parseEvent(EVT_HANDLE evt,
@@ -34,17 +34,40 @@ struct WindowsEventLogSubscriptionContext : public SubscriptionContext {
   friend class WindowsEventLogEventPublisher;
 };
 
+/**
+ * @brief The System properties of a Windows event log record.
+ *
+ * These are rendered as typed values, without rendering the event to XML.
+ */
+struct WindowsEventLogRecord {
+  /// The time the event was created, formatted like the event XML SystemTime
+  std::string datetime;
+
+  std::string channel;
+  std::string provider_name;
+  std::string provider_guid;
+
+  int eventid{-1};
+  int task{-1};
+  int level{-1};
+  long long keywords{-1};
+};
+
 /**
  * @brief Event details for WindowsEventLogEventPublisher events.
  *
- * It is the responsibility of the subscriber to understand the best
- * way in which to parse the event data. The publisher will convert the
- * Event Log record into a boost::property_tree, and return the tree to
- * the subscriber for further parsing and row population.
+ * The publisher renders the System properties of each record into a flat
+ * record. The event data, such as the EventData or UserData elements, is
+ * only rendered and parsed into a boost::property_tree when
+ * --windows_event_data is set. It is the responsibility of the subscriber
+ * to understand the best way in which to parse the event data.
  */
 struct WindowsEventLogEventContext : public EventContext {
-  /// A Windows event log record converted from XML
-  boost::property_tree::ptree eventRecord;
+  /// The System properties of the record
+  WindowsEventLogRecord record;
+
+  /// The children of the record's Event element, excluding System
+  boost::property_tree::ptree eventData;
 
   /*
    * In Windows event logs, the source to which an event belongs is referred
@@ -78,22 +101,36 @@ class WindowsEventLogEventPublisher
   bool shouldFire(const WindowsEventLogSubscriptionContextRef& mc,
                   const WindowsEventLogEventContextRef& ec) const override;
 
+  Status setUp() override;
+
   void configure() override;
 
   void tearDown() override;
 
-  /// The calling for beginning the thread's run loop.
+  /// Wait for the subscriptions to signal and pull the available events.
   Status run() override;
 
-  /// Windows Event Callback required for API calls
-  static unsigned long __stdcall winEventCallback(
-      EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent);
-
   /// Helper function to convert an XML event blob into a property tree
-  static Status WindowsEventLogEventPublisher::parseEvent(
-      EVT_HANDLE evt, boost::property_tree::ptree& propTree);
+  static Status parseEvent(EVT_HANDLE evt,
+                           boost::property_tree::ptree& propTree);
+
+  /**
+   * @brief Render the System properties of an event.
+   *
+   * @param context a render context created for EvtRenderContextSystem
+   * @param evt the event handle
+   * @param channel the output wide channel, as compared with the sources
+   * @param record the output record
+   */
+  static Status renderSystem(EVT_HANDLE context,
+                             EVT_HANDLE evt,
+                             std::wstring& channel,
+                             WindowsEventLogRecord& record);
 
  private:
+  /// Fire an event context for each of the available events.
+  void pull(EVT_HANDLE subscription);
+
   /// Ensures that all Windows event log subscriptions are removed
   void stop() override;
 
@@ -101,9 +138,18 @@ class WindowsEventLogEventPublisher
   bool isSubscriptionActive() const;
 
  private:
-  /// Vector of all handles to windows event log publisher callbacks
+  /// Vector of all handles to windows event log pull subscriptions
   std::vector<EVT_HANDLE> win_event_handles_;
 
+  /// Signaled by every subscription when events are available
+  HANDLE signal_{nullptr};
+
+  /// The precompiled render context for the System properties
+  EVT_HANDLE render_context_{nullptr};
+
+  /// Protect the subscriptions, which are replaced when configured
+  mutable Mutex handles_mutex_;
+
  public:
   friend class WindowsEventLogTests;
   FRIEND_TEST(WindowsEventLogTests, test_register_event_pub);
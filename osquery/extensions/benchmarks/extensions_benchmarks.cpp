@@ -0,0 +1,200 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/extensions.h>
+#include <osquery/filesystem.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/extensions/interface.h"
+#include "osquery/tests/test_util.h"
+
+using namespace osquery::extensions;
+
+namespace osquery {
+
+/// The widest table generated by the benchmarks.
+const size_t kBenchmarkMaxColumns = 32;
+
+/// Rows and columns generated by the benchmark table, set by each benchmark.
+static std::atomic<size_t> kBenchmarkRows{1};
+static std::atomic<size_t> kBenchmarkColumns{1};
+
+/// A table generating kBenchmarkRows rows of kBenchmarkColumns columns.
+class ExtensionBenchmarkTablePlugin : public TablePlugin {
+ protected:
+  TableColumns columns() const override {
+    TableColumns columns;
+    for (size_t i = 0; i < kBenchmarkMaxColumns; i++) {
+      columns.push_back(std::make_tuple(
+          "column_" + std::to_string(i), TEXT_TYPE, ColumnOptions::DEFAULT));
+    }
+    return columns;
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    QueryData results;
+    size_t columns = kBenchmarkColumns;
+    for (size_t i = 0; i < kBenchmarkRows; i++) {
+      Row r;
+      for (size_t j = 0; j < columns; j++) {
+        r["column_" + std::to_string(j)] = "value_" + std::to_string(i);
+      }
+      results.push_back(std::move(r));
+    }
+    return results;
+  }
+};
+
+/// The manager and extension sockets, started once for every benchmark.
+struct ExtensionBenchmarkSockets {
+  std::string manager;
+  std::string extension;
+};
+
+static bool waitForSocket(const std::string& path) {
+  for (size_t delay = 0; delay < 3000; delay += 20) {
+    if (socketExists(path).ok()) {
+      return true;
+    }
+    sleepFor(20);
+  }
+  return false;
+}
+
+/**
+ * @brief Start an extension manager and an extension in this process.
+ *
+ * Like the extensions tests, the manager and extension share one registry.
+ * Duplicate registry items are allowed so the extension may broadcast the
+ * benchmark table that already exists as an internal plugin.
+ */
+static const ExtensionBenchmarkSockets& getBenchmarkSockets() {
+  static ExtensionBenchmarkSockets sockets;
+  static std::once_flag started;
+  std::call_once(started, []() {
+    auto& rf = RegistryFactory::get();
+    rf.registry("table")->add(
+        "extension_benchmark",
+        std::make_shared<ExtensionBenchmarkTablePlugin>());
+    rf.allowDuplicates(true);
+
+    auto path = kTestWorkingDirectory + "benchmarkextmgr";
+    remove(path);
+    if (!startExtensionManager(path).ok() || !waitForSocket(path)) {
+      return;
+    }
+
+    auto status = startExtension(path, "benchmark", "0.1", "0.0.0", "0.0.0");
+    if (!status.ok()) {
+      return;
+    }
+
+    auto extension = path + "." + status.getMessage();
+    if (waitForSocket(extension)) {
+      sockets.manager = path;
+      sockets.extension = extension;
+    }
+  });
+  return sockets;
+}
+
+/// Apply the row and column counts shared by the table benchmarks.
+static void genTableArgs(benchmark::internal::Benchmark* b) {
+  for (int rows : {1, 100, 10000}) {
+    for (int columns : {1, 8, static_cast<int>(kBenchmarkMaxColumns)}) {
+      b->ArgPair(rows, columns);
+    }
+  }
+}
+
+static void EXTENSIONS_ping(benchmark::State& state) {
+  const auto& sockets = getBenchmarkSockets();
+  if (sockets.extension.empty()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  EXClient client(sockets.extension);
+  while (state.KeepRunning()) {
+    ExtensionStatus status;
+    client.get()->ping(status);
+  }
+}
+
+BENCHMARK(EXTENSIONS_ping)->ThreadRange(1, 8);
+
+static void EXTENSIONS_table_generate(benchmark::State& state) {
+  const auto& sockets = getBenchmarkSockets();
+  if (sockets.extension.empty()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  kBenchmarkRows = state.range_x();
+  kBenchmarkColumns = state.range_y();
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    callExtension(sockets.extension,
+                  "table",
+                  "extension_benchmark",
+                  {{"action", "generate"}},
+                  response);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+BENCHMARK(EXTENSIONS_table_generate)->Apply(genTableArgs)->ThreadRange(1, 8);
+
+static void EXTENSIONS_query(benchmark::State& state) {
+  const auto& sockets = getBenchmarkSockets();
+  if (sockets.manager.empty()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  kBenchmarkRows = state.range_x();
+  kBenchmarkColumns = state.range_y();
+  EXManagerClient client(sockets.manager);
+  while (state.KeepRunning()) {
+    ExtensionResponse response;
+    client.get()->query(response, "select * from extension_benchmark");
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+BENCHMARK(EXTENSIONS_query)->Apply(genTableArgs)->ThreadRange(1, 8);
+
+static void EXTENSIONS_get_query_columns(benchmark::State& state) {
+  const auto& sockets = getBenchmarkSockets();
+  if (sockets.manager.empty()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  EXManagerClient client(sockets.manager);
+  while (state.KeepRunning()) {
+    ExtensionResponse response;
+    client.get()->getQueryColumns(response,
+                                  "select * from extension_benchmark");
+  }
+}
+
+BENCHMARK(EXTENSIONS_get_query_columns)->ThreadRange(1, 8);
+}
@@ -8,7 +8,14 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
+#include <iterator>
+#include <mutex>
+#include <set>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -35,6 +42,31 @@ namespace osquery {
 // Millisecond latency between initalizing manager pings.
 const size_t kExtensionInitializeLatency = 20;
 
+/// Idle clients kept open for each extension socket path.
+const size_t kMaxIdleExtensionClients = 4;
+
+/// Open clients, by socket path, not in use by a call.
+static std::map<std::string, std::vector<std::shared_ptr<EXClient>>>
+    kExtensionClients;
+
+/// Protect the idle extension clients.
+static Mutex kExtensionClientsMutex;
+
+/// Registrations expected from autoloaded extensions.
+struct ExtensionAutoload {
+  std::mutex mutex;
+  std::condition_variable registered_cv;
+
+  /// Set while expected extensions have not registered before the deadline.
+  std::atomic<bool> pending{false};
+
+  size_t expected{0};
+  size_t registered{0};
+  std::chrono::steady_clock::time_point deadline;
+};
+
+static ExtensionAutoload kExtensionAutoload;
+
 enum class ExtendableType {
   EXTENSION = 1,
   MODULE = 2,
@@ -78,6 +110,11 @@ CLI_FLAG(string,
          OSQUERY_HOME "/modules.load",
          "Optional path to a list of autoloaded registry modules");
 
+CLI_FLAG(bool,
+         extensions_client_reuse,
+         true,
+         "Reuse connections to extensions across registry calls");
+
 SHELL_FLAG(string, extension, "", "Path to a single extension to autoload");
 
 CLI_FLAG(string,
@@ -98,14 +135,20 @@ EXTENSION_FLAG_ALIAS(socket, extensions_socket);
 EXTENSION_FLAG_ALIAS(timeout, extensions_timeout);
 EXTENSION_FLAG_ALIAS(interval, extensions_interval);
 
-Status applyExtensionDelay(std::function<Status(bool& stop)> predicate) {
-  // Make sure the extension manager path exists, and is writable.
-  size_t delay = 0;
+/// The extensions timeout in milliseconds.
+static size_t getExtensionTimeout() {
   // The timeout is given in seconds, but checked interval is microseconds.
   size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000;
   if (timeout < kExtensionInitializeLatency * 10) {
     timeout = kExtensionInitializeLatency * 10;
   }
+  return timeout;
+}
+
+Status applyExtensionDelay(std::function<Status(bool& stop)> predicate) {
+  // Make sure the extension manager path exists, and is writable.
+  size_t delay = 0;
+  auto timeout = getExtensionTimeout();
 
   Status status;
   do {
@@ -142,6 +185,73 @@ Status extensionPathActive(const std::string& path, bool use_timeout = false) {
   }));
 }
 
+/// Start expecting registrations from the autoloaded extensions.
+static void initExtensionAutoload() {
+  size_t expected = Watcher::extensions().size();
+  if (expected == 0) {
+    // A watcher hints to its worker the number of extensions it launches.
+    auto hint = getEnvVar("OSQUERY_EXTENSIONS");
+    if (!hint.is_initialized()) {
+      return;
+    }
+    expected = std::strtoul(hint->c_str(), nullptr, 10);
+    if (expected == 0) {
+      return;
+    }
+  }
+
+  auto& autoload = kExtensionAutoload;
+  std::lock_guard<std::mutex> lock(autoload.mutex);
+  autoload.expected = expected;
+  autoload.registered = 0;
+  autoload.deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(getExtensionTimeout());
+  autoload.pending = true;
+}
+
+bool extensionsPending() {
+  auto& autoload = kExtensionAutoload;
+  if (!autoload.pending) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(autoload.mutex);
+  if (std::chrono::steady_clock::now() >= autoload.deadline) {
+    autoload.pending = false;
+  }
+  return autoload.pending;
+}
+
+void notifyExtensionRegistered() {
+  auto& autoload = kExtensionAutoload;
+  {
+    std::lock_guard<std::mutex> lock(autoload.mutex);
+    autoload.registered++;
+    if (autoload.registered >= autoload.expected) {
+      autoload.pending = false;
+    }
+  }
+  autoload.registered_cv.notify_all();
+}
+
+bool waitForExtensionTable(const std::string& table) {
+  // Table plugins are registered in lowercase.
+  auto name = table;
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+  auto& autoload = kExtensionAutoload;
+  std::unique_lock<std::mutex> lock(autoload.mutex);
+  autoload.registered_cv.wait_until(
+      lock, autoload.deadline, [&autoload, &name]() {
+        return !autoload.pending ||
+               RegistryFactory::get().exists("table", name);
+      });
+  if (std::chrono::steady_clock::now() >= autoload.deadline) {
+    autoload.pending = false;
+  }
+  return RegistryFactory::get().exists("table", name);
+}
+
 void ExtensionWatcher::start() {
   // Watch the manager, if the socket is removed then the extension will die.
   // A check for sane paths and activity is applied before the watcher
@@ -256,6 +366,7 @@ void ExtensionManagerWatcher::watch() {
     if (uuid.second > 1) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
       RegistryFactory::get().removeBroadcast(uuid.first);
+      resetExtensionClients(getExtensionSocket(uuid.first));
       failures_[uuid.first] = 1;
     }
   }
@@ -532,8 +643,13 @@ Status queryExternal(const std::string& manager_path,
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
 
-  for (const auto& row : response.response) {
-    results.push_back(row);
+  // Hand the rows to the results without copying each one.
+  if (results.empty()) {
+    results = std::move(response.response);
+  } else {
+    results.insert(results.end(),
+                   std::make_move_iterator(response.response.begin()),
+                   std::make_move_iterator(response.response.end()));
   }
 
   return Status(response.status.code, response.status.message);
@@ -647,6 +763,93 @@ Status callExtension(const RouteUUID uuid,
       getExtensionSocket(uuid), registry, item, request, response);
 }
 
+/// Take an idle client for the socket path, or open a new one.
+static std::shared_ptr<EXClient> takeExtensionClient(const std::string& path,
+                                                     bool& reused) {
+  reused = false;
+  if (FLAGS_extensions_client_reuse) {
+    WriteLock lock(kExtensionClientsMutex);
+    auto& idle = kExtensionClients[path];
+    if (!idle.empty()) {
+      auto client = idle.back();
+      idle.pop_back();
+      reused = true;
+      return client;
+    }
+  }
+  return std::make_shared<EXClient>(path);
+}
+
+/// Return a client, after a successful call, to the socket path's idle set.
+static void releaseExtensionClient(const std::string& path,
+                                   std::shared_ptr<EXClient> client) {
+  if (!FLAGS_extensions_client_reuse) {
+    return;
+  }
+
+  WriteLock lock(kExtensionClientsMutex);
+  auto& idle = kExtensionClients[path];
+  if (idle.size() < kMaxIdleExtensionClients) {
+    idle.push_back(std::move(client));
+  }
+}
+
+void resetExtensionClients(const std::string& path) {
+  WriteLock lock(kExtensionClientsMutex);
+  kExtensionClients.erase(path);
+}
+
+size_t getIdleExtensionClients(const std::string& path) {
+  WriteLock lock(kExtensionClientsMutex);
+  auto idle = kExtensionClients.find(path);
+  return (idle == kExtensionClients.end()) ? 0 : idle->second.size();
+}
+
+/**
+ * @brief Make a Thrift call using an extension client for the socket path.
+ *
+ * A reused client may belong to an extension that restarted, a failed call
+ * is retried once with a new client. Thrift exceptions from the new client
+ * are thrown to the caller.
+ */
+template <typename Call>
+static void callExtensionClient(const std::string& extension_path,
+                                ExtensionResponse& ext_response,
+                                Call call) {
+  bool reused = false;
+  auto client = takeExtensionClient(extension_path, reused);
+  try {
+    call(client, ext_response);
+  } catch (const std::exception& /* e */) {
+    if (!reused) {
+      throw;
+    }
+    // The extension may have restarted since the idle client was opened.
+    // Drop every idle client for the path and retry once with a new one.
+    resetExtensionClients(extension_path);
+    ext_response = ExtensionResponse();
+    client = std::make_shared<EXClient>(extension_path);
+    call(client, ext_response);
+  }
+  releaseExtensionClient(extension_path, std::move(client));
+}
+
+/// Move an extension's response rows into a PluginResponse.
+static Status getExtensionResponse(ExtensionResponse& ext_response,
+                                   PluginResponse& response) {
+  // Convert from Thrift-internal list type to PluginResponse type.
+  if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
+    if (response.empty()) {
+      response = std::move(ext_response.response);
+    } else {
+      response.insert(response.end(),
+                      std::make_move_iterator(ext_response.response.begin()),
+                      std::make_move_iterator(ext_response.response.end()));
+    }
+  }
+  return Status(ext_response.status.code, ext_response.status.message);
+}
+
 Status callExtension(const std::string& extension_path,
                      const std::string& registry,
                      const std::string& item,
@@ -660,19 +863,79 @@ Status callExtension(const std::string& extension_path,
 
   ExtensionResponse ext_response;
   try {
-    auto client = EXClient(extension_path);
-    client.get()->call(ext_response, registry, item, request);
+    callExtensionClient(
+        extension_path,
+        ext_response,
+        [&registry, &item, &request](const std::shared_ptr<EXClient>& client,
+                                     ExtensionResponse& output) {
+          client->get()->call(output, registry, item, request);
+        });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
+  return getExtensionResponse(ext_response, response);
+}
 
-  // Convert from Thrift-internal list type to PluginResponse type.
-  if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
-    for (const auto& response_item : ext_response.response) {
-      response.push_back(response_item);
+/// Extensions built before the structured generate API, by route UUID.
+static std::set<RouteUUID> kLegacyTableExtensions;
+
+/// Protect the set of extensions without the structured generate API.
+static Mutex kLegacyTableExtensionsMutex;
+
+Status callExtensionTable(const std::string& table,
+                          const QueryContext& context,
+                          QueryData& response) {
+  RouteUUID uuid = 0;
+  auto registry = RegistryFactory::get().registry("table");
+  if (!FLAGS_disable_extensions && registry != nullptr) {
+    const auto& external = registry->getExternal();
+    auto route = external.find(table);
+    if (route != external.end()) {
+      uuid = route->second;
     }
   }
-  return Status(ext_response.status.code, ext_response.status.message);
+
+  bool structured = (uuid != 0);
+  if (structured) {
+    ReadLock lock(kLegacyTableExtensionsMutex);
+    structured = (kLegacyTableExtensions.count(uuid) == 0);
+  }
+
+  if (structured) {
+    auto extension_path = getExtensionSocket(uuid);
+    auto status = extensionPathActive(extension_path);
+    if (!status.ok()) {
+      return status;
+    }
+
+    InternalQueryContext internal;
+    getInternalQueryContext(context, internal);
+
+    ExtensionResponse ext_response;
+    try {
+      callExtensionClient(
+          extension_path,
+          ext_response,
+          [&table, &internal](const std::shared_ptr<EXClient>& client,
+                              ExtensionResponse& output) {
+            client->get()->generate(output, table, internal);
+          });
+      return getExtensionResponse(ext_response, response);
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        return Status(1, "Extension call failed: " + std::string(e.what()));
+      }
+      // The extension predates the generate API, use the JSON context.
+      WriteLock lock(kLegacyTableExtensionsMutex);
+      kLegacyTableExtensions.insert(uuid);
+    } catch (const std::exception& e) {
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+  }
+
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  return Registry::call("table", table, request, response);
 }
 
 Status startExtensionWatcher(const std::string& manager_path,
@@ -707,6 +970,9 @@ Status startExtensionManager(const std::string& manager_path) {
 
   // Seconds converted to milliseconds, used as a thread interruptible.
   auto latency = atoi(FLAGS_extensions_interval.c_str()) * 1000;
+  // Queries may wait for tables of extensions that have not registered.
+  initExtensionAutoload();
+
   // Start a extension manager watcher, to monitor all registered extensions.
   Dispatcher::addService(
       std::make_shared<ExtensionManagerWatcher>(manager_path, latency));
@@ -717,32 +983,30 @@ Status startExtensionManager(const std::string& manager_path) {
 
   // The shell or daemon flag configuration may require an extension.
   if (!FLAGS_extensions_require.empty()) {
-    bool waited = false;
-    auto extensions = osquery::split(FLAGS_extensions_require, ",");
-    for (const auto& extension : extensions) {
-      status = applyExtensionDelay(([extension, &waited](bool& stop) {
-        ExtensionList registered_extensions;
-        if (getExtensions(registered_extensions).ok()) {
-          for (const auto& existing : registered_extensions) {
-            if (existing.second.name == extension) {
-              return pingExtension(getExtensionSocket(existing.first));
-            }
+    // Required extensions start concurrently, they share a single timeout.
+    auto required = osquery::split(FLAGS_extensions_require, ",");
+    std::set<std::string> missing(required.begin(), required.end());
+    status = applyExtensionDelay(([&missing](bool& stop) {
+      ExtensionList registered_extensions;
+      if (getExtensions(registered_extensions).ok()) {
+        for (const auto& existing : registered_extensions) {
+          if (missing.count(existing.second.name) > 0 &&
+              pingExtension(getExtensionSocket(existing.first)).ok()) {
+            missing.erase(existing.second.name);
           }
         }
+      }
 
-        if (waited) {
-          // If we have already waited for the timeout period, stop early.
-          stop = true;
-        }
-        return Status(1, "Extension not autoloaded: " + extension);
-      }));
-
-      // A required extension was not loaded.
-      waited = true;
-      if (!status.ok()) {
-        LOG(WARNING) << status.getMessage();
-        return status;
+      if (missing.empty()) {
+        return Status(0, "OK");
       }
+      return Status(1, "Extension not autoloaded: " + *missing.begin());
+    }));
+
+    // A required extension was not loaded.
+    if (!status.ok()) {
+      LOG(WARNING) << status.getMessage();
+      return status;
     }
   }
 
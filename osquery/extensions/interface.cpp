@@ -8,18 +8,55 @@
  *
  */
 
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/metrics.h"
 #include "osquery/extensions/interface.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
+
+CLI_FLAG(uint64,
+         extensions_server_threads,
+         16,
+         "Threads serving extension API connections");
+
+CLI_FLAG(uint64,
+         extensions_server_queue,
+         256,
+         "Extension API connections waiting for a server thread");
+
+CLI_FLAG(uint64,
+         extensions_max_connections,
+         8,
+         "Extension manager connections one process may hold (0 = unlimited)");
+
+/**
+ * @brief Seconds an extension API connection may idle between calls.
+ *
+ * An idle connection holds a server thread. Clients keep connections open
+ * between calls, see --extensions_client_reuse, and open a new connection
+ * when a kept one was closed.
+ */
+const int kExtensionServerIdleTimeout = 1;
+
+/// The process of the extension manager connection served by this thread.
+static thread_local uint64_t kCurrentPeer{0};
+
 namespace extensions {
 
 const std::vector<std::string> kSDKVersionChanges = {
@@ -45,24 +82,94 @@ void ExtensionHandler::call(ExtensionResponse& _return,
     local_item = RegistryFactory::get().getActive(registry);
   }
 
+  // An ExtensionPluginRequest is the same map type as a PluginRequest.
   PluginResponse response;
-  PluginRequest plugin_request;
-  for (const auto& request_item : request) {
-    // Create a PluginRequest from an ExtensionPluginRequest.
-    plugin_request[request_item.first] = request_item.second;
-  }
-
-  auto status =
-      RegistryFactory::call(registry, local_item, plugin_request, response);
+  auto status = RegistryFactory::call(registry, local_item, request, response);
   _return.status.code = status.getCode();
   _return.status.message = status.getMessage();
   _return.status.uuid = uuid_;
   if (status.ok()) {
-    for (const auto& response_item : response) {
-      // Translate a PluginResponse to an ExtensionPluginResponse.
-      _return.response.push_back(response_item);
+    // Hand the rows to the Thrift response without copying each one.
+    _return.response = std::move(response);
+  }
+}
+
+void getInternalQueryContext(const QueryContext& context,
+                             InternalQueryContext& internal) {
+  for (const auto& column : context.constraints) {
+    InternalConstraintList list;
+    list.name = column.first;
+    list.affinity = columnTypeName(column.second.affinity);
+    for (const auto& constraint : column.second.getAll()) {
+      InternalConstraint item;
+      item.op = constraint.op;
+      item.expr = constraint.expr;
+      list.constraints.push_back(std::move(item));
+    }
+    internal.constraints.push_back(std::move(list));
+  }
+
+  if (context.colsUsed) {
+    internal.__set_colsUsed(std::vector<std::string>(
+        context.colsUsed->begin(), context.colsUsed->end()));
+  }
+
+  if (context.limit) {
+    internal.__set_limit(static_cast<int64_t>(*context.limit));
+  }
+
+  if (context.orderBy) {
+    internal.__set_orderBy(*context.orderBy);
+    internal.orderDescending = context.orderDescending;
+  }
+}
+
+void setQueryContext(const InternalQueryContext& internal,
+                     QueryContext& context) {
+  for (const auto& list : internal.constraints) {
+    auto& constraints = context.constraints[list.name];
+    for (const auto& item : list.constraints) {
+      Constraint constraint(static_cast<unsigned char>(item.op), item.expr);
+      constraints.add(constraint);
     }
+    constraints.affinity = columnTypeName(list.affinity);
   }
+
+  if (internal.__isset.colsUsed) {
+    context.colsUsed =
+        UsedColumns(internal.colsUsed.begin(), internal.colsUsed.end());
+  }
+
+  if (internal.__isset.limit && internal.limit >= 0) {
+    context.limit = static_cast<size_t>(internal.limit);
+  }
+
+  if (internal.__isset.orderBy) {
+    context.orderBy = internal.orderBy;
+    context.orderDescending = internal.orderDescending;
+  }
+}
+
+void ExtensionHandler::generate(ExtensionResponse& _return,
+                                const std::string& table,
+                                const InternalQueryContext& context) {
+  _return.status.uuid = uuid_;
+  std::shared_ptr<TablePlugin> table_plugin = nullptr;
+  if (RegistryFactory::get().exists("table", table, true)) {
+    auto plugin = RegistryFactory::get().plugin("table", table);
+    table_plugin = std::dynamic_pointer_cast<TablePlugin>(plugin);
+  }
+  if (table_plugin == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Cannot generate table: " + table;
+    return;
+  }
+
+  QueryContext query_context;
+  setQueryContext(context, query_context);
+  _return.response = table_plugin->generate(query_context);
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
 }
 
 void ExtensionHandler::shutdown() {
@@ -140,8 +247,14 @@ void ExtensionManagerHandler::registerExtension(
     return;
   }
 
-  WriteLock lock(extensions_mutex_);
-  extensions_[uuid] = info;
+  // Calls from the extension's process are labeled with its name.
+  ExtensionPeers::get().setName(kCurrentPeer, uuid, info.name);
+
+  {
+    WriteLock lock(extensions_mutex_);
+    extensions_[uuid] = info;
+  }
+  notifyExtensionRegistered();
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "OK";
   _return.uuid = uuid;
@@ -161,6 +274,7 @@ void ExtensionManagerHandler::deregisterExtension(
 
   // On success return the uuid of the now de-registered extension.
   RegistryFactory::get().removeBroadcast(uuid);
+  ExtensionPeers::get().removeName(uuid);
 
   WriteLock lock(extensions_mutex_);
   extensions_.erase(uuid);
@@ -214,6 +328,7 @@ void ExtensionManagerHandler::refresh() {
   // Remove each from the manager's list of extension metadata.
   for (const auto& uuid : removed_routes) {
     extensions_.erase(uuid);
+    ExtensionPeers::get().removeName(uuid);
   }
 }
 
@@ -231,6 +346,67 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
 }
 }
 
+ExtensionPeers& ExtensionPeers::get() {
+  static ExtensionPeers peers;
+  return peers;
+}
+
+bool ExtensionPeers::acquire(uint64_t pid, size_t limit) {
+  if (pid == 0) {
+    return true;
+  }
+
+  WriteLock lock(mutex_);
+  auto& count = connections_[pid];
+  if (limit > 0 && count >= limit) {
+    return false;
+  }
+  count++;
+  return true;
+}
+
+void ExtensionPeers::release(uint64_t pid) {
+  WriteLock lock(mutex_);
+  auto count = connections_.find(pid);
+  if (count != connections_.end() && --count->second == 0) {
+    connections_.erase(count);
+  }
+}
+
+size_t ExtensionPeers::connections(uint64_t pid) {
+  WriteLock lock(mutex_);
+  auto count = connections_.find(pid);
+  return (count == connections_.end()) ? 0 : count->second;
+}
+
+void ExtensionPeers::setName(uint64_t pid,
+                             RouteUUID uuid,
+                             const std::string& name) {
+  if (pid == 0) {
+    return;
+  }
+
+  WriteLock lock(mutex_);
+  names_[pid] = std::make_pair(uuid, name);
+}
+
+void ExtensionPeers::removeName(RouteUUID uuid) {
+  WriteLock lock(mutex_);
+  for (auto it = names_.begin(); it != names_.end();) {
+    if (it->second.first == uuid) {
+      it = names_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::string ExtensionPeers::getName(uint64_t pid) {
+  WriteLock lock(mutex_);
+  auto name = names_.find(pid);
+  return (name == names_.end()) ? "unknown" : name->second.second;
+}
+
 ExtensionRunnerCore::~ExtensionRunnerCore() {
   remove(path_);
 }
@@ -259,7 +435,124 @@ inline void removeStalePaths(const std::string& manager) {
   }
 }
 
-void ExtensionRunnerCore::startServer(TProcessorRef processor) {
+/// The process ID of a connection's peer, 0 if it is unknown.
+static uint64_t getPeerProcess(const TProtocolRef& input) {
+#if defined(__linux__) || defined(__APPLE__)
+  auto buffered = OSQUERY_THRIFT_POINTER::dynamic_pointer_cast<
+      TBufferedTransport>(input->getTransport());
+  if (buffered == nullptr) {
+    return 0;
+  }
+  auto socket = OSQUERY_THRIFT_POINTER::dynamic_pointer_cast<TSocket>(
+      buffered->getUnderlyingTransport());
+  if (socket == nullptr) {
+    return 0;
+  }
+
+#ifdef __linux__
+  struct ucred credentials;
+  socklen_t size = sizeof(credentials);
+  if (getsockopt(socket->getSocketFD(),
+                 SOL_SOCKET,
+                 SO_PEERCRED,
+                 &credentials,
+                 &size) == 0) {
+    return static_cast<uint64_t>(credentials.pid);
+  }
+#else
+  pid_t pid = 0;
+  socklen_t size = sizeof(pid);
+  if (getsockopt(
+          socket->getSocketFD(), SOL_LOCAL, LOCAL_PEERPID, &pid, &size) == 0) {
+    return static_cast<uint64_t>(pid);
+  }
+#endif
+#endif
+  return 0;
+}
+
+/// A connection to the extension manager.
+struct ExtensionConnection {
+  uint64_t pid{0};
+};
+
+/// A call of a connection to the extension manager.
+struct ExtensionCall {
+  uint64_t pid{0};
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * @brief Limit the connections of each process to the extension manager.
+ *
+ * A connection beyond the limit is closed before its first call is read, the
+ * client's call fails instead of waiting for the process's other calls.
+ */
+class ExtensionPeerHandler : public TServerEventHandler {
+ public:
+  void* createContext(TProtocolRef input,
+                      TProtocolRef /* output */) override {
+    auto pid = getPeerProcess(input);
+    auto limit = static_cast<size_t>(FLAGS_extensions_max_connections);
+    if (!ExtensionPeers::get().acquire(pid, limit)) {
+      static auto& refused =
+          getMetricCounter("extensions_refused_connections");
+      refused.add();
+      VLOG(1) << "Refusing extension connection from process " << pid << " ("
+              << ExtensionPeers::get().getName(pid) << ")";
+      input->getTransport()->close();
+      return nullptr;
+    }
+
+    kCurrentPeer = pid;
+    auto connection = new ExtensionConnection();
+    connection->pid = pid;
+    return connection;
+  }
+
+  void deleteContext(void* context,
+                     TProtocolRef /* input */,
+                     TProtocolRef /* output */) override {
+    auto connection = static_cast<ExtensionConnection*>(context);
+    if (connection != nullptr) {
+      ExtensionPeers::get().release(connection->pid);
+      delete connection;
+    }
+    kCurrentPeer = 0;
+  }
+};
+
+/// Measure the latency of each call to the extension manager.
+class ExtensionCallHandler : public TProcessorEventHandler {
+ public:
+  void* getContext(const char* /* fn_name */, void* server_context) override {
+    auto call = new ExtensionCall();
+    auto connection = static_cast<ExtensionConnection*>(server_context);
+    call->pid = (connection != nullptr) ? connection->pid : 0;
+    call->start = std::chrono::steady_clock::now();
+    return call;
+  }
+
+  void freeContext(void* ctx, const char* fn_name) override {
+    auto call = static_cast<ExtensionCall*>(ctx);
+    if (call == nullptr) {
+      return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - call->start);
+    MetricLabels labels = {
+        {"extension", ExtensionPeers::get().getName(call->pid)},
+        {"method", fn_name},
+    };
+    getMetricHistogram("extensions_call_microseconds", labels)
+        .record(static_cast<uint64_t>(elapsed.count()));
+    delete call;
+  }
+};
+
+void ExtensionRunnerCore::startServer(TProcessorRef processor,
+                                      bool limit_peers) {
   {
     WriteLock lock(service_start_);
     // A request to stop the service may occur before the thread starts.
@@ -267,7 +560,14 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
       return;
     }
 
+#ifndef WIN32
+    auto socket = new TPlatformServerSocket(path_);
+    // Idle connections are closed, each holds one of the server's threads.
+    socket->setRecvTimeout(kExtensionServerIdleTimeout * 1000);
+    transport_ = TServerTransportRef(socket);
+#else
     transport_ = TServerTransportRef(new TPlatformServerSocket(path_));
+#endif
 
     if (!isPlatform(PlatformType::TYPE_WINDOWS)) {
       // Before starting and after stopping the manager, remove stale sockets.
@@ -276,15 +576,37 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     }
 
     // Construct the service's transport, protocol, thread pool.
-    auto transport_fac = TTransportFactoryRef(new TBufferedTransportFactory());
+    auto transport_fac = TTransportFactoryRef(new ExtensionTransportFactory());
     auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
 
+    // Connections are served by a fixed set of threads, later connections
+    // wait in a bounded queue.
+    auto threads = std::max<uint64_t>(FLAGS_extensions_server_threads, 1);
+    thread_manager_ = ThreadManager::newSimpleThreadManager(
+        static_cast<size_t>(threads),
+        static_cast<size_t>(FLAGS_extensions_server_queue));
+    thread_manager_->threadFactory(
+        TThreadFactoryRef(new PlatformThreadFactory()));
+    thread_manager_->start();
+
+    if (limit_peers) {
+      processor->setEventHandler(
+          TProcessorEventHandlerRef(new ExtensionCallHandler()));
+    }
+
     // Start the Thrift server's run loop.
-    server_ = TThreadedServerRef(new TThreadedServer(
-        processor, transport_, transport_fac, protocol_fac));
+    server_ = TThreadPoolServerRef(new TThreadPoolServer(
+        processor, transport_, transport_fac, protocol_fac, thread_manager_));
+    if (limit_peers) {
+      server_->setServerEventHandler(
+          TServerEventHandlerRef(new ExtensionPeerHandler()));
+    }
   }
 
   server_->serve();
+
+  // Connections still being served finish, at most after the idle timeout.
+  thread_manager_->stop();
 }
 
 void ExtensionRunner::start() {
@@ -316,7 +638,7 @@ void ExtensionManagerRunner::start() {
 
   VLOG(1) << "Extension manager service starting: " << path_;
   try {
-    startServer(processor);
+    startServer(processor, true);
   } catch (const std::exception& e) {
     LOG(WARNING) << "Extensions disabled: cannot start extension manager ("
                  << path_ << ") (" << e.what() << ")";
@@ -32,7 +32,7 @@
 // paths for their includes. Unfortunately, changing include paths is not
 // possible in every build system.
 // clang-format off
-#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
+#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadPoolServer.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
 
 #ifdef WIN32
@@ -44,6 +44,7 @@
 #endif
 
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TBufferTransports.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/PlatformThreadFactory.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/ThreadManager.h)
 
 // Include intermediate Thrift-generated interface definitions.
@@ -80,12 +81,33 @@ typedef SHARED_PTR_IMPL<TServerTransport> TServerTransportRef;
 typedef SHARED_PTR_IMPL<TTransportFactory> TTransportFactoryRef;
 typedef SHARED_PTR_IMPL<TProtocolFactory> TProtocolFactoryRef;
 typedef SHARED_PTR_IMPL<ThreadManager> TThreadManagerRef;
+typedef SHARED_PTR_IMPL<PlatformThreadFactory> TThreadFactoryRef;
+typedef SHARED_PTR_IMPL<TServerEventHandler> TServerEventHandlerRef;
+typedef SHARED_PTR_IMPL<TProcessorEventHandler> TProcessorEventHandlerRef;
 
 #ifndef WIN32
 typedef SHARED_PTR_IMPL<PosixThreadFactory> PosixThreadFactoryRef;
 #endif
 
-using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
+using TThreadPoolServerRef = std::shared_ptr<TThreadPoolServer>;
+
+/**
+ * @brief Size of the read and write buffers for extension socket transports.
+ *
+ * Table responses and logger requests are often many kilobytes. The Thrift
+ * default of 512 bytes results in a socket read or write for every few rows.
+ * The buffer size is not part of the wire format, either side may differ.
+ */
+const uint32_t kExtensionBufferSize = 64 * 1024;
+
+/// A buffered transport factory using the extensions buffer size.
+class ExtensionTransportFactory : public TTransportFactory {
+ public:
+  TTransportRef getTransport(TTransportRef transport) override {
+    return TTransportRef(
+        new TBufferedTransport(transport, kExtensionBufferSize));
+  }
+};
 
 namespace extensions {
 
@@ -118,6 +140,20 @@ class ExtensionHandler : virtual public ExtensionIf {
             const std::string& item,
             const ExtensionPluginRequest& request);
 
+  /**
+   * @brief The Thrift API used to generate the rows of a table plugin.
+   *
+   * This is the structured equivalent of a table "generate" call, the query
+   * context is not serialized as JSON.
+   *
+   * @param _return The return response (combo Status and QueryData).
+   * @param table The table plugin name.
+   * @param context The query context given to the table.
+   */
+  void generate(ExtensionResponse& _return,
+                const std::string& table,
+                const InternalQueryContext& context);
+
   /// Request an extension to shutdown.
   void shutdown();
 
@@ -234,6 +270,14 @@ class ExtensionManagerHandler : virtual public ExtensionManagerIf,
   Mutex extensions_mutex_;
 };
 
+/// Convert a QueryContext into the Thrift-internal query context.
+void getInternalQueryContext(const QueryContext& context,
+                             InternalQueryContext& internal);
+
+/// Fill a QueryContext from the Thrift-internal query context.
+void setQueryContext(const InternalQueryContext& internal,
+                     QueryContext& context);
+
 typedef SHARED_PTR_IMPL<ExtensionHandler> ExtensionHandlerRef;
 typedef SHARED_PTR_IMPL<ExtensionManagerHandler> ExtensionManagerHandlerRef;
 }
@@ -286,6 +330,51 @@ class ExtensionManagerWatcher : public ExtensionWatcher {
   std::map<RouteUUID, size_t> failures_;
 };
 
+/**
+ * @brief The processes connected to the extension manager.
+ *
+ * Each thread of the manager's server serves one connection at a time. A
+ * process may hold up to --extensions_max_connections connections, so an
+ * extension making many calls cannot occupy every thread. Processes are
+ * known by the peer of their socket, where the platform reports it.
+ */
+class ExtensionPeers : private boost::noncopyable {
+ public:
+  static ExtensionPeers& get();
+
+  /**
+   * @brief Count a connection from a process.
+   *
+   * @param pid the process, 0 if it is unknown and not limited
+   * @param limit the process's connection limit, 0 for no limit
+   * @return false if the process already holds its limit
+   */
+  bool acquire(uint64_t pid, size_t limit);
+
+  /// Remove a connection counted by acquire.
+  void release(uint64_t pid);
+
+  /// The number of connections from a process.
+  size_t connections(uint64_t pid);
+
+  /// Name the process of a registered extension, used to label metrics.
+  void setName(uint64_t pid, RouteUUID uuid, const std::string& name);
+
+  /// Forget the name of a removed extension.
+  void removeName(RouteUUID uuid);
+
+  /// The extension name of a process, or "unknown".
+  std::string getName(uint64_t pid);
+
+ private:
+  std::map<uint64_t, size_t> connections_;
+
+  /// The route UUID and name of each registered extension's process.
+  std::map<uint64_t, std::pair<RouteUUID, std::string>> names_;
+
+  Mutex mutex_;
+};
+
 class ExtensionRunnerCore : public InternalRunnable {
  public:
   virtual ~ExtensionRunnerCore();
@@ -293,8 +382,14 @@ class ExtensionRunnerCore : public InternalRunnable {
       : path_(path), server_(nullptr) {}
 
  public:
-  /// Given a handler transport and protocol start a thrift threaded server.
-  void startServer(TProcessorRef processor);
+  /**
+   * @brief Given a handler transport and protocol start a thread pool server.
+   *
+   * @param processor the Thrift handler's processor
+   * @param limit_peers limit the connections of each process and measure
+   * the latency of their calls, used by the extension manager
+   */
+  void startServer(TProcessorRef processor, bool limit_peers = false);
 
   // The Dispatcher thread service stop point.
   void stop();
@@ -307,7 +402,10 @@ class ExtensionRunnerCore : public InternalRunnable {
   TServerTransportRef transport_{nullptr};
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadedServerRef server_{nullptr};
+  TThreadPoolServerRef server_{nullptr};
+
+  /// The server's threads, stopped after the server.
+  TThreadManagerRef thread_manager_{nullptr};
 
   /// Protect the service start and stop, this mutex protects server creation.
   Mutex service_start_;
@@ -366,7 +464,7 @@ class EXInternal {
  public:
   explicit EXInternal(const std::string& path)
       : socket_(new TPlatformSocket(path)),
-        transport_(new TBufferedTransport(socket_)),
+        transport_(new TBufferedTransport(socket_, kExtensionBufferSize)),
         protocol_(new TBinaryProtocol(transport_)) {}
 
   virtual ~EXInternal() {
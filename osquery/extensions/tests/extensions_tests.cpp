@@ -13,6 +13,7 @@
 #define GTEST_HAS_TR1_TUPLE 0
 #endif
 
+#include <chrono>
 #include <stdexcept>
 
 #include <gtest/gtest.h>
@@ -23,6 +24,7 @@
 #include "osquery/core/process.h"
 #include "osquery/extensions/interface.h"
 #include "osquery/filesystem/fileops.h"
+#include "osquery/sql/sqlite_util.h"
 #include "osquery/tests/test_util.h"
 
 using namespace osquery::extensions;
@@ -172,6 +174,38 @@ TEST_F(ExtensionsTest, test_extension_start) {
   rf.allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_extension_autoload_pending) {
+  // A worker expects the registrations its watcher hints.
+  setEnvVar("OSQUERY_EXTENSIONS", "1");
+  auto status = startExtensionManager(socket_path);
+  unsetEnvVar("OSQUERY_EXTENSIONS");
+  ASSERT_TRUE(status.ok());
+  EXPECT_TRUE(socketExistsLocal(socket_path));
+  EXPECT_TRUE(extensionsPending());
+
+  // Tables created by the query and names no plugin has are not waited for.
+  auto start = std::chrono::steady_clock::now();
+  auto dbc = SQLiteDBManager::getUnique(true);
+  dbc->attachReferencedTables(
+      "CREATE TEMP TABLE created_here(v); SELECT * FROM created_here", true);
+  dbc->attachReferencedTables("SELECT * FROM \"not a plugin\"", true);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+  EXPECT_TRUE(extensionsPending());
+
+  auto& rf = RegistryFactory::get();
+  rf.allowDuplicates(true);
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "9.9.9");
+  ASSERT_TRUE(status.ok());
+  RouteUUID uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+
+  // Once every expected extension registered, missing tables do not wait.
+  EXPECT_FALSE(extensionsPending());
+  EXPECT_FALSE(waitForExtensionTable("not_an_extension_table"));
+
+  rf.removeBroadcast(uuid);
+  rf.allowDuplicates(false);
+}
+
 class ExtensionPlugin : public Plugin {
  public:
   Status call(const PluginRequest& request, PluginResponse& response) {
@@ -256,10 +290,107 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   EXPECT_EQ(response.size(), 1U);
   EXPECT_EQ(response[0]["test_key"], "test_value");
 
+  // The client used by the call is kept open for the next call.
+  EXPECT_EQ(getIdleExtensionClients(ext_socket), 1U);
+  response.clear();
+  status = callExtension(ext_socket,
+                         "extension_test",
+                         "test_alias",
+                         {{"test_key", "test_value"}},
+                         response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 1U);
+  EXPECT_EQ(getIdleExtensionClients(ext_socket), 1U);
+
+  // Responses are appended to a non-empty response.
+  status = callExtension(ext_socket,
+                         "extension_test",
+                         "test_alias",
+                         {{"test_key", "test_value"}},
+                         response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 2U);
+
+  resetExtensionClients(ext_socket);
+  EXPECT_EQ(getIdleExtensionClients(ext_socket), 0U);
+
   rf.removeBroadcast(uuid);
   rf.allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_query_context_conversion) {
+  QueryContext context;
+  context.constraints["pid"].affinity = INTEGER_TYPE;
+  context.constraints["pid"].add(Constraint(EQUALS, "1"));
+  context.constraints["pid"].add(Constraint(GREATER_THAN, "10"));
+  context.constraints["path"].add(Constraint(LIKE, "/bin/%"));
+  context.colsUsed = UsedColumns({"pid", "path"});
+  context.limit = 5;
+  context.orderBy = std::string("pid");
+  context.orderDescending = true;
+
+  // The structured context carries the same content as the JSON context.
+  extensions::InternalQueryContext internal;
+  getInternalQueryContext(context, internal);
+  EXPECT_EQ(internal.constraints.size(), 2U);
+
+  QueryContext result;
+  setQueryContext(internal, result);
+  EXPECT_EQ(result.constraints["pid"].affinity, INTEGER_TYPE);
+  EXPECT_EQ(result.constraints["pid"].getAll(EQUALS),
+            std::set<std::string>({"1"}));
+  EXPECT_EQ(result.constraints["pid"].getAll(GREATER_THAN),
+            std::set<std::string>({"10"}));
+  EXPECT_EQ(result.constraints["path"].getAll(LIKE),
+            std::set<std::string>({"/bin/%"}));
+  ASSERT_TRUE(result.colsUsed);
+  EXPECT_EQ(*result.colsUsed, *context.colsUsed);
+  ASSERT_TRUE(result.limit);
+  EXPECT_EQ(*result.limit, 5U);
+  ASSERT_TRUE(result.orderBy);
+  EXPECT_EQ(*result.orderBy, "pid");
+  EXPECT_TRUE(result.orderDescending);
+
+  // Optional members are not set for an unconstrained context.
+  extensions::InternalQueryContext empty;
+  getInternalQueryContext(QueryContext(), empty);
+  EXPECT_FALSE(empty.__isset.colsUsed);
+  EXPECT_FALSE(empty.__isset.limit);
+  EXPECT_FALSE(empty.__isset.orderBy);
+}
+
+TEST_F(ExtensionsTest, test_extension_peer_limits) {
+  auto& peers = ExtensionPeers::get();
+  EXPECT_TRUE(peers.acquire(1001, 2));
+  EXPECT_TRUE(peers.acquire(1001, 2));
+  EXPECT_EQ(peers.connections(1001), 2U);
+
+  // A process at its limit is refused, other processes are not.
+  EXPECT_FALSE(peers.acquire(1001, 2));
+  EXPECT_TRUE(peers.acquire(1002, 2));
+  peers.release(1001);
+  EXPECT_TRUE(peers.acquire(1001, 2));
+
+  // Unknown processes and a limit of 0 are not limited.
+  EXPECT_TRUE(peers.acquire(0, 1));
+  EXPECT_TRUE(peers.acquire(0, 1));
+  EXPECT_TRUE(peers.acquire(1002, 0));
+
+  peers.release(1001);
+  peers.release(1001);
+  peers.release(1002);
+  peers.release(1002);
+  EXPECT_EQ(peers.connections(1001), 0U);
+  EXPECT_EQ(peers.connections(1002), 0U);
+
+  // Registered extensions name their process until they are removed.
+  EXPECT_EQ(peers.getName(1001), "unknown");
+  peers.setName(1001, 42, "example");
+  EXPECT_EQ(peers.getName(1001), "example");
+  peers.removeName(42);
+  EXPECT_EQ(peers.getName(1001), "unknown");
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   EXPECT_FALSE(loadModules(kFakeDirectory + "/root.txt"));
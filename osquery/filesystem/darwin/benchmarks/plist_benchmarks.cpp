@@ -13,6 +13,7 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/tests/test_util.h"
@@ -22,6 +23,8 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(plist_cache_max_bytes);
+
 static void PLIST_parse_content(benchmark::State& state) {
   // Buffer the plist content into memory.
   std::string content;
@@ -35,12 +38,34 @@ static void PLIST_parse_content(benchmark::State& state) {
 
 BENCHMARK(PLIST_parse_content);
 
-static void PLIST_parse_file(benchmark::State& state) {
+/// Parse a file for each iteration, with or without the cache.
+static void benchmarkParseFile(benchmark::State& state,
+                               const std::string& path,
+                               bool cached) {
+  auto cache_max = FLAGS_plist_cache_max_bytes;
+  FLAGS_plist_cache_max_bytes = (cached) ? cache_max : 0;
   while (state.KeepRunning()) {
     pt::ptree tree;
-    auto status = parsePlist(kTestDataPath + "test.plist", tree);
+    auto status = parsePlist(path, tree);
   }
+  FLAGS_plist_cache_max_bytes = cache_max;
+}
+
+static void PLIST_parse_file(benchmark::State& state) {
+  benchmarkParseFile(state, kTestDataPath + "test.plist", false);
 }
 
 BENCHMARK(PLIST_parse_file);
+
+static void PLIST_parse_file_binary(benchmark::State& state) {
+  benchmarkParseFile(state, kTestDataPath + "test_binary.plist", false);
+}
+
+BENCHMARK(PLIST_parse_file_binary);
+
+static void PLIST_parse_file_cached(benchmark::State& state) {
+  benchmarkParseFile(state, kTestDataPath + "test.plist", true);
+}
+
+BENCHMARK(PLIST_parse_file_cached);
 }
@@ -8,22 +8,38 @@
  *
  */
 
+#include <list>
+#include <map>
 #include <sstream>
 
+#include <sys/stat.h>
+
 #import <Foundation/Foundation.h>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/memory.h"
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+FLAG(uint64,
+     plist_cache_max_bytes,
+     8 * 1024 * 1024,
+     "Memory budget for parsed property lists (0 disables the cache)");
+
+/// The first bytes of a binary property list.
+const std::string kBinaryPlistMagic = "bplist00";
+
 /**
  * @brief Filter selected data types from deserialized property list.
  *
@@ -141,29 +157,191 @@ static inline Status filterPlist(NSData* plist, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status parsePlistContent(const std::string& content, pt::ptree& tree) {
-  tree.clear();
+/**
+ * @brief Parse property list content from memory.
+ *
+ * The content is not copied into the data object. Binary property lists,
+ * the format of most preferences and caches, are decoded from the buffer
+ * without their format being guessed.
+ */
+static Status parsePlistBuffer(const std::string& content, pt::ptree& tree) {
   @autoreleasepool {
-    id data = [NSData dataWithBytes:content.c_str() length:content.size()];
+    id data = [NSData dataWithBytesNoCopy:(void*)content.data()
+                                   length:content.size()
+                             freeWhenDone:NO];
     if (data == nil) {
       return Status(1, "Unable to create plist content");
     }
 
-    // Read file content into a data object, containing potential plist data.
     NSError* error = nil;
-    id plist_data = [NSPropertyListSerialization
-        propertyListWithData:data
-                     options:NSPropertyListImmutable
-                      format:NULL
-                       error:&error];
+    id plist_data = nil;
+    if (content.compare(0, kBinaryPlistMagic.size(), kBinaryPlistMagic) == 0) {
+      auto ref = CFPropertyListCreateWithData(kCFAllocatorDefault,
+                                              (__bridge CFDataRef)data,
+                                              kCFPropertyListImmutable,
+                                              nullptr,
+                                              nullptr);
+      plist_data = CFBridgingRelease(ref);
+    }
     if (plist_data == nil) {
-      std::string error_message([[error localizedFailureReason] UTF8String]);
+      plist_data = [NSPropertyListSerialization
+          propertyListWithData:data
+                       options:NSPropertyListImmutable
+                        format:NULL
+                         error:&error];
+    }
+    if (plist_data == nil) {
+      std::string error_message = "Unable to parse plist content";
+      if (error != nil && [error localizedFailureReason] != nil) {
+        error_message = [[error localizedFailureReason] UTF8String];
+      }
       VLOG(1) << error_message;
       return Status(1, error_message);
     }
-    // Parse the plist data into a core foundation dictionary-literal.
-    return filterPlist(plist_data, tree);
+
+    @try {
+      // Parse the plist data into a core foundation dictionary-literal.
+      return filterPlist(plist_data, tree);
+    } @catch (NSException* exception) {
+      return Status(1, "Plist data is corrupted");
+    }
+  }
+}
+
+/// The approximate memory held by a property tree.
+static size_t getTreeBytes(const pt::ptree& tree) {
+  size_t bytes = sizeof(pt::ptree) + tree.data().size();
+  for (const auto& child : tree) {
+    bytes += child.first.size() + getTreeBytes(child.second);
   }
+  return bytes;
+}
+
+/**
+ * @brief A process-wide cache of parsed property lists.
+ *
+ * Tables such as apps and launchd parse the same files for every query. A
+ * parsed file is reused while its inode, modification time, and size are
+ * unchanged. The least recently used files are evicted when the cache grows
+ * beyond --plist_cache_max_bytes or its share of the memory budget.
+ */
+class PlistCache : private boost::noncopyable {
+ public:
+  PlistCache() {
+    registerMemoryConsumer("plist_cache",
+                           1,
+                           ([this]() { return bytes(); }),
+                           ([this](size_t target) { shrink(target); }));
+  }
+
+  /// Copy the parsed content of an unchanged file into a tree.
+  bool get(const std::string& path, const struct stat& file, pt::ptree& tree) {
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(path);
+    if (entry == entries_.end()) {
+      return false;
+    }
+
+    if (!matches(entry->second, file)) {
+      erase(entry);
+      return false;
+    }
+
+    // Move the file to the most recently used position.
+    lru_.splice(lru_.end(), lru_, entry->second.position);
+    tree = entry->second.tree;
+    return true;
+  }
+
+  /// Add or replace the parsed content of a file.
+  void set(const std::string& path,
+           const struct stat& file,
+           const pt::ptree& tree) {
+    auto bytes = path.size() + getTreeBytes(tree);
+
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(path);
+    if (entry != entries_.end()) {
+      erase(entry);
+    }
+
+    if (bytes > FLAGS_plist_cache_max_bytes) {
+      // This file would evict every other file and still not fit.
+      return;
+    }
+
+    auto& added = entries_[path];
+    added.tree = tree;
+    added.inode = file.st_ino;
+    added.mtime = file.st_mtimespec;
+    added.size = file.st_size;
+    added.bytes = bytes;
+    added.position = lru_.insert(lru_.end(), path);
+    bytes_ += bytes;
+    evict(FLAGS_plist_cache_max_bytes);
+  }
+
+  /// The total size of the cached trees.
+  size_t bytes() {
+    WriteLock lock(mutex_);
+    return bytes_;
+  }
+
+  /// Evict the least recently used files until the cache fits a size.
+  void shrink(size_t target) {
+    WriteLock lock(mutex_);
+    evict(target);
+  }
+
+ private:
+  struct Entry {
+    pt::ptree tree;
+    ino_t inode{0};
+    struct timespec mtime;
+    off_t size{0};
+    size_t bytes{0};
+    std::list<std::string>::iterator position;
+  };
+
+  static bool matches(const Entry& entry, const struct stat& file) {
+    return entry.inode == file.st_ino && entry.size == file.st_size &&
+           entry.mtime.tv_sec == file.st_mtimespec.tv_sec &&
+           entry.mtime.tv_nsec == file.st_mtimespec.tv_nsec;
+  }
+
+  void evict(size_t target) {
+    while (bytes_ > target && !lru_.empty()) {
+      erase(entries_.find(lru_.front()));
+    }
+  }
+
+  void erase(std::map<std::string, Entry>::iterator entry) {
+    bytes_ -= entry->second.bytes;
+    lru_.erase(entry->second.position);
+    entries_.erase(entry);
+  }
+
+ private:
+  /// Parsed content for each path.
+  std::map<std::string, Entry> entries_;
+
+  /// Paths ordered from least to most recently used.
+  std::list<std::string> lru_;
+
+  /// Total size of the cached trees.
+  size_t bytes_{0};
+
+  Mutex mutex_;
+};
+
+static PlistCache& getPlistCache() {
+  static PlistCache cache;
+  return cache;
+}
+
+Status parsePlistContent(const std::string& content, pt::ptree& tree) {
+  tree.clear();
+  return parsePlistBuffer(content, tree);
 }
 
 Status parsePlist(const fs::path& path, pt::ptree& tree) {
@@ -172,40 +350,28 @@ Status parsePlist(const fs::path& path, pt::ptree& tree) {
   auto dropper = DropPrivileges::get();
   dropper->dropToParent(path);
 
+  // The read check applies to cached files too, with the dropped privileges.
   auto status = readFile(path);
   if (!status.ok()) {
     return status;
   }
 
-  @autoreleasepool {
-    id ns_path = [NSString stringWithUTF8String:path.string().c_str()];
-    id stream = [NSInputStream inputStreamWithFileAtPath:ns_path];
-    if (stream == nil) {
-      return Status(1, "Unable to read plist: " + path.string());
-    }
+  struct stat file;
+  bool cached = (FLAGS_plist_cache_max_bytes > 0 &&
+                 stat(path.string().c_str(), &file) == 0);
+  if (cached && getPlistCache().get(path.string(), file, tree)) {
+    return Status(0, "OK");
+  }
 
-    // Read file content into a data object, containing potential plist data.
-    NSError* error = nil;
-    [stream open];
-    id plist_data = [NSPropertyListSerialization propertyListWithStream:stream
-                                                                options:0
-                                                                 format:NULL
-                                                                  error:&error];
-    if (plist_data == nil) {
-      // The most common error is lack of read permissions.
-      std::string error_message([[error localizedFailureReason] UTF8String]);
-      VLOG(1) << error_message;
-      [stream close];
-      return Status(1, error_message);
-    }
+  std::string content;
+  status = readFile(path, content);
+  if (!status.ok()) {
+    return Status(1, "Unable to read plist: " + path.string());
+  }
 
-    @try {
-      // Parse the plist data into a core foundation dictionary-literal.
-      status = filterPlist(plist_data, tree);
-    } @catch (NSException* exception) {
-      status = Status(1, "Plist data is corrupted");
-    }
-    [stream close];
+  status = parsePlistBuffer(content, tree);
+  if (status.ok() && cached) {
+    getPlistCache().set(path.string(), file, tree);
   }
   return status;
 }
@@ -13,6 +13,7 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
@@ -25,6 +26,8 @@ char* argv0;
 
 namespace osquery {
 
+DECLARE_uint64(plist_cache_max_bytes);
+
 class PlistTests : public testing::Test {};
 
 TEST_F(PlistTests, test_parse_plist_content) {
@@ -102,4 +105,36 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_parse_plist_cached) {
+  std::string content;
+  ASSERT_TRUE(readFile(kTestDataPath + "test.plist", content).ok());
+  auto path = kTestWorkingDirectory + "cached.plist";
+  ASSERT_TRUE(writeTextFile(path, content).ok());
+
+  pt::ptree tree;
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd");
+
+  // The cached content is returned as a copy.
+  pt::ptree cached;
+  tree.put("Label", "changed");
+  ASSERT_TRUE(parsePlist(path, cached).ok());
+  EXPECT_EQ(cached.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd");
+
+  // A changed file is parsed again.
+  ASSERT_TRUE(readFile(kTestDataPath + "test_binary.plist", content).ok());
+  ASSERT_TRUE(writeTextFile(path, content).ok());
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.count("Label"), 0U);
+  EXPECT_EQ(tree.get<std::string>("SessionItems.Controller"),
+            "CustomListItems");
+
+  // Without a cache the file is parsed for each call.
+  auto cache_max = FLAGS_plist_cache_max_bytes;
+  FLAGS_plist_cache_max_bytes = 0;
+  EXPECT_TRUE(parsePlist(path, tree).ok());
+  FLAGS_plist_cache_max_bytes = cache_max;
+  fs::remove(path);
+}
 }
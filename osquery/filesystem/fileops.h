@@ -273,6 +273,22 @@ bool platformChmod(const std::string& path, mode_t perms);
  */
 std::vector<std::string> platformGlob(const std::string& find_path);
 
+#ifndef WIN32
+/**
+ * @brief List the non-hidden entries of each directory.
+ *
+ * The result equals platformGlob of each directory followed by "*", sorted
+ * as one glob. Directories, including links to directories, are marked with a
+ * trailing '/'. This expands one level of a recursive pattern.
+ *
+ * @param directories the directories, each ending with a '/'
+ * @param threads the maximum number of threads listing directories
+ * @return The sorted entries.
+ */
+std::vector<std::string> platformGlobChildren(
+    const std::vector<std::string>& directories, size_t threads);
+#endif
+
 /**
  * @brief Checks to see if the current user has the permissions to perform a
  *        specified operation on a file.
@@ -8,6 +8,7 @@
  *
  */
 
+#include <atomic>
 #include <sstream>
 
 #include <fcntl.h>
@@ -16,7 +17,9 @@
 #ifndef WIN32
 #include <glob.h>
 #include <pwd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
 #include <boost/algorithm/string.hpp>
@@ -24,6 +27,7 @@
 #include <boost/filesystem/operations.hpp>
 
 #include <osquery/core.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
@@ -47,6 +51,30 @@ HIDDEN_FLAG(bool, allow_unsafe, false, "Allow unsafe executable permissions");
 /// Disable forensics (atime/mtime preserving) file reads.
 HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
+/// Read a recorded or synthetic host's system paths, see getHostPath.
+HIDDEN_FLAG(string,
+            host_root,
+            "",
+            "Prefix of the system paths read by tables, such as /proc");
+
+FLAG(bool,
+     read_mapped,
+     false,
+     "Map files read by table parsers instead of copying them");
+
+FLAG(uint64,
+     read_threads,
+     4,
+     "Max threads reading files concurrently for multi-file tables");
+
+/// Minimum number of files read by each readFiles thread.
+const size_t kReadFilesPerThread = 16;
+
+FLAG(uint64,
+     glob_threads,
+     4,
+     "Max threads listing directories for recursive (%%) patterns");
+
 static const size_t kMaxRecursiveGlobs = 64;
 
 Status writeTextFile(const fs::path& path,
@@ -109,10 +137,12 @@ Status readFile(const fs::path& path,
   }
 
   // Apply the max byte-read based on file/link target ownership.
+  // The ownership is only inspected if the file exceeds the user limit.
   off_t read_max =
-      static_cast<off_t>((handle.fd->isOwnerRoot().ok())
-                             ? FLAGS_read_max
-                             : std::min(FLAGS_read_max, FLAGS_read_user_max));
+      static_cast<off_t>(std::min(FLAGS_read_max, FLAGS_read_user_max));
+  if (file_size > read_max && handle.fd->isOwnerRoot().ok()) {
+    read_max = static_cast<off_t>(FLAGS_read_max);
+  }
   if (file_size > read_max) {
     LOG(WARNING) << "Cannot read file that exceeds size limit: "
                  << path.string();
@@ -132,18 +162,29 @@ Status readFile(const fs::path& path,
 
   off_t total_bytes = 0;
   if (file_size == 0 || block_size > 0) {
+    // Do not allocate blocks larger than the file.
+    if (file_size > 0 && static_cast<off_t>(block_size) > file_size) {
+      block_size = static_cast<size_t>(file_size);
+    }
     // Reset block size to a sane minimum.
     block_size = (block_size < 4096) ? 4096 : block_size;
     ssize_t part_bytes = 0;
     bool overflow = false;
+    std::string part;
     do {
-      std::string part(block_size, '\0');
+      // The block is reused unless the predicate took or resized it.
+      if (part.size() != block_size) {
+        part.assign(block_size, '\0');
+      }
       part_bytes = handle.fd->read(&part[0], block_size);
       if (part_bytes > 0) {
         total_bytes += static_cast<off_t>(part_bytes);
         if (total_bytes >= read_max) {
           return Status(1, "File exceeds read limits");
         }
+        if (isQueryInterrupted()) {
+          return Status(1, "Query interrupted while reading file");
+        }
         if (file_size > 0 && total_bytes > file_size) {
           overflow = true;
           part_bytes -= (total_bytes - file_size);
@@ -191,6 +232,98 @@ Status readFile(const fs::path& path,
                   blocking);
 }
 
+Status readFileMapped(
+    const fs::path& path,
+    std::function<void(boost::string_ref content)> predicate) {
+#ifndef WIN32
+  int fd = -1;
+  if (FLAGS_read_mapped) {
+    fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+
+  // Special files report no size, they are read into a buffer.
+  struct stat info;
+  if (fd >= 0 && ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_size > 0) {
+    auto read_max = (info.st_uid == 0)
+                        ? FLAGS_read_max
+                        : std::min(FLAGS_read_max, FLAGS_read_user_max);
+    if (static_cast<uint64_t>(info.st_size) > read_max) {
+      ::close(fd);
+      VLOG(1) << "Cannot read " << path.string()
+              << " size exceeds limit: " << info.st_size << " > " << read_max;
+      return Status(1, "File exceeds read limits");
+    }
+
+    auto size = static_cast<size_t>(info.st_size);
+    auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data != MAP_FAILED) {
+      ::madvise(data, size, MADV_SEQUENTIAL);
+      predicate(boost::string_ref(static_cast<const char*>(data), size));
+      ::munmap(data, size);
+      return Status(0, "OK");
+    }
+  } else if (fd >= 0) {
+    ::close(fd);
+  }
+#endif
+
+  std::string content;
+  auto status = readFile(path, content);
+  if (status.ok()) {
+    predicate(content);
+  }
+  return status;
+}
+
+Status readFiles(const std::vector<fs::path>& paths,
+                 std::vector<FileReadResult>& results,
+                 bool preserve_time) {
+  results.clear();
+  results.resize(paths.size());
+
+  // Each worker takes the next path until all have been read, or the query
+  // reading them is interrupted.
+  auto interrupted = getQueryInterrupt();
+  std::atomic<size_t> next(0);
+  auto worker = [&paths, &results, &next, &interrupted, preserve_time]() {
+    size_t index = 0;
+    while (!interrupted() && (index = next++) < paths.size()) {
+      auto& result = results[index];
+      result.status =
+          readFile(paths[index], result.content, 0, false, preserve_time);
+    }
+  };
+
+  auto threads = std::min(static_cast<size_t>(FLAGS_read_threads),
+                          paths.size() / kReadFilesPerThread);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit(worker));
+  }
+  worker();
+  group.wait();
+
+  // Paths the workers did not take have no content.
+  if (interrupted()) {
+    return Status(1, "Query interrupted while reading files");
+  }
+  for (const auto& result : results) {
+    if (!result.status.ok()) {
+      return Status(1, "Cannot read every file");
+    }
+  }
+  return Status(0, "OK");
+}
+
+std::string getHostPath(const std::string& path) {
+  if (FLAGS_host_root.empty()) {
+    return path;
+  }
+  return FLAGS_host_root + path;
+}
+
 Status readFile(const fs::path& path, bool blocking) {
   std::string blank;
   return readFile(path, blank, 0, true, false, blocking);
@@ -252,10 +385,31 @@ static void genGlobs(std::string path,
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path, limits);
 
+#ifndef WIN32
+  // A trailing double star is expanded by listing the directories found.
+  bool list_children =
+      path.size() >= 2 && path.compare(path.size() - 2, 2, "**") == 0;
+#endif
+
   // Generate a glob set and recurse for double star.
   size_t glob_index = 0;
-  while (++glob_index < kMaxRecursiveGlobs) {
-    auto glob_results = platformGlob(path);
+  std::vector<std::string> glob_results;
+  while (++glob_index < kMaxRecursiveGlobs && !isQueryInterrupted()) {
+#ifndef WIN32
+    if (list_children && glob_index > 1) {
+      std::vector<std::string> directories;
+      for (auto& result_path : glob_results) {
+        if (result_path.back() == '/') {
+          directories.push_back(std::move(result_path));
+        }
+      }
+      glob_results = platformGlobChildren(directories, FLAGS_glob_threads);
+    } else {
+      glob_results = platformGlob(path);
+    }
+#else
+    glob_results = platformGlob(path);
+#endif
 
     for (auto const& result_path : glob_results) {
       results.push_back(result_path);
@@ -492,12 +646,7 @@ Status parseJSON(const fs::path& path, pt::ptree& tree) {
 }
 
 Status parseJSONContent(const std::string& content, pt::ptree& tree) {
-  // Read the extensions data into a JSON blob, then property tree.
-  try {
-    std::stringstream json_stream;
-    json_stream << content;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!parseJSONTree(content, tree).ok()) {
     return Status(1, "Could not parse JSON from file");
   }
   return Status(0, "OK");
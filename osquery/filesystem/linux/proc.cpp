@@ -8,62 +8,393 @@
  *
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
 #include <boost/filesystem.hpp>
 
+#include <osquery/core.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 namespace osquery {
 
+FLAG(uint64,
+     proc_snapshot_ttl,
+     0,
+     "Milliseconds a /proc process snapshot is shared between tables "
+     "(0 reads /proc for every table)");
+
+FLAG(uint64,
+     proc_snapshot_threads,
+     4,
+     "Maximum number of threads reading /proc process snapshots and "
+     "descriptors");
+
 const std::string kLinuxProcPath = "/proc";
 
+/// Size of the buffer /proc/<pid>/stat and status are read into.
+const size_t kProcStatBufferSize = 8192;
+
+/// Number of processes each snapshot thread claims at a time.
+const size_t kProcSnapshotBatch = 64;
+
+/// Minimum number of processes read by each snapshot thread.
+const size_t kProcSnapshotThreadMin = 256;
+
+/// Minimum number of processes whose descriptors are read by each thread.
+const size_t kProcDescriptorThreadMin = 32;
+
 Status procProcesses(std::set<std::string>& processes) {
   // Iterate over each process-like directory in proc.
-  boost::filesystem::directory_iterator it(kLinuxProcPath), end;
-  try {
-    for (; it != end; ++it) {
-      if (boost::filesystem::is_directory(it->status())) {
-        // See #792: std::regex is incomplete until GCC 4.9
-        if (std::atoll(it->path().leaf().string().c_str()) > 0) {
-          processes.insert(it->path().leaf().string());
-        }
+  auto proc_path = getHostPath(kLinuxProcPath);
+  auto dir = opendir(proc_path.c_str());
+  if (dir == nullptr) {
+    VLOG(1) << "Cannot iterate Linux processes";
+    return Status(1, "Cannot open " + proc_path);
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    // The entry type avoids a stat of each entry, see #792 for the atoll.
+    if ((entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN) &&
+        std::atoll(entry->d_name) > 0) {
+      processes.insert(entry->d_name);
+    }
+  }
+  closedir(dir);
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Read a small /proc file relative to a directory descriptor.
+ *
+ * @return the number of bytes read, the buffer is NULL-terminated, or -1.
+ */
+static ssize_t readProcFile(int dir_fd,
+                            const std::string& path,
+                            char* buffer,
+                            size_t size) {
+  auto fd = openat(dir_fd, path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  size_t total = 0;
+  while (total < size - 1) {
+    auto bytes = pread(fd, buffer + total, size - 1 - total, total);
+    if (bytes <= 0) {
+      break;
+    }
+    total += bytes;
+  }
+  close(fd);
+  buffer[total] = '\0';
+  return total;
+}
+
+/// Trim leading and trailing spaces and tabs from a range.
+static void trimRange(const char*& start, const char*& end) {
+  while (start < end && (*start == ' ' || *start == '\t')) {
+    start++;
+  }
+  while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+}
+
+/// Parse the real, effective, and saved IDs from a Uid or Gid value.
+static void parseProcIds(const char* start,
+                         const char* end,
+                         std::string& real,
+                         std::string& effective,
+                         std::string& saved) {
+  const char* fields[4] = {nullptr};
+  size_t sizes[4] = {0};
+  size_t count = 0;
+  while (start < end) {
+    auto tab = static_cast<const char*>(memchr(start, '\t', end - start));
+    auto field_end = (tab == nullptr) ? end : tab;
+    if (field_end > start) {
+      if (count == 4) {
+        return;
       }
+      fields[count] = start;
+      sizes[count++] = field_end - start;
     }
-  } catch (const boost::filesystem::filesystem_error& e) {
-    VLOG(1) << "Exception iterating Linux processes " << e.what();
-    return Status(1, e.what());
+    start = field_end + 1;
+  }
+
+  // Format is: R E S F
+  if (count == 4) {
+    real.assign(fields[0], sizes[0]);
+    effective.assign(fields[1], sizes[1]);
+    saved.assign(fields[2], sizes[2]);
+  }
+}
+
+/// Parse one process's stat and status, relative to a /proc descriptor.
+static Status procReadStatAt(int dir_fd,
+                             const std::string& prefix,
+                             const std::string& pid,
+                             ProcStat& stat) {
+  char buffer[kProcStatBufferSize];
+  stat.pid = pid;
+
+  auto bytes =
+      readProcFile(dir_fd, prefix + pid + "/stat", buffer, sizeof(buffer));
+  if (bytes > 0) {
+    // Start parsing stats from ") <MODE>..."
+    auto start = static_cast<const char*>(memrchr(buffer, ')', bytes));
+    if (start == nullptr || buffer + bytes <= start + 2) {
+      return Status(1, "Invalid /proc/stat header");
+    }
+
+    const char* details[20] = {nullptr};
+    size_t sizes[20] = {0};
+    size_t count = 0;
+    const char* end = buffer + bytes;
+    for (auto field = start + 2; field < end && count < 20;) {
+      auto space = static_cast<const char*>(memchr(field, ' ', end - field));
+      auto field_end = (space == nullptr) ? end : space;
+      if (field_end > field) {
+        details[count] = field;
+        sizes[count++] = field_end - field;
+      }
+      field = field_end + 1;
+    }
+    if (count < 20) {
+      return Status(1, "Invalid /proc/stat content");
+    }
+
+    stat.state.assign(details[0], sizes[0]);
+    stat.parent.assign(details[1], sizes[1]);
+    stat.group.assign(details[2], sizes[2]);
+    stat.user_time.assign(details[11], sizes[11]);
+    stat.system_time.assign(details[12], sizes[12]);
+    stat.nice.assign(details[16], sizes[16]);
+    stat.threads.assign(details[17], sizes[17]);
+
+    char* parsed = nullptr;
+    auto start_time = strtoll(details[19], &parsed, 10);
+    stat.start_time = (parsed == details[19] + sizes[19])
+                          ? std::to_string(start_time / 100)
+                          : "-1";
+  }
+
+  // /proc/N/status may be not available, or readable by this user.
+  bytes =
+      readProcFile(dir_fd, prefix + pid + "/status", buffer, sizeof(buffer));
+  if (bytes < 0) {
+    return Status(1, "Cannot read /proc/status");
   }
 
+  const char* end = buffer + bytes;
+  for (const char* line = buffer; line < end;) {
+    auto newline = static_cast<const char*>(memchr(line, '\n', end - line));
+    auto line_end = (newline == nullptr) ? end : newline;
+    // Status lines are formatted: Key: Value....\n.
+    auto colon = static_cast<const char*>(memchr(line, ':', line_end - line));
+    if (colon != nullptr) {
+      auto key = line;
+      auto key_end = colon;
+      auto value = colon + 1;
+      auto value_end = line_end;
+      trimRange(key, key_end);
+      trimRange(value, value_end);
+
+      std::string name(key, key_end - key);
+      if (name == "Name") {
+        stat.name.assign(value, value_end - value);
+      } else if ((name == "VmRSS" || name == "VmSize") &&
+                 value_end - value > 3) {
+        // Memory is reported in kB.
+        auto& size = (name == "VmRSS") ? stat.resident_size : stat.total_size;
+        size.assign(value, value_end - value - 3);
+        size += "000";
+      } else if (name == "Gid") {
+        parseProcIds(value,
+                     value_end,
+                     stat.real_gid,
+                     stat.effective_gid,
+                     stat.saved_gid);
+      } else if (name == "Uid") {
+        parseProcIds(value,
+                     value_end,
+                     stat.real_uid,
+                     stat.effective_uid,
+                     stat.saved_uid);
+      }
+    }
+    line = line_end + 1;
+  }
   return Status(0, "OK");
 }
 
-Status procDescriptors(const std::string& process,
-                       std::map<std::string, std::string>& descriptors) {
-  auto descriptors_path = kLinuxProcPath + "/" + process + "/fd";
-  try {
-    // Access to the process' /fd may be restricted.
-    boost::filesystem::directory_iterator it(descriptors_path), end;
-    for (; it != end; ++it) {
-      auto fd = it->path().leaf().string();
-      std::string linkname;
-      if (procReadDescriptor(process, fd, linkname).ok()) {
-        descriptors[fd] = linkname;
+Status procReadStat(const std::string& pid, ProcStat& stat) {
+  return procReadStatAt(AT_FDCWD, getHostPath(kLinuxProcPath) + "/", pid, stat);
+}
+
+std::shared_ptr<const ProcSnapshot> procSnapshot() {
+  static Mutex snapshot_mutex;
+  static std::shared_ptr<const ProcSnapshot> snapshot;
+  static std::chrono::steady_clock::time_point taken;
+
+  // Concurrent callers wait for a single walk of /proc and share it.
+  WriteLock lock(snapshot_mutex);
+  auto now = std::chrono::steady_clock::now();
+  if (snapshot != nullptr && FLAGS_proc_snapshot_ttl > 0 &&
+      now - taken < std::chrono::milliseconds(FLAGS_proc_snapshot_ttl)) {
+    return snapshot;
+  }
+
+  std::set<std::string> pid_set;
+  procProcesses(pid_set);
+  std::vector<std::string> pids(pid_set.begin(), pid_set.end());
+
+  ProcSnapshot stats(pids.size());
+  std::vector<char> valid(pids.size(), 0);
+  auto dir_fd = open(getHostPath(kLinuxProcPath).c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+      size_t first = 0;
+      while ((first = next.fetch_add(kProcSnapshotBatch)) < pids.size()) {
+        auto last = std::min(first + kProcSnapshotBatch, pids.size());
+        for (auto i = first; i < last; ++i) {
+          valid[i] = procReadStatAt(dir_fd, "", pids[i], stats[i]).ok();
+        }
       }
+    };
+
+    // Small process lists are read by the calling thread alone.
+    size_t threads = std::min<size_t>(
+        FLAGS_proc_snapshot_threads, pids.size() / kProcSnapshotThreadMin + 1);
+    TaskGroup group(TaskPriority::HIGH);
+    for (size_t i = 1; i < threads; ++i) {
+      group.run(worker);
+    }
+    worker();
+    group.wait();
+    close(dir_fd);
+  }
+
+  // Processes that exited or were unreadable are removed.
+  ProcSnapshot results;
+  results.reserve(stats.size());
+  for (size_t i = 0; i < stats.size(); ++i) {
+    if (valid[i]) {
+      results.push_back(std::move(stats[i]));
     }
-  } catch (boost::filesystem::filesystem_error& e) {
+  }
+
+  snapshot = std::make_shared<const ProcSnapshot>(std::move(results));
+  taken = now;
+  return snapshot;
+}
+
+/**
+ * @brief Read the descriptor links of a process relative to /proc.
+ *
+ * @return failure if the process's descriptors could not be listed.
+ */
+static Status procWalkDescriptorsAt(int dir_fd,
+                                    const std::string& process,
+                                    size_t index,
+                                    const ProcDescriptorPredicate& predicate) {
+  // Access to the process' /fd may be restricted.
+  auto path = process + "/fd";
+  auto fd_dir =
+      openat(dir_fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd_dir < 0) {
+    return Status(1, "Cannot access descriptors for " + process);
+  }
+  auto dir = fdopendir(fd_dir);
+  if (dir == nullptr) {
+    close(fd_dir);
     return Status(1, "Cannot access descriptors for " + process);
   }
 
+  char link[PATH_MAX];
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    auto size = readlinkat(fd_dir, entry->d_name, link, sizeof(link) - 1);
+    if (size < 0) {
+      continue;
+    }
+    link[size] = '\0';
+    predicate(index, entry->d_name, link, static_cast<size_t>(size));
+  }
+  // Closing the directory closes its descriptor.
+  closedir(dir);
   return Status(0, "OK");
 }
 
+Status procDescriptors(const std::string& process,
+                       std::map<std::string, std::string>& descriptors) {
+  auto dir_fd = open(getHostPath(kLinuxProcPath).c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return Status(1, "Cannot access descriptors for " + process);
+  }
+
+  auto status = procWalkDescriptorsAt(
+      dir_fd,
+      process,
+      0,
+      [&descriptors](size_t, const char* fd, const char* link, size_t size) {
+        descriptors[fd] = std::string(link, size);
+      });
+  close(dir_fd);
+  return status;
+}
+
+void procWalkDescriptors(const std::vector<std::string>& processes,
+                         const ProcDescriptorPredicate& predicate) {
+  auto dir_fd = open(getHostPath(kLinuxProcPath).c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    size_t i = 0;
+    while ((i = next.fetch_add(1)) < processes.size()) {
+      procWalkDescriptorsAt(dir_fd, processes[i], i, predicate);
+    }
+  };
+
+  // Small process lists are read by the calling thread alone.
+  size_t threads =
+      std::min<size_t>(FLAGS_proc_snapshot_threads,
+                       processes.size() / kProcDescriptorThreadMin + 1);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; ++i) {
+    group.run(worker);
+  }
+  worker();
+  group.wait();
+  close(dir_fd);
+}
+
 Status procReadDescriptor(const std::string& process,
                           const std::string& descriptor,
                           std::string& result) {
-  auto link = kLinuxProcPath + "/" + process + "/fd/" + descriptor;
+  auto link = getHostPath(kLinuxProcPath) + "/" + process + "/fd/" + descriptor;
 
   char result_path[PATH_MAX] = {0};
   auto size = readlink(link.c_str(), result_path, sizeof(result_path) - 1);
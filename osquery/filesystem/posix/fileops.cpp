@@ -8,6 +8,8 @@
  *
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <pwd.h>
 #include <stdio.h>
@@ -18,9 +20,14 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include <boost/optional.hpp>
 
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/sql.h>
 
 #include "osquery/core/process.h"
 #include "osquery/filesystem/fileops.h"
@@ -300,6 +307,74 @@ std::vector<std::string> platformGlob(const std::string& find_path) {
   return results;
 }
 
+/// Minimum number of directories listed by each glob thread.
+const size_t kGlobDirectoriesPerThread = 32;
+
+/// Append the non-hidden entries of a directory, marking directories.
+static void globDirectory(const std::string& directory,
+                          std::vector<std::string>& results) {
+  auto dir = ::opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  auto fd = ::dirfd(dir);
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    // A glob wildcard does not match hidden entries, nor '.' and '..'.
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    // Only links and filesystems without entry types require a stat.
+    bool is_directory = (entry->d_type == DT_DIR);
+    if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      struct stat info;
+      is_directory = (::fstatat(fd, entry->d_name, &info, 0) == 0 &&
+                      S_ISDIR(info.st_mode));
+    }
+
+    results.push_back(directory + entry->d_name);
+    if (is_directory) {
+      results.back() += '/';
+    }
+  }
+  ::closedir(dir);
+}
+
+std::vector<std::string> platformGlobChildren(
+    const std::vector<std::string>& directories, size_t threads) {
+  std::vector<std::vector<std::string>> found(directories.size());
+
+  // Each worker takes the next directory until all have been listed, or the
+  // query listing them is interrupted.
+  auto interrupted = getQueryInterrupt();
+  std::atomic<size_t> next(0);
+  auto worker = [&directories, &found, &next, &interrupted]() {
+    size_t index = 0;
+    while (!interrupted() && (index = next++) < directories.size()) {
+      globDirectory(directories[index], found[index]);
+    }
+  };
+
+  threads = std::min(threads, directories.size() / kGlobDirectoriesPerThread);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit(worker));
+  }
+  worker();
+  group.wait();
+
+  std::vector<std::string> results;
+  for (auto& entries : found) {
+    results.insert(results.end(),
+                   std::make_move_iterator(entries.begin()),
+                   std::make_move_iterator(entries.end()));
+  }
+  std::sort(results.begin(), results.end());
+  return results;
+}
+
 int platformAccess(const std::string& path, mode_t mode) {
   return ::access(path.c_str(), mode);
 }
@@ -32,6 +32,11 @@ namespace osquery {
 
 DECLARE_uint64(read_max);
 DECLARE_uint64(read_user_max);
+DECLARE_uint64(glob_threads);
+DECLARE_bool(read_mapped);
+#ifdef __linux__
+DECLARE_uint64(proc_snapshot_ttl);
+#endif
 
 #ifdef WIN32
 auto raw_drive = getEnvVar("SystemDrive");
@@ -119,6 +124,49 @@ TEST_F(FilesystemTests, test_read_limit) {
   }
 }
 
+TEST_F(FilesystemTests, test_read_file_mapped) {
+  auto mapped = FLAGS_read_mapped;
+  std::string expected;
+  ASSERT_TRUE(readFile(kFakeDirectory + "/root.txt", expected).ok());
+
+  // Mapped and buffered reads provide the same content.
+  for (const auto& flag : {true, false}) {
+    FLAGS_read_mapped = flag;
+    std::string content;
+    auto status = readFileMapped(
+        kFakeDirectory + "/root.txt",
+        ([&content](boost::string_ref data) { content = data.to_string(); }));
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(expected, content);
+  }
+
+  FLAGS_read_mapped = true;
+  EXPECT_FALSE(readFileMapped(kFakeDirectory + "/not-a-file",
+                              [](boost::string_ref data) {})
+                   .ok());
+  FLAGS_read_mapped = mapped;
+}
+
+TEST_F(FilesystemTests, test_read_files) {
+  // Enough files are read for several threads to be used.
+  std::vector<fs::path> paths;
+  for (size_t i = 0; i < 64; i++) {
+    paths.push_back(kTestWorkingDirectory + "read-files-" + std::to_string(i));
+    writeTextFile(paths.back(), std::to_string(i));
+  }
+  paths.push_back(kTestWorkingDirectory + "read-files-missing");
+
+  std::vector<FileReadResult> results;
+  EXPECT_FALSE(readFiles(paths, results).ok());
+  ASSERT_EQ(paths.size(), results.size());
+  for (size_t i = 0; i < 64; i++) {
+    EXPECT_TRUE(results[i].status.ok());
+    EXPECT_EQ(std::to_string(i), results[i].content);
+    fs::remove(paths[i]);
+  }
+  EXPECT_FALSE(results.back().status.ok());
+}
+
 TEST_F(FilesystemTests, test_list_files_missing_directory) {
   std::vector<std::string> results;
   auto status = listFilesInDirectory("/foo/bar", results);
@@ -269,6 +317,29 @@ TEST_F(FilesystemTests, test_wildcard_double_folders) {
                            .string()));
 }
 
+TEST_F(FilesystemTests, test_wildcard_double_threads) {
+  // Enough directories are listed for each level to use several threads.
+  auto root = kTestWorkingDirectory + "glob-threads";
+  for (size_t i = 0; i < 100; i++) {
+    auto directory = root + "/dir" + std::to_string(i);
+    fs::create_directories(directory + "/nested");
+    writeTextFile(directory + "/nested/file.txt", "");
+  }
+
+  auto threads = FLAGS_glob_threads;
+  FLAGS_glob_threads = 1;
+  std::vector<std::string> expected;
+  resolveFilePattern(root + "/%%", expected);
+  EXPECT_EQ(300U, expected.size());
+
+  FLAGS_glob_threads = 4;
+  std::vector<std::string> results;
+  resolveFilePattern(root + "/%%", results);
+  EXPECT_EQ(expected, results);
+  FLAGS_glob_threads = threads;
+  fs::remove_all(root);
+}
+
 TEST_F(FilesystemTests, test_wildcard_end_last_component) {
   std::vector<std::string> results;
   auto status = resolveFilePattern(kFakeDirectory + "/%11/%sh", results);
@@ -378,6 +449,63 @@ TEST_F(FilesystemTests, test_read_proc) {
   EXPECT_TRUE(readFile("/proc/" + std::to_string(getpid()) + "/stat", content));
   EXPECT_GT(content.size(), 0U);
 }
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  auto pid = std::to_string(getpid());
+  ProcStat stat;
+  EXPECT_TRUE(procReadStat(pid, stat).ok());
+  EXPECT_EQ(pid, stat.pid);
+  EXPECT_FALSE(stat.name.empty());
+  EXPECT_EQ(std::to_string(getppid()), stat.parent);
+  EXPECT_EQ(std::to_string(getuid()), stat.real_uid);
+  EXPECT_FALSE(procReadStat("0", stat).ok());
+
+  // The snapshot includes this process, ordered by pid string.
+  auto ttl = FLAGS_proc_snapshot_ttl;
+  FLAGS_proc_snapshot_ttl = 60 * 1000;
+  auto snapshot = procSnapshot();
+  auto self = std::find_if(snapshot->begin(),
+                           snapshot->end(),
+                           [&pid](const ProcStat& p) { return p.pid == pid; });
+  ASSERT_TRUE(self != snapshot->end());
+  EXPECT_EQ(stat.name, self->name);
+  EXPECT_TRUE(std::is_sorted(
+      snapshot->begin(),
+      snapshot->end(),
+      [](const ProcStat& l, const ProcStat& r) { return l.pid < r.pid; }));
+
+  // Callers within the TTL share the snapshot.
+  EXPECT_EQ(snapshot, procSnapshot());
+  FLAGS_proc_snapshot_ttl = 0;
+  EXPECT_NE(snapshot, procSnapshot());
+  FLAGS_proc_snapshot_ttl = ttl;
+}
+
+TEST_F(FilesystemTests, test_proc_descriptors) {
+  auto path = kFakeDirectory + "/roto.txt";
+  auto file = fopen(path.c_str(), "r");
+  ASSERT_NE(file, nullptr);
+  auto fd = std::to_string(fileno(file));
+
+  // The walk and the descriptor map both include the open file.
+  auto pid = std::to_string(getpid());
+  std::vector<std::string> processes = {"0", pid};
+  std::vector<std::map<std::string, std::string>> walked(processes.size());
+  procWalkDescriptors(
+      processes, [&](size_t index, const char* d, const char* l, size_t size) {
+        EXPECT_EQ(strlen(l), size);
+        walked[index][d] = l;
+      });
+  EXPECT_TRUE(walked[0].empty());
+  ASSERT_EQ(walked[1].count(fd), 1U);
+  EXPECT_EQ(walked[1][fd], fs::canonical(path).string());
+
+  std::map<std::string, std::string> descriptors;
+  EXPECT_TRUE(procDescriptors(pid, descriptors).ok());
+  EXPECT_EQ(descriptors[fd], walked[1][fd]);
+  EXPECT_FALSE(procDescriptors("0", descriptors).ok());
+  fclose(file);
+}
 #endif
 
 #ifndef WIN32
@@ -585,41 +585,75 @@ bool PlatformFile::isSpecialFile() const {
   return (::GetFileType(handle_) != FILE_TYPE_DISK);
 }
 
-static Status isUserCurrentUser(PSID user) {
-  BOOL ret = FALSE;
-  HANDLE token = INVALID_HANDLE_VALUE;
+/**
+ * @brief The SID of the process's user, read from its token once.
+ *
+ * Ownership checks run for each file read, the token and well-known SIDs
+ * they compare against do not change while the process runs.
+ */
+static PSID getCurrentUserSid() {
+  static const std::vector<char> kUserSid = []() {
+    std::vector<char> sid;
+    HANDLE token = INVALID_HANDLE_VALUE;
+    if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_READ, &token)) {
+      return sid;
+    }
 
-  if (!::IsValidSid(user)) {
-    return Status(-1, "Invalid SID");
-  }
+    DWORD size = 0;
+    BOOL ret = ::GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+    if (ret || ::GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+      ::CloseHandle(token);
+      return sid;
+    }
 
-  if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_READ, &token)) {
-    return Status(-1, "OpenProcessToken failed");
-  }
+    std::vector<char> buffer(size);
+    auto ptu = (PTOKEN_USER)buffer.data();
+    ret = ::GetTokenInformation(token, TokenUser, (LPVOID)ptu, size, &size);
+    ::CloseHandle(token);
+    if (!ret || !::IsValidSid(ptu->User.Sid)) {
+      return sid;
+    }
 
-  DWORD size = 0;
-  PTOKEN_USER ptu = nullptr;
+    /// Copy the SID out of the token information.
+    sid.assign(::GetLengthSid(ptu->User.Sid), '\0');
+    if (!::CopySid(static_cast<DWORD>(sid.size()),
+                   (PSID)sid.data(),
+                   ptu->User.Sid)) {
+      sid.clear();
+    }
+    return sid;
+  }();
 
-  ret = ::GetTokenInformation(token, TokenUser, (LPVOID)ptu, 0, &size);
-  if (ret || (!ret && ::GetLastError() != ERROR_INSUFFICIENT_BUFFER)) {
-    ::CloseHandle(token);
+  return (kUserSid.empty()) ? nullptr : (PSID)kUserSid.data();
+}
 
-    return Status(-1, "GetTokenInformation failed (1)");
-  }
+/// The SID of the Administrators group, created once.
+static PSID getAdministratorsSid() {
+  static const std::vector<char> kAdminsSid = []() {
+    DWORD size = SECURITY_MAX_SID_SIZE;
+    std::vector<char> sid(size, '\0');
+    if (!::CreateWellKnownSid(
+            WinBuiltinAdministratorsSid, nullptr, (PSID)sid.data(), &size)) {
+      sid.clear();
+    }
+    return sid;
+  }();
 
-  std::vector<char> buffer(size);
-  ptu = (PTOKEN_USER)buffer.data();
+  return (kAdminsSid.empty()) ? nullptr : (PSID)kAdminsSid.data();
+}
 
-  /// Obtain the user SID behind the token handle
-  ret = ::GetTokenInformation(token, TokenUser, (LPVOID)ptu, size, &size);
-  ::CloseHandle(token);
+static Status isUserCurrentUser(PSID user) {
+  if (!::IsValidSid(user)) {
+    return Status(-1, "Invalid SID");
+  }
 
-  if (!ret) {
-    return Status(-1, "GetTokenInformation failed (2)");
+  auto current_user = getCurrentUserSid();
+  if (current_user == nullptr) {
+    return Status(-1, "GetTokenInformation failed");
   }
 
   /// Determine if the current user SID matches that of the specified user
-  if (::EqualSid(user, ptu->User.Sid)) {
+  if (::EqualSid(user, current_user)) {
     return Status(0, "OK");
   }
 
@@ -647,14 +681,8 @@ Status PlatformFile::isOwnerRoot() const {
 
   SecurityDescriptor sd_wrapper(sd);
 
-  DWORD admins_buf_size = SECURITY_MAX_SID_SIZE;
-  std::vector<char> admins_buf;
-  admins_buf.assign(admins_buf_size, '\0');
-
-  PSID admins_sid = (PSID)admins_buf.data();
-
-  if (!::CreateWellKnownSid(
-          WinBuiltinAdministratorsSid, nullptr, admins_sid, &admins_buf_size)) {
+  auto admins_sid = getAdministratorsSid();
+  if (admins_sid == nullptr) {
     return Status(-1, "CreateWellKnownSid failed");
   }
 
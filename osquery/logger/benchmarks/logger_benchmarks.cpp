@@ -0,0 +1,345 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+#include "osquery/logger/plugins/tls.h"
+#include "osquery/logger/queue.h"
+#include "osquery/remote/requests.h"
+#include "osquery/remote/serializers/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+extern void escapeNonPrintableBytesEx(std::string& data);
+
+DECLARE_bool(disable_logging);
+DECLARE_bool(logger_event_type);
+DECLARE_bool(decorations_top_level);
+DECLARE_bool(logger_tls_splice);
+DECLARE_bool(logger_tls_compress);
+
+/// The logger plugin forwarding benchmark results to the TLS forwarder.
+const std::string kBenchmarkLogger = "benchmark_tls";
+
+/// The shapes of benchmark result rows, see genRows.
+enum LoggerRowShape {
+  /// Wide rows, such as deb_packages or apps.
+  PACKAGE_ROWS = 0,
+
+  /// Narrow and mostly numeric rows, such as process_open_sockets.
+  SOCKET_ROWS = 1,
+
+  /// Paths with multi-byte characters and bytes that are escaped.
+  PATH_ROWS = 2,
+};
+
+/// A directory of the path rows, with 2 and 3-byte UTF-8 characters.
+const std::string kUnicodeDirectory = "/Users/usuário/Документы/日本語/";
+
+/// Variants of the pipeline, the default logs decorated events.
+struct LoggerVariant {
+  bool events{true};
+  bool decorations{true};
+  bool top_level{false};
+  bool splice{false};
+  bool compress{false};
+};
+
+/**
+ * @brief A TLS forwarder building request bodies without sending them.
+ *
+ * The bodies are built by the TLS forwarder's own methods: parsing each line
+ * into the request parameters and serializing them, or splicing the lines.
+ */
+class BenchmarkLogForwarder : public TLSLogForwarder {
+ public:
+  /// Send the buffered logs, until none remain.
+  void flush() {
+    while (check()) {
+    }
+  }
+
+  /// The sum of the log lines sent.
+  size_t line_bytes{0};
+
+  /// The sum of the request bodies that would be sent.
+  size_t body_bytes{0};
+
+  /// The number of requests that would be sent.
+  size_t requests{0};
+
+ protected:
+  Status send(std::vector<std::string>& log_data,
+              const std::string& log_type) override {
+    for (const auto& line : log_data) {
+      line_bytes += line.size();
+    }
+
+    std::string body;
+    if (FLAGS_logger_tls_splice) {
+      auto status = genSplicedBody(log_data, log_type, body);
+      if (!status.ok()) {
+        return status;
+      }
+    } else {
+      // The transport serializes and compresses the parameters.
+      pt::ptree params;
+      genParams(log_data, log_type, params);
+      JSONSerializer().serialize(params, body);
+      if (FLAGS_logger_tls_compress) {
+        body = compressString(body);
+      }
+    }
+    body_bytes += body.size();
+    requests++;
+    return Status(0, "OK");
+  }
+};
+
+/// The forwarder used by the benchmark logger plugin.
+static std::shared_ptr<BenchmarkLogForwarder> getBenchmarkForwarder() {
+  static std::shared_ptr<BenchmarkLogForwarder> forwarder;
+  if (forwarder == nullptr) {
+    // The node key is cached, the tls enroll plugin is not called.
+    setDatabaseValue(kPersistentSettings, "nodeKey", "benchmark_node_key");
+    forwarder = std::make_shared<BenchmarkLogForwarder>();
+    forwarder->setUp();
+  }
+  return forwarder;
+}
+
+class BenchmarkLoggerPlugin : public LoggerPlugin {
+ public:
+  Status setUp() override {
+    return Status(0);
+  }
+
+  Status logString(const std::string& s) override {
+    return getBenchmarkForwarder()->logString(s);
+  }
+
+  Status logStatus(const std::vector<StatusLogLine>& log) override {
+    return Status(0);
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+};
+
+REGISTER(BenchmarkLoggerPlugin, "logger", "benchmark_tls");
+
+/**
+ * @brief Generate the rows of a query, of a shape.
+ *
+ * A quarter of the rows include the generation, such that the results of
+ * consecutive generations differ by those rows.
+ */
+static QueryData genRows(int shape, size_t count, size_t generation) {
+  QueryData rows;
+  rows.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    auto id = std::to_string(i);
+    auto version = (i % 4 == 0) ? std::to_string(generation) : "0";
+
+    Row r;
+    if (shape == PACKAGE_ROWS) {
+      r["name"] = "synthetic-package-" + id;
+      r["version"] = "2." + id + "." + version + "-1ubuntu1";
+      r["source"] = "synthetic-source-" + id;
+      r["size"] = std::to_string(1024 + i * 7);
+      r["arch"] = "amd64";
+      r["revision"] = "1ubuntu1";
+      r["maintainer"] = "Synthetic Maintainers <synthetic@example.com>";
+      r["section"] = "utils";
+      r["priority"] = "optional";
+      r["install_time"] = std::to_string(1480000000 + i);
+      r["path"] = "/usr/share/doc/synthetic-package-" + id + "/copyright";
+      r["description"] =
+          "A synthetic package with a description about as long as the "
+          "descriptions of real packages, number " +
+          id;
+    } else if (shape == SOCKET_ROWS) {
+      r["pid"] = std::to_string(1000 + i % 500);
+      r["fd"] = std::to_string(3 + i % 64);
+      r["socket"] = std::to_string(100000 + i);
+      r["family"] = "2";
+      r["protocol"] = "6";
+      r["local_port"] = std::to_string(1024 + i % 60000);
+      r["remote_port"] = version;
+    } else {
+      r["directory"] = kUnicodeDirectory + version;
+      r["path"] = r["directory"] + "/файл-" + id +
+                  ((i % 8 == 0) ? "\x01\x7f.txt" : ".txt");
+      r["filename"] = "файл-" + id + ".txt";
+      r["sha256"] =
+          "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+      r["size"] = std::to_string(i * 13);
+    }
+    rows.push_back(std::move(r));
+  }
+  return rows;
+}
+
+/**
+ * @brief Log the results of a query per iteration, from its rows to a body.
+ *
+ * Each iteration escapes the generated rows as SQL::escapeResults does, diffs
+ * them against the previous iteration's, serializes and logs the log item to
+ * the benchmark logger, and lets the TLS forwarder buffer and send the logs.
+ *
+ * The rates are of CPU time, the forwarder sleeps between large batches.
+ */
+static void benchmarkPipeline(benchmark::State& state,
+                              const LoggerVariant& variant) {
+  auto logging = FLAGS_disable_logging;
+  auto events = FLAGS_logger_event_type;
+  auto top_level = FLAGS_decorations_top_level;
+  auto splice = FLAGS_logger_tls_splice;
+  auto compress = FLAGS_logger_tls_compress;
+  FLAGS_disable_logging = false;
+  FLAGS_logger_event_type = variant.events;
+  FLAGS_decorations_top_level = variant.top_level;
+  FLAGS_logger_tls_splice = variant.splice;
+  FLAGS_logger_tls_compress = variant.compress;
+
+  std::vector<QueryData> generations = {
+      genRows(state.range_x(), state.range_y(), 0),
+      genRows(state.range_x(), state.range_y(), 1),
+  };
+
+  std::map<std::string, std::string> decorations;
+  if (variant.decorations) {
+    decorations = {
+        {"host_uuid", "4740D59F-699E-5B29-960B-979AAF9BBEED"},
+        {"hostname", "benchmark.example.com"},
+        {"username", "benchmark"},
+        {"osquery_version", "2.1.0"},
+    };
+  }
+
+  auto forwarder = getBenchmarkForwarder();
+  forwarder->line_bytes = 0;
+  forwarder->body_bytes = 0;
+  forwarder->requests = 0;
+
+  QueryData previous;
+  size_t rows = 0;
+  size_t generation = 0;
+  while (state.KeepRunning()) {
+    auto current = generations[generation++ % 2];
+    for (auto& row : current) {
+      for (auto& column : row) {
+        escapeNonPrintableBytesEx(column.second);
+      }
+    }
+
+    QueryLogItem item;
+    item.results = diff(previous, current);
+    item.name = "pack_benchmark_pipeline";
+    item.identifier = "benchmark.example.com";
+    item.time = 1480000000 + generation;
+    item.calendar_time = "Thu Nov 24 15:06:40 2016 UTC";
+    item.decorations = decorations;
+    rows += item.results.added.size() + item.results.removed.size();
+
+    logQueryLogItem(item, kBenchmarkLogger);
+    flushLoggerQueues();
+    forwarder->flush();
+    previous = std::move(current);
+  }
+
+  double per_row = (rows > 0) ? rows : 1;
+  state.SetLabel("line_bytes/row=" +
+                 std::to_string(forwarder->line_bytes / per_row) +
+                 " body_bytes/row=" +
+                 std::to_string(forwarder->body_bytes / per_row) +
+                 " requests=" + std::to_string(forwarder->requests));
+  state.SetItemsProcessed(rows);
+  state.SetBytesProcessed(static_cast<int64_t>(forwarder->body_bytes));
+
+  FLAGS_disable_logging = logging;
+  FLAGS_logger_event_type = events;
+  FLAGS_decorations_top_level = top_level;
+  FLAGS_logger_tls_splice = splice;
+  FLAGS_logger_tls_compress = compress;
+}
+
+/// Register each row shape with a small and a large result.
+static void genShapeArgs(benchmark::internal::Benchmark* b) {
+  for (const auto& shape : {PACKAGE_ROWS, SOCKET_ROWS, PATH_ROWS}) {
+    b->ArgPair(shape, 100);
+    b->ArgPair(shape, 5000);
+  }
+}
+
+static void LOGGER_pipeline_events(benchmark::State& state) {
+  benchmarkPipeline(state, LoggerVariant());
+}
+
+BENCHMARK(LOGGER_pipeline_events)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_batch(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.events = false;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_batch)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_undecorated(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.decorations = false;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_undecorated)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_top_level(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.top_level = true;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_top_level)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_splice(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.splice = true;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_splice)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_compress(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.compress = true;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_compress)->Apply(genShapeArgs);
+
+static void LOGGER_pipeline_splice_compress(benchmark::State& state) {
+  LoggerVariant variant;
+  variant.splice = true;
+  variant.compress = true;
+  benchmarkPipeline(state, variant);
+}
+
+BENCHMARK(LOGGER_pipeline_splice_compress)->Apply(genShapeArgs);
+}
@@ -13,6 +13,7 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <thread>
 
 #include <boost/noncopyable.hpp>
@@ -25,6 +26,9 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/tracing.h"
+#include "osquery/logger/queue.h"
+#include "osquery/logger/relay.h"
 
 namespace pt = boost::property_tree;
 
@@ -47,6 +51,13 @@ FLAG(bool,
      false,
      "Only send status logs to secondary logger plugins");
 
+DECLARE_uint64(logger_status_rate);
+DECLARE_bool(logger_status_dedup);
+DECLARE_uint64(logger_status_batch);
+
+/// Interval between sends of held status logs and repeat summaries.
+const size_t kStatusLogFlushInterval = 1000;
+
 /**
  * @brief Logger plugin registry.
  *
@@ -56,6 +67,9 @@ FLAG(bool,
  */
 CREATE_REGISTRY(LoggerPlugin, "logger");
 
+/// Incremented by requestLogReopen, from a signal handler.
+static std::atomic<size_t> kLogReopenRequests{0};
+
 class LoggerDisabler;
 
 /**
@@ -97,6 +111,24 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
     return instance().logs_;
   }
 
+  /// Move the buffered logs, including summaries held by the relay.
+  static void take(std::vector<StatusLogLine>& logs) {
+    auto& self = instance();
+    WriteLock lock(self.relay_mutex_);
+    self.relay_.flush(self.logs_);
+    logs.swap(self.logs_);
+    self.logs_.clear();
+  }
+
+  /**
+   * @brief Send the status logs held for a batch, and relay summaries.
+   *
+   * When forwarding, status logs are held until logger_status_batch lines
+   * are ready. A StatusLogRunner calls this periodically so held lines and
+   * repeat summaries are not delayed indefinitely.
+   */
+  static void flush();
+
   /// Set the forwarding mode of the buffering sink.
   static void forward(bool forward = false) {
     WriteLock lock(instance().forward_mutex_);
@@ -196,10 +228,22 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
     disable();
   }
 
+  /// Send a batch of status logs to each enabled logger plugin.
+  static void sendStatus(const std::vector<StatusLogLine>& lines);
+
  private:
   /// Intermediate log storage until an osquery logger is initialized.
   std::vector<StatusLogLine> logs_;
 
+  /// Status logs held while forwarding, until a batch is ready.
+  std::vector<StatusLogLine> pending_;
+
+  /// Fold repeated status logs and apply the per-severity rate limits.
+  StatusLogRelay relay_;
+
+  /// Protect the relay, buffered, and held status logs.
+  Mutex relay_mutex_;
+
   /// Should the sending act in a forwarding mode.
   bool forward_{false};
 
@@ -249,6 +293,19 @@ class LoggerDisabler : private boost::noncopyable {
   bool enabled_;
 };
 
+/// A service that sends held status logs and relay summaries.
+class StatusLogRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    BufferedLogSink::flush();
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::milliseconds(kStatusLogFlushInterval);
+  }
+};
+
 /// Scoped helper to disable forwarding
 LoggerForwardingDisabler::LoggerForwardingDisabler() {
   forward_state_ = BufferedLogSink::haltForwardingAndLock();
@@ -260,20 +317,26 @@ LoggerForwardingDisabler::~LoggerForwardingDisabler() {
 
 static void serializeIntermediateLog(const std::vector<StatusLogLine>& log,
                                      PluginRequest& request) {
-  pt::ptree tree;
-  for (const auto& log_item : log) {
-    pt::ptree child;
-    child.put("s", log_item.severity);
-    child.put("f", log_item.filename);
-    child.put("i", log_item.line);
-    child.put("m", log_item.message);
-    tree.push_back(std::make_pair("", child));
-  }
-
-  // Save the log as a request JSON string.
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  request["log"] = output.str();
+  // Save the log as a request JSON string, written as a list of trees would.
+  std::string json;
+  if (log.empty()) {
+    json = "\"\"";
+  } else {
+    json += '[';
+    for (const auto& log_item : log) {
+      if (json.size() > 1) {
+        json += ',';
+      }
+      json += "{\"s\":\"" + std::to_string(log_item.severity) + "\",\"f\":";
+      writeJSONString(log_item.filename, json);
+      json += ",\"i\":\"" + std::to_string(log_item.line) + "\",\"m\":";
+      writeJSONString(log_item.message, json);
+      json += '}';
+    }
+    json += ']';
+  }
+  json += '\n';
+  request["log"] = std::move(json);
 }
 
 static void deserializeIntermediateLog(const PluginRequest& request,
@@ -302,6 +365,44 @@ static void deserializeIntermediateLog(const PluginRequest& request,
   }
 }
 
+/// Serialize status lines for a logger request to an extension.
+static PluginRequest getStatusRequest(const std::string& action,
+                                      const std::string& value,
+                                      const std::vector<StatusLogLine>& log) {
+  PluginRequest request = {{action, value}};
+  serializeIntermediateLog(log, request);
+  if (!request["log"].empty()) {
+    request["log"].pop_back();
+  }
+  return request;
+}
+
+/**
+ * @brief Send status lines to each logger.
+ *
+ * Loggers within the process receive the lines directly, they are only
+ * serialized, once, when an extension's logger needs them.
+ */
+static void sendStatusLines(const std::vector<std::string>& loggers,
+                            const std::vector<StatusLogLine>& log) {
+  PluginRequest request;
+  for (const auto& logger : loggers) {
+    auto plugin =
+        RegistryFactory::get().localPlugin<LoggerPlugin>("logger", logger);
+    if (plugin != nullptr) {
+      RegistryFactory::callLocal("logger", logger, [&plugin, &log]() {
+        return plugin->sendStatus(log);
+      });
+      continue;
+    }
+
+    if (request.empty()) {
+      request = getStatusRequest("status", "true", log);
+    }
+    Registry::call("logger", logger, request);
+  }
+}
+
 void setVerboseLevel() {
   if (Flag::getValue("verbose") == "true") {
     // Turn verbosity up to 1.
@@ -362,14 +463,7 @@ void initLogger(const std::string& name) {
 
   // Start the custom status logging facilities, which may instruct Glog as is
   // the case with filesystem logging.
-  PluginRequest init_request = {{"init", name}};
-  serializeIntermediateLog(intermediate_logs, init_request);
-  if (!init_request["log"].empty()) {
-    init_request["log"].pop_back();
-  }
-
   bool forward = false;
-  PluginRequest features_request = {{"action", "features"}};
   auto logger_plugin = RegistryFactory::get().getActive("logger");
   // Allow multiple loggers, make sure each is accessible.
   for (const auto& logger : osquery::split(logger_plugin, ",")) {
@@ -378,9 +472,24 @@ void initLogger(const std::string& name) {
       continue;
     }
 
-    Registry::call("logger", logger, init_request);
-    auto status = Registry::call("logger", logger, features_request);
-    if ((status.getCode() & LOGGER_FEATURE_LOGSTATUS) > 0) {
+    size_t features = 0;
+    auto plugin =
+        RegistryFactory::get().localPlugin<LoggerPlugin>("logger", logger);
+    if (plugin != nullptr) {
+      RegistryFactory::callLocal("logger", logger, [&]() {
+        plugin->sendInit(name, intermediate_logs);
+        features = plugin->getFeatures();
+        return Status(0, "OK");
+      });
+    } else {
+      Registry::call("logger",
+                     logger,
+                     getStatusRequest("init", name, intermediate_logs));
+      auto status = Registry::call("logger", logger, {{"action", "features"}});
+      features = static_cast<size_t>(status.getCode());
+    }
+
+    if ((features & LOGGER_FEATURE_LOGSTATUS) > 0) {
       // Glog status logs are forwarded to logStatus.
       forward = true;
       // To support multiple plugins we only add the names of plugins that
@@ -388,7 +497,7 @@ void initLogger(const std::string& name) {
       BufferedLogSink::addPlugin(logger);
     }
 
-    if ((status.getCode() & LOGGER_FEATURE_LOGEVENT) > 0) {
+    if ((features & LOGGER_FEATURE_LOGEVENT) > 0) {
       EventFactory::addForwarder(logger);
     }
   }
@@ -398,6 +507,13 @@ void initLogger(const std::string& name) {
     // their initialization.
     BufferedLogSink::forward(true);
     BufferedLogSink::enable();
+
+    static bool flushing = false;
+    if (!flushing && (FLAGS_logger_status_batch > 1 ||
+                      FLAGS_logger_status_dedup || FLAGS_logger_status_rate)) {
+      flushing = true;
+      Dispatcher::addPeriodicService(std::make_shared<StatusLogRunner>());
+    }
   }
 }
 
@@ -408,68 +524,118 @@ void BufferedLogSink::send(google::LogSeverity severity,
                            const struct ::tm* tm_time,
                            const char* message,
                            size_t message_len) {
-  // Either forward the log to an enabled logger or buffer until one exists.
-  if (forward_) {
-    auto logger_plugin = RegistryFactory::get().getActive("logger");
-    for (const auto& logger : osquery::split(logger_plugin, ",")) {
-      auto& enabled = BufferedLogSink::enabledPlugins();
-      if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
-        // May use the logs_ storage to buffer/delay sending logs.
-        logs_.push_back({(StatusLogSeverity)severity,
-                         std::string(base_filename),
-                         line,
-                         std::string(message, message_len)});
-        PluginRequest request = {{"status", "true"}};
-        serializeIntermediateLog(logs_, request);
-        if (!request["log"].empty()) {
-          request["log"].pop_back();
-        }
-        logs_.clear();
-        Registry::call("logger", logger, request);
-      }
+  std::vector<StatusLogLine> lines;
+  {
+    WriteLock lock(relay_mutex_);
+    relay_.setLimits(FLAGS_logger_status_rate, FLAGS_logger_status_dedup);
+    relay_.add({(StatusLogSeverity)severity,
+                std::string(base_filename),
+                line,
+                std::string(message, message_len)},
+               StatusLogRelay::Clock::now(),
+               (forward_) ? pending_ : logs_);
+
+    // Either forward the log to an enabled logger or buffer until one exists.
+    if (!forward_ || pending_.size() < FLAGS_logger_status_batch) {
+      return;
     }
-  } else {
-    logs_.push_back({(StatusLogSeverity)severity,
-                     std::string(base_filename),
-                     line,
-                     std::string(message, message_len)});
+    lines.swap(pending_);
   }
+  sendStatus(lines);
 }
 
-Status LoggerPlugin::call(const PluginRequest& request,
-                          PluginResponse& response) {
-  if (FLAGS_logger_secondary_status_only &&
-      !BufferedLogSink::isPrimaryLogger(getName()) &&
-      (request.count("string") || request.count("snapshot"))) {
-    return Status(0, "Logging disabled to secondary plugins");
+void BufferedLogSink::flush() {
+  auto& self = instance();
+  std::vector<StatusLogLine> lines;
+  {
+    WriteLock lock(self.relay_mutex_);
+    if (!self.forward_) {
+      // Held logs are buffered again until forwarding resumes.
+      self.logs_.insert(self.logs_.end(),
+                        std::make_move_iterator(self.pending_.begin()),
+                        std::make_move_iterator(self.pending_.end()));
+      self.pending_.clear();
+      self.relay_.flush(self.logs_);
+      return;
+    }
+    self.relay_.flush(self.pending_);
+    lines.swap(self.pending_);
+  }
+  sendStatus(lines);
+}
+
+void BufferedLogSink::sendStatus(const std::vector<StatusLogLine>& lines) {
+  if (lines.empty()) {
+    return;
   }
 
-  QueryLogItem item;
+  std::vector<std::string> loggers;
+  auto logger_plugin = RegistryFactory::get().getActive("logger");
+  auto& enabled = BufferedLogSink::enabledPlugins();
+  for (const auto& logger : osquery::split(logger_plugin, ",")) {
+    if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
+      loggers.push_back(logger);
+    }
+  }
+  sendStatusLines(loggers, lines);
+}
+
+Status LoggerPlugin::call(const PluginRequest& request,
+                          PluginResponse& response) {
   std::vector<StatusLogLine> intermediate_logs;
   if (request.count("string") > 0) {
-    return this->logString(request.at("string"));
+    return sendString(request.at("string"));
   } else if (request.count("snapshot") > 0) {
-    return this->logSnapshot(request.at("snapshot"));
+    return sendSnapshot(request.at("snapshot"));
   } else if (request.count("init") > 0) {
     deserializeIntermediateLog(request, intermediate_logs);
-    this->setProcessName(request.at("init"));
-    this->init(this->name(), intermediate_logs);
+    sendInit(request.at("init"), intermediate_logs);
     return Status(0);
   } else if (request.count("status") > 0) {
     deserializeIntermediateLog(request, intermediate_logs);
-    return this->logStatus(intermediate_logs);
+    return sendStatus(intermediate_logs);
   } else if (request.count("event") > 0) {
     return this->logEvent(request.at("event"));
   } else if (request.count("action") && request.at("action") == "features") {
-    size_t features = 0;
-    features |= (usesLogStatus()) ? LOGGER_FEATURE_LOGSTATUS : 0;
-    features |= (usesLogEvent()) ? LOGGER_FEATURE_LOGEVENT : 0;
-    return Status(static_cast<int>(features));
+    return Status(static_cast<int>(getFeatures()));
   } else {
     return Status(1, "Unsupported call to logger plugin");
   }
 }
 
+Status LoggerPlugin::sendString(const std::string& s) {
+  if (FLAGS_logger_secondary_status_only &&
+      !BufferedLogSink::isPrimaryLogger(getName())) {
+    return Status(0, "Logging disabled to secondary plugins");
+  }
+  return this->logString(s);
+}
+
+Status LoggerPlugin::sendSnapshot(const std::string& s) {
+  if (FLAGS_logger_secondary_status_only &&
+      !BufferedLogSink::isPrimaryLogger(getName())) {
+    return Status(0, "Logging disabled to secondary plugins");
+  }
+  return this->logSnapshot(s);
+}
+
+Status LoggerPlugin::sendStatus(const std::vector<StatusLogLine>& log) {
+  return this->logStatus(log);
+}
+
+void LoggerPlugin::sendInit(const std::string& name,
+                            const std::vector<StatusLogLine>& log) {
+  this->setProcessName(name);
+  this->init(this->name(), log);
+}
+
+size_t LoggerPlugin::getFeatures() {
+  size_t features = 0;
+  features |= (usesLogStatus()) ? LOGGER_FEATURE_LOGSTATUS : 0;
+  features |= (usesLogEvent()) ? LOGGER_FEATURE_LOGEVENT : 0;
+  return features;
+}
+
 Status logString(const std::string& message, const std::string& category) {
   return logString(
       message, category, RegistryFactory::get().getActive("logger"));
@@ -482,8 +648,7 @@ Status logString(const std::string& message,
     return Status(0, "Logging disabled");
   }
 
-  return Registry::call(
-      "logger", receiver, {{"string", message}, {"category", category}});
+  return queueLoggerRequest(receiver, {message, false, category});
 }
 
 Status logQueryLogItem(const QueryLogItem& results) {
@@ -498,12 +663,15 @@ Status logQueryLogItem(const QueryLogItem& results,
 
   std::vector<std::string> json_items;
   Status status;
-  if (FLAGS_log_result_events) {
-    status = serializeQueryLogItemAsEventsJSON(results, json_items);
-  } else {
-    std::string json;
-    status = serializeQueryLogItemJSON(results, json);
-    json_items.push_back(json);
+  {
+    TraceSpan span("serialize");
+    if (FLAGS_log_result_events) {
+      status = serializeQueryLogItemAsEventsJSON(results, json_items);
+    } else {
+      std::string json;
+      status = serializeQueryLogItemJSON(results, json);
+      json_items.push_back(json);
+    }
   }
   if (!status.ok()) {
     return status;
@@ -524,13 +692,17 @@ Status logSnapshotQuery(const QueryLogItem& item) {
   }
 
   std::string json;
-  if (!serializeQueryLogItemJSON(item, json)) {
-    return Status(1, "Could not serialize snapshot");
+  {
+    TraceSpan span("serialize");
+    if (!serializeQueryLogItemJSON(item, json)) {
+      return Status(1, "Could not serialize snapshot");
+    }
   }
   if (!json.empty() && json.back() == '\n') {
     json.pop_back();
   }
-  return Registry::call("logger", {{"snapshot", json}});
+  return queueLoggerRequest(RegistryFactory::get().getActive("logger"),
+                            {std::move(json), true});
 }
 
 bool haltForwardingAndLock() {
@@ -549,26 +721,21 @@ void relayStatusLogs() {
   // Prevent our dumping and registry calling from producing additional logs.
   LoggerDisabler disabler;
 
-  // Construct a status log plugin request.
-  PluginRequest request = {{"status", "true"}};
-  auto& status_logs = BufferedLogSink::dump();
+  std::vector<StatusLogLine> status_logs;
+  BufferedLogSink::take(status_logs);
   if (status_logs.size() == 0) {
     return;
   }
-  serializeIntermediateLog(status_logs, request);
-  if (!request["log"].empty()) {
-    request["log"].pop_back();
-  }
 
   // Skip the registry's logic, and send directly to the core's logger.
-  PluginResponse response;
-  Registry::call("logger", request, response);
+  sendStatusLines(
+      osquery::split(RegistryFactory::get().getActive("logger"), ","),
+      status_logs);
 
-  // Flush the buffered status logs.
+  // The buffered status logs were taken from the sink.
   // If the logger called failed then the logger is experiencing a catastrophic
   // failure, since it is missing from the registry. The logger plugin may
   // return failure, but it should have buffered independently of the failure.
-  status_logs.clear();
 }
 
 void systemLog(const std::string& line) {
@@ -576,4 +743,12 @@ void systemLog(const std::string& line) {
   syslog(LOG_NOTICE, "%s", line.c_str());
 #endif
 }
+
+void requestLogReopen() {
+  kLogReopenRequests++;
+}
+
+size_t getLogReopenRequests() {
+  return kLogReopenRequests;
+}
 }
@@ -21,6 +21,7 @@
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
+#include "osquery/core/process.h"
 #include "osquery/logger/plugins/aws_firehose.h"
 #include "osquery/logger/plugins/aws_util.h"
 
@@ -39,6 +40,13 @@ const size_t FirehoseLogForwarder::kFirehoseMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t FirehoseLogForwarder::kFirehoseMaxLogBytes = 1000000 - 256;
 
+// Max size of a PutRecordBatch request is 4MiB, including each newline.
+const size_t FirehoseLogForwarder::kFirehoseMaxBytes =
+    4 * 1024 * 1024 - FirehoseLogForwarder::kFirehoseMaxRecords;
+
+// Times the failed records of a batch are sent again.
+const size_t FirehoseLogForwarder::kFirehoseRetries = 3;
+
 Status FirehoseLoggerPlugin::setUp() {
   initAwsSdk();
   forwarder_ = std::make_shared<FirehoseLogForwarder>();
@@ -57,42 +65,87 @@ Status FirehoseLoggerPlugin::logString(const std::string& s) {
 
 Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
                                   const std::string& log_type) {
-  std::vector<Aws::Firehose::Model::Record> records;
-  for (const std::string& log : log_data) {
-    if (log.size() + 1 > kFirehoseMaxLogBytes) {
+  // The indexes of the lines still to be sent.
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < log_data.size(); i++) {
+    if (log_data[i].size() + 1 > kFirehoseMaxLogBytes) {
       LOG(ERROR) << "Firehose log too big, discarding!";
+      continue;
     }
-    Aws::Firehose::Model::Record record;
-    auto buffer =
-        Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length() + 1);
-    // Firehose buffers together the individual records, so we must insert
-    // newlines here if we want newlines in the resultant files after Firehose
-    // processing. See http://goo.gl/Pz6XOj
-    buffer[log.length()] = '\n';
-    record.SetData(buffer);
-    records.push_back(std::move(record));
+    pending.push_back(i);
   }
 
-  Aws::Firehose::Model::PutRecordBatchRequest request;
-  request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
-      .WithRecords(std::move(records));
-
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome =
-      client_->PutRecordBatch(request);
-  Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
-  if (result.GetFailedPutCount() != 0) {
-    for (const auto& record : result.GetRequestResponses()) {
-      if (!record.GetErrorMessage().empty()) {
-        VLOG(1) << "Firehose write for " << result.GetFailedPutCount() << " of "
-                << result.GetRequestResponses().size()
-                << " records failed with error " << record.GetErrorMessage();
-        return Status(1, record.GetErrorMessage());
+  size_t retry_count = kFirehoseRetries;
+  size_t retry_delay = 1000;
+  bool first_attempt = true;
+  while (!pending.empty()) {
+    // Results are reported for each record, in the order of the records.
+    std::vector<Aws::Firehose::Model::Record> records;
+    for (const auto& i : pending) {
+      const auto& log = log_data[i];
+      Aws::Firehose::Model::Record record;
+      auto buffer =
+          Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length() + 1);
+      // Firehose buffers together the individual records, so we must insert
+      // newlines here if we want newlines in the resultant files after
+      // Firehose processing. See http://goo.gl/Pz6XOj
+      buffer[log.length()] = '\n';
+      record.SetData(buffer);
+      records.push_back(std::move(record));
+    }
+
+    Aws::Firehose::Model::PutRecordBatchRequest request;
+    request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
+        .WithRecords(std::move(records));
+
+    Aws::Firehose::Model::PutRecordBatchOutcome outcome =
+        client_->PutRecordBatch(request);
+
+    // A failed request, or one without a response for each record, is sent
+    // again as a whole.
+    std::vector<size_t> failed;
+    std::string error_msg;
+    const auto& responses = outcome.GetResult().GetRequestResponses();
+    if (!outcome.IsSuccess()) {
+      failed = pending;
+      error_msg = outcome.GetError().GetMessage();
+    } else if (responses.size() != pending.size()) {
+      if (outcome.GetResult().GetFailedPutCount() != 0) {
+        failed = pending;
+        error_msg = "Unexpected Firehose response count";
+      }
+    } else {
+      for (size_t i = 0; i < responses.size(); i++) {
+        const auto& response = responses[i];
+        if (!response.GetErrorCode().empty() ||
+            !response.GetErrorMessage().empty()) {
+          failed.push_back(pending[i]);
+          error_msg = response.GetErrorMessage();
+        }
       }
     }
-  }
 
-  VLOG(1) << "Successfully sent " << result.GetRequestResponses().size()
-          << " logs to Firehose.";
+    if (failed.empty()) {
+      VLOG(1) << "Successfully sent " << pending.size() << " logs to Firehose.";
+      break;
+    }
+
+    // Give up if every record failed right away, or no retries remain, the
+    // buffered forwarder will send the batch again later.
+    if (retry_count == 0 ||
+        (first_attempt && failed.size() == pending.size())) {
+      VLOG(1) << "Firehose write for " << failed.size() << " of "
+              << pending.size() << " records failed with error " << error_msg;
+      return Status(1, error_msg);
+    }
+
+    VLOG(1) << "Resending " << failed.size() << " records to Firehose";
+    pending = std::move(failed);
+    first_attempt = false;
+    sleepFor(retry_delay);
+    --retry_count;
+    retry_delay += 1000;
+  }
   return Status(0);
 }
 
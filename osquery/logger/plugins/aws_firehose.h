@@ -30,12 +30,16 @@ class FirehoseLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kFirehoseMaxLogBytes;
   static const size_t kFirehoseMaxRecords;
+  static const size_t kFirehoseMaxBytes;
+  static const size_t kFirehoseRetries;
 
  public:
   FirehoseLogForwarder()
       : BufferedLogForwarder("firehose",
                              std::chrono::seconds(FLAGS_aws_firehose_period),
-                             kFirehoseMaxRecords) {}
+                             kFirehoseMaxRecords) {
+    max_log_bytes_ = kFirehoseMaxBytes;
+  }
   Status setUp() override;
 
  protected:
@@ -48,6 +48,10 @@ const size_t KinesisLogForwarder::kKinesisMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t KinesisLogForwarder::kKinesisMaxLogBytes = 1000000 - 256;
 
+// Max size of a PutRecords request is 5MB, including each partition key.
+const size_t KinesisLogForwarder::kKinesisMaxBytes =
+    5000000 - 256 * KinesisLogForwarder::kKinesisMaxRecords;
+
 Status KinesisLoggerPlugin::setUp() {
   initAwsSdk();
   forwarder_ = std::make_shared<KinesisLogForwarder>();
@@ -69,20 +73,27 @@ Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
   size_t retry_count = 100;
   size_t retry_delay = 3000;
   size_t original_data_size = log_data.size();
+
+  // Seeding a generator is expensive, use one for every record.
+  boost::uuids::random_generator generator;
   // exit if we sent all the data
   while (log_data.size() > 0) {
+    // Results are reported for each entry, in the order of the entries.
     std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> entries;
-    for (const std::string& log : log_data) {
+    std::vector<size_t> sent;
+    for (size_t i = 0; i < log_data.size(); i++) {
+      const auto& log = log_data[i];
       if (log.size() > kKinesisMaxLogBytes) {
         LOG(ERROR) << "Kinesis log too big, discarding!";
+        continue;
       }
+      sent.push_back(i);
 
       std::string record_partition_key = partition_key_;
       if (FLAGS_aws_kinesis_random_partition_key) {
         // Generate a random partition key for each record, ensuring that
         // records are spread evenly across shards.
-        boost::uuids::uuid uuid = boost::uuids::random_generator()();
-        record_partition_key = boost::uuids::to_string(uuid);
+        record_partition_key = boost::uuids::to_string(generator());
       }
 
       Aws::Kinesis::Model::PutRecordsRequestEntry entry;
@@ -92,6 +103,10 @@ Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
       entries.push_back(std::move(entry));
     }
 
+    if (entries.empty()) {
+      break;
+    }
+
     Aws::Kinesis::Model::PutRecordsRequest request;
     request.WithStreamName(FLAGS_aws_kinesis_stream)
         .WithRecords(std::move(entries));
@@ -105,10 +120,10 @@ Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
     if (result.GetFailedRecordCount() != 0) {
       std::vector<std::string> resend;
       std::string error_msg = "";
-      int i = 0;
+      size_t i = 0;
       for (const auto& record : result.GetRecords()) {
-        if (!record.GetErrorMessage().empty()) {
-          resend.push_back(log_data[i]);
+        if (!record.GetErrorMessage().empty() && i < sent.size()) {
+          resend.push_back(std::move(log_data[sent[i]]));
           error_msg = record.GetErrorMessage();
         }
         i++;
@@ -127,7 +142,7 @@ Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
 
       VLOG(1) << "Resending " << result.GetFailedRecordCount()
               << " records to Kinesis";
-      log_data = resend;
+      log_data = std::move(resend);
       sleepFor(retry_delay);
     } else {
       log_data.clear();
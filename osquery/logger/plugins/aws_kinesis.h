@@ -30,12 +30,15 @@ class KinesisLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kKinesisMaxLogBytes;
   static const size_t kKinesisMaxRecords;
+  static const size_t kKinesisMaxBytes;
 
  public:
   KinesisLogForwarder()
       : BufferedLogForwarder("kinesis",
                              std::chrono::seconds(FLAGS_aws_kinesis_period),
-                             kKinesisMaxRecords) {}
+                             kKinesisMaxRecords) {
+    max_log_bytes_ = kKinesisMaxBytes;
+  }
   Status setUp() override;
 
  protected:
@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <set>
 #include <thread>
 
 #include <boost/property_tree/ptree.hpp>
@@ -22,6 +23,7 @@
 
 #include "osquery/config/parsers/decorators.h"
 #include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
 #include "osquery/logger/plugins/buffered.h"
 
 namespace pt = boost::property_tree;
@@ -33,6 +35,29 @@ FLAG(uint64,
      1000000,
      "Maximum number of logs in buffered output plugins (0 = unlimited)");
 
+FLAG(uint64,
+     buffered_log_batch_bytes,
+     0,
+     "Maximum bytes of logs per request in buffered output plugins (0 = "
+     "unlimited)");
+
+FLAG(uint64,
+     buffered_log_inflight,
+     1,
+     "Number of concurrent requests in buffered output plugins");
+
+FLAG(uint64,
+     buffered_log_memory,
+     0,
+     "Bytes of logs buffered in memory before writing to the database in "
+     "buffered output plugins (0 = always write)");
+
+/// Digits of the counter within a log index.
+const size_t kLogIndexWidth = 20;
+
+/// While a backlog remains the log period is halved, at most this many times.
+const size_t kMaxBacklogSpeedup = 4;
+
 const std::chrono::seconds BufferedLogForwarder::kLogPeriod =
     std::chrono::seconds(4);
 const size_t BufferedLogForwarder::kMaxLogLines = 1024;
@@ -47,59 +72,217 @@ Status BufferedLogForwarder::setUp() {
   }
 
   buffer_count_ = indexes.size();
+  MetricLabels labels = {{"forwarder", index_name_}};
+  depth_ = &getMetricGauge("logger_buffered_logs", labels);
+  sent_ = &getMetricCounter("logger_sent_logs", labels);
+  updateDepth();
   return Status(0);
 }
 
-void BufferedLogForwarder::check() {
-  // Get a list of all the buffered log items, with a max of 1024 lines.
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_);
-
-  // For each index, accumulate the log line into the result or status set.
-  std::vector<std::string> results, statuses;
-  iterate(indexes, ([&results, &statuses, this](std::string& index) {
-            std::string value;
-            auto& target = isResultIndex(index) ? results : statuses;
-            if (getDatabaseValue(kLogs, index, value)) {
-              target.push_back(std::move(value));
-            }
-          }));
-
-  // If any results/statuses were found in the flushed buffer, send.
-  if (results.size() > 0) {
-    status = send(results, "result");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending results to logger: " << status.getMessage();
-    } else {
-      // Clear the results logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isResultIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+void BufferedLogForwarder::updateDepth() {
+  if (depth_ != nullptr) {
+    depth_->set(
+        static_cast<int64_t>(buffer_count_.load() + memory_count_.load()));
+  }
+}
+
+void BufferedLogForwarder::genBatches(const std::vector<std::string>& indexes,
+                                      std::vector<std::string>& values,
+                                      std::vector<LogBatch>& batches) {
+  size_t max_bytes = FLAGS_buffered_log_batch_bytes;
+  if (max_log_bytes_ > 0 && (max_bytes == 0 || max_log_bytes_ < max_bytes)) {
+    max_bytes = max_log_bytes_;
+  }
+
+  for (const auto& results : {true, false}) {
+    LogBatch batch;
+    batch.type = (results) ? "result" : "status";
+    for (size_t i = 0; i < indexes.size() && i < values.size(); i++) {
+      if (isResultIndex(indexes[i]) != results) {
+        continue;
+      }
+
+      // Each batch includes at least one line.
+      auto full =
+          (batch.count >= max_log_lines_ ||
+           (max_bytes > 0 && batch.bytes + values[i].size() > max_bytes));
+      if (batch.count > 0 && full) {
+        batches.push_back(std::move(batch));
+        batch = LogBatch();
+        batch.type = (results) ? "result" : "status";
+      }
+
+      if (batch.count == 0) {
+        batch.low = indexes[i];
+      }
+      batch.high = indexes[i];
+      batch.count++;
+      batch.lines.push_back(i);
+      if (!values[i].empty()) {
+        batch.bytes += values[i].size();
+        batch.data.push_back(std::move(values[i]));
+      }
+    }
+
+    if (batch.count > 0) {
+      batches.push_back(std::move(batch));
     }
   }
+}
 
-  if (statuses.size() > 0) {
-    status = send(statuses, "status");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending status to logger: " << status.getMessage();
+std::vector<bool> BufferedLogForwarder::sendBatches(
+    std::vector<LogBatch>& batches) {
+  auto inflight = std::max(static_cast<size_t>(FLAGS_buffered_log_inflight),
+                           static_cast<size_t>(1));
+
+  // Batches are sent in waves of concurrent requests. After a failure the
+  // following batches of the same type wait for the next check.
+  std::vector<bool> sent(batches.size(), false);
+  std::set<std::string> failed;
+  for (size_t i = 0; i < batches.size();) {
+    std::vector<size_t> wave;
+    for (; i < batches.size() && wave.size() < inflight; i++) {
+      if (failed.count(batches[i].type) == 0) {
+        wave.push_back(i);
+      }
+    }
+
+    std::vector<Status> statuses(wave.size());
+    auto sendBatch = ([this, &batches, &wave, &statuses](size_t j) {
+      auto& batch = batches[wave[j]];
+      if (!batch.data.empty()) {
+        statuses[j] = send(batch.data, batch.type);
+      }
+    });
+
+    if (wave.size() == 1) {
+      sendBatch(0);
     } else {
-      // Clear the status logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isStatusIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+      std::vector<std::thread> threads;
+      for (size_t j = 0; j < wave.size(); j++) {
+        threads.emplace_back(sendBatch, j);
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+
+    for (size_t j = 0; j < wave.size(); j++) {
+      auto& batch = batches[wave[j]];
+      if (!statuses[j].ok()) {
+        VLOG(1) << "Error sending " << batch.type
+                << " to logger: " << statuses[j].getMessage();
+        failed.insert(batch.type);
+        continue;
+      }
+
+      sent[wave[j]] = true;
+      if (sent_ != nullptr) {
+        sent_->add(batch.count);
+      }
     }
   }
+  return sent;
+}
+
+bool BufferedLogForwarder::check() {
+  if (FLAGS_buffered_log_memory > 0 && buffer_count_ == 0) {
+    return checkMemory();
+  }
+
+  // Get a list of the buffered log items, with enough for each request.
+  auto inflight = std::max(static_cast<size_t>(FLAGS_buffered_log_inflight),
+                           static_cast<size_t>(1));
+  std::vector<std::string> indexes;
+  auto status =
+      scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_ * inflight);
+
+  // For each index, accumulate the log line into a result or status batch.
+  std::vector<std::string> values;
+  getDatabaseValues(kLogs, indexes, values);
+  std::vector<LogBatch> batches;
+  genBatches(indexes, values, batches);
+
+  auto sent = sendBatches(batches);
+  bool failed = false;
+  for (size_t i = 0; i < batches.size(); i++) {
+    if (!sent[i]) {
+      failed = true;
+      continue;
+    }
+    // Clear the batch's logs once they were sent.
+    auto& batch = batches[i];
+    deleteRangeWithCount(kLogs, batch.low, batch.high, batch.count);
+  }
 
   // Purge any logs exceeding the max after our send attempt
   if (FLAGS_buffered_log_max > 0) {
     purge();
   }
+  return (!failed && indexes.size() >= max_log_lines_ * inflight);
+}
+
+bool BufferedLogForwarder::checkMemory() {
+  auto inflight = std::max(static_cast<size_t>(FLAGS_buffered_log_inflight),
+                           static_cast<size_t>(1));
+  auto limit = max_log_lines_ * inflight;
+
+  // Take the oldest lines, new lines are buffered while these are sent.
+  std::vector<std::string> indexes;
+  std::vector<std::string> values;
+  {
+    WriteLock lock(memory_mutex_);
+    auto count = std::min(memory_.size(), limit);
+    indexes.reserve(count);
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      memory_bytes_ -= memory_[i].second.size();
+      indexes.push_back(std::move(memory_[i].first));
+      values.push_back(std::move(memory_[i].second));
+    }
+    memory_.erase(memory_.begin(), memory_.begin() + count);
+    memory_count_ = memory_.size();
+  }
+
+  if (indexes.empty()) {
+    return false;
+  }
+
+  // The batches own the lines while sending, keep them until each is sent.
+  auto lines = values;
+  std::vector<LogBatch> batches;
+  genBatches(indexes, values, batches);
+
+  auto sent = sendBatches(batches);
+  bool failed = false;
+  for (size_t i = 0; i < batches.size(); i++) {
+    if (sent[i]) {
+      continue;
+    }
+
+    // Lines not sent are written to the backing store and retried from there.
+    failed = true;
+    WriteLock lock(memory_mutex_);
+    for (const auto& line : batches[i].lines) {
+      addValueWithCount(kLogs, indexes[line], lines[line]);
+    }
+  }
+
+  if (FLAGS_buffered_log_max > 0) {
+    purge();
+  }
+  updateDepth();
+  return (!failed && indexes.size() >= limit);
+}
+
+void BufferedLogForwarder::spill() {
+  WriteLock lock(memory_mutex_);
+  for (const auto& line : memory_) {
+    addValueWithCount(kLogs, line.first, line.second);
+  }
+  memory_.clear();
+  memory_bytes_ = 0;
+  memory_count_ = 0;
 }
 
 void BufferedLogForwarder::purge() {
@@ -164,17 +347,48 @@ void BufferedLogForwarder::purge() {
 }
 
 void BufferedLogForwarder::start() {
+  size_t speedup = 0;
   while (!interrupted()) {
-    check();
+    speedup = (check()) ? std::min(speedup + 1, kMaxBacklogSpeedup) : 0;
+
+    // Cool off and time wait the configured period, shortened while a
+    // backlog of logs is draining.
+    auto period = std::chrono::duration_cast<std::chrono::milliseconds>(
+        log_period_);
+    pauseMilli(period / (1 << speedup));
+  }
+
+  // Lines buffered in memory are kept for the next start.
+  stopped_ = true;
+  spill();
+  updateDepth();
+}
 
-    // Cool off and time wait the configured period.
-    pauseMilli(log_period_);
+Status BufferedLogForwarder::bufferValue(const std::string& index,
+                                         const std::string& value) {
+  if (FLAGS_buffered_log_memory == 0 || stopped_) {
+    return addValueWithCount(kLogs, index, value);
   }
+
+  bool overflow = false;
+  {
+    WriteLock lock(memory_mutex_);
+    memory_.emplace_back(index, value);
+    memory_bytes_ += value.size();
+    memory_count_ = memory_.size();
+    overflow = (memory_bytes_ > FLAGS_buffered_log_memory);
+  }
+
+  if (overflow) {
+    spill();
+  }
+  updateDepth();
+  return Status(0);
 }
 
 Status BufferedLogForwarder::logString(const std::string& s, size_t time) {
   std::string index = genResultIndex(time);
-  return addValueWithCount(kLogs, index, s);
+  return bufferValue(index, s);
 }
 
 Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
@@ -188,35 +402,39 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
     dtree.put(decoration.first, decoration.second);
   }
 
-  for (const auto& item : log) {
-    // Convert the StatusLogLine into ptree format, to convert to JSON.
-    pt::ptree buffer;
-    buffer.put("severity", (google::LogSeverity)item.severity);
-    buffer.put("filename", item.filename);
-    buffer.put("line", item.line);
-    buffer.put("message", item.message);
-    buffer.put("version", kVersion);
-    if (decorations.size() > 0) {
-      buffer.put_child("decorations", dtree);
-    }
-
-    // Convert to JSON, for storing a string-representation in the database.
-    std::string json;
+  // The decorations are the same for each line, convert them to JSON once.
+  std::string djson;
+  if (decorations.size() > 0) {
     try {
       std::stringstream json_output;
-      pt::write_json(json_output, buffer, false);
-      json = json_output.str();
+      pt::write_json(json_output, dtree, false);
+      djson = json_output.str();
+      djson.pop_back();
     } catch (const pt::json_parser::json_parser_error& e) {
-      // The log could not be represented as JSON.
+      // The decorations could not be represented as JSON.
       return Status(1, e.what());
     }
+  }
 
-    // Store the status line in a backing store.
-    if (!json.empty()) {
-      json.pop_back();
+  for (const auto& item : log) {
+    // Write the StatusLogLine as JSON, for storing a string-representation
+    // in the database. This matches the JSON of the equivalent ptree.
+    std::string json = "{\"severity\":\"";
+    json += std::to_string(static_cast<google::LogSeverity>(item.severity));
+    json += "\",\"filename\":";
+    writeJSONString(item.filename, json);
+    json += ",\"line\":\"" + std::to_string(item.line) + "\",\"message\":";
+    writeJSONString(item.message, json);
+    json += ",\"version\":";
+    writeJSONString(kVersion, json);
+    if (!djson.empty()) {
+      json += ",\"decorations\":" + djson;
     }
+    json += '}';
+
+    // Store the status line in a backing store.
     std::string index = genStatusIndex(time);
-    Status status = addValueWithCount(kLogs, index, json);
+    Status status = bufferValue(index, json);
     if (!status.ok()) {
       // Do not continue if any line fails.
       return status;
@@ -255,8 +473,13 @@ std::string BufferedLogForwarder::genIndex(bool results, size_t time) {
   if (time == 0) {
     time = getUnixTime();
   }
-  return genIndexPrefix(results) + std::to_string(time) + "_" +
-         std::to_string(++log_index_);
+  // The counter is padded so indexes are lexicographically ordered, batches
+  // are deleted as ranges of indexes.
+  auto counter = std::to_string(++log_index_);
+  if (counter.size() < kLogIndexWidth) {
+    counter.insert(0, kLogIndexWidth - counter.size(), '0');
+  }
+  return genIndexPrefix(results) + std::to_string(time) + "_" + counter;
 }
 
 Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
@@ -265,6 +488,19 @@ Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
   Status status = setDatabaseValue(domain, key, value);
   if (status.ok()) {
     buffer_count_++;
+    updateDepth();
+  }
+  return status;
+}
+
+Status BufferedLogForwarder::deleteRangeWithCount(const std::string& domain,
+                                                  const std::string& low,
+                                                  const std::string& high,
+                                                  size_t count) {
+  Status status = deleteDatabaseRange(domain, low, high);
+  if (status.ok()) {
+    buffer_count_ -= std::min(count, buffer_count_.load());
+    updateDepth();
   }
   return status;
 }
@@ -274,6 +510,7 @@ Status BufferedLogForwarder::deleteValueWithCount(const std::string& domain,
   Status status = deleteDatabaseValue(domain, key);
   if (status.ok()) {
     buffer_count_--;
+    updateDepth();
   }
   return status;
 }
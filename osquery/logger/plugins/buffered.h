@@ -17,11 +17,15 @@
 #include <thread>
 #include <vector>
 
+#include <osquery/core.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
 namespace osquery {
 
+class MetricCounter;
+class MetricGauge;
+
 /// Iterate through a vector, yielding during high utilization
 inline void iterate(std::vector<std::string>& input,
                     std::function<void(std::string&)> predicate) {
@@ -47,6 +51,10 @@ inline void iterate(std::vector<std::string>& input,
  *
  * Subclasses must define the send() method, and if a subclass overrides
  * setUp(), it **MUST** call this base class setUp() from that method.
+ *
+ * When --buffered_log_memory is set, logs are buffered in memory up to that
+ * many bytes and written to the backing store only when a send fails, the
+ * memory buffer overflows, or the forwarder stops.
  */
 class BufferedLogForwarder : public InternalRunnable {
  protected:
@@ -84,6 +92,9 @@ class BufferedLogForwarder : public InternalRunnable {
   /// A simple wait lock, and flush based on settings.
   void start() override;
 
+  /// Write the logs buffered in memory to the backing store.
+  void spill();
+
   /**
    * @brief Set up the forwarder. May be used to init remote clients, etc.
    *
@@ -95,7 +106,7 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Log a results string
    *
-   * Writes the result string to the backing store for buffering, but *does
+   * Writes the result string to the memory or backing store buffer, but *does
    * not* actually send the string. The string will only be sent when check()
    * runs and uses send() to send it.
    *
@@ -128,11 +139,18 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to max_log_lines_ log lines.
-   * Sort those lines into status and request types then forward (send) each
-   * set. On success, clear the data and indexes. Calls purge upon completion.
+   * Scan the logs domain for up to max_log_lines_ log lines for each of the
+   * buffered_log_inflight concurrent requests. Sort those lines into status
+   * and result batches, limited by lines and max_log_bytes_, then
+   * forward (send) each batch. Each batch sent is cleared with a range delete
+   * of its indexes. Calls purge upon completion.
+   *
+   * While the logs domain is empty, the lines buffered in memory are sent
+   * instead, and the lines of batches not sent are spilled to the domain.
+   *
+   * @return true if a backlog of logs remains.
    */
-  void check();
+  bool check();
 
   /**
    * @brief Purge the oldest logs, if the max is exceeded
@@ -154,6 +172,42 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Helper for isResultIndex/isStatusIndex
   bool isIndex(const std::string& index, bool results);
 
+  /// A contiguous range of buffered log indexes of one type.
+  struct LogBatch {
+    std::string type;
+    std::vector<std::string> data;
+
+    /// The first and last index, and the number of indexes.
+    std::string low;
+    std::string high;
+    size_t count{0};
+
+    size_t bytes{0};
+
+    /// The positions of the batch's lines in the split indexes.
+    std::vector<size_t> lines;
+  };
+
+  /// Split scanned indexes and values into batches of each type.
+  void genBatches(const std::vector<std::string>& indexes,
+                  std::vector<std::string>& values,
+                  std::vector<LogBatch>& batches);
+
+  /**
+   * @brief Send batches in waves of buffered_log_inflight requests.
+   *
+   * After a failure the following batches of the same type are not sent.
+   *
+   * @return whether each batch was sent.
+   */
+  std::vector<bool> sendBatches(std::vector<LogBatch>& batches);
+
+  /// Send the lines buffered in memory, see check.
+  bool checkMemory();
+
+  /// Buffer a log line in memory, or the backing store.
+  Status bufferValue(const std::string& index, const std::string& value);
+
  protected:
   /// Generate a result index string to use with the backing store
   std::string genResultIndex(size_t time = 0);
@@ -181,6 +235,18 @@ class BufferedLogForwarder : public InternalRunnable {
   Status deleteValueWithCount(const std::string& domain,
                               const std::string& key);
 
+  /**
+   * @brief Delete a range of count database values while maintaining count
+   *
+   */
+  Status deleteRangeWithCount(const std::string& domain,
+                              const std::string& low,
+                              const std::string& high,
+                              size_t count);
+
+  /// Report the buffered log count to the logger_buffered_logs gauge.
+  void updateDepth();
+
  protected:
   /// Seconds between flushing logs
   std::chrono::seconds log_period_;
@@ -188,6 +254,14 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Max number of logs to flush per check
   size_t max_log_lines_;
 
+  /**
+   * @brief Max bytes of logs per send, 0 for no limit
+   *
+   * Forwarders with a request size limit set this. The smaller of this and
+   * --buffered_log_batch_bytes applies.
+   */
+  size_t max_log_bytes_{0};
+
   /**
    * @brief Name to use in index
    *
@@ -203,5 +277,26 @@ class BufferedLogForwarder : public InternalRunnable {
 
   /// Stores the count of buffered logs
   std::atomic<size_t> buffer_count_{0};
+
+  /// Indexes and lines buffered in memory, oldest first.
+  std::vector<std::pair<std::string, std::string>> memory_;
+
+  /// The sum of the lines buffered in memory.
+  size_t memory_bytes_{0};
+
+  /// The count of lines buffered in memory, for the depth gauge.
+  std::atomic<size_t> memory_count_{0};
+
+  /// Protect the memory buffer, and writes of spilled lines.
+  Mutex memory_mutex_;
+
+  /// The forwarder stopped, lines are written to the backing store.
+  std::atomic<bool> stopped_{false};
+
+  /// Buffered logs by forwarder, set by setUp.
+  MetricGauge* depth_{nullptr};
+
+  /// Logs sent by forwarder, set by setUp.
+  MetricCounter* sent_{nullptr};
 };
 }
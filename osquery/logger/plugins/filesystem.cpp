@@ -8,12 +8,26 @@
  *
  */
 
+#include <chrono>
 #include <exception>
+#include <iomanip>
+#include <map>
+#include <sstream>
 
+#include <zlib.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/fileops.h"
+#include "osquery/remote/requests.h"
+
 namespace fs = boost::filesystem;
 
 /**
@@ -33,13 +47,144 @@ FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
 FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 
+FLAG(uint64,
+     logger_flush_size,
+     0,
+     "Bytes of results buffered before writing (0 = write each line)");
+
+FLAG(uint64,
+     logger_flush_interval,
+     3,
+     "Seconds buffered results may wait before writing");
+
+FLAG(uint64,
+     logger_rotate_size,
+     0,
+     "Rotate results logs when they reach this size in bytes (0 = never)");
+
+FLAG(uint64, logger_rotate_count, 5, "Number of rotated results logs kept");
+
+FLAG(uint64,
+     logger_segment_size,
+     0,
+     "Write results logs as gzip segments of this many bytes (0 = one log)");
+
+FLAG(uint64,
+     logger_segment_interval,
+     60,
+     "Seconds before a results log segment is completed (0 = by size only)");
+
+FLAG(uint64,
+     logger_segment_count,
+     0,
+     "Number of completed results log segments kept (0 = unlimited)");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 
+/// The suffix of the segment being written.
+const std::string kLoggerSegmentSuffix = ".segment";
+
+/// The suffix of the list of completed segments.
+const std::string kLoggerManifestSuffix = ".manifest";
+
+/// The suffix of a segment left by a previous run that is not valid gzip.
+const std::string kLoggerPartialSuffix = ".partial";
+
+/// Lines are buffered before compressing, when there is no flush size.
+const size_t kLoggerSegmentFlushSize = 64 * 1024;
+
+/// The compression level of segments, the zlib default.
+const int kLoggerSegmentCompression = 6;
+
+/// Digits of the sequence number within a completed segment's name.
+const size_t kLoggerSegmentWidth = 10;
+
+/**
+ * @brief Check if a segment is a sequence of complete gzip members.
+ *
+ * A write interrupted by a crash leaves a truncated member.
+ */
+static bool isSegmentComplete(const std::string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  char buffer[4096];
+  auto ret = Z_OK;
+  while (stream.avail_in > 0) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      inflateReset(&stream);
+    } else if (ret != Z_OK) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  return ret == Z_STREAM_END && stream.avail_in == 0;
+}
+
+/// Check if results logs are written as segments.
+static inline bool isSegmented() {
+  return FLAGS_logger_segment_size > 0;
+}
+
+/// Bytes of lines buffered before a write.
+static inline size_t getFlushSize() {
+  if (isSegmented() && FLAGS_logger_flush_size == 0) {
+    return kLoggerSegmentFlushSize;
+  }
+  return FLAGS_logger_flush_size;
+}
+
+/// An open results log and the lines not yet written to it.
+struct FilesystemLogFile {
+  std::unique_ptr<PlatformFile> fd{nullptr};
+
+  /// Lines waiting for a flush.
+  std::string buffer;
+
+  /// Size of the file on disk.
+  size_t size{0};
+
+  /// The reopen request count when the file was opened.
+  size_t reopen{0};
+
+  /// The last flush, or open.
+  std::chrono::steady_clock::time_point flushed;
+
+  /// Segmented logs: bytes of lines written to the segment.
+  size_t segment_bytes{0};
+
+  /// Segmented logs: when the segment was started.
+  std::chrono::steady_clock::time_point segment_started;
+
+  /// Segmented logs: the last completed segment's sequence number.
+  size_t sequence{0};
+
+  /// Segmented logs: the manifest lines of the completed segments.
+  std::vector<std::string> segments;
+
+  /// Segmented logs: the manifest was read.
+  bool indexed{false};
+};
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp() override;
 
+  /// Write buffered lines before the logger is removed.
+  void tearDown() override;
+
+  /// Write the buffered lines of every log whose flush interval passed.
+  void flushExpired();
+
   /// Log results (differential) to a distinct path.
   Status logString(const std::string& s) override;
 
@@ -65,19 +210,70 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
                          const std::string& filename,
                          bool empty = false);
 
+  /// Open a log for appending, the caller must hold the writer mutex.
+  Status openFile(const std::string& filename, FilesystemLogFile& file);
+
+  /// Write a log's buffered lines, rotating it first if it is too large.
+  Status flushFile(const std::string& filename, FilesystemLogFile& file);
+
+  /// Move a log to filename.1, shifting older logs, then reopen it.
+  Status rotateFile(const std::string& filename, FilesystemLogFile& file);
+
+  /// Read a segmented log's manifest of completed segments.
+  void readManifest(const std::string& filename, FilesystemLogFile& file);
+
+  /// Complete, or rename as partial, a segment left by a previous run.
+  void recoverSegment(const std::string& filename, FilesystemLogFile& file);
+
+  /// Rename the segment being written into a completed segment.
+  Status completeSegment(const std::string& filename, FilesystemLogFile& file);
+
+  /// Rename the closed segment to the next sequence and list it.
+  Status renameSegment(const std::string& filename, FilesystemLogFile& file);
+
+  /// Replace the manifest with the list of completed segments.
+  Status writeManifest(const std::string& filename,
+                       const FilesystemLogFile& file);
+
  private:
   /// The folder where Glog and the result/snapshot files are written.
   fs::path log_path_;
 
+  /// Open results and snapshot logs, by filename.
+  std::map<std::string, FilesystemLogFile> files_;
+
   /// Filesystem writer mutex.
   Mutex mutex_;
 
+  /// Set when the buffered lines flushing service was started.
+  bool flushing_{false};
+
  private:
   FRIEND_TEST(FilesystemLoggerTests, test_filesystem_init);
 };
 
 REGISTER(FilesystemLoggerPlugin, "logger", "filesystem");
 
+/// Write buffered results lines when a logger's flush interval passes.
+class FilesystemLoggerFlusher : public PeriodicRunnable {
+ public:
+  explicit FilesystemLoggerFlusher(FilesystemLoggerPlugin* logger)
+      : logger_(logger) {}
+
+  bool run() override {
+    logger_->flushExpired();
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::seconds(FLAGS_logger_flush_interval);
+  }
+
+ private:
+  /// The registry owns the logger, it outlives the service.
+  FilesystemLoggerPlugin* logger_{nullptr};
+};
+
 Status FilesystemLoggerPlugin::setUp() {
   log_path_ = fs::path(FLAGS_logger_path);
 
@@ -85,10 +281,51 @@ Status FilesystemLoggerPlugin::setUp() {
   // Glog 0.3.4 does not support a logfile mode.
   // FLAGS_logfile_mode = FLAGS_logger_mode;
 
+  // Buffered lines are written after an interval even when logging is idle.
+  if (getFlushSize() > 0 && FLAGS_logger_flush_interval > 0) {
+    WriteLock lock(mutex_);
+    if (!flushing_) {
+      flushing_ = true;
+      Dispatcher::addPeriodicService(
+          std::make_shared<FilesystemLoggerFlusher>(this));
+    }
+  }
+
   // Ensure that we create the results log here.
   return logStringToFile("", kFilesystemLoggerFilename, true);
 }
 
+void FilesystemLoggerPlugin::tearDown() {
+  WriteLock lock(mutex_);
+  for (auto& file : files_) {
+    flushFile(file.first, file.second);
+    if (isSegmented()) {
+      completeSegment(file.first, file.second);
+    }
+  }
+}
+
+void FilesystemLoggerPlugin::flushExpired() {
+  auto interval = std::chrono::seconds(FLAGS_logger_flush_interval);
+  auto now = std::chrono::steady_clock::now();
+
+  auto segment_interval = std::chrono::seconds(FLAGS_logger_segment_interval);
+
+  WriteLock lock(mutex_);
+  for (auto& file : files_) {
+    if (!file.second.buffer.empty() && now - file.second.flushed >= interval) {
+      flushFile(file.first, file.second);
+    }
+
+    // Segments are completed after an interval, so shippers read idle logs.
+    if (isSegmented() && FLAGS_logger_segment_interval > 0 &&
+        now - file.second.segment_started >= segment_interval) {
+      flushFile(file.first, file.second);
+      completeSegment(file.first, file.second);
+    }
+  }
+}
+
 Status FilesystemLoggerPlugin::logString(const std::string& s) {
   return logStringToFile(s, kFilesystemLoggerFilename);
 }
@@ -97,15 +334,250 @@ Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
                                                const std::string& filename,
                                                bool empty) {
   WriteLock lock(mutex_);
-  Status status;
+  auto& file = files_[filename];
+  // Logs are reopened after a SIGHUP, an external rotation may have moved them.
+  if (file.fd == nullptr || file.reopen != getLogReopenRequests()) {
+    auto status = openFile(filename, file);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (empty) {
+    return Status(0, "OK");
+  }
+
+  file.buffer += s;
+  file.buffer += '\n';
+  auto interval = std::chrono::seconds(FLAGS_logger_flush_interval);
+  if (file.buffer.size() >= getFlushSize() ||
+      std::chrono::steady_clock::now() - file.flushed >= interval) {
+    return flushFile(filename, file);
+  }
+  return Status(0, "OK");
+}
+
+Status FilesystemLoggerPlugin::openFile(const std::string& filename,
+                                        FilesystemLogFile& file) {
+  auto path = (log_path_ / filename).string();
+  if (isSegmented()) {
+    // A segment left by a previous run is never appended to, a truncated
+    // gzip member would hide the lines written after it.
+    path += kLoggerSegmentSuffix;
+    if (!file.indexed) {
+      readManifest(filename, file);
+      recoverSegment(filename, file);
+      file.indexed = true;
+      file.segment_started = std::chrono::steady_clock::now();
+    }
+  }
   try {
-    status = writeTextFile((log_path_ / filename).string(),
-                           (empty) ? "" : s + '\n',
-                           FLAGS_logger_mode,
-                           true);
+    file.fd.reset(new PlatformFile(
+        path, PF_OPEN_ALWAYS | PF_WRITE | PF_APPEND, FLAGS_logger_mode));
   } catch (const std::exception& e) {
+    file.fd.reset();
     return Status(1, e.what());
   }
+
+  if (!file.fd->isValid()) {
+    file.fd.reset();
+    return Status(1, "Could not create file: " + path);
+  }
+
+  // If the file existed with different permissions before our open
+  // they must be restricted.
+  if (!platformChmod(path, FLAGS_logger_mode)) {
+    file.fd.reset();
+    return Status(1, "Failed to change permissions for file: " + path);
+  }
+
+  file.size = file.fd->size();
+  file.reopen = getLogReopenRequests();
+  file.flushed = std::chrono::steady_clock::now();
+  return Status(0, "OK");
+}
+
+Status FilesystemLoggerPlugin::flushFile(const std::string& filename,
+                                         FilesystemLogFile& file) {
+  if (file.buffer.empty() || file.fd == nullptr) {
+    return Status(0, "OK");
+  }
+
+  if (isSegmented()) {
+    // Each flush is a complete gzip member, a segment is their concatenation.
+    StreamCompressor compressor(kLoggerSegmentCompression);
+    compressor.append(file.buffer);
+    auto data = compressor.finish();
+    if (data.empty()) {
+      return Status(1, "Failed to compress contents of file: " + filename);
+    }
+
+    auto bytes = file.fd->write(data.c_str(), data.size());
+    file.flushed = std::chrono::steady_clock::now();
+    if (bytes < 0 || static_cast<size_t>(bytes) != data.size()) {
+      file.fd.reset();
+      return Status(1, "Failed to write contents to file: " + filename);
+    }
+
+    file.size += data.size();
+    file.segment_bytes += file.buffer.size();
+    file.buffer.clear();
+    if (file.segment_bytes >= FLAGS_logger_segment_size) {
+      return completeSegment(filename, file);
+    }
+    return Status(0, "OK");
+  }
+
+  if (FLAGS_logger_rotate_size > 0 && file.size > 0 &&
+      file.size + file.buffer.size() > FLAGS_logger_rotate_size) {
+    auto status = rotateFile(filename, file);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  auto bytes = file.fd->write(file.buffer.c_str(), file.buffer.size());
+  file.flushed = std::chrono::steady_clock::now();
+  if (bytes < 0 || static_cast<size_t>(bytes) != file.buffer.size()) {
+    // Keep the lines, a reopen is attempted with the next write.
+    file.fd.reset();
+    return Status(1, "Failed to write contents to file: " + filename);
+  }
+
+  file.size += file.buffer.size();
+  file.buffer.clear();
+  return Status(0, "OK");
+}
+
+Status FilesystemLoggerPlugin::rotateFile(const std::string& filename,
+                                          FilesystemLogFile& file) {
+  // The log is closed while it is renamed.
+  file.fd.reset();
+
+  auto path = (log_path_ / filename).string();
+  boost::system::error_code ec;
+  if (FLAGS_logger_rotate_count == 0) {
+    fs::remove(path, ec);
+  } else {
+    for (auto i = FLAGS_logger_rotate_count; i > 1; i--) {
+      auto older = path + "." + std::to_string(i - 1);
+      if (fs::exists(older, ec)) {
+        fs::rename(older, path + "." + std::to_string(i), ec);
+      }
+    }
+    fs::rename(path, path + ".1", ec);
+  }
+
+  return openFile(filename, file);
+}
+
+void FilesystemLoggerPlugin::readManifest(const std::string& filename,
+                                          FilesystemLogFile& file) {
+  std::string content;
+  auto path = log_path_ / (filename + kLoggerManifestSuffix);
+  if (!pathExists(path).ok() || !readFile(path, content).ok()) {
+    return;
+  }
+
+  file.segments.clear();
+  for (const auto& line : osquery::split(content, "\n")) {
+    file.segments.push_back(line);
+  }
+
+  // Continue the sequence of the last completed segment.
+  if (!file.segments.empty()) {
+    auto name = file.segments.back().substr(0, file.segments.back().find(' '));
+    auto start = filename.size() + 1;
+    if (name.size() > start) {
+      auto sequence = name.substr(start, name.find('.', start) - start);
+      file.sequence = static_cast<size_t>(
+          std::strtoull(sequence.c_str(), nullptr, 10));
+    }
+  }
+}
+
+void FilesystemLoggerPlugin::recoverSegment(const std::string& filename,
+                                            FilesystemLogFile& file) {
+  std::string content;
+  auto path = log_path_ / (filename + kLoggerSegmentSuffix);
+  if (!pathExists(path).ok() || !readFile(path, content).ok()) {
+    return;
+  }
+
+  boost::system::error_code ec;
+  if (content.empty()) {
+    fs::remove(path, ec);
+  } else if (isSegmentComplete(content)) {
+    file.size = content.size();
+    if (renameSegment(filename, file).ok()) {
+      writeManifest(filename, file);
+    }
+  } else {
+    // The lines before the truncated member are kept for inspection.
+    fs::rename(path, path.string() + kLoggerPartialSuffix, ec);
+  }
+  file.size = 0;
+}
+
+Status FilesystemLoggerPlugin::completeSegment(const std::string& filename,
+                                               FilesystemLogFile& file) {
+  if (file.fd == nullptr || file.size == 0) {
+    file.segment_started = std::chrono::steady_clock::now();
+    return Status(0, "OK");
+  }
+
+  // The segment is closed while it is renamed.
+  file.fd.reset();
+  auto status = renameSegment(filename, file);
+  if (!status.ok()) {
+    return status;
+  }
+
+  status = writeManifest(filename, file);
+  file.segment_bytes = 0;
+  file.segment_started = std::chrono::steady_clock::now();
+  auto opened = openFile(filename, file);
+  return (status.ok()) ? opened : status;
+}
+
+Status FilesystemLoggerPlugin::renameSegment(const std::string& filename,
+                                             FilesystemLogFile& file) {
+  std::stringstream name;
+  name << filename << "." << std::setw(kLoggerSegmentWidth)
+       << std::setfill('0') << ++file.sequence << ".gz";
+  auto segment = (log_path_ / (filename + kLoggerSegmentSuffix)).string();
+  boost::system::error_code ec;
+  fs::rename(segment, log_path_ / name.str(), ec);
+  if (ec) {
+    --file.sequence;
+    return Status(1, "Failed to complete segment: " + ec.message());
+  }
+
+  file.segments.push_back(name.str() + " " + std::to_string(file.size));
+  if (FLAGS_logger_segment_count > 0) {
+    while (file.segments.size() > FLAGS_logger_segment_count) {
+      auto oldest = file.segments.front().substr(
+          0, file.segments.front().find(' '));
+      fs::remove(log_path_ / oldest, ec);
+      file.segments.erase(file.segments.begin());
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status FilesystemLoggerPlugin::writeManifest(const std::string& filename,
+                                             const FilesystemLogFile& file) {
+  // The manifest is replaced, shippers never read a partial list.
+  auto manifest = (log_path_ / (filename + kLoggerManifestSuffix)).string();
+  auto content = boost::algorithm::join(file.segments, "\n") + "\n";
+  auto status = writeTextFile(manifest + ".tmp", content, FLAGS_logger_mode);
+  boost::system::error_code ec;
+  if (status.ok()) {
+    fs::rename(manifest + ".tmp", manifest, ec);
+    if (ec) {
+      status = Status(1, "Failed to write manifest: " + ec.message());
+    }
+  }
   return status;
 }
 
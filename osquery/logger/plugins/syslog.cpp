@@ -8,10 +8,23 @@
  *
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstring>
 
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/metrics.h"
+#include "osquery/logger/plugins/syslog.h"
 
 namespace osquery {
 
@@ -25,6 +38,40 @@ FLAG(bool,
      false,
      "Prepend @cee: tag to logged JSON messages");
 
+FLAG(uint64,
+     logger_syslog_queue_max,
+     0,
+     "Max queued syslog messages, sent by a service to --logger_syslog_path "
+     "(0 = call syslog)");
+
+FLAG(bool,
+     logger_syslog_drop,
+     false,
+     "Drop syslog messages when the queue is full instead of waiting");
+
+#ifdef __APPLE__
+FLAG(string,
+     logger_syslog_path,
+     "/var/run/syslog",
+     "Path of the syslog datagram socket");
+#else
+FLAG(string,
+     logger_syslog_path,
+     "/dev/log",
+     "Path of the syslog datagram socket");
+#endif
+
+FLAG(bool,
+     logger_syslog_rfc5424,
+     false,
+     "Format queued syslog messages with RFC 5424 headers");
+
+/// Time the sender waits for messages or the receiver between checks.
+const std::chrono::milliseconds kSyslogWait(200);
+
+/// The maximum number of datagrams sent in a batch.
+const size_t kSyslogBatchMax = 64;
+
 class SyslogLoggerPlugin : public LoggerPlugin {
  public:
   bool usesLogStatus() override { return true; }
@@ -34,15 +81,218 @@ class SyslogLoggerPlugin : public LoggerPlugin {
   void init(const std::string& name,
             const std::vector<StatusLogLine>& log) override;
   Status logStatus(const std::vector<StatusLogLine>& log) override;
+
+ private:
+  /// Queue a message for the sender, or call syslog without a sender.
+  void log(int severity, const std::string& message);
+
+ private:
+  /// The application name messages are logged with.
+  std::string tag_;
+
+  /// The sender's queue, if --logger_syslog_queue_max is set.
+  std::shared_ptr<LoggerQueue> queue_;
 };
 
 REGISTER(SyslogLoggerPlugin, "logger", "syslog");
 
+std::string formatSyslogMessage(int priority,
+                                const std::string& tag,
+                                pid_t pid,
+                                std::chrono::system_clock::time_point time,
+                                const std::string& message,
+                                bool rfc5424) {
+  auto seconds = std::chrono::system_clock::to_time_t(time);
+  struct tm tm;
+  char timestamp[32] = {0};
+
+  std::string datagram = "<" + std::to_string(priority) + ">";
+  if (rfc5424) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                      time.time_since_epoch())
+                      .count() %
+                  1000000;
+    gmtime_r(&seconds, &tm);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    char fraction[8] = {0};
+    snprintf(fraction, sizeof(fraction), ".%06d", static_cast<int>(micros));
+
+    auto hostname = getHostname();
+    datagram += "1 " + std::string(timestamp) + fraction + "Z " +
+                ((hostname.empty()) ? "-" : hostname) + " " + tag + " " +
+                std::to_string(pid) + " - - ";
+  } else {
+    localtime_r(&seconds, &tm);
+    strftime(timestamp, sizeof(timestamp), "%b %e %H:%M:%S", &tm);
+    datagram += std::string(timestamp) + " " + tag + "[" +
+                std::to_string(pid) + "]: ";
+  }
+  datagram += message;
+  return datagram;
+}
+
+SyslogSender::~SyslogSender() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool SyslogSender::connect() {
+  struct sockaddr_un addr;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+
+  fd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd_ < 0) {
+    return false;
+  }
+  fcntl(fd_, F_SETFD, FD_CLOEXEC);
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path_.c_str(), path_.size());
+  if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) !=
+      0) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+int SyslogSender::sendMessages(const std::vector<LoggerRequest>& batch,
+                               size_t offset) {
+#ifdef __linux__
+  std::vector<struct mmsghdr> messages(batch.size() - offset);
+  std::vector<struct iovec> vectors(messages.size());
+  for (size_t i = 0; i < messages.size(); i++) {
+    const auto& data = batch[offset + i].data;
+    vectors[i].iov_base = const_cast<char*>(data.data());
+    vectors[i].iov_len = data.size();
+    memset(&messages[i], 0, sizeof(struct mmsghdr));
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  return sendmmsg(fd_,
+                  messages.data(),
+                  static_cast<unsigned int>(messages.size()),
+                  MSG_DONTWAIT);
+#else
+  int sent = 0;
+  for (size_t i = offset; i < batch.size(); i++) {
+    const auto& data = batch[i].data;
+    if (::send(fd_, data.data(), data.size(), 0) < 0) {
+      return (sent > 0) ? sent : -1;
+    }
+    sent++;
+  }
+  return sent;
+#endif
+}
+
+void SyslogSender::send(const std::vector<LoggerRequest>& batch) {
+  size_t sent = 0;
+  size_t dropped = 0;
+  while (sent + dropped < batch.size()) {
+    if (fd_ < 0 && !connect()) {
+      // The receiver is not running, retry until stopped.
+      if (interrupted()) {
+        break;
+      }
+      pauseMilli(kSyslogWait);
+      continue;
+    }
+
+    auto count = sendMessages(batch, sent + dropped);
+    if (count > 0) {
+      sent += count;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      // The receiver is backed up, wait for space without blocking stops.
+      if (interrupted()) {
+        break;
+      }
+      struct pollfd writable = {fd_, POLLOUT, 0};
+      poll(&writable, 1, static_cast<int>(kSyslogWait.count()));
+    } else if (errno == EMSGSIZE || errno == EINTR) {
+      // Datagrams the receiver cannot accept are dropped.
+      dropped += (errno == EMSGSIZE) ? 1 : 0;
+    } else {
+      // The receiver restarted, reconnect.
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  dropped = batch.size() - sent;
+  if (dropped > 0) {
+    getMetricCounter("logger_syslog_dropped").add(dropped);
+  }
+  for (size_t i = 0; i < batch.size(); i++) {
+    queue_->done();
+  }
+}
+
+void SyslogSender::start() {
+  std::vector<LoggerRequest> batch;
+  LoggerRequest request;
+  while (!interrupted()) {
+    if (!queue_->pop(request, kSyslogWait)) {
+      continue;
+    }
+
+    batch.clear();
+    batch.push_back(std::move(request));
+    while (batch.size() < kSyslogBatchMax &&
+           queue_->pop(request, std::chrono::milliseconds(0))) {
+      batch.push_back(std::move(request));
+    }
+    send(batch);
+  }
+
+  // The queue is closed, send the datagrams that remain.
+  batch.clear();
+  while (queue_->pop(request, std::chrono::milliseconds(0))) {
+    batch.push_back(std::move(request));
+  }
+  if (!batch.empty()) {
+    send(batch);
+  }
+}
+
+void SyslogSender::stop() {
+  queue_->close();
+}
+
+void SyslogLoggerPlugin::log(int severity, const std::string& message) {
+  if (queue_ != nullptr) {
+    LoggerRequest request;
+    request.data = formatSyslogMessage((FLAGS_logger_syslog_facility << 3) |
+                                           severity,
+                                       tag_,
+                                       getpid(),
+                                       std::chrono::system_clock::now(),
+                                       message,
+                                       FLAGS_logger_syslog_rfc5424);
+    auto status = queue_->push(std::move(request), FLAGS_logger_syslog_drop);
+    if (status.getCode() == 1) {
+      getMetricCounter("logger_syslog_dropped").add(1);
+    }
+    if (status.getCode() != 2) {
+      return;
+    }
+    // The sender stopped, log synchronously.
+  }
+  syslog(severity, "%s", message.c_str());
+}
+
 Status SyslogLoggerPlugin::logString(const std::string& s) {
   if (FLAGS_logger_syslog_prepend_cee) {
-    syslog(LOG_INFO, "@cee:%s", s.c_str());
+    log(LOG_INFO, "@cee:" + s);
   } else {
-    syslog(LOG_INFO, "%s", s.c_str());
+    log(LOG_INFO, s);
   }
   return Status(0, "OK");
 }
@@ -64,7 +314,7 @@ Status SyslogLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
                        " location=" + item.filename + ":" +
                        std::to_string(item.line) + " message=" + item.message;
 
-    syslog(severity, "%s", line.c_str());
+    this->log(severity, line);
   }
   return Status(0, "OK");
 }
@@ -78,6 +328,14 @@ void SyslogLoggerPlugin::init(const std::string& name,
     FLAGS_logger_syslog_facility = LOG_LOCAL3 >> 3;
   }
   openlog(name.c_str(), LOG_PID | LOG_CONS, FLAGS_logger_syslog_facility << 3);
+  tag_ = name;
+
+  // The sender is started once, syslog is used if it stops.
+  if (FLAGS_logger_syslog_queue_max > 0 && queue_ == nullptr) {
+    queue_ = std::make_shared<LoggerQueue>(FLAGS_logger_syslog_queue_max);
+    Dispatcher::addService(
+        std::make_shared<SyslogSender>(FLAGS_logger_syslog_path, queue_));
+  }
 
   // Now funnel the intermediate status logs provided to `init`.
   logStatus(log);
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest_prod.h>
+
+#include <osquery/dispatcher.h>
+
+#include "osquery/logger/queue.h"
+
+namespace osquery {
+
+/**
+ * @brief Format a message as a syslog datagram.
+ *
+ * The default format is the one the C library's syslog sends to a local
+ * socket: `<PRI>Mmm dd hh:mm:ss TAG[PID]: MESSAGE`, with the local time.
+ * RFC 5424 datagrams are `<PRI>1 TIMESTAMP HOSTNAME TAG PID - - MESSAGE`,
+ * with the UTC time in microseconds.
+ *
+ * @param priority the facility and severity.
+ * @param tag the application name the daemon was opened with.
+ * @param pid the process ID.
+ * @param time the time the message was logged.
+ * @param message the message.
+ * @param rfc5424 format the datagram for RFC 5424 receivers.
+ */
+std::string formatSyslogMessage(int priority,
+                                const std::string& tag,
+                                pid_t pid,
+                                std::chrono::system_clock::time_point time,
+                                const std::string& message,
+                                bool rfc5424);
+
+/**
+ * @brief A service sending queued syslog datagrams to the syslog socket.
+ *
+ * The socket is non-blocking. Datagrams are sent in batches, with sendmmsg
+ * where available, and a receiver that is backed up only delays this
+ * service: loggers queue datagrams and return. When the queue is full they
+ * wait or drop the datagram, see --logger_syslog_drop. Each datagram popped
+ * is counted with the queue's done.
+ */
+class SyslogSender : public InternalRunnable {
+ public:
+  SyslogSender(const std::string& path,
+               const std::shared_ptr<LoggerQueue>& queue)
+      : path_(path), queue_(queue) {}
+
+  ~SyslogSender();
+
+  /// Send datagrams until interrupted, then send what remains.
+  void start() override;
+
+  /// Close the queue, datagrams logged after the stop are sent by syslog.
+  void stop() override;
+
+ private:
+  /// Open and connect the socket, false if the receiver is unavailable.
+  bool connect();
+
+  /// Send a batch, waiting for the receiver while not interrupted.
+  void send(const std::vector<LoggerRequest>& batch);
+
+  /**
+   * @brief Send datagrams from the batch.
+   *
+   * @return the number sent, or -1 with errno set if none were sent.
+   */
+  int sendMessages(const std::vector<LoggerRequest>& batch, size_t offset);
+
+ private:
+  std::string path_;
+  std::shared_ptr<LoggerQueue> queue_;
+
+  int fd_{-1};
+
+ private:
+  FRIEND_TEST(SyslogLoggerTests, test_sender);
+};
+}
@@ -14,6 +14,7 @@
 #include <gtest/gtest.h>
 
 #include <aws/core/utils/Outcome.h>
+#include <aws/firehose/FirehoseErrors.h>
 #include <aws/firehose/model/PutRecordBatchRequest.h>
 #include <aws/firehose/model/PutRecordBatchResponseEntry.h>
 #include <aws/firehose/model/PutRecordBatchResult.h>
@@ -54,8 +55,9 @@ TEST_F(FirehoseTests, test_send) {
   forwarder.client_ = client;
 
   std::vector<std::string> logs{"foo"};
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome;
-  outcome.GetResult().SetFailedPutCount(0);
+  Aws::Firehose::Model::PutRecordBatchResult result;
+  result.SetFailedPutCount(0);
+  Aws::Firehose::Model::PutRecordBatchOutcome outcome(result);
   EXPECT_CALL(*client,
               PutRecordBatch(Property(
                   &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
@@ -63,19 +65,67 @@ TEST_F(FirehoseTests, test_send) {
       .WillOnce(Return(outcome));
   EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
 
-  logs = {"bar", "foo"};
+  // Only the records that failed are sent again.
+  logs = {"bar", "foo", "baz"};
   Aws::Firehose::Model::PutRecordBatchResponseEntry entry;
-  outcome.GetResult().AddRequestResponses(entry);
-  entry.SetErrorCode("foo");
-  entry.SetErrorMessage("Foo error");
-  outcome.GetResult().SetFailedPutCount(1);
-  outcome.GetResult().AddRequestResponses(entry);
+  Aws::Firehose::Model::PutRecordBatchResponseEntry error_entry;
+  error_entry.SetErrorCode("foo");
+  error_entry.SetErrorMessage("Foo error");
+  Aws::Firehose::Model::PutRecordBatchResponseEntry code_entry;
+  code_entry.SetErrorCode("baz");
+  Aws::Firehose::Model::PutRecordBatchResult partial_result;
+  partial_result.AddRequestResponses(entry);
+  partial_result.AddRequestResponses(error_entry);
+  partial_result.AddRequestResponses(code_entry);
+  partial_result.SetFailedPutCount(2);
+  Aws::Firehose::Model::PutRecordBatchOutcome partial(partial_result);
+
+  // A request that fails as a whole sends the same records again.
+  Aws::Client::AWSError<Aws::Firehose::FirehoseErrors> error(
+      Aws::Firehose::FirehoseErrors::SERVICE_UNAVAILABLE,
+      "ServiceUnavailable",
+      "Unavailable",
+      true);
+  Aws::Firehose::Model::PutRecordBatchOutcome unavailable(error);
 
+  Sequence s;
   EXPECT_CALL(*client,
               PutRecordBatch(Property(
                   &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
-                  ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
+                  ElementsAre(MatchesEntry("bar\n"),
+                              MatchesEntry("foo\n"),
+                              MatchesEntry("baz\n")))))
+      .InSequence(s)
+      .WillOnce(Return(partial));
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo\n"), MatchesEntry("baz\n")))))
+      .InSequence(s)
+      .WillOnce(Return(unavailable))
       .WillOnce(Return(outcome));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+
+  // When every record fails the batch is left for the buffered forwarder.
+  logs = {"bar", "foo"};
+  Aws::Firehose::Model::PutRecordBatchResult failed_result;
+  failed_result.AddRequestResponses(error_entry);
+  failed_result.AddRequestResponses(error_entry);
+  failed_result.SetFailedPutCount(2);
+  Aws::Firehose::Model::PutRecordBatchOutcome failed(failed_result);
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
+      .WillOnce(Return(failed));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
+
+  logs = {"foo"};
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo\n")))))
+      .WillOnce(Return(unavailable));
+  EXPECT_EQ(Status(1, "Unavailable"), forwarder.send(logs, "results"));
 }
 }
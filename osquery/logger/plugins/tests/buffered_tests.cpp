@@ -30,6 +30,9 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_uint64(buffered_log_max);
+DECLARE_uint64(buffered_log_batch_bytes);
+DECLARE_uint64(buffered_log_inflight);
+DECLARE_uint64(buffered_log_memory);
 
 // Check that the string matches the StatusLogLine
 MATCHER_P(MatchesStatus, expected, "") {
@@ -77,16 +80,19 @@ class MockBufferedLogForwarder : public BufferedLogForwarder {
   FRIEND_TEST(BufferedLogForwarderTests, test_multiple);
   FRIEND_TEST(BufferedLogForwarderTests, test_async);
   FRIEND_TEST(BufferedLogForwarderTests, test_split);
+  FRIEND_TEST(BufferedLogForwarderTests, test_split_bytes);
+  FRIEND_TEST(BufferedLogForwarderTests, test_inflight);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge_max);
+  FRIEND_TEST(BufferedLogForwarderTests, test_memory);
 };
 
 TEST_F(BufferedLogForwarderTests, test_index) {
   MockBufferedLogForwarder runner;
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_1"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_2"));
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_3"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_4"));
+  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_0*1"));
+  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_0*2"));
+  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_0*3"));
+  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_0*4"));
 
   EXPECT_TRUE(runner.isResultIndex(runner.genResultIndex()));
   EXPECT_FALSE(runner.isResultIndex(runner.genStatusIndex()));
@@ -270,6 +276,60 @@ TEST_F(BufferedLogForwarderTests, test_split) {
   runner2.check();
 }
 
+// Verify that the max bytes of logs per send is respected
+TEST_F(BufferedLogForwarderTests, test_split_bytes) {
+  FLAGS_buffered_log_batch_bytes = 6;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("bazbazbaz");
+  runner.logString("qux");
+
+  // A line larger than the max is sent alone.
+  Sequence s;
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("bazbazbaz"), "result"))
+      .InSequence(s)
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_FALSE(runner.check());
+
+  // Only the batches after the failure are sent again.
+  EXPECT_CALL(runner, send(ElementsAre("bazbazbaz"), "result"))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("qux"), "result"))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_FALSE(runner.check());
+  // This call should not result in sending again
+  runner.check();
+  FLAGS_buffered_log_batch_bytes = 0;
+}
+
+// Verify concurrent sends, and the backlog reported while draining
+TEST_F(BufferedLogForwarderTests, test_inflight) {
+  FLAGS_buffered_log_inflight = 2;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 1);
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("baz");
+
+  EXPECT_CALL(runner, send(ElementsAre("foo"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_TRUE(runner.check());
+
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_FALSE(runner.check());
+  // This call should not result in sending again
+  runner.check();
+  FLAGS_buffered_log_inflight = 1;
+}
+
 // Test the purge() function independently of check()
 TEST_F(BufferedLogForwarderTests, test_purge) {
   FLAGS_buffered_log_max = 3;
@@ -340,4 +400,64 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
 
   runner.check();
 }
+
+TEST_F(BufferedLogForwarderTests, test_memory) {
+  auto memory = FLAGS_buffered_log_memory;
+  FLAGS_buffered_log_memory = 8;
+
+  StrictMock<MockBufferedLogForwarder> runner("memory", kLogPeriod);
+  ASSERT_TRUE(runner.setUp().ok());
+  auto buffered = ([]() {
+    std::vector<std::string> indexes;
+    scanDatabaseKeys(kLogs, indexes, "memory", 0);
+    return indexes.size();
+  });
+
+  // Lines sent from memory are never written to the database.
+  runner.logString("foo");
+  EXPECT_EQ(buffered(), 0U);
+  EXPECT_CALL(runner, send(ElementsAre("foo"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+
+  // A failed send spills the lines, and they are retried from the database.
+  runner.logString("bar");
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  runner.check();
+  EXPECT_EQ(buffered(), 1U);
+
+  // New lines stay in memory until the database buffer is sent.
+  runner.logString("baz");
+  EXPECT_EQ(buffered(), 1U);
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_EQ(buffered(), 0U);
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // Exceeding the memory limit spills every line.
+  runner.logString("1234");
+  runner.logString("5678");
+  EXPECT_EQ(buffered(), 0U);
+  runner.logString("9");
+  EXPECT_EQ(buffered(), 3U);
+  EXPECT_CALL(runner, send(ElementsAre("1234", "5678", "9"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // Stopping the forwarder spills the lines buffered in memory.
+  runner.logString("qux");
+  runner.spill();
+  EXPECT_EQ(buffered(), 1U);
+  EXPECT_CALL(runner, send(ElementsAre("qux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_EQ(buffered(), 0U);
+
+  FLAGS_buffered_log_memory = memory;
+}
 }
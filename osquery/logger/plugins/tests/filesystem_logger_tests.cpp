@@ -8,12 +8,16 @@
  *
  */
 
+#include <zlib.h>
+
 #include <gtest/gtest.h>
 
 #include <boost/filesystem/operations.hpp>
 
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -21,6 +25,40 @@ namespace fs = boost::filesystem;
 namespace osquery {
 
 DECLARE_string(logger_path);
+DECLARE_uint64(logger_flush_size);
+DECLARE_uint64(logger_flush_interval);
+DECLARE_uint64(logger_rotate_size);
+DECLARE_uint64(logger_rotate_count);
+DECLARE_uint64(logger_segment_size);
+DECLARE_uint64(logger_segment_interval);
+DECLARE_uint64(logger_segment_count);
+
+/// Decompress concatenated gzip members.
+static std::string decompressSegment(const std::string& data) {
+  std::string output;
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return output;
+  }
+
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  char buffer[4096];
+  while (stream.avail_in > 0) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    auto ret = inflate(&stream, Z_NO_FLUSH);
+    output.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (ret == Z_STREAM_END) {
+      inflateReset(&stream);
+    } else if (ret != Z_OK) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  return output;
+}
 
 class FilesystemLoggerTests : public testing::Test {
  public:
@@ -101,4 +139,107 @@ TEST_F(FilesystemLoggerTests, test_log_snapshot) {
       "\"unixTime\":\"0\"}\n";
   EXPECT_EQ(content, expected);
 }
+
+TEST_F(FilesystemLoggerTests, test_buffered_flush) {
+  EXPECT_TRUE(Registry::get().setActive("logger", "filesystem"));
+  auto flush_size = FLAGS_logger_flush_size;
+  auto flush_interval = FLAGS_logger_flush_interval;
+  FLAGS_logger_flush_size = 1024;
+  FLAGS_logger_flush_interval = 3600;
+
+  // Lines are buffered until the flush size or interval.
+  std::string before;
+  EXPECT_TRUE(logString("{\"buffered\": true}", "event"));
+  EXPECT_TRUE(readFile(results_path_, before));
+  EXPECT_EQ(before.find("buffered"), std::string::npos);
+
+  // The buffered lines are written when the logger is torn down.
+  Registry::get().plugin("logger", "filesystem")->tearDown();
+  std::string after;
+  EXPECT_TRUE(readFile(results_path_, after));
+  EXPECT_EQ(after, before + "{\"buffered\": true}\n");
+
+  FLAGS_logger_flush_size = flush_size;
+  FLAGS_logger_flush_interval = flush_interval;
+}
+
+TEST_F(FilesystemLoggerTests, test_rotate) {
+  EXPECT_TRUE(Registry::get().setActive("logger", "filesystem"));
+  auto rotate_size = FLAGS_logger_rotate_size;
+  auto rotate_count = FLAGS_logger_rotate_count;
+  FLAGS_logger_rotate_size = 1;
+  FLAGS_logger_rotate_count = 2;
+
+  // Each write exceeds the rotation size, the previous log is moved aside.
+  EXPECT_TRUE(logString("first", "event"));
+  EXPECT_TRUE(logString("second", "event"));
+
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content));
+  EXPECT_EQ(content, "second\n");
+  EXPECT_TRUE(readFile(results_path_ + ".1", content));
+  EXPECT_EQ(content, "first\n");
+
+  FLAGS_logger_rotate_size = rotate_size;
+  FLAGS_logger_rotate_count = rotate_count;
+}
+
+TEST_F(FilesystemLoggerTests, test_segments) {
+  EXPECT_TRUE(Registry::get().setActive("logger", "filesystem"));
+  auto flush_size = FLAGS_logger_flush_size;
+  auto segment_size = FLAGS_logger_segment_size;
+  auto segment_interval = FLAGS_logger_segment_interval;
+  auto segment_count = FLAGS_logger_segment_count;
+  FLAGS_logger_flush_size = 1;
+  FLAGS_logger_segment_size = 1;
+  FLAGS_logger_segment_interval = 0;
+  FLAGS_logger_segment_count = 2;
+
+  auto manifest_path = results_path_ + ".manifest";
+  auto segment = [this](size_t sequence) {
+    return results_path_ + ".000000000" + std::to_string(sequence) + ".gz";
+  };
+  fs::remove(manifest_path);
+  fs::remove(results_path_ + ".segment.partial");
+
+  // A segment left by a crash ends within a gzip member.
+  EXPECT_TRUE(writeTextFile(results_path_ + ".segment", "\x1f\x8b\x08"));
+
+  // The open results log is replaced by a segment.
+  requestLogReopen();
+  EXPECT_TRUE(logString("first", "event"));
+  EXPECT_TRUE(logString("second", "event"));
+
+  // The truncated segment was set aside instead of appended to.
+  std::string partial;
+  EXPECT_TRUE(readFile(results_path_ + ".segment.partial", partial));
+  EXPECT_EQ(partial, "\x1f\x8b\x08");
+
+  // Each write completes a segment, listed in the manifest.
+  std::string content;
+  EXPECT_TRUE(readFile(manifest_path, content));
+  auto lines = split(content, "\n");
+  ASSERT_EQ(lines.size(), 2U);
+  EXPECT_EQ(lines[0].find("osqueryd.results.log.0000000001.gz "), 0U);
+  EXPECT_EQ(lines[1].find("osqueryd.results.log.0000000002.gz "), 0U);
+
+  EXPECT_TRUE(readFile(segment(1), content));
+  EXPECT_EQ(decompressSegment(content), "first\n");
+  EXPECT_TRUE(readFile(segment(2), content));
+  EXPECT_EQ(decompressSegment(content), "second\n");
+
+  // Only the newest segments are kept.
+  EXPECT_TRUE(logString("third", "event"));
+  EXPECT_FALSE(pathExists(segment(1)));
+  EXPECT_TRUE(readFile(manifest_path, content));
+  lines = split(content, "\n");
+  ASSERT_EQ(lines.size(), 2U);
+  EXPECT_EQ(lines[1].find("osqueryd.results.log.0000000003.gz "), 0U);
+
+  FLAGS_logger_flush_size = flush_size;
+  FLAGS_logger_segment_size = segment_size;
+  FLAGS_logger_segment_interval = segment_interval;
+  FLAGS_logger_segment_count = segment_count;
+  requestLogReopen();
+}
 }
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/logger/plugins/syslog.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+class SyslogLoggerTests : public testing::Test {};
+
+TEST_F(SyslogLoggerTests, test_format) {
+  // 2016-11-24 15:06:40.123456 UTC.
+  auto time = std::chrono::system_clock::from_time_t(1480000000) +
+              std::chrono::microseconds(123456);
+  auto priority = (LOG_LOCAL3 | LOG_INFO);
+
+  auto datagram =
+      formatSyslogMessage(priority, "osqueryd", 42, time, "message", false);
+  EXPECT_EQ(datagram.find("<" + std::to_string(priority) + ">Nov "), 0U);
+  EXPECT_NE(datagram.find(" osqueryd[42]: message"), std::string::npos);
+
+  datagram =
+      formatSyslogMessage(priority, "osqueryd", 42, time, "message", true);
+  EXPECT_EQ(datagram,
+            "<" + std::to_string(priority) +
+                ">1 2016-11-24T15:06:40.123456Z " + getHostname() +
+                " osqueryd 42 - - message");
+}
+
+TEST_F(SyslogLoggerTests, test_sender) {
+  auto path = kTestWorkingDirectory + "syslog_test.sock";
+  unlink(path.c_str());
+
+  // Receive datagrams as the syslog daemon would.
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  ASSERT_GE(fd, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  ASSERT_LT(path.size(), sizeof(addr.sun_path));
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  ASSERT_EQ(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)),
+            0);
+
+  auto queue = std::make_shared<LoggerQueue>(10);
+  SyslogSender sender(path, queue);
+
+  std::vector<LoggerRequest> batch(3);
+  for (size_t i = 0; i < batch.size(); i++) {
+    batch[i].data = "datagram " + std::to_string(i);
+    EXPECT_TRUE(queue->push(batch[i], false).ok());
+    LoggerRequest popped;
+    EXPECT_TRUE(queue->pop(popped, std::chrono::milliseconds(0)));
+  }
+  sender.send(batch);
+
+  // Each datagram arrives in order, and each popped request is done.
+  char buffer[64];
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto size = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    ASSERT_GT(size, 0);
+    EXPECT_EQ(std::string(buffer, size), batch[i].data);
+  }
+  EXPECT_TRUE(queue->wait(std::chrono::milliseconds(0)));
+  EXPECT_EQ(queue->getStats().sent, 3U);
+
+  close(fd);
+  unlink(path.c_str());
+}
+}
@@ -22,11 +22,20 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(logger_tls_splice);
+DECLARE_bool(logger_tls_compress);
+
 class TLSLoggerTests : public testing::Test {
  public:
   void runCheck(const std::shared_ptr<TLSLogForwarder>& runner) {
     runner->check();
   }
+
+  Status genSplicedBody(const std::shared_ptr<TLSLogForwarder>& runner,
+                        std::vector<std::string>& lines,
+                        std::string& body) {
+    return runner->genSplicedBody(lines, "result", body);
+  }
 };
 
 TEST_F(TLSLoggerTests, test_database) {
@@ -78,4 +87,48 @@ TEST_F(TLSLoggerTests, test_send) {
   TLSServerRunner::unsetClientConfig();
   TLSServerRunner::stop();
 }
+
+TEST_F(TLSLoggerTests, test_send_spliced) {
+  auto splice = FLAGS_logger_tls_splice;
+  auto compress = FLAGS_logger_tls_compress;
+  FLAGS_logger_tls_splice = true;
+
+  TLSServerRunner::start();
+  TLSServerRunner::setClientConfig();
+
+  // Serialized lines are written into the request as-is, optionally
+  // compressed while they are written.
+  for (const auto& compressed : {false, true}) {
+    FLAGS_logger_tls_compress = compressed;
+    auto forwarder = std::make_shared<TLSLogForwarder>();
+    for (size_t i = 0; i < 20; i++) {
+      forwarder->logString("{\"spliced_json\": true}");
+    }
+    runCheck(forwarder);
+  }
+
+  TLSServerRunner::unsetClientConfig();
+  TLSServerRunner::stop();
+  FLAGS_logger_tls_splice = splice;
+  FLAGS_logger_tls_compress = compress;
+}
+
+TEST_F(TLSLoggerTests, test_spliced_body) {
+  std::string node_key;
+  getDatabaseValue(kPersistentSettings, "nodeKey", node_key);
+  setDatabaseValue(kPersistentSettings, "nodeKey", "spliced_node_key");
+
+  // Empty lines are skipped, and each line is cleared once it is written.
+  auto forwarder = std::make_shared<TLSLogForwarder>();
+  std::vector<std::string> lines = {"{\"a\":1}", "", "{\"b\":2}"};
+  std::string body;
+  EXPECT_TRUE(genSplicedBody(forwarder, lines, body).ok());
+  EXPECT_EQ(
+      "{\"node_key\":\"spliced_node_key\",\"log_type\":\"result\","
+      "\"data\":[{\"a\":1},{\"b\":2}]}",
+      body);
+  EXPECT_TRUE(lines[0].empty());
+
+  setDatabaseValue(kPersistentSettings, "nodeKey", node_key);
+}
 }
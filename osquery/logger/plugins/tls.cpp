@@ -41,6 +41,11 @@ FLAG(uint64,
 
 FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
 
+FLAG(bool,
+     logger_tls_splice,
+     false,
+     "Write serialized log lines into TLS/HTTPS requests without parsing");
+
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
 TLSLogForwarder::TLSLogForwarder()
@@ -88,37 +93,13 @@ void TLSLoggerPlugin::init(const std::string& name,
 
 Status TLSLogForwarder::send(std::vector<std::string>& log_data,
                              const std::string& log_type) {
-  pt::ptree params;
-  params.put<std::string>("node_key", getNodeKey("tls"));
-  params.put<std::string>("log_type", log_type);
-
-  {
-    // Read each logged line into JSON and populate a list of lines.
-    // The result list will use the 'data' key.
-    pt::ptree children;
-    iterate(log_data,
-            ([&children](std::string& item) {
-              // Enforce a max log line size for TLS logging.
-              if (item.size() > FLAGS_logger_tls_max) {
-                LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
-                return;
-              }
-
-              pt::ptree child;
-              try {
-                std::stringstream input;
-                input << item;
-                std::string().swap(item);
-                pt::read_json(input, child);
-              } catch (const pt::json_parser::json_parser_error& /* e */) {
-                // The log line entered was not valid JSON, skip it.
-                return;
-              }
-              children.push_back(std::make_pair("", std::move(child)));
-            }));
-    params.add_child("data", std::move(children));
+  if (FLAGS_logger_tls_splice) {
+    return sendSpliced(log_data, log_type);
   }
 
+  pt::ptree params;
+  genParams(log_data, log_type, params);
+
   // The response body is ignored (status is set appropriately by
   // TLSRequestHelper::go())
   std::string response;
@@ -127,4 +108,103 @@ Status TLSLogForwarder::send(std::vector<std::string>& log_data,
   }
   return TLSRequestHelper::go<JSONSerializer>(uri_, params, response);
 }
+
+void TLSLogForwarder::genParams(std::vector<std::string>& log_data,
+                                const std::string& log_type,
+                                pt::ptree& params) {
+  params.put<std::string>("node_key", getNodeKey("tls"));
+  params.put<std::string>("log_type", log_type);
+
+  // Read each logged line into JSON and populate a list of lines.
+  // The result list will use the 'data' key.
+  pt::ptree children;
+  iterate(log_data,
+          ([&children](std::string& item) {
+            // Enforce a max log line size for TLS logging.
+            if (item.size() > FLAGS_logger_tls_max) {
+              LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
+              return;
+            }
+
+            pt::ptree child;
+            try {
+              std::stringstream input;
+              input << item;
+              std::string().swap(item);
+              pt::read_json(input, child);
+            } catch (const pt::json_parser::json_parser_error& /* e */) {
+              // The log line entered was not valid JSON, skip it.
+              return;
+            }
+            children.push_back(std::make_pair("", std::move(child)));
+          }));
+  params.add_child("data", std::move(children));
+}
+
+Status TLSLogForwarder::sendSpliced(std::vector<std::string>& log_data,
+                                    const std::string& log_type) {
+  std::string body;
+  auto status = genSplicedBody(log_data, log_type, body);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The response body is ignored (status is set appropriately by
+  // TLSRequestHelper::goSerialized())
+  pt::ptree response;
+  return TLSRequestHelper::goSerialized<JSONSerializer>(
+      uri_, body, FLAGS_logger_tls_compress, response);
+}
+
+Status TLSLogForwarder::genSplicedBody(std::vector<std::string>& log_data,
+                                       const std::string& log_type,
+                                       std::string& body) {
+  // Lines are written into the body, and compressed, as they are spliced.
+  std::unique_ptr<StreamCompressor> compressor;
+  if (FLAGS_logger_tls_compress) {
+    compressor.reset(new StreamCompressor());
+  }
+
+  body.clear();
+  auto write = ([&compressor, &body](const std::string& data) {
+    if (compressor != nullptr) {
+      compressor->append(data);
+    } else {
+      body.append(data);
+    }
+  });
+
+  auto node_key = pt::json_parser::create_escapes(getNodeKey("tls"));
+  write("{\"node_key\":\"" + node_key + "\",\"log_type\":\"" +
+        pt::json_parser::create_escapes(log_type) + "\",\"data\":[");
+  bool first = true;
+  iterate(log_data,
+          ([&write, &first](std::string& item) {
+            // Enforce a max log line size for TLS logging.
+            if (item.size() > FLAGS_logger_tls_max) {
+              LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
+              return;
+            }
+
+            // Each line is a serialized JSON object, it is not validated.
+            if (item.empty()) {
+              return;
+            }
+            if (!first) {
+              write(",");
+            }
+            first = false;
+            write(item);
+            std::string().swap(item);
+          }));
+  write("]}");
+
+  if (compressor != nullptr) {
+    body = compressor->finish();
+    if (body.empty()) {
+      return Status(1, "Could not compress TLS/HTTPS request body");
+    }
+  }
+  return Status(0, "OK");
+}
 }
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <boost/property_tree/ptree.hpp>
+
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
@@ -32,6 +34,36 @@ class TLSLogForwarder : public BufferedLogForwarder {
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
+  /**
+   * @brief Send serialized log lines without parsing them.
+   *
+   * Used with --logger_tls_splice, each line is written into the request's
+   * "data" list as-is, and the body is compressed while it is written.
+   */
+  Status sendSpliced(std::vector<std::string>& log_data,
+                     const std::string& log_type);
+
+  /**
+   * @brief Build the request parameters of a batch of log lines.
+   *
+   * Each line is parsed into the "data" list and cleared. Lines that are not
+   * JSON or exceed --logger_tls_max are skipped.
+   */
+  void genParams(std::vector<std::string>& log_data,
+                 const std::string& log_type,
+                 boost::property_tree::ptree& params);
+
+  /**
+   * @brief Write the request body of a batch of log lines as-is.
+   *
+   * The body is compressed with --logger_tls_compress.
+   *
+   * @return failure if the body could not be compressed.
+   */
+  Status genSplicedBody(std::vector<std::string>& log_data,
+                        const std::string& log_type,
+                        std::string& body);
+
   /// Endpoint URI
   std::string uri_;
 
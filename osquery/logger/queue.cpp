@@ -0,0 +1,225 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/logger/queue.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     logger_queue_max,
+     0,
+     "Max queued results per logger plugin, logged in a service (0 = "
+     "log synchronously)");
+
+FLAG(bool,
+     logger_queue_drop,
+     false,
+     "Drop results when a logger plugin's queue is full instead of waiting");
+
+/// Time a logger queue service waits for requests between interrupt checks.
+const std::chrono::milliseconds kLoggerQueueWait(200);
+
+/// The queue of each logger plugin, created on first use.
+static std::map<std::string, std::shared_ptr<LoggerQueue>> kLoggerQueues;
+
+/// Protect access to the logger queues.
+static Mutex kLoggerQueuesMutex;
+
+Status LoggerQueue::push(LoggerRequest request, bool drop) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!closed_ && requests_.size() >= max_) {
+    if (drop) {
+      dropped_++;
+      return Status(1, "Logger queue is full");
+    }
+    popped_.wait(lock,
+                 [this]() { return closed_ || requests_.size() < max_; });
+  }
+
+  if (closed_) {
+    return Status(2, "Logger queue is closed");
+  }
+  requests_.push_back(std::move(request));
+  pending_++;
+  lock.unlock();
+  pushed_.notify_one();
+  return Status(0, "OK");
+}
+
+bool LoggerQueue::pop(LoggerRequest& request,
+                      std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!pushed_.wait_for(lock, timeout, [this]() {
+        return closed_ || !requests_.empty();
+      })) {
+    return false;
+  }
+
+  // A closed queue is drained by its service.
+  if (requests_.empty()) {
+    return false;
+  }
+  request = std::move(requests_.front());
+  requests_.pop_front();
+  lock.unlock();
+  popped_.notify_one();
+  return true;
+}
+
+void LoggerQueue::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  pushed_.notify_all();
+  popped_.notify_all();
+}
+
+void LoggerQueue::done() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_--;
+  }
+  sent_++;
+  done_.notify_all();
+}
+
+bool LoggerQueue::wait(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return done_.wait_for(lock, timeout, [this]() { return pending_ == 0; });
+}
+
+LoggerQueueStats LoggerQueue::getStats() const {
+  LoggerQueueStats stats;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.queued = requests_.size();
+  }
+  stats.sent = sent_;
+  stats.dropped = dropped_;
+  return stats;
+}
+
+Status sendLoggerRequest(const std::string& plugin,
+                         const LoggerRequest& request) {
+  auto logger =
+      RegistryFactory::get().localPlugin<LoggerPlugin>("logger", plugin);
+  if (logger != nullptr) {
+    return RegistryFactory::callLocal("logger", plugin, [&logger, &request]() {
+      return (request.snapshot) ? logger->sendSnapshot(request.data)
+                                : logger->sendString(request.data);
+    });
+  }
+
+  // Extension loggers are reached through the registry.
+  PluginRequest serialized;
+  if (request.snapshot) {
+    serialized["snapshot"] = request.data;
+  } else {
+    serialized["string"] = request.data;
+    serialized["category"] = request.category;
+  }
+  return Registry::call("logger", plugin, serialized);
+}
+
+void LoggerQueueRunner::send(const LoggerRequest& request) {
+  auto status = sendLoggerRequest(plugin_, request);
+  if (!status.ok()) {
+    VLOG(1) << "Queued log to " << plugin_
+            << " failed: " << status.getMessage();
+  }
+  queue_->done();
+}
+
+void LoggerQueueRunner::start() {
+  LoggerRequest request;
+  while (!interrupted()) {
+    if (queue_->pop(request, kLoggerQueueWait)) {
+      send(request);
+    }
+  }
+
+  // The queue is closed, forward the requests that remain.
+  while (queue_->pop(request, std::chrono::milliseconds(0))) {
+    send(request);
+  }
+}
+
+void LoggerQueueRunner::stop() {
+  queue_->close();
+}
+
+Status queueLoggerRequest(const std::string& receiver,
+                          const LoggerRequest& request) {
+  if (FLAGS_logger_queue_max == 0) {
+    if (receiver.find(',') == std::string::npos) {
+      return sendLoggerRequest(receiver, request);
+    }
+    // Multiplexed loggers are called without regard for statuses.
+    for (const auto& plugin : osquery::split(receiver, ",")) {
+      sendLoggerRequest(plugin, request);
+    }
+    return Status(0);
+  }
+
+  Status status;
+  for (const auto& plugin : osquery::split(receiver, ",")) {
+    std::shared_ptr<LoggerQueue> queue;
+    {
+      WriteLock lock(kLoggerQueuesMutex);
+      auto& entry = kLoggerQueues[plugin];
+      if (entry == nullptr) {
+        entry = std::make_shared<LoggerQueue>(FLAGS_logger_queue_max);
+        Dispatcher::addService(
+            std::make_shared<LoggerQueueRunner>(plugin, entry));
+      }
+      queue = entry;
+    }
+
+    auto queued = queue->push(request, FLAGS_logger_queue_drop);
+    if (queued.getCode() == 2) {
+      // The queue's service stopped, log synchronously.
+      status = sendLoggerRequest(plugin, request);
+    } else if (!queued.ok()) {
+      status = Status(1, queued.getMessage() + ": " + plugin);
+    }
+  }
+  return status;
+}
+
+void flushLoggerQueues() {
+  std::vector<std::shared_ptr<LoggerQueue>> queues;
+  {
+    WriteLock lock(kLoggerQueuesMutex);
+    for (const auto& queue : kLoggerQueues) {
+      queues.push_back(queue.second);
+    }
+  }
+
+  for (const auto& queue : queues) {
+    queue->wait(std::chrono::seconds(10));
+  }
+}
+
+void getLoggerQueueStats(
+    std::function<void(const std::string& plugin,
+                       const LoggerQueueStats& stats)> predicate) {
+  WriteLock lock(kLoggerQueuesMutex);
+  for (const auto& queue : kLoggerQueues) {
+    predicate(queue.first, queue.second->getStats());
+  }
+}
+}
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <osquery/dispatcher.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+/**
+ * @brief A results string for logger plugins.
+ *
+ * Loggers within the process receive the string through LoggerPlugin's typed
+ * methods, a PluginRequest is only created to reach an extension's logger.
+ */
+struct LoggerRequest {
+  /// The serialized results.
+  std::string data;
+
+  /// Send the results to logSnapshot instead of logString.
+  bool snapshot{false};
+
+  /// The category of a results string.
+  std::string category;
+};
+
+/// Counters for a logger plugin's queue.
+struct LoggerQueueStats {
+  /// Requests waiting to be forwarded.
+  size_t queued{0};
+
+  /// Requests forwarded to the logger plugin.
+  size_t sent{0};
+
+  /// Requests dropped because the queue was full.
+  size_t dropped{0};
+};
+
+/**
+ * @brief A bounded queue of requests for one logger plugin.
+ *
+ * Threads logging results push serialized requests and return, a
+ * LoggerQueueRunner service forwards them to the plugin. When the queue is
+ * full a push either waits for space or drops the request, see
+ * --logger_queue_drop.
+ */
+class LoggerQueue : private boost::noncopyable {
+ public:
+  explicit LoggerQueue(size_t max) : max_(max) {}
+
+  /**
+   * @brief Queue a request.
+   *
+   * @return Return code (1) if the request was dropped, (2) if the queue is
+   * closed.
+   */
+  Status push(LoggerRequest request, bool drop);
+
+  /// Wait up to a timeout for a request, false if there was none.
+  bool pop(LoggerRequest& request, std::chrono::milliseconds timeout);
+
+  /// Stop accepting requests and wake any waiting threads.
+  void close();
+
+  /// Count a popped request as forwarded to the plugin.
+  void done();
+
+  /// Wait up to a timeout for every pushed request to be forwarded.
+  bool wait(std::chrono::milliseconds timeout);
+
+  LoggerQueueStats getStats() const;
+
+ private:
+  /// The maximum number of queued requests.
+  size_t max_{0};
+
+  std::deque<LoggerRequest> requests_;
+
+  /// Requests pushed and not yet forwarded.
+  size_t pending_{0};
+
+  /// Set when the queue's service stops.
+  bool closed_{false};
+
+  /// Protect the requests and wait for requests or space.
+  mutable std::mutex mutex_;
+  std::condition_variable pushed_;
+  std::condition_variable popped_;
+  std::condition_variable done_;
+
+  std::atomic<size_t> sent_{0};
+  std::atomic<size_t> dropped_{0};
+};
+
+/// A service forwarding a logger plugin's queued requests.
+class LoggerQueueRunner : public InternalRunnable {
+ public:
+  LoggerQueueRunner(const std::string& plugin,
+                    const std::shared_ptr<LoggerQueue>& queue)
+      : plugin_(plugin), queue_(queue) {}
+
+  /// Forward requests until interrupted, then forward what remains.
+  void start() override;
+
+  /// Close the queue, requests pushed after the stop are sent synchronously.
+  void stop() override;
+
+ private:
+  /// Forward one request to the logger plugin.
+  void send(const LoggerRequest& request);
+
+ private:
+  std::string plugin_;
+  std::shared_ptr<LoggerQueue> queue_;
+};
+
+/// Send a request to one logger plugin, within the process or an extension.
+Status sendLoggerRequest(const std::string& plugin,
+                         const LoggerRequest& request);
+
+/**
+ * @brief Queue a logger request for each receiver, or call them if disabled.
+ *
+ * With --logger_queue_max set to 0 the receivers are called directly.
+ * Otherwise each receiver plugin has a queue and service, started on first
+ * use, and the request is handed off to each queue.
+ *
+ * @param receiver a comma-delimited list of logger plugins
+ * @param request the logger request
+ */
+Status queueLoggerRequest(const std::string& receiver,
+                          const LoggerRequest& request);
+
+/// Wait until every queued request has been forwarded, for testing.
+void flushLoggerQueues();
+
+/// Iterate the queue counters of every logger plugin.
+void getLoggerQueueStats(
+    std::function<void(const std::string& plugin,
+                       const LoggerQueueStats& stats)> predicate);
+}
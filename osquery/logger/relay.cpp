@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/flags.h>
+
+#include "osquery/logger/relay.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     logger_status_rate,
+     0,
+     "Max status logs per second for each severity (0 = unlimited)");
+
+FLAG(bool,
+     logger_status_dedup,
+     false,
+     "Fold repeated status logs into a single repeat count");
+
+FLAG(uint64,
+     logger_status_batch,
+     1,
+     "Max status logs forwarded to logger plugins in one request");
+
+static inline bool isRepeat(const StatusLogLine& l, const StatusLogLine& r) {
+  return l.severity == r.severity && l.line == r.line &&
+         l.message == r.message && l.filename == r.filename;
+}
+
+void StatusLogRelay::setLimits(size_t rate, bool dedup) {
+  rate_ = rate;
+  dedup_ = dedup;
+}
+
+void StatusLogRelay::add(StatusLogLine line,
+                         Clock::time_point now,
+                         std::vector<StatusLogLine>& out) {
+  if (dedup_) {
+    if (has_last_ && isRepeat(line, last_)) {
+      if (repeats_++ == 0) {
+        first_repeat_ = now;
+      } else if (now - first_repeat_ >= kStatusRepeatInterval) {
+        // A line repeating indefinitely is still reported periodically.
+        summarize(out);
+      }
+      return;
+    }
+
+    summarize(out);
+    last_ = line;
+    has_last_ = true;
+  } else if (repeats_ > 0) {
+    summarize(out);
+  }
+
+  admit(std::move(line), now, out);
+}
+
+void StatusLogRelay::admit(StatusLogLine line,
+                           Clock::time_point now,
+                           std::vector<StatusLogLine>& out) {
+  if (rate_ == 0) {
+    out.push_back(std::move(line));
+    return;
+  }
+
+  auto severity = std::min(std::max(static_cast<int>(line.severity), 0),
+                           static_cast<int>(O_FATAL));
+  auto& bucket = buckets_[severity];
+  if (!bucket.started) {
+    bucket.started = true;
+    bucket.tokens = static_cast<double>(rate_);
+  } else {
+    std::chrono::duration<double> elapsed = now - bucket.refilled;
+    bucket.tokens = std::min(static_cast<double>(rate_),
+                             bucket.tokens + elapsed.count() * rate_);
+  }
+  bucket.refilled = now;
+
+  if (bucket.tokens < 1) {
+    bucket.dropped++;
+    bucket.filename = line.filename;
+    bucket.line = line.line;
+    total_dropped_++;
+    return;
+  }
+
+  bucket.tokens -= 1;
+  if (bucket.dropped > 0) {
+    out.push_back({line.severity,
+                   bucket.filename,
+                   bucket.line,
+                   "Rate limited " + std::to_string(bucket.dropped) +
+                       " status logs"});
+    bucket.dropped = 0;
+  }
+  out.push_back(std::move(line));
+}
+
+void StatusLogRelay::summarize(std::vector<StatusLogLine>& out) {
+  if (repeats_ == 0) {
+    return;
+  }
+
+  // Summaries are not rate limited, there is at most one per interval.
+  out.push_back({last_.severity,
+                 last_.filename,
+                 last_.line,
+                 "Message repeated " + std::to_string(repeats_) + " times: " +
+                     last_.message});
+  repeats_ = 0;
+}
+
+void StatusLogRelay::flush(std::vector<StatusLogLine>& out) {
+  summarize(out);
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    auto& bucket = buckets_[i];
+    if (bucket.dropped > 0) {
+      out.push_back({static_cast<StatusLogSeverity>(i),
+                     bucket.filename,
+                     bucket.line,
+                     "Rate limited " + std::to_string(bucket.dropped) +
+                         " status logs"});
+      bucket.dropped = 0;
+    }
+  }
+}
+}
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+#include <osquery/logger.h>
+
+namespace osquery {
+
+/// Interval a repeated status line is folded for before it is summarized.
+const std::chrono::seconds kStatusRepeatInterval(1);
+
+/**
+ * @brief Fold repeated status logs and rate limit each severity.
+ *
+ * Status lines pass through the relay before they are buffered or forwarded
+ * to logger plugins. A line equal to the previous line is counted instead of
+ * sent, then summarized as "Message repeated N times: X". Each severity has a
+ * token bucket refilled at a rate of lines per second. Lines arriving at an
+ * empty bucket are counted and reported once the severity may log again.
+ *
+ * The relay is not thread safe, the caller serializes access.
+ */
+class StatusLogRelay : private boost::noncopyable {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Set the limits applied to following lines.
+   *
+   * @param rate lines per second allowed for each severity, 0 is unlimited
+   * @param dedup fold lines equal to the previous line
+   */
+  void setLimits(size_t rate, bool dedup);
+
+  /**
+   * @brief Filter a status line.
+   *
+   * @param line the status line
+   * @param now the time the line was logged
+   * @param out the lines to send, in order, are appended here
+   */
+  void add(StatusLogLine line,
+           Clock::time_point now,
+           std::vector<StatusLogLine>& out);
+
+  /// Append summaries for the folded and rate limited lines.
+  void flush(std::vector<StatusLogLine>& out);
+
+  /// The number of lines dropped by a rate limit.
+  size_t getDropped() const {
+    return total_dropped_;
+  }
+
+ private:
+  /// Append the line if its severity's bucket has a token.
+  void admit(StatusLogLine line,
+             Clock::time_point now,
+             std::vector<StatusLogLine>& out);
+
+  /// Append a summary of a folded line.
+  void summarize(std::vector<StatusLogLine>& out);
+
+ private:
+  /// Each severity's bucket, indexed by StatusLogSeverity.
+  struct Bucket {
+    double tokens{0};
+    Clock::time_point refilled;
+    bool started{false};
+
+    /// Lines dropped since the severity last logged, and the last source.
+    size_t dropped{0};
+    std::string filename;
+    int line{0};
+  };
+
+  std::array<Bucket, O_FATAL + 1> buckets_;
+
+  /// The lines allowed per second for each severity.
+  size_t rate_{0};
+
+  /// Fold repeats of the previous line.
+  bool dedup_{false};
+
+  /// The previous line and the number of times it was repeated since.
+  StatusLogLine last_{O_INFO, "", 0, ""};
+  bool has_last_{false};
+  size_t repeats_{0};
+  Clock::time_point first_repeat_;
+
+  size_t total_dropped_{0};
+};
+}
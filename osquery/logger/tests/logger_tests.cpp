@@ -13,9 +13,13 @@
 #include <osquery/core.h>
 #include <osquery/logger.h>
 
+#include "osquery/logger/queue.h"
+#include "osquery/logger/relay.h"
+
 namespace osquery {
 
 DECLARE_bool(logger_secondary_status_only);
+DECLARE_uint64(logger_queue_max);
 
 class LoggerTests : public testing::Test {
  public:
@@ -306,4 +310,114 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
       "column\":\"test_value\"},\"action\":\"added\"}";
   EXPECT_EQ(LoggerTests::log_lines.back(), expected);
 }
+
+TEST_F(LoggerTests, test_logger_queue) {
+  LoggerQueue queue(1);
+  EXPECT_TRUE(queue.push({"foo"}, true).ok());
+
+  // A full queue drops requests, when asked to.
+  auto status = queue.push({"bar"}, true);
+  EXPECT_EQ(1, status.getCode());
+  EXPECT_EQ(1U, queue.getStats().queued);
+  EXPECT_EQ(1U, queue.getStats().dropped);
+
+  // A closed queue rejects requests, the queued requests remain.
+  queue.close();
+  status = queue.push({"baz"}, false);
+  EXPECT_EQ(2, status.getCode());
+
+  LoggerRequest request;
+  EXPECT_TRUE(queue.pop(request, std::chrono::milliseconds(0)));
+  EXPECT_EQ("foo", request.data);
+  EXPECT_FALSE(queue.pop(request, std::chrono::milliseconds(0)));
+  queue.done();
+  EXPECT_TRUE(queue.wait(std::chrono::milliseconds(0)));
+  EXPECT_EQ(1U, queue.getStats().sent);
+}
+
+TEST_F(LoggerTests, test_logger_queued_strings) {
+  RegistryFactory::get().setActive("logger", "test");
+  FLAGS_logger_queue_max = 10;
+
+  // Strings are forwarded to the plugin from the queue's service.
+  for (size_t i = 0; i < 20; i++) {
+    EXPECT_TRUE(logString(std::to_string(i), "event"));
+  }
+  flushLoggerQueues();
+  FLAGS_logger_queue_max = 0;
+
+  ASSERT_EQ(20U, LoggerTests::log_lines.size());
+  EXPECT_EQ("0", LoggerTests::log_lines.front());
+  EXPECT_EQ("19", LoggerTests::log_lines.back());
+
+  size_t sent = 0;
+  getLoggerQueueStats(([&sent](const std::string& plugin,
+                               const LoggerQueueStats& stats) {
+    if (plugin == "test") {
+      sent = stats.sent;
+      EXPECT_EQ(0U, stats.queued);
+      EXPECT_EQ(0U, stats.dropped);
+    }
+  }));
+  EXPECT_EQ(20U, sent);
+}
+
+TEST_F(LoggerTests, test_status_relay_repeats) {
+  StatusLogRelay relay;
+  relay.setLimits(0, true);
+
+  auto now = StatusLogRelay::Clock::now();
+  std::vector<StatusLogLine> out;
+  for (size_t i = 0; i < 5; i++) {
+    relay.add({O_WARNING, "audit.cpp", 10, "parse failed"}, now, out);
+  }
+  ASSERT_EQ(1U, out.size());
+  EXPECT_EQ("parse failed", out[0].message);
+
+  // A different line is preceded by a summary of the repeats.
+  relay.add({O_WARNING, "audit.cpp", 20, "other"}, now, out);
+  ASSERT_EQ(3U, out.size());
+  EXPECT_EQ("Message repeated 4 times: parse failed", out[1].message);
+  EXPECT_EQ(10, out[1].line);
+  EXPECT_EQ("other", out[2].message);
+
+  // Continuous repeats are summarized after an interval.
+  out.clear();
+  relay.add({O_WARNING, "audit.cpp", 20, "other"}, now, out);
+  relay.add({O_WARNING, "audit.cpp", 20, "other"},
+            now + kStatusRepeatInterval,
+            out);
+  ASSERT_EQ(1U, out.size());
+  EXPECT_EQ("Message repeated 2 times: other", out[0].message);
+
+  relay.flush(out);
+  EXPECT_EQ(1U, out.size());
+}
+
+TEST_F(LoggerTests, test_status_relay_rate) {
+  StatusLogRelay relay;
+  relay.setLimits(2, false);
+
+  auto now = StatusLogRelay::Clock::now();
+  std::vector<StatusLogLine> out;
+  for (size_t i = 0; i < 5; i++) {
+    relay.add({O_ERROR, "f.cpp", 1, std::to_string(i)}, now, out);
+  }
+
+  // Each severity has its own bucket.
+  relay.add({O_INFO, "f.cpp", 1, "info"}, now, out);
+  ASSERT_EQ(3U, out.size());
+  EXPECT_EQ("0", out[0].message);
+  EXPECT_EQ("1", out[1].message);
+  EXPECT_EQ("info", out[2].message);
+  EXPECT_EQ(3U, relay.getDropped());
+
+  // The bucket refills over time, the dropped lines are reported.
+  out.clear();
+  relay.add({O_ERROR, "f.cpp", 1, "5"}, now + std::chrono::seconds(1), out);
+  ASSERT_EQ(2U, out.size());
+  EXPECT_EQ("Rate limited 3 status logs", out[0].message);
+  EXPECT_EQ(O_ERROR, out[0].severity);
+  EXPECT_EQ("5", out[1].message);
+}
 }
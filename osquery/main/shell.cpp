@@ -97,7 +97,12 @@ int main(int argc, char* argv[]) {
   runner.initWorkerWatcher();
 
   // Check for shell-specific switches and positional arguments.
-  if (argc > 1 || !osquery::platformIsatty(stdin) ||
+  if (!osquery::FLAGS_connect.empty()) {
+    // Queries run in the daemon, which has its own events and extensions.
+    osquery::FLAGS_disable_events = true;
+    osquery::FLAGS_disable_caching = true;
+    osquery::FLAGS_disable_extensions = true;
+  } else if (argc > 1 || !osquery::platformIsatty(stdin) ||
       osquery::FLAGS_A.size() > 0 || osquery::FLAGS_pack.size() > 0 ||
       osquery::FLAGS_L || osquery::FLAGS_profile > 0) {
     // A query was set as a positional argument, via stdin, or profiling is on.
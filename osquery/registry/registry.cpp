@@ -399,7 +399,7 @@ Status RegistryFactory::call(const std::string& registry_name,
                              const PluginRequest& request,
                              PluginResponse& response) {
   // Forward factory call to the registry.
-  try {
+  return callLocal(registry_name, item_name, [&]() {
     if (item_name.find(",") != std::string::npos) {
       // Call is multiplexing plugins (usually for multiple loggers).
       for (const auto& item : osquery::split(item_name, ",")) {
@@ -409,6 +409,14 @@ Status RegistryFactory::call(const std::string& registry_name,
       return Status(0);
     }
     return get().registry(registry_name)->call(item_name, request, response);
+  });
+}
+
+Status RegistryFactory::callLocal(const std::string& registry_name,
+                                  const std::string& item_name,
+                                  const std::function<Status()>& typed_call) {
+  try {
+    return typed_call();
   } catch (const std::exception& e) {
     LOG(ERROR) << registry_name << " registry " << item_name
                << " plugin caused exception: " << e.what();
@@ -450,7 +458,9 @@ Status RegistryFactory::call(const std::string& registry_name,
 Status RegistryFactory::setActive(const std::string& registry_name,
                                   const std::string& item_name) {
   WriteLock lock(mutex_);
-  return registry(registry_name)->setActive(item_name);
+  auto status = registry(registry_name)->setActive(item_name);
+  active_generation_++;
+  return status;
 }
 
 std::string RegistryFactory::getActive(const std::string& registry_name) const {
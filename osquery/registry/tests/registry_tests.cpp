@@ -10,11 +10,14 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 
 namespace osquery {
 
+DECLARE_bool(registry_exceptions);
+
 /// Normally we have "Registry" that dictates the set of possible API methods
 /// for all registry types. Here we use a "TestRegistry" instead.
 class TestCoreRegistry : public RegistryFactory {};
@@ -165,6 +168,37 @@ TEST_F(RegistryTests, test_registry_exceptions) {
   EXPECT_EQ(exception_count, 1U);
 }
 
+TEST_F(RegistryTests, test_call_local_exceptions) {
+  auto exceptions = FLAGS_registry_exceptions;
+  FLAGS_registry_exceptions = false;
+
+  // A typed call's status is returned.
+  auto status = RegistryFactory::callLocal(
+      "dog", "doge", []() { return Status(3, "Typed"); });
+  EXPECT_EQ(3, status.getCode());
+
+  // A throwing plugin fails the call instead of the caller.
+  status = RegistryFactory::callLocal("dog", "bad_doge", []() -> Status {
+    throw std::runtime_error("Bad doge");
+  });
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ("Bad doge", status.getMessage());
+
+  status = RegistryFactory::callLocal(
+      "dog", "bad_doge", []() -> Status { throw 1; });
+  EXPECT_EQ(2, status.getCode());
+
+  // Tests may ask for the exceptions.
+  FLAGS_registry_exceptions = true;
+  EXPECT_THROW(RegistryFactory::callLocal("dog",
+                                          "bad_doge",
+                                          []() -> Status {
+                                            throw std::runtime_error("Bad");
+                                          }),
+               std::runtime_error);
+  FLAGS_registry_exceptions = exceptions;
+}
+
 class WidgetPlugin : public Plugin {
  public:
   /// The route information will usually be provided by the plugin type.
@@ -234,6 +268,13 @@ TEST_F(RegistryTests, test_registry_api) {
   request["secret_power"] = "magic";
   status = TestCoreRegistry::call("widgets", "special", request, response);
   EXPECT_EQ(response[0].at("secret_power"), "magic");
+
+  // Plugins of the process are also available as their plugin type.
+  auto& rf = TestCoreRegistry::get();
+  EXPECT_TRUE(rf.localPlugin<WidgetPlugin>("widgets", "special") != nullptr);
+  EXPECT_TRUE(rf.localPlugin<WidgetPlugin>("widgets", "missing") == nullptr);
+  EXPECT_TRUE(rf.localPlugin<DogPlugin>("widgets", "special") == nullptr);
+  EXPECT_TRUE(rf.localPlugin<WidgetPlugin>("gadgets", "special") == nullptr);
 }
 
 TEST_F(RegistryTests, test_real_registry) {
@@ -8,6 +8,7 @@
  *
  */
 
+#include <osquery/database.h>
 #include <osquery/enroll.h>
 #include <osquery/filesystem.h>
 #include <osquery/system.h>
@@ -23,6 +24,7 @@ namespace osquery {
 
 DECLARE_string(enroll_secret_path);
 DECLARE_bool(disable_enrollment);
+DECLARE_string(result_encoding);
 
 /// Enrollment TLS endpoint (path) using TLS hostname.
 CLI_FLAG(string,
@@ -86,6 +88,16 @@ Status TLSEnrollPlugin::requestKey(const std::string& uri,
   boost::property_tree::ptree params;
   params.put<std::string>(FLAGS_tls_enroll_override, getEnrollSecret());
   params.put<std::string>("host_identifier", getHostIdentifier());
+  if (FLAGS_result_encoding == "enroll") {
+    // The endpoint may choose one of these with a "result_encoding".
+    boost::property_tree::ptree encodings;
+    for (const auto& encoding : {"rows", "columnar"}) {
+      boost::property_tree::ptree child;
+      child.put_value(encoding);
+      encodings.push_back(std::make_pair("", child));
+    }
+    params.add_child("result_encodings", encodings);
+  }
 
   auto request = Request<TLSTransport, JSONSerializer>(uri);
   request.setOption("hostname", FLAGS_tls_hostname);
@@ -111,6 +123,10 @@ Status TLSEnrollPlugin::requestKey(const std::string& uri,
   if (node_key.size() == 0) {
     return Status(1, "No node key returned from TLS enroll plugin");
   }
+
+  if (FLAGS_result_encoding == "enroll") {
+    setEnrolledResultEncoding(recv.get("result_encoding", "rows"));
+  }
   return Status(0, "OK");
 }
 }
@@ -8,53 +8,93 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 #include <cstring>
 
 #include <zlib.h>
 
+#include <osquery/flags.h>
+
+#include "osquery/remote/requests.h"
+
 namespace osquery {
 
+FLAG(int32,
+     tls_compression_level,
+     9,
+     "GZip compression level (1-9) for TLS/HTTPS request bodies");
+
 #define MOD_GZIP_ZLIB_WINDOWSIZE 15
 #define MOD_GZIP_ZLIB_CFACTOR 9
 
 std::string compressString(const std::string& data) {
-  z_stream zs;
-  memset(&zs, 0, sizeof(zs));
+  StreamCompressor compressor;
+  compressor.append(data);
+  return compressor.finish();
+}
+
+StreamCompressor::StreamCompressor()
+    : StreamCompressor(FLAGS_tls_compression_level) {}
 
-  if (deflateInit2(&zs,
-                   Z_BEST_COMPRESSION,
+StreamCompressor::StreamCompressor(int level) : stream_(new z_stream) {
+  memset(stream_.get(), 0, sizeof(z_stream));
+  level = std::max(std::min(level, 9), 1);
+  if (deflateInit2(stream_.get(),
+                   level,
                    Z_DEFLATED,
                    MOD_GZIP_ZLIB_WINDOWSIZE + 16,
                    MOD_GZIP_ZLIB_CFACTOR,
                    Z_DEFAULT_STRATEGY) != Z_OK) {
-    return std::string();
+    failed_ = true;
+  }
+}
+
+StreamCompressor::~StreamCompressor() {
+  if (!failed_) {
+    deflateEnd(stream_.get());
   }
+}
 
-  zs.next_in = (Bytef*)data.data();
-  zs.avail_in = static_cast<uInt>(data.size());
+bool StreamCompressor::deflateInput(const char* data, size_t size, int flush) {
+  stream_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream_->avail_in = static_cast<uInt>(size);
 
+  char buffer[16384] = {0};
   int ret = Z_OK;
-  std::string output;
+  do {
+    stream_->next_out = reinterpret_cast<Bytef*>(buffer);
+    stream_->avail_out = sizeof(buffer);
+    ret = deflate(stream_.get(), flush);
+    if (ret == Z_STREAM_ERROR) {
+      return false;
+    }
+    output_.append(buffer, sizeof(buffer) - stream_->avail_out);
+  } while (stream_->avail_out == 0);
+  return (flush != Z_FINISH || ret == Z_STREAM_END);
+}
 
-  {
-    char buffer[16384] = {0};
-    while (ret == Z_OK) {
-      zs.next_out = reinterpret_cast<Bytef*>(buffer);
-      zs.avail_out = sizeof(output);
+void StreamCompressor::append(const char* data, size_t size) {
+  if (!failed_ && size > 0 && !deflateInput(data, size, Z_NO_FLUSH)) {
+    deflateEnd(stream_.get());
+    failed_ = true;
+  }
+}
 
-      ret = deflate(&zs, Z_FINISH);
-      if (output.size() < zs.total_out) {
-        output.append(buffer, zs.total_out - output.size());
-      }
-    }
+std::string StreamCompressor::finish() {
+  if (failed_) {
+    return std::string();
   }
 
-  deflateEnd(&zs);
-  if (ret != Z_STREAM_END) {
+  auto finished = deflateInput(nullptr, 0, Z_FINISH);
+  deflateEnd(stream_.get());
+  failed_ = true;
+  if (!finished) {
     return std::string();
   }
 
+  std::string output;
+  output.swap(output_);
   return output;
 }
 }
@@ -10,15 +10,19 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <utility>
 #include <string>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/status.h>
 
+struct z_stream_s;
+
 namespace osquery {
 
 class Serializer;
@@ -34,6 +38,49 @@ class Serializer;
  */
 std::string compressString(const std::string& data);
 
+/**
+ * @brief Compress data using GZip as it is appended.
+ *
+ * A request body may be compressed while it is written, instead of being
+ * held in full before compressString.
+ */
+class StreamCompressor : private boost::noncopyable {
+ public:
+  /// Start a stream using the --tls_compression_level.
+  StreamCompressor();
+
+  /// Start a stream using a compression level (1-9).
+  explicit StreamCompressor(int level);
+  ~StreamCompressor();
+
+  /// Compress and append data to the output.
+  void append(const char* data, size_t size);
+
+  void append(const std::string& data) {
+    append(data.data(), data.size());
+  }
+
+  /**
+   * @brief Complete the GZip stream.
+   *
+   * @return the compressed output, empty if compression failed.
+   */
+  std::string finish();
+
+ private:
+  /// Deflate data, with flush set to Z_FINISH to complete the stream.
+  bool deflateInput(const char* data, size_t size, int flush);
+
+ private:
+  std::unique_ptr<z_stream_s> stream_;
+
+  /// The compressed output.
+  std::string output_;
+
+  /// Set when the stream ended, after a failure or finish.
+  bool failed_{false};
+};
+
 /**
  * @brief Abstract base class for remote transport implementations
  *
@@ -98,6 +145,28 @@ class Transport {
     return response_params_;
   }
 
+  /**
+   * @brief Get a header of the response
+   *
+   * @param name the lower-case header name
+   *
+   * @return The header value, or an empty string
+   */
+  std::string getResponseHeader(const std::string& name) const {
+    auto header = response_headers_.find(name);
+    return (header == response_headers_.end()) ? "" : header->second;
+  }
+
+  /**
+   * @brief Check if a conditional request's content is unchanged
+   *
+   * A request with an "etag" option asks the destination to respond without
+   * content if the content still has that ETag.
+   */
+  bool isNotModified() const {
+    return not_modified_;
+  }
+
   template <typename T>
   void setOption(const std::string& name, const T& value) {
     options_.put(name, value);
@@ -121,6 +190,12 @@ class Transport {
   /// storage for response parameters
   boost::property_tree::ptree response_params_;
 
+  /// storage for response headers, by lower-case name
+  std::map<std::string, std::string> response_headers_;
+
+  /// set when a conditional request's content is unchanged
+  bool not_modified_{false};
+
   /// options from request call (use defined by specific transport)
   boost::property_tree::ptree options_;
 };
@@ -236,6 +311,20 @@ class Request {
     return transport_->sendRequest(serialized, options_.get("compress", false));
   }
 
+  /**
+   * @brief Send a request with a body the caller serialized
+   *
+   * The serializer is bypassed. Set the "compressed" option if the caller
+   * also compressed the body.
+   *
+   * @param serialized The request body
+   *
+   * @return success or failure of the operation
+   */
+  Status call(const std::string& serialized) {
+    return transport_->sendRequest(serialized, options_.get("compress", false));
+  }
+
   /**
    * @brief Get the request response
    *
@@ -246,6 +335,16 @@ class Request {
     return transport_->getResponseStatus();
   }
 
+  /// Get a header of the response by its lower-case name.
+  std::string getResponseHeader(const std::string& name) const {
+    return transport_->getResponseHeader(name);
+  }
+
+  /// Check if a conditional request's content is unchanged.
+  bool isNotModified() const {
+    return transport_->isNotModified();
+  }
+
   template <typename T>
   void setOption(const std::string& name, const T& value) {
     options_.put(name, value);
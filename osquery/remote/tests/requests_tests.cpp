@@ -16,6 +16,8 @@
 
 namespace osquery {
 
+DECLARE_int32(tls_compression_level);
+
 class RequestsTests : public testing::Test {
  public:
   void SetUp() {}
@@ -154,4 +156,32 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_stream_compression) {
+  std::string uncompressed = "stringstringstringstring";
+  for (size_t i = 0; i < 10; i++) {
+    uncompressed += uncompressed;
+  }
+
+  // Compressing while appending produces the same stream.
+  StreamCompressor compressor;
+  for (size_t i = 0; i < uncompressed.size(); i += 100) {
+    compressor.append(uncompressed.substr(i, 100));
+  }
+  auto compressed = compressor.finish();
+  EXPECT_EQ(compressed, compressString(uncompressed));
+
+  // A finished stream does not compress again.
+  EXPECT_TRUE(compressor.finish().empty());
+
+  // The gzip header's extra flags report the fastest compression level.
+  FLAGS_tls_compression_level = 1;
+  StreamCompressor fast;
+  fast.append(uncompressed);
+  compressed = fast.finish();
+  FLAGS_tls_compression_level = 9;
+  ASSERT_GT(compressed.size(), 9U);
+  EXPECT_EQ('\x4', compressed[8]);
+  EXPECT_NE(compressed, compressString(uncompressed));
+}
 }
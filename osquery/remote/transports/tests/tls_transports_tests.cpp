@@ -26,6 +26,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_string(tls_server_certs);
+DECLARE_bool(tls_session_reuse);
 
 class TLSTransportsTests : public testing::Test {
  public:
@@ -180,4 +181,48 @@ TEST_F(TLSTransportsTests, test_call_client_auth) {
     EXPECT_TRUE(status.ok());
   }
 }
+
+TEST_F(TLSTransportsTests, test_client_reuse) {
+  TLSTransport::resetClients();
+  auto url = "https://localhost:" + port_;
+
+  // Requests to any path of an endpoint share a client.
+  for (const auto& path : {"/", "/config", "/log"}) {
+    auto t = std::make_shared<TLSTransport>();
+    t->disableVerifyPeer();
+    auto r = Request<TLSTransport, JSONSerializer>(url + path, t);
+    Status status;
+    ASSERT_NO_THROW(status = r.call());
+    verify(status);
+  }
+  EXPECT_EQ(1U, TLSTransport::getClientCount());
+
+  // Different TLS options use a different client.
+  auto t = std::make_shared<TLSTransport>();
+  t->setPeerCertificate(kTestDataPath + "test_server_ca.pem");
+  auto r = Request<TLSTransport, JSONSerializer>(url, t);
+  Status status;
+  ASSERT_NO_THROW(status = r.call());
+  if (verify(status)) {
+    EXPECT_TRUE(status.ok());
+  }
+  EXPECT_EQ(2U, TLSTransport::getClientCount());
+
+  // A long-poll request's response timeout uses a different client.
+  auto long_poll = std::make_shared<TLSTransport>();
+  long_poll->disableVerifyPeer();
+  long_poll->setOption("timeout", kTLSRequestTimeout + 30);
+  EXPECT_EQ(kTLSRequestTimeout + 30, long_poll->getTimeout());
+  auto lr = Request<TLSTransport, JSONSerializer>(url, long_poll);
+  ASSERT_NO_THROW(status = lr.call());
+  verify(status);
+  EXPECT_EQ(3U, TLSTransport::getClientCount());
+
+  // Without reuse every request creates a client.
+  TLSTransport::resetClients();
+  FLAGS_tls_session_reuse = false;
+  ASSERT_NO_THROW(status = r.call());
+  EXPECT_EQ(0U, TLSTransport::getClientCount());
+  FLAGS_tls_session_reuse = true;
+}
 }
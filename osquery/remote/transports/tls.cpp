@@ -13,10 +13,16 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
+#include <map>
+
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/system.h>
+
+#include "osquery/core/metrics.h"
 
 namespace fs = boost::filesystem;
 namespace http = boost::network::http;
@@ -64,8 +70,46 @@ HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
+FLAG(bool,
+     tls_session_reuse,
+     true,
+     "Share TLS clients between requests to the same endpoint");
+
+FLAG(uint64,
+     tls_session_timeout,
+     3600,
+     "Seconds a shared TLS client may be idle before it is dropped");
+
 DECLARE_bool(verbose);
 
+/// A client shared by requests to the same endpoint and TLS options.
+struct TLSClientEntry {
+  std::shared_ptr<http::client> client;
+
+  /// The last time a request used the client.
+  size_t used{0};
+};
+
+/// Shared clients, keyed by endpoint and TLS options.
+static std::map<std::string, TLSClientEntry> kTLSClients;
+
+/// Protect access to the shared clients.
+static Mutex kTLSClientsMutex;
+
+/// Metrics shared by every TLS request.
+struct TLSMetrics {
+  MetricCounter& requests = getMetricCounter("tls_requests");
+  MetricCounter& errors = getMetricCounter("tls_request_errors");
+  MetricCounter& sent = getMetricCounter("tls_sent_bytes");
+  MetricCounter& received = getMetricCounter("tls_received_bytes");
+  MetricHistogram& latency = getMetricHistogram("tls_request_microseconds");
+};
+
+static TLSMetrics& getTLSMetrics() {
+  static TLSMetrics metrics;
+  return metrics;
+}
+
 TLSTransport::TLSTransport() : verify_peer_(true) {
   if (FLAGS_tls_server_certs.size() > 0) {
     server_certificate_file_ = FLAGS_tls_server_certs;
@@ -83,11 +127,88 @@ void TLSTransport::decorateRequest(http::client::request& r) {
   r << boost::network::header("Accept", serializer_->getContentType());
   r << boost::network::header("Host", FLAGS_tls_hostname);
   r << boost::network::header("User-Agent", kTLSUserAgentBase + kVersion);
+
+  // Ask for content only if it changed since the response with this ETag.
+  auto etag = options_.get<std::string>("etag", "");
+  if (!etag.empty()) {
+    r << boost::network::header("If-None-Match", etag);
+  }
+}
+
+void TLSTransport::readResponse(const std::string& response_body) {
+  response_headers_.clear();
+  for (const auto& header : response_.headers()) {
+    // Header names are case-insensitive.
+    response_headers_[boost::algorithm::to_lower_copy(header.first)] =
+        header.second;
+  }
+
+  not_modified_ = (response_.status() == 304 && options_.count("etag") > 0);
+  if (not_modified_) {
+    response_params_.clear();
+    response_status_ = Status(0, "Not modified");
+    return;
+  }
+  response_status_ = serializer_->deserialize(response_body, response_params_);
+}
+
+std::string TLSTransport::getClientKey() const {
+  // Requests to different paths of the same scheme and authority may share.
+  auto authority = destination_.find('/', destination_.find("://") + 3);
+  std::string key = destination_.substr(0, authority);
+  key += "|" + options_.get<std::string>("hostname", "");
+  key += "|" + server_certificate_file_;
+  key += "|" + client_certificate_file_;
+  key += "|" + client_private_key_file_;
+  key += (verify_peer_) ? "|verify" : "|noverify";
+  key += "|" + std::to_string(getTimeout());
+  return key;
 }
 
 http::client TLSTransport::getClient() {
+  if (!FLAGS_tls_session_reuse) {
+    return createClient();
+  }
+
+  auto key = getClientKey();
+  auto now = getUnixTime();
+  WriteLock lock(kTLSClientsMutex);
+  for (auto it = kTLSClients.begin(); it != kTLSClients.end();) {
+    if (it->first != key && now - it->second.used > FLAGS_tls_session_timeout) {
+      it = kTLSClients.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto& entry = kTLSClients[key];
+  if (entry.client == nullptr ||
+      now - entry.used > FLAGS_tls_session_timeout) {
+    entry.client = std::make_shared<http::client>(createClient());
+  }
+  entry.used = now;
+  return *entry.client;
+}
+
+void TLSTransport::resetClients() {
+  WriteLock lock(kTLSClientsMutex);
+  kTLSClients.clear();
+}
+
+size_t TLSTransport::getClientCount() {
+  WriteLock lock(kTLSClientsMutex);
+  return kTLSClients.size();
+}
+
+size_t TLSTransport::getTimeout() const {
+  return options_.get<size_t>("timeout", kTLSRequestTimeout);
+}
+
+http::client TLSTransport::createClient() {
   http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(16);
+  options.follow_redirects(true).always_verify_peer(verify_peer_);
+  options.timeout(static_cast<int>(getTimeout()));
+  options.cache_resolved(FLAGS_tls_session_reuse);
 
   std::string ciphers = kTLSCiphers;
   if (!isPlatform(PlatformType::TYPE_OSX)) {
@@ -168,15 +289,19 @@ Status TLSTransport::sendRequest() {
   decorateRequest(r);
 
   VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
+  auto& metrics = getTLSMetrics();
+  metrics.requests.add();
+  MetricTimer timer(metrics.latency);
   try {
     response_ = client.get(r);
-    const auto& response_body = body(response_);
+    const std::string response_body = body(response_);
+    metrics.received.add(response_body.size());
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
     }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    readResponse(response_body);
   } catch (const std::exception& e) {
+    metrics.errors.add();
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
   }
@@ -191,10 +316,13 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
   auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
-  if (compress) {
+  // The caller may have compressed the data while serializing.
+  bool compressed = options_.get("compressed", false);
+  if (compress || compressed) {
     // Later, when posting/putting, the data will be optionally compressed.
     r << boost::network::header("Content-Encoding", "gzip");
   }
+  compress = compress && !compressed;
 
   // Allow request calls to override the default HTTP POST verb.
   HTTPVerb verb = HTTP_POST;
@@ -208,20 +336,26 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
     fprintf(stdout, "%s\n", params.c_str());
   }
 
+  auto& metrics = getTLSMetrics();
+  metrics.requests.add();
+  MetricTimer timer(metrics.latency);
   try {
+    auto data = (compress) ? compressString(params) : params;
+    metrics.sent.add(data.size());
     if (verb == HTTP_POST) {
-      response_ = client.post(r, (compress) ? compressString(params) : params);
+      response_ = client.post(r, data);
     } else {
-      response_ = client.put(r, (compress) ? compressString(params) : params);
+      response_ = client.put(r, data);
     }
 
-    const auto& response_body = body(response_);
+    const std::string response_body = body(response_);
+    metrics.received.add(response_body.size());
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
     }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    readResponse(response_body);
   } catch (const std::exception& e) {
+    metrics.errors.add();
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
   }
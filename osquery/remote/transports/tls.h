@@ -101,6 +101,9 @@ enum HTTPVerb {
   HTTP_PUT,
 };
 
+/// Seconds a request may wait for a response, unless a "timeout" is set.
+const size_t kTLSRequestTimeout = 16;
+
 /**
  * @brief HTTPS (TLS) transport.
  */
@@ -134,8 +137,32 @@ class TLSTransport : public Transport {
  public:
   TLSTransport();
 
+  /**
+   * @brief Get a client for the destination and TLS options
+   *
+   * Clients are shared by every transport and TLS plugin requesting the same
+   * endpoint with the same TLS options, unless --tls_session_reuse is false.
+   * A shared client keeps its IO service, worker thread, and resolved
+   * addresses. Clients unused for --tls_session_timeout seconds are dropped.
+   */
   boost::network::http::client getClient();
 
+  /// Drop every shared client.
+  static void resetClients();
+
+ private:
+  /// Create a new client using the TLS options.
+  boost::network::http::client createClient();
+
+  /// Identify the endpoint and TLS options a shared client is created for.
+  std::string getClientKey() const;
+
+  /// Seconds to wait for a response, a long-poll request waits longer.
+  size_t getTimeout() const;
+
+  /// Number of shared clients.
+  static size_t getClientCount();
+
  private:
   /// Testing-only, disable peer verification.
   void disableVerifyPeer() {
@@ -175,6 +202,15 @@ class TLSTransport : public Transport {
     */
   void decorateRequest(boost::network::http::client::request& r);
 
+  /**
+   * @brief Read the response headers and deserialize its body
+   *
+   * A conditional request's unchanged content is not deserialized.
+   *
+   * @param response_body the body of the response
+   */
+  void readResponse(const std::string& response_body);
+
  protected:
   /// Storage for the HTTP response object
   boost::network::http::client::response response_;
@@ -186,6 +222,7 @@ class TLSTransport : public Transport {
   FRIEND_TEST(TLSTransportsTests, test_call_server_cert_pinning);
   FRIEND_TEST(TLSTransportsTests, test_call_client_auth);
   FRIEND_TEST(TLSTransportsTests, test_call_http);
+  FRIEND_TEST(TLSTransportsTests, test_client_reuse);
 
   friend class TestDistributedPlugin;
 };
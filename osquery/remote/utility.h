@@ -71,6 +71,11 @@ class TLSRequestHelper : private boost::noncopyable {
    * @param output is the ptree which will be populated with the deserialized
    * results
    *
+   * If params include an "_etag" the request is conditional on the content
+   * having changed since the response with that ETag. The "_etag" is then
+   * replaced with the response's ETag and "_not_modified" is set if the
+   * content did not change, in which case the output is empty.
+   *
    * @return a Status object indicating the success or failure of the operation
    */
   template <class TSerializer>
@@ -105,6 +110,26 @@ class TLSRequestHelper : private boost::noncopyable {
       params.erase("_verb");
     }
 
+    // A long-poll request may set a longer response timeout.
+    size_t timeout = 0;
+    if (params.count("_timeout")) {
+      timeout = params.get<size_t>("_timeout", 0);
+      request.setOption("timeout", timeout);
+      params.erase("_timeout");
+    }
+
+    bool conditional = false;
+    std::string etag;
+    if (params.count("_etag")) {
+      conditional = true;
+      etag = params.get<std::string>("_etag", "");
+      if (!etag.empty()) {
+        request.setOption("etag", etag);
+      }
+      params.erase("_etag");
+    }
+    params.erase("_not_modified");
+
     bool use_post = true;
     if (params.count("_get")) {
       use_post = false;
@@ -122,6 +147,19 @@ class TLSRequestHelper : private boost::noncopyable {
       params.put("_compress", true);
     }
 
+    if (timeout > 0) {
+      params.put("_timeout", timeout);
+    }
+
+    if (conditional) {
+      if (status.ok() && request.isNotModified()) {
+        params.put("_not_modified", true);
+      } else if (status.ok()) {
+        etag = request.getResponseHeader("etag");
+      }
+      params.put("_etag", etag);
+    }
+
     if (!status.ok()) {
       return status;
     }
@@ -131,7 +169,54 @@ class TLSRequestHelper : private boost::noncopyable {
     if (!status.ok()) {
       return status;
     }
+    return checkResponse(output);
+  }
+
+  /**
+   * @brief Send a TLS POST request with a body the caller serialized
+   *
+   * This avoids building a ptree of params when the caller can write the
+   * body directly, such as splicing serialized log lines.
+   *
+   * @param uri is the URI to send the request to
+   * @param body is the serialized request, it must include the node_key
+   * unless --tls_node_api is set
+   * @param compressed true if the caller GZip compressed the body
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status goSerialized(const std::string& uri,
+                             const std::string& body,
+                             bool compressed,
+                             boost::property_tree::ptree& output) {
+    std::string uri_suffix;
+    if (FLAGS_tls_node_api) {
+      uri_suffix = "&node_key=" + getNodeKey("tls");
+    }
+
+    auto request = Request<TLSTransport, TSerializer>(uri + uri_suffix);
+    request.setOption("hostname", FLAGS_tls_hostname);
+    if (compressed) {
+      request.setOption("compressed", true);
+    }
+
+    auto status = request.call(body);
+    if (!status.ok()) {
+      return status;
+    }
+
+    status = request.getResponse(output);
+    if (!status.ok()) {
+      return status;
+    }
+    return checkResponse(output);
+  }
 
+  /// Check a response for a node key rejection or error.
+  static Status checkResponse(const boost::property_tree::ptree& output) {
     // Receive config or key rejection
     if (output.count("node_invalid") > 0) {
       auto invalid = output.get("node_invalid", "");
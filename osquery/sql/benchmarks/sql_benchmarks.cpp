@@ -151,6 +151,29 @@ static void SQL_virtual_table_internal_unique(benchmark::State& state) {
 
 BENCHMARK(SQL_virtual_table_internal_unique);
 
+static void SQL_virtual_table_internal_pooled(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("benchmark", std::make_shared<BenchmarkTablePlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "benchmark", {{"action", "columns"}}, res);
+
+  // Hold the primary connection so each request contends for it.
+  auto primary = SQLiteDBManager::get();
+  attachTableInternal("benchmark", columnDefinition(res), primary);
+  SQLiteDBManager::resetPool();
+
+  while (state.KeepRunning()) {
+    auto dbc = SQLiteDBManager::get();
+
+    QueryData results;
+    queryInternal("select * from benchmark", results, dbc->db());
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_pooled);
+
 class BenchmarkLongTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const {
@@ -232,6 +255,21 @@ class BenchmarkWideTableYieldPlugin : public BenchmarkWideTablePlugin {
   }
 };
 
+class BenchmarkWideTableTypedPlugin : public BenchmarkWideTablePlugin {
+ public:
+  bool usesTypedRows() const override {
+    return true;
+  }
+
+  TypedQueryData generateTyped(QueryContext& ctx) override {
+    TypedQueryData results;
+    for (size_t k = 0; k < kWideCount; k++) {
+      results.push_back(TypedRow(20, 0LL));
+    }
+    return results;
+  }
+};
+
 static void SQL_virtual_table_internal_wide(benchmark::State& state) {
   auto tables = RegistryFactory::get().registry("table");
   tables->add("wide_benchmark", std::make_shared<BenchmarkWideTablePlugin>());
@@ -283,6 +321,32 @@ BENCHMARK(SQL_virtual_table_internal_wide_yield)
     ->ArgPair(0, 100)
     ->ArgPair(0, 1000);
 
+static void SQL_virtual_table_internal_wide_typed(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("wide_benchmark_typed",
+              std::make_shared<BenchmarkWideTableTypedPlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "wide_benchmark_typed", {{"action", "columns"}}, res);
+
+  // Attach a sample virtual table.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("wide_benchmark_typed", columnDefinition(res), dbc);
+
+  kWideCount = state.range_y();
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal("select * from wide_benchmark_typed", results, dbc->db());
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_wide_typed)
+    ->ArgPair(0, 1)
+    ->ArgPair(0, 10)
+    ->ArgPair(0, 100)
+    ->ArgPair(0, 1000);
+
 static void SQL_select_metadata(benchmark::State& state) {
   auto dbc = SQLiteDBManager::getUnique();
   while (state.KeepRunning()) {
@@ -295,6 +359,30 @@ static void SQL_select_metadata(benchmark::State& state) {
 
 BENCHMARK(SQL_select_metadata);
 
+static void SQL_attach_all(benchmark::State& state) {
+  // Profile a transient connection attaching every table for one query.
+  while (state.KeepRunning()) {
+    auto dbc = SQLiteDBManager::getUnique();
+    QueryData results;
+    dbc->query("select * from benchmark", results);
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_attach_all);
+
+static void SQL_attach_lazy(benchmark::State& state) {
+  // The same query only attaches the table it references.
+  while (state.KeepRunning()) {
+    auto dbc = SQLiteDBManager::getUnique(true);
+    QueryData results;
+    dbc->query("select * from benchmark", results);
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_attach_lazy);
+
 static void SQL_select_basic(benchmark::State& state) {
   // Profile executing a query against an internal, already attached table.
   while (state.KeepRunning()) {
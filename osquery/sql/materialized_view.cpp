@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+
+#include <osquery/core.h>
+
+#include "osquery/sql/materialized_view.h"
+
+namespace osquery {
+
+/// Escape a result value, see SQL::escapeResults.
+extern void escapeNonPrintableBytesEx(std::string& data);
+
+namespace {
+
+/// The escaped selected columns of a row, and the read it was last seen by.
+struct KeptRow {
+  Row row;
+  size_t generation{0};
+};
+
+/// The rows a continuous query read from a view.
+struct MaterializedConsumer {
+  std::string table;
+  std::vector<std::string> columns;
+
+  /// The kept rows by each row's key.
+  std::map<std::string, KeptRow> rows;
+  size_t generation{0};
+
+  /// Reads of the view are serialized per query.
+  Mutex mutex;
+};
+
+struct MaterializedViews {
+  std::map<std::string, std::shared_ptr<MaterializedView>> views;
+  std::map<std::string, std::shared_ptr<MaterializedConsumer>> consumers;
+  Mutex mutex;
+};
+
+MaterializedViews& getMaterializedViews() {
+  static MaterializedViews views;
+  return views;
+}
+
+/// Check if the selected columns of a view row differ from the kept row.
+bool rowChanged(const Row& row,
+                const Row& kept,
+                const std::vector<std::string>& columns) {
+  for (const auto& column : columns) {
+    auto value = row.find(column);
+    auto kept_value = kept.find(column);
+    if (kept_value == kept.end()) {
+      return true;
+    }
+
+    std::string raw = (value != row.end()) ? value->second : "";
+    if (raw == kept_value->second) {
+      // Escaping leaves printable values as they are.
+      continue;
+    }
+    escapeNonPrintableBytesEx(raw);
+    if (raw != kept_value->second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Row selectColumns(const Row& row, const std::vector<std::string>& columns) {
+  Row selected;
+  for (const auto& column : columns) {
+    auto value = row.find(column);
+    auto& escaped = selected[column];
+    if (value != row.end()) {
+      escaped = value->second;
+      escapeNonPrintableBytesEx(escaped);
+    }
+  }
+  return selected;
+}
+}
+
+bool registerMaterializedView(const std::string& table,
+                              std::shared_ptr<MaterializedView> view) {
+  auto& views = getMaterializedViews();
+  WriteLock lock(views.mutex);
+  views.views[table] = std::move(view);
+  return true;
+}
+
+Status getMaterializedDelta(const std::string& name,
+                            const std::string& table,
+                            const std::vector<std::string>& columns,
+                            DiffResults& dr) {
+  auto& views = getMaterializedViews();
+  std::shared_ptr<MaterializedView> view;
+  std::shared_ptr<MaterializedConsumer> consumer;
+  {
+    WriteLock lock(views.mutex);
+    auto it = views.views.find(table);
+    if (it == views.views.end()) {
+      return Status(1, "Table has no materialized view: " + table);
+    }
+    view = it->second;
+
+    if (columns.empty()) {
+      return Status(1, "No columns are selected");
+    }
+    for (const auto& column : columns) {
+      if (view->columns().count(column) == 0) {
+        return Status(1, "Column is not materialized: " + column);
+      }
+    }
+
+    auto& kept = views.consumers[name];
+    if (kept == nullptr || kept->table != table || kept->columns != columns) {
+      kept = std::make_shared<MaterializedConsumer>();
+      kept->table = table;
+      kept->columns = columns;
+    }
+    consumer = kept;
+  }
+
+  WriteLock lock(consumer->mutex);
+  auto generation = ++consumer->generation;
+  view->scan(([&consumer, &columns, &dr, generation](const std::string& key,
+                                                     const Row& row) {
+    auto& kept = consumer->rows[key];
+    kept.generation = generation;
+    if (!kept.row.empty()) {
+      if (!rowChanged(row, kept.row, columns)) {
+        return;
+      }
+      dr.removed.push_back(std::move(kept.row));
+    }
+    kept.row = selectColumns(row, columns);
+    dr.added.push_back(kept.row);
+  }));
+
+  // Rows the view no longer has were removed.
+  for (auto it = consumer->rows.begin(); it != consumer->rows.end();) {
+    if (it->second.generation == generation) {
+      ++it;
+      continue;
+    }
+    dr.removed.push_back(std::move(it->second.row));
+    it = consumer->rows.erase(it);
+  }
+  return Status(0, "OK");
+}
+
+void resetMaterializedDelta(const std::string& name) {
+  auto& views = getMaterializedViews();
+  WriteLock lock(views.mutex);
+  views.consumers.erase(name);
+}
+
+void pruneMaterializedDeltas(const std::set<std::string>& names) {
+  auto& views = getMaterializedViews();
+  WriteLock lock(views.mutex);
+  for (auto it = views.consumers.begin(); it != views.consumers.end();) {
+    it = (names.count(it->first) > 0) ? std::next(it)
+                                      : views.consumers.erase(it);
+  }
+}
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// Called with each row of a view and the row's identity, such as a pid.
+using MaterializedRowCallback =
+    std::function<void(const std::string& key, const Row& row)>;
+
+/**
+ * @brief A table's state kept up to date between queries.
+ *
+ * A view maintains the rows of a table for a set of columns whose values
+ * change rarely, updating them from state kept between scans and from event
+ * publishers. Continuous scheduled queries read the changes of a view instead
+ * of executing SQL and diffing the complete results.
+ */
+class MaterializedView : private boost::noncopyable {
+ public:
+  virtual ~MaterializedView() {}
+
+  /// The columns the view maintains.
+  virtual const std::set<std::string>& columns() const = 0;
+
+  /// Bring the view up to date and call for each row, each key once.
+  virtual void scan(MaterializedRowCallback callback) = 0;
+};
+
+/// Register the view of a table, from a static initializer.
+bool registerMaterializedView(const std::string& table,
+                              std::shared_ptr<MaterializedView> view);
+
+/**
+ * @brief Get the changes of a view since a continuous query's last read.
+ *
+ * The selected columns of each row are kept in memory for the query name.
+ * The first read, and the first after the selection changes, adds every row.
+ * Values are escaped as the results of scheduled queries are.
+ *
+ * @param name the scheduled query name
+ * @param table the table with a view
+ * @param columns the selected columns, each must be maintained by the view
+ * @param dr output differential of the rows
+ * @return failure if the table has no view, or a column is not maintained.
+ */
+Status getMaterializedDelta(const std::string& name,
+                            const std::string& table,
+                            const std::vector<std::string>& columns,
+                            DiffResults& dr);
+
+/// Forget the rows kept for a continuous query.
+void resetMaterializedDelta(const std::string& name);
+
+/// Forget the rows kept for continuous queries not in the set of names.
+void pruneMaterializedDeltas(const std::set<std::string>& names);
+}
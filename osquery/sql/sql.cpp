@@ -8,6 +8,13 @@
  *
  */
 
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include <sstream>
 
 #include <osquery/core.h>
@@ -40,6 +47,12 @@ const QueryData& SQL::rows() const {
   return results_;
 }
 
+QueryData SQL::takeRows() {
+  QueryData rows;
+  rows.swap(results_);
+  return rows;
+}
+
 const ColumnNames& SQL::columns() {
   return columns_;
 }
@@ -56,8 +69,60 @@ std::string SQL::getMessageString() {
   return status_.toString();
 }
 
+static inline bool isNonPrintableByte(unsigned char c) {
+  return c < 0x20 || c >= 0x80;
+}
+
+/**
+ * @brief Find the first byte that must be escaped.
+ *
+ * Most values are printable, they are scanned 16 bytes at a time with SSE2,
+ * or a word at a time elsewhere, and the remaining bytes one at a time.
+ *
+ * @return the offset of the byte, or std::string::npos if there is none.
+ */
+static inline size_t findNonPrintableByte(const std::string& data) {
+  const auto bytes = data.data();
+  const auto size = data.size();
+  size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+  // A signed compare finds bytes below 0x20 and at or above 0x80 at once.
+  const auto limit = _mm_set1_epi8(0x20);
+  for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    if (_mm_movemask_epi8(_mm_cmplt_epi8(block, limit)) != 0) {
+      break;
+    }
+  }
+#else
+  // Set the high bit of each byte below 0x20 or with the high bit set.
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    if (((word | ((word - ones * 0x20) & ~word)) & highs) != 0) {
+      break;
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (isNonPrintableByte(static_cast<unsigned char>(bytes[i]))) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
 static inline void escapeNonPrintableBytes(std::string& data) {
-  std::string escaped;
+  // Only replace if any escapes are needed.
+  auto first = findNonPrintableByte(data);
+  if (first == std::string::npos) {
+    return;
+  }
+
   // clang-format off
   char const hex_chars[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7',
@@ -65,22 +130,20 @@ static inline void escapeNonPrintableBytes(std::string& data) {
   };
   // clang-format on
 
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((unsigned char)data[i]) < 0x20 || ((unsigned char)data[i]) >= 0x80) {
-      needs_replacement = true;
+  std::string escaped;
+  escaped.reserve(data.size() + 3 * (data.size() - first));
+  escaped.append(data, 0, first);
+  for (size_t i = first; i < data.length(); i++) {
+    auto c = static_cast<unsigned char>(data[i]);
+    if (isNonPrintableByte(c)) {
       escaped += "\\x";
-      escaped += hex_chars[(((unsigned char)data[i])) >> 4];
-      escaped += hex_chars[((unsigned char)data[i] & 0x0F) >> 0];
+      escaped += hex_chars[c >> 4];
+      escaped += hex_chars[c & 0x0F];
     } else {
       escaped += data[i];
     }
   }
-
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = std::move(escaped);
-  }
+  data = std::move(escaped);
 }
 
 void escapeNonPrintableBytesEx(std::string& data) {
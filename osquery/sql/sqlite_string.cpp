@@ -16,22 +16,98 @@
 #include <arpa/inet.h>
 #endif
 
-#include <functional>
+#include <cctype>
+#include <memory>
 #include <string>
-#include <vector>
 
-#include <boost/algorithm/string/regex.hpp>
 #include <boost/regex.hpp>
-
-#include "osquery/core/conversions.h"
+#include <boost/utility/string_ref.hpp>
 
 #include <sqlite3.h>
 
 namespace osquery {
 
-using SplitResult = std::vector<std::string>;
-using StringSplitFunction = std::function<SplitResult(
-    const std::string& input, const std::string& tokens)>;
+/// The auxiliary data slot of a compiled pattern argument.
+const int kRegexAuxSlot = 1;
+
+/**
+ * @brief A pattern argument compiled at most once per statement.
+ *
+ * SQLite keeps auxiliary data attached to a constant argument for every row
+ * of a statement. The compiled regex is reused from there, or compiled and
+ * handed to SQLite once the function has produced its result. SQLite may
+ * destroy the data as soon as it is set, so it is set last.
+ */
+class CachedRegex {
+ public:
+  CachedRegex(sqlite3_context* context, sqlite3_value* pattern)
+      : context_(context) {
+    regex_ = static_cast<boost::regex*>(
+        sqlite3_get_auxdata(context_, kRegexAuxSlot));
+    if (regex_ != nullptr) {
+      return;
+    }
+
+    try {
+      auto text = reinterpret_cast<const char*>(sqlite3_value_text(pattern));
+      auto size = static_cast<size_t>(sqlite3_value_bytes(pattern));
+      compiled_.reset(new boost::regex(text, text + size));
+      regex_ = compiled_.get();
+    } catch (const boost::regex_error& e) {
+      error_ = std::string("Invalid regex pattern: ") + e.what();
+    }
+  }
+
+  ~CachedRegex() {
+    if (compiled_ != nullptr) {
+      sqlite3_set_auxdata(
+          context_, kRegexAuxSlot, compiled_.release(), deleteRegex);
+    }
+  }
+
+  /// The compiled pattern, or nullptr if the pattern is invalid.
+  const boost::regex* get() const {
+    return regex_;
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  static void deleteRegex(void* regex) {
+    delete static_cast<boost::regex*>(regex);
+  }
+
+ private:
+  sqlite3_context* context_{nullptr};
+  const boost::regex* regex_{nullptr};
+  std::unique_ptr<boost::regex> compiled_;
+  std::string error_;
+};
+
+/// A view of a text argument, the text is owned by SQLite.
+static boost::string_ref getTextArg(sqlite3_value* value) {
+  auto text = reinterpret_cast<const char*>(sqlite3_value_text(value));
+  return boost::string_ref(text,
+                           static_cast<size_t>(sqlite3_value_bytes(value)));
+}
+
+static bool isAnyArgNull(int argc, sqlite3_value** argv) {
+  for (int i = 0; i < argc; i++) {
+    if (SQLITE_NULL == sqlite3_value_type(argv[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void resultTextRef(sqlite3_context* context, boost::string_ref text) {
+  sqlite3_result_text(context,
+                      text.data(),
+                      static_cast<int>(text.size()),
+                      SQLITE_TRANSIENT);
+}
 
 /**
  * @brief A simple SQLite column string split implementation.
@@ -47,10 +123,35 @@ using StringSplitFunction = std::function<SplitResult(
  *      168
  *   3. SELECT SPLIT(ip_address, ".0", 0) from addresses;
  *      192
+ *
+ * The input is scanned only until the selected index, the results match
+ * osquery::split, which drops empty elements and trims the rest.
  */
-static SplitResult tokenSplit(const std::string& input,
-                              const std::string& tokens) {
-  return osquery::split(input, tokens);
+static bool tokenSplit(boost::string_ref input,
+                       boost::string_ref tokens,
+                       size_t index,
+                       boost::string_ref& selected) {
+  size_t start = 0;
+  size_t element = 0;
+  for (size_t i = 0; i <= input.size(); i++) {
+    if (i < input.size() && tokens.find(input[i]) == boost::string_ref::npos) {
+      continue;
+    }
+    if (i > start && element++ == index) {
+      selected = input.substr(start, i - start);
+      while (!selected.empty() &&
+             std::isspace(static_cast<unsigned char>(selected.front()))) {
+        selected.remove_prefix(1);
+      }
+      while (!selected.empty() &&
+             std::isspace(static_cast<unsigned char>(selected.back()))) {
+        selected.remove_suffix(1);
+      }
+      return true;
+    }
+    start = i + 1;
+  }
+  return false;
 }
 
 /**
@@ -66,62 +167,157 @@ static SplitResult tokenSplit(const std::string& input,
  *      168
  *   3. SELECT SPLIT(ip_address, "\.0", 0) from addresses;
  *      192.168
+ *
+ * Matches are searched only until the selected index. Empty elements are
+ * kept, as boost::algorithm::split_regex does.
  */
-static SplitResult regexSplit(const std::string& input,
-                              const std::string& token) {
-  // Split using the token as a regex to support multi-character tokens.
-  std::vector<std::string> result;
-  boost::algorithm::split_regex(result, input, boost::regex(token));
-  return result;
+static bool regexSplit(boost::string_ref input,
+                       const boost::regex& token,
+                       size_t index,
+                       boost::string_ref& selected) {
+  auto begin = input.data();
+  auto end = input.data() + input.size();
+  boost::cmatch match;
+  for (size_t element = 0; element <= index; element++) {
+    auto flags = boost::match_not_null;
+    if (begin != input.data()) {
+      // Anchors and word boundaries see the text before the element.
+      flags |= boost::match_prev_avail;
+    }
+    if (!boost::regex_search(begin, end, match, token, flags)) {
+      selected = boost::string_ref(begin, end - begin);
+      return element == index;
+    }
+    selected = boost::string_ref(begin, match[0].first - begin);
+    begin = match[0].second;
+  }
+  return true;
 }
 
-static void callStringSplitFunc(sqlite3_context* context,
-                                int argc,
-                                sqlite3_value** argv,
-                                StringSplitFunction f) {
+static void tokenStringSplitFunc(sqlite3_context* context,
+                                 int argc,
+                                 sqlite3_value** argv) {
   assert(argc == 3);
-  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
-      SQLITE_NULL == sqlite3_value_type(argv[1]) ||
-      SQLITE_NULL == sqlite3_value_type(argv[2])) {
+  if (isAnyArgNull(argc, argv)) {
     sqlite3_result_null(context);
     return;
   }
 
   // Parse and verify the split input parameters.
-  std::string input((char*)sqlite3_value_text(argv[0]));
-  std::string token((char*)sqlite3_value_text(argv[1]));
+  auto input = getTextArg(argv[0]);
+  auto tokens = getTextArg(argv[1]);
   auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
-  if (token.empty()) {
+  if (tokens.empty()) {
     // Allow the input string to be empty.
     sqlite3_result_error(context, "Invalid input to split function", -1);
     return;
   }
 
-  auto result = f(input, token);
-  if (index >= result.size()) {
+  boost::string_ref selected;
+  if (!tokenSplit(input, tokens, index, selected)) {
     // Could emit a warning about a selected index that is out of bounds.
     sqlite3_result_null(context);
     return;
   }
-
-  // Yield the selected index.
-  const auto& selected = result[index];
-  sqlite3_result_text(context,
-                      selected.c_str(),
-                      static_cast<int>(selected.size()),
-                      SQLITE_TRANSIENT);
+  resultTextRef(context, selected);
 }
 
-static void tokenStringSplitFunc(sqlite3_context* context,
+static void regexStringSplitFunc(sqlite3_context* context,
                                  int argc,
                                  sqlite3_value** argv) {
-  callStringSplitFunc(context, argc, argv, tokenSplit);
+  assert(argc == 3);
+  if (isAnyArgNull(argc, argv)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto input = getTextArg(argv[0]);
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  if (sqlite3_value_bytes(argv[1]) == 0) {
+    sqlite3_result_error(context, "Invalid input to split function", -1);
+    return;
+  }
+
+  CachedRegex regex(context, argv[1]);
+  if (regex.get() == nullptr) {
+    sqlite3_result_error(context, regex.error().c_str(), -1);
+    return;
+  }
+
+  boost::string_ref selected;
+  if (!regexSplit(input, *regex.get(), index, selected)) {
+    sqlite3_result_null(context);
+    return;
+  }
+  resultTextRef(context, selected);
 }
 
-static void regexStringSplitFunc(sqlite3_context* context,
-                                 int argc,
-                                 sqlite3_value** argv) {
-  callStringSplitFunc(context, argc, argv, regexSplit);
+/**
+ * @brief Return 1 if a regex matches any part of a column value, else 0.
+ *
+ * Example:
+ *   SELECT * FROM processes WHERE REGEX_MATCH(cmdline, "--(user|pass)=");
+ */
+static void regexMatchFunc(sqlite3_context* context,
+                           int argc,
+                           sqlite3_value** argv) {
+  assert(argc == 2);
+  if (isAnyArgNull(argc, argv)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto input = getTextArg(argv[0]);
+  CachedRegex regex(context, argv[1]);
+  if (regex.get() == nullptr) {
+    sqlite3_result_error(context, regex.error().c_str(), -1);
+    return;
+  }
+
+  auto found = boost::regex_search(
+      input.data(), input.data() + input.size(), *regex.get());
+  sqlite3_result_int(context, (found) ? 1 : 0);
+}
+
+/**
+ * @brief Select a capture group of the first regex match in a column value.
+ *
+ * Index 0 selects the entire match. If there is no match, or the group did
+ * not participate in the match, a NULL is returned.
+ *
+ * Example:
+ *   1. SELECT path from processes;
+ *      /usr/lib/jvm/java-8/bin/java
+ *   2. SELECT REGEX_EXTRACT(path, "/java-([0-9]+)/", 1) from processes;
+ *      8
+ */
+static void regexExtractFunc(sqlite3_context* context,
+                             int argc,
+                             sqlite3_value** argv) {
+  assert(argc == 3);
+  if (isAnyArgNull(argc, argv)) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto input = getTextArg(argv[0]);
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  CachedRegex regex(context, argv[1]);
+  if (regex.get() == nullptr) {
+    sqlite3_result_error(context, regex.error().c_str(), -1);
+    return;
+  }
+
+  boost::cmatch match;
+  if (!boost::regex_search(
+          input.data(), input.data() + input.size(), match, *regex.get()) ||
+      index >= match.size() || !match[index].matched) {
+    sqlite3_result_null(context);
+    return;
+  }
+  resultTextRef(
+      context,
+      boost::string_ref(match[index].first, match[index].length()));
 }
 
 /**
@@ -169,6 +365,22 @@ void registerStringExtensions(sqlite3* db) {
                           regexStringSplitFunc,
                           nullptr,
                           nullptr);
+  sqlite3_create_function(db,
+                          "regex_match",
+                          2,
+                          SQLITE_UTF8,
+                          nullptr,
+                          regexMatchFunc,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "regex_extract",
+                          3,
+                          SQLITE_UTF8,
+                          nullptr,
+                          regexExtractFunc,
+                          nullptr,
+                          nullptr);
   sqlite3_create_function(db,
                           "inet_aton",
                           1,
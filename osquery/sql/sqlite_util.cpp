@@ -8,10 +8,17 @@
  *
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+
 #include <osquery/core.h>
+#include <osquery/extensions.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
@@ -25,6 +32,55 @@ FLAG(string,
 
 FLAG(string, nullvalue, "", "Set string for NULL values, default ''");
 
+FLAG(uint64,
+     sql_pool_size,
+     4,
+     "Attached SQLite connections kept for concurrent queries (0 to disable)");
+
+FLAG(uint64,
+     sql_prefetch_threads,
+     0,
+     "Generate the independent tables of a query using up to N threads");
+
+FLAG(bool,
+     sql_lazy_attach,
+     true,
+     "Attach tables to transient connections when a query references them");
+
+FLAG(uint64,
+     sql_statement_cache,
+     512,
+     "Prepared statements cached by the primary connection (0 to disable)");
+
+FLAG(uint64,
+     sql_columns_cache,
+     256,
+     "Inferred query column types cached for getQueryColumns (0 to disable)");
+
+FLAG(uint64,
+     schedule_yield_max,
+     1000,
+     "Milliseconds a scheduled query waits for distributed queries before "
+     "each table's first scan (0 = never)");
+
+/// Number of SQLite virtual machine steps between query limit checks.
+const int kSQLiteProgressSteps = 1000;
+
+/// Milliseconds between query limit checks of a yielding query.
+const size_t kQueryYieldInterval = 50;
+
+/// The calling thread's active query limit.
+static thread_local SQLQueryLimit* kQueryLimit{nullptr};
+
+/// The calling thread's query priority.
+static thread_local SQLQueryPriority::Priority kQueryPriority{
+    SQLQueryPriority::NORMAL};
+
+/// The number of threads running INTERACTIVE queries.
+static size_t kInteractiveQueries{0};
+static std::mutex kInteractiveMutex;
+static std::condition_variable kInteractiveDone;
+
 using OpReg = QueryPlanner::Opcode::Register;
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
@@ -140,22 +196,48 @@ std::string getStringForSQLiteReturnCode(int code) {
   }
 }
 
+/// Wait for autoloaded extensions to register the tables a query references.
+static void waitForExtensionTables(const std::string& q) {
+  if (extensionsPending()) {
+    // A unique instance does not hold the primary database while waiting, the
+    // registration attaches tables to it.
+    SQLiteDBManager::getUnique(true)->attachReferencedTables(q, true);
+  }
+}
+
 Status SQLiteSQLPlugin::query(const std::string& q, QueryData& results) const {
+  waitForExtensionTables(q);
   auto dbc = SQLiteDBManager::get();
-  auto result = queryInternal(q, results, dbc->db());
+  auto result = dbc->query(q, results);
   dbc->clearAffectedTables();
   return result;
 }
 
 Status SQLiteSQLPlugin::getQueryColumns(const std::string& q,
                                         TableColumns& columns) const {
+  auto& cache = QueryColumnsCache::instance();
+  auto key = QueryColumnsCache::normalize(q);
+  if (cache.get(key, columns)) {
+    return Status(0, "OK");
+  }
+
+  // The version is read first, a schema change while inferring is not stored.
+  auto version = cache.version();
+  waitForExtensionTables(q);
   auto dbc = SQLiteDBManager::get();
-  return getQueryColumnsInternal(q, columns, dbc->db());
+  dbc->attachReferencedTables(q);
+  auto status = getQueryColumnsInternal(q, columns, dbc->db());
+  if (status.ok()) {
+    cache.put(key, version, columns);
+  }
+  return status;
 }
 
 Status SQLiteSQLPlugin::getQueryTables(const std::string& q,
                                        std::vector<std::string>& tables) const {
+  waitForExtensionTables(q);
   auto dbc = SQLiteDBManager::get();
+  dbc->attachReferencedTables(q);
   QueryPlanner planner(q, dbc->db());
   tables = planner.tables();
   return Status(0);
@@ -163,7 +245,7 @@ Status SQLiteSQLPlugin::getQueryTables(const std::string& q,
 
 SQLInternal::SQLInternal(const std::string& q) {
   auto dbc = SQLiteDBManager::get();
-  status_ = queryInternal(q, results_, dbc->db());
+  status_ = dbc->query(q, results_);
 
   // One of the advantages of using SQLInternal (aside from the Registry-bypass)
   // is the ability to "deep-inspect" the table attributes and actions.
@@ -185,7 +267,12 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
   // primary database. To allow this, getConnection can explicitly request the
   // primary instance and avoid the contention decisions.
   auto dbc = SQLiteDBManager::getConnection(true);
-  return attachTableInternal(name, statement, dbc);
+  dbc->clearStatements();
+  // Pooled connections must be attached again to include the new table.
+  SQLiteDBManager::resetPool();
+  auto attached = attachTableInternal(name, statement, dbc);
+  QueryColumnsCache::instance().clear();
+  return attached;
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
@@ -193,7 +280,11 @@ void SQLiteSQLPlugin::detach(const std::string& name) {
   if (!dbc->isPrimary()) {
     return;
   }
+  // Statements must not reference the table's content once it is dropped.
+  dbc->clearStatements();
+  SQLiteDBManager::resetPool();
   detachTableInternal(name, dbc->db());
+  QueryColumnsCache::instance().clear();
 }
 
 SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, Mutex& mtx)
@@ -207,8 +298,200 @@ SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, Mutex& mtx)
   }
 }
 
+struct SQLQueryLimit::State {
+  /// Time after which queries are interrupted, if there is a deadline.
+  Clock::time_point deadline;
+  bool has_deadline{false};
+
+  /// CPU time allowed, in microseconds, if there is a CPU time limit.
+  unsigned long long int cpu_allowance{0};
+  bool has_cpu_allowance{false};
+
+  /// The CPU time of the query's thread when the limit started.
+  unsigned long long int cpu_start{0};
+
+  /// CPU time used by the tasks the query queued for other threads.
+  std::atomic<unsigned long long int> task_cpu{0};
+
+  /// The thread running the query.
+  std::thread::id thread;
+
+  std::shared_ptr<std::atomic<bool>> cancel{nullptr};
+
+  /// Set once a check found the limit expired, seen by every thread.
+  std::atomic<bool> expired{false};
+
+  /// The state of the limit this replaced on the query's thread.
+  std::shared_ptr<State> previous{nullptr};
+
+  /// The CPU time used by the query, as far as the calling thread knows.
+  unsigned long long int cpuUsed(unsigned long long int running) const {
+    auto used = task_cpu.load() + running;
+    if (std::this_thread::get_id() == thread) {
+      used += getThreadCPUTime() - cpu_start;
+    }
+    return used;
+  }
+
+  /**
+   * @brief Check this limit and the limits it replaced.
+   *
+   * @param running CPU time of the query's task running on the calling
+   * thread, not yet counted.
+   */
+  bool check(unsigned long long int running = 0) {
+    for (auto state = this; state != nullptr; state = state->previous.get()) {
+      if (state->expired) {
+        return true;
+      }
+      if ((state->cancel != nullptr && *state->cancel) ||
+          (state->has_deadline && Clock::now() >= state->deadline) ||
+          (state->has_cpu_allowance &&
+           state->cpuUsed(running) >= state->cpu_allowance)) {
+        state->expired = true;
+        return true;
+      }
+      running = 0;
+    }
+    return false;
+  }
+};
+
+SQLQueryLimit::SQLQueryLimit(std::chrono::milliseconds timeout,
+                             std::shared_ptr<std::atomic<bool>> cancel,
+                             std::chrono::milliseconds cpu)
+    : state_(std::make_shared<State>()), previous_(kQueryLimit) {
+  state_->cancel = std::move(cancel);
+  state_->thread = std::this_thread::get_id();
+  if (timeout.count() > 0) {
+    state_->deadline = Clock::now() + timeout;
+    state_->has_deadline = true;
+  }
+  if (cpu.count() > 0) {
+    state_->cpu_start = getThreadCPUTime();
+    state_->cpu_allowance = cpu.count() * 1000ULL;
+    state_->has_cpu_allowance = true;
+  }
+  if (previous_ != nullptr) {
+    state_->previous = previous_->state_;
+  }
+  kQueryLimit = this;
+}
+
+SQLQueryLimit::SQLQueryLimit(std::shared_ptr<State> state, bool counted)
+    : state_(std::move(state)), previous_(kQueryLimit), task_(!counted) {
+  if (task_) {
+    task_start_ = getThreadCPUTime();
+  }
+  kQueryLimit = this;
+}
+
+SQLQueryLimit::~SQLQueryLimit() {
+  kQueryLimit = previous_;
+  if (task_) {
+    state_->task_cpu += getThreadCPUTime() - task_start_;
+  }
+}
+
+bool SQLQueryLimit::expired() {
+  if (kQueryLimit == nullptr) {
+    return false;
+  }
+
+  auto running =
+      (kQueryLimit->task_) ? getThreadCPUTime() - kQueryLimit->task_start_ : 0;
+  return kQueryLimit->state_->check(running);
+}
+
+bool SQLQueryLimit::interrupted() const {
+  return state_->check();
+}
+
+bool isQueryInterrupted() {
+  return SQLQueryLimit::expired();
+}
+
+std::function<bool()> getQueryInterrupt() {
+  if (kQueryLimit == nullptr) {
+    return []() { return false; };
+  }
+
+  auto state = kQueryLimit->state_;
+  return [state]() {
+    // Within a task of the query, include the task's running CPU time.
+    if (kQueryLimit != nullptr && kQueryLimit->state_ == state) {
+      return SQLQueryLimit::expired();
+    }
+    return state->check();
+  };
+}
+
+std::function<void()> bindQueryLimit(std::function<void()> task) {
+  if (kQueryLimit == nullptr) {
+    return task;
+  }
+
+  auto state = kQueryLimit->state_;
+  return [state, task]() {
+    // A task run within another task of the query is already limited.
+    if (kQueryLimit != nullptr && kQueryLimit->state_ == state) {
+      task();
+      return;
+    }
+
+    // The task is limited by its query alone, not by a limit of the thread
+    // running it. The query's thread has its CPU time counted.
+    SQLQueryLimit limit(state, std::this_thread::get_id() == state->thread);
+    task();
+  };
+}
+
+SQLQueryPriority::SQLQueryPriority(Priority priority)
+    : priority_(priority), previous_(kQueryPriority) {
+  kQueryPriority = priority;
+  if (priority_ == INTERACTIVE) {
+    std::lock_guard<std::mutex> lock(kInteractiveMutex);
+    kInteractiveQueries++;
+  }
+}
+
+SQLQueryPriority::~SQLQueryPriority() {
+  kQueryPriority = previous_;
+  if (priority_ == INTERACTIVE) {
+    {
+      std::lock_guard<std::mutex> lock(kInteractiveMutex);
+      kInteractiveQueries--;
+    }
+    kInteractiveDone.notify_all();
+  }
+}
+
+bool SQLQueryPriority::yield() {
+  if (kQueryPriority == LOW && FLAGS_schedule_yield_max > 0) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(FLAGS_schedule_yield_max);
+    std::unique_lock<std::mutex> lock(kInteractiveMutex);
+    while (kInteractiveQueries > 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+      // The limit is checked while waiting, a cancel does not notify.
+      if (kQueryLimit != nullptr && SQLQueryLimit::expired()) {
+        return false;
+      }
+      kInteractiveDone.wait_for(
+          lock, std::chrono::milliseconds(kQueryYieldInterval));
+    }
+  }
+  return (kQueryLimit == nullptr || !SQLQueryLimit::expired());
+}
+
+/// SQLite progress handler, a non-zero return interrupts the query.
+static int checkQueryLimit(void* /* unused */) {
+  return (kQueryLimit != nullptr && SQLQueryLimit::expired()) ? 1 : 0;
+}
+
 static inline void openOptimized(sqlite3*& db) {
   sqlite3_open(":memory:", &db);
+  sqlite3_progress_handler(db, kSQLiteProgressSteps, checkQueryLimit, nullptr);
 
   std::string settings;
   for (const auto& setting : kMemoryDBSettings) {
@@ -247,6 +530,14 @@ TableAttributes SQLiteDBInstance::getAttributes() const {
   return attributes;
 }
 
+/// Erase the transient plans that no cached statement uses.
+template <typename T>
+static void erasePlans(T& plans, const std::unordered_set<size_t>& pinned) {
+  for (auto it = plans.begin(); it != plans.end();) {
+    it = (pinned.count(it->first) == 0) ? plans.erase(it) : std::next(it);
+  }
+}
+
 void SQLiteDBInstance::clearAffectedTables() {
   if (isPrimary() && !managed_) {
     // A primary instance must forward clear requests to the DB manager's
@@ -256,15 +547,286 @@ void SQLiteDBInstance::clearAffectedTables() {
   }
 
   for (const auto& table : affected_tables_) {
-    table.second->constraints.clear();
-    table.second->cache.clear();
+    auto* content = table.second;
+    if (content->pinned.empty()) {
+      content->constraints.clear();
+      content->colsUsed.clear();
+      content->hints.clear();
+    } else {
+      // Cached statements will filter using their plans again.
+      erasePlans(content->constraints, content->pinned);
+      erasePlans(content->colsUsed, content->pinned);
+      erasePlans(content->hints, content->pinned);
+    }
+    content->cache.clear();
+    content->results.clear();
   }
   // Since the affected tables are cleared, there are no more affected tables.
   // There is no concept of compounding tables between queries.
   affected_tables_.clear();
 }
 
+/// Step a prepared statement, appending its rows.
+static int stepRows(sqlite3_stmt* stmt, QueryData& results) {
+  auto columns = sqlite3_column_count(stmt);
+  int rc = SQLITE_OK;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Row r;
+    for (int i = 0; i < columns; i++) {
+      auto name = sqlite3_column_name(stmt, i);
+      if (name == nullptr) {
+        continue;
+      }
+      auto value = (const char*)sqlite3_column_text(stmt, i);
+      r[name] = (value != nullptr) ? value : FLAGS_nullvalue;
+    }
+    results.push_back(std::move(r));
+  }
+  return rc;
+}
+
+Status SQLiteDBInstance::query(const std::string& q, QueryData& results) {
+  if (lazy_) {
+    return queryLazy(q, results);
+  }
+  if (!isPrimary() || FLAGS_sql_statement_cache == 0) {
+    return queryInternal(q, results, db_);
+  }
+
+  // A temporary primary instance forwards to the manager's connection, which
+  // owns the cached statements. The held lock makes this access exclusive.
+  auto connection = (managed_) ? nullptr : SQLiteDBManager::getConnection(true);
+  auto* rdbc = (managed_) ? this : connection.get();
+  auto* statement = rdbc->getStatement(q);
+  if (statement == nullptr) {
+    return queryInternal(q, results, db_);
+  }
+
+  if (FLAGS_sql_prefetch_threads > 1) {
+    prefetchTableScans(statement->plans, rdbc, FLAGS_sql_prefetch_threads);
+  }
+
+  // SQLite may plan the statement again if it expired.
+  rdbc->statement_plans_ = &statement->plans;
+  auto* stmt = statement->stmt;
+  auto rc = stepRows(stmt, results);
+  rdbc->statement_plans_ = nullptr;
+
+  std::string error;
+  if (rc != SQLITE_DONE) {
+    error = sqlite3_errmsg(db_);
+  }
+  sqlite3_reset(stmt);
+  sqlite3_db_release_memory(db_);
+  if (rc != SQLITE_DONE) {
+    return Status(1, "Error running query: " + error);
+  }
+  return Status(0, "OK");
+}
+
+SQLiteDBInstance::CachedStatement* SQLiteDBInstance::getStatement(
+    const std::string& q) {
+  auto cached = statements_.find(q);
+  if (cached != statements_.end()) {
+    statements_lru_.splice(
+        statements_lru_.end(), statements_lru_, cached->second.position);
+    return &cached->second;
+  }
+
+  std::vector<StatementPlan> plans;
+  statement_plans_ = &plans;
+  sqlite3_stmt* stmt = nullptr;
+  const char* tail = nullptr;
+  auto rc = sqlite3_prepare_v2(
+      db_, q.c_str(), static_cast<int>(q.size()), &stmt, &tail);
+  statement_plans_ = nullptr;
+
+  auto statement = CachedStatement();
+  statement.stmt = stmt;
+  statement.plans = std::move(plans);
+  if (rc != SQLITE_OK || stmt == nullptr ||
+      (tail != nullptr && tail[strspn(tail, " \t\r\n;")] != '\0')) {
+    // Errors and multiple statements are left to sqlite3_exec.
+    finalizeStatement(statement);
+    return nullptr;
+  }
+
+  while (!statements_lru_.empty() &&
+         statements_.size() >= FLAGS_sql_statement_cache) {
+    auto evicted = statements_.find(statements_lru_.front());
+    finalizeStatement(evicted->second);
+    statements_lru_.erase(evicted->second.position);
+    statements_.erase(evicted);
+  }
+
+  statement.position = statements_lru_.insert(statements_lru_.end(), q);
+  return &(statements_[q] = std::move(statement));
+}
+
+void SQLiteDBInstance::finalizeStatement(CachedStatement& statement) {
+  if (statement.stmt != nullptr) {
+    sqlite3_finalize(statement.stmt);
+    statement.stmt = nullptr;
+  }
+
+  for (const auto& plan : statement.plans) {
+    plan.first->pinned.erase(plan.second);
+    plan.first->constraints.erase(plan.second);
+    plan.first->colsUsed.erase(plan.second);
+  }
+  statement.plans.clear();
+}
+
+void SQLiteDBInstance::clearStatements() {
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    SQLiteDBManager::getConnection(true)->clearStatements();
+    return;
+  }
+
+  for (auto& statement : statements_) {
+    finalizeStatement(statement.second);
+  }
+  statements_.clear();
+  statements_lru_.clear();
+}
+
+/// Find the table named by a "no such table" error, or an empty string.
+static std::string getMissingTable(const std::string& error) {
+  const std::string kMissing = "no such table: ";
+  if (error.compare(0, kMissing.size(), kMissing) != 0) {
+    return "";
+  }
+
+  // Table names are case insensitive, plugins are registered in lowercase.
+  auto name = error.substr(kMissing.size());
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  auto schema = name.find('.');
+  if (schema != std::string::npos) {
+    // Tables are only attached to the temp schema and read from main.
+    auto prefix = name.substr(0, schema);
+    if (prefix != "main" && prefix != "temp") {
+      return "";
+    }
+    name = name.substr(schema + 1);
+  }
+  return name;
+}
+
+/// Table plugins are named with plain identifiers, other names are not waited.
+static bool isTableName(const std::string& name) {
+  if (name.empty() || name.compare(0, 7, "sqlite_") == 0) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+  });
+}
+
+void SQLiteDBInstance::attachReferencedTables(const std::string& q,
+                                              bool wait) {
+  if (!lazy_) {
+    return;
+  }
+
+  // Statements are only prepared, a missing table makes preparation fail.
+  const char* next = q.c_str();
+  while (next[strspn(next, " \t\r\n;")] != '\0') {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    auto rc = sqlite3_prepare_v2(db_, next, -1, &stmt, &tail);
+    if (stmt != nullptr) {
+      // Later statements may read tables this one creates, which are not
+      // missing once it runs and are not waited for.
+      if (!sqlite3_stmt_readonly(stmt)) {
+        wait = false;
+      }
+      sqlite3_finalize(stmt);
+    }
+
+    if (rc == SQLITE_OK) {
+      if (tail == nullptr || tail == next) {
+        return;
+      }
+      next = tail;
+      continue;
+    }
+
+    // Errors other than a missing table are left to the query.
+    if (!attachMissingTable(wait)) {
+      return;
+    }
+  }
+}
+
+bool SQLiteDBInstance::attachMissingTable(bool wait) {
+  // A table is attached once.
+  auto name = getMissingTable(sqlite3_errmsg(db_));
+  if (name.empty() || attached_.count(name) > 0) {
+    return false;
+  }
+  if (!RegistryFactory::get().exists("table", name) &&
+      !(wait && isTableName(name) && waitForExtensionTable(name))) {
+    return false;
+  }
+  attached_.insert(name);
+  return attachVirtualTable(name, this).ok();
+}
+
+Status SQLiteDBInstance::queryLazy(const std::string& q, QueryData& results) {
+  // Like sqlite3_exec, statements before a failing one have run.
+  std::string error;
+  const char* next = q.c_str();
+  while (next[strspn(next, " \t\r\n;")] != '\0') {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    auto rc = sqlite3_prepare_v2(db_, next, -1, &stmt, &tail);
+    if (rc != SQLITE_OK) {
+      if (stmt != nullptr) {
+        sqlite3_finalize(stmt);
+      }
+      if (attachMissingTable(false)) {
+        continue;
+      }
+      error = sqlite3_errmsg(db_);
+      break;
+    }
+
+    if (stmt != nullptr) {
+      rc = stepRows(stmt, results);
+      if (rc != SQLITE_DONE) {
+        error = sqlite3_errmsg(db_);
+      }
+      sqlite3_finalize(stmt);
+      if (rc != SQLITE_DONE) {
+        break;
+      }
+    }
+    if (tail == nullptr || tail == next) {
+      break;
+    }
+    next = tail;
+  }
+
+  sqlite3_db_release_memory(db_);
+  if (!error.empty()) {
+    return Status(1, "Error running query: " + error);
+  }
+  return Status(0, "OK");
+}
+
+void SQLiteDBInstance::addStatementPlan(VirtualTableContent* table,
+                                        size_t index) {
+  if (statement_plans_ != nullptr) {
+    statement_plans_->push_back(std::make_pair(table, index));
+    table->pinned.insert(index);
+  }
+}
+
 SQLiteDBInstance::~SQLiteDBInstance() {
+  for (auto& statement : statements_) {
+    finalizeStatement(statement.second);
+  }
   if (!isPrimary() && db_ != nullptr) {
     sqlite3_close(db_);
   } else {
@@ -293,6 +855,66 @@ void SQLiteDBManager::resetPrimary() {
     sqlite3_close(self.db_);
     self.db_ = nullptr;
   }
+
+  // Pooled connections hold SQLite arenas too.
+  resetPool();
+}
+
+SQLiteDBInstanceRef SQLiteDBManager::getPooled() {
+  auto& self = instance();
+  std::unique_ptr<SQLiteDBInstance> pooled{nullptr};
+  size_t generation = 0;
+  {
+    WriteLock lock(self.pool_mutex_);
+    generation = self.pool_generation_;
+    if (!self.pool_.empty()) {
+      pooled = std::move(self.pool_.back());
+      self.pool_.pop_back();
+    } else if (self.pool_count_ < FLAGS_sql_pool_size) {
+      self.pool_count_++;
+    } else {
+      return nullptr;
+    }
+  }
+
+  bool attach = (pooled == nullptr);
+  if (attach) {
+    pooled = std::unique_ptr<SQLiteDBInstance>(new SQLiteDBInstance());
+  }
+
+  auto instance = SQLiteDBInstanceRef(
+      pooled.release(), [generation](SQLiteDBInstance* released) {
+        SQLiteDBManager::releasePooled(released, generation);
+      });
+  if (attach && FLAGS_sql_lazy_attach) {
+    instance->lazy_ = true;
+  } else if (attach) {
+    VLOG(1) << "DBManager contention: attaching a pooled SQLite database";
+    attachVirtualTables(instance);
+  }
+  return instance;
+}
+
+void SQLiteDBManager::releasePooled(SQLiteDBInstance* instance,
+                                    size_t generation) {
+  std::unique_ptr<SQLiteDBInstance> pooled(instance);
+  pooled->clearAffectedTables();
+
+  auto& self = SQLiteDBManager::instance();
+  WriteLock lock(self.pool_mutex_);
+  if (generation == self.pool_generation_) {
+    self.pool_.push_back(std::move(pooled));
+  } else {
+    self.pool_count_--;
+  }
+}
+
+void SQLiteDBManager::resetPool() {
+  auto& self = instance();
+  WriteLock lock(self.pool_mutex_);
+  self.pool_generation_++;
+  self.pool_count_ -= self.pool_.size();
+  self.pool_.clear();
 }
 
 void SQLiteDBManager::setDisabledTables(const std::string& list) {
@@ -301,9 +923,13 @@ void SQLiteDBManager::setDisabledTables(const std::string& list) {
       std::unordered_set<std::string>(tables.begin(), tables.end());
 }
 
-SQLiteDBInstanceRef SQLiteDBManager::getUnique() {
+SQLiteDBInstanceRef SQLiteDBManager::getUnique(bool lazy) {
   auto instance = std::make_shared<SQLiteDBInstance>();
-  attachVirtualTables(instance);
+  if (lazy) {
+    instance->lazy_ = true;
+  } else {
+    attachVirtualTables(instance);
+  }
   return instance;
 }
 
@@ -326,7 +952,17 @@ SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
   // Create a 'database connection' for the managed database instance.
   auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
   if (!instance->isPrimary()) {
-    attachVirtualTables(instance);
+    // Prefer an attached connection from the pool over a new transient.
+    auto pooled = getPooled();
+    if (pooled != nullptr) {
+      return pooled;
+    }
+
+    if (FLAGS_sql_lazy_attach) {
+      instance->lazy_ = true;
+    } else {
+      attachVirtualTables(instance);
+    }
   }
   return instance;
 }
@@ -422,6 +1058,69 @@ Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
   return Status(0, "OK");
 }
 
+QueryColumnsCache& QueryColumnsCache::instance() {
+  static QueryColumnsCache cache;
+  return cache;
+}
+
+std::string QueryColumnsCache::normalize(const std::string& q) {
+  static const char* kSpace = " \t\r\n;";
+  auto first = q.find_first_not_of(kSpace);
+  if (first == std::string::npos) {
+    return "";
+  }
+  return q.substr(first, q.find_last_not_of(kSpace) - first + 1);
+}
+
+bool QueryColumnsCache::get(const std::string& key, TableColumns& columns) {
+  WriteLock lock(mutex_);
+  auto entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    return false;
+  }
+  lru_.splice(lru_.end(), lru_, entry->second.position);
+  columns = entry->second.columns;
+  return true;
+}
+
+void QueryColumnsCache::put(const std::string& key,
+                            size_t version,
+                            const TableColumns& columns) {
+  if (FLAGS_sql_columns_cache == 0 || key.empty()) {
+    return;
+  }
+
+  WriteLock lock(mutex_);
+  if (version != version_ || entries_.count(key) > 0) {
+    return;
+  }
+  while (!lru_.empty() && entries_.size() >= FLAGS_sql_columns_cache) {
+    entries_.erase(lru_.front());
+    lru_.pop_front();
+  }
+
+  auto& entry = entries_[key];
+  entry.columns = columns;
+  entry.position = lru_.insert(lru_.end(), key);
+}
+
+size_t QueryColumnsCache::version() const {
+  WriteLock lock(mutex_);
+  return version_;
+}
+
+void QueryColumnsCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+  version_++;
+}
+
+size_t QueryColumnsCache::size() const {
+  WriteLock lock(mutex_);
+  return entries_.size();
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db) {
@@ -11,9 +11,13 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <list>
 #include <map>
 #include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -68,10 +72,74 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Clear per-query state of a table affected by the use of this instance.
   void clearAffectedTables();
 
+  /**
+   * @brief Execute a query, reusing a prepared statement when possible.
+   *
+   * The primary connection keeps a bounded set of prepared statements keyed by
+   * query text. Repeated queries, such as scheduled queries, skip parsing and
+   * planning. Transient connections and multi-statement queries fall back to
+   * queryInternal.
+   *
+   * @param q the query to execute
+   * @param results The QueryData struct to emit row on query success.
+   */
+  Status query(const std::string& q, QueryData& results);
+
+  /// Finalize all cached statements, required when the schema changes.
+  void clearStatements();
+
+  /// Allow a virtual table implementation to record plans for a statement.
+  void addStatementPlan(VirtualTableContent* table, size_t index);
+
+  /**
+   * @brief Attach the virtual tables a query references.
+   *
+   * Transient and pooled connections may attach table plugins lazily. Each
+   * statement in the query is prepared, and a registered table SQLite reports
+   * as missing is attached until the statement prepares. Instances with all
+   * tables attached do nothing. Queries run on the instance attach tables
+   * without this, when their own preparation fails.
+   *
+   * Only names a table plugin could have are waited for, and not after a
+   * statement that writes, which may create the tables read after it.
+   *
+   * @param q the query that will be executed on this instance
+   * @param wait wait for autoloaded extensions to register missing tables
+   */
+  void attachReferencedTables(const std::string& q, bool wait = false);
+
+  /// Check if table plugins are attached when a query references them.
+  bool isLazy() const {
+    return lazy_;
+  }
+
  private:
   /// Handle the primary/forwarding requests for table attribute accesses.
   TableAttributes getAttributes() const;
 
+  /// A virtual table plan (constraint index) made for a prepared statement.
+  using StatementPlan = std::pair<VirtualTableContent*, size_t>;
+
+  /// A prepared statement and the virtual table plans it references.
+  struct CachedStatement {
+    sqlite3_stmt* stmt{nullptr};
+    std::vector<StatementPlan> plans;
+    std::list<std::string>::iterator position;
+  };
+
+  /// Return a cached or newly prepared statement, or nullptr.
+  CachedStatement* getStatement(const std::string& q);
+
+  /// Finalize a statement and release its virtual table plans.
+  void finalizeStatement(CachedStatement& statement);
+
+ private:
+  /// Attach the table SQLite reported missing, false if none was attached.
+  bool attachMissingTable(bool wait);
+
+  /// Run each statement, preparing one again only after attaching a table.
+  Status queryLazy(const std::string& q, QueryData& results);
+
  private:
   /// An opaque constructor only used by the DBManager.
   explicit SQLiteDBInstance(sqlite3* db)
@@ -84,6 +152,12 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Track whether this instance is managed internally by the DB manager.
   bool managed_{false};
 
+  /// Table plugins are attached when a query references them.
+  bool lazy_{false};
+
+  /// The tables attached lazily.
+  std::unordered_set<std::string> attached_;
+
   /// Either the managed primary database or an ephemeral instance.
   sqlite3* db_{nullptr};
 
@@ -93,12 +167,22 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Vector of tables that need their constraints cleared after execution.
   std::map<std::string, VirtualTableContent*> affected_tables_;
 
+  /// Prepared statements keyed by query text, only used by the primary.
+  std::unordered_map<std::string, CachedStatement> statements_;
+
+  /// Query text ordered from least to most recently used.
+  std::list<std::string> statements_lru_;
+
+  /// Plans made by the statement being prepared or executed.
+  std::vector<StatementPlan>* statement_plans_{nullptr};
+
  private:
   friend class SQLiteDBManager;
   friend class SQLInternal;
 
  private:
   FRIEND_TEST(SQLiteUtilTests, test_affected_tables);
+  FRIEND_TEST(SQLiteUtilTests, test_statement_cache);
 };
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
@@ -139,8 +223,12 @@ class SQLiteDBManager : private boost::noncopyable {
     return getConnection();
   }
 
-  /// See `get` but always return a transient DB connection (for testing).
-  static SQLiteDBInstanceRef getUnique();
+  /**
+   * @brief See `get` but always return a transient DB connection.
+   *
+   * @param lazy attach tables when SQLiteDBInstance::query references them
+   */
+  static SQLiteDBInstanceRef getUnique(bool lazy = false);
 
   /**
    * @brief Reset the primary database connection.
@@ -150,6 +238,9 @@ class SQLiteDBManager : private boost::noncopyable {
    */
   static void resetPrimary();
 
+  /// Close idle pooled connections, in-use connections close when released.
+  static void resetPool();
+
   /**
    * @brief Check if `table_name` is disabled.
    *
@@ -185,15 +276,47 @@ class SQLiteDBManager : private boost::noncopyable {
   /// Member variable to hold set of disabled tables.
   std::unordered_set<std::string> disabled_tables_;
 
+  /// Idle, attached, pooled connections.
+  std::vector<std::unique_ptr<SQLiteDBInstance>> pool_;
+
+  /// Number of pooled connections, idle or in use.
+  size_t pool_count_{0};
+
+  /// Connections from an earlier generation are closed when released.
+  size_t pool_generation_{0};
+
+  /// Mutex around pool access.
+  Mutex pool_mutex_;
+
   /// Parse a comma-delimited set of tables names, passed in as a flag.
   void setDisabledTables(const std::string& s);
 
   /// Request a connection, optionally request the primary connection.
   static SQLiteDBInstanceRef getConnection(bool primary = false);
 
+  /**
+   * @brief Request an attached connection from the pool.
+   *
+   * When the primary connection is in use, a pooled connection avoids
+   * attaching every virtual table to a new transient database. The pool grows
+   * on demand up to the size flag, the connection returns to the pool when
+   * the last reference is released.
+   *
+   * @return A pooled connection, or nullptr if every connection is in use.
+   */
+  static SQLiteDBInstanceRef getPooled();
+
+  /// Return a pooled connection, or close it if the pool was reset.
+  static void releasePooled(SQLiteDBInstance* instance, size_t generation);
+
  private:
   friend class SQLiteDBInstance;
   friend class SQLiteSQLPlugin;
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_statement_cache);
+  FRIEND_TEST(SQLiteUtilTests, test_connection_pool);
+  FRIEND_TEST(SQLiteUtilTests, test_prefetch_scans);
 };
 
 /**
@@ -267,6 +390,54 @@ class QueryPlanner : private boost::noncopyable {
 /// Specific SQLite opcodes that change column/expression type.
 extern const std::map<std::string, QueryPlanner::Opcode> kSQLOpcodes;
 
+/**
+ * @brief Inferred result columns of queries, keyed by normalized query text.
+ *
+ * Inferring column types prepares a statement and may walk its EXPLAIN
+ * program. Extensions and distributed queries ask for the columns of the same
+ * queries repeatedly, see SQLiteSQLPlugin::getQueryColumns. The cache is
+ * cleared when tables are attached or detached, and results inferred before a
+ * clear are not stored.
+ */
+class QueryColumnsCache : private boost::noncopyable {
+ public:
+  static QueryColumnsCache& instance();
+
+  /// Normalize query text, removing surrounding whitespace and semicolons.
+  static std::string normalize(const std::string& q);
+
+  /// Read the columns of a normalized query, false if not cached.
+  bool get(const std::string& key, TableColumns& columns);
+
+  /// Store the columns of a normalized query, inferred at a version.
+  void put(const std::string& key, size_t version, const TableColumns& columns);
+
+  /// The schema version, read before inferring columns to store.
+  size_t version() const;
+
+  /// Remove every entry and start a new schema version.
+  void clear();
+
+  size_t size() const;
+
+ private:
+  QueryColumnsCache() = default;
+
+  struct Entry {
+    TableColumns columns;
+    std::list<std::string>::iterator position;
+  };
+
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// Keys ordered from least to most recently used.
+  std::list<std::string> lru_;
+
+  size_t version_{0};
+
+  mutable Mutex mutex_;
+};
+
 /**
  * @brief SQLite Internal: Execute a query on a specific database
  *
@@ -301,6 +472,112 @@ Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db);
 
+/**
+ * @brief Interrupt the queries run by a thread after a deadline or cancel.
+ *
+ * While an SQLQueryLimit is in scope, SQLite queries started by the same
+ * thread are interrupted when the deadline passes, the query used its CPU
+ * time allowance, or the cancel flag is set. SQLite checks the limit between
+ * virtual machine steps. Table generators and the filesystem walkers check
+ * it between items with isQueryInterrupted, and a table that stopped early
+ * fails the query instead of returning partial rows.
+ *
+ * The CPU time of a query is that of its thread, plus that of the tasks it
+ * queued with bindQueryLimit, such as prefetched table scans, while they run
+ * on other threads. Limits nest on the query's thread, a task of a query is
+ * only limited by the query's own limit.
+ */
+class SQLQueryLimit : private boost::noncopyable {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Limit the calling thread's queries.
+   *
+   * @param timeout wall time allowed, 0 for no deadline
+   * @param cancel optional flag, set by any thread to interrupt the query
+   * @param cpu CPU time of the query allowed, 0 for no limit
+   */
+  SQLQueryLimit(std::chrono::milliseconds timeout,
+                std::shared_ptr<std::atomic<bool>> cancel = nullptr,
+                std::chrono::milliseconds cpu = std::chrono::milliseconds(0));
+
+  /// Restore the calling thread's previous limit.
+  ~SQLQueryLimit();
+
+  /// Check if the calling thread's query should be interrupted.
+  static bool expired();
+
+  /// Check if this limit interrupted, or would interrupt, the query.
+  bool interrupted() const;
+
+  /// The limit's state, shared with the checks given to other threads.
+  struct State;
+
+ private:
+  /**
+   * @brief Apply a query's limit to one of its tasks.
+   *
+   * @param state the query's limit
+   * @param counted true if the calling thread's CPU time is already counted
+   */
+  SQLQueryLimit(std::shared_ptr<State> state, bool counted);
+
+ private:
+  std::shared_ptr<State> state_;
+
+  /// The limit this replaced, limits may be nested.
+  SQLQueryLimit* previous_{nullptr};
+
+  /// A task of the query, its CPU time is added to the query's when it ends.
+  bool task_{false};
+
+  /// The thread CPU time when the task started.
+  unsigned long long int task_start_{0};
+
+ private:
+  friend std::function<bool()> getQueryInterrupt();
+  friend std::function<void()> bindQueryLimit(std::function<void()> task);
+};
+
+/**
+ * @brief Set the priority of the queries run by a thread.
+ *
+ * While an INTERACTIVE query, such as a distributed query, is running, the
+ * LOW priority queries of other threads, such as scheduled queries, wait
+ * before the first scan of each table. A query waits at most
+ * --schedule_yield_max milliseconds per table, and stops waiting when its
+ * SQLQueryLimit expires. A table scanned again for each row of a join does not
+ * wait again.
+ */
+class SQLQueryPriority : private boost::noncopyable {
+ public:
+  enum Priority {
+    LOW = 0,
+    NORMAL = 1,
+    INTERACTIVE = 2,
+  };
+
+  /// Set the calling thread's priority.
+  explicit SQLQueryPriority(Priority priority);
+
+  /// Restore the calling thread's previous priority.
+  ~SQLQueryPriority();
+
+  /**
+   * @brief A cancellation point, called before a table's first scan.
+   *
+   * @return false if the calling thread's query should be interrupted.
+   */
+  static bool yield();
+
+ private:
+  Priority priority_;
+
+  /// The priority this replaced, priorities may be nested.
+  Priority previous_;
+};
+
 /**
  * @brief SQLInternal: SQL, but backed by internal calls.
  */
@@ -105,5 +105,12 @@ TEST_F(SQLTests, test_sql_escape) {
   input = "The quick brown fox jumps over the lazy dog.";
   escapeNonPrintableBytesEx(input);
   EXPECT_EQ(input, "The quick brown fox jumps over the lazy dog.");
+
+  // Bytes to escape may follow a long printable prefix, or end the value.
+  input = std::string(37, 'a') + "\t" + std::string(20, 'b') + "\x7f\x80";
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input,
+            std::string(37, 'a') + "\\x09" + std::string(20, 'b') +
+                "\x7f\\x80");
 }
 }
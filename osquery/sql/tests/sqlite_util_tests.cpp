@@ -9,17 +9,24 @@
  */
 
 #include <iostream>
+#include <thread>
 
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
 #include <osquery/sql.h>
 
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_uint64(sql_prefetch_threads);
+DECLARE_uint64(schedule_yield_max);
+
 class SQLiteUtilTests : public testing::Test {};
 
 std::shared_ptr<SQLiteDBInstance> getTestDBC() {
@@ -139,6 +146,444 @@ TEST_F(SQLiteUtilTests, test_affected_tables) {
   EXPECT_EQ(dbc->affected_tables_.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto primary = SQLiteDBManager::getConnection(true);
+  primary->clearStatements();
+
+  {
+    auto dbc = SQLiteDBManager::get();
+    ASSERT_TRUE(dbc->isPrimary());
+
+    // Constrained queries keep their plan between executions.
+    std::string query = "SELECT * FROM time WHERE hour >= 0";
+    for (size_t i = 0; i < 2; i++) {
+      QueryData results;
+      auto status = dbc->query(query, results);
+      dbc->clearAffectedTables();
+      EXPECT_TRUE(status.ok());
+      EXPECT_EQ(results.size(), 1U);
+    }
+    EXPECT_EQ(primary->statements_.size(), 1U);
+
+    // Multiple statements are not cached.
+    QueryData results;
+    auto status = dbc->query("SELECT 1; SELECT 2", results);
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results.size(), 2U);
+    EXPECT_EQ(primary->statements_.size(), 1U);
+
+    // Errors are reported without caching the statement.
+    status = dbc->query("SELECT * FROM does_not_exist", results);
+    EXPECT_FALSE(status.ok());
+    EXPECT_EQ(primary->statements_.size(), 1U);
+  }
+
+  primary->clearStatements();
+  EXPECT_TRUE(primary->statements_.empty());
+}
+
+TEST_F(SQLiteUtilTests, test_connection_pool) {
+  SQLiteDBManager::resetPool();
+  auto primary = SQLiteDBManager::get();
+  ASSERT_TRUE(primary->isPrimary());
+
+  // Contention for the primary uses a pooled, attached connection.
+  sqlite3* pooled_db = nullptr;
+  {
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_FALSE(dbc->isPrimary());
+    pooled_db = dbc->db();
+
+    QueryData results;
+    EXPECT_TRUE(dbc->query("SELECT * FROM time", results).ok());
+    EXPECT_EQ(results.size(), 1U);
+  }
+
+  // The released connection is reused without attaching tables again.
+  {
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_EQ(dbc->db(), pooled_db);
+  }
+
+  auto& manager = SQLiteDBManager::instance();
+  EXPECT_EQ(manager.pool_.size(), 1U);
+  SQLiteDBManager::resetPool();
+  EXPECT_TRUE(manager.pool_.empty());
+  EXPECT_EQ(manager.pool_count_, 0U);
+}
+
+TEST_F(SQLiteUtilTests, test_lazy_attach) {
+  auto dbc = SQLiteDBManager::getUnique(true);
+  ASSERT_TRUE(dbc->isLazy());
+
+  QueryData results;
+  queryInternal("SELECT * FROM sqlite_temp_master", results, dbc->db());
+  EXPECT_TRUE(results.empty());
+
+  // Only the tables a query references are attached.
+  results.clear();
+  EXPECT_TRUE(
+      dbc->query("SELECT * FROM time, (SELECT * FROM osquery_info)", results)
+          .ok());
+  EXPECT_EQ(results.size(), 1U);
+  results.clear();
+  queryInternal("SELECT name FROM sqlite_temp_master", results, dbc->db());
+  EXPECT_EQ(results.size(), 2U);
+
+  // Table names are case insensitive, each statement of a query runs once.
+  results.clear();
+  EXPECT_TRUE(dbc->query("CREATE TEMP TABLE lazy_once(v); "
+                         "INSERT INTO lazy_once SELECT 1 FROM OSQUERY_Registry LIMIT 1; "
+                         "SELECT * FROM lazy_once",
+                         results)
+                  .ok());
+  EXPECT_EQ(results.size(), 1U);
+
+  // Queries for unknown tables fail as an attached connection would.
+  results.clear();
+  EXPECT_FALSE(dbc->query("SELECT * FROM not_a_table", results).ok());
+  dbc->clearAffectedTables();
+}
+
+class prefetchTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  TableAttributes attributes() const override {
+    return (concurrent_) ? TableAttributes::CONCURRENT : TableAttributes::NONE;
+  }
+
+ public:
+  explicit prefetchTablePlugin(bool concurrent = true)
+      : concurrent_(concurrent) {}
+
+  QueryData generate(QueryContext& context) override {
+    scans++;
+    thread = std::this_thread::get_id();
+    return {{{"v", "1"}}, {{"v", "2"}}};
+  }
+
+  size_t scans{0};
+  std::thread::id thread;
+
+ private:
+  bool concurrent_{true};
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_prefetch_scans);
+};
+
+TEST_F(SQLiteUtilTests, test_prefetch_scans) {
+  auto first = std::make_shared<prefetchTablePlugin>();
+  auto second = std::make_shared<prefetchTablePlugin>();
+  auto serial = std::make_shared<prefetchTablePlugin>(false);
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("prefetch_first", first);
+  tables->add("prefetch_second", second);
+  tables->add("prefetch_serial", serial);
+
+  auto primary = SQLiteDBManager::getConnection(true);
+  attachTableInternal("prefetch_first", first->columnDefinition(), primary);
+  attachTableInternal("prefetch_second", second->columnDefinition(), primary);
+  attachTableInternal("prefetch_serial", serial->columnDefinition(), primary);
+
+  FLAGS_sql_prefetch_threads = 2;
+  {
+    auto dbc = SQLiteDBManager::get();
+    ASSERT_TRUE(dbc->isPrimary());
+
+    // Both tables are independent, each is generated once and concurrently.
+    QueryData results;
+    auto status = dbc->query(
+        "SELECT f.v, s.v FROM prefetch_first f, prefetch_second s", results);
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results.size(), 4U);
+    EXPECT_EQ(first->scans, 1U);
+    EXPECT_EQ(second->scans, 1U);
+    EXPECT_NE(first->thread, second->thread);
+
+    // A constrained table depends on the rows of the other table.
+    status = dbc->query(
+        "SELECT f.v FROM prefetch_first f, prefetch_second s WHERE f.v = s.v",
+        results);
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(first->thread, std::this_thread::get_id());
+    EXPECT_EQ(second->thread, std::this_thread::get_id());
+
+    // Tables not marked concurrent are generated within xFilter.
+    status = dbc->query(
+        "SELECT f.v, s.v FROM prefetch_first f, prefetch_serial s", results);
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(first->thread, std::this_thread::get_id());
+    EXPECT_EQ(serial->thread, std::this_thread::get_id());
+  }
+  FLAGS_sql_prefetch_threads = 0;
+}
+
+TEST_F(SQLiteUtilTests, test_query_limit) {
+  auto dbc = SQLiteDBManager::getUnique();
+  const std::string kUnbounded =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+
+  QueryData results;
+  {
+    // The unbounded query is interrupted after the deadline.
+    SQLQueryLimit limit(std::chrono::milliseconds(20));
+    auto status = queryInternal(kUnbounded, results, dbc->db());
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(SQLQueryLimit::expired());
+  }
+  EXPECT_FALSE(SQLQueryLimit::expired());
+
+  // Another thread may cancel the query.
+  auto cancel = std::make_shared<std::atomic<bool>>(false);
+  std::thread canceller([cancel]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    *cancel = true;
+  });
+  {
+    SQLQueryLimit limit(std::chrono::milliseconds(0), cancel);
+    EXPECT_FALSE(queryInternal(kUnbounded, results, dbc->db()).ok());
+  }
+  canceller.join();
+
+  // Queries outside of a limit are not affected.
+  results.clear();
+  EXPECT_TRUE(queryInternal("SELECT 1 AS one", results, dbc->db()).ok());
+  EXPECT_EQ(1U, results.size());
+}
+
+/// A table walking until its query is interrupted.
+class interruptibleTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    while (!context.isInterrupted()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    results.push_back({{"v", "1"}});
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_query_interrupted_table);
+};
+
+TEST_F(SQLiteUtilTests, test_query_cpu_limit) {
+  auto dbc = SQLiteDBManager::getUnique();
+  const std::string kUnbounded =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+
+  QueryData results;
+  {
+    // The unbounded query is interrupted once the thread used its CPU time.
+    SQLQueryLimit limit(std::chrono::milliseconds(0),
+                        nullptr,
+                        std::chrono::milliseconds(20));
+    EXPECT_FALSE(limit.interrupted());
+    EXPECT_FALSE(queryInternal(kUnbounded, results, dbc->db()).ok());
+    EXPECT_TRUE(limit.interrupted());
+    EXPECT_TRUE(isQueryInterrupted());
+
+    // Other threads see the expired limit.
+    auto interrupted = getQueryInterrupt();
+    bool seen = false;
+    std::thread checker([&interrupted, &seen]() { seen = interrupted(); });
+    checker.join();
+    EXPECT_TRUE(seen);
+  }
+  EXPECT_FALSE(isQueryInterrupted());
+  EXPECT_FALSE(getQueryInterrupt()());
+}
+
+TEST_F(SQLiteUtilTests, test_query_limit_tasks) {
+  // Without a limit the task is unchanged.
+  bool ran = false;
+  bindQueryLimit([&ran]() { ran = true; })();
+  EXPECT_TRUE(ran);
+
+  {
+    // The CPU time of a query's task run by another thread is counted.
+    SQLQueryLimit limit(std::chrono::milliseconds(0),
+                        nullptr,
+                        std::chrono::milliseconds(50));
+    bool interrupted = false;
+    auto task = bindQueryLimit([&interrupted]() {
+      auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (!interrupted && std::chrono::steady_clock::now() < deadline) {
+        interrupted = isQueryInterrupted();
+      }
+    });
+    std::thread worker(task);
+    worker.join();
+    EXPECT_TRUE(interrupted);
+    EXPECT_TRUE(limit.interrupted());
+  }
+
+  // A task is limited by its own query, not by the limit of the thread
+  // running it.
+  bool seen = true;
+  std::function<void()> task;
+  {
+    SQLQueryLimit query(std::chrono::milliseconds(0));
+    task = bindQueryLimit([&seen]() { seen = isQueryInterrupted(); });
+  }
+  auto cancel = std::make_shared<std::atomic<bool>>(true);
+  {
+    SQLQueryLimit limit(std::chrono::milliseconds(0), cancel);
+    EXPECT_TRUE(isQueryInterrupted());
+    task();
+    EXPECT_FALSE(seen);
+    EXPECT_TRUE(isQueryInterrupted());
+  }
+}
+
+TEST_F(SQLiteUtilTests, test_query_interrupted_table) {
+  auto table = std::make_shared<interruptibleTablePlugin>();
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("interruptible", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("interruptible", table->columnDefinition(), dbc.get());
+
+  // The table stops early, and its partial rows fail the query.
+  QueryData results;
+  {
+    SQLQueryLimit limit(std::chrono::milliseconds(20));
+    auto status =
+        queryInternal("SELECT * FROM interruptible", results, dbc->db());
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(limit.interrupted());
+  }
+  EXPECT_TRUE(results.empty());
+  tables->remove("interruptible");
+}
+
+TEST_F(SQLiteUtilTests, test_query_priority) {
+  auto yield_max = FLAGS_schedule_yield_max;
+  FLAGS_schedule_yield_max = 5000;
+
+  // Without interactive queries a low priority query does not wait.
+  SQLQueryPriority low(SQLQueryPriority::LOW);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(SQLQueryPriority::yield());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+  // A low priority query waits until the interactive query finishes.
+  std::atomic<bool> started{false};
+  std::thread interactive([&started]() {
+    SQLQueryPriority priority(SQLQueryPriority::INTERACTIVE);
+    started = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(SQLQueryPriority::yield());
+  auto waited = std::chrono::steady_clock::now() - start;
+  interactive.join();
+  EXPECT_GE(waited, std::chrono::milliseconds(100));
+  EXPECT_LT(waited, std::chrono::seconds(4));
+
+  {
+    // An expired limit stops the wait, and interrupts the query.
+    SQLQueryPriority priority(SQLQueryPriority::INTERACTIVE);
+    SQLQueryLimit limit(std::chrono::milliseconds(20));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_FALSE(SQLQueryPriority::yield());
+  }
+  FLAGS_schedule_yield_max = yield_max;
+}
+
+/// A table with a few rows, filtered again for each row of a join.
+class yieldTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    for (size_t i = 0; i < 10; i++) {
+      results.push_back({{"v", std::to_string(i)}});
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_query_priority_once_per_table);
+};
+
+TEST_F(SQLiteUtilTests, test_query_priority_once_per_table) {
+  auto table = std::make_shared<yieldTablePlugin>();
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("yielding", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("yielding", table->columnDefinition(), dbc.get());
+
+  auto yield_max = FLAGS_schedule_yield_max;
+  FLAGS_schedule_yield_max = 100;
+
+  std::atomic<bool> started{false};
+  std::atomic<bool> done{false};
+  std::thread interactive([&started, &done]() {
+    SQLQueryPriority priority(SQLQueryPriority::INTERACTIVE);
+    started = true;
+    while (!done) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+
+  // The correlated subquery filters the inner table for each outer row, the
+  // query waits once for each of the two tables.
+  QueryData results;
+  auto start = std::chrono::steady_clock::now();
+  {
+    SQLQueryPriority low(SQLQueryPriority::LOW);
+    auto status = queryInternal(
+        "SELECT (SELECT count(*) FROM yielding i WHERE i.v = o.v) AS c "
+        "FROM yielding o",
+        results,
+        dbc->db());
+    EXPECT_TRUE(status.ok());
+  }
+  auto waited = std::chrono::steady_clock::now() - start;
+  done = true;
+  interactive.join();
+
+  EXPECT_EQ(10U, results.size());
+  EXPECT_GE(waited, std::chrono::milliseconds(150));
+  EXPECT_LT(waited, std::chrono::milliseconds(800));
+
+  FLAGS_schedule_yield_max = yield_max;
+  tables->remove("yielding");
+}
+
 TEST_F(SQLiteUtilTests, test_table_attributes_event_based) {
   {
     SQLInternal sql_internal("select * from process_events");
@@ -175,6 +620,42 @@ TEST_F(SQLiteUtilTests, test_get_query_columns) {
   ASSERT_FALSE(status.ok());
 }
 
+TEST_F(SQLiteUtilTests, test_query_columns_cache) {
+  EXPECT_EQ("SELECT 1", QueryColumnsCache::normalize("\n SELECT 1; \t"));
+  EXPECT_EQ("", QueryColumnsCache::normalize(" ;"));
+
+  auto& cache = QueryColumnsCache::instance();
+  cache.clear();
+  TableColumns columns = {
+      std::make_tuple("seconds", INTEGER_TYPE, ColumnOptions::DEFAULT)};
+  auto version = cache.version();
+  cache.put("SELECT seconds FROM time", version, columns);
+  EXPECT_EQ(1U, cache.size());
+
+  TableColumns results;
+  ASSERT_TRUE(cache.get("SELECT seconds FROM time", results));
+  EXPECT_EQ(columns, results);
+  EXPECT_FALSE(cache.get("SELECT version FROM osquery_info", results));
+
+  // Columns inferred before the schema changed are not stored.
+  cache.clear();
+  EXPECT_FALSE(cache.get("SELECT seconds FROM time", results));
+  cache.put("SELECT seconds FROM time", version, columns);
+  EXPECT_EQ(0U, cache.size());
+
+  // The plugin stores successfully inferred columns.
+  results.clear();
+  auto status = getQueryColumns("SELECT seconds FROM time;", results);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_TRUE(cache.get("SELECT seconds FROM time", results));
+
+  status = getQueryColumns("SELECT * FROM foo", results);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(1U, cache.size());
+  cache.clear();
+}
+
 TEST_F(SQLiteUtilTests, test_get_query_tables) {
   std::string query =
       "SELECT * FROM time, osquery_info, (SELECT * FROM file) ff GROUP BY pid";
@@ -257,4 +738,45 @@ TEST_F(SQLiteUtilTests, test_query_planner) {
   getQueryColumnsInternal(query, columns, dbc->db());
   EXPECT_EQ(getTypes(columns), TypeList({TEXT_TYPE, INTEGER_TYPE, TEXT_TYPE}));
 }
+
+TEST_F(SQLiteUtilTests, test_string_functions) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(
+      "select split('192.168.0.1', '.', 1) as a, "
+      "split(' a , b ', ',', 1) as b, "
+      "regex_split('192.168.0.1', '\\.0', 1) as c, "
+      "regex_split('a..b', '\\.', 1) as d, "
+      "regex_match(username, '^m[ai]') as e, "
+      "regex_extract('/java-8/bin', '/java-([0-9]+)/', 1) as f "
+      "from test_table",
+      results,
+      dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("168", results[0]["a"]);
+  EXPECT_EQ("b", results[0]["b"]);
+  EXPECT_EQ(".1", results[0]["c"]);
+  EXPECT_EQ("", results[0]["d"]);
+  EXPECT_EQ("1", results[0]["e"]);
+  EXPECT_EQ("1", results[1]["e"]);
+  EXPECT_EQ("8", results[0]["f"]);
+
+  // Indexes past the last element, or unmatched groups, are NULL.
+  results.clear();
+  status = queryInternal(
+      "select split('a.b', '.', 2) is null as a, "
+      "regex_split('a.b', '\\.', 2) is null as b, "
+      "regex_extract('abc', '(x)?b', 1) is null as c",
+      results,
+      dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ(Row({{"a", "1"}, {"b", "1"}, {"c", "1"}}), results[0]);
+
+  // An invalid pattern is a query error.
+  results.clear();
+  status = queryInternal("select regex_match('a', '(')", results, dbc->db());
+  EXPECT_FALSE(status.ok());
+}
 }
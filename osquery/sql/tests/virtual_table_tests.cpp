@@ -466,6 +466,294 @@ TEST_F(VirtualTableTests, test_yield_generator) {
   EXPECT_EQ(results[0]["index"], "10");
 }
 
+class colsUsedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("a", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("b", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("c", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    Row r;
+    for (const auto& column : {"a", "b", "c"}) {
+      if (context.isColumnUsed(column)) {
+        r[column] = "used";
+      }
+    }
+    return {r};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_used_columns);
+};
+
+TEST_F(VirtualTableTests, test_used_columns) {
+  auto table = std::make_shared<colsUsedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("cols_used", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("cols_used", table->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal("SELECT a FROM cols_used WHERE c = 'used'", results, dbc->db());
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["a"], "used");
+
+  // Selecting every column generates every column.
+  results.clear();
+  queryInternal("SELECT * FROM cols_used WHERE b IS NULL", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 0U);
+
+  // Without a context every column is considered used.
+  QueryContext context;
+  EXPECT_TRUE(context.isColumnUsed("b"));
+  context.colsUsed = UsedColumns({"a"});
+  EXPECT_FALSE(context.isColumnUsed("b"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"b", "a"}));
+}
+
+class typedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("number", BIGINT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("real", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("parsed", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  ColumnAliasSet columnAliases() const override {
+    return {{"number", {"number_alias"}}};
+  }
+
+ public:
+  bool usesTypedRows() const override {
+    return true;
+  }
+
+  TypedQueryData generateTyped(QueryContext& context) override {
+    return {
+        {1LL, 1.5, std::string("one"), std::string("10")},
+        {2LL, boost::blank(), std::string("two")},
+    };
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_typed_rows);
+  FRIEND_TEST(VirtualTableTests, test_typed_column_row);
+};
+
+TEST_F(VirtualTableTests, test_typed_rows) {
+  auto table = std::make_shared<typedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("typed", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("typed", table->columnDefinition(), dbc);
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT number + 1 AS next, typeof(real) AS real_type, text, parsed, "
+      "number_alias FROM typed",
+      results,
+      dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["next"], "2");
+  EXPECT_EQ(results[0]["real_type"], "real");
+  EXPECT_EQ(results[0]["text"], "one");
+  EXPECT_EQ(results[0]["parsed"], "10");
+  EXPECT_EQ(results[0]["number_alias"], "1");
+  EXPECT_EQ(results[1]["real_type"], "null");
+  EXPECT_EQ(results[1]["parsed"], "");
+
+  // The default generate adapts typed rows for string-valued callers.
+  QueryContext context;
+  auto rows = table->generate(context);
+  ASSERT_EQ(rows.size(), 2U);
+  EXPECT_EQ(rows[0]["number"], "1");
+  EXPECT_EQ(rows[0]["real"], "1.5");
+  EXPECT_EQ(rows[1].count("real"), 0U);
+}
+
+/// Columns as generated for the typed table, see columns.h.in.
+struct typedColumns {
+  enum class Col : size_t {
+    number = 0,
+    real = 1,
+    text = 2,
+    parsed = 3,
+  };
+
+  static constexpr size_t kCount = 4;
+
+  static constexpr ColumnType kTypes[kCount] = {
+      BIGINT_TYPE, DOUBLE_TYPE, TEXT_TYPE, INTEGER_TYPE,
+  };
+};
+
+TEST_F(VirtualTableTests, test_typed_column_row) {
+  using Col = typedColumns::Col;
+  TypedColumnRow<typedColumns> r;
+  r.set<Col::number>(1);
+  r.set<Col::real>(1.5);
+  r.set<Col::text>("one");
+  r.set<Col::parsed>(std::string("10"));
+  EXPECT_EQ(boost::get<long long>(r.get<Col::number>()), 1LL);
+
+  auto row = r.take();
+  ASSERT_EQ(row.size(), typedColumns::kCount);
+  auto table = std::make_shared<typedTablePlugin>();
+  auto converted = typedRowToRow(row, table->columns());
+  EXPECT_EQ(converted["number"], "1");
+  EXPECT_EQ(converted["real"], "1.5");
+  EXPECT_EQ(converted["text"], "one");
+  EXPECT_EQ(converted["parsed"], "10");
+
+  // Unset columns are blank.
+  TypedColumnRow<typedColumns> blank;
+  EXPECT_EQ(blank.get<Col::real>().which(), 0);
+}
+
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("k", INTEGER_TYPE, ColumnOptions::INDEX),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    scans++;
+
+    QueryData results;
+    for (const auto& k : context.constraints["k"].getAll<int>(EQUALS)) {
+      results.push_back({{"k", INTEGER(k)}});
+    }
+    return results;
+  }
+
+  size_t scans{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_scan_reuse);
+};
+
+TEST_F(VirtualTableTests, test_scan_reuse) {
+  auto table = std::make_shared<memoTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("memo", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("memo", table->columnDefinition(), dbc);
+
+  // Both cursors use the same constraint and columns, the rows are reused.
+  QueryData results;
+  queryInternal(
+      "SELECT m1.k FROM memo m1, memo m2 WHERE m1.k = 1 AND m2.k = 1",
+      results,
+      dbc->db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(table->scans, 1U);
+
+  // A different constraint value is a different scan.
+  results.clear();
+  queryInternal("SELECT k FROM memo WHERE k = 2", results, dbc->db());
+  EXPECT_EQ(table->scans, 2U);
+
+  // Reused rows do not outlive the query.
+  dbc->clearAffectedTables();
+  results.clear();
+  queryInternal("SELECT k FROM memo WHERE k = 2", results, dbc->db());
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(table->scans, 3U);
+}
+
+class sharedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("k", INTEGER_TYPE, ColumnOptions::INDEX),
+        std::make_tuple("v", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("h", TEXT_TYPE, ColumnOptions::HIDDEN),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    scans++;
+    return {{{"k", "1"}, {"v", "one"}}, {{"k", "2"}, {"v", "two"}}};
+  }
+
+  size_t scans{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_shared_scans);
+};
+
+TEST_F(VirtualTableTests, test_shared_scans) {
+  auto table = std::make_shared<sharedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("shared", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("shared", table->columnDefinition(), dbc);
+  resetSharedScans();
+
+  QueryData results;
+  {
+    SharedScanScope scope;
+    queryInternal("SELECT k, v FROM shared", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(scope.hits(), 0U);
+    EXPECT_EQ(scope.misses(), 1U);
+  }
+  EXPECT_EQ(table->scans, 1U);
+
+  {
+    // An INDEX constraint is compatible with the unconstrained scan.
+    SharedScanScope scope;
+    results.clear();
+    queryInternal("SELECT v FROM shared WHERE k = 2", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(scope.hits(), 1U);
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0]["v"], "two");
+
+    // A HIDDEN constraint may change the generated rows.
+    queryInternal("SELECT v FROM shared WHERE h = 'x'", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(scope.misses(), 1U);
+  }
+  EXPECT_EQ(table->scans, 2U);
+
+  // Scans outside of a scope, or after a reset, are generated.
+  queryInternal("SELECT k, v FROM shared", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->scans, 3U);
+
+  resetSharedScans();
+  {
+    SharedScanScope scope;
+    queryInternal("SELECT k, v FROM shared", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(scope.hits(), 0U);
+  }
+  EXPECT_EQ(table->scans, 4U);
+  resetSharedScans();
+}
+
 class indexIOptimizedTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -605,4 +893,247 @@ TEST_F(VirtualTableTests, test_indexing_costs) {
   EXPECT_EQ(10U, i->scans);
   EXPECT_EQ(10U, j->scans);
 }
+
+TEST_F(VirtualTableTests, test_scan_estimates) {
+  // A table without history uses the defaults, an index expects one row.
+  auto full = estimateTableScan("estimates_test", false);
+  auto indexed = estimateTableScan("estimates_test", true);
+  EXPECT_GT(full.cost, indexed.cost);
+  EXPECT_GT(full.rows, indexed.rows);
+  EXPECT_EQ(1, indexed.rows);
+
+  // A measured full scan replaces the defaults.
+  recordTableScan("estimates_test", false, 400, 20000);
+  full = estimateTableScan("estimates_test", false);
+  EXPECT_EQ(20000, full.cost);
+  EXPECT_EQ(400, full.rows);
+
+  // The indexed estimate is derived from the full scan until it is measured.
+  indexed = estimateTableScan("estimates_test", true);
+  EXPECT_EQ(50, indexed.cost);
+  recordTableScan("estimates_test", true, 2, 100);
+  indexed = estimateTableScan("estimates_test", true);
+  EXPECT_EQ(100, indexed.cost);
+  EXPECT_EQ(2, indexed.rows);
+
+  // Later scans move the running average.
+  recordTableScan("estimates_test", false, 400, 40000);
+  full = estimateTableScan("estimates_test", false);
+  EXPECT_GT(full.cost, 20000);
+  EXPECT_LT(full.cost, 40000);
+}
+
+class orderedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("time", BIGINT_TYPE, ColumnOptions::SORTED),
+        std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("path", TEXT_TYPE, ColumnOptions::INDEX),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    order_by = (context.orderBy) ? *context.orderBy : "";
+    descending = context.orderDescending;
+    limited = (context.limit) ? *context.limit : 0;
+
+    QueryData results;
+    for (const auto& time : {"3", "10", "1", "2"}) {
+      if (context.isLimitReached(results.size())) {
+        break;
+      }
+      results.push_back({{"time", time}, {"name", "event"}});
+    }
+    return results;
+  }
+
+  std::string order_by;
+  bool descending{false};
+  size_t limited{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_scan_order);
+};
+
+TEST_F(VirtualTableTests, test_scan_order) {
+  auto table = std::make_shared<orderedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("ordered", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("ordered", table->columnDefinition(), dbc);
+
+  // The table is asked for the order, numeric values are ordered numerically.
+  QueryData results;
+  queryInternal("SELECT time FROM ordered ORDER BY time", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->order_by, "time");
+  EXPECT_FALSE(table->descending);
+  QueryData expected = {
+      {{"time", "1"}}, {{"time", "2"}}, {{"time", "3"}}, {{"time", "10"}}};
+  EXPECT_EQ(results, expected);
+
+  results.clear();
+  queryInternal(
+      "SELECT time FROM ordered ORDER BY time DESC", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(table->descending);
+  std::reverse(expected.begin(), expected.end());
+  EXPECT_EQ(results, expected);
+
+  // Columns that are not SORTED are ordered by SQLite.
+  results.clear();
+  queryInternal(
+      "SELECT time FROM ordered ORDER BY name, time", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(table->order_by.empty());
+  EXPECT_EQ(results.size(), 4U);
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // An unfiltered scan may stop at the query's LIMIT and OFFSET.
+  results.clear();
+  queryInternal(
+      "SELECT time FROM ordered LIMIT 1 OFFSET 1", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->limited, 2U);
+  EXPECT_EQ(results, QueryData({{{"time", "10"}}}));
+
+  // Rows that SQLite filters again do not use the limit.
+  results.clear();
+  queryInternal("SELECT time FROM ordered WHERE name = 'event' LIMIT 1",
+                results,
+                dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->limited, 0U);
+
+  // Tables may match LIKE patterns unlike SQLite, which filters them again.
+  results.clear();
+  queryInternal("SELECT time FROM ordered WHERE path LIKE '/%' LIMIT 1",
+                results,
+                dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->limited, 0U);
+#endif
+}
+
+class inListTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("pid", INTEGER_TYPE, ColumnOptions::INDEX),
+        std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    scans++;
+    QueryData results;
+    for (const auto& pid : context.constraints["pid"].getAll(EQUALS)) {
+      results.push_back({{"pid", pid}, {"name", "process"}});
+    }
+    return results;
+  }
+
+  size_t scans{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_in_list_constraints);
+};
+
+TEST_F(VirtualTableTests, test_in_list_constraints) {
+  auto table = std::make_shared<inListTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("in_list", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("in_list", table->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal("SELECT pid FROM in_list WHERE pid IN (1, 2, 3) ORDER BY pid",
+                results,
+                dbc->db());
+  dbc->clearAffectedTables();
+  QueryData expected = {{{"pid", "1"}}, {{"pid", "2"}}, {{"pid", "3"}}};
+  EXPECT_EQ(results, expected);
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // The IN list is given to a single scan as a set of EQUALS constraints.
+  EXPECT_EQ(table->scans, 1U);
+#else
+  EXPECT_EQ(table->scans, 3U);
+#endif
+}
+
+class uniqueLookupTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple(
+            "i", INTEGER_TYPE, ColumnOptions::INDEX | ColumnOptions::UNIQUE),
+        std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    std::set<std::string> values;
+    if (!context.getLookupValues("i", values)) {
+      scans++;
+      for (size_t i = 0; i < 10; i++) {
+        results.push_back({{"i", INTEGER(i)}, {"text", "scan"}});
+      }
+      return results;
+    }
+
+    lookups++;
+    for (const auto& i : values) {
+      results.push_back({{"i", i}, {"text", "lookup"}});
+    }
+    return results;
+  }
+
+  size_t scans{0};
+  size_t lookups{0};
+};
+
+TEST_F(VirtualTableTests, test_unique_lookups) {
+  auto dbc = SQLiteDBManager::getUnique();
+  auto table_registry = RegistryFactory::get().registry("table");
+
+  auto unique = std::make_shared<uniqueLookupTablePlugin>();
+  table_registry->add("unique_lookup", unique);
+  attachTableInternal("unique_lookup", unique->columnDefinition(), dbc);
+
+  auto default_scan = std::make_shared<defaultScanTablePlugin>();
+  table_registry->add("default_scan_unique", default_scan);
+  attachTableInternal(
+      "default_scan_unique", default_scan->columnDefinition(), dbc);
+
+  // Either join order looks up the unique table once per outer row.
+  for (const auto& query :
+       {"SELECT * FROM default_scan_unique JOIN unique_lookup USING (i)",
+        "SELECT * FROM unique_lookup JOIN default_scan_unique USING (i)"}) {
+    QueryData results;
+    queryInternal(query, results, dbc->db());
+    dbc->clearAffectedTables();
+    ASSERT_EQ(10U, results.size());
+    EXPECT_EQ("lookup", results[0]["text"]);
+    EXPECT_EQ(0U, unique->scans);
+    EXPECT_EQ(10U, unique->lookups);
+    EXPECT_EQ(1U, default_scan->scans);
+    unique->lookups = 0;
+    default_scan->scans = 0;
+  }
+
+  // Without an equality every row is generated.
+  QueryData results;
+  queryInternal("SELECT * FROM unique_lookup WHERE i > 5", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(4U, results.size());
+  EXPECT_EQ(1U, unique->scans);
+}
 }
@@ -8,13 +8,23 @@
  *
  */
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <tuple>
 
 #include <osquery/core.h>
+#include <osquery/dispatcher.h>
+#include <osquery/extensions.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/interned.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -27,6 +37,217 @@ DECLARE_bool(disable_events);
 
 RecursiveMutex kAttachMutex;
 
+/// Assumed cost, in microseconds, of a full scan of a table without history.
+const double kDefaultScanCost{1000};
+
+/// Assumed number of rows from a full scan of a table without history.
+const double kDefaultScanRows{100};
+
+/// Weight of the most recent scan within the running averages.
+const double kScanWeight{0.25};
+
+/// Running averages for one type of scan over a table.
+struct TableScanStats {
+  bool known{false};
+  double cost{0};
+  double rows{0};
+};
+
+/// Full and indexed scan statistics for each table.
+struct TableScans {
+  TableScanStats full;
+  TableScanStats indexed;
+};
+
+static Mutex kTableScansMutex;
+static std::map<std::string, TableScans> kTableScans;
+
+void recordTableScan(const std::string& name,
+                     bool indexed,
+                     size_t rows,
+                     size_t micros) {
+  WriteLock lock(kTableScansMutex);
+  auto& scans = kTableScans[name];
+  auto& stats = (indexed) ? scans.indexed : scans.full;
+  if (!stats.known) {
+    stats.known = true;
+    stats.cost = static_cast<double>(micros);
+    stats.rows = static_cast<double>(rows);
+  } else {
+    stats.cost += kScanWeight * (static_cast<double>(micros) - stats.cost);
+    stats.rows += kScanWeight * (static_cast<double>(rows) - stats.rows);
+  }
+}
+
+TableScanEstimate estimateTableScan(const std::string& name, bool indexed) {
+  TableScans scans;
+  {
+    ReadLock lock(kTableScansMutex);
+    auto it = kTableScans.find(name);
+    if (it != kTableScans.end()) {
+      scans = it->second;
+    }
+  }
+
+  TableScanEstimate estimate;
+  estimate.cost = (scans.full.known) ? scans.full.cost : kDefaultScanCost;
+  estimate.rows = (scans.full.known) ? scans.full.rows : kDefaultScanRows;
+  if (indexed) {
+    if (scans.indexed.known) {
+      estimate.cost = scans.indexed.cost;
+      estimate.rows = scans.indexed.rows;
+    } else {
+      // Without history assume the constraint selects a single row.
+      estimate.cost /= std::max(estimate.rows, 1.0);
+      estimate.rows = 1;
+    }
+  }
+
+  // Every scan has a cost, even if a previous scan was immeasurably fast.
+  estimate.cost = std::max(estimate.cost, 1.0);
+  return estimate;
+}
+
+/// Rows generated by a scan that may be shared with later queries.
+struct SharedScan {
+  /// The generated columns, none if every column was generated.
+  boost::optional<UsedColumns> columns;
+
+  /// True if the scan was generated without constraints.
+  bool unconstrained{false};
+
+  /// The generated rows, interned while they are kept for the step.
+  InternedQueryData rows;
+};
+
+/// Shared scans and the scope currently sharing them.
+struct SharedScans {
+  /// Only the thread within a SharedScanScope shares scans.
+  std::thread::id thread;
+  bool active{false};
+
+  /// Counts for the current scope.
+  size_t hits{0};
+  size_t misses{0};
+
+  /// Shared scans for each table, keyed like the per-query results.
+  std::map<std::string, std::map<std::string, SharedScan>> tables;
+};
+
+static Mutex kSharedScansMutex;
+static SharedScans kSharedScans;
+
+SharedScanScope::SharedScanScope() {
+  WriteLock lock(kSharedScansMutex);
+  kSharedScans.thread = std::this_thread::get_id();
+  kSharedScans.active = true;
+  kSharedScans.hits = 0;
+  kSharedScans.misses = 0;
+}
+
+SharedScanScope::~SharedScanScope() {
+  WriteLock lock(kSharedScansMutex);
+  kSharedScans.active = false;
+}
+
+size_t SharedScanScope::hits() const {
+  ReadLock lock(kSharedScansMutex);
+  return kSharedScans.hits;
+}
+
+size_t SharedScanScope::misses() const {
+  ReadLock lock(kSharedScansMutex);
+  return kSharedScans.misses;
+}
+
+void resetSharedScans() {
+  WriteLock lock(kSharedScansMutex);
+  kSharedScans.tables.clear();
+}
+
+/// True if scans from the calling thread are shared.
+static bool isSharingScans() {
+  ReadLock lock(kSharedScansMutex);
+  return kSharedScans.active &&
+         kSharedScans.thread == std::this_thread::get_id();
+}
+
+/// True if a query context includes at least one constraint value.
+static bool hasConstraints(const QueryContext& context) {
+  for (const auto& column : context.constraints) {
+    if (!column.second.getAll().empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// True if the generated columns include every used column.
+static bool coversColumns(const boost::optional<UsedColumns>& generated,
+                          const boost::optional<UsedColumns>& used) {
+  if (!generated) {
+    return true;
+  } else if (!used) {
+    return false;
+  }
+
+  for (const auto& column : *used) {
+    if (generated->count(column) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Find shared rows that can serve a scan.
+ *
+ * If the scan's constraints only prune rows, so are compatible with any
+ * superset, an unconstrained scan with the used columns also serves it.
+ */
+static bool getSharedScan(const std::string& table,
+                          const std::string& key,
+                          const QueryContext& context,
+                          bool compatible,
+                          QueryData& rows) {
+  WriteLock lock(kSharedScansMutex);
+  auto scans = kSharedScans.tables.find(table);
+  if (scans == kSharedScans.tables.end()) {
+    return false;
+  }
+
+  auto scan = scans->second.find(key);
+  if (scan == scans->second.end() && compatible) {
+    for (scan = scans->second.begin(); scan != scans->second.end(); ++scan) {
+      if (scan->second.unconstrained &&
+          coversColumns(scan->second.columns, context.colsUsed)) {
+        break;
+      }
+    }
+  }
+
+  if (scan == scans->second.end()) {
+    return false;
+  }
+  rows = scan->second.rows.rows();
+  kSharedScans.hits++;
+  return true;
+}
+
+/// Make the rows of a scan available to later scopes.
+static void addSharedScan(const std::string& table,
+                          const std::string& key,
+                          const QueryContext& context,
+                          const QueryData& rows) {
+  InternedQueryData interned(rows);
+  WriteLock lock(kSharedScansMutex);
+  auto& scan = kSharedScans.tables[table][key];
+  scan.columns = context.colsUsed;
+  scan.unconstrained = !hasConstraints(context);
+  scan.rows = std::move(interned);
+  kSharedScans.misses++;
+}
+
 namespace tables {
 namespace sqlite {
 
@@ -103,9 +324,10 @@ int xClose(sqlite3_vtab_cursor* cur) {
 int xEof(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   if (pCur->uses_generator) {
-    if (*pCur->generator) {
+    if (pCur->generator != nullptr && *pCur->generator) {
       return false;
     }
+    pCur->current = nullptr;
     pCur->generator = nullptr;
     return true;
   }
@@ -129,8 +351,10 @@ int xNext(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   if (pCur->uses_generator) {
     pCur->generator->operator()();
-    if (*pCur->generator) {
-      pCur->current = pCur->generator->get();
+    pCur->current = (*pCur->generator) ? &pCur->generator->get() : nullptr;
+    // A generator that ended early for an interrupted query is incomplete.
+    if (pCur->current == nullptr && SQLQueryLimit::expired()) {
+      return SQLITE_INTERRUPT;
     }
   }
   pCur->row++;
@@ -163,6 +387,11 @@ int xCreate(sqlite3* db,
   PluginResponse response;
   pVtab->content->name = std::string(argv[0]);
   const auto& name = pVtab->content->name;
+  // Resolve a local table plugin once, instead of within every filter.
+  if (Registry::get().exists("table", name, true)) {
+    auto plugin = Registry::get().plugin("table", name);
+    pVtab->content->table = std::dynamic_pointer_cast<TablePlugin>(plugin);
+  }
   // Get the table column information.
   auto status =
       Registry::call("table", name, {{"action", "columns"}}, response);
@@ -240,42 +469,12 @@ int xCreate(sqlite3* db,
   return rc;
 }
 
-int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
-  BaseCursor* pCur = (BaseCursor*)cur;
-  const auto* pVtab = (VirtualTable*)cur->pVtab;
-  if (col >= static_cast<int>(pVtab->content->columns.size())) {
-    // Requested column index greater than column set size.
-    return SQLITE_ERROR;
-  }
-  if (!pCur->uses_generator && pCur->row >= pCur->data.size()) {
-    // Request row index greater than row set size.
-    return SQLITE_ERROR;
-  }
-
-  auto& column_name = std::get<0>(pVtab->content->columns[col]);
-  auto& type = std::get<1>(pVtab->content->columns[col]);
-  if (pVtab->content->aliases.count(column_name)) {
-    // Overwrite the aliased column with the type and name of the new column.
-    type = std::get<1>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-    column_name = std::get<0>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-  }
-
-  Row* row = nullptr;
-  if (pCur->uses_generator) {
-    row = &pCur->current;
-  } else {
-    row = &pCur->data[pCur->row];
-  }
-
-  // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto& value = (*row)[column_name];
-  if (row->count(column_name) == 0) {
-    // Missing content.
-    VLOG(1) << "Error " << column_name << " is empty";
-    sqlite3_result_null(ctx);
-  } else if (type == TEXT_TYPE) {
+/// Cast a string cell to the column's SQLite type.
+static void resultText(sqlite3_context* ctx,
+                       const std::string& column_name,
+                       ColumnType type,
+                       const std::string& value) {
+  if (type == TEXT_TYPE) {
     sqlite3_result_text(
         ctx, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
   } else if (type == INTEGER_TYPE) {
@@ -310,10 +509,193 @@ int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
   } else {
     LOG(ERROR) << "Error unknown column type " << column_name;
   }
+}
+
+/// Report a native cell, no string parsing is needed for numeric values.
+static void resultTyped(sqlite3_context* ctx,
+                        const std::string& column_name,
+                        ColumnType type,
+                        const TypedValue& value) {
+  if (const auto* integer = boost::get<long long>(&value)) {
+    if (type == DOUBLE_TYPE) {
+      sqlite3_result_double(ctx, static_cast<double>(*integer));
+    } else if (type == INTEGER_TYPE &&
+               (*integer < INT_MIN || *integer > INT_MAX)) {
+      VLOG(1) << "Error casting " << column_name << " (" << *integer
+              << ") to INTEGER";
+      sqlite3_result_null(ctx);
+    } else {
+      sqlite3_result_int64(ctx, *integer);
+    }
+  } else if (const auto* real = boost::get<double>(&value)) {
+    sqlite3_result_double(ctx, *real);
+  } else if (const auto* text = boost::get<std::string>(&value)) {
+    resultText(ctx, column_name, type, *text);
+  } else {
+    sqlite3_result_null(ctx);
+  }
+}
+
+int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
+  BaseCursor* pCur = (BaseCursor*)cur;
+  const auto* pVtab = (VirtualTable*)cur->pVtab;
+  if (col >= static_cast<int>(pVtab->content->columns.size())) {
+    // Requested column index greater than column set size.
+    return SQLITE_ERROR;
+  }
+  if (!pCur->uses_generator && pCur->row >= pCur->n) {
+    // Request row index greater than row set size.
+    return SQLITE_ERROR;
+  }
+
+  // Aliased columns use the type, name, and position of the target column.
+  size_t index = static_cast<size_t>(col);
+  const auto& aliases = pVtab->content->aliases;
+  auto alias = aliases.find(std::get<0>(pVtab->content->columns[index]));
+  if (alias != aliases.end()) {
+    index = alias->second;
+  }
+  const auto& column_name = std::get<0>(pVtab->content->columns[index]);
+  auto type = std::get<1>(pVtab->content->columns[index]);
+
+  if (pCur->uses_typed_rows) {
+    const auto& row = pCur->typed_data[pCur->row];
+    if (index < row.size()) {
+      resultTyped(ctx, column_name, type, row[index]);
+    } else {
+      sqlite3_result_null(ctx);
+    }
+    return SQLITE_OK;
+  }
+
+  const Row* row = nullptr;
+  if (pCur->uses_generator) {
+    if (pCur->current == nullptr) {
+      return SQLITE_ERROR;
+    }
+    row = pCur->current;
+  } else {
+    row = &pCur->data[pCur->row];
+  }
+
+  // Attempt to cast each xFilter-populated row/column to the SQLite type.
+  auto value = row->find(column_name);
+  if (value == row->end()) {
+    // Missing content.
+    VLOG(1) << "Error " << column_name << " is empty";
+    sqlite3_result_null(ctx);
+  } else {
+    resultText(ctx, column_name, type, value->second);
+  }
 
   return SQLITE_OK;
 }
 
+/// Check if a scan's rows may be ordered before they are returned to SQLite.
+static bool isOrderable(const VirtualTableContent* content) {
+  if (content->table == nullptr) {
+    // Rows from an extension are ordered after they are received.
+    return true;
+  }
+
+  // Generated and typed rows are returned as they are produced.
+  return (!content->table->usesGenerator() &&
+          !content->table->usesTypedRows());
+}
+
+/**
+ * @brief Check if a table generates exactly the rows matching the constraints.
+ *
+ * Tables generate rows for each equality constraint on an index, required,
+ * or additional column. Rows are a union when several columns are
+ * constrained, such that SQLite may filter them again. Tables expand LIKE
+ * patterns in their own way, such as globbing paths, so those rows are
+ * filtered again too.
+ */
+static bool isExactScan(const ConstraintSet& constraints,
+                        const TableColumns& columns) {
+  for (const auto& constraint : constraints) {
+    if (constraint.second.op != EQUALS) {
+      return false;
+    }
+
+    if (constraint.first != constraints.front().first) {
+      return false;
+    }
+
+    for (const auto& column : columns) {
+      if (std::get<0>(column) == constraint.first &&
+          !(std::get<2>(column) & (ColumnOptions::INDEX |
+                                   ColumnOptions::REQUIRED |
+                                   ColumnOptions::ADDITIONAL))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Plan the order and row limit an xFilter scan may use.
+ *
+ * A single ORDER BY term on a SORTED column is consumed, xFilter orders the
+ * generated rows instead of SQLite sorting them again. SQLite 3.38 and later
+ * include the LIMIT and OFFSET as constraints when it is able. Their values
+ * are requested as arguments following the column constraints.
+ */
+static ScanHints planScanHints(VirtualTable* pVtab,
+                               sqlite3_index_info* pIdxInfo,
+                               const ConstraintSet& constraints,
+                               bool exact,
+                               size_t& expr_index) {
+  ScanHints hints;
+  const auto& columns = pVtab->content->columns;
+  if (pIdxInfo->nOrderBy == 1) {
+    const auto& order = pIdxInfo->aOrderBy[0];
+    if (order.iColumn >= 0 &&
+        static_cast<size_t>(order.iColumn) < columns.size() &&
+        std::get<2>(columns[order.iColumn]) & ColumnOptions::SORTED &&
+        isOrderable(pVtab->content)) {
+      hints.order_by = std::get<0>(columns[order.iColumn]);
+      hints.descending = (order.desc != 0);
+      pIdxInfo->orderByConsumed = 1;
+    }
+  }
+
+  // Rows filtered by SQLite after the scan, or sorted by SQLite, could not
+  // use the limit.
+  if (!exact || (pIdxInfo->nOrderBy > 0 && !pIdxInfo->orderByConsumed) ||
+      pVtab->content->attributes & (TableAttributes::CACHEABLE |
+                                    TableAttributes::CACHEABLE_PROCESS |
+                                    TableAttributes::CACHEABLE_BOOT) ||
+      !isExactScan(constraints, columns)) {
+    return hints;
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // The library may be older than the headers, it then has no such terms.
+  if (sqlite3_libversion_number() < 3038000) {
+    return hints;
+  }
+
+  for (size_t i = 0; i < static_cast<size_t>(pIdxInfo->nConstraint); ++i) {
+    const auto& constraint_info = pIdxInfo->aConstraint[i];
+    if (!constraint_info.usable) {
+      continue;
+    }
+
+    if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT) {
+      hints.limit_index = ++expr_index;
+      pIdxInfo->aConstraintUsage[i].argvIndex = static_cast<int>(expr_index);
+    } else if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+      hints.offset_index = ++expr_index;
+      pIdxInfo->aConstraintUsage[i].argvIndex = static_cast<int>(expr_index);
+    }
+  }
+#endif
+  return hints;
+}
+
 static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   auto* pVtab = (VirtualTable*)tab;
   const auto& columns = pVtab->content->columns;
@@ -325,10 +707,20 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   // If any constraints are unusable increment the cost of the index.
   double cost = 1;
 
+  // Equality constraints on an IN list whose values are given all at once.
+  std::set<size_t> in_lists;
+
   // Tables may have requirements or use indexes.
   bool required_satisfied = false;
   bool index_used = false;
 
+  // An equality on a UNIQUE column is a point lookup of at most one row.
+  bool unique = false;
+
+  // If every predicate term is a column constraint, rows are not filtered
+  // by terms the table did not see.
+  bool exact = true;
+
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
   // Subsequent attempts from failed (unusable) constraints replace the set,
@@ -347,14 +739,24 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
       if (!constraint_info.usable) {
         // A higher cost less priority, prefer more usable query constraints.
         cost += 10;
+        exact = false;
         continue;
       }
 
+#if SQLITE_VERSION_NUMBER >= 3038000
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        // Row limits are planned after the column constraints.
+        continue;
+      }
+#endif
+
       // Lookup the column name given an index into the table column set.
       if (constraint_info.iColumn < 0 ||
           static_cast<size_t>(constraint_info.iColumn) >=
               pVtab->content->columns.size()) {
         cost += 10;
+        exact = false;
         continue;
       }
       const auto& name = std::get<0>(columns[constraint_info.iColumn]);
@@ -374,6 +776,18 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
       constraints.push_back(
           std::make_pair(name, Constraint(constraint_info.op)));
       pIdxInfo->aConstraintUsage[i].argvIndex = static_cast<int>(++expr_index);
+#if SQLITE_VERSION_NUMBER >= 3038000
+      // Request the IN list as a single argument, rather than a filter for
+      // each value, so the table generates the rows for all values at once.
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_EQ &&
+          sqlite3_vtab_in(pIdxInfo, static_cast<int>(i), 1)) {
+        in_lists.insert(expr_index);
+      }
+#endif
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_EQ &&
+          options & ColumnOptions::UNIQUE && in_lists.count(expr_index) == 0) {
+        unique = true;
+      }
 #if defined(DEBUG)
       plan("Adding constraint for table: " + pVtab->content->name +
            " [column=" + name + " arg_index=" + std::to_string(expr_index) +
@@ -382,6 +796,10 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
     }
   }
 
+  // The limit arguments follow the column constraints.
+  auto hints = planScanHints(pVtab, pIdxInfo, constraints, exact, expr_index);
+  hints.in_lists = std::move(in_lists);
+
   // Check the table for a required column.
   for (const auto& column : columns) {
     auto& options = std::get<2>(column);
@@ -392,12 +810,49 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
     }
   }
 
-  if (!index_used) {
-    // A column is marked index, but no index constraint was provided.
-    cost += 200;
+  // Add the expected cost of the scan, from previous scans when available.
+  // SQLite uses these estimates to place cheap or indexed tables within
+  // a join such that expensive tables are scanned the fewest times.
+  auto estimate = estimateTableScan(pVtab->content->name, index_used);
+  cost += estimate.cost;
+  if (unique) {
+    // Indexed scans of IN lists may have read many rows, a lookup reads one.
+    estimate.rows = 1;
+#if SQLITE_VERSION_NUMBER >= 3008012
+    pIdxInfo->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+#endif
   }
+#if SQLITE_VERSION_NUMBER >= 3008002
+  pIdxInfo->estimatedRows =
+      static_cast<sqlite3_int64>(std::max(estimate.rows, 1.0));
+#endif
 
   pIdxInfo->idxNum = static_cast<int>(kConstraintIndexID++);
+  // A cached statement keeps this plan between executions.
+  pVtab->instance->addStatementPlan(pVtab->content,
+                                    static_cast<size_t>(pIdxInfo->idxNum));
+
+#if SQLITE_VERSION_NUMBER >= 3010000
+  // Record the columns used by the query, the last bit represents every
+  // column at or beyond its index.
+  UsedColumns colsUsed;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    auto bit = (i < 63) ? i : 63;
+    if ((pIdxInfo->colUsed & (static_cast<sqlite3_uint64>(1) << bit)) == 0) {
+      continue;
+    }
+
+    const auto& name = std::get<0>(columns[i]);
+    colsUsed.insert(name);
+    if (pVtab->content->aliases.count(name) > 0) {
+      // Aliased columns are generated using the new column name.
+      colsUsed.insert(
+          std::get<0>(columns[pVtab->content->aliases.at(name)]));
+    }
+  }
+  pVtab->content->colsUsed[pIdxInfo->idxNum] = std::move(colsUsed);
+#endif
+
 #if defined(DEBUG)
   plan("Recording constraint set for table: " + pVtab->content->name +
        " [cost=" + std::to_string(cost) + " size=" +
@@ -406,10 +861,119 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
 #endif
   // Add the constraint set to the table's tracked constraints.
   pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  pVtab->content->hints[pIdxInfo->idxNum] = std::move(hints);
   pIdxInfo->estimatedCost = cost;
   return SQLITE_OK;
 }
 
+/// Build a canonical key from the constraint values and used columns.
+static std::string scanKey(const QueryContext& context) {
+  std::vector<std::string> terms;
+  for (const auto& column : context.constraints) {
+    for (const auto& constraint : column.second.getAll()) {
+      terms.push_back(column.first + " " + std::to_string(constraint.op) +
+                      " " + std::to_string(constraint.expr.size()) + ":" +
+                      constraint.expr);
+    }
+  }
+  std::sort(terms.begin(), terms.end());
+
+  std::string key;
+  for (const auto& term : terms) {
+    key += term + "\n";
+  }
+
+  if (context.colsUsed) {
+    std::vector<std::string> columns(context.colsUsed->begin(),
+                                     context.colsUsed->end());
+    std::sort(columns.begin(), columns.end());
+    key += "columns";
+    for (const auto& column : columns) {
+      key += " " + column;
+    }
+    key += "\n";
+  }
+
+  if (context.orderBy) {
+    key += "order " + *context.orderBy +
+           ((context.orderDescending) ? " desc\n" : "\n");
+  }
+
+  if (context.limit) {
+    key += "limit " + std::to_string(*context.limit) + "\n";
+  }
+  return key;
+}
+
+/// Order rows by a column the way SQLite orders the column's values.
+static void orderRows(QueryData& rows,
+                      const std::string& column,
+                      ColumnType type,
+                      bool descending) {
+  // NULLs order before numeric values, and numeric values before text.
+  using OrderKey = std::tuple<int, long double, std::string>;
+  std::vector<std::pair<OrderKey, size_t>> keys;
+  keys.reserve(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    auto value = rows[i].find(column);
+    const auto& expr = (value != rows[i].end()) ? value->second : "";
+    if (type == TEXT_TYPE) {
+      keys.push_back(std::make_pair(OrderKey(2, 0, expr), i));
+      continue;
+    }
+
+    char* end = nullptr;
+    auto number = strtold(expr.c_str(), &end);
+    if (end == nullptr || end == expr.c_str() || *end != '\0') {
+      keys.push_back(std::make_pair(OrderKey(0, 0, ""), i));
+    } else {
+      keys.push_back(std::make_pair(OrderKey(1, number, ""), i));
+    }
+  }
+
+  auto compare = [descending](const std::pair<OrderKey, size_t>& left,
+                              const std::pair<OrderKey, size_t>& right) {
+    return (descending) ? right.first < left.first : left.first < right.first;
+  };
+  if (std::is_sorted(keys.begin(), keys.end(), compare)) {
+    // The table generated rows in the requested order.
+    return;
+  }
+
+  std::stable_sort(keys.begin(), keys.end(), compare);
+  QueryData ordered;
+  ordered.reserve(rows.size());
+  for (const auto& key : keys) {
+    ordered.push_back(std::move(rows[key.second]));
+  }
+  rows = std::move(ordered);
+}
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+/// Add an EQUALS constraint for each value of an IN list argument.
+static void addInListConstraints(BaseCursor* pCur,
+                                 sqlite3_value* list,
+                                 const ConstraintSet::value_type& constraint,
+                                 QueryContext& context) {
+  size_t values = 0;
+  sqlite3_value* value = nullptr;
+  for (auto rc = sqlite3_vtab_in_first(list, &value);
+       rc == SQLITE_OK && value != nullptr;
+       rc = sqlite3_vtab_in_next(list, &value)) {
+    auto expr = (const char*)sqlite3_value_text(value);
+    if (expr == nullptr || expr[0] == 0) {
+      continue;
+    }
+    context.constraints[constraint.first].add(
+        Constraint(constraint.second.op, expr));
+    values++;
+  }
+  plan("Adding IN list to cursor (" + std::to_string(pCur->id) + "): " +
+       constraint.first + " " + opString(constraint.second.op) + " " +
+       std::to_string(values) + " values");
+}
+#endif
+
 static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
                    int idxNum,
                    const char* idxStr,
@@ -441,6 +1005,16 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
       ((content->attributes & TableAttributes::EVENT_BASED) == 0 ||
        !FLAGS_disable_events);
 
+  // Scans constrained by index columns are costed separately from full scans.
+  bool indexed = false;
+
+  // Scans may be shared between scheduled queries, for tables without
+  // per-query state. Scans constrained only by INDEX or DEFAULT columns may
+  // also be served from an unconstrained scan.
+  bool shareable = (content->attributes & (TableAttributes::EVENT_BASED |
+                                           TableAttributes::CACHEABLE)) == 0;
+  bool compatible = true;
+
   std::map<std::string, ColumnOptions> options;
   for (size_t i = 0; i < content->columns.size(); ++i) {
     // Set the column affinity for each optional constraint list.
@@ -467,7 +1041,16 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
   if (content->constraints.size() > 0) {
     auto& constraints = content->constraints[idxNum];
     if (argc > 0) {
-      for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
+      // The plan may be missing if it was released before this filter.
+      auto count = std::min(static_cast<size_t>(argc), constraints.size());
+      for (size_t i = 0; i < count; ++i) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+        if (content->hints.count(idxNum) > 0 &&
+            content->hints[idxNum].in_lists.count(i + 1) > 0) {
+          addInListConstraints(pCur, argv[i], constraints[i], context);
+          continue;
+        }
+#endif
         auto expr = (const char*)sqlite3_value_text(argv[i]);
         if (expr == nullptr || expr[0] == 0) {
           // SQLite did not expose the expression value.
@@ -486,6 +1069,11 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
       // Constraints failed.
     }
 
+    // Compile the constraints once, tables may match many values.
+    for (const auto& list : context.constraints) {
+      list.second.getMatcher();
+    }
+
     // Evaluate index and optimized constraint requirements.
     // These are satisfied regardless of expression content availability.
     for (const auto& constraint : constraints) {
@@ -494,6 +1082,18 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
         required_satisfied = true;
       }
 
+      if (options[constraint.first] &
+          (ColumnOptions::REQUIRED | ColumnOptions::INDEX |
+           ColumnOptions::ADDITIONAL)) {
+        indexed = true;
+      }
+
+      if (options[constraint.first] &
+          (ColumnOptions::REQUIRED | ColumnOptions::ADDITIONAL |
+           ColumnOptions::HIDDEN)) {
+        compatible = false;
+      }
+
       if (!user_based_satisfied && constraint.first == "uid") {
         // UID was required and exists in the constraints.
         user_based_satisfied = true;
@@ -521,44 +1121,312 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
                  << table_doc(pVtab->content->name);
   }
 
+  // Cacheable tables keep every column, the results may be used by any query.
+  if ((content->attributes & TableAttributes::CACHEABLE) == 0 &&
+      content->colsUsed.count(idxNum) > 0) {
+    context.colsUsed = content->colsUsed[idxNum];
+  }
+
+  // Apply the planned order and the number of rows SQLite will read.
+  ColumnType order_type = TEXT_TYPE;
+  if (content->hints.count(idxNum) > 0) {
+    const auto& hints = content->hints[idxNum];
+    if (!hints.order_by.empty()) {
+      context.orderBy = hints.order_by;
+      context.orderDescending = hints.descending;
+      order_type = context.constraints[hints.order_by].affinity;
+    }
+
+    if (hints.limit_index > 0 &&
+        hints.limit_index <= static_cast<size_t>(argc)) {
+      auto limit = sqlite3_value_int64(argv[hints.limit_index - 1]);
+      if (limit >= 0 && hints.offset_index > 0 &&
+          hints.offset_index <= static_cast<size_t>(argc)) {
+        limit += std::max(sqlite3_value_int64(argv[hints.offset_index - 1]),
+                          static_cast<sqlite3_int64>(0));
+      }
+      if (limit >= 0) {
+        context.limit = static_cast<size_t>(limit);
+        // Scans of the first rows are not complete scans.
+        shareable = false;
+      }
+    }
+  }
+
   // Reset the virtual table contents.
   pCur->data.clear();
+  pCur->typed_data.clear();
+  pCur->uses_typed_rows = false;
   options.clear();
 
+  // Low priority queries wait here for interactive queries before the first
+  // scan of each cursor. A table filtered again for each row of a join does
+  // not wait again. A query that was cancelled or timed out does not
+  // generate more tables.
+  auto proceed = (pCur->yielded) ? !SQLQueryLimit::expired()
+                                 : SQLQueryPriority::yield();
+  pCur->yielded = true;
+  if (!proceed) {
+    return SQLITE_INTERRUPT;
+  }
+
   // Generate the row data set.
   plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
-  if (Registry::get().exists("table", pVtab->content->name, true)) {
-    auto plugin = Registry::get().plugin("table", pVtab->content->name);
-    auto table = std::dynamic_pointer_cast<TablePlugin>(plugin);
+  TraceSpan span("generate", pVtab->content->name);
+  ProfileLabel label(ProfileLabel::TABLE, pVtab->content->name);
+  auto start = std::chrono::steady_clock::now();
+  // The table plugin is resolved when the virtual table is created.
+  auto table = content->table;
+  if (table != nullptr) {
     if (table->usesGenerator()) {
+      // Generators produce rows lazily, their scans are not measured.
       pCur->uses_generator = true;
       pCur->generator = std::make_unique<RowGenerator::pull_type>(
           std::bind(&TablePlugin::generator,
                     table,
                     std::placeholders::_1,
                     std::move(context)));
-      if (*pCur->generator) {
-        pCur->current = pCur->generator->get();
-      }
+      pCur->current = (*pCur->generator) ? &pCur->generator->get() : nullptr;
       return SQLITE_OK;
     }
-    pCur->data = table->generate(context);
+  }
+
+  if (table != nullptr && table->usesTypedRows()) {
+    pCur->uses_typed_rows = true;
+    pCur->typed_data = table->generateTyped(context);
+    if (SQLQueryLimit::expired()) {
+      pCur->typed_data.clear();
+      return SQLITE_INTERRUPT;
+    }
   } else {
-    PluginRequest request = {{"action", "generate"}};
-    TablePlugin::setRequestFromContext(context, request);
-    Registry::call("table", pVtab->content->name, request, pCur->data);
+    // Reuse the rows of an identical scan within this query.
+    auto key = scanKey(context);
+    auto results = content->results.find(key);
+    if (results != content->results.end()) {
+      plan("Reusing rows for cursor (" + std::to_string(pCur->id) + ")");
+      pCur->data = results->second;
+      pCur->n = pCur->data.size();
+      span.setRows(pCur->n);
+      return SQLITE_OK;
+    }
+
+    // Reuse the rows of a scan made by an earlier scheduled query.
+    bool sharing = shareable && isSharingScans();
+    if (sharing &&
+        getSharedScan(content->name, key, context, compatible, pCur->data)) {
+      plan("Sharing rows for cursor (" + std::to_string(pCur->id) + ")");
+      if (context.orderBy) {
+        orderRows(
+            pCur->data, *context.orderBy, order_type, context.orderDescending);
+      }
+      content->results[key] = pCur->data;
+      pCur->n = pCur->data.size();
+      span.setRows(pCur->n);
+      return SQLITE_OK;
+    }
+
+    std::string lifetime_key;
+    bool cached = (table != nullptr &&
+                   table->getLifetimeCache(pCur->data, lifetime_key));
+    if (cached) {
+      plan("Using cached rows for cursor (" + std::to_string(pCur->id) + ")");
+    } else if (table != nullptr) {
+      pCur->data = table->generate(context);
+    } else {
+      // Extensions receive the context as a structured Thrift request.
+      callExtensionTable(content->name, context, pCur->data);
+    }
+    // A table that returned early for an interrupted query has partial rows,
+    // they are neither cached nor shared.
+    if (SQLQueryLimit::expired()) {
+      pCur->data.clear();
+      return SQLITE_INTERRUPT;
+    }
+    if (!cached && table != nullptr) {
+      table->setLifetimeCache(context, lifetime_key, pCur->data);
+    }
+    if (context.orderBy) {
+      // SQLite trusts the scan's order, see planScanHints.
+      orderRows(
+          pCur->data, *context.orderBy, order_type, context.orderDescending);
+    }
+    content->results[key] = pCur->data;
+    if (sharing) {
+      addSharedScan(content->name, key, context, pCur->data);
+    }
   }
 
   // Set the number of rows.
-  pCur->n = pCur->data.size();
+  pCur->n = (pCur->uses_typed_rows) ? pCur->typed_data.size()
+                                    : pCur->data.size();
+  span.setRows(pCur->n);
+
+  // Feed the duration and size of this scan into later cost estimates.
+  auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  recordTableScan(content->name,
+                  indexed,
+                  pCur->n,
+                  static_cast<size_t>(micros.count()));
   return SQLITE_OK;
 }
 }
 }
 
+/// An unconstrained scan generated before its statement is stepped.
+struct PrefetchScan : private boost::noncopyable {
+  explicit PrefetchScan(VirtualTableContent* table_content)
+      : content(table_content), context(table_content) {}
+
+  VirtualTableContent* content{nullptr};
+  std::shared_ptr<TablePlugin> table{nullptr};
+  QueryContext context;
+  std::string key;
+  QueryData rows;
+  bool generated{false};
+};
+
+/// Create the xFilter context for an unconstrained plan, if it is prefetched.
+static bool getPrefetchScan(size_t index, PrefetchScan& scan) {
+  auto* content = scan.content;
+  // Only tables marked concurrent may share state with other tables' scans.
+  // Event-based tables advance their optimization state for every scan, and
+  // tables requiring constraints generate nothing without them.
+  if ((content->attributes & TableAttributes::CONCURRENT) == 0 ||
+      content->attributes & TableAttributes::EVENT_BASED ||
+      content->table == nullptr) {
+    return false;
+  }
+
+  scan.table = content->table;
+  if (scan.table->usesGenerator() ||
+      scan.table->usesTypedRows()) {
+    return false;
+  }
+
+  for (const auto& column : content->columns) {
+    if (std::get<2>(column) & ColumnOptions::REQUIRED) {
+      return false;
+    }
+    scan.context.constraints[std::get<0>(column)].affinity =
+        std::get<1>(column);
+  }
+
+  if ((content->attributes & TableAttributes::CACHEABLE) == 0 &&
+      content->colsUsed.count(index) > 0) {
+    scan.context.colsUsed = content->colsUsed.at(index);
+  }
+
+  if (content->hints.count(index) > 0) {
+    const auto& hints = content->hints.at(index);
+    if (hints.limit_index > 0) {
+      // The limit value is only known within xFilter.
+      return false;
+    }
+
+    if (!hints.order_by.empty()) {
+      scan.context.orderBy = hints.order_by;
+      scan.context.orderDescending = hints.descending;
+    }
+  }
+
+  scan.key = tables::sqlite::scanKey(scan.context);
+  return (content->results.count(scan.key) == 0);
+}
+
+void prefetchTableScans(
+    const std::vector<std::pair<VirtualTableContent*, size_t>>& plans,
+    SQLiteDBInstance* instance,
+    size_t threads) {
+  // Only tables planned without constraints are independent of the other
+  // tables in the statement, a table with any constrained plan is skipped.
+  std::map<VirtualTableContent*, size_t> unconstrained;
+  std::set<VirtualTableContent*> constrained;
+  for (const auto& plan : plans) {
+    auto constraints = plan.first->constraints.find(plan.second);
+    if (constraints == plan.first->constraints.end() ||
+        !constraints->second.empty()) {
+      constrained.insert(plan.first);
+    } else if (unconstrained.count(plan.first) == 0) {
+      unconstrained[plan.first] = plan.second;
+    }
+  }
+
+  std::vector<std::unique_ptr<PrefetchScan>> scans;
+  for (const auto& plan : unconstrained) {
+    auto scan = std::make_unique<PrefetchScan>(plan.first);
+    if (constrained.count(plan.first) == 0 &&
+        getPrefetchScan(plan.second, *scan)) {
+      scans.push_back(std::move(scan));
+    }
+  }
+
+  if (scans.size() < 2 || threads == 0) {
+    // A single table is generated within xFilter.
+    return;
+  }
+
+  // The workers stop when the statement's query is interrupted.
+  auto interrupted = getQueryInterrupt();
+  std::atomic<size_t> next{0};
+  auto worker = [&scans, &next, &interrupted]() {
+    for (auto i = next++; i < scans.size() && !interrupted(); i = next++) {
+      auto& scan = *scans[i];
+      auto start = std::chrono::steady_clock::now();
+      try {
+        scan.rows = scan.table->generate(scan.context);
+      } catch (const std::exception& e) {
+        // The scan is generated again within xFilter.
+        VLOG(1) << "Cannot prefetch " << scan.content->name << ": "
+                << e.what();
+        continue;
+      }
+
+      if (scan.context.orderBy) {
+        const auto& order = *scan.context.orderBy;
+        tables::sqlite::orderRows(scan.rows,
+                                  order,
+                                  scan.context.constraints[order].affinity,
+                                  scan.context.orderDescending);
+      }
+
+      auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+      recordTableScan(scan.content->name,
+                      false,
+                      scan.rows.size(),
+                      static_cast<size_t>(micros.count()));
+      // Rows generated while the query was interrupted may be partial.
+      scan.generated = !interrupted();
+    }
+  };
+
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < std::min(threads, scans.size()); ++i) {
+    group.run(bindQueryLimit(worker));
+  }
+  // The calling thread generates scans too.
+  worker();
+  group.wait();
+
+  // Cursors reuse the rows as if an identical scan preceded them.
+  for (auto& scan : scans) {
+    if (scan->generated) {
+      instance->addAffectedTable(scan->content);
+      scan->content->results[scan->key] = std::move(scan->rows);
+    }
+  }
+}
+
 Status attachTableInternal(const std::string& name,
                            const std::string& statement,
                            const SQLiteDBInstanceRef& instance) {
+  return attachTableInternal(name, statement, instance.get());
+}
+
+Status attachTableInternal(const std::string& name,
+                           const std::string& statement,
+                           SQLiteDBInstance* instance) {
   if (SQLiteDBManager::isDisabled(name)) {
     VLOG(1) << "Table " << name << " is disabled, not attaching";
     return Status(0, getStringForSQLiteReturnCode(0));
@@ -597,7 +1465,7 @@ Status attachTableInternal(const std::string& name,
   // within xCreate.
   RecursiveLock lock(kAttachMutex);
   int rc = sqlite3_create_module(
-      instance->db(), name.c_str(), &module, (void*)&(*instance));
+      instance->db(), name.c_str(), &module, (void*)instance);
   if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
     auto format =
         "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
@@ -647,15 +1515,21 @@ void attachVirtualTables(const SQLiteDBInstanceRef& instance) {
 #endif
   }
 
-  PluginResponse response;
   for (const auto& name : RegistryFactory::get().names("table")) {
-    // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
-    if (status.ok()) {
-      auto statement = columnDefinition(response, true);
-      attachTableInternal(name, statement, instance);
-    }
+    attachVirtualTable(name, instance.get());
   }
 }
+
+Status attachVirtualTable(const std::string& name, SQLiteDBInstance* instance) {
+  // Column information is nice for virtual table create call.
+  PluginResponse response;
+  auto status =
+      Registry::call("table", name, {{"action", "columns"}}, response);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto statement = columnDefinition(response, true);
+  return attachTableInternal(name, statement, instance);
+}
 }
@@ -45,15 +45,24 @@ struct BaseCursor : private boost::noncopyable {
   /// Table data generated from last access.
   QueryData data;
 
+  /// Typed table data generated from last access.
+  TypedQueryData typed_data;
+
   /// Callable generator.
   std::unique_ptr<RowGenerator::pull_type> generator{nullptr};
 
-  /// Results of current call.
-  Row current;
+  /// Results of current call, owned by the suspended generator.
+  Row* current{nullptr};
 
   /// Does the backing local table use a generator type.
   bool uses_generator{false};
 
+  /// Does the backing local table generate typed rows.
+  bool uses_typed_rows{false};
+
+  /// Did the cursor's first scan yield to interactive queries.
+  bool yielded{false};
+
   /// Current cursor position.
   size_t row{0};
 
@@ -78,11 +87,82 @@ struct VirtualTable : private boost::noncopyable {
   SQLiteDBInstance* instance{nullptr};
 };
 
+/// Estimated cost, in microseconds, and size of a virtual table scan.
+struct TableScanEstimate {
+  double cost{0};
+  double rows{0};
+};
+
+/**
+ * @brief Record the duration and size of a completed table scan.
+ *
+ * These are kept as running averages per table and per scan type. A scan is
+ * indexed if it is constrained by an INDEX, ADDITIONAL, or REQUIRED column.
+ */
+void recordTableScan(const std::string& name,
+                     bool indexed,
+                     size_t rows,
+                     size_t micros);
+
+/// Estimate a table scan using previous scans, or defaults for a new table.
+TableScanEstimate estimateTableScan(const std::string& name, bool indexed);
+
+/**
+ * @brief Share table scans made by the calling thread with later scopes.
+ *
+ * The scheduler opens a scope for each scheduled query. A scan within the
+ * scope reuses rows generated in an earlier scope if the constraint values and
+ * used columns are identical, or if the earlier scan was unconstrained and
+ * generated every used column. SQLite applies the query's constraints to the
+ * reused rows. Event-based, cacheable, generator, and typed-row tables are
+ * never shared.
+ *
+ * Shared rows are kept until resetSharedScans is called.
+ */
+class SharedScanScope : private boost::noncopyable {
+ public:
+  SharedScanScope();
+  ~SharedScanScope();
+
+  /// Scans within this scope served from rows of an earlier scope.
+  size_t hits() const;
+
+  /// Scans within this scope generated and shared with later scopes.
+  size_t misses() const;
+};
+
+/// Drop all shared scan rows, the scheduler calls this for each tick.
+void resetSharedScans();
+
+/**
+ * @brief Generate a statement's independent table scans concurrently.
+ *
+ * Tables that were only planned without constraints, such as the tables of a
+ * UNION or CROSS JOIN, do not depend on rows of the other tables. When more
+ * than one exists they are generated using up to threads threads, including
+ * the caller, before the statement is stepped. Cursors then consume the rows
+ * like a reused scan. Generator, typed-row, event-based, and extension tables
+ * are generated within xFilter.
+ *
+ * @param plans The table plans made while preparing the statement.
+ * @param instance The connection executing the statement.
+ * @param threads The maximum number of concurrent scans.
+ */
+void prefetchTableScans(
+    const std::vector<std::pair<VirtualTableContent*, size_t>>& plans,
+    SQLiteDBInstance* instance,
+    size_t threads);
+
 /// Attach a table plugin name to an in-memory SQLite database.
 Status attachTableInternal(const std::string& name,
                            const std::string& statement,
                            const SQLiteDBInstanceRef& instance);
 
+/// See attachTableInternal, for an instance attaching tables to itself.
+Status attachTableInternal(const std::string& name,
+                           const std::string& statement,
+                           SQLiteDBInstance* instance);
+
 /// Detach (drop) a table.
 Status detachTableInternal(const std::string& name, sqlite3* db);
 
@@ -94,6 +174,9 @@ Status attachFunctionInternal(
 /// Attach all table plugins to an in-memory SQLite database.
 void attachVirtualTables(const SQLiteDBInstanceRef& instance);
 
+/// Attach a single table plugin, using the plugin's column definition.
+Status attachVirtualTable(const std::string& name, SQLiteDBInstance* instance);
+
 #if !defined(OSQUERY_EXTERNAL)
 /**
  * A generated foreign amalgamation file includes schema for all tables.
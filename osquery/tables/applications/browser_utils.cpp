@@ -8,11 +8,23 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <atomic>
+
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
+
+#include "osquery/core/json.h"
 #include "osquery/tables/applications/browser_utils.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
+
+DECLARE_uint64(read_threads);
+
 namespace tables {
 
 #define kManifestFile "/manifest.json"
@@ -26,24 +38,63 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"author", "author"},
     {"background.persistent", "persistent"}};
 
-void genExtension(const std::string& uid,
-                  const std::string& path,
-                  QueryData& results) {
+/// The number of users each extension scanning thread enumerates, at least.
+const size_t kExtensionUsersPerThread = 4;
+
+/// The maximum number of parsed extension manifests cached.
+const size_t kManifestCacheMax = 8192;
+
+/// A parsed manifest, and the state of the files it was parsed from.
+struct ManifestCacheEntry {
+  std::string manifest_state;
+
+  /// The locale's messages file, if the manifest has a default locale.
+  std::string messages_path;
+  std::string messages_state;
+
+  /// The extension's columns, without uid.
+  Row row;
+};
+
+/// Parsed manifests for each extension version path.
+static std::map<std::string, ManifestCacheEntry> kManifestCache;
+
+/// Protect access to the manifest cache.
+static Mutex kManifestCacheMutex;
+
+/// Describe the inode, size, and modification time of a file.
+static std::string getFileState(const std::string& path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return "";
+  }
+
+  auto state = std::to_string(info.st_ino) + ":" +
+               std::to_string(info.st_size) + ":" +
+               std::to_string(info.st_mtime);
+#ifdef __linux__
+  state += "." + std::to_string(info.st_mtim.tv_nsec);
+#elif defined(__APPLE__)
+  state += "." + std::to_string(info.st_mtimespec.tv_nsec);
+#endif
+  return state;
+}
+
+/// Parse an extension's manifest into its columns.
+static bool parseExtension(const std::string& path,
+                           std::string& messages_path,
+                           Row& r) {
   std::string json_data;
   if (!forensicReadFile(path + kManifestFile, json_data).ok()) {
     VLOG(1) << "Could not read file: " << path + kManifestFile;
-    return;
+    return false;
   }
 
-  // Read the extension metadata into a JSON blob, then property tree.
+  // Read the extension metadata into a property tree.
   pt::ptree tree;
-  try {
-    std::stringstream json_stream;
-    json_stream << json_data;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!parseJSONTree(json_data, tree).ok()) {
     VLOG(1) << "Could not parse JSON from: " << path + kManifestFile;
-    return;
+    return false;
   }
 
   pt::ptree messagetree;
@@ -51,27 +102,20 @@ void genExtension(const std::string& uid,
   if (!tree.get<std::string>("default_locale", "").empty()) {
     // Read the localized variables into a second ptree
     std::string messages_json;
-    std::string localized_path = path + "/_locales/" +
-                                 tree.get<std::string>("default_locale") +
-                                 "/messages.json";
-    if (!forensicReadFile(localized_path, messages_json).ok()) {
-      VLOG(1) << "Could not read file: " << localized_path;
-      return;
+    messages_path = path + "/_locales/" +
+                    tree.get<std::string>("default_locale") + "/messages.json";
+    if (!forensicReadFile(messages_path, messages_json).ok()) {
+      VLOG(1) << "Could not read file: " << messages_path;
+      return false;
     }
 
-    try {
-      std::stringstream messages_stream;
-      messages_stream << messages_json;
-      pt::read_json(messages_stream, messagetree);
-    } catch (const pt::json_parser::json_parser_error& /* e */) {
-      VLOG(1) << "Could not parse JSON from: " << localized_path;
-      return;
+    if (!parseJSONTree(messages_json, messagetree).ok()) {
+      VLOG(1) << "Could not parse JSON from: " << messages_path;
+      return false;
     }
   }
 
   std::string localized_prefix = "__MSG_";
-  Row r;
-  r["uid"] = uid;
   // Most of the keys are in the top-level JSON dictionary.
   for (const auto& it : kExtensionKeys) {
     std::string key = tree.get<std::string>(it.first, "");
@@ -98,42 +142,120 @@ void genExtension(const std::string& uid,
 
   r["identifier"] = fs::path(path).parent_path().parent_path().leaf().string();
   r["path"] = path;
-  results.push_back(r);
+  return true;
+}
+
+void genExtension(const std::string& uid,
+                  const std::string& path,
+                  QueryData& results) {
+  // A manifest is parsed again when it, or its messages, changed.
+  auto manifest_state = getFileState(path + kManifestFile);
+  if (manifest_state.empty()) {
+    VLOG(1) << "Could not read file: " << path + kManifestFile;
+    return;
+  }
+
+  {
+    ReadLock lock(kManifestCacheMutex);
+    auto cached = kManifestCache.find(path);
+    if (cached != kManifestCache.end() &&
+        cached->second.manifest_state == manifest_state &&
+        (cached->second.messages_path.empty() ||
+         cached->second.messages_state ==
+             getFileState(cached->second.messages_path))) {
+      results.push_back(cached->second.row);
+      results.back()["uid"] = uid;
+      return;
+    }
+  }
+
+  ManifestCacheEntry entry;
+  entry.manifest_state = std::move(manifest_state);
+  if (!parseExtension(path, entry.messages_path, entry.row)) {
+    return;
+  }
+  if (!entry.messages_path.empty()) {
+    entry.messages_state = getFileState(entry.messages_path);
+  }
+
+  Row r = entry.row;
+  r["uid"] = uid;
+  results.push_back(std::move(r));
+
+  WriteLock lock(kManifestCacheMutex);
+  if (kManifestCache.size() >= kManifestCacheMax &&
+      kManifestCache.count(path) == 0) {
+    // Extensions removed from disk are dropped along with the others.
+    kManifestCache.clear();
+  }
+  kManifestCache[path] = std::move(entry);
+}
+
+/// Enumerate a user's profiles, extensions, and extension versions.
+static void genUserExtensions(const Row& user,
+                              const fs::path& sub_dir,
+                              QueryData& results) {
+  // For each user, enumerate all of their chrome profiles.
+  std::vector<std::string> profiles;
+  fs::path extension_path = user.at("directory") / sub_dir;
+  if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
+    return;
+  }
+
+  // For each profile list each extension in the Extensions directory.
+  std::vector<std::string> extensions;
+  for (const auto& profile : profiles) {
+    listDirectoriesInDirectory(profile, extensions);
+  }
+
+  // Generate an addons list from their extensions JSON.
+  std::vector<std::string> versions;
+  for (const auto& extension : extensions) {
+    listDirectoriesInDirectory(extension, versions);
+  }
+
+  // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
+  for (const auto& version : versions) {
+    genExtension(user.at("uid"), version, results);
+  }
 }
 
 QueryData genChromeBasedExtensions(QueryContext& context,
                                    const fs::path& sub_dir) {
-  QueryData results;
-
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
+  // A uid constraint selects the users before their homes are enumerated.
+  std::vector<const Row*> users;
+  auto user_rows = usersFromContext(context);
+  for (const auto& row : user_rows) {
     if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their chrome profiles.
-      std::vector<std::string> profiles;
-      fs::path extension_path = row.at("directory") / sub_dir;
-      if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-        continue;
-      }
-
-      // For each profile list each extension in the Extensions directory.
-      std::vector<std::string> extensions;
-      for (const auto& profile : profiles) {
-        listDirectoriesInDirectory(profile, extensions);
-      }
-
-      // Generate an addons list from their extensions JSON.
-      std::vector<std::string> versions;
-      for (const auto& extension : extensions) {
-        listDirectoriesInDirectory(extension, versions);
-      }
-
-      // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
-      for (const auto& version : versions) {
-        genExtension(row.at("uid"), version, results);
-      }
+      users.push_back(&row);
     }
   }
 
+  // Each worker takes the next user until all have been enumerated.
+  std::vector<QueryData> rows(users.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    size_t index = 0;
+    while ((index = next++) < users.size()) {
+      genUserExtensions(*users[index], sub_dir, rows[index]);
+    }
+  };
+
+  auto threads = std::min(static_cast<size_t>(FLAGS_read_threads),
+                          users.size() / kExtensionUsersPerThread);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit(worker));
+  }
+  worker();
+  group.wait();
+
+  QueryData results;
+  for (auto& user_rows : rows) {
+    results.insert(results.end(),
+                   std::make_move_iterator(user_rows.begin()),
+                   std::make_move_iterator(user_rows.end()));
+  }
   return results;
 }
 }
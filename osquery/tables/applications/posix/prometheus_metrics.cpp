@@ -7,7 +7,9 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <osquery/config.h>
 #include <osquery/logger.h>
@@ -23,49 +25,173 @@ namespace http = boost::network::http;
 namespace osquery {
 namespace tables {
 
+/// Scrape at most this many targets at once.
+const size_t kMaxConcurrentScrapes = 8;
+
+/// The last successful scrape of each target, reused within a TTL.
+struct PrometheusScrapeCache {
+  std::map<std::string, PrometheusResponseData> targets;
+  Mutex mutex;
+};
+
+static PrometheusScrapeCache& getScrapeCache() {
+  static PrometheusScrapeCache cache;
+  return cache;
+}
+
+/// A client shared by every scrape, its IO thread and resolver cache persist.
+static http::client& getScrapeClient() {
+  static http::client client(http::client::options()
+                                 .follow_redirects(true)
+                                 .cache_resolved(true)
+                                 .timeout(1));
+  return client;
+}
+
+static inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
 void parseScrapeResults(
     const std::map<std::string, PrometheusResponseData>& scrapeResults,
     QueryData& rows) {
   for (auto const& target : scrapeResults) {
-    std::stringstream ss(target.second.content);
-    std::string dest;
-
-    while (std::getline(ss, dest)) {
-      if (!dest.empty() && dest[0] != '#') {
-        auto metric(osquery::split(dest, " "));
+    const auto& content = target.second.content;
+    auto timestamp = BIGINT(target.second.timestampMS.count());
+
+    // Each sample line is a metric name, optional labels, and the value.
+    size_t line = 0;
+    while (line < content.size()) {
+      auto line_end = content.find('\n', line);
+      if (line_end == std::string::npos) {
+        line_end = content.size();
+      }
 
-        if (metric.size() > 1) {
-          Row r;
-          r[kColTargetName] = target.first;
-          r[kColTimeStamp] = BIGINT(target.second.timestampMS.count());
-          r[kColMetric] = metric[0];
-          r[kColValue] = metric[1];
+      auto i = line;
+      while (i < line_end && isBlank(content[i])) {
+        i++;
+      }
+      if (i == line_end || content[i] == '#') {
+        line = line_end + 1;
+        continue;
+      }
 
-          rows.push_back(r);
+      // Label values are quoted and may contain spaces and escaped quotes.
+      auto name_start = i;
+      bool labels = false;
+      bool quoted = false;
+      for (; i < line_end; i++) {
+        auto c = content[i];
+        if (quoted) {
+          if (c == '\\') {
+            i++;
+          } else if (c == '"') {
+            quoted = false;
+          }
+        } else if (labels) {
+          quoted = (c == '"');
+          labels = (c != '}');
+        } else if (c == '{') {
+          labels = true;
+        } else if (isBlank(c)) {
+          break;
         }
       }
+      auto name_end = std::min(i, line_end);
+
+      while (i < line_end && isBlank(content[i])) {
+        i++;
+      }
+      auto value_start = i;
+      while (i < line_end && !isBlank(content[i])) {
+        i++;
+      }
+
+      if (value_start < i) {
+        Row r;
+        r[kColTargetName] = target.first;
+        r[kColTimeStamp] = timestamp;
+        r[kColMetric] = content.substr(name_start, name_end - name_start);
+        r[kColValue] = content.substr(value_start, i - value_start);
+        rows.push_back(std::move(r));
+      }
+      line = line_end + 1;
     }
   }
 }
 
-void scrapeTargets(
-    std::map<std::string, PrometheusResponseData>& scrapeResults) {
-  http::client client(
-      http::client::options().follow_redirects(true).timeout(1));
+/// Scrape a single target, returns true if the response was read.
+static bool scrapeTarget(const std::string& url, PrometheusResponseData& data) {
+  try {
+    http::client::request request(url);
+    http::client::response response(getScrapeClient().get(request));
+
+    data.content = static_cast<std::string>(body(response));
+    data.timestampMS = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    return true;
+  } catch (std::exception& e) {
+    LOG(ERROR) << "Failed on scrape of target " << url << ": " << e.what();
+  }
+  return false;
+}
 
-  for (auto& target : scrapeResults) {
-    try {
-      http::client::request request(target.first);
-      http::client::response response(client.get(request));
+void scrapeTargets(std::map<std::string, PrometheusResponseData>& scrapeResults,
+                   size_t ttl) {
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+
+  // Targets scraped within the TTL are not scraped again.
+  std::vector<std::pair<const std::string*, PrometheusResponseData*>> pending;
+  {
+    auto& cache = getScrapeCache();
+    WriteLock lock(cache.mutex);
+    for (auto it = cache.targets.begin(); it != cache.targets.end();) {
+      auto age = now - it->second.timestampMS;
+      if (scrapeResults.count(it->first) == 0 ||
+          age >= std::chrono::seconds(ttl)) {
+        it = cache.targets.erase(it);
+      } else {
+        ++it;
+      }
+    }
 
-      target.second.timestampMS =
-          std::chrono::duration_cast<std::chrono::milliseconds>(
-              std::chrono::system_clock::now().time_since_epoch());
-      target.second.content = static_cast<std::string>(body(response));
+    for (auto& target : scrapeResults) {
+      auto cached = cache.targets.find(target.first);
+      if (cached != cache.targets.end()) {
+        target.second = cached->second;
+      } else {
+        pending.push_back(std::make_pair(&target.first, &target.second));
+      }
+    }
+  }
+
+  // Slow targets only delay the targets scraped by the same worker.
+  std::vector<char> scraped(pending.size(), false);
+  std::atomic<size_t> next{0};
+  auto worker = ([&pending, &scraped, &next]() {
+    for (size_t i = next++; i < pending.size(); i = next++) {
+      scraped[i] = scrapeTarget(*pending[i].first, *pending[i].second);
+    }
+  });
 
-    } catch (std::exception& e) {
-      LOG(ERROR) << "Failed on scrape of target " << target.first << ": "
-                 << e.what();
+  std::vector<std::thread> workers;
+  auto count = std::min(pending.size(), kMaxConcurrentScrapes);
+  for (size_t i = 1; i < count; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  if (ttl > 0) {
+    auto& cache = getScrapeCache();
+    WriteLock lock(cache.mutex);
+    for (size_t i = 0; i < pending.size(); i++) {
+      if (scraped[i]) {
+        cache.targets[*pending[i].first] = *pending[i].second;
+      }
     }
   }
 }
@@ -116,7 +242,7 @@ QueryData genPrometheusMetrics(QueryContext& context) {
     sr[url.second.data()] = PrometheusResponseData{};
   }
 
-  scrapeTargets(sr);
+  scrapeTargets(sr, config.get<size_t>("cache_ttl", 0));
   parseScrapeResults(sr, result);
 
   return result;
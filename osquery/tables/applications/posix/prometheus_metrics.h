@@ -46,11 +46,14 @@ void parseScrapeResults(
  * @brief Scrapes the Prometheus targets and returns response payload and
  * timestamp.
  *
+ * Targets are scraped concurrently by a bounded number of workers.
+ *
  * @param scrapeResults map where the key is the target url to be scraped and
  * value is the struct PrometheusResponseData where payload and timestamp are to
  * be written to.
+ * @param ttl seconds a successful scrape is reused for, 0 always scrapes.
  */
-void scrapeTargets(
-    std::map<std::string, PrometheusResponseData>& scrapeResults);
+void scrapeTargets(std::map<std::string, PrometheusResponseData>& scrapeResults,
+                   size_t ttl = 0);
 }
 }
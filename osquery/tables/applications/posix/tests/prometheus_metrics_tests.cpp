@@ -103,6 +103,32 @@ TEST_F(PrometheusMetricsTest, happy_path_extra_spaces_lines) {
   validate(sr, expected);
 }
 
+TEST_F(PrometheusMetricsTest, happy_path_labels_and_timestamps) {
+  // Initialize stubbed scrape results.
+  std::chrono::milliseconds now(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()));
+  std::string name =
+      "http_requests_total{method=\"post\",path=\"a \\\"b\\\"\"}";
+  PrometheusResponseData r0 = PrometheusResponseData{
+      name + " 1027 1395066363000\r\nhttp_requests_sum 3", now};
+  std::map<std::string, PrometheusResponseData> sr = {{"example1.com", r0}};
+
+  // Label values may contain spaces, the sample timestamp is not reported.
+  QueryData expected = {
+      {{kColTargetName, "example1.com"},
+       {kColMetric, name},
+       {kColValue, "1027"},
+       {kColTimeStamp, std::to_string(now.count())}},
+      {{kColTargetName, "example1.com"},
+       {kColMetric, "http_requests_sum"},
+       {kColValue, "3"},
+       {kColTimeStamp, std::to_string(now.count())}},
+  };
+
+  validate(sr, expected);
+}
+
 TEST_F(PrometheusMetricsTest, happy_path_10_metrics_1_target) {
   // Initialize stubbed scrape results.
   std::chrono::milliseconds now(
@@ -0,0 +1,332 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+#include <osquery/system.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/process.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+/// Heap allocations made by the process, see the operator new below.
+static std::atomic<size_t> kAllocations{0};
+
+/// Bytes requested by the heap allocations.
+static std::atomic<size_t> kAllocatedBytes{0};
+}
+
+void* operator new(size_t size) {
+  osquery::kAllocations++;
+  osquery::kAllocatedBytes += size;
+  auto memory = malloc((size > 0) ? size : 1);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+namespace osquery {
+
+DECLARE_string(host_root);
+DECLARE_uint64(read_max);
+DECLARE_uint64(read_user_max);
+DECLARE_bool(packages_cache);
+DECLARE_bool(sockets_netlink);
+
+/**
+ * @brief Environment variable naming a recorded fixture root.
+ *
+ * The root is an unpacked capture of a host's /proc, /sys, /etc, and package
+ * databases, such as the tarballs attached to a performance report. Without
+ * it the recorded benchmarks are skipped.
+ */
+const std::string kBenchmarkRootEnv = "OSQUERY_BENCHMARK_ROOT";
+
+/// Tables reading their content below --host_root.
+const std::vector<std::string> kHostTables = {
+    "processes",
+    "process_open_files",
+    "process_open_sockets",
+    "cpu_time",
+    "memory_info",
+    "kernel_modules",
+    "etc_hosts",
+    "etc_services",
+    "etc_protocols",
+    "deb_packages",
+    "rpm_packages",
+    "rpm_package_files",
+};
+
+/// Processes each synthetic socket fixture's sockets are opened by.
+const size_t kSocketFixtureProcesses = 1000;
+
+/// Write a fixture file readable after the tables drop privileges.
+static void writeFixture(const fs::path& path, const std::string& content) {
+  fs::create_directories(path.parent_path());
+  writeTextFile(path, content, 0644);
+}
+
+/// Write the /proc files of a process, with one socket descriptor.
+static void writeFixtureProcess(const fs::path& proc, size_t pid) {
+  auto id = std::to_string(pid);
+  auto path = proc / id;
+  writeFixture(path / "stat",
+               id + " (synthetic" + id + ") S 1 " + id + " " + id +
+                   " 0 -1 4194560 1000 0 0 0 12 3 0 0 20 0 1 0 " +
+                   std::to_string(1000 + pid) + " 10485760 512 0\n");
+  writeFixture(path / "status",
+               "Name:\tsynthetic" + id + "\nState:\tS (sleeping)\nPid:\t" +
+                   id + "\nPPid:\t1\nUid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\n"
+                        "VmSize:\t   10240 kB\nVmRSS:\t    2048 kB\n"
+                        "Threads:\t1\n");
+  writeFixture(path / "cmdline",
+               std::string("/usr/sbin/synthetic\0--id\0", 25) + id + '\0');
+  writeFixture(path / "environ",
+               std::string("PATH=/usr/bin:/bin\0HOME=/\0", 26) + "ID=" + id +
+                   '\0');
+
+  boost::system::error_code ec;
+  fs::create_symlink("/usr/sbin/synthetic", path / "exe", ec);
+  fs::create_symlink("/", path / "cwd", ec);
+  fs::create_symlink("/", path / "root", ec);
+  fs::create_directories(path / "fd");
+  fs::create_symlink("/dev/null", path / "fd" / "0", ec);
+  fs::create_symlink("socket:[" + std::to_string(100000 + pid) + "]",
+                     path / "fd" / "3",
+                     ec);
+}
+
+/// The system files read by the tables without a scaled fixture.
+static void writeFixtureSystem(const fs::path& root) {
+  writeFixture(root / "proc" / "stat",
+               "cpu  100 0 50 1000 10 0 5 0 0 0\n"
+               "cpu0 100 0 50 1000 10 0 5 0 0 0\n"
+               "intr 0\nctxt 1000\nbtime 1000000000\n");
+  writeFixture(root / "proc" / "meminfo",
+               "MemTotal:        8000000 kB\nMemFree:         4000000 kB\n"
+               "Buffers:          100000 kB\nCached:          1000000 kB\n"
+               "SwapCached:            0 kB\nActive:          2000000 kB\n"
+               "Inactive:        1000000 kB\nSwapTotal:       1000000 kB\n"
+               "SwapFree:        1000000 kB\n");
+  writeFixture(root / "proc" / "modules",
+               "synthetic 16384 0 - Live 0x0000000000000000\n");
+  writeFixture(root / "etc" / "hosts",
+               "127.0.0.1 localhost\n::1 localhost ip6-localhost\n");
+  writeFixture(root / "etc" / "services",
+               "ssh 22/tcp # SSH Remote Login Protocol\n");
+  writeFixture(root / "etc" / "protocols", "tcp 6 TCP # comment\n");
+}
+
+/**
+ * @brief Create, once, a synthetic host with a scaled fixture.
+ *
+ * The fixture is "processes", "sockets", or "packages": the number of process
+ * directories in /proc, of TCP sockets in /proc/net/tcp, or of packages in
+ * the dpkg status database.
+ */
+static std::string getSyntheticRoot(const std::string& fixture, size_t count) {
+  static std::map<std::string, std::string> roots;
+  auto name = fixture + "-" + std::to_string(count);
+  if (roots.count(name) > 0) {
+    return roots.at(name);
+  }
+
+  auto root = fs::path(kTestWorkingDirectory) / "tables-benchmark" / name;
+  fs::remove_all(root);
+  writeFixtureSystem(root);
+
+  auto proc = root / "proc";
+  if (fixture == "processes") {
+    for (size_t pid = 1; pid <= count; pid++) {
+      writeFixtureProcess(proc, pid);
+    }
+  } else if (fixture == "sockets") {
+    for (size_t pid = 1; pid <= kSocketFixtureProcesses; pid++) {
+      writeFixtureProcess(proc, pid);
+    }
+
+    // Sockets are listening, or connected to one of the listening ports.
+    std::string content =
+        "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when "
+        "retrnsmt   uid  timeout inode\n";
+    char line[256] = {0};
+    for (size_t i = 0; i < count; i++) {
+      auto port = static_cast<unsigned int>(1024 + i % 60000);
+      snprintf(line,
+               sizeof(line),
+               "%6zu: 0100007F:%04X %08X:%04X %s 00000000:00000000 "
+               "00:00000000 00000000     0        0 %zu 1 0000000000000000 "
+               "100 0 0 10 0\n",
+               i,
+               port,
+               (i % 2 == 0) ? 0U : 0x0100007FU,
+               (i % 2 == 0) ? 0U : 1024 + (port + 1) % 60000,
+               (i % 2 == 0) ? "0A" : "01",
+               100001 + i);
+      content += line;
+    }
+    writeFixture(proc / "net" / "tcp", content);
+  } else if (fixture == "packages") {
+    std::string content;
+    for (size_t i = 0; i < count; i++) {
+      auto id = std::to_string(i);
+      content += "Package: synthetic-" + id +
+                 "\nStatus: install ok installed\nPriority: optional\n"
+                 "Section: misc\nInstalled-Size: " +
+                 std::to_string(i % 1000 + 1) +
+                 "\nMaintainer: osquery <osquery@example.com>\n"
+                 "Architecture: amd64\nSource: synthetic\nVersion: 1." +
+                 id + "-1\nDescription: Synthetic package " + id + "\n\n";
+    }
+    auto dpkg = root / "var" / "lib" / "dpkg";
+    writeFixture(dpkg / "status", content);
+    fs::create_directories(dpkg / "updates");
+    fs::create_directories(dpkg / "info");
+    fs::create_directories(dpkg / "triggers");
+  }
+
+  roots[name] = root.string();
+  return roots.at(name);
+}
+
+/**
+ * @brief Generate a table below a root once per iteration.
+ *
+ * The label reports the rows generated, and the time, heap allocations, and
+ * allocated bytes of each row. Allocations made by C libraries with malloc,
+ * such as libdpkg and librpm, are not counted.
+ */
+static void benchmarkTable(benchmark::State& state,
+                           const std::string& table,
+                           const std::string& root) {
+  auto plugin =
+      RegistryFactory::get().localPlugin<TablePlugin>("table", table);
+  if (plugin == nullptr) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  auto host_root = FLAGS_host_root;
+  auto read_max = FLAGS_read_max;
+  auto read_user_max = FLAGS_read_user_max;
+  auto packages_cache = FLAGS_packages_cache;
+  auto sockets_netlink = FLAGS_sockets_netlink;
+  FLAGS_host_root = root;
+  // Scaled fixtures are larger than the default read limits.
+  FLAGS_read_max = 1024 * 1024 * 1024;
+  FLAGS_read_user_max = FLAGS_read_max;
+  // Packages are parsed every iteration, and sockets read from the root.
+  FLAGS_packages_cache = false;
+  FLAGS_sockets_netlink = false;
+
+  size_t rows = 0;
+  auto allocations = kAllocations.load();
+  auto bytes = kAllocatedBytes.load();
+  auto start = std::chrono::steady_clock::now();
+  while (state.KeepRunning()) {
+    QueryContext context;
+    rows += plugin->generate(context).size();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  allocations = kAllocations - allocations;
+  bytes = kAllocatedBytes - bytes;
+
+  FLAGS_host_root = host_root;
+  FLAGS_read_max = read_max;
+  FLAGS_read_user_max = read_user_max;
+  FLAGS_packages_cache = packages_cache;
+  FLAGS_sockets_netlink = sockets_netlink;
+
+  double iterations = (state.iterations() > 0) ? state.iterations() : 1;
+  double per_row = (rows > 0) ? rows : 1;
+  state.SetLabel(table + " rows=" + std::to_string(rows / iterations) +
+                 " ns/row=" + std::to_string(elapsed.count() / per_row) +
+                 " allocs/row=" + std::to_string(allocations / per_row) +
+                 " bytes/row=" + std::to_string(bytes / per_row));
+  state.SetItemsProcessed(rows);
+}
+
+static void TABLES_processes(benchmark::State& state) {
+  auto root = getSyntheticRoot("processes", state.range_x());
+  benchmarkTable(state, "processes", root);
+}
+
+BENCHMARK(TABLES_processes)->Arg(1000)->Arg(10000);
+
+static void TABLES_process_open_files(benchmark::State& state) {
+  auto root = getSyntheticRoot("processes", state.range_x());
+  benchmarkTable(state, "process_open_files", root);
+}
+
+BENCHMARK(TABLES_process_open_files)->Arg(1000)->Arg(10000);
+
+static void TABLES_process_open_sockets(benchmark::State& state) {
+  auto root = getSyntheticRoot("sockets", state.range_x());
+  benchmarkTable(state, "process_open_sockets", root);
+}
+
+BENCHMARK(TABLES_process_open_sockets)->Arg(10000)->Arg(1000000);
+
+static void TABLES_deb_packages(benchmark::State& state) {
+  auto root = getSyntheticRoot("packages", state.range_x());
+  benchmarkTable(state, "deb_packages", root);
+}
+
+BENCHMARK(TABLES_deb_packages)->Arg(1000)->Arg(100000);
+
+/// Register a benchmark argument for every table, if a root is recorded.
+static void genRecordedArgs(benchmark::internal::Benchmark* b) {
+  if (!getEnvVar(kBenchmarkRootEnv).is_initialized()) {
+    return;
+  }
+
+  for (size_t i = 0; i < kHostTables.size(); i++) {
+    b->Arg(static_cast<int>(i));
+  }
+}
+
+/// Generate a table below the recorded fixture root.
+static void TABLES_recorded(benchmark::State& state) {
+  auto root = getEnvVar(kBenchmarkRootEnv);
+  if (!root.is_initialized() ||
+      static_cast<size_t>(state.range_x()) >= kHostTables.size()) {
+    while (state.KeepRunning()) {
+    }
+    return;
+  }
+
+  benchmarkTable(state, kHostTables.at(state.range_x()), *root);
+}
+
+BENCHMARK(TABLES_recorded)->Apply(genRecordedArgs);
+}
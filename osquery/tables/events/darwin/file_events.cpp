@@ -14,6 +14,7 @@
 #include <osquery/core.h>
 #include <osquery/config.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/tables.h>
 
 #include "osquery/events/darwin/fsevents.h"
@@ -81,6 +82,11 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
     return Status(0);
   }
 
+  if (sc->category == kDiscoveryFileCategory) {
+    // A watched path changed, such as a package install, check pack discovery.
+    Pack::invalidateDiscovery();
+  }
+
   Row r;
   r["action"] = ec->action;
   r["target_path"] = ec->path;
@@ -88,10 +94,10 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
   r["transaction_id"] = INTEGER(ec->transaction_id);
 
   // Add hashing and 'join' against the file table for stat-information.
-  decorateFileEvent(
-      ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
-
-  add(r);
+  addFileEvent(ec->path,
+               (ec->action == "CREATED" || ec->action == "UPDATED"),
+               std::move(r),
+               [this](std::vector<Row>& rows) { addBatch(rows); });
   return Status(0, "OK");
 }
 }
@@ -8,7 +8,10 @@
  *
  */
 
+#include <algorithm>
+
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 
 #include "osquery/tables/events/event_utils.h"
@@ -16,10 +19,102 @@
 
 namespace osquery {
 
+FLAG(uint64,
+     file_events_hash_delay,
+     0,
+     "Milliseconds a changed file must be quiet before it is hashed in a "
+     "service (0 = hash in the event callback)");
+
+FLAG(uint64,
+     file_events_hash_rate,
+     0,
+     "Max bytes per second hashed by the file events service (0 = unlimited)");
+
 const std::set<std::string> kCommonFileColumns = {
     "inode", "uid", "gid", "mode", "size", "atime", "mtime", "ctime",
 };
 
+/// The maximum number of paths with remembered hashes.
+const size_t kMaxFileHashCache = 4096;
+
+/// Hashes of a path, and the file state they were computed for.
+struct FileHashCacheEntry {
+  std::string state;
+  std::string md5;
+  std::string sha1;
+  std::string sha256;
+};
+
+/// The last hashes of each path.
+static std::map<std::string, FileHashCacheEntry> kFileHashCache;
+
+/// Protect the remembered hashes.
+static Mutex kFileHashCacheMutex;
+
+/// The hashing service, started on first use.
+static std::shared_ptr<FileHashRunner> kFileHashRunner{nullptr};
+
+/// Protect the hashing service.
+static Mutex kFileHashRunnerMutex;
+
+/**
+ * @brief Identify a file's content, empty if not known.
+ *
+ * The modification and change times are compared to the nanosecond, a file
+ * rewritten with the same size within a second is hashed again. Platforms
+ * without a stat use the decorated columns.
+ */
+static std::string getFileState(const std::string& path, const Row& r) {
+  std::string key;
+  std::string version;
+  if (getFileCacheIdentity(path, key, version)) {
+    return key + ":" + version;
+  }
+
+  std::string state;
+  for (const auto& column : {"inode", "size", "mtime", "ctime"}) {
+    auto value = r.find(column);
+    if (value == r.end()) {
+      return "";
+    }
+    state += value->second + ":";
+  }
+  return state;
+}
+
+static void hashFileEvent(const std::string& path, Row& r) {
+  // The state is read before the content, a change while hashing is seen by
+  // the next event.
+  auto state = getFileState(path, r);
+  if (!state.empty()) {
+    WriteLock lock(kFileHashCacheMutex);
+    auto cached = kFileHashCache.find(path);
+    if (cached != kFileHashCache.end() && cached->second.state == state) {
+      r["md5"] = cached->second.md5;
+      r["sha1"] = cached->second.sha1;
+      r["sha256"] = cached->second.sha256;
+      r["hashed"] = "1";
+      return;
+    }
+  }
+
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  // Hashed determines the success/status of hashing, -1 failed, 1 success.
+  r["hashed"] = (hashes.md5.empty()) ? "-1" : "1";
+  if (!state.empty() && !hashes.md5.empty()) {
+    WriteLock lock(kFileHashCacheMutex);
+    if (kFileHashCache.size() >= kMaxFileHashCache &&
+        kFileHashCache.count(path) == 0) {
+      kFileHashCache.clear();
+    }
+    kFileHashCache[path] = {state, hashes.md5, hashes.sha1, hashes.sha256};
+  }
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
+}
+
 void decorateFileEvent(const std::string& path, bool hash, Row& r) {
   auto results = SQL::selectAllFrom("file", "path", EQUALS, path);
   if (results.size() == 1) {
@@ -32,16 +127,143 @@ void decorateFileEvent(const std::string& path, bool hash, Row& r) {
   }
 
   if (hash) {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    // Hashed determines the success/status of hashing, -1 failed, 1 success.
-    r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
+    hashFileEvent(path, r);
   } else {
     // Alternatively if hashing wasn't needed hashed is a 0.
     r["hashed"] = "0";
   }
 }
+
+void addFileEvent(const std::string& path,
+                  bool hash,
+                  Row r,
+                  const FileEventAdd& add) {
+  if (hash && FLAGS_file_events_hash_delay > 0) {
+    // The event time is kept, the row is added after hashing.
+    r["time"] = std::to_string(getUnixTime());
+    std::shared_ptr<FileHashRunner> runner;
+    {
+      WriteLock lock(kFileHashRunnerMutex);
+      if (kFileHashRunner == nullptr) {
+        kFileHashRunner = std::make_shared<FileHashRunner>(
+            std::chrono::milliseconds(FLAGS_file_events_hash_delay));
+        Dispatcher::addService(kFileHashRunner);
+      }
+      runner = kFileHashRunner;
+    }
+
+    if (runner->push(path, r, add)) {
+      return;
+    }
+    // The service stopped, hash in the event callback.
+  }
+
+  decorateFileEvent(path, hash, r);
+  std::vector<Row> rows = {std::move(r)};
+  add(rows);
+}
+
+bool FileHashRunner::push(const std::string& path,
+                          Row& r,
+                          const FileEventAdd& add) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return false;
+    }
+    auto& pending = pending_[path];
+    // Each event for the path restarts its quiet period.
+    pending.due = std::chrono::steady_clock::now() + delay_;
+    pending.rows.push_back(std::move(r));
+    pending.add = add;
+  }
+  cv_.notify_one();
+  return true;
+}
+
+void FileHashRunner::hash(const std::string& path,
+                          Pending& pending,
+                          bool limit) {
+  Row decorations;
+  decorateFileEvent(path, false, decorations);
+
+  if (limit && FLAGS_file_events_hash_rate > 0) {
+    // Wait until the rate allows the file's bytes to be read.
+    double rate = static_cast<double>(FLAGS_file_events_hash_rate);
+    double size = 0;
+    if (decorations.count("size") > 0) {
+      size = std::strtod(decorations.at("size").c_str(), nullptr);
+    }
+    while (!interrupted()) {
+      auto now = std::chrono::steady_clock::now();
+      std::chrono::duration<double> elapsed = now - refilled_;
+      refilled_ = now;
+      tokens_ = std::min(rate, tokens_ + elapsed.count() * rate);
+      // A file larger than a second of hashing waits for a full bucket.
+      if (tokens_ >= std::min(size, rate)) {
+        tokens_ -= std::min(size, rate);
+        break;
+      }
+      pauseMilli(static_cast<size_t>(
+          (std::min(size, rate) - tokens_) / rate * 1000 + 1));
+    }
+  }
+
+  hashFileEvent(path, decorations);
+  for (auto& row : pending.rows) {
+    for (const auto& column : decorations) {
+      row[column.first] = column.second;
+    }
+  }
+  pending.add(pending.rows);
+}
+
+void FileHashRunner::start() {
+  refilled_ = std::chrono::steady_clock::now();
+  tokens_ = static_cast<double>(FLAGS_file_events_hash_rate);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    if (pending_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+
+    // Find the path that has been quiet the longest.
+    auto next = pending_.begin();
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+      if (it->second.due < next->second.due) {
+        next = it;
+      }
+    }
+
+    if (next->second.due > std::chrono::steady_clock::now()) {
+      cv_.wait_until(lock, next->second.due);
+      continue;
+    }
+
+    auto path = next->first;
+    auto pending = std::move(next->second);
+    pending_.erase(next);
+    lock.unlock();
+    hash(path, pending, true);
+    lock.lock();
+  }
+
+  // Rows held when the service stops are hashed without waiting.
+  auto remaining = std::move(pending_);
+  pending_.clear();
+  lock.unlock();
+  for (auto& pending : remaining) {
+    hash(pending.first, pending.second, false);
+  }
+}
+
+void FileHashRunner::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+}
 }
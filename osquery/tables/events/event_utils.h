@@ -10,9 +10,16 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
+#include <osquery/dispatcher.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -20,15 +27,84 @@ namespace osquery {
 /// List of columns decorated for file events.
 extern const std::set<std::string> kCommonFileColumns;
 
+/// A subscriber's callable storing decorated file event rows.
+using FileEventAdd = std::function<void(std::vector<Row>& rows)>;
+
 /**
  * @brief A helper function for each platform's implementation of file_events.
  *
  * Given an action and path, this Row decorator assures a common implementation
  * of hashing and common columns from the `file` table.
  *
+ * A path is not read again if its device, inode, size, and nanosecond mtime
+ * and ctime match the last time it was hashed.
+ *
  * @param path The target path from the file event.
  * @param hash Should the target path be read and hashed.
  * @param r The output parameter row structure.
  */
 void decorateFileEvent(const std::string& path, bool hash, Row& r);
+
+/**
+ * @brief Decorate a file event row and store it using the subscriber's add.
+ *
+ * Without --file_events_hash_delay this is decorateFileEvent followed by add.
+ * Otherwise, rows needing a hash are given to a FileHashRunner service. Rows
+ * for a path are held until the path has no new events for the delay, then
+ * the path is hashed once and every held row is added with the hashes.
+ *
+ * @param path The target path from the file event.
+ * @param hash Should the target path be read and hashed.
+ * @param r The row, with the event's columns set.
+ * @param add The subscriber's callable for storing rows.
+ */
+void addFileEvent(const std::string& path,
+                  bool hash,
+                  Row r,
+                  const FileEventAdd& add);
+
+/**
+ * @brief A service hashing the targets of file events.
+ *
+ * A path's rows are hashed and added after the path is quiet for the delay,
+ * and the bytes hashed each second are limited by --file_events_hash_rate.
+ */
+class FileHashRunner : public InternalRunnable {
+ public:
+  explicit FileHashRunner(std::chrono::milliseconds delay) : delay_(delay) {}
+
+  /// Hold a row until its path is quiet, false if the service stopped.
+  bool push(const std::string& path, Row& r, const FileEventAdd& add);
+
+  /// Hash and add rows as their paths become quiet.
+  void start() override;
+
+  /// Wake the service, held rows are hashed and added before it stops.
+  void stop() override;
+
+ private:
+  /// Rows held for one path.
+  struct Pending {
+    std::chrono::steady_clock::time_point due;
+    std::vector<Row> rows;
+    FileEventAdd add;
+  };
+
+  /// Hash a path's rows and add them.
+  void hash(const std::string& path, Pending& pending, bool limit);
+
+ private:
+  std::chrono::milliseconds delay_;
+
+  /// Held rows, by path.
+  std::map<std::string, Pending> pending_;
+
+  /// Bytes that may be hashed before waiting, and the last refill time.
+  double tokens_{0};
+  std::chrono::steady_clock::time_point refilled_;
+
+  bool stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
 }
@@ -14,13 +14,17 @@
 #include <osquery/core.h>
 #include <osquery/config.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/linux/fanotify.h"
 #include "osquery/events/linux/inotify.h"
 #include "osquery/tables/events/event_utils.h"
 
 namespace osquery {
 
+DECLARE_bool(file_events_fanotify);
+
 /**
  * @brief Track time, action changes to /etc/passwd
  *
@@ -35,6 +39,13 @@ class FileEventSubscriber : public EventSubscriber<INotifyEventPublisher> {
   /// Walk the configuration's file paths, create subscriptions.
   void configure() override;
 
+  /// Subscribe to the fanotify publisher if --file_events_fanotify is set.
+  EventPublisherID& getType() const override {
+    static EventPublisherID inotify = "inotify";
+    static EventPublisherID fanotify = "fanotify";
+    return (FLAGS_file_events_fanotify) ? fanotify : inotify;
+  }
+
   /**
    * @brief This exports a single Callback for INotifyEventPublisher events.
    *
@@ -85,24 +96,27 @@ Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
     return Status(0);
   }
 
+  if (sc->category == kDiscoveryFileCategory) {
+    // A watched path changed, such as a package install, check pack discovery.
+    Pack::invalidateDiscovery();
+  }
+
   Row r;
   r["action"] = ec->action;
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->event->cookie);
 
-  if ((sc->mask & kFileAccessMasks) != kFileAccessMasks) {
-    // Add hashing and 'join' against the file table for stat-information.
-    decorateFileEvent(
-        ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
-  } else {
-    // The access event on Linux would generate additional events if hashed.
-    decorateFileEvent(ec->path, false, r);
-  }
+  // Add hashing and 'join' against the file table for stat-information.
+  // The access event on Linux would generate additional events if hashed.
+  bool hash = (sc->mask & kFileAccessMasks) != kFileAccessMasks &&
+              (ec->action == "CREATED" || ec->action == "UPDATED");
 
   // A callback is somewhat useless unless it changes the EventSubscriber
   // state or calls `add` to store a marked up event.
-  add(r);
+  addFileEvent(ec->path, hash, std::move(r), [this](std::vector<Row>& rows) {
+    addBatch(rows);
+  });
   return Status(0, "OK");
 }
 }
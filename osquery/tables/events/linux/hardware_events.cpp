@@ -16,6 +16,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/hardware_inventory.h"
 
 namespace osquery {
 
@@ -40,6 +41,10 @@ Status HardwareEventSubscriber::init() {
 }
 
 Status HardwareEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  // Keep the hardware inventory tables current, such as block_devices.
+  tables::updateHardwareInventory(
+      ec->action_string, ec->subsystem, ec->syspath);
+
   Row r;
 
   if (ec->devtype.empty()) {
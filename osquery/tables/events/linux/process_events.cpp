@@ -8,7 +8,10 @@
  *
  */
 
+#include <mutex>
+
 #include <osquery/config.h>
+#include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
@@ -19,9 +22,20 @@ namespace osquery {
 
 #define AUDIT_SYSCALL_EXECVE 59
 
-// Depend on the external getUptime table method.
+FLAG(uint64,
+     audit_process_events_batch,
+     64,
+     "Max number of process events buffered and written together");
+
+FLAG(string,
+     audit_process_filter,
+     "",
+     "Audit rule field comparisons added to the execve rule (auid>=1000)");
+
+// Depend on the external getUptime and process metadata table methods.
 namespace tables {
 extern long getUptime();
+extern void invalidateProcessMetadata(const std::string& pid);
 }
 
 bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
@@ -95,20 +109,65 @@ class ProcessEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
+  /// Write buffered rows before the table is generated.
+  QueryData genTable(QueryContext& context) override;
+
+  /// Write buffered rows, when events end or their time passed.
+  void flushBuffered() override;
+
  private:
-  AuditAssembler asm_;
+  /// Write all buffered rows as a single batch, the caller must lock.
+  void flush();
+
+ private:
+  ShardedAuditAssembler asm_;
+
+  /// Completed rows waiting to be written.
+  std::vector<Row> batch_;
+
+  /// The time the first buffered row was completed.
+  size_t batch_time_{0};
+
+  /// Protect the buffered rows from concurrent callbacks and queries.
+  Mutex batch_mutex_;
 };
 
 REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
 
+/// Write the rows buffered by process_events when no later event does.
+class ProcessEventsFlushRunner : public PeriodicRunnable {
+ public:
+  bool run() override {
+    auto subscriber = EventFactory::getEventSubscriber("process_events");
+    if (subscriber == nullptr) {
+      return false;
+    }
+    subscriber->flushBuffered();
+    return true;
+  }
+
+  std::chrono::milliseconds interval() override {
+    return std::chrono::milliseconds(1000);
+  }
+};
+
 Status ProcessEventSubscriber::init() {
+  if (FLAGS_audit_process_events_batch > 1) {
+    static std::once_flag flush_runner;
+    std::call_once(flush_runner, []() {
+      Dispatcher::addPeriodicService(
+          std::make_shared<ProcessEventsFlushRunner>());
+    });
+  }
+
+
   asm_.start(
       20, {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD}, &ProcessUpdate);
 
   auto sc = createSubscriptionContext();
 
   // Monitor for execve syscalls.
-  sc->rules.push_back({AUDIT_SYSCALL_EXECVE, ""});
+  sc->rules.push_back({AUDIT_SYSCALL_EXECVE, FLAGS_audit_process_filter});
 
   // Request call backs for all parts of the process execution state.
   // Drop events if they are encountered outside of the expected state.
@@ -130,11 +189,52 @@ Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
     return Status(0, "OK");
   }
 
-  auto fields = asm_.add(ec->auid, ec->type, ec->fields);
-  if (fields.is_initialized()) {
+  auto fields = asm_.shard(ec->shard).add(ec->auid, ec->type, ec->fields);
+  if (!fields.is_initialized()) {
+    return Status(0, "OK");
+  }
+
+  // The process exec'd, its cached processes metadata is stale.
+  if (fields->count("pid") > 0) {
+    tables::invalidateProcessMetadata(fields->at("pid"));
+  }
+
+  if (FLAGS_audit_process_events_batch <= 1) {
     add(*fields);
+    return Status(0, "OK");
+  }
+
+  // Buffer a burst of executions and write them together.
+  // The batch is written when it is full or after a second has passed, by
+  // a later execution or the flush service.
+  auto now = getUnixTime();
+  WriteLock lock(batch_mutex_);
+  if (batch_.empty()) {
+    batch_time_ = now;
+  }
+  (*fields)["time"] = std::to_string(now);
+  batch_.push_back(std::move(*fields));
+  if (batch_.size() >= FLAGS_audit_process_events_batch || now > batch_time_) {
+    flush();
   }
 
   return Status(0, "OK");
 }
+
+void ProcessEventSubscriber::flush() {
+  if (!batch_.empty()) {
+    addBatch(batch_);
+    batch_.clear();
+  }
+}
+
+void ProcessEventSubscriber::flushBuffered() {
+  WriteLock lock(batch_mutex_);
+  flush();
+}
+
+QueryData ProcessEventSubscriber::genTable(QueryContext& context) {
+  flushBuffered();
+  return EventSubscriberPlugin::genTable(context);
+}
 }
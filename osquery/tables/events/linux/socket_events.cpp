@@ -28,6 +28,11 @@ FLAG(bool,
      false,
      "Allow the audit publisher to install socket-related rules");
 
+FLAG(string,
+     audit_socket_filter,
+     "",
+     "Audit rule field comparisons added to the bind and connect rules");
+
 // Depend on the external getUptime table method.
 namespace tables {
 extern long getUptime();
@@ -50,7 +55,7 @@ class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   Status Callback(const ECRef& ec, const SCRef& sc);
 
  private:
-  AuditAssembler asm_;
+  ShardedAuditAssembler asm_;
 };
 
 REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
@@ -140,8 +145,8 @@ Status SocketEventSubscriber::init() {
   auto sc = createSubscriptionContext();
 
   // Monitor for bind and connect syscalls.
-  sc->rules.push_back({AUDIT_SYSCALL_BIND, ""});
-  sc->rules.push_back({AUDIT_SYSCALL_CONNECT, ""});
+  sc->rules.push_back({AUDIT_SYSCALL_BIND, FLAGS_audit_socket_filter});
+  sc->rules.push_back({AUDIT_SYSCALL_CONNECT, FLAGS_audit_socket_filter});
   // Also grab SADDR structures
   sc->types.insert(AUDIT_TYPE_SOCKADDR);
 
@@ -162,11 +167,12 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
     return Status(0);
   }
 
-  auto fields = asm_.add(ec->auid, ec->type, ec->fields);
+  auto& assembler = asm_.shard(ec->shard);
+  auto fields = assembler.add(ec->auid, ec->type, ec->fields);
   if (ec->syscall == AUDIT_SYSCALL_CONNECT) {
-    asm_.set(ec->auid, "action", "connect");
+    assembler.set(ec->auid, "action", "connect");
   } else if (ec->syscall == AUDIT_SYSCALL_BIND) {
-    asm_.set(ec->auid, "action", "bind");
+    assembler.set(ec->auid, "action", "bind");
   }
 
   if (fields.is_initialized()) {
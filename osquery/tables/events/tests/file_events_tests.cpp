@@ -8,10 +8,15 @@
  *
  */
 
+#include <chrono>
+#include <fstream>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/config.h>
 #include <osquery/events.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
@@ -119,4 +124,51 @@ TEST_F(FileEventsTableTests, test_configure_subscriptions) {
   }
 }
 #endif
+
+TEST_F(FileEventsTableTests, test_file_event_hashes) {
+  auto path = kTestWorkingDirectory + "file-events-hash";
+  writeTextFile(path, "first");
+
+  Row r;
+  decorateFileEvent(path, true, r);
+  EXPECT_EQ(r["hashed"], "1");
+  auto first = r["sha256"];
+  EXPECT_FALSE(first.empty());
+
+  // A file in the same state reuses the remembered hashes.
+  Row again;
+  decorateFileEvent(path, true, again);
+  EXPECT_EQ(again["sha256"], first);
+
+  // New content changes the size, the file is read again.
+  writeTextFile(path, "second content");
+  Row changed;
+  decorateFileEvent(path, true, changed);
+  EXPECT_EQ(changed["hashed"], "1");
+  EXPECT_NE(changed["sha256"], first);
+
+  // Content rewritten with the same size, within the same second, is read
+  // again. Timestamps are compared to the nanosecond, the kernel's clock for
+  // them is coarse.
+#ifndef WIN32
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file << "SECOND";
+  }
+  Row rewritten;
+  decorateFileEvent(path, true, rewritten);
+  EXPECT_EQ(rewritten["hashed"], "1");
+  EXPECT_NE(rewritten["sha256"], changed["sha256"]);
+#endif
+
+  // Without a hash delay the row is decorated and added immediately.
+  std::vector<Row> added;
+  auto add = [&added](std::vector<Row>& rows) { added = rows; };
+  addFileEvent(path, false, {{"action", "UPDATED"}}, add);
+  ASSERT_EQ(added.size(), 1U);
+  EXPECT_EQ(added[0]["hashed"], "0");
+  EXPECT_EQ(added[0]["action"], "UPDATED");
+  remove(path);
+}
 }
@@ -72,17 +72,14 @@ Status WindowsEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   FILETIME cTime;
   GetSystemTimeAsFileTime(&cTime);
   r["time"] = BIGINT(filetimeToUnixtime(cTime));
-  r["datetime"] =
-      ec->eventRecord.get("Event.System.TimeCreated.<xmlattr>.SystemTime", "");
-  r["source"] = ec->eventRecord.get("Event.System.Channel", "");
-  r["provider_name"] =
-      ec->eventRecord.get("Event.System.Provider.<xmlattr>.Name", "");
-  r["provider_guid"] =
-      ec->eventRecord.get("Event.System.Provider.<xmlattr>.Guid", "");
-  r["eventid"] = INTEGER(ec->eventRecord.get("Event.System.EventID", -1));
-  r["task"] = INTEGER(ec->eventRecord.get("Event.System.Task", -1));
-  r["level"] = INTEGER(ec->eventRecord.get("Event.System.Level", -1));
-  r["keywords"] = BIGINT(ec->eventRecord.get("Event.System.Keywords", -1));
+  r["datetime"] = ec->record.datetime;
+  r["source"] = ec->record.channel;
+  r["provider_name"] = ec->record.provider_name;
+  r["provider_guid"] = ec->record.provider_guid;
+  r["eventid"] = INTEGER(ec->record.eventid);
+  r["task"] = INTEGER(ec->record.task);
+  r["level"] = INTEGER(ec->record.level);
+  r["keywords"] = BIGINT(ec->record.keywords);
 
   /*
    * From the MSDN definition of the Event Schema, each event will have
@@ -94,11 +91,7 @@ Status WindowsEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   std::map<std::string, std::string> results;
   std::string eventDataType;
 
-  for (const auto& node : ec->eventRecord.get_child("Event", pt::ptree())) {
-    /// We have already processed the System event data above
-    if (node.first == "System" || node.first == "<xmlattr>") {
-      continue;
-    }
+  for (const auto& node : ec->eventData) {
     eventDataType = node.first;
     parseTree(node.second, results);
   }
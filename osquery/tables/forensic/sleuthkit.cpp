@@ -10,7 +10,9 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/filesystem.hpp>
 
@@ -63,19 +65,26 @@ class DeviceHelper : private boost::noncopyable {
       std::function<void(const std::string&, TskFsFile*, const std::string&)>
           predicate);
 
-  /// Provide a partition description for context and iterate from path.
+  /**
+   * @brief Provide a partition description for context and iterate from path.
+   *
+   * If prefixes are provided only files with a path starting with a prefix
+   * are yielded, and only directories that may contain them are walked. The
+   * prefixes are compared case-insensitively, like a SQL LIKE.
+   */
   void generateFiles(const std::string& partition,
                      TskFsInfo* fs,
                      const std::string& path,
-                     QueryData& results,
-                     TSK_INUM_T inode = 0);
+                     RowYield& yield,
+                     TSK_INUM_T inode = 0,
+                     const std::set<std::string>& prefixes = {});
 
-  /// Similar to generateFiles but only yield a row to results.
+  /// Similar to generateFiles but only yield a single row.
   void generateFile(const std::string& partition,
                     TskFsFile* file,
                     TskFsInfo* fs,
                     const std::string& path,
-                    QueryData& results);
+                    RowYield& yield);
 
   /// Volume accessor, used for computing offsets using block/sector size.
   const std::shared_ptr<TskVsInfo>& getVolume() { return volume_; }
@@ -163,7 +172,7 @@ void DeviceHelper::generateFile(const std::string& partition,
                                 TskFsFile* file,
                                 TskFsInfo* fs,
                                 const std::string& path,
-                                QueryData& results) {
+                                RowYield& yield) {
   Row r;
   r["device"] = device_path_;
   r["partition"] = partition;
@@ -192,70 +201,115 @@ void DeviceHelper::generateFile(const std::string& partition,
     }
     delete meta;
   }
-  results.push_back(r);
+  yield(r);
 }
 
-void DeviceHelper::generateFiles(const std::string& partition,
-                                 TskFsInfo* fs,
-                                 const std::string& path,
-                                 QueryData& results,
-                                 TSK_INUM_T inode) {
-  if (stack_++ > 1024) {
-    return;
+/// Check if a path starts with any prefix, an empty set matches every path.
+static bool matchesPrefix(const std::set<std::string>& prefixes,
+                          const std::string& path) {
+  if (prefixes.empty()) {
+    return true;
   }
 
-  auto* dir = new TskFsDir();
-  if (dir->open(fs, ((inode == 0) ? fs->getRootINum() : inode))) {
-    delete dir;
-    return;
+  for (const auto& prefix : prefixes) {
+    if (boost::istarts_with(path, prefix)) {
+      return true;
+    }
   }
+  return false;
+}
 
-  // Iterate through the directory.
-  std::map<TSK_INUM_T, std::string> additional;
-  for (size_t i = 0; i < dir->getSize(); i++) {
-    if (count_++ > 1024 * 10) {
-      break;
+/// Check if a directory may contain a path starting with any prefix.
+static bool containsPrefix(const std::set<std::string>& prefixes,
+                           const std::string& directory) {
+  if (prefixes.empty()) {
+    return true;
+  }
+
+  for (const auto& prefix : prefixes) {
+    if (boost::istarts_with(prefix, directory + "/") ||
+        boost::istarts_with(directory, prefix)) {
+      return true;
     }
+  }
+  return false;
+}
 
-    auto* file = dir->getFile(i);
-    if (file == nullptr) {
+void DeviceHelper::generateFiles(const std::string& partition,
+                                 TskFsInfo* fs,
+                                 const std::string& path,
+                                 RowYield& yield,
+                                 TSK_INUM_T inode,
+                                 const std::set<std::string>& prefixes) {
+  // Directories are walked depth-first from an explicit stack, the walk may
+  // run on the small stack of a table generator.
+  std::vector<std::pair<TSK_INUM_T, std::string>> pending = {{inode, path}};
+  while (!pending.empty()) {
+    auto directory = std::move(pending.back());
+    pending.pop_back();
+    if (loops_.count(directory.second) > 0) {
       continue;
     }
+    loops_.insert(directory.second);
 
-    // Failure to access the file's metadata information.
-    auto* meta = file->getMeta();
-    if (meta == nullptr) {
-      delete file;
-      continue;
+    if (stack_++ > 1024) {
+      return;
     }
 
-    std::string leaf;
-    auto* name = file->getName();
-    if (name != nullptr) {
-      leaf = (fs::path(path) / name->getName()).string();
+    auto* dir = new TskFsDir();
+    auto address = (directory.first == 0) ? fs->getRootINum() : directory.first;
+    if (dir->open(fs, address)) {
+      delete dir;
+      continue;
     }
 
-    if (meta->getType() == TSK_FS_META_TYPE_REG) {
-      generateFile(partition, file, fs, leaf, results);
-    } else if (meta->getType() == TSK_FS_META_TYPE_DIR) {
-      if (name != nullptr && !TSK_FS_ISDOT(name->getName())) {
-        additional[meta->getAddr()] = leaf;
+    // Iterate through the directory.
+    std::map<TSK_INUM_T, std::string> additional;
+    for (size_t i = 0; i < dir->getSize(); i++) {
+      if (count_++ > 1024 * 10) {
+        break;
+      }
+
+      auto* file = dir->getFile(i);
+      if (file == nullptr) {
+        continue;
       }
-    }
 
-    if (name != nullptr) {
-      delete name;
+      // Failure to access the file's metadata information.
+      auto* meta = file->getMeta();
+      if (meta == nullptr) {
+        delete file;
+        continue;
+      }
+
+      std::string leaf;
+      auto* name = file->getName();
+      if (name != nullptr) {
+        leaf = (fs::path(directory.second) / name->getName()).string();
+      }
+
+      if (meta->getType() == TSK_FS_META_TYPE_REG) {
+        if (matchesPrefix(prefixes, leaf)) {
+          generateFile(partition, file, fs, leaf, yield);
+        }
+      } else if (meta->getType() == TSK_FS_META_TYPE_DIR) {
+        if (name != nullptr && !TSK_FS_ISDOT(name->getName()) &&
+            containsPrefix(prefixes, leaf)) {
+          additional[meta->getAddr()] = leaf;
+        }
+      }
+
+      if (name != nullptr) {
+        delete name;
+      }
+      delete meta;
+      delete file;
     }
-    delete meta;
-    delete file;
-  }
-  delete dir;
+    delete dir;
 
-  // If we are recursing.
-  for (const auto& d : additional) {
-    if (std::find(loops_.begin(), loops_.end(), d.second) == loops_.end()) {
-      generateFiles(partition, fs, d.second, results, d.first);
-      loops_.insert(d.second);
+    // Walk the subdirectories in inode order.
+    for (auto d = additional.rbegin(); d != additional.rend(); ++d) {
+      pending.push_back(*d);
     }
   }
 }
@@ -362,9 +416,7 @@ QueryData genDeviceHash(QueryContext& context) {
   return results;
 }
 
-QueryData genDeviceFile(QueryContext& context) {
-  QueryData results;
-
+void genDeviceFile(RowYield& yield, QueryContext& context) {
   auto devices = context.constraints["device"].getAll(EQUALS);
   // This table requires two or more columns to determine an action.
   auto parts = context.constraints["partition"].getAll(EQUALS);
@@ -374,14 +426,26 @@ QueryData genDeviceFile(QueryContext& context) {
 
   if (devices.empty() || parts.size() != 1) {
     TLOG << "Device files require at least one device and a single partition";
-    return {};
+    return;
+  }
+
+  // The literal prefix of each path pattern limits the partition walk.
+  std::set<std::string> prefixes;
+  for (const auto& pattern : context.constraints["path"].getAll(LIKE)) {
+    auto prefix = pattern.substr(0, pattern.find_first_of("%_"));
+    if (prefix.empty()) {
+      // A pattern starting with a wildcard may match any path.
+      prefixes.clear();
+      break;
+    }
+    prefixes.insert(prefix);
   }
 
   for (const auto& dev : devices) {
     // For each require device path, open a device helper that checks the
     // image, checks the volume, and allows partition iteration.
     DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes, &paths](
+    dh.partitions(([&yield, &dh, &parts, &inodes, &paths, &prefixes](
         const TskVsPartInfo* part) {
       // The table also requires a partition for searching.
       auto address = std::to_string(part->getAddr());
@@ -401,7 +465,7 @@ QueryData genDeviceFile(QueryContext& context) {
       // If no inodes or paths were provided as constraints assume a walk of
       // the partition was requested.
       if (inodes.empty() && paths.empty()) {
-        dh.generateFiles(address, fs, "/", results);
+        dh.generateFiles(address, fs, "/", yield, 0, prefixes);
         dh.resetStack();
       }
 
@@ -409,23 +473,21 @@ QueryData genDeviceFile(QueryContext& context) {
       for (const auto& path : paths) {
         auto* file = new TskFsFile();
         if (file->open(fs, file, path.c_str()) == 0) {
-          dh.generateFile(address, file, fs, path, results);
+          dh.generateFile(address, file, fs, path, yield);
         }
         delete file;
       }
 
       dh.inodes(inodes,
                 fs,
-                ([&results, &address, &dh, &fs](const std::string& inode,
-                                                TskFsFile* file,
-                                                const std::string& path) {
-                  dh.generateFile(address, file, fs, path, results);
+                ([&yield, &address, &dh, &fs](const std::string& inode,
+                                              TskFsFile* file,
+                                              const std::string& path) {
+                  dh.generateFile(address, file, fs, path, yield);
                 }));
       delete fs;
     }));
   }
-
-  return results;
 }
 
 QueryData genDevicePartitions(QueryContext& context) {
@@ -191,31 +191,33 @@ void genRouteTableType(RouteType type, InterfaceMap ifmap, QueryData &results) {
   free(table);
 }
 
-QueryData genArpCache(QueryContext &context) {
-  QueryData results;
+void genArpCache(RowYield &yield, QueryContext &context) {
   InterfaceMap ifmap;
 
   ifmap = genInterfaceMap();
   for (const auto &arp_type : kArpTypes) {
+    QueryData results;
     genRouteTableType(arp_type, ifmap, results);
+    for (auto &r : results) {
+      yield(r);
+    }
   }
-
-  return results;
 }
 
-QueryData genRoutes(QueryContext &context) {
-  QueryData results;
+void genRoutes(RowYield &yield, QueryContext &context) {
   InterfaceMap ifmap;
 
   // Need a map from index->name for each route entry.
   ifmap = genInterfaceMap();
   for (const auto &route_type : kRouteTypes) {
     if (context.constraints["type"].notExistsOrMatches(route_type.second)) {
+      QueryData results;
       genRouteTableType(route_type, ifmap, results);
+      for (auto &r : results) {
+        yield(r);
+      }
     }
   }
-
-  return results;
 }
 }
 }
@@ -11,9 +11,8 @@
 #include <string>
 #include <vector>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -33,40 +32,41 @@ fs::path kEtcHosts = "/etc/hosts";
 #else
 fs::path kEtcHosts = (getSystemRoot() / "system32\\drivers\\etc\\hosts");
 #endif
-QueryData parseEtcHostsContent(const std::string& content) {
+QueryData parseEtcHostsContent(boost::string_ref content) {
   QueryData results;
 
-  for (const auto& _line : osquery::split(content, "\n")) {
-    auto line = split(_line);
-    if (line.size() == 0 || boost::starts_with(line[0], "#")) {
-      continue;
-    }
+  // Lines are tokenized in place, only column values are copied.
+  iterateLines(content, ([&results](boost::string_ref _line) {
+                 auto line = splitRef(_line);
+                 if (line.size() == 0 || line[0].starts_with('#')) {
+                   return;
+                 }
 
-    Row r;
-    r["address"] = line[0];
-    if (line.size() > 1) {
-      std::vector<std::string> hostnames;
-      for (size_t i = 1; i < line.size(); ++i) {
-        if (boost::starts_with(line[i], "#")) {
-          break;
-        }
-        hostnames.push_back(line[i]);
-      }
-      r["hostnames"] = boost::algorithm::join(hostnames, " ");
-    }
-    results.push_back(r);
-  }
+                 Row r;
+                 r["address"] = line[0].to_string();
+                 if (line.size() > 1) {
+                   std::vector<boost::string_ref> hostnames;
+                   for (size_t i = 1; i < line.size(); ++i) {
+                     if (line[i].starts_with('#')) {
+                       break;
+                     }
+                     hostnames.push_back(line[i]);
+                   }
+                   r["hostnames"] = join(hostnames, " ");
+                 }
+                 results.push_back(r);
+               }));
 
   return results;
 }
 
 QueryData genEtcHosts(QueryContext& context) {
-  std::string content;
-  if (readFile(kEtcHosts, content).ok()) {
-    return parseEtcHostsContent(content);
-  } else {
-    return {};
-  }
+  QueryData results;
+  readFileMapped(getHostPath(kEtcHosts.string()),
+                 ([&results](boost::string_ref content) {
+                   results = parseEtcHostsContent(content);
+                 }));
+  return results;
 }
 }
 }
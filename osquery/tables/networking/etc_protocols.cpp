@@ -11,9 +11,8 @@
 #include <string>
 #include <vector>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -34,57 +33,62 @@ fs::path kEtcProtocols = "/etc/protocols";
 fs::path kEtcProtocols = (getSystemRoot() / "system32\\drivers\\etc\\protocol");
 #endif
 
-QueryData parseEtcProtocolsContent(const std::string& content) {
-  QueryData results;
-
-  for (const auto& line : osquery::split(content, "\n")) {
-    // Empty line or comment.
-    if (line.size() == 0 || boost::starts_with(line, "#")) {
-      continue;
-    }
+void parseEtcProtocolsLine(boost::string_ref line, QueryData& results) {
+  // Empty line or comment.
+  if (line.size() == 0 || line.starts_with('#')) {
+    return;
+  }
 
-    // [0]: name protocol_number alias
-    // [1]: [comment part1]
-    // [2]: [comment part2]
-    // [n]: [comment partn]
-    auto protocol_comment = osquery::split(line, "#");
+  // [0]: name protocol_number alias
+  // [1]: [comment part1]
+  // [2]: [comment part2]
+  // [n]: [comment partn]
+  auto protocol_comment = splitRef(line, "#");
 
-    // [0]: name
-    // [1]: protocol_number
-    // [2]: alias
-    auto protocol_fields = osquery::split(protocol_comment[0]);
-    if (protocol_fields.size() < 2) {
-      continue;
-    }
+  // [0]: name
+  // [1]: protocol_number
+  // [2]: alias
+  auto protocol_fields = splitRef(protocol_comment[0]);
+  if (protocol_fields.size() < 2) {
+    return;
+  }
 
-    Row r;
-    r["name"] = TEXT(protocol_fields[0]);
-    r["number"] = INTEGER(protocol_fields[1]);
-    if (protocol_fields.size() > 2) {
-      r["alias"] = TEXT(protocol_fields[2]);
-    }
+  Row r;
+  r["name"] = protocol_fields[0].to_string();
+  r["number"] = protocol_fields[1].to_string();
+  if (protocol_fields.size() > 2) {
+    r["alias"] = protocol_fields[2].to_string();
+  }
 
-    // If there is a comment for the service.
-    if (protocol_comment.size() > 1) {
-      // Removes everything except the comment (parts of the comment).
-      protocol_comment.erase(protocol_comment.begin(),
-                             protocol_comment.begin() + 1);
-      r["comment"] = TEXT(boost::algorithm::join(protocol_comment, " # "));
-    }
-    results.push_back(r);
+  // If there is a comment for the service.
+  if (protocol_comment.size() > 1) {
+    // Removes everything except the comment (parts of the comment).
+    protocol_comment.erase(protocol_comment.begin(),
+                           protocol_comment.begin() + 1);
+    r["comment"] = join(protocol_comment, " # ");
   }
+  results.push_back(r);
+}
+
+QueryData parseEtcProtocolsContent(boost::string_ref content) {
+  QueryData results;
+  // Lines are tokenized in place, only column values are copied.
+  iterateLines(content, ([&results](boost::string_ref line) {
+                 parseEtcProtocolsLine(line, results);
+               }));
   return results;
 }
 
 QueryData genEtcProtocols(QueryContext& context) {
-  std::string content;
-  auto s = readFile(kEtcProtocols, content);
-  if (s.ok()) {
-    return parseEtcProtocolsContent(content);
-  } else {
-    TLOG << "Error reading " << kEtcProtocols << ": " << s.toString();
-    return {};
+  QueryData results;
+  auto path = getHostPath(kEtcProtocols.string());
+  auto s = readFileMapped(path, ([&results](boost::string_ref content) {
+                            results = parseEtcProtocolsContent(content);
+                          }));
+  if (!s.ok()) {
+    TLOG << "Error reading " << path << ": " << s.toString();
   }
+  return results;
 }
 }
 }
@@ -11,9 +11,8 @@
 #include <string>
 #include <vector>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -34,67 +33,72 @@ fs::path kEtcServices = "/etc/services";
 fs::path kEtcServices = (getSystemRoot() / "system32\\drivers\\etc\\services");
 #endif
 
-QueryData parseEtcServicesContent(const std::string& content) {
-  QueryData results;
+void parseEtcServicesLine(boost::string_ref line, QueryData& results) {
+  // Empty line or comment.
+  if (line.size() == 0 || line.starts_with('#')) {
+    return;
+  }
+
+  // [0]: name port/protocol [aliases]
+  // [1]: [comment part1]
+  // [2]: [comment part2]
+  // [n]: [comment partn]
+  auto service_info_comment = splitRef(line, "#");
+
+  // [0]: name
+  // [1]: port/protocol
+  // [2]: [aliases0]
+  // [3]: [aliases1]
+  // [n]: [aliasesn]
+  auto service_info = splitRef(service_info_comment[0]);
+  if (service_info.size() < 2) {
+    return;
+  }
+
+  // [0]: port [1]: protocol
+  auto service_port_protocol = splitRef(service_info[1], "/");
+  if (service_port_protocol.size() != 2) {
+    return;
+  }
 
-  for (const auto& line : osquery::split(content, "\n")) {
-    // Empty line or comment.
-    if (line.size() == 0 || boost::starts_with(line, "#")) {
-      continue;
-    }
-
-    // [0]: name port/protocol [aliases]
-    // [1]: [comment part1]
-    // [2]: [comment part2]
-    // [n]: [comment partn]
-    auto service_info_comment = osquery::split(line, "#");
-
-    // [0]: name
-    // [1]: port/protocol
-    // [2]: [aliases0]
-    // [3]: [aliases1]
-    // [n]: [aliasesn]
-    auto service_info = osquery::split(service_info_comment[0]);
-    if (service_info.size() < 2) {
-      continue;
-    }
-
-    // [0]: port [1]: protocol
-    auto service_port_protocol = osquery::split(service_info[1], "/");
-    if (service_port_protocol.size() != 2) {
-      continue;
-    }
-
-    Row r;
-    r["name"] = TEXT(service_info[0]);
-    r["port"] = INTEGER(service_port_protocol[0]);
-    r["protocol"] = TEXT(service_port_protocol[1]);
-
-    // Removes the name and the port/protcol elements.
-    service_info.erase(service_info.begin(), service_info.begin() + 2);
-    r["aliases"] = TEXT(boost::algorithm::join(service_info, " "));
-
-    // If there is a comment for the service.
-    if (service_info_comment.size() > 1) {
-      // Removes everything except the comment (parts of the comment).
-      service_info_comment.erase(service_info_comment.begin(),
-                                 service_info_comment.begin() + 1);
-      r["comment"] = TEXT(boost::algorithm::join(service_info_comment, " # "));
-    }
-    results.push_back(r);
+  Row r;
+  r["name"] = service_info[0].to_string();
+  r["port"] = service_port_protocol[0].to_string();
+  r["protocol"] = service_port_protocol[1].to_string();
+
+  // Removes the name and the port/protcol elements.
+  service_info.erase(service_info.begin(), service_info.begin() + 2);
+  r["aliases"] = join(service_info, " ");
+
+  // If there is a comment for the service.
+  if (service_info_comment.size() > 1) {
+    // Removes everything except the comment (parts of the comment).
+    service_info_comment.erase(service_info_comment.begin(),
+                               service_info_comment.begin() + 1);
+    r["comment"] = join(service_info_comment, " # ");
   }
+  results.push_back(r);
+}
+
+QueryData parseEtcServicesContent(boost::string_ref content) {
+  QueryData results;
+  // Lines are tokenized in place, only column values are copied.
+  iterateLines(content, ([&results](boost::string_ref line) {
+                 parseEtcServicesLine(line, results);
+               }));
   return results;
 }
 
 QueryData genEtcServices(QueryContext& context) {
-  std::string content;
-  auto s = readFile(kEtcServices, content);
-  if (s.ok()) {
-    return parseEtcServicesContent(content);
-  } else {
-    TLOG << "Error reading " << kEtcServices << ": " << s.toString();
-    return {};
+  QueryData results;
+  auto path = getHostPath(kEtcServices.string());
+  auto s = readFileMapped(path, ([&results](boost::string_ref content) {
+                            results = parseEtcServicesContent(content);
+                          }));
+  if (!s.ok()) {
+    TLOG << "Error reading " << path << ": " << s.toString();
   }
+  return results;
 }
 }
 }
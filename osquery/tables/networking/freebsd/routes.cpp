@@ -14,20 +14,12 @@
 namespace osquery {
 namespace tables {
 
-QueryData genArpCache() {
-  QueryData results;
-
+void genArpCache(RowYield& yield, QueryContext& context) {
   throw std::domain_error("Table not implemented for FreeBSD");
-
-  return results;
 }
 
-QueryData genRoutes() {
-  QueryData results;
-
+void genRoutes(RowYield& yield, QueryContext& context) {
   throw std::domain_error("Table not implemented for FreeBSD");
-
-  return results;
 }
 }
 }
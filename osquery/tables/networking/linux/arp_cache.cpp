@@ -8,72 +8,122 @@
  *
  */
 
-#include <fstream>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
-#include <osquery/tables.h>
-#include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/rtnetlink.h"
 
 namespace osquery {
 namespace tables {
 
-const std::string kLinuxArpTable = "/proc/net/arp";
-
-QueryData genArpCache(QueryContext& context) {
-  QueryData results;
+/// Incomplete entries have no link-layer address, as in /proc/net/arp.
+const std::string kBlankMac = "00:00:00:00:00:00";
 
-  boost::filesystem::path arp_path = kLinuxArpTable;
-  if (!osquery::isReadable(arp_path).ok()) {
-    VLOG(1) << "Cannot read arp table";
-    return results;
+/// Format a link-layer address attribute.
+static std::string getNeighborMac(const struct rtattr* attr) {
+  if (attr == nullptr || RTA_PAYLOAD(attr) != 6) {
+    return kBlankMac;
   }
 
-  std::ifstream fd(arp_path.string(), std::ios::in | std::ios::binary);
-  std::string line;
+  auto data = static_cast<const unsigned char*>(RTA_DATA(attr));
+  char mac[18] = {0};
+  snprintf(mac,
+           sizeof(mac),
+           "%02x:%02x:%02x:%02x:%02x:%02x",
+           data[0],
+           data[1],
+           data[2],
+           data[3],
+           data[4],
+           data[5]);
+  return mac;
+}
 
-  if (fd.fail() || fd.eof()) {
-    VLOG(1) << "Empty or failed arp table";
-    return results;
+/**
+ * @brief Parse a neighbor message into a row.
+ *
+ * @return false if the neighbor does not match the constraints.
+ */
+static bool genNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                               const std::map<int, std::string>& interfaces,
+                               QueryContext& context,
+                               Row& r) {
+  auto message = static_cast<struct ndmsg*>(NLMSG_DATA(netlink_msg));
+  if ((message->ndm_family != AF_INET && message->ndm_family != AF_INET6) ||
+      (message->ndm_state & NUD_NOARP) != 0) {
+    // Entries without resolution, such as multicast, are not in the cache.
+    return false;
   }
 
-  // Read the header line.
-  std::getline(fd, line, '\n');
-  while (!(fd.fail() || fd.eof())) {
-    std::getline(fd, line, '\n');
-
-    // IP address, HW type, Flags, HW address, Mask Device
-    std::vector<std::string> fields;
-    boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
-    for (auto& f : fields) {
-      // Inline trim each split.
-      boost::trim(f);
+  const struct rtattr* attrs[NDA_MAX + 1] = {nullptr};
+  auto attr = reinterpret_cast<struct rtattr*>(
+      reinterpret_cast<char*>(message) + NLMSG_ALIGN(sizeof(struct ndmsg)));
+  auto attr_size = NLMSG_PAYLOAD(netlink_msg, sizeof(struct ndmsg));
+  while (RTA_OK(attr, attr_size)) {
+    if (attr->rta_type <= NDA_MAX) {
+      attrs[attr->rta_type] = attr;
     }
+    attr = RTA_NEXT(attr, attr_size);
+  }
 
-    if (fields.size() != 6) {
-      // An unhandled error case.
-      continue;
-    }
+  if (attrs[NDA_DST] == nullptr) {
+    return false;
+  }
+  auto address = getNetlinkIP(message->ndm_family, RTA_DATA(attrs[NDA_DST]));
+  if (!context.constraints["address"].notExistsOrMatches(address)) {
+    return false;
+  }
 
-    Row r;
-    r["address"] = fields[0];
-    r["mac"] = fields[3];
-    r["interface"] = fields[5];
+  auto name = interfaces.find(message->ndm_ifindex);
+  r["interface"] = (name != interfaces.end()) ? name->second : "";
+  if (!context.constraints["interface"].notExistsOrMatches(r["interface"])) {
+    return false;
+  }
 
-    // Note: it's also possible to detect publish entries (ATF_PUB).
-    if (fields[2] == "0x6") {
-      // The string representation of ATF_COM | ATF_PERM.
-      r["permanent"] = "1";
-    } else {
-      r["permanent"] = "0";
-    }
+  r["address"] = std::move(address);
+  r["mac"] = getNeighborMac(attrs[NDA_LLADDR]);
+  r["permanent"] = ((message->ndm_state & NUD_PERMANENT) != 0) ? "1" : "0";
+  return true;
+}
 
-    results.push_back(r);
+void genArpCache(RowYield& yield, QueryContext& context) {
+  struct ndmsg message;
+  memset(&message, 0, sizeof(message));
+
+  // The address family is known from the requested addresses.
+  message.ndm_family =
+      getAddressFamily(context.constraints["address"].getAll(EQUALS));
+  std::string request(reinterpret_cast<char*>(&message), sizeof(message));
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.size() == 1) {
+    uint32_t index = if_nametoindex(names.begin()->c_str());
+    if (index == 0) {
+      return;
+    }
+    addRtnetlinkAttr(request, NDA_IFINDEX, &index, sizeof(index));
   }
 
-  return results;
+  auto interfaces = getInterfaceNames();
+  auto status = dumpRtnetlink(
+      RTM_GETNEIGH,
+      request,
+      ([&yield, &interfaces, &context](const struct nlmsghdr* netlink_msg) {
+        if (netlink_msg->nlmsg_type == RTM_NEWNEIGH) {
+          Row r;
+          if (genNetlinkNeighbor(netlink_msg, interfaces, context, r)) {
+            yield(r);
+          }
+        }
+        return true;
+      }));
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read the neighbor cache: " << status.getMessage();
+  }
 }
 }
 }
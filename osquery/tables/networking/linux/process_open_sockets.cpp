@@ -9,16 +9,42 @@
  */
 
 #include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
 
 namespace osquery {
+
+FLAG(bool,
+     sockets_netlink,
+     true,
+     "Use netlink sock_diag to read TCP and UDP sockets, not /proc/net");
+
 namespace tables {
 
+/// Size of the buffer netlink socket dumps are received into.
+const size_t kSockDiagBufferSize = 64 * 1024;
+
+/// Every TCP state, as a mask of (1 << state).
+const uint32_t kSockDiagAllStates = 0xFFF;
+
+/// States of sockets without a remote port: listening or unconnected.
+const uint32_t kSockDiagUnconnectedStates =
+    (1 << TCP_LISTEN) | (1 << TCP_CLOSE);
+
 // Linux proc protocol define to net stats file name.
 const std::map<int, std::string> kLinuxProtocolNames = {
     {IPPROTO_ICMP, "icmp"},
@@ -67,7 +93,7 @@ void genSocketsFromProc(const InodeMap &inodes,
                         int protocol,
                         int family,
                         QueryData &results) {
-  std::string path = "/proc/net/";
+  auto path = getHostPath("/proc/net/");
   if (family == AF_UNIX) {
     path += "unix";
   } else {
@@ -145,6 +171,155 @@ void genSocketsFromProc(const InodeMap &inodes,
   }
 }
 
+/// Check if an EQUALS constraint on a column allows a value.
+static bool isConstraintAllowed(QueryContext &context,
+                                const std::string &column,
+                                const std::string &value) {
+  if (context.constraints.count(column) == 0 ||
+      !context.constraints.at(column).exists(EQUALS)) {
+    return true;
+  }
+  return context.constraints.at(column).getAll(EQUALS).count(value) > 0;
+}
+
+/**
+ * @brief Build a sock_diag filter matching a single local port.
+ *
+ * The kernel runs the bytecode for each socket: each port comparison jumps
+ * to its next operation on success, or past the end of the program to skip
+ * the socket.
+ */
+static std::vector<inet_diag_bc_op> getPortFilter(unsigned short port) {
+  return {
+      {INET_DIAG_BC_S_GE, 8, 20},
+      {0, 0, port},
+      {INET_DIAG_BC_S_LE, 8, 12},
+      {0, 0, port},
+  };
+}
+
+/**
+ * @brief Request the sockets of a protocol and family with sock_diag.
+ *
+ * @return failure if the kernel does not support the request, the caller
+ * then reads the sockets from /proc.
+ */
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             uint32_t states,
+                             const std::vector<inet_diag_bc_op> &filter,
+                             QueryData &results) {
+  auto fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (fd < 0) {
+    return Status(1, "Cannot open a netlink sock_diag socket");
+  }
+
+  struct {
+    struct nlmsghdr header;
+    struct inet_diag_req_v2 request;
+    struct rtattr filter;
+  } message;
+  memset(&message, 0, sizeof(message));
+
+  auto filter_size = filter.size() * sizeof(inet_diag_bc_op);
+  message.header.nlmsg_len = NLMSG_LENGTH(sizeof(message.request));
+  message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  message.request.sdiag_family = family;
+  message.request.sdiag_protocol = protocol;
+  message.request.idiag_states = states;
+  message.filter.rta_type = INET_DIAG_REQ_BYTECODE;
+  message.filter.rta_len = RTA_LENGTH(filter_size);
+
+  // The request is sent with the optional filter attribute and bytecode.
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  struct iovec iov[3];
+  iov[0].iov_base = &message;
+  iov[0].iov_len = message.header.nlmsg_len;
+  iov[1].iov_base = &message.filter;
+  iov[1].iov_len = sizeof(message.filter);
+  iov[2].iov_base = const_cast<inet_diag_bc_op *>(filter.data());
+  iov[2].iov_len = filter_size;
+  if (filter_size > 0) {
+    message.header.nlmsg_len += RTA_LENGTH(filter_size);
+  }
+
+  struct msghdr request;
+  memset(&request, 0, sizeof(request));
+  request.msg_name = &address;
+  request.msg_namelen = sizeof(address);
+  request.msg_iov = iov;
+  request.msg_iovlen = (filter_size > 0) ? 3 : 1;
+  if (sendmsg(fd, &request, 0) < 0) {
+    close(fd);
+    return Status(1, "Cannot send a sock_diag request");
+  }
+
+  std::vector<char> buffer(kSockDiagBufferSize);
+  std::vector<Row> rows;
+  bool done = false;
+  while (!done) {
+    auto bytes = recv(fd, buffer.data(), buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      close(fd);
+      return Status(1, "Cannot receive a sock_diag response");
+    }
+
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    size_t remaining = bytes;
+    for (; NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        // The protocol or family is not supported by this kernel.
+        close(fd);
+        return Status(1, "Unsupported sock_diag request");
+      }
+
+      auto diag = static_cast<struct inet_diag_msg *>(NLMSG_DATA(header));
+      char local[INET6_ADDRSTRLEN] = {0};
+      char remote[INET6_ADDRSTRLEN] = {0};
+      inet_ntop(family, diag->id.idiag_src, local, sizeof(local));
+      inet_ntop(family, diag->id.idiag_dst, remote, sizeof(remote));
+
+      Row r;
+      r["socket"] = BIGINT(diag->idiag_inode);
+      r["family"] = INTEGER(family);
+      r["protocol"] = INTEGER(protocol);
+      r["local_address"] = local;
+      r["local_port"] = INTEGER(ntohs(diag->id.idiag_sport));
+      r["remote_address"] = remote;
+      r["remote_port"] = INTEGER(ntohs(diag->id.idiag_dport));
+      // Path is only used for UNIX domain sockets.
+      r["path"] = "";
+
+      auto inode = inodes.find(r["socket"]);
+      if (inode != inodes.end()) {
+        r["pid"] = inode->second.second;
+        r["fd"] = inode->second.first;
+      } else {
+        r["pid"] = "-1";
+        r["fd"] = "-1";
+      }
+      rows.push_back(std::move(r));
+    }
+  }
+  close(fd);
+
+  // Only a complete dump is used, a failed request falls back to /proc.
+  results.insert(results.end(),
+                 std::make_move_iterator(rows.begin()),
+                 std::make_move_iterator(rows.end()));
+  return Status(0, "OK");
+}
+
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
@@ -157,29 +332,82 @@ QueryData genOpenSockets(QueryContext &context) {
   }
 
   // Generate a map of socket inode to process tid.
+  // Walking each process's descriptors is skipped if pid and fd are unused.
   InodeMap socket_inodes;
-  for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      for (const auto &fd : descriptors) {
-        if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
-          auto inode = fd.second.substr(8);
-          socket_inodes[inode.substr(0, inode.size() - 1)] =
-              std::make_pair(fd.first, process);
+  if (!context.isAnyColumnUsed({"pid", "fd"})) {
+    pids.clear();
+  }
+
+  // Only socket descriptors are copied, the processes are read in parallel.
+  std::vector<std::string> processes(pids.begin(), pids.end());
+  std::vector<std::vector<std::pair<std::string, std::string>>> sockets(
+      processes.size());
+  procWalkDescriptors(
+      processes,
+      [&sockets](size_t index, const char *fd, const char *link, size_t size) {
+        // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
+        if (size > 9 && strncmp(link, "socket:[", 8) == 0) {
+          sockets[index].push_back(
+              std::make_pair(std::string(link + 8, size - 9), fd));
         }
-      }
+      });
+  for (size_t i = 0; i < processes.size(); ++i) {
+    for (auto &socket : sockets[i]) {
+      socket_inodes[socket.first] =
+          std::make_pair(std::move(socket.second), processes[i]);
     }
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
+  // Sockets without a remote port are listening or unconnected, and a single
+  // local port is matched by the kernel. SQLite applies the full constraints.
+  auto states = kSockDiagAllStates;
+  if (context.constraints["remote_port"].exists(EQUALS) &&
+      context.constraints["remote_port"].getAll(EQUALS) ==
+          std::set<std::string>({"0"})) {
+    states = kSockDiagUnconnectedStates;
+  }
+
+  std::vector<inet_diag_bc_op> filter;
+  if (context.constraints["local_port"].exists(EQUALS)) {
+    auto ports = context.constraints["local_port"].getAll(EQUALS);
+    unsigned long int port = 0;
+    if (ports.size() == 1 && safeStrtoul(*ports.begin(), 10, port).ok() &&
+        port <= 0xFFFF) {
+      filter = getPortFilter(static_cast<unsigned short>(port));
+    }
+  }
+
+  // TCP and UDP sockets are requested with netlink (Ref: #1094) when it is
+  // supported. Other protocols and UNIX sockets are read from /proc.
   for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+    if (!isConstraintAllowed(context, "protocol", INTEGER(protocol.first))) {
+      continue;
+    }
+
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (!isConstraintAllowed(context, "family", INTEGER(family))) {
+        continue;
+      }
+
+      bool netlink = FLAGS_sockets_netlink &&
+                     (protocol.first == IPPROTO_TCP ||
+                      protocol.first == IPPROTO_UDP ||
+                      protocol.first == IPPROTO_UDPLITE);
+      if (!netlink || !genSocketsFromNetlink(socket_inodes,
+                                             protocol.first,
+                                             family,
+                                             states,
+                                             filter,
+                                             results)
+                           .ok()) {
+        genSocketsFromProc(socket_inodes, protocol.first, family, results);
+      }
+    }
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  if (isConstraintAllowed(context, "family", "0")) {
+    genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  }
   return results;
 }
 }
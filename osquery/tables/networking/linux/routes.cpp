@@ -9,137 +9,96 @@
  */
 
 #include <sys/socket.h>
-#include <linux/netlink.h>
-#include <linux/rtnetlink.h>
 #include <net/if.h>
 
-#include <boost/algorithm/string/trim.hpp>
+#include <string.h>
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-#include "osquery/tables/networking/utils.h"
+#include "osquery/tables/networking/linux/rtnetlink.h"
 
 namespace osquery {
 namespace tables {
 
-#define MAX_NETLINK_SIZE 8192
-#define MAX_NETLINK_ATTEMPTS 8
-
-std::string getNetlinkIP(int family, const char* buffer) {
-  char dst[INET6_ADDRSTRLEN] = {0};
-
-  inet_ntop(family, buffer, dst, INET6_ADDRSTRLEN);
-  std::string address(dst);
-  boost::trim(address);
-
-  return address;
-}
-
-Status readNetlink(int socket_fd, int seq, char* output, size_t* size) {
-  struct nlmsghdr* nl_hdr = nullptr;
-
-  size_t message_size = 0;
-  do {
-    size_t latency = 0;
-    size_t total_bytes = 0;
-    ssize_t bytes = 0;
-    while (bytes == 0) {
-      bytes = recv(socket_fd, output, MAX_NETLINK_SIZE - message_size, 0);
-      if (bytes < 0) {
-        // Unrecoverable NETLINK error, bail.
-        return Status(1, "Could not read from NETLINK");
-      }
-
-      // Bytes were returned by we might need to read more.
-      total_bytes += bytes;
-      if (latency >= MAX_NETLINK_ATTEMPTS) {
-        // Too many attempts to read bytes have occurred.
-        // Prevent the NETLINK socket from handing and bail.
-        return Status(1, "Netlink timeout");
-      } else if (bytes == 0) {
-        if (total_bytes > 0) {
-          // Bytes were read, but now no more are available, attempt to parse
-          // the received NETLINK message.
-          break;
-        }
-        ::usleep(20);
-        latency += 1;
-      }
-    }
-
-    // Assure valid header response, and not an error type.
-    nl_hdr = (struct nlmsghdr*)output;
-    if (NLMSG_OK(nl_hdr, bytes) == 0 || nl_hdr->nlmsg_type == NLMSG_ERROR) {
-      return Status(1, "Read invalid NETLINK message");
-    }
-
-    if (nl_hdr->nlmsg_type == NLMSG_DONE) {
-      break;
-    }
+/**
+ * @brief Parse a route message into a row.
+ *
+ * The destination, table, and interface are checked against the query's
+ * constraints before the rest of the row is built.
+ *
+ * @return false if the route does not match the constraints.
+ */
+static bool genNetlinkRoute(const struct nlmsghdr* netlink_msg,
+                            const std::map<int, std::string>& interfaces,
+                            QueryContext& context,
+                            Row& r) {
+  auto message = static_cast<struct rtmsg*>(NLMSG_DATA(netlink_msg));
+  if (message->rtm_family != AF_INET && message->rtm_family != AF_INET6) {
+    return false;
+  }
 
-    // Move the buffer pointer
-    output += bytes;
-    message_size += bytes;
-    if ((nl_hdr->nlmsg_flags & NLM_F_MULTI) == 0) {
-      break;
+  // Collect the attributes, the constraints are checked before formatting.
+  const struct rtattr* attrs[RTA_MAX + 1] = {nullptr};
+  auto attr = static_cast<struct rtattr*>(RTM_RTA(message));
+  auto attr_size = RTM_PAYLOAD(netlink_msg);
+  while (RTA_OK(attr, attr_size)) {
+    if (attr->rta_type <= RTA_MAX) {
+      attrs[attr->rta_type] = attr;
     }
-  } while (static_cast<pid_t>(nl_hdr->nlmsg_seq) != seq ||
-           static_cast<pid_t>(nl_hdr->nlmsg_pid) != getpid());
-
-  *size = message_size;
-  return Status(0, "OK");
-}
+    attr = RTA_NEXT(attr, attr_size);
+  }
 
-void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
-  std::string address;
   int mask = 0;
-  char interface[IF_NAMESIZE] = {0};
-
-  struct rtmsg* message = static_cast<struct rtmsg*>(NLMSG_DATA(netlink_msg));
-  struct rtattr* attr = static_cast<struct rtattr*>(RTM_RTA(message));
-  uint32_t attr_size = RTM_PAYLOAD(netlink_msg);
+  std::string destination;
+  if (attrs[RTA_DST] != nullptr) {
+    if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
+      mask = static_cast<int>(message->rtm_dst_len);
+    }
+    destination = getNetlinkIP(message->rtm_family, RTA_DATA(attrs[RTA_DST]));
+  } else {
+    destination = (message->rtm_family == AF_INET6) ? "::" : "0.0.0.0";
+    mask = static_cast<int>(message->rtm_dst_len);
+  }
+  if (!context.constraints["destination"].notExistsOrMatches(destination)) {
+    return false;
+  }
 
-  Row r;
+  // Tables beyond 255 are only given as an attribute.
+  uint32_t table = message->rtm_table;
+  if (attrs[RTA_TABLE] != nullptr) {
+    table = *static_cast<uint32_t*>(RTA_DATA(attrs[RTA_TABLE]));
+  }
+  if (!context.constraints["table_id"].notExistsOrMatches(BIGINT(table))) {
+    return false;
+  }
 
-  // Iterate over each route in the netlink message
-  bool has_destination = false;
-  r["metric"] = "0";
-  while (RTA_OK(attr, attr_size)) {
-    switch (attr->rta_type) {
-    case RTA_OIF:
-      if_indextoname(*(int*)RTA_DATA(attr), interface);
-      r["interface"] = std::string(interface);
-      break;
-    case RTA_GATEWAY:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["gateway"] = address;
-      break;
-    case RTA_PREFSRC:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["source"] = address;
-      break;
-    case RTA_DST:
-      if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
-        mask = (int)message->rtm_dst_len;
-      }
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["destination"] = address;
-      has_destination = true;
-      break;
-    case RTA_PRIORITY:
-      r["metric"] = INTEGER(*(int*)RTA_DATA(attr));
-      break;
+  if (attrs[RTA_OIF] != nullptr) {
+    auto index = *static_cast<int*>(RTA_DATA(attrs[RTA_OIF]));
+    auto name = interfaces.find(index);
+    if (name != interfaces.end()) {
+      r["interface"] = name->second;
     }
-    attr = RTA_NEXT(attr, attr_size);
+  }
+  if (!context.constraints["interface"].notExistsOrMatches(
+          (r.count("interface") > 0) ? r.at("interface") : "")) {
+    return false;
   }
 
-  if (!has_destination) {
-    r["destination"] = "0.0.0.0";
-    if (message->rtm_dst_len) {
-      mask = (int)message->rtm_dst_len;
-    }
+  r["destination"] = std::move(destination);
+  r["table_id"] = BIGINT(table);
+  if (attrs[RTA_GATEWAY] != nullptr) {
+    r["gateway"] =
+        getNetlinkIP(message->rtm_family, RTA_DATA(attrs[RTA_GATEWAY]));
+  }
+  if (attrs[RTA_PREFSRC] != nullptr) {
+    r["source"] =
+        getNetlinkIP(message->rtm_family, RTA_DATA(attrs[RTA_PREFSRC]));
+  }
+  r["metric"] = "0";
+  if (attrs[RTA_PRIORITY] != nullptr) {
+    r["metric"] = INTEGER(*static_cast<int*>(RTA_DATA(attrs[RTA_PRIORITY])));
   }
 
   // Route type determination
@@ -162,59 +121,53 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
 
   // Fields not supported by Linux routes:
   r["mtu"] = "0";
-  results.push_back(r);
+  return true;
 }
 
-QueryData genRoutes(QueryContext& context) {
-  QueryData results;
-
-  int socket_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-  if (socket_fd < 0) {
-    VLOG(1) << "Cannot open NETLINK socket";
-    return {};
-  }
-
-  // Create netlink message header
-  auto netlink_buffer = (void*)malloc(MAX_NETLINK_SIZE);
-  if (netlink_buffer == nullptr) {
-    close(socket_fd);
-    return {};
+void genRoutes(RowYield& yield, QueryContext& context) {
+  struct rtmsg message;
+  memset(&message, 0, sizeof(message));
+
+  // Full BGP tables hold many routes, the kernel filters when it can.
+  message.rtm_family =
+      getAddressFamily(context.constraints["destination"].getAll(EQUALS));
+  auto tables = context.constraints["table_id"].getAll<long long>(EQUALS);
+  uint32_t table = 0;
+  if (tables.size() == 1) {
+    table = static_cast<uint32_t>(*tables.begin());
+    message.rtm_table = (table < 256) ? table : RT_TABLE_UNSPEC;
   }
 
-  memset(netlink_buffer, 0, MAX_NETLINK_SIZE);
-  auto netlink_msg = (struct nlmsghdr*)netlink_buffer;
-  netlink_msg->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-  netlink_msg->nlmsg_type = RTM_GETROUTE; // routes from kernel routing table
-  netlink_msg->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST | NLM_F_ATOMIC;
-  netlink_msg->nlmsg_seq = 0;
-  netlink_msg->nlmsg_pid = getpid();
-
-  // Send the netlink request to the kernel
-  if (send(socket_fd, netlink_msg, netlink_msg->nlmsg_len, 0) < 0) {
-    TLOG << "Cannot write NETLINK request header to socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  std::string request(reinterpret_cast<char*>(&message), sizeof(message));
+  if (tables.size() == 1) {
+    addRtnetlinkAttr(request, RTA_TABLE, &table, sizeof(table));
   }
 
-  // Wrap the read socket to support multi-netlink messages
-  size_t size = 0;
-  if (!readNetlink(socket_fd, 1, (char*)netlink_msg, &size).ok()) {
-    TLOG << "Cannot read NETLINK response from socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.size() == 1) {
+    uint32_t index = if_nametoindex(names.begin()->c_str());
+    if (index == 0) {
+      return;
+    }
+    addRtnetlinkAttr(request, RTA_OIF, &index, sizeof(index));
   }
 
-  // Treat the netlink response as route information
-  while (NLMSG_OK(netlink_msg, size)) {
-    genNetlinkRoutes(netlink_msg, results);
-    netlink_msg = NLMSG_NEXT(netlink_msg, size);
+  auto interfaces = getInterfaceNames();
+  auto status = dumpRtnetlink(
+      RTM_GETROUTE,
+      request,
+      ([&yield, &interfaces, &context](const struct nlmsghdr* netlink_msg) {
+        if (netlink_msg->nlmsg_type == RTM_NEWROUTE) {
+          Row r;
+          if (genNetlinkRoute(netlink_msg, interfaces, context, r)) {
+            yield(r);
+          }
+        }
+        return true;
+      }));
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read routes: " << status.getMessage();
   }
-
-  close(socket_fd);
-  free(netlink_buffer);
-  return results;
 }
 }
 }
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "osquery/tables/networking/linux/rtnetlink.h"
+
+// Added in Linux 4.20, older kernels reject the socket option.
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+namespace osquery {
+namespace tables {
+
+/// Size of the buffer rtnetlink dumps are received into.
+const size_t kRtnetlinkBufferSize = 64 * 1024;
+
+/// The sequence number of every dump request.
+const uint32_t kRtnetlinkSequence = 1;
+
+/// Close the socket when a dump is stopped, or a generator is destroyed.
+class RtnetlinkSocket : private boost::noncopyable {
+ public:
+  RtnetlinkSocket()
+      : fd(socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) {}
+
+  ~RtnetlinkSocket() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  int fd{-1};
+};
+
+Status dumpRtnetlink(uint16_t type,
+                     const std::string& request,
+                     RtnetlinkCallback callback) {
+  RtnetlinkSocket handle;
+  if (handle.fd < 0) {
+    return Status(1, "Cannot open a NETLINK_ROUTE socket");
+  }
+
+  // Kernels without strict checking ignore the filters of dump requests.
+  int strict = 1;
+  setsockopt(handle.fd,
+             SOL_NETLINK,
+             NETLINK_GET_STRICT_CHK,
+             &strict,
+             sizeof(strict));
+
+  std::string message(NLMSG_HDRLEN, '\0');
+  message += request;
+  auto header = reinterpret_cast<struct nlmsghdr*>(&message[0]);
+  header->nlmsg_len = static_cast<uint32_t>(message.size());
+  header->nlmsg_type = type;
+  header->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  header->nlmsg_seq = kRtnetlinkSequence;
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  if (sendto(handle.fd,
+             message.data(),
+             message.size(),
+             0,
+             reinterpret_cast<struct sockaddr*>(&address),
+             sizeof(address)) < 0) {
+    return Status(1, "Cannot send a NETLINK_ROUTE request");
+  }
+
+  std::vector<char> buffer(kRtnetlinkBufferSize);
+  while (true) {
+    auto bytes = recv(handle.fd, buffer.data(), buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      return Status(1, "Cannot receive a NETLINK_ROUTE response");
+    }
+
+    auto response = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+    size_t remaining = static_cast<size_t>(bytes);
+    for (; NLMSG_OK(response, remaining);
+         response = NLMSG_NEXT(response, remaining)) {
+      if (response->nlmsg_seq != kRtnetlinkSequence) {
+        continue;
+      } else if (response->nlmsg_type == NLMSG_DONE) {
+        return Status(0, "OK");
+      } else if (response->nlmsg_type == NLMSG_ERROR) {
+        auto error = static_cast<struct nlmsgerr*>(NLMSG_DATA(response));
+        return Status(1, "NETLINK_ROUTE dump failed: " +
+                             std::string(strerror(-error->error)));
+      }
+
+      if (!callback(response)) {
+        return Status(0, "OK");
+      }
+    }
+  }
+}
+
+void addRtnetlinkAttr(std::string& request,
+                      uint16_t type,
+                      const void* data,
+                      size_t size) {
+  request.resize(NLMSG_ALIGN(request.size()), '\0');
+
+  struct rtattr attr;
+  attr.rta_type = type;
+  attr.rta_len = static_cast<unsigned short>(RTA_LENGTH(size));
+  request.append(reinterpret_cast<const char*>(&attr), sizeof(attr));
+  request.append(static_cast<const char*>(data), size);
+  request.append(RTA_ALIGN(size) - size, '\0');
+}
+
+int getAddressFamily(const std::set<std::string>& addresses) {
+  int family = AF_UNSPEC;
+  for (const auto& address : addresses) {
+    int next = (address.find(':') != std::string::npos) ? AF_INET6 : AF_INET;
+    if (family != AF_UNSPEC && family != next) {
+      return AF_UNSPEC;
+    }
+    family = next;
+  }
+  return family;
+}
+
+std::string getNetlinkIP(int family, const void* data) {
+  char dst[INET6_ADDRSTRLEN] = {0};
+  if (inet_ntop(family, data, dst, sizeof(dst)) == nullptr) {
+    return "";
+  }
+  return dst;
+}
+
+std::map<int, std::string> getInterfaceNames() {
+  std::map<int, std::string> names;
+  auto interfaces = if_nameindex();
+  if (interfaces == nullptr) {
+    return names;
+  }
+
+  for (auto interface = interfaces; interface->if_index != 0; interface++) {
+    names[static_cast<int>(interface->if_index)] = interface->if_name;
+  }
+  if_freenameindex(interfaces);
+  return names;
+}
+}
+}
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// Called with each message of a dump, returns false to stop the dump.
+using RtnetlinkCallback = std::function<bool(const struct nlmsghdr* message)>;
+
+/**
+ * @brief Dump routes, neighbors, or addresses with rtnetlink.
+ *
+ * The request is the family header, such as a struct rtmsg, followed by any
+ * attributes added with addRtnetlinkAttr. The kernel is asked to apply the
+ * header fields and attributes as filters, which Linux 4.20 and later do.
+ * Older kernels may dump every entry of the family, so callers must also
+ * check the entries they are given.
+ *
+ * Messages are received into a fixed buffer and passed to the callback as
+ * they arrive, the dump is never held in memory.
+ *
+ * @param type the request type, such as RTM_GETROUTE
+ * @param request the family header and attributes
+ * @param callback called with each message
+ * @return failure if the socket or dump failed.
+ */
+Status dumpRtnetlink(uint16_t type,
+                     const std::string& request,
+                     RtnetlinkCallback callback);
+
+/// Append an attribute, such as RTA_TABLE, to a dump request.
+void addRtnetlinkAttr(std::string& request,
+                      uint16_t type,
+                      const void* data,
+                      size_t size);
+
+/**
+ * @brief The family shared by a set of addresses.
+ *
+ * @return AF_INET or AF_INET6, or AF_UNSPEC if the set is empty or mixed.
+ */
+int getAddressFamily(const std::set<std::string>& addresses);
+
+/// Format an address attribute of a family.
+std::string getNetlinkIP(int family, const void* data);
+
+/// Map interface indexes to names, as if_indextoname for each index.
+std::map<int, std::string> getInterfaceNames();
+}
+}
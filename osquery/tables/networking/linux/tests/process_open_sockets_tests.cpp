@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+DECLARE_bool(sockets_netlink);
+
+namespace tables {
+
+QueryData genOpenSockets(QueryContext& context);
+
+class ProcessOpenSocketsTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd_, 0);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(fd_, (struct sockaddr*)&address, sizeof(address)));
+    ASSERT_EQ(0, listen(fd_, 1));
+
+    socklen_t size = sizeof(address);
+    getsockname(fd_, (struct sockaddr*)&address, &size);
+    port_ = std::to_string(ntohs(address.sin_port));
+  }
+
+  void TearDown() override {
+    close(fd_);
+  }
+
+  /// Find the listening socket in the sockets matching the constraints.
+  Row getListening(QueryContext& context) {
+    for (const auto& row : genOpenSockets(context)) {
+      if (row.at("local_port") == port_ && row.at("protocol") == "6") {
+        return row;
+      }
+    }
+    return Row();
+  }
+
+ protected:
+  int fd_{-1};
+  std::string port_;
+};
+
+TEST_F(ProcessOpenSocketsTests, test_netlink_sockets) {
+  auto netlink = FLAGS_sockets_netlink;
+
+  QueryContext context;
+  context.constraints["remote_port"].add(Constraint(EQUALS, "0"));
+  context.constraints["local_port"].add(Constraint(EQUALS, port_));
+
+  FLAGS_sockets_netlink = true;
+  auto row = getListening(context);
+  ASSERT_FALSE(row.empty());
+  EXPECT_EQ(std::to_string(getpid()), row["pid"]);
+  EXPECT_EQ("127.0.0.1", row["local_address"]);
+  EXPECT_EQ("0", row["remote_port"]);
+
+  // The /proc backend reports the same socket.
+  FLAGS_sockets_netlink = false;
+  EXPECT_EQ(row, getListening(context));
+
+  // The kernel filters TCP and UDP sockets by local port.
+  FLAGS_sockets_netlink = true;
+  QueryContext other;
+  other.constraints["local_port"].add(Constraint(EQUALS, "1"));
+  for (const auto& socket : genOpenSockets(other)) {
+    if (socket.at("protocol") == "6" || socket.at("protocol") == "17") {
+      EXPECT_EQ("1", socket.at("local_port"));
+    }
+  }
+  FLAGS_sockets_netlink = netlink;
+}
+}
+}
@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/rtnetlink.h"
+
+namespace osquery {
+namespace tables {
+
+void genRoutes(RowYield& yield, QueryContext& context);
+QueryData genInterfaceAddresses(QueryContext& context);
+
+class RtnetlinkTests : public testing::Test {};
+
+static QueryData getRoutes(QueryContext& context) {
+  QueryData results;
+  RowGenerator::pull_type generator(
+      [&context](RowYield& yield) { genRoutes(yield, context); });
+  for (auto& row : generator) {
+    results.push_back(row);
+  }
+  return results;
+}
+
+TEST_F(RtnetlinkTests, test_address_family) {
+  EXPECT_EQ(AF_UNSPEC, getAddressFamily({}));
+  EXPECT_EQ(AF_INET, getAddressFamily({"127.0.0.1", "10.0.0.1"}));
+  EXPECT_EQ(AF_INET6, getAddressFamily({"::1"}));
+  EXPECT_EQ(AF_UNSPEC, getAddressFamily({"127.0.0.1", "::1"}));
+}
+
+TEST_F(RtnetlinkTests, test_loopback_routes) {
+  // The local table holds the loopback address route.
+  QueryContext context;
+  context.constraints["table_id"].add(Constraint(EQUALS, "255"));
+  context.constraints["interface"].add(Constraint(EQUALS, "lo"));
+  context.constraints["destination"].add(Constraint(EQUALS, "127.0.0.1"));
+
+  auto results = getRoutes(context);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("127.0.0.1", results[0]["destination"]);
+  EXPECT_EQ("255", results[0]["table_id"]);
+  EXPECT_EQ("lo", results[0]["interface"]);
+  EXPECT_EQ("local", results[0]["type"]);
+
+  // Routes of other tables are not included.
+  QueryContext main;
+  main.constraints["table_id"].add(Constraint(EQUALS, "254"));
+  for (const auto& row : getRoutes(main)) {
+    EXPECT_EQ("254", row.at("table_id"));
+  }
+}
+
+TEST_F(RtnetlinkTests, test_loopback_addresses) {
+  QueryContext context;
+  context.constraints["interface"].add(Constraint(EQUALS, "lo"));
+  context.constraints["address"].add(Constraint(EQUALS, "127.0.0.1"));
+
+  auto results = genInterfaceAddresses(context);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("lo", results[0]["interface"]);
+  EXPECT_EQ("255.0.0.0", results[0]["mask"]);
+  EXPECT_EQ(0U, results[0].count("point_to_point"));
+}
+}
+}
@@ -8,9 +8,12 @@
  *
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 
+#include <string.h>
+
 // Maintain the order of includes (ifaddrs after if).
 #include <ifaddrs.h>
 #include <net/if.h>
@@ -25,6 +28,9 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#ifdef __linux__
+#include "osquery/tables/networking/linux/rtnetlink.h"
+#endif
 #include "osquery/tables/networking/utils.h"
 
 namespace osquery {
@@ -133,6 +139,114 @@ void genDetailsFromAddr(const struct ifaddrs* addr, QueryData& results) {
   results.push_back(r);
 }
 
+#ifdef __linux__
+/// Format a prefix length as a netmask address of a family.
+static std::string getNetlinkMask(int family, unsigned char prefix) {
+  unsigned char mask[16] = {0};
+  size_t size = (family == AF_INET6) ? 16 : 4;
+  for (size_t i = 0; i < size && prefix > 0; i++) {
+    auto bits = std::min(prefix, static_cast<unsigned char>(8));
+    mask[i] = static_cast<unsigned char>(0xFF << (8 - bits));
+    prefix -= bits;
+  }
+  return getNetlinkIP(family, mask);
+}
+
+/**
+ * @brief Parse an address message into a row, as getifaddrs would.
+ *
+ * @return false if the address does not match the constraints.
+ */
+static bool genAddressesFromNetlink(
+    const struct nlmsghdr* netlink_msg,
+    const std::map<int, std::string>& interfaces,
+    QueryContext& context,
+    Row& r) {
+  auto message = static_cast<struct ifaddrmsg*>(NLMSG_DATA(netlink_msg));
+  if (message->ifa_family != AF_INET && message->ifa_family != AF_INET6) {
+    return false;
+  }
+
+  const struct rtattr* attrs[IFA_MAX + 1] = {nullptr};
+  auto attr = static_cast<struct rtattr*>(IFA_RTA(message));
+  auto attr_size = IFA_PAYLOAD(netlink_msg);
+  while (RTA_OK(attr, attr_size)) {
+    if (attr->rta_type <= IFA_MAX) {
+      attrs[attr->rta_type] = attr;
+    }
+    attr = RTA_NEXT(attr, attr_size);
+  }
+
+  // IPv4 aliases are named by their label.
+  if (attrs[IFA_LABEL] != nullptr) {
+    r["interface"] = static_cast<const char*>(RTA_DATA(attrs[IFA_LABEL]));
+  } else {
+    auto name = interfaces.find(static_cast<int>(message->ifa_index));
+    r["interface"] = (name != interfaces.end()) ? name->second : "";
+  }
+  if (!context.constraints["interface"].notExistsOrMatches(r["interface"])) {
+    return false;
+  }
+
+  // The local address of a point-to-point link is given separately.
+  auto family = message->ifa_family;
+  auto local = (attrs[IFA_LOCAL] != nullptr) ? attrs[IFA_LOCAL]
+                                             : attrs[IFA_ADDRESS];
+  if (local == nullptr) {
+    return false;
+  }
+  r["address"] = getNetlinkIP(family, RTA_DATA(local));
+  if (!context.constraints["address"].notExistsOrMatches(r["address"])) {
+    return false;
+  }
+
+  r["mask"] = getNetlinkMask(family, message->ifa_prefixlen);
+  if (attrs[IFA_BROADCAST] != nullptr) {
+    r["broadcast"] = getNetlinkIP(family, RTA_DATA(attrs[IFA_BROADCAST]));
+  } else if (attrs[IFA_ADDRESS] != nullptr &&
+             RTA_PAYLOAD(local) == RTA_PAYLOAD(attrs[IFA_ADDRESS]) &&
+             memcmp(RTA_DATA(local),
+                    RTA_DATA(attrs[IFA_ADDRESS]),
+                    RTA_PAYLOAD(local)) != 0) {
+    r["point_to_point"] = getNetlinkIP(family, RTA_DATA(attrs[IFA_ADDRESS]));
+  }
+  return true;
+}
+
+QueryData genInterfaceAddresses(QueryContext& context) {
+  QueryData results;
+
+  // The kernel filters by family and interface index when it can.
+  struct ifaddrmsg message;
+  memset(&message, 0, sizeof(message));
+  message.ifa_family =
+      getAddressFamily(context.constraints["address"].getAll(EQUALS));
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.size() == 1) {
+    // Labels of IPv4 aliases are not interface names.
+    message.ifa_index = if_nametoindex(names.begin()->c_str());
+  }
+
+  std::string request(reinterpret_cast<char*>(&message), sizeof(message));
+  auto interfaces = getInterfaceNames();
+  auto status = dumpRtnetlink(
+      RTM_GETADDR,
+      request,
+      ([&results, &interfaces, &context](const struct nlmsghdr* netlink_msg) {
+        if (netlink_msg->nlmsg_type == RTM_NEWADDR) {
+          Row r;
+          if (genAddressesFromNetlink(netlink_msg, interfaces, context, r)) {
+            results.push_back(std::move(r));
+          }
+        }
+        return true;
+      }));
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read interface addresses: " << status.getMessage();
+  }
+  return results;
+}
+#else
 QueryData genInterfaceAddresses(QueryContext& context) {
   QueryData results;
 
@@ -155,6 +269,7 @@ QueryData genInterfaceAddresses(QueryContext& context) {
   freeifaddrs(if_addrs);
   return results;
 }
+#endif
 
 QueryData genInterfaceDetails(QueryContext& context) {
   QueryData results;
@@ -8,6 +8,8 @@
  *
  */
 
+#include <boost/utility/string_ref.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -17,9 +19,9 @@
 namespace osquery {
 namespace tables {
 
-osquery::QueryData parseEtcHostsContent(const std::string& content);
+osquery::QueryData parseEtcHostsContent(boost::string_ref content);
 #ifndef WIN32
-osquery::QueryData parseEtcProtocolsContent(const std::string& content);
+osquery::QueryData parseEtcProtocolsContent(boost::string_ref content);
 #endif
 
 class NetworkingTablesTests : public testing::Test {};
@@ -86,8 +86,7 @@ QueryData genIPv4ArpCache(QueryContext& context) {
   return results;
 }
 
-QueryData genArpCache(QueryContext& context) {
-  QueryData results;
+void genArpCache(RowYield& yield, QueryContext& context) {
   QueryData winArpCache = genIPv4ArpCache(context);
 
   for (const auto& item : winArpCache) {
@@ -101,11 +100,9 @@ QueryData genArpCache(QueryContext& context) {
       r["mac"] = item.at("link_layer_address");
       r["interface"] = item.at("interface");
       r["permanent"] = SQL_TEXT(("Permanent" == item.at("state")) ? "1" : "0");
-      results.push_back(r);
+      yield(r);
     }
   }
-
-  return results;
 }
 }
 }
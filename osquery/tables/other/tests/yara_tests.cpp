@@ -8,14 +8,40 @@
  *
  */
 
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/tables/other/yara_utils.h"
 
 namespace osquery {
 
+DECLARE_uint64(yara_scan_threads);
+DECLARE_uint64(yara_cache_max);
+DECLARE_string(yara_rules_cache);
+
+namespace tables {
+
+void scanYARAFiles(const std::vector<std::string>& paths,
+                   const std::vector<YARARuleGroup>& groups,
+                   QueryData& results);
+}
+
+/// A signature group scanning with rules and a rule fingerprint.
+static YARARuleGroup getGroup(const std::string& name,
+                              YR_RULES* rules,
+                              const std::string& fingerprint = "") {
+  YARARuleGroup group;
+  group.name = name;
+  group.rules = rules;
+  group.fingerprint = fingerprint;
+  return group;
+}
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -60,6 +86,16 @@ class YARATest : public testing::Test {
 
     return r;
   }
+
+  /// Replace the rule file content and compile it.
+  YR_RULES* compileRules(const std::string& ruleContent) {
+    remove(ruleFile);
+    writeTextFile(ruleFile, ruleContent);
+
+    YR_RULES* rules = nullptr;
+    EXPECT_TRUE(compileSingleFile(ruleFile, &rules).ok());
+    return rules;
+  }
 };
 
 TEST_F(YARATest, test_match_true) {
@@ -73,4 +109,127 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_scan_threads) {
+  auto threads = FLAGS_yara_scan_threads;
+  ASSERT_EQ(ERROR_SUCCESS, yr_initialize());
+
+  auto always_true = compileRules(alwaysTrue);
+  auto always_false = compileRules(alwaysFalse);
+  ASSERT_NE(nullptr, always_true);
+  ASSERT_NE(nullptr, always_false);
+
+  // Scan a missing file among copies of a readable file.
+  std::vector<std::string> paths(32, ls);
+  paths[7] = "/tmp/osquery-yara-missing";
+  std::vector<YARARuleGroup> groups = {getGroup("always_true", always_true),
+                                       getGroup("always_false", always_false)};
+
+  FLAGS_yara_scan_threads = 1;
+  QueryData expected;
+  tables::scanYARAFiles(paths, groups, expected);
+  ASSERT_EQ(62U, expected.size());
+  EXPECT_EQ("1", expected[0]["count"]);
+  EXPECT_EQ("always_true", expected[0]["sig_group"]);
+  EXPECT_EQ("0", expected[1]["count"]);
+  EXPECT_EQ("always_false", expected[1]["sig_group"]);
+
+  // Concurrent scans share the rules and keep the path and group order.
+  FLAGS_yara_scan_threads = 4;
+  QueryData results;
+  tables::scanYARAFiles(paths, groups, results);
+  EXPECT_EQ(expected, results);
+
+  yr_rules_destroy(always_true);
+  yr_rules_destroy(always_false);
+  FLAGS_yara_scan_threads = threads;
+}
+
+TEST_F(YARATest, test_scan_cache) {
+  auto cache_max = FLAGS_yara_cache_max;
+  FLAGS_yara_cache_max = 8;
+  ASSERT_EQ(ERROR_SUCCESS, yr_initialize());
+
+  auto always_true = compileRules(alwaysTrue);
+  auto always_false = compileRules(alwaysFalse);
+  ASSERT_NE(nullptr, always_true);
+  ASSERT_NE(nullptr, always_false);
+
+  const std::string target = "/tmp/osquery-yara-target";
+  ASSERT_TRUE(writeTextFile(target, "content").ok());
+
+  // The first scan result is cached under the file and group.
+  QueryData results;
+  tables::scanYARAFiles(
+      {target}, {getGroup("group", always_true, "first")}, results);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["count"]);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kYARAScans, keys);
+  EXPECT_EQ(1U, keys.size());
+
+  // The cached result is used while the fingerprint is unchanged.
+  results.clear();
+  tables::scanYARAFiles(
+      {target}, {getGroup("group", always_false, "first")}, results);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["count"]);
+  EXPECT_EQ("always_true", results[0]["matches"]);
+
+  // Changed rules are scanned again.
+  results.clear();
+  tables::scanYARAFiles(
+      {target}, {getGroup("group", always_false, "second")}, results);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("0", results[0]["count"]);
+
+  // A changed file is scanned again.
+  ASSERT_TRUE(writeTextFile(target, "changed content").ok());
+  results.clear();
+  tables::scanYARAFiles(
+      {target}, {getGroup("group", always_true, "second")}, results);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["count"]);
+
+  yr_rules_destroy(always_true);
+  yr_rules_destroy(always_false);
+  remove(target);
+  FLAGS_yara_cache_max = cache_max;
+}
+
+TEST_F(YARATest, test_rules_cache) {
+  auto rules_cache = FLAGS_yara_rules_cache;
+  FLAGS_yara_rules_cache = "/tmp/osquery-yara-rules";
+  ASSERT_EQ(ERROR_SUCCESS, yr_initialize());
+
+  remove(ruleFile);
+  writeTextFile(ruleFile, alwaysTrue);
+  auto fingerprint = getYARAFingerprint({ruleFile});
+  EXPECT_EQ(fingerprint, getYARAFingerprint({ruleFile}));
+
+  YR_RULES* rules = nullptr;
+  EXPECT_FALSE(loadYARARulesCache(fingerprint, &rules).ok());
+  ASSERT_TRUE(compileSingleFile(ruleFile, &rules).ok());
+  saveYARARulesCache(fingerprint, rules);
+  yr_rules_destroy(rules);
+
+  // The saved rules are loaded while the sources are unchanged.
+  rules = nullptr;
+  ASSERT_TRUE(loadYARARulesCache(fingerprint, &rules).ok());
+  QueryData results;
+  tables::scanYARAFiles({ls}, {getGroup("group", rules)}, results);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("always_true", results[0]["matches"]);
+  yr_rules_destroy(rules);
+
+  // Changed sources have a new fingerprint, and unused rules are removed.
+  remove(ruleFile);
+  writeTextFile(ruleFile, alwaysFalse);
+  EXPECT_NE(fingerprint, getYARAFingerprint({ruleFile}));
+  pruneYARARulesCache({getYARAFingerprint({ruleFile})});
+  EXPECT_FALSE(loadYARARulesCache(fingerprint, &rules).ok());
+
+  boost::filesystem::remove_all(FLAGS_yara_rules_cache);
+  FLAGS_yara_rules_cache = rules_cache;
+}
 }
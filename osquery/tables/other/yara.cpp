@@ -8,14 +8,23 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 
+#include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
 #include <osquery/tables.h>
 #include <osquery/status.h>
 
 #include "osquery/tables/other/yara_utils.h"
+#include "osquery/tables/system/hash.h"
 
 #ifdef CONCAT
 #undef CONCAT
@@ -23,31 +32,202 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64, yara_scan_threads, 4, "Max threads scanning files for a query");
+
+FLAG(uint64,
+     yara_cache_max,
+     0,
+     "Max file and signature group scan results cached (0 = disabled)");
+
+/// Minimum number of files scanned by each YARA scan thread.
+const size_t kYARAFilesPerThread = 4;
+
+/**
+ * @brief Max threads scanning with the same rules.
+ *
+ * YARA allows a limited number of concurrent scans of a compiled rules
+ * handle, the remainder is left to yara_events subscribers.
+ */
+const size_t kYARAMaxScanThreads = 16;
+
 namespace tables {
 
-void doYARAScan(YR_RULES* rules,
-                const std::string& path,
-                QueryData& results,
-                const std::string& group,
-                const std::string& sigfile) {
-  Row r;
-
-  // These are default values, to be updated in YARACallback.
-  r["count"] = INTEGER(0);
-  r["matches"] = std::string("");
-  r["strings"] = std::string("");
-  r["tags"] = std::string("");
-
-  // This could use target_path instead to be consistent with yara_events.
-  r["path"] = path;
-  r["sig_group"] = std::string(group);
-  r["sigfile"] = std::string(sigfile);
-
-  // Perform the scan, using the static YARA subscriber callback.
-  int result = yr_rules_scan_file(
-      rules, path.c_str(), SCAN_FLAGS_FAST_MODE, YARACallback, (void*)&r, 0);
-  if (result == ERROR_SUCCESS) {
-    results.push_back(std::move(r));
+/// The compiled rules for each signature group, shared by the scan threads.
+using YARARuleGroups = std::vector<YARARuleGroup>;
+
+/// The columns of a scan result, in the order they are cached.
+static const std::vector<std::string> kYARAScanColumns = {
+    "count", "matches", "strings", "tags"};
+
+/**
+ * @brief Read a cached scan result of a file.
+ *
+ * The cached value is the file version, the group fingerprint, then the
+ * scan result columns, separated by newlines.
+ */
+static bool getYARAScanCache(const std::string& key,
+                             const std::string& version,
+                             const std::string& fingerprint,
+                             Row& r) {
+  std::string value;
+  if (!getDatabaseValue(kYARAScans, key, value).ok()) {
+    return false;
+  }
+
+  std::vector<std::string> fields;
+  boost::split(fields, value, [](char c) { return c == '\n'; });
+  if (fields.size() != kYARAScanColumns.size() + 2 || fields[0] != version ||
+      fields[1] != fingerprint) {
+    return false;
+  }
+
+  for (size_t i = 0; i < kYARAScanColumns.size(); i++) {
+    r[kYARAScanColumns[i]] = std::move(fields[i + 2]);
+  }
+  touchFileCache(kYARAScans, key, FLAGS_yara_cache_max);
+  return true;
+}
+
+/// Cache the scan result of a file.
+static void setYARAScanCache(const std::string& key,
+                             const std::string& version,
+                             const std::string& fingerprint,
+                             const Row& r) {
+  auto value = version + "\n" + fingerprint;
+  for (const auto& column : kYARAScanColumns) {
+    value += "\n" + r.at(column);
+  }
+  setDatabaseValue(kYARAScans, key, value);
+  touchFileCache(kYARAScans, key, FLAGS_yara_cache_max);
+}
+
+/**
+ * @brief Scan each file with every signature group.
+ *
+ * Each file is mapped once and scanned in memory with each group's rules.
+ * The rules are only read during a scan, so they are shared by a pool of at
+ * most --yara_scan_threads threads. Rows are appended in path then group
+ * order, as if the files were scanned serially.
+ *
+ * With --yara_cache_max, the result of each file and group is cached under
+ * the file identity and group. A file is not read again while it and the
+ * group's rule files are unchanged.
+ */
+void scanYARAFiles(const std::vector<std::string>& paths,
+                   const YARARuleGroups& groups,
+                   QueryData& results) {
+  std::vector<QueryData> scans(paths.size());
+
+  // Each worker takes the next path until all have been scanned.
+  std::atomic<size_t> next(0);
+  auto worker = [&paths, &groups, &scans, &next]() {
+    size_t index = 0;
+    while ((index = next++) < paths.size()) {
+      const auto& path = paths[index];
+      std::string identity;
+      std::string version;
+      bool cache = FLAGS_yara_cache_max > 0 &&
+                   getFileCacheIdentity(path, identity, version);
+
+      std::vector<Row> rows(groups.size());
+      std::vector<bool> scanned(groups.size(), false);
+      bool pending = false;
+      for (size_t i = 0; i < groups.size(); i++) {
+        auto& r = rows[i];
+        // This could use target_path instead to be consistent with
+        // yara_events.
+        r["path"] = path;
+        r["sig_group"] = groups[i].name;
+        r["sigfile"] = groups[i].name;
+        if (cache && !groups[i].fingerprint.empty() &&
+            getYARAScanCache(identity + ":" + groups[i].name,
+                             version,
+                             groups[i].fingerprint,
+                             r)) {
+          scanned[i] = true;
+        } else {
+          pending = true;
+        }
+      }
+
+      YR_MAPPED_FILE mapped;
+      if (pending && yr_filemap_map(path.c_str(), &mapped) != ERROR_SUCCESS) {
+        // The cached results of a file that cannot be read are not used.
+        continue;
+      }
+
+      std::vector<bool> cached(scanned);
+      for (size_t i = 0; pending && i < groups.size(); i++) {
+        if (scanned[i]) {
+          continue;
+        }
+
+        // These are default values, to be updated in YARACallback.
+        auto& r = rows[i];
+        r["count"] = INTEGER(0);
+        r["matches"] = std::string("");
+        r["strings"] = std::string("");
+        r["tags"] = std::string("");
+
+        // Perform the scan, using the static YARA subscriber callback.
+        int result = yr_rules_scan_mem(groups[i].rules,
+                                       mapped.data,
+                                       mapped.size,
+                                       SCAN_FLAGS_FAST_MODE,
+                                       YARACallback,
+                                       (void*)&r,
+                                       0);
+        scanned[i] = (result == ERROR_SUCCESS);
+      }
+
+      if (pending) {
+        yr_filemap_unmap(&mapped);
+
+        // Results are not cached if the file changed while it was scanned.
+        std::string scan_identity;
+        std::string scan_version;
+        if (cache && getFileCacheIdentity(path, scan_identity, scan_version) &&
+            scan_identity == identity && scan_version == version) {
+          for (size_t i = 0; i < groups.size(); i++) {
+            if (scanned[i] && !cached[i] && !groups[i].fingerprint.empty()) {
+              setYARAScanCache(identity + ":" + groups[i].name,
+                               version,
+                               groups[i].fingerprint,
+                               rows[i]);
+            }
+          }
+        }
+      }
+
+      for (size_t i = 0; i < groups.size(); i++) {
+        if (scanned[i]) {
+          scans[index].push_back(std::move(rows[i]));
+        }
+      }
+    }
+  };
+
+  auto threads = std::min(static_cast<size_t>(FLAGS_yara_scan_threads),
+                          paths.size() / kYARAFilesPerThread);
+  threads = std::min(threads, kYARAMaxScanThreads);
+  threads = std::min(
+      threads, static_cast<size_t>(std::thread::hardware_concurrency()));
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit([&worker]() {
+      worker();
+      // Release the thread's YARA scan state, workers are shared.
+      yr_finalize_thread();
+    }));
+  }
+  worker();
+  group.wait();
+
+  for (auto& scan : scans) {
+    for (auto& r : scan) {
+      results.push_back(std::move(r));
+    }
   }
 }
 
@@ -107,33 +287,46 @@ QueryData genYara(QueryContext& context) {
     // Check if this "ad-hoc" signature file has not been used/compiled.
     if (rules.count(file) == 0) {
       // If this is a relative path append the default yara search path.
-      auto path = (file[0] != '/') ? std::string("/etc/osquery/yara/") : "";
-      path += file;
+      auto path = getYARARulePath(file);
+      auto fingerprint = getYARAFingerprint({path});
 
       YR_RULES* tmp_rules = nullptr;
-      auto status = compileSingleFile(path, &tmp_rules);
-      if (!status.ok()) {
-        VLOG(1) << "YARA compile error: " << status.toString();
-        continue;
+      if (!loadYARARulesCache(fingerprint, &tmp_rules).ok()) {
+        auto status = compileSingleFile(path, &tmp_rules);
+        if (!status.ok()) {
+          VLOG(1) << "YARA compile error: " << status.toString();
+          continue;
+        }
+        saveYARARulesCache(fingerprint, tmp_rules);
       }
       // Cache the compiled rules by setting the unique signature file path
       // as the lookup name. Additional signature file uses will skip the
       // compile step and be added as rule groups.
       rules[file] = tmp_rules;
+      yaraParser->fingerprints()[file] = fingerprint;
     }
     // Assemble an "ad-hoc" group using the signature file path as the name.
     groups.insert(file);
   }
 
   // Scan every path pair.
-  for (const auto& path : paths) {
-    // Scan using the signature groups.
-    for (const auto& group : groups) {
-      if (rules.count(group) > 0) {
-        doYARAScan(rules[group], path.c_str(), results, group, group);
+  YARARuleGroups scan_groups;
+  auto& fingerprints = yaraParser->fingerprints();
+  for (const auto& group : groups) {
+    if (rules.count(group) > 0) {
+      YARARuleGroup scan_group;
+      scan_group.name = group;
+      scan_group.rules = rules[group];
+      if (fingerprints.count(group) > 0) {
+        scan_group.fingerprint = fingerprints[group];
       }
+      scan_groups.push_back(std::move(scan_group));
     }
   }
+  if (!scan_groups.empty()) {
+    std::vector<std::string> scan_paths(paths.begin(), paths.end());
+    scanYARAFiles(scan_paths, scan_groups, results);
+  }
 
   return results;
 }
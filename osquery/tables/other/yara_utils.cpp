@@ -8,16 +8,47 @@
  *
  */
 
+#include <sys/stat.h>
+
 #include <map>
+#include <set>
 #include <string>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/process.h"
+#include "osquery/filesystem/fileops.h"
 #include "osquery/tables/other/yara_utils.h"
+#include "osquery/tables/system/hash.h"
+
+namespace fs = boost::filesystem;
 
 namespace osquery {
 
+FLAG(string,
+     yara_rules_cache,
+     "",
+     "Directory to save compiled YARA rules in (empty = disabled)");
+
+/// The extension of compiled rules saved in the rules cache.
+const std::string kYARARulesCacheExtension = ".yarc";
+
+/// Serialize saving compiled rules to the rules cache.
+static Mutex kYARARulesCacheMutex;
+
+/// The path of the compiled rules saved for a fingerprint.
+static std::string getYARARulesCachePath(const std::string &fingerprint) {
+  return (fs::path(FLAGS_yara_rules_cache) /
+          (fingerprint + kYARARulesCacheExtension))
+      .string();
+}
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -102,6 +133,97 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
   return Status(0, "OK");
 }
 
+std::string getYARARulePath(const std::string &file) {
+  if (!file.empty() && file[0] == '/') {
+    return file;
+  }
+  return "/etc/osquery/yara/" + file;
+}
+
+std::string getYARAFingerprint(const std::vector<std::string> &files) {
+  std::string content;
+  for (const auto &file : files) {
+    content += file + '\0' + hashFromFile(HASH_TYPE_SHA256, file) + '\0';
+  }
+  return hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size());
+}
+
+Status loadYARARulesCache(const std::string &fingerprint, YR_RULES **rules) {
+  if (FLAGS_yara_rules_cache.empty() || fingerprint.empty()) {
+    return Status(1, "YARA rules cache is disabled");
+  }
+
+  auto path = getYARARulesCachePath(fingerprint);
+  if (!pathExists(path).ok()) {
+    return Status(1, "Rules are not cached");
+  }
+
+  // Loading saved rules runs their code, the file must be protected.
+  if (!safePermissions(FLAGS_yara_rules_cache, path)) {
+    return Status(1, "Unsafe permissions on cached rules: " + path);
+  }
+
+  YR_RULES *tmp_rules = nullptr;
+  int result = yr_rules_load(path.c_str(), &tmp_rules);
+  if (result != ERROR_SUCCESS) {
+    return Status(1, "YARA load error " + std::to_string(result));
+  }
+
+  VLOG(1) << "Loaded cached YARA rules " << path;
+  *rules = tmp_rules;
+  return Status(0, "OK");
+}
+
+void saveYARARulesCache(const std::string &fingerprint, YR_RULES *rules) {
+  if (FLAGS_yara_rules_cache.empty() || fingerprint.empty() ||
+      rules == nullptr) {
+    return;
+  }
+
+  WriteLock lock(kYARARulesCacheMutex);
+  boost::system::error_code ec;
+  if (!fs::is_directory(FLAGS_yara_rules_cache, ec)) {
+    fs::create_directories(FLAGS_yara_rules_cache, ec);
+    platformChmod(FLAGS_yara_rules_cache, S_IRWXU);
+  }
+
+  // Rules are saved to a temporary path then renamed, readers never see a
+  // partial file.
+  auto path = getYARARulesCachePath(fingerprint);
+  auto temporary = path + "." + std::to_string(platformGetPid());
+  int result = yr_rules_save(rules, temporary.c_str());
+  if (result != ERROR_SUCCESS) {
+    VLOG(1) << "Could not save YARA rules: " << std::to_string(result);
+    fs::remove(temporary, ec);
+    return;
+  }
+
+  fs::rename(temporary, path, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+  }
+}
+
+void pruneYARARulesCache(const std::set<std::string> &fingerprints) {
+  if (FLAGS_yara_rules_cache.empty()) {
+    return;
+  }
+
+  std::vector<std::string> files;
+  if (!listFilesInDirectory(FLAGS_yara_rules_cache, files).ok()) {
+    return;
+  }
+
+  for (const auto &file : files) {
+    fs::path path(file);
+    if (path.extension() == kYARARulesCacheExtension &&
+        fingerprints.count(path.stem().string()) == 0) {
+      boost::system::error_code ec;
+      fs::remove(path, ec);
+    }
+  }
+}
+
 /**
  * Given a vector of strings, attempt to compile them and store the result
  * in the map under the given category.
@@ -121,10 +243,7 @@ Status handleRuleFiles(const std::string &category,
   bool compiled = false;
   for (const auto &item : rule_files) {
     YR_RULES *tmp_rules = nullptr;
-    auto rule = item.second.get("", "");
-    if (rule[0] != '/') {
-      rule = std::string("/etc/osquery/yara/") + rule;
-    }
+    auto rule = getYARARulePath(item.second.get("", ""));
 
     // First attempt to load the file, in case it is saved (pre-compiled)
     // rules. Sadly there is no way to load multiple compiled rules in
@@ -261,12 +380,36 @@ Status YARAConfigParserPlugin::update(const std::string &source,
     data_.add_child("signatures", signatures);
     for (const auto &element : signatures) {
       VLOG(1) << "Compiling YARA signature group: " << element.first;
-      auto status = handleRuleFiles(element.first, element.second, rules_);
-      if (!status.ok()) {
-        VLOG(1) << "YARA rule compile error: " << status.getMessage();
-        return status;
+      std::vector<std::string> files;
+      for (const auto &item : element.second) {
+        files.push_back(getYARARulePath(item.second.get("", "")));
       }
+      auto fingerprint = getYARAFingerprint(files);
+
+      // Rules compiled from the same sources are loaded from the cache.
+      YR_RULES *cached_rules = nullptr;
+      if (loadYARARulesCache(fingerprint, &cached_rules).ok()) {
+        if (rules_.count(element.first) > 0) {
+          yr_rules_destroy(rules_[element.first]);
+        }
+        rules_[element.first] = cached_rules;
+      } else {
+        auto status = handleRuleFiles(element.first, element.second, rules_);
+        if (!status.ok()) {
+          VLOG(1) << "YARA rule compile error: " << status.getMessage();
+          return status;
+        }
+        saveYARARulesCache(fingerprint, rules_[element.first]);
+      }
+      fingerprints_[element.first] = fingerprint;
+    }
+
+    // Remove compiled rules no group or signature file uses.
+    std::set<std::string> used;
+    for (const auto &fingerprint : fingerprints_) {
+      used.insert(fingerprint.second);
     }
+    pruneYARARulesCache(used);
   }
 
   // The "file_paths" set maps the rule groups to the "file_paths" top level
@@ -8,6 +8,8 @@
  *
  */
 
+#include <set>
+
 #include <osquery/config.h>
 #include <osquery/tables.h>
 
@@ -28,6 +30,51 @@ void YARACompilerCallback(int error_level,
 
 Status compileSingleFile(const std::string& file, YR_RULES** rule);
 
+/// Resolve a rule file path, relative paths are in /etc/osquery/yara.
+std::string getYARARulePath(const std::string& file);
+
+/**
+ * @brief Fingerprint the rule files of a signature group.
+ *
+ * The fingerprint is a hash of the path and content of each file. Cached scan
+ * results are reused only if they were scanned with the same fingerprint.
+ *
+ * @param files the resolved rule file paths, in compile order
+ * @return a hex digest of the rule files
+ */
+std::string getYARAFingerprint(const std::vector<std::string>& files);
+
+/**
+ * @brief Load the compiled rules saved for a rule fingerprint.
+ *
+ * With --yara_rules_cache, rules compiled from the same sources are loaded
+ * instead of compiled again. The saved rules are only loaded if the file
+ * and the cache directory have safe permissions.
+ *
+ * @param fingerprint the fingerprint of the rule files
+ * @param rules the output loaded rules
+ * @return Failure if there are no usable saved rules.
+ */
+Status loadYARARulesCache(const std::string& fingerprint, YR_RULES** rules);
+
+/// Save compiled rules for a rule fingerprint, if the cache is enabled.
+void saveYARARulesCache(const std::string& fingerprint, YR_RULES* rules);
+
+/// Remove saved rules whose fingerprint is not in the set.
+void pruneYARARulesCache(const std::set<std::string>& fingerprints);
+
+/// A compiled signature group, shared by scans of many files.
+struct YARARuleGroup {
+  /// The signature group or ad-hoc signature file name.
+  std::string name;
+
+  /// The compiled rules.
+  YR_RULES* rules{nullptr};
+
+  /// The fingerprint of the rule files, empty if results are not cached.
+  std::string fingerprint;
+};
+
 Status handleRuleFiles(const std::string& category,
                        const pt::ptree& rule_files,
                        std::map<std::string, YR_RULES*>& rules);
@@ -52,12 +99,18 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   // Retrieve compiled rules.
   std::map<std::string, YR_RULES*>& rules() { return rules_; }
 
+  /// Retrieve the fingerprint of each compiled group's rule files.
+  std::map<std::string, std::string>& fingerprints() { return fingerprints_; }
+
   Status setUp() override;
 
  private:
   // Store compiled rules in a map (group => rules).
   std::map<std::string, YR_RULES*> rules_;
 
+  // Store the fingerprint of each group's rule files (group => fingerprint).
+  std::map<std::string, std::string> fingerprints_;
+
   /// Store the signatures and file_paths and compile the rules.
   Status update(const std::string& source, const ParserConfig& config) override;
 };
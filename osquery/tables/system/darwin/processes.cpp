@@ -8,6 +8,7 @@
  *
  */
 
+#include <errno.h>
 #include <libproc.h>
 #include <mach/mach.h>
 #include <mach/mach_time.h>
@@ -17,6 +18,7 @@
 
 #include <array>
 #include <map>
+#include <mutex>
 #include <set>
 
 #include <boost/algorithm/string.hpp>
@@ -106,41 +108,126 @@ struct proc_cred {
   } real, effective, saved;
 };
 
-inline bool getProcCred(int pid, proc_cred& cred) {
-  struct proc_bsdinfo bsdinfo;
-  struct proc_bsdshortinfo bsdinfo_short;
-
-  if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 1, &bsdinfo, PROC_PIDTBSDINFO_SIZE) ==
-      PROC_PIDTBSDINFO_SIZE) {
-    cred.parent = bsdinfo.pbi_ppid;
-    cred.group = bsdinfo.pbi_pgid;
-    cred.status = bsdinfo.pbi_status;
-    cred.nice = bsdinfo.pbi_nice;
-    cred.real.uid = bsdinfo.pbi_ruid;
-    cred.real.gid = bsdinfo.pbi_rgid;
-    cred.effective.uid = bsdinfo.pbi_uid;
-    cred.effective.gid = bsdinfo.pbi_gid;
-    cred.saved.uid = bsdinfo.pbi_svuid;
-    cred.saved.gid = bsdinfo.pbi_svgid;
-    return true;
-  } else if (proc_pidinfo(pid,
-                          PROC_PIDT_SHORTBSDINFO,
-                          1,
-                          &bsdinfo_short,
-                          PROC_PIDT_SHORTBSDINFO_SIZE) ==
-             PROC_PIDT_SHORTBSDINFO_SIZE) {
-    cred.parent = bsdinfo_short.pbsi_ppid;
-    cred.group = bsdinfo_short.pbsi_pgid;
-    cred.status = bsdinfo_short.pbsi_status;
-    cred.real.uid = bsdinfo_short.pbsi_ruid;
-    cred.real.gid = bsdinfo_short.pbsi_rgid;
-    cred.effective.uid = bsdinfo_short.pbsi_uid;
-    cred.effective.gid = bsdinfo_short.pbsi_gid;
-    cred.saved.uid = bsdinfo_short.pbsi_svuid;
-    cred.saved.gid = bsdinfo_short.pbsi_svgid;
-    return true;
-  }
-  return false;
+/// Fill process credentials from a kernel process snapshot entry.
+static void getProcCred(const struct kinfo_proc& proc, proc_cred& cred) {
+  cred.parent = proc.kp_eproc.e_ppid;
+  cred.group = proc.kp_eproc.e_pgid;
+  cred.status = proc.kp_proc.p_stat;
+  cred.nice = proc.kp_proc.p_nice;
+  cred.real.uid = proc.kp_eproc.e_pcred.p_ruid;
+  cred.real.gid = proc.kp_eproc.e_pcred.p_rgid;
+  cred.effective.uid = proc.kp_eproc.e_ucred.cr_uid;
+  cred.effective.gid = proc.kp_eproc.e_ucred.cr_groups[0];
+  cred.saved.uid = proc.kp_eproc.e_pcred.p_svuid;
+  cred.saved.gid = proc.kp_eproc.e_pcred.p_svgid;
+}
+
+/**
+ * @brief Read the kernel's process table in one sysctl.
+ *
+ * When the query constrains pids only those processes are requested,
+ * otherwise a single KERN_PROC_ALL snapshot includes every process.
+ *
+ * @param context the query context, for pid constraints
+ * @param procs output, the snapshot entry for each process
+ * @return true if every process was requested
+ */
+static bool getProcSnapshot(const QueryContext& context,
+                            std::vector<struct kinfo_proc>& procs) {
+  if (context.constraints.count("pid") > 0 &&
+      context.constraints.at("pid").exists(EQUALS)) {
+    for (const auto& pid : getProcList(context)) {
+      int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
+      struct kinfo_proc proc;
+      size_t size = sizeof(proc);
+      if (sysctl(mib, 4, &proc, &size, nullptr, 0) == 0 &&
+          size == sizeof(proc)) {
+        procs.push_back(proc);
+      }
+    }
+    return false;
+  }
+
+  int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0};
+  // Processes may be created between sizing and reading the table.
+  for (size_t attempt = 0; attempt < 3; attempt++) {
+    size_t size = 0;
+    if (sysctl(mib, 4, nullptr, &size, nullptr, 0) == -1) {
+      break;
+    }
+    size += size / 8;
+    procs.resize(size / sizeof(struct kinfo_proc));
+    size = procs.size() * sizeof(struct kinfo_proc);
+    if (sysctl(mib, 4, procs.data(), &size, nullptr, 0) == 0) {
+      procs.resize(size / sizeof(struct kinfo_proc));
+      return true;
+    }
+    if (errno != ENOMEM) {
+      break;
+    }
+  }
+
+  VLOG(1) << "An error occurred retrieving the process list";
+  procs.clear();
+  return true;
+}
+
+/// Details that do not change for the lifetime of a process.
+struct CachedProcess {
+  struct timeval start_time{0, 0};
+  bool has_path{false};
+  std::string path;
+  bool has_cmdline{false};
+  std::string cmdline;
+};
+
+/**
+ * @brief Details of processes keyed by pid.
+ *
+ * A pid is reused by a new process with a different start time, entries are
+ * only used if the start times match.
+ */
+struct ProcessCache {
+  std::map<int, CachedProcess> processes;
+  std::mutex mutex;
+};
+
+static ProcessCache& getProcessCache() {
+  static ProcessCache cache;
+  return cache;
+}
+
+/// Get the cached details of a process, replacing any for a reused pid.
+static CachedProcess getCachedProcess(int pid, const struct timeval& start) {
+  auto& cache = getProcessCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  auto& cached = cache.processes[pid];
+  if (cached.start_time.tv_sec != start.tv_sec ||
+      cached.start_time.tv_usec != start.tv_usec) {
+    cached = CachedProcess();
+    cached.start_time = start;
+  }
+  return cached;
+}
+
+static void setCachedProcess(int pid, const CachedProcess& process) {
+  auto& cache = getProcessCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.processes[pid] = process;
+}
+
+/// Remove the details of processes that are not in a full snapshot.
+static void pruneProcessCache(const std::vector<struct kinfo_proc>& procs) {
+  std::set<int> pids;
+  for (const auto& proc : procs) {
+    pids.insert(proc.kp_proc.p_pid);
+  }
+
+  auto& cache = getProcessCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  for (auto it = cache.processes.begin(); it != cache.processes.end();) {
+    it = (pids.count(it->first) == 0) ? cache.processes.erase(it) : ++it;
+  }
 }
 
 // Get the max args space
@@ -234,71 +321,109 @@ QueryData genProcesses(QueryContext& context) {
     mach_timebase_info(&time_base);
   }
 
-  auto pidlist = getProcList(context);
+  std::vector<struct kinfo_proc> procs;
+  if (getProcSnapshot(context, procs)) {
+    pruneProcessCache(procs);
+  }
   int argmax = genMaxArgs();
 
-  for (auto& pid : pidlist) {
+  // Per-process calls are only made for the columns the query uses.
+  bool use_cmdline = context.isColumnUsed("cmdline");
+  bool use_path = context.isAnyColumnUsed({"path", "name", "on_disk"});
+  bool use_dirs = context.isAnyColumnUsed({"cwd", "root"});
+  bool use_rusage = context.isAnyColumnUsed({"wired_size",
+                                             "resident_size",
+                                             "total_size",
+                                             "user_time",
+                                             "system_time",
+                                             "start_time"});
+  bool use_threads = context.isColumnUsed("threads");
+
+  for (const auto& proc : procs) {
+    int pid = proc.kp_proc.p_pid;
+    if (pid <= 0) {
+      continue;
+    }
+
     Row r;
     r["pid"] = INTEGER(pid);
 
-    {
-      // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
+    proc_cred cred;
+    getProcCred(proc, cred);
+    r["parent"] = BIGINT(cred.parent);
+    r["pgroup"] = BIGINT(cred.group);
+    // check if process state is one of the expected ones
+    r["state"] = (1 <= cred.status && cred.status <= 5)
+                     ? TEXT(kProcessStateMapping[cred.status])
+                     : TEXT('?');
+    r["nice"] = INTEGER(cred.nice);
+    r["uid"] = BIGINT(cred.real.uid);
+    r["gid"] = BIGINT(cred.real.gid);
+    r["euid"] = BIGINT(cred.effective.uid);
+    r["egid"] = BIGINT(cred.effective.gid);
+    r["suid"] = BIGINT(cred.saved.uid);
+    r["sgid"] = BIGINT(cred.saved.gid);
+
+    // The path and arguments are cached for the lifetime of the process.
+    auto cached = getCachedProcess(pid, proc.kp_proc.p_starttime);
+    bool updated = false;
+    if (use_cmdline) {
+      if (!cached.has_cmdline) {
+        // The command line invocation including arguments.
+        auto args = getProcRawArgs(pid, argmax);
+        cached.cmdline = boost::algorithm::join(args.args, " ");
+        cached.has_cmdline = true;
+        updated = true;
+      }
+      r["cmdline"] = cached.cmdline;
     }
 
-    // The process relative root and current working directory.
-    genProcRootAndCWD(pid, r);
-
-    proc_cred cred;
-    if (getProcCred(pid, cred)) {
-      r["parent"] = BIGINT(cred.parent);
-      r["pgroup"] = BIGINT(cred.group);
-      // check if process state is one of the expected ones
-      r["state"] = (1 <= cred.status && cred.status <= 5)
-                       ? TEXT(kProcessStateMapping[cred.status])
-                       : TEXT('?');
-      r["nice"] = INTEGER(cred.nice);
-      r["uid"] = BIGINT(cred.real.uid);
-      r["gid"] = BIGINT(cred.real.gid);
-      r["euid"] = BIGINT(cred.effective.uid);
-      r["egid"] = BIGINT(cred.effective.gid);
-      r["suid"] = BIGINT(cred.saved.uid);
-      r["sgid"] = BIGINT(cred.saved.gid);
-    } else {
-      continue;
+    if (use_dirs) {
+      // The process relative root and current working directory.
+      genProcRootAndCWD(pid, r);
     }
 
-    // If the process is not a Zombie, try to find the path and name.
-    if (cred.status != 5) {
-      r["path"] = getProcPath(pid);
-      // OS X proc_name only returns 16 bytes, use the basename of the path.
-      r["name"] = fs::path(r["path"]).filename().string();
-    } else {
-      r["path"] = "";
-      std::vector<char> name(17);
-      proc_name(pid, name.data(), 16);
-      r["name"] = std::string(name.data());
+    if (use_path) {
+      // If the process is not a Zombie, try to find the path and name.
+      if (cred.status != 5) {
+        if (!cached.has_path) {
+          cached.path = getProcPath(pid);
+          cached.has_path = true;
+          updated = true;
+        }
+        r["path"] = cached.path;
+        // OS X proc_name only returns 16 bytes, use the basename of the path.
+        r["name"] = fs::path(r["path"]).filename().string();
+      } else {
+        r["path"] = "";
+        r["name"] = std::string(proc.kp_proc.p_comm);
+      }
+
+      // If the path of the executable that started the process is available
+      // and the path exists on disk, set on_disk to 1. If the path is not
+      // available, set on_disk to -1. If, and only if, the path of the
+      // executable is available and the file does NOT exist on disk, set
+      // on_disk to 0.
+      if (r["path"].empty()) {
+        r["on_disk"] = INTEGER(-1);
+      } else if (pathExists(r["path"])) {
+        r["on_disk"] = INTEGER(1);
+      } else {
+        r["on_disk"] = INTEGER(0);
+      }
     }
 
-    // If the path of the executable that started the process is available and
-    // the path exists on disk, set on_disk to 1. If the path is not
-    // available, set on_disk to -1. If, and only if, the path of the
-    // executable is available and the file does NOT exist on disk, set on_disk
-    // to 0.
-    if (r["path"].empty()) {
-      r["on_disk"] = INTEGER(-1);
-    } else if (pathExists(r["path"])) {
-      r["on_disk"] = INTEGER(1);
-    } else {
-      r["on_disk"] = INTEGER(0);
+    if (updated) {
+      setCachedProcess(pid, cached);
     }
 
     // systems usage and time information
     struct rusage_info_v2 rusage_info_data;
-    int status =
-        proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&rusage_info_data);
+    int status = -1;
+    if (use_rusage) {
+      status = proc_pid_rusage(
+          pid, RUSAGE_INFO_V2, (rusage_info_t*)&rusage_info_data);
+    }
     // proc_pid_rusage returns -1 if it was unable to gather information
     if (status == 0) {
       // size/memory information
@@ -324,8 +449,11 @@ QueryData genProcesses(QueryContext& context) {
     }
 
     struct proc_taskinfo task_info;
-    status =
-        proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
+    status = 0;
+    if (use_threads) {
+      status =
+          proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
+    }
     if (status == sizeof(task_info)) {
       r["threads"] = INTEGER(task_info.pti_threadnum);
     } else {
@@ -594,15 +722,16 @@ static std::string getProcPath(int pid) {
   return std::string(path);
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
-
+void genProcessMemoryMap(RowYield& yield, QueryContext& context) {
   auto pidlist = getProcList(context);
   for (const auto& pid : pidlist) {
+    // The task port is released before any rows for the process are yielded.
+    QueryData results;
     genProcessMemoryMap(pid, results);
+    for (auto& r : results) {
+      yield(r);
+    }
   }
-
-  return results;
 }
 }
 }
@@ -24,6 +24,7 @@
 #include <libprocstat.h>
 
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
 #include <osquery/tables.h>
@@ -219,19 +220,28 @@ QueryData genProcessEnvs(QueryContext& context) {
   return results;
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
+/// Release the process list even if the generator is not resumed.
+struct ProcstatScope : private boost::noncopyable {
+  struct kinfo_proc* procs{nullptr};
+  struct procstat* pstat{nullptr};
 
-  auto cnt = getProcesses(context, &pstat, &procs);
+  ~ProcstatScope() {
+    procstatCleanup(pstat, procs);
+  }
+};
+
+void genProcessMemoryMap(RowYield& yield, QueryContext& context) {
+  ProcstatScope scope;
+  auto cnt = getProcesses(context, &scope.pstat, &scope.procs);
 
   for (size_t i = 0; i < cnt; i++) {
-    genProcessMap(pstat, &procs[i], results);
+    // Each process's map entries are released before its rows are yielded.
+    QueryData results;
+    genProcessMap(scope.pstat, &scope.procs[i], results);
+    for (auto& r : results) {
+      yield(r);
+    }
   }
-
-  procstatCleanup(pstat, procs);
-  return results;
 }
 }
 }
@@ -8,24 +8,63 @@
  *
  */
 
-#include <iomanip>
-#include <sstream>
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 
+#include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
 #include <osquery/tables.h>
 
 #include "osquery/tables/system/hash.h"
 
 namespace osquery {
 
-#define HASH_CHUNK_SIZE 4096
+/// Files are read and hashed in chunks of this size.
+#define HASH_CHUNK_SIZE (1024 * 1024)
+
+/// Digests of chunks at least this large are computed on separate workers.
+#define HASH_CONCURRENT_SIZE (64 * 1024)
+
+FLAG(uint64,
+     hash_cache_max,
+     0,
+     "Max files with content hashes cached in the database (0 = disabled)");
+
+/// The use order of a persistent file cache domain.
+struct FileCacheOrder {
+  /// The keys of the cache, least recently used first.
+  std::list<std::string> order;
+
+  /// The position of each key in the cache order.
+  std::unordered_map<std::string, std::list<std::string>::iterator> keys;
+
+  /// The cached keys are read from the database on first use.
+  bool loaded{false};
+};
+
+/// The use order of each persistent file cache, by database domain.
+static std::map<std::string, FileCacheOrder> kFileCacheOrders;
+
+/// Protect access to the persistent file cache orders.
+static Mutex kFileCacheMutex;
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -74,12 +113,13 @@ std::string Hash::digest() {
   }
 
   // The hash value is only relevant as a hex digest.
-  std::stringstream digest;
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string digest(length_ * 2, '0');
   for (size_t i = 0; i < length_; i++) {
-    digest << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    digest[i * 2] = kHexDigits[hash[i] >> 4];
+    digest[i * 2 + 1] = kHexDigits[hash[i] & 0x0F];
   }
-
-  return digest.str();
+  return digest;
 }
 
 std::string hashFromBuffer(HashType hash_type,
@@ -90,25 +130,201 @@ std::string hashFromBuffer(HashType hash_type,
   return hash.digest();
 }
 
-MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash>> hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
-  };
+bool getFileCacheIdentity(const std::string& path,
+                          std::string& key,
+                          std::string& version) {
+#ifdef WIN32
+  return false;
+#else
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+    return false;
+  }
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+  const auto& mtime = info.st_mtimespec;
+  const auto& ctime = info.st_ctimespec;
+#else
+  const auto& mtime = info.st_mtim;
+  const auto& ctime = info.st_ctim;
+#endif
+  key = std::to_string(info.st_dev) + ":" + std::to_string(info.st_ino);
+  version = std::to_string(info.st_size) + ":" +
+            std::to_string(mtime.tv_sec) + "." +
+            std::to_string(mtime.tv_nsec) + ":" +
+            std::to_string(ctime.tv_sec) + "." + std::to_string(ctime.tv_nsec);
+  return true;
+#endif
+}
+
+void touchFileCache(const std::string& domain,
+                    const std::string& key,
+                    size_t max) {
+  std::vector<std::string> evicted;
+  {
+    WriteLock lock(kFileCacheMutex);
+    auto& cache = kFileCacheOrders[domain];
+    if (!cache.loaded) {
+      // Keys cached by a previous run are evicted first.
+      std::vector<std::string> keys;
+      scanDatabaseKeys(domain, keys);
+      for (const auto& cached : keys) {
+        if (cache.keys.count(cached) == 0) {
+          cache.keys[cached] = cache.order.insert(cache.order.end(), cached);
+        }
+      }
+      cache.loaded = true;
+    }
+
+    auto it = cache.keys.find(key);
+    if (it != cache.keys.end()) {
+      cache.order.splice(cache.order.end(), cache.order, it->second);
+    } else {
+      cache.keys[key] = cache.order.insert(cache.order.end(), key);
+    }
+
+    while (cache.order.size() > max) {
+      evicted.push_back(cache.order.front());
+      cache.keys.erase(cache.order.front());
+      cache.order.pop_front();
+    }
+  }
+
+  for (const auto& cached : evicted) {
+    deleteDatabaseValue(domain, cached);
+  }
+}
+
+/**
+ * @brief Computes one digest of a file's chunks on an executor worker.
+ *
+ * The worker's task is queued once for the whole file, each chunk is handed
+ * over without queuing a task. A chunk the worker has not claimed when the
+ * reader finishes is hashed by the reader, so a busy executor only makes the
+ * hashing serial.
+ */
+class DigestWorker : private boost::noncopyable {
+ public:
+  explicit DigestWorker(Hash& hash) : hash_(hash) {}
+
+  /// The worker's task, returns once stopped.
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      ready_.wait(lock, [this]() {
+        return stopped_ || (data_ != nullptr && !claimed_);
+      });
+      if (stopped_) {
+        return;
+      }
+
+      claimed_ = true;
+      auto data = data_;
+      auto size = size_;
+      lock.unlock();
+      hash_.update(data, size);
+      lock.lock();
+      data_ = nullptr;
+      done_.notify_one();
+    }
+  }
+
+  /// Hand over a chunk, the buffer is read until finish returns.
+  void update(const char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_ = data;
+    size_ = size;
+    claimed_ = false;
+    ready_.notify_one();
+  }
+
+  /// Wait for the chunk's digest update, or update it here if not claimed.
+  void finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (data_ != nullptr && !claimed_) {
+      auto data = data_;
+      auto size = size_;
+      data_ = nullptr;
+      lock.unlock();
+      hash_.update(data, size);
+      return;
+    }
+    done_.wait(lock, [this]() { return data_ == nullptr; });
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    ready_.notify_one();
+  }
+
+ private:
+  Hash& hash_;
+
+  /// The chunk handed over, until its update completes.
+  const char* data_{nullptr};
+  size_t size_{0};
+
+  /// The worker started the chunk's update.
+  bool claimed_{false};
 
+  bool stopped_{false};
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable done_;
+};
+
+static MultiHashes hashMultiFromRead(int mask, const std::string& path) {
+  // Only the requested digests are computed.
+  std::vector<std::pair<HashType, std::unique_ptr<Hash>>> hashes;
+  for (const auto& type : {HASH_TYPE_MD5, HASH_TYPE_SHA1, HASH_TYPE_SHA256}) {
+    if (mask & type) {
+      hashes.emplace_back(type, std::unique_ptr<Hash>(new Hash(type)));
+    }
+  }
+
+  // Workers for the digests after the first, started by the first large chunk.
+  std::vector<std::unique_ptr<DigestWorker>> workers;
+  TaskGroup group(TaskPriority::HIGH);
   auto s = readFile(path,
                     0,
                     HASH_CHUNK_SIZE,
                     false,
                     true,
-                    ([&hashes, &mask](std::string& buffer, size_t size) {
-                      for (auto& hash : hashes) {
-                        if (mask & hash.first) {
-                          hash.second->update(&buffer[0], size);
+                    ([&hashes, &workers, &group](std::string& buffer,
+                                                 size_t size) {
+                      const auto* data = buffer.data();
+                      if (hashes.size() == 1 || size < HASH_CONCURRENT_SIZE) {
+                        for (auto& hash : hashes) {
+                          hash.second->update(data, size);
                         }
+                        return;
+                      }
+
+                      if (workers.empty()) {
+                        for (size_t i = 1; i < hashes.size(); i++) {
+                          workers.emplace_back(
+                              new DigestWorker(*hashes[i].second));
+                          auto* worker = workers.back().get();
+                          group.run(
+                              bindQueryLimit([worker]() { worker->run(); }));
+                        }
+                      }
+
+                      // Each digest of a large chunk reads the same buffer.
+                      for (auto& worker : workers) {
+                        worker->update(data, size);
+                      }
+                      hashes[0].second->update(data, size);
+                      for (auto& worker : workers) {
+                        worker->finish();
                       }
                     }));
+  for (auto& worker : workers) {
+    worker->stop();
+  }
+  group.wait();
 
   MultiHashes mh;
   if (!s.ok()) {
@@ -116,14 +332,72 @@ MultiHashes hashMultiFromFile(int mask, const std::string& path) {
   }
 
   mh.mask = mask;
-  if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+  for (auto& hash : hashes) {
+    if (hash.first == HASH_TYPE_MD5) {
+      mh.md5 = hash.second->digest();
+    } else if (hash.first == HASH_TYPE_SHA1) {
+      mh.sha1 = hash.second->digest();
+    } else {
+      mh.sha256 = hash.second->digest();
+    }
   }
-  if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+  return mh;
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
+  std::string key;
+  std::string version;
+  if (FLAGS_hash_cache_max == 0 || !getFileCacheIdentity(path, key, version)) {
+    return hashMultiFromRead(mask, path);
   }
-  if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+
+  // The cached value is the version, mask, md5, sha1, and sha256.
+  MultiHashes mh;
+  std::string value;
+  if (getDatabaseValue(kHashes, key, value).ok()) {
+    std::vector<std::string> fields;
+    boost::split(fields, value, boost::is_any_of(","));
+    if (fields.size() == 5 && fields[0] == version) {
+      mh.mask = std::atoi(fields[1].c_str());
+      mh.md5 = std::move(fields[2]);
+      mh.sha1 = std::move(fields[3]);
+      mh.sha256 = std::move(fields[4]);
+    }
+  }
+
+  // Only digests missing from the cache are computed.
+  auto missing = mask & ~mh.mask;
+  if (missing == 0) {
+    touchFileCache(kHashes, key, FLAGS_hash_cache_max);
+    return mh;
+  }
+
+  auto hashes = hashMultiFromRead(missing, path);
+  if (hashes.mask != missing) {
+    return hashes;
+  }
+
+  mh.mask |= missing;
+  if (missing & HASH_TYPE_MD5) {
+    mh.md5 = std::move(hashes.md5);
+  }
+  if (missing & HASH_TYPE_SHA1) {
+    mh.sha1 = std::move(hashes.sha1);
+  }
+  if (missing & HASH_TYPE_SHA256) {
+    mh.sha256 = std::move(hashes.sha256);
+  }
+
+  // The hashes are not cached if the file changed while it was read.
+  std::string read_key;
+  std::string read_version;
+  if (getFileCacheIdentity(path, read_key, read_version) && read_key == key &&
+      read_version == version) {
+    setDatabaseValue(kHashes,
+                     key,
+                     version + "," + std::to_string(mh.mask) + "," + mh.md5 +
+                         "," + mh.sha1 + "," + mh.sha256);
+    touchFileCache(kHashes, key, FLAGS_hash_cache_max);
   }
   return mh;
 }
@@ -147,18 +421,39 @@ void genHashForFile(const std::string& path,
                     QueryData& results) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
+  // Only compute the hashes for columns used by the query.
+  int mask = 0;
+  mask |= (context.isColumnUsed("md5")) ? HASH_TYPE_MD5 : 0;
+  mask |= (context.isColumnUsed("sha1")) ? HASH_TYPE_SHA1 : 0;
+  mask |= (context.isColumnUsed("sha256")) ? HASH_TYPE_SHA256 : 0;
+
   Row r;
   if (context.isCached(path)) {
     r = context.getCache(path);
-  } else {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  }
+
+  // A cached row may be missing hashes not needed by a previous cursor.
+  int missing = mask;
+  missing &= (r.count("md5") > 0) ? ~HASH_TYPE_MD5 : ~0;
+  missing &= (r.count("sha1") > 0) ? ~HASH_TYPE_SHA1 : ~0;
+  missing &= (r.count("sha256") > 0) ? ~HASH_TYPE_SHA256 : ~0;
+  if (r.empty() || missing != 0) {
+    MultiHashes hashes;
+    if (missing != 0) {
+      hashes = hashMultiFromFile(missing, path);
+    }
 
     r["path"] = path;
     r["directory"] = dir;
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
+    if (missing & HASH_TYPE_MD5) {
+      r["md5"] = std::move(hashes.md5);
+    }
+    if (missing & HASH_TYPE_SHA1) {
+      r["sha1"] = std::move(hashes.sha1);
+    }
+    if (missing & HASH_TYPE_SHA256) {
+      r["sha256"] = std::move(hashes.sha256);
+    }
     context.setCache(path, r);
   }
   results.push_back(r);
@@ -190,6 +485,10 @@ QueryData genHash(QueryContext& context) {
 
   // Iterate through the file paths, adding the hash results
   for (const auto& path_string : paths) {
+    if (context.isLimitReached(results.size()) || context.isInterrupted()) {
+      return results;
+    }
+
     boost::filesystem::path path = path_string;
     if (!boost::filesystem::is_regular_file(path, ec)) {
       continue;
@@ -227,6 +526,12 @@ QueryData genHash(QueryContext& context) {
     // file.
     boost::filesystem::directory_iterator begin(directory), end;
     for (; begin != end; ++begin) {
+      if (context.isLimitReached(results.size()) || context.isInterrupted()) {
+        // Stop hashing once the query's LIMIT is satisfied or it is
+        // interrupted.
+        return results;
+      }
+
       if (boost::filesystem::is_regular_file(begin->path(), ec)) {
         genHashForFile(
             begin->path().string(), directory_string, context, results);
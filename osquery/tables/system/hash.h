@@ -29,7 +29,7 @@ enum HashType {
 
 /// A result structure for multiple hash requests.
 struct MultiHashes {
-  int mask;
+  int mask{0};
   std::string md5;
   std::string sha1;
   std::string sha256;
@@ -129,4 +129,33 @@ MultiHashes hashMultiFromFile(int mask, const std::string& path);
  * @return A string (hex) representation of the hash digest.
  */
 std::string hashFromBuffer(HashType hash_type, const void* buffer, size_t size);
+
+/**
+ * @brief Identify a file and the version of its content.
+ *
+ * Persistent caches of values computed from file content key each file by
+ * its identity, and the value is valid while the version is unchanged.
+ *
+ * @param path the file path, symlinks are followed
+ * @param key the device and inode of the file
+ * @param version the size, modification, and change time of the file
+ * @return false if the file is not a regular file or was not identified
+ */
+bool getFileCacheIdentity(const std::string& path,
+                          std::string& key,
+                          std::string& version);
+
+/**
+ * @brief Mark a key of a persistent file cache as used.
+ *
+ * The least recently used keys beyond the limit are deleted from the
+ * database domain. Keys left by a previous run are evicted first.
+ *
+ * @param domain the database domain of the cache
+ * @param key the used key
+ * @param max the max number of keys kept in the domain
+ */
+void touchFileCache(const std::string& domain,
+                    const std::string& key,
+                    size_t max);
 }
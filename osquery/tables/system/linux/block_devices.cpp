@@ -19,15 +19,16 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/hardware_inventory.h"
+
 namespace osquery {
 namespace tables {
 
-static void getBlockDevice(struct udev_device *dev, QueryData &results) {
-  Row r;
+static bool getBlockDevice(struct udev_device *dev, Row &r) {
   const char *name = udev_device_get_devnode(dev);
   if (name == nullptr) {
     // Cannot get devnode information from UDEV.
-    return;
+    return false;
   }
 
   // The device name may be blank but will have a string value.
@@ -78,7 +79,7 @@ static void getBlockDevice(struct udev_device *dev, QueryData &results) {
     blkid_free_probe(pr);
   }
 
-  results.push_back(r);
+  return true;
 }
 
 QueryData genBlockDevs(QueryContext &context) {
@@ -86,32 +87,8 @@ QueryData genBlockDevs(QueryContext &context) {
     VLOG(1) << "Not running as root, some column data not available";
   }
 
-  QueryData results;
-
-  struct udev *udev = udev_new();
-  if (udev == nullptr) {
-    return {};
-  }
-
-  struct udev_enumerate *enumerate = udev_enumerate_new(udev);
-  udev_enumerate_add_match_subsystem(enumerate, "block");
-  udev_enumerate_scan_devices(enumerate);
-
-  struct udev_list_entry *devices, *dev_list_entry;
-  devices = udev_enumerate_get_list_entry(enumerate);
-  udev_list_entry_foreach(dev_list_entry, devices) {
-    const char *path = udev_list_entry_get_name(dev_list_entry);
-    struct udev_device *dev = udev_device_new_from_syspath(udev, path);
-    if (path != nullptr && dev != nullptr) {
-      getBlockDevice(dev, results);
-    }
-    udev_device_unref(dev);
-  }
-
-  udev_enumerate_unref(enumerate);
-  udev_unref(udev);
-
-  return results;
+  // Devices are probed again only when udev reports a change.
+  return getHardwareInventory("block", getBlockDevice);
 }
 }
 }
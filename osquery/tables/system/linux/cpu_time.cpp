@@ -84,7 +84,7 @@ static void genCpuTimeLine(const std::string &line, QueryData &results) {
 QueryData genCpuTime(QueryContext &context) {
   QueryData results;
 
-  auto proc_lines = procFromFile(kProcStat);
+  auto proc_lines = procFromFile(getHostPath(kProcStat));
   for (const auto &line : proc_lines) {
     genCpuTimeLine(line, results);
   }
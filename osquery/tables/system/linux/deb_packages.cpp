@@ -18,6 +18,8 @@ extern "C" {
 #include <dpkg/parsedump.h>
 }
 
+#include <set>
+
 #include <boost/algorithm/string.hpp>
 
 #include <osquery/filesystem.h>
@@ -25,6 +27,8 @@ extern "C" {
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 namespace osquery {
 namespace tables {
 
@@ -71,12 +75,15 @@ void w_revision(struct varbuf *vb,
 
 /**
 * @brief Initialize dpkg and load packages into memory
+*
+* dpkg keeps a pointer to the database directory, it must outlive the
+* matching dpkg_teardown.
 */
-void dpkg_setup(struct pkg_array *packages) {
+void dpkg_setup(struct pkg_array *packages, const std::string &db_dir) {
   dpkg_set_progname("osquery");
   push_error_context();
 
-  dpkg_db_set_dir("/var/lib/dpkg/");
+  dpkg_db_set_dir(db_dir.c_str());
   modstatdb_init();
   modstatdb_open(msdbrw_readonly);
 
@@ -154,11 +161,12 @@ void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genDebPackages(QueryContext &context) {
+static QueryData genDebPackagesFromDatabase() {
   QueryData results;
 
-  if (!osquery::isDirectory(kDPKGPath)) {
-    TLOG << "Cannot find DPKG database: " << kDPKGPath;
+  auto db_dir = getHostPath(kDPKGPath);
+  if (!osquery::isDirectory(db_dir)) {
+    TLOG << "Cannot find DPKG database: " << db_dir;
     return results;
   }
 
@@ -166,7 +174,8 @@ QueryData genDebPackages(QueryContext &context) {
   dropper->dropTo("nobody");
 
   struct pkg_array packages;
-  dpkg_setup(&packages);
+  db_dir += "/";
+  dpkg_setup(&packages, db_dir);
 
   for (int i = 0; i < packages.n_pkgs; i++) {
     struct pkginfo *pkg = packages.pkgs[i];
@@ -183,5 +192,23 @@ QueryData genDebPackages(QueryContext &context) {
   dpkg_teardown(&packages);
   return results;
 }
+
+QueryData genDebPackages(QueryContext &context) {
+  // Lookups by name, such as from a join, copy their packages from the cache.
+  std::set<std::string> names;
+  std::function<bool(const Row &r)> filter = nullptr;
+  if (context.getLookupValues("name", names)) {
+    filter = [&names](const Row &r) {
+      auto name = r.find("name");
+      return name != r.end() && names.count(name->second) > 0;
+    };
+  }
+
+  return genCachedPackages("deb_packages",
+                           {getHostPath(kDPKGPath + "/status")},
+                           true,
+                           genDebPackagesFromDatabase,
+                           filter);
+}
 }
 }
@@ -16,31 +16,44 @@
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/identity_cache.h"
+
 namespace osquery {
 namespace tables {
 
 Mutex grpEnumerationMutex;
 
+static void genGroup(const GroupEntry& group, QueryData& results) {
+  Row r;
+  r["gid"] = INTEGER(group.gid);
+  r["gid_signed"] = INTEGER((int32_t)group.gid);
+  r["groupname"] = TEXT(group.name);
+  results.push_back(r);
+}
+
 QueryData genGroups(QueryContext& context) {
   QueryData results;
-  struct group* grp = nullptr;
-  std::set<long> groups_in;
 
-  WriteLock lock(grpEnumerationMutex);
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
-      Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t)grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
-      results.push_back(r);
-      groups_in.insert(grp->gr_gid);
+  std::set<std::string> gids;
+  if (context.getLookupValues("gid", gids)) {
+    GroupEntry group;
+    for (const auto& gid : gids) {
+      long agid{0};
+      if (safeStrtol(gid, 10, agid) && getCachedGroup(agid, group)) {
+        genGroup(group, results);
+      }
+    }
+    return results;
+  }
+
+  std::set<long> groups_in;
+  for (const auto& group : getCachedGroups()) {
+    if (groups_in.count(group.gid) == 0) {
+      genGroup(group, results);
+      groups_in.insert(group.gid);
     }
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
@@ -0,0 +1,189 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <memory>
+
+#include <osquery/core.h>
+#include <osquery/events.h>
+#include <osquery/logger.h>
+
+#include "osquery/tables/system/linux/hardware_inventory.h"
+
+namespace osquery {
+namespace tables {
+
+/// The subscriber whose udev events keep inventories current.
+const std::string kHardwareSubscriber = "hardware_events";
+
+namespace {
+
+/// The rows of a subsystem's devices, keyed by syspath.
+struct HardwareInventory {
+  bool valid{false};
+
+  /// The publisher's restart count when the subsystem was scanned.
+  size_t restarts{0};
+
+  HardwareRowGenerator generator;
+  std::map<std::string, Row> rows;
+};
+
+struct HardwareInventories {
+  std::map<std::string, HardwareInventory> inventories;
+  Mutex mutex;
+};
+
+HardwareInventories& getInventories() {
+  static HardwareInventories inventories;
+  return inventories;
+}
+
+using UdevRef = std::unique_ptr<struct udev, decltype(&udev_unref)>;
+using UdevDeviceRef =
+    std::unique_ptr<struct udev_device, decltype(&udev_device_unref)>;
+
+/**
+ * @brief Check if udev events are delivered for inventory updates.
+ *
+ * @param restarts output, the number of times the publisher restarted
+ */
+bool isInventoryLive(size_t& restarts) {
+  if (!EventFactory::exists(kHardwareSubscriber)) {
+    return false;
+  }
+
+  auto subscriber = EventFactory::getEventSubscriber(kHardwareSubscriber);
+  if (subscriber == nullptr ||
+      subscriber->state() != EventState::EVENT_RUNNING) {
+    return false;
+  }
+
+  auto publisher = EventFactory::getEventPublisher(subscriber->getType());
+  if (publisher == nullptr || !publisher->hasStarted() ||
+      publisher->isEnding()) {
+    return false;
+  }
+  restarts = publisher->restartCount();
+  return true;
+}
+
+/// Read every device in a subsystem.
+std::map<std::string, Row> scanSubsystem(
+    const std::string& subsystem, const HardwareRowGenerator& generator) {
+  std::map<std::string, Row> rows;
+  UdevRef handle(udev_new(), udev_unref);
+  if (handle == nullptr) {
+    VLOG(1) << "Could not get udev handle";
+    return rows;
+  }
+
+  auto enumerate = udev_enumerate_new(handle.get());
+  if (enumerate == nullptr) {
+    VLOG(1) << "Could not get udev_enumerate handle";
+    return rows;
+  }
+
+  udev_enumerate_add_match_subsystem(enumerate, subsystem.c_str());
+  udev_enumerate_scan_devices(enumerate);
+
+  struct udev_list_entry* entry = nullptr;
+  udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+    const char* path = udev_list_entry_get_name(entry);
+    if (path == nullptr) {
+      continue;
+    }
+
+    UdevDeviceRef device(udev_device_new_from_syspath(handle.get(), path),
+                         udev_device_unref);
+    Row r;
+    if (device != nullptr && generator(device.get(), r)) {
+      rows[path] = std::move(r);
+    }
+  }
+
+  udev_enumerate_unref(enumerate);
+  return rows;
+}
+
+QueryData toResults(const std::map<std::string, Row>& rows) {
+  QueryData results;
+  for (const auto& row : rows) {
+    results.push_back(row.second);
+  }
+  return results;
+}
+}
+
+QueryData getHardwareInventory(const std::string& subsystem,
+                               HardwareRowGenerator generator) {
+  auto& inventories = getInventories();
+  size_t restarts = 0;
+  if (!isInventoryLive(restarts)) {
+    {
+      // Events may be missed until the subscriber runs again.
+      WriteLock lock(inventories.mutex);
+      inventories.inventories.clear();
+    }
+    return toResults(scanSubsystem(subsystem, generator));
+  }
+
+  // Events for the subsystem wait while it is first scanned.
+  WriteLock lock(inventories.mutex);
+  auto& inventory = inventories.inventories[subsystem];
+  if (!inventory.valid || inventory.restarts != restarts) {
+    inventory.generator = generator;
+    inventory.rows = scanSubsystem(subsystem, generator);
+    inventory.restarts = restarts;
+    inventory.valid = true;
+  }
+  return toResults(inventory.rows);
+}
+
+void updateHardwareInventory(const std::string& action,
+                             const std::string& subsystem,
+                             const std::string& syspath) {
+  auto& inventories = getInventories();
+  WriteLock lock(inventories.mutex);
+  auto inventory = inventories.inventories.find(subsystem);
+  if (inventory == inventories.inventories.end() ||
+      !inventory->second.valid) {
+    return;
+  }
+
+  auto& rows = inventory->second.rows;
+  if (action == "remove") {
+    rows.erase(syspath);
+    return;
+  } else if (action == "move") {
+    // The event does not name the previous syspath, scan again.
+    inventory->second.valid = false;
+    return;
+  }
+
+  // Other actions, such as add, change, or bind, read the device again.
+  UdevRef handle(udev_new(), udev_unref);
+  if (handle == nullptr) {
+    inventory->second.valid = false;
+    return;
+  }
+
+  UdevDeviceRef device(
+      udev_device_new_from_syspath(handle.get(), syspath.c_str()),
+      udev_device_unref);
+  Row r;
+  if (device != nullptr && inventory->second.generator(device.get(), r)) {
+    rows[syspath] = std::move(r);
+  } else {
+    rows.erase(syspath);
+  }
+}
+}
+}
@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <libudev.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// Fill the row of a udev device, return false to skip the device.
+using HardwareRowGenerator = std::function<bool(struct udev_device*, Row&)>;
+
+/**
+ * @brief Get the rows of every device in a udev subsystem.
+ *
+ * While the hardware_events subscriber is running, the rows are kept in an
+ * inventory that is scanned once and updated from udev add, change, and
+ * remove events. Otherwise, or if the udev publisher restarted and may have
+ * missed events, the subsystem is scanned again.
+ *
+ * @param subsystem a udev subsystem such as "block"
+ * @param generator fills the row of each device
+ * @return a row for each device the generator did not skip
+ */
+QueryData getHardwareInventory(const std::string& subsystem,
+                               HardwareRowGenerator generator);
+
+/**
+ * @brief Update the inventory of a subsystem from a udev event.
+ *
+ * Added and changed devices are read again from their syspath, so the event's
+ * device does not need to outlive the event.
+ *
+ * @param action the udev action string, such as "add"
+ * @param subsystem the device's subsystem
+ * @param syspath the device's sysfs path
+ */
+void updateHardwareInventory(const std::string& action,
+                             const std::string& subsystem,
+                             const std::string& syspath);
+}
+}
@@ -0,0 +1,352 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <grp.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+#include <map>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/system/linux/identity_cache.h"
+#include "osquery/tables/system/user_groups.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     nss_cache_ttl,
+     300,
+     "Seconds NSS users and groups are cached, 0 disables the cache");
+
+namespace tables {
+
+extern Mutex pwdEnumerationMutex;
+extern Mutex grpEnumerationMutex;
+
+const std::string kPasswdPath = "/etc/passwd";
+const std::string kGroupPath = "/etc/group";
+
+namespace {
+
+/// A cached NSS database and the state of its local file.
+struct CachedDatabase {
+  std::string state;
+  size_t refreshed{0};
+  bool enumerated{false};
+};
+
+struct IdentityCache {
+  CachedDatabase passwd;
+  CachedDatabase group;
+
+  /// Users in enumeration order, and users found only by lookups.
+  std::vector<PasswdEntry> users;
+  std::map<uid_t, PasswdEntry> lookups;
+
+  /// Groups in enumeration order, and groups found only by lookups.
+  std::vector<GroupEntry> groups;
+  std::map<gid_t, GroupEntry> group_lookups;
+
+  /// The user_groups rows of each uid.
+  std::map<uid_t, QueryData> memberships;
+
+  Mutex mutex;
+};
+
+IdentityCache& getIdentityCache() {
+  static IdentityCache cache;
+  return cache;
+}
+
+/// Describe the device, inode, size, and modification time of a file.
+std::string getFileState(const std::string& path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return "-";
+  }
+  return std::to_string(info.st_dev) + ":" + std::to_string(info.st_ino) +
+         ":" + std::to_string(info.st_size) + ":" +
+         std::to_string(info.st_mtim.tv_sec) + "." +
+         std::to_string(info.st_mtim.tv_nsec);
+}
+
+/// Mark a database refreshed if its file changed or its entries expired.
+bool expireDatabase(CachedDatabase& database, const std::string& path) {
+  auto state = getFileState(path);
+  auto now = getUnixTime();
+  if (state == database.state &&
+      now < database.refreshed + FLAGS_nss_cache_ttl) {
+    return false;
+  }
+  database.state = state;
+  database.refreshed = now;
+  database.enumerated = false;
+  return true;
+}
+
+/// Expire cached entries, the cache mutex must be held.
+void expireIdentityCache(IdentityCache& cache) {
+  bool passwd = expireDatabase(cache.passwd, kPasswdPath);
+  bool group = expireDatabase(cache.group, kGroupPath);
+  if (passwd) {
+    cache.users.clear();
+    cache.lookups.clear();
+  }
+  if (group) {
+    cache.groups.clear();
+    cache.group_lookups.clear();
+  }
+  if (passwd || group) {
+    cache.memberships.clear();
+  }
+}
+
+PasswdEntry toPasswdEntry(const struct passwd* pwd) {
+  PasswdEntry user;
+  user.uid = pwd->pw_uid;
+  user.gid = pwd->pw_gid;
+  if (pwd->pw_name != nullptr) {
+    user.name = pwd->pw_name;
+  }
+  if (pwd->pw_gecos != nullptr) {
+    user.description = pwd->pw_gecos;
+  }
+  if (pwd->pw_dir != nullptr) {
+    user.directory = pwd->pw_dir;
+  }
+  if (pwd->pw_shell != nullptr) {
+    user.shell = pwd->pw_shell;
+  }
+  return user;
+}
+
+std::vector<PasswdEntry> enumerateUsers() {
+  std::vector<PasswdEntry> users;
+  WriteLock lock(pwdEnumerationMutex);
+  setpwent();
+  struct passwd* pwd = nullptr;
+  while ((pwd = getpwent()) != nullptr) {
+    users.push_back(toPasswdEntry(pwd));
+  }
+  endpwent();
+  return users;
+}
+
+GroupEntry toGroupEntry(const struct group* grp) {
+  GroupEntry group;
+  group.gid = grp->gr_gid;
+  if (grp->gr_name != nullptr) {
+    group.name = grp->gr_name;
+  }
+  return group;
+}
+
+std::vector<GroupEntry> enumerateGroups() {
+  std::vector<GroupEntry> groups;
+  WriteLock lock(grpEnumerationMutex);
+  setgrent();
+  struct group* grp = nullptr;
+  while ((grp = getgrent()) != nullptr) {
+    groups.push_back(toGroupEntry(grp));
+  }
+  endgrent();
+  return groups;
+}
+
+bool lookupGroup(gid_t gid, GroupEntry& group) {
+  WriteLock lock(grpEnumerationMutex);
+  auto grp = getgrgid(gid);
+  if (grp == nullptr) {
+    return false;
+  }
+  group = toGroupEntry(grp);
+  return true;
+}
+
+bool lookupUser(uid_t uid, PasswdEntry& user) {
+  WriteLock lock(pwdEnumerationMutex);
+  auto pwd = getpwuid(uid);
+  if (pwd == nullptr) {
+    return false;
+  }
+  user = toPasswdEntry(pwd);
+  return true;
+}
+
+bool lookupUser(const std::string& name, PasswdEntry& user) {
+  WriteLock lock(pwdEnumerationMutex);
+  auto pwd = getpwnam(name.c_str());
+  if (pwd == nullptr) {
+    return false;
+  }
+  user = toPasswdEntry(pwd);
+  return true;
+}
+
+QueryData lookupUserGroups(const PasswdEntry& user) {
+  QueryData results;
+  user_t<uid_t, gid_t> entry;
+  entry.name = user.name.c_str();
+  entry.uid = user.uid;
+  entry.gid = user.gid;
+  getGroupsForUser<uid_t, gid_t>(results, entry);
+  return results;
+}
+
+/// Find a user among the cached users, the cache mutex must be held.
+template <typename Predicate>
+bool findCachedUser(IdentityCache& cache,
+                    Predicate predicate,
+                    PasswdEntry& user) {
+  for (const auto& cached : cache.users) {
+    if (predicate(cached)) {
+      user = cached;
+      return true;
+    }
+  }
+  for (const auto& cached : cache.lookups) {
+    if (predicate(cached.second)) {
+      user = cached.second;
+      return true;
+    }
+  }
+  return false;
+}
+}
+
+std::vector<PasswdEntry> getCachedUsers() {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return enumerateUsers();
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  if (!cache.passwd.enumerated) {
+    cache.users = enumerateUsers();
+    cache.passwd.enumerated = true;
+  }
+  return cache.users;
+}
+
+bool getCachedUser(uid_t uid, PasswdEntry& user) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return lookupUser(uid, user);
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  auto matches = [uid](const PasswdEntry& cached) { return cached.uid == uid; };
+  if (findCachedUser(cache, matches, user)) {
+    return true;
+  }
+  if (!lookupUser(uid, user)) {
+    return false;
+  }
+  cache.lookups[user.uid] = user;
+  return true;
+}
+
+bool getCachedUser(const std::string& name, PasswdEntry& user) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return lookupUser(name, user);
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  auto matches = [&name](const PasswdEntry& cached) {
+    return cached.name == name;
+  };
+  if (findCachedUser(cache, matches, user)) {
+    return true;
+  }
+  if (!lookupUser(name, user)) {
+    return false;
+  }
+  cache.lookups[user.uid] = user;
+  return true;
+}
+
+std::vector<GroupEntry> getCachedGroups() {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return enumerateGroups();
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  if (!cache.group.enumerated) {
+    cache.groups = enumerateGroups();
+    cache.group.enumerated = true;
+  }
+  return cache.groups;
+}
+
+bool getCachedGroup(gid_t gid, GroupEntry& group) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return lookupGroup(gid, group);
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  for (const auto& cached : cache.groups) {
+    if (cached.gid == gid) {
+      group = cached;
+      return true;
+    }
+  }
+  auto lookup = cache.group_lookups.find(gid);
+  if (lookup != cache.group_lookups.end()) {
+    group = lookup->second;
+    return true;
+  }
+  if (!lookupGroup(gid, group)) {
+    return false;
+  }
+  cache.group_lookups[gid] = group;
+  return true;
+}
+
+QueryData getCachedUserGroups(const PasswdEntry& user) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return lookupUserGroups(user);
+  }
+
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  expireIdentityCache(cache);
+  auto membership = cache.memberships.find(user.uid);
+  if (membership != cache.memberships.end()) {
+    return membership->second;
+  }
+  auto results = lookupUserGroups(user);
+  cache.memberships[user.uid] = results;
+  return results;
+}
+
+void resetIdentityCache() {
+  auto& cache = getIdentityCache();
+  WriteLock lock(cache.mutex);
+  cache.passwd = CachedDatabase();
+  cache.group = CachedDatabase();
+  cache.users.clear();
+  cache.lookups.clear();
+  cache.groups.clear();
+  cache.group_lookups.clear();
+  cache.memberships.clear();
+}
+}
+}
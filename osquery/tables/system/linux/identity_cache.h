@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// A user from the NSS passwd database.
+struct PasswdEntry {
+  uid_t uid{0};
+  gid_t gid{0};
+  std::string name;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A group from the NSS group database.
+struct GroupEntry {
+  gid_t gid{0};
+  std::string name;
+};
+
+/**
+ * @brief Get every user NSS enumerates.
+ *
+ * Enumerating directory-backed NSS sources, such as SSSD or LDAP, may take
+ * seconds. The users are cached until /etc/passwd changes or for at most
+ * --nss_cache_ttl seconds.
+ */
+std::vector<PasswdEntry> getCachedUsers();
+
+/// Look up a user by uid, lookups of users NSS does not enumerate are cached.
+bool getCachedUser(uid_t uid, PasswdEntry& user);
+
+/// Look up a user by name, lookups of users NSS does not enumerate are cached.
+bool getCachedUser(const std::string& name, PasswdEntry& user);
+
+/**
+ * @brief Get every group NSS enumerates.
+ *
+ * The groups are cached until /etc/group changes or for at most
+ * --nss_cache_ttl seconds.
+ */
+std::vector<GroupEntry> getCachedGroups();
+
+/// Look up a group by gid, lookups of groups NSS does not enumerate are cached.
+bool getCachedGroup(gid_t gid, GroupEntry& group);
+
+/**
+ * @brief Get the user_groups rows of a user.
+ *
+ * Group memberships are cached until either /etc/passwd or /etc/group changes
+ * or for at most --nss_cache_ttl seconds.
+ */
+QueryData getCachedUserGroups(const PasswdEntry& user);
+
+/// Drop every cached user, group, and membership.
+void resetIdentityCache();
+}
+}
@@ -9,6 +9,7 @@
  */
 
 #include <fstream>
+#include <set>
 
 #include <boost/algorithm/string/trim.hpp>
 
@@ -24,18 +25,40 @@ namespace tables {
 
 static const std::string kKernelModulePath = "/proc/modules";
 
+/// Loaded modules have an init state below this path.
+static const std::string kKernelModuleSysPath = "/sys/module/";
+
 QueryData genKernelModules(QueryContext& context) {
   QueryData results;
 
-  if (!pathExists(kKernelModulePath).ok()) {
-    VLOG(1) << "Cannot find kernel modules proc file: " << kKernelModulePath;
+  // Lookups by name skip the module list when none of the modules are loaded.
+  std::set<std::string> names;
+  bool lookup = context.getLookupValues("name", names);
+  if (lookup) {
+    for (auto it = names.begin(); it != names.end();) {
+      if (it->empty() || it->find('/') != std::string::npos ||
+          !pathExists(getHostPath(kKernelModuleSysPath + *it + "/initstate"))
+               .ok()) {
+        it = names.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (names.empty()) {
+      return {};
+    }
+  }
+
+  auto path = getHostPath(kKernelModulePath);
+  if (!pathExists(path).ok()) {
+    VLOG(1) << "Cannot find kernel modules proc file: " << path;
     return {};
   }
 
   // Cannot seek to the end of procfs.
-  std::ifstream fd(kKernelModulePath, std::ios::in);
+  std::ifstream fd(path, std::ios::in);
   if (!fd) {
-    VLOG(1) << "Cannot read kernel modules from: " << kKernelModulePath;
+    VLOG(1) << "Cannot read kernel modules from: " << path;
     return {};
   }
 
@@ -43,6 +66,10 @@ QueryData genKernelModules(QueryContext& context) {
                                  std::istreambuf_iterator<char>());
 
   for (const auto& module : osquery::split(module_info, "\n")) {
+    if (lookup && names.count(module.substr(0, module.find(' '))) == 0) {
+      continue;
+    }
+
     Row r;
     auto details = osquery::split(module, " ");
     if (details.size() < 6) {
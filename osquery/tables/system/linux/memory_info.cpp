@@ -40,7 +40,7 @@ QueryData getMemoryInfo(QueryContext& context) {
   Row r;
 
   std::string meminfo_content;
-  if (forensicReadFile(kMemInfoPath, meminfo_content).ok()) {
+  if (forensicReadFile(getHostPath(kMemInfoPath), meminfo_content).ok()) {
     // Able to read meminfo file, now grab info we want
     for (const auto& line : split(meminfo_content, "\n")) {
       std::vector<std::string> tokens;
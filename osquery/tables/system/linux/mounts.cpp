@@ -8,49 +8,311 @@
  *
  */
 
-#include <mntent.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <sys/vfs.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
+
+FLAG(uint64,
+     mounts_statfs_timeout,
+     1000,
+     "Milliseconds the mounts table waits for statfs, 0 waits for every mount");
+
+FLAG(uint64,
+     mounts_statfs_ttl,
+     5,
+     "Seconds statfs results of each mount are cached, 0 disables the cache");
+
 namespace tables {
 
-QueryData genMounts(QueryContext &context) {
+const std::string kMountInfoPath = "/proc/self/mountinfo";
+
+/// Maximum number of helper threads calling statfs for a query.
+const size_t kStatfsThreads = 4;
+
+namespace {
+
+/// A mount from one read of the mount list.
+struct MountInfo {
+  std::string key;
+  std::string device;
+  std::string path;
+  std::string type;
+  std::string flags;
+};
+
+/// The last statfs result of a mount.
+struct StatfsEntry {
+  struct statfs st;
+  bool ok{false};
+
+  /// Unix time the result was read, 0 if there is no result.
+  size_t time{0};
+
+  /// A helper thread is calling statfs, it may be blocked on a hung mount.
+  bool in_flight{false};
+};
+
+struct StatfsCache {
+  std::map<std::string, StatfsEntry> entries;
+  Mutex mutex;
+};
+
+StatfsCache& getStatfsCache() {
+  static StatfsCache cache;
+  return cache;
+}
+
+/**
+ * @brief Mounts whose statfs is called by a set of helper threads.
+ *
+ * The batch is shared with the threads, which may outlive the query when a
+ * call blocks. Each index is taken once, either to call statfs or, after the
+ * deadline, to release the mount for a later query.
+ */
+struct StatfsBatch {
+  std::vector<std::string> keys;
+  std::vector<std::string> paths;
+  std::atomic<size_t> next{0};
+  std::chrono::steady_clock::time_point deadline;
+  bool wait_forever{false};
+
+  size_t done{0};
+  std::mutex mutex;
+  std::condition_variable finished;
+};
+
+/// Decode the octal escapes of spaces, tabs, newlines, and backslashes.
+std::string unescapeMountField(const std::string& field) {
+  std::string decoded;
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] == '\\' && i + 3 < field.size() &&
+        field.find_first_not_of("01234567", i + 1) >= i + 4) {
+      decoded += static_cast<char>(std::stoi(field.substr(i + 1, 3), 0, 8));
+      i += 3;
+    } else {
+      decoded += field[i];
+    }
+  }
+  return decoded;
+}
+
+/**
+ * @brief Parse the mount list from one read of mountinfo.
+ *
+ * Each line is: ID, parent ID, major:minor, root, mount point, mount options,
+ * optional fields, a separator, type, source, and superblock options. The
+ * flags combine the mount and superblock options, as /proc/mounts does.
+ */
+std::vector<MountInfo> parseMountInfo(const std::string& content) {
+  std::vector<MountInfo> mounts;
+  for (const auto& line : split(content, "\n")) {
+    auto fields = split(line, " ");
+    size_t separator = 6;
+    while (separator < fields.size() && fields[separator] != "-") {
+      separator++;
+    }
+    if (separator + 2 >= fields.size()) {
+      continue;
+    }
+
+    MountInfo mount;
+    mount.path = unescapeMountField(fields[4]);
+    mount.key = fields[0] + " " + mount.path;
+    mount.type = unescapeMountField(fields[separator + 1]);
+    mount.device = unescapeMountField(fields[separator + 2]);
+    mount.flags = fields[5];
+
+    // The superblock's rw or ro is the same as the mount's.
+    auto super_options = (separator + 3 < fields.size())
+                             ? split(fields[separator + 3], ",")
+                             : std::vector<std::string>();
+    for (const auto& option : super_options) {
+      if (option != "rw" && option != "ro") {
+        mount.flags += "," + option;
+      }
+    }
+    mounts.push_back(std::move(mount));
+  }
+  return mounts;
+}
+
+/// Call statfs for the next mounts of a batch, run by a detached thread.
+void runStatfsBatch(std::shared_ptr<StatfsBatch> batch) {
+  auto& cache = getStatfsCache();
+  size_t index = 0;
+  while ((index = batch->next++) < batch->paths.size()) {
+    StatfsEntry entry;
+    if (batch->wait_forever ||
+        std::chrono::steady_clock::now() < batch->deadline) {
+      entry.ok = (statfs(batch->paths[index].c_str(), &entry.st) == 0);
+      entry.time = getUnixTime();
+    }
+
+    {
+      WriteLock lock(cache.mutex);
+      auto& cached = cache.entries[batch->keys[index]];
+      if (entry.time > 0) {
+        cached = entry;
+      }
+      cached.in_flight = false;
+    }
+
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    batch->done++;
+    batch->finished.notify_all();
+  }
+}
+
+/**
+ * @brief Get the statfs results of mounts without blocking on hung mounts.
+ *
+ * Recent results are reused for --mounts_statfs_ttl seconds. Other mounts are
+ * read by helper threads, and the query waits for them until the timeout. A
+ * mount whose call is still blocked, such as a hung NFS mount, is skipped by
+ * later queries until the call returns, so helper threads do not pile up.
+ */
+std::map<std::string, struct statfs> getMountStats(
+    const std::vector<MountInfo>& mounts) {
+  auto& cache = getStatfsCache();
+  auto now = getUnixTime();
+  std::map<std::string, struct statfs> stats;
+  auto batch = std::make_shared<StatfsBatch>();
+  {
+    WriteLock lock(cache.mutex);
+    std::set<std::string> keys;
+    for (const auto& mount : mounts) {
+      keys.insert(mount.key);
+      auto& entry = cache.entries[mount.key];
+      if (entry.in_flight) {
+        continue;
+      }
+
+      if (entry.time > 0 && now < entry.time + FLAGS_mounts_statfs_ttl) {
+        if (entry.ok) {
+          stats[mount.key] = entry.st;
+        }
+      } else {
+        entry.in_flight = true;
+        batch->keys.push_back(mount.key);
+        batch->paths.push_back(mount.path);
+      }
+    }
+
+    // Forget unmounted mounts, unless a call is still blocked.
+    for (auto it = cache.entries.begin(); it != cache.entries.end();) {
+      if (keys.count(it->first) == 0 && !it->second.in_flight) {
+        it = cache.entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  if (batch->paths.empty()) {
+    return stats;
+  }
+
+  batch->wait_forever = (FLAGS_mounts_statfs_timeout == 0);
+  batch->deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(FLAGS_mounts_statfs_timeout);
+  auto threads = std::min(kStatfsThreads, batch->paths.size());
+  for (size_t i = 0; i < threads; i++) {
+    std::thread(runStatfsBatch, batch).detach();
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    auto complete = [&batch]() { return batch->done == batch->paths.size(); };
+    if (batch->wait_forever) {
+      batch->finished.wait(lock, complete);
+    } else {
+      batch->finished.wait_until(lock, batch->deadline, complete);
+    }
+  }
+
+  // Release mounts the blocked threads did not reach.
+  size_t index = 0;
+  while ((index = batch->next++) < batch->paths.size()) {
+    WriteLock lock(cache.mutex);
+    cache.entries[batch->keys[index]].in_flight = false;
+  }
+
+  ReadLock lock(cache.mutex);
+  for (const auto& key : batch->keys) {
+    auto entry = cache.entries.find(key);
+    if (entry != cache.entries.end() && entry->second.time >= now &&
+        entry->second.ok) {
+      stats[key] = entry->second.st;
+    }
+  }
+  return stats;
+}
+}
+
+QueryData genMounts(QueryContext& context) {
   QueryData results;
 
-  FILE *mounts = setmntent("/proc/mounts", "r");
-  if (mounts == nullptr) {
+  // The mount list is read at once, the kernel formats each line atomically.
+  std::string content;
+  if (!readFile(kMountInfoPath, content).ok()) {
     return {};
   }
+  auto mounts = parseMountInfo(content);
+
+  // Mounts are only asked for their usage when it is selected.
+  std::map<std::string, struct statfs> stats;
+  if (context.isAnyColumnUsed({"blocks_size",
+                               "blocks",
+                               "blocks_free",
+                               "blocks_available",
+                               "inodes",
+                               "inodes_free"})) {
+    stats = getMountStats(mounts);
+  }
 
   char real_path[PATH_MAX + 1] = {0};
-  struct mntent *ent = nullptr;
-  while ((ent = getmntent(mounts))) {
+  for (auto& mount : mounts) {
     Row r;
+    r["device_alias"] =
+        (realpath(mount.device.c_str(), real_path) != nullptr) ? real_path
+                                                               : mount.device;
+    r["device"] = std::move(mount.device);
+    r["path"] = std::move(mount.path);
+    r["type"] = std::move(mount.type);
+    r["flags"] = std::move(mount.flags);
 
-    r["device"] = std::string(ent->mnt_fsname);
-    r["device_alias"] = std::string(
-        realpath(ent->mnt_fsname, real_path) ? real_path : ent->mnt_fsname);
-    r["path"] = std::string(ent->mnt_dir);
-    r["type"] = std::string(ent->mnt_type);
-    r["flags"] = std::string(ent->mnt_opts);
-
-    struct statfs st;
-    if (!statfs(ent->mnt_dir, &st)) {
-      r["blocks_size"] = BIGINT(st.f_bsize);
-      r["blocks"] = BIGINT(st.f_blocks);
-      r["blocks_free"] = BIGINT(st.f_bfree);
-      r["blocks_available"] = BIGINT(st.f_bavail);
-      r["inodes"] = BIGINT(st.f_files);
-      r["inodes_free"] = BIGINT(st.f_ffree);
+    auto st = stats.find(mount.key);
+    if (st != stats.end()) {
+      r["blocks_size"] = BIGINT(st->second.f_bsize);
+      r["blocks"] = BIGINT(st->second.f_blocks);
+      r["blocks_free"] = BIGINT(st->second.f_bfree);
+      r["blocks_available"] = BIGINT(st->second.f_bavail);
+      r["inodes"] = BIGINT(st->second.f_files);
+      r["inodes_free"] = BIGINT(st->second.f_ffree);
     }
 
     results.push_back(std::move(r));
   }
-  endmntent(mounts);
 
   return results;
 }
@@ -8,6 +8,8 @@
  *
  */
 
+#include <cstring>
+
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
@@ -16,44 +18,47 @@
 namespace osquery {
 namespace tables {
 
-void genDescriptors(const std::string& process,
-                    const std::map<std::string, std::string>& descriptors,
-                    QueryData& results) {
-  for (const auto& fd : descriptors) {
-    if (fd.second.find("socket:") != std::string::npos ||
-        fd.second.find("anon_inode:") != std::string::npos ||
-        fd.second.find("pipe:") != std::string::npos) {
-      // This is NOT a vnode/file descriptor.
-      continue;
-    }
-
-    Row r;
-    r["pid"] = process;
-    r["fd"] = fd.first;
-    r["path"] = fd.second;
-    results.push_back(r);
-  }
-
-  return;
-}
+/// Virtual paths of descriptors that are NOT vnode/file descriptors.
+const std::vector<std::string> kNonFileDescriptors = {
+    "socket:", "anon_inode:", "pipe:",
+};
 
 QueryData genOpenFiles(QueryContext& context) {
-  QueryData results;
-
-  std::set<std::string> pids;
+  std::set<std::string> pid_set;
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
+    pid_set = context.constraints["pid"].getAll(EQUALS);
   } else {
-    osquery::procProcesses(pids);
+    osquery::procProcesses(pid_set);
   }
+  std::vector<std::string> pids(pid_set.begin(), pid_set.end());
 
-  for (const auto& process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      genDescriptors(process, descriptors, results);
-    }
-  }
+  // Each process's rows are generated by one thread, then merged in order.
+  const auto& path_constraints = context.constraints["path"];
+  std::vector<QueryData> process_results(pids.size());
+  procWalkDescriptors(
+      pids,
+      [&](size_t index, const char* fd, const char* link, size_t size) {
+        for (const auto& prefix : kNonFileDescriptors) {
+          if (strncmp(link, prefix.c_str(), prefix.size()) == 0) {
+            return;
+          }
+        }
+        // Paths the query cannot select are skipped before rows are built.
+        if (!path_constraints.matches(boost::string_ref(link, size))) {
+          return;
+        }
+
+        Row r;
+        r["pid"] = pids[index];
+        r["fd"] = fd;
+        r["path"] = std::string(link, size);
+        process_results[index].push_back(std::move(r));
+      });
 
+  QueryData results;
+  for (auto& rows : process_results) {
+    std::move(rows.begin(), rows.end(), std::back_inserter(results));
+  }
   return results;
 }
 }
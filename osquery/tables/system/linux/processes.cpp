@@ -9,7 +9,10 @@
  */
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_set>
 
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -17,22 +20,65 @@
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
-#include <boost/noncopyable.hpp>
 #include <boost/regex.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/sql/materialized_view.h"
 
 namespace osquery {
+
+FLAG(bool,
+     processes_metadata_cache,
+     false,
+     "Cache process path, cmdline, root, and on_disk between queries");
+
 namespace tables {
 
+/**
+ * @brief Process columns that do not change until the process execs.
+ *
+ * Metadata is cached per pid and reused while the process start_time and the
+ * /proc/N/exe link are unchanged. Deleting or replacing the binary changes the
+ * link, so on_disk is refreshed too. The process_events subscriber invalidates
+ * a pid when it execs, which also refreshes the cmdline of a process that
+ * execs the same binary. The cwd is not cached, it changes with chdir.
+ */
+struct ProcessMetadata {
+  std::string start_time;
+
+  /// The exe link as read, before on_disk removes a " (deleted)" suffix.
+  std::string exe;
+
+  std::string path;
+  std::string cmdline;
+  std::string root;
+  int on_disk{-1};
+
+  bool has_cmdline{false};
+  bool has_root{false};
+  bool has_on_disk{false};
+};
+
+/// The cached metadata of each pid.
+static std::map<std::string, ProcessMetadata> kProcessMetadata;
+
+/// Protect access to the process metadata cache.
+static Mutex kProcessMetadataMutex;
+
+void invalidateProcessMetadata(const std::string& pid) {
+  WriteLock lock(kProcessMetadataMutex);
+  kProcessMetadata.erase(pid);
+}
+
 inline std::string getProcAttr(const std::string& attr,
                                const std::string& pid) {
-  return "/proc/" + pid + "/" + attr;
+  return getHostPath("/proc/" + pid + "/" + attr);
 }
 
 inline std::string readProcCMDLine(const std::string& pid) {
@@ -100,10 +146,10 @@ Status deletedMatchesInode(const std::string& path, const std::string& pid) {
 
 std::set<std::string> getProcList(const QueryContext& context) {
   std::set<std::string> pidlist;
-  if (context.constraints.count("pid") > 0 &&
-      context.constraints.at("pid").exists(EQUALS)) {
-    for (const auto& pid : context.constraints.at("pid").getAll(EQUALS)) {
-      if (isDirectory("/proc/" + pid)) {
+  std::set<std::string> pids;
+  if (context.getLookupValues("pid", pids)) {
+    for (const auto& pid : pids) {
+      if (isDirectory(getHostPath("/proc/" + pid))) {
         pidlist.insert(pid);
       }
     }
@@ -135,155 +181,58 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
   }
 }
 
-void genProcessMap(const std::string& pid, QueryData& results) {
+void genProcessMap(const std::string& pid,
+                   const QueryContext& context,
+                   RowYield& yield) {
   auto map = getProcAttr("maps", pid);
 
   std::string content;
   readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
-    auto fields = osquery::split(line, " ");
+  iterateLines(content, [&](boost::string_ref line) {
+    auto fields = osquery::splitRef(line, " ");
     // If can't read address, not sure.
     if (fields.size() < 5) {
-      continue;
+      return;
+    }
+
+    // Anonymous mappings have an empty path.
+    auto path = (fields.size() > 5) ? fields[5] : boost::string_ref();
+    // Rows failing the compiled constraints are skipped before they are built.
+    if (!context.matches("permissions", fields[1]) ||
+        !context.matches("path", path)) {
+      return;
     }
 
     Row r;
     r["pid"] = pid;
     if (!fields[0].empty()) {
-      auto addresses = osquery::split(fields[0], "-");
+      auto addresses = osquery::splitRef(fields[0], "-");
       if (addresses.size() >= 2) {
-        r["start"] = "0x" + addresses[0];
-        r["end"] = "0x" + addresses[1];
+        r["start"] = "0x" + addresses[0].to_string();
+        r["end"] = "0x" + addresses[1].to_string();
       } else {
         // Problem with the address format.
-        continue;
+        return;
       }
     }
 
-    r["permissions"] = fields[1];
+    r["permissions"] = fields[1].to_string();
     try {
-      auto offset = std::stoll(fields[2], nullptr, 16);
+      auto offset = std::stoll(fields[2].to_string(), nullptr, 16);
       r["offset"] = (offset != 0) ? BIGINT(offset) : r["start"];
 
     } catch (const std::exception& e) {
       // Value was out of range or could not be interpreted as a hex long long.
       r["offset"] = "-1";
     }
-    r["device"] = fields[3];
-    r["inode"] = fields[4];
-
-    // Path name must be trimmed.
-    if (fields.size() > 5) {
-      boost::trim(fields[5]);
-      r["path"] = fields[5];
-    }
+    r["device"] = fields[3].to_string();
+    r["inode"] = fields[4].to_string();
+    r["path"] = path.to_string();
 
     // BSS with name in pathname.
-    r["pseudo"] = (fields[4] == "0" && !r["path"].empty()) ? "1" : "0";
-    results.push_back(std::move(r));
-  }
-}
-
-/**
- *  Output from string parsing /proc/<pid>/status.
- */
-struct SimpleProcStat : private boost::noncopyable {
- public:
-  std::string name;
-  std::string real_uid;
-  std::string real_gid;
-  std::string effective_uid;
-  std::string effective_gid;
-  std::string saved_uid;
-  std::string saved_gid;
-  std::string resident_size;
-  std::string total_size;
-  std::string state;
-  std::string parent;
-  std::string group;
-  std::string nice;
-  std::string threads;
-  std::string user_time;
-  std::string system_time;
-  std::string start_time;
-
-  /// For errors processing proc data.
-  Status status;
-
-  explicit SimpleProcStat(const std::string& pid);
-};
-
-SimpleProcStat::SimpleProcStat(const std::string& pid) {
-  std::string content;
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
-    auto start = content.find_last_of(")");
-    // Start parsing stats from ") <MODE>..."
-    if (start == std::string::npos || content.size() <= start + 2) {
-      status = Status(1, "Invalid /proc/stat header");
-      return;
-    }
-
-    auto details = osquery::split(content.substr(start + 2), " ");
-    if (details.size() <= 19) {
-      status = Status(1, "Invalid /proc/stat content");
-      return;
-    }
-
-    this->state = details.at(0);
-    this->parent = details.at(1);
-    this->group = details.at(2);
-    this->user_time = details.at(11);
-    this->system_time = details.at(12);
-    this->nice = details.at(16);
-    this->threads = details.at(17);
-    try {
-      this->start_time = TEXT(AS_LITERAL(BIGINT_LITERAL, details.at(19)) / 100);
-    } catch (const boost::bad_lexical_cast& e) {
-      this->start_time = "-1";
-    }
-  }
-
-  // /proc/N/status may be not available, or readable by this user.
-  if (!readFile(getProcAttr("status", pid), content).ok()) {
-    status = Status(1, "Cannot read /proc/status");
-    return;
-  }
-
-  for (const auto& line : osquery::split(content, "\n")) {
-    // Status lines are formatted: Key: Value....\n.
-    auto detail = osquery::split(line, ":", 1);
-    if (detail.size() != 2) {
-      continue;
-    }
-
-    // There are specific fields from each detail.
-    if (detail.at(0) == "Name") {
-      this->name = detail.at(1);
-    } else if (detail.at(0) == "VmRSS") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-      // Memory is reported in kB.
-      this->resident_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "VmSize") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-      // Memory is reported in kB.
-      this->total_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "Gid") {
-      // Format is: R E - -
-      auto gid_detail = osquery::split(detail.at(1), "\t");
-      if (gid_detail.size() == 4) {
-        this->real_gid = gid_detail.at(0);
-        this->effective_gid = gid_detail.at(1);
-        this->saved_gid = gid_detail.at(2);
-      }
-    } else if (detail.at(0) == "Uid") {
-      auto uid_detail = osquery::split(detail.at(1), "\t");
-      if (uid_detail.size() == 4) {
-        this->real_uid = uid_detail.at(0);
-        this->effective_uid = uid_detail.at(1);
-        this->saved_uid = uid_detail.at(2);
-      }
-    }
-  }
+    r["pseudo"] = (fields[4] == "0" && !path.empty()) ? "1" : "0";
+    yield(r);
+  });
 }
 
 /**
@@ -338,28 +287,63 @@ int getOnDisk(const std::string& pid, std::string& path) {
   }
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
-  // Parse the process stat and status.
-  SimpleProcStat proc_stat(pid);
-
-  if (!proc_stat.status.ok()) {
-    VLOG(1) << proc_stat.status.getMessage() << " for pid " << pid;
-    return;
+void genProcess(const ProcStat& proc_stat,
+                const QueryContext& context,
+                bool cache,
+                QueryData& results) {
+  const auto& pid = proc_stat.pid;
+
+  ProcessMetadata meta;
+  if (cache) {
+    ReadLock lock(kProcessMetadataMutex);
+    auto it = kProcessMetadata.find(pid);
+    if (it != kProcessMetadata.end() &&
+        it->second.start_time == proc_stat.start_time) {
+      meta = it->second;
+    }
   }
 
   Row r;
   r["pid"] = pid;
   r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
+  // Reading each /proc link or file is skipped if the column is not used.
+  // The exe link is read to validate cached metadata.
+  std::string exe;
+  if (context.isAnyColumnUsed({"path", "on_disk"}) ||
+      (cache && context.isAnyColumnUsed({"cmdline", "root"}))) {
+    exe = readProcLink("exe", pid);
+    if (context.isAnyColumnUsed({"path", "on_disk"})) {
+      r["path"] = exe;
+    }
+  }
+  if (cache && (meta.start_time != proc_stat.start_time || meta.exe != exe)) {
+    meta = ProcessMetadata();
+    meta.start_time = proc_stat.start_time;
+    meta.exe = exe;
+  }
   r["name"] = proc_stat.name;
   r["pgroup"] = proc_stat.group;
   r["state"] = proc_stat.state;
   r["nice"] = proc_stat.nice;
   r["threads"] = proc_stat.threads;
   // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
+  if (context.isColumnUsed("cmdline")) {
+    if (!meta.has_cmdline) {
+      meta.cmdline = readProcCMDLine(pid);
+      meta.has_cmdline = true;
+    }
+    r["cmdline"] = meta.cmdline;
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = readProcLink("cwd", pid);
+  }
+  if (context.isColumnUsed("root")) {
+    if (!meta.has_root) {
+      meta.root = readProcLink("root", pid);
+      meta.has_root = true;
+    }
+    r["root"] = meta.root;
+  }
   r["uid"] = proc_stat.real_uid;
   r["euid"] = proc_stat.effective_uid;
   r["suid"] = proc_stat.saved_uid;
@@ -367,7 +351,15 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["egid"] = proc_stat.effective_gid;
   r["sgid"] = proc_stat.saved_gid;
 
-  r["on_disk"] = INTEGER(getOnDisk(pid, r["path"]));
+  if (context.isColumnUsed("on_disk")) {
+    if (!meta.has_on_disk) {
+      meta.path = exe;
+      meta.on_disk = getOnDisk(pid, meta.path);
+      meta.has_on_disk = true;
+    }
+    r["path"] = meta.path;
+    r["on_disk"] = INTEGER(meta.on_disk);
+  }
 
   // size/memory information
   r["wired_size"] = "0"; // No support for unpagable counters in linux.
@@ -379,20 +371,112 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["system_time"] = proc_stat.system_time;
   r["start_time"] = proc_stat.start_time;
 
+  if (cache && (meta.has_cmdline || meta.has_root || meta.has_on_disk)) {
+    WriteLock lock(kProcessMetadataMutex);
+    kProcessMetadata[pid] = std::move(meta);
+  }
   results.push_back(r);
 }
 
+/// Remove the metadata of processes that exited.
+static void pruneProcessMetadata(const ProcSnapshot& snapshot) {
+  std::unordered_set<std::string> pids;
+  for (const auto& proc_stat : snapshot) {
+    pids.insert(proc_stat.pid);
+  }
+  WriteLock lock(kProcessMetadataMutex);
+  for (auto it = kProcessMetadata.begin(); it != kProcessMetadata.end();) {
+    it = (pids.count(it->first) > 0) ? std::next(it)
+                                     : kProcessMetadata.erase(it);
+  }
+}
+
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+  if (context.hasConstraint("pid", EQUALS)) {
+    for (const auto& pid : getProcList(context)) {
+      // Parse the process stat and status.
+      ProcStat proc_stat;
+      auto status = procReadStat(pid, proc_stat);
+      if (!status.ok()) {
+        VLOG(1) << status.getMessage() << " for pid " << pid;
+        continue;
+      }
+      genProcess(proc_stat, context, FLAGS_processes_metadata_cache, results);
+    }
+    return results;
   }
 
+  // Every process is read from a shared snapshot of /proc.
+  auto snapshot = procSnapshot();
+  for (const auto& proc_stat : *snapshot) {
+    genProcess(proc_stat, context, FLAGS_processes_metadata_cache, results);
+  }
+
+  if (FLAGS_processes_metadata_cache) {
+    pruneProcessMetadata(*snapshot);
+  }
   return results;
 }
 
+/**
+ * @brief The processes columns that change when a process execs.
+ *
+ * With processes_metadata_cache the cmdline and root are kept in the process
+ * metadata cache, which the process_events subscriber invalidates on exec.
+ * The other columns are read from the shared /proc snapshot. Rows are keyed by pid and start_time, so a
+ * reused pid is a new row.
+ */
+class ProcessView : public MaterializedView {
+ public:
+  ProcessView()
+      : columns_({"pid",
+                  "name",
+                  "path",
+                  "cmdline",
+                  "root",
+                  "parent",
+                  "pgroup",
+                  "nice",
+                  "uid",
+                  "euid",
+                  "suid",
+                  "gid",
+                  "egid",
+                  "sgid",
+                  "start_time"}) {
+    context_.colsUsed = UsedColumns(columns_.begin(), columns_.end());
+  }
+
+  const std::set<std::string>& columns() const override {
+    return columns_;
+  }
+
+  void scan(MaterializedRowCallback callback) override {
+    auto snapshot = procSnapshot();
+    QueryData rows;
+    for (const auto& proc_stat : *snapshot) {
+      rows.clear();
+      genProcess(proc_stat, context_, FLAGS_processes_metadata_cache, rows);
+      callback(proc_stat.pid + ":" + proc_stat.start_time, rows.back());
+    }
+
+    if (FLAGS_processes_metadata_cache) {
+      pruneProcessMetadata(*snapshot);
+    }
+  }
+
+ private:
+  std::set<std::string> columns_;
+
+  /// Only the view's columns are generated.
+  QueryContext context_;
+};
+
+static const bool kProcessViewRegistered =
+    registerMaterializedView("processes", std::make_shared<ProcessView>());
+
 QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
 
@@ -404,15 +488,13 @@ QueryData genProcessEnvs(QueryContext& context) {
   return results;
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
-
+void genProcessMemoryMap(RowYield& yield, QueryContext& context) {
   auto pidlist = getProcList(context);
   for (const auto& pid : pidlist) {
-    genProcessMap(pid, results);
+    if (context.matches("pid", pid)) {
+      genProcessMap(pid, context, yield);
+    }
   }
-
-  return results;
 }
 }
 }
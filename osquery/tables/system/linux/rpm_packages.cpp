@@ -23,6 +23,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/process.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -30,6 +31,20 @@ namespace tables {
 // Maximum number of files per RPM.
 #define MAX_RPM_FILES 2048
 
+/// The RPM database files modified when packages change.
+const std::vector<std::string> kRpmDatabases = {
+    "/var/lib/rpm/Packages", "/var/lib/rpm/rpmdb.sqlite",
+};
+
+/// The RPM database files below --host_root.
+static std::vector<std::string> getHostDatabases() {
+  std::vector<std::string> databases;
+  for (const auto& database : kRpmDatabases) {
+    databases.push_back(getHostPath(database));
+  }
+  return databases;
+}
+
 /**
  * @brief Return a string representation of the RPM tag type.
  *
@@ -87,7 +102,15 @@ class RpmEnvironmentManager : public boost::noncopyable {
   boost::optional<std::string> config_;
 };
 
-QueryData genRpmPackages(QueryContext& context) {
+/// Read the RPM database below --host_root.
+static void setRpmRoot(rpmts ts) {
+  auto root = getHostPath("/");
+  if (root != "/") {
+    rpmtsSetRootDir(ts, root.c_str());
+  }
+}
+
+static QueryData genRpmPackagesFromDatabase(QueryContext& context) {
   QueryData results;
 
   auto dropper = DropPrivileges::get();
@@ -104,6 +127,7 @@ QueryData genRpmPackages(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
+  setRpmRoot(ts);
   rpmdbMatchIterator matches;
   if (context.constraints["name"].exists(EQUALS)) {
     auto name = (*context.constraints["name"].getAll(EQUALS).begin());
@@ -136,6 +160,14 @@ QueryData genRpmPackages(QueryContext& context) {
   return results;
 }
 
+QueryData genRpmPackages(QueryContext& context) {
+  return genCachedPackages(
+      "rpm_packages",
+      getHostDatabases(),
+      !context.constraints["name"].exists(EQUALS),
+      [&context]() { return genRpmPackagesFromDatabase(context); });
+}
+
 QueryData genRpmPackageFiles(QueryContext& context) {
   QueryData results;
 
@@ -151,6 +183,7 @@ QueryData genRpmPackageFiles(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
+  setRpmRoot(ts);
   rpmdbMatchIterator matches;
   if (context.constraints["package"].exists(EQUALS)) {
     auto name = (*context.constraints["package"].getAll(EQUALS).begin());
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/linux/identity_cache.h"
+
+namespace osquery {
+
+DECLARE_uint64(nss_cache_ttl);
+
+namespace tables {
+
+class IdentityCacheTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    ttl_ = FLAGS_nss_cache_ttl;
+    resetIdentityCache();
+  }
+
+  void TearDown() override {
+    FLAGS_nss_cache_ttl = ttl_;
+    resetIdentityCache();
+  }
+
+ private:
+  uint64_t ttl_{0};
+};
+
+TEST_F(IdentityCacheTests, test_users) {
+  auto users = getCachedUsers();
+  ASSERT_FALSE(users.empty());
+  EXPECT_EQ(users.size(), getCachedUsers().size());
+
+  PasswdEntry root;
+  ASSERT_TRUE(getCachedUser(0, root));
+  EXPECT_EQ("root", root.name);
+
+  PasswdEntry by_name;
+  ASSERT_TRUE(getCachedUser("root", by_name));
+  EXPECT_EQ(0U, by_name.uid);
+  EXPECT_EQ(root.directory, by_name.directory);
+
+  PasswdEntry missing;
+  EXPECT_FALSE(getCachedUser("osquery_missing_user", missing));
+}
+
+TEST_F(IdentityCacheTests, test_groups_and_memberships) {
+  auto groups = getCachedGroups();
+  ASSERT_FALSE(groups.empty());
+
+  PasswdEntry root;
+  ASSERT_TRUE(getCachedUser(0, root));
+  auto memberships = getCachedUserGroups(root);
+  ASSERT_FALSE(memberships.empty());
+  EXPECT_EQ("0", memberships[0]["uid"]);
+
+  // The cache may be disabled, every call then queries NSS.
+  FLAGS_nss_cache_ttl = 0;
+  EXPECT_EQ(memberships.size(), getCachedUserGroups(root).size());
+  EXPECT_EQ(groups.size(), getCachedGroups().size());
+}
+}
+}
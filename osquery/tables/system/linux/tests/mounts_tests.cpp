@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+DECLARE_uint64(mounts_statfs_ttl);
+
+namespace tables {
+
+QueryData genMounts(QueryContext& context);
+
+class MountsTests : public testing::Test {};
+
+static Row getRootMount(QueryContext& context) {
+  for (const auto& row : genMounts(context)) {
+    if (row.at("path") == "/") {
+      return row;
+    }
+  }
+  return Row();
+}
+
+TEST_F(MountsTests, test_root_mount) {
+  auto ttl = FLAGS_mounts_statfs_ttl;
+  FLAGS_mounts_statfs_ttl = 60;
+
+  QueryContext context;
+  auto root = getRootMount(context);
+  ASSERT_FALSE(root.empty());
+  EXPECT_FALSE(root["type"].empty());
+  EXPECT_FALSE(root["flags"].empty());
+  ASSERT_EQ(1U, root.count("blocks"));
+
+  // The cached statfs result is reused.
+  auto cached = getRootMount(context);
+  EXPECT_EQ(root["blocks_size"], cached["blocks_size"]);
+  EXPECT_EQ(root["blocks"], cached["blocks"]);
+
+  // Usage is not read unless it is selected.
+  QueryContext paths;
+  paths.colsUsed = UsedColumns({"path", "type"});
+  auto unused = getRootMount(paths);
+  ASSERT_FALSE(unused.empty());
+  EXPECT_EQ(0U, unused.count("blocks"));
+  FLAGS_mounts_statfs_ttl = ttl;
+}
+}
+}
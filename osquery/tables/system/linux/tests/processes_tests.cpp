@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/sql/materialized_view.h"
+
+namespace osquery {
+
+DECLARE_bool(processes_metadata_cache);
+
+namespace tables {
+
+QueryData genProcesses(QueryContext& context);
+void invalidateProcessMetadata(const std::string& pid);
+void genProcessMemoryMap(RowYield& yield, QueryContext& context);
+
+class ProcessesTests : public testing::Test {};
+
+/// Select this process, the volatile columns are removed from the row.
+static Row getSelf() {
+  auto pid = std::to_string(getpid());
+  QueryContext context;
+  context.constraints["pid"].add(Constraint(EQUALS, pid));
+
+  auto results = genProcesses(context);
+  if (results.size() != 1) {
+    return Row();
+  }
+
+  auto row = results[0];
+  for (const auto& column :
+       {"user_time", "system_time", "resident_size", "total_size", "state"}) {
+    row.erase(column);
+  }
+  return row;
+}
+
+TEST_F(ProcessesTests, test_metadata_cache) {
+  auto cache = FLAGS_processes_metadata_cache;
+
+  FLAGS_processes_metadata_cache = false;
+  auto expected = getSelf();
+  ASSERT_FALSE(expected.empty());
+  EXPECT_FALSE(expected["path"].empty());
+  EXPECT_FALSE(expected["cmdline"].empty());
+
+  // The first query fills the cache and the second is answered from it.
+  FLAGS_processes_metadata_cache = true;
+  EXPECT_EQ(expected, getSelf());
+  EXPECT_EQ(expected, getSelf());
+
+  // An exec invalidates the pid, the metadata is read again.
+  invalidateProcessMetadata(std::to_string(getpid()));
+  EXPECT_EQ(expected, getSelf());
+
+  FLAGS_processes_metadata_cache = cache;
+}
+
+/// Check if a differential includes this process.
+static bool hasSelf(const QueryData& rows) {
+  auto pid = std::to_string(getpid());
+  for (const auto& row : rows) {
+    if (row.at("pid") == pid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST_F(ProcessesTests, test_materialized_view) {
+  // The first read adds every process with only the selected columns.
+  DiffResults dr;
+  ASSERT_TRUE(
+      getMaterializedDelta("test_view", "processes", {"pid", "path"}, dr)
+          .ok());
+  EXPECT_TRUE(hasSelf(dr.added));
+  ASSERT_FALSE(dr.added.empty());
+  EXPECT_EQ(2U, dr.added[0].size());
+
+  // This process is unchanged, it is not in the next read.
+  DiffResults next;
+  ASSERT_TRUE(
+      getMaterializedDelta("test_view", "processes", {"pid", "path"}, next)
+          .ok());
+  EXPECT_FALSE(hasSelf(next.added));
+  EXPECT_FALSE(hasSelf(next.removed));
+
+  // A changed selection starts again with every row added.
+  DiffResults changed;
+  ASSERT_TRUE(getMaterializedDelta(
+                  "test_view", "processes", {"pid", "cmdline"}, changed)
+                  .ok());
+  EXPECT_TRUE(hasSelf(changed.added));
+
+  // Pruning keeps the rows of the named queries only.
+  pruneMaterializedDeltas({"test_view"});
+  DiffResults kept;
+  ASSERT_TRUE(getMaterializedDelta(
+                  "test_view", "processes", {"pid", "cmdline"}, kept)
+                  .ok());
+  EXPECT_FALSE(hasSelf(kept.added));
+  pruneMaterializedDeltas({});
+  DiffResults pruned;
+  ASSERT_TRUE(getMaterializedDelta(
+                  "test_view", "processes", {"pid", "cmdline"}, pruned)
+                  .ok());
+  EXPECT_TRUE(hasSelf(pruned.added));
+  resetMaterializedDelta("test_view");
+
+  // Volatile columns are not maintained by the view.
+  DiffResults invalid;
+  EXPECT_FALSE(getMaterializedDelta(
+                   "test_view", "processes", {"pid", "user_time"}, invalid)
+                   .ok());
+  EXPECT_FALSE(
+      getMaterializedDelta("test_view", "time", {"minutes"}, invalid).ok());
+}
+
+/// Select the memory map of this process matching the constraints.
+static QueryData getSelfMap(QueryContext& context) {
+  context.constraints["pid"].add(Constraint(EQUALS, std::to_string(getpid())));
+
+  QueryData results;
+  RowGenerator::pull_type generator(
+      [&context](RowYield& yield) { genProcessMemoryMap(yield, context); });
+  for (auto& row : generator) {
+    results.push_back(row);
+  }
+  return results;
+}
+
+TEST_F(ProcessesTests, test_memory_map_constraints) {
+  QueryContext context;
+  auto all = getSelfMap(context);
+  ASSERT_FALSE(all.empty());
+
+  QueryData executable;
+  QueryData libc;
+  for (const auto& row : all) {
+    if (row.at("permissions") == "r-xp") {
+      executable.push_back(row);
+    }
+    if (boost::icontains(row.at("path"), "libc")) {
+      libc.push_back(row);
+    }
+  }
+
+  // Equality and LIKE constraints are applied while parsing the map.
+  QueryContext permissions;
+  permissions.constraints["permissions"].add(Constraint(EQUALS, "r-xp"));
+  EXPECT_EQ(executable, getSelfMap(permissions));
+
+  QueryContext path;
+  path.constraints["path"].add(Constraint(LIKE, "%LIBC%"));
+  EXPECT_EQ(libc, getSelfMap(path));
+
+  // A pid outside a range constraint is skipped.
+  QueryContext pid;
+  pid.constraints["pid"].affinity = INTEGER_TYPE;
+  pid.constraints["pid"].add(Constraint(LESS_THAN, std::to_string(getpid())));
+  EXPECT_TRUE(getSelfMap(pid).empty());
+}
+}
+}
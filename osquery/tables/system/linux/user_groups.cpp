@@ -8,46 +8,35 @@
  *
  */
 
-#include "osquery/tables/system/user_groups.h"
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/identity_cache.h"
+#include "osquery/tables/system/user_groups.h"
 
 namespace osquery {
 namespace tables {
 
-extern Mutex pwdEnumerationMutex;
-
 QueryData genUserGroups(QueryContext& context) {
   QueryData results;
-  struct passwd* pwd = nullptr;
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
+      PasswdEntry user;
+      if (safeStrtol(uid, 10, auid) && getCachedUser(auid, user)) {
+        auto groups = getCachedUserGroups(user);
+        results.insert(results.end(), groups.begin(), groups.end());
       }
     }
   } else {
-    WriteLock lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+    std::set<uid_t> users_in;
+    for (const auto& user : getCachedUsers()) {
+      if (users_in.count(user.uid) == 0) {
+        auto groups = getCachedUserGroups(user);
+        results.insert(results.end(), groups.begin(), groups.end());
+        users_in.insert(user.uid);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
@@ -8,10 +8,17 @@
  *
  */
 
+#include <fnmatch.h>
+
 #include <augeas.h>
 
+#include <map>
+#include <set>
+#include <vector>
+
 #include <boost/algorithm/string/join.hpp>
 
+#include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -140,20 +147,193 @@ void matchAugeasPattern(augeas* aug,
   free(matches);
 }
 
-QueryData genAugeas(QueryContext& context) {
-  augeas* aug = aug_init(nullptr, nullptr, AUG_NO_ERR_CLOSE | AUG_ENABLE_SPAN);
+/**
+ * @brief A long-lived Augeas handle that loads files as queries need them.
+ *
+ * The handle is initialized without loading files. Each lens's include globs
+ * are saved and replaced with only the files queries have requested, until a
+ * query needs every file. Augeas skips files whose mtime is unchanged since
+ * they were loaded, so repeated queries only parse files that changed.
+ */
+struct AugeasHandle {
+  augeas* aug{nullptr};
+
+  /// The original include globs of each lens, keyed by its load node.
+  std::map<std::string, std::vector<std::string>> lenses;
+
+  /// The files requested so far and if every file is loaded.
+  std::set<std::string> files;
+  bool all{false};
+
+  Mutex mutex;
+
+  ~AugeasHandle() {
+    if (aug != nullptr) {
+      aug_close(aug);
+    }
+  }
+};
+
+static AugeasHandle& getAugeasHandle() {
+  static AugeasHandle handle;
+  return handle;
+}
+
+/// Get the values of the nodes matching an Augeas path expression.
+static std::vector<std::pair<std::string, std::string>> getAugeasValues(
+    augeas* aug, const std::string& expression) {
+  std::vector<std::pair<std::string, std::string>> values;
+  char** matches = nullptr;
+  int len = aug_match(aug, expression.c_str(), &matches);
+  for (int i = 0; i < len; i++) {
+    const char* value = nullptr;
+    if (aug_get(aug, matches[i], &value) == 1) {
+      values.push_back(std::make_pair(matches[i], (value) ? value : ""));
+    }
+    free(matches[i]);
+  }
+  free(matches);
+  return values;
+}
+
+static Status initAugeasHandle(AugeasHandle& handle) {
+  handle.aug = aug_init(
+      nullptr, nullptr, AUG_NO_LOAD | AUG_NO_ERR_CLOSE | AUG_ENABLE_SPAN);
 
   // Handle initialization errors.
-  if (aug == nullptr) {
-    VLOG(1) << "An error has occurred while trying to initialize augeas";
-    return {};
-  } else if (aug_error(aug) != AUG_NOERROR) {
+  if (handle.aug == nullptr) {
+    return Status(1, "Cannot initialize augeas");
+  } else if (aug_error(handle.aug) != AUG_NOERROR) {
     // Do not use aug_error_details() here since augeas is not fully
     // initialized.
-    VLOG(1) << "An error has occurred while trying to initialize augeas: "
-            << aug_error_message(aug);
-    aug_close(aug);
-    return {};
+    auto message = std::string(aug_error_message(handle.aug));
+    aug_close(handle.aug);
+    handle.aug = nullptr;
+    return Status(1, message);
+  }
+
+  for (const auto& lens : getAugeasValues(handle.aug, "/augeas/load/*")) {
+    auto& incls = handle.lenses[lens.first];
+    for (const auto& incl : getAugeasValues(handle.aug, lens.first + "/incl")) {
+      incls.push_back(incl.second);
+    }
+  }
+  return Status(0);
+}
+
+/// Include only the requested files, or every file, in each lens.
+static void setAugeasIncludes(AugeasHandle& handle) {
+  for (const auto& lens : handle.lenses) {
+    auto incl = lens.first + "/incl";
+    aug_rm(handle.aug, incl.c_str());
+    for (const auto& glob : lens.second) {
+      if (handle.all) {
+        aug_set(handle.aug, (incl + "[last()+1]").c_str(), glob.c_str());
+        continue;
+      }
+
+      for (const auto& file : handle.files) {
+        if (fnmatch(glob.c_str(), file.c_str(), 0) == 0) {
+          aug_set(handle.aug, (incl + "[last()+1]").c_str(), file.c_str());
+        } else if (glob.compare(0, file.size() + 1, file + "/") == 0) {
+          // A requested directory includes the files below it.
+          aug_set(handle.aug, (incl + "[last()+1]").c_str(), glob.c_str());
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Load the files a query needs.
+ *
+ * @param handle an initialized handle, its mutex must be held
+ * @param files the file paths the query needs
+ * @param all true if the query needs every file
+ */
+static bool loadAugeasFiles(AugeasHandle& handle,
+                            const std::set<std::string>& files,
+                            bool all) {
+  bool changed = false;
+  if (all && !handle.all) {
+    handle.all = true;
+    changed = true;
+  } else if (!handle.all) {
+    for (const auto& file : files) {
+      changed = handle.files.insert(file).second || changed;
+    }
+  }
+
+  if (changed) {
+    setAugeasIncludes(handle);
+  }
+
+  if (aug_load(handle.aug) != 0) {
+    reportAugeasError(handle.aug);
+    return false;
+  }
+  return true;
+}
+
+/// Check if a lens includes a file path.
+static bool isAugeasFile(const AugeasHandle& handle, const std::string& path) {
+  for (const auto& lens : handle.lenses) {
+    for (const auto& glob : lens.second) {
+      if (fnmatch(glob.c_str(), path.c_str(), 0) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Find the file a node expression selects from.
+ *
+ * The literal part of a "/files" node expression, before any wildcard or
+ * predicate, is a file path followed by nodes within the file.
+ *
+ * @return false if the expression may select from any file
+ */
+static bool getNodeFile(const AugeasHandle& handle,
+                        const std::string& node,
+                        std::set<std::string>& files) {
+  const std::string kFiles = "/files";
+  if (node.compare(0, kFiles.size() + 1, kFiles + "/") != 0) {
+    return false;
+  }
+
+  auto end = node.find_first_of("*[|(", kFiles.size());
+  auto path = node.substr(kFiles.size(), end - kFiles.size());
+  if (path.find("//") != std::string::npos) {
+    return false;
+  }
+
+  // Each prefix of the path may be the file.
+  for (auto sep = path.find('/', 1);; sep = path.find('/', sep + 1)) {
+    auto prefix = path.substr(0, sep);
+    if (!prefix.empty() && prefix.back() != '/' &&
+        isAugeasFile(handle, prefix)) {
+      files.insert(prefix);
+      return true;
+    }
+    if (sep == std::string::npos) {
+      break;
+    }
+  }
+  return false;
+}
+
+QueryData genAugeas(QueryContext& context) {
+  auto& handle = getAugeasHandle();
+  WriteLock lock(handle.mutex);
+  if (handle.aug == nullptr) {
+    auto status = initAugeasHandle(handle);
+    if (!status.ok()) {
+      VLOG(1) << "An error has occurred while trying to initialize augeas: "
+              << status.getMessage();
+      return {};
+    }
   }
 
   QueryData results;
@@ -161,18 +341,31 @@ QueryData genAugeas(QueryContext& context) {
     // Allow requests via filesystem path.
     // We will request the pattern match by path using an optional argument.
     auto paths = context.constraints["path"].getAll(EQUALS);
+    if (!loadAugeasFiles(handle, paths, false)) {
+      return {};
+    }
     for (const auto& path : paths) {
-      matchAugeasPattern(aug, path, results, context, true);
+      matchAugeasPattern(handle.aug, path, results, context, true);
     }
   } else if (context.hasConstraint("node", EQUALS)) {
     auto nodes = context.constraints["node"].getAll(EQUALS);
+    std::set<std::string> files;
+    bool all = false;
+    for (const auto& node : nodes) {
+      all = !getNodeFile(handle, node, files) || all;
+    }
+    if (!loadAugeasFiles(handle, files, all)) {
+      return {};
+    }
     auto pattern = boost::algorithm::join(nodes, "|");
-    matchAugeasPattern(aug, pattern, results, context);
+    matchAugeasPattern(handle.aug, pattern, results, context);
   } else {
-    matchAugeasPattern(aug, "/files//*", results, context);
+    if (!loadAugeasFiles(handle, {}, true)) {
+      return {};
+    }
+    matchAugeasPattern(handle.aug, "/files//*", results, context);
   }
 
-  aug_close(aug);
   return results;
 }
 }
@@ -25,28 +25,19 @@ const std::vector<std::string> kSSHAuthorizedkeys = {".ssh/authorized_keys",
                                                      ".ssh/authorized_keys2"};
 
 void genSSHkeysForUser(const std::string& uid,
-                       const std::string& directory,
+                       const std::string& keys_file,
+                       const std::string& keys_content,
                        QueryData& results) {
-  for (const auto& kfile : kSSHAuthorizedkeys) {
-    boost::filesystem::path keys_file = directory;
-    keys_file /= kfile;
-
-    std::string keys_content;
-    if (!osquery::forensicReadFile(keys_file, keys_content).ok()) {
-      // Cannot read a specific keys file.
-      continue;
-    }
-    // Protocol 1 public key consist of: options, bits, exponent, modulus,
-    // comment; Protocol 2 public key consist of: options, keytype,
-    // base64-encoded key, comment.
-    for (const auto& line : split(keys_content, "\n")) {
-      if (!line.empty() && line[0] != '#') {
-        Row r;
-        r["uid"] = uid;
-        r["key"] = line;
-        r["key_file"] = keys_file.string();
-        results.push_back(r);
-      }
+  // Protocol 1 public key consist of: options, bits, exponent, modulus,
+  // comment; Protocol 2 public key consist of: options, keytype,
+  // base64-encoded key, comment.
+  for (const auto& line : split(keys_content, "\n")) {
+    if (!line.empty() && line[0] != '#') {
+      Row r;
+      r["uid"] = uid;
+      r["key"] = line;
+      r["key_file"] = keys_file;
+      results.push_back(r);
     }
   }
 }
@@ -54,13 +45,14 @@ void genSSHkeysForUser(const std::string& uid,
 QueryData getAuthorizedKeys(QueryContext& context) {
   QueryData results;
 
-  // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genSSHkeysForUser(row.at("uid"), row.at("directory"), results);
-    }
-  }
+  // Read the keys files of every user together.
+  readUsersFiles(usersFromContext(context),
+                 kSSHAuthorizedkeys,
+                 ([&results](const std::string& uid,
+                             const std::string& keys_file,
+                             std::string& keys_content) {
+                   genSSHkeysForUser(uid, keys_file, keys_content, results);
+                 }));
 
   return results;
 }
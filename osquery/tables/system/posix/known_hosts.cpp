@@ -24,26 +24,16 @@ namespace tables {
 const std::vector<std::string> kSSHKnownHostskeys = {".ssh/known_hosts"};
 
 void genSSHkeysForHosts(const std::string& uid,
-                        const std::string& directory,
+                        const std::string& keys_file,
+                        const std::string& keys_content,
                         QueryData& results) {
-  for (const auto& kfile : kSSHKnownHostskeys) {
-    boost::filesystem::path keys_file = directory;
-    keys_file /= kfile;
-
-    std::string keys_content;
-    if (!forensicReadFile(keys_file, keys_content).ok()) {
-      // Cannot read a specific keys file.
-      continue;
-    }
-
-    for (const auto& line : split(keys_content, "\n")) {
-      if (!line.empty() && line[0] != '#') {
-        Row r;
-        r["uid"] = uid;
-        r["key"] = line;
-        r["key_file"] = keys_file.string();
-        results.push_back(r);
-      }
+  for (const auto& line : split(keys_content, "\n")) {
+    if (!line.empty() && line[0] != '#') {
+      Row r;
+      r["uid"] = uid;
+      r["key"] = line;
+      r["key_file"] = keys_file;
+      results.push_back(r);
     }
   }
 }
@@ -51,13 +41,14 @@ void genSSHkeysForHosts(const std::string& uid,
 QueryData getKnownHostsKeys(QueryContext& context) {
   QueryData results;
 
-  // Iterate over each user
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genSSHkeysForHosts(row.at("uid"), row.at("directory"), results);
-    }
-  }
+  // Read the known hosts files of every user together.
+  readUsersFiles(usersFromContext(context),
+                 kSSHKnownHostskeys,
+                 ([&results](const std::string& uid,
+                             const std::string& keys_file,
+                             std::string& keys_content) {
+                   genSSHkeysForHosts(uid, keys_file, keys_content, results);
+                 }));
 
   return results;
 }
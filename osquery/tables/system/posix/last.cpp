@@ -8,49 +8,143 @@
  *
  */
 
-#include <vector>
+#include <string.h>
+
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <utmpx.h>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/fileops.h"
+
 namespace osquery {
 namespace tables {
 
+#ifdef __linux__
+/// Login records are read in blocks of this many records.
+const off_t kLastRecordsPerBlock = 256;
+
+/// The login records, glibc reads wtmp when the wtmpx name is missing.
+const std::vector<std::string> kLastFiles = {"/var/log/wtmpx",
+                                             "/var/log/wtmp"};
+#endif
+
+/// Copy a field that is not terminated when it fills its array.
+template <size_t N>
+static std::string utmpxField(const char (&field)[N]) {
+  return std::string(field, strnlen(field, N));
+}
+
+/**
+ * @brief Add the row for a login record.
+ *
+ * Records are filtered by username constraints before a row is built.
+ *
+ * @param ordered true if records are read in the order the query requested
+ * @return false if no more records are needed.
+ */
+static bool genLastRecord(const struct utmpx& ut,
+                          QueryContext& context,
+                          bool ordered,
+                          QueryData& results) {
+  auto username = utmpxField(ut.ut_user);
+  if (context.constraints["username"].notExistsOrMatches(username)) {
+    Row r;
+    r["username"] = std::move(username);
+    r["tty"] = utmpxField(ut.ut_line);
+    r["pid"] = INTEGER(ut.ut_pid);
+    r["type"] = INTEGER(ut.ut_type);
+    r["time"] = INTEGER(ut.ut_tv.tv_sec);
+    r["host"] = utmpxField(ut.ut_host);
+    results.push_back(std::move(r));
+  }
+  return !(ordered && context.isLimitReached(results.size()));
+}
+
+#ifdef __linux__
+/**
+ * @brief Read fixed-size login records from the first or the last.
+ *
+ * Records are read in blocks, a query for the newest logins reads only the
+ * end of the file.
+ */
+static void genLoginRecords(const std::string& path,
+                            bool reverse,
+                            QueryContext& context,
+                            bool ordered,
+                            QueryData& results) {
+  PlatformFile fd(path, PF_OPEN_EXISTING | PF_READ | PF_NONBLOCK);
+  if (!fd.isValid()) {
+    return;
+  }
+
+  // A partially written record at the end is skipped.
+  const auto record_size = static_cast<off_t>(sizeof(struct utmpx));
+  auto records = static_cast<off_t>(fd.size()) / record_size;
+  std::vector<struct utmpx> block(static_cast<size_t>(kLastRecordsPerBlock));
+  for (off_t done = 0; done < records;) {
+    auto count = std::min(records - done, kLastRecordsPerBlock);
+    auto first = (reverse) ? records - done - count : done;
+    auto bytes = count * record_size;
+    if (fd.seek(first * record_size, PF_SEEK_BEGIN) != first * record_size ||
+        fd.read(block.data(), static_cast<size_t>(bytes)) != bytes) {
+      return;
+    }
+
+    for (off_t i = 0; i < count; i++) {
+      auto index = static_cast<size_t>((reverse) ? count - 1 - i : i);
+      if (!genLastRecord(block[index], context, ordered, results)) {
+        return;
+      }
+    }
+    done += count;
+  }
+}
+#endif
+
 QueryData genLastAccess(QueryContext& context) {
   QueryData results;
+  // Records are kept in time order, a scan may follow or reverse it.
+  bool by_time = context.orderBy && *context.orderBy == "time";
+  bool newest = by_time && context.orderDescending;
+
+#ifdef __linux__
+  for (const auto& path : kLastFiles) {
+    if (pathExists(path).ok()) {
+      bool ordered = !context.orderBy || by_time;
+      genLoginRecords(path, newest, context, ordered, results);
+      break;
+    }
+  }
+#else
   struct utmpx* ut;
 #ifdef __APPLE__
+  bool ordered = !context.orderBy || newest;
   setutxent_wtmp(0); // 0 = reverse chronological order
 
   while ((ut = getutxent_wtmp()) != nullptr) {
 #else
-
-#ifndef __FreeBSD__
-  utmpxname("/var/log/wtmpx");
-#endif
+  bool ordered = !context.orderBy || (by_time && !newest);
   setutxent();
 
   while ((ut = getutxent()) != nullptr) {
 #endif
 
-    Row r;
-    r["username"] = TEXT(ut->ut_user);
-    r["tty"] = TEXT(ut->ut_line);
-    r["pid"] = INTEGER(ut->ut_pid);
-    r["type"] = INTEGER(ut->ut_type);
-    r["time"] = INTEGER(ut->ut_tv.tv_sec);
-    r["host"] = TEXT(ut->ut_host);
-
-    results.push_back(r);
+    if (!genLastRecord(*ut, context, ordered, results)) {
+      break;
+    }
   }
 
 #ifdef __APPLE__
   endutxent_wtmp();
 #else
   endutxent();
+#endif
 #endif
 
   return results;
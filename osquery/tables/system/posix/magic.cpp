@@ -11,48 +11,157 @@
 #include <stdio.h>
 #include <magic.h>
 
+#include <atomic>
+#include <vector>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
 #include <osquery/tables.h>
 
 namespace osquery {
+
+DECLARE_uint64(read_threads);
+
 namespace tables {
 
-QueryData genMagicData(QueryContext& context) {
-  QueryData results;
-  magic_t magic_cookie = nullptr;
+/// Minimum number of files identified by each thread.
+const size_t kMagicFilesPerThread = 16;
 
-  // No default flags
-  magic_cookie = magic_open(MAGIC_NONE);
+/**
+ * @brief Loaded magic cookies, kept for the life of the process.
+ *
+ * Loading parses the whole compiled magic database. A cookie is not
+ * thread-safe, so each identifying thread takes one from the pool and returns
+ * it when done. The pool grows to the number of concurrent threads.
+ */
+class MagicCookies {
+ public:
+  ~MagicCookies() {
+    for (auto cookie : idle_) {
+      magic_close(cookie);
+    }
+  }
+
+  /// Take a loaded cookie, or nullptr if the database cannot be loaded.
+  magic_t acquire() {
+    {
+      WriteLock lock(mutex_);
+      if (!idle_.empty()) {
+        auto cookie = idle_.back();
+        idle_.pop_back();
+        return cookie;
+      }
+    }
 
-  if (magic_cookie == nullptr) {
-    VLOG(1) << "Unable to initialize magic library";
-    return results;
+    // No default flags
+    auto cookie = magic_open(MAGIC_NONE);
+    if (cookie == nullptr) {
+      VLOG(1) << "Unable to initialize magic library";
+      return nullptr;
+    }
+    if (magic_load(cookie, nullptr) != 0) {
+      VLOG(1) << "Unable to load magic database : " << magic_error(cookie);
+      magic_close(cookie);
+      return nullptr;
+    }
+    return cookie;
   }
-  if (magic_load(magic_cookie, nullptr) != 0) {
-    VLOG(1) << "Unable to load magic database : " << magic_error(magic_cookie);
-    magic_close(magic_cookie);
-    return results;
+
+  void release(magic_t cookie) {
+    WriteLock lock(mutex_);
+    idle_.push_back(cookie);
   }
 
-  // Iterate through all the provided paths
-  auto paths = context.constraints["path"].getAll(EQUALS);
-  for (const auto& path_string : paths) {
-    Row r;
-    r["path"] = path_string;
-    r["data"] = magic_file(magic_cookie, path_string.c_str());
+ private:
+  std::vector<magic_t> idle_;
+  Mutex mutex_;
+};
+
+static MagicCookies& getMagicCookies() {
+  static MagicCookies cookies;
+  return cookies;
+}
+
+static std::string getMagic(magic_t cookie,
+                            const std::string& path,
+                            int flags) {
+  magic_setflags(cookie, flags);
+  auto magic = magic_file(cookie, path.c_str());
+  return (magic == nullptr) ? "" : magic;
+}
+
+/// Identify each file, in parallel across cookies from the pool.
+static void identifyFiles(const std::vector<std::string>& paths,
+                          QueryData& results) {
+  std::vector<Row> rows(paths.size());
+  std::vector<bool> identified(paths.size(), false);
 
-    // Retrieve MIME type
-    magic_setflags(magic_cookie, MAGIC_MIME_TYPE);
-    r["mime_type"] = magic_file(magic_cookie, path_string.c_str());
+  // Each worker takes the next path until all have been identified.
+  std::atomic<size_t> next(0);
+  auto worker = [&paths, &rows, &identified, &next]() {
+    auto& cookies = getMagicCookies();
+    auto cookie = cookies.acquire();
+    if (cookie == nullptr) {
+      return;
+    }
 
-    // Retrieve MIME encoding
-    magic_setflags(magic_cookie, MAGIC_MIME_ENCODING);
-    r["mime_encoding"] = magic_file(magic_cookie, path_string.c_str());
+    size_t index = 0;
+    while ((index = next++) < paths.size()) {
+      const auto& path = paths[index];
+      auto& r = rows[index];
+      r["path"] = path;
+      r["data"] = getMagic(cookie, path, MAGIC_NONE);
+      // Retrieve MIME type
+      r["mime_type"] = getMagic(cookie, path, MAGIC_MIME_TYPE);
+      // Retrieve MIME encoding
+      r["mime_encoding"] = getMagic(cookie, path, MAGIC_MIME_ENCODING);
+      identified[index] = true;
+    }
+    cookies.release(cookie);
+  };
 
-    results.push_back(r);
+  auto threads = std::min(static_cast<size_t>(FLAGS_read_threads),
+                          paths.size() / kMagicFilesPerThread);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit(worker));
   }
+  worker();
+  group.wait();
+
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (identified[i]) {
+      results.push_back(std::move(rows[i]));
+    }
+  }
+}
 
-  magic_close(magic_cookie);
+QueryData genMagicData(QueryContext& context) {
+  QueryData results;
+
+  // Resolve file paths for EQUALS and LIKE operations.
+  auto paths = context.constraints["path"].getAll(EQUALS);
+  context.expandConstraints(
+      "path",
+      LIKE,
+      paths,
+      ([&](const std::string& pattern, std::set<std::string>& out) {
+        std::vector<std::string> patterns;
+        auto status =
+            resolveFilePattern(pattern, patterns, GLOB_FILES | GLOB_NO_CANON);
+        if (status.ok()) {
+          for (const auto& resolved : patterns) {
+            out.insert(resolved);
+          }
+        }
+        return status;
+      }));
+
+  // Iterate through all the provided paths
+  identifyFiles(std::vector<std::string>(paths.begin(), paths.end()), results);
   return results;
 }
 }
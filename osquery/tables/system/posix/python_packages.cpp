@@ -17,6 +17,8 @@
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 namespace osquery {
 namespace tables {
 
@@ -60,7 +62,7 @@ void genPackage(const std::string& path, Row& r) {
   }
 }
 
-QueryData genPythonPackages(QueryContext& context) {
+static QueryData genPythonPackagesFromPaths() {
   QueryData results;
 
   for (const auto& key : kPythonPath) {
@@ -91,5 +93,12 @@ QueryData genPythonPackages(QueryContext& context) {
 
   return results;
 }
+
+QueryData genPythonPackages(QueryContext& context) {
+  // Installing or removing a package adds or removes a metadata directory.
+  std::vector<std::string> paths(kPythonPath.begin(), kPythonPath.end());
+  return genCachedPackages(
+      "python_packages", paths, true, genPythonPackagesFromPaths);
+}
 }
 }
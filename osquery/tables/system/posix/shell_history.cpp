@@ -8,86 +8,309 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/xpressive/xpressive.hpp>
 
 #include <osquery/core.h>
-#include <osquery/tables.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/sql.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/fileops.h"
 #include "osquery/tables/system/system_utils.h"
 
+namespace fs = boost::filesystem;
 namespace xp = boost::xpressive;
 
 namespace osquery {
+
+DECLARE_uint64(read_max);
+DECLARE_uint64(read_user_max);
+DECLARE_bool(disable_forensic);
+DECLARE_uint64(read_threads);
+
 namespace tables {
 
 const std::vector<std::string> kShellHistoryFiles = {
     ".bash_history", ".zsh_history", ".zhistory", ".history", ".sh_history",
 };
 
-void genShellHistoryForUser(const std::string& uid,
-                            const std::string& directory,
-                            QueryData& results) {
-  auto bash_timestamp_rx = xp::sregex::compile("^#(?P<timestamp>[0-9]+)$");
-  xp::smatch bash_timestamp_matches;
-  auto zsh_timestamp_rx = xp::sregex::compile(
-      "^: {0,10}(?P<timestamp>[0-9]{1,11}):[0-9]+;(?P<command>.*)$");
-  xp::smatch zsh_timestamp_matches;
-
-  for (const auto& hfile : kShellHistoryFiles) {
-    boost::filesystem::path history_file = directory;
-    history_file /= hfile;
-
-    std::string history_content;
-    if (!forensicReadFile(history_file, history_content).ok()) {
-      // Cannot read a specific history file.
-      continue;
+/// History files are parsed in blocks, they are never read whole.
+const size_t kShellHistoryBlockSize = 64 * 1024;
+
+/// Minimum number of history files parsed by each thread.
+const size_t kShellHistoryFilesPerThread = 16;
+
+/// Parse the lines of a history file, in file order, into rows.
+class ShellHistoryParser : private boost::noncopyable {
+ public:
+  ShellHistoryParser(const std::string& uid, const std::string& history_file)
+      : uid_(uid), history_file_(history_file) {
+    bash_timestamp_rx_ = xp::sregex::compile("^#(?P<timestamp>[0-9]+)$");
+    zsh_timestamp_rx_ = xp::sregex::compile(
+        "^: {0,10}(?P<timestamp>[0-9]{1,11}):[0-9]+;(?P<command>.*)$");
+  }
+
+  /// Parse the next line, returns true if it completed a row.
+  bool parse(std::string line, Row& r) {
+    if (line.empty()) {
+      return false;
     }
+    boost::algorithm::trim(line);
 
-    std::string prev_bash_timestamp;
-    for (const auto& line : split(history_content, "\n")) {
-      if (prev_bash_timestamp.empty() &&
-          xp::regex_search(line, bash_timestamp_matches, bash_timestamp_rx)) {
-        prev_bash_timestamp = bash_timestamp_matches["timestamp"];
-        continue;
-      }
+    if (prev_bash_timestamp_.empty() &&
+        xp::regex_search(line, bash_timestamp_matches_, bash_timestamp_rx_)) {
+      prev_bash_timestamp_ = bash_timestamp_matches_["timestamp"];
+      return false;
+    }
 
-      Row r;
+    if (!prev_bash_timestamp_.empty()) {
+      r["time"] = INTEGER(prev_bash_timestamp_);
+      r["command"] = std::move(line);
+      prev_bash_timestamp_.clear();
+    } else if (xp::regex_search(
+                   line, zsh_timestamp_matches_, zsh_timestamp_rx_)) {
+      r["time"] = INTEGER(zsh_timestamp_matches_["timestamp"]);
+      r["command"] = zsh_timestamp_matches_["command"];
+    } else {
+      r["command"] = std::move(line);
+    }
+
+    r["uid"] = uid_;
+    r["history_file"] = history_file_;
+    return true;
+  }
 
-      if (!prev_bash_timestamp.empty()) {
-        r["time"] = INTEGER(prev_bash_timestamp);
-        r["command"] = line;
-        prev_bash_timestamp.clear();
-      } else if (xp::regex_search(
-                     line, zsh_timestamp_matches, zsh_timestamp_rx)) {
-        r["time"] = INTEGER(zsh_timestamp_matches["timestamp"]);
-        r["command"] = zsh_timestamp_matches["command"];
+ private:
+  std::string uid_;
+  std::string history_file_;
+  std::string prev_bash_timestamp_;
+
+  xp::sregex bash_timestamp_rx_;
+  xp::sregex zsh_timestamp_rx_;
+  xp::smatch bash_timestamp_matches_;
+  xp::smatch zsh_timestamp_matches_;
+};
+
+/**
+ * @brief Parse complete lines of history content into rows.
+ *
+ * The content may begin within a line, that partial line and the row it
+ * starts are skipped.
+ *
+ * @param skipped set to the size of the skipped content, which is parsed
+ * again following the content that precedes it.
+ * @return the number of rows with a time.
+ */
+static size_t parseShellHistory(const std::string& uid,
+                                const std::string& history_file,
+                                const std::string& content,
+                                bool partial,
+                                QueryData& rows,
+                                size_t& skipped) {
+  ShellHistoryParser parser(uid, history_file);
+  size_t timed = 0;
+  size_t start = 0;
+  skipped = (partial) ? content.size() : 0;
+  if (partial) {
+    start = content.find('\n');
+    start = (start == std::string::npos) ? content.size() : start + 1;
+  }
+
+  bool skip = partial;
+  while (start < content.size()) {
+    auto end = content.find('\n', start);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+
+    Row r;
+    if (parser.parse(content.substr(start, end - start), r)) {
+      // The first row may be missing a timestamp from the preceding line.
+      if (skip) {
+        skip = false;
+        skipped = std::min(end + 1, content.size());
       } else {
-        r["command"] = line;
+        timed += (r.count("time") > 0) ? 1 : 0;
+        rows.push_back(std::move(r));
       }
+    }
+    start = end + 1;
+  }
+  return timed;
+}
 
-      r["uid"] = uid;
-      r["history_file"] = history_file.string();
-      results.push_back(r);
+/// Stream a history file from its beginning.
+static void genShellHistoryFile(const std::string& uid,
+                                const fs::path& history_file,
+                                const QueryContext& context,
+                                QueryData& rows) {
+  ShellHistoryParser parser(uid, history_file.string());
+  // The rows are generated in file order, a requested order may not be.
+  bool limited = !context.orderBy;
+  std::string line;
+  auto parse_line = [&]() {
+    Row r;
+    if (!(limited && context.isLimitReached(rows.size())) &&
+        parser.parse(std::move(line), r)) {
+      rows.push_back(std::move(r));
     }
+    line.clear();
+  };
+
+  readFile(history_file,
+           0,
+           kShellHistoryBlockSize,
+           false,
+           true,
+           ([&line, &parse_line](std::string& buffer, size_t size) {
+             size_t start = 0;
+             for (size_t i = 0; i < size; i++) {
+               if (buffer[i] == '\n') {
+                 line.append(buffer, start, i - start);
+                 parse_line();
+                 start = i + 1;
+               }
+             }
+             line.append(buffer, start, size - start);
+           }));
+  parse_line();
+}
+
+/**
+ * @brief Parse the newest entries of a history file.
+ *
+ * Shells append to their history files, so the entries of a file are assumed
+ * to be in time order. The file is read backward in blocks until it has at
+ * least count rows with a time, which are the file's newest rows. Each block
+ * is parsed once, with the skipped start of the block that follows it.
+ *
+ * @return false if the file could not be read from its end.
+ */
+static bool genShellHistoryTail(const std::string& uid,
+                                const fs::path& history_file,
+                                size_t count,
+                                QueryData& rows) {
+  PlatformFile fd(history_file.string(),
+                  PF_OPEN_EXISTING | PF_READ | PF_NONBLOCK);
+  if (!fd.isValid() || fd.isSpecialFile()) {
+    return false;
+  }
+
+  PlatformTime times;
+  fd.getFileTimes(times);
+
+  // The ownership is only inspected if the file exceeds the user limit.
+  auto size = static_cast<off_t>(fd.size());
+  auto read_max =
+      static_cast<off_t>(std::min(FLAGS_read_max, FLAGS_read_user_max));
+  if (size > read_max && fd.isOwnerRoot().ok()) {
+    read_max = static_cast<off_t>(FLAGS_read_max);
   }
+  auto offset = size;
+  size_t timed = 0;
+  std::string carry;
+  std::vector<QueryData> blocks;
+  while (offset > 0 && size - offset < read_max) {
+    auto block = std::min(offset, static_cast<off_t>(kShellHistoryBlockSize));
+    offset -= block;
+    std::string buffer(static_cast<size_t>(block), '\0');
+    if (fd.seek(offset, PF_SEEK_BEGIN) != offset ||
+        fd.read(&buffer[0], buffer.size()) != static_cast<ssize_t>(block)) {
+      break;
+    }
+    buffer.append(carry);
+
+    QueryData block_rows;
+    size_t skipped = 0;
+    timed += parseShellHistory(uid,
+                               history_file.string(),
+                               buffer,
+                               offset > 0,
+                               block_rows,
+                               skipped);
+    carry = buffer.substr(0, skipped);
+    blocks.push_back(std::move(block_rows));
+    if (timed >= count) {
+      break;
+    }
+  }
+
+  // The blocks were parsed from the end of the file.
+  rows.clear();
+  for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+    rows.insert(rows.end(),
+                std::make_move_iterator(it->begin()),
+                std::make_move_iterator(it->end()));
+  }
+
+  if (!FLAGS_disable_forensic) {
+    fd.setFileTimes(times);
+  }
+  return true;
 }
 
 QueryData genShellHistory(QueryContext& context) {
   QueryData results;
 
-  // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genShellHistoryForUser(row.at("uid"), row.at("directory"), results);
+  // Users are selected by the uid constraints before any file is opened.
+  std::vector<const std::string*> uids;
+  std::vector<fs::path> paths;
+  auto users = usersFromContext(context);
+  for (const auto& user : users) {
+    if (user.count("uid") == 0 || user.count("directory") == 0) {
+      continue;
+    }
+    for (const auto& file : kShellHistoryFiles) {
+      auto history_file = fs::path(user.at("directory")) / file;
+      if (pathExists(history_file).ok()) {
+        uids.push_back(&user.at("uid"));
+        paths.push_back(std::move(history_file));
+      }
     }
   }
 
+  // A query for the newest entries reads the end of each file.
+  bool newest = context.limit && context.orderBy &&
+                *context.orderBy == "time" && context.orderDescending;
+
+  // Each worker takes the next file until all have been parsed.
+  std::vector<QueryData> rows(paths.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    size_t index = 0;
+    while ((index = next++) < paths.size()) {
+      if (!newest ||
+          !genShellHistoryTail(
+              *uids[index], paths[index], *context.limit, rows[index])) {
+        genShellHistoryFile(*uids[index], paths[index], context, rows[index]);
+      }
+    }
+  };
+
+  auto threads = std::min(static_cast<size_t>(FLAGS_read_threads),
+                          paths.size() / kShellHistoryFilesPerThread);
+  TaskGroup group(TaskPriority::HIGH);
+  for (size_t i = 1; i < threads; i++) {
+    group.run(bindQueryLimit(worker));
+  }
+  worker();
+  group.wait();
+
+  for (auto& file_rows : rows) {
+    results.insert(results.end(),
+                   std::make_move_iterator(file_rows.begin()),
+                   std::make_move_iterator(file_rows.end()));
+  }
   return results;
 }
 }
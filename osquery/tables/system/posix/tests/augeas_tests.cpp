@@ -51,6 +51,20 @@ TEST_F(AugeasTests, select_by_path_expression_with_or) {
   ASSERT_EQ(results.rows()[1].at("path"), "/etc/resolv.conf");
 }
 
+TEST_F(AugeasTests, select_files_loaded_by_earlier_queries) {
+  // Each query loads the files it needs into the shared handle.
+  auto hosts = SQL("select * from augeas where path = '/etc/hosts'");
+  ASSERT_FALSE(hosts.rows().empty());
+
+  auto resolv =
+      SQL("select * from augeas where node = '/files/etc/resolv.conf'");
+  ASSERT_EQ(resolv.rows().size(), 1U);
+  EXPECT_EQ(resolv.rows()[0].at("path"), "/etc/resolv.conf");
+
+  auto again = SQL("select * from augeas where path = '/etc/hosts'");
+  EXPECT_EQ(hosts.rows().size(), again.rows().size());
+}
+
 TEST_F(AugeasTests, select_hosts_by_node) {
   auto results = SQL("select * from augeas where node = '/files/etc/hosts'");
   ASSERT_GE(results.rows().size(), 1U);
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/sql.h>
+
+namespace osquery {
+namespace tables {
+
+class MagicTests : public testing::Test {};
+
+TEST_F(MagicTests, select_by_path) {
+  auto results = SQL("select * from magic where path = '/bin/ls'");
+  ASSERT_EQ(results.rows().size(), 1U);
+  EXPECT_FALSE(results.rows()[0].at("data").empty());
+  EXPECT_FALSE(results.rows()[0].at("mime_type").empty());
+}
+
+TEST_F(MagicTests, select_by_path_pattern) {
+  // Enough files are identified to use several threads and cookies.
+  auto results = SQL("select * from magic where path like '/bin/%'");
+  ASSERT_GT(results.rows().size(), 1U);
+  for (const auto& row : results.rows()) {
+    EXPECT_EQ(0U, row.at("path").find("/bin/"));
+    EXPECT_FALSE(row.at("mime_type").empty());
+  }
+
+  // The data column is not left with a MIME flag from an earlier file.
+  auto ls = SQL("select * from magic where path = '/bin/ls'");
+  ASSERT_EQ(ls.rows().size(), 1U);
+  EXPECT_NE(ls.rows()[0].at("data"), ls.rows()[0].at("mime_encoding"));
+}
+}
+}
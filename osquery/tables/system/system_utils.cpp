@@ -8,13 +8,60 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <map>
+
+#include <boost/filesystem/path.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 
 #include "osquery/core/process.h"
 
 namespace osquery {
+
+FLAG(bool,
+     packages_cache,
+     true,
+     "Cache package tables while their package databases are unchanged");
+
 namespace tables {
 
+/// The rows of a package table and the database state they were read from.
+struct PackageCache {
+  std::string state;
+  QueryData results;
+};
+
+/// The cache of each package table.
+static std::map<std::string, PackageCache> kPackageCaches;
+
+/// Protect access to the package caches.
+static Mutex kPackageCachesMutex;
+
+/// Describe the device, inode, size, and modification time of each path.
+static std::string getPackagesState(const std::vector<std::string>& paths) {
+  std::string state;
+  for (const auto& path : paths) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+      state += "-;";
+      continue;
+    }
+
+    state += std::to_string(info.st_dev) + ":" + std::to_string(info.st_ino) +
+             ":" + std::to_string(info.st_size) + ":" +
+             std::to_string(info.st_mtime);
+#ifdef __linux__
+    state += "." + std::to_string(info.st_mtim.tv_nsec);
+#endif
+    state += ";";
+  }
+  return state;
+}
+
 QueryData usersFromContext(const QueryContext& context, bool all) {
   QueryData users;
   if (context.hasConstraint("uid", EQUALS)) {
@@ -48,5 +95,73 @@ QueryData pidsFromContext(const QueryContext& context, bool all) {
   }
   return procs;
 }
+
+void readUsersFiles(
+    const QueryData& users,
+    const std::vector<std::string>& files,
+    std::function<void(const std::string& uid,
+                       const std::string& path,
+                       std::string& content)> predicate) {
+  std::vector<const std::string*> uids;
+  std::vector<boost::filesystem::path> paths;
+  for (const auto& row : users) {
+    if (row.count("uid") == 0 || row.count("directory") == 0) {
+      continue;
+    }
+    for (const auto& file : files) {
+      uids.push_back(&row.at("uid"));
+      paths.push_back(boost::filesystem::path(row.at("directory")) / file);
+    }
+  }
+
+  std::vector<FileReadResult> results;
+  readFiles(paths, results, true);
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (results[i].status.ok()) {
+      predicate(*uids[i], paths[i].string(), results[i].content);
+    }
+  }
+}
+
+/// Copy the rows a filter selects.
+static QueryData filterPackages(
+    const QueryData& rows, const std::function<bool(const Row& r)>& filter) {
+  QueryData results;
+  for (const auto& r : rows) {
+    if (filter(r)) {
+      results.push_back(r);
+    }
+  }
+  return results;
+}
+
+QueryData genCachedPackages(const std::string& table,
+                            const std::vector<std::string>& paths,
+                            bool complete,
+                            std::function<QueryData()> generate,
+                            std::function<bool(const Row& r)> filter) {
+  if (!FLAGS_packages_cache) {
+    auto results = generate();
+    return (filter == nullptr) ? results : filterPackages(results, filter);
+  }
+
+  auto state = getPackagesState(paths);
+  {
+    ReadLock lock(kPackageCachesMutex);
+    auto cache = kPackageCaches.find(table);
+    if (cache != kPackageCaches.end() && cache->second.state == state) {
+      const auto& cached = cache->second.results;
+      return (filter == nullptr) ? cached : filterPackages(cached, filter);
+    }
+  }
+
+  auto results = generate();
+  // A database changed while it was read if its state is different now.
+  if (complete && getPackagesState(paths) == state) {
+    WriteLock lock(kPackageCachesMutex);
+    kPackageCaches[table] = {state, results};
+  }
+  return (filter == nullptr) ? results : filterPackages(results, filter);
+}
 }
 }
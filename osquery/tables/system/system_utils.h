@@ -10,6 +10,10 @@
 
 #pragma once
 
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -36,5 +40,52 @@ QueryData usersFromContext(const QueryContext& context, bool all = false);
  * @return A complete set of rows for each process.
  */
 QueryData pidsFromContext(const QueryContext& context, bool all = true);
+
+/**
+ * @brief Read files relative to each user's home directory.
+ *
+ * The files of every user are read together with readFiles, preserving their
+ * atime and mtime, then passed to the predicate in user and file order.
+ * Unreadable files are skipped.
+ *
+ * @param users rows with uid and directory columns, see usersFromContext.
+ * @param files the paths within each home directory.
+ * @param predicate called with the uid, path, and content of each file.
+ */
+void readUsersFiles(
+    const QueryData& users,
+    const std::vector<std::string>& files,
+    std::function<void(const std::string& uid,
+                       const std::string& path,
+                       std::string& content)> predicate);
+
+/**
+ * @brief Serve a package table from a cache while its databases are unchanged.
+ *
+ * Package databases change rarely but are expensive to iterate. The rows of a
+ * table are cached with the device, inode, size, and modification time of each
+ * database path, and reused until any of them changes. A missing path is also
+ * part of the state, so a database that appears invalidates the cache.
+ *
+ * Tables that use constraints to narrow their database iteration generate all
+ * rows only when unconstrained. A constrained query is served by a valid
+ * cache or generated without updating it.
+ *
+ * Point lookups, such as a join on package names, pass a filter so only the
+ * matching rows are copied out of the cache.
+ *
+ * @param table the cache name, usually the table name
+ * @param paths the files or directories modified when packages change
+ * @param complete true if generate returns every row
+ * @param generate the table implementation
+ * @param filter optionally select the returned rows
+ * @return The cached or generated rows.
+ */
+QueryData genCachedPackages(
+    const std::string& table,
+    const std::vector<std::string>& paths,
+    bool complete,
+    std::function<QueryData()> generate,
+    std::function<bool(const Row& r)> filter = nullptr);
 }
 }
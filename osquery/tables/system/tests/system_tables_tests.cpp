@@ -8,17 +8,27 @@
  *
  */
 
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/hash.h"
+#include "osquery/tables/system/system_utils.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
+
+DECLARE_uint64(hash_cache_max);
+
 namespace tables {
 
 class SystemsTablesTests : public testing::Test {};
@@ -155,5 +165,104 @@ TEST_F(SystemsTablesTests, test_abstract_joins) {
     ASSERT_GT(results.rows().size(), 1U);
   }
 }
+
+TEST_F(SystemsTablesTests, test_cached_packages) {
+  auto database = kTestWorkingDirectory + "packages-database";
+  ASSERT_TRUE(writeTextFile(database, "1").ok());
+
+  size_t generated = 0;
+  auto generate = [&generated]() {
+    generated++;
+    return QueryData{{{"count", std::to_string(generated)}}};
+  };
+
+  // The first query reads the database and the second is served a cache.
+  auto results = genCachedPackages("test", {database}, true, generate);
+  EXPECT_EQ(1U, generated);
+  EXPECT_EQ(results, genCachedPackages("test", {database}, true, generate));
+  EXPECT_EQ(1U, generated);
+
+  // Modifying the database invalidates the cache.
+  ASSERT_TRUE(writeTextFile(database, "22").ok());
+  results = genCachedPackages("test", {database}, true, generate);
+  EXPECT_EQ(2U, generated);
+  EXPECT_EQ("2", results[0]["count"]);
+
+  // Incomplete results are not cached.
+  ASSERT_TRUE(writeTextFile(database, "333").ok());
+  genCachedPackages("test", {database}, false, generate);
+  genCachedPackages("test", {database}, true, generate);
+  EXPECT_EQ(4U, generated);
+  boost::filesystem::remove(database);
+}
+
+TEST_F(SystemsTablesTests, test_hash_multi) {
+  // The content is large enough for digests to be computed concurrently.
+  std::string content;
+  for (size_t i = 0; i < 300 * 1024; i++) {
+    content.push_back(static_cast<char>(i * 7));
+  }
+  auto path = kTestWorkingDirectory + "hash-content";
+  ASSERT_TRUE(writeTextFile(path, content).ok());
+
+  auto md5 = hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size());
+  auto sha1 = hashFromBuffer(HASH_TYPE_SHA1, content.data(), content.size());
+  auto sha256 =
+      hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size());
+
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  EXPECT_EQ(md5, hashes.md5);
+  EXPECT_EQ(sha1, hashes.sha1);
+  EXPECT_EQ(sha256, hashes.sha256);
+
+  // Only the requested digests are computed.
+  hashes = hashMultiFromFile(HASH_TYPE_SHA256, path);
+  EXPECT_TRUE(hashes.md5.empty());
+  EXPECT_TRUE(hashes.sha1.empty());
+  EXPECT_EQ(sha256, hashes.sha256);
+  boost::filesystem::remove(path);
+}
+
+TEST_F(SystemsTablesTests, test_hash_cache) {
+  auto cache_max = FLAGS_hash_cache_max;
+  FLAGS_hash_cache_max = 2;
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < 3; i++) {
+    paths.push_back(kTestWorkingDirectory + "hash-cache-" + std::to_string(i));
+    ASSERT_TRUE(writeTextFile(paths[i], std::to_string(i)).ok());
+  }
+
+  // Hashes are stored for each file and read back while it is unchanged.
+  auto expected = hashFromBuffer(HASH_TYPE_SHA256, "0", 1);
+  EXPECT_EQ(expected, hashMultiFromFile(HASH_TYPE_SHA256, paths[0]).sha256);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kHashes, keys);
+  EXPECT_EQ(1U, keys.size());
+  EXPECT_EQ(expected, hashMultiFromFile(HASH_TYPE_SHA256, paths[0]).sha256);
+
+  // A missing digest is added to the cached hashes.
+  auto hashes = hashMultiFromFile(HASH_TYPE_MD5 | HASH_TYPE_SHA256, paths[0]);
+  EXPECT_EQ(hashFromBuffer(HASH_TYPE_MD5, "0", 1), hashes.md5);
+  EXPECT_EQ(expected, hashes.sha256);
+
+  // A modified file is hashed again.
+  ASSERT_TRUE(writeTextFile(paths[0], "changed").ok());
+  EXPECT_EQ(hashFromBuffer(HASH_TYPE_SHA256, "changed", 7),
+            hashMultiFromFile(HASH_TYPE_SHA256, paths[0]).sha256);
+
+  // The least recently used file is evicted.
+  hashMultiFromFile(HASH_TYPE_SHA256, paths[1]);
+  hashMultiFromFile(HASH_TYPE_SHA256, paths[2]);
+  keys.clear();
+  scanDatabaseKeys(kHashes, keys);
+  EXPECT_EQ(2U, keys.size());
+
+  FLAGS_hash_cache_max = cache_max;
+  for (const auto& path : paths) {
+    boost::filesystem::remove(path);
+  }
+}
 }
 }
@@ -8,6 +8,7 @@
  *
  */
 
+#include <map>
 #include <string>
 
 #include <osquery/core.h>
@@ -25,31 +26,33 @@ struct sdb {
   std::string type;
 };
 
+/// Read each key below a parent in one walk, keyed by the subkey's path.
+static std::map<std::string, QueryData> querySubkeys(const std::string& key) {
+  QueryData regResults;
+  queryKeyPattern(key + "\\%", regResults);
+  std::map<std::string, QueryData> subkeys;
+  for (auto& rKey : regResults) {
+    subkeys[rKey.at("key")].push_back(std::move(rKey));
+  }
+  return subkeys;
+}
+
 QueryData genShims(QueryContext& context) {
   QueryData results;
-  QueryData sdbResults;
-  QueryData shimResults;
   std::map<std::string, sdb> sdbs;
 
-  queryKey(
+  auto sdbKeys = querySubkeys(
       "HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\Windows "
-      "NT\\CurrentVersion\\AppCompatFlags\\InstalledSDB",
-      sdbResults);
-  for (const auto& rKey : sdbResults) {
-    if (rKey.at("type") != "subkey") {
-      continue;
-    }
-    QueryData regResults;
+      "NT\\CurrentVersion\\AppCompatFlags\\InstalledSDB");
+  for (const auto& sdbKey : sdbKeys) {
     sdb sdb;
-    std::string subkey = rKey.at("path");
+    const auto& subkey = sdbKey.first;
     auto start = subkey.find("{");
     if (start == std::string::npos) {
       continue;
     }
     std::string sdbId = subkey.substr(start, subkey.length());
-    // make sure it's a sane uninstall key
-    queryKey(subkey, regResults);
-    for (const auto& aKey : regResults) {
+    for (const auto& aKey : sdbKey.second) {
       if (aKey.at("name") == "DatabaseDescription") {
         sdb.description = aKey.at("data");
       }
@@ -68,25 +71,16 @@ QueryData genShims(QueryContext& context) {
     sdbs[sdbId] = sdb;
   }
 
-  queryKey(
+  auto shimKeys = querySubkeys(
       "HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\Windows NT\\"
-      "CurrentVersion\\AppCompatFlags\\Custom",
-      shimResults);
-  for (const auto& rKey : shimResults) {
-    QueryData regResults;
-    if (rKey.at("type") != "subkey") {
-      continue;
-    }
-    std::string subkey = rKey.at("path");
-    auto start = rKey.at("path").rfind("\\");
+      "CurrentVersion\\AppCompatFlags\\Custom");
+  for (const auto& shimKey : shimKeys) {
+    auto start = shimKey.first.rfind("\\");
     if (start == std::string::npos) {
       continue;
     }
-    std::string executable =
-        rKey.at("path").substr(start + 1, rKey.at("subkey").length());
-    // make sure it's a sane uninstall key
-    queryKey(subkey, regResults);
-    for (const auto& aKey : regResults) {
+    std::string executable = shimKey.first.substr(start + 1);
+    for (const auto& aKey : shimKey.second) {
       Row r;
       std::string sdbId;
       if (aKey.at("name").length() > 4) {
@@ -21,7 +21,17 @@ namespace tables {
 QueryData genInstalledPatches(QueryContext& context) {
   QueryData results;
 
-  WmiRequest wmiSystemReq("select * from Win32_QuickFixEngineering");
+  auto query = getWmiSelect(context,
+                            "Win32_QuickFixEngineering",
+                            {{"csname", "CSName"},
+                             {"hotfix_id", "HotFixID"},
+                             {"caption", "Caption"},
+                             {"description", "Description"},
+                             {"fix_comments", "FixComments"},
+                             {"installed_by", "InstalledBy"},
+                             {"install_date", "InstallDate"},
+                             {"installed_on", "InstalledOn"}});
+  WmiRequest wmiSystemReq(query);
   std::vector<WmiResultItem>& wmiResults = wmiSystemReq.results();
 
   if (wmiResults.size() != 0) {
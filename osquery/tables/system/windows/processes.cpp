@@ -16,6 +16,7 @@
 #include <Windows.h>
 #include <psapi.h>
 #include <stdlib.h>
+#include <winternl.h>
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -35,6 +36,303 @@ int getUidFromSid(PSID sid);
 int getGidFromSid(PSID sid);
 namespace tables {
 
+/**
+ * @brief The documented layout of SYSTEM_PROCESS_INFORMATION.
+ *
+ * The winternl.h declaration reserves the times and most counters.
+ */
+struct SystemProcessInformation {
+  ULONG NextEntryOffset;
+  ULONG NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG HardFaultCount;
+  ULONG NumberOfThreadsHighWatermark;
+  ULONGLONG CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  UNICODE_STRING ImageName;
+  LONG BasePriority;
+  HANDLE UniqueProcessId;
+  HANDLE InheritedFromUniqueProcessId;
+  ULONG HandleCount;
+  ULONG SessionId;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
+  ULONG PageFaultCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
+};
+
+using NtQuerySystemInformationFunction =
+    NTSTATUS(NTAPI*)(ULONG, PVOID, ULONG, PULONG);
+using NtQueryInformationProcessFunction =
+    NTSTATUS(NTAPI*)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+
+const ULONG kSystemProcessInformation = 5;
+const ULONG kProcessCommandLineInformation = 60;
+const NTSTATUS kStatusInfoLengthMismatch = static_cast<NTSTATUS>(0xC0000004L);
+const NTSTATUS kStatusInvalidInfoClass = static_cast<NTSTATUS>(0xC0000003L);
+
+/// CPU times are reported in 100ns intervals.
+const long long kTimeUnitsPerSecond = 10000000;
+
+/// Columns requiring a handle to the process.
+const std::initializer_list<std::string> kProcessHandleColumns = {
+    "path", "on_disk", "cmdline", "cwd", "root", "uid", "gid"};
+
+static FARPROC getNtdllFunction(const char* name) {
+  auto ntdll = GetModuleHandleA("ntdll.dll");
+  return (ntdll == nullptr) ? nullptr : GetProcAddress(ntdll, name);
+}
+
+static std::string unicodeToString(const UNICODE_STRING& src) {
+  if (src.Buffer == nullptr || src.Length == 0) {
+    return "";
+  }
+  std::wstring wide(src.Buffer, src.Length / sizeof(wchar_t));
+  return wstringToString(wide.c_str());
+}
+
+/**
+ * @brief Look up the uid and gid of an account SID.
+ *
+ * Account lookups are slow and the accounts owning processes rarely change,
+ * each SID is looked up once per process lifetime.
+ */
+static void getSidIds(PSID sid, long& uid, long& gid) {
+  static std::map<std::string, std::pair<long, long>> cache;
+  static Mutex cache_mutex;
+
+  std::string key(static_cast<const char*>(sid), GetLengthSid(sid));
+  {
+    ReadLock lock(cache_mutex);
+    auto cached = cache.find(key);
+    if (cached != cache.end()) {
+      uid = cached->second.first;
+      gid = cached->second.second;
+      return;
+    }
+  }
+
+  uid = getUidFromSid(sid);
+  gid = getGidFromSid(sid);
+  WriteLock lock(cache_mutex);
+  cache[key] = std::make_pair(uid, gid);
+}
+
+/// Read the uid and gid of a process token's owner.
+static bool getTokenIds(HANDLE process, long& uid, long& gid) {
+  HANDLE tok = nullptr;
+  if (OpenProcessToken(process, TOKEN_QUERY, &tok) == 0 || tok == nullptr) {
+    return false;
+  }
+
+  unsigned long size = 0;
+  GetTokenInformation(tok, TokenOwner, nullptr, 0, &size);
+  std::vector<char> owner(size, 0x0);
+  auto ret = GetTokenInformation(tok, TokenOwner, owner.data(), size, &size);
+  CloseHandle(tok);
+  if (ret == 0 || owner.empty()) {
+    return false;
+  }
+
+  getSidIds(PTOKEN_OWNER(owner.data())->Owner, uid, gid);
+  return true;
+}
+
+/// Query a process command line, this requires Windows 8.1 or later.
+static NTSTATUS queryProcessCmdline(HANDLE process, std::vector<char>& buffer) {
+  static auto query = reinterpret_cast<NtQueryInformationProcessFunction>(
+      getNtdllFunction("NtQueryInformationProcess"));
+  if (query == nullptr) {
+    return kStatusInvalidInfoClass;
+  }
+
+  ULONG size = 1024;
+  NTSTATUS status = 0;
+  do {
+    buffer.resize(size);
+    status = query(process,
+                   kProcessCommandLineInformation,
+                   buffer.data(),
+                   static_cast<ULONG>(buffer.size()),
+                   &size);
+  } while (status == kStatusInfoLengthMismatch && size > buffer.size());
+  return status;
+}
+
+/// Check once if processes report their command line information class.
+static bool isProcessCmdlineSupported() {
+  static const bool supported = ([]() {
+    std::vector<char> buffer;
+    return queryProcessCmdline(GetCurrentProcess(), buffer) !=
+           kStatusInvalidInfoClass;
+  })();
+  return supported;
+}
+
+static std::string getProcessCmdline(HANDLE process) {
+  std::vector<char> buffer;
+  // Failure statuses are negative.
+  if (queryProcessCmdline(process, buffer) < 0) {
+    return "";
+  }
+  return unicodeToString(*reinterpret_cast<UNICODE_STRING*>(buffer.data()));
+}
+
+/**
+ * @brief Read the command lines of processes through WMI.
+ *
+ * Before Windows 8.1 a command line is only in each process's memory, WMI
+ * reads them for every selected process in a single request.
+ */
+static void getWmiCmdlines(const std::set<long>& pidlist,
+                           std::map<long, std::string>& cmdlines) {
+  std::string query = "SELECT ProcessId, CommandLine FROM Win32_Process";
+  if (pidlist.size() > 0) {
+    std::vector<std::string> constraints;
+    for (const auto& pid : pidlist) {
+      constraints.push_back("ProcessId=" + std::to_string(pid));
+    }
+    query += " WHERE " + boost::algorithm::join(constraints, " OR ");
+  }
+
+  WmiRequest request(query);
+  if (!request.getStatus().ok()) {
+    return;
+  }
+  for (const auto& item : request.results()) {
+    long pid = 0;
+    if (item.GetLong("ProcessId", pid).ok()) {
+      item.GetString("CommandLine", cmdlines[pid]);
+    }
+  }
+}
+
+/**
+ * @brief Read every process's information in a single call.
+ *
+ * The snapshot is an array of variable length entries, each including its
+ * image name. It grows if processes start while it is read.
+ */
+static Status getProcessSnapshot(std::vector<char>& buffer) {
+  static auto query = reinterpret_cast<NtQuerySystemInformationFunction>(
+      getNtdllFunction("NtQuerySystemInformation"));
+  if (query == nullptr) {
+    return Status(1, "NtQuerySystemInformation is not available");
+  }
+
+  ULONG size = 256 * 1024;
+  for (size_t attempt = 0; attempt < 8; attempt++) {
+    buffer.resize(size);
+    ULONG needed = 0;
+    auto status = query(kSystemProcessInformation,
+                        buffer.data(),
+                        static_cast<ULONG>(buffer.size()),
+                        &needed);
+    if (status >= 0) {
+      return Status(0, "OK");
+    }
+
+    if (status != kStatusInfoLengthMismatch) {
+      return Status(1, "Cannot read processes: " + std::to_string(status));
+    }
+    size = std::max(size * 2, needed + 64 * 1024);
+  }
+  return Status(1, "Cannot read processes: the snapshot keeps growing");
+}
+
+void genSnapshotProcess(const SystemProcessInformation& info,
+                        QueryContext& context,
+                        const std::map<long, std::string>* wmi_cmdlines,
+                        QueryData& results_data) {
+  Row r;
+  auto pid =
+      static_cast<long>(reinterpret_cast<ULONG_PTR>(info.UniqueProcessId));
+  r["pid"] = BIGINT(pid);
+  r["name"] = unicodeToString(info.ImageName);
+  if (pid == 0 && r["name"].empty()) {
+    r["name"] = "System Idle Process";
+  }
+  r["state"] = "";
+  r["parent"] = BIGINT(static_cast<long>(
+      reinterpret_cast<ULONG_PTR>(info.InheritedFromUniqueProcessId)));
+  r["nice"] = INTEGER(info.BasePriority);
+  r["threads"] = INTEGER(info.NumberOfThreads);
+
+  r["pgroup"] = "-1";
+  r["euid"] = "-1";
+  r["suid"] = "-1";
+  r["egid"] = "-1";
+  r["sgid"] = "-1";
+  r["start_time"] = "0";
+
+  r["user_time"] = BIGINT(info.UserTime.QuadPart / kTimeUnitsPerSecond);
+  r["system_time"] = BIGINT(info.KernelTime.QuadPart / kTimeUnitsPerSecond);
+  r["wired_size"] = BIGINT(info.PrivatePageCount);
+  r["resident_size"] = BIGINT(info.WorkingSetSize);
+  r["total_size"] = BIGINT(info.VirtualSize);
+
+  // Handles are only opened for the columns that need them.
+  long uid = -1;
+  long gid = -1;
+  if (context.isAnyColumnUsed(kProcessHandleColumns)) {
+    HANDLE process = nullptr;
+    if (pid == static_cast<long>(GetCurrentProcessId())) {
+      process = GetCurrentProcess();
+    } else {
+      process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+    }
+
+    if (process == nullptr && GetLastError() == ERROR_ACCESS_DENIED) {
+      uid = 0;
+      gid = 0;
+    }
+
+    if (process != nullptr) {
+      if (context.isAnyColumnUsed({"path", "on_disk", "cwd", "root"})) {
+        std::vector<char> path(MAX_PATH + 1, '\0');
+        auto path_size = static_cast<unsigned long>(MAX_PATH);
+        if (QueryFullProcessImageNameA(process, 0, path.data(), &path_size)) {
+          r["path"] = SQL_TEXT(path.data());
+        }
+      }
+
+      if (context.isColumnUsed("cmdline") && wmi_cmdlines == nullptr) {
+        r["cmdline"] = getProcessCmdline(process);
+      }
+
+      if (context.isAnyColumnUsed({"uid", "gid"})) {
+        getTokenIds(process, uid, gid);
+      }
+      CloseHandle(process);
+    }
+  }
+
+  if (wmi_cmdlines != nullptr) {
+    auto cmdline = wmi_cmdlines->find(pid);
+    if (cmdline != wmi_cmdlines->end()) {
+      r["cmdline"] = cmdline->second;
+    }
+  }
+
+  r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  r["cwd"] = r["path"];
+  r["root"] = r["path"];
+  r["uid"] = INTEGER(uid);
+  r["gid"] = INTEGER(gid);
+  results_data.push_back(r);
+}
+
 std::set<long> getSelectedPids(const QueryContext& context) {
   std::set<long> pidlist;
   if (context.constraints.count("pid") > 0 &&
@@ -54,7 +352,7 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
   Row r;
   Status s;
   long pid;
-  long lPlaceHolder;
+  long lPlaceHolder = 0;
   std::string sPlaceHolder;
   HANDLE hProcess = nullptr;
 
@@ -106,7 +404,7 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
   r["start_time"] = "0";
 
   result.GetString("UserModeTime", sPlaceHolder);
-  long long llHolder;
+  long long llHolder = 0;
   osquery::safeStrtoll(sPlaceHolder, 10, llHolder);
   r["user_time"] = BIGINT(llHolder / 10000000);
   result.GetString("KernelModeTime", sPlaceHolder);
@@ -133,9 +431,9 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
     }
   }
   if (uid != 0 && ret != 0 && !tokOwner.empty()) {
-    auto sid = PTOKEN_OWNER(tokOwner.data())->Owner;
-    r["uid"] = INTEGER(getUidFromSid(sid));
-    r["gid"] = INTEGER(getGidFromSid(sid));
+    getSidIds(PTOKEN_OWNER(tokOwner.data())->Owner, uid, gid);
+    r["uid"] = INTEGER(uid);
+    r["gid"] = INTEGER(gid);
   } else {
     r["uid"] = INTEGER(uid);
     r["gid"] = INTEGER(gid);
@@ -152,10 +450,11 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
   results_data.push_back(r);
 }
 
-QueryData genProcesses(QueryContext& context) {
+/// Enumerate processes through WMI, if the snapshot cannot be read.
+QueryData genWmiProcesses(QueryContext& context) {
   QueryData results;
 
-  std::string query = "SELECT * FROM Win32_Process";
+  std::string query = "Win32_Process";
 
   auto pidlist = getSelectedPids(context);
   if (pidlist.size() > 0) {
@@ -168,6 +467,22 @@ QueryData genProcesses(QueryContext& context) {
     }
   }
 
+  // The process path is also used to check on_disk and open the process.
+  query = getWmiSelect(context,
+                       query,
+                       {{"name", "Name"},
+                        {"path", "ExecutablePath"},
+                        {"on_disk", "ExecutablePath"},
+                        {"cmdline", "CommandLine"},
+                        {"state", "ExecutionState"},
+                        {"parent", "ParentProcessId"},
+                        {"nice", "Priority"},
+                        {"user_time", "UserModeTime"},
+                        {"system_time", "KernelModeTime"},
+                        {"wired_size", "PrivatePageCount"},
+                        {"resident_size", "WorkingSetSize"},
+                        {"total_size", "VirtualSize"}},
+                       {"ProcessId"});
   WmiRequest request(query);
   if (request.getStatus().ok()) {
     for (const auto& item : request.results()) {
@@ -180,5 +495,42 @@ QueryData genProcesses(QueryContext& context) {
 
   return results;
 }
+
+QueryData genProcesses(QueryContext& context) {
+  std::vector<char> snapshot;
+  auto status = getProcessSnapshot(snapshot);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return genWmiProcesses(context);
+  }
+
+  QueryData results;
+  auto pidlist = getSelectedPids(context);
+
+  // Command lines are read through WMI before Windows 8.1.
+  std::map<long, std::string> cmdlines;
+  const std::map<long, std::string>* wmi_cmdlines = nullptr;
+  if (context.isColumnUsed("cmdline") && !isProcessCmdlineSupported()) {
+    getWmiCmdlines(pidlist, cmdlines);
+    wmi_cmdlines = &cmdlines;
+  }
+
+  size_t offset = 0;
+  while (offset + sizeof(SystemProcessInformation) <= snapshot.size()) {
+    const auto& info = *reinterpret_cast<const SystemProcessInformation*>(
+        snapshot.data() + offset);
+    auto pid = static_cast<long>(
+        reinterpret_cast<ULONG_PTR>(info.UniqueProcessId));
+    if (pidlist.empty() || pidlist.count(pid) > 0) {
+      genSnapshotProcess(info, context, wmi_cmdlines, results);
+    }
+
+    if (info.NextEntryOffset == 0) {
+      break;
+    }
+    offset += info.NextEntryOffset;
+  }
+  return results;
+}
 }
 }
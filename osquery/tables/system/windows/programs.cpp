@@ -8,6 +8,7 @@
  *
  */
 
+#include <map>
 #include <string>
 
 #include <boost/regex.hpp>
@@ -26,25 +27,27 @@ namespace tables {
 QueryData genPrograms(QueryContext& context) {
   QueryData results;
   QueryData regResults;
-  queryKey(
+  // Read every uninstall key in one walk, then group the values by key.
+  queryKeyPattern(
       "HKEY_LOCAL_MACHINE\\SOFTWARE\\Wow6432Node\\Microsoft\\"
-      "Windows\\CurrentVersion\\Uninstall",
+      "Windows\\CurrentVersion\\Uninstall\\%",
       regResults);
-  for (const auto& rKey : regResults) {
-    if (rKey.at("type") != "subkey") {
-      continue;
-    }
-    QueryData appResults;
-    std::string subkey = rKey.at("path");
+  std::map<std::string, QueryData> apps;
+  for (auto& rKey : regResults) {
+    apps[rKey.at("key")].push_back(std::move(rKey));
+  }
+
+  boost::regex expression(
+      "({[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+})"
+      "$");
+  for (const auto& app : apps) {
+    const auto& subkey = app.first;
+    const auto& appResults = app.second;
     // make sure it's a sane uninstall key
     boost::smatch matches;
-    boost::regex expression(
-        "({[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+-[a-fA-F0-9]+})"
-        "$");
     if (!boost::regex_search(subkey, matches, expression)) {
       continue;
     }
-    queryKey(subkey, appResults);
     Row r;
     r["identifying_number"] = matches[0];
     for (const auto& aKey : appResults) {
@@ -14,15 +14,22 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <functional>
 #include <iterator>
 #include <map>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -75,99 +82,122 @@ void explodeRegistryPath(const std::string& path,
   rKey = osquery::join(toks, kRegSep);
 }
 
-/// Microsoft helper function for getting the contents of a registry key
-void queryKey(const std::string& keyPath, QueryData& results) {
-  std::string hive;
-  std::string key;
-  explodeRegistryPath(keyPath, hive, key);
-
-  if (kRegistryHives.count(hive) != 1) {
-    return;
+/// Registry walks share a small pool of threads across subtrees.
+const size_t kRegistryWalkThreads = 4;
+
+/// Case-insensitive SQL LIKE matching of a single key name.
+static bool matchKeyName(const std::string& pattern, const std::string& name) {
+  size_t p = 0;
+  size_t n = 0;
+  size_t star = std::string::npos;
+  size_t mark = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() &&
+        (pattern[p] == '_' || ::tolower(pattern[p]) == ::tolower(name[n]))) {
+      p++;
+      n++;
+    } else if (p < pattern.size() && pattern[p] == '%') {
+      star = p++;
+      mark = n;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      n = ++mark;
+    } else {
+      return false;
+    }
   }
+  while (p < pattern.size() && pattern[p] == '%') {
+    p++;
+  }
+  return (p == pattern.size());
+}
 
-  HKEY hRegistryHandle;
-  auto ret = RegOpenKeyEx(kRegistryHives.at(hive),
-                          TEXT(key.c_str()),
-                          0,
-                          KEY_READ,
-                          &hRegistryHandle);
+static bool isKeyPattern(const std::string& name) {
+  return (name.find_first_of("%_") != std::string::npos);
+}
 
-  if (ret != ERROR_SUCCESS) {
+/**
+ * @brief Get the contents of an open registry key.
+ *
+ * Buffers are sized from the key's RegQueryInfoKey maxima.
+ *
+ * @param hKey an open handle for keyPath
+ * @param keyPath the key's full path, used for the result rows
+ * @param results the key's subkey and value rows
+ * @param subkeys optional output, the names of the key's subkeys
+ */
+static void queryKeyHandle(HKEY hKey,
+                           const std::string& keyPath,
+                           QueryData& results,
+                           std::vector<std::string>* subkeys = nullptr) {
+  DWORD cSubKeys = 0;
+  DWORD cbMaxSubKey = 0;
+  DWORD cValues = 0;
+  DWORD cchMaxValueName = 0;
+  DWORD cbMaxValueData = 0;
+  FILETIME ftKeyWriteTime;
+  auto retCode = RegQueryInfoKey(hKey,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 &cSubKeys,
+                                 &cbMaxSubKey,
+                                 nullptr,
+                                 &cValues,
+                                 &cchMaxValueName,
+                                 &cbMaxValueData,
+                                 nullptr,
+                                 &ftKeyWriteTime);
+  if (retCode != ERROR_SUCCESS) {
     return;
   }
 
-  const DWORD maxKeyLength = 255;
-  const DWORD maxValueName = 16383;
-  TCHAR achClass[MAX_PATH] = TEXT("");
-  DWORD cchClassName = MAX_PATH;
-  DWORD cSubKeys = 0;
-  DWORD cbMaxSubKey;
-  DWORD cchMaxClass;
-  DWORD cValues;
-  DWORD cchMaxValueName;
-  DWORD cbMaxValueData;
-  DWORD cbSecurityDescriptor;
-  DWORD retCode;
-  FILETIME ftLastWriteTime;
-  retCode = RegQueryInfoKey(hRegistryHandle,
-                            achClass,
-                            &cchClassName,
-                            nullptr,
-                            &cSubKeys,
-                            &cbMaxSubKey,
-                            &cchMaxClass,
-                            &cValues,
-                            &cchMaxValueName,
-                            &cbMaxValueData,
-                            &cbSecurityDescriptor,
-                            &ftLastWriteTime);
-
-  TCHAR achKey[maxKeyLength];
-  DWORD cbName;
-
-  // Process registry subkeys
-  if (cSubKeys > 0) {
-    for (DWORD i = 0; i < cSubKeys; i++) {
-      cbName = maxKeyLength;
-      retCode = RegEnumKeyEx(hRegistryHandle,
-                             i,
-                             achKey,
-                             &cbName,
-                             nullptr,
-                             nullptr,
-                             nullptr,
-                             &ftLastWriteTime);
-      if (retCode != ERROR_SUCCESS) {
-        continue;
-      }
-      Row r;
-      r["key"] = keyPath;
-      r["type"] = "subkey";
-      r["name"] = achKey;
-      r["path"] = keyPath + kRegSep + achKey;
-      r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftLastWriteTime));
-      results.push_back(r);
+  // Process registry subkeys, the name lengths exclude the terminator.
+  std::vector<TCHAR> achKey(cbMaxSubKey + 1);
+  for (DWORD i = 0; i < cSubKeys; i++) {
+    DWORD cbName = static_cast<DWORD>(achKey.size());
+    FILETIME ftLastWriteTime;
+    retCode = RegEnumKeyEx(hKey,
+                           i,
+                           achKey.data(),
+                           &cbName,
+                           nullptr,
+                           nullptr,
+                           nullptr,
+                           &ftLastWriteTime);
+    if (retCode != ERROR_SUCCESS) {
+      continue;
+    }
+    std::string name(achKey.data(), cbName);
+    Row r;
+    r["key"] = keyPath;
+    r["type"] = "subkey";
+    r["name"] = name;
+    r["path"] = keyPath + kRegSep + name;
+    r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftLastWriteTime));
+    results.push_back(r);
+    if (subkeys != nullptr) {
+      subkeys->push_back(std::move(name));
     }
   }
 
-  if (cValues <= 0) {
+  if (cValues == 0) {
     return;
   }
 
-  DWORD cchValue = maxKeyLength;
-  TCHAR achValue[maxValueName];
-  BYTE* bpDataBuff =
-      (cbMaxValueData == 0) ? nullptr : new BYTE[cbMaxValueData]();
+  // Trailing zeros terminate strings stored without a terminator.
+  std::vector<TCHAR> achValue(cchMaxValueName + 1);
+  std::vector<BYTE> dataBuff(cbMaxValueData + 2 * sizeof(TCHAR));
+  BYTE* bpDataBuff = (cbMaxValueData == 0) ? nullptr : dataBuff.data();
 
   // Process registry values
-  for (size_t i = 0, retCode = ERROR_SUCCESS; i < cValues; i++) {
-    size_t cnt = 0;
-    cchValue = maxValueName;
+  for (DWORD i = 0; i < cValues; i++) {
+    DWORD cchValue = static_cast<DWORD>(achValue.size());
     achValue[0] = '\0';
 
-    retCode = RegEnumValue(hRegistryHandle,
-                           static_cast<DWORD>(i),
-                           achValue,
+    retCode = RegEnumValue(hKey,
+                           i,
+                           achValue.data(),
                            &cchValue,
                            nullptr,
                            nullptr,
@@ -179,9 +209,16 @@ void queryKey(const std::string& keyPath, QueryData& results) {
 
     DWORD lpData = cbMaxValueData;
     DWORD lpType;
-
     retCode = RegQueryValueEx(
-        hRegistryHandle, achValue, 0, &lpType, bpDataBuff, &lpData);
+        hKey, achValue.data(), 0, &lpType, bpDataBuff, &lpData);
+    if (retCode == ERROR_MORE_DATA) {
+      // The value grew since the key was queried.
+      cbMaxValueData = lpData;
+      dataBuff.assign(cbMaxValueData + 2 * sizeof(TCHAR), 0);
+      bpDataBuff = dataBuff.data();
+      retCode = RegQueryValueEx(
+          hKey, achValue.data(), 0, &lpType, bpDataBuff, &lpData);
+    }
     if (retCode != ERROR_SUCCESS) {
       continue;
     }
@@ -193,45 +230,41 @@ void queryKey(const std::string& keyPath, QueryData& results) {
       bpDataBuff[lpData - 1] = 0x00;
     }
 
+    std::string valueName(achValue.data(), cchValue);
     Row r;
     r["key"] = keyPath;
-    r["name"] = ((achValue[0] == '\0') ? "(Default)" : achValue);
-    r["path"] = keyPath + kRegSep + achValue;
+    r["name"] = ((valueName.empty()) ? "(Default)" : valueName);
+    r["path"] = keyPath + kRegSep + valueName;
     if (kRegistryTypes.count(lpType) > 0) {
       r["type"] = kRegistryTypes.at(lpType);
     } else {
       r["type"] = "UNKNOWN";
     }
-    r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftLastWriteTime));
+    r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftKeyWriteTime));
 
     if (bpDataBuff != nullptr) {
       /// REG_LINK is a Unicode string, which in Windows is wchar_t
-      char* regLinkStr = nullptr;
+      std::vector<char> regLinkStr;
       if (lpType == REG_LINK) {
-        regLinkStr = new char[cbMaxValueData];
-        const size_t newSize = cbMaxValueData;
+        regLinkStr.resize(dataBuff.size());
         size_t convertedChars = 0;
         wcstombs_s(&convertedChars,
-                   regLinkStr,
-                   newSize,
+                   regLinkStr.data(),
+                   regLinkStr.size(),
                    (wchar_t*)bpDataBuff,
                    _TRUNCATE);
       }
 
       BYTE* bpDataBuffTmp = bpDataBuff;
       std::vector<std::string> multiSzStrs;
-      std::vector<char> regBinary;
       std::string data;
 
       switch (lpType) {
       case REG_FULL_RESOURCE_DESCRIPTOR:
       case REG_RESOURCE_LIST:
       case REG_BINARY:
-        for (size_t i = 0; i < cbMaxValueData; i++) {
-          regBinary.push_back((char)bpDataBuff[i]);
-        }
         boost::algorithm::hex(
-            regBinary.begin(), regBinary.end(), std::back_inserter(data));
+            bpDataBuff, bpDataBuff + lpData, std::back_inserter(data));
         r["data"] = data;
         break;
       case REG_DWORD:
@@ -244,7 +277,7 @@ void queryKey(const std::string& keyPath, QueryData& results) {
         r["data"] = std::string((char*)bpDataBuff);
         break;
       case REG_LINK:
-        r["data"] = std::string(regLinkStr);
+        r["data"] = std::string(regLinkStr.data());
         break;
       case REG_MULTI_SZ:
         while (*bpDataBuffTmp != 0x00) {
@@ -267,28 +300,231 @@ void queryKey(const std::string& keyPath, QueryData& results) {
         r["data"] = "";
         break;
       }
-      if (regLinkStr != nullptr) {
-        delete[](regLinkStr);
-      }
-      ZeroMemory(bpDataBuff, cbMaxValueData);
+      std::fill(dataBuff.begin(), dataBuff.end(), 0);
     }
     results.push_back(r);
   }
-  if (bpDataBuff != nullptr) {
-    delete[](bpDataBuff);
+}
+
+/// List the names of an open key's subkeys.
+static void getSubkeyNames(HKEY hKey, std::vector<std::string>& subkeys) {
+  DWORD cSubKeys = 0;
+  DWORD cbMaxSubKey = 0;
+  auto retCode = RegQueryInfoKey(hKey,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 &cSubKeys,
+                                 &cbMaxSubKey,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 nullptr);
+  if (retCode != ERROR_SUCCESS) {
+    return;
+  }
+
+  std::vector<TCHAR> achKey(cbMaxSubKey + 1);
+  for (DWORD i = 0; i < cSubKeys; i++) {
+    DWORD cbName = static_cast<DWORD>(achKey.size());
+    retCode = RegEnumKeyEx(
+        hKey, i, achKey.data(), &cbName, nullptr, nullptr, nullptr, nullptr);
+    if (retCode == ERROR_SUCCESS) {
+      subkeys.emplace_back(achKey.data(), cbName);
+    }
+  }
+}
+
+/// Walk an open key and its subkeys using a handle to each subkey.
+using RegistryWalker =
+    std::function<void(HKEY, const std::string&, QueryData&)>;
+
+/**
+ * @brief Open each child relative to its parent's handle and walk it.
+ *
+ * Children are walked in parallel when requested, their rows are appended in
+ * the order the children are listed.
+ */
+static void walkSubkeys(HKEY parent,
+                        const std::string& keyPath,
+                        const std::vector<std::string>& children,
+                        bool parallel,
+                        const RegistryWalker& walker,
+                        QueryData& results) {
+  std::vector<QueryData> childResults(children.size());
+  auto walkChild = [&](size_t i) {
+    HKEY hChild;
+    auto ret =
+        RegOpenKeyEx(parent, children[i].c_str(), 0, KEY_READ, &hChild);
+    if (ret == ERROR_SUCCESS) {
+      walker(hChild, keyPath + kRegSep + children[i], childResults[i]);
+      RegCloseKey(hChild);
+    }
+  };
+
+  if (!parallel || children.size() < 2) {
+    for (size_t i = 0; i < children.size(); i++) {
+      walkChild(i);
+    }
+  } else {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    auto count = std::min(kRegistryWalkThreads, children.size());
+    for (size_t t = 0; t < count; t++) {
+      threads.emplace_back(([&]() {
+        for (auto i = next++; i < children.size(); i = next++) {
+          walkChild(i);
+        }
+      }));
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  for (auto& child : childResults) {
+    std::move(child.begin(), child.end(), std::back_inserter(results));
+  }
+}
+
+/// Get the contents of every key below an open key and its listed children.
+static void walkAllSubkeys(HKEY hKey,
+                           const std::string& keyPath,
+                           const std::vector<std::string>& children,
+                           bool parallel,
+                           QueryData& results) {
+  walkSubkeys(hKey,
+              keyPath,
+              children,
+              parallel,
+              ([](HKEY hChild, const std::string& path, QueryData& rows) {
+                std::vector<std::string> subkeys;
+                queryKeyHandle(hChild, path, rows, &subkeys);
+                walkAllSubkeys(hChild, path, subkeys, false, rows);
+              }),
+              results);
+}
+
+/**
+ * @brief Walk the keys below an open key that match the remaining segments.
+ *
+ * Consecutive literal segments are opened with a single call, only segments
+ * with wildcards enumerate subkeys. The first fan-out is walked in parallel.
+ */
+static void walkKeyPattern(HKEY hKey,
+                           const std::string& keyPath,
+                           const std::vector<std::string>& segments,
+                           size_t index,
+                           bool parallel,
+                           QueryData& results) {
+  if (index == segments.size()) {
+    queryKeyHandle(hKey, keyPath, results);
+    return;
+  }
+
+  const auto& segment = segments[index];
+  if (segment == kSQLGlobRecursive && index + 1 == segments.size()) {
+    std::vector<std::string> children;
+    getSubkeyNames(hKey, children);
+    walkAllSubkeys(hKey, keyPath, children, parallel, results);
+    return;
   }
+
+  if (!isKeyPattern(segment)) {
+    auto end = index;
+    while (end < segments.size() && !isKeyPattern(segments[end])) {
+      end++;
+    }
+    std::vector<std::string> literal(segments.begin() + index,
+                                     segments.begin() + end);
+    auto subkey = osquery::join(literal, kRegSep);
+    HKEY hChild;
+    if (RegOpenKeyEx(hKey, subkey.c_str(), 0, KEY_READ, &hChild) ==
+        ERROR_SUCCESS) {
+      walkKeyPattern(hChild,
+                     keyPath + kRegSep + subkey,
+                     segments,
+                     end,
+                     parallel,
+                     results);
+      RegCloseKey(hChild);
+    }
+    return;
+  }
+
+  std::vector<std::string> children;
+  getSubkeyNames(hKey, children);
+  children.erase(std::remove_if(children.begin(),
+                                children.end(),
+                                ([&segment](const std::string& name) {
+                                  return !matchKeyName(segment, name);
+                                })),
+                 children.end());
+  walkSubkeys(hKey,
+              keyPath,
+              children,
+              parallel,
+              ([&segments, index](
+                  HKEY hChild, const std::string& path, QueryData& rows) {
+                walkKeyPattern(hChild, path, segments, index + 1, false, rows);
+              }),
+              results);
+}
+
+/// Microsoft helper function for getting the contents of a registry key
+void queryKey(const std::string& keyPath, QueryData& results) {
+  std::string hive;
+  std::string key;
+  explodeRegistryPath(keyPath, hive, key);
+
+  if (kRegistryHives.count(hive) != 1) {
+    return;
+  }
+
+  HKEY hRegistryHandle;
+  auto ret = RegOpenKeyEx(
+      kRegistryHives.at(hive), key.c_str(), 0, KEY_READ, &hRegistryHandle);
+  if (ret != ERROR_SUCCESS) {
+    return;
+  }
+
+  queryKeyHandle(hRegistryHandle, keyPath, results);
   RegCloseKey(hRegistryHandle);
-};
+}
+
+void queryKeyPattern(const std::string& pattern, QueryData& results) {
+  auto segments = osquery::split(pattern, kRegSep);
+  if (segments.empty()) {
+    return;
+  }
+
+  auto hivePattern = segments.front();
+  segments.erase(segments.begin());
+  for (const auto& hive : kRegistryHives) {
+    if (matchKeyName(hivePattern, hive.first)) {
+      walkKeyPattern(hive.second, hive.first, segments, 0, true, results);
+    }
+  }
+}
 
 QueryData genRegistry(QueryContext& context) {
   QueryData results;
   std::set<std::string> rKeys;
   auto shouldWarnLocalUsers = false;
+  auto patterns = context.constraints["key"].getAll(LIKE);
   /// By default, we display all HIVEs
   if ((context.constraints["key"].exists(EQUALS) &&
        context.constraints["key"].getAll(EQUALS).size() > 0)) {
     rKeys = context.constraints["key"].getAll(EQUALS);
     shouldWarnLocalUsers = true;
+  } else if (!patterns.empty()) {
+    // Walk only the keys below the literal prefix of each pattern.
+    for (const auto& pattern : patterns) {
+      queryKeyPattern(pattern, results);
+    }
+    return results;
   } else {
     for (auto& h : kRegistryHives) {
       rKeys.insert(h.first);
@@ -18,6 +18,19 @@ namespace tables {
 /// Microsoft helper function for getting the contents of a registry key
 void queryKey(const std::string& keyPath, QueryData& results);
 
+/**
+ * @brief Get the contents of every registry key matching a pattern.
+ *
+ * As with file globbing, '%' matches within a single key name and a trailing
+ * '%%' matches every subkey recursively. Subkeys are opened relative to their
+ * parent's handle and the subtrees of the first wildcard are walked in
+ * parallel.
+ *
+ * @param pattern a key path pattern such as "HKEY_USERS\%\Software\%%"
+ * @param results the subkey and value rows of each matching key
+ */
+void queryKeyPattern(const std::string& pattern, QueryData& results);
+
 void explodeRegistryPath(const std::string& path,
                          std::string& rHive,
                          std::string& rKey);
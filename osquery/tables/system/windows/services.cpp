@@ -12,7 +12,10 @@
 #include <Windows.h>
 #include <Winsvc.h>
 
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
@@ -42,13 +45,79 @@ const std::map<int, std::string> kServiceType = {
     {0x00000110, "OWN_PROCESS(Interactive)"},
     {0x00000120, "SHARE_PROCESS(Interactive)"}};
 
-bool QuerySvcInfo(const SC_HANDLE& schScManager,
-                  ENUM_SERVICE_STATUS_PROCESS& svc,
-                  Row& r) {
+const std::string kSvcRegistryKey = "SYSTEM\\CurrentControlSet\\Services\\";
+
+/// The maximum number of services whose configuration is cached.
+const size_t kSvcConfigCacheMax = 4096;
+
+/// The configuration columns, read from the service control manager.
+struct ServiceConfig {
+  /// The last write times of the service's key and Parameters subkey.
+  std::string state;
+
+  /// The start_type, path, user_account, description, and module_path.
+  Row row;
+};
+
+/**
+ * @brief Configuration of each service name.
+ *
+ * The SCM stores the configuration in the service's registry key, so an
+ * unchanged key means unchanged configuration. Reading the key's write time
+ * is local, while each configuration request is an RPC to the SCM.
+ */
+static std::map<std::string, ServiceConfig> kSvcConfigCache;
+
+/// Protect access to the configuration cache.
+static Mutex kSvcConfigCacheMutex;
+
+/// Describe the last write time of a service's registry key, or "".
+static std::string getKeyWriteTime(const std::string& path) {
+  HKEY key = nullptr;
+  if (RegOpenKeyExA(HKEY_LOCAL_MACHINE, path.c_str(), 0, KEY_READ, &key) !=
+      ERROR_SUCCESS) {
+    return "";
+  }
+
+  FILETIME last_write = {0};
+  auto ret = RegQueryInfoKeyA(key,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              nullptr,
+                              &last_write);
+  RegCloseKey(key);
+  if (ret != ERROR_SUCCESS) {
+    return "";
+  }
+  return std::to_string(last_write.dwHighDateTime) + ":" +
+         std::to_string(last_write.dwLowDateTime);
+}
+
+/// Describe the state of a service's configuration, or "" if unknown.
+static std::string getConfigState(const std::string& name) {
+  auto service = getKeyWriteTime(kSvcRegistryKey + name);
+  if (service.empty()) {
+    return "";
+  }
+  // The ServiceDll is read from the Parameters subkey, which may not exist.
+  auto parameters = getKeyWriteTime(kSvcRegistryKey + name + "\\Parameters");
+  return service + ";" + parameters;
+}
+
+bool QuerySvcConfig(const SC_HANDLE& schScManager,
+                    const std::string& name,
+                    Row& r) {
   DWORD cbBufSize = 0;
 
   auto schService =
-      OpenService(schScManager, svc.lpServiceName, SERVICE_QUERY_CONFIG);
+      OpenService(schScManager, name.c_str(), SERVICE_QUERY_CONFIG);
 
   if (schService == nullptr) {
     TLOG << "OpenService failed (" << GetLastError() << ")";
@@ -56,56 +125,83 @@ bool QuerySvcInfo(const SC_HANDLE& schScManager,
   }
 
   QueryServiceConfig(schService, nullptr, 0, &cbBufSize);
-  auto lpsc = (LPQUERY_SERVICE_CONFIG)malloc(cbBufSize);
-  if (!QueryServiceConfig(schService, lpsc, cbBufSize, &cbBufSize)) {
+  std::vector<char> config(cbBufSize);
+  auto lpsc = (LPQUERY_SERVICE_CONFIG)config.data();
+  if (cbBufSize == 0 ||
+      !QueryServiceConfig(schService, lpsc, cbBufSize, &cbBufSize)) {
     TLOG << "QueryServiceConfig failed (" << GetLastError() << ")";
+    CloseServiceHandle(schService);
+    return FALSE;
   }
 
+  cbBufSize = 0;
   QueryServiceConfig2(
       schService, SERVICE_CONFIG_DESCRIPTION, nullptr, 0, &cbBufSize);
-  auto lpsd = (LPSERVICE_DESCRIPTION)malloc(cbBufSize);
-  if (!QueryServiceConfig2(schService,
-                           SERVICE_CONFIG_DESCRIPTION,
-                           (LPBYTE)lpsd,
-                           cbBufSize,
-                           &cbBufSize)) {
+  std::vector<char> description(cbBufSize);
+  auto lpsd = (LPSERVICE_DESCRIPTION)description.data();
+  if (cbBufSize == 0 || !QueryServiceConfig2(schService,
+                                             SERVICE_CONFIG_DESCRIPTION,
+                                             (LPBYTE)lpsd,
+                                             cbBufSize,
+                                             &cbBufSize)) {
     TLOG << "QueryServiceConfig2 failed (" << GetLastError() << ")";
+    lpsd = nullptr;
   }
+  CloseServiceHandle(schService);
 
-  r["name"] = SQL_TEXT(svc.lpServiceName);
-  r["display_name"] = SQL_TEXT(svc.lpDisplayName);
-  r["status"] = SQL_TEXT(kSvcStatus[svc.ServiceStatusProcess.dwCurrentState]);
-  r["pid"] = INTEGER(svc.ServiceStatusProcess.dwProcessId);
-  r["win32_exit_code"] = INTEGER(svc.ServiceStatusProcess.dwWin32ExitCode);
-  r["service_exit_code"] =
-      INTEGER(svc.ServiceStatusProcess.dwServiceSpecificExitCode);
-  r["start_type"] = SQL_TEXT(kSvcStartType[lpsc->dwStartType]);
+  if (lpsc->dwStartType < sizeof(kSvcStartType) / sizeof(kSvcStartType[0])) {
+    r["start_type"] = SQL_TEXT(kSvcStartType[lpsc->dwStartType]);
+  }
   r["path"] = SQL_TEXT(lpsc->lpBinaryPathName);
   r["user_account"] = SQL_TEXT(lpsc->lpServiceStartName);
 
-  if (lpsd->lpDescription != nullptr) {
+  if (lpsd != nullptr && lpsd->lpDescription != nullptr) {
     r["description"] = SQL_TEXT(lpsd->lpDescription);
   }
 
-  if (kServiceType.count(lpsc->dwServiceType) > 0) {
-    r["service_type"] = SQL_TEXT(kServiceType.at(lpsc->dwServiceType));
-  } else {
-    r["service_type"] = SQL_TEXT("UNKNOWN");
-  }
-
   QueryData regResults;
-  queryKey("HKEY_LOCAL_MACHINE\\SYSTEM\\CurrentControlSet\\Services\\" +
-               r["name"] + "\\Parameters",
+  queryKey("HKEY_LOCAL_MACHINE\\" + kSvcRegistryKey + name + "\\Parameters",
            regResults);
   for (const auto& aKey : regResults) {
     if (aKey.at("name") == "ServiceDll") {
       r["module_path"] = SQL_TEXT(aKey.at("data"));
     }
   }
+  return TRUE;
+}
 
-  free(lpsc);
-  free(lpsd);
-  CloseServiceHandle(schService);
+/// Add a service's configuration columns, from the cache if unchanged.
+static bool genSvcConfig(const SC_HANDLE& schScManager,
+                         const std::string& name,
+                         Row& r) {
+  auto state = getConfigState(name);
+  if (!state.empty()) {
+    ReadLock lock(kSvcConfigCacheMutex);
+    auto cached = kSvcConfigCache.find(name);
+    if (cached != kSvcConfigCache.end() && cached->second.state == state) {
+      for (const auto& column : cached->second.row) {
+        r[column.first] = column.second;
+      }
+      return TRUE;
+    }
+  }
+
+  ServiceConfig config;
+  if (!QuerySvcConfig(schScManager, name, config.row)) {
+    return FALSE;
+  }
+  for (const auto& column : config.row) {
+    r[column.first] = column.second;
+  }
+
+  if (!state.empty()) {
+    config.state = std::move(state);
+    WriteLock lock(kSvcConfigCacheMutex);
+    if (kSvcConfigCache.size() >= kSvcConfigCacheMax) {
+      kSvcConfigCache.clear();
+    }
+    kSvcConfigCache[name] = std::move(config);
+  }
   return TRUE;
 }
 
@@ -121,6 +217,16 @@ QueryData genServices(QueryContext& context) {
     return {};
   }
 
+  // The enumeration includes the status columns, the configuration columns
+  // are requested from the SCM per service, only when selected.
+  auto config = context.isAnyColumnUsed(
+      {"start_type", "path", "user_account", "description", "module_path"});
+
+  std::set<std::string> names;
+  if (context.constraints["name"].exists(EQUALS)) {
+    names = context.constraints["name"].getAll(EQUALS);
+  }
+
   (void)EnumServicesStatusEx(schScManager,
                              SC_ENUM_PROCESS_INFO,
                              SERVICE_WIN32,
@@ -145,10 +251,36 @@ QueryData genServices(QueryContext& context) {
                            nullptr)) {
     ENUM_SERVICE_STATUS_PROCESS* services = (ENUM_SERVICE_STATUS_PROCESS*)buf;
     for (DWORD i = 0; i < serviceCount; ++i) {
+      const auto& svc = services[i];
+      std::string name = svc.lpServiceName;
+      if (!names.empty() && names.count(name) == 0) {
+        continue;
+      }
+
       Row r;
-      if (QuerySvcInfo(schScManager, services[i], r)) {
-        results.push_back(r);
+      r["name"] = SQL_TEXT(name);
+      r["display_name"] = SQL_TEXT(svc.lpDisplayName);
+      auto state = svc.ServiceStatusProcess.dwCurrentState;
+      r["status"] = SQL_TEXT(
+          kSvcStatus[(state < sizeof(kSvcStatus) / sizeof(kSvcStatus[0]))
+                         ? state
+                         : 0]);
+      r["pid"] = INTEGER(svc.ServiceStatusProcess.dwProcessId);
+      r["win32_exit_code"] = INTEGER(svc.ServiceStatusProcess.dwWin32ExitCode);
+      r["service_exit_code"] =
+          INTEGER(svc.ServiceStatusProcess.dwServiceSpecificExitCode);
+
+      auto type = svc.ServiceStatusProcess.dwServiceType;
+      if (kServiceType.count(type) > 0) {
+        r["service_type"] = SQL_TEXT(kServiceType.at(type));
+      } else {
+        r["service_type"] = SQL_TEXT("UNKNOWN");
+      }
+
+      if (config && !genSvcConfig(schScManager, name, r)) {
+        continue;
       }
+      results.push_back(r);
     }
   } else {
     TLOG << "EnumServiceStatusEx failed (" << GetLastError() << ")";
@@ -33,6 +33,30 @@ TEST_F(RegistryTablesTest, test_registry_non_existing_key) {
   EXPECT_TRUE(results.size() == 0);
 }
 
+TEST_F(RegistryTablesTest, test_registry_key_pattern) {
+  QueryData results;
+  queryKeyPattern("HKEY_LOCAL_MACHINE\\SOFTWARE", results);
+  QueryData expected;
+  queryKey("HKEY_LOCAL_MACHINE\\SOFTWARE", expected);
+  EXPECT_EQ(expected.size(), results.size());
+
+  // Only the keys below the prefix are walked.
+  results.clear();
+  queryKeyPattern("HKEY_LOCAL_MACHINE\\SOFTWARE\\%", results);
+  EXPECT_TRUE(results.size() > 0);
+  for (const auto& row : results) {
+    EXPECT_EQ(0U, row.at("key").find("HKEY_LOCAL_MACHINE\\SOFTWARE\\"));
+  }
+
+  // A recursive pattern includes the keys below each subkey.
+  QueryData recursive;
+  queryKeyPattern("HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\%%",
+                  recursive);
+  QueryData children;
+  queryKeyPattern("HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\%", children);
+  EXPECT_GT(recursive.size(), children.size());
+}
+
 TEST_F(RegistryTablesTest, test_explode_registry_path_normal) {
   auto path = "HKEY_LOCAL_MACHINE\\PATH\\to\\madeup\\key";
   std::string rKey;
@@ -33,21 +33,34 @@ const std::map<fs::file_type, std::string> kTypeNames{
     {fs::status_error, "error"},
 };
 
+#if !defined(WIN32)
+/// Name the type of a followed file, as fs::status would.
+static std::string getFileType(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return "regular";
+  } else if (S_ISDIR(mode)) {
+    return "directory";
+  } else if (S_ISBLK(mode)) {
+    return "block";
+  } else if (S_ISCHR(mode)) {
+    return "character";
+  } else if (S_ISFIFO(mode)) {
+    return "fifo";
+  } else if (S_ISSOCK(mode)) {
+    return "socket";
+  }
+  return "unknown";
+}
+#endif
+
 void genFileInfo(const fs::path& path,
                  const fs::path& parent,
                  const std::string& pattern,
-                 QueryData& results) {
+                 const QueryContext& context,
+                 RowYield& yield) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-#if !defined(WIN32)
-  // On POSIX systems, first check the link state.
-  struct stat link_stat;
-  if (lstat(path.string().c_str(), &link_stat) < 0) {
-    // Path was not real, had too may links, or could not be accessed.
-    return;
-  }
-#endif
-
+  // A single stat provides every column, including the type.
   struct stat file_stat;
   if (stat(path.string().c_str(), &file_stat)) {
     // Path was not real, had too may links, or could not be accessed.
@@ -83,20 +96,25 @@ void genFileInfo(const fs::path& path,
 #endif
 
   // Type booleans
-  boost::system::error_code ec;
-  auto status = fs::status(path, ec);
-  if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
-  } else {
-    r["type"] = "unknown";
+#if !defined(WIN32)
+  r["type"] = getFileType(file_stat.st_mode);
+#else
+  // The CRT stat does not name the type, only look it up when selected.
+  if (context.isColumnUsed("type")) {
+    boost::system::error_code ec;
+    auto status = fs::status(path, ec);
+    if (kTypeNames.count(status.type())) {
+      r["type"] = kTypeNames.at(status.type());
+    } else {
+      r["type"] = "unknown";
+    }
   }
+#endif
 
-  results.push_back(r);
+  yield(r);
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
-
+void genFile(RowYield& yield, QueryContext& context) {
   // Resolve file paths for EQUALS and LIKE operations.
   auto paths = context.constraints["path"].getAll(EQUALS);
   context.expandConstraints(
@@ -117,8 +135,11 @@ QueryData genFile(QueryContext& context) {
 
   // Iterate through each of the resolved/supplied paths.
   for (const auto& path_string : paths) {
+    if (context.isInterrupted()) {
+      return;
+    }
     fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
+    genFileInfo(path, path.parent_path(), "", context, yield);
   }
 
   // Resolve directories for EQUALS and LIKE operations.
@@ -141,6 +162,9 @@ QueryData genFile(QueryContext& context) {
 
   // Now loop through constraints using the directory column constraint.
   for (const auto& directory_string : directories) {
+    if (context.isInterrupted()) {
+      return;
+    }
     if (!isReadable(directory_string) || !isDirectory(directory_string)) {
       continue;
     }
@@ -148,15 +172,13 @@ QueryData genFile(QueryContext& context) {
     try {
       // Iterate over the directory and generate info for each regular file.
       fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
+      for (; begin != end && !context.isInterrupted(); ++begin) {
+        genFileInfo(begin->path(), directory_string, "", context, yield);
       }
     } catch (const fs::filesystem_error& /* e */) {
       continue;
     }
   }
-
-  return results;
 }
 }
 }
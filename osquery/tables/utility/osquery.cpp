@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
@@ -21,7 +22,10 @@
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
+#include "osquery/logger/queue.h"
 
 namespace osquery {
 
@@ -45,11 +49,15 @@ QueryData genOsqueryEvents(QueryContext& context) {
       r["subscriptions"] = INTEGER(pubref->numSubscriptions());
       r["events"] = INTEGER(pubref->numEvents());
       r["refreshes"] = INTEGER(pubref->restartCount());
+      r["dropped"] = INTEGER(pubref->numDropped());
+      r["placement"] = pubref->placement();
       r["active"] = (pubref->hasStarted() && !pubref->isEnding()) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
       r["refreshes"] = "0";
+      r["dropped"] = "0";
+      r["placement"] = "";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -60,8 +68,10 @@ QueryData genOsqueryEvents(QueryContext& context) {
     Row r;
     r["name"] = subscriber;
     r["type"] = "subscriber";
-    // Subscribers will never 'restart'.
+    // Subscribers will never 'restart' or drop events.
     r["refreshes"] = "0";
+    r["dropped"] = "0";
+    r["placement"] = "";
 
     auto subref = EventFactory::getEventSubscriber(subscriber);
     if (subref != nullptr) {
@@ -175,6 +185,90 @@ QueryData genOsqueryRegistry(QueryContext& context) {
   return results;
 }
 
+QueryData genOsqueryDatabase(QueryContext& context) {
+  QueryData results;
+
+  // The empty domain reports statistics for the entire backing store.
+  std::vector<std::string> domains = {""};
+  domains.insert(domains.end(), kDomains.begin(), kDomains.end());
+  for (const auto& domain : domains) {
+    std::map<std::string, std::string> props;
+    getDatabaseProperties(domain, props);
+    for (const auto& prop : props) {
+      Row r;
+      r["domain"] = domain;
+      r["property"] = prop.first;
+      r["value"] = prop.second;
+      results.push_back(r);
+    }
+  }
+
+  return results;
+}
+
+QueryData genOsqueryLoggerQueues(QueryContext& context) {
+  QueryData results;
+  getLoggerQueueStats(([&results](const std::string& plugin,
+                                  const LoggerQueueStats& stats) {
+    Row r;
+    r["plugin"] = plugin;
+    r["queued"] = BIGINT(stats.queued);
+    r["sent"] = BIGINT(stats.sent);
+    r["dropped"] = BIGINT(stats.dropped);
+    results.push_back(r);
+  }));
+  return results;
+}
+
+QueryData genOsqueryScheduleProfile(QueryContext& context) {
+  QueryData results;
+  getScheduleProfile(([&results](const std::string& query,
+                                 const std::string& span,
+                                 const SpanStats& stats) {
+    Row r;
+    r["name"] = query;
+    r["span"] = span;
+    r["calls"] = BIGINT(stats.calls);
+    r["total_time"] = BIGINT(stats.total_time);
+    r["max_time"] = BIGINT(stats.max_time);
+    r["rows"] = BIGINT(stats.rows);
+    results.push_back(r);
+  }));
+  return results;
+}
+
+QueryData genOsqueryMetrics(QueryContext& context) {
+  QueryData results;
+  for (const auto& metric : getMetrics()) {
+    Row r;
+    r["name"] = metric.name;
+    std::string labels;
+    for (const auto& label : metric.labels) {
+      labels += (labels.empty()) ? "" : ",";
+      labels += label.first + "=\"" + label.second + "\"";
+    }
+    r["labels"] = labels;
+    r["value"] = BIGINT(metric.value);
+    if (metric.type == MetricType::HISTOGRAM) {
+      r["type"] = "histogram";
+      r["count"] = BIGINT(metric.count);
+      r["max"] = BIGINT(metric.max);
+      r["p50"] = BIGINT(metric.p50);
+      r["p90"] = BIGINT(metric.p90);
+      r["p99"] = BIGINT(metric.p99);
+    } else {
+      r["type"] = (metric.type == MetricType::COUNTER) ? "counter" : "gauge";
+      r["count"] = "0";
+      r["max"] = "0";
+      r["p50"] = "0";
+      r["p90"] = "0";
+      r["p99"] = "0";
+    }
+    results.push_back(r);
+  }
+  return results;
+}
+
 QueryData genOsqueryExtensions(QueryContext& context) {
   QueryData results;
 
@@ -228,6 +322,7 @@ QueryData genOsqueryInfo(QueryContext& context) {
   } else {
     r["watcher"] = "-1";
   }
+  r["startup_duration"] = INTEGER(Initializer::getStartupDuration());
 
   std::string uuid;
   r["uuid"] = (getHostUUID(uuid)) ? uuid : "";
@@ -256,6 +351,15 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["shared_hits"] = "0";
+        r["shared_misses"] = "0";
+        r["deduplicated"] = "0";
+        r["aborted"] = "0";
+        r["context_switches"] = "0";
+        r["major_faults"] = "0";
+        r["cycles"] = "0";
+        r["instructions"] = "0";
+        r["cache_misses"] = "0";
 
         // Report optional performance information.
         Config::getInstance().getPerformanceStats(
@@ -267,6 +371,15 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["user_time"] = BIGINT(perf.user_time);
               r["system_time"] = BIGINT(perf.system_time);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["shared_hits"] = BIGINT(perf.shared_hits);
+              r["shared_misses"] = BIGINT(perf.shared_misses);
+              r["deduplicated"] = BIGINT(perf.deduplicated);
+              r["aborted"] = BIGINT(perf.aborted);
+              r["context_switches"] = BIGINT(perf.context_switches);
+              r["major_faults"] = BIGINT(perf.major_faults);
+              r["cycles"] = BIGINT(perf.cycles);
+              r["instructions"] = BIGINT(perf.instructions);
+              r["cache_misses"] = BIGINT(perf.cache_misses);
             });
 
         results.push_back(r);
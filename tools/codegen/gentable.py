@@ -33,6 +33,9 @@ TEMPLATES = {}
 # Temporary reserved column names
 RESERVED = ["n", "index"]
 
+# Column names that cannot be used as C++ enumerators, these have a '_' suffix
+CPP_RESERVED = ["class", "protected", "signed", "interface"]
+
 # Set the platform in osquery-language
 PLATFORM = platform()
 
@@ -72,6 +75,9 @@ COLUMN_OPTIONS = {
     "additional": "ADDITIONAL",
     "required": "REQUIRED",
     "optimized": "OPTIMIZED",
+    "sorted": "SORTED",
+    "unique": "UNIQUE",
+    "hidden": "HIDDEN",
 }
 
 # Column options that render tables uncacheable.
@@ -81,12 +87,22 @@ NON_CACHEABLE = [
     "OPTIMIZED",
 ]
 
+# Table attributes that cache results.
+CACHEABLE_ATTRIBUTES = [
+    "cacheable",
+    "cacheable_process",
+    "cacheable_boot",
+]
+
 TABLE_ATTRIBUTES = {
     "event_subscriber": "EVENT_BASED",
     "user_data": "USER_BASED",
     "cacheable": "CACHEABLE",
+    "cacheable_process": "CACHEABLE_PROCESS",
+    "cacheable_boot": "CACHEABLE_BOOT",
     "utility": "UTILITY",
     "kernel_required": "KERNEL_REQUIRED",
+    "concurrent": "CONCURRENT",
 }
 
 
@@ -184,6 +200,7 @@ class TableState(Singleton):
         self.has_options = False
         self.has_column_aliases = False
         self.generator = False
+        self.typed = False
 
     def columns(self):
         return [i for i in self.schema if isinstance(i, Column)]
@@ -209,14 +226,39 @@ class TableState(Singleton):
                 self.has_column_aliases = True
         if len(all_options) > 0:
             self.has_options = True
-        if "cacheable" in self.attributes:
+        for cacheable in CACHEABLE_ATTRIBUTES:
+            if cacheable not in self.attributes:
+                continue
             if len(set(all_options).intersection(NON_CACHEABLE)) > 0:
-                print(lightred("Table cannot be marked cacheable: %s" % (path)))
+                print(lightred("Table cannot be marked %s: %s" % (
+                    cacheable, path)))
                 exit(1)
             if self.generator:
                 print(lightred(
-                    "Table cannot use a generator and be marked cacheable: %s" % (path)))
+                    "Table cannot use a generator and be marked %s: %s" % (
+                        cacheable, path)))
+                exit(1)
+            if self.typed:
+                print(lightred(
+                    "Table cannot use typed rows and be marked %s: %s" % (
+                        cacheable, path)))
                 exit(1)
+        if "cacheable_process" in self.attributes and \
+                "cacheable_boot" in self.attributes:
+            print(lightred(
+                "Table cannot be marked cacheable_process and cacheable_boot: %s"
+                % (path)))
+            exit(1)
+
+        # Lifetime cached results may be invalidated by a list of files.
+        cache_paths = []
+        for cacheable in ["cacheable_process", "cacheable_boot"]:
+            if isinstance(self.attributes.get(cacheable), list):
+                cache_paths = self.attributes[cacheable]
+        if self.generator and self.typed:
+            print(lightred(
+                "Table cannot use a generator and typed rows: %s" % (path)))
+            exit(1)
         if self.table_name == "" or self.function == "":
             print(lightred("Invalid table spec: %s" % (path)))
             exit(1)
@@ -255,12 +297,29 @@ class TableState(Singleton):
             has_options=self.has_options,
             has_column_aliases=self.has_column_aliases,
             generator=self.generator,
+            typed=self.typed,
             attribute_set=[TABLE_ATTRIBUTES[attr] for attr in self.attributes],
+            cache_paths=cache_paths,
         )
 
         with open(path, "w+") as file_h:
             file_h.write(self.impl_content)
 
+    def generate_columns(self, path):
+        """Generate the compile-time column descriptors header"""
+        logging.debug("TableState.generate_columns")
+        for column in self.columns():
+            column.enumerator = column.name
+            if column.name in CPP_RESERVED:
+                column.enumerator += "_"
+        content = jinja2.Template(TEMPLATES["columns"]).render(
+            table_name=self.table_name,
+            table_name_cc=to_camel_case(self.table_name),
+            schema=self.columns(),
+        )
+        with open(path, "w+") as file_h:
+            file_h.write(content)
+
     def blacklist(self, path):
         print(lightred("Blacklisting generated %s" % path))
         logging.debug("blacklisting %s" % path)
@@ -345,7 +404,7 @@ def fuzz_paths(paths):
     table.fuzz_paths = paths
 
 
-def implementation(impl_string, generator=False):
+def implementation(impl_string, generator=False, typed=False):
     """
     define the path to the implementation file and the function which
     implements the virtual table. You should use the following format:
@@ -353,6 +412,9 @@ def implementation(impl_string, generator=False):
       # the path is "osquery/table/implementations/foo.cpp"
       # the function is "QueryData genFoo();"
       implementation("foo@genFoo")
+
+    use generator=True for "void genFoo(RowYield&, QueryContext&);" and
+    typed=True for "TypedQueryData genFoo(QueryContext&);"
     """
     logging.debug("- implementation")
     filename, function = impl_string.split("@")
@@ -367,6 +429,7 @@ def implementation(impl_string, generator=False):
     table.function = function
     table.class_name = class_name
     table.generator = generator
+    table.typed = typed
 
     '''Check if the table has a subscriber attribute, if so, enforce time.'''
     if "event_subscriber" in table.attributes:
@@ -387,6 +450,11 @@ def implementation(impl_string, generator=False):
                 "Event subscriber: %s, 'time' column must be a %s type" % (
                     table.table_name, BIGINT)))
             sys.exit(1)
+        # Rows stored while overloaded report the events they represent.
+        if "sampling" not in columns:
+            table.schema.append(Column("sampling", INTEGER,
+                "Number of events the row represents while sampling",
+                hidden=True))
 
 
 def main(argc, argv):
@@ -402,8 +470,11 @@ def main(argc, argv):
         help="Generate a foreign table")
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
                         help="Path to codegen output .cpp.in templates")
+    parser.add_argument("--columns", metavar="DIR", default=None,
+        help="Generate a columns header in DIR for each input spec file")
     parser.add_argument("spec_file", help="Path to input .table spec file")
-    parser.add_argument("output", help="Path to output .cpp file")
+    parser.add_argument("output", nargs="*",
+        help="Path to output .cpp file, or more spec files with --columns")
     args = parser.parse_args()
 
     if args.debug:
@@ -411,8 +482,23 @@ def main(argc, argv):
     else:
         logging.basicConfig(format=LOG_FORMAT, level=logging.INFO)
 
+    if args.columns is not None:
+        setup_templates(args.templates)
+        if not os.path.exists(args.columns):
+            os.makedirs(args.columns)
+        for filename in [args.spec_file] + args.output:
+            table.__init__()
+            with open(filename, "rU") as file_handle:
+                tree = ast.parse(file_handle.read())
+                exec(compile(tree, "<string>", "exec"))
+            output = os.path.join(args.columns, "%s.h" % (table.table_name))
+            table.generate_columns(output)
+        return
+
+    if len(args.output) != 1:
+        parser.error("a single output .cpp file is required")
     filename = args.spec_file
-    output = args.output
+    output = args.output[0]
     if filename.endswith(".table"):
         # Adding a 3rd parameter will enable the blacklist
 
@@ -14,6 +14,7 @@ from __future__ import unicode_literals
 
 import argparse
 import base64
+import hashlib
 import json
 import os
 import random
@@ -125,11 +126,16 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
 
     def do_POST(self):
         debug("RealSimpleHandler::post %s" % self.path)
-        self._set_headers()
         content_len = int(self.headers.getheader('content-length', 0))
         request = json.loads(self.rfile.read(content_len))
         debug("Request: %s" % str(request))
 
+        if self.path == '/config_etag':
+            # This endpoint sets its own response status and headers.
+            self.config_etag(request)
+            return
+
+        self._set_headers()
         if self.path == '/enroll':
             self.enroll(request)
         elif self.path == '/config':
@@ -196,6 +202,25 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
             return
         self._reply(EXAMPLE_CONFIG)
 
+    def config_etag(self, request):
+        '''A config endpoint supporting conditional requests'''
+
+        # The config is sent with an ETag. A request with an If-None-Match
+        # header matching the ETag receives a 304 without content.
+        self._push_request('config_etag', request)
+        etag = '"%s"' % hashlib.sha1(json.dumps(EXAMPLE_CONFIG)).hexdigest()
+        if self.headers.getheader('if-none-match', '') == etag:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            return
+
+        self.send_response(200)
+        self.send_header('Content-type', 'application/json')
+        self.send_header('ETag', etag)
+        self.end_headers()
+        self._reply(EXAMPLE_CONFIG)
+
     def distributed_read(self, request):
         '''A basic distributed read endpoint'''
         if "node_key" not in request or request["node_key"] not in NODE_KEYS: